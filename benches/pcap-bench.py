@@ -0,0 +1,209 @@
+#!/usr/bin/env python
+# Copyright(C) 2016 Open Information Security Foundation
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, version 2 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+# Run suricata in pcap file mode over a set of pcaps with a fixed ruleset
+# and report the throughput, cycles per packet and peak memory use of
+# each as JSON.
+#
+# The processing time is the 'time elapsed' suricata logs, which leaves
+# out the rule loading. The cycles are counted with perf, when it is
+# installed, minus the cycles of a run over the first packet of the pcap
+# only, to leave out the start up and shut down cost.
+
+import argparse
+import glob
+import json
+import os
+import re
+import resource
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+PCAP_MAGIC = (0xa1b2c3d4, 0xa1b23c4d)
+
+
+def pcap_read(path):
+    """Count the packets and bytes on the wire of a classic pcap file.
+    Returns (packets, bytes, header + first record)."""
+    with open(path, "rb") as f:
+        hdr = f.read(24)
+        if len(hdr) < 24:
+            raise ValueError("%s: not a pcap file" % path)
+        for endian in ("<", ">"):
+            if struct.unpack(endian + "I", hdr[:4])[0] in PCAP_MAGIC:
+                break
+        else:
+            raise ValueError("%s: not a pcap file (pcapng is not supported)" % path)
+
+        packets = 0
+        wire = 0
+        first = None
+        while True:
+            rec = f.read(16)
+            if len(rec) < 16:
+                break
+            caplen, origlen = struct.unpack(endian + "II", rec[8:])
+            data = f.read(caplen)
+            if first is None:
+                first = hdr + rec + data
+            packets += 1
+            wire += origlen
+        return packets, wire, first
+
+
+def run(cmd, logdir):
+    """Run 'cmd' in a child of our own, so that the peak rss of the
+    children is that of this command alone.
+    Returns (exit code, output, peak rss in kB)."""
+    out = os.path.join(logdir, "bench-output.txt")
+    rfd, wfd = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        os.close(rfd)
+        with open(out, "w") as f:
+            rc = subprocess.call(cmd, stdout=f, stderr=subprocess.STDOUT)
+        rss = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss
+        os.write(wfd, str(rss).encode())
+        os._exit(rc & 0xff)
+    os.close(wfd)
+    rss = os.read(rfd, 64)
+    os.close(rfd)
+    rc = os.waitpid(pid, 0)[1] >> 8
+    with open(out) as f:
+        output = f.read()
+    return rc, output, int(rss or 0)
+
+
+def run_suricata(args, pcap, logdir):
+    cmd = [args.suricata, "-c", args.config, "-S", args.rules, "-r", pcap,
+           "-l", logdir, "-k", "none", "-v"]
+    if args.runmode:
+        cmd += ["--runmode", args.runmode]
+
+    perf_out = None
+    if args.perf:
+        perf_out = os.path.join(logdir, "bench-perf.txt")
+        cmd = [args.perf, "stat", "-x", ",", "-e", "cycles", "-o", perf_out,
+               "--"] + cmd
+
+    rc, output, rss = run(cmd, logdir)
+    if rc != 0:
+        sys.stderr.write(output)
+        raise RuntimeError("suricata failed on %s" % pcap)
+
+    m = re.search(r"time elapsed ([0-9.]+)s", output)
+    seconds = float(m.group(1)) if m else None
+
+    cycles = None
+    if perf_out is not None:
+        with open(perf_out) as f:
+            for line in f:
+                fields = line.strip().split(",")
+                if len(fields) > 2 and fields[2].startswith("cycles") and \
+                   fields[0].isdigit():
+                    cycles = int(fields[0])
+    return seconds, cycles, rss
+
+
+def bench_pcap(args, pcap, logdir):
+    packets, wire, first = pcap_read(pcap)
+
+    best = None
+    for i in range(args.runs):
+        seconds, cycles, rss = run_suricata(args, pcap, logdir)
+        if best is None or (seconds or 0) < (best[0] or 0):
+            best = (seconds, cycles, rss)
+    seconds, cycles, rss = best
+
+    cpp = None
+    if cycles is not None and packets > 1:
+        one = os.path.join(logdir, "bench-first-packet.pcap")
+        with open(one, "wb") as f:
+            f.write(first)
+        base = run_suricata(args, one, logdir)[1]
+        if base is not None:
+            cpp = round(float(max(cycles - base, 0)) / (packets - 1), 2)
+
+    result = {
+        "pcap": os.path.basename(pcap),
+        "packets": packets,
+        "bytes": wire,
+        "seconds": seconds,
+        "mpps": None,
+        "gbps": None,
+        "cycles_per_packet": cpp,
+        "peak_rss_kb": rss,
+    }
+    if seconds:
+        result["mpps"] = round(packets / seconds / 1e6, 4)
+        result["gbps"] = round(wire * 8 / seconds / 1e9, 4)
+    return result
+
+
+def find_perf():
+    for path in os.environ.get("PATH", "").split(os.pathsep):
+        perf = os.path.join(path, "perf")
+        if os.access(perf, os.X_OK):
+            return perf
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="pcap benchmarks")
+    parser.add_argument("--suricata", default="src/suricata",
+                        help="suricata binary (default: src/suricata)")
+    parser.add_argument("-c", "--config", default="suricata.yaml",
+                        help="configuration (default: suricata.yaml)")
+    parser.add_argument("-S", "--rules", required=True,
+                        help="rule file, the same for every run")
+    parser.add_argument("--runmode", help="runmode, default from the config")
+    parser.add_argument("--runs", type=int, default=1,
+                        help="runs per pcap, the fastest is reported")
+    parser.add_argument("--no-perf", action="store_true",
+                        help="don't count the cycles")
+    parser.add_argument("-o", "--output", help="write the results here")
+    parser.add_argument("pcaps", nargs="+",
+                        help="pcap files or directories of pcaps")
+    args = parser.parse_args()
+
+    args.perf = None if args.no_perf else find_perf()
+
+    pcaps = []
+    for p in args.pcaps:
+        if os.path.isdir(p):
+            pcaps += sorted(glob.glob(os.path.join(p, "*.pcap")))
+        else:
+            pcaps.append(p)
+
+    logdir = tempfile.mkdtemp(prefix="suricata-bench-")
+    try:
+        results = [bench_pcap(args, p, logdir) for p in pcaps]
+    finally:
+        shutil.rmtree(logdir)
+
+    report = {"rules": args.rules, "runmode": args.runmode, "pcaps": results}
+    text = json.dumps(report, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    print(text)
+
+
+if __name__ == "__main__":
+    main()
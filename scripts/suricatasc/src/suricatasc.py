@@ -80,7 +80,7 @@ class SuricataCompleter:
 
 class SuricataSC:
     def __init__(self, sck_path, verbose=False):
-        self.cmd_list=['shutdown','quit','pcap-file','pcap-file-number','pcap-file-list','iface-list','iface-stat','register-tenant','unregister-tenant','register-tenant-handler','unregister-tenant-handler']
+        self.cmd_list=['shutdown','quit','pcap-file','pcap-file-number','pcap-file-list','iface-list','iface-stat','iface-set-workers','register-tenant','unregister-tenant','register-tenant-handler','unregister-tenant-handler']
         self.sck_path = sck_path
         self.verbose = verbose
 
@@ -192,6 +192,17 @@ class SuricataSC:
                     arguments["output-dir"] = output
                     if tenant != None:
                         arguments["tenant"] = int(tenant)
+            elif "iface-set-workers" in command:
+                try:
+                    [cmd, iface, workers] = command.split(' ', 2)
+                except:
+                    raise SuricataCommandException("Unable to split command '%s'" % (command))
+                if cmd != "iface-set-workers":
+                    raise SuricataCommandException("Invalid command '%s'" % (command))
+                else:
+                    arguments = {}
+                    arguments["iface"] = iface
+                    arguments["workers"] = int(workers)
             elif "iface-stat" in command:
                 try:
                     [cmd, iface] = command.split(' ', 1)
@@ -212,6 +223,27 @@ class SuricataSC:
                 else:
                     arguments = {}
                     arguments["variable"] = variable
+            elif "job-status" in command:
+                try:
+                    [cmd, jobid] = command.split(' ', 1)
+                except:
+                    raise SuricataCommandException("Unable to split command '%s'" % (command))
+                if cmd != "job-status":
+                    raise SuricataCommandException("Invalid command '%s'" % (command))
+                else:
+                    arguments = {}
+                    arguments["job-id"] = int(jobid)
+            elif "rule-profiling" in command:
+                parts = command.split(' ')
+                if parts[0] != "rule-profiling" or len(parts) < 2:
+                    raise SuricataCommandException("Invalid command '%s'" % (command))
+                arguments = {}
+                arguments["action"] = parts[1]
+                if len(parts) > 2:
+                    if parts[1] == "start":
+                        arguments["rate"] = int(parts[2])
+                    elif parts[1] == "dump":
+                        arguments["count"] = int(parts[2])
             elif "unregister-tenant-handler" in command:
                 try:
                     parts = command.split(' ')
@@ -205,7 +205,7 @@ static TmEcode AlertSyslogIPv4(ThreadVars *tv, const Packet *p, void *data)
     if (p->alerts.cnt == 0)
         return TM_ECODE_OK;
 
-    SCMutexLock(&ast->file_ctx->fp_mutex);
+    SCMutexLockCounted(&ast->file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
 
     ast->file_ctx->alerts += p->alerts.cnt;
 
@@ -263,7 +263,7 @@ static TmEcode AlertSyslogIPv6(ThreadVars *tv, const Packet *p, void *data)
     if (p->alerts.cnt == 0)
         return TM_ECODE_OK;
 
-    SCMutexLock(&ast->file_ctx->fp_mutex);
+    SCMutexLockCounted(&ast->file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
 
     ast->file_ctx->alerts += p->alerts.cnt;
 
@@ -326,7 +326,7 @@ static TmEcode AlertSyslogDecoderEvent(ThreadVars *tv, const Packet *p, void *da
     if (p->alerts.cnt == 0)
         return TM_ECODE_OK;
 
-    SCMutexLock(&ast->file_ctx->fp_mutex);
+    SCMutexLockCounted(&ast->file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
 
     ast->file_ctx->alerts += p->alerts.cnt;
     char temp_buf_hdr[512];
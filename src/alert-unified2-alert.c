@@ -66,6 +66,16 @@
 
 #include "util-optimize.h"
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+typedef struct iovec Unified2IOVec;
+#else
+typedef struct Unified2IOVec_ {
+    void *iov_base;
+    size_t iov_len;
+} Unified2IOVec;
+#endif
+
 #ifndef IPPROTO_SCTP
 #define IPPROTO_SCTP 132
 #endif
@@ -193,9 +203,22 @@ typedef struct Unified2AlertFileCtx_ {
  *
  * Used for storing file options.
  */
+/** records written for an alert in one go: event, extra data and
+ *  packets each take one iovec for the headers, packets another for the
+ *  payload */
+#define UNIFIED2_IOV_MAX            16
+
+/** largest record built in the buffer */
+#define UNIFIED2_RECORD_MAX         (sizeof(Unified2AlertFileHeader) + sizeof(Unified2Packet) + \
+                                     IPV4_MAXPACKET_LEN + sizeof(Unified2ExtraDataHdr) + \
+                                     sizeof(Unified2ExtraData))
+/** room for the records of an alert before they are flushed */
+#define UNIFIED2_BUFFER_SIZE        (2 * UNIFIED2_RECORD_MAX)
+
 typedef struct Unified2AlertThread_ {
     Unified2AlertFileCtx *unified2alert_ctx; /**< LogFileCtx pointer */
-    uint8_t *data; /**< Per function and thread data */
+    uint8_t *buf; /**< Records queued for the current alert */
+    uint8_t *data; /**< Record being built, points into buf */
     /** Pointer to the Unified2AlertFileHeader contained in
      * the pointer data. */
     Unified2AlertFileHeader *hdr;
@@ -211,6 +234,9 @@ typedef struct Unified2AlertThread_ {
     uint8_t xff_flags; /**< XFF flags for the current alert */
     uint32_t xff_ip[4]; /**< The XFF reported IP address for the current alert */
     uint32_t event_id;
+    /** queued records and payloads, written by Unified2Flush */
+    Unified2IOVec iov[UNIFIED2_IOV_MAX];
+    int iov_cnt;
 } Unified2AlertThread;
 
 #define UNIFIED2_PACKET_SIZE        (sizeof(Unified2Packet) - 4)
@@ -291,24 +317,99 @@ int Unified2AlertRotateFile(ThreadVars *t, Unified2AlertThread *aun)
 }
 
 /**
- * \brief Wrapper for fwrite
- *
- * This function is basically a wrapper for fwrite which take
- * in charge a size counter.
+ * \brief Drop the queued records and start over at the buffer start
+ */
+static void Unified2Reset(Unified2AlertThread *aun)
+{
+    aun->data = aun->buf;
+    aun->datalen = UNIFIED2_RECORD_MAX;
+    aun->iov_cnt = 0;
+    aun->length = 0;
+    aun->offset = 0;
+}
+
+/**
+ * \brief Write out the queued records, with a single writev if nothing
+ *        gets in the way. Caller holds fp_mutex.
  *
  * \return 1 in case of success
  */
-static int Unified2Write(Unified2AlertThread *aun)
+static int Unified2Flush(Unified2AlertThread *aun)
 {
-    int ret;
+    FILE *fp = aun->unified2alert_ctx->file_ctx->fp;
+    int ret = 1;
+    int i = 0;
+
+#ifdef HAVE_SYS_UIO_H
+    int fd = fileno(fp);
+    while (i < aun->iov_cnt) {
+        ssize_t r = writev(fd, &aun->iov[i], aun->iov_cnt - i);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR)
+                continue;
+            SCLogError(SC_ERR_FWRITE, "Error: writev failed: %s", strerror(errno));
+            ret = -1;
+            break;
+        }
+        /* partial write: skip what went out and retry the rest */
+        while (i < aun->iov_cnt && (size_t)r >= aun->iov[i].iov_len) {
+            r -= aun->iov[i].iov_len;
+            i++;
+        }
+        if (r > 0) {
+            aun->iov[i].iov_base = (uint8_t *)aun->iov[i].iov_base + r;
+            aun->iov[i].iov_len -= r;
+        }
+    }
+#else
+    for ( ; i < aun->iov_cnt; i++) {
+        if (fwrite(aun->iov[i].iov_base, aun->iov[i].iov_len, 1, fp) != 1) {
+            SCLogError(SC_ERR_FWRITE, "Error: fwrite failed: %s", strerror(errno));
+            ret = -1;
+            break;
+        }
+    }
+    fflush(fp);
+#endif
 
-    ret = fwrite(aun->data, aun->length, 1, aun->unified2alert_ctx->file_ctx->fp);
-    if (ret != 1) {
-        SCLogError(SC_ERR_FWRITE, "Error: fwrite failed: %s", strerror(errno));
-        return -1;
+    Unified2Reset(aun);
+    return ret;
+}
+
+/**
+ * \brief Queue the record at aun->data, followed by 'payload'
+ *
+ * The record stays in the buffer and the payload is referenced where it
+ * is, so the caller has to keep it in place until Unified2Flush. Records
+ * of an alert are laid out behind each other, the next one is built in
+ * the updated aun->data. Flushes early if the buffer or the iovecs run
+ * out. Takes in charge the size counter.
+ *
+ * \return 1 in case of success
+ */
+static int Unified2Write(Unified2AlertThread *aun, const uint8_t *payload,
+        uint32_t payload_len)
+{
+    aun->iov[aun->iov_cnt].iov_base = aun->data;
+    aun->iov[aun->iov_cnt].iov_len = aun->length;
+    aun->iov_cnt++;
+    if (payload_len > 0) {
+        aun->iov[aun->iov_cnt].iov_base = (void *)payload;
+        aun->iov[aun->iov_cnt].iov_len = payload_len;
+        aun->iov_cnt++;
     }
 
-    aun->unified2alert_ctx->file_ctx->size_current += aun->length;
+    aun->unified2alert_ctx->file_ctx->size_current += aun->length + payload_len;
+
+    aun->data += aun->length;
+    aun->length = 0;
+    aun->offset = 0;
+
+    if (aun->iov_cnt + 2 > UNIFIED2_IOV_MAX ||
+        aun->data + UNIFIED2_RECORD_MAX > aun->buf + UNIFIED2_BUFFER_SIZE)
+    {
+        return Unified2Flush(aun);
+    }
     return 1;
 }
 
@@ -657,8 +758,8 @@ static int Unified2PrintStreamSegmentCallback(const Packet *p, void *data, uint8
                 IPV4_GET_RAW_HLEN(&fakehdr->ip4h));
     }
 
-    /* write out */
-    ret = Unified2Write(aun);
+    /* queue, the payload was copied in for the checksum */
+    ret = Unified2Write(aun, NULL, 0);
     if (ret != 1) {
         goto error;
     }
@@ -743,7 +844,6 @@ static int Unified2PacketTypeAlert(Unified2AlertThread *aun, const Packet *p, ui
         /* we need to reset offset and length which could
          * have been modified by the segment logging */
         aun->offset = len;
-        len += GET_PKT_LEN(p);
         aun->length = len;
 
         /* Unified 2 packet header is the one of the packet. */
@@ -768,16 +868,11 @@ static int Unified2PacketTypeAlert(Unified2AlertThread *aun, const Packet *p, ui
         }
 #endif
 
-        if (len > aun->datalen) {
-            SCLogError(SC_ERR_INVALID_VALUE, "len is too big for thread data: %d vs %d",
-                    len, aun->datalen - aun->offset);
-            return -1;
-        }
         hdr->length = htonl(UNIFIED2_PACKET_SIZE + GET_PKT_LEN(p));
         phdr->packet_length = htonl(GET_PKT_LEN(p));
-        memcpy(aun->data + aun->offset, GET_PKT_DATA(p), GET_PKT_LEN(p));
 
-        ret = Unified2Write(aun);
+        /* the payload is written straight from the packet */
+        ret = Unified2Write(aun, GET_PKT_DATA(p), GET_PKT_LEN(p));
     }
 
     if (ret < 1) {
@@ -811,14 +906,9 @@ static int Unified2IPv6TypeAlert(ThreadVars *t, const Packet *p, void *data)
     if (likely(p->alerts.cnt == 0 && !(p->flags & PKT_HAS_TAG)))
         return 0;
 
-    phdr = (AlertIPv6Unified2 *)(aun->data +
-                                sizeof(Unified2AlertFileHeader));
-
     length = (sizeof(Unified2AlertFileHeader) + sizeof(AlertIPv6Unified2));
     offset = length;
 
-    memset(aun->data, 0, aun->datalen);
-
     hdr.type = htonl(UNIFIED2_IDS_EVENT_IPV6_TYPE);
     hdr.length = htonl(sizeof(AlertIPv6Unified2));
 
@@ -918,10 +1008,11 @@ static int Unified2IPv6TypeAlert(ThreadVars *t, const Packet *p, void *data)
             }
         }
 
-        /* reset length and offset */
+        /* reset length and offset, dropping what a failed alert left */
+        Unified2Reset(aun);
         aun->offset = offset;
         aun->length = length;
-        memset(aun->data + aun->offset, 0, aun->datalen - aun->offset);
+        phdr = (AlertIPv6Unified2 *)(aun->data + sizeof(Unified2AlertFileHeader));
 
         /* copy the part common to all alerts */
         memcpy(aun->data, &hdr, sizeof(hdr));
@@ -936,7 +1027,7 @@ static int Unified2IPv6TypeAlert(ThreadVars *t, const Packet *p, void *data)
         phdr->classification_id = htonl(pa->s->class);
         phdr->priority_id = htonl(pa->s->prio);
 
-        SCMutexLock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
+        SCMutexLockCounted(&aun->unified2alert_ctx->file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
         if ((aun->unified2alert_ctx->file_ctx->size_current + length) >
               aun->unified2alert_ctx->file_ctx->size_limit) {
             if (Unified2AlertRotateFile(t,aun) < 0) {
@@ -946,27 +1037,27 @@ static int Unified2IPv6TypeAlert(ThreadVars *t, const Packet *p, void *data)
             }
         }
 
-        if (Unified2Write(aun) != 1) {
+        if (Unified2Write(aun, NULL, 0) != 1) {
             aun->unified2alert_ctx->file_ctx->alerts += i;
             SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
             return -1;
         }
 
-        memset(aun->data, 0, aun->length);
-        aun->length = 0;
-        aun->offset = 0;
-
         /* stream flag based on state match, but only for TCP */
         int stream = (gphdr.protocol == IPPROTO_TCP) ?
             (pa->flags & (PACKET_ALERT_FLAG_STATE_MATCH|PACKET_ALERT_FLAG_STREAM_MATCH) ? 1 : 0) : 0;
-        ret = Unified2PacketTypeAlert(aun, p, phdr->event_id, stream);
+        ret = Unified2PacketTypeAlert(aun, p, event_id, stream);
         if (ret != 1) {
             SCLogError(SC_ERR_FWRITE, "Error: fwrite failed: %s", strerror(errno));
             aun->unified2alert_ctx->file_ctx->alerts += i;
             SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
             return -1;
         }
-        fflush(aun->unified2alert_ctx->file_ctx->fp);
+        if (Unified2Flush(aun) != 1) {
+            aun->unified2alert_ctx->file_ctx->alerts += i;
+            SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
+            return -1;
+        }
         aun->unified2alert_ctx->file_ctx->alerts++;
         SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
     }
@@ -998,14 +1089,9 @@ static int Unified2IPv4TypeAlert (ThreadVars *tv, const Packet *p, void *data)
     if (likely(p->alerts.cnt == 0 && !(p->flags & PKT_HAS_TAG)))
         return 0;
 
-    phdr = (AlertIPv4Unified2 *)(aun->data +
-                                sizeof(Unified2AlertFileHeader));
-
     length = (sizeof(Unified2AlertFileHeader) + sizeof(AlertIPv4Unified2));
     offset = length;
 
-    memset(aun->data, 0, aun->datalen);
-
     hdr.type = htonl(UNIFIED2_IDS_EVENT_TYPE);
     hdr.length = htonl(sizeof(AlertIPv4Unified2));
 
@@ -1095,10 +1181,11 @@ static int Unified2IPv4TypeAlert (ThreadVars *tv, const Packet *p, void *data)
             }
         }
 
-        /* reset length and offset */
+        /* reset length and offset, dropping what a failed alert left */
+        Unified2Reset(aun);
         aun->offset = offset;
         aun->length = length;
-        memset(aun->data + aun->offset, 0, aun->datalen - aun->offset);
+        phdr = (AlertIPv4Unified2 *)(aun->data + sizeof(Unified2AlertFileHeader));
 
         /* copy the part common to all alerts */
         memcpy(aun->data, &hdr, sizeof(hdr));
@@ -1114,7 +1201,7 @@ static int Unified2IPv4TypeAlert (ThreadVars *tv, const Packet *p, void *data)
         phdr->priority_id = htonl(pa->s->prio);
 
         /* check and enforce the filesize limit */
-        SCMutexLock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
+        SCMutexLockCounted(&aun->unified2alert_ctx->file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
 
         if ((aun->unified2alert_ctx->file_ctx->size_current + length) >
               aun->unified2alert_ctx->file_ctx->size_limit) {
@@ -1125,16 +1212,12 @@ static int Unified2IPv4TypeAlert (ThreadVars *tv, const Packet *p, void *data)
             }
         }
 
-        if (Unified2Write(aun) != 1) {
+        if (Unified2Write(aun, NULL, 0) != 1) {
             aun->unified2alert_ctx->file_ctx->alerts += i;
             SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
             return -1;
         }
 
-        memset(aun->data, 0, aun->length);
-        aun->length = 0;
-        aun->offset = 0;
-
         /* Write the alert (it doesn't lock inside, since we
          * already locked here for rotation check)
          */
@@ -1147,7 +1230,11 @@ static int Unified2IPv4TypeAlert (ThreadVars *tv, const Packet *p, void *data)
             return -1;
         }
 
-        fflush(aun->unified2alert_ctx->file_ctx->fp);
+        if (Unified2Flush(aun) != 1) {
+            aun->unified2alert_ctx->file_ctx->alerts += i;
+            SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
+            return -1;
+        }
         aun->unified2alert_ctx->file_ctx->alerts++;
         SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
     }
@@ -1180,14 +1267,12 @@ TmEcode Unified2AlertThreadInit(ThreadVars *t, void *initdata, void **data)
     /** Use the Ouptut Context (file pointer and mutex) */
     aun->unified2alert_ctx = ((OutputCtx *)initdata)->data;
 
-    aun->data = SCMalloc(sizeof(Unified2AlertFileHeader) + sizeof(Unified2Packet) +
-                    IPV4_MAXPACKET_LEN + sizeof(Unified2ExtraDataHdr) + sizeof (Unified2ExtraData));
-    if (aun->data == NULL) {
+    aun->buf = SCMalloc(UNIFIED2_BUFFER_SIZE);
+    if (aun->buf == NULL) {
         SCFree(aun);
         return TM_ECODE_FAILED;
     }
-    aun->datalen = sizeof(Unified2AlertFileHeader) + sizeof(Unified2Packet) +
-                    IPV4_MAXPACKET_LEN + sizeof(Unified2ExtraDataHdr) + sizeof(Unified2ExtraData);
+    Unified2Reset(aun);
 
     *data = (void *)aun;
 
@@ -1219,10 +1304,11 @@ TmEcode Unified2AlertThreadDeinit(ThreadVars *t, void *data)
 
     }
 
-    if (aun->data != NULL) {
-        SCFree(aun->data);
-        aun->data = NULL;
+    if (aun->buf != NULL) {
+        SCFree(aun->buf);
+        aun->buf = NULL;
     }
+    aun->data = NULL;
     aun->datalen = 0;
     /* clear memory */
     memset(aun, 0, sizeof(Unified2AlertThread));
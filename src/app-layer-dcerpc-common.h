@@ -172,6 +172,8 @@ typedef struct DCERPCRequest_ {
     uint8_t *stub_data_buffer;
     /* length of the above buffer */
     uint32_t stub_data_buffer_len;
+    /* allocated size of the above buffer */
+    uint32_t stub_data_buffer_size;
     /* used by the dce preproc to indicate fresh entry in the stub data buffer */
     uint8_t stub_data_fresh;
     uint8_t first_request_seen;
@@ -182,6 +184,8 @@ typedef struct DCERPCResponse_ {
     uint8_t *stub_data_buffer;
     /* length of the above buffer */
     uint32_t stub_data_buffer_len;
+    /* allocated size of the above buffer */
+    uint32_t stub_data_buffer_size;
     /* used by the dce preproc to indicate fresh entry in the stub data buffer */
     uint8_t stub_data_fresh;
 } DCERPCResponse;
@@ -241,6 +245,8 @@ typedef struct DCERPCUDP_ {
 #define NO_PSAP_AVAILABLE               7 /* not used */
 
 int32_t DCERPCParser(DCERPC *, uint8_t *, uint32_t);
+int DCERPCStubDataAppend(uint8_t **, uint32_t *, uint32_t *,
+        const uint8_t *, uint32_t);
 void hexdump(const void *buf, size_t len);
 void printUUID(char *type, DCERPCUuidEntry *uuid);
 
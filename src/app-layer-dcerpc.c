@@ -1170,25 +1170,70 @@ static uint32_t DCERPCParseREQUEST(DCERPC *dcerpc, uint8_t *input, uint32_t inpu
 
 /** \internal
  *  \retval stub_len or 0 in case of error */
+/** initial size of the stub data buffers */
+#define DCERPC_STUB_BUFFER_MIN  256
+
+/**
+ * \brief append a stub fragment to the stub buffer
+ *
+ * The buffer grows geometrically and is kept over PDUs, so a large
+ * fragmented PDU doesn't realloc (and copy) the whole stub per fragment.
+ *
+ * \retval 0 ok
+ * \retval -1 out of memory, buffer is freed
+ */
+int DCERPCStubDataAppend(uint8_t **buffer, uint32_t *len, uint32_t *size,
+        const uint8_t *data, uint32_t data_len)
+{
+    if (*len + data_len > *size || *buffer == NULL) {
+        uint32_t needed = *len + data_len;
+        uint32_t new_size = *size ? *size : DCERPC_STUB_BUFFER_MIN;
+        while (new_size < needed) {
+            if (new_size > UINT32_MAX / 2) {
+                new_size = needed;
+                break;
+            }
+            new_size *= 2;
+        }
+
+        void *ptmp = SCRealloc(*buffer, new_size);
+        if (ptmp == NULL) {
+            SCFree(*buffer);
+            *buffer = NULL;
+            *len = 0;
+            *size = 0;
+            return -1;
+        }
+        *buffer = ptmp;
+        *size = new_size;
+    }
+
+    memcpy(*buffer + *len, data, data_len);
+    *len += data_len;
+    return 0;
+}
+
 static uint32_t StubDataParser(DCERPC *dcerpc, uint8_t *input, uint32_t input_len)
 {
     SCEnter();
     uint8_t **stub_data_buffer = NULL;
     uint32_t *stub_data_buffer_len = NULL;
+    uint32_t *stub_data_buffer_size = NULL;
     uint8_t *stub_data_fresh = NULL;
     uint16_t stub_len = 0;
-    void *ptmp;
 
     /* request PDU.  Retrieve the request stub buffer */
     if (dcerpc->dcerpchdr.type == REQUEST) {
         stub_data_buffer = &dcerpc->dcerpcrequest.stub_data_buffer;
         stub_data_buffer_len = &dcerpc->dcerpcrequest.stub_data_buffer_len;
+        stub_data_buffer_size = &dcerpc->dcerpcrequest.stub_data_buffer_size;
         stub_data_fresh = &dcerpc->dcerpcrequest.stub_data_fresh;
 
     /* response PDU.  Retrieve the response stub buffer */
     } else {
         stub_data_buffer = &dcerpc->dcerpcresponse.stub_data_buffer;
         stub_data_buffer_len = &dcerpc->dcerpcresponse.stub_data_buffer_len;
+        stub_data_buffer_size = &dcerpc->dcerpcresponse.stub_data_buffer_size;
         stub_data_fresh = &dcerpc->dcerpcresponse.stub_data_fresh;
     }
 
@@ -1224,20 +1269,13 @@ static uint32_t StubDataParser(DCERPC *dcerpc, uint8_t *input, uint32_t input_le
         dcerpc->pdu_fragged = 1;
     }
 
-    ptmp = SCRealloc(*stub_data_buffer, *stub_data_buffer_len + stub_len);
-    if (ptmp == NULL) {
-        SCFree(*stub_data_buffer);
-        *stub_data_buffer = NULL;
+    if (DCERPCStubDataAppend(stub_data_buffer, stub_data_buffer_len,
+                stub_data_buffer_size, input, stub_len) < 0) {
         SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
         SCReturnUInt(0);
     }
-    *stub_data_buffer = ptmp;
-
-    memcpy(*stub_data_buffer + *stub_data_buffer_len, input, stub_len);
 
     *stub_data_fresh = 1;
-    /* length of the buffered stub */
-    *stub_data_buffer_len += stub_len;
     /* To see the total reassembled stubdata */
     //hexdump(*stub_data_buffer, *stub_data_buffer_len);
 
@@ -1978,11 +2016,13 @@ void DCERPCCleanup(DCERPC *dcerpc)
         SCFree(dcerpc->dcerpcrequest.stub_data_buffer);
         dcerpc->dcerpcrequest.stub_data_buffer = NULL;
         dcerpc->dcerpcrequest.stub_data_buffer_len = 0;
+        dcerpc->dcerpcrequest.stub_data_buffer_size = 0;
     }
     if (dcerpc->dcerpcresponse.stub_data_buffer != NULL) {
         SCFree(dcerpc->dcerpcresponse.stub_data_buffer);
         dcerpc->dcerpcresponse.stub_data_buffer = NULL;
         dcerpc->dcerpcresponse.stub_data_buffer_len = 0;
+        dcerpc->dcerpcresponse.stub_data_buffer_size = 0;
     }
 }
 
@@ -6377,6 +6417,36 @@ end:
     return result;
 }
 
+/** \test stub buffer grows geometrically and is reused */
+static int DCERPCParserTest20(void)
+{
+    uint8_t *buffer = NULL;
+    uint32_t len = 0;
+    uint32_t size = 0;
+    uint8_t data[300];
+    memset(data, 'A', sizeof(data));
+
+    FAIL_IF(DCERPCStubDataAppend(&buffer, &len, &size, data, 10) != 0);
+    FAIL_IF_NULL(buffer);
+    FAIL_IF(len != 10);
+    FAIL_IF(size != DCERPC_STUB_BUFFER_MIN);
+
+    FAIL_IF(DCERPCStubDataAppend(&buffer, &len, &size, data, sizeof(data)) != 0);
+    FAIL_IF(len != 310);
+    FAIL_IF(size != DCERPC_STUB_BUFFER_MIN * 2);
+
+    /* reset like at a new PDU, the buffer is kept */
+    uint8_t *old = buffer;
+    len = 0;
+    FAIL_IF(DCERPCStubDataAppend(&buffer, &len, &size, data, sizeof(data)) != 0);
+    FAIL_IF(buffer != old);
+    FAIL_IF(len != sizeof(data));
+    FAIL_IF(memcmp(buffer, data, sizeof(data)) != 0);
+
+    SCFree(buffer);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DCERPCParserRegisterTests(void)
@@ -6401,6 +6471,7 @@ void DCERPCParserRegisterTests(void)
     UtRegisterTest("DCERPCParserTest17", DCERPCParserTest17);
     UtRegisterTest("DCERPCParserTest18", DCERPCParserTest18);
     UtRegisterTest("DCERPCParserTest19", DCERPCParserTest19);
+    UtRegisterTest("DCERPCParserTest20", DCERPCParserTest20);
 #endif /* UNITTESTS */
 
     return;
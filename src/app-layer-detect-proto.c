@@ -166,6 +166,34 @@ struct AppLayerProtoDetectThreadCtx_ {
 /* The global app layer proto detection context. */
 static AppLayerProtoDetectCtx alpd_ctx;
 
+/** min number of agreeing full detections before the cache is used */
+#define ALPD_CACHE_MIN_CONFIDENCE   4
+#define ALPD_CACHE_LOCKS            64
+
+/**
+ * \brief Cached detection result for a server address and port.
+ */
+typedef struct AppLayerProtoDetectCacheEntry_ {
+    FlowAddress addr;
+    uint16_t port;
+    uint8_t ipproto;
+    uint8_t confidence;
+    AppProto alproto;
+} AppLayerProtoDetectCacheEntry;
+
+/**
+ * \brief Optional direct mapped cache of server ip:port -> AppProto, so
+ *        that repeated short flows to the same service skip the PM and
+ *        probing parsers. Disabled if size is 0.
+ */
+typedef struct AppLayerProtoDetectCache_ {
+    AppLayerProtoDetectCacheEntry *entries;
+    uint32_t size;
+    SCMutex locks[ALPD_CACHE_LOCKS];
+} AppLayerProtoDetectCache;
+
+static AppLayerProtoDetectCache alpd_cache;
+
 /***** Static Internal Calls: Protocol Retrieval *****/
 
 /** \internal
@@ -329,6 +357,7 @@ static AppProto AppLayerProtoDetectPPGetProto(Flow *f,
     AppProto alproto = ALPROTO_UNKNOWN;
     uint32_t *alproto_masks;
     uint32_t mask = 0;
+    uint32_t tried = 0; /* parsers already run on this buffer */
 
     if (direction & STREAM_TOSERVER) {
         /* first try the destination port */
@@ -395,6 +424,7 @@ static AppProto AppLayerProtoDetectPPGetProto(Flow *f,
             continue;
         }
 
+        tried |= pe->alproto_mask;
         alproto = pe->ProbingParser(buf, buflen, NULL);
         if (alproto != ALPROTO_UNKNOWN && alproto != ALPROTO_FAILED)
             goto end;
@@ -406,8 +436,12 @@ static AppProto AppLayerProtoDetectPPGetProto(Flow *f,
     }
     pe = pe2;
     while (pe != NULL) {
+        /* the dp and sp lists often share parsers, e.g. when both ports
+         * resolve to an 'any port' registration. Running a parser again
+         * on the same buffer can't give a different answer. */
         if ((buflen < pe->min_depth)  ||
-            (alproto_masks[0] & pe->alproto_mask)) {
+            (alproto_masks[0] & pe->alproto_mask) ||
+            (tried & pe->alproto_mask)) {
             pe = pe->next;
             continue;
         }
@@ -1281,6 +1315,129 @@ static int AppLayerProtoDetectPMRegisterPattern(uint8_t ipproto, AppProto alprot
     SCReturnInt(ret);
 }
 
+/***** Detection Cache *****/
+
+static uint32_t AppLayerProtoDetectCacheHash(const FlowAddress *a, uint16_t port,
+                                             uint8_t ipproto)
+{
+    uint32_t hash = a->addr_data32[0] ^ a->addr_data32[1] ^
+                    a->addr_data32[2] ^ a->addr_data32[3];
+    hash ^= ((uint32_t)port << 8) | ipproto;
+    hash *= 2654435761U;
+    return hash % alpd_cache.size;
+}
+
+static inline int AppLayerProtoDetectCacheEntryIsFlow(const AppLayerProtoDetectCacheEntry *e,
+                                                     const Flow *f, uint8_t ipproto)
+{
+    return (e->port == f->dp && e->ipproto == ipproto &&
+            memcmp(&e->addr, &f->dst, sizeof(e->addr)) == 0);
+}
+
+/** \retval alproto cached protocol or ALPROTO_UNKNOWN */
+static AppProto AppLayerProtoDetectCacheLookup(const Flow *f, uint8_t ipproto)
+{
+    AppProto alproto = ALPROTO_UNKNOWN;
+    uint32_t idx = AppLayerProtoDetectCacheHash(&f->dst, f->dp, ipproto);
+    AppLayerProtoDetectCacheEntry *e = &alpd_cache.entries[idx];
+
+    SCMutexLock(&alpd_cache.locks[idx % ALPD_CACHE_LOCKS]);
+    if (e->confidence >= ALPD_CACHE_MIN_CONFIDENCE &&
+        AppLayerProtoDetectCacheEntryIsFlow(e, f, ipproto))
+    {
+        alproto = e->alproto;
+    }
+    SCMutexUnlock(&alpd_cache.locks[idx % ALPD_CACHE_LOCKS]);
+    return alproto;
+}
+
+/** \brief record the result of a full detection for the server of 'f' */
+static void AppLayerProtoDetectCacheUpdate(const Flow *f, uint8_t ipproto,
+                                           AppProto alproto)
+{
+    uint32_t idx = AppLayerProtoDetectCacheHash(&f->dst, f->dp, ipproto);
+    AppLayerProtoDetectCacheEntry *e = &alpd_cache.entries[idx];
+
+    SCMutexLock(&alpd_cache.locks[idx % ALPD_CACHE_LOCKS]);
+    if (AppLayerProtoDetectCacheEntryIsFlow(e, f, ipproto)) {
+        if (e->alproto == alproto) {
+            if (e->confidence < UINT8_MAX)
+                e->confidence++;
+        } else {
+            e->alproto = alproto;
+            e->confidence = 1;
+        }
+    } else {
+        /* new server or a collision: the last one seen wins */
+        e->addr = f->dst;
+        e->port = f->dp;
+        e->ipproto = ipproto;
+        e->alproto = alproto;
+        e->confidence = 1;
+    }
+    SCMutexUnlock(&alpd_cache.locks[idx % ALPD_CACHE_LOCKS]);
+}
+
+/**
+ * \brief The parser rejected the protocol of 'f', so don't trust the
+ *        cached result for its server anymore.
+ */
+void AppLayerProtoDetectCacheInvalidate(const Flow *f)
+{
+    if (alpd_cache.entries == NULL)
+        return;
+
+    uint32_t idx = AppLayerProtoDetectCacheHash(&f->dst, f->dp, f->proto);
+    AppLayerProtoDetectCacheEntry *e = &alpd_cache.entries[idx];
+
+    SCMutexLock(&alpd_cache.locks[idx % ALPD_CACHE_LOCKS]);
+    if (AppLayerProtoDetectCacheEntryIsFlow(e, f, f->proto))
+        e->confidence = 0;
+    SCMutexUnlock(&alpd_cache.locks[idx % ALPD_CACHE_LOCKS]);
+}
+
+static void AppLayerProtoDetectCacheSetup(void)
+{
+    intmax_t size = 0;
+    int i;
+
+    memset(&alpd_cache, 0, sizeof(alpd_cache));
+
+    if (ConfGetInt("app-layer.detection-cache.size", &size) != 1 || size <= 0)
+        return;
+    if (size > UINT32_MAX) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "app-layer.detection-cache.size "
+                "%"PRIdMAX" too big, disabling the cache", size);
+        return;
+    }
+
+    alpd_cache.entries = SCCalloc((uint32_t)size, sizeof(AppLayerProtoDetectCacheEntry));
+    if (alpd_cache.entries == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc %"PRIdMAX" detection "
+                "cache entries, disabling the cache", size);
+        return;
+    }
+    alpd_cache.size = (uint32_t)size;
+    for (i = 0; i < ALPD_CACHE_LOCKS; i++)
+        SCMutexInit(&alpd_cache.locks[i], NULL);
+
+    SCLogConfig("app-layer detection cache enabled, %"PRIu32" entries",
+                alpd_cache.size);
+}
+
+static void AppLayerProtoDetectCacheDeSetup(void)
+{
+    int i;
+
+    if (alpd_cache.entries == NULL)
+        return;
+
+    for (i = 0; i < ALPD_CACHE_LOCKS; i++)
+        SCMutexDestroy(&alpd_cache.locks[i]);
+    SCFree(alpd_cache.entries);
+    memset(&alpd_cache, 0, sizeof(alpd_cache));
+}
+
 /***** Protocol Retrieval *****/
 
 AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
@@ -1294,6 +1451,14 @@ AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
     AppProto pm_results[ALPROTO_MAX];
     uint16_t pm_matches;
 
+    if (alpd_cache.entries != NULL) {
+        alproto = AppLayerProtoDetectCacheLookup(f, ipproto);
+        if (alproto != ALPROTO_UNKNOWN) {
+            SCLogDebug("using cached alproto %u", alproto);
+            SCReturnCT(alproto, "AppProto");
+        }
+    }
+
     if (!FLOW_IS_PM_DONE(f, direction)) {
         pm_matches = AppLayerProtoDetectPMGetProto(tctx, f,
                                                    buf, buflen,
@@ -1310,6 +1475,11 @@ AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
         alproto = AppLayerProtoDetectPPGetProto(f, buf, buflen, ipproto, direction);
 
  end:
+    if (alpd_cache.entries != NULL &&
+        alproto != ALPROTO_UNKNOWN && alproto != ALPROTO_FAILED)
+    {
+        AppLayerProtoDetectCacheUpdate(f, ipproto, alproto);
+    }
     SCReturnCT(alproto, "AppProto");
 }
 
@@ -1547,6 +1717,8 @@ int AppLayerProtoDetectSetup(void)
             MpmInitCtx(&alpd_ctx.ctx_ipp[i].ctx_pm[j].mpm_ctx, mpm_matcher);
         }
     }
+
+    AppLayerProtoDetectCacheSetup();
     SCReturnInt(0);
 }
 
@@ -1578,6 +1750,8 @@ int AppLayerProtoDetectDeSetup(void)
 
     AppLayerProtoDetectFreeProbingParsers(alpd_ctx.ctx_pp);
 
+    AppLayerProtoDetectCacheDeSetup();
+
     SCReturnInt(0);
 }
 
@@ -3757,6 +3931,52 @@ static int AppLayerProtoDetectTest20(void)
     return result;
 }
 
+/**
+ * \test detection cache: only used after enough agreeing detections and
+ *       dropped when the parser rejects the protocol
+ */
+static int AppLayerProtoDetectTest21(void)
+{
+    ConfCreateContextBackup();
+    ConfInit();
+    FAIL_IF(ConfSet("app-layer.detection-cache.size", "16") != 1);
+    AppLayerProtoDetectCacheSetup();
+    FAIL_IF_NULL(alpd_cache.entries);
+
+    Flow *f = UTHBuildFlow(AF_INET, "1.2.3.4", "5.6.7.8", 1024, 8080);
+    FAIL_IF_NULL(f);
+    f->proto = IPPROTO_TCP;
+    Flow *f2 = UTHBuildFlow(AF_INET, "1.2.3.4", "5.6.7.9", 1024, 8080);
+    FAIL_IF_NULL(f2);
+
+    int i;
+    for (i = 0; i < ALPD_CACHE_MIN_CONFIDENCE - 1; i++) {
+        AppLayerProtoDetectCacheUpdate(f, IPPROTO_TCP, ALPROTO_HTTP);
+        FAIL_IF(AppLayerProtoDetectCacheLookup(f, IPPROTO_TCP) != ALPROTO_UNKNOWN);
+    }
+    AppLayerProtoDetectCacheUpdate(f, IPPROTO_TCP, ALPROTO_HTTP);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(f, IPPROTO_TCP) != ALPROTO_HTTP);
+    /* different server or ipproto */
+    FAIL_IF(AppLayerProtoDetectCacheLookup(f2, IPPROTO_TCP) != ALPROTO_UNKNOWN);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(f, IPPROTO_UDP) != ALPROTO_UNKNOWN);
+
+    /* other protocol detected resets the confidence */
+    AppLayerProtoDetectCacheUpdate(f, IPPROTO_TCP, ALPROTO_TLS);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(f, IPPROTO_TCP) != ALPROTO_UNKNOWN);
+
+    for (i = 0; i < ALPD_CACHE_MIN_CONFIDENCE; i++)
+        AppLayerProtoDetectCacheUpdate(f, IPPROTO_TCP, ALPROTO_TLS);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(f, IPPROTO_TCP) != ALPROTO_TLS);
+    AppLayerProtoDetectCacheInvalidate(f);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(f, IPPROTO_TCP) != ALPROTO_UNKNOWN);
+
+    UTHFreeFlow(f);
+    UTHFreeFlow(f2);
+    AppLayerProtoDetectCacheDeSetup();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
 
 void AppLayerProtoDetectUnittestsRegister(void)
 {
@@ -3782,6 +4002,7 @@ void AppLayerProtoDetectUnittestsRegister(void)
     UtRegisterTest("AppLayerProtoDetectTest18", AppLayerProtoDetectTest18);
     UtRegisterTest("AppLayerProtoDetectTest19", AppLayerProtoDetectTest19);
     UtRegisterTest("AppLayerProtoDetectTest20", AppLayerProtoDetectTest20);
+    UtRegisterTest("AppLayerProtoDetectTest21", AppLayerProtoDetectTest21);
 
     SCReturn;
 }
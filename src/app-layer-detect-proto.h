@@ -49,6 +49,12 @@ AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
                                      uint8_t *buf, uint32_t buflen,
                                      uint8_t ipproto, uint8_t direction);
 
+/**
+ * \brief Drops the cached detection result for the server of a flow,
+ *        e.g. when the parser failed on the detected protocol.
+ */
+void AppLayerProtoDetectCacheInvalidate(const Flow *f);
+
 /***** State Preparation *****/
 
 /**
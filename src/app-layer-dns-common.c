@@ -30,6 +30,7 @@
 #endif
 #include "util-memcmp.h"
 #include "util-atomic.h"
+#include "util-memuse.h"
 
 typedef struct DNSConfig_ {
     uint32_t request_flood;
@@ -60,6 +61,7 @@ SC_ATOMIC_DECLARE(uint64_t, dns_memcap_global); /**< counts number of 'rejects'
 void DNSConfigSetGlobalMemcap(uint64_t value)
 {
     dns_config.global_memcap = value;
+    MemuseSetMemcap(MEMUSE_DNS, value);
 
     SC_ATOMIC_INIT(dns_memuse);
     SC_ATOMIC_INIT(dns_memcap_state);
@@ -72,6 +74,7 @@ void DNSIncrMemcap(uint32_t size, DNSState *state)
         state->memuse += size;
     }
     SC_ATOMIC_ADD(dns_memuse, size);
+    MemuseAlloc(MEMUSE_DNS, size);
 }
 
 void DNSDecrMemcap(uint32_t size, DNSState *state)
@@ -83,6 +86,7 @@ void DNSDecrMemcap(uint32_t size, DNSState *state)
 
     BUG_ON(size > SC_ATOMIC_GET(dns_memuse)); /**< TODO remove later */
     (void)SC_ATOMIC_SUB(dns_memuse, size);
+    MemuseFree(MEMUSE_DNS, size);
 }
 
 int DNSCheckMemcap(uint32_t want, DNSState *state)
@@ -103,6 +107,12 @@ int DNSCheckMemcap(uint32_t want, DNSState *state)
     return 0;
 }
 
+/** \brief memory used by a state, as accounted by DNSIncrMemcap */
+uint64_t DNSStateGetMemuse(void *state)
+{
+    return ((DNSState *)state)->memuse;
+}
+
 uint64_t DNSMemcapGetMemuseCounter(void)
 {
     uint64_t x = SC_ATOMIC_GET(dns_memuse);
@@ -277,13 +287,21 @@ void DNSSetEvent(DNSState *s, uint8_t e)
  *  \retval tx or NULL */
 static DNSTransaction *DNSTransactionAlloc(DNSState *state, const uint16_t tx_id)
 {
-    if (DNSCheckMemcap(sizeof(DNSTransaction), state) < 0)
-        return NULL;
+    DNSTransaction *tx;
 
-    DNSTransaction *tx = SCMalloc(sizeof(DNSTransaction));
-    if (unlikely(tx == NULL))
-        return NULL;
-    DNSIncrMemcap(sizeof(DNSTransaction), state);
+    /* the state's own tx is part of the state memuse already */
+    if (!state->tx0_used) {
+        tx = &state->tx0;
+        state->tx0_used = 1;
+    } else {
+        if (DNSCheckMemcap(sizeof(DNSTransaction), state) < 0)
+            return NULL;
+
+        tx = SCMalloc(sizeof(DNSTransaction));
+        if (unlikely(tx == NULL))
+            return NULL;
+        DNSIncrMemcap(sizeof(DNSTransaction), state);
+    }
 
     memset(tx, 0x00, sizeof(DNSTransaction));
 
@@ -295,6 +313,113 @@ static DNSTransaction *DNSTransactionAlloc(DNSState *state, const uint16_t tx_id
     return tx;
 }
 
+static inline uint32_t DNSStateIdHashIdx(const uint16_t tx_id)
+{
+    return tx_id % DNS_STATE_ID_HASH_SIZE;
+}
+
+/** \internal
+ *  \brief add tx to the end of its bucket, so that lookups return the
+ *         oldest tx for a reused dns id, as a list walk would */
+static void DNSStateIdHashAdd(DNSState *state, DNSTransaction *tx)
+{
+    DNSTransaction **t = &state->id_hash[DNSStateIdHashIdx(tx->tx_id)];
+    while (*t != NULL)
+        t = &(*t)->id_hnext;
+    tx->id_hnext = NULL;
+    *t = tx;
+}
+
+static void DNSStateIdHashRemove(DNSState *state, DNSTransaction *tx)
+{
+    if (state->id_hash == NULL)
+        return;
+
+    DNSTransaction **t = &state->id_hash[DNSStateIdHashIdx(tx->tx_id)];
+    while (*t != NULL) {
+        if (*t == tx) {
+            *t = tx->id_hnext;
+            break;
+        }
+        t = &(*t)->id_hnext;
+    }
+    tx->id_hnext = NULL;
+}
+
+/** \internal
+ *  \brief append tx to the state. Once a state holds many tx, e.g. a tcp
+ *         session from a resolver, index them by dns id so that matching
+ *         responses doesn't walk the whole list. */
+static void DNSStateAddTx(DNSState *state, DNSTransaction *tx)
+{
+    TAILQ_INSERT_TAIL(&state->tx_list, tx, next);
+    state->tx_cnt++;
+
+    if (state->id_hash != NULL) {
+        DNSStateIdHashAdd(state, tx);
+    } else if (state->tx_cnt >= DNS_STATE_ID_HASH_MIN_TX) {
+        const uint32_t size = DNS_STATE_ID_HASH_SIZE * sizeof(DNSTransaction *);
+        if (DNSCheckMemcap(size, state) < 0)
+            return;
+        state->id_hash = SCCalloc(DNS_STATE_ID_HASH_SIZE, sizeof(DNSTransaction *));
+        if (unlikely(state->id_hash == NULL))
+            return;
+        DNSIncrMemcap(size, state);
+
+        DNSTransaction *t;
+        TAILQ_FOREACH(t, &state->tx_list, next) {
+            DNSStateIdHashAdd(state, t);
+        }
+    }
+}
+
+/** \internal
+ *  \brief get memory for a query or answer entry
+ *
+ *  Taken from the state's arena while it has room. That memory is part
+ *  of the state memuse already, so only the heap entries are checked
+ *  against and accounted to the memcaps.
+ */
+static void *DNSStateEntryAlloc(DNSState *state, const uint32_t size)
+{
+    const uint32_t asize = (size + 7) & ~7;
+    if (state->arena_off + asize <= sizeof(state->arena)) {
+        void *ptr = state->arena + state->arena_off;
+        state->arena_off += asize;
+        state->arena_live++;
+        return ptr;
+    }
+
+    if (DNSCheckMemcap(size, state) < 0)
+        return NULL;
+    void *ptr = SCMalloc(size);
+    if (unlikely(ptr == NULL))
+        return NULL;
+    DNSIncrMemcap(size, state);
+    return ptr;
+}
+
+/** \internal
+ *  \brief free an entry from DNSStateEntryAlloc()
+ *
+ *  The arena is reused once all of its entries are freed, e.g. when
+ *  a flow's first exchange is logged and the next one comes in.
+ */
+static void DNSStateEntryFree(DNSState *state, void *ptr, const uint32_t size)
+{
+    if ((uint8_t *)ptr >= state->arena &&
+        (uint8_t *)ptr < state->arena + sizeof(state->arena))
+    {
+        BUG_ON(state->arena_live == 0);
+        if (--state->arena_live == 0)
+            state->arena_off = 0;
+        return;
+    }
+
+    DNSDecrMemcap(size, state);
+    SCFree(ptr);
+}
+
 /** \internal
  *  \brief Free a DNS TX
  *  \param tx DNS TX to free */
@@ -305,20 +430,19 @@ static void DNSTransactionFree(DNSTransaction *tx, DNSState *state)
     DNSQueryEntry *q = NULL;
     while ((q = TAILQ_FIRST(&tx->query_list))) {
         TAILQ_REMOVE(&tx->query_list, q, next);
-        DNSDecrMemcap((sizeof(DNSQueryEntry) + q->len), state);
-        SCFree(q);
+        DNSStateEntryFree(state, q, sizeof(DNSQueryEntry) + q->len);
     }
 
     DNSAnswerEntry *a = NULL;
     while ((a = TAILQ_FIRST(&tx->answer_list))) {
         TAILQ_REMOVE(&tx->answer_list, a, next);
-        DNSDecrMemcap((sizeof(DNSAnswerEntry) + a->fqdn_len + a->data_len), state);
-        SCFree(a);
+        DNSStateEntryFree(state, a,
+                sizeof(DNSAnswerEntry) + a->fqdn_len + a->data_len);
     }
     while ((a = TAILQ_FIRST(&tx->authority_list))) {
         TAILQ_REMOVE(&tx->authority_list, a, next);
-        DNSDecrMemcap((sizeof(DNSAnswerEntry) + a->fqdn_len + a->data_len), state);
-        SCFree(a);
+        DNSStateEntryFree(state, a,
+                sizeof(DNSAnswerEntry) + a->fqdn_len + a->data_len);
     }
 
     AppLayerDecoderEventsFreeEvents(&tx->decoder_events);
@@ -332,8 +456,15 @@ static void DNSTransactionFree(DNSTransaction *tx, DNSState *state)
     if (state->iter == tx)
         state->iter = NULL;
 
-    DNSDecrMemcap(sizeof(DNSTransaction), state);
-    SCFree(tx);
+    DNSStateIdHashRemove(state, tx);
+    state->tx_cnt--;
+
+    if (tx == &state->tx0) {
+        state->tx0_used = 0;
+    } else {
+        DNSDecrMemcap(sizeof(DNSTransaction), state);
+        SCFree(tx);
+    }
     SCReturn;
 }
 
@@ -386,6 +517,15 @@ DNSTransaction *DNSTransactionFindByTxId(const DNSState *dns_state, const uint16
     if (dns_state->curr->tx_id == tx_id) {
         return dns_state->curr;
 
+    /* indexed */
+    } else if (dns_state->id_hash != NULL) {
+        DNSTransaction *tx = dns_state->id_hash[DNSStateIdHashIdx(tx_id)];
+        for ( ; tx != NULL; tx = tx->id_hnext) {
+            if (tx->tx_id == tx_id) {
+                return tx;
+            }
+        }
+
     /* slow path, iterate list */
     } else {
         DNSTransaction *tx = NULL;
@@ -426,7 +566,8 @@ void *DNSStateAlloc(void)
     if (unlikely(s == NULL))
         return NULL;
 
-    memset(s, 0, sizeof(DNSState));
+    /* the arena is handed out before it's written to */
+    memset(s, 0, offsetof(DNSState, arena));
 
     DNSState *dns_state = (DNSState *)s;
 
@@ -448,6 +589,11 @@ void DNSStateFree(void *s)
             DNSTransactionFree(tx, dns_state);
         }
 
+        if (dns_state->id_hash != NULL) {
+            DNSDecrMemcap(DNS_STATE_ID_HASH_SIZE * sizeof(DNSTransaction *), dns_state);
+            SCFree(dns_state->id_hash);
+        }
+
         if (dns_state->buffer != NULL) {
             DNSDecrMemcap(0xffff, dns_state); /** TODO update if/once we alloc
                                                *  in a smarter way */
@@ -575,18 +721,15 @@ void DNSStoreQueryInState(DNSState *dns_state, const uint8_t *fqdn, const uint16
             return;
         dns_state->transaction_max++;
         SCLogDebug("dns_state->transaction_max updated to %"PRIu64, dns_state->transaction_max);
-        TAILQ_INSERT_TAIL(&dns_state->tx_list, tx, next);
+        DNSStateAddTx(dns_state, tx);
         dns_state->curr = tx;
         tx->tx_num = dns_state->transaction_max;
         SCLogDebug("new tx %u with internal id %u", tx->tx_id, tx->tx_num);
     }
 
-    if (DNSCheckMemcap((sizeof(DNSQueryEntry) + fqdn_len), dns_state) < 0)
+    DNSQueryEntry *q = DNSStateEntryAlloc(dns_state, sizeof(DNSQueryEntry) + fqdn_len);
+    if (q == NULL)
         return;
-    DNSQueryEntry *q = SCMalloc(sizeof(DNSQueryEntry) + fqdn_len);
-    if (unlikely(q == NULL))
-        return;
-    DNSIncrMemcap((sizeof(DNSQueryEntry) + fqdn_len), dns_state);
 
     q->type = type;
     q->class = class;
@@ -607,17 +750,15 @@ void DNSStoreAnswerInState(DNSState *dns_state, const int rtype, const uint8_t *
         tx = DNSTransactionAlloc(dns_state, tx_id);
         if (tx == NULL)
             return;
-        TAILQ_INSERT_TAIL(&dns_state->tx_list, tx, next);
+        DNSStateAddTx(dns_state, tx);
         dns_state->curr = tx;
         tx->tx_num = dns_state->transaction_max;
     }
 
-    if (DNSCheckMemcap((sizeof(DNSAnswerEntry) + fqdn_len + data_len), dns_state) < 0)
-        return;
-    DNSAnswerEntry *q = SCMalloc(sizeof(DNSAnswerEntry) + fqdn_len + data_len);
-    if (unlikely(q == NULL))
+    DNSAnswerEntry *q = DNSStateEntryAlloc(dns_state,
+            sizeof(DNSAnswerEntry) + fqdn_len + data_len);
+    if (q == NULL)
         return;
-    DNSIncrMemcap((sizeof(DNSAnswerEntry) + fqdn_len + data_len), dns_state);
 
     q->type = type;
     q->class = class;
@@ -204,14 +204,27 @@ typedef struct DNSTransaction_ {
     AppLayerDecoderEvents *decoder_events;          /**< per tx events */
 
     TAILQ_ENTRY(DNSTransaction_) next;
+    struct DNSTransaction_ *id_hnext;               /**< next in DNSState::id_hash bucket */
     DetectEngineState *de_state;
 } DNSTransaction;
 
+/** buckets of the per state dns id index */
+#define DNS_STATE_ID_HASH_SIZE      256
+/** number of tx in a state before we start indexing them by dns id */
+#define DNS_STATE_ID_HASH_MIN_TX    16
+
+/** bytes in the state for query and answer entries, enough for the
+ *  records of a typical request and response */
+#define DNS_STATE_ARENA_SIZE        512
+
 /** \brief Per flow DNS state container */
 typedef struct DNSState_ {
     TAILQ_HEAD(, DNSTransaction_) tx_list;  /**< transaction list */
     DNSTransaction *curr;                   /**< ptr to current tx */
     DNSTransaction *iter;
+    DNSTransaction **id_hash;               /**< tx by dns id, only set up
+                                                 for busy (tcp) sessions */
+    uint32_t tx_cnt;                        /**< number of tx in tx_list */
     uint64_t transaction_max;
     uint32_t unreplied_cnt;                 /**< number of unreplied requests in a row */
     uint32_t memuse;                        /**< state memuse, for comparing with
@@ -225,6 +238,17 @@ typedef struct DNSState_ {
     uint16_t offset;
     uint16_t record_len;
     uint8_t *buffer;
+
+    /* Most flows, UDP ones in particular, carry a single request and
+     * response. The first tx and the entries of the first records are
+     * stored in the state itself, so that such a flow takes a single
+     * allocation. More tx and records are allocated as usual. */
+    uint8_t tx0_used;                       /**< tx0 is in tx_list */
+    uint16_t arena_off;                     /**< next free byte in arena */
+    uint16_t arena_live;                    /**< entries in arena not freed */
+    DNSTransaction tx0;
+    /* keep last, it's not cleared on alloc */
+    uint8_t arena[DNS_STATE_ARENA_SIZE] __attribute__((aligned(8)));
 } DNSState;
 
 #define DNS_CONFIG_DEFAULT_REQUEST_FLOOD 500
@@ -259,6 +283,7 @@ int DNSGetAlstateProgress(void *tx, uint8_t direction);
 int DNSGetAlstateProgressCompletionStatus(uint8_t direction);
 
 void DNSStateTransactionFree(void *state, uint64_t tx_id);
+uint64_t DNSStateGetMemuse(void *state);
 DNSTransaction *DNSTransactionFindByTxId(const DNSState *dns_state, const uint16_t tx_id);
 
 int DNSStateHasTxDetectState(void *alstate);
@@ -415,6 +415,8 @@ void RegisterDNSUDPParsers(void)
         AppLayerParserRegisterDetectStateFuncs(IPPROTO_UDP, ALPROTO_DNS,
                                                DNSStateHasTxDetectState,
                                                DNSGetTxDetectState, DNSSetTxDetectState);
+        AppLayerParserRegisterGetStateMemuseFunc(IPPROTO_UDP, ALPROTO_DNS,
+                                                 DNSStateGetMemuse);
 
         AppLayerParserRegisterGetTx(IPPROTO_UDP, ALPROTO_DNS,
                                     DNSGetTx);
@@ -627,6 +629,70 @@ end:
     return (result);
 }
 
+/** \test many outstanding queries: lookup by dns id through the index */
+static int DNSUDPParserTest06 (void)
+{
+    const uint8_t fqdn[] = "www.suricata-ids.org";
+    DNSState *dns_state = DNSStateAlloc();
+    FAIL_IF_NULL(dns_state);
+
+    uint16_t id;
+    for (id = 0; id < 2 * DNS_STATE_ID_HASH_MIN_TX; id++) {
+        DNSStoreQueryInState(dns_state, fqdn, sizeof(fqdn) - 1,
+                DNS_RECORD_TYPE_A, 1, id * DNS_STATE_ID_HASH_SIZE + 1);
+    }
+    FAIL_IF(dns_state->tx_cnt != 2 * DNS_STATE_ID_HASH_MIN_TX);
+    FAIL_IF_NULL(dns_state->id_hash);
+
+    /* all ids share a bucket, and each one maps to its own tx */
+    for (id = 0; id < 2 * DNS_STATE_ID_HASH_MIN_TX; id++) {
+        DNSTransaction *tx = DNSTransactionFindByTxId(dns_state,
+                id * DNS_STATE_ID_HASH_SIZE + 1);
+        FAIL_IF_NULL(tx);
+        FAIL_IF(tx->tx_num != id + 1);
+    }
+
+    /* freed tx are gone from the index too */
+    DNSStateTransactionFree(dns_state, 0);
+    FAIL_IF_NOT_NULL(DNSTransactionFindByTxId(dns_state, 1));
+    FAIL_IF_NULL(DNSTransactionFindByTxId(dns_state, DNS_STATE_ID_HASH_SIZE + 1));
+    FAIL_IF(dns_state->tx_cnt != 2 * DNS_STATE_ID_HASH_MIN_TX - 1);
+
+    DNSStateFree(dns_state);
+    PASS;
+}
+
+/** \test a single exchange lives in the state allocation */
+static int DNSUDPParserTest07 (void)
+{
+    const uint8_t fqdn[] = "www.suricata-ids.org";
+    const uint8_t addr[] = { 192, 0, 2, 1 };
+    DNSState *dns_state = DNSStateAlloc();
+    FAIL_IF_NULL(dns_state);
+
+    int i;
+    for (i = 0; i < 2; i++) {
+        DNSStoreQueryInState(dns_state, fqdn, sizeof(fqdn) - 1,
+                DNS_RECORD_TYPE_A, 1, 0x1234 + i);
+        DNSStoreAnswerInState(dns_state, DNS_LIST_ANSWER, fqdn, sizeof(fqdn) - 1,
+                DNS_RECORD_TYPE_A, 1, 60, addr, sizeof(addr), 0x1234 + i);
+
+        DNSTransaction *tx = DNSTransactionFindByTxId(dns_state, 0x1234 + i);
+        FAIL_IF(tx != &dns_state->tx0);
+        FAIL_IF_NOT(tx->replied);
+        FAIL_IF(TAILQ_FIRST(&tx->query_list) == NULL);
+        FAIL_IF(TAILQ_FIRST(&tx->answer_list) == NULL);
+        FAIL_IF(dns_state->memuse != sizeof(DNSState));
+
+        /* logged and freed: the next exchange reuses the tx and arena */
+        DNSStateTransactionFree(dns_state, i);
+        FAIL_IF(dns_state->tx0_used);
+        FAIL_IF(dns_state->arena_off != 0);
+    }
+
+    DNSStateFree(dns_state);
+    PASS;
+}
 
 void DNSUDPParserRegisterTests(void)
 {
@@ -635,5 +701,7 @@ void DNSUDPParserRegisterTests(void)
     UtRegisterTest("DNSUDPParserTest03", DNSUDPParserTest03);
     UtRegisterTest("DNSUDPParserTest04", DNSUDPParserTest04);
     UtRegisterTest("DNSUDPParserTest05", DNSUDPParserTest05);
+    UtRegisterTest("DNSUDPParserTest06", DNSUDPParserTest06);
+    UtRegisterTest("DNSUDPParserTest07", DNSUDPParserTest07);
 }
 #endif
@@ -0,0 +1,188 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Expectation table for flows negotiated by a control channel.
+ *
+ * The table is direct mapped on the addresses and the responder port of
+ * the expected flow. A collision overwrites the older entry, which then
+ * just goes through normal protocol detection. Entries are not removed on
+ * a match, so both directions of the expected flow see it, and time out
+ * after APP_LAYER_EXPECTATION_TIMEOUT seconds.
+ *
+ * The addresses are taken from the control flow rather than from the
+ * negotiated ones, so that NAT'd clients still match.
+ */
+
+#include "suricata-common.h"
+#include "threads.h"
+#include "decode.h"
+#include "flow.h"
+#include "util-hash-lookup3.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#include "app-layer-protos.h"
+#include "app-layer-expectation.h"
+
+typedef struct AppLayerExpectation_ {
+    FlowAddress src;        /**< initiator of the expected flow */
+    FlowAddress dst;        /**< responder of the expected flow */
+    Port dp;
+    AppProto alproto;       /**< ALPROTO_UNKNOWN for an unused slot */
+    uint32_t expire;        /**< seconds, packet time */
+} AppLayerExpectation;
+
+static SCMutex expectation_lock = SCMUTEX_INITIALIZER;
+static AppLayerExpectation expectations[APP_LAYER_EXPECTATION_SIZE];
+
+/* time of the last expectation added. Lets new flows skip the lookup
+ * altogether when there is nothing to find, without taking the lock. */
+SC_ATOMIC_DECLARE(uint32_t, expectation_last);
+
+void AppLayerExpectationSetup(void)
+{
+    memset(expectations, 0, sizeof(expectations));
+    SC_ATOMIC_INIT(expectation_last);
+}
+
+static uint32_t AppLayerExpectationHash(const FlowAddress *src,
+                                        const FlowAddress *dst, Port dp)
+{
+    uint32_t key[9];
+    memcpy(&key[0], src->addr_data32, 16);
+    memcpy(&key[4], dst->addr_data32, 16);
+    key[8] = dp;
+    return hashword(key, 9, 0) % APP_LAYER_EXPECTATION_SIZE;
+}
+
+/**
+ *  \brief expect a new tcp flow negotiated by a control flow
+ *
+ *  \param f control flow
+ *  \param to_client 1 if the expected flow is opened by the responder of
+ *         the control flow (active FTP), 0 if by its initiator (passive)
+ *  \param dp responder port of the expected flow
+ *  \param alproto protocol to set on the expected flow
+ */
+int AppLayerExpectationAdd(const Flow *f, int to_client, Port dp,
+                           AppProto alproto)
+{
+    const FlowAddress *src = to_client ? &f->dst : &f->src;
+    const FlowAddress *dst = to_client ? &f->src : &f->dst;
+    uint32_t now = (uint32_t)f->lastts.tv_sec;
+
+    uint32_t idx = AppLayerExpectationHash(src, dst, dp);
+
+    SCMutexLock(&expectation_lock);
+    AppLayerExpectation *e = &expectations[idx];
+    e->src = *src;
+    e->dst = *dst;
+    e->dp = dp;
+    e->alproto = alproto;
+    e->expire = now + APP_LAYER_EXPECTATION_TIMEOUT;
+    SCMutexUnlock(&expectation_lock);
+
+    (void)SC_ATOMIC_SET(expectation_last, now);
+
+    SCLogDebug("expecting %s flow to port %u", AppProtoToString(alproto), dp);
+    return 0;
+}
+
+/**
+ *  \brief get the protocol of a new flow from the expectation table
+ *
+ *  \retval alproto or ALPROTO_UNKNOWN if the flow wasn't expected
+ */
+AppProto AppLayerExpectationLookup(const Flow *f)
+{
+    uint32_t now = (uint32_t)f->lastts.tv_sec;
+    uint32_t last = SC_ATOMIC_GET(expectation_last);
+    if (last == 0 || now > last + APP_LAYER_EXPECTATION_TIMEOUT)
+        return ALPROTO_UNKNOWN;
+
+    AppProto alproto = ALPROTO_UNKNOWN;
+    uint32_t idx = AppLayerExpectationHash(&f->src, &f->dst, f->dp);
+
+    SCMutexLock(&expectation_lock);
+    AppLayerExpectation *e = &expectations[idx];
+    if (e->alproto != ALPROTO_UNKNOWN) {
+        if (now > e->expire) {
+            e->alproto = ALPROTO_UNKNOWN;
+        } else if (e->dp == f->dp &&
+                   memcmp(&e->src, &f->src, sizeof(e->src)) == 0 &&
+                   memcmp(&e->dst, &f->dst, sizeof(e->dst)) == 0) {
+            alproto = e->alproto;
+        }
+    }
+    SCMutexUnlock(&expectation_lock);
+
+    return alproto;
+}
+
+#ifdef UNITTESTS
+
+static int AppLayerExpectationTest01(void)
+{
+    Flow *ctrl = UTHBuildFlow(AF_INET, "1.2.3.4", "4.3.2.1", 2000, 21);
+    FAIL_IF_NULL(ctrl);
+    ctrl->lastts.tv_sec = 1000;
+
+    /* passive: the client connects to the server */
+    FAIL_IF(AppLayerExpectationAdd(ctrl, 0, 30000, ALPROTO_FTP) != 0);
+    /* active: the server connects back to the client */
+    FAIL_IF(AppLayerExpectationAdd(ctrl, 1, 2001, ALPROTO_SMTP) != 0);
+
+    Flow *pasv = UTHBuildFlow(AF_INET, "1.2.3.4", "4.3.2.1", 2002, 30000);
+    FAIL_IF_NULL(pasv);
+    pasv->lastts.tv_sec = 1010;
+    FAIL_IF(AppLayerExpectationLookup(pasv) != ALPROTO_FTP);
+    /* still there for the other direction */
+    FAIL_IF(AppLayerExpectationLookup(pasv) != ALPROTO_FTP);
+
+    Flow *port = UTHBuildFlow(AF_INET, "4.3.2.1", "1.2.3.4", 20, 2001);
+    FAIL_IF_NULL(port);
+    port->lastts.tv_sec = 1010;
+    FAIL_IF(AppLayerExpectationLookup(port) != ALPROTO_SMTP);
+
+    /* different host */
+    Flow *other = UTHBuildFlow(AF_INET, "1.2.3.5", "4.3.2.1", 2002, 30000);
+    FAIL_IF_NULL(other);
+    other->lastts.tv_sec = 1010;
+    FAIL_IF(AppLayerExpectationLookup(other) != ALPROTO_UNKNOWN);
+
+    /* timed out */
+    pasv->lastts.tv_sec = 1000 + APP_LAYER_EXPECTATION_TIMEOUT + 1;
+    FAIL_IF(AppLayerExpectationLookup(pasv) != ALPROTO_UNKNOWN);
+
+    UTHFreeFlow(ctrl);
+    UTHFreeFlow(pasv);
+    UTHFreeFlow(port);
+    UTHFreeFlow(other);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void AppLayerExpectationRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("AppLayerExpectationTest01", AppLayerExpectationTest01);
+#endif
+}
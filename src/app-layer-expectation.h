@@ -0,0 +1,41 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Expectations for flows negotiated by a control channel, like the FTP
+ * data connections. A new flow matching an expectation gets its app-layer
+ * protocol without going through protocol detection.
+ */
+
+#ifndef __APP_LAYER_EXPECTATION_H__
+#define __APP_LAYER_EXPECTATION_H__
+
+/** seconds an expectation stays valid */
+#define APP_LAYER_EXPECTATION_TIMEOUT   60
+
+#define APP_LAYER_EXPECTATION_SIZE      1024
+
+void AppLayerExpectationSetup(void);
+int AppLayerExpectationAdd(const Flow *f, int to_client, Port dp,
+                           AppProto alproto);
+AppProto AppLayerExpectationLookup(const Flow *f);
+
+void AppLayerExpectationRegisterTests(void);
+
+#endif /* __APP_LAYER_EXPECTATION_H__ */
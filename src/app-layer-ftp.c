@@ -44,9 +44,11 @@
 #include "app-layer-protos.h"
 #include "app-layer-parser.h"
 #include "app-layer-ftp.h"
+#include "app-layer-expectation.h"
 
 #include "util-spm.h"
 #include "util-unittest.h"
+#include "util-unittest-helper.h"
 #include "util-debug.h"
 #include "util-memcmp.h"
 
@@ -199,6 +201,83 @@ static int FTPParseRequestCommand(void *ftp_state, uint8_t *input,
     return 1;
 }
 
+/**
+ * \brief Get the port from a "h1,h2,h3,h4,p1,p2" tuple as used by PORT and
+ *        the 227 reply to PASV. Anything before the first digit is skipped.
+ *
+ * \retval 0 on success, -1 if no valid tuple was found
+ */
+static int FTPParsePortTuple(const uint8_t *input, uint32_t input_len,
+                             uint16_t *port)
+{
+    uint32_t values[6];
+    int n = 0;
+    uint32_t i = 0;
+
+    while (i < input_len && !isdigit(input[i]))
+        i++;
+
+    while (n < 6) {
+        if (i >= input_len || !isdigit(input[i]))
+            return -1;
+        values[n] = 0;
+        while (i < input_len && isdigit(input[i])) {
+            values[n] = values[n] * 10 + (input[i] - '0');
+            if (values[n] > 255)
+                return -1;
+            i++;
+        }
+        n++;
+        if (n < 6) {
+            if (i >= input_len || input[i] != ',')
+                return -1;
+            i++;
+        }
+    }
+
+    *port = (uint16_t)(values[4] * 256 + values[5]);
+    return (*port != 0) ? 0 : -1;
+}
+
+/**
+ * \brief Get the port from the "|proto|addr|port|" format of EPRT and the 229
+ *        reply to EPSV, the latter with empty proto and address fields.
+ *
+ * \retval 0 on success, -1 if no valid port was found
+ */
+static int FTPParseExtendedPort(const uint8_t *input, uint32_t input_len,
+                                uint16_t *port)
+{
+    const uint8_t *delim = memchr(input, '|', input_len);
+    if (delim == NULL)
+        return -1;
+
+    uint32_t i = delim - input;
+    int fields = 0;
+    /* skip the delimiter and the proto and address fields */
+    while (i < input_len && fields < 3) {
+        if (input[i] == '|')
+            fields++;
+        i++;
+    }
+    if (fields != 3)
+        return -1;
+
+    uint32_t value = 0;
+    uint32_t start = i;
+    while (i < input_len && isdigit(input[i])) {
+        value = value * 10 + (input[i] - '0');
+        if (value > 65535)
+            return -1;
+        i++;
+    }
+    if (i == start || i >= input_len || input[i] != '|' || value == 0)
+        return -1;
+
+    *port = (uint16_t)value;
+    return 0;
+}
+
 /**
  * \brief This function is called to retrieve a ftp request
  * \param ftp_state the ftp state structure for the parser
@@ -249,6 +328,18 @@ static int FTPParseRequest(Flow *f, void *ftp_state,
             memcpy(state->port_line, state->current_line,
                    state->current_line_len);
             state->port_line_len = state->current_line_len;
+
+            /* active mode: the server connects to the client */
+            uint16_t port;
+            if (FTPParsePortTuple(state->current_line + 4,
+                                  state->current_line_len - 4, &port) == 0)
+                AppLayerExpectationAdd(f, 1, port, ALPROTO_FTPDATA);
+        } else if (state->current_line_len >= 4 &&
+                   SCMemcmpLowercase("eprt", state->current_line, 4) == 0) {
+            uint16_t port;
+            if (FTPParseExtendedPort(state->current_line + 4,
+                                     state->current_line_len - 4, &port) == 0)
+                AppLayerExpectationAdd(f, 1, port, ALPROTO_FTPDATA);
         }
     }
 
@@ -268,7 +359,37 @@ static int FTPParseResponse(Flow *f, void *ftp_state, AppLayerParserState *pstat
                             uint8_t *input, uint32_t input_len,
                             void *local_data)
 {
-    return 1;
+    SCEnter();
+
+    FtpState *state = (FtpState *)ftp_state;
+
+    if (input == NULL || input_len == 0)
+        SCReturnInt(1);
+
+    state->input = input;
+    state->input_len = input_len;
+    /* toclient stream */
+    state->direction = 1;
+
+    /* passive mode replies: the client connects to the server */
+    while (FTPGetLine(state) >= 0) {
+        uint16_t port;
+
+        if (state->current_line_len < 4)
+            continue;
+
+        if (memcmp(state->current_line, "227 ", 4) == 0) {
+            if (FTPParsePortTuple(state->current_line + 4,
+                                  state->current_line_len - 4, &port) == 0)
+                AppLayerExpectationAdd(f, 0, port, ALPROTO_FTPDATA);
+        } else if (memcmp(state->current_line, "229 ", 4) == 0) {
+            if (FTPParseExtendedPort(state->current_line + 4,
+                                     state->current_line_len - 4, &port) == 0)
+                AppLayerExpectationAdd(f, 0, port, ALPROTO_FTPDATA);
+        }
+    }
+
+    SCReturnInt(1);
 }
 
 #ifdef DEBUG
@@ -340,6 +461,9 @@ void RegisterFTPParsers(void)
     /** FTP */
     if (AppLayerProtoDetectConfProtoDetectionEnabled("tcp", proto_name)) {
         AppLayerProtoDetectRegisterProtocol(ALPROTO_FTP, proto_name);
+        /* data connections are only found through the expectations
+         * set up by the parser below */
+        AppLayerProtoDetectRegisterProtocol(ALPROTO_FTPDATA, "ftp-data");
         if (FTPRegisterPatternsForProtocolDetection() < 0 )
             return;
     }
@@ -666,6 +790,68 @@ end:
     FLOW_DESTROY(&f);
     return result;
 }
+
+/** \test PORT/PASV/EPSV argument parsing */
+static int FTPParserTest11(void)
+{
+    uint16_t port = 0;
+
+    FAIL_IF(FTPParsePortTuple((uint8_t *)" 192,168,1,1,0,80", 17, &port) != 0);
+    FAIL_IF(port != 80);
+    FAIL_IF(FTPParsePortTuple((uint8_t *)"Entering Passive Mode (10,0,0,1,117,48).",
+                              40, &port) != 0);
+    FAIL_IF(port != 30000);
+    FAIL_IF(FTPParsePortTuple((uint8_t *)" 192,168,1,1,0", 14, &port) == 0);
+    FAIL_IF(FTPParsePortTuple((uint8_t *)" 192,168,1,1,256,1", 18, &port) == 0);
+
+    FAIL_IF(FTPParseExtendedPort((uint8_t *)"Entering Extended Passive Mode (|||6446|)",
+                                 41, &port) != 0);
+    FAIL_IF(port != 6446);
+    FAIL_IF(FTPParseExtendedPort((uint8_t *)" |1|132.235.1.2|6275|", 21, &port) != 0);
+    FAIL_IF(port != 6275);
+    FAIL_IF(FTPParseExtendedPort((uint8_t *)" |1|132.235.1.2|6275", 20, &port) == 0);
+    PASS;
+}
+
+/** \test a PASV reply sets up the ftp-data expectation for the data flow */
+static int FTPParserTest12(void)
+{
+    uint8_t ftpbuf[] = "227 Entering Passive Mode (192,168,1,1,117,48).\r\n";
+    TcpSession ssn;
+    memset(&ssn, 0, sizeof(ssn));
+
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    Flow *f = UTHBuildFlow(AF_INET, "1.2.3.4", "4.3.2.1", 2000, 21);
+    FAIL_IF_NULL(f);
+    f->protoctx = &ssn;
+    f->proto = IPPROTO_TCP;
+    f->alproto = ALPROTO_FTP;
+    f->lastts.tv_sec = 100;
+
+    StreamTcpInitConfig(TRUE);
+
+    SCMutexLock(&f->m);
+    int r = AppLayerParserParse(alp_tctx, f, ALPROTO_FTP, STREAM_TOCLIENT,
+                                ftpbuf, sizeof(ftpbuf) - 1);
+    SCMutexUnlock(&f->m);
+    FAIL_IF(r != 0);
+
+    Flow *data = UTHBuildFlow(AF_INET, "1.2.3.4", "4.3.2.1", 2001, 30000);
+    FAIL_IF_NULL(data);
+    data->lastts.tv_sec = 101;
+    FAIL_IF(AppLayerExpectationLookup(data) != ALPROTO_FTPDATA);
+
+    data->dp = 30001;
+    FAIL_IF(AppLayerExpectationLookup(data) != ALPROTO_UNKNOWN);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    UTHFreeFlow(data);
+    UTHFreeFlow(f);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 void FTPParserRegisterTests(void)
@@ -676,6 +862,8 @@ void FTPParserRegisterTests(void)
     UtRegisterTest("FTPParserTest06", FTPParserTest06);
     UtRegisterTest("FTPParserTest07", FTPParserTest07);
     UtRegisterTest("FTPParserTest10", FTPParserTest10);
+    UtRegisterTest("FTPParserTest11", FTPParserTest11);
+    UtRegisterTest("FTPParserTest12", FTPParserTest12);
 #endif /* UNITTESTS */
 }
 
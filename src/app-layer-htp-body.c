@@ -75,12 +75,17 @@ static StreamingBufferConfig default_cfg = {
  * \retval 0 ok
  * \retval -1 error
  */
+/** max size of a chunk that new data is merged into. Keeps pruning
+ *  granular: a chunk is only freed once all of its data slid out. */
+#define HTP_BODY_CHUNK_MERGE_MAX    (64 * 1024)
+
 int HtpBodyAppendChunk(const HTPCfgDir *hcfg, HtpBody *body,
                        const uint8_t *data, uint32_t len)
 {
     SCEnter();
 
     HtpBodyChunk *bd = NULL;
+    StreamingBufferSegment seg = { 0, 0 };
 
     if (len == 0 || data == NULL) {
         SCReturnInt(0);
@@ -93,29 +98,36 @@ int HtpBodyAppendChunk(const HTPCfgDir *hcfg, HtpBody *body,
             SCReturnInt(-1);
     }
 
-    if (body->first == NULL) {
-        /* New chunk */
-        bd = (HtpBodyChunk *)HTPCalloc(1, sizeof(HtpBodyChunk));
-        if (bd == NULL) {
-            SCReturnInt(-1);
-        }
+    StreamingBufferAppend(body->sb, &seg, data, len);
+
+    /* libhtp hands us the body in many small pieces. The data is stored
+     * contiguously in the streaming buffer anyway, so if the last chunk
+     * wasn't picked up by the streaming loggers yet, just extend it
+     * instead of allocating a chunk per callback. */
+    bd = body->last;
+    if (bd != NULL && bd->logged == 0 && seg.segment_len == len &&
+            bd->sbseg.segment_len + len <= HTP_BODY_CHUNK_MERGE_MAX &&
+            bd->sbseg.stream_offset + bd->sbseg.segment_len == seg.stream_offset)
+    {
+        bd->sbseg.segment_len += len;
+        body->content_len_so_far += len;
+        SCLogDebug("body %p, merged into chunk %p", body, bd);
+        SCReturnInt(0);
+    }
 
-        StreamingBufferAppend(body->sb, &bd->sbseg, data, len);
+    bd = (HtpBodyChunk *)HTPCalloc(1, sizeof(HtpBodyChunk));
+    if (bd == NULL) {
+        SCReturnInt(-1);
+    }
+    bd->sbseg = seg;
 
+    if (body->first == NULL) {
+        /* New chunk */
         body->first = body->last = bd;
-
         body->content_len_so_far = len;
     } else {
-        bd = (HtpBodyChunk *)HTPCalloc(1, sizeof(HtpBodyChunk));
-        if (bd == NULL) {
-            SCReturnInt(-1);
-        }
-
-        StreamingBufferAppend(body->sb, &bd->sbseg, data, len);
-
         body->last->next = bd;
         body->last = bd;
-
         body->content_len_so_far += len;
     }
     SCLogDebug("body %p", body);
@@ -123,11 +135,6 @@ int HtpBodyAppendChunk(const HTPCfgDir *hcfg, HtpBody *body,
     SCReturnInt(0);
 }
 
-/**
- * \brief Print the information and chunks of a Body
- * \param body pointer to the HtpBody holding the list
- * \retval none
- */
 void HtpBodyPrint(HtpBody *body)
 {
     if (SCLogDebugEnabled()||1) {
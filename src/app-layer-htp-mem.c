@@ -35,6 +35,7 @@
 #include "conf.h"
 #include "util-mem.h"
 #include "util-misc.h"
+#include "util-memuse.h"
 
 #include "app-layer-htp-mem.h"
 
@@ -61,6 +62,7 @@ void HTPParseMemcap()
         /* default to unlimited */
         htp_config_memcap = 0;
     }
+    MemuseSetMemcap(MEMUSE_HTTP, htp_config_memcap);
 
     SC_ATOMIC_INIT(htp_memuse);
     SC_ATOMIC_INIT(htp_memcap);
@@ -117,6 +119,7 @@ void *HTPMalloc(size_t size)
         return NULL;
 
     HTPIncrMemuse((uint64_t)size);
+    MemuseAlloc(MEMUSE_HTTP, (uint64_t)size);
 
     return ptr;
 }
@@ -134,6 +137,7 @@ void *HTPCalloc(size_t n, size_t size)
         return NULL;
 
     HTPIncrMemuse((uint64_t)(n * size));
+    MemuseAlloc(MEMUSE_HTTP, (uint64_t)(n * size));
 
     return ptr;
 }
@@ -150,6 +154,8 @@ void *HTPRealloc(void *ptr, size_t orig_size, size_t size)
         return NULL;
 
     HTPIncrMemuse((uint64_t)(size - orig_size));
+    MemuseFree(MEMUSE_HTTP, (uint64_t)orig_size);
+    MemuseAlloc(MEMUSE_HTTP, (uint64_t)size);
 
     return rptr;
 }
@@ -159,6 +165,7 @@ void HTPFree(void *ptr, size_t size)
     SCFree(ptr);
 
     HTPDecrMemuse((uint64_t)size);
+    MemuseFree(MEMUSE_HTTP, (uint64_t)size);
 }
 
 
@@ -85,6 +85,11 @@ static SCRadixTree *cfgtree;
 /** List of HTP configurations. */
 static HTPCfgRec cfglist;
 
+/** response bodies not decompressed as no rule or output needs them */
+static SC_ATOMIC_DECLARE(uint64_t, htp_decompress_skipped);
+/** flows that used up their response-body-decompress-budget */
+static SC_ATOMIC_DECLARE(uint64_t, htp_decompress_budget);
+
 #ifdef DEBUG
 static SCMutex htp_state_mem_lock = SCMUTEX_INITIALIZER;
 static uint64_t htp_state_memuse = 0;
@@ -156,6 +161,8 @@ SCEnumCharMap http_decoder_event_table[ ] = {
         HTTP_DECODER_EVENT_MULTIPART_NO_FILEDATA},
     { "MULTIPART_INVALID_HEADER",
         HTTP_DECODER_EVENT_MULTIPART_INVALID_HEADER},
+    { "RESPONSE_DECOMPRESSION_BUDGET",
+        HTTP_DECODER_EVENT_RESPONSE_DECOMPRESSION_BUDGET},
 
     { NULL,                      -1 },
 };
@@ -312,6 +319,10 @@ static void HtpTxUserDataFree(HtpState *state, HtpTxUserData *htud)
             HTPFree(htud->request_headers_raw, htud->request_headers_raw_len);
         if (htud->response_headers_raw)
             HTPFree(htud->response_headers_raw, htud->response_headers_raw_len);
+        if (htud->request_hhd_buffer)
+            HTPFree(htud->request_hhd_buffer, htud->request_hhd_buffer_size);
+        if (htud->response_hhd_buffer)
+            HTPFree(htud->response_hhd_buffer, htud->response_hhd_buffer_size);
         AppLayerDecoderEventsFreeEvents(&htud->decoder_events);
         if (htud->boundary)
             HTPFree(htud->boundary, htud->boundary_len);
@@ -440,6 +451,21 @@ void AppLayerHtpEnableResponseBodyCallback(void)
     SCReturn;
 }
 
+/**
+ * \brief Sets a flag that informs the HTP app layer that an output needs
+ *        the decompressed http response body of every flow, whatever the
+ *        rules of the flow inspect.
+ * \initonly
+ */
+void AppLayerHtpNeedResponseBodyForOutput(void)
+{
+    SCEnter();
+    AppLayerHtpEnableResponseBodyCallback();
+
+    SC_ATOMIC_OR(htp_config_flags, HTP_REQUIRE_RESPONSE_BODY_OUTPUT);
+    SCReturn;
+}
+
 /**
  * \brief Sets a flag that informs the HTP app layer that some module in the
  *        engine needs the http request multi part header.
@@ -472,6 +498,37 @@ void AppLayerHtpNeedFileInspection(void)
     SCReturn;
 }
 
+/**
+ * \brief Sets a flag that informs the HTP app layer that some module in the
+ *        engine needs the raw request and response headers.
+ *
+ * \initonly
+ */
+void AppLayerHtpNeedRawHeaders(void)
+{
+    SCEnter();
+
+    SC_ATOMIC_OR(htp_config_flags, HTP_REQUIRE_HEADERS_RAW);
+    SCReturn;
+}
+
+/**
+ * \brief Log what the enabled rules and outputs need from http parsing.
+ *        Whatever isn't needed is skipped for all flows.
+ */
+void AppLayerHtpPrintProfile(void)
+{
+    uint32_t flags = SC_ATOMIC_GET(htp_config_flags);
+
+    SCLogConfig("http inspection: request body %s, response body %s%s, "
+            "files %s, raw headers %s",
+            (flags & HTP_REQUIRE_REQUEST_BODY) ? "yes" : "no",
+            (flags & HTP_REQUIRE_RESPONSE_BODY) ? "yes" : "no",
+            (flags & HTP_REQUIRE_RESPONSE_BODY_OUTPUT) ? " (all flows)" : "",
+            (flags & HTP_REQUIRE_REQUEST_FILE) ? "yes" : "no",
+            (flags & HTP_REQUIRE_HEADERS_RAW) ? "yes" : "no");
+}
+
 /* below error messages updated up to libhtp 0.5.7 (git 379632278b38b9a792183694a4febb9e0dbd1e7a) */
 struct {
     char *msg;
@@ -1803,6 +1860,70 @@ end:
     SCReturnInt(HTP_OK);
 }
 
+uint64_t HTPDecompressSkippedGlobalCounter(void)
+{
+    uint64_t tmpval = SC_ATOMIC_GET(htp_decompress_skipped);
+    return tmpval;
+}
+
+uint64_t HTPDecompressBudgetGlobalCounter(void)
+{
+    uint64_t tmpval = SC_ATOMIC_GET(htp_decompress_budget);
+    return tmpval;
+}
+
+/** \internal
+ *  \brief see if the response body of the flow has to be decompressed
+ *
+ *  With response-body-decompress-lazy the body is left compressed if no
+ *  sig of the to client sig group inspects the body or files and no output
+ *  needs it. The sig group is set on the first to client packet, so the
+ *  response headers of the first tx are seen before detect has run only
+ *  if the response comes in the same packet as the handshake ack, in which
+ *  case we decompress.
+ *
+ *  \retval 1 decompress
+ *  \retval 0 leave the body compressed
+ */
+static int HTPNeedResponseDecompression(const HtpState *hstate)
+{
+    uint32_t flags = SC_ATOMIC_GET(htp_config_flags);
+
+    if (!(flags & HTP_REQUIRE_RESPONSE_BODY))
+        return 0;
+    if (hstate->flags & HTP_FLAG_DECOMPRESS_BUDGET)
+        return 0;
+    if (hstate->cfg->response_decompress_lazy &&
+            !(flags & HTP_REQUIRE_RESPONSE_BODY_OUTPUT) &&
+            hstate->f != NULL && (hstate->f->flags & FLOW_NO_RESPONSE_BODY))
+        return 0;
+    return 1;
+}
+
+/**
+ * \brief Function callback for the response headers, turns off
+ *        decompression of the body if no one needs it.
+ * \param tx pointer to the htp_tx_t structure
+ * \retval int HTP_OK
+ */
+static int HTPCallbackResponseHeaders(htp_tx_t *tx)
+{
+    if (tx->response_content_encoding_processing != HTP_COMPRESSION_GZIP &&
+        tx->response_content_encoding_processing != HTP_COMPRESSION_DEFLATE)
+        return HTP_OK;
+
+    HtpState *hstate = htp_connp_get_user_data(tx->connp);
+    if (hstate == NULL)
+        return HTP_OK;
+
+    if (!HTPNeedResponseDecompression(hstate)) {
+        SCLogDebug("not decompressing response body of tx %p", tx);
+        tx->response_content_encoding_processing = HTP_COMPRESSION_NONE;
+        (void) SC_ATOMIC_ADD(htp_decompress_skipped, 1);
+    }
+    return HTP_OK;
+}
+
 /**
  * \brief Function callback to append chunks for Responses
  * \param d pointer to the htp_tx_data_t structure (a chunk from htp lib)
@@ -1842,6 +1963,36 @@ int HTPCallbackResponseBodyData(htp_tx_data_t *d)
         tx_ud->operation = HTP_BODY_RESPONSE;
     }
 
+    /* budget used up part way this body: ignore what libhtp still had
+     * decompressed in its buffers */
+    if (tx_ud->tcflags & HTP_DECOMPRESS_STOPPED)
+        SCReturnInt(HTP_OK);
+
+    if (hstate->cfg->response_decompress_budget > 0 &&
+        (d->tx->response_content_encoding_processing == HTP_COMPRESSION_GZIP ||
+         d->tx->response_content_encoding_processing == HTP_COMPRESSION_DEFLATE))
+    {
+        hstate->decompressed += d->len;
+        if (hstate->decompressed > hstate->cfg->response_decompress_budget) {
+            SCLogDebug("flow used up its decompress budget, %"PRIu64" bytes",
+                    hstate->decompressed);
+            hstate->flags |= HTP_FLAG_DECOMPRESS_BUDGET;
+            tx_ud->tcflags |= HTP_DECOMPRESS_STOPPED;
+            /* no more inflating for the rest of this body */
+            d->tx->response_content_encoding_processing = HTP_COMPRESSION_NONE;
+            HTPSetEvent(hstate, tx_ud,
+                    HTTP_DECODER_EVENT_RESPONSE_DECOMPRESSION_BUDGET);
+            (void) SC_ATOMIC_ADD(htp_decompress_budget, 1);
+
+            if (tx_ud->tcflags & HTP_FILENAME_SET) {
+                SCLogDebug("closing file that was being stored");
+                (void)HTPFileClose(hstate, NULL, 0, FILE_TRUNCATED, STREAM_TOCLIENT);
+                tx_ud->tcflags &= ~HTP_FILENAME_SET;
+            }
+            SCReturnInt(HTP_OK);
+        }
+    }
+
     /* see if we can get rid of htp body chunks */
     HtpBodyPrune(hstate, &tx_ud->response_body, STREAM_TOCLIENT);
 
@@ -2054,6 +2205,10 @@ static int HTPCallbackRequestHeaderData(htp_tx_data_t *tx_data)
     if (tx_data->len == 0 || tx_data->tx == NULL)
         return HTP_OK;
 
+    /* nothing inspects the raw headers, don't keep a copy */
+    if (!(SC_ATOMIC_GET(htp_config_flags) & HTP_REQUIRE_HEADERS_RAW))
+        goto end;
+
     HtpTxUserData *tx_ud = htp_tx_get_user_data(tx_data->tx);
     if (tx_ud == NULL) {
         tx_ud = HTPMalloc(sizeof(*tx_ud));
@@ -2078,6 +2233,7 @@ static int HTPCallbackRequestHeaderData(htp_tx_data_t *tx_data)
            tx_data->data, tx_data->len);
     tx_ud->request_headers_raw_len += tx_data->len;
 
+end:
     if (tx_data->tx && tx_data->tx->flags) {
         HtpState *hstate = htp_connp_get_user_data(tx_data->tx->connp);
         HTPErrorCheckTxRequestFlags(hstate, tx_data->tx);
@@ -2091,6 +2247,9 @@ static int HTPCallbackResponseHeaderData(htp_tx_data_t *tx_data)
     if (tx_data->len == 0 || tx_data->tx == NULL)
         return HTP_OK;
 
+    if (!(SC_ATOMIC_GET(htp_config_flags) & HTP_REQUIRE_HEADERS_RAW))
+        return HTP_OK;
+
     HtpTxUserData *tx_ud = htp_tx_get_user_data(tx_data->tx);
     if (tx_ud == NULL) {
         tx_ud = HTPMalloc(sizeof(*tx_ud));
@@ -2130,6 +2289,8 @@ static void HTPConfigSetDefaultsPhase1(HTPCfgRec *cfg_prec)
     cfg_prec->request.inspect_window = HTP_CONFIG_DEFAULT_REQUEST_INSPECT_WINDOW;
     cfg_prec->response.inspect_min_size = HTP_CONFIG_DEFAULT_RESPONSE_INSPECT_MIN_SIZE;
     cfg_prec->response.inspect_window = HTP_CONFIG_DEFAULT_RESPONSE_INSPECT_WINDOW;
+    cfg_prec->response_decompress_lazy = 1;
+    cfg_prec->response_decompress_budget = 0;
 #ifndef AFLFUZZ_NO_RANDOM
     cfg_prec->randomize = HTP_CONFIG_DEFAULT_RANDOMIZE;
 #else
@@ -2140,6 +2301,7 @@ static void HTPConfigSetDefaultsPhase1(HTPCfgRec *cfg_prec)
     htp_config_register_request_header_data(cfg_prec->cfg, HTPCallbackRequestHeaderData);
     htp_config_register_request_trailer_data(cfg_prec->cfg, HTPCallbackRequestHeaderData);
     htp_config_register_response_header_data(cfg_prec->cfg, HTPCallbackResponseHeaderData);
+    htp_config_register_response_headers(cfg_prec->cfg, HTPCallbackResponseHeaders);
     htp_config_register_response_trailer_data(cfg_prec->cfg, HTPCallbackResponseHeaderData);
 
     htp_config_register_request_body_data(cfg_prec->cfg, HTPCallbackRequestBodyData);
@@ -2361,6 +2523,16 @@ static void HTPConfigParseParameters(HTPCfgRec *cfg_prec, ConfNode *s,
             SCLogWarning(SC_WARN_OUTDATED_LIBHTP, "can't set response-body-decompress-layer-limit "
                     "to %u, libhtp version too old", value);
 #endif
+        } else if (strcasecmp("response-body-decompress-lazy", p->name) == 0) {
+            cfg_prec->response_decompress_lazy = ConfValIsTrue(p->val);
+
+        } else if (strcasecmp("response-body-decompress-budget", p->name) == 0) {
+            if (ParseSizeStringU32(p->val, &cfg_prec->response_decompress_budget) < 0) {
+                SCLogError(SC_ERR_SIZE_PARSE, "Error parsing response-body-decompress-budget "
+                           "from conf file - %s.  Killing engine", p->val);
+                exit(EXIT_FAILURE);
+            }
+
         } else if (strcasecmp("path-convert-backslash-separators", p->name) == 0) {
             htp_config_set_backslash_convert_slashes(cfg_prec->cfg,
                                                      HTP_DECODER_URL_PATH,
@@ -2783,6 +2955,8 @@ void RegisterHTPParsers(void)
         AppLayerParserRegisterParser(IPPROTO_TCP, ALPROTO_HTTP, STREAM_TOCLIENT,
                                      HTPHandleResponseData);
         SC_ATOMIC_INIT(htp_config_flags);
+        SC_ATOMIC_INIT(htp_decompress_skipped);
+        SC_ATOMIC_INIT(htp_decompress_budget);
         AppLayerParserRegisterParserAcceptableDataDirection(IPPROTO_TCP, ALPROTO_HTTP, STREAM_TOSERVER);
         HTPConfigure();
     } else {
@@ -5672,6 +5846,38 @@ end:
     return result;
 }
 
+/** \test consecutive body data is merged into a single chunk until
+ *        it is logged */
+static int HTPBodyChunkMergeTest01(void)
+{
+    HtpBody body;
+    memset(&body, 0x00, sizeof(body));
+
+    uint8_t data1[] = "0123456789";
+    uint8_t data2[] = "abcdefghij";
+
+    FAIL_IF(HtpBodyAppendChunk(NULL, &body, data1, sizeof(data1)-1) != 0);
+    FAIL_IF(HtpBodyAppendChunk(NULL, &body, data2, sizeof(data2)-1) != 0);
+    FAIL_IF_NULL(body.first);
+    FAIL_IF(body.first != body.last);
+    FAIL_IF(body.content_len_so_far != 20);
+    FAIL_IF(StreamingBufferSegmentCompareRawData(body.sb, &body.first->sbseg,
+                (uint8_t *)"0123456789abcdefghij", 20) != 1);
+
+    /* logged chunks are left alone */
+    body.last->logged = 1;
+    FAIL_IF(HtpBodyAppendChunk(NULL, &body, data1, sizeof(data1)-1) != 0);
+    FAIL_IF(body.first == body.last);
+    FAIL_IF(body.first->next != body.last);
+    FAIL_IF(body.content_len_so_far != 30);
+    FAIL_IF(body.last->sbseg.stream_offset != 20);
+    FAIL_IF(StreamingBufferSegmentCompareRawData(body.sb, &body.last->sbseg,
+                data1, 10) != 1);
+
+    HtpBodyFree(&body);
+    PASS;
+}
+
 /** \test BG crash */
 static int HTPSegvTest01(void)
 {
@@ -6458,6 +6664,48 @@ end:
     return result;
 }
 
+/** \test lazy response decompression and the decompress budget flag */
+static int HTPDecompressLazyTest01(void)
+{
+    HTPCfgRec cfg;
+    HtpState hstate;
+    Flow f;
+
+    memset(&cfg, 0, sizeof(cfg));
+    memset(&hstate, 0, sizeof(hstate));
+    memset(&f, 0, sizeof(f));
+    hstate.cfg = &cfg;
+    hstate.f = &f;
+    cfg.response_decompress_lazy = 1;
+
+    uint32_t saved = SC_ATOMIC_GET(htp_config_flags);
+    SC_ATOMIC_SET(htp_config_flags, 0);
+
+    /* nothing needs the response body */
+    FAIL_IF(HTPNeedResponseDecompression(&hstate));
+
+    SC_ATOMIC_SET(htp_config_flags, HTP_REQUIRE_RESPONSE_BODY);
+    FAIL_IF_NOT(HTPNeedResponseDecompression(&hstate));
+
+    /* the rules of this flow don't look at the body */
+    f.flags |= FLOW_NO_RESPONSE_BODY;
+    FAIL_IF(HTPNeedResponseDecompression(&hstate));
+    cfg.response_decompress_lazy = 0;
+    FAIL_IF_NOT(HTPNeedResponseDecompression(&hstate));
+    cfg.response_decompress_lazy = 1;
+
+    /* an output needs it anyway */
+    SC_ATOMIC_OR(htp_config_flags, HTP_REQUIRE_RESPONSE_BODY_OUTPUT);
+    FAIL_IF_NOT(HTPNeedResponseDecompression(&hstate));
+
+    /* budget used up */
+    hstate.flags |= HTP_FLAG_DECOMPRESS_BUDGET;
+    FAIL_IF(HTPNeedResponseDecompression(&hstate));
+
+    SC_ATOMIC_SET(htp_config_flags, saved);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -6498,6 +6746,7 @@ void HTPParserRegisterTests(void)
     UtRegisterTest("HTPParserDecodingTest09", HTPParserDecodingTest09);
 
     UtRegisterTest("HTPBodyReassemblyTest01", HTPBodyReassemblyTest01);
+    UtRegisterTest("HTPBodyChunkMergeTest01", HTPBodyChunkMergeTest01);
 
     UtRegisterTest("HTPSegvTest01", HTPSegvTest01);
 
@@ -6507,6 +6756,7 @@ void HTPParserRegisterTests(void)
     UtRegisterTest("HTPParserTest17", HTPParserTest17);
     UtRegisterTest("HTPParserTest18", HTPParserTest18);
     UtRegisterTest("HTPParserTest19", HTPParserTest19);
+    UtRegisterTest("HTPDecompressLazyTest01", HTPDecompressLazyTest01);
 
     HTPFileParserRegisterTests();
     HTPXFFParserRegisterTests();
@@ -79,6 +79,8 @@
 #define HTP_FLAG_NEW_FILE_TX_TS     0x0400
 /** flag the state that a new file has been set in this tx */
 #define HTP_FLAG_NEW_FILE_TX_TC     0x0800
+/** the flow used up its response-body-decompress-budget */
+#define HTP_FLAG_DECOMPRESS_BUDGET  0x1000
 
 enum {
     HTP_BODY_NONE = 0,                  /**< Flag to indicate the current
@@ -131,6 +133,7 @@ enum {
     HTTP_DECODER_EVENT_MULTIPART_GENERIC_ERROR,
     HTTP_DECODER_EVENT_MULTIPART_NO_FILEDATA,
     HTTP_DECODER_EVENT_MULTIPART_INVALID_HEADER,
+    HTTP_DECODER_EVENT_RESPONSE_DECOMPRESSION_BUDGET,
 };
 
 #define HTP_PCRE_NONE           0x00    /**< No pcre executed yet */
@@ -159,6 +162,11 @@ typedef struct HTPCfgRec_ {
     int                 randomize_range;
     int                 http_body_inline;
 
+    /** skip decompression of response bodies no rule or output needs */
+    int                 response_decompress_lazy;
+    /** max decompressed response body bytes per flow, 0 for no limit */
+    uint32_t            response_decompress_budget;
+
     HTPCfgDir request;
     HTPCfgDir response;
 } HTPCfgRec;
@@ -191,6 +199,8 @@ typedef struct HtpBody_ {
 #define HTP_BOUNDARY_OPEN       0x04    /**< We have a boundary string */
 #define HTP_FILENAME_SET        0x08   /**< filename is registered in the flow */
 #define HTP_DONTSTORE           0x10    /**< not storing this file */
+#define HTP_DECOMPRESS_STOPPED  0x20    /**< rest of the response body is
+                                             not decompressed or used */
 
 #define HTP_TX_HAS_FILE             0x01
 #define HTP_TX_HAS_FILENAME         0x02    /**< filename is known at this time */
@@ -222,6 +232,17 @@ typedef struct HtpTxUserData_ {
     uint32_t request_headers_raw_len;
     uint32_t response_headers_raw_len;
 
+    /* http_header buffers built by the detection engine */
+    uint8_t *request_hhd_buffer;
+    uint8_t *response_hhd_buffer;
+    uint32_t request_hhd_buffer_len;
+    uint32_t response_hhd_buffer_len;
+    uint32_t request_hhd_buffer_size;
+    uint32_t response_hhd_buffer_size;
+    /* number of headers the buffers were built from */
+    uint32_t request_hhd_headers;
+    uint32_t response_hhd_headers;
+
     AppLayerDecoderEvents *decoder_events;          /**< per tx events */
 
     /** Holds the boundary identificator string if any (used on
@@ -257,6 +278,8 @@ typedef struct HtpState_ {
     uint16_t events;
     uint16_t htp_messages_offset; /**< offset into conn->messages list */
     uint64_t tx_with_detect_state_cnt;
+    /** decompressed response body bytes, for the decompress budget */
+    uint64_t decompressed;
 } HtpState;
 
 /** part of the engine needs the request body (e.g. http_client_body keyword) */
@@ -268,6 +291,11 @@ typedef struct HtpState_ {
 #define HTP_REQUIRE_REQUEST_FILE        (1 << 2)
 /** part of the engine needs the request body (e.g. file_data keyword) */
 #define HTP_REQUIRE_RESPONSE_BODY       (1 << 3)
+/** part of the engine needs the raw headers (e.g. http_raw_header keyword) */
+#define HTP_REQUIRE_HEADERS_RAW         (1 << 4)
+/** an output needs the response body of every flow (e.g. file logging),
+ *  not just of the flows with response body rules */
+#define HTP_REQUIRE_RESPONSE_BODY_OUTPUT (1 << 5)
 
 SC_ATOMIC_DECLARE(uint32_t, htp_config_flags);
 
@@ -287,6 +315,11 @@ void HTPStateFree(void *);
 void AppLayerHtpEnableRequestBodyCallback(void);
 void AppLayerHtpEnableResponseBodyCallback(void);
 void AppLayerHtpNeedFileInspection(void);
+void AppLayerHtpNeedRawHeaders(void);
+void AppLayerHtpNeedResponseBodyForOutput(void);
+void AppLayerHtpPrintProfile(void);
+uint64_t HTPDecompressSkippedGlobalCounter(void);
+uint64_t HTPDecompressBudgetGlobalCounter(void);
 void AppLayerHtpPrintStats(void);
 
 void HTPConfigure(void);
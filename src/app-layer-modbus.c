@@ -237,12 +237,23 @@ void *ModbusGetTx(void *alstate, uint64_t tx_id) {
     if (modbus->curr && modbus->curr->tx_num == tx_id + 1)
         return modbus->curr;
 
+    /* fast track: detection and logging ask for the tx in order, so
+     * try the one after the last tx we returned */
+    if (modbus->iter && modbus->iter->tx_num == tx_id) {
+        tx = TAILQ_NEXT(modbus->iter, next);
+        if (tx && tx->tx_num == tx_id + 1) {
+            modbus->iter = tx;
+            return tx;
+        }
+    }
+
     TAILQ_FOREACH(tx, &modbus->tx_list, next) {
         SCLogDebug("tx->tx_num %"PRIu64", tx_id %"PRIu64, tx->tx_num, (tx_id+1));
         if (tx->tx_num != (tx_id+1))
             continue;
 
         SCLogDebug("returning tx %p", tx);
+        modbus->iter = tx;
         return tx;
     }
 
@@ -268,6 +279,36 @@ uint64_t ModbusGetTxCnt(void *alstate) {
     return ((uint64_t) ((ModbusState *) alstate)->transaction_max);
 }
 
+/** \internal
+ *  \brief Add a request to the transactionId index of the state. Txs
+ *          are appended to the bucket so the oldest request is found first.
+ */
+static void ModbusTxIndexAdd(ModbusState *modbus, ModbusTransaction *tx) {
+    ModbusTransaction **p = &modbus->tx_index[tx->transactionId % MODBUS_TX_INDEX_SIZE];
+
+    while (*p != NULL)
+        p = &(*p)->index_next;
+
+    tx->index_next = NULL;
+    *p = tx;
+}
+
+/** \internal
+ *  \brief Remove a transaction from the transactionId index, if present.
+ */
+static void ModbusTxIndexRemove(ModbusState *modbus, ModbusTransaction *tx) {
+    ModbusTransaction **p = &modbus->tx_index[tx->transactionId % MODBUS_TX_INDEX_SIZE];
+
+    while (*p != NULL) {
+        if (*p == tx) {
+            *p = tx->index_next;
+            tx->index_next = NULL;
+            return;
+        }
+        p = &(*p)->index_next;
+    }
+}
+
 /** \internal
  *  \brief Find the Modbus Transaction in the state based on Transaction ID.
  *
@@ -280,21 +321,21 @@ static ModbusTransaction *ModbusTxFindByTransaction(const ModbusState   *modbus,
                                                     const uint16_t      transactionId) {
     ModbusTransaction *tx = NULL;
 
-    if (modbus->curr == NULL)
-        return NULL;
-
     /* fast path */
-    if ((modbus->curr->transactionId == transactionId)  &&
-        !(modbus->curr->replied)) {
+    if ((modbus->curr != NULL)                          &&
+        (modbus->curr->transactionId == transactionId)  &&
+        !(modbus->curr->replied))
         return modbus->curr;
-    /* slow path, iterate list */
-    } else {
-        TAILQ_FOREACH(tx, &modbus->tx_list, next) {
-            if ((tx->transactionId == transactionId)    &&
-                !(modbus->curr->replied))
-                return tx;
-        }
+
+    /* slow path, lookup the index bucket */
+    for (tx = modbus->tx_index[transactionId % MODBUS_TX_INDEX_SIZE];
+         tx != NULL;
+         tx = tx->index_next) {
+        if ((tx->transactionId == transactionId)    &&
+            !(tx->replied))
+            return tx;
     }
+
     /* not found */
     return NULL;
 }
@@ -372,6 +413,10 @@ void ModbusStateTxFree(void *state, uint64_t tx_id) {
 
         if (tx == modbus->curr)
             modbus->curr = NULL;
+        if (tx == modbus->iter)
+            modbus->iter = NULL;
+
+        ModbusTxIndexRemove(modbus, tx);
 
         if (tx->decoder_events != NULL) {
             if (tx->decoder_events->cnt <= modbus->events)
@@ -1281,6 +1326,7 @@ static int ModbusParseRequest(Flow                  *f,
         /* Store Transaction ID & PDU length */
         tx->transactionId   = header.transactionId;
         tx->length          = header.length;
+        ModbusTxIndexAdd(modbus, tx);
 
         /* Extract MODBUS PDU and fill Transaction Context */
         ModbusParseRequestPDU(tx, modbus, adu, adu_len);
@@ -1357,6 +1403,7 @@ static int ModbusParseResponse(Flow                 *f,
 
         /* Mark as completed */
         tx->replied = 1;
+        ModbusTxIndexRemove(modbus, tx);
 
         /* Update input line and remaining input length of the command */
         input       += adu_len;
@@ -3077,6 +3124,45 @@ end:
     UTHFreePackets(&p, 1);
     return result;
 }
+
+/** \test Lookup of outstanding requests by transactionId, including
+ *        ids sharing an index bucket and txs freed out of order. */
+static int ModbusParserTest17(void) {
+    ModbusState *modbus = ModbusStateAlloc();
+    FAIL_IF_NULL(modbus);
+
+    uint16_t ids[] = { 1, 1 + MODBUS_TX_INDEX_SIZE, 2, 1 };
+    ModbusTransaction *txs[4];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        txs[i] = ModbusTxAlloc(modbus);
+        FAIL_IF_NULL(txs[i]);
+        txs[i]->transactionId = ids[i];
+        ModbusTxIndexAdd(modbus, txs[i]);
+    }
+
+    /* oldest outstanding request wins on duplicate ids */
+    FAIL_IF(ModbusTxFindByTransaction(modbus, 1) != txs[0]);
+    FAIL_IF(ModbusTxFindByTransaction(modbus, 1 + MODBUS_TX_INDEX_SIZE) != txs[1]);
+    FAIL_IF(ModbusTxFindByTransaction(modbus, 2) != txs[2]);
+    FAIL_IF_NOT_NULL(ModbusTxFindByTransaction(modbus, 3));
+
+    /* replied requests are skipped */
+    txs[0]->replied = 1;
+    ModbusTxIndexRemove(modbus, txs[0]);
+    FAIL_IF(ModbusTxFindByTransaction(modbus, 1) != txs[3]);
+
+    /* free while 'curr' is gone, the rest stays reachable */
+    ModbusStateTxFree(modbus, txs[3]->tx_num - 1);
+    FAIL_IF_NOT_NULL(modbus->curr);
+    FAIL_IF_NOT_NULL(ModbusTxFindByTransaction(modbus, 1));
+    FAIL_IF(ModbusTxFindByTransaction(modbus, 1 + MODBUS_TX_INDEX_SIZE) != txs[1]);
+    FAIL_IF(ModbusTxFindByTransaction(modbus, 2) != txs[2]);
+
+    ModbusStateFree(modbus);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 void ModbusParserRegisterTests(void) {
@@ -3113,5 +3199,7 @@ void ModbusParserRegisterTests(void) {
                    ModbusParserTest15);
     UtRegisterTest("ModbusParserTest16 - Modbus invalid Write single register request",
                    ModbusParserTest16);
+    UtRegisterTest("ModbusParserTest17 - Modbus transactionId index",
+                   ModbusParserTest17);
 #endif /* UNITTESTS */
 }
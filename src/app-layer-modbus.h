@@ -81,6 +81,7 @@ enum {
 /* Modbus Transaction Structure, request/response. */
 typedef struct ModbusTransaction_ {
     struct ModbusState_ *modbus;
+    struct ModbusTransaction_ *index_next;  /**< next tx in the same index bucket */
 
     uint64_t    tx_num;         /**< internal: id */
     uint32_t    logged;         /**< flags indicating which loggers have logged */
@@ -115,9 +116,14 @@ typedef struct ModbusTransaction_ {
 } ModbusTransaction;
 
 /* Modbus State Structure. */
+/* buckets of the per state index of unreplied requests */
+#define MODBUS_TX_INDEX_SIZE    32
+
 typedef struct ModbusState_ {
     TAILQ_HEAD(, ModbusTransaction_)    tx_list;    /**< transaction list */
     ModbusTransaction                   *curr;      /**< ptr to current tx */
+    ModbusTransaction                   *iter;      /**< last tx returned by GetTx */
+    ModbusTransaction                   *tx_index[MODBUS_TX_INDEX_SIZE]; /**< unreplied requests by transactionId */
     uint64_t                            transaction_max;
     uint32_t                            unreplied_cnt;  /**< number of unreplied requests */
     uint16_t                            events;
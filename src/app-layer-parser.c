@@ -53,15 +53,18 @@
 #include "app-layer-htp.h"
 #include "app-layer-ftp.h"
 #include "app-layer-ssl.h"
+#include "app-layer-tls-handshake.h"
 #include "app-layer-ssh.h"
 #include "app-layer-smtp.h"
 #include "app-layer-dns-udp.h"
 #include "app-layer-dns-tcp.h"
 #include "app-layer-modbus.h"
 #include "app-layer-template.h"
+#include "app-layer-expectation.h"
 
 #include "conf.h"
 #include "util-spm.h"
+#include "util-misc.h"
 
 #include "util-debug.h"
 #include "decode-events.h"
@@ -70,10 +73,22 @@
 
 #include "runmodes.h"
 
+#if defined(HAVE_MALLINFO2) || defined(HAVE_MALLINFO)
+#include <malloc.h>
+#endif
+
 static GetActiveTxIdFunc AppLayerGetActiveTxIdFuncPtr = NULL;
 
 struct AppLayerParserThreadCtx_ {
     void *alproto_local_storage[FLOW_PROTO_MAX][ALPROTO_MAX];
+
+    /* state memory accounted by this thread, per protocol. Can go negative
+     * as states grown by one thread may be shrunk by another one. */
+    int64_t memuse[ALPROTO_MAX];
+    uint64_t memcap_hits;
+
+    /** list of all thread ctxs, for the stats thread to sum up */
+    struct AppLayerParserThreadCtx_ *next;
 };
 
 
@@ -114,6 +129,16 @@ typedef struct AppLayerParserProtoCtx_
     DetectEngineState *(*GetTxDetectState)(void *tx);
     int (*SetTxDetectState)(void *alstate, void *tx, DetectEngineState *);
 
+    uint64_t (*StateGetMemuse)(void *alstate);
+    /** per flow memory budget, 0 for unlimited */
+    uint64_t flow_memcap;
+    uint8_t flow_memcap_policy;
+
+    /** reassembly depth for flows of this protocol, 0 for unlimited. Only
+     *  used if stream_depth_set, otherwise stream.reassembly.depth is kept */
+    uint32_t stream_depth;
+    char stream_depth_set;
+
     /* Indicates the direction the parser is ready to see the data
      * the first time for a flow.  Values accepted -
      * STREAM_TOSERVER, STREAM_TOCLIENT */
@@ -140,6 +165,14 @@ struct AppLayerParserState_ {
      * we don't need a var per direction since we don't log a transaction
      * unless we have the entire transaction. */
     uint64_t log_id;
+    /* Set when the state was updated after the tx loggers last ran over
+     * it, with the disruption flags they saw per direction. Without an
+     * update or new disruptions no tx can have become ready to log. */
+    uint8_t log_pending;
+    uint8_t log_disruption[2];
+
+    /* State memory as last reported by the parser. */
+    uint64_t memuse;
 
     /* Used to store decoder events. */
     AppLayerDecoderEvents *decoder_events;
@@ -149,6 +182,16 @@ struct AppLayerParserState_ {
  * Post 2.0 let's look at changing this to move it out to app-layer.c. */
 static AppLayerParserCtx alp_ctx;
 
+/* Memory accounting. Workers only touch their own thread ctx, the lock
+ * protects the list of thread ctxs and the totals of ctxs/states that
+ * are gone already. */
+static SCMutex alp_mem_lock = SCMUTEX_INITIALIZER;
+static AppLayerParserThreadCtx *alp_mem_threads = NULL;
+static int64_t alp_mem_retired[ALPROTO_MAX];
+static uint64_t alp_memcap_hits_retired = 0;
+
+static void AppLayerParserStreamDepthConfig(AppProto alproto);
+
 AppLayerParserState *AppLayerParserStateAlloc(void)
 {
     SCEnter();
@@ -157,6 +200,7 @@ AppLayerParserState *AppLayerParserStateAlloc(void)
     if (pstate == NULL)
         goto end;
     memset(pstate, 0, sizeof(*pstate));
+    pstate->log_pending = 1;
 
  end:
     SCReturnPtr(pstate, "AppLayerParserState");
@@ -178,6 +222,7 @@ int AppLayerParserSetup(void)
     SCEnter();
 
     memset(&alp_ctx, 0, sizeof(alp_ctx));
+    AppLayerExpectationSetup();
 
     /* set the default tx handler if none was set explicitly */
     if (AppLayerGetActiveTxIdFuncPtr == NULL) {
@@ -192,6 +237,7 @@ int AppLayerParserDeSetup(void)
     SCEnter();
 
     SMTPParserCleanup();
+    TLSCertCacheFree();
 
     SCReturnInt(0);
 }
@@ -218,6 +264,11 @@ AppLayerParserThreadCtx *AppLayerParserThreadCtxAlloc(void)
         }
     }
 
+    SCMutexLock(&alp_mem_lock);
+    tctx->next = alp_mem_threads;
+    alp_mem_threads = tctx;
+    SCMutexUnlock(&alp_mem_lock);
+
  end:
     SCReturnPtr(tctx, "void *");
 }
@@ -238,6 +289,20 @@ void AppLayerParserThreadCtxFree(AppLayerParserThreadCtx *tctx)
         }
     }
 
+    SCMutexLock(&alp_mem_lock);
+    AppLayerParserThreadCtx **t = &alp_mem_threads;
+    while (*t != NULL) {
+        if (*t == tctx) {
+            *t = tctx->next;
+            break;
+        }
+        t = &(*t)->next;
+    }
+    for (alproto = 0; alproto < ALPROTO_MAX; alproto++)
+        alp_mem_retired[alproto] += tctx->memuse[alproto];
+    alp_memcap_hits_retired += tctx->memcap_hits;
+    SCMutexUnlock(&alp_mem_lock);
+
     SCFree(tctx);
     SCReturn;
 }
@@ -316,6 +381,9 @@ int AppLayerParserRegisterParser(uint8_t ipproto, AppProto alproto,
     alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].
         Parser[(direction & STREAM_TOSERVER) ? 0 : 1] = Parser;
 
+    if (ipproto == IPPROTO_TCP)
+        AppLayerParserStreamDepthConfig(alproto);
+
     SCReturnInt(0);
 }
 
@@ -506,6 +574,149 @@ void AppLayerParserRegisterDetectStateFuncs(uint8_t ipproto, AppProto alproto,
     SCReturn;
 }
 
+/**
+ *  \brief register the function returning the memory used by a state
+ *
+ *  Enables the memory accounting for the protocol. The per flow budget
+ *  is read from app-layer.protocols.<proto>.flow-memcap, with
+ *  flow-memcap-policy 'evict' (default) to free the oldest transactions
+ *  or 'stop' to stop parsing the flow once the budget is exceeded.
+ */
+void AppLayerParserRegisterGetStateMemuseFunc(uint8_t ipproto, AppProto alproto,
+        uint64_t (*StateGetMemuse)(void *alstate))
+{
+    SCEnter();
+
+    AppLayerParserProtoCtx *ctx = &alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto];
+    ctx->StateGetMemuse = StateGetMemuse;
+    ctx->flow_memcap = 0;
+    ctx->flow_memcap_policy = APP_LAYER_MEMCAP_POLICY_EVICT;
+
+    char param[100];
+    char *str = NULL;
+    snprintf(param, sizeof(param), "app-layer.protocols.%s.flow-memcap",
+            AppLayerGetProtoName(alproto));
+    if (ConfGet(param, &str) == 1 && str != NULL) {
+        if (ParseSizeStringU64(str, &ctx->flow_memcap) < 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value for %s: %s, "
+                    "disabling the per flow memcap", param, str);
+            ctx->flow_memcap = 0;
+        }
+    }
+
+    str = NULL;
+    snprintf(param, sizeof(param), "app-layer.protocols.%s.flow-memcap-policy",
+            AppLayerGetProtoName(alproto));
+    if (ConfGet(param, &str) == 1 && str != NULL) {
+        if (strcasecmp(str, "stop") == 0) {
+            ctx->flow_memcap_policy = APP_LAYER_MEMCAP_POLICY_STOP;
+        } else if (strcasecmp(str, "evict") != 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value for %s: %s, "
+                    "using 'evict'", param, str);
+        }
+    }
+
+    if (ctx->flow_memcap != 0) {
+        SCLogConfig("%s: per flow memcap %"PRIu64" bytes, policy %s",
+                AppLayerGetProtoName(alproto), ctx->flow_memcap,
+                ctx->flow_memcap_policy == APP_LAYER_MEMCAP_POLICY_STOP ?
+                "stop" : "evict");
+    }
+
+    SCReturn;
+}
+
+/**
+ *  \brief set the reassembly depth for flows of a protocol
+ *
+ *  Applied when the protocol is detected, overriding stream.reassembly.depth.
+ *
+ *  \param stream_depth depth in bytes, 0 for unlimited
+ */
+void AppLayerParserSetStreamDepth(uint8_t ipproto, AppProto alproto,
+        uint32_t stream_depth)
+{
+    SCEnter();
+
+    AppLayerParserProtoCtx *ctx = &alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto];
+    ctx->stream_depth = stream_depth;
+    ctx->stream_depth_set = 1;
+
+    SCReturn;
+}
+
+/**
+ *  \brief get the reassembly depth for flows of a protocol
+ *
+ *  \retval 1 if set, the depth is in 'stream_depth'
+ *  \retval 0 if not set, for stream.reassembly.depth
+ */
+int AppLayerParserGetStreamDepth(uint8_t ipproto, AppProto alproto,
+        uint32_t *stream_depth)
+{
+    AppLayerParserProtoCtx *ctx = &alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto];
+    if (!ctx->stream_depth_set)
+        return 0;
+    *stream_depth = ctx->stream_depth;
+    return 1;
+}
+
+/** \internal
+ *  \brief read app-layer.protocols.<proto>.stream-depth */
+static void AppLayerParserStreamDepthConfig(AppProto alproto)
+{
+    char param[100];
+    char *str = NULL;
+    uint32_t stream_depth = 0;
+
+    snprintf(param, sizeof(param), "app-layer.protocols.%s.stream-depth",
+            AppLayerGetProtoName(alproto));
+    if (ConfGet(param, &str) != 1 || str == NULL)
+        return;
+
+    if (ParseSizeStringU32(str, &stream_depth) < 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value for %s: %s, "
+                "using stream.reassembly.depth", param, str);
+        return;
+    }
+    AppLayerParserSetStreamDepth(IPPROTO_TCP, alproto, stream_depth);
+    SCLogConfig("%s: stream reassembly depth %"PRIu32,
+            AppLayerGetProtoName(alproto), stream_depth);
+}
+
+/** \brief memory used by the states of a protocol, summed over all threads */
+uint64_t AppLayerParserGetMemuse(AppProto alproto)
+{
+    SCMutexLock(&alp_mem_lock);
+    int64_t memuse = alp_mem_retired[alproto];
+    AppLayerParserThreadCtx *t;
+    for (t = alp_mem_threads; t != NULL; t = t->next)
+        memuse += t->memuse[alproto];
+    SCMutexUnlock(&alp_mem_lock);
+
+    return (memuse > 0) ? (uint64_t)memuse : 0;
+}
+
+uint64_t AppLayerParserMemuseGlobalCounter(void)
+{
+    uint64_t memuse = 0;
+    AppProto alproto;
+    for (alproto = 0; alproto < ALPROTO_MAX; alproto++)
+        memuse += AppLayerParserGetMemuse(alproto);
+    return memuse;
+}
+
+uint64_t AppLayerParserMemcapGlobalCounter(void)
+{
+    SCMutexLock(&alp_mem_lock);
+    uint64_t hits = alp_memcap_hits_retired;
+    AppLayerParserThreadCtx *t;
+    for (t = alp_mem_threads; t != NULL; t = t->next)
+        hits += t->memcap_hits;
+    SCMutexUnlock(&alp_mem_lock);
+    return hits;
+}
+
 /***** Get and transaction functions *****/
 
 void *AppLayerParserGetProtocolParserLocalStorage(uint8_t ipproto, AppProto alproto)
@@ -584,6 +795,35 @@ void AppLayerParserSetTransactionLogId(AppLayerParserState *pstate)
     SCReturn;
 }
 
+/** \brief check if the tx loggers need to run over the state again
+ *
+ *  \param ts_disruption FlowGetDisruptionFlags() for the toserver side
+ *  \param tc_disruption FlowGetDisruptionFlags() for the toclient side
+ *
+ *  \retval 1 the state was updated or the disruption flags changed since
+ *          AppLayerParserSetTxLogDone(), 0 otherwise
+ */
+int AppLayerParserTxLogPending(const AppLayerParserState *pstate,
+        uint8_t ts_disruption, uint8_t tc_disruption)
+{
+    if (pstate == NULL)
+        return 1;
+    return (pstate->log_pending ||
+            pstate->log_disruption[0] != ts_disruption ||
+            pstate->log_disruption[1] != tc_disruption);
+}
+
+/** \brief tx loggers ran over all ready transactions of the state */
+void AppLayerParserSetTxLogDone(AppLayerParserState *pstate,
+        uint8_t ts_disruption, uint8_t tc_disruption)
+{
+    if (pstate == NULL)
+        return;
+    pstate->log_pending = 0;
+    pstate->log_disruption[0] = ts_disruption;
+    pstate->log_disruption[1] = tc_disruption;
+}
+
 uint64_t AppLayerParserGetTransactionInspectId(AppLayerParserState *pstate, uint8_t direction)
 {
     SCEnter();
@@ -897,6 +1137,62 @@ int AppLayerParserSetTxDetectState(uint8_t ipproto, AppProto alproto,
     SCReturnInt(r);
 }
 
+/***** Memory accounting *****/
+
+/** \internal
+ *  \brief enforce the per flow memcap of the protocol
+ *
+ *  With the 'evict' policy all but the newest transaction are given up on:
+ *  detection and logging skip them and they are freed right away.
+ */
+static void AppLayerParserMemcapCheck(AppLayerParserThreadCtx *tctx, Flow *f,
+        AppLayerParserProtoCtx *p, AppLayerParserState *pstate, void *alstate)
+{
+    if (p->flow_memcap == 0 || p->StateGetMemuse(alstate) <= p->flow_memcap)
+        return;
+
+    tctx->memcap_hits++;
+
+    if (p->flow_memcap_policy == APP_LAYER_MEMCAP_POLICY_STOP) {
+        SCLogDebug("flow %p exceeds the %s flow memcap, stop parsing",
+                f, AppLayerGetProtoName(f->alproto));
+        AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_INSPECTION);
+        return;
+    }
+
+    uint64_t total_txs = p->StateGetTxCnt(alstate);
+    if (total_txs < 2 || p->StateTransactionFree == NULL)
+        return;
+
+    uint64_t tx_id_ts = AppLayerTransactionGetActive(f, STREAM_TOSERVER);
+    uint64_t tx_id_tc = AppLayerTransactionGetActive(f, STREAM_TOCLIENT);
+    uint64_t tx_id = MIN(tx_id_ts, tx_id_tc);
+    uint64_t keep = total_txs - 1;
+
+    SCLogDebug("flow %p exceeds the %s flow memcap, evicting txs %"PRIu64
+            " to %"PRIu64, f, AppLayerGetProtoName(f->alproto), tx_id, keep);
+
+    if (pstate->inspect_id[0] < keep)
+        pstate->inspect_id[0] = keep;
+    if (pstate->inspect_id[1] < keep)
+        pstate->inspect_id[1] = keep;
+    if (pstate->log_id < keep)
+        pstate->log_id = keep;
+
+    for ( ; tx_id < keep; tx_id++)
+        p->StateTransactionFree(alstate, tx_id);
+}
+
+/** \internal
+ *  \brief account the change in state memory to this thread */
+static void AppLayerParserMemuseUpdate(AppLayerParserThreadCtx *tctx, Flow *f,
+        AppLayerParserProtoCtx *p, AppLayerParserState *pstate, void *alstate)
+{
+    uint64_t memuse = p->StateGetMemuse(alstate);
+    tctx->memuse[f->alproto] += (int64_t)memuse - (int64_t)pstate->memuse;
+    pstate->memuse = memuse;
+}
+
 /***** General *****/
 
 int AppLayerParserParse(AppLayerParserThreadCtx *alp_tctx, Flow *f, AppProto alproto,
@@ -932,6 +1228,7 @@ int AppLayerParserParse(AppLayerParserThreadCtx *alp_tctx, Flow *f, AppProto alp
             goto error;
     }
     pstate->version++;
+    pstate->log_pending = 1;
     SCLogDebug("app layer parser state version incremented to %"PRIu8,
                pstate->version);
 
@@ -961,6 +1258,9 @@ int AppLayerParserParse(AppLayerParserThreadCtx *alp_tctx, Flow *f, AppProto alp
         }
     }
 
+    if (p->StateGetMemuse != NULL)
+        AppLayerParserMemcapCheck(alp_tctx, f, p, pstate, alstate);
+
     /* set the packets to no inspection and reassembly if required */
     if (pstate->flags & APP_LAYER_PARSER_NO_INSPECTION) {
         AppLayerParserSetEOF(pstate);
@@ -1000,6 +1300,9 @@ int AppLayerParserParse(AppLayerParserThreadCtx *alp_tctx, Flow *f, AppProto alp
     /* next, see if we can get rid of transactions now */
     AppLayerParserTransactionsCleanup(f);
 
+    if (p->StateGetMemuse != NULL)
+        AppLayerParserMemuseUpdate(alp_tctx, f, p, pstate, alstate);
+
     /* stream truncated, inform app layer */
     if (flags & STREAM_DEPTH)
         AppLayerParserStreamTruncated(f->proto, alproto, alstate, flags);
@@ -1027,6 +1330,7 @@ void AppLayerParserSetEOF(AppLayerParserState *pstate)
     /* increase version so we will inspect it one more time
      * with the EOF flags now set */
     pstate->version++;
+    pstate->log_pending = 1;
 
  end:
     SCReturn;
@@ -1140,8 +1444,16 @@ void AppLayerParserStateCleanup(uint8_t ipproto, AppProto alproto, void *alstate
         ctx->StateFree(alstate);
 
     /* free the app layer parser api state */
-    if (pstate != NULL)
+    if (pstate != NULL) {
+        /* states are usually freed by the flow manager, so there is
+         * no thread ctx to account this to */
+        if (pstate->memuse != 0) {
+            SCMutexLock(&alp_mem_lock);
+            alp_mem_retired[alproto] -= (int64_t)pstate->memuse;
+            SCMutexUnlock(&alp_mem_lock);
+        }
         AppLayerParserStateFree(pstate);
+    }
 
     SCReturn;
 }
@@ -1246,6 +1558,221 @@ void AppLayerParserStatePrintDetails(AppLayerParserState *pstate)
 }
 #endif
 
+/** \internal
+ *  \brief read a whole stream file into memory
+ *
+ *  \retval 0 ok, or no file given
+ *  \retval -1 error
+ */
+static int AppLayerParserBenchLoadFile(const char *filename,
+        uint8_t **buf, uint32_t *len)
+{
+    *buf = NULL;
+    *len = 0;
+
+    if (filename == NULL)
+        return 0;
+
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", filename,
+                strerror(errno));
+        return -1;
+    }
+
+    uint8_t chunk[4096];
+    size_t r;
+    while ((r = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        uint8_t *ptmp = SCRealloc(*buf, *len + r);
+        if (ptmp == NULL) {
+            SCFree(*buf);
+            *buf = NULL;
+            fclose(fp);
+            return -1;
+        }
+        *buf = ptmp;
+        memcpy(*buf + *len, chunk, r);
+        *len += r;
+    }
+    fclose(fp);
+    return 0;
+}
+
+/** \internal
+ *  \brief heap in use, used to get the peak memory of the states
+ */
+static uint64_t AppLayerParserBenchHeapInUse(void)
+{
+#if defined(HAVE_MALLINFO2)
+    struct mallinfo2 mi = mallinfo2();
+    return (uint64_t)mi.uordblks;
+#elif defined(HAVE_MALLINFO)
+    struct mallinfo mi = mallinfo();
+    return (uint64_t)(unsigned int)mi.uordblks;
+#else
+    return 0;
+#endif
+}
+
+/** \internal
+ *  \brief feed a stream through the parser in chunk_size pieces
+ */
+static void AppLayerParserBenchFeed(AppLayerParserThreadCtx *alp_tctx,
+        Flow *f, AppProto alproto, uint8_t direction,
+        uint8_t *data, uint32_t data_len, uint32_t chunk_size,
+        uint64_t heap_start, uint64_t *heap_peak)
+{
+    uint32_t offset = 0;
+    while (offset < data_len) {
+        uint32_t len = data_len - offset;
+        if (len > chunk_size)
+            len = chunk_size;
+
+        uint8_t flags = direction;
+        if (offset == 0)
+            flags |= STREAM_START;
+        if (offset + len == data_len)
+            flags |= STREAM_EOF;
+
+        (void)AppLayerParserParse(alp_tctx, f, alproto, flags,
+                data + offset, len);
+        offset += len;
+
+        uint64_t heap = AppLayerParserBenchHeapInUse();
+        if (heap > heap_start && heap - heap_start > *heap_peak)
+            *heap_peak = heap - heap_start;
+    }
+}
+
+/**
+ *  \brief benchmark a parser on reassembled stream data
+ *
+ *  Uses the applayer-bench.* settings from the command line. The toserver
+ *  stream is fed in full before the toclient stream, which is how
+ *  pipelined requests look to the parsers. Every round uses a fresh flow.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int AppLayerParserBench(void)
+{
+    char *proto_name = NULL;
+    char *ts_file = NULL;
+    char *tc_file = NULL;
+    intmax_t chunk_size = 1460;
+    intmax_t rounds = 100;
+    uint8_t *ts_buf = NULL, *tc_buf = NULL;
+    uint32_t ts_len = 0, tc_len = 0;
+    int result = -1;
+
+    (void)ConfGet("applayer-bench.proto", &proto_name);
+    (void)ConfGet("applayer-bench.toserver", &ts_file);
+    (void)ConfGet("applayer-bench.toclient", &tc_file);
+    (void)ConfGetInt("applayer-bench.chunk-size", &chunk_size);
+    (void)ConfGetInt("applayer-bench.rounds", &rounds);
+
+    AppProto alproto = ALPROTO_UNKNOWN;
+    if (proto_name != NULL)
+        alproto = AppLayerGetProtoByName(proto_name);
+    if (alproto == ALPROTO_UNKNOWN) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "unknown app-layer protocol "
+                "'%s', see --list-app-layer-protos", proto_name ? proto_name : "");
+        return -1;
+    }
+    if (chunk_size <= 0 || chunk_size > UINT32_MAX || rounds <= 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid chunk size or rounds");
+        return -1;
+    }
+
+    /* use the tcp parser, fall back to udp for udp only protocols */
+    uint8_t ipproto = IPPROTO_TCP;
+    if (alp_ctx.ctxs[FlowGetProtoMapping(IPPROTO_TCP)][alproto].StateAlloc == NULL)
+        ipproto = IPPROTO_UDP;
+    if (alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].StateAlloc == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "no parser enabled for %s",
+                proto_name);
+        return -1;
+    }
+
+    if (AppLayerParserBenchLoadFile(ts_file, &ts_buf, &ts_len) != 0 ||
+        AppLayerParserBenchLoadFile(tc_file, &tc_buf, &tc_len) != 0)
+        goto end;
+    if (ts_len == 0 && tc_len == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "no stream data, use "
+                "--applayer-bench-ts and/or --applayer-bench-tc");
+        goto end;
+    }
+
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    if (alp_tctx == NULL)
+        goto end;
+
+    uint64_t txs = 0;
+    uint64_t heap_peak = 0;
+    struct timeval start, stop;
+    gettimeofday(&start, NULL);
+
+    intmax_t n;
+    for (n = 0; n < rounds; n++) {
+        TcpSession ssn;
+        memset(&ssn, 0, sizeof(ssn));
+
+        Flow *f = SCCalloc(1, sizeof(Flow));
+        if (f == NULL)
+            break;
+        FLOW_INITIALIZE(f);
+        f->flags |= FLOW_IPV4;
+        f->src.addr_data32[0] = 0x01020304;
+        f->dst.addr_data32[0] = 0x05060708;
+        f->sp = 10000;
+        f->dp = 80;
+        f->proto = ipproto;
+        f->protomap = FlowGetProtoMapping(ipproto);
+        if (ipproto == IPPROTO_TCP)
+            f->protoctx = &ssn;
+        f->alproto = alproto;
+
+        uint64_t heap_start = AppLayerParserBenchHeapInUse();
+        AppLayerParserBenchFeed(alp_tctx, f, alproto, STREAM_TOSERVER,
+                ts_buf, ts_len, (uint32_t)chunk_size, heap_start, &heap_peak);
+        AppLayerParserBenchFeed(alp_tctx, f, alproto, STREAM_TOCLIENT,
+                tc_buf, tc_len, (uint32_t)chunk_size, heap_start, &heap_peak);
+
+        if (f->alstate != NULL)
+            txs += AppLayerParserGetTxCnt(ipproto, alproto, f->alstate);
+
+        FlowFree(f);
+    }
+
+    gettimeofday(&stop, NULL);
+    AppLayerParserThreadCtxFree(alp_tctx);
+
+    uint64_t usecs = (uint64_t)(stop.tv_sec - start.tv_sec) * 1000000 +
+                     (stop.tv_usec - start.tv_usec);
+    uint64_t bytes = ((uint64_t)ts_len + tc_len) * (uint64_t)n;
+    if (usecs == 0)
+        usecs = 1;
+    if (n == 0)
+        goto end;
+
+    printf("app-layer bench: %s, %"PRIdMAX" rounds of %"PRIu32"/%"PRIu32
+           " bytes (toserver/toclient) in %"PRIdMAX" byte chunks\n",
+           proto_name, n, ts_len, tc_len, chunk_size);
+    printf("  time:        %"PRIu64" ms\n", usecs / 1000);
+    printf("  throughput:  %.2f MB/s\n", (double)bytes / (double)usecs);
+    printf("  txs/round:   %"PRIu64"\n", txs / (uint64_t)n);
+#if defined(HAVE_MALLINFO2) || defined(HAVE_MALLINFO)
+    printf("  peak state memory: %"PRIu64" bytes\n", heap_peak);
+#endif
+    result = 0;
+end:
+    if (ts_buf != NULL)
+        SCFree(ts_buf);
+    if (tc_buf != NULL)
+        SCFree(tc_buf);
+    return result;
+}
+
 #ifdef AFLFUZZ_APPLAYER
 int AppLayerParserRequestFromFile(AppProto alproto, char *filename)
 {
@@ -1575,6 +2102,141 @@ static int AppLayerParserTest02(void)
     return result;
 }
 
+typedef struct TestMemState_ {
+    uint64_t tx_cnt;
+    uint64_t memuse;
+    uint8_t freed[8];
+} TestMemState;
+
+/** \brief test parser adding a 100 byte tx for each chunk of data */
+static int TestMemProtocolParser(Flow *f, void *state, AppLayerParserState *pstate,
+                                 uint8_t *input, uint32_t input_len,
+                                 void *local_data)
+{
+    TestMemState *s = state;
+    if (s->tx_cnt < sizeof(s->freed)) {
+        s->tx_cnt++;
+        s->memuse += 100;
+    }
+    return 0;
+}
+
+static void *TestMemProtocolStateAlloc(void)
+{
+    return SCCalloc(1, sizeof(TestMemState));
+}
+
+static void TestMemProtocolTxFree(void *state, uint64_t tx_id)
+{
+    TestMemState *s = state;
+    if (tx_id < s->tx_cnt && !s->freed[tx_id]) {
+        s->freed[tx_id] = 1;
+        s->memuse -= 100;
+    }
+}
+
+static uint64_t TestMemProtocolGetTxCnt(void *state)
+{
+    return ((TestMemState *)state)->tx_cnt;
+}
+
+static uint64_t TestMemProtocolGetMemuse(void *state)
+{
+    return ((TestMemState *)state)->memuse;
+}
+
+/**
+ * \test memory accounting and the 'evict' flow memcap policy
+ */
+static int AppLayerParserTest03(void)
+{
+    AppLayerParserBackupParserTable();
+
+    uint8_t testbuf[] = { 0x11 };
+    TcpSession ssn;
+    memset(&ssn, 0, sizeof(ssn));
+
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    AppLayerParserRegisterParser(IPPROTO_TCP, ALPROTO_TEST, STREAM_TOSERVER,
+                      TestMemProtocolParser);
+    AppLayerParserRegisterStateFuncs(IPPROTO_TCP, ALPROTO_TEST,
+                          TestMemProtocolStateAlloc, TestProtocolStateFree);
+    AppLayerParserRegisterTxFreeFunc(IPPROTO_TCP, ALPROTO_TEST,
+                          TestMemProtocolTxFree);
+    AppLayerParserRegisterGetTxCnt(IPPROTO_TCP, ALPROTO_TEST,
+                          TestMemProtocolGetTxCnt);
+    AppLayerParserRegisterGetStateMemuseFunc(IPPROTO_TCP, ALPROTO_TEST,
+                          TestMemProtocolGetMemuse);
+    alp_ctx.ctxs[FLOW_PROTO_TCP][ALPROTO_TEST].flow_memcap = 250;
+
+    Flow *f = UTHBuildFlow(AF_INET, "1.2.3.4", "4.3.2.1", 20, 40);
+    FAIL_IF_NULL(f);
+    f->protoctx = &ssn;
+    f->alproto = ALPROTO_TEST;
+    f->proto = IPPROTO_TCP;
+    f->protomap = FlowGetProtoMapping(f->proto);
+
+    StreamTcpInitConfig(TRUE);
+
+    int i;
+    for (i = 0; i < 2; i++) {
+        FAIL_IF(AppLayerParserParse(alp_tctx, f, ALPROTO_TEST, STREAM_TOSERVER,
+                    testbuf, sizeof(testbuf)) != 0);
+    }
+    FAIL_IF(AppLayerParserGetMemuse(ALPROTO_TEST) != 200);
+    FAIL_IF(alp_tctx->memcap_hits != 0);
+
+    /* third tx goes over the budget, all but the last one get evicted */
+    FAIL_IF(AppLayerParserParse(alp_tctx, f, ALPROTO_TEST, STREAM_TOSERVER,
+                testbuf, sizeof(testbuf)) != 0);
+    TestMemState *s = f->alstate;
+    FAIL_IF(alp_tctx->memcap_hits != 1);
+    FAIL_IF(!s->freed[0] || !s->freed[1] || s->freed[2]);
+    FAIL_IF(f->alparser->inspect_id[0] != 2);
+    FAIL_IF(AppLayerParserGetMemuse(ALPROTO_TEST) != 100);
+
+    AppLayerParserStateCleanup(f->proto, f->alproto, f->alstate, f->alparser);
+    f->alstate = NULL;
+    f->alparser = NULL;
+    FAIL_IF(AppLayerParserGetMemuse(ALPROTO_TEST) != 0);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    AppLayerParserRestoreParserTable();
+    StreamTcpFreeConfig(TRUE);
+    UTHFreeFlow(f);
+    PASS;
+}
+
+/**
+ * \test the tx loggers only need to run after a state update or a change
+ *       of the disruption flags
+ */
+static int AppLayerParserTest04(void)
+{
+    AppLayerParserState *pstate = AppLayerParserStateAlloc();
+    FAIL_IF_NULL(pstate);
+
+    /* new state: never logged */
+    FAIL_IF_NOT(AppLayerParserTxLogPending(pstate, STREAM_TOSERVER, STREAM_TOCLIENT));
+    AppLayerParserSetTxLogDone(pstate, STREAM_TOSERVER, STREAM_TOCLIENT);
+    FAIL_IF(AppLayerParserTxLogPending(pstate, STREAM_TOSERVER, STREAM_TOCLIENT));
+
+    /* a gap on one side can complete txs without an update */
+    FAIL_IF_NOT(AppLayerParserTxLogPending(pstate, STREAM_TOSERVER|STREAM_GAP,
+                STREAM_TOCLIENT));
+    AppLayerParserSetTxLogDone(pstate, STREAM_TOSERVER|STREAM_GAP, STREAM_TOCLIENT);
+    FAIL_IF(AppLayerParserTxLogPending(pstate, STREAM_TOSERVER|STREAM_GAP,
+                STREAM_TOCLIENT));
+
+    AppLayerParserSetEOF(pstate);
+    FAIL_IF_NOT(AppLayerParserTxLogPending(pstate, STREAM_TOSERVER|STREAM_GAP,
+                STREAM_TOCLIENT));
+
+    AppLayerParserStateFree(pstate);
+    PASS;
+}
 
 void AppLayerParserRegisterUnittests(void)
 {
@@ -1595,6 +2257,8 @@ void AppLayerParserRegisterUnittests(void)
 
     UtRegisterTest("AppLayerParserTest01", AppLayerParserTest01);
     UtRegisterTest("AppLayerParserTest02", AppLayerParserTest02);
+    UtRegisterTest("AppLayerParserTest03", AppLayerParserTest03);
+    UtRegisterTest("AppLayerParserTest04", AppLayerParserTest04);
 
     SCReturn;
 }
@@ -34,6 +34,10 @@
 #define APP_LAYER_PARSER_NO_REASSEMBLY          0x04
 #define APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD  0x08
 
+/* what to do when a flow exceeds its protocol's flow-memcap */
+#define APP_LAYER_MEMCAP_POLICY_EVICT           0
+#define APP_LAYER_MEMCAP_POLICY_STOP            1
+
 
 /***** transaction handling *****/
 
@@ -148,6 +152,17 @@ void AppLayerParserRegisterDetectStateFuncs(uint8_t ipproto, AppProto alproto,
         int (*StateHasTxDetectState)(void *alstate),
         DetectEngineState *(*GetTxDetectState)(void *tx),
         int (*SetTxDetectState)(void *alstate, void *tx, DetectEngineState *));
+void AppLayerParserRegisterGetStateMemuseFunc(uint8_t ipproto, AppProto alproto,
+        uint64_t (*StateGetMemuse)(void *alstate));
+
+void AppLayerParserSetStreamDepth(uint8_t ipproto, AppProto alproto,
+        uint32_t stream_depth);
+int AppLayerParserGetStreamDepth(uint8_t ipproto, AppProto alproto,
+        uint32_t *stream_depth);
+
+uint64_t AppLayerParserGetMemuse(AppProto alproto);
+uint64_t AppLayerParserMemuseGlobalCounter(void);
+uint64_t AppLayerParserMemcapGlobalCounter(void);
 
 /***** Get and transaction functions *****/
 
@@ -158,6 +173,10 @@ void AppLayerParserDestroyProtocolParserLocalStorage(uint8_t ipproto, AppProto a
 
 uint64_t AppLayerParserGetTransactionLogId(AppLayerParserState *pstate);
 void AppLayerParserSetTransactionLogId(AppLayerParserState *pstate);
+int AppLayerParserTxLogPending(const AppLayerParserState *pstate,
+        uint8_t ts_disruption, uint8_t tc_disruption);
+void AppLayerParserSetTxLogDone(AppLayerParserState *pstate,
+        uint8_t ts_disruption, uint8_t tc_disruption);
 void AppLayerParserSetTxLogged(uint8_t ipproto, AppProto alproto, void *alstate,
                                void *tx, uint32_t logger);
 int AppLayerParserGetTxLogged(uint8_t ipproto, AppProto alproto, void *alstate,
@@ -228,6 +247,8 @@ void AppLayerParserStateFree(AppLayerParserState *pstate);
 void AppLayerParserStatePrintDetails(AppLayerParserState *pstate);
 #endif
 
+int AppLayerParserBench(void);
+
 #ifdef AFLFUZZ_APPLAYER
 int AppLayerParserRequestFromFile(AppProto alproto, char *filename);
 int AppLayerParserFromFile(AppProto alproto, char *filename);
@@ -43,6 +43,7 @@ enum AppProtoEnum {
     ALPROTO_DNS,
     ALPROTO_MODBUS,
     ALPROTO_TEMPLATE,
+    ALPROTO_FTPDATA,
 
     /* used by the probing parser when alproto detection fails
      * permanently for that particular stream */
@@ -796,6 +796,23 @@ static uint32_t SMBParseWordCount(Flow *f, void *smb_state,
     }
 }
 
+/**
+ *  \brief consume up to input_len bytes of the ByteCount data we don't parse
+ *
+ *  \retval number of bytes to skip
+ */
+static inline uint32_t SMBSkipByteCount(SMBState *sstate, uint32_t input_len)
+{
+    uint32_t skip = sstate->bytecount.bytecountleft;
+    if (skip > input_len)
+        skip = input_len;
+
+    sstate->bytecount.bytecountleft -= skip;
+    SCLogDebug("skipping %"PRIu32" bytes, bytecount %"PRIu16"/%"PRIu16,
+            skip, sstate->bytecount.bytecountleft, sstate->bytecount.bytecount);
+    return skip;
+}
+
 /**
  *  \brief SMBParseByteCount parses the SMB ByteCount portion of the SMB Transaction.
  *         until sstate->bytecount.bytecount bytes are parsed.
@@ -835,12 +852,9 @@ static uint32_t SMBParseByteCount(Flow *f, void *smb_state,
                 parsed += (uint32_t)sres;
                 input_len -= (uint32_t)sres;
             } else { /* Did not Validate as DCERPC over SMB */
-                while (sstate->bytecount.bytecountleft-- && input_len--) {
-                    SCLogDebug("0x%02x bytecount %"PRIu16"/%"PRIu16" input_len %"PRIu32, *p,
-                            sstate->bytecount.bytecountleft,
-                            sstate->bytecount.bytecount, input_len);
-                    p++;
-                }
+                /* skip the rest of the data, e.g. the file content of
+                 * a bulk read/write, in one go */
+                p += SMBSkipByteCount(sstate, input_len);
                 sstate->bytesprocessed += (p - input);
                 SCReturnUInt((p - input));
             }
@@ -848,12 +862,7 @@ static uint32_t SMBParseByteCount(Flow *f, void *smb_state,
         SCReturnUInt(ures);
     }
 
-    while (sstate->bytecount.bytecountleft-- && input_len--) {
-        SCLogDebug("0x%02x bytecount %u/%u input_len %u", *p,
-                sstate->bytecount.bytecountleft,
-                sstate->bytecount.bytecount, input_len);
-        p++;
-    }
+    p += SMBSkipByteCount(sstate, input_len);
     sstate->bytesprocessed += (p - input);
 
     SCReturnUInt((p - input));
@@ -67,6 +67,9 @@
 
 #define SMTP_COMMAND_BUFFER_STEPS 5
 
+/* initial size of the buffer for lines that are split over chunks */
+#define SMTP_LINE_BUFFER_MIN 256
+
 /* we are in process of parsing a fresh command.  Just a placeholder.  If we
  * are not in STATE_COMMAND_DATA_MODE, we have to be in this mode */
 #define SMTP_PARSER_STATE_COMMAND_MODE            0x00
@@ -233,6 +236,39 @@ SMTPConfig smtp_config = { 0, { 0, 0, 0, 0, 0 }, 0, 0, 0, STREAMING_BUFFER_CONFI
 
 static SMTPString *SMTPStringAlloc(void);
 
+/**
+ * \brief Set up the list of MIME header fields to store from the
+ *        mime.header-fields config list.
+ */
+static void SMTPConfigureHeaderFields(ConfNode *fields)
+{
+    ConfNode *field;
+    uint32_t cnt = 0, i = 0;
+
+    TAILQ_FOREACH(field, &fields->head, next) {
+        cnt++;
+    }
+
+    char **list = SCCalloc(cnt + 1, sizeof(char *));
+    if (unlikely(list == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc the mime header field "
+                "list, storing all header fields");
+        return;
+    }
+
+    TAILQ_FOREACH(field, &fields->head, next) {
+        char *name = SCStrdup(field->val);
+        if (unlikely(name == NULL))
+            continue;
+        char *c;
+        for (c = name; *c != '\0'; c++)
+            *c = tolower((unsigned char)*c);
+        list[i++] = name;
+    }
+
+    smtp_config.mime_config.header_fields = list;
+}
+
 /**
  * \brief Configure SMTP Mime Decoder by parsing out mime section of YAML
  * config file
@@ -280,6 +316,11 @@ static void SMTPConfigure(void) {
         if (ret) {
             smtp_config.mime_config.body_md5 = val;
         }
+
+        ConfNode *fields = ConfNodeLookupChild(config, "header-fields");
+        if (fields != NULL) {
+            SMTPConfigureHeaderFields(fields);
+        }
     }
 
     /* Pass mime config data to MimeDec API */
@@ -520,6 +561,42 @@ int SMTPProcessDataChunk(const uint8_t *chunk, uint32_t len,
     SCReturnInt(ret);
 }
 
+/**
+ * \internal
+ * \brief Append data to a fragmented line buffer. The buffer grows in
+ *        steps so that a line that comes in many small pieces doesn't
+ *        cost a realloc per piece.
+ *
+ * \retval 0 ok
+ * \retval -1 out of memory, buffer is freed
+ */
+static int SMTPLineBufferAppend(uint8_t **db, int32_t *db_len, uint32_t *db_size,
+                                const uint8_t *data, uint32_t data_len)
+{
+    uint32_t need = (uint32_t)*db_len + data_len;
+
+    if (need > *db_size) {
+        uint32_t size = MAX(*db_size * 2, SMTP_LINE_BUFFER_MIN);
+        if (size < need)
+            size = need;
+
+        void *ptmp = SCRealloc(*db, size);
+        if (ptmp == NULL) {
+            SCFree(*db);
+            *db = NULL;
+            *db_len = 0;
+            *db_size = 0;
+            return -1;
+        }
+        *db = ptmp;
+        *db_size = size;
+    }
+
+    memcpy(*db + *db_len, data, data_len);
+    *db_len += data_len;
+    return 0;
+}
+
 /**
  * \internal
  * \brief Get the next line from input.  It doesn't do any length validation.
@@ -533,217 +610,106 @@ int SMTPProcessDataChunk(const uint8_t *chunk, uint32_t len,
 static int SMTPGetLine(SMTPState *state)
 {
     SCEnter();
-    void *ptmp;
 
     /* we have run out of input */
     if (state->input_len <= 0)
         return -1;
 
-    /* toserver */
+    /* the line buffer for this direction */
+    uint8_t **db;
+    int32_t *db_len;
+    uint32_t *db_size;
+    uint8_t *current_line_db;
+    uint8_t *current_line_lf_seen;
+
     if (state->direction == 0) {
-        if (state->ts_current_line_lf_seen == 1) {
-            /* we have seen the lf for the previous line.  Clear the parser
-             * details to parse new line */
-            state->ts_current_line_lf_seen = 0;
-            if (state->ts_current_line_db == 1) {
-                state->ts_current_line_db = 0;
-                SCFree(state->ts_db);
-                state->ts_db = NULL;
-                state->ts_db_len = 0;
-                state->current_line = NULL;
-                state->current_line_len = 0;
-            }
+        db = &state->ts_db;
+        db_len = &state->ts_db_len;
+        db_size = &state->ts_db_size;
+        current_line_db = &state->ts_current_line_db;
+        current_line_lf_seen = &state->ts_current_line_lf_seen;
+    } else {
+        db = &state->tc_db;
+        db_len = &state->tc_db_len;
+        db_size = &state->tc_db_size;
+        current_line_db = &state->tc_current_line_db;
+        current_line_lf_seen = &state->tc_current_line_lf_seen;
+    }
+
+    if (*current_line_lf_seen == 1) {
+        /* we have seen the lf for the previous line.  Clear the parser
+         * details to parse new line */
+        *current_line_lf_seen = 0;
+        if (*current_line_db == 1) {
+            *current_line_db = 0;
+            SCFree(*db);
+            *db = NULL;
+            *db_len = 0;
+            *db_size = 0;
+            state->current_line = NULL;
+            state->current_line_len = 0;
         }
+    }
 
-        uint8_t *lf_idx = memchr(state->input, 0x0a, state->input_len);
-
-        if (lf_idx == NULL) {
-            /* fragmented lines.  Decoder event for special cases.  Not all
-             * fragmented lines should be treated as a possible evasion
-             * attempt.  With multi payload smtp chunks we can have valid
-             * cases of fragmentation.  But within the same segment chunk
-             * if we see fragmentation then it's definitely something you
-             * should alert about */
-            if (state->ts_current_line_db == 0) {
-                state->ts_db = SCMalloc(state->input_len);
-                if (state->ts_db == NULL) {
-                    return -1;
-                }
-                state->ts_current_line_db = 1;
-                memcpy(state->ts_db, state->input, state->input_len);
-                state->ts_db_len = state->input_len;
-            } else {
-                ptmp = SCRealloc(state->ts_db,
-                                 (state->ts_db_len + state->input_len));
-                if (ptmp == NULL) {
-                    SCFree(state->ts_db);
-                    state->ts_db = NULL;
-                    state->ts_db_len = 0;
-                    return -1;
-                }
-                state->ts_db = ptmp;
-
-                memcpy(state->ts_db + state->ts_db_len,
-                       state->input, state->input_len);
-                state->ts_db_len += state->input_len;
-            } /* else */
-            state->input += state->input_len;
-            state->input_len = 0;
+    uint8_t *lf_idx = memchr(state->input, 0x0a, state->input_len);
 
+    if (lf_idx == NULL) {
+        /* fragmented lines.  Decoder event for special cases.  Not all
+         * fragmented lines should be treated as a possible evasion
+         * attempt.  With multi payload smtp chunks we can have valid
+         * cases of fragmentation.  But within the same segment chunk
+         * if we see fragmentation then it's definitely something you
+         * should alert about */
+        if (SMTPLineBufferAppend(db, db_len, db_size,
+                                 state->input, state->input_len) < 0) {
             return -1;
+        }
+        *current_line_db = 1;
 
-        } else {
-            state->ts_current_line_lf_seen = 1;
-
-            if (state->ts_current_line_db == 1) {
-                ptmp = SCRealloc(state->ts_db,
-                                 (state->ts_db_len + (lf_idx + 1 - state->input)));
-                if (ptmp == NULL) {
-                    SCFree(state->ts_db);
-                    state->ts_db = NULL;
-                    state->ts_db_len = 0;
-                    return -1;
-                }
-                state->ts_db = ptmp;
-
-                memcpy(state->ts_db + state->ts_db_len,
-                       state->input, (lf_idx + 1 - state->input));
-                state->ts_db_len += (lf_idx + 1 - state->input);
-
-                if (state->ts_db_len > 1 &&
-                    state->ts_db[state->ts_db_len - 2] == 0x0D) {
-                    state->ts_db_len -= 2;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->ts_db_len -= 1;
-                    state->current_line_delimiter_len = 1;
-                }
-
-                state->current_line = state->ts_db;
-                state->current_line_len = state->ts_db_len;
-
-            } else {
-                state->current_line = state->input;
-                state->current_line_len = lf_idx - state->input;
-
-                if (state->input != lf_idx &&
-                    *(lf_idx - 1) == 0x0D) {
-                    state->current_line_len--;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->current_line_delimiter_len = 1;
-                }
-            }
-
-            state->input_len -= (lf_idx - state->input) + 1;
-            state->input = (lf_idx + 1);
+        state->input += state->input_len;
+        state->input_len = 0;
 
-            return 0;
-        }
+        return -1;
 
-        /* toclient */
     } else {
-        if (state->tc_current_line_lf_seen == 1) {
-            /* we have seen the lf for the previous line.  Clear the parser
-             * details to parse new line */
-            state->tc_current_line_lf_seen = 0;
-            if (state->tc_current_line_db == 1) {
-                state->tc_current_line_db = 0;
-                SCFree(state->tc_db);
-                state->tc_db = NULL;
-                state->tc_db_len = 0;
-                state->current_line = NULL;
-                state->current_line_len = 0;
+        *current_line_lf_seen = 1;
+
+        if (*current_line_db == 1) {
+            if (SMTPLineBufferAppend(db, db_len, db_size, state->input,
+                                     (lf_idx + 1 - state->input)) < 0) {
+                return -1;
             }
-        }
 
-        uint8_t *lf_idx = memchr(state->input, 0x0a, state->input_len);
-
-        if (lf_idx == NULL) {
-            /* fragmented lines.  Decoder event for special cases.  Not all
-             * fragmented lines should be treated as a possible evasion
-             * attempt.  With multi payload smtp chunks we can have valid
-             * cases of fragmentation.  But within the same segment chunk
-             * if we see fragmentation then it's definitely something you
-             * should alert about */
-            if (state->tc_current_line_db == 0) {
-                state->tc_db = SCMalloc(state->input_len);
-                if (state->tc_db == NULL) {
-                    return -1;
-                }
-                state->tc_current_line_db = 1;
-                memcpy(state->tc_db, state->input, state->input_len);
-                state->tc_db_len = state->input_len;
+            if (*db_len > 1 && (*db)[*db_len - 2] == 0x0D) {
+                *db_len -= 2;
+                state->current_line_delimiter_len = 2;
             } else {
-                ptmp = SCRealloc(state->tc_db,
-                                 (state->tc_db_len + state->input_len));
-                if (ptmp == NULL) {
-                    SCFree(state->tc_db);
-                    state->tc_db = NULL;
-                    state->tc_db_len = 0;
-                    return -1;
-                }
-                state->tc_db = ptmp;
-
-                memcpy(state->tc_db + state->tc_db_len,
-                       state->input, state->input_len);
-                state->tc_db_len += state->input_len;
-            } /* else */
-            state->input += state->input_len;
-            state->input_len = 0;
+                *db_len -= 1;
+                state->current_line_delimiter_len = 1;
+            }
 
-            return -1;
+            state->current_line = *db;
+            state->current_line_len = *db_len;
 
         } else {
-            state->tc_current_line_lf_seen = 1;
-
-            if (state->tc_current_line_db == 1) {
-                ptmp = SCRealloc(state->tc_db,
-                                 (state->tc_db_len + (lf_idx + 1 - state->input)));
-                if (ptmp == NULL) {
-                    SCFree(state->tc_db);
-                    state->tc_db = NULL;
-                    state->tc_db_len = 0;
-                    return -1;
-                }
-                state->tc_db = ptmp;
-
-                memcpy(state->tc_db + state->tc_db_len,
-                       state->input, (lf_idx + 1 - state->input));
-                state->tc_db_len += (lf_idx + 1 - state->input);
-
-                if (state->tc_db_len > 1 &&
-                    state->tc_db[state->tc_db_len - 2] == 0x0D) {
-                    state->tc_db_len -= 2;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->tc_db_len -= 1;
-                    state->current_line_delimiter_len = 1;
-                }
-
-                state->current_line = state->tc_db;
-                state->current_line_len = state->tc_db_len;
-
+            /* line is complete in the input: use it in place */
+            state->current_line = state->input;
+            state->current_line_len = lf_idx - state->input;
+
+            if (state->input != lf_idx &&
+                *(lf_idx - 1) == 0x0D) {
+                state->current_line_len--;
+                state->current_line_delimiter_len = 2;
             } else {
-                state->current_line = state->input;
-                state->current_line_len = lf_idx - state->input;
-
-                if (state->input != lf_idx &&
-                    *(lf_idx - 1) == 0x0D) {
-                    state->current_line_len--;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->current_line_delimiter_len = 1;
-                }
+                state->current_line_delimiter_len = 1;
             }
+        }
 
-            state->input_len -= (lf_idx - state->input) + 1;
-            state->input = (lf_idx + 1);
+        state->input_len -= (lf_idx - state->input) + 1;
+        state->input = (lf_idx + 1);
 
-            return 0;
-        } /* else - if (lf_idx == NULL) */
+        return 0;
     }
-
 }
 
 static int SMTPInsertCommandIntoCommandBuffer(uint8_t command, SMTPState *state, Flow *f)
@@ -1387,6 +1353,9 @@ static void SMTPLocalStorageFree(void *ptr)
 
 static void SMTPTransactionFree(SMTPTransaction *tx, SMTPState *state)
 {
+    if (state->iter == tx)
+        state->iter = NULL;
+
     if (tx->mime_state != NULL) {
         MimeDecDeInitParser(tx->mime_state);
     }
@@ -1539,6 +1508,49 @@ static void SMTPStateTransactionFree (void *state, uint64_t tx_id)
 
 }
 
+static uint64_t SMTPMimeEntityMemuse(const MimeDecEntity *entity)
+{
+    uint64_t memuse = 0;
+
+    for ( ; entity != NULL; entity = entity->next) {
+        memuse += sizeof(*entity) + entity->filename_len;
+
+        const MimeDecField *field;
+        for (field = entity->field_list; field != NULL; field = field->next)
+            memuse += sizeof(*field) + field->name_len + field->value_len;
+
+        const MimeDecUrl *url;
+        for (url = entity->url_list; url != NULL; url = url->next)
+            memuse += sizeof(*url) + url->url_len;
+
+        memuse += SMTPMimeEntityMemuse(entity->child);
+    }
+    return memuse;
+}
+
+/** \brief approximate memory used by the state, for the app-layer
+ *         memory accounting */
+static uint64_t SMTPStateGetMemuse(void *state)
+{
+    SMTPState *smtp_state = state;
+    uint64_t memuse = sizeof(*smtp_state) + smtp_state->ts_db_size +
+        smtp_state->tc_db_size + smtp_state->cmds_buffer_len;
+
+    const SMTPTransaction *tx;
+    TAILQ_FOREACH(tx, &smtp_state->tx_list, next) {
+        memuse += sizeof(*tx) + tx->mail_from_len;
+
+        const SMTPString *str;
+        TAILQ_FOREACH(str, &tx->rcpt_to_list, next)
+            memuse += sizeof(*str) + str->len;
+
+        memuse += SMTPMimeEntityMemuse(tx->msg_head);
+    }
+
+    memuse += FileContainerMemuse(smtp_state->files_ts);
+    return memuse;
+}
+
 /** \retval cnt highest tx id */
 static uint64_t SMTPStateGetTxCnt(void *state)
 {
@@ -1562,9 +1574,21 @@ static void *SMTPStateGetTx(void *state, uint64_t id)
         if (smtp_state->curr_tx->tx_id == id)
             return smtp_state->curr_tx;
 
+        /* fast track: detection and logging ask for the tx in order, so
+         * try the one after the last tx we returned */
+        if (smtp_state->iter && smtp_state->iter->tx_id + 1 == id) {
+            tx = TAILQ_NEXT(smtp_state->iter, next);
+            if (tx && tx->tx_id == id) {
+                smtp_state->iter = tx;
+                return tx;
+            }
+        }
+
         TAILQ_FOREACH(tx, &smtp_state->tx_list, next) {
-            if (tx->tx_id == id)
+            if (tx->tx_id == id) {
+                smtp_state->iter = tx;
                 return tx;
+            }
         }
     }
     return NULL;
@@ -1674,6 +1698,8 @@ void RegisterSMTPParsers(void)
         AppLayerParserRegisterGetEventsFunc(IPPROTO_TCP, ALPROTO_SMTP, SMTPGetEvents);
         AppLayerParserRegisterDetectStateFuncs(IPPROTO_TCP, ALPROTO_SMTP, NULL,
                                                SMTPGetTxDetectState, SMTPSetTxDetectState);
+        AppLayerParserRegisterGetStateMemuseFunc(IPPROTO_TCP, ALPROTO_SMTP,
+                                                 SMTPStateGetMemuse);
 
         AppLayerParserRegisterLocalStorageFunc(IPPROTO_TCP, ALPROTO_SMTP, SMTPLocalStorageAlloc,
                                                SMTPLocalStorageFree);
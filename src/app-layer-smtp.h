@@ -101,6 +101,7 @@ typedef struct SMTPConfig {
 
 typedef struct SMTPState_ {
     SMTPTransaction *curr_tx;
+    SMTPTransaction *iter;      /**< last tx returned by GetTx */
     TAILQ_HEAD(, SMTPTransaction_) tx_list;  /**< transaction list */
     uint64_t tx_cnt;
 
@@ -120,6 +121,7 @@ typedef struct SMTPState_ {
      * use a malloced buffer, if a line is fragmented */
     uint8_t *tc_db;
     int32_t tc_db_len;
+    uint32_t tc_db_size;
     uint8_t tc_current_line_db;
     /** we have see LF for the currently parsed line */
     uint8_t tc_current_line_lf_seen;
@@ -128,6 +130,7 @@ typedef struct SMTPState_ {
      * use a malloced buffer, if a line is fragmented */
     uint8_t *ts_db;
     int32_t ts_db_len;
+    uint32_t ts_db_size;
     uint8_t ts_current_line_db;
     /** we have see LF for the currently parsed line */
     uint8_t ts_current_line_lf_seen;
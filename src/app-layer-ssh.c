@@ -287,6 +287,10 @@ again:
             SCReturnInt(-1);
         header->buf_offset = 0;
 
+        /* the rest is encrypted, don't try to parse it as records */
+        if (header->flags & SSH_FLAG_PARSER_DONE)
+            SCReturnInt(0);
+
         uint32_t record_left = header->pkt_len - 2;
         input_len -= needed;
         input += needed;
@@ -312,6 +316,9 @@ again:
         if (SSHParseRecordHeader(state, header, input, 6) < 0)
             SCReturnInt(-1);
 
+        if (header->flags & SSH_FLAG_PARSER_DONE)
+            SCReturnInt(0);
+
         uint32_t record_left = header->pkt_len - 2;
         SCLogDebug("record left %u", record_left);
         input_len -= 6;
@@ -2572,6 +2579,60 @@ end:
     return result;
 }
 
+/** \test NEWKEYS followed by encrypted data in the same chunk, in both
+ *        directions. The encrypted part must not be parsed as records and
+ *        the flow should be handed off once both sides are done. */
+static int SSHParserTest25(void)
+{
+    Flow f;
+    uint8_t banner_ts[] = "SSH-2.0-MySSHClient-0.5.1\r\n";
+    uint8_t banner_tc[] = "SSH-2.0-MySSHServer-0.5.1\r\n";
+    /* KEXINIT and NEWKEYS records, then something that is not a valid
+     * record header */
+    uint8_t records[] = { 0x00, 0x00, 0x00, 0x03, 0x01, 20, 0x00,
+                          0x00, 0x00, 0x00, 0x03, 0x01, 21, 0x00,
+                          0x00, 0x00, 0x00, 0x00, 0xaa, 0xbb, 0xcc };
+    TcpSession ssn;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.protomap = FlowGetProtoMapping(f.proto);
+    f.alproto = ALPROTO_SSH;
+
+    StreamTcpInitConfig(TRUE);
+
+    SCMutexLock(&f.m);
+    FAIL_IF(AppLayerParserParse(alp_tctx, &f, ALPROTO_SSH, STREAM_TOSERVER,
+                banner_ts, sizeof(banner_ts) - 1) != 0);
+    FAIL_IF(AppLayerParserParse(alp_tctx, &f, ALPROTO_SSH, STREAM_TOCLIENT,
+                banner_tc, sizeof(banner_tc) - 1) != 0);
+    FAIL_IF(AppLayerParserParse(alp_tctx, &f, ALPROTO_SSH, STREAM_TOSERVER,
+                records, sizeof(records)) != 0);
+
+    SshState *ssh_state = f.alstate;
+    FAIL_IF_NULL(ssh_state);
+    FAIL_IF_NOT(ssh_state->cli_hdr.flags & SSH_FLAG_PARSER_DONE);
+    FAIL_IF(ssn.flags & STREAMTCP_FLAG_APP_LAYER_DISABLED);
+
+    FAIL_IF(AppLayerParserParse(alp_tctx, &f, ALPROTO_SSH, STREAM_TOCLIENT,
+                records, sizeof(records)) != 0);
+    SCMutexUnlock(&f.m);
+
+    FAIL_IF_NOT(ssh_state->srv_hdr.flags & SSH_FLAG_PARSER_DONE);
+    FAIL_IF_NOT(ssn.flags & STREAMTCP_FLAG_APP_LAYER_DISABLED);
+    FAIL_IF_NOT(ssn.client.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY);
+    FAIL_IF_NOT(ssn.server.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    PASS;
+}
 
 #endif /* UNITTESTS */
 
@@ -2602,6 +2663,7 @@ void SSHParserRegisterTests(void)
     UtRegisterTest("SSHParserTest22", SSHParserTest22);
     UtRegisterTest("SSHParserTest23", SSHParserTest23);
     UtRegisterTest("SSHParserTest24", SSHParserTest24);
+    UtRegisterTest("SSHParserTest25", SSHParserTest25);
 #endif /* UNITTESTS */
 }
 
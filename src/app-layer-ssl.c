@@ -79,6 +79,8 @@ SCEnumCharMap tls_decoder_event_table[ ] = {
 
 typedef struct SslConfig_ {
     int no_reassemble;
+    int bypass_encrypted;   /**< stop parsing and reassembly once the
+                                 session is encrypted */
 } SslConfig;
 
 SslConfig ssl_config;
@@ -1169,13 +1171,18 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
         case SSLV3_APPLICATION_PROTOCOL:
             if ((ssl_state->flags & SSL_AL_FLAG_CLIENT_CHANGE_CIPHER_SPEC) &&
                     (ssl_state->flags & SSL_AL_FLAG_SERVER_CHANGE_CIPHER_SPEC)) {
-                /*
-                AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_INSPECTION);
-                if (ssl_config.no_reassemble == 1)
+                if (ssl_config.bypass_encrypted) {
+                    /* nothing left to see: stop parsing and reassembly
+                     * so that the flow can be bypassed. This disables
+                     * heartbeat checks for the rest of the session. */
+                    AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_INSPECTION);
                     AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_REASSEMBLY);
-                */
-                AppLayerParserStateSetFlag(pstate,
-                        APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD);
+                } else {
+                    /* keep walking the record headers for the heartbeat
+                     * checks, the encrypted data itself is skipped */
+                    AppLayerParserStateSetFlag(pstate,
+                            APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD);
+                }
             }
 
             /* if we see (encrypted) aplication data, then this means the
@@ -1769,6 +1776,24 @@ void RegisterSSLParsers(void)
             if (ConfGetBool("app-layer.protocols.tls.no-reassemble", &ssl_config.no_reassemble) != 1)
                 ssl_config.no_reassemble = 1;
         }
+
+        if (ConfGetBool("app-layer.protocols.tls.bypass-encrypted",
+                        &ssl_config.bypass_encrypted) != 1)
+            ssl_config.bypass_encrypted = 0;
+        SCLogConfig("tls: bypass encrypted sessions: %s",
+                    ssl_config.bypass_encrypted ? "yes" : "no");
+
+        intmax_t cert_cache_size = 0;
+        if (ConfGetInt("app-layer.protocols.tls.cert-cache-size",
+                       &cert_cache_size) != 1)
+            cert_cache_size = TLS_CERT_CACHE_DEFAULT_SIZE;
+        if (cert_cache_size < 0 || cert_cache_size > UINT32_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value for "
+                    "app-layer.protocols.tls.cert-cache-size, using default");
+            cert_cache_size = TLS_CERT_CACHE_DEFAULT_SIZE;
+        }
+        TLSCertCacheInit((uint32_t)cert_cache_size);
+        SCLogConfig("tls: certificate cache size: %"PRIdMAX, cert_cache_size);
     } else {
         SCLogInfo("Parsed disabled for %s protocol. Protocol detection"
                   "still on.", proto_name);
@@ -46,9 +46,244 @@
 #include "util-decode-der.h"
 #include "util-decode-der-get.h"
 #include "util-crypt.h"
+#include "util-unittest.h"
 
 #define SSLV3_RECORD_LEN 5
 
+/** max size of a certificate that is kept in the cache */
+#define TLS_CERT_CACHE_MAX_CERT_LEN 4096
+#define TLS_CERT_CACHE_LOCKS        64
+
+/** a decoded certificate. The raw cert is kept to rule out collisions. */
+typedef struct TLSCertCacheEntry_ {
+    uint8_t *cert;
+    uint32_t cert_len;
+    char *subject;
+    char *issuerdn;
+    char *fingerprint;
+} TLSCertCacheEntry;
+
+/** Direct mapped cache of decoded certificates. Servers hand out the same
+ *  certificate chain to every client, so most handshakes in a busy network
+ *  decode certificates we have seen before. A collision just replaces the
+ *  old entry. */
+typedef struct TLSCertCache_ {
+    TLSCertCacheEntry *entries;
+    uint32_t size;
+    SCMutex locks[TLS_CERT_CACHE_LOCKS];
+} TLSCertCache;
+
+static TLSCertCache tls_cert_cache = { NULL, 0, };
+
+static uint32_t TLSCertCacheHash(const uint8_t *cert, uint32_t len)
+{
+    /* FNV-1a over the last bytes of the cert: the signature at the end
+     * makes them unique enough and keeps the hash cheap for large certs */
+    uint32_t hash = 2166136261U ^ len;
+    uint32_t off = len > 64 ? len - 64 : 0;
+    for ( ; off < len; off++) {
+        hash ^= cert[off];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static void TLSCertCacheEntryClear(TLSCertCacheEntry *e)
+{
+    if (e->cert != NULL)
+        SCFree(e->cert);
+    if (e->subject != NULL)
+        SCFree(e->subject);
+    if (e->issuerdn != NULL)
+        SCFree(e->issuerdn);
+    if (e->fingerprint != NULL)
+        SCFree(e->fingerprint);
+    memset(e, 0, sizeof(*e));
+}
+
+/**
+ * \brief setup the certificate cache
+ *
+ * \param size number of entries, 0 disables the cache
+ */
+void TLSCertCacheInit(uint32_t size)
+{
+    if (tls_cert_cache.entries != NULL || size == 0)
+        return;
+
+    tls_cert_cache.entries = SCCalloc(size, sizeof(TLSCertCacheEntry));
+    if (tls_cert_cache.entries == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to allocate tls certificate "
+                "cache of %"PRIu32" entries", size);
+        return;
+    }
+    tls_cert_cache.size = size;
+
+    int i;
+    for (i = 0; i < TLS_CERT_CACHE_LOCKS; i++)
+        SCMutexInit(&tls_cert_cache.locks[i], NULL);
+}
+
+void TLSCertCacheFree(void)
+{
+    if (tls_cert_cache.entries == NULL)
+        return;
+
+    uint32_t u;
+    for (u = 0; u < tls_cert_cache.size; u++)
+        TLSCertCacheEntryClear(&tls_cert_cache.entries[u]);
+    SCFree(tls_cert_cache.entries);
+    tls_cert_cache.entries = NULL;
+    tls_cert_cache.size = 0;
+
+    int i;
+    for (i = 0; i < TLS_CERT_CACHE_LOCKS; i++)
+        SCMutexDestroy(&tls_cert_cache.locks[i]);
+}
+
+/**
+ * \brief look up a certificate in the cache
+ *
+ * On a hit the strings are copied into the caller's buffers.
+ *
+ * \retval 1 hit
+ * \retval 0 miss
+ */
+static int TLSCertCacheLookup(const uint8_t *cert, uint32_t cert_len,
+        char *subject, size_t subject_size, char *issuerdn, size_t issuerdn_size,
+        char *fingerprint, size_t fingerprint_size)
+{
+    if (tls_cert_cache.entries == NULL || cert_len > TLS_CERT_CACHE_MAX_CERT_LEN)
+        return 0;
+
+    uint32_t hash = TLSCertCacheHash(cert, cert_len);
+    TLSCertCacheEntry *e = &tls_cert_cache.entries[hash % tls_cert_cache.size];
+    SCMutex *m = &tls_cert_cache.locks[hash % TLS_CERT_CACHE_LOCKS];
+    int hit = 0;
+
+    SCMutexLock(m);
+    if (e->cert != NULL && e->cert_len == cert_len &&
+            memcmp(e->cert, cert, cert_len) == 0) {
+        strlcpy(subject, e->subject, subject_size);
+        strlcpy(issuerdn, e->issuerdn, issuerdn_size);
+        strlcpy(fingerprint, e->fingerprint, fingerprint_size);
+        hit = 1;
+    }
+    SCMutexUnlock(m);
+    return hit;
+}
+
+/** \brief add a decoded certificate, replacing whatever was in its slot */
+static void TLSCertCacheAdd(const uint8_t *cert, uint32_t cert_len,
+        const char *subject, const char *issuerdn, const char *fingerprint)
+{
+    if (tls_cert_cache.entries == NULL || cert_len > TLS_CERT_CACHE_MAX_CERT_LEN)
+        return;
+
+    TLSCertCacheEntry n;
+    memset(&n, 0, sizeof(n));
+    n.cert = SCMalloc(cert_len);
+    n.subject = SCStrdup(subject);
+    n.issuerdn = SCStrdup(issuerdn);
+    n.fingerprint = SCStrdup(fingerprint);
+    if (n.cert == NULL || n.subject == NULL || n.issuerdn == NULL ||
+            n.fingerprint == NULL) {
+        TLSCertCacheEntryClear(&n);
+        return;
+    }
+    memcpy(n.cert, cert, cert_len);
+    n.cert_len = cert_len;
+
+    uint32_t hash = TLSCertCacheHash(cert, cert_len);
+    TLSCertCacheEntry *e = &tls_cert_cache.entries[hash % tls_cert_cache.size];
+    SCMutex *m = &tls_cert_cache.locks[hash % TLS_CERT_CACHE_LOCKS];
+    TLSCertCacheEntry old;
+
+    SCMutexLock(m);
+    old = *e;
+    *e = n;
+    SCMutexUnlock(m);
+
+    TLSCertCacheEntryClear(&old);
+}
+
+/**
+ * \brief SHA1 fingerprint of a cert as "xx:xx:..."
+ *
+ * \retval 0 ok
+ * \retval -1 error
+ */
+static int TLSCertFingerprint(const uint8_t *cert, uint32_t cert_len,
+                              char *out, size_t out_len)
+{
+    unsigned char *hash = ComputeSHA1((unsigned char *)cert, (int)cert_len);
+    if (hash == NULL)
+        return -1;
+
+    int hash_len = 20;
+    memset(out, 0x00, out_len);
+
+    int j = 0;
+    for (j = 0; j < hash_len; j++) {
+        char one[4];
+        snprintf(one, sizeof(one), j == hash_len - 1 ? "%02x" : "%02x:", hash[j]);
+        strlcat(out, one, out_len);
+    }
+    SCFree(hash);
+    return 0;
+}
+
+/**
+ * \brief store a decoded certificate in the state
+ *
+ * \retval 0 ok
+ * \retval -1 memory error
+ */
+static int TLSCertStore(SSLState *ssl_state, int i, uint8_t *input,
+        uint32_t cur_cert_length, const char *subject, const char *issuerdn,
+        const char *fingerprint)
+{
+    if (subject != NULL) {
+        SSLCertsChain *ncert;
+
+        if (i == 0) {
+            if (ssl_state->server_connp.cert0_subject == NULL)
+                ssl_state->server_connp.cert0_subject = SCStrdup(subject);
+            if (ssl_state->server_connp.cert0_subject == NULL)
+                return -1;
+        }
+
+        ncert = (SSLCertsChain *)SCMalloc(sizeof(SSLCertsChain));
+        if (ncert == NULL)
+            return -1;
+
+        memset(ncert, 0, sizeof(*ncert));
+        ncert->cert_data = input;
+        ncert->cert_len = cur_cert_length;
+        TAILQ_INSERT_TAIL(&ssl_state->server_connp.certs, ncert, next);
+    }
+
+    if (issuerdn != NULL && i == 0) {
+        if (ssl_state->server_connp.cert0_issuerdn == NULL)
+            ssl_state->server_connp.cert0_issuerdn = SCStrdup(issuerdn);
+        if (ssl_state->server_connp.cert0_issuerdn == NULL)
+            return -1;
+    }
+
+    if (i == 0 && ssl_state->server_connp.cert0_fingerprint == NULL) {
+        if (fingerprint != NULL) {
+            ssl_state->server_connp.cert0_fingerprint = SCStrdup(fingerprint);
+            if (ssl_state->server_connp.cert0_fingerprint == NULL) {
+                // TODO do we need an event here?
+            }
+        }
+
+        ssl_state->server_connp.cert_input = input;
+        ssl_state->server_connp.cert_input_len = cur_cert_length;
+    }
+    return 0;
+}
+
 static void TLSCertificateErrCodeToWarning(SSLState *ssl_state,
                                            uint32_t errcode)
 {
@@ -86,7 +321,10 @@ int DecodeTLSHandshakeServerCertificate(SSLState *ssl_state, uint8_t *input,
     uint32_t certificates_length, cur_cert_length;
     int i;
     Asn1Generic *cert;
-    char buffer[256];
+    char subject[256];
+    char issuerdn[256];
+    char fingerprint[61];
+    int have_subject, have_issuerdn, have_fingerprint;
     int rc;
     int parsed;
     uint8_t *start_data;
@@ -126,89 +364,57 @@ int DecodeTLSHandshakeServerCertificate(SSLState *ssl_state, uint8_t *input,
             return -1;
         }
 
+        if (TLSCertCacheLookup(input, cur_cert_length, subject, sizeof(subject),
+                    issuerdn, sizeof(issuerdn), fingerprint, sizeof(fingerprint))) {
+            if (TLSCertStore(ssl_state, i, input, cur_cert_length,
+                        subject, issuerdn, fingerprint) < 0)
+                return -1;
+            goto next;
+        }
+
         cert = DecodeDer(input, cur_cert_length, &errcode);
         if (cert == NULL) {
             TLSCertificateErrCodeToWarning(ssl_state, errcode);
         }
 
         if (cert != NULL) {
-            rc = Asn1DerGetSubjectDN(cert, buffer, sizeof(buffer), &errcode);
-
+            rc = Asn1DerGetSubjectDN(cert, subject, sizeof(subject), &errcode);
+            have_subject = (rc == 0);
             if (rc != 0) {
                 TLSCertificateErrCodeToWarning(ssl_state, errcode);
-            } else {
-                SSLCertsChain *ncert;
-                //SCLogInfo("TLS Cert %d: %s\n", i, buffer);
-
-                if (i == 0) {
-                    if (ssl_state->server_connp.cert0_subject == NULL)
-                        ssl_state->server_connp.cert0_subject = SCStrdup(buffer);
-                    if (ssl_state->server_connp.cert0_subject == NULL) {
-                        DerFree(cert);
-                        return -1;
-                    }
-                }
-
-                ncert = (SSLCertsChain *)SCMalloc(sizeof(SSLCertsChain));
-                if (ncert == NULL) {
-                    DerFree(cert);
-                    return -1;
-                }
-
-                memset(ncert, 0, sizeof(*ncert));
-                ncert->cert_data = input;
-                ncert->cert_len = cur_cert_length;
-                TAILQ_INSERT_TAIL(&ssl_state->server_connp.certs, ncert, next);
             }
 
-            rc = Asn1DerGetIssuerDN(cert, buffer, sizeof(buffer), &errcode);
+            rc = Asn1DerGetIssuerDN(cert, issuerdn, sizeof(issuerdn), &errcode);
+            have_issuerdn = (rc == 0);
             if (rc != 0) {
                 TLSCertificateErrCodeToWarning(ssl_state, errcode);
-            } else {
-                //SCLogInfo("TLS IssuerDN %d: %s\n", i, buffer);
-                if (i == 0) {
-                    if (ssl_state->server_connp.cert0_issuerdn == NULL)
-                        ssl_state->server_connp.cert0_issuerdn = SCStrdup(buffer);
-                    if (ssl_state->server_connp.cert0_issuerdn == NULL) {
-                        DerFree(cert);
-                        return -1;
-                    }
-                }
             }
 
             DerFree(cert);
 
-            if (i == 0 && ssl_state->server_connp.cert0_fingerprint == NULL) {
-                int msg_len = cur_cert_length;
-                unsigned char *hash;
-                hash = ComputeSHA1((unsigned char *) input, (int) msg_len);
-
-                if (hash == NULL) {
-                    // TODO maybe an event here?
-                } else {
-                    int hash_len = 20;
-                    int out_len = hash_len * 3 + 1;
-                    char out[out_len];
-                    memset(out, 0x00, out_len);
-
-                    int j = 0;
-                    for (j = 0; j < hash_len; j++) {
-                        char one[4];
-                        snprintf(one, sizeof(one), j == hash_len - 1 ? "%02x" : "%02x:", hash[j]);
-                        strlcat(out, one, out_len);
-                    }
-                    SCFree(hash);
-                    ssl_state->server_connp.cert0_fingerprint = SCStrdup(out);
-                    if (ssl_state->server_connp.cert0_fingerprint == NULL) {
-                        // TODO do we need an event here?
-                    }
-                }
-
-                ssl_state->server_connp.cert_input = input;
-                ssl_state->server_connp.cert_input_len = cur_cert_length;
+            /* the fingerprint is only needed for the first cert, unless
+             * the cert goes into the cache */
+            have_fingerprint = 0;
+            if ((i == 0 && ssl_state->server_connp.cert0_fingerprint == NULL) ||
+                    (have_subject && have_issuerdn && tls_cert_cache.entries != NULL)) {
+                have_fingerprint = (TLSCertFingerprint(input, cur_cert_length,
+                            fingerprint, sizeof(fingerprint)) == 0);
+                // TODO maybe an event here if it failed?
+            }
+
+            if (have_subject && have_issuerdn && have_fingerprint) {
+                TLSCertCacheAdd(input, cur_cert_length,
+                        subject, issuerdn, fingerprint);
             }
+
+            if (TLSCertStore(ssl_state, i, input, cur_cert_length,
+                        have_subject ? subject : NULL,
+                        have_issuerdn ? issuerdn : NULL,
+                        have_fingerprint ? fingerprint : NULL) < 0)
+                return -1;
         }
 
+next:
         i++;
         certificates_length -= (cur_cert_length + 3);
         parsed += cur_cert_length;
@@ -218,3 +424,46 @@ int DecodeTLSHandshakeServerCertificate(SSLState *ssl_state, uint8_t *input,
     return parsed;
 }
 
+#ifdef UNITTESTS
+
+static int TLSCertCacheTest01(void)
+{
+    uint8_t cert1[] = "not really a certificate, but the cache doesn't care";
+    uint8_t cert2[] = "not really a certificate, but the cache doesn't care!";
+    char subject[256], issuerdn[256], fingerprint[61];
+
+    TLSCertCacheInit(16);
+    FAIL_IF_NULL(tls_cert_cache.entries);
+
+    FAIL_IF(TLSCertCacheLookup(cert1, sizeof(cert1), subject, sizeof(subject),
+                issuerdn, sizeof(issuerdn), fingerprint, sizeof(fingerprint)));
+
+    FAIL_IF(TLSCertFingerprint(cert1, sizeof(cert1), fingerprint,
+                sizeof(fingerprint)) != 0);
+    FAIL_IF(strlen(fingerprint) != 59);
+    TLSCertCacheAdd(cert1, sizeof(cert1), "CN=subject", "CN=issuer", fingerprint);
+
+    memset(fingerprint, 0, sizeof(fingerprint));
+    FAIL_IF_NOT(TLSCertCacheLookup(cert1, sizeof(cert1), subject, sizeof(subject),
+                issuerdn, sizeof(issuerdn), fingerprint, sizeof(fingerprint)));
+    FAIL_IF(strcmp(subject, "CN=subject") != 0);
+    FAIL_IF(strcmp(issuerdn, "CN=issuer") != 0);
+    FAIL_IF(strlen(fingerprint) != 59);
+
+    /* different cert must not hit, even if it maps to the same slot */
+    FAIL_IF(TLSCertCacheLookup(cert2, sizeof(cert2), subject, sizeof(subject),
+                issuerdn, sizeof(issuerdn), fingerprint, sizeof(fingerprint)));
+
+    TLSCertCacheFree();
+    FAIL_IF_NOT_NULL(tls_cert_cache.entries);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void TLSCertCacheRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("TLSCertCacheTest01", TLSCertCacheTest01);
+#endif
+}
@@ -37,4 +37,11 @@
 
 int DecodeTLSHandshakeServerCertificate(SSLState *ssl_state, uint8_t *input, uint32_t input_len);
 
+/** default number of entries in the decoded certificate cache */
+#define TLS_CERT_CACHE_DEFAULT_SIZE 1024
+
+void TLSCertCacheInit(uint32_t size);
+void TLSCertCacheFree(void);
+void TLSCertCacheRegisterTests(void);
+
 #endif /* __APP_LAYER_TLS_HANDSHAKE_H__ */
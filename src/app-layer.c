@@ -30,6 +30,7 @@
 #include "app-layer-parser.h"
 #include "app-layer-protos.h"
 #include "app-layer-detect-proto.h"
+#include "app-layer-expectation.h"
 #include "stream-tcp-reassemble.h"
 #include "stream-tcp-private.h"
 #include "stream-tcp-inline.h"
@@ -43,6 +44,7 @@
 #include "decode-events.h"
 
 #include "app-layer-htp-mem.h"
+#include "app-layer-htp.h"
 #include "app-layer-dns-common.h"
 
 /**
@@ -140,10 +142,15 @@ int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
 #endif
 
         PACKET_PROFILING_APP_PD_START(app_tctx);
-        *alproto = AppLayerProtoDetectGetProto(app_tctx->alpd_tctx,
-                                f,
-                                data, data_len,
-                                IPPROTO_TCP, flags);
+        /* flows negotiated by a control channel (e.g. ftp-data) don't
+         * need to go through detection */
+        *alproto = AppLayerExpectationLookup(f);
+        if (*alproto == ALPROTO_UNKNOWN) {
+            *alproto = AppLayerProtoDetectGetProto(app_tctx->alpd_tctx,
+                                    f,
+                                    data, data_len,
+                                    IPPROTO_TCP, flags);
+        }
         PACKET_PROFILING_APP_PD_END(app_tctx);
 
         if (*alproto != ALPROTO_UNKNOWN) {
@@ -164,6 +171,10 @@ int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
             f->alproto = *alproto;
             StreamTcpSetStreamFlagAppProtoDetectionCompleted(stream);
 
+            uint32_t stream_depth;
+            if (AppLayerParserGetStreamDepth(f->proto, f->alproto, &stream_depth))
+                StreamTcpSetSessionReassemblyDepth(ssn, stream_depth);
+
             /* if we have seen data from the other direction first, send
              * data for that direction first to the parser.  This shouldn't
              * be an issue, since each stream processing happens
@@ -276,6 +287,8 @@ int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
             PACKET_PROFILING_APP_START(app_tctx, *alproto);
             r = AppLayerParserParse(app_tctx->alp_tctx, f, *alproto, flags, data + data_al_so_far, data_len - data_al_so_far);
             PACKET_PROFILING_APP_END(app_tctx, *alproto);
+            if (r < 0)
+                AppLayerProtoDetectCacheInvalidate(f);
             f->data_al_so_far[dir] = 0;
         } else {
             /* if the ssn is midstream, we may end up with a case where the
@@ -503,6 +516,8 @@ int AppLayerHandleUdp(ThreadVars *tv, AppLayerThreadCtx *tctx, Packet *p, Flow *
                               f, f->alproto, flags,
                               p->payload, p->payload_len);
             PACKET_PROFILING_APP_END(tctx, f->alproto);
+            if (r < 0)
+                AppLayerProtoDetectCacheInvalidate(f);
         } else {
             f->flags |= FLOW_ALPROTO_DETECT_DONE;
             SCLogDebug("ALPROTO_UNKNOWN flow %p", f);
@@ -646,6 +661,10 @@ void AppLayerRegisterGlobalCounters(void)
     StatsRegisterGlobalCounter("dns.memcap_global", DNSMemcapGetMemcapGlobalCounter);
     StatsRegisterGlobalCounter("http.memuse", HTPMemuseGlobalCounter);
     StatsRegisterGlobalCounter("http.memcap", HTPMemcapGlobalCounter);
+    StatsRegisterGlobalCounter("http.decompress_skipped", HTPDecompressSkippedGlobalCounter);
+    StatsRegisterGlobalCounter("http.decompress_budget_exceeded", HTPDecompressBudgetGlobalCounter);
+    StatsRegisterGlobalCounter("app_layer.memuse", AppLayerParserMemuseGlobalCounter);
+    StatsRegisterGlobalCounter("app_layer.flow_memcap", AppLayerParserMemcapGlobalCounter);
 }
 
 /***** Unittests *****/
@@ -35,6 +35,7 @@
 #include "util-debug.h"
 #include "util-privs.h"
 #include "util-signal.h"
+#include "util-lock-contention.h"
 #include "unix-manager.h"
 #include "runmodes.h"
 
@@ -106,15 +107,42 @@ void StatsReleaseCounters(StatsCounter *head);
  *  loggers. Initialized at first use. */
 static StatsTable stats_table = { NULL, NULL, 0, 0, 0, {0 , 0}};
 static SCMutex stats_table_mutex = SCMUTEX_INITIALIZER;
+/** number of times the stats table was filled, protected by
+ *  stats_table_mutex */
+static uint64_t stats_table_updates = 0;
 static int stats_loggers_active = 1;
 
 static uint16_t counters_global_id = 0;
 
+/** times StatsOutput rereads a thread's counters that changed under it,
+ *  before taking the values as they are */
+#define STATS_READ_RETRIES 1000
+
 static void StatsPublicThreadContextInit(StatsPublicThreadContext *t)
 {
+    SC_ATOMIC_INIT(t->seq);
     SCMutexInit(&t->m, NULL);
 }
 
+/** \internal
+ *  \brief start a read of the counter values of 'ctx'
+ *  \retval seq sequence to pass to StatsReadRetry */
+static inline uint32_t StatsReadBegin(const StatsPublicThreadContext *ctx)
+{
+    uint32_t seq = SC_ATOMIC_GET(ctx->seq);
+    __sync_synchronize();
+    return seq;
+}
+
+/** \internal
+ *  \brief check if the values read since StatsReadBegin may be torn
+ *  \retval 1 if they have to be read again */
+static inline int StatsReadRetry(const StatsPublicThreadContext *ctx, uint32_t seq)
+{
+    __sync_synchronize();
+    return ((seq & 1) || SC_ATOMIC_GET(ctx->seq) != seq);
+}
+
 static void StatsPublicThreadContextCleanup(StatsPublicThreadContext *t)
 {
     SCMutexLock(&t->m);
@@ -148,6 +176,30 @@ void StatsAddUI64(ThreadVars *tv, uint16_t id, uint64_t x)
     return;
 }
 
+/**
+ * \brief Adds a value that was accumulated over 'updates' updates to the
+ *        local counter, so that average counters stay correct when the
+ *        caller batches updates
+ *
+ * \param id      Index of the local counter in the counter array
+ * \param x       Sum of the values
+ * \param updates Number of values summed in x
+ */
+void StatsAddUI64Batch(ThreadVars *tv, uint16_t id, uint64_t x, uint64_t updates)
+{
+    StatsPrivateThreadContext *pca = &tv->perf_private_ctx;
+#ifdef UNITTESTS
+    if (pca->initialized == 0)
+        return;
+#endif
+#ifdef DEBUG
+    BUG_ON ((id < 1) || (id > pca->size));
+#endif
+    pca->head[id].value += x;
+    pca->head[id].updates += updates;
+    return;
+}
+
 /**
  * \brief Increments the local counter
  *
@@ -668,28 +720,33 @@ static int StatsOutput(ThreadVars *tv)
         memset(&thread_table, 0x00,
                 max_id * sizeof(struct CountersMergeTable));
 
-        SCMutexLock(&sts->ctx->m);
-        pc = sts->ctx->head;
-        while (pc != NULL) {
-            SCLogDebug("Counter %s (%u:%u) value %"PRIu64,
-                    pc->name, pc->id, pc->gid, pc->value);
+        SCMutexLockCounted(&sts->ctx->m, LOCK_CONTENTION_STATS);
+        uint32_t seq;
+        int tries = 0;
+        do {
+            seq = StatsReadBegin(sts->ctx);
+            pc = sts->ctx->head;
+            while (pc != NULL) {
+                SCLogDebug("Counter %s (%u:%u) value %"PRIu64,
+                        pc->name, pc->id, pc->gid, pc->value);
+
+                thread_table[pc->gid].type = pc->type;
+                switch (pc->type) {
+                    case STATS_TYPE_FUNC:
+                        if (pc->Func != NULL)
+                            thread_table[pc->gid].value = pc->Func();
+                        break;
+                    case STATS_TYPE_AVERAGE:
+                    default:
+                        thread_table[pc->gid].value = pc->value;
+                        break;
+                }
+                thread_table[pc->gid].updates = pc->updates;
+                table[pc->gid].name = pc->name;
 
-            thread_table[pc->gid].type = pc->type;
-            switch (pc->type) {
-                case STATS_TYPE_FUNC:
-                    if (pc->Func != NULL)
-                        thread_table[pc->gid].value = pc->Func();
-                    break;
-                case STATS_TYPE_AVERAGE:
-                default:
-                    thread_table[pc->gid].value = pc->value;
-                    break;
+                pc = pc->next;
             }
-            thread_table[pc->gid].updates = pc->updates;
-            table[pc->gid].name = pc->name;
-
-            pc = pc->next;
-        }
+        } while (StatsReadRetry(sts->ctx, seq) && ++tries < STATS_READ_RETRIES);
         SCMutexUnlock(&sts->ctx->m);
 
         /* update merge table */
@@ -775,6 +832,8 @@ static int StatsOutput(ThreadVars *tv)
         }
     }
 
+    stats_table_updates++;
+
     /* invoke logger(s) */
     if (stats_loggers_active) {
         OutputStatsLog(tv, td, &stats_table);
@@ -803,6 +862,17 @@ TmEcode StatsOutputCounterSocket(json_t *cmd,
     json_object_set_new(answer, "message", message);
     return r;
 }
+
+/** \brief get the number of stats table updates so far, the output of
+ *         StatsOutputCounterSocket() only changes when this does
+ */
+uint64_t StatsTableUpdates(void)
+{
+    SCMutexLock(&stats_table_mutex);
+    uint64_t updates = stats_table_updates;
+    SCMutexUnlock(&stats_table_mutex);
+    return updates;
+}
 #endif /* BUILD_UNIX_SOCKET */
 
 /**
@@ -962,6 +1032,181 @@ uint16_t StatsRegisterGlobalCounter(char *name, uint64_t (*Func)(void))
     return id;
 }
 
+/** histograms registered so far, so that each thread registering the
+ *  same histogram uses the same counter names */
+typedef struct StatsHistogram_ {
+    char *name;
+    char *names[STATS_HISTOGRAM_COUNTERS];
+    struct StatsHistogram_ *next;
+} StatsHistogram;
+
+static StatsHistogram *stats_histograms = NULL;
+static SCMutex stats_histograms_lock = SCMUTEX_INITIALIZER;
+
+/** \internal
+ *  \brief get the histogram 'name', setting up its counter names if
+ *         it's new. Call with stats_histograms_lock held.
+ *  \retval h histogram or NULL on memory error */
+static StatsHistogram *StatsHistogramGet(const char *name)
+{
+    StatsHistogram *h;
+    for (h = stats_histograms; h != NULL; h = h->next) {
+        if (strcmp(h->name, name) == 0)
+            return h;
+    }
+
+    h = SCCalloc(1, sizeof(*h));
+    if (unlikely(h == NULL))
+        return NULL;
+    h->name = SCStrdup(name);
+    if (unlikely(h->name == NULL))
+        goto error;
+
+    int i;
+    for (i = 0; i < STATS_HISTOGRAM_COUNTERS; i++) {
+        char cname[256];
+        if (i < STATS_HISTOGRAM_BUCKETS) {
+            snprintf(cname, sizeof(cname), "%s.bucket.%"PRIu64, name,
+                    (uint64_t)1 << i);
+        } else if (i == STATS_HISTOGRAM_BUCKETS) {
+            snprintf(cname, sizeof(cname), "%s.bucket.inf", name);
+        } else {
+            snprintf(cname, sizeof(cname), "%s.sum", name);
+        }
+        h->names[i] = SCStrdup(cname);
+        if (unlikely(h->names[i] == NULL))
+            goto error;
+    }
+
+    h->next = stats_histograms;
+    stats_histograms = h;
+    return h;
+
+error:
+    for (i = 0; i < STATS_HISTOGRAM_COUNTERS; i++) {
+        if (h->names[i] != NULL)
+            SCFree(h->names[i]);
+    }
+    if (h->name != NULL)
+        SCFree(h->name);
+    SCFree(h);
+    return NULL;
+}
+
+static void StatsHistogramsFree(void)
+{
+    SCMutexLock(&stats_histograms_lock);
+    while (stats_histograms != NULL) {
+        StatsHistogram *h = stats_histograms;
+        stats_histograms = h->next;
+
+        int i;
+        for (i = 0; i < STATS_HISTOGRAM_COUNTERS; i++)
+            SCFree(h->names[i]);
+        SCFree(h->name);
+        SCFree(h);
+    }
+    SCMutexUnlock(&stats_histograms_lock);
+}
+
+/**
+ * \brief Registers a histogram: STATS_HISTOGRAM_BUCKETS buckets counting
+ *        the values up to 1, 2, 4 ... 2^(STATS_HISTOGRAM_BUCKETS-1), a
+ *        bucket for everything above and the sum of the values.
+ *
+ *        They are plain counters named "<name>.bucket.<upper bound>",
+ *        "<name>.bucket.inf" and "<name>.sum", so every stats output
+ *        shows them. Buckets are not cumulative.
+ *
+ * \param name Name of the histogram
+ * \param tv   Pointer to the ThreadVars instance for which the histogram
+ *             would be registered
+ *
+ * \retval id to pass to StatsHistogramAdd, 0 on failure
+ */
+uint16_t StatsRegisterHistogramCounter(const char *name, struct ThreadVars_ *tv)
+{
+    if (name == NULL || tv == NULL)
+        return 0;
+
+    SCMutexLock(&stats_histograms_lock);
+    StatsHistogram *h = StatsHistogramGet(name);
+    SCMutexUnlock(&stats_histograms_lock);
+    if (h == NULL)
+        return 0;
+
+    /* ids are handed out in order, so the counters of the histogram
+     * follow the first one */
+    uint16_t id = 0;
+    int i;
+    for (i = 0; i < STATS_HISTOGRAM_COUNTERS; i++) {
+        uint16_t cid = StatsRegisterCounter(h->names[i], tv);
+        if (i == 0)
+            id = cid;
+        else if (cid != id + i)
+            return 0;
+    }
+    return id;
+}
+
+/**
+ * \brief Adds a value to a histogram. Only touches the thread's local
+ *        counters, like the other counter updates.
+ *
+ * \param id    Id returned by StatsRegisterHistogramCounter
+ * \param value Value to add, e.g. a latency
+ */
+void StatsHistogramAdd(ThreadVars *tv, uint16_t id, uint64_t value)
+{
+    if (id == 0)
+        return;
+
+    uint16_t bucket = 0;
+    if (value > 1) {
+        bucket = 64 - __builtin_clzll(value - 1);
+        if (bucket > STATS_HISTOGRAM_BUCKETS)
+            bucket = STATS_HISTOGRAM_BUCKETS;
+    }
+    StatsIncr(tv, id + bucket);
+    StatsAddUI64(tv, id + STATS_HISTOGRAM_BUCKETS + 1, value);
+}
+
+/**
+ * \brief Tells if a counter is part of a histogram, for outputs that
+ *        render histograms as such.
+ *
+ * \param name     Counter name
+ * \param base_len Set to the length of the histogram name in 'name'
+ *
+ * \retval -1 not a histogram counter
+ * \retval idx 0 .. STATS_HISTOGRAM_BUCKETS-1 for the buckets,
+ *             STATS_HISTOGRAM_BUCKETS for the +Inf bucket and
+ *             STATS_HISTOGRAM_BUCKETS+1 for the sum
+ */
+int StatsHistogramCounterIndex(const char *name, size_t *base_len)
+{
+    int r = -1;
+
+    SCMutexLock(&stats_histograms_lock);
+    StatsHistogram *h;
+    for (h = stats_histograms; h != NULL && r == -1; h = h->next) {
+        size_t len = strlen(h->name);
+        if (strncmp(name, h->name, len) != 0 || name[len] != '.')
+            continue;
+
+        int i;
+        for (i = 0; i < STATS_HISTOGRAM_COUNTERS; i++) {
+            if (strcmp(name, h->names[i]) == 0) {
+                *base_len = len;
+                r = i;
+                break;
+            }
+        }
+    }
+    SCMutexUnlock(&stats_histograms_lock);
+    return r;
+}
+
 typedef struct CountersIdType_ {
     uint16_t id;
     const char *string;
@@ -1156,6 +1401,16 @@ int StatsSetupPrivate(ThreadVars *tv)
     return 0;
 }
 
+/**
+ * \brief set up the local counters of a tv that isn't run by the thread
+ *        manager. Its counters are not merged into the stats, release them
+ *        with StatsThreadCleanup().
+ */
+int StatsSetupPrivateLocal(ThreadVars *tv)
+{
+    return StatsGetAllCountersArray(&(tv)->perf_public_ctx, &(tv)->perf_private_ctx);
+}
+
 /**
  * \brief Syncs the counter array with the global counter variables
  *
@@ -1177,11 +1432,13 @@ int StatsUpdateCounterArray(StatsPrivateThreadContext *pca, StatsPublicThreadCon
 
     pcae = pca->head;
 
-    SCMutexLock(&pctx->m);
+    /* only this thread writes the values, readers retry if the
+     * sequence was odd or moved while they read */
+    SC_ATOMIC_ADD(pctx->seq, 1);
     for (i = 1; i <= pca->size; i++) {
         StatsCopyCounterValue(&pcae[i]);
     }
-    SCMutexUnlock(&pctx->m);
+    SC_ATOMIC_ADD(pctx->seq, 1);
 
     pctx->perf_flag = 0;
 
@@ -1212,6 +1469,7 @@ uint64_t StatsGetLocalCounterValue(ThreadVars *tv, uint16_t id)
 void StatsReleaseResources()
 {
     StatsReleaseCtx();
+    StatsHistogramsFree();
 
     return;
 }
@@ -1519,6 +1777,75 @@ static int StatsTestCounterValues11()
     return result;
 }
 
+/** \test an update moves the sequence on by 2 and leaves it even, so a
+ *        reader can tell it raced with it */
+static int StatsTestSeqlock12(void)
+{
+    ThreadVars tv;
+    StatsPrivateThreadContext *pca = NULL;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    uint16_t id = RegisterCounter("t1", "c1", &tv.perf_public_ctx);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+    pca = &tv.perf_private_ctx;
+
+    uint32_t seq = StatsReadBegin(&tv.perf_public_ctx);
+    FAIL_IF(StatsReadRetry(&tv.perf_public_ctx, seq));
+
+    StatsAddUI64(&tv, id, 42);
+    StatsUpdateCounterArray(pca, &tv.perf_public_ctx);
+
+    FAIL_IF_NOT(StatsReadRetry(&tv.perf_public_ctx, seq));
+    FAIL_IF(SC_ATOMIC_GET(tv.perf_public_ctx.seq) != seq + 2);
+    FAIL_IF(tv.perf_public_ctx.head->value != 42);
+
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(pca);
+    PASS;
+}
+
+static int StatsTestHistogram13(void)
+{
+    ThreadVars tv;
+    StatsPrivateThreadContext *pca = NULL;
+    size_t len = 0;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    uint16_t id = StatsRegisterHistogramCounter("t.lat", &tv);
+    FAIL_IF(id == 0);
+    /* second registration gives the same counters */
+    FAIL_IF(StatsRegisterHistogramCounter("t.lat", &tv) != id);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+    pca = &tv.perf_private_ctx;
+
+    StatsHistogramAdd(&tv, id, 0);
+    StatsHistogramAdd(&tv, id, 1);
+    StatsHistogramAdd(&tv, id, 3);
+    StatsHistogramAdd(&tv, id, 4);
+    StatsHistogramAdd(&tv, id, 5);
+    StatsHistogramAdd(&tv, id, UINT64_MAX / 2);
+
+    FAIL_IF(pca->head[id].value != 2);
+    FAIL_IF(pca->head[id + 2].value != 2);
+    FAIL_IF(pca->head[id + 3].value != 1);
+    FAIL_IF(pca->head[id + STATS_HISTOGRAM_BUCKETS].value != 1);
+    FAIL_IF(pca->head[id + STATS_HISTOGRAM_BUCKETS + 1].value !=
+            13 + UINT64_MAX / 2);
+
+    FAIL_IF(StatsHistogramCounterIndex("t.lat.bucket.4", &len) != 2);
+    FAIL_IF(len != 5);
+    FAIL_IF(StatsHistogramCounterIndex("t.lat.sum", &len) !=
+            STATS_HISTOGRAM_BUCKETS + 1);
+    FAIL_IF(StatsHistogramCounterIndex("t.lat", &len) != -1);
+
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(pca);
+    StatsHistogramsFree();
+    PASS;
+}
+
 #endif
 
 void StatsRegisterTests()
@@ -1535,5 +1862,7 @@ void StatsRegisterTests()
     UtRegisterTest("StatsTestUpdateGlobalCounter10",
                    StatsTestUpdateGlobalCounter10);
     UtRegisterTest("StatsTestCounterValues11", StatsTestCounterValues11);
+    UtRegisterTest("StatsTestSeqlock12", StatsTestSeqlock12);
+    UtRegisterTest("StatsTestHistogram13", StatsTestHistogram13);
 #endif
 }
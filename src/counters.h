@@ -68,7 +68,12 @@ typedef struct StatsPublicThreadContext_ {
     /* holds the total no of counters already assigned for this perf context */
     uint16_t curr_id;
 
-    /* mutex to prevent simultaneous access during update_counter/output_stat */
+    /* seqlock for the counter values: odd while the owning thread copies
+     * its local counters in, so readers never block the owner */
+    SC_ATOMIC_DECLARE(uint32_t, seq);
+
+    /* mutex to protect the counter list against registration/cleanup
+     * while it's being output. Not taken by the owning thread on updates. */
     SCMutex m;
 } StatsPublicThreadContext;
 
@@ -103,6 +108,12 @@ typedef struct StatsPrivateThreadContext_ {
     int initialized;
 } StatsPrivateThreadContext;
 
+/** number of finite buckets of a histogram: bucket k counts the values
+ *  up to 2^k */
+#define STATS_HISTOGRAM_BUCKETS 32
+/** counters per histogram: the buckets, +Inf and the sum */
+#define STATS_HISTOGRAM_COUNTERS (STATS_HISTOGRAM_BUCKETS + 2)
+
 /* the initialization functions */
 void StatsInit(void);
 void StatsSetupPostConfig(void);
@@ -117,16 +128,21 @@ uint16_t StatsRegisterCounter(char *, struct ThreadVars_ *);
 uint16_t StatsRegisterAvgCounter(char *, struct ThreadVars_ *);
 uint16_t StatsRegisterMaxCounter(char *, struct ThreadVars_ *);
 uint16_t StatsRegisterGlobalCounter(char *cname, uint64_t (*Func)(void));
+uint16_t StatsRegisterHistogramCounter(const char *, struct ThreadVars_ *);
 
 /* functions used to update local counter values */
 void StatsAddUI64(struct ThreadVars_ *, uint16_t, uint64_t);
+void StatsAddUI64Batch(struct ThreadVars_ *, uint16_t, uint64_t, uint64_t);
 void StatsSetUI64(struct ThreadVars_ *, uint16_t, uint64_t);
 void StatsIncr(struct ThreadVars_ *, uint16_t);
+void StatsHistogramAdd(struct ThreadVars_ *, uint16_t, uint64_t);
 
 /* utility functions */
 int StatsUpdateCounterArray(StatsPrivateThreadContext *, StatsPublicThreadContext *);
 uint64_t StatsGetLocalCounterValue(struct ThreadVars_ *, uint16_t);
 int StatsSetupPrivate(struct ThreadVars_ *);
+int StatsSetupPrivateLocal(struct ThreadVars_ *);
+int StatsHistogramCounterIndex(const char *, size_t *);
 void StatsThreadCleanup(struct ThreadVars_ *);
 
 #define StatsSyncCounters(tv) \
@@ -143,6 +159,7 @@ void StatsThreadCleanup(struct ThreadVars_ *);
 #ifdef BUILD_UNIX_SOCKET
 TmEcode StatsOutputCounterSocket(json_t *cmd,
                                  json_t *answer, void *data);
+uint64_t StatsTableUpdates(void);
 #endif
 
 #endif /* __COUNTERS_H__ */
@@ -0,0 +1,565 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Named sets for the 'dataset' keyword, see datasets.h.
+ *
+ * A set is loaded from its file the first time a rule uses it and then
+ * kept for the lifetime of the process, so a rule reload doesn't load
+ * it again. The 'dataset-reload' unix socket command loads the file into
+ * a new table and swaps it in under the write lock.
+ *
+ * The items are kept in one block of memory with an open addressing
+ * table of offsets on top, about 6 bytes per item on top of the item
+ * itself. A lookup is a single probe sequence, domains take one per
+ * label: 'www.example.com' is looked up as 'www.example.com',
+ * 'example.com' and 'com'.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "datasets.h"
+
+#include "util-hash-lookup3.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#ifdef BUILD_UNIX_SOCKET
+#include <jansson.h>
+#endif
+
+#define DATASET_TABLE_MIN_SIZE  1024
+/** longest item, domains can't be longer than 253 */
+#define DATASET_ITEM_MAX_LEN    1024
+
+static Dataset *sets = NULL;
+static SCMutex sets_lock = SCMUTEX_INITIALIZER;
+
+static DatasetTable *DatasetTableAlloc(uint32_t size)
+{
+    DatasetTable *t = SCMalloc(sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    memset(t, 0x00, sizeof(*t));
+
+    t->slots = SCCalloc(size, sizeof(uint32_t));
+    if (t->slots == NULL) {
+        SCFree(t);
+        return NULL;
+    }
+    t->size = size;
+    return t;
+}
+
+static void DatasetTableFree(DatasetTable *t)
+{
+    if (t == NULL)
+        return;
+    if (t->slots != NULL)
+        SCFree(t->slots);
+    if (t->data != NULL)
+        SCFree(t->data);
+    SCFree(t);
+}
+
+static inline const uint8_t *DatasetTableItem(const DatasetTable *t,
+        uint32_t slot, uint16_t *len)
+{
+    const uint8_t *item = t->data + (t->slots[slot] - 1);
+    memcpy(len, item, sizeof(*len));
+    return item + sizeof(uint16_t);
+}
+
+/** \retval slot of the item, or of the empty slot where it goes */
+static uint32_t DatasetTableProbe(const DatasetTable *t, const uint8_t *data,
+        uint16_t data_len)
+{
+    const uint32_t mask = t->size - 1;
+    uint32_t slot = hashlittle_safe(data, data_len, 0) & mask;
+
+    while (t->slots[slot] != 0) {
+        uint16_t len;
+        const uint8_t *item = DatasetTableItem(t, slot, &len);
+        if (len == data_len && memcmp(item, data, len) == 0)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/** \internal
+ *  \brief double the slots, the items stay where they are */
+static int DatasetTableGrow(DatasetTable *t)
+{
+    uint32_t *old = t->slots;
+    uint32_t old_size = t->size;
+    uint32_t i;
+
+    t->slots = SCCalloc(old_size * 2, sizeof(uint32_t));
+    if (t->slots == NULL) {
+        t->slots = old;
+        return -1;
+    }
+    t->size = old_size * 2;
+
+    for (i = 0; i < old_size; i++) {
+        if (old[i] == 0)
+            continue;
+
+        uint16_t len;
+        const uint8_t *item = t->data + (old[i] - 1);
+        memcpy(&len, item, sizeof(len));
+        t->slots[DatasetTableProbe(t, item + sizeof(len), len)] = old[i];
+    }
+    SCFree(old);
+    return 0;
+}
+
+/**
+ * \retval 1 added
+ * \retval 0 already in the table
+ * \retval -1 error
+ */
+static int DatasetTableAdd(DatasetTable *t, const uint8_t *data, uint16_t data_len)
+{
+    if ((t->cnt + 1) * 2 > t->size) {
+        if (DatasetTableGrow(t) < 0)
+            return -1;
+    }
+
+    uint32_t slot = DatasetTableProbe(t, data, data_len);
+    if (t->slots[slot] != 0)
+        return 0;
+
+    uint32_t need = sizeof(uint16_t) + data_len;
+    if (t->data_len + need > t->data_size) {
+        uint32_t size = t->data_size ? t->data_size : 65536;
+        while (t->data_len + need > size) {
+            if (size > UINT32_MAX / 2)
+                return -1;
+            size *= 2;
+        }
+
+        uint8_t *ptr = SCRealloc(t->data, size);
+        if (ptr == NULL)
+            return -1;
+        t->data = ptr;
+        t->data_size = size;
+    }
+
+    memcpy(t->data + t->data_len, &data_len, sizeof(data_len));
+    memcpy(t->data + t->data_len + sizeof(data_len), data, data_len);
+    t->slots[slot] = t->data_len + 1;
+    t->data_len += need;
+    t->cnt++;
+    return 1;
+}
+
+static inline int DatasetTableLookup(const DatasetTable *t, const uint8_t *data,
+        uint16_t data_len)
+{
+    return (t->slots[DatasetTableProbe(t, data, data_len)] != 0);
+}
+
+/** \internal
+ *  \brief bring a domain to the form it is stored in: lower case, without
+ *         a leading '*.' or '.' and without the trailing '.'
+ *
+ *  \retval length of the domain in out, 0 if it doesn't fit
+ */
+static uint32_t DatasetDomainNormalize(const uint8_t *data, uint32_t data_len,
+        uint8_t *out, uint32_t out_size)
+{
+    if (data_len >= 2 && data[0] == '*' && data[1] == '.') {
+        data += 2;
+        data_len -= 2;
+    }
+    while (data_len > 0 && data[0] == '.') {
+        data++;
+        data_len--;
+    }
+    while (data_len > 0 && data[data_len - 1] == '.')
+        data_len--;
+
+    if (data_len == 0 || data_len > out_size)
+        return 0;
+
+    uint32_t i;
+    for (i = 0; i < data_len; i++)
+        out[i] = u8_tolower(data[i]);
+    return data_len;
+}
+
+static int DatasetTableAddItem(const Dataset *set, DatasetTable *t,
+        const uint8_t *data, uint32_t data_len)
+{
+    uint8_t buf[DATASET_ITEM_MAX_LEN];
+
+    if (set->type == DATASET_TYPE_DOMAIN) {
+        data_len = DatasetDomainNormalize(data, data_len, buf, sizeof(buf));
+        data = buf;
+    }
+    if (data_len == 0 || data_len > DATASET_ITEM_MAX_LEN)
+        return 0;
+
+    return DatasetTableAdd(t, data, (uint16_t)data_len);
+}
+
+/** \internal
+ *  \brief load the file of the set into a new table
+ *
+ *  One item per line. Empty lines and lines starting with '#' are
+ *  skipped, as is white space around the item.
+ */
+static DatasetTable *DatasetLoad(const Dataset *set)
+{
+    DatasetTable *t = DatasetTableAlloc(DATASET_TABLE_MIN_SIZE);
+    if (t == NULL)
+        return NULL;
+    if (set->file == NULL)
+        return t;
+
+    FILE *fp = fopen(set->file, "r");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "dataset %s: failed to open %s: %s",
+                set->name, set->file, strerror(errno));
+        DatasetTableFree(t);
+        return NULL;
+    }
+
+    char line[DATASET_ITEM_MAX_LEN + 2];
+    uint32_t line_no = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_no++;
+
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] != '\n' && !feof(fp)) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "dataset %s: line %u of %s "
+                    "is too long, skipping", set->name, line_no, set->file);
+            int c;
+            while ((c = fgetc(fp)) != EOF && c != '\n')
+                ;
+            continue;
+        }
+
+        char *item = line;
+        while (isspace((unsigned char)*item))
+            item++;
+        len = strlen(item);
+        while (len > 0 && isspace((unsigned char)item[len - 1]))
+            len--;
+        if (len == 0 || item[0] == '#')
+            continue;
+
+        if (DatasetTableAddItem(set, t, (const uint8_t *)item, (uint32_t)len) < 0) {
+            SCLogError(SC_ERR_MEM_ALLOC, "dataset %s: out of memory loading "
+                    "%s", set->name, set->file);
+            fclose(fp);
+            DatasetTableFree(t);
+            return NULL;
+        }
+    }
+    fclose(fp);
+
+    SCLogConfig("dataset %s: %u items from %s", set->name, t->cnt, set->file);
+    return t;
+}
+
+static int DatasetParseType(const char *str)
+{
+    if (str == NULL || strcasecmp(str, "string") == 0)
+        return DATASET_TYPE_STRING;
+    if (strcasecmp(str, "domain") == 0)
+        return DATASET_TYPE_DOMAIN;
+    return DATASET_TYPE_NOTSET;
+}
+
+static void DatasetFree(Dataset *set)
+{
+    DatasetTableFree(set->table);
+    if (set->file != NULL)
+        SCFree(set->file);
+    SCRWLockDestroy(&set->lock);
+    SCFree(set);
+}
+
+/**
+ * \brief get the set 'name', loaded from datasets.<name> on first use
+ *
+ * \retval set or NULL if it is not defined or failed to load
+ */
+Dataset *DatasetGet(const char *name)
+{
+    Dataset *set;
+
+    if (strlen(name) >= sizeof(set->name)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "dataset name '%s' too long", name);
+        return NULL;
+    }
+
+    SCMutexLock(&sets_lock);
+    for (set = sets; set != NULL; set = set->next) {
+        if (strcmp(set->name, name) == 0) {
+            SCMutexUnlock(&sets_lock);
+            return set;
+        }
+    }
+
+    ConfNode *root = ConfGetNode("datasets");
+    ConfNode *node = root ? ConfNodeLookupChild(root, name) : NULL;
+    if (node == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "dataset '%s' is not defined "
+                "in the datasets section of the yaml", name);
+        goto error;
+    }
+
+    int type = DatasetParseType(ConfNodeLookupChildValue(node, "type"));
+    if (type == DATASET_TYPE_NOTSET) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "dataset %s: type must "
+                "be string or domain", name);
+        goto error;
+    }
+
+    set = SCMalloc(sizeof(*set));
+    if (set == NULL)
+        goto error;
+    memset(set, 0x00, sizeof(*set));
+    strlcpy(set->name, name, sizeof(set->name));
+    set->type = type;
+    SCRWLockInit(&set->lock, NULL);
+
+    const char *file = ConfNodeLookupChildValue(node, "file");
+    if (file != NULL) {
+        set->file = SCStrdup(file);
+        if (set->file == NULL) {
+            DatasetFree(set);
+            goto error;
+        }
+    }
+
+    set->table = DatasetLoad(set);
+    if (set->table == NULL) {
+        DatasetFree(set);
+        goto error;
+    }
+
+    set->next = sets;
+    sets = set;
+    SCMutexUnlock(&sets_lock);
+    return set;
+
+error:
+    SCMutexUnlock(&sets_lock);
+    return NULL;
+}
+
+/**
+ * \brief add an item to the set, for sets without a file
+ *
+ * \retval 1 added, 0 already there, -1 error
+ */
+int DatasetAdd(Dataset *set, const uint8_t *data, uint32_t data_len)
+{
+    SCRWLockWRLock(&set->lock);
+    int r = DatasetTableAddItem(set, set->table, data, data_len);
+    SCRWLockUnlock(&set->lock);
+    return r;
+}
+
+/**
+ * \retval 1 the buffer is in the set, or for domain sets the buffer or
+ *           one of its parent domains
+ * \retval 0 not in the set
+ */
+int DatasetLookup(Dataset *set, const uint8_t *data, uint32_t data_len)
+{
+    int r = 0;
+
+    if (set->type == DATASET_TYPE_DOMAIN) {
+        uint8_t buf[256];
+        uint32_t len = DatasetDomainNormalize(data, data_len, buf, sizeof(buf));
+        if (len == 0)
+            return 0;
+
+        SCRWLockRDLock(&set->lock);
+        const uint8_t *label = buf;
+        const uint8_t *end = buf + len;
+        while (label < end) {
+            if (DatasetTableLookup(set->table, label, (uint16_t)(end - label))) {
+                r = 1;
+                break;
+            }
+            label = memchr(label, '.', end - label);
+            if (label == NULL)
+                break;
+            label++;
+        }
+        SCRWLockUnlock(&set->lock);
+        return r;
+    }
+
+    if (data_len == 0 || data_len > DATASET_ITEM_MAX_LEN)
+        return 0;
+
+    SCRWLockRDLock(&set->lock);
+    r = DatasetTableLookup(set->table, data, (uint16_t)data_len);
+    SCRWLockUnlock(&set->lock);
+    return r;
+}
+
+/**
+ * \brief load the file of set 'name' again
+ *
+ * The old table stays in use until the new one is loaded.
+ *
+ * \retval number of items, -1 on error
+ */
+int DatasetReload(const char *name)
+{
+    Dataset *set;
+
+    SCMutexLock(&sets_lock);
+    for (set = sets; set != NULL; set = set->next) {
+        if (strcmp(set->name, name) == 0)
+            break;
+    }
+    SCMutexUnlock(&sets_lock);
+
+    if (set == NULL || set->file == NULL)
+        return -1;
+
+    DatasetTable *t = DatasetLoad(set);
+    if (t == NULL)
+        return -1;
+
+    SCRWLockWRLock(&set->lock);
+    DatasetTable *old = set->table;
+    set->table = t;
+    SCRWLockUnlock(&set->lock);
+
+    DatasetTableFree(old);
+    return (int)t->cnt;
+}
+
+void DatasetsShutdown(void)
+{
+    SCMutexLock(&sets_lock);
+    while (sets != NULL) {
+        Dataset *next = sets->next;
+        DatasetFree(sets);
+        sets = next;
+    }
+    SCMutexUnlock(&sets_lock);
+}
+
+#ifdef BUILD_UNIX_SOCKET
+/**
+ * \brief 'dataset-reload' unix socket command
+ *
+ * Arguments: "name" of the set to load from its file again.
+ */
+TmEcode DatasetReloadCommand(json_t *cmd, json_t *answer, void *data)
+{
+    json_t *jarg = json_object_get(cmd, "name");
+    if (!json_is_string(jarg)) {
+        json_object_set_new(answer, "message", json_string("name is not a string"));
+        return TM_ECODE_FAILED;
+    }
+    const char *name = json_string_value(jarg);
+
+    int cnt = DatasetReload(name);
+    if (cnt < 0) {
+        json_object_set_new(answer, "message", json_string("dataset not "
+                    "in use, without file or failed to load"));
+        return TM_ECODE_FAILED;
+    }
+
+    SCLogInfo("dataset %s: reloaded, %d items", name, cnt);
+    json_object_set_new(answer, "message", json_integer(cnt));
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#ifdef UNITTESTS
+static int DatasetsTest01(void)
+{
+    Dataset set;
+    int i;
+
+    memset(&set, 0x00, sizeof(set));
+    set.type = DATASET_TYPE_STRING;
+    SCRWLockInit(&set.lock, NULL);
+    set.table = DatasetTableAlloc(DATASET_TABLE_MIN_SIZE);
+    FAIL_IF_NULL(set.table);
+
+    /* enough to grow the table a few times */
+    for (i = 0; i < 5000; i++) {
+        char item[32];
+        snprintf(item, sizeof(item), "item-%d", i);
+        FAIL_IF(DatasetAdd(&set, (uint8_t *)item, strlen(item)) != 1);
+    }
+    FAIL_IF(DatasetAdd(&set, (uint8_t *)"item-1", 6) != 0);
+    FAIL_IF(set.table->cnt != 5000);
+
+    FAIL_IF_NOT(DatasetLookup(&set, (uint8_t *)"item-0", 6));
+    FAIL_IF_NOT(DatasetLookup(&set, (uint8_t *)"item-4999", 9));
+    FAIL_IF(DatasetLookup(&set, (uint8_t *)"item-5000", 9));
+    FAIL_IF(DatasetLookup(&set, (uint8_t *)"item-", 5));
+    FAIL_IF(DatasetLookup(&set, (uint8_t *)"ITEM-1", 6));
+
+    DatasetTableFree(set.table);
+    SCRWLockDestroy(&set.lock);
+    PASS;
+}
+
+/** \test domain sets match the domain and its sub domains */
+static int DatasetsTest02(void)
+{
+    Dataset set;
+
+    memset(&set, 0x00, sizeof(set));
+    set.type = DATASET_TYPE_DOMAIN;
+    SCRWLockInit(&set.lock, NULL);
+    set.table = DatasetTableAlloc(DATASET_TABLE_MIN_SIZE);
+    FAIL_IF_NULL(set.table);
+
+    FAIL_IF(DatasetAdd(&set, (uint8_t *)"*.Evil.example", 14) != 1);
+    FAIL_IF(DatasetAdd(&set, (uint8_t *)"evil.example.", 13) != 0);
+
+    FAIL_IF_NOT(DatasetLookup(&set, (uint8_t *)"evil.example", 12));
+    FAIL_IF_NOT(DatasetLookup(&set, (uint8_t *)"WWW.evil.example", 16));
+    FAIL_IF_NOT(DatasetLookup(&set, (uint8_t *)"a.b.evil.example.", 17));
+    FAIL_IF(DatasetLookup(&set, (uint8_t *)"notevil.example", 15));
+    FAIL_IF(DatasetLookup(&set, (uint8_t *)"example", 7));
+    FAIL_IF(DatasetLookup(&set, (uint8_t *)"evil.example.org", 16));
+
+    DatasetTableFree(set.table);
+    SCRWLockDestroy(&set.lock);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DatasetsRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DatasetsTest01", DatasetsTest01);
+    UtRegisterTest("DatasetsTest02 -- domains", DatasetsTest02);
+#endif
+}
@@ -0,0 +1,69 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Named sets of strings or domains, defined in the 'datasets' section of
+ * the yaml and shared by the rules of all detect engines.
+ */
+
+#ifndef __DATASETS_H__
+#define __DATASETS_H__
+
+enum DatasetTypes {
+    DATASET_TYPE_NOTSET = 0,
+    DATASET_TYPE_STRING,    /**< exact match on the buffer */
+    DATASET_TYPE_DOMAIN,    /**< the buffer or a parent domain of it */
+};
+
+/** open addressing table of the items, read only once built */
+typedef struct DatasetTable_ {
+    uint32_t *slots;        /**< offset + 1 of the item in data, 0 is empty */
+    uint32_t size;          /**< number of slots, power of 2 */
+    uint32_t cnt;           /**< number of items */
+    uint8_t *data;          /**< items: uint16_t length, then the bytes */
+    uint32_t data_len;
+    uint32_t data_size;
+} DatasetTable;
+
+typedef struct Dataset_ {
+    char name[64];
+    int type;
+    char *file;
+
+    /** taken for reading by the lookups, for writing to swap the table
+     *  on a reload */
+    SCRWLock lock;
+    DatasetTable *table;
+
+    struct Dataset_ *next;
+} Dataset;
+
+Dataset *DatasetGet(const char *name);
+int DatasetAdd(Dataset *set, const uint8_t *data, uint32_t data_len);
+int DatasetLookup(Dataset *set, const uint8_t *data, uint32_t data_len);
+int DatasetReload(const char *name);
+void DatasetsShutdown(void);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode DatasetReloadCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+
+void DatasetsRegisterTests(void);
+
+#endif /* __DATASETS_H__ */
@@ -56,7 +56,9 @@ int DecodeEthernet(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
 
     switch (ntohs(p->ethh->eth_type)) {
         case ETHERNET_TYPE_IP:
-            //printf("DecodeEthernet ip4\n");
+            if (likely(DecodeIPV4Fast(tv, dtv, p, pkt + ETHERNET_HEADER_LEN,
+                            len - ETHERNET_HEADER_LEN, pq)))
+                break;
             DecodeIPV4(tv, dtv, p, pkt + ETHERNET_HEADER_LEN,
                        len - ETHERNET_HEADER_LEN, pq);
             break;
@@ -142,6 +144,69 @@ static int DecodeEthernetTest01 (void)
     SCFree(p);
     return 1;
 }
+
+/** \test IPv4/TCP without options goes through the fast path, IPv4 with
+ *        options through the generic decoder, both with the same result */
+static int DecodeEthernetTest02 (void)
+{
+    uint8_t raw_eth[] = {
+        0x00, 0x10, 0x94, 0x55, 0x00, 0x01, 0x00, 0x10,
+        0x94, 0x56, 0x00, 0x01, 0x08, 0x00,
+        /* ipv4 */
+        0x45, 0x00, 0x00, 0x2c, 0x00, 0x01, 0x40, 0x00,
+        0x40, 0x06, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        /* tcp */
+        0x04, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x00, 0x50, 0x02, 0x10, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        /* payload */
+        'a', 'b', 'c', 'd' };
+    uint8_t raw_eth_opt[] = {
+        0x00, 0x10, 0x94, 0x55, 0x00, 0x01, 0x00, 0x10,
+        0x94, 0x56, 0x00, 0x01, 0x08, 0x00,
+        /* ipv4 with a NOP/EOL option word */
+        0x46, 0x00, 0x00, 0x30, 0x00, 0x01, 0x40, 0x00,
+        0x40, 0x06, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02, 0x01, 0x01, 0x01, 0x00,
+        /* tcp */
+        0x04, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x00, 0x50, 0x02, 0x10, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        /* payload */
+        'a', 'b', 'c', 'd' };
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&tv,  0, sizeof(ThreadVars));
+
+    FAIL_IF(DecodeIPV4Fast(&tv, &dtv, NULL, raw_eth_opt + ETHERNET_HEADER_LEN,
+                sizeof(raw_eth_opt) - ETHERNET_HEADER_LEN, NULL) != 0);
+
+    Packet *p1 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p1);
+    Packet *p2 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p2);
+
+    DecodeEthernet(&tv, &dtv, p1, raw_eth, sizeof(raw_eth), NULL);
+    DecodeEthernet(&tv, &dtv, p2, raw_eth_opt, sizeof(raw_eth_opt), NULL);
+
+    FAIL_IF_NOT(PKT_IS_IPV4(p1) && PKT_IS_TCP(p1));
+    FAIL_IF_NOT(PKT_IS_IPV4(p2) && PKT_IS_TCP(p2));
+    FAIL_IF(p1->proto != IPPROTO_TCP || p2->proto != IPPROTO_TCP);
+    FAIL_IF(p1->sp != 1024 || p1->dp != 80);
+    FAIL_IF(p1->sp != p2->sp || p1->dp != p2->dp);
+    FAIL_IF(CMP_ADDR(&p1->src, &p2->src) == 0 || CMP_ADDR(&p1->dst, &p2->dst) == 0);
+    FAIL_IF(p1->payload_len != 4 || p2->payload_len != 4);
+    FAIL_IF(memcmp(p1->payload, "abcd", 4) != 0);
+    FAIL_IF(p1->flow_hash != p2->flow_hash);
+    FAIL_IF_NOT(p1->flags & PKT_WANTS_FLOW);
+
+    PacketFree(p1);
+    PacketFree(p2);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 
@@ -153,6 +218,7 @@ void DecodeEthernetRegisterTests(void)
 {
 #ifdef UNITTESTS
     UtRegisterTest("DecodeEthernetTest01", DecodeEthernetTest01);
+    UtRegisterTest("DecodeEthernetTest02", DecodeEthernetTest02);
 #endif /* UNITTESTS */
 }
 /**
@@ -144,6 +144,20 @@ void DecodeIPV6FragHeader(Packet *p, uint8_t *pkt,
             p->ip6eh.fh_data_len);
 }
 
+/** \internal
+ *  \brief record an extension header in p->ip6eh.eh */
+static inline void DecodeIPV6ExtHdrRecord(Packet *p, uint8_t type,
+        const uint8_t *pkt, uint16_t hdrextlen)
+{
+    if (p->ip6eh.eh_cnt < IPV6_EXTHDR_MAX) {
+        IPV6ExtHdrRec *rec = &p->ip6eh.eh[p->ip6eh.eh_cnt++];
+        rec->type = type;
+        rec->nh = (type == IPPROTO_ESP) ? IPPROTO_NONE : *pkt;
+        rec->offset = (uint16_t)(pkt - GET_PKT_DATA(p));
+        rec->len = hdrextlen;
+    }
+}
+
 static void
 DecodeIPV6ExtHdrs(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, uint16_t len, PacketQueue *pq)
 {
@@ -207,6 +221,7 @@ DecodeIPV6ExtHdrs(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt
                     ENGINE_SET_EVENT(p, IPV6_TRUNC_EXTHDR);
                     SCReturn;
                 }
+                DecodeIPV6ExtHdrRecord(p, nh, pkt, hdrextlen);
 
                 if (rh) {
                     ENGINE_SET_EVENT(p, IPV6_EXTHDR_DUPL_RH);
@@ -246,6 +261,7 @@ DecodeIPV6ExtHdrs(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt
                     ENGINE_SET_EVENT(p, IPV6_TRUNC_EXTHDR);
                     SCReturn;
                 }
+                DecodeIPV6ExtHdrRecord(p, nh, pkt, hdrextlen);
 
                 uint8_t *ptr = pkt + 2; /* +2 to go past nxthdr and len */
 
@@ -425,6 +441,7 @@ DecodeIPV6ExtHdrs(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt
                     ENGINE_SET_EVENT(p, IPV6_TRUNC_EXTHDR);
                     SCReturn;
                 }
+                DecodeIPV6ExtHdrRecord(p, nh, pkt, hdrextlen);
 
                 /* for the frag header, the length field is reserved */
                 if (*(pkt + 1) != 0) {
@@ -471,6 +488,7 @@ DecodeIPV6ExtHdrs(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt
                     ENGINE_SET_EVENT(p, IPV6_TRUNC_EXTHDR);
                     SCReturn;
                 }
+                DecodeIPV6ExtHdrRecord(p, nh, pkt, hdrextlen);
 
                 if (eh) {
                     ENGINE_SET_EVENT(p, IPV6_EXTHDR_DUPL_EH);
@@ -500,6 +518,7 @@ DecodeIPV6ExtHdrs(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt
                     ENGINE_SET_EVENT(p, IPV6_TRUNC_EXTHDR);
                     SCReturn;
                 }
+                DecodeIPV6ExtHdrRecord(p, nh, pkt, hdrextlen);
 
                 IPV6AuthHdr *ahhdr = (IPV6AuthHdr *)pkt;
                 if (ahhdr->ip6ah_reserved != 0x0000) {
@@ -541,6 +560,7 @@ DecodeIPV6ExtHdrs(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt
                     ENGINE_SET_EVENT(p, IPV6_TRUNC_EXTHDR);
                     SCReturn;
                 }
+                DecodeIPV6ExtHdrRecord(p, nh, pkt, hdrextlen);
                 nh = *pkt;
                 pkt += hdrextlen;
                 plen -= hdrextlen;
@@ -912,6 +932,67 @@ static int DecodeIPV6HopTest01 (void)
     PASS;
 }
 
+/**
+ * \test the extension header records: HOP + RH + TCP
+ */
+static int DecodeIPV6ExtHdrTest01 (void)
+{
+    uint8_t raw_pkt1[] = {
+        0x60, 0x00, 0x00, 0x00, 0x00, 0x24, 0x00, 0x40,
+        0x20, 0x01, 0xaa, 0xaa, 0x00, 0x01, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+        0x20, 0x01, 0xaa, 0xaa, 0x00, 0x01, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        /* HOP, a PadN */
+        0x2b, 0x00, 0x01, 0x04, 0x00, 0x00, 0x00, 0x00,
+        /* RH type 2 */
+        0x06, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+
+        0xb2, 0xed, 0x00, 0x50, 0x1b, 0xc7, 0x6a, 0xdf,
+        0x00, 0x00, 0x00, 0x00, 0x50, 0x02, 0x20, 0x00,
+        0xfa, 0x87, 0x00, 0x00,
+    };
+    Packet *p1 = PacketGetFromAlloc();
+    FAIL_IF(unlikely(p1 == NULL));
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    FlowInitConfig(FLOW_QUIET);
+
+    memset(&pq, 0, sizeof(PacketQueue));
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+
+    PacketCopyData(p1, raw_pkt1, sizeof(raw_pkt1));
+
+    DecodeIPV6(&tv, &dtv, p1, GET_PKT_DATA(p1), GET_PKT_LEN(p1), &pq);
+
+    FAIL_IF(IPV6_GET_L4PROTO(p1) != IPPROTO_TCP);
+    FAIL_IF(IPV6_EXTHDR_CNT(p1) != 2);
+    FAIL_IF(p1->ip6eh.eh[0].type != IPPROTO_HOPOPTS);
+    FAIL_IF(p1->ip6eh.eh[0].nh != IPPROTO_ROUTING);
+    FAIL_IF(p1->ip6eh.eh[0].offset != 40);
+    FAIL_IF(p1->ip6eh.eh[0].len != 8);
+    FAIL_IF(p1->ip6eh.eh[1].type != IPPROTO_ROUTING);
+    FAIL_IF(p1->ip6eh.eh[1].nh != IPPROTO_TCP);
+    FAIL_IF(p1->ip6eh.eh[1].offset != 48);
+
+    const IPV6ExtHdrRec *rec = IPV6ExtHdrFind(&p1->ip6eh, IPPROTO_ROUTING);
+    FAIL_IF_NULL(rec);
+    FAIL_IF(rec != &p1->ip6eh.eh[1]);
+    FAIL_IF_NOT_NULL(IPV6ExtHdrFind(&p1->ip6eh, IPPROTO_FRAGMENT));
+
+    /* a new packet starts without records */
+    PACKET_RECYCLE(p1);
+    FAIL_IF(IPV6_EXTHDR_CNT(p1) != 0);
+    FAIL_IF_NOT_NULL(IPV6ExtHdrFind(&p1->ip6eh, IPPROTO_ROUTING));
+
+    SCFree(p1);
+    FlowShutdown();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -924,6 +1005,7 @@ void DecodeIPV6RegisterTests(void)
     UtRegisterTest("DecodeIPV6FragTest01", DecodeIPV6FragTest01);
     UtRegisterTest("DecodeIPV6RouteTest01", DecodeIPV6RouteTest01);
     UtRegisterTest("DecodeIPV6HopTest01", DecodeIPV6HopTest01);
+    UtRegisterTest("DecodeIPV6ExtHdrTest01", DecodeIPV6ExtHdrTest01);
 #endif /* UNITTESTS */
 }
 
@@ -109,7 +109,7 @@ typedef struct IPV6Vars_
     (p)->ip6h = NULL; \
     (p)->ip6vars.ip_opts_len = 0; \
     (p)->ip6vars.l4proto = 0; \
-    memset(&(p)->ip6eh, 0x00, sizeof((p)->ip6eh)); \
+    memset(&(p)->ip6eh, 0x00, offsetof(IPV6ExtHdrs, eh)); \
 } while (0)
 
 /* Fragment header */
@@ -208,6 +208,18 @@ typedef struct IPV6GenOptHdr_
     uint8_t *data;
 }   IPV6GenOptHdr;
 
+/** max extension headers recorded per packet in IPV6ExtHdrs::eh */
+#define IPV6_EXTHDR_MAX     8
+
+/** an extension header as the decoder found it */
+typedef struct IPV6ExtHdrRec_
+{
+    uint8_t type;       /**< IPPROTO_* of the header */
+    uint8_t nh;         /**< next header field of the header */
+    uint16_t offset;    /**< offset of the header in the packet data */
+    uint16_t len;       /**< length of the header */
+} IPV6ExtHdrRec;
+
 typedef struct IPV6ExtHdrs_
 {
     _Bool rh_set;
@@ -230,6 +242,13 @@ typedef struct IPV6ExtHdrs_
     uint16_t fh_offset;
     uint32_t fh_id;
 
+    /** number of headers in eh, headers past IPV6_EXTHDR_MAX are not
+     *  recorded */
+    uint8_t eh_cnt;
+
+    /** the extension headers in packet order. Keep last: only eh_cnt
+     *  is reset for a new packet, not the records themselves */
+    IPV6ExtHdrRec eh[IPV6_EXTHDR_MAX];
 } IPV6ExtHdrs;
 
 #define IPV6_EXTHDR_SET_FH(p)       (p)->ip6eh.fh_set = TRUE
@@ -237,6 +256,28 @@ typedef struct IPV6ExtHdrs_
 #define IPV6_EXTHDR_SET_RH(p)       (p)->ip6eh.rh_set = TRUE
 #define IPV6_EXTHDR_ISSET_RH(p)     (p)->ip6eh.rh_set
 
+#define IPV6_EXTHDR_CNT(p)          (p)->ip6eh.eh_cnt
+
+/**
+ * \brief get the first recorded extension header of 'type', so
+ *        that it doesn't have to be parsed again
+ *
+ * \param ip6eh the packet's p->ip6eh
+ *
+ * \retval rec the header or NULL if the packet doesn't have it
+ */
+static inline const IPV6ExtHdrRec *IPV6ExtHdrFind(const IPV6ExtHdrs *ip6eh,
+        uint8_t type)
+{
+    uint8_t i;
+
+    for (i = 0; i < ip6eh->eh_cnt; i++) {
+        if (ip6eh->eh[i].type == type)
+            return &ip6eh->eh[i];
+    }
+    return NULL;
+}
+
 void DecodeIPV6RegisterTests(void);
 
 #endif /* __DECODE_IPV6_H__ */
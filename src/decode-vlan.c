@@ -92,6 +92,9 @@ int DecodeVLAN(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, u
 
     switch (proto)   {
         case ETHERNET_TYPE_IP:
+            if (likely(DecodeIPV4Fast(tv, dtv, p, pkt + VLAN_HEADER_LEN,
+                            len - VLAN_HEADER_LEN, pq)))
+                break;
             DecodeIPV4(tv, dtv, p, pkt + VLAN_HEADER_LEN,
                        len - VLAN_HEADER_LEN, pq);
             break;
@@ -59,13 +59,17 @@
 #include "util-error.h"
 #include "util-print.h"
 #include "tmqh-packetpool.h"
+#include "defrag.h"
 #include "util-profiling.h"
 #include "pkt-var.h"
 #include "util-mpm-ac.h"
+#include "util-memuse.h"
 
 #include "output.h"
 #include "output-flow.h"
 
+uint32_t packet_inline_size = DEFAULT_PACKET_SIZE;
+
 int DecodeTunnel(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
         uint8_t *pkt, uint16_t len, PacketQueue *pq, enum DecodeTunnelProto proto)
 {
@@ -89,6 +93,51 @@ int DecodeTunnel(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
     return TM_ECODE_OK;
 }
 
+/**
+ * \brief fast path for the common IPv4 case
+ *
+ * Handles IPv4 without options and fragmentation carrying TCP or UDP,
+ * which is the bulk of the traffic. The header is validated with a few
+ * combined checks and the L4 decoder is called directly. Anything else
+ * is left to DecodeIPV4(), which sets the proper events.
+ *
+ * \retval 1 packet decoded
+ * \retval 0 not handled, caller needs to use DecodeIPV4()
+ */
+int DecodeIPV4Fast(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    if (unlikely(len < IPV4_HEADER_LEN))
+        return 0;
+
+    IPV4Hdr *ip4h = (IPV4Hdr *)pkt;
+    uint16_t iplen = ntohs(IPV4_GET_RAW_IPLEN(ip4h));
+    uint8_t proto = IPV4_GET_RAW_IPPROTO(ip4h);
+
+    /* version 4, no options, sane length, no MF flag or offset */
+    if (unlikely(ip4h->ip_verhl != 0x45 ||
+                 iplen < IPV4_HEADER_LEN || iplen > len ||
+                 (ntohs(IPV4_GET_RAW_IPOFFSET(ip4h)) & 0x3fff) != 0 ||
+                 (proto != IPPROTO_TCP && proto != IPPROTO_UDP)))
+        return 0;
+
+    StatsIncr(tv, dtv->counter_ipv4);
+
+    p->ip4h = ip4h;
+    SET_IPV4_SRC_ADDR(p, &p->src);
+    SET_IPV4_DST_ADDR(p, &p->dst);
+    p->proto = proto;
+
+    if (proto == IPPROTO_TCP) {
+        DecodeTCP(tv, dtv, p, pkt + IPV4_HEADER_LEN,
+                  iplen - IPV4_HEADER_LEN, pq);
+    } else {
+        DecodeUDP(tv, dtv, p, pkt + IPV4_HEADER_LEN,
+                  iplen - IPV4_HEADER_LEN, pq);
+    }
+    return 1;
+}
+
 /**
  * \brief Return a malloced packet.
  */
@@ -96,6 +145,30 @@ void PacketFree(Packet *p)
 {
     PACKET_DESTRUCTOR(p);
     SCFree(p);
+    MemuseFree(MEMUSE_PACKETS, SIZE_OF_PACKET);
+}
+
+/**
+ * \brief Bypass the flow of a packet
+ *
+ * Marks the flow as bypassed so the flow worker stops running stream and
+ * detection on it, and asks the capture method (if it implements the
+ * BypassPacketsFlow callback) to stop delivering the flow's packets.
+ *
+ * \note flow needs to be locked by the caller
+ */
+void PacketBypassCallback(Packet *p)
+{
+    Flow *f = p->flow;
+
+    if (f == NULL || (f->flags & (FLOW_BYPASSED|FLOW_ACTION_DROP)))
+        return;
+
+    if (p->BypassPacketsFlow != NULL && p->BypassPacketsFlow(p)) {
+        SCLogDebug("flow %p bypassed in capture", f);
+    }
+
+    f->flags |= FLOW_BYPASSED;
 }
 
 /**
@@ -136,8 +209,11 @@ Packet *PacketGetFromAlloc(void)
     if (unlikely(p == NULL)) {
         return NULL;
     }
+    MemuseAlloc(MEMUSE_PACKETS, SIZE_OF_PACKET);
 
-    memset(p, 0, SIZE_OF_PACKET);
+    /* the inline data buffer is written before it's read, no need to
+     * clear it */
+    memset(p, 0, sizeof(Packet));
     PACKET_INITIALIZE(p);
     p->ReleasePacket = PacketFree;
     p->flags |= PKT_ALLOC;
@@ -193,6 +269,25 @@ inline int PacketCallocExtPkt(Packet *p, int datalen)
     return 0;
 }
 
+/**
+ *  \brief Size the data buffer of the packets allocated from now on
+ *
+ *  Call before the packet pools are set up.
+ *
+ *  \param zero_copy 1 if all capture threads hand us zero copy data,
+ *         the buffer is then only used for pseudo packets and for the
+ *         packets the capture method has to copy after all
+ */
+void PacketSetInlineSize(int zero_copy)
+{
+    if (zero_copy) {
+        packet_inline_size = PACKET_INLINE_ZERO_COPY_SIZE;
+        SCLogConfig("zero copy capture, packets have no inline data buffer");
+    } else {
+        packet_inline_size = default_packet_size;
+    }
+}
+
 /**
  *  \brief Copy data to Packet payload at given offset
  *
@@ -200,7 +295,7 @@ inline int PacketCallocExtPkt(Packet *p, int datalen)
  * space allocated at Packet creation (pointed by Packet::pkt)
  * or allocate some memory (pointed by Packet::ext_pkt) if the
  * data size is to big to fit in initial space (of size
- * default_packet_size).
+ * packet_inline_size).
  *
  *  \param Pointer to the Packet to modify
  *  \param Offset of the copy relatively to payload of Packet
@@ -216,7 +311,7 @@ inline int PacketCopyDataOffset(Packet *p, int offset, uint8_t *data, int datale
 
     /* Do we have already an packet with allocated data */
     if (! p->ext_pkt) {
-        if (offset + datalen <= (int)default_packet_size) {
+        if (offset + datalen <= (int)GET_PKT_DIRECT_MAX_SIZE(p)) {
             /* data will fit in memory allocated with packet */
             memcpy(GET_PKT_DIRECT_DATA(p) + offset, data, datalen);
         } else {
@@ -412,6 +507,12 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
     dtv->counter_max_pkt_size = StatsRegisterMaxCounter("decoder.max_pkt_size", tv);
     dtv->counter_erspan = StatsRegisterMaxCounter("decoder.erspan", tv);
     dtv->counter_flow_memcap = StatsRegisterCounter("flow.memcap", tv);
+    dtv->counter_flow_evict_closed =
+        StatsRegisterCounter("flow.evict.closed", tv);
+    dtv->counter_flow_evict_new =
+        StatsRegisterCounter("flow.evict.new", tv);
+    dtv->counter_flow_evict_established =
+        StatsRegisterCounter("flow.evict.established", tv);
 
     dtv->counter_defrag_ipv4_fragments =
         StatsRegisterCounter("defrag.ipv4.fragments", tv);
@@ -437,14 +538,37 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
     return;
 }
 
+/** \brief fold the locally batched packet counters into the stats api */
+void DecodeFlushPacketCounters(ThreadVars *tv, DecodeThreadVars *dtv)
+{
+    if (dtv->stats_pkts == 0)
+        return;
+
+    StatsAddUI64Batch(tv, dtv->counter_pkts, dtv->stats_pkts, dtv->stats_pkts);
+    StatsAddUI64Batch(tv, dtv->counter_bytes, dtv->stats_bytes, dtv->stats_pkts);
+    StatsAddUI64Batch(tv, dtv->counter_avg_pkt_size, dtv->stats_bytes, dtv->stats_pkts);
+    StatsSetUI64(tv, dtv->counter_max_pkt_size, dtv->stats_max_pkt_size);
+
+    dtv->stats_pkts = 0;
+    dtv->stats_bytes = 0;
+    dtv->stats_max_pkt_size = 0;
+}
+
 void DecodeUpdatePacketCounters(ThreadVars *tv,
-                                const DecodeThreadVars *dtv, const Packet *p)
+                                DecodeThreadVars *dtv, const Packet *p)
 {
-    StatsIncr(tv, dtv->counter_pkts);
-    //StatsIncr(tv, dtv->counter_pkts_per_sec);
-    StatsAddUI64(tv, dtv->counter_bytes, GET_PKT_LEN(p));
-    StatsAddUI64(tv, dtv->counter_avg_pkt_size, GET_PKT_LEN(p));
-    StatsSetUI64(tv, dtv->counter_max_pkt_size, GET_PKT_LEN(p));
+    uint32_t len = GET_PKT_LEN(p);
+
+    dtv->stats_pkts++;
+    dtv->stats_bytes += len;
+    if (len > dtv->stats_max_pkt_size)
+        dtv->stats_max_pkt_size = len;
+
+    /* flush before the thread syncs its counters so the stats output
+     * is not behind by a partial batch */
+    if (dtv->stats_pkts >= DECODE_STATS_BATCH ||
+            tv->perf_public_ctx.perf_flag == 1)
+        DecodeFlushPacketCounters(tv, dtv);
 }
 
 /**
@@ -478,6 +602,7 @@ DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv)
     if ( (dtv = SCMalloc(sizeof(DecodeThreadVars))) == NULL)
         return NULL;
     memset(dtv, 0, sizeof(DecodeThreadVars));
+    MemuseAlloc(MEMUSE_THREADS, sizeof(DecodeThreadVars));
 
     dtv->app_tctx = AppLayerGetCtxThread(tv);
 
@@ -500,6 +625,15 @@ DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv)
 void DecodeThreadVarsFree(ThreadVars *tv, DecodeThreadVars *dtv)
 {
     if (dtv != NULL) {
+        DefragThreadCacheFlush();
+        FlowThreadCacheFlush();
+
+        /* the final counter sync of the thread has been done already */
+        if (dtv->stats_pkts > 0 && tv->perf_private_ctx.initialized) {
+            DecodeFlushPacketCounters(tv, dtv);
+            StatsSyncCounters(tv);
+        }
+
         if (dtv->app_tctx != NULL)
             AppLayerDestroyCtxThread(dtv->app_tctx);
 
@@ -507,6 +641,7 @@ void DecodeThreadVarsFree(ThreadVars *tv, DecodeThreadVars *dtv)
             OutputFlowLogThreadDeinit(tv, dtv->output_flow_thread_data);
 
         SCFree(dtv);
+        MemuseFree(MEMUSE_THREADS, sizeof(DecodeThreadVars));
     }
 }
 
@@ -214,7 +214,7 @@ typedef struct Address_ {
 #define GET_PKT_LEN(p) ((p)->pktlen)
 #define GET_PKT_DATA(p) ((((p)->ext_pkt) == NULL ) ? (uint8_t *)((p) + 1) : (p)->ext_pkt)
 #define GET_PKT_DIRECT_DATA(p) (uint8_t *)((p) + 1)
-#define GET_PKT_DIRECT_MAX_SIZE(p) (default_packet_size)
+#define GET_PKT_DIRECT_MAX_SIZE(p) (packet_inline_size)
 
 #define SET_PKT_LEN(p, len) do { \
     (p)->pktlen = (len); \
@@ -441,6 +441,11 @@ typedef struct Packet_
     /** The release function for packet structure and data */
     void (*ReleasePacket)(struct Packet_ *);
 
+    /** Optional capture source callback asking the capture method to stop
+     *  handing us the packets of this packet's flow. Returns 1 if the
+     *  capture method accepted the bypass, 0 otherwise. */
+    int (*BypassPacketsFlow)(struct Packet_ *);
+
     /* pkt vars */
     PktVar *pktvar;
 
@@ -559,6 +564,9 @@ typedef struct Packet_
      */
     struct PktPool_ *pool;
 
+    /** ticks at the start of the latency sample, 0 if not sampled */
+    uint64_t latency_ticks;
+
 #ifdef PROFILING
     PktProfiling *profile;
 #endif
@@ -576,7 +584,14 @@ Packet;
 /* storage: maximum ip packet size + link header */
 #define MAX_PAYLOAD_SIZE (IPV6_HEADER_LEN + 65536 + 28)
 uint32_t default_packet_size;
-#define SIZE_OF_PACKET (default_packet_size + sizeof(Packet))
+/** size of the data buffer following the Packet: default_packet_size,
+ *  or PACKET_INLINE_ZERO_COPY_SIZE if the capture method hands us the
+ *  packet data in its own buffers (PKT_ZERO_COPY). Data that doesn't
+ *  fit goes to Packet::ext_pkt. */
+extern uint32_t packet_inline_size;
+/** enough for the headers of the flow timeout pseudo packets */
+#define PACKET_INLINE_ZERO_COPY_SIZE 128
+#define SIZE_OF_PACKET (packet_inline_size + sizeof(Packet))
 
 typedef struct PacketQueue_ {
     Packet *top;
@@ -590,6 +605,9 @@ typedef struct PacketQueue_ {
 } PacketQueue;
 
 /** \brief Structure to hold thread specific data for all decode modules */
+/** packets to batch the decoder pkt/byte counters for */
+#define DECODE_STATS_BATCH  64
+
 typedef struct DecodeThreadVars_
 {
     /** Specific context for udp protocol detection (here atm) */
@@ -603,6 +621,13 @@ typedef struct DecodeThreadVars_
     uint16_t counter_avg_pkt_size;
     uint16_t counter_max_pkt_size;
 
+    /** pkts/bytes/pkt size are accumulated here and folded into the
+     *  counters above every DECODE_STATS_BATCH packets or when a stats
+     *  sync is pending, see DecodeUpdatePacketCounters() */
+    uint32_t stats_pkts;
+    uint32_t stats_max_pkt_size;
+    uint64_t stats_bytes;
+
     uint16_t counter_invalid;
 
     uint16_t counter_eth;
@@ -638,6 +663,9 @@ typedef struct DecodeThreadVars_
     uint16_t counter_defrag_max_hit;
 
     uint16_t counter_flow_memcap;
+    uint16_t counter_flow_evict_closed;
+    uint16_t counter_flow_evict_new;
+    uint16_t counter_flow_evict_established;
 
      uint16_t counter_invalid_events[DECODE_EVENT_PACKET_MAX];
     /* thread data for flow logging api: only used at forced
@@ -733,6 +761,7 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         (p)->ts.tv_usec = 0;                    \
         (p)->datalink = 0;                      \
         (p)->action = 0;                        \
+        (p)->BypassPacketsFlow = NULL;          \
         if ((p)->pktvar != NULL) {              \
             PktVarFree((p)->pktvar);            \
             (p)->pktvar = NULL;                 \
@@ -782,6 +811,7 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         PACKET_RESET_CHECKSUMS((p));            \
         PACKET_PROFILING_RESET((p));            \
         p->tenant_id = 0;                       \
+        (p)->latency_ticks = 0;                 \
     } while (0)
 
 #define PACKET_RECYCLE(p) do { \
@@ -890,16 +920,19 @@ Packet *PacketGetFromAlloc(void);
 void PacketDecodeFinalize(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p);
 void PacketFree(Packet *p);
 void PacketFreeOrRelease(Packet *p);
+void PacketBypassCallback(Packet *p);
 int PacketCallocExtPkt(Packet *p, int datalen);
 int PacketCopyData(Packet *p, uint8_t *pktdata, int pktlen);
 int PacketSetData(Packet *p, uint8_t *pktdata, int pktlen);
 int PacketCopyDataOffset(Packet *p, int offset, uint8_t *data, int datalen);
+void PacketSetInlineSize(int zero_copy);
 const char *PktSrcToString(enum PktSrcEnum pkt_src);
 
 DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *);
 void DecodeThreadVarsFree(ThreadVars *, DecodeThreadVars *);
 void DecodeUpdatePacketCounters(ThreadVars *tv,
-                                const DecodeThreadVars *dtv, const Packet *p);
+                                DecodeThreadVars *dtv, const Packet *p);
+void DecodeFlushPacketCounters(ThreadVars *tv, DecodeThreadVars *dtv);
 
 /* decoder functions */
 int DecodeEthernet(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
@@ -911,6 +944,7 @@ int DecodeTunnel(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t
 int DecodeNull(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
 int DecodeRaw(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
 int DecodeIPV4(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
+int DecodeIPV4Fast(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
 int DecodeIPV6(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
 int DecodeICMPV4(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
 int DecodeICMPV6(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
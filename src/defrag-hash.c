@@ -23,7 +23,10 @@
 #include "util-random.h"
 #include "util-byte.h"
 #include "util-misc.h"
-#include "util-hash-lookup3.h"
+#include "util-hash-word.h"
+#include "util-hugepages.h"
+#include "util-memuse.h"
+#include "util-prealloc.h"
 
 static DefragTracker *DefragTrackerGetUsedDefragTracker(void);
 
@@ -52,6 +55,7 @@ DefragTracker *DefragTrackerAlloc(void)
     DefragTracker *dt = SCMalloc(sizeof(DefragTracker));
     if (unlikely(dt == NULL))
         goto error;
+    MemuseAlloc(MEMUSE_DEFRAG, sizeof(DefragTracker));
 
     memset(dt, 0x00, sizeof(DefragTracker));
 
@@ -71,6 +75,7 @@ void DefragTrackerFree(DefragTracker *dt)
         SCMutexDestroy(&dt->lock);
         SCFree(dt);
         (void) SC_ATOMIC_SUB(defrag_memuse, sizeof(DefragTracker));
+        MemuseFree(MEMUSE_DEFRAG, sizeof(DefragTracker));
     }
 }
 
@@ -119,6 +124,27 @@ void DefragTrackerClearMemory(DefragTracker *dt)
 #define DEFRAG_DEFAULT_MEMCAP 16777216
 #define DEFRAG_DEFAULT_PREALLOC 1000
 
+/** \internal
+ *  \brief allocate the defrag trackers not preallocated at startup, in the
+ *         background. See util-prealloc.h
+ */
+static uint32_t DefragTrackerPreallocFill(void)
+{
+    uint32_t cnt = defrag_config.prealloc - PreallocStartupCount(defrag_config.prealloc);
+    uint32_t i;
+
+    for (i = 0; i < cnt && !PreallocStopped(); i++) {
+        if (!(DEFRAG_CHECK_MEMCAP(sizeof(DefragTracker))))
+            break;
+
+        DefragTracker *h = DefragTrackerAlloc();
+        if (h == NULL)
+            break;
+        DefragTrackerEnqueue(&defragtracker_spare_q, h);
+    }
+    return i;
+}
+
 /** \brief initialize the configuration
  *  \warning Not thread safe */
 void DefragInitConfig(char quiet)
@@ -190,7 +216,7 @@ void DefragInitConfig(char quiet)
                 (uintmax_t)sizeof(DefragTrackerHashRow));
         exit(EXIT_FAILURE);
     }
-    defragtracker_hash = SCCalloc(defrag_config.hash_size, sizeof(DefragTrackerHashRow));
+    defragtracker_hash = SCMallocHuge("defrag hash", defrag_config.hash_size * sizeof(DefragTrackerHashRow));
     if (unlikely(defragtracker_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in DefragTrackerInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -202,6 +228,8 @@ void DefragInitConfig(char quiet)
         DRLOCK_INIT(&defragtracker_hash[i]);
     }
     (void) SC_ATOMIC_ADD(defrag_memuse, (defrag_config.hash_size * sizeof(DefragTrackerHashRow)));
+    MemuseAlloc(MEMUSE_DEFRAG, defrag_config.hash_size * sizeof(DefragTrackerHashRow));
+    MemuseSetMemcap(MEMUSE_DEFRAG, defrag_config.memcap);
 
     if (quiet == FALSE) {
         SCLogConfig("allocated %llu bytes of memory for the defrag hash... "
@@ -213,8 +241,10 @@ void DefragInitConfig(char quiet)
     if ((ConfGet("defrag.prealloc", &conf_val)) == 1)
     {
         if (ConfValIsTrue(conf_val)) {
-            /* pre allocate defrag trackers */
-            for (i = 0; i < defrag_config.prealloc; i++) {
+            /* pre allocate defrag trackers, in background mode only
+             * part of them */
+            uint32_t startup_cnt = PreallocStartupCount(defrag_config.prealloc);
+            for (i = 0; i < startup_cnt; i++) {
                 if (!(DEFRAG_CHECK_MEMCAP(sizeof(DefragTracker)))) {
                     SCLogError(SC_ERR_DEFRAG_INIT, "preallocating defrag trackers failed: "
                             "max defrag memcap reached. Memcap %"PRIu64", "
@@ -230,6 +260,8 @@ void DefragInitConfig(char quiet)
                 }
                 DefragTrackerEnqueue(&defragtracker_spare_q,h);
             }
+            if (startup_cnt < defrag_config.prealloc)
+                PreallocRegisterFill("defrag trackers", DefragTrackerPreallocFill);
             if (quiet == FALSE) {
                 SCLogConfig("preallocated %" PRIu32 " defrag trackers of size %" PRIuMAX "",
                         defragtracker_spare_q.len, (uintmax_t)sizeof(DefragTracker));
@@ -279,10 +311,11 @@ void DefragHashShutdown(void)
 
             DRLOCK_DESTROY(&defragtracker_hash[u]);
         }
-        SCFree(defragtracker_hash);
+        SCFreeHuge(defragtracker_hash);
         defragtracker_hash = NULL;
     }
     (void) SC_ATOMIC_SUB(defrag_memuse, defrag_config.hash_size * sizeof(DefragTrackerHashRow));
+    MemuseFree(MEMUSE_DEFRAG, defrag_config.hash_size * sizeof(DefragTrackerHashRow));
     DefragTrackerQueueDestroy(&defragtracker_spare_q);
 
     SC_ATOMIC_DESTROY(defragtracker_prune_idx);
@@ -364,7 +397,7 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[0] = p->vlan_id[0];
         dhk.vlan_id[1] = p->vlan_id[1];
 
-        uint32_t hash = hashword(dhk.u32, 4, defrag_config.hash_rand);
+        uint32_t hash = HashWord(dhk.u32, 4, defrag_config.hash_rand);
         key = hash % defrag_config.hash_size;
     } else if (p->ip6h != NULL) {
         DefragHashKey6 dhk;
@@ -391,7 +424,7 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[0] = p->vlan_id[0];
         dhk.vlan_id[1] = p->vlan_id[1];
 
-        uint32_t hash = hashword(dhk.u32, 10, defrag_config.hash_rand);
+        uint32_t hash = HashWord(dhk.u32, 10, defrag_config.hash_rand);
         key = hash % defrag_config.hash_size;
     } else
         key = 0;
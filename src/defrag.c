@@ -100,6 +100,105 @@ static int default_policy = DEFRAG_POLICY_BSD;
  * context. */
 static DefragContext *defrag_context;
 
+/** Size of the per thread frag cache. Frags move between the cache and
+ *  the shared pool DEFRAG_FRAG_CACHE_BATCH at a time. */
+#define DEFRAG_FRAG_CACHE_SIZE  64
+#define DEFRAG_FRAG_CACHE_BATCH (DEFRAG_FRAG_CACHE_SIZE / 2)
+
+/** defrag.thread-cache */
+static int defrag_thread_cache = 0;
+
+#ifdef TLS
+/**
+ * Per thread cache of frags taken from the shared pool, so that the
+ * pool lock is only taken once per DEFRAG_FRAG_CACHE_BATCH frags. Only
+ * threads that insert frags activate it, others (e.g. the flow manager
+ * timing out trackers) return frags to the pool directly.
+ */
+typedef struct DefragFragCache_ {
+    int active;
+    uint32_t cnt;
+    Frag *frags[DEFRAG_FRAG_CACHE_SIZE];
+} DefragFragCache;
+
+static __thread DefragFragCache defrag_frag_cache;
+
+/** \brief give 'cnt' frags of this thread's cache back to the pool */
+static void DefragFragCacheShrink(uint32_t cnt)
+{
+    DefragFragCache *fc = &defrag_frag_cache;
+
+    SCMutexLock(&defrag_context->frag_pool_lock);
+    while (cnt-- > 0 && fc->cnt > 0) {
+        PoolReturn(defrag_context->frag_pool, fc->frags[--fc->cnt]);
+    }
+    SCMutexUnlock(&defrag_context->frag_pool_lock);
+}
+#endif /* TLS */
+
+/**
+ * \brief get a frag from the thread cache or the shared pool
+ *
+ * \retval frag or NULL if the max-frags limit is reached
+ */
+static Frag *DefragFragGet(void)
+{
+    Frag *frag;
+
+#ifdef TLS
+    if (defrag_thread_cache) {
+        DefragFragCache *fc = &defrag_frag_cache;
+
+        if (fc->cnt == 0) {
+            fc->active = 1;
+
+            SCMutexLock(&defrag_context->frag_pool_lock);
+            while (fc->cnt < DEFRAG_FRAG_CACHE_BATCH) {
+                frag = PoolGet(defrag_context->frag_pool);
+                if (frag == NULL)
+                    break;
+                fc->frags[fc->cnt++] = frag;
+            }
+            SCMutexUnlock(&defrag_context->frag_pool_lock);
+
+            if (fc->cnt == 0)
+                return NULL;
+        }
+        return fc->frags[--fc->cnt];
+    }
+#endif
+    SCMutexLock(&defrag_context->frag_pool_lock);
+    frag = PoolGet(defrag_context->frag_pool);
+    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    return frag;
+}
+
+#ifdef TLS
+/** \brief put a reset frag in the thread cache */
+static void DefragFragCachePut(Frag *frag)
+{
+    DefragFragCache *fc = &defrag_frag_cache;
+
+    if (fc->cnt == DEFRAG_FRAG_CACHE_SIZE)
+        DefragFragCacheShrink(DEFRAG_FRAG_CACHE_BATCH);
+    fc->frags[fc->cnt++] = frag;
+}
+#endif
+
+/**
+ * \brief return the frags cached by the calling thread to the pool
+ *
+ * To be called by threads that insert frags before they exit.
+ */
+void DefragThreadCacheFlush(void)
+{
+#ifdef TLS
+    if (defrag_context != NULL && defrag_frag_cache.cnt > 0)
+        DefragFragCacheShrink(defrag_frag_cache.cnt);
+    defrag_frag_cache.active = 0;
+#endif
+}
+
 /**
  * Utility/debugging function to dump the frags associated with a
  * tracker.  Only enable when unit tests are enabled.
@@ -122,13 +221,39 @@ DumpFrags(DefragTracker *tracker)
 
 /**
  * \brief Reset a frag for reuse in a pool.
+ *
+ * Packet sized buffers are kept, so that a reused frag doesn't need a
+ * new allocation. Larger ones (jumbo frames) are freed.
  */
 static void
 DefragFragReset(Frag *frag)
 {
-    if (frag->pkt != NULL)
-        SCFree(frag->pkt);
+    uint8_t *pkt = frag->pkt;
+    uint32_t pkt_size = frag->pkt_size;
+
+    if (pkt != NULL && pkt_size > default_packet_size) {
+        SCFree(pkt);
+        pkt = NULL;
+        pkt_size = 0;
+    }
     memset(frag, 0, sizeof(*frag));
+    frag->pkt = pkt;
+    frag->pkt_size = pkt_size;
+}
+
+/**
+ * \brief Free the buffer of a frag that leaves the pool.
+ */
+static void
+DefragFragCleanup(void *data)
+{
+    Frag *frag = data;
+
+    if (frag->pkt != NULL) {
+        SCFree(frag->pkt);
+        frag->pkt = NULL;
+        frag->pkt_size = 0;
+    }
 }
 
 /**
@@ -151,6 +276,18 @@ DefragTrackerFreeFrags(DefragTracker *tracker)
 {
     Frag *frag;
 
+#ifdef TLS
+    if (defrag_thread_cache && defrag_frag_cache.active) {
+        while ((frag = TAILQ_FIRST(&tracker->frags)) != NULL) {
+            TAILQ_REMOVE(&tracker->frags, frag, next);
+
+            DefragFragReset(frag);
+            DefragFragCachePut(frag);
+        }
+        return;
+    }
+#endif
+
     /* Lock the frag pool as we'll be return items to it. */
     SCMutexLock(&defrag_context->frag_pool_lock);
 
@@ -194,7 +331,7 @@ DefragContextNew(void)
     intmax_t frag_pool_prealloc = frag_pool_size / 2;
     dc->frag_pool = PoolInit(frag_pool_size, frag_pool_prealloc,
         sizeof(Frag),
-        NULL, DefragFragInit, dc, NULL, NULL);
+        NULL, DefragFragInit, dc, DefragFragCleanup, NULL);
     if (dc->frag_pool == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC,
             "Defrag: Failed to initialize fragment pool.");
@@ -496,8 +633,6 @@ error_remove_tracker:
 
 /**
  * Insert a new IPv4/IPv6 fragment into a tracker.
- *
- * \todo Allocate packet buffers from a pool.
  */
 static Packet *
 DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker, Packet *p, PacketQueue *pq)
@@ -714,9 +849,7 @@ insert:
     }
 
     /* Allocate fragment and insert. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-    Frag *new = PoolGet(defrag_context->frag_pool);
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    Frag *new = DefragFragGet();
     if (new == NULL) {
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
@@ -725,11 +858,25 @@ insert:
         }
         goto done;
     }
-    new->pkt = SCMalloc(GET_PKT_LEN(p));
+    if (new->pkt_size < GET_PKT_LEN(p)) {
+        if (new->pkt != NULL)
+            SCFree(new->pkt);
+        new->pkt_size = 0;
+        new->pkt = SCMalloc(MAX(GET_PKT_LEN(p), default_packet_size));
+        if (new->pkt != NULL)
+            new->pkt_size = MAX(GET_PKT_LEN(p), default_packet_size);
+    }
     if (new->pkt == NULL) {
-        SCMutexLock(&defrag_context->frag_pool_lock);
-        PoolReturn(defrag_context->frag_pool, new);
-        SCMutexUnlock(&defrag_context->frag_pool_lock);
+#ifdef TLS
+        if (defrag_thread_cache) {
+            DefragFragCachePut(new);
+        } else
+#endif
+        {
+            SCMutexLock(&defrag_context->frag_pool_lock);
+            PoolReturn(defrag_context->frag_pool, new);
+            SCMutexUnlock(&defrag_context->frag_pool_lock);
+        }
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
         } else {
@@ -839,11 +986,8 @@ DefragGetOsPolicy(Packet *p)
 {
     int policy = -1;
 
-    if (PKT_IS_IPV4(p)) {
-        policy = SCHInfoGetIPv4HostOSFlavour((uint8_t *)GET_IPV4_DST_ADDR_PTR(p));
-    }
-    else if (PKT_IS_IPV6(p)) {
-        policy = SCHInfoGetIPv6HostOSFlavour((uint8_t *)GET_IPV6_DST_ADDR(p));
+    if (PKT_IS_IPV4(p) || PKT_IS_IPV6(p)) {
+        policy = SCHInfoGetHostOSFlavourByAddr(&p->dst);
     }
 
     if (policy == -1) {
@@ -980,10 +1124,22 @@ DefragInit(void)
 
     DefragSetDefaultTimeout(defrag_context->timeout);
     DefragInitConfig(FALSE);
+
+    int thread_cache = 0;
+    defrag_thread_cache = 0;
+    if (ConfGetBool("defrag.thread-cache", &thread_cache) == 1 && thread_cache) {
+#ifdef TLS
+        defrag_thread_cache = 1;
+#else
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "defrag.thread-cache needs "
+                "thread local storage support, disabled");
+#endif
+    }
 }
 
 void DefragDestroy(void)
 {
+    DefragThreadCacheFlush();
     DefragHashShutdown();
     DefragContextDestroy(defrag_context);
     defrag_context = NULL;
@@ -2176,6 +2332,89 @@ end:
  * fail.  The fix was simple, but this unit test is just to make sure
  * its not introduced.
  */
+#ifdef TLS
+/**
+ * Reassembly with the thread cache: frags are kept in the cache after
+ * reassembly and given back to the pool on flush.
+ */
+static int DefragThreadCacheTest(void)
+{
+    Packet *p1, *p2, *p3, *reassembled;
+    int id = 12;
+
+    DefragInit();
+    defrag_thread_cache = 1;
+
+    p1 = BuildTestPacket(id, 0, 1, 'A', 8);
+    FAIL_IF_NULL(p1);
+    p2 = BuildTestPacket(id, 1, 1, 'B', 8);
+    FAIL_IF_NULL(p2);
+    p3 = BuildTestPacket(id, 2, 0, 'C', 3);
+    FAIL_IF_NULL(p3);
+
+    FAIL_IF(Defrag(NULL, NULL, p1, NULL) != NULL);
+    /* a batch was taken from the pool at once */
+    FAIL_IF(defrag_context->frag_pool->outstanding != DEFRAG_FRAG_CACHE_BATCH);
+    FAIL_IF(defrag_frag_cache.cnt != DEFRAG_FRAG_CACHE_BATCH - 1);
+    FAIL_IF(Defrag(NULL, NULL, p2, NULL) != NULL);
+    reassembled = Defrag(NULL, NULL, p3, NULL);
+    FAIL_IF_NULL(reassembled);
+    FAIL_IF(IPV4_GET_IPLEN(reassembled) != 39);
+
+    /* the frags went back to the cache, not to the pool */
+    FAIL_IF(defrag_frag_cache.cnt != DEFRAG_FRAG_CACHE_BATCH);
+    FAIL_IF(defrag_context->frag_pool->outstanding != DEFRAG_FRAG_CACHE_BATCH);
+
+    DefragThreadCacheFlush();
+    FAIL_IF(defrag_frag_cache.cnt != 0);
+    FAIL_IF(defrag_context->frag_pool->outstanding != 0);
+
+    SCFree(p1);
+    SCFree(p2);
+    SCFree(p3);
+    SCFree(reassembled);
+
+    DefragDestroy();
+    defrag_thread_cache = 0;
+    PASS;
+}
+#endif /* TLS */
+
+/**
+ * Frag buffers are kept when the frags go back to the pool.
+ */
+static int DefragFragBufferReuseTest(void)
+{
+    Packet *p1, *p2, *reassembled;
+    int id = 12;
+
+    DefragInit();
+
+    p1 = BuildTestPacket(id, 0, 1, 'A', 8);
+    FAIL_IF_NULL(p1);
+    p2 = BuildTestPacket(id, 1, 0, 'B', 8);
+    FAIL_IF_NULL(p2);
+
+    FAIL_IF(Defrag(NULL, NULL, p1, NULL) != NULL);
+    reassembled = Defrag(NULL, NULL, p2, NULL);
+    FAIL_IF_NULL(reassembled);
+    FAIL_IF(defrag_context->frag_pool->outstanding != 0);
+
+    Frag *frag = PoolGet(defrag_context->frag_pool);
+    FAIL_IF_NULL(frag);
+    FAIL_IF_NULL(frag->pkt);
+    FAIL_IF(frag->pkt_size < GET_PKT_LEN(p1));
+    FAIL_IF(frag->len != 0 || frag->data_len != 0);
+    PoolReturn(defrag_context->frag_pool, frag);
+
+    SCFree(p1);
+    SCFree(p2);
+    SCFree(reassembled);
+
+    DefragDestroy();
+    PASS;
+}
+
 static int
 DefragIPv4NoDataTest(void)
 {
@@ -2544,6 +2783,43 @@ end:
     return retval;
 }
 
+/**
+ * Benchmark the reassembly of a 1472 byte payload sent in 4 fragments.
+ */
+static int
+DefragBench01(UtBench *b)
+{
+    Packet *frags[4];
+    const int fraglen = 368;
+    int i;
+
+    DefragInit();
+
+    for (i = 0; i < 4; i++) {
+        frags[i] = BuildTestPacket(0, i * fraglen / 8, i < 3, 'A' + i, fraglen);
+        FAIL_IF_NULL(frags[i]);
+    }
+
+    UtBenchResetTimer(b);
+    uint64_t n;
+    for (n = 0; n < b->n; n++) {
+        Packet *reassembled = NULL;
+        for (i = 0; i < 4; i++) {
+            /* a new datagram each time */
+            frags[i]->ip4h->ip_id = htons((uint16_t)n);
+            reassembled = Defrag(NULL, NULL, frags[i], NULL);
+        }
+        FAIL_IF_NULL(reassembled);
+        SCFree(reassembled);
+    }
+    b->bytes = 4 * fraglen;
+
+    for (i = 0; i < 4; i++)
+        SCFree(frags[i]);
+    DefragDestroy();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void
@@ -2551,6 +2827,7 @@ DefragRegisterTests(void)
 {
 #ifdef UNITTESTS
     UtRegisterTest("DefragInOrderSimpleTest", DefragInOrderSimpleTest);
+    UtRegisterBenchmark("DefragBench01", DefragBench01);
     UtRegisterTest("DefragReverseSimpleTest", DefragReverseSimpleTest);
     UtRegisterTest("DefragSturgesNovakBsdTest", DefragSturgesNovakBsdTest);
     UtRegisterTest("DefragSturgesNovakLinuxTest", DefragSturgesNovakLinuxTest);
@@ -2561,6 +2838,10 @@ DefragRegisterTests(void)
     UtRegisterTest("DefragSturgesNovakFirstTest", DefragSturgesNovakFirstTest);
     UtRegisterTest("DefragSturgesNovakLastTest", DefragSturgesNovakLastTest);
 
+#ifdef TLS
+    UtRegisterTest("DefragThreadCacheTest", DefragThreadCacheTest);
+#endif
+    UtRegisterTest("DefragFragBufferReuseTest", DefragFragBufferReuseTest);
     UtRegisterTest("DefragIPv4NoDataTest", DefragIPv4NoDataTest);
     UtRegisterTest("DefragIPv4TooLargeTest", DefragIPv4TooLargeTest);
 
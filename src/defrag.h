@@ -63,6 +63,8 @@ typedef struct Frag_ {
                                  * re-assembling the packet. */
 
     uint8_t *pkt;               /**< The actual packet. */
+    uint32_t pkt_size;          /**< Size of the pkt buffer. The buffer is
+                                 * kept when the frag is reused. */
 
 #ifdef DEBUG
     uint64_t pcap_cnt;          /**< pcap_cnt of original packet */
@@ -119,6 +121,7 @@ void DefragReload(void); /**< use only in unittests */
 
 uint8_t DefragGetOsPolicy(Packet *);
 void DefragTrackerFreeFrags(DefragTracker *);
+void DefragThreadCacheFlush(void);
 Packet *Defrag(ThreadVars *, DecodeThreadVars *, Packet *, PacketQueue *);
 void DefragRegisterTests(void);
 
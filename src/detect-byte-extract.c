@@ -177,7 +177,7 @@ int DetectByteExtractDoMatch(DetectEngineThreadCtx *det_ctx, SigMatch *sm,
     } else {
         int endianness = (endian == DETECT_BYTE_EXTRACT_ENDIAN_BIG) ?
                           BYTE_BIG_ENDIAN : BYTE_LITTLE_ENDIAN;
-        extbytes = ByteExtractUint64(&val, endianness, data->nbytes, ptr);
+        extbytes = ByteExtract(&val, endianness, data->nbytes, ptr);
         if (extbytes != data->nbytes) {
             SCLogError(SC_ERR_INVALID_NUM_BYTES, "Error extracting %d bytes "
                    "of numeric data: %d\n", data->nbytes, extbytes);
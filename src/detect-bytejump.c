@@ -141,7 +141,7 @@ int DetectBytejumpDoMatch(DetectEngineThreadCtx *det_ctx, Signature *s,
     }
     else {
         int endianness = (flags & DETECT_BYTEJUMP_LITTLE) ? BYTE_LITTLE_ENDIAN : BYTE_BIG_ENDIAN;
-        extbytes = ByteExtractUint64(&val, endianness, data->nbytes, ptr);
+        extbytes = ByteExtract(&val, endianness, data->nbytes, ptr);
         if (extbytes != data->nbytes) {
             SCLogError(SC_ERR_BYTE_EXTRACT_FAILED,"Error extracting %d bytes "
                    "of numeric data: %d", data->nbytes, extbytes);
@@ -250,7 +250,7 @@ int DetectBytejumpMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
     }
     else {
         int endianness = (data->flags & DETECT_BYTEJUMP_LITTLE) ? BYTE_LITTLE_ENDIAN : BYTE_BIG_ENDIAN;
-        extbytes = ByteExtractUint64(&val, endianness, data->nbytes, ptr);
+        extbytes = ByteExtract(&val, endianness, data->nbytes, ptr);
         if (extbytes != data->nbytes) {
             SCLogError(SC_ERR_BYTE_EXTRACT_FAILED,"Error extracting %d bytes "
                    "of numeric data: %d", data->nbytes, extbytes);
@@ -55,6 +55,10 @@
  * the inspection phase */
 #define DETECT_CONTENT_NO_DOUBLE_INSPECTION_REQUIRED (1 << 16)
 
+/** content and the rest of its list only depend on the buffer and the
+ *  relative offset, so a failed inspection can be remembered */
+#define DETECT_CONTENT_CHAIN_PURE        (1 << 17)
+
 #define DETECT_CONTENT_IS_SINGLE(c) (!( ((c)->flags & DETECT_CONTENT_DISTANCE) || \
                                         ((c)->flags & DETECT_CONTENT_WITHIN) || \
                                         ((c)->flags & DETECT_CONTENT_RELATIVE_NEXT) || \
@@ -0,0 +1,247 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Implements the dataset keyword: check the buffer against a set of
+ * strings or domains from the 'datasets' section of the yaml.
+ *
+ * dataset:<isset|isnotset>,<name>[,<buffer>];
+ *
+ * The keyword works on the sticky buffer it follows, like dns_query or
+ * tls_sni, or on the buffer named as third option: dns_query, tls_sni or
+ * http_host.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-dataset.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+
+static int DetectDatasetSetup(DetectEngineCtx *, Signature *, char *);
+static void DetectDatasetFree(void *);
+static void DetectDatasetRegisterTests(void);
+
+void DetectDatasetRegister(void)
+{
+    sigmatch_table[DETECT_DATASET].name = "dataset";
+    sigmatch_table[DETECT_DATASET].desc = "match the buffer against a set of strings or domains";
+    sigmatch_table[DETECT_DATASET].Match = NULL;
+    sigmatch_table[DETECT_DATASET].Setup = DetectDatasetSetup;
+    sigmatch_table[DETECT_DATASET].Free  = DetectDatasetFree;
+    sigmatch_table[DETECT_DATASET].RegisterTests = DetectDatasetRegisterTests;
+
+    sigmatch_table[DETECT_DATASET].flags |= SIGMATCH_PAYLOAD;
+}
+
+/**
+ * \brief match the buffer, called from the content inspection
+ *
+ * \retval 1 match
+ * \retval 0 no match
+ */
+int DetectDatasetBufferMatch(DetectEngineThreadCtx *det_ctx,
+        const DetectDatasetData *sd, const uint8_t *data, uint32_t data_len)
+{
+    int r = DatasetLookup(sd->set, data, data_len);
+    if (sd->cmd == DETECT_DATASET_CMD_ISNOTSET)
+        r = !r;
+    return r;
+}
+
+static int DetectDatasetSetup(DetectEngineCtx *de_ctx, Signature *s, char *str)
+{
+    char copy[256];
+    char *args[3] = { NULL, NULL, NULL };
+    int nargs = 0;
+    char *saveptr = NULL;
+    char *tok;
+    DetectDatasetData *sd = NULL;
+    SigMatch *sm = NULL;
+
+    if (str == NULL || strlcpy(copy, str, sizeof(copy)) >= sizeof(copy)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid dataset option");
+        return -1;
+    }
+
+    for (tok = strtok_r(copy, ",", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, ",", &saveptr)) {
+        if (nargs == 3) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "dataset takes at most 3 options");
+            return -1;
+        }
+        while (isspace((unsigned char)*tok))
+            tok++;
+        size_t len = strlen(tok);
+        while (len > 0 && isspace((unsigned char)tok[len - 1]))
+            tok[--len] = '\0';
+        args[nargs++] = tok;
+    }
+    if (nargs < 2) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "dataset needs a command and a "
+                "set name: dataset:isset,<name>");
+        return -1;
+    }
+
+    uint8_t cmd;
+    if (strcmp(args[0], "isset") == 0) {
+        cmd = DETECT_DATASET_CMD_ISSET;
+    } else if (strcmp(args[0], "isnotset") == 0) {
+        cmd = DETECT_DATASET_CMD_ISNOTSET;
+    } else {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "dataset command '%s' is not "
+                "isset or isnotset", args[0]);
+        return -1;
+    }
+
+    int list = s->list;
+    if (args[2] != NULL) {
+        if (s->list != DETECT_SM_LIST_NOTSET) {
+            SCLogError(SC_ERR_INVALID_SIGNATURE, "dataset with a buffer option "
+                    "can't be used with a sticky buffer set");
+            return -1;
+        }
+
+        AppProto alproto;
+        if (strcmp(args[2], "dns_query") == 0) {
+            list = DETECT_SM_LIST_DNSQUERYNAME_MATCH;
+            alproto = ALPROTO_DNS;
+        } else if (strcmp(args[2], "tls_sni") == 0) {
+            list = DETECT_SM_LIST_TLSSNI_MATCH;
+            alproto = ALPROTO_TLS;
+        } else if (strcmp(args[2], "http_host") == 0) {
+            list = DETECT_SM_LIST_HHHDMATCH;
+            alproto = ALPROTO_HTTP;
+        } else {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "dataset buffer '%s' is not "
+                    "dns_query, tls_sni or http_host", args[2]);
+            return -1;
+        }
+
+        if (s->alproto != ALPROTO_UNKNOWN && s->alproto != alproto) {
+            SCLogError(SC_ERR_CONFLICTING_RULE_KEYWORDS, "rule contains "
+                    "conflicting alprotos set");
+            return -1;
+        }
+        s->alproto = alproto;
+        s->flags |= SIG_FLAG_APPLAYER;
+    }
+
+    if (list == DETECT_SM_LIST_NOTSET) {
+        SCLogError(SC_ERR_INVALID_SIGNATURE, "dataset needs a sticky buffer "
+                "or a buffer option");
+        return -1;
+    }
+
+    Dataset *set = DatasetGet(args[1]);
+    if (set == NULL)
+        return -1;
+
+    sd = SCMalloc(sizeof(*sd));
+    if (unlikely(sd == NULL))
+        goto error;
+    sd->set = set;
+    sd->cmd = cmd;
+
+    sm = SigMatchAlloc();
+    if (sm == NULL)
+        goto error;
+    sm->type = DETECT_DATASET;
+    sm->ctx = (SigMatchCtx *)sd;
+
+    SigMatchAppendSMToList(s, sm, list);
+    return 0;
+
+error:
+    if (sd != NULL)
+        SCFree(sd);
+    return -1;
+}
+
+static void DetectDatasetFree(void *ptr)
+{
+    /* the set itself is shared and lives until shutdown */
+    if (ptr != NULL)
+        SCFree(ptr);
+}
+
+#ifdef UNITTESTS
+#include "conf-yaml-loader.h"
+
+static int DetectDatasetTest01(void)
+{
+    const char conf[] =
+        "%YAML 1.1\n"
+        "---\n"
+        "datasets:\n"
+        "  dataset-test-01:\n"
+        "    type: domain\n";
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfYamlLoadString(conf, strlen(conf));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert dns any any -> any any "
+            "(dns_query; dataset:isset,dataset-test-01; sid:1;)");
+    FAIL_IF_NULL(s);
+    FAIL_IF_NULL(s->sm_lists[DETECT_SM_LIST_DNSQUERYNAME_MATCH]);
+    FAIL_IF(s->sm_lists[DETECT_SM_LIST_DNSQUERYNAME_MATCH]->type != DETECT_DATASET);
+
+    s = DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(dataset:isnotset,dataset-test-01,http_host; sid:2;)");
+    FAIL_IF_NULL(s);
+    FAIL_IF_NULL(s->sm_lists[DETECT_SM_LIST_HHHDMATCH]);
+    FAIL_IF(s->alproto != ALPROTO_HTTP);
+
+    /* no buffer, unknown set, bad command */
+    FAIL_IF_NOT_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(dataset:isset,dataset-test-01; sid:3;)"));
+    FAIL_IF_NOT_NULL(DetectEngineAppendSig(de_ctx, "alert dns any any -> any any "
+            "(dns_query; dataset:isset,nosuchset; sid:4;)"));
+    FAIL_IF_NOT_NULL(DetectEngineAppendSig(de_ctx, "alert dns any any -> any any "
+            "(dns_query; dataset:add,dataset-test-01; sid:5;)"));
+
+    const DetectDatasetData *sd = (const DetectDatasetData *)
+        s->sm_lists[DETECT_SM_LIST_HHHDMATCH]->ctx;
+    FAIL_IF(DatasetAdd(sd->set, (uint8_t *)"evil.example", 12) != 1);
+    /* isnotset */
+    FAIL_IF(DetectDatasetBufferMatch(NULL, sd, (uint8_t *)"www.evil.example", 16));
+    FAIL_IF_NOT(DetectDatasetBufferMatch(NULL, sd, (uint8_t *)"www.good.example", 16));
+
+    DetectEngineCtxFree(de_ctx);
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+#endif /* UNITTESTS */
+
+static void DetectDatasetRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectDatasetTest01", DetectDatasetTest01);
+#endif
+}
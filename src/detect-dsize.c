@@ -32,6 +32,7 @@
 #include "flow-var.h"
 
 #include "detect-dsize.h"
+#include "detect-engine-prefilter.h"
 
 #include "util-unittest.h"
 #include "util-debug.h"
@@ -52,6 +53,7 @@ int DetectDsizeMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 static int DetectDsizeSetup (DetectEngineCtx *, Signature *s, char *str);
 void DsizeRegisterTests(void);
 static void DetectDsizeFree(void *);
+static int PrefilterSetupDsize(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
 
 /**
  * \brief Registration function for dsize: keyword
@@ -65,6 +67,7 @@ void DetectDsizeRegister (void)
     sigmatch_table[DETECT_DSIZE].Setup = DetectDsizeSetup;
     sigmatch_table[DETECT_DSIZE].Free  = DetectDsizeFree;
     sigmatch_table[DETECT_DSIZE].RegisterTests = DsizeRegisterTests;
+    sigmatch_table[DETECT_DSIZE].SetupPrefilter = PrefilterSetupDsize;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
@@ -107,6 +110,58 @@ int DetectDsizeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
     SCReturnInt(ret);
 }
 
+/** \internal
+ *  \brief dsize prefilter table compare
+ *
+ *  Payload lengths of 255 and up share the last bucket, so for value 255
+ *  the sig is added if any length of 255 or more can match.
+ */
+static int PrefilterDsizeCompare(const uint8_t value, const SigMatchCtx *ctx)
+{
+    const DetectDsizeData *dd = (const DetectDsizeData *)ctx;
+
+    if (value < 255) {
+        switch (dd->mode) {
+            case DETECTDSIZE_EQ:
+                return (value == dd->dsize);
+            case DETECTDSIZE_LT:
+                return (value < dd->dsize);
+            case DETECTDSIZE_GT:
+                return (value > dd->dsize);
+            case DETECTDSIZE_RA:
+                return (value > dd->dsize && value < dd->dsize2);
+        }
+        return 0;
+    }
+
+    switch (dd->mode) {
+        case DETECTDSIZE_EQ:
+            return (dd->dsize >= 255);
+        case DETECTDSIZE_LT:
+            return (dd->dsize > 255);
+        case DETECTDSIZE_GT:
+            return (dd->dsize < 65535);
+        case DETECTDSIZE_RA:
+            return (MAX((uint32_t)dd->dsize + 1, 255) < dd->dsize2);
+    }
+    return 0;
+}
+
+static void PrefilterPacketDsizeMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void *pectx)
+{
+    if (PKT_IS_PSEUDOPKT(p))
+        return;
+
+    const uint8_t value = (p->payload_len < 255) ? (uint8_t)p->payload_len : 255;
+    PrefilterPacketU8TableAdd(det_ctx, pectx, value);
+}
+
+static int PrefilterSetupDsize(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketU8Table(sgh, DETECT_DSIZE,
+            PrefilterDsizeCompare, PrefilterPacketDsizeMatch);
+}
+
 /**
  * \internal
  * \brief This function is used to parse dsize options passed via dsize: keyword
@@ -1557,9 +1557,8 @@ int DetectAddressCmp(DetectAddress *a, DetectAddress *b)
  *  \retval 0 no match
  *  \retval 1 match
  *
- *  \note addresses in addrs are in host order
- *
- *  \todo array should be ordered, so we can break out of the loop
+ *  \note addresses in addrs are in host order, sorted and not
+ *        overlapping (see DetectAddressMatchIPv4Sort)
  */
 int DetectAddressMatchIPv4(DetectMatchAddressIPv4 *addrs, uint16_t addrs_cnt, Address *a)
 {
@@ -1569,18 +1568,38 @@ int DetectAddressMatchIPv4(DetectMatchAddressIPv4 *addrs, uint16_t addrs_cnt, Ad
         SCReturnInt(0);
     }
 
-    uint16_t idx;
-    for (idx = 0; idx < addrs_cnt; idx++) {
-        if (ntohl(a->addr_data32[0]) >= addrs[idx].ip &&
-            ntohl(a->addr_data32[0]) <= addrs[idx].ip2)
-        {
+    const uint32_t ip = ntohl(a->addr_data32[0]);
+    int lo = 0;
+    int hi = (int)addrs_cnt - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (ip < addrs[mid].ip)
+            hi = mid - 1;
+        else if (ip > addrs[mid].ip2)
+            lo = mid + 1;
+        else
             SCReturnInt(1);
-        }
     }
 
     SCReturnInt(0);
 }
 
+/** \internal
+ *  \brief compare two host order IPv6 addresses
+ *  \retval -1, 0 or 1 if a is lower, equal or higher than b
+ */
+static inline int AddressIPv6Cmp(const uint32_t *a, const uint32_t *b)
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+        if (a[i] < b[i])
+            return -1;
+        if (a[i] > b[i])
+            return 1;
+    }
+    return 0;
+}
+
 /**
  *  \brief Match a packets address against a signatures addrs array
  *
@@ -1591,9 +1610,8 @@ int DetectAddressMatchIPv4(DetectMatchAddressIPv4 *addrs, uint16_t addrs_cnt, Ad
  *  \retval 0 no match
  *  \retval 1 match
  *
- *  \note addresses in addrs are in host order
- *
- *  \todo array should be ordered, so we can break out of the loop
+ *  \note addresses in addrs are in host order, sorted and not
+ *        overlapping (see DetectAddressMatchIPv6Sort)
  */
 int DetectAddressMatchIPv6(DetectMatchAddressIPv6 *addrs, uint16_t addrs_cnt, Address *a)
 {
@@ -1603,72 +1621,93 @@ int DetectAddressMatchIPv6(DetectMatchAddressIPv6 *addrs, uint16_t addrs_cnt, Ad
         SCReturnInt(0);
     }
 
-    uint16_t idx;
-    int i = 0;
-    uint16_t result1, result2;
-
-    /* See if the packet address is within the range of any entry in the
-     * signature's address match array.
-     */
-    for (idx = 0; idx < addrs_cnt; idx++) {
-        result1 = result2 = 0;
-
-        /* See if packet address equals either limit. Return 1 if true. */
-        if (ntohl(a->addr_data32[0]) == addrs[idx].ip[0] &&
-            ntohl(a->addr_data32[1]) == addrs[idx].ip[1] &&
-            ntohl(a->addr_data32[2]) == addrs[idx].ip[2] &&
-            ntohl(a->addr_data32[3]) == addrs[idx].ip[3])
-        {
+    uint32_t ip[4];
+    ip[0] = ntohl(a->addr_data32[0]);
+    ip[1] = ntohl(a->addr_data32[1]);
+    ip[2] = ntohl(a->addr_data32[2]);
+    ip[3] = ntohl(a->addr_data32[3]);
+
+    int lo = 0;
+    int hi = (int)addrs_cnt - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (AddressIPv6Cmp(ip, addrs[mid].ip) < 0)
+            hi = mid - 1;
+        else if (AddressIPv6Cmp(ip, addrs[mid].ip2) > 0)
+            lo = mid + 1;
+        else
             SCReturnInt(1);
-        }
-        if (ntohl(a->addr_data32[0]) == addrs[idx].ip2[0] &&
-            ntohl(a->addr_data32[1]) == addrs[idx].ip2[1] &&
-            ntohl(a->addr_data32[2]) == addrs[idx].ip2[2] &&
-            ntohl(a->addr_data32[3]) == addrs[idx].ip2[3])
-        {
-            SCReturnInt(1);
-        }
+    }
 
-        /* See if packet address is greater than lower limit
-         * of the current signature address match pair.
-         */
-        for (i = 0; i < 4; i++) {
-            if (ntohl(a->addr_data32[i]) > addrs[idx].ip[i]) {
-                result1 = 1;
-                break;
-            }
-            if (ntohl(a->addr_data32[i]) < addrs[idx].ip[i]) {
-                result1 = 0;
-                break;
-            }
-        }
+    SCReturnInt(0);
+}
 
-        /* If not greater than lower limit, try next address match entry */
-        if (result1 == 0)
-            continue;
-
-        /* See if packet address is less than upper limit
-         * of the current signature address match pair.
-         */
-        for (i = 0; i < 4; i++) {
-            if (ntohl(a->addr_data32[i]) < addrs[idx].ip2[i]) {
-                result2 = 1;
-                break;
-            }
-            if (ntohl(a->addr_data32[i]) > addrs[idx].ip2[i]) {
-                result2 = 0;
-                break;
-            }
-        }
+static int DetectAddressMatchIPv4Cmp(const void *a, const void *b)
+{
+    const DetectMatchAddressIPv4 *x = a;
+    const DetectMatchAddressIPv4 *y = b;
+    if (x->ip < y->ip)
+        return -1;
+    return x->ip > y->ip;
+}
 
-        /* Return a match if packet address is between the two
-         * signature address match limits.
-         */
-        if (result1 == 1 && result2 == 1)
-            SCReturnInt(1);
+static int DetectAddressMatchIPv6Cmp(const void *a, const void *b)
+{
+    const DetectMatchAddressIPv6 *x = a;
+    const DetectMatchAddressIPv6 *y = b;
+    return AddressIPv6Cmp(x->ip, y->ip);
+}
+
+/**
+ *  \brief sort an IPv4 match array and merge overlapping ranges, so that
+ *         DetectAddressMatchIPv4 can binary search it
+ *
+ *  \retval cnt number of ranges left in the array
+ */
+uint16_t DetectAddressMatchIPv4Sort(DetectMatchAddressIPv4 *addrs, uint16_t addrs_cnt)
+{
+    if (addrs_cnt < 2)
+        return addrs_cnt;
+
+    qsort(addrs, addrs_cnt, sizeof(DetectMatchAddressIPv4), DetectAddressMatchIPv4Cmp);
+
+    uint16_t out = 0;
+    uint16_t idx;
+    for (idx = 1; idx < addrs_cnt; idx++) {
+        if (addrs[idx].ip <= addrs[out].ip2) {
+            if (addrs[idx].ip2 > addrs[out].ip2)
+                addrs[out].ip2 = addrs[idx].ip2;
+        } else {
+            addrs[++out] = addrs[idx];
+        }
     }
+    return out + 1;
+}
 
-    SCReturnInt(0);
+/**
+ *  \brief sort an IPv6 match array and merge overlapping ranges, so that
+ *         DetectAddressMatchIPv6 can binary search it
+ *
+ *  \retval cnt number of ranges left in the array
+ */
+uint16_t DetectAddressMatchIPv6Sort(DetectMatchAddressIPv6 *addrs, uint16_t addrs_cnt)
+{
+    if (addrs_cnt < 2)
+        return addrs_cnt;
+
+    qsort(addrs, addrs_cnt, sizeof(DetectMatchAddressIPv6), DetectAddressMatchIPv6Cmp);
+
+    uint16_t out = 0;
+    uint16_t idx;
+    for (idx = 1; idx < addrs_cnt; idx++) {
+        if (AddressIPv6Cmp(addrs[idx].ip, addrs[out].ip2) <= 0) {
+            if (AddressIPv6Cmp(addrs[idx].ip2, addrs[out].ip2) > 0)
+                memcpy(addrs[out].ip2, addrs[idx].ip2, sizeof(addrs[out].ip2));
+        } else {
+            addrs[++out] = addrs[idx];
+        }
+    }
+    return out + 1;
 }
 
 /**
@@ -4808,6 +4847,80 @@ int AddressConfVarsTest05(void)
     return result;
 }
 
+/** \test sorted and merged match arrays are binary searched correctly */
+static int AddressMatchArrayTest01(void)
+{
+    DetectMatchAddressIPv4 addrs[5];
+    Address a;
+
+    /* unsorted, with an overlap and a range contained in another */
+    addrs[0].ip = 0x0a000000; addrs[0].ip2 = 0x0affffff;    /* 10/8 */
+    addrs[1].ip = 0xc0a80000; addrs[1].ip2 = 0xc0a800ff;    /* 192.168.0/24 */
+    addrs[2].ip = 0x0a010000; addrs[2].ip2 = 0x0a01ffff;    /* in 10/8 */
+    addrs[3].ip = 0xc0a80080; addrs[3].ip2 = 0xc0a801ff;    /* overlaps */
+    addrs[4].ip = 0x01020304; addrs[4].ip2 = 0x01020304;
+
+    uint16_t cnt = DetectAddressMatchIPv4Sort(addrs, 5);
+    FAIL_IF(cnt != 3);
+    FAIL_IF(addrs[0].ip != 0x01020304);
+    FAIL_IF(addrs[1].ip != 0x0a000000 || addrs[1].ip2 != 0x0affffff);
+    FAIL_IF(addrs[2].ip != 0xc0a80000 || addrs[2].ip2 != 0xc0a801ff);
+
+    memset(&a, 0, sizeof(a));
+    a.family = AF_INET;
+    a.addr_data32[0] = htonl(0x01020304);
+    FAIL_IF_NOT(DetectAddressMatchIPv4(addrs, cnt, &a));
+    a.addr_data32[0] = htonl(0x0a7f0001);
+    FAIL_IF_NOT(DetectAddressMatchIPv4(addrs, cnt, &a));
+    a.addr_data32[0] = htonl(0xc0a801ff);
+    FAIL_IF_NOT(DetectAddressMatchIPv4(addrs, cnt, &a));
+    a.addr_data32[0] = htonl(0xc0a80200);
+    FAIL_IF(DetectAddressMatchIPv4(addrs, cnt, &a));
+    a.addr_data32[0] = htonl(0x01020305);
+    FAIL_IF(DetectAddressMatchIPv4(addrs, cnt, &a));
+    a.addr_data32[0] = htonl(0x00000001);
+    FAIL_IF(DetectAddressMatchIPv4(addrs, cnt, &a));
+
+    PASS;
+}
+
+/** \test IPv6 match array sort, merge and search */
+static int AddressMatchArrayTest02(void)
+{
+    DetectMatchAddressIPv6 addrs[3];
+    Address a;
+
+    memset(&addrs, 0, sizeof(addrs));
+    /* 2001:db8::/32 */
+    addrs[0].ip[0] = 0x20010db8;
+    addrs[0].ip2[0] = 0x20010db8;
+    addrs[0].ip2[1] = addrs[0].ip2[2] = addrs[0].ip2[3] = 0xffffffff;
+    /* ::1 */
+    addrs[1].ip[3] = 1;
+    addrs[1].ip2[3] = 1;
+    /* 2001:db8:1::/48, inside the first */
+    addrs[2].ip[0] = 0x20010db8;
+    addrs[2].ip[1] = 0x00010000;
+    addrs[2].ip2[0] = 0x20010db8;
+    addrs[2].ip2[1] = 0x0001ffff;
+    addrs[2].ip2[2] = addrs[2].ip2[3] = 0xffffffff;
+
+    uint16_t cnt = DetectAddressMatchIPv6Sort(addrs, 3);
+    FAIL_IF(cnt != 2);
+
+    memset(&a, 0, sizeof(a));
+    a.family = AF_INET6;
+    a.addr_data32[3] = htonl(1);
+    FAIL_IF_NOT(DetectAddressMatchIPv6(addrs, cnt, &a));
+    a.addr_data32[0] = htonl(0x20010db8);
+    a.addr_data32[1] = htonl(0x12345678);
+    FAIL_IF_NOT(DetectAddressMatchIPv6(addrs, cnt, &a));
+    a.addr_data32[0] = htonl(0x20010db9);
+    FAIL_IF(DetectAddressMatchIPv6(addrs, cnt, &a));
+
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DetectAddressTests(void)
@@ -5010,5 +5123,7 @@ void DetectAddressTests(void)
     UtRegisterTest("AddressConfVarsTest03 ", AddressConfVarsTest03);
     UtRegisterTest("AddressConfVarsTest04 ", AddressConfVarsTest04);
     UtRegisterTest("AddressConfVarsTest05 ", AddressConfVarsTest05);
+    UtRegisterTest("AddressMatchArrayTest01", AddressMatchArrayTest01);
+    UtRegisterTest("AddressMatchArrayTest02", AddressMatchArrayTest02);
 #endif /* UNITTESTS */
 }
@@ -54,6 +54,8 @@ int DetectAddressCmp(DetectAddress *, DetectAddress *);
 
 int DetectAddressMatchIPv4(DetectMatchAddressIPv4 *, uint16_t, Address *);
 int DetectAddressMatchIPv6(DetectMatchAddressIPv6 *, uint16_t, Address *);
+uint16_t DetectAddressMatchIPv4Sort(DetectMatchAddressIPv4 *, uint16_t);
+uint16_t DetectAddressMatchIPv6Sort(DetectMatchAddressIPv6 *, uint16_t);
 
 int DetectAddressTestConfVars(void);
 
@@ -179,6 +179,10 @@ int PacketAlertRemove(Packet *p, uint16_t pos)
 }
 
 /** \brief append a signature match to a packet
+ *
+ *  Alerts are appended unsorted, PacketAlertFinalize sorts them once. If
+ *  the array is full the new alert replaces the lowest priority alert
+ *  if it has a higher priority itself.
  *
  *  \param det_ctx thread detection engine ctx
  *  \param s the signature that matched
@@ -188,42 +192,51 @@ int PacketAlertRemove(Packet *p, uint16_t pos)
  */
 int PacketAlertAppend(DetectEngineThreadCtx *det_ctx, Signature *s, Packet *p, uint64_t tx_id, uint8_t flags)
 {
-    int i = 0;
-
-    if (p->alerts.cnt == PACKET_ALERT_MAX)
-        return 0;
+    PacketAlert *pa;
 
     SCLogDebug("sid %"PRIu32"", s->id);
 
-    /* It should be usually the last, so check it before iterating */
-    if (p->alerts.cnt == 0 || (p->alerts.cnt > 0 &&
-                               p->alerts.alerts[p->alerts.cnt - 1].num < s->num)) {
-        /* We just add it */
-        p->alerts.alerts[p->alerts.cnt].num = s->num;
-        p->alerts.alerts[p->alerts.cnt].action = s->action;
-        p->alerts.alerts[p->alerts.cnt].flags = flags;
-        p->alerts.alerts[p->alerts.cnt].s = s;
-        p->alerts.alerts[p->alerts.cnt].tx_id = tx_id;
+    if (likely(p->alerts.cnt < PACKET_ALERT_MAX)) {
+        pa = &p->alerts.alerts[p->alerts.cnt];
+        p->alerts.cnt++;
     } else {
-        /* We need to make room for this s->num
-         (a bit ugly with memcpy but we are planning changes here)*/
-        for (i = p->alerts.cnt - 1; i >= 0 && p->alerts.alerts[i].num > s->num; i--) {
-            memcpy(&p->alerts.alerts[i + 1], &p->alerts.alerts[i], sizeof(PacketAlert));
+        uint16_t i, low = 0;
+        for (i = 1; i < p->alerts.cnt; i++) {
+            if (p->alerts.alerts[i].num > p->alerts.alerts[low].num)
+                low = i;
         }
+        if (p->alerts.alerts[low].num < s->num)
+            return 0;
+        pa = &p->alerts.alerts[low];
+    }
 
-        i++; /* The right place to store the alert */
+    pa->num = s->num;
+    pa->action = s->action;
+    pa->flags = flags;
+    pa->s = s;
+    pa->tx_id = tx_id;
+    return 0;
+}
 
-        p->alerts.alerts[i].num = s->num;
-        p->alerts.alerts[i].action = s->action;
-        p->alerts.alerts[i].flags = flags;
-        p->alerts.alerts[i].s = s;
-        p->alerts.alerts[i].tx_id = tx_id;
-    }
+/** \brief sort the alerts by internal sig num, which is the priority
+ *         order. Insertion sort, as the array is small and usually
+ *         already (nearly) sorted. Equal nums keep their append order. */
+static void PacketAlertSort(Packet *p)
+{
+    uint16_t i;
 
-    /* Update the count */
-    p->alerts.cnt++;
+    for (i = 1; i < p->alerts.cnt; i++) {
+        if (p->alerts.alerts[i - 1].num <= p->alerts.alerts[i].num)
+            continue;
 
-    return 0;
+        PacketAlert tmp = p->alerts.alerts[i];
+        int j = i - 1;
+        while (j >= 0 && p->alerts.alerts[j].num > tmp.num) {
+            p->alerts.alerts[j + 1] = p->alerts.alerts[j];
+            j--;
+        }
+        p->alerts.alerts[j + 1] = tmp;
+    }
 }
 
 /**
@@ -239,10 +252,15 @@ void PacketAlertFinalize(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
 {
     SCEnter();
     int i = 0;
+    int cnt = p->alerts.cnt;
+    /* alerts that survive thresholding are compacted to the front */
+    int w = 0;
     Signature *s = NULL;
     SigMatch *sm = NULL;
 
-    while (i < p->alerts.cnt) {
+    PacketAlertSort(p);
+
+    for (i = 0; i < cnt; i++) {
         SCLogDebug("Sig->num: %"PRIu16, p->alerts.alerts[i].num);
         s = de_ctx->sig_array[p->alerts.alerts[i].num];
 
@@ -290,7 +308,7 @@ void PacketAlertFinalize(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
             if (PACKET_TEST_ACTION(p, ACTION_PASS)) {
                 /* Ok, reset the alert cnt to end in the previous of pass
                  * so we ignore the rest with less prio */
-                p->alerts.cnt = i;
+                p->alerts.cnt = w;
 
                 /* if an stream/app-layer match we enforce the pass for the flow */
                 if ((p->flow != NULL) &&
@@ -299,7 +317,7 @@ void PacketAlertFinalize(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
                 {
                     FlowSetNoPacketInspectionFlag(p->flow);
                 }
-                break;
+                goto tag;
 
             /* if the signature wants to drop, check if the
              * PACKET_ALERT_FLAG_DROP_FLOW flag is set. */
@@ -314,16 +332,15 @@ void PacketAlertFinalize(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
         }
 
         /* Thresholding removes this alert */
-        if (res == 0 || res == 2) {
-            PacketAlertRemove(p, i);
-
-            if (p->alerts.cnt == 0)
-                break;
-        } else {
-            i++;
+        if (res != 0 && res != 2) {
+            if (w != i)
+                p->alerts.alerts[w] = p->alerts.alerts[i];
+            w++;
         }
     }
+    p->alerts.cnt = w;
 
+tag:
     /* At this point, we should have all the new alerts. Now check the tag
      * keyword context for sessions and hosts */
     if (!(p->flags & PKT_PSEUDO_STREAM_END))
@@ -34,7 +34,9 @@
 #include "detect-content.h"
 #include "detect-flow.h"
 #include "detect-flags.h"
+#include "detect-pcre.h"
 #include "util-print.h"
+#include "util-time.h"
 
 static int rule_warnings_only = 0;
 static FILE *rule_engine_analysis_FD = NULL;
@@ -52,6 +54,36 @@ typedef struct FpPatternStats_ {
 
 static FpPatternStats fp_pattern_stats[DETECT_SM_LIST_MAX];
 
+/** rule cost report, see EngineAnalysisRulesCost() */
+static FILE *cost_engine_analysis_FD = NULL;
+static char cost_log_path[PATH_MAX];
+
+/** assumed inspections per MB of traffic for a rule that is evaluated
+ *  for every packet or buffer, i.e. 1k per packet or buffer */
+#define COST_INSPECTIONS_PER_MB     1024.0
+/** share of the inspections left over by a keyword prefilter engine */
+#define COST_PREFILTER_FACTOR       0.125
+/** inspection cost of the keywords of a rule, in content compares */
+#define COST_KEYWORD                0.5
+#define COST_CONTENT                1.0
+#define COST_PCRE_ANCHORED          5.0
+#define COST_PCRE_UNANCHORED        25.0
+
+#define COST_HASH3_SIZE             (1 << 20)
+#define COST_HASH3(a, b, c) \
+    (((((uint32_t)(a) << 16) | ((uint32_t)(b) << 8) | (c)) * 2654435761U) >> 12)
+
+/** n-gram counts of the reference traffic, [0] as is, [1] lowercased */
+typedef struct CostProfile_ {
+    uint64_t len;
+    uint32_t c1[256];
+    uint32_t *c2;       /**< 2-grams, 65536 */
+    uint32_t *c3;       /**< 3-grams, hashed to COST_HASH3_SIZE */
+} CostProfile;
+
+static CostProfile cost_profile[2];
+static int cost_profile_loaded = 0;
+
 static void FpPatternStatsAdd(int list, uint16_t patlen)
 {
     if (list < 0 || list >= DETECT_SM_LIST_MAX)
@@ -318,6 +350,135 @@ int SetupRuleAnalyzer(void)
     return 1;
 }
 
+/** \internal
+ *  \brief count the 1, 2 and 3 byte n-grams of the traffic profile
+ *
+ *  The profile is a file of raw payload bytes, e.g. the reassembled
+ *  streams of a pcap that represents the sensor's traffic.
+ */
+static int CostProfileLoad(const char *path)
+{
+    uint8_t buf[65536];
+    uint8_t h[2][2] = { { 0, 0 }, { 0, 0 } };
+    uint64_t pos = 0;
+    size_t n, i;
+    int t;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    for (t = 0; t < 2; t++) {
+        memset(&cost_profile[t], 0, sizeof(CostProfile));
+        cost_profile[t].c2 = SCCalloc(65536, sizeof(uint32_t));
+        cost_profile[t].c3 = SCCalloc(COST_HASH3_SIZE, sizeof(uint32_t));
+        if (cost_profile[t].c2 == NULL || cost_profile[t].c3 == NULL) {
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        for (i = 0; i < n; i++, pos++) {
+            for (t = 0; t < 2; t++) {
+                CostProfile *cp = &cost_profile[t];
+                uint8_t c = t ? u8_tolower(buf[i]) : buf[i];
+
+                cp->c1[c]++;
+                if (pos >= 1)
+                    cp->c2[(h[t][1] << 8) | c]++;
+                if (pos >= 2)
+                    cp->c3[COST_HASH3(h[t][0], h[t][1], c)]++;
+                h[t][0] = h[t][1];
+                h[t][1] = c;
+            }
+        }
+    }
+    fclose(fp);
+
+    if (pos < 3) {
+        SCLogError(SC_ERR_INVALID_VALUE, "traffic profile %s is empty", path);
+        return -1;
+    }
+    cost_profile[0].len = cost_profile[1].len = pos;
+    cost_profile_loaded = 1;
+    return 0;
+}
+
+static void CostProfileFree(void)
+{
+    int t;
+    for (t = 0; t < 2; t++) {
+        if (cost_profile[t].c2 != NULL)
+            SCFree(cost_profile[t].c2);
+        if (cost_profile[t].c3 != NULL)
+            SCFree(cost_profile[t].c3);
+        memset(&cost_profile[t], 0, sizeof(CostProfile));
+    }
+    cost_profile_loaded = 0;
+}
+
+/**
+ * \brief Sets up the rule cost report according to the config
+ *
+ *        engine-analysis.rules-cost enables it, the optional
+ *        engine-analysis.traffic-profile file is what the fast patterns
+ *        are measured against.
+ *
+ * \retval 1 if the cost report is enabled
+ * \retval 0 if not enabled
+ */
+int SetupCostAnalyzer(void)
+{
+    int enabled = 0;
+
+    if (ConfGetBool("engine-analysis.rules-cost", &enabled) == 0 || enabled == 0)
+        return 0;
+
+#ifndef HAVE_LIBJANSSON
+    SCLogWarning(SC_ERR_NO_JSON_SUPPORT, "no json support compiled in, "
+            "not printing the rules cost report");
+    return 0;
+#else
+    char *log_dir;
+    log_dir = ConfigGetLogDirectory();
+    snprintf(cost_log_path, sizeof(cost_log_path), "%s/%s", log_dir,
+             "rules_cost.json");
+
+    cost_engine_analysis_FD = fopen(cost_log_path, "w");
+    if (cost_engine_analysis_FD == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", cost_log_path,
+                   strerror(errno));
+        return 0;
+    }
+
+    char *profile = NULL;
+    if (ConfGet("engine-analysis.traffic-profile", &profile) == 1 &&
+            profile != NULL) {
+        if (CostProfileLoad(profile) < 0) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "can't use traffic profile %s, "
+                    "estimating fast pattern hits from their length", profile);
+            CostProfileFree();
+        }
+    }
+
+    SCLogInfo("Engine-Analysis for rule cost printed to file - %s",
+              cost_log_path);
+    return 1;
+#endif
+}
+
+void CleanupCostAnalyzer(void)
+{
+    if (cost_engine_analysis_FD != NULL) {
+        fclose(cost_engine_analysis_FD);
+        cost_engine_analysis_FD = NULL;
+    }
+    CostProfileFree();
+}
+
 void CleanupFPAnalyzer(void)
 {
     fprintf(fp_engine_analysis_FD, "============\n"
@@ -943,3 +1104,330 @@ void EngineAnalysisRules(const Signature *s, const char *line)
     }
     return;
 }
+
+#ifdef HAVE_LIBJANSSON
+/**
+ * \brief Predicted fast pattern hits per MB of inspected buffer.
+ *
+ *        With a traffic profile the pattern is scored with its 3-grams,
+ *        i.e. P(b0 b1 b2) * P(b3 | b1 b2) * ... With no profile, or for
+ *        patterns the profile never saw, every byte of real traffic is
+ *        taken to carry 6 bits of entropy, 5 for nocase.
+ */
+static double EngineAnalysisPatternRate(const uint8_t *pat, uint16_t patlen,
+        int nocase)
+{
+    double prob = 1.0;
+    uint16_t i;
+
+    if (patlen == 0)
+        return COST_INSPECTIONS_PER_MB;
+
+    if (cost_profile_loaded) {
+        const CostProfile *cp = &cost_profile[nocase ? 1 : 0];
+        uint8_t p1 = 0, p2 = 0;
+
+        for (i = 0; i < patlen; i++) {
+            uint8_t c = nocase ? u8_tolower(pat[i]) : pat[i];
+
+            if (i == 0) {
+                prob = (cp->c1[c] + 0.5) / (double)cp->len;
+            } else if (i == 1) {
+                prob = (cp->c2[(p1 << 8) | c] + 0.5) / (double)cp->len;
+            } else if (i == 2) {
+                prob = (cp->c3[COST_HASH3(p2, p1, c)] + 0.5) / (double)cp->len;
+            } else {
+                prob *= (cp->c3[COST_HASH3(p2, p1, c)] + 0.5) /
+                        (cp->c2[(p2 << 8) | p1] + 1.0);
+            }
+            p2 = p1;
+            p1 = c;
+        }
+    } else {
+        double p = nocase ? 1.0 / 32.0 : 1.0 / 64.0;
+        for (i = 0; i < patlen && i < 8; i++)
+            prob *= p;
+    }
+
+    return prob * 1048576.0;
+}
+
+/** \internal
+ *  \brief cost of inspecting a rule once it's a candidate, in content
+ *         compares */
+static double EngineAnalysisSigInspectCost(const Signature *s,
+        uint32_t *content_cnt, uint32_t *pcre_cnt, uint32_t *pcre_unanchored)
+{
+    double cost = 1.0;
+    int list;
+
+    for (list = 0; list < DETECT_SM_LIST_DETECT_MAX; list++) {
+        const SigMatch *sm;
+        for (sm = s->sm_lists[list]; sm != NULL; sm = sm->next) {
+            if (sm->type == DETECT_CONTENT) {
+                (*content_cnt)++;
+                cost += COST_CONTENT;
+            } else if (sm->type == DETECT_PCRE) {
+                const DetectPcreData *pd = (const DetectPcreData *)sm->ctx;
+                unsigned long opts = 0;
+
+                (*pcre_cnt)++;
+                (void)pcre_fullinfo(pd->re, pd->sd, PCRE_INFO_OPTIONS, &opts);
+                if ((opts & PCRE_ANCHORED) || (pd->flags & DETECT_PCRE_RELATIVE)) {
+                    cost += COST_PCRE_ANCHORED;
+                } else {
+                    (*pcre_unanchored)++;
+                    cost += COST_PCRE_UNANCHORED;
+                }
+            } else {
+                cost += COST_KEYWORD;
+            }
+        }
+    }
+    return cost;
+}
+
+typedef struct RuleCost_ {
+    const Signature *s;
+    double cost;
+    json_t *js;
+} RuleCost;
+
+static int RuleCostSortByCost(const void *a, const void *b)
+{
+    const RuleCost *r0 = a;
+    const RuleCost *r1 = b;
+    if (r1->cost == r0->cost)
+        return 0;
+    return r0->cost > r1->cost ? -1 : 1;
+}
+
+/** \internal
+ *  \brief estimate the cost of a rule per MB of traffic: the rate at which
+ *         it becomes a candidate times the cost of inspecting it */
+static json_t *EngineAnalysisRuleCost(const Signature *s, double *cost)
+{
+    uint32_t content_cnt = 0, pcre_cnt = 0, pcre_unanchored = 0;
+    double rate;
+    const char *prefilter;
+
+    json_t *js = json_object();
+    if (js == NULL)
+        return NULL;
+
+    json_object_set_new(js, "signature_id", json_integer(s->id));
+    json_object_set_new(js, "gid", json_integer(s->gid));
+    json_object_set_new(js, "rev", json_integer(s->rev));
+
+    double inspect = EngineAnalysisSigInspectCost(s, &content_cnt, &pcre_cnt,
+            &pcre_unanchored);
+    json_t *warn = json_array();
+
+    if (s->flags & SIG_FLAG_IPONLY) {
+        /* evaluated once per flow direction */
+        prefilter = "iponly";
+        rate = 0.0;
+    } else if (s->mpm_sm != NULL) {
+        const DetectContentData *cd = (const DetectContentData *)s->mpm_sm->ctx;
+        const uint8_t *pat = cd->content;
+        uint16_t patlen = cd->content_len;
+
+        if (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP) {
+            pat = cd->content + cd->fp_chop_offset;
+            patlen = cd->fp_chop_len;
+        }
+
+        prefilter = "mpm";
+        if (s->flags & SIG_FLAG_MPM_NEG)
+            rate = COST_INSPECTIONS_PER_MB;
+        else
+            rate = EngineAnalysisPatternRate(pat, patlen,
+                    (cd->flags & DETECT_CONTENT_NOCASE) ? 1 : 0);
+        if (rate > COST_INSPECTIONS_PER_MB)
+            rate = COST_INSPECTIONS_PER_MB;
+
+        json_t *fp = json_object();
+        if (fp != NULL) {
+            int list = SigMatchListSMBelongsTo(s, s->mpm_sm);
+            json_object_set_new(fp, "buffer",
+                    json_string(DetectSigmatchListEnumToString(list)));
+            json_object_set_new(fp, "length", json_integer(patlen));
+            json_object_set_new(fp, "nocase",
+                    (cd->flags & DETECT_CONTENT_NOCASE) ? json_true() : json_false());
+            json_object_set_new(fp, "negated",
+                    (s->flags & SIG_FLAG_MPM_NEG) ? json_true() : json_false());
+            json_object_set_new(fp, "hits_per_mb", json_real(rate));
+            json_object_set_new(js, "fast_pattern", fp);
+        }
+        if (patlen < 3 && warn != NULL)
+            json_array_append_new(warn, json_string("short_fast_pattern"));
+    } else if (s->prefilter_sm != NULL) {
+        prefilter = "keyword";
+        rate = COST_INSPECTIONS_PER_MB * COST_PREFILTER_FACTOR;
+    } else {
+        prefilter = "none";
+        rate = COST_INSPECTIONS_PER_MB;
+        if (warn != NULL)
+            json_array_append_new(warn, json_string("no_prefilter"));
+    }
+    if (pcre_unanchored > 0 && warn != NULL) {
+        json_array_append_new(warn, json_string(content_cnt == 0 ?
+                    "pcre_unanchored_no_content" : "pcre_unanchored"));
+    }
+
+    *cost = rate * inspect;
+
+    json_object_set_new(js, "prefilter", json_string(prefilter));
+    json_object_set_new(js, "contents", json_integer(content_cnt));
+    json_object_set_new(js, "pcres", json_integer(pcre_cnt));
+    json_object_set_new(js, "pcres_unanchored", json_integer(pcre_unanchored));
+    json_object_set_new(js, "inspect_cost", json_real(inspect));
+    json_object_set_new(js, "cost", json_real(*cost));
+    if (warn != NULL) {
+        if (json_array_size(warn) > 0)
+            json_object_set_new(js, "warnings", warn);
+        else
+            json_decref(warn);
+    }
+    return js;
+}
+#endif /* HAVE_LIBJANSSON */
+
+/**
+ * \brief Prints the predicted cost of the loaded rules and of the sig
+ *        group heads they end up in, as json.
+ *
+ *        The cost of a rule is the rate at which it becomes a candidate
+ *        (fast pattern hits per MB, or every inspection if there's no
+ *        prefilter) times what it takes to inspect it, in content
+ *        compares. The cost of a group is the sum of the costs of its
+ *        rules. The numbers are estimates to compare rule sets with, not
+ *        cpu time.
+ *
+ *        To be called after SigGroupBuild().
+ *
+ * \param de_ctx detection engine ctx with the built sig groups
+ */
+void EngineAnalysisRulesCost(const DetectEngineCtx *de_ctx)
+{
+#ifdef HAVE_LIBJANSSON
+    char timebuf[64];
+    struct timeval tval;
+    const Signature *s;
+    uint32_t i, cnt = 0;
+    double total = 0.0, group_max = 0.0;
+
+    if (cost_engine_analysis_FD == NULL)
+        return;
+
+    double *sig_costs = SCCalloc(de_ctx->sig_array_len ? de_ctx->sig_array_len : 1,
+            sizeof(double));
+    if (sig_costs == NULL)
+        return;
+
+    for (s = de_ctx->sig_list; s != NULL; s = s->next)
+        cnt++;
+    RuleCost *rules = SCCalloc(cnt ? cnt : 1, sizeof(RuleCost));
+    if (rules == NULL) {
+        SCFree(sig_costs);
+        return;
+    }
+
+    json_t *js = json_object();
+    json_t *jsr = json_array();
+    json_t *jsg = json_array();
+    if (js == NULL || jsr == NULL || jsg == NULL)
+        goto end;
+
+    gettimeofday(&tval, NULL);
+    CreateIsoTimeString(&tval, timebuf, sizeof(timebuf));
+    json_object_set_new(js, "timestamp", json_string(timebuf));
+    json_object_set_new(js, "traffic_profile",
+            json_string(cost_profile_loaded ? "file" : "heuristic"));
+
+    /* rules, most expensive first */
+    for (i = 0, s = de_ctx->sig_list; s != NULL && i < cnt; s = s->next, i++) {
+        rules[i].s = s;
+        rules[i].js = EngineAnalysisRuleCost(s, &rules[i].cost);
+        if (s->num < de_ctx->sig_array_len)
+            sig_costs[s->num] = rules[i].cost;
+        total += rules[i].cost;
+    }
+    qsort(rules, cnt, sizeof(RuleCost), RuleCostSortByCost);
+    for (i = 0; i < cnt; i++) {
+        if (rules[i].js != NULL) {
+            json_array_append_new(jsr, rules[i].js);
+            rules[i].js = NULL;
+        }
+    }
+
+    for (i = 0; i < de_ctx->sgh_array_cnt; i++) {
+        const SigGroupHead *sgh = de_ctx->sgh_array[i];
+        uint32_t sig, mpm_cnt = 0;
+        double cost = 0.0;
+
+        if (sgh == NULL || sgh->match_array == NULL)
+            continue;
+
+        for (sig = 0; sig < sgh->sig_cnt; sig++) {
+            const Signature *gs = sgh->match_array[sig];
+            if (gs == NULL)
+                continue;
+            if (gs->mpm_sm != NULL)
+                mpm_cnt++;
+            if (gs->num < de_ctx->sig_array_len)
+                cost += sig_costs[gs->num];
+        }
+        if (cost > group_max)
+            group_max = cost;
+
+        json_t *g = json_object();
+        if (g == NULL)
+            continue;
+        json_object_set_new(g, "id", json_integer(sgh->id));
+        json_object_set_new(g, "rules", json_integer(sgh->sig_cnt));
+        json_object_set_new(g, "mpm_rules", json_integer(mpm_cnt));
+        json_object_set_new(g, "non_mpm_rules",
+                json_integer(sgh->non_mpm_other_store_cnt));
+        json_object_set_new(g, "non_mpm_syn_rules",
+                json_integer(sgh->non_mpm_syn_store_cnt));
+        json_object_set_new(g, "cost", json_real(cost));
+        json_array_append_new(jsg, g);
+    }
+
+    json_t *tot = json_object();
+    if (tot != NULL) {
+        json_object_set_new(tot, "rules", json_integer(cnt));
+        json_object_set_new(tot, "groups", json_integer(de_ctx->sgh_array_cnt));
+        json_object_set_new(tot, "cost", json_real(total));
+        json_object_set_new(tot, "group_cost_max", json_real(group_max));
+        json_object_set_new(js, "totals", tot);
+    }
+    json_object_set_new(js, "rules", jsr);
+    jsr = NULL;
+    json_object_set_new(js, "groups", jsg);
+    jsg = NULL;
+
+    char *js_s = json_dumps(js, JSON_PRESERVE_ORDER|JSON_INDENT(2));
+    if (js_s != NULL) {
+        fprintf(cost_engine_analysis_FD, "%s\n", js_s);
+        free(js_s);
+    }
+    SCLogInfo("rules cost: %u rules, predicted cost %.0f, "
+            "most expensive group %.0f", cnt, total, group_max);
+
+end:
+    for (i = 0; i < cnt; i++) {
+        if (rules[i].js != NULL)
+            json_decref(rules[i].js);
+    }
+    if (jsr != NULL)
+        json_decref(jsr);
+    if (jsg != NULL)
+        json_decref(jsg);
+    if (js != NULL)
+        json_decref(js);
+    SCFree(rules);
+    SCFree(sig_costs);
+#endif /* HAVE_LIBJANSSON */
+}
@@ -39,4 +39,8 @@ void EngineAnalysisFP(Signature *s, char *line);
 void EngineAnalysisRules(const Signature *s, const char *line);
 void EngineAnalysisRulesFailure(char *line, char *file, int lineno);
 
+int SetupCostAnalyzer(void);
+void CleanupCostAnalyzer(void);
+void EngineAnalysisRulesCost(const DetectEngineCtx *de_ctx);
+
 #endif /* __DETECT_ENGINE_ANALYZER_H__ */
@@ -44,6 +44,7 @@
 #include "detect-lua.h"
 #include "detect-base64-decode.h"
 #include "detect-base64-data.h"
+#include "detect-dataset.h"
 
 #include "app-layer-dcerpc.h"
 
@@ -59,6 +60,51 @@
 #include "util-lua.h"
 #endif
 
+/** \brief mark the contents whose remaining list only depends on the
+ *         buffer and the relative offset, see DETECT_CONTENT_CHAIN_PURE.
+ *
+ *  Walks each list from the tail, so the result is known for the rest
+ *  of the list when a content is reached.
+ */
+void DetectEngineContentInspectionPrepare(Signature *s)
+{
+    int list;
+
+    for (list = 0; list < DETECT_SM_LIST_MAX; list++) {
+        /* the decoded buffer changes as the parent list backtracks */
+        if (list == DETECT_SM_LIST_BASE64_DATA)
+            continue;
+
+        int pure = 1;
+        SigMatch *sm = s->sm_lists_tail[list];
+        for ( ; sm != NULL; sm = sm->prev) {
+            if (sm->type == DETECT_CONTENT) {
+                DetectContentData *cd = (DetectContentData *)sm->ctx;
+                if (cd->flags & (DETECT_CONTENT_REPLACE|DETECT_CONTENT_OFFSET_BE|
+                            DETECT_CONTENT_DEPTH_BE|DETECT_CONTENT_DISTANCE_BE|
+                            DETECT_CONTENT_WITHIN_BE))
+                    pure = 0;
+                if (pure)
+                    cd->flags |= DETECT_CONTENT_CHAIN_PURE;
+                else
+                    cd->flags &= ~DETECT_CONTENT_CHAIN_PURE;
+            } else if (sm->type == DETECT_ISDATAAT) {
+                DetectIsdataatData *id = (DetectIsdataatData *)sm->ctx;
+                if (id->flags & ISDATAAT_OFFSET_BE)
+                    pure = 0;
+            } else if (sm->type != DETECT_AL_URILEN && sm->type != DETECT_DATASET) {
+                pure = 0;
+            }
+        }
+    }
+}
+
+static inline uint32_t InspectionMemoHash(const SigMatch *sm, uint32_t offset)
+{
+    return (((uint32_t)(uintptr_t)sm >> 4) ^ (offset * 2654435761U)) &
+        (DETECT_INSPECTION_MEMO_SIZE - 1);
+}
+
 /**
  * \brief Run the actual payload match functions
  *
@@ -70,6 +116,7 @@
  * - bytetest
  * - byte_extract
  * - urilen
+ * - dataset
  * -
  *
  * All keywords are evaluated against the buffer with buffer_len.
@@ -107,11 +154,26 @@ int DetectEngineContentInspection(DetectEngineCtx *de_ctx, DetectEngineThreadCtx
 {
     SCEnter();
     KEYWORD_PROFILING_START;
+    /* memo slot of this call, if a failure can be remembered */
+    uint32_t memo_slot = DETECT_INSPECTION_MEMO_SIZE;
+    uint32_t memo_offset = det_ctx->buffer_offset;
 
     det_ctx->inspection_recursion_counter++;
 
+    /* callers reset the counter for each buffer, so the memo starts over */
+    if (det_ctx->inspection_recursion_counter == 1) {
+        det_ctx->inspection_memo_gen++;
+        if (unlikely(det_ctx->inspection_memo_gen == 0)) {
+            memset(det_ctx->inspection_memo, 0, sizeof(det_ctx->inspection_memo));
+            det_ctx->inspection_memo_gen = 1;
+        }
+    }
+
     if (det_ctx->inspection_recursion_counter == de_ctx->inspection_recursion_limit) {
         det_ctx->discontinue_matching = 1;
+        if (det_ctx->counter_inspection_limit != 0 && det_ctx->tv != NULL)
+            StatsIncr(det_ctx->tv, det_ctx->counter_inspection_limit);
+        SCLogDebug("sid %"PRIu32" hit the inspection recursion limit", s->id);
         KEYWORD_PROFILING_END(det_ctx, sm->type, 0);
         SCReturnInt(0);
     }
@@ -121,6 +183,21 @@ int DetectEngineContentInspection(DetectEngineCtx *de_ctx, DetectEngineThreadCtx
         SCReturnInt(0);
     }
 
+    /* a relative content we've already failed at this offset with the
+     * same buffer will fail again. */
+    if (sm->type == DETECT_CONTENT && det_ctx->inspection_recursion_counter > 1 &&
+        (((DetectContentData *)sm->ctx)->flags & DETECT_CONTENT_CHAIN_PURE))
+    {
+        memo_slot = InspectionMemoHash(sm, memo_offset);
+        if (det_ctx->inspection_memo[memo_slot].gen == det_ctx->inspection_memo_gen &&
+            det_ctx->inspection_memo[memo_slot].sm == sm &&
+            det_ctx->inspection_memo[memo_slot].offset == memo_offset)
+        {
+            KEYWORD_PROFILING_END(det_ctx, sm->type, 0);
+            SCReturnInt(0);
+        }
+    }
+
     /* \todo unify this which is phase 2 of payload inspection unification */
     if (sm->type == DETECT_CONTENT) {
 
@@ -531,6 +608,12 @@ int DetectEngineContentInspection(DetectEngineCtx *de_ctx, DetectEngineThreadCtx
 
         det_ctx->discontinue_matching = 0;
 
+        goto no_match;
+    } else if (sm->type == DETECT_DATASET) {
+        if (DetectDatasetBufferMatch(det_ctx, (const DetectDatasetData *)sm->ctx,
+                    buffer, buffer_len) == 1) {
+            goto match;
+        }
         goto no_match;
 #ifdef HAVE_LUA
     }
@@ -564,6 +647,11 @@ int DetectEngineContentInspection(DetectEngineCtx *de_ctx, DetectEngineThreadCtx
     }
 
 no_match:
+    if (memo_slot != DETECT_INSPECTION_MEMO_SIZE && !det_ctx->discontinue_matching) {
+        det_ctx->inspection_memo[memo_slot].sm = sm;
+        det_ctx->inspection_memo[memo_slot].offset = memo_offset;
+        det_ctx->inspection_memo[memo_slot].gen = det_ctx->inspection_memo_gen;
+    }
     KEYWORD_PROFILING_END(det_ctx, sm->type, 0);
     SCReturnInt(0);
 
@@ -55,6 +55,8 @@ enum {
     DETECT_ENGINE_CONTENT_INSPECTION_MODE_TEMPLATE_BUFFER,
 };
 
+void DetectEngineContentInspectionPrepare(Signature *s);
+
 int DetectEngineContentInspection(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx,
                                   Signature *s, SigMatch *sm,
                                   Flow *f,
@@ -76,24 +76,40 @@ static inline int SMTPCreateSpace(DetectEngineThreadCtx *det_ctx, uint16_t size)
     for (int i = det_ctx->smtp_buffers_list_len; i < (size); i++) {
         det_ctx->smtp[i].buffer_len = 0;
         det_ctx->smtp[i].offset = 0;
+        det_ctx->smtp[i].mpm_skip = 0;
     }
 
     return 0;
 }
 
+/**
+ *  \brief get the filedata buffer of a tx
+ *
+ *  Only the data after File::content_inspected is new. The buffer starts
+ *  a window before that, like the http body inspection, so that content
+ *  inspection can match across the boundary. The mpm has seen most of
+ *  that window already: it only has to start the longest pattern minus
+ *  one byte before the new data, see mpm_skip.
+ *
+ *  \param mpm_skip[out] bytes at the start of the buffer the mpm can
+ *         skip, may be NULL
+ */
 static const uint8_t *DetectEngineSMTPGetBufferForTX(uint64_t tx_id,
                                                DetectEngineCtx *de_ctx,
                                                DetectEngineThreadCtx *det_ctx,
                                                Flow *f, File *curr_file,
                                                uint8_t flags,
                                                uint32_t *buffer_len,
-                                               uint32_t *stream_start_offset)
+                                               uint32_t *stream_start_offset,
+                                               uint32_t *mpm_skip)
 {
     SCEnter();
     int index = 0;
     const uint8_t *buffer = NULL;
     *buffer_len = 0;
     *stream_start_offset = 0;
+    if (mpm_skip != NULL)
+        *mpm_skip = 0;
     uint64_t file_size = FileSize(curr_file);
 
     if (det_ctx->smtp_buffers_list_len == 0) {
@@ -111,6 +127,8 @@ static const uint8_t *DetectEngineSMTPGetBufferForTX(uint64_t tx_id,
                 *buffer_len = det_ctx->smtp[(tx_id - det_ctx->smtp_start_tx_id)].buffer_len;
                 *stream_start_offset = det_ctx->smtp[(tx_id - det_ctx->smtp_start_tx_id)].offset;
                 buffer = det_ctx->smtp[(tx_id - det_ctx->smtp_start_tx_id)].buffer;
+                if (mpm_skip != NULL)
+                    *mpm_skip = det_ctx->smtp[(tx_id - det_ctx->smtp_start_tx_id)].mpm_skip;
 
                 SCReturnPtr(buffer, "uint8_t");
             }
@@ -151,20 +169,62 @@ static const uint8_t *DetectEngineSMTPGetBufferForTX(uint64_t tx_id,
         goto end;
     }
 
+    /* get the inspect buffer
+     *
+     * make sure that we have at least the configured inspect_win size.
+     * If we have more, take at least 1/4 of the inspect win size before
+     * the new data.
+     */
+    uint64_t inspected = curr_file->content_inspected;
+    uint64_t offset = 0;
+    if (inspected > smtp_config.content_inspect_min_size) {
+        uint64_t inspect_win = file_size - inspected;
+        if (inspect_win < smtp_config.content_inspect_window) {
+            uint64_t inspect_short = smtp_config.content_inspect_window - inspect_win;
+            if (inspected < inspect_short)
+                offset = 0;
+            else
+                offset = inspected - inspect_short;
+        } else {
+            offset = inspected - (smtp_config.content_inspect_window / 4);
+        }
+    }
+    /* SMTPPruneFiles may have moved the tracker and the data before it
+     * may be gone */
+    if (offset < curr_file->sb->stream_offset)
+        offset = curr_file->sb->stream_offset;
+    if (inspected < offset)
+        inspected = offset;
+
+    /* a match ending in the new data starts at most maxlen - 1 bytes
+     * before it */
+    uint64_t mpm_offset = inspected;
+    const MpmCtx *mpm_ctx = (det_ctx->sgh != NULL) ?
+        det_ctx->sgh->mpm_smtp_filedata_ctx_ts : NULL;
+    if (mpm_ctx != NULL && mpm_ctx->maxlen > 1) {
+        uint32_t overlap = mpm_ctx->maxlen - 1;
+        mpm_offset = (mpm_offset - offset > overlap) ? mpm_offset - overlap : offset;
+    }
+
     StreamingBufferGetDataAtOffset(curr_file->sb,
             &det_ctx->smtp[index].buffer, &det_ctx->smtp[index].buffer_len,
-            curr_file->content_inspected);
+            offset);
 
-    det_ctx->smtp[index].offset = curr_file->content_inspected;
+    det_ctx->smtp[index].offset = offset;
+    det_ctx->smtp[index].mpm_skip = (uint32_t)(mpm_offset - offset);
 
     /* updat inspected tracker */
     curr_file->content_inspected = FileSize(curr_file);
 
-    SCLogDebug("content_inspected %u, offset %u", (uint)curr_file->content_inspected, (uint)det_ctx->smtp[index].offset);
+    SCLogDebug("content_inspected %u, offset %u, mpm_skip %u",
+            (uint)curr_file->content_inspected, (uint)det_ctx->smtp[index].offset,
+            det_ctx->smtp[index].mpm_skip);
 
     buffer = det_ctx->smtp[index].buffer;
     *buffer_len = det_ctx->smtp[index].buffer_len;
     *stream_start_offset = det_ctx->smtp[index].offset;
+    if (mpm_skip != NULL)
+        *mpm_skip = det_ctx->smtp[index].mpm_skip;
 
 end:
     SCLogDebug("buffer %p, len %u", buffer, *buffer_len);
@@ -194,7 +254,8 @@ int DetectEngineInspectSMTPFiledata(ThreadVars *tv,
                                                     f, file,
                                                     flags,
                                                     &buffer_len,
-                                                    &stream_start_offset);
+                                                    &stream_start_offset,
+                                                    NULL);
         if (buffer_len == 0)
             goto end;
 
@@ -225,6 +286,7 @@ void DetectEngineCleanSMTPBuffers(DetectEngineThreadCtx *det_ctx)
         for (int i = 0; i < det_ctx->smtp_buffers_list_len; i++) {
             det_ctx->smtp[i].buffer_len = 0;
             det_ctx->smtp[i].offset = 0;
+            det_ctx->smtp[i].mpm_skip = 0;
         }
     }
     det_ctx->smtp_buffers_list_len = 0;
@@ -272,6 +334,7 @@ int DetectEngineRunSMTPMpm(DetectEngineCtx *de_ctx,
     uint32_t cnt = 0;
     uint32_t buffer_len = 0;
     uint32_t stream_start_offset = 0;
+    uint32_t mpm_skip = 0;
     const uint8_t *buffer = NULL;
 
     if (ffc != NULL) {
@@ -282,11 +345,16 @@ int DetectEngineRunSMTPMpm(DetectEngineCtx *de_ctx,
                                                     f, file,
                                                     flags,
                                                     &buffer_len,
-                                                    &stream_start_offset);
+                                                    &stream_start_offset,
+                                                    &mpm_skip);
             if (buffer_len == 0)
                 goto end;
 
-            cnt += SMTPFiledataPatternSearch(det_ctx, (uint8_t *)buffer, buffer_len, flags);
+            /* only the new data and the overlap with what was seen */
+            if (mpm_skip < buffer_len) {
+                cnt += SMTPFiledataPatternSearch(det_ctx, buffer + mpm_skip,
+                                                 buffer_len - mpm_skip, flags);
+            }
         }
     }
 end:
@@ -550,6 +618,63 @@ end:
     return result == 0;
 }
 
+/** \test the buffer starts a window before the new data, the mpm only
+ *        the longest pattern before it */
+static int DetectEngineSMTPFiledataTest04(void)
+{
+    DetectEngineThreadCtx det_ctx;
+    SigGroupHead sgh;
+    MpmCtx mpm_ctx;
+    StreamingBufferConfig sbcfg = STREAMING_BUFFER_CONFIG_INITIALIZER;
+    uint8_t data[64];
+    uint32_t buffer_len = 0, stream_start_offset = 0, mpm_skip = 0;
+    const uint8_t *buffer;
+
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    memset(&sgh, 0, sizeof(sgh));
+    memset(&mpm_ctx, 0, sizeof(mpm_ctx));
+    memset(data, 'a', sizeof(data));
+    mpm_ctx.maxlen = 8;
+    sgh.mpm_smtp_filedata_ctx_ts = &mpm_ctx;
+    det_ctx.sgh = &sgh;
+
+    SMTPConfig saved = smtp_config;
+    smtp_config.content_limit = 0;
+    smtp_config.content_inspect_min_size = 4;
+    smtp_config.content_inspect_window = 64;
+
+    FileContainer *ffc = FileContainerAlloc();
+    FAIL_IF_NULL(ffc);
+    File *file = FileOpenFile(ffc, &sbcfg, (const uint8_t *)"f", 1,
+                              data, sizeof(data), FILE_USE_DETECT);
+    FAIL_IF_NULL(file);
+
+    buffer = DetectEngineSMTPGetBufferForTX(0, NULL, &det_ctx, NULL, file,
+            STREAM_TOSERVER|STREAM_EOF, &buffer_len, &stream_start_offset,
+            &mpm_skip);
+    FAIL_IF_NULL(buffer);
+    FAIL_IF(buffer_len != 64);
+    FAIL_IF(stream_start_offset != 0);
+    FAIL_IF(mpm_skip != 0);
+    DetectEngineCleanSMTPBuffers(&det_ctx);
+
+    FAIL_IF(FileAppendData(ffc, data, sizeof(data)) != 0);
+    buffer = DetectEngineSMTPGetBufferForTX(0, NULL, &det_ctx, NULL, file,
+            STREAM_TOSERVER|STREAM_EOF, &buffer_len, &stream_start_offset,
+            &mpm_skip);
+    FAIL_IF_NULL(buffer);
+    /* a quarter of the window before the new data */
+    FAIL_IF(stream_start_offset != 48);
+    FAIL_IF(buffer_len != 80);
+    /* maxlen - 1 before the new data */
+    FAIL_IF(mpm_skip != 64 - 7 - 48);
+
+    smtp_config = saved;
+    SCFree(det_ctx.smtp);
+    FileContainerFree(ffc);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DetectEngineSMTPFiledataRegisterTests(void)
@@ -561,6 +686,8 @@ void DetectEngineSMTPFiledataRegisterTests(void)
                    DetectEngineSMTPFiledataTest02);
     UtRegisterTest("DetectEngineSMTPFiledataTest03",
                    DetectEngineSMTPFiledataTest03);
+    UtRegisterTest("DetectEngineSMTPFiledataTest04",
+                   DetectEngineSMTPFiledataTest04);
     #endif /* UNITTESTS */
 
     return;
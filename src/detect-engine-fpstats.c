@@ -0,0 +1,426 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Fast pattern statistics.
+ *
+ * In training mode the detect threads count the (lower cased) byte pairs
+ * in a sample of the packet payloads. The counts are merged and written to
+ * a file when the threads shut down. At start up the file is loaded and
+ * the counts are turned into the number of bits a pattern is expected to
+ * take to show up in traffic, using the pairs as a first order Markov
+ * model. The fast pattern selection then picks the content with the
+ * highest score, instead of the longest one.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-mpm.h"
+#include "detect-content.h"
+#include "detect-engine-fpstats.h"
+
+#define FP_STATS_MAGIC          "SCFP"
+#define FP_STATS_VERSION        1
+/* below this many samples the stats are not trusted */
+#define FP_STATS_MIN_SAMPLES    100000
+#define FP_STATS_SAMPLE_RATE    100
+
+typedef struct FpStatsFileHeader_ {
+    char magic[4];
+    uint32_t version;
+    uint64_t total;
+} FpStatsFileHeader;
+
+static const char *fp_stats_file = NULL;
+static int fp_stats_train = 0;
+static uint32_t fp_stats_sample_rate = FP_STATS_SAMPLE_RATE;
+
+/* training: counts of all threads, protected by fp_stats_lock */
+static uint64_t *fp_stats_counts = NULL;
+static SCMutex fp_stats_lock = SCMUTEX_INITIALIZER;
+
+/* scores in 1/16th bits: -log2(P(b|a)) for the pair ab and -log2(P(a)) for
+ * the first byte of a pattern. Read only after setup. */
+static int fp_stats_loaded = 0;
+static uint16_t *fp_stats_pair_score = NULL;
+static uint16_t fp_stats_byte_score[256];
+
+/** \internal
+ *  \brief log2(x) in 1/16ths, with a linear approximation of the fraction
+ *  \param x > 0 */
+static uint32_t FpStatsLog2(uint64_t x)
+{
+    uint32_t msb = 63 - __builtin_clzll(x);
+    uint32_t frac;
+    if (msb >= 4)
+        frac = (uint32_t)(x >> (msb - 4)) & 0xf;
+    else
+        frac = (uint32_t)(x << (4 - msb)) & 0xf;
+    return msb * 16 + frac;
+}
+
+static uint16_t FpStatsBits(uint64_t num, uint64_t den)
+{
+    uint32_t bits = FpStatsLog2(den) - FpStatsLog2(num);
+    return (uint16_t)MIN(bits, UINT16_MAX);
+}
+
+/** \internal
+ *  \brief turn pair counts into scores, with add one smoothing so that
+ *         unseen pairs get a high but finite score
+ *  \retval 0 ok, -1 error */
+static int FpStatsBuildScores(const uint64_t *counts)
+{
+    uint64_t row[256];
+    uint64_t total = 0;
+    uint32_t a, b;
+
+    memset(row, 0, sizeof(row));
+    for (a = 0; a < 256; a++) {
+        for (b = 0; b < 256; b++)
+            row[a] += counts[a << 8 | b];
+        total += row[a];
+    }
+
+    if (fp_stats_pair_score == NULL) {
+        fp_stats_pair_score = SCMalloc(FP_STATS_PAIRS * sizeof(uint16_t));
+        if (fp_stats_pair_score == NULL)
+            return -1;
+    }
+
+    for (a = 0; a < 256; a++) {
+        fp_stats_byte_score[a] = FpStatsBits(row[a] + 1, total + 256);
+        for (b = 0; b < 256; b++) {
+            fp_stats_pair_score[a << 8 | b] =
+                FpStatsBits(counts[a << 8 | b] + 1, row[a] + 256);
+        }
+    }
+    fp_stats_loaded = 1;
+    return 0;
+}
+
+/** \internal
+ *  \brief load counts from a stats file
+ *  \retval total number of pairs in the file, 0 on errors */
+static uint64_t FpStatsLoad(const char *path, uint64_t *counts)
+{
+    FpStatsFileHeader hdr;
+    uint64_t total = 0;
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        SCLogDebug("no fast pattern stats at %s", path);
+        return 0;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, FP_STATS_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != FP_STATS_VERSION ||
+        fread(counts, sizeof(uint64_t), FP_STATS_PAIRS, fp) != FP_STATS_PAIRS)
+    {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "ignoring invalid fast pattern "
+                     "stats file %s", path);
+        memset(counts, 0, FP_STATS_PAIRS * sizeof(uint64_t));
+    } else {
+        total = hdr.total;
+    }
+    fclose(fp);
+    return total;
+}
+
+/** \internal
+ *  \brief write the counts, through a temporary file */
+static void FpStatsSave(const char *path, const uint64_t *counts)
+{
+    char tmp_path[PATH_MAX];
+    FpStatsFileHeader hdr;
+    uint32_t i;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FP_STATS_MAGIC, sizeof(hdr.magic));
+    hdr.version = FP_STATS_VERSION;
+    for (i = 0; i < FP_STATS_PAIRS; i++)
+        hdr.total += counts[i];
+
+    int r = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (r < 0 || (size_t)r >= sizeof(tmp_path))
+        return;
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to open fast pattern stats file "
+                     "%s: %s", tmp_path, strerror(errno));
+        return;
+    }
+    int ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              fwrite(counts, sizeof(uint64_t), FP_STATS_PAIRS, fp) == FP_STATS_PAIRS);
+    if (fclose(fp) != 0 || !ok || rename(tmp_path, path) != 0) {
+        SCLogWarning(SC_ERR_FWRITE, "failed to write fast pattern stats file "
+                     "%s", path);
+        unlink(tmp_path);
+        return;
+    }
+    SCLogInfo("fast pattern stats: %"PRIu64" byte pairs written to %s",
+              hdr.total, path);
+}
+
+/**
+ * \brief read the detect.fast-pattern-stats config and load the stats
+ */
+void FpStatsSetup(void)
+{
+    ConfNode *node = ConfGetNode("detect.fast-pattern-stats");
+    if (node == NULL)
+        return;
+
+    fp_stats_file = ConfNodeLookupChildValue(node, "file");
+    if (fp_stats_file == NULL || strlen(fp_stats_file) == 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "detect.fast-pattern-stats "
+                     "needs a file, not using fast pattern stats");
+        fp_stats_file = NULL;
+        return;
+    }
+    fp_stats_train = ConfNodeChildValueIsTrue(node, "train");
+
+    const char *rate = ConfNodeLookupChildValue(node, "sample-rate");
+    if (rate != NULL) {
+        int r = atoi(rate);
+        if (r < 1) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid fast-pattern-stats "
+                         "sample-rate %s, using %u", rate, FP_STATS_SAMPLE_RATE);
+        } else {
+            fp_stats_sample_rate = (uint32_t)r;
+        }
+    }
+
+    uint64_t *counts = SCCalloc(FP_STATS_PAIRS, sizeof(uint64_t));
+    if (counts == NULL)
+        return;
+
+    uint64_t total = FpStatsLoad(fp_stats_file, counts);
+    if (total >= FP_STATS_MIN_SAMPLES) {
+        if (FpStatsBuildScores(counts) == 0) {
+            SCLogConfig("fast pattern selection using stats of %"PRIu64
+                        " byte pairs from %s", total, fp_stats_file);
+        }
+    } else if (total > 0) {
+        SCLogConfig("only %"PRIu64" byte pairs in %s, not using them for "
+                    "fast pattern selection yet", total, fp_stats_file);
+    }
+
+    if (fp_stats_train) {
+        /* continue from what was there */
+        fp_stats_counts = counts;
+        SCLogConfig("fast pattern stats training: sampling 1 in %u packets "
+                    "into %s", fp_stats_sample_rate, fp_stats_file);
+    } else {
+        SCFree(counts);
+    }
+}
+
+void FpStatsFree(void)
+{
+    if (fp_stats_counts != NULL) {
+        SCFree(fp_stats_counts);
+        fp_stats_counts = NULL;
+    }
+    if (fp_stats_pair_score != NULL) {
+        SCFree(fp_stats_pair_score);
+        fp_stats_pair_score = NULL;
+    }
+    fp_stats_loaded = 0;
+    fp_stats_train = 0;
+}
+
+/** \retval 1 if fast pattern selection should use the stats */
+int FpStatsEnabled(void)
+{
+    return fp_stats_loaded;
+}
+
+/**
+ * \brief number of 1/16th bits the pattern is expected to take to show up,
+ *        higher is rarer
+ */
+uint32_t FpStatsPatternScore(const uint8_t *pat, uint16_t patlen)
+{
+    if (patlen == 0)
+        return 0;
+
+    uint8_t prev = u8_tolower(pat[0]);
+    uint32_t score = fp_stats_byte_score[prev];
+    uint16_t u;
+    for (u = 1; u < patlen; u++) {
+        uint8_t c = u8_tolower(pat[u]);
+        score += fp_stats_pair_score[prev << 8 | c];
+        prev = c;
+    }
+    return score;
+}
+
+/** \retval ctx thread ctx if training, NULL otherwise */
+FpStatsThreadCtx *FpStatsThreadInit(void)
+{
+    if (!fp_stats_train)
+        return NULL;
+
+    FpStatsThreadCtx *ctx = SCCalloc(1, sizeof(FpStatsThreadCtx));
+    if (ctx == NULL) {
+        SCLogWarning(SC_ERR_MEM_ALLOC, "no memory for fast pattern stats");
+    }
+    return ctx;
+}
+
+/** \brief merge a thread's counts into the stats file */
+void FpStatsThreadDeinit(FpStatsThreadCtx *ctx)
+{
+    if (ctx == NULL)
+        return;
+
+    SCMutexLock(&fp_stats_lock);
+    if (fp_stats_counts != NULL) {
+        uint64_t total = 0;
+        uint32_t i;
+        for (i = 0; i < FP_STATS_PAIRS; i++) {
+            fp_stats_counts[i] += ctx->counts[i];
+            total += ctx->counts[i];
+        }
+        if (total > 0 && fp_stats_file != NULL)
+            FpStatsSave(fp_stats_file, fp_stats_counts);
+    }
+    SCMutexUnlock(&fp_stats_lock);
+
+    SCFree(ctx);
+}
+
+/** \brief count the byte pairs of 1 in sample-rate buffers */
+void FpStatsSample(FpStatsThreadCtx *ctx, const uint8_t *buf, uint32_t buflen)
+{
+    if (++ctx->pkts < fp_stats_sample_rate)
+        return;
+    ctx->pkts = 0;
+
+    if (buflen < 2)
+        return;
+
+    uint8_t prev = u8_tolower(buf[0]);
+    uint32_t u;
+    for (u = 1; u < buflen; u++) {
+        uint8_t c = u8_tolower(buf[u]);
+        ctx->counts[prev << 8 | c]++;
+        prev = c;
+    }
+}
+
+#ifdef UNITTESTS
+
+static FpStatsThreadCtx *FpStatsTestTrain(void)
+{
+    static const char *traffic[] = {
+        "GET /index.html HTTP/1.1\r\nHost: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0\r\nAccept: */*\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n"
+        "Content-Length: 1234\r\n\r\n<html><body>hello</body></html>",
+    };
+
+    FpStatsThreadCtx *ctx = SCCalloc(1, sizeof(FpStatsThreadCtx));
+    if (ctx == NULL)
+        return NULL;
+
+    uint32_t old_rate = fp_stats_sample_rate;
+    fp_stats_sample_rate = 1;
+    int i;
+    for (i = 0; i < 1000; i++) {
+        const char *t = traffic[i % 2];
+        FpStatsSample(ctx, (const uint8_t *)t, strlen(t));
+    }
+    fp_stats_sample_rate = old_rate;
+    return ctx;
+}
+
+/** \test common strings score lower than rare ones of the same length */
+static int FpStatsTest01(void)
+{
+    FpStatsThreadCtx *ctx = FpStatsTestTrain();
+    FAIL_IF_NULL(ctx);
+    FAIL_IF(ctx->counts['h' << 8 | 't'] == 0);
+
+    FAIL_IF(FpStatsBuildScores(ctx->counts) != 0);
+    FAIL_IF_NOT(FpStatsEnabled());
+
+    uint32_t common = FpStatsPatternScore((const uint8_t *)"Host", 4);
+    uint32_t rare = FpStatsPatternScore((const uint8_t *)"\x90\x90zq", 4);
+    FAIL_IF_NOT(common < rare);
+    /* case doesn't matter */
+    FAIL_IF(common != FpStatsPatternScore((const uint8_t *)"hOST", 4));
+    /* longer is rarer */
+    FAIL_IF_NOT(FpStatsPatternScore((const uint8_t *)"Host:", 5) > common);
+
+    SCFree(ctx);
+    FpStatsFree();
+    PASS;
+}
+
+/** \test a short rare content is picked over a long common one */
+static int FpStatsTest02(void)
+{
+    FpStatsThreadCtx *ctx = FpStatsTestTrain();
+    FAIL_IF_NULL(ctx);
+    FAIL_IF(FpStatsBuildScores(ctx->counts) != 0);
+    SCFree(ctx);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = SigInit(de_ctx, "alert tcp any any -> any any "
+            "(content:\"HTTP/1.1\"; content:\"x0R\"; sid:1;)");
+    FAIL_IF_NULL(s);
+    s->mpm_sm = NULL;
+    RetrieveFPForSig(s);
+    FAIL_IF_NULL(s->mpm_sm);
+    FAIL_IF(((DetectContentData *)s->mpm_sm->ctx)->content_len != 3);
+
+    /* without stats the longest content wins */
+    FpStatsFree();
+    s->mpm_sm = NULL;
+    RetrieveFPForSig(s);
+    FAIL_IF_NULL(s->mpm_sm);
+    FAIL_IF(((DetectContentData *)s->mpm_sm->ctx)->content_len != 8);
+
+    SigFree(s);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void FpStatsRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FpStatsTest01", FpStatsTest01);
+    UtRegisterTest("FpStatsTest02", FpStatsTest02);
+#endif
+}
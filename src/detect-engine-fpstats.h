@@ -0,0 +1,49 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Byte pair statistics of observed traffic, used to pick the fast
+ * pattern of a rule that is least likely to match.
+ */
+
+#ifndef __DETECT_ENGINE_FPSTATS_H__
+#define __DETECT_ENGINE_FPSTATS_H__
+
+/* number of (lower cased) byte pairs */
+#define FP_STATS_PAIRS 65536
+
+typedef struct FpStatsThreadCtx_ {
+    /* packets seen, to sample 1 in sample_rate */
+    uint32_t pkts;
+    uint64_t counts[FP_STATS_PAIRS];
+} FpStatsThreadCtx;
+
+void FpStatsSetup(void);
+void FpStatsFree(void);
+
+int FpStatsEnabled(void);
+uint32_t FpStatsPatternScore(const uint8_t *pat, uint16_t patlen);
+
+FpStatsThreadCtx *FpStatsThreadInit(void);
+void FpStatsThreadDeinit(FpStatsThreadCtx *ctx);
+void FpStatsSample(FpStatsThreadCtx *ctx, const uint8_t *buf, uint32_t buflen);
+
+void FpStatsRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_FPSTATS_H__ */
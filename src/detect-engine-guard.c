@@ -0,0 +1,256 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+/**
+ * \file
+ *
+ * Rule guard, see detect-engine-guard.h
+ *
+ * The rules of 1 in sample-rate packets are timed. After min-checks timed
+ * checks of a rule, its average is compared to the budget and the window
+ * starts over. A rule over budget is skipped by the thread for cooldown
+ * seconds of packet time, then timed again like any other rule.
+ *
+ * Each thread keeps its own table and judges the rules on the traffic it
+ * sees, so no locking is needed.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-guard.h"
+
+#define RULE_GUARD_SAMPLE_RATE  100
+#define RULE_GUARD_BUDGET       1000000
+#define RULE_GUARD_MIN_CHECKS   100
+#define RULE_GUARD_COOLDOWN     300
+
+static int rule_guard_enabled = 0;
+static uint32_t rule_guard_sample_rate = RULE_GUARD_SAMPLE_RATE;
+static uint64_t rule_guard_budget = RULE_GUARD_BUDGET;
+static uint32_t rule_guard_min_checks = RULE_GUARD_MIN_CHECKS;
+static uint32_t rule_guard_cooldown = RULE_GUARD_COOLDOWN;
+
+/** \internal
+ *  \brief get a positive integer 'name' from 'node' into 'value', or
+ *         leave it at its default */
+static void RuleGuardGetValue(ConfNode *node, const char *name, uint64_t max,
+        uint64_t *value)
+{
+    intmax_t v;
+    if (ConfGetChildValueInt(node, name, &v) != 1)
+        return;
+    if (v < 1 || (uint64_t)v > max) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid detect.rule-guard.%s "
+                     "%"PRIdMAX", using %"PRIu64, name, v, *value);
+        return;
+    }
+    *value = (uint64_t)v;
+}
+
+/**
+ * \brief read the detect.rule-guard config
+ */
+void RuleGuardSetup(void)
+{
+    ConfNode *node = ConfGetNode("detect.rule-guard");
+    if (node == NULL || !ConfNodeChildValueIsTrue(node, "enabled"))
+        return;
+
+    uint64_t rate = rule_guard_sample_rate;
+    uint64_t checks = rule_guard_min_checks;
+    uint64_t cooldown = rule_guard_cooldown;
+    RuleGuardGetValue(node, "sample-rate", UINT32_MAX, &rate);
+    RuleGuardGetValue(node, "budget", UINT64_MAX, &rule_guard_budget);
+    RuleGuardGetValue(node, "min-checks", UINT32_MAX, &checks);
+    RuleGuardGetValue(node, "cooldown", UINT32_MAX, &cooldown);
+    rule_guard_sample_rate = (uint32_t)rate;
+    rule_guard_min_checks = (uint32_t)checks;
+    rule_guard_cooldown = (uint32_t)cooldown;
+
+    rule_guard_enabled = 1;
+    SCLogConfig("rule guard: rules over %"PRIu64" ticks per check are "
+                "disabled for %us, timing 1 in %u packets",
+                rule_guard_budget, rule_guard_cooldown, rule_guard_sample_rate);
+}
+
+int RuleGuardEnabled(void)
+{
+    return rule_guard_enabled;
+}
+
+RuleGuardThreadCtx *RuleGuardThreadInit(const DetectEngineCtx *de_ctx)
+{
+    if (!rule_guard_enabled || de_ctx->sig_array_len == 0)
+        return NULL;
+
+    RuleGuardThreadCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (unlikely(ctx == NULL))
+        return NULL;
+    ctx->sigs = SCCalloc(de_ctx->sig_array_len, sizeof(RuleGuardSig));
+    if (unlikely(ctx->sigs == NULL)) {
+        SCFree(ctx);
+        return NULL;
+    }
+    ctx->nsigs = de_ctx->sig_array_len;
+    return ctx;
+}
+
+void RuleGuardThreadDeinit(RuleGuardThreadCtx *ctx)
+{
+    if (ctx == NULL)
+        return;
+    SCFree(ctx->sigs);
+    SCFree(ctx);
+}
+
+/** \retval 1 if it's the turn of this packet to be timed */
+int RuleGuardSample(RuleGuardThreadCtx *ctx)
+{
+    if (++ctx->pkts < rule_guard_sample_rate)
+        return 0;
+    ctx->pkts = 0;
+    return 1;
+}
+
+/**
+ * \brief check if 's' is disabled, and enable it again if its cooldown
+ *        is over
+ *
+ * \param ts packet time in seconds
+ *
+ * \retval 1 skip the rule
+ */
+int RuleGuardIsGuarded(DetectEngineThreadCtx *det_ctx, const Signature *s,
+        uint32_t ts)
+{
+    RuleGuardThreadCtx *ctx = det_ctx->rule_guard;
+    if (s->num >= ctx->nsigs)
+        return 0;
+
+    RuleGuardSig *g = &ctx->sigs[s->num];
+    if (g->until == 0)
+        return 0;
+    if (ts < g->until)
+        return 1;
+
+    g->until = 0;
+    ctx->guarded--;
+    SCLogInfo("rule guard: enabling rule %"PRIu32":%"PRIu32":%"PRIu32
+              " again", s->gid, s->id, s->rev);
+    return 0;
+}
+
+/**
+ * \brief add a timed check of 's', and disable it if it's over budget
+ */
+void RuleGuardUpdate(DetectEngineThreadCtx *det_ctx, const Signature *s,
+        uint64_t ticks, uint32_t ts)
+{
+    RuleGuardThreadCtx *ctx = det_ctx->rule_guard;
+    if (s->num >= ctx->nsigs)
+        return;
+
+    RuleGuardSig *g = &ctx->sigs[s->num];
+    if (g->until != 0)
+        return;
+
+    g->ticks += ticks;
+    if (++g->checks < rule_guard_min_checks)
+        return;
+
+    uint64_t avg = g->ticks / g->checks;
+    g->ticks = 0;
+    g->checks = 0;
+    if (avg <= rule_guard_budget)
+        return;
+
+    g->until = ts + rule_guard_cooldown;
+    ctx->guarded++;
+    if (det_ctx->counter_rule_guard != 0)
+        StatsIncr(det_ctx->tv, det_ctx->counter_rule_guard);
+
+    SCLogWarning(SC_WARN_POOR_RULE, "rule guard: rule %"PRIu32":%"PRIu32
+                 ":%"PRIu32" takes %"PRIu64" ticks per check, over the "
+                 "budget of %"PRIu64", disabling it for %us", s->gid, s->id,
+                 s->rev, avg, rule_guard_budget, rule_guard_cooldown);
+}
+
+#ifdef UNITTESTS
+static int RuleGuardTest01(void)
+{
+    DetectEngineThreadCtx det_ctx;
+    memset(&det_ctx, 0, sizeof(det_ctx));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    Signature *s = DetectEngineAppendSig(de_ctx,
+            "alert tcp any any -> any any (content:\"abc\"; sid:1;)");
+    FAIL_IF_NULL(s);
+    SigGroupBuild(de_ctx);
+
+    rule_guard_enabled = 1;
+    rule_guard_min_checks = 2;
+    rule_guard_budget = 100;
+    rule_guard_cooldown = 10;
+    rule_guard_sample_rate = 2;
+
+    det_ctx.rule_guard = RuleGuardThreadInit(de_ctx);
+    FAIL_IF_NULL(det_ctx.rule_guard);
+
+    FAIL_IF(RULE_GUARD_SAMPLE(&det_ctx));
+    FAIL_IF_NOT(RULE_GUARD_SAMPLE(&det_ctx));
+
+    /* on budget */
+    RuleGuardUpdate(&det_ctx, s, 100, 1000);
+    RuleGuardUpdate(&det_ctx, s, 100, 1000);
+    FAIL_IF(det_ctx.rule_guard->guarded != 0);
+
+    /* over budget on average, a single expensive check isn't enough */
+    RuleGuardUpdate(&det_ctx, s, 250, 1000);
+    FAIL_IF(det_ctx.rule_guard->guarded != 0);
+    RuleGuardUpdate(&det_ctx, s, 50, 1000);
+    FAIL_IF(det_ctx.rule_guard->guarded != 1);
+
+    FAIL_IF_NOT(RuleGuardIsGuarded(&det_ctx, s, 1009));
+    FAIL_IF(RuleGuardIsGuarded(&det_ctx, s, 1010));
+    FAIL_IF(det_ctx.rule_guard->guarded != 0);
+
+    RuleGuardThreadDeinit(det_ctx.rule_guard);
+    rule_guard_enabled = 0;
+    rule_guard_min_checks = RULE_GUARD_MIN_CHECKS;
+    rule_guard_budget = RULE_GUARD_BUDGET;
+    rule_guard_cooldown = RULE_GUARD_COOLDOWN;
+    rule_guard_sample_rate = RULE_GUARD_SAMPLE_RATE;
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void RuleGuardRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("RuleGuardTest01", RuleGuardTest01);
+#endif
+}
@@ -0,0 +1,72 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+/**
+ * \file
+ *
+ * Rule guard: rules that on average take more cpu than the configured
+ * budget are disabled for a while, by the detect thread that measured it.
+ */
+
+#ifndef __DETECT_ENGINE_GUARD_H__
+#define __DETECT_ENGINE_GUARD_H__
+
+typedef struct RuleGuardSig_ {
+    /** ticks and timed checks of the current window */
+    uint64_t ticks;
+    uint32_t checks;
+    /** packet time (sec) until the rule is disabled, 0 if it's not */
+    uint32_t until;
+} RuleGuardSig;
+
+typedef struct RuleGuardThreadCtx_ {
+    /** packets seen, to time 1 in sample_rate */
+    uint32_t pkts;
+    /** number of rules currently disabled */
+    uint32_t guarded;
+    /** rules by Signature::num */
+    uint32_t nsigs;
+    RuleGuardSig *sigs;
+} RuleGuardThreadCtx;
+
+void RuleGuardSetup(void);
+int RuleGuardEnabled(void);
+
+RuleGuardThreadCtx *RuleGuardThreadInit(const DetectEngineCtx *de_ctx);
+void RuleGuardThreadDeinit(RuleGuardThreadCtx *ctx);
+
+int RuleGuardSample(RuleGuardThreadCtx *ctx);
+int RuleGuardIsGuarded(DetectEngineThreadCtx *det_ctx, const Signature *s,
+        uint32_t ts);
+void RuleGuardUpdate(DetectEngineThreadCtx *det_ctx, const Signature *s,
+        uint64_t ticks, uint32_t ts);
+
+/** \brief should the rules of this packet be timed */
+#define RULE_GUARD_SAMPLE(det_ctx) \
+    (unlikely((det_ctx)->rule_guard != NULL) && \
+     RuleGuardSample((det_ctx)->rule_guard))
+
+/** \brief skip 's' as it's disabled by the guard */
+#define RULE_GUARD_SKIP(det_ctx, s, p) \
+    (unlikely((det_ctx)->rule_guard != NULL && \
+              (det_ctx)->rule_guard->guarded != 0) && \
+     RuleGuardIsGuarded((det_ctx), (s), (uint32_t)(p)->ts.tv_sec))
+
+void RuleGuardRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_GUARD_H__ */
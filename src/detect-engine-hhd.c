@@ -59,90 +59,22 @@
 #include "app-layer-protos.h"
 
 #include "util-validate.h"
+#include "app-layer-htp-mem.h"
 
-#define BUFFER_STEP 50
-
-static inline int HHDCreateSpace(DetectEngineThreadCtx *det_ctx, uint64_t size)
-{
-    if (size >= (USHRT_MAX - BUFFER_STEP))
-        return -1;
-
-    void *ptmp;
-    if (size > det_ctx->hhd_buffers_size) {
-        ptmp = SCRealloc(det_ctx->hhd_buffers,
-                         (det_ctx->hhd_buffers_size + BUFFER_STEP) * sizeof(uint8_t *));
-        if (ptmp == NULL) {
-            SCFree(det_ctx->hhd_buffers);
-            det_ctx->hhd_buffers = NULL;
-            det_ctx->hhd_buffers_size = 0;
-            det_ctx->hhd_buffers_list_len = 0;
-            return -1;
-        }
-        det_ctx->hhd_buffers = ptmp;
-
-        memset(det_ctx->hhd_buffers + det_ctx->hhd_buffers_size, 0, BUFFER_STEP * sizeof(uint8_t *));
-        ptmp = SCRealloc(det_ctx->hhd_buffers_len,
-                         (det_ctx->hhd_buffers_size + BUFFER_STEP) * sizeof(uint32_t));
-        if (ptmp == NULL) {
-            SCFree(det_ctx->hhd_buffers_len);
-            det_ctx->hhd_buffers_len = NULL;
-            det_ctx->hhd_buffers_size = 0;
-            det_ctx->hhd_buffers_list_len = 0;
-            return -1;
-        }
-        det_ctx->hhd_buffers_len = ptmp;
-
-        memset(det_ctx->hhd_buffers_len + det_ctx->hhd_buffers_size, 0, BUFFER_STEP * sizeof(uint32_t));
-        det_ctx->hhd_buffers_size += BUFFER_STEP;
-    }
-    memset(det_ctx->hhd_buffers_len + det_ctx->hhd_buffers_list_len, 0, (size - det_ctx->hhd_buffers_list_len) * sizeof(uint32_t));
-
-    return 0;
-}
-
-static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
-                                              DetectEngineCtx *de_ctx,
-                                              DetectEngineThreadCtx *det_ctx,
-                                              Flow *f, HtpState *htp_state,
-                                              uint8_t flags,
+/** \internal
+ *  \brief get the http_header buffer of a tx
+ *
+ *  The buffer is built once the headers are complete and then kept in
+ *  the tx user data, so that mpm and inspection on later packets reuse
+ *  it. Trailers of a chunked body can still add headers, in which case
+ *  the header count no longer matches and the buffer is rebuilt.
+ */
+static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint8_t flags,
                                               uint32_t *buffer_len)
 {
     uint8_t *headers_buffer = NULL;
-    int index = 0;
     *buffer_len = 0;
 
-    if (det_ctx->hhd_buffers_list_len == 0) {
-        /* get the inspect id to use as a 'base id' */
-        uint64_t base_inspect_id = AppLayerParserGetTransactionInspectId(f->alparser, flags);
-        BUG_ON(base_inspect_id > tx_id);
-        /* see how many space we need for the current tx_id */
-        uint64_t txs = (tx_id - base_inspect_id) + 1;
-        if (HHDCreateSpace(det_ctx, txs) < 0)
-            goto end;
-
-        index = (tx_id - base_inspect_id);
-        det_ctx->hhd_start_tx_id = base_inspect_id;
-        det_ctx->hhd_buffers_list_len = txs;
-    } else {
-        /* tx fits in our current buffers */
-        if ((tx_id - det_ctx->hhd_start_tx_id) < det_ctx->hhd_buffers_list_len) {
-            /* if we previously reassembled, return that buffer */
-            if (det_ctx->hhd_buffers_len[(tx_id - det_ctx->hhd_start_tx_id)] != 0) {
-                *buffer_len = det_ctx->hhd_buffers_len[(tx_id - det_ctx->hhd_start_tx_id)];
-                return det_ctx->hhd_buffers[(tx_id - det_ctx->hhd_start_tx_id)];
-            }
-            /* otherwise fall through */
-        } else {
-            /* not enough space, lets expand */
-            uint64_t txs = (tx_id - det_ctx->hhd_start_tx_id) + 1;
-            if (HHDCreateSpace(det_ctx, txs) < 0)
-                goto end;
-
-            det_ctx->hhd_buffers_list_len = txs;
-        }
-        index = (tx_id - det_ctx->hhd_start_tx_id);
-    }
-
     htp_table_t *headers;
     if (flags & STREAM_TOSERVER) {
         if (AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, flags) <= HTP_REQUEST_HEADERS)
@@ -156,13 +88,58 @@ static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
     if (headers == NULL)
         goto end;
 
+    /* reuse the stored buffer unless trailers were added since */
+    size_t no_of_headers = htp_table_size(headers);
+    HtpTxUserData *tx_ud = htp_tx_get_user_data(tx);
+    if (tx_ud != NULL) {
+        if (flags & STREAM_TOSERVER) {
+            if (tx_ud->request_hhd_buffer != NULL) {
+                if (tx_ud->request_hhd_headers == no_of_headers) {
+                    *buffer_len = tx_ud->request_hhd_buffer_len;
+                    return tx_ud->request_hhd_buffer;
+                }
+                HTPFree(tx_ud->request_hhd_buffer, tx_ud->request_hhd_buffer_size);
+                tx_ud->request_hhd_buffer = NULL;
+            }
+        } else {
+            if (tx_ud->response_hhd_buffer != NULL) {
+                if (tx_ud->response_hhd_headers == no_of_headers) {
+                    *buffer_len = tx_ud->response_hhd_buffer_len;
+                    return tx_ud->response_hhd_buffer;
+                }
+                HTPFree(tx_ud->response_hhd_buffer, tx_ud->response_hhd_buffer_size);
+                tx_ud->response_hhd_buffer = NULL;
+            }
+        }
+    }
+
     htp_header_t *h = NULL;
-    headers_buffer = det_ctx->hhd_buffers[index];
     size_t headers_buffer_len = 0;
+    size_t buffer_size = 0;
     size_t i = 0;
 
-    size_t no_of_headers = htp_table_size(headers);
-    for (; i < no_of_headers; i++) {
+    /* size the buffer first, so it takes a single allocation */
+    for (i = 0; i < no_of_headers; i++) {
+        h = htp_table_get_index(headers, i, NULL);
+        /* the extra 4 bytes if for ": " and "\r\n" */
+        buffer_size += bstr_size(h->name) + bstr_size(h->value) + 4;
+    }
+    if (buffer_size == 0)
+        goto end;
+
+    if (tx_ud == NULL) {
+        tx_ud = HTPMalloc(sizeof(*tx_ud));
+        if (unlikely(tx_ud == NULL))
+            goto end;
+        memset(tx_ud, 0, sizeof(*tx_ud));
+        htp_tx_set_user_data(tx, tx_ud);
+    }
+
+    headers_buffer = HTPMalloc(buffer_size);
+    if (unlikely(headers_buffer == NULL))
+        goto end;
+
+    for (i = 0; i < no_of_headers; i++) {
         h = htp_table_get_index(headers, i, NULL);
         size_t size1 = bstr_size(h->name);
         size_t size2 = bstr_size(h->value);
@@ -179,19 +156,6 @@ static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
             }
         }
 
-        /* the extra 4 bytes if for ": " and "\r\n" */
-        uint8_t *new_headers_buffer = SCRealloc(headers_buffer, headers_buffer_len + size1 + size2 + 4);
-        if (unlikely(new_headers_buffer == NULL)) {
-            if (headers_buffer != NULL) {
-                SCFree(headers_buffer);
-                headers_buffer = NULL;
-            }
-            det_ctx->hhd_buffers[index] = NULL;
-            det_ctx->hhd_buffers_len[index] = 0;
-            goto end;
-        }
-        headers_buffer = new_headers_buffer;
-
         memcpy(headers_buffer + headers_buffer_len, bstr_ptr(h->name), size1);
         headers_buffer_len += size1;
         headers_buffer[headers_buffer_len] = ':';
@@ -205,9 +169,19 @@ static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
         headers_buffer[headers_buffer_len - 1] = '\n';
     }
 
-    /* store the buffers.  We will need it for further inspection */
-    det_ctx->hhd_buffers[index] = headers_buffer;
-    det_ctx->hhd_buffers_len[index] = headers_buffer_len;
+    /* store the buffer in the tx, we will need it for further inspection.
+     * The allocated size is kept so it can be freed against the memcap. */
+    if (flags & STREAM_TOSERVER) {
+        tx_ud->request_hhd_buffer = headers_buffer;
+        tx_ud->request_hhd_buffer_len = headers_buffer_len;
+        tx_ud->request_hhd_buffer_size = buffer_size;
+        tx_ud->request_hhd_headers = no_of_headers;
+    } else {
+        tx_ud->response_hhd_buffer = headers_buffer;
+        tx_ud->response_hhd_buffer_len = headers_buffer_len;
+        tx_ud->response_hhd_buffer_size = buffer_size;
+        tx_ud->response_hhd_headers = no_of_headers;
+    }
 
     *buffer_len = (uint32_t)headers_buffer_len;
  end:
@@ -258,11 +232,7 @@ int DetectEngineRunHttpHeaderMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
 {
     uint32_t cnt = 0;
     uint32_t buffer_len = 0;
-    uint8_t *buffer = DetectEngineHHDGetBufferForTX(tx, idx,
-                                                    NULL, det_ctx,
-                                                    f, htp_state,
-                                                    flags,
-                                                    &buffer_len);
+    uint8_t *buffer = DetectEngineHHDGetBufferForTX(tx, flags, &buffer_len);
     if (buffer_len == 0)
         goto end;
 
@@ -279,13 +249,8 @@ int DetectEngineInspectHttpHeader(ThreadVars *tv,
                                   void *alstate,
                                   void *tx, uint64_t tx_id)
 {
-    HtpState *htp_state = (HtpState *)alstate;
     uint32_t buffer_len = 0;
-    uint8_t *buffer = DetectEngineHHDGetBufferForTX(tx, tx_id,
-                                                    de_ctx, det_ctx,
-                                                    f, htp_state,
-                                                    flags,
-                                                    &buffer_len);
+    uint8_t *buffer = DetectEngineHHDGetBufferForTX(tx, flags, &buffer_len);
     if (buffer_len == 0)
         goto end;
 
@@ -312,20 +277,6 @@ int DetectEngineInspectHttpHeader(ThreadVars *tv,
     return DETECT_ENGINE_INSPECT_SIG_NO_MATCH;
 }
 
-void DetectEngineCleanHHDBuffers(DetectEngineThreadCtx *det_ctx)
-{
-    if (det_ctx->hhd_buffers_list_len != 0) {
-        int i;
-        for (i = 0; i < det_ctx->hhd_buffers_list_len; i++) {
-            det_ctx->hhd_buffers_len[i] = 0;
-        }
-        det_ctx->hhd_buffers_list_len = 0;
-    }
-    det_ctx->hhd_start_tx_id = 0;
-
-    return;
-}
-
 /***********************************Unittests**********************************/
 
 #ifdef UNITTESTS
@@ -3859,6 +3810,60 @@ end:
     return result;
 }
 
+/**
+ * \test Test that the http_header buffer is kept in the tx and reused.
+ */
+static int DetectEngineHttpHeaderTest34(void)
+{
+    TcpSession ssn;
+    Flow f;
+    uint8_t http_buf[] =
+        "GET /index.html HTTP/1.0\r\n"
+        "Host: www.onetwothreefourfivesixseven.org\r\n\r\n";
+    uint32_t http_len = sizeof(http_buf) - 1;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+    f.alproto = ALPROTO_HTTP;
+
+    StreamTcpInitConfig(TRUE);
+
+    SCMutexLock(&f.m);
+    int r = AppLayerParserParse(alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER, http_buf, http_len);
+    SCMutexUnlock(&f.m);
+    FAIL_IF(r != 0);
+
+    HtpState *http_state = f.alstate;
+    FAIL_IF_NULL(http_state);
+    htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, http_state, 0);
+    FAIL_IF_NULL(tx);
+
+    uint32_t len1 = 0, len2 = 0;
+    uint8_t *buf1 = DetectEngineHHDGetBufferForTX(tx, STREAM_TOSERVER, &len1);
+    FAIL_IF_NULL(buf1);
+    FAIL_IF(len1 == 0);
+
+    HtpTxUserData *tx_ud = htp_tx_get_user_data(tx);
+    FAIL_IF_NULL(tx_ud);
+    FAIL_IF(tx_ud->request_hhd_buffer != buf1);
+
+    uint8_t *buf2 = DetectEngineHHDGetBufferForTX(tx, STREAM_TOSERVER, &len2);
+    FAIL_IF(buf2 != buf1);
+    FAIL_IF(len2 != len1);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DetectEngineHttpHeaderRegisterTests(void)
@@ -3935,6 +3940,8 @@ void DetectEngineHttpHeaderRegisterTests(void)
                    DetectEngineHttpHeaderTest32);
     UtRegisterTest("DetectEngineHttpHeaderTest33",
                    DetectEngineHttpHeaderTest33);
+    UtRegisterTest("DetectEngineHttpHeaderTest34",
+                   DetectEngineHttpHeaderTest34);
 
 #endif /* UNITTESTS */
 
@@ -958,6 +958,114 @@ int IPOnlyMatchCompatSMs(ThreadVars *tv,
     return 1;
 }
 
+/**
+ * \brief Check the non-address parts of an ip-only sig that matched on
+ *        address and alert or apply its actions
+ */
+static void IPOnlyMatchPacketSig(ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
+                                 Signature *s, Packet *p)
+{
+    if ((s->proto.flags & DETECT_PROTO_IPV4) && !PKT_IS_IPV4(p)) {
+        SCLogDebug("ip version didn't match");
+        return;
+    }
+    if ((s->proto.flags & DETECT_PROTO_IPV6) && !PKT_IS_IPV6(p)) {
+        SCLogDebug("ip version didn't match");
+        return;
+    }
+
+    if (DetectProtoContainsProto(&s->proto, IP_GET_IPPROTO(p)) == 0) {
+        SCLogDebug("proto didn't match");
+        return;
+    }
+
+    /* check the source & dst port in the sig */
+    if (p->proto == IPPROTO_TCP || p->proto == IPPROTO_UDP || p->proto == IPPROTO_SCTP) {
+        if (!(s->flags & SIG_FLAG_DP_ANY)) {
+            if (p->flags & PKT_IS_FRAGMENT)
+                return;
+
+            DetectPort *dport = DetectPortLookupGroup(s->dp,p->dp);
+            if (dport == NULL) {
+                SCLogDebug("dport didn't match.");
+                return;
+            }
+        }
+        if (!(s->flags & SIG_FLAG_SP_ANY)) {
+            if (p->flags & PKT_IS_FRAGMENT)
+                return;
+
+            DetectPort *sport = DetectPortLookupGroup(s->sp,p->sp);
+            if (sport == NULL) {
+                SCLogDebug("sport didn't match.");
+                return;
+            }
+        }
+    } else if ((s->flags & (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) != (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) {
+        SCLogDebug("port-less protocol and sig needs ports");
+        return;
+    }
+
+    if (!IPOnlyMatchCompatSMs(tv, det_ctx, s, p)) {
+        return;
+    }
+
+    SCLogDebug("Signum %"PRIu32" match (sid: %"PRIu32", msg: %s)",
+               s->num, s->id, s->msg);
+
+    if (s->sm_arrays[DETECT_SM_LIST_POSTMATCH] != NULL) {
+        KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_POSTMATCH);
+        SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_POSTMATCH];
+
+        SCLogDebug("running match functions, sm %p", smd);
+
+        if (smd != NULL) {
+            while (1) {
+                KEYWORD_PROFILING_START;
+                (void)sigmatch_table[smd->type].Match(tv, det_ctx, p, s, smd->ctx);
+                KEYWORD_PROFILING_END(det_ctx, smd->type, 1);
+                if (smd->is_last)
+                    break;
+                smd++;
+            }
+        }
+    }
+    if (!(s->flags & SIG_FLAG_NOALERT)) {
+        if (s->action & ACTION_DROP)
+            PacketAlertAppend(det_ctx, s, p, 0, PACKET_ALERT_FLAG_DROP_FLOW);
+        else
+            PacketAlertAppend(det_ctx, s, p, 0, 0);
+    } else {
+        /* apply actions for noalert/rule suppressed as well */
+        DetectSignatureApplyActions(p, s);
+    }
+}
+
+/**
+ * \brief AND the src and dst sig arrays in [start, end) and handle the
+ *        sigs that are in both
+ */
+static void IPOnlyMatchPacketRange(ThreadVars *tv, DetectEngineCtx *de_ctx,
+                                   DetectEngineThreadCtx *det_ctx,
+                                   const SigNumArray *src, const SigNumArray *dst,
+                                   Packet *p, uint32_t start, uint32_t end)
+{
+    uint32_t u;
+    for (u = start; u < end; u++) {
+        /* We have to move the logic of the signature checking
+         * to the main detect loop, in order to apply the
+         * priority of actions (pass, drop, reject, alert) */
+        uint8_t bitarray = src->array[u] & dst->array[u];
+        uint8_t i = 0;
+
+        for (; bitarray != 0; i++, bitarray = bitarray >> 1) {
+            if (bitarray & 0x01) {
+                IPOnlyMatchPacketSig(tv, det_ctx, de_ctx->sig_array[u * 8 + i], p);
+            }
+        }
+    }
+}
+
 /**
  * \brief Match a packet against the IP Only detection engine contexts
  *
@@ -998,103 +1106,21 @@ void IPOnlyMatchPacket(ThreadVars *tv,
     if (src == NULL || dst == NULL)
         return;
 
-    uint32_t u;
-    for (u = 0; u < src->size; u++) {
-        SCLogDebug("And %"PRIu8" & %"PRIu8, src->array[u], dst->array[u]);
-
-        /* The final results will be at io_tctx */
-        io_tctx->sig_match_array[u] = dst->array[u] & src->array[u];
-
-        /* We have to move the logic of the signature checking
-         * to the main detect loop, in order to apply the
-         * priority of actions (pass, drop, reject, alert) */
-        if (io_tctx->sig_match_array[u] != 0) {
-            /* We have a match :) Let's see from which signum's */
-            uint8_t bitarray = io_tctx->sig_match_array[u];
-            uint8_t i = 0;
-
-            for (; i < 8; i++, bitarray = bitarray >> 1) {
-                if (bitarray & 0x01) {
-                    Signature *s = de_ctx->sig_array[u * 8 + i];
-
-                    if ((s->proto.flags & DETECT_PROTO_IPV4) && !PKT_IS_IPV4(p)) {
-                        SCLogDebug("ip version didn't match");
-                        continue;
-                    }
-                    if ((s->proto.flags & DETECT_PROTO_IPV6) && !PKT_IS_IPV6(p)) {
-                        SCLogDebug("ip version didn't match");
-                        continue;
-                    }
-
-                    if (DetectProtoContainsProto(&s->proto, IP_GET_IPPROTO(p)) == 0) {
-                        SCLogDebug("proto didn't match");
-                        continue;
-                    }
-
-                    /* check the source & dst port in the sig */
-                    if (p->proto == IPPROTO_TCP || p->proto == IPPROTO_UDP || p->proto == IPPROTO_SCTP) {
-                        if (!(s->flags & SIG_FLAG_DP_ANY)) {
-                            if (p->flags & PKT_IS_FRAGMENT)
-                                continue;
-
-                            DetectPort *dport = DetectPortLookupGroup(s->dp,p->dp);
-                            if (dport == NULL) {
-                                SCLogDebug("dport didn't match.");
-                                continue;
-                            }
-                        }
-                        if (!(s->flags & SIG_FLAG_SP_ANY)) {
-                            if (p->flags & PKT_IS_FRAGMENT)
-                                continue;
-
-                            DetectPort *sport = DetectPortLookupGroup(s->sp,p->sp);
-                            if (sport == NULL) {
-                                SCLogDebug("sport didn't match.");
-                                continue;
-                            }
-                        }
-                    } else if ((s->flags & (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) != (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) {
-                        SCLogDebug("port-less protocol and sig needs ports");
-                        continue;
-                    }
-
-                    if (!IPOnlyMatchCompatSMs(tv, det_ctx, s, p)) {
-                        continue;
-                    }
+    /* With many ip-only sigs most of the arrays is zero, so AND them a
+     * word at a time and only look at the bits of the words that are
+     * set in both. */
+    uint32_t u = 0;
+    for (; u + sizeof(uint64_t) <= src->size; u += sizeof(uint64_t)) {
+        uint64_t src_w, dst_w;
+        memcpy(&src_w, src->array + u, sizeof(src_w));
+        memcpy(&dst_w, dst->array + u, sizeof(dst_w));
+        if ((src_w & dst_w) == 0)
+            continue;
 
-                    SCLogDebug("Signum %"PRIu16" match (sid: %"PRIu16", msg: %s)",
-                               u * 8 + i, s->id, s->msg);
-
-                    if (s->sm_arrays[DETECT_SM_LIST_POSTMATCH] != NULL) {
-                        KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_POSTMATCH);
-                        SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_POSTMATCH];
-
-                        SCLogDebug("running match functions, sm %p", smd);
-
-                        if (smd != NULL) {
-                            while (1) {
-                                KEYWORD_PROFILING_START;
-                                (void)sigmatch_table[smd->type].Match(tv, det_ctx, p, s, smd->ctx);
-                                KEYWORD_PROFILING_END(det_ctx, smd->type, 1);
-                                if (smd->is_last)
-                                    break;
-                                smd++;
-                            }
-                        }
-                    }
-                    if (!(s->flags & SIG_FLAG_NOALERT)) {
-                        if (s->action & ACTION_DROP)
-                            PacketAlertAppend(det_ctx, s, p, 0, PACKET_ALERT_FLAG_DROP_FLOW);
-                        else
-                            PacketAlertAppend(det_ctx, s, p, 0, 0);
-                    } else {
-                        /* apply actions for noalert/rule suppressed as well */
-                        DetectSignatureApplyActions(p, s);
-                    }
-                }
-            }
-        }
+        IPOnlyMatchPacketRange(tv, de_ctx, det_ctx, src, dst, p,
+                               u, u + sizeof(uint64_t));
     }
+    IPOnlyMatchPacketRange(tv, de_ctx, det_ctx, src, dst, p, u, src->size);
 }
 
 /**
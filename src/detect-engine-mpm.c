@@ -35,6 +35,7 @@
 #include "detect-engine-siggroup.h"
 #include "detect-engine-mpm.h"
 #include "detect-engine-iponly.h"
+#include "detect-engine-fpstats.h"
 #include "detect-parse.h"
 #include "util-mpm.h"
 #include "util-memcmp.h"
@@ -55,6 +56,7 @@
 #include "util-debug.h"
 #include "util-print.h"
 #include "util-validate.h"
+#include "util-cpu.h"
 
 const char *builtin_mpms[] = {
     "toserver TCP packet",
@@ -615,6 +617,7 @@ void RetrieveFPForSig(Signature *s)
 
     BUG_ON(count_final_sm_list == 0);
 
+    int use_stats = FpStatsEnabled();
     int max_len = 0;
     int i;
     for (i = 0; i < count_final_sm_list; i++) {
@@ -642,7 +645,8 @@ void RetrieveFPForSig(Signature *s)
              * non-negated content present in the sig */
             if ((cd->flags & DETECT_CONTENT_NEGATED) && skip_negated_content)
                 continue;
-            if (cd->content_len != max_len)
+            /* with traffic stats the rarest pattern wins, not the longest */
+            if (!use_stats && cd->content_len != max_len)
                 continue;
 
             if (mpm_sm == NULL) {
@@ -650,8 +654,14 @@ void RetrieveFPForSig(Signature *s)
             } else {
                 DetectContentData *data1 = (DetectContentData *)sm->ctx;
                 DetectContentData *data2 = (DetectContentData *)mpm_sm->ctx;
-                uint32_t ls = PatternStrength(data1->content, data1->content_len);
-                uint32_t ss = PatternStrength(data2->content, data2->content_len);
+                uint32_t ls, ss;
+                if (use_stats) {
+                    ls = FpStatsPatternScore(data1->content, data1->content_len);
+                    ss = FpStatsPatternScore(data2->content, data2->content_len);
+                } else {
+                    ls = PatternStrength(data1->content, data1->content_len);
+                    ss = PatternStrength(data2->content, data2->content_len);
+                }
                 if (ls > ss) {
                     mpm_sm = sm;
                 } else if (ls == ss) {
@@ -800,12 +810,54 @@ static MpmStore *MpmStoreLookup(DetectEngineCtx *de_ctx, MpmStore *s)
     return rs;
 }
 
+/**
+ * \brief memory of the prepared mpm contexts of 'de_ctx'
+ *
+ * The shared contexts are in the factory, the rest in the mpm store.
+ */
+uint64_t MpmStoreMemuse(const DetectEngineCtx *de_ctx)
+{
+    HashListTableBucket *htb = NULL;
+    uint64_t memory_size = 0;
+
+    if (de_ctx->mpm_hash_table != NULL) {
+        for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+                htb != NULL;
+                htb = HashListTableGetListNext(htb))
+        {
+            const MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+            if (ms != NULL && ms->mpm_ctx != NULL &&
+                ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT)
+                memory_size += ms->mpm_ctx->memory_size;
+        }
+    }
+
+    const MpmCtxFactoryContainer *c = de_ctx->mpm_ctx_factory_container;
+    if (c != NULL) {
+        int32_t i;
+        for (i = 0; i < c->no_of_items; i++) {
+            if (c->items[i].mpm_ctx_ts != NULL)
+                memory_size += c->items[i].mpm_ctx_ts->memory_size;
+            if (c->items[i].mpm_ctx_tc != NULL)
+                memory_size += c->items[i].mpm_ctx_tc->memory_size;
+        }
+    }
+    return memory_size;
+}
+
+/* contexts larger than this are unlikely to stay in the cpu cache */
+#define MPM_STORE_CACHE_SIZE (256 * 1024)
+
 void MpmStoreReportStats(const DetectEngineCtx *de_ctx)
 {
     HashListTableBucket *htb = NULL;
 
     uint32_t stats[MPMB_MAX] = {0};
     uint32_t appstats[APP_MPMS_MAX] = {0};
+    uint32_t ctx_cnt = 0;
+    uint32_t ctx_over_cache = 0;
+    uint64_t memory_size = 0;
+    const MpmCtx *largest = NULL;
 
     for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
             htb != NULL;
@@ -815,6 +867,15 @@ void MpmStoreReportStats(const DetectEngineCtx *de_ctx)
         if (ms == NULL) {
             continue;
         }
+        if (ms->mpm_ctx != NULL &&
+            ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
+            ctx_cnt++;
+            memory_size += ms->mpm_ctx->memory_size;
+            if (ms->mpm_ctx->memory_size > MPM_STORE_CACHE_SIZE)
+                ctx_over_cache++;
+            if (largest == NULL || ms->mpm_ctx->memory_size > largest->memory_size)
+                largest = ms->mpm_ctx;
+        }
         if (ms->buffer < MPMB_MAX)
             stats[ms->buffer]++;
         else if (ms->sm_list != DETECT_SM_LIST_PMATCH) {
@@ -848,6 +909,13 @@ void MpmStoreReportStats(const DetectEngineCtx *de_ctx)
             char *direction = app_mpms[x].direction == SIG_FLAG_TOSERVER ? "toserver" : "toclient";
             SCLogPerf("AppLayer MPM \"%s %s\": %u", direction, name, appstats[x]);
         }
+        if (largest != NULL) {
+            SCLogPerf("MPM memory: %u contexts using %"PRIu64" bytes, "
+                    "%u over %u KiB", ctx_cnt, memory_size, ctx_over_cache,
+                    MPM_STORE_CACHE_SIZE / 1024);
+            SCLogPerf("MPM largest context: %u bytes for %u patterns",
+                    largest->memory_size, largest->pattern_cnt);
+        }
     }
 }
 
@@ -910,6 +978,9 @@ void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
         return;
 
     MpmInitCtx(ms->mpm_ctx, de_ctx->mpm_matcher);
+    /* stream chunks are searched as a vector by StreamPatternSearch() */
+    if (ms->buffer == MPMB_TCP_STREAM_TS || ms->buffer == MPMB_TCP_STREAM_TC)
+        ms->mpm_ctx->flags |= MPMCTX_FLAGS_VECTORED;
 
     /* add the patterns */
     for (sig = 0; sig < (ms->sid_array_size * 8); sig++) {
@@ -951,16 +1022,128 @@ void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
         }
     }
 
+    /* unique contexts are prepared later by MpmStorePrepareAll() */
     if (ms->mpm_ctx->pattern_cnt == 0) {
         MpmFactoryReClaimMpmCtx(de_ctx, ms->mpm_ctx);
         ms->mpm_ctx = NULL;
-    } else {
-        if (ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
-            if (mpm_table[ms->mpm_ctx->mpm_type].Prepare != NULL) {
-                mpm_table[ms->mpm_ctx->mpm_type].Prepare(ms->mpm_ctx);
-            }
+    }
+}
+
+#define MPM_PREPARE_THREADS_MAX 16
+
+typedef struct MpmPrepareQueue_ {
+    MpmCtx **ctxs;
+    uint32_t cnt;
+    uint32_t next;
+    SCMutex m;
+} MpmPrepareQueue;
+
+static void *MpmStorePrepareWorker(void *arg)
+{
+    MpmPrepareQueue *q = (MpmPrepareQueue *)arg;
+
+    for (;;) {
+        SCMutexLock(&q->m);
+        uint32_t i = q->next++;
+        SCMutexUnlock(&q->m);
+        if (i >= q->cnt)
+            break;
+
+        MpmCtx *mpm_ctx = q->ctxs[i];
+        mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx);
+    }
+    return NULL;
+}
+
+static int MpmStorePrepareThreads(const DetectEngineCtx *de_ctx)
+{
+#ifdef __SC_CUDA_SUPPORT__
+    /* cuda contexts are bound to the calling thread */
+    if (de_ctx->mpm_matcher == MPM_AC_CUDA)
+        return 1;
+#endif
+
+    intmax_t setting = 0;
+    if (ConfGetInt("detect.mpm-prepare-threads", &setting) == 1 && setting > 0)
+        return (int)MIN(setting, MPM_PREPARE_THREADS_MAX);
+
+    int cpus = UtilCpuGetNumProcessorsOnline();
+    if (cpus < 1)
+        return 1;
+    return MIN(cpus, MPM_PREPARE_THREADS_MAX);
+}
+
+/** \brief prepare all unique mpm contexts of the MpmStores
+ *
+ *  Building the matchers is the expensive part of SigGroupBuild, so the
+ *  contexts are handed out to a few short lived threads. Each context is
+ *  prepared independently of the others, so the result doesn't depend on
+ *  the order or the number of threads.
+ *
+ *  \retval 0 ok, -1 error
+ */
+int MpmStorePrepareAll(const DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->mpm_hash_table == NULL)
+        return 0;
+
+    uint32_t cnt = 0;
+    HashListTableBucket *htb;
+    for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+         htb != NULL; htb = HashListTableGetListNext(htb))
+    {
+        const MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms == NULL || ms->mpm_ctx == NULL ||
+            ms->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT ||
+            mpm_table[ms->mpm_ctx->mpm_type].Prepare == NULL)
+            continue;
+        cnt++;
+    }
+    if (cnt == 0)
+        return 0;
+
+    MpmPrepareQueue q;
+    memset(&q, 0, sizeof(q));
+    q.ctxs = SCCalloc(cnt, sizeof(MpmCtx *));
+    if (q.ctxs == NULL)
+        return -1;
+
+    for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+         htb != NULL; htb = HashListTableGetListNext(htb))
+    {
+        const MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms == NULL || ms->mpm_ctx == NULL ||
+            ms->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT ||
+            mpm_table[ms->mpm_ctx->mpm_type].Prepare == NULL)
+            continue;
+        q.ctxs[q.cnt++] = ms->mpm_ctx;
+    }
+    SCMutexInit(&q.m, NULL);
+
+    int nthreads = MIN((uint32_t)MpmStorePrepareThreads(de_ctx), q.cnt);
+    pthread_t threads[MPM_PREPARE_THREADS_MAX];
+    int started = 0;
+
+    /* the calling thread helps out, so start one less */
+    for (int i = 0; i < nthreads - 1; i++) {
+        if (pthread_create(&threads[started], NULL, MpmStorePrepareWorker, &q) != 0) {
+            SCLogWarning(SC_ERR_THREAD_CREATE, "failed to start mpm prepare "
+                         "thread, continuing with %d", started + 1);
+            break;
         }
+        started++;
     }
+    SCLogDebug("preparing %u mpm contexts using %d threads", q.cnt, started + 1);
+
+    MpmStorePrepareWorker(&q);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    SCMutexDestroy(&q.m);
+    SCFree(q.ctxs);
+    return 0;
 }
 
 
@@ -70,6 +70,8 @@ void RetrieveFPForSig(Signature *s);
 int MpmStoreInit(DetectEngineCtx *);
 void MpmStoreFree(DetectEngineCtx *);
 void MpmStoreReportStats(const DetectEngineCtx *de_ctx);
+uint64_t MpmStoreMemuse(const DetectEngineCtx *de_ctx);
+int MpmStorePrepareAll(const DetectEngineCtx *de_ctx);
 MpmStore *MpmStorePrepareBuffer(DetectEngineCtx *de_ctx, SigGroupHead *sgh, enum MpmBuiltinBuffers buf);
 
 /**
@@ -65,6 +65,10 @@ uint32_t PacketPatternSearchWithStreamCtx(DetectEngineThreadCtx *det_ctx,
 }
 
 /** \brief Pattern match -- searches for only one pattern per signature.
+ *
+ *  Runs of smsgs that follow each other in the stream are searched as one
+ *  vector, so that patterns spanning the smsg boundaries are found without
+ *  copying the data together.
  *
  *  \param det_ctx detection engine thread ctx
  *  \param p packet
@@ -78,20 +82,35 @@ uint32_t StreamPatternSearch(DetectEngineThreadCtx *det_ctx, const Packet *p,
 {
     SCEnter();
 
+    const MpmCtx *mpm_ctx = det_ctx->sgh->mpm_stream_ctx;
+    const StreamMsg *last = NULL;
+    const uint8_t *bufs[MPM_VECTOR_MAX];
+    uint16_t lens[MPM_VECTOR_MAX];
+    uint32_t cnt = 0;
     uint32_t ret = 0;
 
     //PrintRawDataFp(stdout, smsg->data.data, smsg->data.data_len);
 
-    uint32_t r;
     for ( ; smsg != NULL; smsg = smsg->next) {
-        if (smsg->data_len >= det_ctx->sgh->mpm_stream_ctx->minlen) {
-            r = mpm_table[det_ctx->sgh->mpm_stream_ctx->mpm_type].
-                Search(det_ctx->sgh->mpm_stream_ctx, &det_ctx->mtcs,
-                        &det_ctx->pmq, smsg->data, smsg->data_len);
-            if (r > 0) {
-                ret += r;
-            }
+        if (smsg->data_len == 0)
+            continue;
+
+        /* flush the vector on a gap or when it's full */
+        if (cnt > 0 && (cnt == MPM_VECTOR_MAX ||
+                    smsg->seq != last->seq + last->data_len))
+        {
+            ret += MpmSearchVector(mpm_ctx, &det_ctx->mtcs, &det_ctx->pmq,
+                                   bufs, lens, cnt);
+            cnt = 0;
         }
+        bufs[cnt] = smsg->data;
+        lens[cnt] = smsg->data_len;
+        cnt++;
+        last = smsg;
+    }
+    if (cnt > 0) {
+        ret += MpmSearchVector(mpm_ctx, &det_ctx->mtcs, &det_ctx->pmq,
+                               bufs, lens, cnt);
     }
 
     SCReturnInt(ret);
@@ -1165,6 +1184,61 @@ end:
     return result;
 }
 
+/**
+ * \test backtracking relative contents on a buffer they fail on should
+ *       stay well below the recursion limit, and still match when the
+ *       match is only found after backtracking.
+ */
+static int PayloadTestSig35(void)
+{
+    uint8_t buf[41];
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(buf, 'a', sizeof(buf));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->inspection_recursion_limit = 3000;
+
+    de_ctx->sig_list = SigInit(de_ctx, "alert tcp any any -> any any "
+        "(content:\"aa\"; content:\"aa\"; distance:0; "
+        "content:\"b\"; distance:0; within:3; sid:1;)");
+    FAIL_IF_NULL(de_ctx->sig_list);
+    Signature *s = de_ctx->sig_list;
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+
+    /* no 'b' at all */
+    det_ctx->buffer_offset = 0;
+    det_ctx->discontinue_matching = 0;
+    det_ctx->inspection_recursion_counter = 0;
+    int r = DetectEngineContentInspection(de_ctx, det_ctx, s,
+            s->sm_lists[DETECT_SM_LIST_PMATCH], NULL, buf, sizeof(buf) - 1, 0,
+            DETECT_ENGINE_CONTENT_INSPECTION_MODE_PAYLOAD, NULL);
+    FAIL_IF(r != 0);
+    FAIL_IF(det_ctx->discontinue_matching != 0);
+    FAIL_IF(det_ctx->inspection_recursion_counter >= 3000);
+
+    /* 'b' at the end */
+    buf[sizeof(buf) - 1] = 'b';
+    det_ctx->buffer_offset = 0;
+    det_ctx->discontinue_matching = 0;
+    det_ctx->inspection_recursion_counter = 0;
+    r = DetectEngineContentInspection(de_ctx, det_ctx, s,
+            s->sm_lists[DETECT_SM_LIST_PMATCH], NULL, buf, sizeof(buf), 0,
+            DETECT_ENGINE_CONTENT_INSPECTION_MODE_PAYLOAD, NULL);
+    FAIL_IF(r != 1);
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void PayloadRegisterTests(void)
@@ -1206,6 +1280,7 @@ void PayloadRegisterTests(void)
     UtRegisterTest("PayloadTestSig32", PayloadTestSig32);
     UtRegisterTest("PayloadTestSig33", PayloadTestSig33);
     UtRegisterTest("PayloadTestSig34", PayloadTestSig34);
+    UtRegisterTest("PayloadTestSig35", PayloadTestSig35);
 #endif /* UNITTESTS */
 
     return;
@@ -0,0 +1,312 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Prefilter engines for keywords other than content.
+ *
+ * Sigs without a fast pattern end up in the non-mpm list of their group
+ * and are looked at for every packet. With 'detect.prefilter.default: auto'
+ * such a sig gets a prefilter keyword instead (Signature::prefilter_sm),
+ * the first keyword of its match list that has a SetupPrefilter callback.
+ * Per group each of those keywords sets up one engine that, like the mpm,
+ * adds the ids of the sigs that can match the packet to det_ctx::pmq.
+ *
+ * Most header keywords look at a single byte of the packet (tcp flags,
+ * ttl, icmp type and code), for those PrefilterSetupPacketU8Table builds
+ * a table with the sigs for each of the 256 values.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-prefilter.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+/**
+ * \brief add a prefilter engine to the group
+ *
+ * \param pectx engine data, owned by the engine after this call
+ *
+ * \retval 0 ok
+ * \retval -1 error, pectx is not freed
+ */
+int PrefilterAppendEngine(SigGroupHead *sgh, int sm_type,
+        void (*Prefilter)(DetectEngineThreadCtx *, Packet *, const void *),
+        void *pectx, void (*FreeFunc)(void *))
+{
+    PrefilterEngine *e = SCMalloc(sizeof(*e));
+    if (e == NULL)
+        return -1;
+    memset(e, 0x00, sizeof(*e));
+
+    e->sm_type = sm_type;
+    e->Prefilter = Prefilter;
+    e->pectx = pectx;
+    e->Free = FreeFunc;
+
+    if (sgh->prefilter_engines == NULL) {
+        sgh->prefilter_engines = e;
+    } else {
+        PrefilterEngine *t = sgh->prefilter_engines;
+        while (t->next != NULL)
+            t = t->next;
+        t->next = e;
+    }
+    return 0;
+}
+
+void PrefilterFreeEngines(SigGroupHead *sgh)
+{
+    PrefilterEngine *e = sgh->prefilter_engines;
+    while (e != NULL) {
+        PrefilterEngine *next = e->next;
+        if (e->Free != NULL && e->pectx != NULL)
+            e->Free(e->pectx);
+        SCFree(e);
+        e = next;
+    }
+    sgh->prefilter_engines = NULL;
+}
+
+static void PrefilterPacketU8TableFree(void *ptr)
+{
+    PrefilterPacketU8Table *t = (PrefilterPacketU8Table *)ptr;
+    int v;
+
+    for (v = 0; v < 256; v++) {
+        if (t->sigs[v] != NULL)
+            SCFree(t->sigs[v]);
+    }
+    SCFree(t);
+}
+
+/**
+ * \brief set up an engine that looks up the sigs by a uint8_t value of
+ *        the packet
+ *
+ * \param Compare returns 1 if the keyword ctx matches value
+ * \param Prefilter gets the value from the packet and calls
+ *        PrefilterPacketU8TableAdd, the table is passed as pectx
+ *
+ * \retval 0 ok
+ * \retval -1 error
+ */
+int PrefilterSetupPacketU8Table(SigGroupHead *sgh, int sm_type,
+        int (*Compare)(const uint8_t value, const SigMatchCtx *smctx),
+        void (*Prefilter)(DetectEngineThreadCtx *, Packet *, const void *))
+{
+    PrefilterPacketU8Table *t = SCMalloc(sizeof(*t));
+    if (t == NULL)
+        return -1;
+    memset(t, 0x00, sizeof(*t));
+
+    uint32_t sig;
+    int v;
+
+    /* first count, then fill in the sig ids */
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL || s->prefilter_sm == NULL || s->prefilter_sm->type != sm_type)
+            continue;
+
+        for (v = 0; v < 256; v++) {
+            if (Compare((uint8_t)v, s->prefilter_sm->ctx))
+                t->sigs_cnt[v]++;
+        }
+    }
+
+    for (v = 0; v < 256; v++) {
+        if (t->sigs_cnt[v] == 0)
+            continue;
+
+        t->sigs[v] = SCMalloc(t->sigs_cnt[v] * sizeof(SigIntId));
+        if (t->sigs[v] == NULL)
+            goto error;
+        t->sigs_cnt[v] = 0;
+    }
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL || s->prefilter_sm == NULL || s->prefilter_sm->type != sm_type)
+            continue;
+
+        for (v = 0; v < 256; v++) {
+            if (Compare((uint8_t)v, s->prefilter_sm->ctx))
+                t->sigs[v][t->sigs_cnt[v]++] = s->num;
+        }
+    }
+
+    if (PrefilterAppendEngine(sgh, sm_type, Prefilter, t,
+                PrefilterPacketU8TableFree) < 0)
+        goto error;
+    return 0;
+
+error:
+    PrefilterPacketU8TableFree(t);
+    return -1;
+}
+
+/**
+ * \brief pick the prefilter keyword of the sigs that have no mpm
+ *
+ * To be called after the fast patterns are set and before the non-mpm
+ * lists of the groups are built.
+ */
+void PrefilterSetupSignatures(DetectEngineCtx *de_ctx)
+{
+    Signature *s;
+
+    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
+        s->prefilter_sm = NULL;
+
+        if (de_ctx->prefilter_setting != DETECT_PREFILTER_AUTO)
+            continue;
+        if (s->mpm_sm != NULL)
+            continue;
+        if (s->flags & SIG_FLAG_IPONLY || s->init_flags & SIG_FLAG_INIT_DEONLY)
+            continue;
+
+        SigMatch *sm = s->sm_lists[DETECT_SM_LIST_MATCH];
+        for ( ; sm != NULL; sm = sm->next) {
+            const SigTableElmt *st = &sigmatch_table[sm->type];
+            if (st->SetupPrefilter == NULL)
+                continue;
+            if (st->SupportsPrefilter != NULL && !st->SupportsPrefilter(s))
+                continue;
+
+            SCLogDebug("sig %u: prefilter %s", s->id, st->name);
+            s->prefilter_sm = sm;
+            break;
+        }
+    }
+}
+
+/**
+ * \brief set up the prefilter engines of a group, one per keyword
+ */
+int PrefilterSetupGroup(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    uint8_t types[DETECT_TBLSIZE];
+    uint32_t sig;
+    int t;
+
+    BUG_ON(sgh->prefilter_engines != NULL);
+
+    if (de_ctx->prefilter_setting != DETECT_PREFILTER_AUTO)
+        return 0;
+
+    memset(types, 0x00, sizeof(types));
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s != NULL && s->prefilter_sm != NULL)
+            types[s->prefilter_sm->type] = 1;
+    }
+
+    for (t = 0; t < DETECT_TBLSIZE; t++) {
+        if (types[t] == 0)
+            continue;
+
+        if (sigmatch_table[t].SetupPrefilter(de_ctx, sgh) < 0) {
+            SCLogError(SC_ERR_MEM_ALLOC, "setting up the %s prefilter failed",
+                    sigmatch_table[t].name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief run the prefilter engines of det_ctx::sgh on the packet
+ */
+void PrefilterRunEngines(DetectEngineThreadCtx *det_ctx, Packet *p)
+{
+    const PrefilterEngine *e = det_ctx->sgh->prefilter_engines;
+
+    for ( ; e != NULL; e = e->next) {
+        e->Prefilter(det_ctx, p, e->pectx);
+    }
+}
+
+#ifdef UNITTESTS
+/** \test sigs without content are matched through the flags and dsize
+ *        prefilters instead of the non-mpm list */
+static int PrefilterTest01(void)
+{
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    uint32_t i;
+    int engines = 0;
+
+    memset(&th_v, 0, sizeof(th_v));
+
+    Packet *p = UTHBuildPacket((uint8_t *)"abcd", 4, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    p->tcph->th_flags = TH_SYN;
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->prefilter_setting = DETECT_PREFILTER_AUTO;
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (flags:S; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (flags:A; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (dsize:4; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (dsize:>300; sid:4;)"));
+    SigGroupBuild(de_ctx);
+
+    for (i = 0; i < de_ctx->sgh_array_cnt; i++) {
+        SigGroupHead *sgh = de_ctx->sgh_array[i];
+        if (sgh == NULL)
+            continue;
+        FAIL_IF(sgh->non_mpm_syn_store_cnt != 0);
+        if (sgh->prefilter_engines != NULL)
+            engines++;
+    }
+    FAIL_IF(engines == 0);
+
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+
+    FAIL_IF_NOT(PacketAlertCheck(p, 1));
+    FAIL_IF(PacketAlertCheck(p, 2));
+    FAIL_IF_NOT(PacketAlertCheck(p, 3));
+    FAIL_IF(PacketAlertCheck(p, 4));
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePacket(p);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PrefilterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PrefilterTest01", PrefilterTest01);
+#endif
+}
@@ -0,0 +1,58 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Prefilter engines for keywords other than content, see
+ * detect-engine-prefilter.c.
+ */
+
+#ifndef __DETECT_ENGINE_PREFILTER_H__
+#define __DETECT_ENGINE_PREFILTER_H__
+
+#include "util-mpm.h"
+
+/** sig ids per value of a uint8_t packet field */
+typedef struct PrefilterPacketU8Table_ {
+    uint32_t sigs_cnt[256];
+    SigIntId *sigs[256];
+} PrefilterPacketU8Table;
+
+int PrefilterAppendEngine(SigGroupHead *sgh, int sm_type,
+        void (*Prefilter)(DetectEngineThreadCtx *, Packet *, const void *),
+        void *pectx, void (*FreeFunc)(void *));
+void PrefilterFreeEngines(SigGroupHead *sgh);
+
+int PrefilterSetupPacketU8Table(SigGroupHead *sgh, int sm_type,
+        int (*Compare)(const uint8_t value, const SigMatchCtx *smctx),
+        void (*Prefilter)(DetectEngineThreadCtx *, Packet *, const void *));
+
+void PrefilterSetupSignatures(DetectEngineCtx *de_ctx);
+int PrefilterSetupGroup(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
+void PrefilterRunEngines(DetectEngineThreadCtx *det_ctx, Packet *p);
+
+void PrefilterRegisterTests(void);
+
+/** \brief add the sigs for 'value' to the candidates of the packet */
+static inline void PrefilterPacketU8TableAdd(DetectEngineThreadCtx *det_ctx,
+        const PrefilterPacketU8Table *t, const uint8_t value)
+{
+    MpmAddSids(&det_ctx->pmq, t->sigs[value], t->sigs_cnt[value]);
+}
+
+#endif /* __DETECT_ENGINE_PREFILTER_H__ */
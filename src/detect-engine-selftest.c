@@ -0,0 +1,597 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Detect self-test, see detect-engine-selftest.h
+ *
+ * The packets come from 'detect.self-test.pcap', or if that isn't set
+ * from a few built in frames. They're decoded once and kept. A run gets
+ * a det_ctx of its own for each engine, on a ThreadVars that isn't known
+ * to the stats, and inspects the packets 'passes' times without a flow.
+ * The fastest pass counts, so that a pass that got preempted doesn't.
+ *
+ * On a reload the old and the new engine are timed back to back, after
+ * the detect threads moved to the new one, so the comparison doesn't
+ * depend on the load of the box at two different times and doesn't
+ * delay the swap.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "decode.h"
+#include "packet-queue.h"
+#include "pkt-var.h"
+#include "threadvars.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-time.h"
+#include "util-unittest.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-selftest.h"
+
+#define SELF_TEST_MAX_PACKETS   1000
+#define SELF_TEST_PASSES        10
+#define SELF_TEST_THRESHOLD     30
+
+static int self_test_enabled = 0;
+static char *self_test_pcap = NULL;
+static uint32_t self_test_max_packets = SELF_TEST_MAX_PACKETS;
+static uint32_t self_test_passes = SELF_TEST_PASSES;
+static uint32_t self_test_threshold = SELF_TEST_THRESHOLD;
+
+/** decoded packets, loaded by the first run */
+static Packet **self_test_packets = NULL;
+static uint32_t self_test_packets_cnt = 0;
+/** one run at a time, runs share the packets */
+static SCMutex self_test_lock = SCMUTEX_INITIALIZER;
+
+typedef int (*DetectSelfTestDecoderFunc)(ThreadVars *, DecodeThreadVars *,
+        Packet *, uint8_t *, uint16_t, PacketQueue *);
+
+static SC_ATOMIC_DECLARE(uint64_t, self_test_runs);
+static SC_ATOMIC_DECLARE(uint64_t, self_test_regressions);
+static SC_ATOMIC_DECLARE(uint64_t, self_test_ticks);
+
+/* built in frames, between documentation addresses */
+static uint8_t self_test_syn[] = {
+    0x00, 0x1b, 0x21, 0x01, 0x02, 0x03, 0x00, 0x1b, 0x21, 0x04, 0x05, 0x06,
+    0x08, 0x00, 0x45, 0x00, 0x00, 0x28, 0x00, 0x01, 0x40, 0x00, 0x40, 0x06,
+    0x4e, 0x7d, 0xc0, 0x00, 0x02, 0x0a, 0xc6, 0x33, 0x64, 0x14, 0x9c, 0x40,
+    0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x50, 0x02,
+    0xff, 0xff, 0x00, 0x00, 0x00, 0x00,
+};
+static uint8_t self_test_http_get[] = {
+    0x00, 0x1b, 0x21, 0x01, 0x02, 0x03, 0x00, 0x1b, 0x21, 0x04, 0x05, 0x06,
+    0x08, 0x00, 0x45, 0x00, 0x00, 0x81, 0x00, 0x01, 0x40, 0x00, 0x40, 0x06,
+    0x4e, 0x24, 0xc0, 0x00, 0x02, 0x0a, 0xc6, 0x33, 0x64, 0x14, 0x9c, 0x40,
+    0x00, 0x50, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x03, 0xe9, 0x50, 0x18,
+    0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x47, 0x45, 0x54, 0x20, 0x2f, 0x69,
+    0x6e, 0x64, 0x65, 0x78, 0x2e, 0x68, 0x74, 0x6d, 0x6c, 0x20, 0x48, 0x54,
+    0x54, 0x50, 0x2f, 0x31, 0x2e, 0x31, 0x0d, 0x0a, 0x48, 0x6f, 0x73, 0x74,
+    0x3a, 0x20, 0x77, 0x77, 0x77, 0x2e, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c,
+    0x65, 0x2e, 0x63, 0x6f, 0x6d, 0x0d, 0x0a, 0x55, 0x73, 0x65, 0x72, 0x2d,
+    0x41, 0x67, 0x65, 0x6e, 0x74, 0x3a, 0x20, 0x4d, 0x6f, 0x7a, 0x69, 0x6c,
+    0x6c, 0x61, 0x2f, 0x35, 0x2e, 0x30, 0x0d, 0x0a, 0x41, 0x63, 0x63, 0x65,
+    0x70, 0x74, 0x3a, 0x20, 0x2a, 0x2f, 0x2a, 0x0d, 0x0a, 0x0d, 0x0a,
+};
+static uint8_t self_test_http_resp[] = {
+    0x00, 0x1b, 0x21, 0x01, 0x02, 0x03, 0x00, 0x1b, 0x21, 0x04, 0x05, 0x06,
+    0x08, 0x00, 0x45, 0x00, 0x00, 0x75, 0x00, 0x01, 0x40, 0x00, 0x40, 0x06,
+    0x4e, 0x30, 0xc6, 0x33, 0x64, 0x14, 0xc0, 0x00, 0x02, 0x0a, 0x00, 0x50,
+    0x9c, 0x40, 0x00, 0x00, 0x03, 0xe9, 0x00, 0x00, 0x00, 0x5b, 0x50, 0x18,
+    0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x48, 0x54, 0x54, 0x50, 0x2f, 0x31,
+    0x2e, 0x31, 0x20, 0x32, 0x30, 0x30, 0x20, 0x4f, 0x4b, 0x0d, 0x0a, 0x43,
+    0x6f, 0x6e, 0x74, 0x65, 0x6e, 0x74, 0x2d, 0x54, 0x79, 0x70, 0x65, 0x3a,
+    0x20, 0x74, 0x65, 0x78, 0x74, 0x2f, 0x68, 0x74, 0x6d, 0x6c, 0x0d, 0x0a,
+    0x43, 0x6f, 0x6e, 0x74, 0x65, 0x6e, 0x74, 0x2d, 0x4c, 0x65, 0x6e, 0x67,
+    0x74, 0x68, 0x3a, 0x20, 0x31, 0x33, 0x0d, 0x0a, 0x0d, 0x0a, 0x3c, 0x68,
+    0x74, 0x6d, 0x6c, 0x3e, 0x3c, 0x2f, 0x68, 0x74, 0x6d, 0x6c, 0x3e,
+};
+static uint8_t self_test_dns[] = {
+    0x00, 0x1b, 0x21, 0x01, 0x02, 0x03, 0x00, 0x1b, 0x21, 0x04, 0x05, 0x06,
+    0x08, 0x00, 0x45, 0x00, 0x00, 0x3d, 0x00, 0x01, 0x40, 0x00, 0x40, 0x11,
+    0x4e, 0x3c, 0xc0, 0x00, 0x02, 0x0a, 0xc6, 0x33, 0x64, 0x35, 0x9c, 0x41,
+    0x00, 0x35, 0x00, 0x29, 0x00, 0x00, 0x12, 0x34, 0x01, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x77, 0x77, 0x77, 0x07, 0x65,
+    0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+    0x01, 0x00, 0x01,
+};
+static uint8_t self_test_icmp[] = {
+    0x00, 0x1b, 0x21, 0x01, 0x02, 0x03, 0x00, 0x1b, 0x21, 0x04, 0x05, 0x06,
+    0x08, 0x00, 0x45, 0x00, 0x00, 0x2c, 0x00, 0x01, 0x40, 0x00, 0x40, 0x01,
+    0x4e, 0x7e, 0xc0, 0x00, 0x02, 0x0a, 0xc6, 0x33, 0x64, 0x14, 0x08, 0x00,
+    0xb4, 0xb2, 0x00, 0x01, 0x00, 0x01, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66,
+    0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70,
+};
+
+static struct {
+    uint8_t *data;
+    uint16_t len;
+} self_test_frames[] = {
+    { self_test_syn, sizeof(self_test_syn) },
+    { self_test_http_get, sizeof(self_test_http_get) },
+    { self_test_http_resp, sizeof(self_test_http_resp) },
+    { self_test_dns, sizeof(self_test_dns) },
+    { self_test_icmp, sizeof(self_test_icmp) },
+};
+
+/** \internal
+ *  \brief get a positive integer 'name' from 'node' into 'value', or
+ *         leave it at its default */
+static void DetectSelfTestGetValue(ConfNode *node, const char *name,
+        uint32_t max, uint32_t *value)
+{
+    intmax_t v;
+    if (ConfGetChildValueInt(node, name, &v) != 1)
+        return;
+    if (v < 1 || (uint64_t)v > max) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid detect.self-test.%s "
+                     "%"PRIdMAX", using %u", name, v, *value);
+        return;
+    }
+    *value = (uint32_t)v;
+}
+
+/**
+ * \brief read the detect.self-test config
+ */
+void DetectSelfTestSetup(void)
+{
+    SC_ATOMIC_INIT(self_test_runs);
+    SC_ATOMIC_INIT(self_test_regressions);
+    SC_ATOMIC_INIT(self_test_ticks);
+
+    ConfNode *node = ConfGetNode("detect.self-test");
+    if (node == NULL || !ConfNodeChildValueIsTrue(node, "enabled"))
+        return;
+
+    char *pcap = NULL;
+    if (ConfGetChildValue(node, "pcap", &pcap) == 1 && pcap != NULL &&
+        strlen(pcap) > 0)
+    {
+        self_test_pcap = SCStrdup(pcap);
+        if (unlikely(self_test_pcap == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "no memory for the self-test pcap "
+                       "name, self-test disabled");
+            return;
+        }
+    }
+    DetectSelfTestGetValue(node, "max-packets", 1000000, &self_test_max_packets);
+    DetectSelfTestGetValue(node, "passes", 1000, &self_test_passes);
+    DetectSelfTestGetValue(node, "threshold", 1000, &self_test_threshold);
+
+    self_test_enabled = 1;
+    SCLogConfig("detect self-test: %u passes over %s, warning if a new "
+                "engine is %u%% slower than the one it replaces",
+                self_test_passes, self_test_pcap ? self_test_pcap :
+                "the built in packets", self_test_threshold);
+}
+
+int DetectSelfTestEnabled(void)
+{
+    return self_test_enabled;
+}
+
+static void DetectSelfTestFreePackets(void)
+{
+    /* tunnel and reassembled packets come after their root */
+    while (self_test_packets_cnt > 0) {
+        PacketFree(self_test_packets[--self_test_packets_cnt]);
+    }
+    SCFree(self_test_packets);
+    self_test_packets = NULL;
+}
+
+void DetectSelfTestShutdown(void)
+{
+    SCMutexLock(&self_test_lock);
+    DetectSelfTestFreePackets();
+    SCMutexUnlock(&self_test_lock);
+
+    if (self_test_pcap != NULL) {
+        SCFree(self_test_pcap);
+        self_test_pcap = NULL;
+    }
+    self_test_enabled = 0;
+}
+
+static uint64_t DetectSelfTestRunsCounter(void)
+{
+    return SC_ATOMIC_GET(self_test_runs);
+}
+
+static uint64_t DetectSelfTestRegressionsCounter(void)
+{
+    return SC_ATOMIC_GET(self_test_regressions);
+}
+
+static uint64_t DetectSelfTestTicksCounter(void)
+{
+    return SC_ATOMIC_GET(self_test_ticks);
+}
+
+/**
+ * \brief register the detect.self_test.* stats counters, if enabled
+ */
+void DetectSelfTestRegisterGlobalCounters(void)
+{
+    if (!self_test_enabled)
+        return;
+
+    StatsRegisterGlobalCounter("detect.self_test.runs",
+            DetectSelfTestRunsCounter);
+    StatsRegisterGlobalCounter("detect.self_test.regressions",
+            DetectSelfTestRegressionsCounter);
+    StatsRegisterGlobalCounter("detect.self_test.ticks_per_packet",
+            DetectSelfTestTicksCounter);
+}
+
+/** \internal
+ *  \brief decode a frame into a new packet and add it and the packets
+ *         the decoder put in 'pq' to the set
+ *  \retval 0 ok or the frame was skipped, -1 out of memory */
+static int DetectSelfTestAddPacket(ThreadVars *tv, DecodeThreadVars *dtv,
+        DetectSelfTestDecoderFunc Decoder, int datalink, const struct timeval *ts,
+        uint8_t *data, uint32_t len, PacketQueue *pq)
+{
+    if (len == 0 || len > UINT16_MAX)
+        return 0;
+
+    Packet *p = PacketGetFromAlloc();
+    if (unlikely(p == NULL))
+        return -1;
+    PKT_SET_SRC(p, PKT_SRC_WIRE);
+    p->ts = *ts;
+    p->datalink = datalink;
+    if (PacketCopyData(p, data, len) != 0) {
+        PacketFree(p);
+        return -1;
+    }
+    (void)Decoder(tv, dtv, p, GET_PKT_DATA(p), (uint16_t)GET_PKT_LEN(p), pq);
+
+    Packet *tp = p;
+    do {
+        if (self_test_packets_cnt < self_test_max_packets) {
+            self_test_packets[self_test_packets_cnt++] = tp;
+        } else {
+            PacketFree(tp);
+        }
+    } while ((tp = PacketDequeue(pq)) != NULL);
+    return 0;
+}
+
+/** \internal
+ *  \brief read up to 'max-packets' packets from the self-test pcap
+ *  \retval 0 ok, -1 error */
+static int DetectSelfTestLoadPcap(ThreadVars *tv, DecodeThreadVars *dtv,
+        PacketQueue *pq)
+{
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    DetectSelfTestDecoderFunc Decoder = NULL;
+    int r = 0;
+
+    pcap_t *pcap = pcap_open_offline(self_test_pcap, errbuf);
+    if (pcap == NULL) {
+        SCLogError(SC_ERR_PCAP_OPEN_OFFLINE, "detect self-test: can't open "
+                   "%s: %s", self_test_pcap, errbuf);
+        return -1;
+    }
+
+    int datalink = pcap_datalink(pcap);
+    switch (datalink) {
+        case LINKTYPE_ETHERNET:
+            Decoder = DecodeEthernet;
+            break;
+        case LINKTYPE_LINUX_SLL:
+            Decoder = DecodeSll;
+            break;
+        case LINKTYPE_RAW:
+            Decoder = DecodeRaw;
+            break;
+        case LINKTYPE_NULL:
+            Decoder = DecodeNull;
+            break;
+        default:
+            SCLogError(SC_ERR_UNIMPLEMENTED, "detect self-test: datalink type "
+                       "%d of %s not supported", datalink, self_test_pcap);
+            pcap_close(pcap);
+            return -1;
+    }
+
+    struct pcap_pkthdr *hdr;
+    const u_char *data;
+    while (self_test_packets_cnt < self_test_max_packets &&
+           pcap_next_ex(pcap, &hdr, &data) == 1)
+    {
+        if (DetectSelfTestAddPacket(tv, dtv, Decoder, datalink, &hdr->ts,
+                    (uint8_t *)data, hdr->caplen, pq) != 0) {
+            r = -1;
+            break;
+        }
+    }
+    pcap_close(pcap);
+    return r;
+}
+
+/** \internal
+ *  \brief decode the packets of the self-test
+ *  \retval 0 ok, -1 error */
+static int DetectSelfTestLoad(ThreadVars *tv, DecodeThreadVars *dtv)
+{
+    PacketQueue pq;
+    memset(&pq, 0, sizeof(pq));
+    int r = 0;
+
+    self_test_packets = SCCalloc(self_test_max_packets, sizeof(Packet *));
+    if (unlikely(self_test_packets == NULL))
+        return -1;
+
+    if (self_test_pcap != NULL) {
+        r = DetectSelfTestLoadPcap(tv, dtv, &pq);
+    } else {
+        struct timeval ts;
+        TimeGet(&ts);
+
+        uint32_t i;
+        for (i = 0; i < sizeof(self_test_frames) / sizeof(self_test_frames[0]); i++) {
+            if (DetectSelfTestAddPacket(tv, dtv, DecodeEthernet, LINKTYPE_ETHERNET,
+                        &ts, self_test_frames[i].data, self_test_frames[i].len,
+                        &pq) != 0) {
+                r = -1;
+                break;
+            }
+        }
+    }
+
+    if (r != 0 || self_test_packets_cnt == 0) {
+        DetectSelfTestFreePackets();
+        return -1;
+    }
+    SCLogInfo("detect self-test: %u packets loaded", self_test_packets_cnt);
+    return 0;
+}
+
+/** \internal
+ *  \brief time the inspection of the packets by 'det_ctx'
+ *  \retval 0 ok, -1 out of memory */
+static int DetectSelfTestMeasure(ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
+        DetectSelfTestResult *res)
+{
+    DetectEngineCtx *de_ctx = det_ctx->de_ctx;
+    uint64_t *sgh_ticks = NULL;
+    uint32_t *sgh_pkts = NULL;
+    uint64_t best = UINT64_MAX;
+    uint32_t pass, i;
+
+    memset(res, 0, sizeof(*res));
+    if (de_ctx->sgh_array_cnt > 0) {
+        sgh_ticks = SCCalloc(de_ctx->sgh_array_cnt, sizeof(uint64_t));
+        sgh_pkts = SCCalloc(de_ctx->sgh_array_cnt, sizeof(uint32_t));
+        if (unlikely(sgh_ticks == NULL || sgh_pkts == NULL)) {
+            SCFree(sgh_ticks);
+            SCFree(sgh_pkts);
+            return -1;
+        }
+    }
+
+    for (pass = 0; pass < self_test_passes; pass++) {
+        uint64_t total = 0;
+
+        for (i = 0; i < self_test_packets_cnt; i++) {
+            Packet *p = self_test_packets[i];
+            if ((p->flags & PKT_NOPACKET_INSPECTION) ||
+                PACKET_TEST_ACTION(p, ACTION_DROP))
+                continue;
+
+            p->alerts.cnt = 0;
+            if (p->pktvar != NULL) {
+                PktVarFree(p->pktvar);
+                p->pktvar = NULL;
+            }
+            det_ctx->sgh = NULL;
+
+            uint64_t start = UtilCpuGetTicks();
+            (void)SigMatchSignatures(tv, de_ctx, det_ctx, p);
+            uint64_t ticks = UtilCpuGetTicks() - start;
+
+            total += ticks;
+            if (det_ctx->sgh != NULL && det_ctx->sgh->id < de_ctx->sgh_array_cnt) {
+                sgh_ticks[det_ctx->sgh->id] += ticks;
+                sgh_pkts[det_ctx->sgh->id]++;
+            }
+            /* an action of a rule isn't a decoder action, undo it for
+             * the next pass and the next engine */
+            p->action = 0;
+        }
+        if (total < best)
+            best = total;
+    }
+
+    res->packets = self_test_packets_cnt;
+    res->ticks = best / self_test_packets_cnt;
+    for (i = 0; i < de_ctx->sgh_array_cnt; i++) {
+        if (sgh_pkts[i] == 0)
+            continue;
+        uint64_t avg = sgh_ticks[i] / sgh_pkts[i];
+        if (avg > res->slowest_sgh_ticks) {
+            res->slowest_sgh = i;
+            res->slowest_sgh_ticks = avg;
+        }
+    }
+
+    SCFree(sgh_ticks);
+    SCFree(sgh_pkts);
+    return 0;
+}
+
+/**
+ * \brief time 'de_ctx' and, if set, the engine 'prev_de_ctx' it replaces
+ *
+ * A warning is logged and detect.self_test.regressions is incremented if
+ * 'de_ctx' takes more than 'threshold' percent more ticks per packet.
+ *
+ * \retval 1 the new engine is slower than allowed
+ * \retval 0 ok or self-test disabled
+ * \retval -1 the self-test couldn't run
+ */
+int DetectSelfTestRun(DetectEngineCtx *de_ctx, DetectEngineCtx *prev_de_ctx)
+{
+    if (!self_test_enabled || de_ctx == NULL || de_ctx->minimal)
+        return 0;
+    if (prev_de_ctx != NULL && prev_de_ctx->minimal)
+        prev_de_ctx = NULL;
+
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    DetectEngineThreadCtx *prev_det_ctx = NULL;
+    DetectSelfTestResult res, prev_res;
+    int r = -1;
+
+    memset(&tv, 0, sizeof(tv));
+    memset(&dtv, 0, sizeof(dtv));
+    strlcpy(tv.name, "DetectSelfTest", sizeof(tv.name));
+    SCMutexInit(&tv.perf_public_ctx.m, NULL);
+
+    SCMutexLock(&self_test_lock);
+
+    /* all counters have to be registered before the local ones are set up */
+    det_ctx = DetectEngineThreadCtxInitStandalone(&tv, de_ctx);
+    if (det_ctx == NULL)
+        goto end;
+    if (prev_de_ctx != NULL) {
+        prev_det_ctx = DetectEngineThreadCtxInitStandalone(&tv, prev_de_ctx);
+        if (prev_det_ctx == NULL)
+            goto end;
+    }
+    if (self_test_packets == NULL)
+        DecodeRegisterPerfCounters(&dtv, &tv);
+    StatsSetupPrivateLocal(&tv);
+
+    if (self_test_packets == NULL && DetectSelfTestLoad(&tv, &dtv) != 0) {
+        SCLogWarning(SC_ERR_INITIALIZATION, "detect self-test: no packets "
+                     "to test with, self-test disabled");
+        self_test_enabled = 0;
+        goto end;
+    }
+
+    if (DetectSelfTestMeasure(&tv, det_ctx, &res) != 0)
+        goto end;
+    if (prev_det_ctx != NULL && DetectSelfTestMeasure(&tv, prev_det_ctx, &prev_res) != 0)
+        goto end;
+
+    (void)SC_ATOMIC_ADD(self_test_runs, 1);
+    SC_ATOMIC_SET(self_test_ticks, res.ticks);
+    r = 0;
+
+    if (prev_det_ctx != NULL && prev_res.ticks > 0 &&
+        res.ticks * 100 > prev_res.ticks * (100 + self_test_threshold))
+    {
+        (void)SC_ATOMIC_ADD(self_test_regressions, 1);
+        SCLogWarning(SC_WARN_POOR_RULE, "detect self-test: the new detection "
+                     "engine takes %"PRIu64" ticks per packet, the previous one "
+                     "%"PRIu64" (%"PRIu64"%% more). Slowest rule group %u at "
+                     "%"PRIu64" ticks per packet", res.ticks, prev_res.ticks,
+                     (res.ticks - prev_res.ticks) * 100 / prev_res.ticks,
+                     res.slowest_sgh, res.slowest_sgh_ticks);
+        r = 1;
+    } else if (prev_det_ctx != NULL) {
+        SCLogInfo("detect self-test: %"PRIu64" ticks per packet, previous "
+                  "engine %"PRIu64". Slowest rule group %u at %"PRIu64" ticks "
+                  "per packet", res.ticks, prev_res.ticks, res.slowest_sgh,
+                  res.slowest_sgh_ticks);
+    } else {
+        SCLogInfo("detect self-test: %"PRIu64" ticks per packet over %u "
+                  "packets. Slowest rule group %u at %"PRIu64" ticks per "
+                  "packet", res.ticks, res.packets, res.slowest_sgh,
+                  res.slowest_sgh_ticks);
+    }
+
+end:
+    SCMutexUnlock(&self_test_lock);
+    if (prev_det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&tv, prev_det_ctx);
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&tv, det_ctx);
+    StatsThreadCleanup(&tv);
+    return r;
+}
+
+#ifdef UNITTESTS
+/** \test the built in packets through an engine and a slower copy */
+static int DetectSelfTestTest01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    DetectEngineCtx *slow_de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    FAIL_IF_NULL(slow_de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    slow_de_ctx->flags |= DE_QUIET;
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+                "(content:\"GET\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(slow_de_ctx, "alert tcp any any -> any 80 "
+                "(content:\"GET\"; sid:1;)"));
+    /* rules without a fast pattern are checked for every packet */
+    FAIL_IF_NULL(DetectEngineAppendSig(slow_de_ctx, "alert ip any any -> any any "
+                "(pcre:\"/(a|b)*c+d?(e|f|g)+h/\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(slow_de_ctx, "alert ip any any -> any any "
+                "(pcre:\"/(x|y)*z+w?(v|u|t)+s/\"; sid:3;)"));
+    FAIL_IF(SigGroupBuild(de_ctx) < 0);
+    FAIL_IF(SigGroupBuild(slow_de_ctx) < 0);
+
+    int enabled = self_test_enabled;
+    char *pcap = self_test_pcap;
+    self_test_enabled = 1;
+    self_test_pcap = NULL;
+    SC_ATOMIC_INIT(self_test_runs);
+    SC_ATOMIC_INIT(self_test_regressions);
+    SC_ATOMIC_INIT(self_test_ticks);
+
+    FAIL_IF(DetectSelfTestRun(de_ctx, NULL) != 0);
+    FAIL_IF(self_test_packets_cnt != 5);
+    FAIL_IF(SC_ATOMIC_GET(self_test_ticks) == 0);
+
+    /* the result of the comparison depends on the box, it has to run */
+    FAIL_IF(DetectSelfTestRun(slow_de_ctx, de_ctx) < 0);
+    FAIL_IF(DetectSelfTestRun(de_ctx, slow_de_ctx) != 0);
+    FAIL_IF(SC_ATOMIC_GET(self_test_runs) != 3);
+
+    SCMutexLock(&self_test_lock);
+    DetectSelfTestFreePackets();
+    SCMutexUnlock(&self_test_lock);
+    self_test_enabled = enabled;
+    self_test_pcap = pcap;
+
+    DetectEngineCtxFree(de_ctx);
+    DetectEngineCtxFree(slow_de_ctx);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DetectSelfTestRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectSelfTestTest01", DetectSelfTestTest01);
+#endif
+}
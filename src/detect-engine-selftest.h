@@ -0,0 +1,45 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Detect self-test: a newly built detection engine is timed on a small
+ * set of packets, and on a reload compared to the engine it replaces.
+ */
+
+#ifndef __DETECT_ENGINE_SELFTEST_H__
+#define __DETECT_ENGINE_SELFTEST_H__
+
+typedef struct DetectSelfTestResult_ {
+    uint32_t packets;       /**< packets inspected per pass */
+    uint64_t ticks;         /**< ticks per packet of the fastest pass */
+    /** rule group with the most ticks per packet */
+    uint32_t slowest_sgh;
+    uint64_t slowest_sgh_ticks;
+} DetectSelfTestResult;
+
+void DetectSelfTestSetup(void);
+void DetectSelfTestShutdown(void);
+void DetectSelfTestRegisterGlobalCounters(void);
+int DetectSelfTestEnabled(void);
+
+int DetectSelfTestRun(DetectEngineCtx *de_ctx, DetectEngineCtx *prev_de_ctx);
+
+void DetectSelfTestRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_SELFTEST_H__ */
@@ -36,11 +36,14 @@
 #include "detect-engine-address.h"
 #include "detect-engine-mpm.h"
 #include "detect-engine-siggroup.h"
+#include "detect-engine-prefilter.h"
 
 #include "detect-content.h"
 #include "detect-uricontent.h"
 #include "detect-flags.h"
+#include "detect-flowbits.h"
 
+#include "util-var-name.h"
 #include "util-hash.h"
 #include "util-hashlist.h"
 
@@ -50,6 +53,7 @@
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
 #include "util-memcmp.h"
+#include "util-memuse.h"
 
 /* prototypes */
 int SigGroupHeadClearSigs(SigGroupHead *);
@@ -122,6 +126,7 @@ static SigGroupHead *SigGroupHeadAlloc(const DetectEngineCtx *de_ctx, uint32_t s
     if (unlikely(sgh == NULL))
         return NULL;
     memset(sgh, 0, sizeof(SigGroupHead));
+    MemuseAlloc(MEMUSE_DETECT, sizeof(SigGroupHead));
 
     sgh->init = SigGroupHeadInitDataAlloc(size);
     if (sgh->init == NULL)
@@ -163,6 +168,14 @@ void SigGroupHeadFree(SigGroupHead *sgh)
         sgh->non_mpm_syn_store_cnt = 0;
     }
 
+    if (sgh->flowbit_req_array != NULL) {
+        SCFree(sgh->flowbit_req_array);
+        sgh->flowbit_req_array = NULL;
+        sgh->flowbit_req_cnt = 0;
+    }
+
+    PrefilterFreeEngines(sgh);
+
     sgh->sig_cnt = 0;
 
     if (sgh->init != NULL) {
@@ -171,6 +184,7 @@ void SigGroupHeadFree(SigGroupHead *sgh)
     }
 
     SCFree(sgh);
+    MemuseFree(MEMUSE_DETECT, sizeof(SigGroupHead));
 
     return;
 }
@@ -579,6 +593,74 @@ uint16_t SigGroupHeadGetMinMpmSize(DetectEngineCtx *de_ctx,
     return min;
 }
 
+/**
+ *  \brief Set the stream flag in the sgh if any of its sigs inspects the
+ *         reassembled stream, so raw reassembly can be disabled for
+ *         flows that will never inspect it.
+ *
+ *  \param de_ctx detection engine ctx for the signatures
+ *  \param sgh sig group head to set the flag in
+ */
+void SigGroupHeadSetStreamFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    Signature *s = NULL;
+    uint32_t sig = 0;
+
+    if (sgh == NULL)
+        return;
+
+    if (sgh->flags & SIG_GROUP_HEAD_MPM_STREAM) {
+        sgh->flags |= SIG_GROUP_HEAD_HAVESTREAM;
+        return;
+    }
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        s = sgh->match_array[sig];
+        if (s == NULL)
+            continue;
+
+        if ((s->flags & SIG_FLAG_REQUIRE_STREAM) &&
+            s->sm_lists[DETECT_SM_LIST_PMATCH] != NULL) {
+            sgh->flags |= SIG_GROUP_HEAD_HAVESTREAM;
+            break;
+        }
+    }
+
+    return;
+}
+
+/**
+ *  \brief Set the response body flag in the sgh if any of its sigs inspects
+ *         the (decompressed) response body or the files in it, so the
+ *         http parser can skip decompressing bodies no rule looks at.
+ *
+ *  \param de_ctx detection engine ctx for the signatures
+ *  \param sgh sig group head to set the flag in
+ */
+void SigGroupHeadSetRespBodyFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    Signature *s = NULL;
+    uint32_t sig = 0;
+
+    if (sgh == NULL)
+        return;
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        s = sgh->match_array[sig];
+        if (s == NULL)
+            continue;
+
+        if (s->sm_lists[DETECT_SM_LIST_FILEDATA] != NULL ||
+            s->sm_lists[DETECT_SM_LIST_FILEMATCH] != NULL ||
+            (s->flags & SIG_FLAG_FILESTORE)) {
+            sgh->flags |= SIG_GROUP_HEAD_HAVERESPBODY;
+            break;
+        }
+    }
+
+    return;
+}
+
 /**
  *  \brief Set the need size flag in the sgh.
  *
@@ -665,6 +747,8 @@ void SigGroupHeadSetFilestoreCount(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
 
 /** \brief build an array of rule id's for sigs with no mpm
  *  Also updated de_ctx::non_mpm_store_cnt_max to track the highest cnt
+ *  Sigs with a prefilter keyword are left out, their prefilter engine
+ *  adds them to the candidates.
  */
 int SigGroupHeadBuildNonMpmArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
 {
@@ -683,6 +767,9 @@ int SigGroupHeadBuildNonMpmArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         if (s == NULL)
             continue;
 
+        if (s->prefilter_sm != NULL)
+            continue;
+
         if (s->mpm_sm == NULL || (s->flags & SIG_FLAG_MPM_NEG)) {
             if (!(DetectFlagsSignatureNeedsSynPackets(s))) {
                 non_mpm++;
@@ -714,6 +801,9 @@ int SigGroupHeadBuildNonMpmArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         if (s == NULL)
             continue;
 
+        if (s->prefilter_sm != NULL)
+            continue;
+
         if (s->mpm_sm == NULL || (s->flags & SIG_FLAG_MPM_NEG)) {
             if (!(DetectFlagsSignatureNeedsSynPackets(s))) {
                 BUG_ON(sgh->non_mpm_other_store_cnt >= non_mpm);
@@ -739,6 +829,111 @@ int SigGroupHeadBuildNonMpmArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
     return 0;
 }
 
+/** \internal
+ *  \brief get a flowbits:isset idx of the sig that is not in 'written'
+ *
+ *  \retval 1 found, idx is set
+ *  \retval 0 none
+ */
+static int SigGetFlowbitRequired(const Signature *s, const uint8_t *written,
+                                 uint32_t size, uint16_t *idx)
+{
+    const SigMatch *sm = s->sm_lists[DETECT_SM_LIST_MATCH];
+    for ( ; sm != NULL; sm = sm->next) {
+        if (sm->type != DETECT_FLOWBITS)
+            continue;
+
+        const DetectFlowbitsData *fd = (const DetectFlowbitsData *)sm->ctx;
+        if (fd->cmd != DETECT_FLOWBITS_CMD_ISSET)
+            continue;
+        if (fd->idx < size && (written[fd->idx / 8] & (1 << (fd->idx % 8))))
+            continue;
+
+        *idx = fd->idx;
+        return 1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief mark the flowbits set or toggled by the sm list in 'written' */
+static void SigMarkFlowbitsWritten(const SigMatch *sm, uint8_t *written,
+                                   uint32_t size)
+{
+    for ( ; sm != NULL; sm = sm->next) {
+        if (sm->type != DETECT_FLOWBITS)
+            continue;
+
+        const DetectFlowbitsData *fd = (const DetectFlowbitsData *)sm->ctx;
+        if ((fd->cmd == DETECT_FLOWBITS_CMD_SET ||
+             fd->cmd == DETECT_FLOWBITS_CMD_TOGGLE) && fd->idx < size) {
+            written[fd->idx / 8] |= (1 << (fd->idx % 8));
+        }
+    }
+}
+
+/** \brief build the array of sigs that require a flowbit to be set
+ *
+ *  Used at runtime to drop these sigs from the match array when the
+ *  flow doesn't have the bit. Bits that are set or toggled by a sig in
+ *  this sgh are skipped, as that sig may run before the isset in the
+ *  same packet.
+ */
+int SigGroupHeadBuildFlowbitReqArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    Signature *s = NULL;
+    uint32_t sig = 0;
+    uint32_t cnt = 0;
+    uint16_t idx = 0;
+
+    if (sgh == NULL)
+        return 0;
+
+    BUG_ON(sgh->flowbit_req_array != NULL);
+
+    uint32_t size = (uint32_t)de_ctx->variable_names_idx + 1;
+    uint8_t *written = SCMalloc((size / 8) + 1);
+    if (written == NULL)
+        return -1;
+    memset(written, 0, (size / 8) + 1);
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        s = sgh->match_array[sig];
+        if (s == NULL)
+            continue;
+
+        SigMarkFlowbitsWritten(s->sm_lists[DETECT_SM_LIST_MATCH], written, size);
+        SigMarkFlowbitsWritten(s->sm_lists[DETECT_SM_LIST_POSTMATCH], written, size);
+    }
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        s = sgh->match_array[sig];
+        if (s != NULL && SigGetFlowbitRequired(s, written, size, &idx))
+            cnt++;
+    }
+
+    if (cnt > 0) {
+        sgh->flowbit_req_array = SCMalloc(cnt * sizeof(SignatureFlowbitReq));
+        if (sgh->flowbit_req_array == NULL) {
+            SCFree(written);
+            return -1;
+        }
+
+        for (sig = 0; sig < sgh->sig_cnt; sig++) {
+            s = sgh->match_array[sig];
+            if (s == NULL || !SigGetFlowbitRequired(s, written, size, &idx))
+                continue;
+
+            sgh->flowbit_req_array[sgh->flowbit_req_cnt].id = s->num;
+            sgh->flowbit_req_array[sgh->flowbit_req_cnt].idx = idx;
+            sgh->flowbit_req_cnt++;
+        }
+    }
+
+    SCFree(written);
+    return 0;
+}
+
 /**
  * \brief Check if a SigGroupHead contains a Signature, whose sid is sent as an
  *        argument.
@@ -1273,6 +1468,45 @@ end:
     UTHFreePackets(&p, 1);
     return result;
 }
+/**
+ * \test flowbit requirement array skips bits set by a sig in the sgh.
+ */
+static int SigGroupHeadTest12(void)
+{
+    int found = 0;
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(flowbits:isset,fb1; content:\"abc\"; sid:1;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(flowbits:isset,fb2; content:\"def\"; sid:2;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"ghi\"; flowbits:set,fb2; sid:3;)");
+    FAIL_IF_NULL(s);
+
+    SigGroupBuild(de_ctx);
+
+    uint16_t idx = VariableNameGetIdx(de_ctx, "fb1", VAR_TYPE_FLOW_BIT);
+
+    uint32_t i;
+    for (i = 0; i < de_ctx->sgh_array_cnt; i++) {
+        SigGroupHead *sgh = de_ctx->sgh_array[i];
+        if (sgh == NULL || sgh->sig_cnt != 3)
+            continue;
+
+        FAIL_IF_NOT(sgh->flowbit_req_cnt == 1);
+        FAIL_IF_NOT(sgh->flowbit_req_array[0].idx == idx);
+        FAIL_IF_NOT(de_ctx->sig_array[sgh->flowbit_req_array[0].id]->id == 1);
+        found++;
+    }
+    FAIL_IF(found == 0);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
 #endif
 
 void SigGroupHeadRegisterTests(void)
@@ -1285,5 +1519,6 @@ void SigGroupHeadRegisterTests(void)
     UtRegisterTest("SigGroupHeadTest09", SigGroupHeadTest09);
     UtRegisterTest("SigGroupHeadTest10", SigGroupHeadTest10);
     UtRegisterTest("SigGroupHeadTest11", SigGroupHeadTest11);
+    UtRegisterTest("SigGroupHeadTest12", SigGroupHeadTest12);
 #endif
 }
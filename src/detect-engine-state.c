@@ -23,10 +23,9 @@
  * the list of signatures to match on the reconstructed stream.
  *
  * The Flow::de_state is a ::DetectEngineState structure. This is
- * basically a containter for storage item of type ::DeStateStore.
- * They contains an array of ::DeStateStoreItem which store the
- * state of match for an individual signature identified by
- * DeStateStoreItem::sid.
+ * basically a containter for an array of ::DeStateStoreItem which
+ * store the state of match for an individual signature identified by
+ * DeStateStoreItem::sid. The array is kept sorted by sid.
  *
  * The state is constructed by DeStateDetectStartDetection() which
  * also starts the matching. Work is continued by
@@ -117,15 +116,6 @@ static inline int TxIsLast(uint64_t tx_id, uint64_t total_txs)
     return 0;
 }
 
-static DeStateStore *DeStateStoreAlloc(void)
-{
-    DeStateStore *d = SCMalloc(sizeof(DeStateStore));
-    if (unlikely(d == NULL))
-        return NULL;
-    memset(d, 0, sizeof(DeStateStore));
-
-    return d;
-}
 static DeStateStoreFlowRules *DeStateStoreFlowRulesAlloc(void)
 {
     DeStateStoreFlowRules *d = SCMalloc(sizeof(DeStateStoreFlowRules));
@@ -136,68 +126,79 @@ static DeStateStoreFlowRules *DeStateStoreFlowRulesAlloc(void)
     return d;
 }
 
+/** \internal
+ *  \brief find the position of sig num in the sorted item array
+ *
+ *  \param pos set to the position of num, or where it should be
+ *             inserted if it's not in the array
+ *
+ *  \retval 1 found
+ *  \retval 0 not found
+ */
+static int DeStateSearchPos(const DetectEngineStateDirection *dir_state,
+                            SigIntId num, SigIntId *pos)
+{
+    SigIntId lo = 0;
+    SigIntId hi = dir_state->cnt;
+
+    /* items are usually appended in sid order */
+    if (hi > 0 && dir_state->store[hi - 1].sid < num) {
+        *pos = hi;
+        return 0;
+    }
+
+    while (lo < hi) {
+        SigIntId mid = lo + (hi - lo) / 2;
+        if (dir_state->store[mid].sid < num)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *pos = lo;
+    return (lo < dir_state->cnt && dir_state->store[lo].sid == num);
+}
+
 static int DeStateSearchState(DetectEngineState *state, uint8_t direction, SigIntId num)
 {
     DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
-    DeStateStore *tx_store = dir_state->head;
-    SigIntId store_cnt;
-    SigIntId state_cnt = 0;
+    SigIntId pos;
 
-    for (; tx_store != NULL; tx_store = tx_store->next) {
-        SCLogDebug("tx_store %p", tx_store);
-        for (store_cnt = 0;
-             store_cnt < DE_STATE_CHUNK_SIZE && state_cnt < dir_state->cnt;
-             store_cnt++, state_cnt++)
-        {
-            DeStateStoreItem *item = &tx_store->store[store_cnt];
-            if (item->sid == num) {
-                SCLogDebug("sid %u already in state: %p %p %p %u %u, direction %s",
-                            num, state, dir_state, tx_store, state_cnt,
-                            store_cnt, direction & STREAM_TOSERVER ? "toserver" : "toclient");
-                return 1;
-            }
-        }
+    if (DeStateSearchPos(dir_state, num, &pos) == 1) {
+        SCLogDebug("sid %u already in state: %p %p %u, direction %s",
+                    num, state, dir_state, pos,
+                    direction & STREAM_TOSERVER ? "toserver" : "toclient");
+        return 1;
     }
     return 0;
 }
 
 static void DeStateSignatureAppend(DetectEngineState *state, Signature *s, uint32_t inspect_flags, uint8_t direction)
 {
-    int jump = 0;
-    int i = 0;
     DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
+    SigIntId pos;
 
 #ifdef DEBUG_VALIDATION
     BUG_ON(DeStateSearchState(state, direction, s->num));
 #endif
-    DeStateStore *store = dir_state->head;
+    (void)DeStateSearchPos(dir_state, s->num, &pos);
 
-    if (store == NULL) {
-        store = DeStateStoreAlloc();
-        if (store != NULL) {
-            dir_state->head = store;
-            dir_state->tail = store;
-        }
-    } else {
-        jump = dir_state->cnt / DE_STATE_CHUNK_SIZE;
-        for (i = 0; i < jump; i++) {
-            store = store->next;
-        }
-        if (store == NULL) {
-            store = DeStateStoreAlloc();
-            if (store != NULL) {
-                dir_state->tail->next = store;
-                dir_state->tail = store;
-            }
-        }
+    if (dir_state->cnt == dir_state->size) {
+        SigIntId size = dir_state->size ? dir_state->size * 2 : DE_STATE_CHUNK_SIZE + 1;
+        DeStateStoreItem *store = SCRealloc(dir_state->store, size * sizeof(DeStateStoreItem));
+        if (unlikely(store == NULL))
+            return;
+        dir_state->store = store;
+        dir_state->size = size;
     }
 
-    if (store == NULL)
-        return;
-
-    SigIntId idx = dir_state->cnt++ % DE_STATE_CHUNK_SIZE;
-    store->store[idx].sid = s->num;
-    store->store[idx].flags = inspect_flags;
+    if (pos < dir_state->cnt) {
+        memmove(&dir_state->store[pos + 1], &dir_state->store[pos],
+                (dir_state->cnt - pos) * sizeof(DeStateStoreItem));
+    }
+    dir_state->store[pos].sid = s->num;
+    dir_state->store[pos].flags = inspect_flags;
+    dir_state->cnt++;
 
     return;
 }
@@ -285,17 +286,11 @@ DetectEngineStateFlow *DetectEngineStateFlowAlloc(void)
 
 void DetectEngineStateFree(DetectEngineState *state)
 {
-    DeStateStore *store;
-    DeStateStore *store_next;
     int i = 0;
 
     for (i = 0; i < 2; i++) {
-        store = state->dir_state[i].head;
-        while (store != NULL) {
-            store_next = store->next;
-            SCFree(store);
-            store = store_next;
-        }
+        if (state->dir_state[i].store != NULL)
+            SCFree(state->dir_state[i].store);
     }
     SCFree(state);
 
@@ -523,6 +518,7 @@ int DeStateDetectStartDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
             det_ctx->tx_id = tx_id;
             det_ctx->tx_id_set = 1;
 
+            const int tx_progress = AppLayerParserGetStateProgress(f->proto, alproto, tx, flags);
             DetectEngineAppInspectionEngine *engine = app_inspection_engine[f->protomap][alproto][direction];
             SCLogDebug("engine %p", engine);
             inspect_flags = 0;
@@ -530,6 +526,10 @@ int DeStateDetectStartDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
                 SCLogDebug("engine %p", engine);
                 SCLogDebug("inspect_flags %x", inspect_flags);
                 if (s->sm_lists[engine->sm_list] != NULL) {
+                    /* tx not far enough along for this engine: no match */
+                    if (tx_progress < engine->progress)
+                        break;
+
                     KEYWORD_PROFILING_SET_LIST(det_ctx, engine->sm_list);
                     int match = engine->Callback(tv, de_ctx, det_ctx, s, f,
                                              flags, alstate,
@@ -576,7 +576,7 @@ int DeStateDetectStartDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
 
             /* if this is the last tx in our list, and it's incomplete: then
              * we store the state so that ContinueDetection knows about it */
-            int tx_is_done = (AppLayerParserGetStateProgress(f->proto, alproto, tx, flags) >=
+            int tx_is_done = (tx_progress >=
                     AppLayerParserGetStateProgressCompletionStatus(alproto, flags));
             /* see if we need to consider the next tx in our decision to add
              * a sig to the 'no inspect array'. */
@@ -731,7 +731,8 @@ static int DoInspectItem(ThreadVars *tv,
     const uint64_t inspect_tx_id, const uint64_t total_txs,
 
     uint16_t *file_no_match, int inprogress, // is current tx in progress?
-    const int next_tx_no_progress)                // tx after current is still dormant
+    const int next_tx_no_progress,               // tx after current is still dormant
+    const int tx_progress)                       // progress of the current tx
 {
     Signature *s = de_ctx->sig_array[item->sid];
 
@@ -854,6 +855,10 @@ static int DoInspectItem(ThreadVars *tv,
         if (!(item->flags & engine->inspect_flags) &&
                 s->sm_lists[engine->sm_list] != NULL)
         {
+            /* tx not far enough along for this engine: no match */
+            if (tx_progress < engine->progress)
+                break;
+
             SCLogDebug("inspect_flags %x", inspect_flags);
             KEYWORD_PROFILING_SET_LIST(det_ctx, engine->sm_list);
             int match = engine->Callback(tv, de_ctx, det_ctx, s, f,
@@ -1080,9 +1085,9 @@ void DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
             int next_tx_no_progress = 0;
             void *inspect_tx = AppLayerParserGetTx(f->proto, alproto, alstate, inspect_tx_id);
             if (inspect_tx != NULL) {
-                int a = AppLayerParserGetStateProgress(f->proto, alproto, inspect_tx, flags);
+                int tx_progress = AppLayerParserGetStateProgress(f->proto, alproto, inspect_tx, flags);
                 int b = AppLayerParserGetStateProgressCompletionStatus(alproto, flags);
-                if (a < b) {
+                if (tx_progress < b) {
                     inspect_tx_inprogress = 1;
                 }
                 SCLogDebug("tx %"PRIu64" (%"PRIu64") => %s", inspect_tx_id, total_txs,
@@ -1094,7 +1099,6 @@ void DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
                     continue;
                 }
                 DetectEngineStateDirection *tx_dir_state = &tx_de_state->dir_state[direction];
-                DeStateStore *tx_store = tx_dir_state->head;
 
                 SCLogDebug("tx_dir_state->filestore_cnt %u", tx_dir_state->filestore_cnt);
 
@@ -1111,23 +1115,17 @@ void DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
                 }
 
                 /* Loop through stored 'items' (stateful rules) and inspect them */
-                state_cnt = 0;
-                for (; tx_store != NULL; tx_store = tx_store->next) {
-                    SCLogDebug("tx_store %p", tx_store);
-                    for (store_cnt = 0;
-                            store_cnt < DE_STATE_CHUNK_SIZE && state_cnt < tx_dir_state->cnt;
-                            store_cnt++, state_cnt++)
-                    {
-                        DeStateStoreItem *item = &tx_store->store[store_cnt];
-                        int r = DoInspectItem(tv, de_ctx, det_ctx,
-                                item, tx_dir_state->flags,
-                                p, f, alproto, flags,
-                                inspect_tx_id, total_txs,
-                                &file_no_match, inspect_tx_inprogress, next_tx_no_progress);
-                        if (r < 0) {
-                            SCLogDebug("failed");
-                            goto end;
-                        }
+                for (state_cnt = 0; state_cnt < tx_dir_state->cnt; state_cnt++) {
+                    DeStateStoreItem *item = &tx_dir_state->store[state_cnt];
+                    int r = DoInspectItem(tv, de_ctx, det_ctx,
+                            item, tx_dir_state->flags,
+                            p, f, alproto, flags,
+                            inspect_tx_id, total_txs,
+                            &file_no_match, inspect_tx_inprogress, next_tx_no_progress,
+                            tx_progress);
+                    if (r < 0) {
+                        SCLogDebug("failed");
+                        goto end;
                     }
                 }
 
@@ -1148,6 +1146,7 @@ void DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
         DetectEngineStateDirectionFlow *dir_state = &f->de_state->dir_state[direction];
         DeStateStoreFlowRules *store = dir_state->head;
         /* Loop through stored 'items' (stateful rules) and inspect them */
+        state_cnt = 0;
         for (; store != NULL; store = store->next) {
             for (store_cnt = 0;
                     store_cnt < DE_STATE_CHUNK_SIZE && state_cnt < dir_state->cnt;
@@ -1249,8 +1248,6 @@ static int DeStateTest01(void)
 {
     SCLogDebug("sizeof(DetectEngineState)\t\t%"PRIuMAX,
             (uintmax_t)sizeof(DetectEngineState));
-    SCLogDebug("sizeof(DeStateStore)\t\t\t%"PRIuMAX,
-            (uintmax_t)sizeof(DeStateStore));
     SCLogDebug("sizeof(DeStateStoreItem)\t\t%"PRIuMAX"",
             (uintmax_t)sizeof(DeStateStoreItem));
 
@@ -1307,27 +1304,24 @@ static int DeStateTest02(void)
     s.num = 166;
     DeStateSignatureAppend(state, &s, 0, direction);
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head == NULL) {
-        goto end;
-    }
-
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].sid != 11) {
+    DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
+    if (dir_state->store == NULL || dir_state->cnt != 17) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next == NULL) {
+    if (dir_state->store[1].sid != 11) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[14].sid != 144) {
+    if (dir_state->store[14].sid != 144) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next->store[0].sid != 155) {
+    if (dir_state->store[15].sid != 155) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next->store[1].sid != 166) {
+    if (dir_state->store[16].sid != 166) {
         goto end;
     }
 
@@ -1359,23 +1353,23 @@ static int DeStateTest03(void)
     s.num = 22;
     DeStateSignatureAppend(state, &s, DE_STATE_FLAG_URI_INSPECT, direction);
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head == NULL) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store == NULL) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[0].sid != 11) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[0].sid != 11) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[0].flags & DE_STATE_FLAG_URI_INSPECT) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[0].flags & DE_STATE_FLAG_URI_INSPECT) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].sid != 22) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[1].sid != 22) {
         goto end;
     }
 
-    if (!(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].flags & DE_STATE_FLAG_URI_INSPECT)) {
+    if (!(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[1].flags & DE_STATE_FLAG_URI_INSPECT)) {
         goto end;
     }
 
@@ -1387,6 +1381,40 @@ end:
     return result;
 }
 
+/** \test out of order appends keep the items sorted */
+static int DeStateTest04(void)
+{
+    DetectEngineState *state = DetectEngineStateAlloc();
+    FAIL_IF_NULL(state);
+
+    Signature s;
+    memset(&s, 0x00, sizeof(s));
+
+    uint8_t direction = STREAM_TOSERVER;
+    SigIntId nums[] = { 40, 10, 30, 50, 20 };
+    uint32_t i;
+    for (i = 0; i < sizeof(nums) / sizeof(nums[0]); i++) {
+        s.num = nums[i];
+        DeStateSignatureAppend(state, &s, (uint32_t)nums[i], direction);
+    }
+
+    DetectEngineStateDirection *dir_state = &state->dir_state[0];
+    FAIL_IF_NOT(dir_state->cnt == 5);
+    for (i = 0; i < dir_state->cnt; i++) {
+        FAIL_IF_NOT(dir_state->store[i].sid == (i + 1) * 10);
+        FAIL_IF_NOT(dir_state->store[i].flags == (i + 1) * 10);
+    }
+
+    FAIL_IF_NOT(DeStateSearchState(state, direction, 30));
+    FAIL_IF(DeStateSearchState(state, direction, 35));
+    FAIL_IF(DeStateSearchState(state, direction, 5));
+    FAIL_IF(DeStateSearchState(state, direction, 55));
+    FAIL_IF(DeStateSearchState(state, STREAM_TOCLIENT, 30));
+
+    DetectEngineStateFree(state);
+    PASS;
+}
+
 static int DeStateSigTest01(void)
 {
     int result = 0;
@@ -1649,7 +1677,7 @@ static int DeStateSigTest02(void)
     }
     DetectEngineState *tx_de_state = AppLayerParserGetTxDetectState(IPPROTO_TCP, ALPROTO_HTTP, tx);
     if (tx_de_state == NULL || tx_de_state->dir_state[0].cnt != 1 ||
-        tx_de_state->dir_state[0].head->store[0].flags != 0x00000001) {
+        tx_de_state->dir_state[0].store[0].flags != 0x00000001) {
         printf("de_state not present or has unexpected content: ");
         goto end;
     }
@@ -2402,6 +2430,7 @@ void DeStateRegisterTests(void)
     UtRegisterTest("DeStateTest01", DeStateTest01);
     UtRegisterTest("DeStateTest02", DeStateTest02);
     UtRegisterTest("DeStateTest03", DeStateTest03);
+    UtRegisterTest("DeStateTest04", DeStateTest04);
     UtRegisterTest("DeStateSigTest01", DeStateSigTest01);
     UtRegisterTest("DeStateSigTest02", DeStateSigTest02);
     UtRegisterTest("DeStateSigTest03", DeStateSigTest03);
@@ -59,7 +59,8 @@
  *  more files that have ongoing inspection. */
 #define DETECT_ENGINE_INSPECT_SIG_MATCH_MORE_FILES 4
 
-/** number of DeStateStoreItem's in one DeStateStore object */
+/** number of DeStateStoreFlowRule's in one DeStateStoreFlowRules object,
+ *  also the initial size of the tx item array */
 #define DE_STATE_CHUNK_SIZE             15
 
 /* per sig flags */
@@ -121,14 +122,9 @@ typedef struct DeStateStoreItem_ {
     SigIntId sid;
 } DeStateStoreItem;
 
-typedef struct DeStateStore_ {
-    DeStateStoreItem store[DE_STATE_CHUNK_SIZE];
-    struct DeStateStore_ *next;
-} DeStateStore;
-
 typedef struct DetectEngineStateDirection_ {
-    DeStateStore *head;
-    DeStateStore *tail;
+    DeStateStoreItem *store;    /**< items sorted by sid */
+    SigIntId size;              /**< number of items allocated */
     SigIntId cnt;
     uint16_t filestore_cnt;
     uint8_t flags;
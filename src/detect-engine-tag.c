@@ -45,14 +45,29 @@
 SC_ATOMIC_DECLARE(unsigned int, num_tags);  /**< Atomic counter, to know if we
                                                  have tagged hosts/sessions,
                                                  to avoid locking */
+SC_ATOMIC_DECLARE(unsigned int, num_host_tags); /**< Part of num_tags that is
+                                                     set on hosts, so that we
+                                                     can skip the host lookups
+                                                     if only flows are tagged */
 static int host_tag_id = -1;                /**< Host storage id for tags */
 static int flow_tag_id = -1;                /**< Flow storage id for tags */
 
+/** \brief free the tag list of a host, keeping num_host_tags in sync */
+static void TagHostDataListFree(void *ptr)
+{
+    DetectTagDataEntry *entry = ptr;
+    for ( ; entry != NULL; entry = entry->next) {
+        (void) SC_ATOMIC_SUB(num_host_tags, 1);
+    }
+    DetectTagDataListFree(ptr);
+}
+
 void TagInitCtx(void)
 {
     SC_ATOMIC_INIT(num_tags);
+    SC_ATOMIC_INIT(num_host_tags);
 
-    host_tag_id = HostStorageRegister("tag", sizeof(void *), NULL, DetectTagDataListFree);
+    host_tag_id = HostStorageRegister("tag", sizeof(void *), NULL, TagHostDataListFree);
     if (host_tag_id == -1) {
         SCLogError(SC_ERR_HOST_INIT, "Can't initiate host storage for tag");
         exit(EXIT_FAILURE);
@@ -74,8 +89,10 @@ void TagDestroyCtx(void)
 {
 #ifdef DEBUG
     BUG_ON(SC_ATOMIC_GET(num_tags) != 0);
+    BUG_ON(SC_ATOMIC_GET(num_host_tags) != 0);
 #endif
     SC_ATOMIC_DESTROY(num_tags);
+    SC_ATOMIC_DESTROY(num_host_tags);
 }
 
 /** \brief Reset the tagging engine context
@@ -208,6 +225,7 @@ int TagHashAddTag(DetectTagDataEntry *tde, Packet *p)
         if (new_tde != NULL) {
             HostSetStorageById(host, host_tag_id, new_tde);
             (void) SC_ATOMIC_ADD(num_tags, 1);
+            (void) SC_ATOMIC_ADD(num_host_tags, 1);
             SCLogDebug("host tag added");
         }
     } else {
@@ -240,6 +258,7 @@ int TagHashAddTag(DetectTagDataEntry *tde, Packet *p)
             DetectTagDataEntry *new_tde = DetectTagDataCopy(tde);
             if (new_tde != NULL) {
                 (void) SC_ATOMIC_ADD(num_tags, 1);
+                (void) SC_ATOMIC_ADD(num_host_tags, 1);
 
                 new_tde->next = tag;
                 HostSetStorageById(host, host_tag_id, new_tde);
@@ -413,12 +432,14 @@ void TagHandlePacketHost(Host *host, Packet *p)
                             iter = iter->next;
                             SCFree(tde);
                             (void) SC_ATOMIC_SUB(num_tags, 1);
+                            (void) SC_ATOMIC_SUB(num_host_tags, 1);
                             continue;
                         } else {
                             tde = iter;
                             iter = iter->next;
                             SCFree(tde);
                             (void) SC_ATOMIC_SUB(num_tags, 1);
+                            (void) SC_ATOMIC_SUB(num_host_tags, 1);
                             HostSetStorageById(host, host_tag_id, iter);
                             continue;
                         }
@@ -439,12 +460,14 @@ void TagHandlePacketHost(Host *host, Packet *p)
                             iter = iter->next;
                             SCFree(tde);
                             (void) SC_ATOMIC_SUB(num_tags, 1);
+                            (void) SC_ATOMIC_SUB(num_host_tags, 1);
                             continue;
                         } else {
                             tde = iter;
                             iter = iter->next;
                             SCFree(tde);
                             (void) SC_ATOMIC_SUB(num_tags, 1);
+                            (void) SC_ATOMIC_SUB(num_host_tags, 1);
                             HostSetStorageById(host, host_tag_id, iter);
                             continue;
                         }
@@ -469,12 +492,14 @@ void TagHandlePacketHost(Host *host, Packet *p)
                             iter = iter->next;
                             SCFree(tde);
                             (void) SC_ATOMIC_SUB(num_tags, 1);
+                            (void) SC_ATOMIC_SUB(num_host_tags, 1);
                             continue;
                         } else {
                             tde = iter;
                             iter = iter->next;
                             SCFree(tde);
                             (void) SC_ATOMIC_SUB(num_tags, 1);
+                            (void) SC_ATOMIC_SUB(num_host_tags, 1);
                             HostSetStorageById(host, host_tag_id, iter);
                             continue;
                         }
@@ -517,6 +542,10 @@ void TagHandlePacket(DetectEngineCtx *de_ctx,
         TagHandlePacketFlow(p->flow, p);
     }
 
+    /* only flows are tagged, no need to look up the hosts */
+    if (SC_ATOMIC_GET(num_host_tags) == 0)
+        SCReturn;
+
     Host *src = HostLookupHostFromHash(&p->src);
     if (src) {
         if (TagHostHasTag(src)) {
@@ -573,6 +602,7 @@ int TagTimeoutCheck(Host *host, struct timeval *tv)
 
             SCFree(tde);
             (void) SC_ATOMIC_SUB(num_tags, 1);
+            (void) SC_ATOMIC_SUB(num_host_tags, 1);
         } else {
             HostSetStorageById(host, host_tag_id, tmp->next);
 
@@ -581,6 +611,7 @@ int TagTimeoutCheck(Host *host, struct timeval *tv)
 
             SCFree(tde);
             (void) SC_ATOMIC_SUB(num_tags, 1);
+            (void) SC_ATOMIC_SUB(num_host_tags, 1);
         }
     }
     return retval;
@@ -1495,6 +1526,52 @@ end:
     return result;
 }
 
+/**
+ * \test host tags are counted in num_host_tags, flow-only tagging
+ *       leaves it at 0 so TagHandlePacket skips the host lookups
+ */
+static int DetectTagTestPacket08 (void)
+{
+    StorageInit();
+    TagInitCtx();
+    StorageFinalize();
+    HostInitConfig(1);
+
+    Packet *p = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP,
+                                   "192.168.1.5", "192.168.1.1",
+                                   41424, 80);
+    FAIL_IF_NULL(p);
+
+    DetectTagDataEntry tde;
+    memset(&tde, 0, sizeof(tde));
+    tde.sid = 1;
+    tde.gid = 1;
+    tde.flags = TAG_ENTRY_FLAG_DIR_SRC;
+    tde.metric = DETECT_TAG_METRIC_PACKET;
+    tde.count = 10;
+
+    FAIL_IF(SC_ATOMIC_GET(num_host_tags) != 0);
+    FAIL_IF(TagHashAddTag(&tde, p) != 0);
+    /* same sid/gid updates the existing entry */
+    FAIL_IF(TagHashAddTag(&tde, p) != 1);
+    FAIL_IF(SC_ATOMIC_GET(num_host_tags) != 1);
+    tde.sid = 2;
+    FAIL_IF(TagHashAddTag(&tde, p) != 0);
+    FAIL_IF(SC_ATOMIC_GET(num_host_tags) != 2);
+    FAIL_IF(SC_ATOMIC_GET(num_tags) != 2);
+
+    UTHFreePacket(p);
+
+    /* freeing the host storage drops the counts */
+    HostShutdown();
+    FAIL_IF(SC_ATOMIC_GET(num_host_tags) != 0);
+    FAIL_IF(SC_ATOMIC_GET(num_tags) != 0);
+
+    TagDestroyCtx();
+    StorageCleanup();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -1510,6 +1587,7 @@ void DetectEngineTagRegisterTests(void)
     UtRegisterTest("DetectTagTestPacket05", DetectTagTestPacket05);
     UtRegisterTest("DetectTagTestPacket06", DetectTagTestPacket06);
     UtRegisterTest("DetectTagTestPacket07", DetectTagTestPacket07);
+    UtRegisterTest("DetectTagTestPacket08", DetectTagTestPacket08);
 #endif /* UNITTESTS */
 }
 
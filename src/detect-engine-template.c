@@ -43,6 +43,10 @@ int DetectEngineInspectTemplateBuffer(ThreadVars *tv, DetectEngineCtx *de_ctx,
     TemplateTransaction *tx = (TemplateTransaction *)txv;
     int ret = 0;
 
+    det_ctx->discontinue_matching = 0;
+    det_ctx->buffer_offset = 0;
+    det_ctx->inspection_recursion_counter = 0;
+
     if (flags & STREAM_TOSERVER && tx->request_buffer != NULL) {
         ret = DetectEngineContentInspection(de_ctx, det_ctx, s,
             s->sm_lists[DETECT_SM_LIST_TEMPLATE_BUFFER_MATCH], f,
@@ -0,0 +1,359 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per tenant accounting, see detect-engine-tenant.h
+ *
+ * The blocks are read as they are while their threads write them, so a
+ * dump may miss the packet being inspected at the time. When a det_ctx
+ * goes away, on a reload or at shutdown, its counts are kept in the
+ * retired totals of its tenant, so the counters only go up.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "threads.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-engine-tenant.h"
+
+#define DETECT_TENANT_SAMPLE_RATE 100
+
+uint32_t detect_tenant_sample_rate = DETECT_TENANT_SAMPLE_RATE;
+static int detect_tenant_enabled = 0;
+
+static DetectTenantThread *detect_tenant_list = NULL;
+/** counts of the det_ctxs that are gone, by tenant */
+static DetectTenantStats *detect_tenant_retired = NULL;
+static uint32_t detect_tenant_retired_cnt = 0;
+static SCMutex detect_tenant_lock = SCMUTEX_INITIALIZER;
+
+/**
+ * \brief read the multi-detect.accounting config
+ *
+ * Accounting is on by default in multi tenant mode.
+ */
+void DetectTenantSetup(void)
+{
+    ConfNode *node = ConfGetNode("multi-detect.accounting");
+    int enabled = 1;
+    if (node != NULL && ConfGetChildValueBool(node, "enabled", &enabled) == 1 &&
+            !enabled)
+        return;
+
+    intmax_t v;
+    if (node != NULL && ConfGetChildValueInt(node, "sample-rate", &v) == 1) {
+        if (v < 0 || v > UINT32_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "multi-detect.accounting.sample-rate %"PRIdMAX", "
+                    "using %u", v, DETECT_TENANT_SAMPLE_RATE);
+        } else {
+            detect_tenant_sample_rate = (uint32_t)v;
+        }
+    }
+
+    detect_tenant_enabled = 1;
+    if (detect_tenant_sample_rate != 0) {
+        SCLogConfig("tenant accounting: timing 1 in %u packets",
+                detect_tenant_sample_rate);
+    } else {
+        SCLogConfig("tenant accounting: not timing packets");
+    }
+}
+
+void DetectTenantShutdown(void)
+{
+    SCMutexLock(&detect_tenant_lock);
+    if (detect_tenant_retired != NULL)
+        SCFree(detect_tenant_retired);
+    detect_tenant_retired = NULL;
+    detect_tenant_retired_cnt = 0;
+    SCMutexUnlock(&detect_tenant_lock);
+}
+
+/**
+ * \brief set up the block of a tenant det_ctx
+ *
+ * Called when the det_ctx is created, after the engine it uses is built.
+ */
+void DetectTenantThreadSetup(DetectEngineThreadCtx *det_ctx)
+{
+    if (!detect_tenant_enabled || det_ctx->tenant_id == 0)
+        return;
+
+    DetectTenantThread *t = SCCalloc(1, sizeof(*t));
+    if (unlikely(t == NULL))
+        return;
+    t->tenant_id = det_ctx->tenant_id;
+    if (det_ctx->de_ctx != NULL)
+        t->engine_memuse = det_ctx->de_ctx->memuse;
+    t->thread_memuse = det_ctx->memuse;
+
+    SCMutexLock(&detect_tenant_lock);
+    t->next = detect_tenant_list;
+    detect_tenant_list = t;
+    SCMutexUnlock(&detect_tenant_lock);
+
+    det_ctx->tenant_stats = t;
+}
+
+static void DetectTenantCountsAdd(DetectTenantCounts *dst,
+        const DetectTenantCounts *src)
+{
+    dst->packets += src->packets;
+    dst->alerts += src->alerts;
+    dst->mpm_matches += src->mpm_matches;
+    dst->sampled += src->sampled;
+    dst->ticks += src->ticks;
+}
+
+/** \internal
+ *  \brief add the counts of 't' to the retired totals of its tenant.
+ *         Call with the lock. */
+static void DetectTenantRetire(const DetectTenantThread *t)
+{
+    uint32_t i;
+    for (i = 0; i < detect_tenant_retired_cnt; i++) {
+        if (detect_tenant_retired[i].tenant_id == t->tenant_id)
+            break;
+    }
+    if (i == detect_tenant_retired_cnt) {
+        DetectTenantStats *r = SCRealloc(detect_tenant_retired,
+                (i + 1) * sizeof(DetectTenantStats));
+        if (unlikely(r == NULL))
+            return;
+        detect_tenant_retired = r;
+        memset(&r[i], 0, sizeof(DetectTenantStats));
+        r[i].tenant_id = t->tenant_id;
+        detect_tenant_retired_cnt++;
+    }
+    DetectTenantCountsAdd(&detect_tenant_retired[i].c, &t->c);
+}
+
+/**
+ * \brief drop the block of a det_ctx that goes away, keeping its counts
+ */
+void DetectTenantThreadCleanup(DetectEngineThreadCtx *det_ctx)
+{
+    DetectTenantThread *t = det_ctx->tenant_stats;
+    if (t == NULL)
+        return;
+
+    SCMutexLock(&detect_tenant_lock);
+    DetectTenantThread **prev = &detect_tenant_list;
+    while (*prev != NULL && *prev != t)
+        prev = &(*prev)->next;
+    if (*prev != NULL)
+        *prev = t->next;
+    DetectTenantRetire(t);
+    SCMutexUnlock(&detect_tenant_lock);
+
+    SCFree(t);
+    det_ctx->tenant_stats = NULL;
+}
+
+static int DetectTenantCompare(const void *a, const void *b)
+{
+    const DetectTenantStats *x = a, *y = b;
+    if (x->tenant_id != y->tenant_id)
+        return x->tenant_id < y->tenant_id ? -1 : 1;
+    return 0;
+}
+
+/**
+ * \brief add up the blocks and the retired totals per tenant
+ *
+ * The engine memory is that of the newest engine, the det_ctx memory the
+ * sum over the threads. While a tenant is reloaded both engines count.
+ *
+ * \param stats set to the totals by tenant id, caller frees
+ * \retval cnt number of tenants, 0 if there are none or on error
+ */
+uint32_t DetectTenantGetStats(DetectTenantStats **stats)
+{
+    const DetectTenantThread *t;
+    uint32_t n = 0, i;
+
+    *stats = NULL;
+
+    SCMutexLock(&detect_tenant_lock);
+    uint32_t total = detect_tenant_retired_cnt;
+    for (t = detect_tenant_list; t != NULL; t = t->next)
+        total++;
+    if (total == 0) {
+        SCMutexUnlock(&detect_tenant_lock);
+        return 0;
+    }
+
+    DetectTenantStats *s = SCCalloc(total, sizeof(DetectTenantStats));
+    if (unlikely(s == NULL)) {
+        SCMutexUnlock(&detect_tenant_lock);
+        return 0;
+    }
+    for (i = 0; i < detect_tenant_retired_cnt; i++)
+        s[n++] = detect_tenant_retired[i];
+    for (t = detect_tenant_list; t != NULL; t = t->next, n++) {
+        s[n].tenant_id = t->tenant_id;
+        s[n].c = t->c;
+        s[n].engine_memuse = t->engine_memuse;
+        s[n].thread_memuse = t->thread_memuse;
+    }
+    SCMutexUnlock(&detect_tenant_lock);
+
+    qsort(s, n, sizeof(DetectTenantStats), DetectTenantCompare);
+    uint32_t m = 0;
+    for (i = 0; i < n; i++) {
+        if (m > 0 && s[m - 1].tenant_id == s[i].tenant_id) {
+            DetectTenantCountsAdd(&s[m - 1].c, &s[i].c);
+            s[m - 1].thread_memuse += s[i].thread_memuse;
+            if (s[i].engine_memuse > s[m - 1].engine_memuse)
+                s[m - 1].engine_memuse = s[i].engine_memuse;
+        } else {
+            s[m++] = s[i];
+        }
+    }
+    for (i = 0; i < m; i++) {
+        if (s[i].c.sampled > 0)
+            s[i].ticks_estimate = (s[i].c.ticks / s[i].c.sampled) * s[i].c.packets;
+    }
+
+    *stats = s;
+    return m;
+}
+
+#ifdef HAVE_LIBJANSSON
+/**
+ * \brief the totals per tenant for the stats, NULL if there are none
+ */
+json_t *DetectTenantToJSON(void)
+{
+    DetectTenantStats *s;
+    uint32_t n = DetectTenantGetStats(&s);
+    if (n == 0)
+        return NULL;
+
+    json_t *js = json_array();
+    if (unlikely(js == NULL)) {
+        SCFree(s);
+        return NULL;
+    }
+
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        json_t *jt = json_object();
+        if (unlikely(jt == NULL))
+            break;
+        json_object_set_new(jt, "tenant_id", json_integer(s[i].tenant_id));
+        json_object_set_new(jt, "packets", json_integer(s[i].c.packets));
+        json_object_set_new(jt, "alerts", json_integer(s[i].c.alerts));
+        json_object_set_new(jt, "mpm_matches", json_integer(s[i].c.mpm_matches));
+        json_object_set_new(jt, "ticks", json_integer(s[i].ticks_estimate));
+        json_object_set_new(jt, "ticks_sampled", json_integer(s[i].c.ticks));
+        json_object_set_new(jt, "packets_sampled", json_integer(s[i].c.sampled));
+        json_object_set_new(jt, "engine_memuse", json_integer(s[i].engine_memuse));
+        json_object_set_new(jt, "thread_memuse", json_integer(s[i].thread_memuse));
+        json_array_append_new(js, jt);
+    }
+
+    SCFree(s);
+    return js;
+}
+#endif /* HAVE_LIBJANSSON */
+
+#ifdef UNITTESTS
+/** \test counts of the threads of a tenant add up, and are kept when
+ *        a det_ctx goes away */
+static int DetectTenantTest01(void)
+{
+    DetectEngineCtx de_ctx;
+    DetectEngineThreadCtx *det_ctx1 = SCCalloc(1, sizeof(DetectEngineThreadCtx));
+    DetectEngineThreadCtx *det_ctx2 = SCCalloc(1, sizeof(DetectEngineThreadCtx));
+    FAIL_IF_NULL(det_ctx1);
+    FAIL_IF_NULL(det_ctx2);
+
+    int enabled = detect_tenant_enabled;
+    uint32_t rate = detect_tenant_sample_rate;
+    detect_tenant_enabled = 1;
+    detect_tenant_sample_rate = 2;
+
+    memset(&de_ctx, 0, sizeof(de_ctx));
+    de_ctx.memuse = 1000;
+    det_ctx1->de_ctx = det_ctx2->de_ctx = &de_ctx;
+    det_ctx1->tenant_id = det_ctx2->tenant_id = 7;
+    det_ctx1->memuse = det_ctx2->memuse = 10;
+
+    DetectTenantThreadSetup(det_ctx1);
+    DetectTenantThreadSetup(det_ctx2);
+    FAIL_IF_NULL(det_ctx1->tenant_stats);
+    FAIL_IF_NULL(det_ctx2->tenant_stats);
+
+    int i;
+    for (i = 0; i < 4; i++) {
+        uint64_t start = DetectTenantPacketStart(det_ctx1->tenant_stats);
+        FAIL_IF((i % 2 == 1) != (start != 0));
+        DetectTenantPacketEnd(det_ctx1->tenant_stats, start);
+    }
+    det_ctx1->tenant_stats->c.alerts = 3;
+    DetectTenantPacketEnd(det_ctx2->tenant_stats,
+            DetectTenantPacketStart(det_ctx2->tenant_stats));
+
+    DetectTenantStats *s;
+    FAIL_IF(DetectTenantGetStats(&s) != 1);
+    FAIL_IF(s[0].tenant_id != 7);
+    FAIL_IF(s[0].c.packets != 5);
+    FAIL_IF(s[0].c.sampled != 2);
+    FAIL_IF(s[0].c.alerts != 3);
+    FAIL_IF(s[0].engine_memuse != 1000);
+    FAIL_IF(s[0].thread_memuse != 20);
+    SCFree(s);
+
+    DetectTenantThreadCleanup(det_ctx1);
+    FAIL_IF_NOT_NULL(det_ctx1->tenant_stats);
+    FAIL_IF(DetectTenantGetStats(&s) != 1);
+    FAIL_IF(s[0].c.packets != 5);
+    FAIL_IF(s[0].c.alerts != 3);
+    FAIL_IF(s[0].thread_memuse != 10);
+    SCFree(s);
+
+    DetectTenantThreadCleanup(det_ctx2);
+    FAIL_IF(DetectTenantGetStats(&s) != 1);
+    FAIL_IF(s[0].c.packets != 5);
+    FAIL_IF(s[0].engine_memuse != 0);
+    SCFree(s);
+
+    DetectTenantShutdown();
+    FAIL_IF(DetectTenantGetStats(&s) != 0);
+
+    detect_tenant_enabled = enabled;
+    detect_tenant_sample_rate = rate;
+    SCFree(det_ctx1);
+    SCFree(det_ctx2);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DetectTenantRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectTenantTest01", DetectTenantTest01);
+#endif
+}
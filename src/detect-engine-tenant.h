@@ -0,0 +1,107 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per tenant accounting in multi tenant mode: the packets, alerts, mpm
+ * candidates, cpu ticks and engine memory of each tenant.
+ *
+ * Each tenant det_ctx of a detect thread counts into a block of its own,
+ * without locking. The detection of 1 in 'sample-rate' packets is timed
+ * and the ticks of all packets are estimated from those. The blocks are
+ * only added up when the stats are asked for.
+ */
+
+#ifndef __DETECT_ENGINE_TENANT_H__
+#define __DETECT_ENGINE_TENANT_H__
+
+#include "util-cpu.h"
+
+struct DetectEngineThreadCtx_;
+
+typedef struct DetectTenantCounts_ {
+    uint64_t packets;
+    uint64_t alerts;
+    uint64_t mpm_matches;   /**< mpm and prefilter candidates */
+    uint64_t sampled;       /**< packets whose detection was timed */
+    uint64_t ticks;         /**< ticks of the timed packets */
+} DetectTenantCounts;
+
+/** counts of a tenant det_ctx, only written by its thread */
+typedef struct DetectTenantThread_ {
+    uint32_t tenant_id;
+    /** packets since the last timed one */
+    uint32_t sample_cnt;
+    DetectTenantCounts c;
+
+    /** memory of the tenant's engine and of this det_ctx */
+    uint64_t engine_memuse;
+    uint64_t thread_memuse;
+
+    struct DetectTenantThread_ *next;
+} DetectTenantThread;
+
+/** totals of a tenant, see DetectTenantGetStats() */
+typedef struct DetectTenantStats_ {
+    uint32_t tenant_id;
+    DetectTenantCounts c;
+    /** ticks of all packets, estimated from the timed ones */
+    uint64_t ticks_estimate;
+    uint64_t engine_memuse;
+    uint64_t thread_memuse;
+} DetectTenantStats;
+
+/** time 1 in detect_tenant_sample_rate packets, 0 to not time any */
+extern uint32_t detect_tenant_sample_rate;
+
+void DetectTenantSetup(void);
+void DetectTenantShutdown(void);
+void DetectTenantThreadSetup(struct DetectEngineThreadCtx_ *det_ctx);
+void DetectTenantThreadCleanup(struct DetectEngineThreadCtx_ *det_ctx);
+
+uint32_t DetectTenantGetStats(DetectTenantStats **stats);
+#ifdef HAVE_LIBJANSSON
+json_t *DetectTenantToJSON(void);
+#endif
+
+void DetectTenantRegisterTests(void);
+
+/**
+ * \brief count a packet for the tenant
+ * \retval ticks at the start of its detection if it's timed, 0 if not
+ */
+static inline uint64_t DetectTenantPacketStart(DetectTenantThread *t)
+{
+    t->c.packets++;
+    if (detect_tenant_sample_rate == 0 ||
+            ++t->sample_cnt < detect_tenant_sample_rate)
+        return 0;
+    t->sample_cnt = 0;
+    return UtilCpuGetTicks();
+}
+
+static inline void DetectTenantPacketEnd(DetectTenantThread *t,
+        uint64_t start)
+{
+    if (start != 0) {
+        t->c.ticks += UtilCpuGetTicks() - start;
+        t->c.sampled++;
+    }
+}
+
+#endif /* __DETECT_ENGINE_TENANT_H__ */
@@ -197,15 +197,28 @@ static inline DetectThresholdEntry *DetectThresholdEntryAlloc(DetectThresholdDat
     SCReturnPtr(ste, "DetectThresholdEntry");
 }
 
+/** \brief find the entry for sid/gid in the host's list
+ *
+ *  A found entry is moved to the front of the list, so that the rules
+ *  that alert most for a host (e.g. a scanner) are found first.
+ *
+ *  \note host must be locked
+ */
 static DetectThresholdEntry *ThresholdHostLookupEntry(Host *h, uint32_t sid, uint32_t gid)
 {
-    DetectThresholdEntry *e;
+    DetectThresholdEntry *head = HostGetStorageById(h, threshold_id);
+    DetectThresholdEntry *e, *prev = NULL;
 
-    for (e = HostGetStorageById(h, threshold_id); e != NULL; e = e->next) {
+    for (e = head; e != NULL; prev = e, e = e->next) {
         if (e->sid == sid && e->gid == gid)
             break;
     }
 
+    if (e != NULL && prev != NULL) {
+        prev->next = e->next;
+        e->next = head;
+        HostSetStorageById(h, threshold_id, e);
+    }
     return e;
 }
 
@@ -629,9 +642,10 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
             HostRelease(dst);
         }
     } else if (td->track == TRACK_RULE) {
-        SCMutexLock(&de_ctx->ths_ctx.threshold_table_lock);
+        SCMutex *m = &de_ctx->ths_ctx.th_entry_lock[s->num % THRESHOLD_RULE_LOCKS];
+        SCMutexLock(m);
         ret = ThresholdHandlePacketRule(de_ctx,p,td,s);
-        SCMutexUnlock(&de_ctx->ths_ctx.threshold_table_lock);
+        SCMutexUnlock(m);
     }
 
     SCReturnInt(ret);
@@ -645,10 +659,13 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
  */
 void ThresholdHashInit(DetectEngineCtx *de_ctx)
 {
-    if (SCMutexInit(&de_ctx->ths_ctx.threshold_table_lock, NULL) != 0) {
-        SCLogError(SC_ERR_MEM_ALLOC,
-                "Threshold: Failed to initialize hash table mutex.");
-        exit(EXIT_FAILURE);
+    int i;
+    for (i = 0; i < THRESHOLD_RULE_LOCKS; i++) {
+        if (SCMutexInit(&de_ctx->ths_ctx.th_entry_lock[i], NULL) != 0) {
+            SCLogError(SC_ERR_MEM_ALLOC,
+                    "Threshold: Failed to initialize rule entry mutex.");
+            exit(EXIT_FAILURE);
+        }
     }
 }
 
@@ -662,7 +679,10 @@ void ThresholdContextDestroy(DetectEngineCtx *de_ctx)
 {
     if (de_ctx->ths_ctx.th_entry != NULL)
         SCFree(de_ctx->ths_ctx.th_entry);
-    SCMutexDestroy(&de_ctx->ths_ctx.threshold_table_lock);
+    int i;
+    for (i = 0; i < THRESHOLD_RULE_LOCKS; i++) {
+        SCMutexDestroy(&de_ctx->ths_ctx.th_entry_lock[i]);
+    }
 }
 
 /**
@@ -74,12 +74,17 @@
 #include "detect-engine-threshold.h"
 
 #include "detect-engine-loader.h"
+#include "detect-engine-fpstats.h"
+#include "detect-engine-guard.h"
+#include "detect-engine-selftest.h"
+#include "detect-engine-tenant.h"
 
 #include "util-classification-config.h"
 #include "util-reference-config.h"
 #include "util-threshold-config.h"
 #include "util-error.h"
 #include "util-hash.h"
+#include "util-hash-lookup3.h"
 #include "util-byte.h"
 #include "util-debug.h"
 #include "util-unittest.h"
@@ -87,6 +92,8 @@
 #include "util-magic.h"
 #include "util-signal.h"
 #include "util-spm.h"
+#include "util-arena.h"
+#include "util-memuse.h"
 
 #include "util-var-name.h"
 
@@ -95,16 +102,23 @@
 
 #ifdef PROFILING
 #include "util-profiling.h"
+#include "util-profiling-sample.h"
 #endif
 
 #include "reputation.h"
 
 #define DETECT_ENGINE_DEFAULT_INSPECTION_RECURSION_LIMIT 3000
 
+/** chunk size of the per thread scratch arena */
+#define DETECT_ENGINE_ARENA_CHUNK_SIZE 65536
+
 static uint32_t detect_engine_ctx_id = 1;
 
 static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
-        ThreadVars *tv, DetectEngineCtx *new_de_ctx, int mt);
+        ThreadVars *tv, DetectEngineCtx *new_de_ctx, int mt,
+        const DetectEngineThreadCtx *scratch);
+static int DetectEngineThreadCtxInitScratch(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineCtx *list);
 
 static int DetectEngineCtxLoadConf(DetectEngineCtx *);
 
@@ -150,6 +164,19 @@ static void DetectEnginePrintAppInspectionEngines(DetectEngineAppInspectionEngin
 
 #endif
 
+static void AppInspectionEngineSetProgress(uint8_t ipproto, AppProto alproto,
+                                           uint16_t dir, int32_t sm_list, int progress,
+                                           DetectEngineAppInspectionEngine *list[][ALPROTO_MAX][2])
+{
+    DetectEngineAppInspectionEngine *engine = list[FlowGetProtoMapping(ipproto)][alproto][dir];
+    for ( ; engine != NULL; engine = engine->next) {
+        if (engine->sm_list == sm_list) {
+            engine->progress = progress;
+            return;
+        }
+    }
+}
+
 void DetectEngineRegisterAppInspectionEngines(void)
 {
     struct tmp_t {
@@ -403,6 +430,30 @@ void DetectEngineRegisterAppInspectionEngines(void)
                                                 app_inspection_engine);
     }
 
+    /* engines that can't inspect anything before the tx reached a
+     * certain progress */
+    struct {
+        uint8_t ipproto;
+        AppProto alproto;
+        uint16_t dir;
+        int32_t sm_list;
+        int progress;
+    } data_progress[] = {
+        { IPPROTO_TCP, ALPROTO_HTTP, 0, DETECT_SM_LIST_HHDMATCH, HTP_REQUEST_HEADERS + 1 },
+        { IPPROTO_TCP, ALPROTO_HTTP, 0, DETECT_SM_LIST_HRHDMATCH, HTP_REQUEST_HEADERS + 1 },
+        { IPPROTO_TCP, ALPROTO_HTTP, 1, DETECT_SM_LIST_HHDMATCH, HTP_RESPONSE_HEADERS + 1 },
+        { IPPROTO_TCP, ALPROTO_HTTP, 1, DETECT_SM_LIST_HRHDMATCH, HTP_RESPONSE_HEADERS + 1 },
+    };
+
+    for (i = 0 ; i < sizeof(data_progress) / sizeof(data_progress[0]); i++) {
+        AppInspectionEngineSetProgress(data_progress[i].ipproto,
+                                       data_progress[i].alproto,
+                                       data_progress[i].dir,
+                                       data_progress[i].sm_list,
+                                       data_progress[i].progress,
+                                       app_inspection_engine);
+    }
+
 #if 0
     DetectEnginePrintAppInspectionEngines(app_inspection_engine);
 #endif
@@ -697,7 +748,7 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
             old_det_ctx[i] = FlowWorkerGetDetectCtxPtr(SC_ATOMIC_GET(slots->slot_data));
             detect_tvs[i] = tv;
 
-            new_det_ctx[i] = DetectEngineThreadCtxInitForReload(tv, new_de_ctx, 1);
+            new_det_ctx[i] = DetectEngineThreadCtxInitForReload(tv, new_de_ctx, 1, NULL);
             if (new_det_ctx[i] == NULL) {
                 SCLogError(SC_ERR_LIVE_RULE_SWAP, "Detect engine thread init "
                            "failure in live rule swap.  Let's get out of here");
@@ -820,6 +871,7 @@ static DetectEngineCtx *DetectEngineCtxInitReal(int minimal, const char *prefix)
         goto error;
 
     memset(de_ctx,0,sizeof(DetectEngineCtx));
+    MemuseAlloc(MEMUSE_DETECT, sizeof(DetectEngineCtx));
 
     if (minimal) {
         de_ctx->minimal = 1;
@@ -951,6 +1003,8 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx)
     VariableNameFreeHash(de_ctx);
     if (de_ctx->sig_array)
         SCFree(de_ctx->sig_array);
+    if (de_ctx->sig_header_array)
+        SCFree(de_ctx->sig_header_array);
 
     SCClassConfDeInitContext(de_ctx);
     SCRConfDeInitContext(de_ctx);
@@ -980,6 +1034,7 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx)
     DetectPortCleanupList(de_ctx->udp_whitelist);
 
     SCFree(de_ctx);
+    MemuseFree(MEMUSE_DETECT, sizeof(DetectEngineCtx));
     //DetectAddressGroupPrintMemory();
     //DetectSigGroupPrintMemory();
     //DetectPortPrintMemory();
@@ -1263,6 +1318,21 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
         }
     }
 
+    de_ctx->prefilter_setting = DETECT_PREFILTER_MPM;
+    char *pf_setting = NULL;
+    if (ConfGet("detect.prefilter.default", &pf_setting) == 1 && pf_setting) {
+        if (strcasecmp(pf_setting, "mpm") == 0) {
+            de_ctx->prefilter_setting = DETECT_PREFILTER_MPM;
+        } else if (strcasecmp(pf_setting, "auto") == 0) {
+            de_ctx->prefilter_setting = DETECT_PREFILTER_AUTO;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "'%s' is not a valid "
+                    "value for detect.prefilter.default, using 'mpm'", pf_setting);
+        }
+    }
+    SCLogConfig("prefilter engines: %s",
+            de_ctx->prefilter_setting == DETECT_PREFILTER_AUTO ? "auto" : "mpm");
+
     return 0;
 error:
     return -1;
@@ -1325,6 +1395,10 @@ static void DetectEngineThreadCtxDeinitKeywords(DetectEngineCtx *de_ctx, DetectE
     }
 }
 
+/* max tenant id for which the tenant thread ctxs are kept in a direct
+ * lookup array, above it the hash is used */
+#define DETECT_ENGINE_MT_ARRAY_MAX  65536
+
 /** NOTE: master MUST be locked before calling this */
 static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThreadCtx *det_ctx)
 {
@@ -1335,6 +1409,8 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
     int max_tenant_id = 0;
     DetectEngineCtx *list = master->list;
     HashTable *mt_det_ctxs_hash = NULL;
+    DetectEngineThreadCtx **mt_det_ctxs = NULL;
+    uint32_t *vlan_map = NULL;
 
     if (master->tenant_selector == TENANT_SELECTOR_UNKNOWN) {
         SCLogError(SC_ERR_MT_NO_SELECTOR, "no tenant selector set: "
@@ -1361,6 +1437,12 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
     } else {
         max_tenant_id++;
 
+        if (max_tenant_id <= DETECT_ENGINE_MT_ARRAY_MAX) {
+            mt_det_ctxs = SCCalloc(max_tenant_id, sizeof(DetectEngineThreadCtx *));
+            if (mt_det_ctxs == NULL)
+                goto error;
+        }
+
         DetectEngineTenantMapping *map = master->tenant_mapping_list;
         while (map) {
             map_cnt++;
@@ -1387,19 +1469,38 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
                 map = map->next;
             }
 
+            if (master->tenant_selector == TENANT_SELECTOR_VLAN) {
+                vlan_map = SCCalloc(4096, sizeof(uint32_t));
+                if (vlan_map == NULL)
+                    goto error;
+                uint32_t x;
+                for (x = 0; x < map_cnt; x++) {
+                    /* first mapping wins, like the list walk did */
+                    uint32_t vlan_id = map_array[x].traffic_id & 0x0fff;
+                    if (vlan_map[vlan_id] == 0)
+                        vlan_map[vlan_id] = map_array[x].tenant_id;
+                }
+            }
         }
 
+        /* one set of per packet arrays for all tenants of this thread */
+        if (DetectEngineThreadCtxInitScratch(det_ctx, master->list) != 0)
+            goto error;
+
         /* set up hash for tenant lookup */
         list = master->list;
         while (list) {
             SCLogInfo("tenant-id %u", list->tenant_id);
             if (list->tenant_id != 0) {
-                DetectEngineThreadCtx *mt_det_ctx = DetectEngineThreadCtxInitForReload(tv, list, 0);
+                DetectEngineThreadCtx *mt_det_ctx = DetectEngineThreadCtxInitForReload(tv, list, 0, det_ctx);
                 if (mt_det_ctx == NULL)
                     goto error;
+                DetectTenantThreadSetup(mt_det_ctx);
                 if (HashTableAdd(mt_det_ctxs_hash, mt_det_ctx, 0) != 0) {
                     goto error;
                 }
+                if (mt_det_ctxs != NULL)
+                    mt_det_ctxs[list->tenant_id] = mt_det_ctx;
             }
             list = list->next;
         }
@@ -1407,6 +1508,10 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
 
     det_ctx->mt_det_ctxs_hash = mt_det_ctxs_hash;
     mt_det_ctxs_hash = NULL;
+    det_ctx->mt_det_ctxs = mt_det_ctxs;
+    mt_det_ctxs = NULL;
+    det_ctx->tenant_vlan_map = vlan_map;
+    vlan_map = NULL;
 
     det_ctx->mt_det_ctxs_cnt = max_tenant_id;
 
@@ -1433,14 +1538,157 @@ error:
         SCFree(map_array);
     if (mt_det_ctxs_hash != NULL)
         HashTableFree(mt_det_ctxs_hash);
+    if (mt_det_ctxs != NULL)
+        SCFree(mt_det_ctxs);
+    if (vlan_map != NULL)
+        SCFree(vlan_map);
 
     return TM_ECODE_FAILED;
 }
 
+/** \internal
+ *  \brief size of det_ctx::match_array for a de_ctx
+ *
+ *  The match array only holds sigs of the packet's sgh, so the largest
+ *  sgh bounds it. With a single mpm ctx for all sgh's the mpm can
+ *  return sigs of other groups as well, so then it's the sig count.
+ */
+static uint32_t DetectEngineMatchArrayLen(const DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE ||
+        de_ctx->sgh_sig_cnt_max == 0)
+        return de_ctx->sig_array_len;
+    return MIN(de_ctx->sgh_sig_cnt_max, de_ctx->sig_array_len);
+}
+
+/** \internal
+ *  \brief bytes used by the per packet arrays sized to the rule set */
+static uint64_t ThreadCtxScratchSize(const DetectEngineThreadCtx *det_ctx)
+{
+    return det_ctx->non_mpm_id_array_size * sizeof(SigIntId) +
+        det_ctx->de_state_sig_array_len * sizeof(uint8_t) +
+        det_ctx->match_array_len * sizeof(Signature *) +
+        det_ctx->match_bits_len * sizeof(uint64_t);
+}
+
+/** \internal
+ *  \brief free the per packet arrays, unless they are borrowed */
+static void ThreadCtxFreeScratch(DetectEngineThreadCtx *det_ctx)
+{
+    if (det_ctx->scratch_shared == 0) {
+        if (det_ctx->non_mpm_id_array != NULL)
+            SCFree(det_ctx->non_mpm_id_array);
+        if (det_ctx->de_state_sig_array != NULL)
+            SCFree(det_ctx->de_state_sig_array);
+        if (det_ctx->match_array != NULL)
+            SCFree(det_ctx->match_array);
+        if (det_ctx->match_bits != NULL)
+            SCFree(det_ctx->match_bits);
+    }
+    det_ctx->non_mpm_id_array = NULL;
+    det_ctx->non_mpm_id_array_size = 0;
+    det_ctx->de_state_sig_array = NULL;
+    det_ctx->de_state_sig_array_len = 0;
+    det_ctx->match_array = NULL;
+    det_ctx->match_array_len = 0;
+    det_ctx->match_bits = NULL;
+    det_ctx->match_bits_len = 0;
+    det_ctx->scratch_shared = 0;
+}
+
+/** \internal
+ *  \brief (re)allocate the per packet arrays
+ *
+ *  \param non_mpm_len items in non_mpm_id_array, the largest sgh
+ *         non-mpm store
+ *  \param sig_len the sig array len, for the arrays indexed by sig num
+ *  \param match_len items in match_array
+ */
+static int ThreadCtxAllocScratch(DetectEngineThreadCtx *det_ctx,
+        uint32_t non_mpm_len, uint32_t sig_len, uint32_t match_len)
+{
+    ThreadCtxFreeScratch(det_ctx);
+
+    /* sized to the max of our sgh settings. A max setting of 0 implies that all
+     * sgh's have: sgh->non_mpm_store_cnt == 0 */
+    if (non_mpm_len > 0) {
+        det_ctx->non_mpm_id_array = SCCalloc(non_mpm_len, sizeof(SigIntId));
+        if (det_ctx->non_mpm_id_array == NULL)
+            return -1;
+        det_ctx->non_mpm_id_array_size = non_mpm_len;
+    }
+
+    /* DeState */
+    if (sig_len > 0) {
+        det_ctx->de_state_sig_array = SCCalloc(sig_len, sizeof(uint8_t));
+        if (det_ctx->de_state_sig_array == NULL)
+            return -1;
+        det_ctx->de_state_sig_array_len = sig_len;
+
+        det_ctx->match_array = SCCalloc(match_len, sizeof(Signature *));
+        if (det_ctx->match_array == NULL)
+            return -1;
+        det_ctx->match_array_len = match_len;
+
+        det_ctx->match_bits = SCCalloc((sig_len + 63) / 64, sizeof(uint64_t));
+        if (det_ctx->match_bits == NULL)
+            return -1;
+        det_ctx->match_bits_len = (sig_len + 63) / 64;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief grow the per packet arrays of a multi tenant root det_ctx to
+ *         fit every tenant, so the tenant det_ctxs can borrow them
+ *
+ *  Only one tenant is inspected at a time in a thread, and the arrays
+ *  are reset for every packet, so one set per thread is enough.
+ */
+static int DetectEngineThreadCtxInitScratch(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineCtx *list)
+{
+    uint32_t non_mpm_len = det_ctx->non_mpm_id_array_size;
+    uint32_t sig_len = det_ctx->de_state_sig_array_len;
+    uint32_t match_len = det_ctx->match_array_len;
+
+    for ( ; list != NULL; list = list->next) {
+        if (list->tenant_id == 0 || list->minimal)
+            continue;
+        non_mpm_len = MAX(non_mpm_len, list->non_mpm_store_cnt_max);
+        sig_len = MAX(sig_len, list->sig_array_len);
+        match_len = MAX(match_len, DetectEngineMatchArrayLen(list));
+    }
+
+    if (non_mpm_len == det_ctx->non_mpm_id_array_size &&
+        sig_len == det_ctx->de_state_sig_array_len &&
+        match_len == det_ctx->match_array_len)
+        return 0;
+
+    uint64_t old_size = ThreadCtxScratchSize(det_ctx);
+    if (ThreadCtxAllocScratch(det_ctx, non_mpm_len, sig_len, match_len) != 0)
+        return -1;
+    uint64_t new_size = ThreadCtxScratchSize(det_ctx);
+
+    /* the root may not have had a rule set of its own */
+    if (det_ctx->memuse > 0)
+        MemuseFree(MEMUSE_THREADS, old_size);
+    det_ctx->memuse = det_ctx->memuse - old_size + new_size;
+    MemuseAlloc(MEMUSE_THREADS, new_size);
+
+    SCLogDebug("shared tenant arrays: %u non-mpm, %u sigs, %u matches",
+            non_mpm_len, sig_len, match_len);
+    return 0;
+}
+
 /** \internal
  *  \brief Helper for DetectThread setup functions
+ *
+ *  \param scratch root det_ctx to borrow the per packet arrays from, or
+ *         NULL
  */
-static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx)
+static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx,
+        const DetectEngineThreadCtx *scratch)
 {
     PatternMatchThreadPrepare(&det_ctx->mtc, de_ctx->mpm_matcher);
     PatternMatchThreadPrepare(&det_ctx->mtcs, de_ctx->mpm_matcher);
@@ -1453,33 +1701,36 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
         return TM_ECODE_FAILED;
     }
 
-    /* sized to the max of our sgh settings. A max setting of 0 implies that all
-     * sgh's have: sgh->non_mpm_store_cnt == 0 */
-    if (de_ctx->non_mpm_store_cnt_max > 0) {
-        det_ctx->non_mpm_id_array =  SCCalloc(de_ctx->non_mpm_store_cnt_max, sizeof(SigIntId));
-        BUG_ON(det_ctx->non_mpm_id_array == NULL);
+    det_ctx->fp_stats = FpStatsThreadInit();
+    det_ctx->rule_guard = RuleGuardThreadInit(de_ctx);
+
+    uint32_t match_len = DetectEngineMatchArrayLen(de_ctx);
+    if (scratch != NULL && scratch->match_array_len >= match_len &&
+        scratch->de_state_sig_array_len >= de_ctx->sig_array_len &&
+        scratch->non_mpm_id_array_size >= de_ctx->non_mpm_store_cnt_max)
+    {
+        /* use the lengths of our own rule set, the arrays may be larger */
+        det_ctx->non_mpm_id_array = scratch->non_mpm_id_array;
+        det_ctx->non_mpm_id_array_size = de_ctx->non_mpm_store_cnt_max;
+        det_ctx->de_state_sig_array = scratch->de_state_sig_array;
+        det_ctx->de_state_sig_array_len = de_ctx->sig_array_len;
+        det_ctx->match_array = scratch->match_array;
+        det_ctx->match_array_len = match_len;
+        det_ctx->match_bits = scratch->match_bits;
+        det_ctx->match_bits_len = (de_ctx->sig_array_len + 63) / 64;
+        det_ctx->scratch_shared = 1;
+    } else if (ThreadCtxAllocScratch(det_ctx, de_ctx->non_mpm_store_cnt_max,
+                de_ctx->sig_array_len, match_len) != 0) {
+        return TM_ECODE_FAILED;
     }
 
     /* IP-ONLY */
     DetectEngineIPOnlyThreadInit(de_ctx,&det_ctx->io_ctx);
 
-    /* DeState */
-    if (de_ctx->sig_array_len > 0) {
-        det_ctx->de_state_sig_array_len = de_ctx->sig_array_len;
-        det_ctx->de_state_sig_array = SCMalloc(det_ctx->de_state_sig_array_len * sizeof(uint8_t));
-        if (det_ctx->de_state_sig_array == NULL) {
-            return TM_ECODE_FAILED;
-        }
-        memset(det_ctx->de_state_sig_array, 0,
-               det_ctx->de_state_sig_array_len * sizeof(uint8_t));
-
-        det_ctx->match_array_len = de_ctx->sig_array_len;
-        det_ctx->match_array = SCMalloc(det_ctx->match_array_len * sizeof(Signature *));
-        if (det_ctx->match_array == NULL) {
-            return TM_ECODE_FAILED;
-        }
-        memset(det_ctx->match_array, 0,
-               det_ctx->match_array_len * sizeof(Signature *));
+    /* per packet scratch memory */
+    det_ctx->arena = ArenaCreate(DETECT_ENGINE_ARENA_CHUNK_SIZE);
+    if (det_ctx->arena == NULL) {
+        return TM_ECODE_FAILED;
     }
 
     /* byte_extract storage */
@@ -1507,6 +1758,15 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
 #endif
     SC_ATOMIC_INIT(det_ctx->so_far_used_by_detect);
 
+    /* the ctx and its arrays sized to the rule set. Borrowed arrays are
+     * accounted to the root det_ctx. */
+    det_ctx->memuse = sizeof(DetectEngineThreadCtx) +
+        (det_ctx->scratch_shared ? 0 : ThreadCtxScratchSize(det_ctx)) +
+        det_ctx->base64_decoded_len_max +
+        det_ctx->mtc.memory_size + det_ctx->mtcs.memory_size +
+        det_ctx->mtcu.memory_size;
+    MemuseAlloc(MEMUSE_THREADS, det_ctx->memuse);
+
     return TM_ECODE_OK;
 }
 
@@ -1532,6 +1792,10 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
     /* first register the counter. In delayed detect mode we exit right after if the
      * rules haven't been loaded yet. */
     uint16_t counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    uint16_t counter_inspection_limit = StatsRegisterCounter("detect.inspection_limit", tv);
+    uint16_t counter_rule_guard = 0;
+    if (RuleGuardEnabled())
+        counter_rule_guard = StatsRegisterCounter("detect.rule_guard", tv);
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -1560,7 +1824,7 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
     }
 
     if (det_ctx->de_ctx->minimal == 0) {
-        if (ThreadCtxDoInit(det_ctx->de_ctx, det_ctx) != TM_ECODE_OK) {
+        if (ThreadCtxDoInit(det_ctx->de_ctx, det_ctx, NULL) != TM_ECODE_OK) {
             DetectEngineThreadCtxDeinit(tv, det_ctx);
             return TM_ECODE_FAILED;
         }
@@ -1568,6 +1832,8 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
 
     /** alert counter setup */
     det_ctx->counter_alerts = counter_alerts;
+    det_ctx->counter_inspection_limit = counter_inspection_limit;
+    det_ctx->counter_rule_guard = counter_rule_guard;
 #ifdef PROFILING
     det_ctx->counter_mpm_list = counter_mpm_list;
     det_ctx->counter_nonmpm_list = counter_nonmpm_list;
@@ -1592,11 +1858,14 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
  * \param new_de_ctx the new detection engine
  * \param mt flag to indicate if MT should be set up for this det_ctx
  *           this should only be done for the 'root' det_ctx
+ * \param scratch root det_ctx to borrow the per packet arrays from, or
+ *        NULL to allocate them
  *
  * \retval det_ctx detection engine thread ctx or NULL in case of error
  */
 static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
-        ThreadVars *tv, DetectEngineCtx *new_de_ctx, int mt)
+        ThreadVars *tv, DetectEngineCtx *new_de_ctx, int mt,
+        const DetectEngineThreadCtx *scratch)
 {
     DetectEngineThreadCtx *det_ctx = SCMalloc(sizeof(DetectEngineThreadCtx));
     if (unlikely(det_ctx == NULL))
@@ -1612,7 +1881,7 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
     }
 
     /* most of the init happens here */
-    if (ThreadCtxDoInit(det_ctx->de_ctx, det_ctx) != TM_ECODE_OK) {
+    if (ThreadCtxDoInit(det_ctx->de_ctx, det_ctx, scratch) != TM_ECODE_OK) {
         DetectEngineDeReference(&det_ctx->de_ctx);
         SCFree(det_ctx);
         return NULL;
@@ -1620,6 +1889,9 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
 
     /** alert counter setup */
     det_ctx->counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    det_ctx->counter_inspection_limit = StatsRegisterCounter("detect.inspection_limit", tv);
+    if (RuleGuardEnabled())
+        det_ctx->counter_rule_guard = StatsRegisterCounter("detect.rule_guard", tv);
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -1642,6 +1914,24 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
     return det_ctx;
 }
 
+/**
+ * \brief set up a det_ctx for 'de_ctx' outside of the detect threads, e.g.
+ *        for the self-test. Free with DetectEngineThreadCtxDeinit().
+ *
+ *  The det_ctx doesn't add to the fast pattern stats training.
+ */
+DetectEngineThreadCtx *DetectEngineThreadCtxInitStandalone(ThreadVars *tv,
+        DetectEngineCtx *de_ctx)
+{
+    DetectEngineThreadCtx *det_ctx =
+        DetectEngineThreadCtxInitForReload(tv, de_ctx, 0, NULL);
+    if (det_ctx != NULL && det_ctx->fp_stats != NULL) {
+        SCFree(det_ctx->fp_stats);
+        det_ctx->fp_stats = NULL;
+    }
+    return det_ctx;
+}
+
 void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
 {
     int i;
@@ -1650,6 +1940,17 @@ void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
         SCFree(det_ctx->tenant_array);
         det_ctx->tenant_array = NULL;
     }
+    if (det_ctx->tenant_vlan_map != NULL) {
+        SCFree(det_ctx->tenant_vlan_map);
+        det_ctx->tenant_vlan_map = NULL;
+    }
+    if (det_ctx->mt_det_ctxs != NULL) {
+        SCFree(det_ctx->mt_det_ctxs);
+        det_ctx->mt_det_ctxs = NULL;
+    }
+
+    RuleSampleThreadCleanup(det_ctx);
+    DetectTenantThreadCleanup(det_ctx);
 
 #ifdef PROFILING
     SCProfilingRuleThreadCleanup(det_ctx);
@@ -1672,28 +1973,19 @@ void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
         SpmDestroyThreadCtx(det_ctx->spm_thread_ctx);
     }
 
-    if (det_ctx->non_mpm_id_array != NULL)
-        SCFree(det_ctx->non_mpm_id_array);
+    FpStatsThreadDeinit(det_ctx->fp_stats);
+    RuleGuardThreadDeinit(det_ctx->rule_guard);
+
+    if (det_ctx->memuse != 0)
+        MemuseFree(MEMUSE_THREADS, det_ctx->memuse);
 
-    if (det_ctx->de_state_sig_array != NULL)
-        SCFree(det_ctx->de_state_sig_array);
-    if (det_ctx->match_array != NULL)
-        SCFree(det_ctx->match_array);
+    ThreadCtxFreeScratch(det_ctx);
 
     if (det_ctx->bj_values != NULL)
         SCFree(det_ctx->bj_values);
 
-    /* HHD temp storage */
-    for (i = 0; i < det_ctx->hhd_buffers_size; i++) {
-        if (det_ctx->hhd_buffers[i] != NULL)
-            SCFree(det_ctx->hhd_buffers[i]);
-    }
-    if (det_ctx->hhd_buffers)
-        SCFree(det_ctx->hhd_buffers);
-    det_ctx->hhd_buffers = NULL;
-    if (det_ctx->hhd_buffers_len)
-        SCFree(det_ctx->hhd_buffers_len);
-    det_ctx->hhd_buffers_len = NULL;
+    ArenaDestroy(det_ctx->arena);
+    det_ctx->arena = NULL;
 
     /* HSBD */
     if (det_ctx->hsbd != NULL) {
@@ -1876,6 +2168,31 @@ int DetectEngineMultiTenantEnabled(void)
  *  \retval 0 ok
  *  \retval -1 failed
  */
+/** \internal
+ *  \brief find a loaded tenant built from the same rules and config
+ *
+ *  \retval tenant_id of the first such tenant, or 0 if there is none
+ */
+static uint32_t DetectEngineMultiTenantFindIdentical(const DetectEngineCtx *de_ctx)
+{
+    DetectEngineMasterCtx *master = &g_master_de_ctx;
+    uint32_t tenant_id = 0;
+
+    SCMutexLock(&master->lock);
+    const DetectEngineCtx *list = master->list;
+    for ( ; list != NULL; list = list->next) {
+        if (list->tenant_id != 0 && list->tenant_id != de_ctx->tenant_id &&
+            memcmp(list->ruleset_hash, de_ctx->ruleset_hash,
+                   sizeof(de_ctx->ruleset_hash)) == 0)
+        {
+            tenant_id = list->tenant_id;
+            break;
+        }
+    }
+    SCMutexUnlock(&master->lock);
+    return tenant_id;
+}
+
 static int DetectEngineMultiTenantLoadTenant(uint32_t tenant_id, const char *filename, int loader_id)
 {
     DetectEngineCtx *de_ctx = NULL;
@@ -1924,6 +2241,15 @@ static int DetectEngineMultiTenantLoadTenant(uint32_t tenant_id, const char *fil
         goto error;
     }
 
+    /* engines are not shared between tenants, but point out the
+     * duplicate, as mapping both to one tenant saves a whole engine */
+    uint32_t same_id = DetectEngineMultiTenantFindIdentical(de_ctx);
+    if (same_id != 0) {
+        SCLogNotice("tenant %u uses the same rules and config as tenant %u, "
+                "consider mapping its traffic to tenant %u", tenant_id,
+                same_id, same_id);
+    }
+
     DetectEngineAddToMaster(de_ctx);
 
     return 0;
@@ -2104,6 +2430,8 @@ int DetectEngineMultiTenantSetup(void)
         DetectLoaderThreadSpawn();
         TmThreadContinueDetectLoaderThreads();
 
+        DetectTenantSetup();
+
         SCMutexLock(&master->lock);
         master->multi_tenant_enabled = 1;
 
@@ -2272,7 +2600,13 @@ static uint32_t DetectEngineTentantGetIdFromVlanId(const void *ctx, const Packet
 
     vlan_id = p->vlan_id[0];
 
-    if (det_ctx == NULL || det_ctx->tenant_array == NULL || det_ctx->tenant_array_size == 0)
+    if (det_ctx == NULL)
+        return 0;
+
+    if (likely(det_ctx->tenant_vlan_map != NULL))
+        return det_ctx->tenant_vlan_map[vlan_id & 0x0fff];
+
+    if (det_ctx->tenant_array == NULL || det_ctx->tenant_array_size == 0)
         return 0;
 
     /* not very efficient, but for now we're targeting only limited amounts.
@@ -2543,6 +2877,66 @@ static int reloads = 0;
  *  \retval -1 error
  *  \retval 0 ok
  */
+static void DetectEngineHashConfNode(DetectEngineCtx *de_ctx, const ConfNode *node,
+                                     int is_root)
+{
+    const ConfNode *child;
+    TAILQ_FOREACH(child, &node->head, next) {
+        /* skip the trees loaded by earlier reloads */
+        if (is_root && child->name != NULL &&
+            strncmp(child->name, "detect-engine-reloads", 21) == 0)
+            continue;
+
+        if (child->name != NULL)
+            hashlittle2(child->name, strlen(child->name),
+                        &de_ctx->ruleset_hash[0], &de_ctx->ruleset_hash[1]);
+        if (child->val != NULL)
+            hashlittle2(child->val, strlen(child->val),
+                        &de_ctx->ruleset_hash[0], &de_ctx->ruleset_hash[1]);
+        DetectEngineHashConfNode(de_ctx, child, 0);
+    }
+}
+
+static void DetectEngineHashFile(DetectEngineCtx *de_ctx, const char *filename)
+{
+    if (filename == NULL)
+        return;
+
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+        return;
+
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        hashlittle2(buf, len, &de_ctx->ruleset_hash[0], &de_ctx->ruleset_hash[1]);
+    }
+    fclose(fp);
+}
+
+/**
+ *  \brief add the detect config and the classification, reference and
+ *         threshold files to the engine's ruleset_hash
+ *
+ *  The rule lines themselves are hashed as they are loaded. Together
+ *  this covers everything a reload would read, so an equal hash means
+ *  the reload would build the same engine.
+ */
+void DetectEngineHashConfig(DetectEngineCtx *de_ctx)
+{
+    const ConfNode *node;
+    if (strlen(de_ctx->config_prefix) > 0)
+        node = ConfGetNode(de_ctx->config_prefix);
+    else
+        node = ConfGetRootNode();
+    if (node != NULL)
+        DetectEngineHashConfNode(de_ctx, node, strlen(de_ctx->config_prefix) == 0);
+
+    DetectEngineHashFile(de_ctx, SCClassConfGetConfFilename(de_ctx));
+    DetectEngineHashFile(de_ctx, SCRConfGetConfFilename(de_ctx));
+    DetectEngineHashFile(de_ctx, SCThresholdConfGetConfFilename(de_ctx));
+}
+
 int DetectEngineReload(SCInstance *suri)
 {
     DetectEngineCtx *new_de_ctx = NULL;
@@ -2586,12 +2980,25 @@ int DetectEngineReload(SCInstance *suri)
         DetectEngineDeReference(&old_de_ctx);
         return -1;
     }
-    if (SigLoadSignatures(new_de_ctx,
-                          suri->sig_file, suri->sig_file_exclusive) != 0) {
+    /* if nothing changed since the current engine was built, we don't
+     * need to build and swap in a new one */
+    new_de_ctx->flags |= DE_RELOAD_UNCHANGED_SKIP;
+    memcpy(new_de_ctx->reload_ruleset_hash, old_de_ctx->ruleset_hash,
+           sizeof(new_de_ctx->reload_ruleset_hash));
+
+    int r = SigLoadSignatures(new_de_ctx, suri->sig_file, suri->sig_file_exclusive);
+    if (r == 1) {
+        DetectEngineCtxFree(new_de_ctx);
+        DetectEngineDeReference(&old_de_ctx);
+        SCLogNotice("rule reload complete: rules and config unchanged, "
+                "kept the current detection engine");
+        return 0;
+    } else if (r != 0) {
         DetectEngineCtxFree(new_de_ctx);
         DetectEngineDeReference(&old_de_ctx);
         return -1;
     }
+    new_de_ctx->flags &= ~DE_RELOAD_UNCHANGED_SKIP;
     SCThresholdConfInitContext(new_de_ctx, NULL);
     SCLogDebug("set up new_de_ctx %p", new_de_ctx);
 
@@ -2600,13 +3007,16 @@ int DetectEngineReload(SCInstance *suri)
 
     /* move to old free list */
     DetectEngineMoveToFreeList(old_de_ctx);
-    DetectEngineDeReference(&old_de_ctx);
 
     SCLogDebug("going to reload the threads to use new_de_ctx %p", new_de_ctx);
     /* update the threads */
     DetectEngineReloadThreads(new_de_ctx);
     SCLogDebug("threads now run new_de_ctx %p", new_de_ctx);
 
+    /* compare the engines while we still hold a reference to the old one */
+    (void)DetectSelfTestRun(new_de_ctx, old_de_ctx);
+    DetectEngineDeReference(&old_de_ctx);
+
     /* walk free list, freeing the old_de_ctx */
     DetectEnginePruneFreeList();
 
@@ -3299,6 +3709,107 @@ static int DetectEngineTest09(void)
     return result;
 }
 
+/** \test engines that need tx progress have it set, others don't */
+static int DetectEngineTest10(void)
+{
+    DetectEngineAppInspectionEngine *engine =
+        app_inspection_engine[FlowGetProtoMapping(IPPROTO_TCP)][ALPROTO_HTTP][0];
+    int seen = 0;
+
+    for ( ; engine != NULL; engine = engine->next) {
+        if (engine->sm_list == DETECT_SM_LIST_HHDMATCH ||
+            engine->sm_list == DETECT_SM_LIST_HRHDMATCH) {
+            FAIL_IF_NOT(engine->progress == HTP_REQUEST_HEADERS + 1);
+            seen++;
+        } else {
+            FAIL_IF_NOT(engine->progress == 0);
+        }
+    }
+    FAIL_IF_NOT(seen == 2);
+
+    engine = app_inspection_engine[FlowGetProtoMapping(IPPROTO_TCP)][ALPROTO_HTTP][1];
+    for ( ; engine != NULL; engine = engine->next) {
+        if (engine->sm_list == DETECT_SM_LIST_HHDMATCH)
+            FAIL_IF_NOT(engine->progress == HTP_RESPONSE_HEADERS + 1);
+    }
+    PASS;
+}
+
+/** \test the ruleset hash only depends on the config */
+static int DetectEngineTest11(void)
+{
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("vars.address-groups.HOME_NET", "[10.0.0.0/8]");
+
+    DetectEngineCtx *de_ctx1 = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx1);
+    DetectEngineCtx *de_ctx2 = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx2);
+
+    DetectEngineHashConfig(de_ctx1);
+    DetectEngineHashConfig(de_ctx2);
+    FAIL_IF(memcmp(de_ctx1->ruleset_hash, de_ctx2->ruleset_hash,
+                   sizeof(de_ctx1->ruleset_hash)) != 0);
+
+    ConfSet("vars.address-groups.HOME_NET", "[192.168.0.0/16]");
+    memset(de_ctx2->ruleset_hash, 0, sizeof(de_ctx2->ruleset_hash));
+    DetectEngineHashConfig(de_ctx2);
+    FAIL_IF(memcmp(de_ctx1->ruleset_hash, de_ctx2->ruleset_hash,
+                   sizeof(de_ctx1->ruleset_hash)) == 0);
+
+    DetectEngineCtxFree(de_ctx1);
+    DetectEngineCtxFree(de_ctx2);
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+
+/** \test the match array is sized to the largest sgh, and a tenant
+ *        det_ctx borrows the arrays of the root */
+static int DetectEngineTest12(void)
+{
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+
+    memset(&tv, 0, sizeof(tv));
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+                "(content:\"one\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+                "(content:\"two\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+                "(content:\"three\"; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert udp any any -> any 53 "
+                "(content:\"four\"; sid:4;)"));
+    SigGroupBuild(de_ctx);
+
+    DetectEngineThreadCtxInit(&tv, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+    FAIL_IF(det_ctx->match_array_len > de_ctx->sig_array_len);
+    if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
+        FAIL_IF(de_ctx->sgh_sig_cnt_max == 0);
+        FAIL_IF(de_ctx->sgh_sig_cnt_max >= de_ctx->sig_array_len);
+        FAIL_IF(det_ctx->match_array_len != de_ctx->sgh_sig_cnt_max);
+    }
+
+    DetectEngineThreadCtx *tenant = SCCalloc(1, sizeof(*tenant));
+    FAIL_IF_NULL(tenant);
+    tenant->de_ctx = de_ctx;
+    FAIL_IF(ThreadCtxDoInit(de_ctx, tenant, det_ctx) != TM_ECODE_OK);
+    FAIL_IF_NOT(tenant->scratch_shared);
+    FAIL_IF(tenant->match_array != det_ctx->match_array);
+    FAIL_IF(tenant->de_state_sig_array != det_ctx->de_state_sig_array);
+    DetectEngineThreadCtxFree(tenant);
+
+    DetectEngineThreadCtxDeinit(&tv, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 #endif
 
 void DetectEngineRegisterTests()
@@ -3314,6 +3825,9 @@ void DetectEngineRegisterTests()
     UtRegisterTest("DetectEngineTest07", DetectEngineTest07);
     UtRegisterTest("DetectEngineTest08", DetectEngineTest08);
     UtRegisterTest("DetectEngineTest09", DetectEngineTest09);
+    UtRegisterTest("DetectEngineTest10", DetectEngineTest10);
+    UtRegisterTest("DetectEngineTest11", DetectEngineTest11);
+    UtRegisterTest("DetectEngineTest12", DetectEngineTest12);
 #endif
 
     return;
@@ -36,6 +36,11 @@ typedef struct DetectEngineAppInspectionEngine_ {
     int32_t sm_list;
     uint32_t inspect_flags;
 
+    /** tx progress the engine needs before it can inspect anything.
+     *  Below it the engine is skipped as a 'no match'. 0 means the
+     *  engine decides for itself. */
+    int progress;
+
     /* \retval 0 No match.  Don't discontinue matching yet.  We need more data.
      *         1 Match.
      *         2 Sig can't match.
@@ -61,6 +66,8 @@ void DetectEngineCtxFree(DetectEngineCtx *);
 
 TmEcode DetectEngineThreadCtxInit(ThreadVars *, void *, void **);
 TmEcode DetectEngineThreadCtxDeinit(ThreadVars *, void *);
+DetectEngineThreadCtx *DetectEngineThreadCtxInitStandalone(ThreadVars *,
+        DetectEngineCtx *);
 //inline uint32_t DetectEngineGetMaxSigId(DetectEngineCtx *);
 /* faster as a macro than a inline function on my box -- VJ */
 #define DetectEngineGetMaxSigId(de_ctx) ((de_ctx)->signum)
@@ -76,6 +83,7 @@ int DetectEngineMoveToFreeList(DetectEngineCtx *de_ctx);
 DetectEngineCtx *DetectEngineReference(DetectEngineCtx *);
 void DetectEngineDeReference(DetectEngineCtx **de_ctx);
 int DetectEngineReload(SCInstance *suri);
+void DetectEngineHashConfig(DetectEngineCtx *de_ctx);
 int DetectEngineEnabled(void);
 int DetectEngineMTApply(void);
 int DetectEngineMultiTenantEnabled(void);
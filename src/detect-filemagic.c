@@ -262,8 +262,6 @@ error:
 
 static void *DetectFilemagicThreadInit(void *data)
 {
-    char *filename = NULL;
-    FILE *fd = NULL;
     DetectFilemagicData *filemagic = (DetectFilemagicData *)data;
     BUG_ON(filemagic == NULL);
 
@@ -274,42 +272,13 @@ static void *DetectFilemagicThreadInit(void *data)
     }
     memset(t, 0x00, sizeof(DetectFilemagicThreadData));
 
-    t->ctx = magic_open(0);
+    t->ctx = MagicInitContext();
     if (t->ctx == NULL) {
-        SCLogError(SC_ERR_MAGIC_OPEN, "magic_open failed: %s", magic_error(t->ctx));
-        goto error;
-    }
-
-    (void)ConfGet("magic-file", &filename);
-    if (filename != NULL) {
-        if (strlen(filename) == 0) {
-            /* set filename to NULL on *nix systems so magic_load uses system default path (see man libmagic) */
-            SCLogInfo("using system default magic-file");
-            filename = NULL;
-        }
-        else {
-            SCLogInfo("using magic-file %s", filename);
-
-            if ( (fd = fopen(filename, "r")) == NULL) {
-                SCLogWarning(SC_ERR_FOPEN, "Error opening file: \"%s\": %s", filename, strerror(errno));
-                goto error;
-            }
-            fclose(fd);
-        }
-    }
-
-    if (magic_load(t->ctx, filename) != 0) {
-        SCLogError(SC_ERR_MAGIC_LOAD, "magic_load failed: %s", magic_error(t->ctx));
-        goto error;
+        SCFree(t);
+        return NULL;
     }
 
     return (void *)t;
-
-error:
-    if (t->ctx)
-        magic_close(t->ctx);
-    SCFree(t);
-    return NULL;
 }
 
 static void DetectFilemagicThreadFree(void *ctx)
@@ -34,6 +34,7 @@
 #include "decode-events.h"
 
 #include "detect-flags.h"
+#include "detect-engine-prefilter.h"
 #include "util-unittest.h"
 
 #include "util-debug.h"
@@ -59,6 +60,7 @@ static pcre_extra *parse_regex_study;
 static int DetectFlagsMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature *, const SigMatchCtx *);
 static int DetectFlagsSetup (DetectEngineCtx *, Signature *, char *);
 static void DetectFlagsFree(void *);
+static int PrefilterSetupFlags(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
 
 /**
  * \brief Registration function for flags: keyword
@@ -71,42 +73,21 @@ void DetectFlagsRegister (void)
     sigmatch_table[DETECT_FLAGS].Setup = DetectFlagsSetup;
     sigmatch_table[DETECT_FLAGS].Free  = DetectFlagsFree;
     sigmatch_table[DETECT_FLAGS].RegisterTests = FlagsRegisterTests;
+    sigmatch_table[DETECT_FLAGS].SetupPrefilter = PrefilterSetupFlags;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
-/**
- * \internal
- * \brief This function is used to match flags on a packet with those passed via flags:
- *
- * \param t pointer to thread vars
- * \param det_ctx pointer to the pattern matcher thread
- * \param p pointer to the current packet
- * \param s pointer to the Signature
- * \param m pointer to the sigmatch
- *
- * \retval 0 no match
- * \retval 1 match
- */
-static int DetectFlagsMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Signature *s, const SigMatchCtx *ctx)
+/** \internal
+ *  \brief match the tcp flags 'flags' against the keyword */
+static inline int FlagsMatch(uint8_t flags, const DetectFlagsData *de)
 {
-    SCEnter();
-
-    uint8_t flags = 0;
-    const DetectFlagsData *de = (const DetectFlagsData *)ctx;
-
-    if (!(PKT_IS_TCP(p)) || PKT_IS_PSEUDOPKT(p)) {
-        SCReturnInt(0);
-    }
-
-    flags = p->tcph->th_flags;
-
     if (!de->flags && flags) {
         if(de->modifier == MODIFIER_NOT) {
-            SCReturnInt(1);
+            return 1;
         }
 
-        SCReturnInt(0);
+        return 0;
     }
 
     flags &= de->ignored_flags;
@@ -114,30 +95,75 @@ static int DetectFlagsMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Pack
     switch (de->modifier) {
         case MODIFIER_ANY:
             if ((flags & de->flags) > 0) {
-                SCReturnInt(1);
+                return 1;
             }
-            SCReturnInt(0);
+            return 0;
 
         case MODIFIER_PLUS:
             if (((flags & de->flags) == de->flags)) {
-                SCReturnInt(1);
+                return 1;
             }
-            SCReturnInt(0);
+            return 0;
 
         case MODIFIER_NOT:
             if ((flags & de->flags) != de->flags) {
-                SCReturnInt(1);
+                return 1;
             }
-            SCReturnInt(0);
+            return 0;
 
         default:
             SCLogDebug("flags %"PRIu8" and de->flags %"PRIu8"",flags,de->flags);
             if (flags == de->flags) {
-                SCReturnInt(1);
+                return 1;
             }
     }
 
-    SCReturnInt(0);
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief This function is used to match flags on a packet with those passed via flags:
+ *
+ * \param t pointer to thread vars
+ * \param det_ctx pointer to the pattern matcher thread
+ * \param p pointer to the current packet
+ * \param s pointer to the Signature
+ * \param m pointer to the sigmatch
+ *
+ * \retval 0 no match
+ * \retval 1 match
+ */
+static int DetectFlagsMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Signature *s, const SigMatchCtx *ctx)
+{
+    SCEnter();
+
+    const DetectFlagsData *de = (const DetectFlagsData *)ctx;
+
+    if (!(PKT_IS_TCP(p)) || PKT_IS_PSEUDOPKT(p)) {
+        SCReturnInt(0);
+    }
+
+    SCReturnInt(FlagsMatch(p->tcph->th_flags, de));
+}
+
+static int PrefilterFlagsCompare(const uint8_t value, const SigMatchCtx *ctx)
+{
+    return FlagsMatch(value, (const DetectFlagsData *)ctx);
+}
+
+static void PrefilterPacketFlagsMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void *pectx)
+{
+    if (!(PKT_IS_TCP(p)) || PKT_IS_PSEUDOPKT(p))
+        return;
+
+    PrefilterPacketU8TableAdd(det_ctx, pectx, p->tcph->th_flags);
+}
+
+static int PrefilterSetupFlags(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketU8Table(sgh, DETECT_FLAGS,
+            PrefilterFlagsCompare, PrefilterPacketFlagsMatch);
 }
 
 /**
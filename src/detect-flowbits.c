@@ -827,13 +827,8 @@ static int FlowBitsTestSig06(void)
 
     idx = VariableNameGetIdx(de_ctx, "myflow", VAR_TYPE_FLOW_BIT);
 
-    gv = p->flow->flowvar;
-
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
-                result = 1;
-        }
-    }
+    if (FlowBitIsset(p->flow, idx) == 1)
+        result = 1;
 
     SigGroupCleanup(de_ctx);
     SigCleanSignatures(de_ctx);
@@ -933,13 +928,8 @@ static int FlowBitsTestSig07(void)
 
     idx = VariableNameGetIdx(de_ctx, "myflow", VAR_TYPE_FLOW_BIT);
 
-    gv = p->flow->flowvar;
-
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
-                result = 1;
-        }
-    }
+    if (FlowBitIsset(p->flow, idx) == 1)
+        result = 1;
 
     SigGroupCleanup(de_ctx);
     SigCleanSignatures(de_ctx);
@@ -1042,13 +1032,8 @@ static int FlowBitsTestSig08(void)
 
     idx = VariableNameGetIdx(de_ctx, "myflow", VAR_TYPE_FLOW_BIT);
 
-    gv = p->flow->flowvar;
-
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
-                result = 1;
-        }
-    }
+    if (FlowBitIsset(p->flow, idx) == 1)
+        result = 1;
 
     SigGroupCleanup(de_ctx);
     SigCleanSignatures(de_ctx);
@@ -116,6 +116,8 @@ void DetectHttpRawHeaderFree(void *ptr)
  */
 int DetectHttpRawHeaderSetup(DetectEngineCtx *de_ctx, Signature *s, char *arg)
 {
+    AppLayerHtpNeedRawHeaders();
+
     return DetectEngineContentModifierBufferSetup(de_ctx, s, arg,
                                                   DETECT_AL_HTTP_RAW_HEADER,
                                                   DETECT_SM_LIST_HRHDMATCH,
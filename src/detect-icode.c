@@ -31,6 +31,7 @@
 #include "detect-parse.h"
 
 #include "detect-icode.h"
+#include "detect-engine-prefilter.h"
 
 #include "util-byte.h"
 #include "util-unittest.h"
@@ -49,6 +50,7 @@ int DetectICodeMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 static int DetectICodeSetup(DetectEngineCtx *, Signature *, char *);
 void DetectICodeRegisterTests(void);
 void DetectICodeFree(void *);
+static int PrefilterSetupICode(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
 
 
 /**
@@ -63,10 +65,27 @@ void DetectICodeRegister (void)
     sigmatch_table[DETECT_ICODE].Setup = DetectICodeSetup;
     sigmatch_table[DETECT_ICODE].Free = DetectICodeFree;
     sigmatch_table[DETECT_ICODE].RegisterTests = DetectICodeRegisterTests;
+    sigmatch_table[DETECT_ICODE].SetupPrefilter = PrefilterSetupICode;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
+static inline int ICodeMatch(const uint8_t picode, const DetectICodeData *icd)
+{
+    switch(icd->mode) {
+        case DETECT_ICODE_EQ:
+            return (picode == icd->code1) ? 1 : 0;
+        case DETECT_ICODE_LT:
+            return (picode < icd->code1) ? 1 : 0;
+        case DETECT_ICODE_GT:
+            return (picode > icd->code1) ? 1 : 0;
+        case DETECT_ICODE_RN:
+            return (picode >= icd->code1 && picode <= icd->code2) ? 1 : 0;
+    }
+
+    return 0;
+}
+
 /**
  * \brief This function is used to match icode rule option set on a packet with those passed via icode:
  *
@@ -96,22 +115,30 @@ int DetectICodeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
         return ret;
     }
 
-    switch(icd->mode) {
-        case DETECT_ICODE_EQ:
-            ret = (picode == icd->code1) ? 1 : 0;
-            break;
-        case DETECT_ICODE_LT:
-            ret = (picode < icd->code1) ? 1 : 0;
-            break;
-        case DETECT_ICODE_GT:
-            ret = (picode > icd->code1) ? 1 : 0;
-            break;
-        case DETECT_ICODE_RN:
-            ret = (picode >= icd->code1 && picode <= icd->code2) ? 1 : 0;
-            break;
+    return ICodeMatch(picode, icd);
+}
+
+static int PrefilterICodeCompare(const uint8_t value, const SigMatchCtx *ctx)
+{
+    return ICodeMatch(value, (const DetectICodeData *)ctx);
+}
+
+static void PrefilterPacketICodeMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void *pectx)
+{
+    if (PKT_IS_PSEUDOPKT(p))
+        return;
+
+    if (PKT_IS_ICMPV4(p)) {
+        PrefilterPacketU8TableAdd(det_ctx, pectx, ICMPV4_GET_CODE(p));
+    } else if (PKT_IS_ICMPV6(p)) {
+        PrefilterPacketU8TableAdd(det_ctx, pectx, ICMPV6_GET_CODE(p));
     }
+}
 
-    return ret;
+static int PrefilterSetupICode(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketU8Table(sgh, DETECT_ICODE,
+            PrefilterICodeCompare, PrefilterPacketICodeMatch);
 }
 
 /**
@@ -31,6 +31,7 @@
 #include "detect-parse.h"
 
 #include "detect-itype.h"
+#include "detect-engine-prefilter.h"
 
 #include "util-byte.h"
 #include "util-unittest.h"
@@ -49,6 +50,7 @@ int DetectITypeMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 static int DetectITypeSetup(DetectEngineCtx *, Signature *, char *);
 void DetectITypeRegisterTests(void);
 void DetectITypeFree(void *);
+static int PrefilterSetupIType(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
 
 
 /**
@@ -63,10 +65,27 @@ void DetectITypeRegister (void)
     sigmatch_table[DETECT_ITYPE].Setup = DetectITypeSetup;
     sigmatch_table[DETECT_ITYPE].Free = DetectITypeFree;
     sigmatch_table[DETECT_ITYPE].RegisterTests = DetectITypeRegisterTests;
+    sigmatch_table[DETECT_ITYPE].SetupPrefilter = PrefilterSetupIType;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
+static inline int ITypeMatch(const uint8_t pitype, const DetectITypeData *itd)
+{
+    switch(itd->mode) {
+        case DETECT_ITYPE_EQ:
+            return (pitype == itd->type1) ? 1 : 0;
+        case DETECT_ITYPE_LT:
+            return (pitype < itd->type1) ? 1 : 0;
+        case DETECT_ITYPE_GT:
+            return (pitype > itd->type1) ? 1 : 0;
+        case DETECT_ITYPE_RN:
+            return (pitype > itd->type1 && pitype < itd->type2) ? 1 : 0;
+    }
+
+    return 0;
+}
+
 /**
  * \brief This function is used to match itype rule option set on a packet with those passed via itype:
  *
@@ -96,22 +115,30 @@ int DetectITypeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
         return ret;
     }
 
-    switch(itd->mode) {
-        case DETECT_ITYPE_EQ:
-            ret = (pitype == itd->type1) ? 1 : 0;
-            break;
-        case DETECT_ITYPE_LT:
-            ret = (pitype < itd->type1) ? 1 : 0;
-            break;
-        case DETECT_ITYPE_GT:
-            ret = (pitype > itd->type1) ? 1 : 0;
-            break;
-        case DETECT_ITYPE_RN:
-            ret = (pitype > itd->type1 && pitype < itd->type2) ? 1 : 0;
-            break;
+    return ITypeMatch(pitype, itd);
+}
+
+static int PrefilterITypeCompare(const uint8_t value, const SigMatchCtx *ctx)
+{
+    return ITypeMatch(value, (const DetectITypeData *)ctx);
+}
+
+static void PrefilterPacketITypeMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void *pectx)
+{
+    if (PKT_IS_PSEUDOPKT(p))
+        return;
+
+    if (PKT_IS_ICMPV4(p)) {
+        PrefilterPacketU8TableAdd(det_ctx, pectx, ICMPV4_GET_TYPE(p));
+    } else if (PKT_IS_ICMPV6(p)) {
+        PrefilterPacketU8TableAdd(det_ctx, pectx, ICMPV6_GET_TYPE(p));
     }
+}
 
-    return ret;
+static int PrefilterSetupIType(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketU8Table(sgh, DETECT_ITYPE,
+            PrefilterITypeCompare, PrefilterPacketITypeMatch);
 }
 
 /**
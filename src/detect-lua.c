@@ -291,6 +291,34 @@ void LuaDumpStack(lua_State *state)
     }
 }
 
+/** \internal
+ *  \brief set a buffer in the args table at the top of the stack
+ *
+ *  As a string under 'key', or if the script asked for 'ffi', as a
+ *  pointer under 'key' and the length under 'lenkey'. The pointer is
+ *  only valid during the call to the script, which can read it with
+ *  ffi.string or ffi.cast without the buffer being copied.
+ */
+static void DetectLuaSetBuffer(lua_State *luastate, int ffi,
+        const char *key, const char *lenkey,
+        const uint8_t *buffer, uint32_t buffer_len)
+{
+#ifdef HAVE_LUAJIT
+    if (ffi) {
+        lua_pushstring(luastate, key);
+        lua_pushlightuserdata(luastate, (void *)buffer);
+        lua_settable(luastate, -3);
+        lua_pushstring(luastate, lenkey);
+        lua_pushnumber(luastate, (lua_Number)buffer_len);
+        lua_settable(luastate, -3);
+        return;
+    }
+#endif
+    lua_pushstring(luastate, key);
+    LuaPushStringBuffer(luastate, buffer, (size_t)buffer_len);
+    lua_settable(luastate, -3);
+}
+
 int DetectLuaMatchBuffer(DetectEngineThreadCtx *det_ctx, Signature *s, SigMatch *sm,
         uint8_t *buffer, uint32_t buffer_len, uint32_t offset,
         Flow *f)
@@ -317,17 +345,17 @@ int DetectLuaMatchBuffer(DetectEngineThreadCtx *det_ctx, Signature *s, SigMatch
     LuaExtensionsMatchSetup(tluajit->luastate, luajit, det_ctx,
             f, flow_lock, /* no packet in the ctx */NULL, 0);
 
-    /* prepare data to pass to script */
+    /* prepare data to pass to script. The keys are the same on every
+     * call, so the args table is reused instead of built each time. */
     lua_getglobal(tluajit->luastate, "match");
-    lua_newtable(tluajit->luastate); /* stack at -1 */
+    lua_rawgeti(tluajit->luastate, LUA_REGISTRYINDEX, tluajit->args_ref); /* stack at -1 */
 
     lua_pushliteral (tluajit->luastate, "offset"); /* stack at -2 */
     lua_pushnumber (tluajit->luastate, (int)(offset + 1));
     lua_settable(tluajit->luastate, -3);
 
-    lua_pushstring (tluajit->luastate, luajit->buffername); /* stack at -2 */
-    LuaPushStringBuffer(tluajit->luastate, (const uint8_t *)buffer, (size_t)buffer_len);
-    lua_settable(tluajit->luastate, -3);
+    DetectLuaSetBuffer(tluajit->luastate, tluajit->ffi, luajit->buffername,
+            luajit->buffername_len, (const uint8_t *)buffer, buffer_len);
 
     int retval = lua_pcall(tluajit->luastate, 1, 1, 0);
     if (retval != 0) {
@@ -445,17 +473,15 @@ static int DetectLuaMatch (ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
     }
 
     lua_getglobal(tluajit->luastate, "match");
-    lua_newtable(tluajit->luastate); /* stack at -1 */
+    lua_createtable(tluajit->luastate, 0, 2); /* stack at -1 */
 
     if ((tluajit->flags & DATATYPE_PAYLOAD) && p->payload_len) {
-        lua_pushliteral(tluajit->luastate, "payload"); /* stack at -2 */
-        LuaPushStringBuffer (tluajit->luastate, (const uint8_t *)p->payload, (size_t)p->payload_len); /* stack at -3 */
-        lua_settable(tluajit->luastate, -3);
+        DetectLuaSetBuffer(tluajit->luastate, tluajit->ffi, "payload", "payload.len",
+                (const uint8_t *)p->payload, p->payload_len);
     }
     if ((tluajit->flags & DATATYPE_PACKET) && GET_PKT_LEN(p)) {
-        lua_pushliteral(tluajit->luastate, "packet"); /* stack at -2 */
-        LuaPushStringBuffer (tluajit->luastate, (const uint8_t *)GET_PKT_DATA(p), (size_t)GET_PKT_LEN(p)); /* stack at -3 */
-        lua_settable(tluajit->luastate, -3);
+        DetectLuaSetBuffer(tluajit->luastate, tluajit->ffi, "packet", "packet.len",
+                (const uint8_t *)GET_PKT_DATA(p), GET_PKT_LEN(p));
     }
     if (tluajit->alproto == ALPROTO_HTTP) {
         HtpState *htp_state = p->flow->alstate;
@@ -471,11 +497,10 @@ static int DetectLuaMatch (ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
 
                 if ((tluajit->flags & DATATYPE_HTTP_REQUEST_LINE) && tx->request_line != NULL &&
                     bstr_len(tx->request_line) > 0) {
-                    lua_pushliteral(tluajit->luastate, "http.request_line"); /* stack at -2 */
-                    LuaPushStringBuffer(tluajit->luastate,
-                                     (const uint8_t *)bstr_ptr(tx->request_line),
-                                     bstr_len(tx->request_line));
-                    lua_settable(tluajit->luastate, -3);
+                    DetectLuaSetBuffer(tluajit->luastate, tluajit->ffi,
+                            "http.request_line", "http.request_line.len",
+                            (const uint8_t *)bstr_ptr(tx->request_line),
+                            bstr_len(tx->request_line));
                 }
             }
         }
@@ -564,7 +589,7 @@ static int DetectLuaAppMatchCommon (ThreadVars *t, DetectEngineThreadCtx *det_ct
     }
 
     lua_getglobal(tluajit->luastate, "match");
-    lua_newtable(tluajit->luastate); /* stack at -1 */
+    lua_createtable(tluajit->luastate, 0, 2); /* stack at -1 */
 
     if (tluajit->alproto == ALPROTO_HTTP) {
         HtpState *htp_state = state;
@@ -574,11 +599,10 @@ static int DetectLuaAppMatchCommon (ThreadVars *t, DetectEngineThreadCtx *det_ct
             if (tx != NULL) {
                 if ((tluajit->flags & DATATYPE_HTTP_REQUEST_LINE) && tx->request_line != NULL &&
                     bstr_len(tx->request_line) > 0) {
-                    lua_pushliteral(tluajit->luastate, "http.request_line"); /* stack at -2 */
-                    LuaPushStringBuffer(tluajit->luastate,
-                                     (const uint8_t *)bstr_ptr(tx->request_line),
-                                     bstr_len(tx->request_line));
-                    lua_settable(tluajit->luastate, -3);
+                    DetectLuaSetBuffer(tluajit->luastate, tluajit->ffi,
+                            "http.request_line", "http.request_line.len",
+                            (const uint8_t *)bstr_ptr(tx->request_line),
+                            bstr_len(tx->request_line));
                 }
             }
         }
@@ -698,6 +722,8 @@ static void *DetectLuaThreadInit(void *data)
 
     t->alproto = luajit->alproto;
     t->flags = luajit->flags;
+    t->ffi = luajit->ffi;
+    t->args_ref = LUA_NOREF;
 
     t->luastate = DetectLuaGetState();
     if (t->luastate == NULL) {
@@ -741,6 +767,9 @@ static void *DetectLuaThreadInit(void *data)
         goto error;
     }
 
+    lua_newtable(t->luastate);
+    t->args_ref = luaL_ref(t->luastate, LUA_REGISTRYINDEX);
+
     return (void *)t;
 
 error:
@@ -754,8 +783,11 @@ static void DetectLuaThreadFree(void *ctx)
 {
     if (ctx != NULL) {
         DetectLuaThreadData *t = (DetectLuaThreadData *)ctx;
-        if (t->luastate != NULL)
+        if (t->luastate != NULL) {
+            /* the state goes back to the pool, drop our table */
+            luaL_unref(t->luastate, LUA_REGISTRYINDEX, t->args_ref);
             DetectLuaReturnState(t->luastate);
+        }
         SCFree(t);
     }
 }
@@ -1033,6 +1065,13 @@ static int DetectLuaSetupPrime(DetectEngineCtx *de_ctx, DetectLuaData *ld)
 
             ld->flags |= DATATYPE_SMTP;
 
+        } else if (strcmp(k, "ffi") == 0 && strcmp(v, "true") == 0) {
+#ifdef HAVE_LUAJIT
+            ld->ffi = 1;
+#else
+            SCLogError(SC_ERR_LUA_ERROR, "ffi buffers need LuaJIT");
+            goto error;
+#endif
         } else {
             SCLogError(SC_ERR_LUA_ERROR, "unsupported data type %s", k);
             goto error;
@@ -1042,6 +1081,16 @@ static int DetectLuaSetupPrime(DetectEngineCtx *de_ctx, DetectLuaData *ld)
     /* pop the table */
     lua_pop(luastate, 1);
     lua_close(luastate);
+
+    if (ld->ffi && ld->buffername != NULL) {
+        size_t len = strlen(ld->buffername) + sizeof(".len");
+        ld->buffername_len = SCMalloc(len);
+        if (ld->buffername_len == NULL) {
+            SCLogError(SC_ERR_LUA_ERROR, "alloc error");
+            return -1;
+        }
+        snprintf(ld->buffername_len, len, "%s.len", ld->buffername);
+    }
     return 0;
 error:
     lua_close(luastate);
@@ -1184,6 +1233,8 @@ static void DetectLuaFree(void *ptr)
 
         if (luajit->buffername)
             SCFree(luajit->buffername);
+        if (luajit->buffername_len)
+            SCFree(luajit->buffername_len);
         if (luajit->filename)
             SCFree(luajit->filename);
 
@@ -2084,6 +2135,89 @@ end:
     return result;
 }
 
+#ifdef HAVE_LUAJIT
+/** \test payload buffer passed as pointer and length through ffi */
+static int LuaMatchTest07(void)
+{
+    const char script[] =
+        "local ffi = require(\"ffi\")\n"
+        "function init (args)\n"
+        "   local needs = {}\n"
+        "   needs[\"payload\"] = tostring(true)\n"
+        "   needs[\"ffi\"] = tostring(true)\n"
+        "   return needs\n"
+        "end\n"
+        "\n"
+        "function match(args)\n"
+        "   local p = ffi.cast(\"const char *\", args[\"payload\"])\n"
+        "   local s = ffi.string(p, args[\"payload.len\"])\n"
+        "   if s:find(\"openinfosecfoundation\", 1, true) then\n"
+        "       return 1\n"
+        "   end\n"
+        "   return 0\n"
+        "end\n"
+        "return 0\n";
+    char sig[] = "alert tcp any any -> any any (flow:to_server; luajit:unittest; sid:1;)";
+    uint8_t buf1[] =
+        "POST / HTTP/1.1\r\n"
+        "Host: www.emergingthreats.net\r\n\r\n";
+    uint8_t buf2[] =
+        "POST / HTTP/1.1\r\n"
+        "Host: www.openinfosecfoundation.org\r\n\r\n";
+    TcpSession ssn;
+    Flow f;
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+
+    ut_script = script;
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    Packet *p1 = UTHBuildPacket(buf1, sizeof(buf1) - 1, IPPROTO_TCP);
+    Packet *p2 = UTHBuildPacket(buf2, sizeof(buf2) - 1, IPPROTO_TCP);
+    FAIL_IF_NULL(p1);
+    FAIL_IF_NULL(p2);
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+
+    p1->flow = &f;
+    p1->flowflags |= FLOW_PKT_TOSERVER|FLOW_PKT_ESTABLISHED;
+    p1->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+    p2->flow = &f;
+    p2->flowflags |= FLOW_PKT_TOSERVER|FLOW_PKT_ESTABLISHED;
+    p2->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+
+    StreamTcpInitConfig(TRUE);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, sig));
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p1);
+    FAIL_IF(PacketAlertCheck(p1, 1));
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p2);
+    FAIL_IF_NOT(PacketAlertCheck(p2, 1));
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    UTHFreePackets(&p1, 1);
+    UTHFreePackets(&p2, 1);
+    PASS;
+}
+#endif /* HAVE_LUAJIT */
+
 #endif
 
 void DetectLuaRegisterTests(void)
@@ -2095,6 +2229,9 @@ void DetectLuaRegisterTests(void)
     UtRegisterTest("LuaMatchTest04", LuaMatchTest04);
     UtRegisterTest("LuaMatchTest05", LuaMatchTest05);
     UtRegisterTest("LuaMatchTest06", LuaMatchTest06);
+#ifdef HAVE_LUAJIT
+    UtRegisterTest("LuaMatchTest07", LuaMatchTest07);
+#endif
 #endif
 }
 
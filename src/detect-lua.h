@@ -34,6 +34,9 @@ typedef struct DetectLuaThreadData {
     lua_State *luastate;
     uint32_t flags;
     int alproto;
+    int ffi;
+    int args_ref;   /**< registry ref of the reused args table of
+                     *   DetectLuaMatchBuffer */
 } DetectLuaThreadData;
 
 #define DETECT_LUAJIT_MAX_FLOWVARS  15
@@ -46,6 +49,8 @@ typedef struct DetectLuaData {
     uint32_t flags;
     AppProto alproto;
     char *buffername; /* buffer name in case of a single buffer */
+    char *buffername_len; /* buffername".len", the length key with ffi */
+    int ffi; /* pass buffers as pointer and length instead of strings */
     uint16_t flowint[DETECT_LUAJIT_MAX_FLOWINTS];
     uint16_t flowints;
     uint16_t flowvar[DETECT_LUAJIT_MAX_FLOWVARS];
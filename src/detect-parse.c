@@ -64,6 +64,7 @@
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
 #include "util-debug.h"
+#include "util-memuse.h"
 #include "string.h"
 #include "detect-parse.h"
 #include "detect-engine-iponly.h"
@@ -943,6 +944,7 @@ Signature *SigAlloc (void)
     Signature *sig = SCMalloc(sizeof(Signature));
     if (unlikely(sig == NULL))
         return NULL;
+    MemuseAlloc(MEMUSE_DETECT, sizeof(Signature));
 
     memset(sig, 0, sizeof(Signature));
 
@@ -985,13 +987,21 @@ static void SigRefFree (Signature *s)
     SCReturn;
 }
 
+/** \internal
+ *  \brief free the match arrays
+ *
+ *  SigMatchPrepare puts all lists in one allocation, starting at the
+ *  first list that has one.
+ */
 static void SigMatchFreeArrays(Signature *s)
 {
     if (s != NULL) {
         int type;
         for (type = 0; type < DETECT_SM_LIST_MAX; type++) {
-            if (s->sm_arrays[type] != NULL)
+            if (s->sm_arrays[type] != NULL) {
                 SCFree(s->sm_arrays[type]);
+                break;
+            }
         }
     }
 }
@@ -1047,12 +1057,16 @@ void SigFree(Signature *s)
     SigRefFree(s);
 
     SCFree(s);
+    MemuseFree(MEMUSE_DETECT, sizeof(Signature));
 }
 
 /**
  *  \internal
  *  \brief build address match array for cache efficient matching
  *
+ *  The arrays are sorted and overlapping ranges merged, so that they
+ *  can be binary searched.
+ *
  *  \param s the signature
  */
 static void SigBuildAddressMatchArray(Signature *s)
@@ -1075,7 +1089,7 @@ static void SigBuildAddressMatchArray(Signature *s)
             s->addr_src_match4[idx].ip2 = ntohl(da->ip2.addr_data32[0]);
             idx++;
         }
-        s->addr_src_match4_cnt = cnt;
+        s->addr_src_match4_cnt = DetectAddressMatchIPv4Sort(s->addr_src_match4, cnt);
     }
 
     /* destination addresses */
@@ -1096,7 +1110,7 @@ static void SigBuildAddressMatchArray(Signature *s)
             s->addr_dst_match4[idx].ip2 = ntohl(da->ip2.addr_data32[0]);
             idx++;
         }
-        s->addr_dst_match4_cnt = cnt;
+        s->addr_dst_match4_cnt = DetectAddressMatchIPv4Sort(s->addr_dst_match4, cnt);
     }
 
     /* source addresses IPv6 */
@@ -1123,7 +1137,7 @@ static void SigBuildAddressMatchArray(Signature *s)
             s->addr_src_match6[idx].ip2[3] = ntohl(da->ip2.addr_data32[3]);
             idx++;
         }
-        s->addr_src_match6_cnt = cnt;
+        s->addr_src_match6_cnt = DetectAddressMatchIPv6Sort(s->addr_src_match6, cnt);
     }
 
     /* destination addresses IPv6 */
@@ -1150,7 +1164,7 @@ static void SigBuildAddressMatchArray(Signature *s)
             s->addr_dst_match6[idx].ip2[3] = ntohl(da->ip2.addr_data32[3]);
             idx++;
         }
-        s->addr_dst_match6_cnt = cnt;
+        s->addr_dst_match6_cnt = DetectAddressMatchIPv6Sort(s->addr_dst_match6, cnt);
     }
 }
 
@@ -58,6 +58,10 @@
 #include "app-layer-protos.h"
 #include "app-layer-parser.h"
 
+#ifdef BUILD_HYPERSCAN
+#include <hs.h>
+#endif
+
 #define PARSE_CAPTURE_REGEX "\\(\\?P\\<([A-z]+)\\_([A-z0-9_]+)\\>"
 #define PARSE_REGEX         "(?<!\\\\)/(.*(?<!(?<!\\\\)\\\\))/([^\"]*)"
 
@@ -67,6 +71,34 @@
 static int pcre_match_limit = 0;
 static int pcre_match_limit_recursion = 0;
 
+#ifdef PCRE_HAVE_JIT_EXEC
+/* per thread jit stack, the default one on the machine stack is only 32k */
+#define PCRE_JIT_STACK_MIN      (32 * 1024)
+#define PCRE_JIT_STACK_MAX      (512 * 1024)
+#endif
+
+typedef struct DetectPcreThreadData_ {
+#ifdef PCRE_HAVE_JIT_EXEC
+    pcre_jit_stack *jit_stack;
+#endif
+#ifdef BUILD_HYPERSCAN
+    hs_scratch_t *hs_scratch;
+#endif
+#if !defined(PCRE_HAVE_JIT_EXEC) && !defined(BUILD_HYPERSCAN)
+    int unused;
+#endif
+} DetectPcreThreadData;
+
+/* passed as data to DetectRegisterThreadCtxFuncs, which wants it non-NULL */
+static int pcre_thread_ctx_data = 1;
+
+#ifdef BUILD_HYPERSCAN
+static int pcre_hs_prefilter = 0;
+/* grown for every prefilter database, cloned by the detect threads */
+static hs_scratch_t *pcre_hs_scratch_proto = NULL;
+static SCMutex pcre_hs_scratch_lock = SCMUTEX_INITIALIZER;
+#endif
+
 static pcre *parse_regex;
 static pcre_extra *parse_regex_study;
 static pcre *parse_capture_regex;
@@ -123,6 +155,13 @@ void DetectPcreRegister (void)
         }
     }
 
+#ifdef BUILD_HYPERSCAN
+    if (ConfGetBool("pcre.hyperscan-prefilter", &pcre_hs_prefilter) != 1)
+        pcre_hs_prefilter = 0;
+    if (pcre_hs_prefilter)
+        SCLogConfig("using hyperscan prefilters for pcre");
+#endif
+
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 
     /* setup the capture regex, as it needs PCRE_UNGREEDY we do it manually */
@@ -146,6 +185,148 @@ void DetectPcreRegister (void)
     return;
 }
 
+static void *DetectPcreThreadInit(void *data)
+{
+    DetectPcreThreadData *td = SCCalloc(1, sizeof(DetectPcreThreadData));
+    if (unlikely(td == NULL))
+        return NULL;
+
+#ifdef PCRE_HAVE_JIT_EXEC
+    /* without a stack of our own pcre_exec() falls back to the default */
+    td->jit_stack = pcre_jit_stack_alloc(PCRE_JIT_STACK_MIN, PCRE_JIT_STACK_MAX);
+#endif
+#ifdef BUILD_HYPERSCAN
+    SCMutexLock(&pcre_hs_scratch_lock);
+    if (pcre_hs_scratch_proto != NULL &&
+        hs_clone_scratch(pcre_hs_scratch_proto, &td->hs_scratch) != HS_SUCCESS)
+    {
+        td->hs_scratch = NULL;
+    }
+    SCMutexUnlock(&pcre_hs_scratch_lock);
+#endif
+    return td;
+}
+
+static void DetectPcreThreadFree(void *ctx)
+{
+    DetectPcreThreadData *td = ctx;
+    if (td == NULL)
+        return;
+
+#ifdef PCRE_HAVE_JIT_EXEC
+    if (td->jit_stack != NULL)
+        pcre_jit_stack_free(td->jit_stack);
+#endif
+#ifdef BUILD_HYPERSCAN
+    if (td->hs_scratch != NULL)
+        hs_free_scratch(td->hs_scratch);
+#endif
+    SCFree(td);
+}
+
+#ifdef BUILD_HYPERSCAN
+/** \internal
+ *  \brief compile a prefilter for the regex, if hyperscan supports it
+ *
+ *  Prefilter mode may match more than the regex but never less. Patterns
+ *  it can't handle are simply left without prefilter. */
+static void DetectPcreHSPrefilterSetup(DetectPcreData *pd, const char *re,
+                                       int opts)
+{
+    hs_compile_error_t *compile_err = NULL;
+    unsigned int flags = HS_FLAG_PREFILTER | HS_FLAG_SINGLEMATCH;
+
+    /* options that can be dropped: they only make the regex stricter or
+     * don't change whether it matches */
+    opts &= ~(PCRE_ANCHORED | PCRE_DOLLAR_ENDONLY | PCRE_UNGREEDY |
+              PCRE_NO_AUTO_CAPTURE);
+    if (opts & PCRE_CASELESS)
+        flags |= HS_FLAG_CASELESS;
+    if (opts & PCRE_DOTALL)
+        flags |= HS_FLAG_DOTALL;
+    if (opts & PCRE_MULTILINE)
+        flags |= HS_FLAG_MULTILINE;
+    if (opts & PCRE_UTF8)
+        flags |= HS_FLAG_UTF8;
+    opts &= ~(PCRE_CASELESS | PCRE_DOTALL | PCRE_MULTILINE | PCRE_UTF8);
+    if (opts != 0) {
+        SCLogDebug("pcre options %x not supported by hyperscan", opts);
+        return;
+    }
+
+    hs_database_t *db = NULL;
+    if (hs_compile(re, flags, HS_MODE_BLOCK, NULL, &db,
+                   &compile_err) != HS_SUCCESS) {
+        SCLogDebug("no hyperscan prefilter for \"%s\": %s", re,
+                   compile_err ? compile_err->message : "unknown");
+        hs_free_compile_error(compile_err);
+        return;
+    }
+
+    SCMutexLock(&pcre_hs_scratch_lock);
+    hs_error_t err = hs_alloc_scratch(db, &pcre_hs_scratch_proto);
+    SCMutexUnlock(&pcre_hs_scratch_lock);
+    if (err != HS_SUCCESS) {
+        hs_free_database(db);
+        return;
+    }
+    pd->hs_db = db;
+}
+
+static int DetectPcreHSMatchEvent(unsigned int id, unsigned long long from,
+                                  unsigned long long to, unsigned int flags,
+                                  void *ctx)
+{
+    *(int *)ctx = 1;
+    /* one match is enough */
+    return 1;
+}
+
+/** \internal
+ *  \retval 0 the regex can't match the buffer, 1 it may */
+static int DetectPcreHSPrefilter(const DetectPcreData *pe,
+                                 const DetectPcreThreadData *td,
+                                 const uint8_t *buf, uint16_t len)
+{
+    if (pe->hs_db == NULL || td == NULL || td->hs_scratch == NULL)
+        return 1;
+
+    int match = 0;
+    hs_error_t err = hs_scan(pe->hs_db, (const char *)buf, len, 0,
+                             td->hs_scratch, DetectPcreHSMatchEvent, &match);
+    if (err != HS_SUCCESS && err != HS_SCAN_TERMINATED)
+        return 1;
+    return match;
+}
+#endif /* BUILD_HYPERSCAN */
+
+/** \internal
+ *  \brief run the regex, through the prefilter and the thread's jit stack
+ *          when available */
+static inline int DetectPcreExec(DetectEngineThreadCtx *det_ctx,
+                                 const DetectPcreData *pe, const uint8_t *ptr,
+                                 uint16_t len, int start_offset, int *ov,
+                                 int ovsize)
+{
+#if defined(PCRE_HAVE_JIT_EXEC) || defined(BUILD_HYPERSCAN)
+    DetectPcreThreadData *td = NULL;
+    if (pe->thread_ctx_id != -1)
+        td = DetectThreadCtxGetKeywordThreadCtx(det_ctx, pe->thread_ctx_id);
+#endif
+#ifdef BUILD_HYPERSCAN
+    if (DetectPcreHSPrefilter(pe, td, ptr, len) == 0)
+        return PCRE_ERROR_NOMATCH;
+#endif
+#ifdef PCRE_HAVE_JIT_EXEC
+    if ((pe->flags & DETECT_PCRE_JIT) && td != NULL && td->jit_stack != NULL) {
+        return pcre_jit_exec(pe->re, pe->sd, (const char *)ptr, len,
+                             start_offset, 0, ov, ovsize, td->jit_stack);
+    }
+#endif
+    return pcre_exec(pe->re, pe->sd, (const char *)ptr, len, start_offset, 0,
+                     ov, ovsize);
+}
+
 /**
  * \brief Match a regex on a single payload.
  *
@@ -188,7 +369,7 @@ int DetectPcrePayloadMatch(DetectEngineThreadCtx *det_ctx, Signature *s,
     }
 
     /* run the actual pcre detection */
-    ret = pcre_exec(pe->re, pe->sd, (char *)ptr, len, start_offset, 0, ov, MAX_SUBSTRINGS);
+    ret = DetectPcreExec(det_ctx, pe, ptr, len, start_offset, ov, MAX_SUBSTRINGS);
     SCLogDebug("ret %d (negating %s)", ret, (pe->flags & DETECT_PCRE_NEGATE) ? "set" : "not set");
 
     if (ret == PCRE_ERROR_NOMATCH) {
@@ -334,6 +515,7 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr,
     if (unlikely(pd == NULL))
         goto error;
     memset(pd, 0, sizeof(DetectPcreData));
+    pd->thread_ctx_id = -1;
 
     if (negate)
         pd->flags |= DETECT_PCRE_NEGATE;
@@ -520,6 +702,8 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr,
         SCLogDebug("PCRE JIT compiler does not support: %s. "
                 "Falling back to regular PCRE handling (%s:%d)",
                 regexstr, de_ctx->rule_file, de_ctx->rule_line);
+    } else {
+        pd->flags |= DETECT_PCRE_JIT;
     }
 #else
     pd->sd = pcre_study(pd->re, 0, &eb);
@@ -556,6 +740,10 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr,
         goto error;
     }
 
+#ifdef BUILD_HYPERSCAN
+    if (pcre_hs_prefilter)
+        DetectPcreHSPrefilterSetup(pd, re, opts);
+#endif
     return pd;
 
 error:
@@ -652,6 +840,23 @@ static int DetectPcreSetup (DetectEngineCtx *de_ctx, Signature *s, char *regexst
     if (DetectPcreParseCapture(regexstr, de_ctx, pd) < 0)
         goto error;
 
+    int need_thread_ctx = 0;
+#ifdef PCRE_HAVE_JIT_EXEC
+    if (pd->flags & DETECT_PCRE_JIT)
+        need_thread_ctx = 1;
+#endif
+#ifdef BUILD_HYPERSCAN
+    if (pd->hs_db != NULL)
+        need_thread_ctx = 1;
+#endif
+    if (need_thread_ctx) {
+        pd->thread_ctx_id = DetectRegisterThreadCtxFuncs(de_ctx, "pcre",
+                DetectPcreThreadInit, (void *)&pcre_thread_ctx_data,
+                DetectPcreThreadFree, 1);
+        if (pd->thread_ctx_id == -1)
+            goto error;
+    }
+
     if (parsed_sm_list == DETECT_SM_LIST_UMATCH ||
         parsed_sm_list == DETECT_SM_LIST_HRUDMATCH ||
         parsed_sm_list == DETECT_SM_LIST_HCBDMATCH ||
@@ -789,6 +994,10 @@ void DetectPcreFree(void *ptr)
         pcre_free(pd->re);
     if (pd->sd != NULL)
         pcre_free_study(pd->sd);
+#ifdef BUILD_HYPERSCAN
+    if (pd->hs_db != NULL)
+        hs_free_database(pd->hs_db);
+#endif
 
     SCFree(pd);
     return;
@@ -4066,6 +4275,37 @@ end:
     return result;
 }
 
+#ifdef BUILD_HYPERSCAN
+/** \test hyperscan prefilter rules out buffers the regex can't match */
+static int DetectPcreHSPrefilterTest01(void)
+{
+    int list = DETECT_SM_LIST_NOTSET;
+    int old = pcre_hs_prefilter;
+    pcre_hs_prefilter = 1;
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    DetectPcreData *pd = DetectPcreParse(de_ctx, "/ab[0-9]+cd/i", &list);
+    FAIL_IF_NULL(pd);
+    FAIL_IF_NULL(pd->hs_db);
+
+    DetectPcreThreadData *td = DetectPcreThreadInit(&pcre_thread_ctx_data);
+    FAIL_IF_NULL(td);
+    FAIL_IF_NULL(td->hs_scratch);
+
+    const char *yes = "xxAB12CDyy";
+    const char *no = "abcdab1c";
+    FAIL_IF(DetectPcreHSPrefilter(pd, td, (uint8_t *)yes, strlen(yes)) != 1);
+    FAIL_IF(DetectPcreHSPrefilter(pd, td, (uint8_t *)no, strlen(no)) != 0);
+
+    DetectPcreThreadFree(td);
+    DetectPcreFree(pd);
+    DetectEngineCtxFree(de_ctx);
+    pcre_hs_prefilter = old;
+    PASS;
+}
+#endif /* BUILD_HYPERSCAN */
+
 #endif /* UNITTESTS */
 
 /**
@@ -4148,6 +4388,9 @@ void DetectPcreRegisterTests(void)
                    DetectPcreFlowvarCapture03);
 
     UtRegisterTest("DetectPcreParseHttpHost", DetectPcreParseHttpHost);
+#ifdef BUILD_HYPERSCAN
+    UtRegisterTest("DetectPcreHSPrefilterTest01", DetectPcreHSPrefilterTest01);
+#endif
 
 #endif /* UNITTESTS */
 }
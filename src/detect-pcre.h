@@ -32,6 +32,7 @@
 #define DETECT_PCRE_MATCH_LIMIT         0x00020
 #define DETECT_PCRE_RELATIVE_NEXT       0x00040
 #define DETECT_PCRE_NEGATE              0x00080
+#define DETECT_PCRE_JIT                 0x00100
 
 typedef struct DetectPcreData_ {
     /* pcre options */
@@ -41,6 +42,12 @@ typedef struct DetectPcreData_ {
     uint16_t flags;
     uint16_t capidx;
     char *capname;
+    /* id of the jit stack and hyperscan scratch, -1 if none */
+    int thread_ctx_id;
+#ifdef BUILD_HYPERSCAN
+    /* prefilter: if it doesn't match, the regex can't either */
+    struct hs_database *hs_db;
+#endif
 } DetectPcreData;
 
 /* prototypes */
@@ -31,6 +31,7 @@
 #include "detect-parse.h"
 
 #include "detect-ttl.h"
+#include "detect-engine-prefilter.h"
 #include "util-debug.h"
 
 /**
@@ -46,6 +47,7 @@ int DetectTtlMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature *
 static int DetectTtlSetup (DetectEngineCtx *, Signature *, char *);
 void DetectTtlFree (void *);
 void DetectTtlRegisterTests (void);
+static int PrefilterSetupTtl(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
 
 /**
  * \brief Registration function for ttl: keyword
@@ -60,11 +62,26 @@ void DetectTtlRegister(void)
     sigmatch_table[DETECT_TTL].Setup = DetectTtlSetup;
     sigmatch_table[DETECT_TTL].Free = DetectTtlFree;
     sigmatch_table[DETECT_TTL].RegisterTests = DetectTtlRegisterTests;
+    sigmatch_table[DETECT_TTL].SetupPrefilter = PrefilterSetupTtl;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
     return;
 }
 
+static inline int TtlMatch(const uint8_t pttl, const DetectTtlData *ttld)
+{
+    if (ttld->mode == DETECT_TTL_EQ && pttl == ttld->ttl1)
+        return 1;
+    else if (ttld->mode == DETECT_TTL_LT && pttl < ttld->ttl1)
+        return 1;
+    else if (ttld->mode == DETECT_TTL_GT && pttl > ttld->ttl1)
+        return 1;
+    else if (ttld->mode == DETECT_TTL_RA && (pttl > ttld->ttl1 && pttl < ttld->ttl2))
+        return 1;
+
+    return 0;
+}
+
 /**
  * \brief This function is used to match TTL rule option on a packet with those passed via ttl:
  *
@@ -78,8 +95,6 @@ void DetectTtlRegister(void)
  */
 int DetectTtlMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Signature *s, const SigMatchCtx *ctx)
 {
-
-    int ret = 0;
     uint8_t pttl;
     const DetectTtlData *ttld = (const DetectTtlData *)ctx;
 
@@ -92,19 +107,33 @@ int DetectTtlMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Si
         pttl = IPV6_GET_HLIM(p);
     } else {
         SCLogDebug("Packet is of not IPv4 or IPv6");
-        return ret;
+        return 0;
     }
 
-    if (ttld->mode == DETECT_TTL_EQ && pttl == ttld->ttl1)
-        ret = 1;
-    else if (ttld->mode == DETECT_TTL_LT && pttl < ttld->ttl1)
-        ret = 1;
-    else if (ttld->mode == DETECT_TTL_GT && pttl > ttld->ttl1)
-        ret = 1;
-    else if (ttld->mode == DETECT_TTL_RA && (pttl > ttld->ttl1 && pttl < ttld->ttl2))
-        ret = 1;
+    return TtlMatch(pttl, ttld);
+}
+
+static int PrefilterTtlCompare(const uint8_t value, const SigMatchCtx *ctx)
+{
+    return TtlMatch(value, (const DetectTtlData *)ctx);
+}
+
+static void PrefilterPacketTtlMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void *pectx)
+{
+    if (PKT_IS_PSEUDOPKT(p))
+        return;
 
-    return ret;
+    if (PKT_IS_IPV4(p)) {
+        PrefilterPacketU8TableAdd(det_ctx, pectx, IPV4_GET_IPTTL(p));
+    } else if (PKT_IS_IPV6(p)) {
+        PrefilterPacketU8TableAdd(det_ctx, pectx, IPV6_GET_HLIM(p));
+    }
+}
+
+static int PrefilterSetupTtl(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketU8Table(sgh, DETECT_TTL,
+            PrefilterTtlCompare, PrefilterPacketTtlMatch);
 }
 
 /**
@@ -30,6 +30,7 @@
 #include "flow.h"
 #include "flow-private.h"
 #include "flow-bit.h"
+#include "flow-worker.h"
 
 #include "detect-parse.h"
 #include "detect-engine.h"
@@ -37,12 +38,17 @@
 
 #include "detect-engine-alert.h"
 #include "detect-engine-siggroup.h"
+#include "detect-engine-prefilter.h"
 #include "detect-engine-address.h"
 #include "detect-engine-proto.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
 #include "detect-engine-iponly.h"
+#include "detect-engine-fpstats.h"
+#include "detect-engine-guard.h"
+#include "detect-engine-tenant.h"
 #include "detect-engine-threshold.h"
+#include "detect-engine-content-inspection.h"
 
 #include "detect-engine-payload.h"
 #include "detect-engine-dcepayload.h"
@@ -156,6 +162,7 @@
 #include "detect-app-layer-event.h"
 #include "detect-lua.h"
 #include "detect-iprep.h"
+#include "detect-dataset.h"
 #include "detect-geoip.h"
 #include "detect-app-layer-protocol.h"
 #include "detect-template.h"
@@ -187,7 +194,9 @@
 
 #include "stream-tcp.h"
 #include "stream-tcp-inline.h"
+#include "stream-tcp-reassemble.h"
 
+#include "util-arena.h"
 #include "util-var-name.h"
 #include "util-classification-config.h"
 #include "util-print.h"
@@ -195,9 +204,12 @@
 #include "util-unittest-helper.h"
 #include "util-debug.h"
 #include "util-hashlist.h"
+#include "util-hash-lookup3.h"
 #include "util-cuda.h"
 #include "util-privs.h"
+#include "util-cpu.h"
 #include "util-profiling.h"
+#include "util-profiling-sample.h"
 #include "util-validate.h"
 #include "util-optimize.h"
 #include "util-path.h"
@@ -211,6 +223,7 @@ extern int rule_reload;
 extern int engine_analysis;
 static int fp_engine_analysis_set = 0;
 static int rule_engine_analysis_set = 0;
+static int cost_engine_analysis_set = 0;
 
 SigMatch *SigMatchAlloc(void);
 void DetectExitPrintStats(ThreadVars *tv, void *data);
@@ -325,6 +338,8 @@ static int DetectLoadSigFile(DetectEngineCtx *de_ctx, char *sig_file,
         /* Reset offset. */
         offset = 0;
 
+        hashlittle2(line, strlen(line), &de_ctx->ruleset_hash[0], &de_ctx->ruleset_hash[1]);
+
         de_ctx->rule_file = sig_file;
         de_ctx->rule_line = lineno - multiline;
 
@@ -408,12 +423,23 @@ static int ProcessSigFiles(DetectEngineCtx *de_ctx, char *pattern,
     return r;
 }
 
+static inline uint64_t SigLoadElapsedUsec(const struct timeval *start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t usec = (int64_t)(now.tv_sec - start->tv_sec) * 1000000 +
+                   (int64_t)(now.tv_usec - start->tv_usec);
+    return usec > 0 ? (uint64_t)usec : 0;
+}
+
 /**
  *  \brief Load signatures
  *  \param de_ctx Pointer to the detection engine context
  *  \param sig_file Filename (or pattern) holding signatures
  *  \param sig_file_exclusive File passed in 'sig_file' should be loaded exclusively.
  *  \retval -1 on error
+ *  \retval 1 with DE_RELOAD_UNCHANGED_SKIP set: ruleset unchanged, the
+ *          engine was not built
  */
 int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_exclusive)
 {
@@ -427,8 +453,10 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
     char varname[128] = "rule-files";
     int good_sigs = 0;
     int bad_sigs = 0;
+    struct timeval phase_start;
 
     memset(&sig_stat, 0, sizeof(SigFileLoaderStat));
+    gettimeofday(&phase_start, NULL);
 
     if (strlen(de_ctx->config_prefix) > 0) {
         snprintf(varname, sizeof(varname), "%s.rule-files",
@@ -438,6 +466,7 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
     if (RunmodeGetCurrent() == RUNMODE_ENGINE_ANALYSIS) {
         fp_engine_analysis_set = SetupFPAnalyzer();
         rule_engine_analysis_set = SetupRuleAnalyzer();
+        cost_engine_analysis_set = SetupCostAnalyzer();
     }
 
     /* ok, let's load signature files from the general config */
@@ -481,6 +510,8 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
         }
     }
 
+    sig_stat.parse_usec = SigLoadElapsedUsec(&phase_start);
+
     /* now we should have signatures to work with */
     if (sig_stat.good_sigs_total <= 0) {
         if (sig_stat.total_files > 0) {
@@ -500,13 +531,36 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
         goto end;
     }
 
+    DetectEngineHashConfig(de_ctx);
+    if ((de_ctx->flags & DE_RELOAD_UNCHANGED_SKIP) &&
+        memcmp(de_ctx->ruleset_hash, de_ctx->reload_ruleset_hash,
+               sizeof(de_ctx->ruleset_hash)) == 0)
+    {
+        SCLogConfig("rules and config unchanged, skipping engine build");
+        ret = 1;
+        goto end;
+    }
+
+    gettimeofday(&phase_start, NULL);
     SCSigRegisterSignatureOrderingFuncs(de_ctx);
     SCSigOrderSignatures(de_ctx);
     SCSigSignatureOrderingModuleCleanup(de_ctx);
+    sig_stat.order_usec = SigLoadElapsedUsec(&phase_start);
 
     /* Setup the signature group lookup structure and pattern matchers */
+    gettimeofday(&phase_start, NULL);
     if (SigGroupBuild(de_ctx) < 0)
         goto end;
+    sig_stat.build_usec = SigLoadElapsedUsec(&phase_start);
+
+    if (cost_engine_analysis_set)
+        EngineAnalysisRulesCost(de_ctx);
+
+    SCLogInfo("rule loading took %"PRIu64" ms: parsing %"PRIu64" ms, "
+            "ordering %"PRIu64" ms, building %"PRIu64" ms",
+            (sig_stat.parse_usec + sig_stat.order_usec + sig_stat.build_usec) / 1000,
+            sig_stat.parse_usec / 1000, sig_stat.order_usec / 1000,
+            sig_stat.build_usec / 1000);
 
     ret = 0;
 
@@ -518,6 +572,9 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
         if (fp_engine_analysis_set) {
             CleanupFPAnalyzer();
         }
+        if (cost_engine_analysis_set) {
+            CleanupCostAnalyzer();
+        }
     }
 
     DetectParseDupSigHashFree(de_ctx);
@@ -693,8 +750,56 @@ end:
     SCReturnPtr(smsg, "StreamMsg");
 }
 
+/** \internal
+ *  \brief quick reject of a candidate sig on the compact sig header
+ *
+ *  Checks the mask, app proto, dsize and ip version, so that sigs failing
+ *  those are dropped from the match array without touching the Signature.
+ *
+ *  \retval 1 sig may match
+ *  \retval 0 sig can't match
+ */
+static inline int SigHeaderMatch(const SignatureHeader *h, const SignatureMask mask,
+                                 const AppProto alproto, const uint16_t payload_len,
+                                 const uint8_t proto_flags)
+{
+    if ((h->mask & mask) != h->mask)
+        return 0;
+
+    /* if the sig has alproto and the session as well they should match */
+    if (likely(h->flags & SIG_FLAG_APPLAYER)) {
+        if (h->alproto != ALPROTO_UNKNOWN && h->alproto != alproto) {
+            if (h->alproto == ALPROTO_DCERPC) {
+                if (alproto != ALPROTO_SMB && alproto != ALPROTO_SMB2) {
+                    SCLogDebug("DCERPC sig, alproto not SMB or SMB2");
+                    return 0;
+                }
+            } else {
+                SCLogDebug("alproto mismatch");
+                return 0;
+            }
+        }
+    }
+
+    if (unlikely(h->flags & SIG_FLAG_DSIZE)) {
+        if (likely(payload_len < h->dsize_low || payload_len > h->dsize_high)) {
+            SCLogDebug("kicked out as p->payload_len %u, dsize low %u, hi %u",
+                       payload_len, h->dsize_low, h->dsize_high);
+            return 0;
+        }
+    }
+
+    if ((h->proto_flags & (DETECT_PROTO_IPV4|DETECT_PROTO_IPV6)) & ~proto_flags) {
+        SCLogDebug("ip version didn't match");
+        return 0;
+    }
+    return 1;
+}
+
 static inline void DetectPrefilterMergeSort(DetectEngineCtx *de_ctx,
-                                            DetectEngineThreadCtx *det_ctx)
+                                            DetectEngineThreadCtx *det_ctx,
+                                            SignatureMask mask, AppProto alproto,
+                                            uint16_t payload_len, uint8_t proto_flags)
 {
     SigIntId mpm, nonmpm;
     det_ctx->match_array_cnt = 0;
@@ -707,8 +812,8 @@ static inline void DetectPrefilterMergeSort(DetectEngineCtx *de_ctx,
     SigIntId id;
     SigIntId previous_id = (SigIntId)-1;
     Signature **sig_array = de_ctx->sig_array;
+    const SignatureHeader *sig_hdrs = de_ctx->sig_header_array;
     Signature **match_array = det_ctx->match_array;
-    Signature *s;
 
     SCLogDebug("PMQ rule id array count %d", det_ctx->pmq.rule_id_array_cnt);
 
@@ -734,10 +839,10 @@ static inline void DetectPrefilterMergeSort(DetectEngineCtx *de_ctx,
             /* Take from mpm list */
             id = mpm;
 
-            s = sig_array[id];
             /* As the mpm list can contain duplicates, check for that here. */
             if (likely(id != previous_id)) {
-                *match_array++ = s;
+                if (SigHeaderMatch(&sig_hdrs[id], mask, alproto, payload_len, proto_flags))
+                    *match_array++ = sig_array[id];
                 previous_id = id;
             }
             if (unlikely(--m_cnt == 0)) {
@@ -751,10 +856,10 @@ static inline void DetectPrefilterMergeSort(DetectEngineCtx *de_ctx,
          } else if (mpm > nonmpm) {
              id = nonmpm;
 
-             s = sig_array[id];
              /* As the mpm list can contain duplicates, check for that here. */
              if (likely(id != previous_id)) {
-                 *match_array++ = s;
+                 if (SigHeaderMatch(&sig_hdrs[id], mask, alproto, payload_len, proto_flags))
+                     *match_array++ = sig_array[id];
                  previous_id = id;
              }
              if (unlikely(--n_cnt == 0)) {
@@ -803,11 +908,11 @@ static inline void DetectPrefilterMergeSort(DetectEngineCtx *de_ctx,
 
     while (final_cnt-- > 0) {
         id = *final_ptr++;
-        s = sig_array[id];
 
         /* As the mpm list can contain duplicates, check for that here. */
         if (likely(id != previous_id)) {
-            *match_array++ = s;
+            if (SigHeaderMatch(&sig_hdrs[id], mask, alproto, payload_len, proto_flags))
+                *match_array++ = sig_array[id];
             previous_id = id;
         }
     }
@@ -817,6 +922,126 @@ static inline void DetectPrefilterMergeSort(DetectEngineCtx *de_ctx,
     BUG_ON((det_ctx->pmq.rule_id_array_cnt + det_ctx->non_mpm_id_cnt) < det_ctx->match_array_cnt);
 }
 
+/** \internal
+ *  \brief merge the mpm and non-mpm lists through a bitmap
+ *
+ *  Used instead of sorting the pmq when it holds many candidates. The
+ *  mpm ids are OR'd in, which takes care of the duplicates, the non-mpm
+ *  ids are XOR'd in so that a sig on both lists (negated mpm) is
+ *  dropped, like in DetectPrefilterMergeSort. Words are cleared while
+ *  they are extracted, so the bitmap is all zero again afterwards.
+ */
+static inline void DetectPrefilterMergeBits(DetectEngineCtx *de_ctx,
+                                            DetectEngineThreadCtx *det_ctx,
+                                            SignatureMask mask, AppProto alproto,
+                                            uint16_t payload_len, uint8_t proto_flags)
+{
+    uint64_t *bits = det_ctx->match_bits;
+    const SigIntId *mpm_ptr = det_ctx->pmq.rule_id_array;
+    const SigIntId *nonmpm_ptr = det_ctx->non_mpm_id_array;
+    const uint32_t m_cnt = det_ctx->pmq.rule_id_array_cnt;
+    const uint32_t n_cnt = det_ctx->non_mpm_id_cnt;
+    Signature **sig_array = de_ctx->sig_array;
+    const SignatureHeader *sig_hdrs = de_ctx->sig_header_array;
+    Signature **match_array = det_ctx->match_array;
+    uint32_t min_word = det_ctx->match_bits_len;
+    uint32_t max_word = 0;
+    uint32_t i;
+
+    for (i = 0; i < m_cnt; i++) {
+        const SigIntId id = mpm_ptr[i];
+        const uint32_t w = id / 64;
+        bits[w] |= (1ULL << (id % 64));
+        if (w < min_word)
+            min_word = w;
+        if (w > max_word)
+            max_word = w;
+    }
+    for (i = 0; i < n_cnt; i++) {
+        const SigIntId id = nonmpm_ptr[i];
+        const uint32_t w = id / 64;
+        bits[w] ^= (1ULL << (id % 64));
+        if (w < min_word)
+            min_word = w;
+        if (w > max_word)
+            max_word = w;
+    }
+
+    for (i = min_word; i <= max_word; i++) {
+        uint64_t word = bits[i];
+        if (word == 0)
+            continue;
+        bits[i] = 0;
+        do {
+            const SigIntId id = (SigIntId)(i * 64 + __builtin_ctzll(word));
+            if (SigHeaderMatch(&sig_hdrs[id], mask, alproto, payload_len, proto_flags))
+                *match_array++ = sig_array[id];
+            word &= word - 1;
+        } while (word != 0);
+    }
+
+    det_ctx->match_array_cnt = match_array - det_ctx->match_array;
+
+    BUG_ON((det_ctx->pmq.rule_id_array_cnt + det_ctx->non_mpm_id_cnt) < det_ctx->match_array_cnt);
+}
+
+/** \internal
+ *  \brief drop sigs from the match array that need a flowbit the flow
+ *         doesn't have
+ *
+ *  Both the match array and the sgh's flowbit_req_array are sorted by
+ *  sig id, so this is a single merge pass.
+ */
+static inline void DetectPrefilterFlowbits(DetectEngineThreadCtx *det_ctx,
+                                           const SigGroupHead *sgh, Flow *f)
+{
+    const SignatureFlowbitReq *req = sgh->flowbit_req_array;
+    const SignatureFlowbitReq *req_end = req + sgh->flowbit_req_cnt;
+    Signature **match_array = det_ctx->match_array;
+    Signature **end = match_array + det_ctx->match_array_cnt;
+    Signature **out = match_array;
+
+    for ( ; match_array < end; match_array++) {
+        Signature *s = *match_array;
+        while (req < req_end && req->id < s->num)
+            req++;
+
+        if (req < req_end && req->id == s->num &&
+            (f == NULL || FlowBitIsnotset(f, req->idx)))
+        {
+            SCLogDebug("sig %u needs flowbit %u, skipped", s->id, req->idx);
+            continue;
+        }
+        *out++ = s;
+    }
+
+    det_ctx->match_array_cnt = out - det_ctx->match_array;
+}
+
+/** \internal
+ *  \brief drop the sigs that aren't priority rules from the match array
+ *
+ *  Used while the flow worker is shedding load, see flow-worker.c.
+ */
+static inline void DetectPrefilterPriority(DetectEngineThreadCtx *det_ctx,
+                                           int priority)
+{
+    Signature **match_array = det_ctx->match_array;
+    Signature **end = match_array + det_ctx->match_array_cnt;
+    Signature **out = match_array;
+
+    for ( ; match_array < end; match_array++) {
+        Signature *s = *match_array;
+        if (s->prio > priority) {
+            SCLogDebug("sig %u prio %d, skipped under overload", s->id, s->prio);
+            continue;
+        }
+        *out++ = s;
+    }
+
+    det_ctx->match_array_cnt = out - det_ctx->match_array;
+}
+
 /* Return true is the list is sorted smallest to largest */
 static void QuickSortSigIntId(SigIntId *sids, uint32_t n)
 {
@@ -1077,6 +1302,9 @@ static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
     }
 
     if (p->payload_len > 0 && (!(p->flags & PKT_NOPAYLOAD_INSPECTION))) {
+        if (unlikely(det_ctx->fp_stats != NULL)) {
+            FpStatsSample(det_ctx->fp_stats, p->payload, p->payload_len);
+        }
         if (!(p->flags & PKT_STREAM_ADD) && (det_ctx->sgh->flags & SIG_GROUP_HEAD_MPM_STREAM)) {
             *sms_runflags |= SMS_USED_PM;
             PACKET_PROFILING_DETECT_START(p, PROF_DETECT_MPM_PKT_STREAM);
@@ -1126,11 +1354,6 @@ static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
         }
     }
 
-    /* Sort the rule list to lets look at pmq.
-     * NOTE due to merging of 'stream' pmqs we *MAY* have duplicate entries */
-    if (det_ctx->pmq.rule_id_array_cnt > 1) {
-        QuickSortSigIntId(det_ctx->pmq.rule_id_array, det_ctx->pmq.rule_id_array_cnt);
-    }
 }
 
 #ifdef DEBUG
@@ -1170,15 +1393,9 @@ static void AlertDebugLogModeSyncFlowbitsNamesToPacketStruct(Packet *p, DetectEn
            sizeof(char *) * p->debuglog_flowbits_names_len);
 
     i = 0;
-    gv = p->flow->flowvar;
-    while (gv != NULL) {
-        if (gv->type != DETECT_FLOWBITS) {
-            gv = gv->next;
-            continue;
-        }
-
-        FlowBit *fb = (FlowBit *) gv;
-        char *name = VariableIdxGetName(de_ctx, fb->idx, VAR_TYPE_FLOW_BIT);
+    int idx = FlowBitGetNext(p->flow, 0);
+    while (idx >= 0) {
+        char *name = VariableIdxGetName(de_ctx, (uint16_t)idx, VAR_TYPE_FLOW_BIT);
         if (name != NULL) {
             p->debuglog_flowbits_names[i] = SCStrdup(name);
             if (p->debuglog_flowbits_names[i] == NULL) {
@@ -1204,7 +1421,7 @@ static void AlertDebugLogModeSyncFlowbitsNamesToPacketStruct(Packet *p, DetectEn
                    0, sizeof(char *) * MALLOC_JUMP);
         }
 
-        gv = gv->next;
+        idx = FlowBitGetNext(p->flow, (uint32_t)idx + 1);
     }
 
     return;
@@ -1252,9 +1469,7 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
     uint8_t sms_runflags = 0;   /* function flags */
     uint8_t alert_flags = 0;
     AppProto alproto = ALPROTO_UNKNOWN;
-#ifdef PROFILING
     int smatch = 0; /* signature match: 1, no match: 0 */
-#endif
     uint8_t flow_flags = 0; /* flow/state flags */
     StreamMsg *smsg = NULL;
     Signature *s = NULL;
@@ -1318,6 +1533,10 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
                 pflow->sgh_toserver = NULL;
                 pflow->sgh_toclient = NULL;
 
+                /* ip-only sigs of the new engine haven't seen this flow */
+                pflow->flags &= ~(FLOW_TOSERVER_IPONLY_SET|FLOW_TOCLIENT_IPONLY_SET);
+                pflow->flags &= ~FLOW_NO_RESPONSE_BODY;
+
                 pflow->de_ctx_id = de_ctx->id;
                 GenericVarFree(pflow->flowvar);
                 pflow->flowvar = NULL;
@@ -1349,6 +1568,13 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
                 PACKET_PROFILING_DETECT_END(p, PROF_DETECT_GETSGH);
 
                 smsg = SigMatchSignaturesGetSmsg(pflow, p, flow_flags);
+                /* overload: shed raw stream inspection first */
+                if (smsg != NULL && det_ctx->tv != NULL &&
+                    det_ctx->tv->overload_level >= FLOW_WORKER_OVERLOAD_NO_RAW)
+                {
+                    StreamMsgReturnListToPool(smsg);
+                    smsg = NULL;
+                }
 #if 0
                 StreamMsg *tmpsmsg = smsg;
                 while (tmpsmsg) {
@@ -1475,7 +1701,13 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
     /* run the mpm for each type */
     PACKET_PROFILING_DETECT_START(p, PROF_DETECT_MPM);
     DetectMpmPrefilter(de_ctx, det_ctx, smsg, p, flow_flags, alproto, has_state, &sms_runflags);
+    /* keyword prefilters add their candidates to the mpm ones */
+    if (det_ctx->sgh->prefilter_engines != NULL) {
+        PrefilterRunEngines(det_ctx, p);
+    }
     PACKET_PROFILING_DETECT_END(p, PROF_DETECT_MPM);
+    if (det_ctx->tenant_stats != NULL)
+        det_ctx->tenant_stats->c.mpm_matches += det_ctx->pmq.rule_id_array_cnt;
 #ifdef PROFILING
     if (th_v) {
         StatsAddUI64(th_v, det_ctx->counter_mpm_list,
@@ -1489,7 +1721,29 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
 #endif
 
     PACKET_PROFILING_DETECT_START(p, PROF_DETECT_PREFILTER);
-    DetectPrefilterMergeSort(de_ctx, det_ctx);
+    /* with many mpm candidates walking a bitmap of all sigs is cheaper
+     * than sorting the pmq. Otherwise sort, keeping in mind that due to
+     * merging of 'stream' pmqs we *MAY* have duplicate entries */
+    const uint8_t pkt_proto_flags = (PKT_IS_IPV4(p) ? DETECT_PROTO_IPV4 : 0) |
+                                    (PKT_IS_IPV6(p) ? DETECT_PROTO_IPV6 : 0);
+    if (det_ctx->pmq.rule_id_array_cnt > det_ctx->match_bits_len) {
+        DetectPrefilterMergeBits(de_ctx, det_ctx, mask, alproto,
+                                 p->payload_len, pkt_proto_flags);
+    } else {
+        if (det_ctx->pmq.rule_id_array_cnt > 1) {
+            QuickSortSigIntId(det_ctx->pmq.rule_id_array, det_ctx->pmq.rule_id_array_cnt);
+        }
+        DetectPrefilterMergeSort(de_ctx, det_ctx, mask, alproto,
+                                 p->payload_len, pkt_proto_flags);
+    }
+    if (det_ctx->sgh->flowbit_req_cnt > 0 && det_ctx->match_array_cnt > 0) {
+        DetectPrefilterFlowbits(det_ctx, det_ctx->sgh, pflow);
+    }
+    if (det_ctx->tv != NULL && det_ctx->match_array_cnt > 0 &&
+        det_ctx->tv->overload_level >= FLOW_WORKER_OVERLOAD_PRIO)
+    {
+        DetectPrefilterPriority(det_ctx, fw_overload.priority);
+    }
     PACKET_PROFILING_DETECT_END(p, PROF_DETECT_PREFILTER);
 
     PACKET_PROFILING_DETECT_START(p, PROF_DETECT_RULES);
@@ -1513,6 +1767,9 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
 #endif
 #endif
 
+    /* time the rules of this packet for the rule guard */
+    const int guard_sample = RULE_GUARD_SAMPLE(det_ctx);
+
     uint32_t sflags, next_sflags = 0;
     if (match_cnt) {
         next_s = *match_array++;
@@ -1521,10 +1778,9 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
 
     while (match_cnt--) {
         RULE_PROFILING_START(p);
+        uint64_t guard_start = guard_sample ? UtilCpuGetTicks() : 0;
         state_alert = 0;
-#ifdef PROFILING
         smatch = 0;
-#endif
 
         s = next_s;
         sflags = next_sflags;
@@ -1532,35 +1788,17 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
             next_s = *match_array++;
             next_sflags = next_s->flags;
         }
-        uint8_t s_proto_flags = s->proto.flags;
-
-        SCLogDebug("inspecting signature id %"PRIu32"", s->id);
 
-        if ((s->mask & mask) != s->mask)
+        /* disabled for using too much cpu */
+        if (RULE_GUARD_SKIP(det_ctx, s, p)) {
+            guard_start = 0;
             goto next;
-
-        /* if the sig has alproto and the session as well they should match */
-        if (likely(sflags & SIG_FLAG_APPLAYER)) {
-            if (s->alproto != ALPROTO_UNKNOWN && s->alproto != alproto) {
-                if (s->alproto == ALPROTO_DCERPC) {
-                    if (alproto != ALPROTO_SMB && alproto != ALPROTO_SMB2) {
-                        SCLogDebug("DCERPC sig, alproto not SMB or SMB2");
-                        goto next;
-                    }
-                } else {
-                    SCLogDebug("alproto mismatch");
-                    goto next;
-                }
-            }
         }
 
-        if (unlikely(sflags & SIG_FLAG_DSIZE)) {
-            if (likely(p->payload_len < s->dsize_low || p->payload_len > s->dsize_high)) {
-                SCLogDebug("kicked out as p->payload_len %u, dsize low %u, hi %u",
-                           p->payload_len, s->dsize_low, s->dsize_high);
-                goto next;
-            }
-        }
+        SCLogDebug("inspecting signature id %"PRIu32"", s->id);
+
+        /* mask, alproto, dsize and ip version were checked against the
+         * sig header when the match array was built */
 
         if (sflags & SIG_FLAG_STATE_MATCH) {
             if (det_ctx->de_state_sig_array[s->num] & DE_STATE_MATCH_NO_NEW_STATE)
@@ -1581,15 +1819,6 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
             }
         }
 
-        if ((s_proto_flags & DETECT_PROTO_IPV4) && !PKT_IS_IPV4(p)) {
-            SCLogDebug("ip version didn't match");
-            goto next;
-        }
-        if ((s_proto_flags & DETECT_PROTO_IPV6) && !PKT_IS_IPV6(p)) {
-            SCLogDebug("ip version didn't match");
-            goto next;
-        }
-
         if (DetectProtoContainsProto(&s->proto, IP_GET_IPPROTO(p)) == 0) {
             SCLogDebug("proto didn't match");
             goto next;
@@ -1749,9 +1978,7 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
             alert_flags |= PACKET_ALERT_FLAG_STATE_MATCH;
         }
 
-#ifdef PROFILING
         smatch = 1;
-#endif
 
         SigMatchSignaturesRunPostMatch(th_v, de_ctx, det_ctx, p, s);
 
@@ -1768,6 +1995,10 @@ next:
         DetectFlowvarProcessList(det_ctx, pflow);
         DetectReplaceFree(det_ctx);
         RULE_PROFILING_END(det_ctx, s, smatch, p);
+        if (guard_start != 0) {
+            RuleGuardUpdate(det_ctx, s, UtilCpuGetTicks() - guard_start,
+                    (uint32_t)p->ts.tv_sec);
+        }
 
         det_ctx->flags = 0;
         continue;
@@ -1794,6 +2025,8 @@ end:
     PacketAlertFinalize(de_ctx, det_ctx, p);
     if (p->alerts.cnt > 0) {
         StatsAddUI64(th_v, det_ctx->counter_alerts, (uint64_t)p->alerts.cnt);
+        if (det_ctx->tenant_stats != NULL)
+            det_ctx->tenant_stats->c.alerts += p->alerts.cnt;
     }
     PACKET_PROFILING_DETECT_END(p, PROF_DETECT_ALERT);
 
@@ -1803,8 +2036,8 @@ end:
 
     DetectEngineCleanHCBDBuffers(det_ctx);
     DetectEngineCleanHSBDBuffers(det_ctx);
-    DetectEngineCleanHHDBuffers(det_ctx);
     DetectEngineCleanSMTPBuffers(det_ctx);
+    ArenaReset(det_ctx->arena);
 
     /* store the found sgh (or NULL) in the flow to save us from looking it
      * up again for the next packet. Also return any stream chunk we processed
@@ -1855,6 +2088,16 @@ end:
                     SCLogDebug("disabling filesize for flow");
                     FileDisableFilesize(pflow, STREAM_TOSERVER);
                 }
+
+                /* no stream sigs means the to server raw stream is never
+                 * inspected, so don't reassemble it */
+                if (p->proto == IPPROTO_TCP && pflow->protoctx != NULL &&
+                        (pflow->sgh_toserver == NULL ||
+                         !(pflow->sgh_toserver->flags & SIG_GROUP_HEAD_HAVESTREAM)))
+                {
+                    SCLogDebug("disabling raw reassembly toserver for flow");
+                    StreamTcpSetDisableRawReassemblyFlag((TcpSession *)pflow->protoctx, 0);
+                }
             } else if ((p->flowflags & FLOW_PKT_TOCLIENT) && !(pflow->flags & FLOW_SGH_TOCLIENT)) {
                 pflow->sgh_toclient = det_ctx->sgh;
                 pflow->flags |= FLOW_SGH_TOCLIENT;
@@ -1886,6 +2129,21 @@ end:
                     SCLogDebug("disabling filesize for flow");
                     FileDisableFilesize(pflow, STREAM_TOCLIENT);
                 }
+
+                if (p->proto == IPPROTO_TCP && pflow->protoctx != NULL &&
+                        (pflow->sgh_toclient == NULL ||
+                         !(pflow->sgh_toclient->flags & SIG_GROUP_HEAD_HAVESTREAM)))
+                {
+                    SCLogDebug("disabling raw reassembly toclient for flow");
+                    StreamTcpSetDisableRawReassemblyFlag((TcpSession *)pflow->protoctx, 1);
+                }
+
+                if (pflow->sgh_toclient == NULL ||
+                        !(pflow->sgh_toclient->flags & SIG_GROUP_HEAD_HAVERESPBODY))
+                {
+                    SCLogDebug("no response body inspection for flow");
+                    pflow->flags |= FLOW_NO_RESPONSE_BODY;
+                }
             }
         }
 
@@ -1915,12 +2173,17 @@ void DetectSignatureApplyActions(Packet *p, const Signature *s)
 
 /* tm module api functions */
 
-static DetectEngineThreadCtx *GetTenantById(HashTable *h, uint32_t id)
+static DetectEngineThreadCtx *GetTenantById(const DetectEngineThreadCtx *det_ctx, uint32_t id)
 {
+    /* direct lookup if the tenant ids are small enough, id is already
+     * checked against mt_det_ctxs_cnt by the caller */
+    if (likely(det_ctx->mt_det_ctxs != NULL))
+        return det_ctx->mt_det_ctxs[id];
+
     /* technically we need to pass a DetectEngineThreadCtx struct with the
      * tentant_id member. But as that member is the first in the struct, we
      * can use the id directly. */
-    return HashTableLookup(h, &id, 0);
+    return HashTableLookup(det_ctx->mt_det_ctxs_hash, &id, 0);
 }
 
 static void DetectFlow(ThreadVars *tv,
@@ -1949,7 +2212,9 @@ static void DetectFlow(ThreadVars *tv,
     }
 
     /* see if the packet matches one or more of the sigs */
+    RULE_SAMPLE_PACKET_START(det_ctx);
     (void)SigMatchSignatures(tv,de_ctx,det_ctx,p);
+    RULE_SAMPLE_PACKET_END(det_ctx);
 }
 
 
@@ -1965,7 +2230,9 @@ static void DetectNoFlow(ThreadVars *tv,
     }
 
     /* see if the packet matches one or more of the sigs */
+    RULE_SAMPLE_PACKET_START(det_ctx);
     (void)SigMatchSignatures(tv,de_ctx,det_ctx,p);
+    RULE_SAMPLE_PACKET_END(det_ctx);
     return;
 }
 
@@ -2003,7 +2270,7 @@ TmEcode Detect(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQue
             tenant_id = det_ctx->TenantGetId(det_ctx, p);
         if (tenant_id > 0 && tenant_id < det_ctx->mt_det_ctxs_cnt) {
             p->tenant_id = tenant_id;
-            det_ctx = GetTenantById(det_ctx->mt_det_ctxs_hash, tenant_id);
+            det_ctx = GetTenantById(det_ctx, tenant_id);
             if (det_ctx == NULL)
                 return TM_ECODE_OK;
             de_ctx = det_ctx->de_ctx;
@@ -2022,6 +2289,11 @@ TmEcode Detect(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQue
         de_ctx = det_ctx->de_ctx;
     }
 
+    DetectTenantThread *tenant_stats = det_ctx->tenant_stats;
+    uint64_t tenant_start = 0;
+    if (tenant_stats != NULL)
+        tenant_start = DetectTenantPacketStart(tenant_stats);
+
     if (p->flow) {
         det_ctx->flow_locked = 1;
         DetectFlow(tv, de_ctx, det_ctx, p);
@@ -2029,6 +2301,9 @@ TmEcode Detect(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQue
     } else {
         DetectNoFlow(tv, de_ctx, det_ctx, p);
     }
+
+    if (tenant_stats != NULL)
+        DetectTenantPacketEnd(tenant_stats, tenant_start);
     return TM_ECODE_OK;
 error:
     return TM_ECODE_FAILED;
@@ -2359,7 +2634,8 @@ deonly:
 /* Create mask for this packet + it's flow if it has one
  *
  * Sets SIG_MASK_REQUIRE_PAYLOAD, SIG_MASK_REQUIRE_FLOW,
- * SIG_MASK_REQUIRE_HTTP_STATE, SIG_MASK_REQUIRE_DCE_STATE
+ * SIG_MASK_REQUIRE_HTTP_STATE, SIG_MASK_REQUIRE_DCE_STATE,
+ * SIG_MASK_REQUIRE_IPOPTS, ...
  */
 static void
 PacketCreateMask(Packet *p, SignatureMask *mask, AppProto alproto, int has_state, StreamMsg *smsg,
@@ -2379,6 +2655,11 @@ PacketCreateMask(Packet *p, SignatureMask *mask, AppProto alproto, int has_state
         (*mask) |= SIG_MASK_REQUIRE_ENGINE_EVENT;
     }
 
+    if (PKT_IS_IPV4(p) && !PKT_IS_PSEUDOPKT(p) && p->ip4vars.opts_set != 0) {
+        SCLogDebug("packet has ip options");
+        (*mask) |= SIG_MASK_REQUIRE_IPOPTS;
+    }
+
     if (PKT_IS_TCP(p)) {
         if ((p->tcph->th_flags & MASK_TCP_INITDEINIT_FLAGS) != 0) {
             (*mask) |= SIG_MASK_REQUIRE_FLAGS_INITDEINIT;
@@ -2428,6 +2709,10 @@ PacketCreateMask(Packet *p, SignatureMask *mask, AppProto alproto, int has_state
                     SCLogDebug("packet/flow has template state");
                     (*mask) |= SIG_MASK_REQUIRE_TEMPLATE_STATE;
                     break;
+                case ALPROTO_MODBUS:
+                    SCLogDebug("packet/flow has modbus state");
+                    (*mask) |= SIG_MASK_REQUIRE_MODBUS_STATE;
+                    break;
                 default:
                     SCLogDebug("packet/flow has other state");
                     break;
@@ -2646,6 +2931,10 @@ static int SignatureCreateMask(Signature *s)
             case DETECT_ENGINE_EVENT:
                 s->mask |= SIG_MASK_REQUIRE_ENGINE_EVENT;
                 break;
+            case DETECT_IPOPTS:
+                s->mask |= SIG_MASK_REQUIRE_IPOPTS;
+                SCLogDebug("sig requires ip options");
+                break;
         }
     }
 
@@ -2673,6 +2962,10 @@ static int SignatureCreateMask(Signature *s)
         s->mask |= SIG_MASK_REQUIRE_TEMPLATE_STATE;
         SCLogDebug("sig requires template state");
     }
+    if (s->alproto == ALPROTO_MODBUS) {
+        s->mask |= SIG_MASK_REQUIRE_MODBUS_STATE;
+        SCLogDebug("sig requires modbus state");
+    }
 
     if ((s->mask & SIG_MASK_REQUIRE_DCE_STATE) ||
         (s->mask & SIG_MASK_REQUIRE_HTTP_STATE) ||
@@ -2681,6 +2974,7 @@ static int SignatureCreateMask(Signature *s)
         (s->mask & SIG_MASK_REQUIRE_FTP_STATE) ||
         (s->mask & SIG_MASK_REQUIRE_SMTP_STATE) ||
         (s->mask & SIG_MASK_REQUIRE_TEMPLATE_STATE) ||
+        (s->mask & SIG_MASK_REQUIRE_MODBUS_STATE) ||
         (s->mask & SIG_MASK_REQUIRE_TLS_STATE))
     {
         s->mask |= SIG_MASK_REQUIRE_FLOW;
@@ -2702,7 +2996,7 @@ static int SignatureCreateMask(Signature *s)
         SCLogDebug("sig requires flow");
     }
 
-    SCLogDebug("mask %02X", s->mask);
+    SCLogDebug("mask %08X", s->mask);
     SCReturnInt(0);
 }
 
@@ -3447,6 +3741,10 @@ static DetectPort *RulesGroupByPorts(DetectEngineCtx *de_ctx, int ipproto, uint3
     uint32_t cnt = 0;
     uint32_t own = 0;
     uint32_t ref = 0;
+    /* candidate sigs summed over all ports, as a cost estimate for
+     * the grouping assuming traffic spread over the ports evenly */
+    uint64_t sigs_per_port = 0;
+    uint32_t covered = 0;
     DetectPort *iter;
     for (iter = list ; iter != NULL; iter = iter->next) {
         BUG_ON (iter->sh == NULL);
@@ -3474,6 +3772,14 @@ static DetectPort *RulesGroupByPorts(DetectEngineCtx *de_ctx, int ipproto, uint3
             de_ctx->gh_reuse++;
             ref++;
         }
+
+        /* groups are disjoint, except for the catch-all that is looked
+         * up last and so only gets the ports the others don't cover */
+        uint32_t width = (uint32_t)iter->port2 - (uint32_t)iter->port + 1;
+        if (width == 65536)
+            width -= covered;
+        covered += width;
+        sigs_per_port += (uint64_t)width * iter->sh->sig_cnt;
     }
 #if 0
     for (iter = list ; iter != NULL; iter = iter->next) {
@@ -3484,10 +3790,11 @@ static DetectPort *RulesGroupByPorts(DetectEngineCtx *de_ctx, int ipproto, uint3
                 iter->sh->init->whitelist);
     }
 #endif
-    SCLogPerf("%s %s: %u port groups, %u unique SGH's, %u copies",
+    SCLogPerf("%s %s: %u port groups, %u unique SGH's, %u copies, "
+            "%"PRIu64" sigs per port on average",
             ipproto == 6 ? "TCP" : "UDP",
             direction == SIG_FLAG_TOSERVER ? "toserver" : "toclient",
-            cnt, own, ref);
+            cnt, own, ref, sigs_per_port / 65536);
     return list;
 }
 
@@ -3973,6 +4280,9 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
 
     //SCLogInfo("sgh's %"PRIu32, de_ctx->sgh_array_cnt);
 
+    /* sigs with a prefilter keyword stay out of the non-mpm lists */
+    PrefilterSetupSignatures(de_ctx);
+
     uint32_t cnt = 0;
     uint32_t idx = 0;
     for (idx = 0; idx < de_ctx->sgh_array_cnt; idx++) {
@@ -3989,13 +4299,31 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
         SCLogDebug("filestore count %u", sgh->filestore_cnt);
 
         BUG_ON(PatternMatchPrepareGroup(de_ctx, sgh) != 0);
+        SigGroupHeadSetStreamFlag(de_ctx, sgh);
+        SigGroupHeadSetRespBodyFlag(de_ctx, sgh);
         SigGroupHeadBuildNonMpmArray(de_ctx, sgh);
+        if (PrefilterSetupGroup(de_ctx, sgh) != 0) {
+            SCReturnInt(-1);
+        }
+        SigGroupHeadBuildFlowbitReqArray(de_ctx, sgh);
+
+        if (sgh->sig_cnt > de_ctx->sgh_sig_cnt_max)
+            de_ctx->sgh_sig_cnt_max = sgh->sig_cnt;
 
         sgh->id = idx;
         cnt++;
     }
     SCLogPerf("Unique rule groups: %u", cnt);
 
+    if (de_ctx->decoder_event_sgh != NULL &&
+        de_ctx->decoder_event_sgh->sig_cnt > de_ctx->sgh_sig_cnt_max)
+        de_ctx->sgh_sig_cnt_max = de_ctx->decoder_event_sgh->sig_cnt;
+
+    if (MpmStorePrepareAll(de_ctx) != 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to prepare mpm contexts");
+        SCReturnInt(-1);
+    }
+
     MpmStoreReportStats(de_ctx);
 
     if (de_ctx->decoder_event_sgh != NULL) {
@@ -4038,27 +4366,59 @@ static int SigMatchPrepare(DetectEngineCtx *de_ctx)
 {
     SCEnter();
 
+    /* compact copy of the fields the prefilter rejects on */
+    if (de_ctx->sig_header_array != NULL)
+        SCFree(de_ctx->sig_header_array);
+    de_ctx->sig_header_array = NULL;
+    if (de_ctx->sig_array_len > 0) {
+        de_ctx->sig_header_array = SCCalloc(de_ctx->sig_array_len, sizeof(SignatureHeader));
+        if (de_ctx->sig_header_array == NULL) {
+            SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     Signature *s = de_ctx->sig_list;
     for (; s != NULL; s = s->next) {
+        SignatureHeader *h = &de_ctx->sig_header_array[s->num];
+        h->flags = s->flags;
+        h->mask = s->mask;
+        h->alproto = s->alproto;
+        h->dsize_low = s->dsize_low;
+        h->dsize_high = s->dsize_high;
+        h->proto_flags = s->proto.flags;
+
+        DetectEngineContentInspectionPrepare(s);
+
+        /* all lists of the sig go into a single allocation, in list
+         * order, so the first non-NULL array is the one to free */
+        int lens[DETECT_SM_LIST_MAX];
+        int total = 0;
         int type;
         for (type = 0; type < DETECT_SM_LIST_MAX; type++) {
+            lens[type] = SigMatchListLen(s->sm_lists[type]);
+            total += lens[type];
+            s->sm_arrays[type] = NULL;
+        }
+        if (total == 0)
+            continue;
+
+        SigMatchData *smd = (SigMatchData*)SCMalloc(total * sizeof(SigMatchData));
+        if (smd == NULL) {
+            SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
+            exit(EXIT_FAILURE);
+        }
+        for (type = 0; type < DETECT_SM_LIST_MAX; type++) {
+            if (lens[type] == 0)
+                continue;
+
+            /* Copy sm type and Context into array */
+            s->sm_arrays[type] = smd;
             SigMatch *sm = s->sm_lists[type];
-            int len = SigMatchListLen(sm);
-            if (len == 0)
-                s->sm_arrays[type] = NULL;
-            else {
-                SigMatchData *smd = (SigMatchData*)SCMalloc(len * sizeof(SigMatchData));
-                if (smd == NULL) {
-                    SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
-                    exit(EXIT_FAILURE);
-                }
-                /* Copy sm type and Context into array */
-                s->sm_arrays[type] = smd;
-                for (; sm != NULL; sm = sm->next, smd++) {
-                    smd->type = sm->type;
-                    smd->ctx = sm->ctx;
-                    smd->is_last = (sm->next == NULL);
-                }
+            for (; sm != NULL; sm = sm->next, smd++) {
+                smd->type = sm->type;
+                smd->ctx = sm->ctx;
+                smd->is_last = (sm->next == NULL);
             }
         }
     }
@@ -4156,6 +4516,12 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
         exit(EXIT_FAILURE);
     }
 
+    /* rule options and the sgh's arrays are not counted */
+    de_ctx->memuse = sizeof(DetectEngineCtx) +
+        (uint64_t)de_ctx->sig_cnt * sizeof(Signature) +
+        (uint64_t)de_ctx->sgh_array_cnt * sizeof(SigGroupHead) +
+        MpmStoreMemuse(de_ctx);
+
 #ifdef PROFILING
     SCProfilingRuleInitCounters(de_ctx);
 #endif
@@ -4374,6 +4740,7 @@ void SigTableSetup(void)
     DetectHttpHRHRegister();
     DetectLuaRegister();
     DetectIPRepRegister();
+    DetectDatasetRegister();
     DetectDnsQueryRegister();
     DetectTlsSniRegister();
     DetectModbusRegister();
@@ -9881,6 +10248,148 @@ end:
     return result;
 }
 
+/** \test the bitmap merge of the mpm and non-mpm lists gives the same
+ *        result as the sort and merge */
+static int SigTestMergeBits01(void)
+{
+    DetectEngineCtx de_ctx;
+    DetectEngineThreadCtx det_ctx;
+    Signature sigs[200];
+    Signature *sig_array[200];
+    SignatureHeader sig_hdrs[200];
+    Signature *match_array[200];
+    uint64_t match_bits[4];
+    SigIntId mpm_ids1[] = { 150, 3, 70, 3, 199, 64, 10, 150, 63 };
+    SigIntId mpm_ids2[sizeof(mpm_ids1) / sizeof(SigIntId)];
+    /* 10 is on both lists, so it's a negated mpm sig that matched */
+    SigIntId nonmpm_ids[] = { 0, 10, 65, 128 };
+    Signature *expect[200];
+    uint32_t expect_cnt;
+    uint32_t i;
+
+    memset(&de_ctx, 0, sizeof(de_ctx));
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    memset(&match_bits, 0, sizeof(match_bits));
+    memset(&sig_hdrs, 0, sizeof(sig_hdrs));
+    for (i = 0; i < 200; i++)
+        sig_array[i] = &sigs[i];
+    memcpy(mpm_ids2, mpm_ids1, sizeof(mpm_ids1));
+
+    de_ctx.sig_array = sig_array;
+    de_ctx.sig_header_array = sig_hdrs;
+    det_ctx.match_array = match_array;
+    det_ctx.match_bits = match_bits;
+    det_ctx.match_bits_len = 4;
+    det_ctx.non_mpm_id_array = nonmpm_ids;
+    det_ctx.non_mpm_id_cnt = sizeof(nonmpm_ids) / sizeof(SigIntId);
+
+    det_ctx.pmq.rule_id_array = mpm_ids1;
+    det_ctx.pmq.rule_id_array_cnt = sizeof(mpm_ids1) / sizeof(SigIntId);
+    QuickSortSigIntId(mpm_ids1, det_ctx.pmq.rule_id_array_cnt);
+    DetectPrefilterMergeSort(&de_ctx, &det_ctx, 0, ALPROTO_UNKNOWN, 0, 0);
+    expect_cnt = det_ctx.match_array_cnt;
+    memcpy(expect, match_array, expect_cnt * sizeof(Signature *));
+    FAIL_IF(expect_cnt != 9);
+
+    det_ctx.pmq.rule_id_array = mpm_ids2;
+    DetectPrefilterMergeBits(&de_ctx, &det_ctx, 0, ALPROTO_UNKNOWN, 0, 0);
+    FAIL_IF(det_ctx.match_array_cnt != expect_cnt);
+    FAIL_IF(memcmp(expect, match_array, expect_cnt * sizeof(Signature *)) != 0);
+
+    /* bitmap is left cleared */
+    for (i = 0; i < 4; i++)
+        FAIL_IF(match_bits[i] != 0);
+
+    PASS;
+}
+
+/** \test ipopts and modbus sigs get the mask bits, and only packets with
+ *        ip options get the ipopts bit */
+static int SigTestMask01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = SigInit(de_ctx, "alert ip any any -> any any "
+                           "(ipopts:rr; sid:1;)");
+    FAIL_IF_NULL(s);
+    SignatureCreateMask(s);
+    FAIL_IF_NOT(s->mask & SIG_MASK_REQUIRE_IPOPTS);
+    SigFree(s);
+
+    s = SigInit(de_ctx, "alert modbus any any -> any any "
+                "(modbus:function 1; sid:2;)");
+    FAIL_IF_NULL(s);
+    SignatureCreateMask(s);
+    FAIL_IF_NOT(s->mask & SIG_MASK_REQUIRE_MODBUS_STATE);
+    FAIL_IF_NOT(s->mask & SIG_MASK_REQUIRE_FLOW);
+    SigFree(s);
+
+    Packet *p = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    SignatureMask mask = 0;
+    PacketCreateMask(p, &mask, ALPROTO_UNKNOWN, 0, NULL, 0);
+    FAIL_IF(mask & SIG_MASK_REQUIRE_IPOPTS);
+
+    p->ip4vars.opts_set |= IPV4_OPT_FLAG_RR;
+    mask = 0;
+    PacketCreateMask(p, &mask, ALPROTO_UNKNOWN, 0, NULL, 0);
+    FAIL_IF_NOT(mask & SIG_MASK_REQUIRE_IPOPTS);
+
+    UTHFreePackets(&p, 1);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/** \test a flow last inspected by another detect engine gets its sgh and
+ *        ip-only state reset, so the new engine's ip-only sigs run */
+static int SigTestEngineSwitch01(void)
+{
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    Flow f;
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    de_ctx->sig_list = SigInit(de_ctx, "alert ip any any -> any any "
+                               "(msg:\"ip-only\"; sid:1;)");
+    FAIL_IF_NULL(de_ctx->sig_list);
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    Packet *p = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    FLOW_INITIALIZE(&f);
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+    p->flow = &f;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+    p->flags |= PKT_HAS_FLOW;
+
+    /* pretend an earlier engine already inspected this direction */
+    f.de_ctx_id = de_ctx->id + 1;
+    f.flags |= (FLOW_TOSERVER_IPONLY_SET|FLOW_SGH_TOSERVER);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1));
+    FAIL_IF(f.de_ctx_id != de_ctx->id);
+    FAIL_IF_NOT(f.flags & FLOW_TOSERVER_IPONLY_SET);
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    SigGroupCleanup(de_ctx);
+    DetectEngineCtxFree(de_ctx);
+    FLOW_DESTROY(&f);
+    UTHFreePackets(&p, 1);
+    PASS;
+}
+
 static const char *dummy_conf_string2 =
     "%YAML 1.1\n"
     "---\n"
@@ -10185,6 +10694,9 @@ void SigRegisterTests(void)
 
     UtRegisterTest("SigTestPorts01", SigTestPorts01);
     UtRegisterTest("SigTestBug01", SigTestBug01);
+    UtRegisterTest("SigTestMergeBits01", SigTestMergeBits01);
+    UtRegisterTest("SigTestMask01", SigTestMask01);
+    UtRegisterTest("SigTestEngineSwitch01", SigTestEngineSwitch01);
 
 #if 0
     DetectSimdRegisterTests();
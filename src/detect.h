@@ -78,6 +78,9 @@ struct SCSigSignatureWrapper_;
  * DETECT ADDRESS
  */
 
+/** number of entries in the content inspection memo, power of 2 */
+#define DETECT_INSPECTION_MEMO_SIZE 256
+
 /* holds the values for different possible lists in struct Signature.
  * These codes are access points to particular lists in the array
  * Signature->sm_lists[DETECT_SM_LIST_MAX]. */
@@ -293,9 +296,10 @@ typedef struct DetectPort_ {
 #define SIG_MASK_REQUIRE_FTP_STATE          (1<<11)
 #define SIG_MASK_REQUIRE_SMTP_STATE         (1<<12)
 #define SIG_MASK_REQUIRE_TEMPLATE_STATE     (1<<13)
+#define SIG_MASK_REQUIRE_IPOPTS             (1<<14)   /* IPv4 options present */
+#define SIG_MASK_REQUIRE_MODBUS_STATE       (1<<15)
 
-/* for now a uint8_t is enough */
-#define SignatureMask uint16_t
+#define SignatureMask uint32_t
 
 #define DETECT_ENGINE_THREAD_CTX_INSPECTING_PACKET 0x0001
 #define DETECT_ENGINE_THREAD_CTX_INSPECTING_STREAM 0x0002
@@ -311,6 +315,8 @@ typedef struct DetectPort_ {
 
 /* Detection Engine flags */
 #define DE_QUIET           0x01     /**< DE is quiet (esp for unittests) */
+#define DE_RELOAD_UNCHANGED_SKIP 0x02 /**< don't build if ruleset_hash equals
+                                        *   reload_ruleset_hash */
 
 typedef struct IPOnlyCIDRItem_ {
     /* address data for this item */
@@ -431,6 +437,9 @@ typedef struct Signature_ {
     SigMatch *dsize_sm;
     /* the fast pattern added from this signature */
     SigMatch *mpm_sm;
+    /* keyword that puts this sig in a prefilter engine instead of the
+     * non-mpm list, see detect-engine-prefilter.c */
+    SigMatch *prefilter_sm;
 
     /* SigMatch list used for adding content and friends. E.g. file_data; */
     int list;
@@ -517,13 +526,16 @@ typedef struct DetectEngineLookupFlow_ {
  */
 #define FLOW_STATES 2
 
+/** number of locks the rate_filter "by_rule" entries are spread over */
+#define THRESHOLD_RULE_LOCKS    64
+
 /** \brief threshold ctx */
 typedef struct ThresholdCtx_    {
-    SCMutex threshold_table_lock;                   /**< Mutex for hash table */
-
     /** to support rate_filter "by_rule" option */
     DetectThresholdEntry **th_entry;
     uint32_t th_size;
+    /** locks for th_entry, indexed by sig num % THRESHOLD_RULE_LOCKS */
+    SCMutex th_entry_lock[THRESHOLD_RULE_LOCKS];
 } ThresholdCtx;
 
 typedef struct DetectEngineThreadKeywordCtxItem_ {
@@ -554,12 +566,17 @@ typedef struct DetectEngineCtx_ {
     Signature **sig_array;
     uint32_t sig_array_size; /* size in bytes */
     uint32_t sig_array_len;  /* size in array members */
+    /** sig_array_len headers, built at SigGroupBuild */
+    struct SignatureHeader_ *sig_header_array;
 
     uint32_t signum;
 
     /** Maximum value of all our sgh's non_mpm_store_cnt setting,
      *  used to alloc det_ctx::non_mpm_id_array */
     uint32_t non_mpm_store_cnt_max;
+    /** Maximum sig_cnt of all our sgh's, used to alloc
+     *  det_ctx::match_array */
+    uint32_t sgh_sig_cnt_max;
 
     /* used by the signature ordering module */
     struct SCSigOrderFunc_ *sc_sig_order_funcs;
@@ -622,6 +639,10 @@ typedef struct DetectEngineCtx_ {
     uint32_t sgh_array_cnt;
     uint32_t sgh_array_size;
 
+    /** estimated memory of the rules, rule groups and mpm contexts, set
+     *  by SigGroupBuild() */
+    uint64_t memuse;
+
     int32_t sgh_mpm_context_proto_tcp_packet;
     int32_t sgh_mpm_context_proto_udp_packet;
     int32_t sgh_mpm_context_proto_other_packet;
@@ -660,6 +681,12 @@ typedef struct DetectEngineCtx_ {
 
     char config_prefix[64];
 
+    /** hash over the rule lines, the detect config and the classification,
+     *  reference and threshold files this engine was built from */
+    uint32_t ruleset_hash[2];
+    /** ruleset_hash of the engine being replaced, see DetectEngineReload */
+    uint32_t reload_ruleset_hash[2];
+
     /** minimal: essentially a stub */
     int minimal;
 
@@ -677,6 +704,9 @@ typedef struct DetectEngineCtx_ {
     DetectPort *tcp_whitelist;
     DetectPort *udp_whitelist;
 
+    /** DETECT_PREFILTER_MPM or DETECT_PREFILTER_AUTO */
+    int prefilter_setting;
+
 } DetectEngineCtx;
 
 /* Engine groups profiles (low, medium, high, custom) */
@@ -696,6 +726,15 @@ enum {
     ENGINE_SGH_MPM_FACTORY_CONTEXT_AUTO
 };
 
+/* detect.prefilter.default */
+enum {
+    /** only the mpm is used as prefilter, others go in the non-mpm list */
+    DETECT_PREFILTER_MPM = 0,
+    /** keywords that support it set up prefilter engines for sigs
+     *  without mpm */
+    DETECT_PREFILTER_AUTO,
+};
+
 typedef struct HttpReassembledBody_ {
     const uint8_t *buffer;
     uint32_t buffer_size;   /**< size of the buffer itself */
@@ -708,15 +747,34 @@ typedef struct FiledataReassembledBody_ {
     uint32_t buffer_size;   /**< size of the buffer itself */
     uint32_t buffer_len;    /**< data len in the buffer */
     uint64_t offset;        /**< data offset */
+    uint32_t mpm_skip;      /**< bytes at the start of the buffer the mpm
+                             *   has already seen */
 } FiledataReassembledBody;
 
 #define DETECT_FILESTORE_MAX 15
 
+/** \brief compact copy of the sig fields used to reject a candidate
+ *         before the Signature itself is touched, indexed by sig num */
+typedef struct SignatureHeader_ {
+    uint32_t flags;
+    SignatureMask mask;
+    AppProto alproto;
+    uint16_t dsize_low;
+    uint16_t dsize_high;
+    uint8_t proto_flags;    /**< DetectProto::flags */
+} SignatureHeader;
+
 typedef struct SignatureNonMpmStore_ {
     SigIntId id;
     SignatureMask mask;
 } SignatureNonMpmStore;
 
+/** sig id and the flowbit it requires through flowbits:isset */
+typedef struct SignatureFlowbitReq_ {
+    SigIntId id;
+    uint16_t idx;
+} SignatureFlowbitReq;
+
 /**
   * Detection engine thread data.
   */
@@ -729,14 +787,20 @@ typedef struct DetectEngineThreadCtx_ {
     ThreadVars *tv;
 
     SigIntId *non_mpm_id_array;
+    uint32_t non_mpm_id_array_size;
     uint32_t non_mpm_id_cnt; // size is cnt * sizeof(uint32_t)
 
     uint32_t mt_det_ctxs_cnt;
+    /** tenant thread ctxs indexed by tenant id, NULL if the ids are too
+     *  large for that and mt_det_ctxs_hash has to be used. Doesn't own
+     *  the ctxs, the hash does. */
     struct DetectEngineThreadCtx_ **mt_det_ctxs;
     HashTable *mt_det_ctxs_hash;
 
     struct DetectEngineTenantMapping_ *tenant_array;
     uint32_t tenant_array_size;
+    /** vlan id to tenant id, for the vlan selector */
+    uint32_t *tenant_vlan_map;
 
     uint32_t (*TenantGetId)(const void *, const Packet *p);
 
@@ -765,11 +829,9 @@ typedef struct DetectEngineThreadCtx_ {
     uint16_t hcbd_buffers_size;
     uint16_t hcbd_buffers_list_len;
 
-    uint8_t **hhd_buffers;
-    uint32_t *hhd_buffers_len;
-    uint16_t hhd_buffers_size;
-    uint16_t hhd_buffers_list_len;
-    uint64_t hhd_start_tx_id;
+    /** per packet scratch memory, reset at the end of every packet */
+    struct Arena_ *arena;
+
 
     FiledataReassembledBody *smtp;
     uint64_t smtp_start_tx_id;
@@ -799,6 +861,20 @@ typedef struct DetectEngineThreadCtx_ {
     /* holds the current recursion depth on content inspection */
     int inspection_recursion_counter;
 
+    /** failed (content, relative offset) pairs of the current content
+     *  inspection, so backtracking doesn't redo the same work. Entries
+     *  are only valid if their gen is inspection_memo_gen. */
+    struct {
+        const struct SigMatch_ *sm;
+        uint32_t offset;
+        uint32_t gen;
+    } inspection_memo[DETECT_INSPECTION_MEMO_SIZE];
+    uint32_t inspection_memo_gen;
+
+    /** id for the inspection recursion limit counter */
+    uint16_t counter_inspection_limit;
+    uint16_t counter_rule_guard;
+
     /** array of signature pointers we're going to inspect in the detection
      *  loop. */
     Signature **match_array;
@@ -807,6 +883,10 @@ typedef struct DetectEngineThreadCtx_ {
     uint32_t match_array_len;
     /** size in use */
     SigIntId match_array_cnt;
+    /** bitmap of sig nums, used to build the match array without sorting
+     *  when the mpm returned many candidates. Size in 64 bit words. */
+    uint64_t *match_bits;
+    uint32_t match_bits_len;
 
     /** Array of sigs that had a state change */
     SigIntId de_state_sig_array_len;
@@ -829,6 +909,22 @@ typedef struct DetectEngineThreadCtx_ {
      * prototype held by DetectEngineCtx. */
     SpmThreadCtx *spm_thread_ctx;
 
+    /** byte pair counts when training fast pattern stats, NULL otherwise */
+    struct FpStatsThreadCtx_ *fp_stats;
+
+    /** rule guard state, NULL if the guard is disabled */
+    struct RuleGuardThreadCtx_ *rule_guard;
+
+    /** per tenant accounting, NULL if this isn't a tenant det_ctx */
+    struct DetectTenantThread_ *tenant_stats;
+
+    /** bytes accounted to MEMUSE_THREADS, 0 if setup didn't complete */
+    uint64_t memuse;
+
+    /** set if the match, non-mpm and de_state arrays are borrowed from
+     *  the multi tenant root det_ctx of this thread */
+    int scratch_shared;
+
     /** ip only rules ctx */
     DetectEngineIPOnlyThreadCtx io_ctx;
 
@@ -858,6 +954,11 @@ typedef struct DetectEngineThreadCtx_ {
     int base64_decoded_len;
     int base64_decoded_len_max;
 
+    /** sampled rule profiling, see util-profiling-sample.h */
+    uint32_t rule_sample_cnt;
+    int rule_sample_active;
+    struct RuleSampleThread_ *rule_sample;
+
 #ifdef PROFILING
     struct SCProfileData_ *rule_perf_data;
     int rule_perf_data_size;
@@ -898,6 +999,13 @@ typedef struct SigTableElmt_ {
     void (*Free)(void *);
     void (*RegisterTests)(void);
 
+    /** optional: can this keyword in sig s be used as its prefilter.
+     *  If NULL and SetupPrefilter is set, it always can. */
+    int (*SupportsPrefilter)(const Signature *s);
+    /** set up the prefilter engine for the sigs in the group that
+     *  have this keyword as prefilter_sm */
+    int (*SetupPrefilter)(struct DetectEngineCtx_ *de_ctx, struct SigGroupHead_ *sgh);
+
     uint8_t flags;
     char *name;     /**< keyword name alias */
     char *alias;    /**< name alias */
@@ -933,6 +1041,8 @@ typedef struct SigTableElmt_ {
 #define SIG_GROUP_HEAD_MPM_DNSQUERY     (1 << 23)
 #define SIG_GROUP_HEAD_MPM_TLSSNI       (1 << 24)
 #define SIG_GROUP_HEAD_MPM_FD_SMTP      (1 << 25)
+#define SIG_GROUP_HEAD_HAVESTREAM       (1 << 26)
+#define SIG_GROUP_HEAD_HAVERESPBODY     (1 << 27)
 
 #define APP_MPMS_MAX 19
 
@@ -976,6 +1086,16 @@ typedef struct SigGroupHeadInitData_ {
     struct DetectPort_ *port;
 } SigGroupHeadInitData;
 
+/** \brief prefilter engine of a signature group: adds the sig ids of
+ *         candidates for the packet to det_ctx::pmq, like the mpm */
+typedef struct PrefilterEngine_ {
+    int sm_type;    /**< keyword that set up the engine */
+    void (*Prefilter)(DetectEngineThreadCtx *det_ctx, Packet *p, const void *pectx);
+    void *pectx;
+    void (*Free)(void *pectx);
+    struct PrefilterEngine_ *next;
+} PrefilterEngine;
+
 /** \brief Container for matching data for a signature group */
 typedef struct SigGroupHead_ {
     uint32_t flags;
@@ -989,6 +1109,14 @@ typedef struct SigGroupHead_ {
     /* non mpm list including SYN rules */
     SignatureNonMpmStore *non_mpm_syn_store_array; // size is non_mpm_syn_store_cnt * sizeof(SignatureNonMpmStore)
 
+    /* sigs that can't match unless a flowbit is set, and the bit is
+     * not set by any sig in this head. Sorted by sig id. */
+    uint32_t flowbit_req_cnt;
+    SignatureFlowbitReq *flowbit_req_array;
+
+    /* prefilter engines for the sigs that are not in the non mpm lists */
+    PrefilterEngine *prefilter_engines;
+
     /** the number of signatures in this sgh that have the filestore keyword
      *  set. */
     uint16_t filestore_cnt;
@@ -1092,6 +1220,10 @@ typedef struct SigFileLoaderStat_ {
     int total_files;
     int good_sigs_total;
     int bad_sigs_total;
+    /* time spent in each load phase, in usec */
+    uint64_t parse_usec;
+    uint64_t order_usec;
+    uint64_t build_usec;
 } SigFileLoaderStat;
 
 /** Remember to add the options in SignatureIsIPOnly() at detect.c otherwise it wont be part of a signature group */
@@ -1211,6 +1343,7 @@ enum {
     DETECT_L3PROTO,
     DETECT_LUA,
     DETECT_IPREP,
+    DETECT_DATASET,
 
     DETECT_AL_DNS_QUERY,
     DETECT_AL_TLS_SNI,
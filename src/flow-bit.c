@@ -24,7 +24,6 @@
  * but called that way because of Snort's flowbits.
  * It's a binary storage.
  *
- * \todo move away from a linked list implementation
  * \todo use different datatypes, such as string, int, etc.
  * \todo have more than one instance of the same var, and be able to match on a
  *       specific one, or one all at a time. So if a certain capture matches
@@ -42,12 +41,13 @@
 #include "util-debug.h"
 #include "util-unittest.h"
 
-/* get the flowbit with idx from the flow */
-static FlowBit *FlowBitGet(Flow *f, uint16_t idx)
+/* get the flowbits node of the flow. It's kept at the head of the
+ * list, but other vars may have been put in front of it. */
+static FlowBit *FlowBitGetBits(Flow *f)
 {
     GenericVar *gv = f->flowvar;
     for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
+        if (gv->type == DETECT_FLOWBITS) {
             return (FlowBit *)gv;
         }
     }
@@ -55,19 +55,38 @@ static FlowBit *FlowBitGet(Flow *f, uint16_t idx)
     return NULL;
 }
 
+/* get the flowbits of the flow if bit idx is set */
+static FlowBit *FlowBitGet(Flow *f, uint16_t idx)
+{
+    FlowBit *fb = FlowBitGetBits(f);
+    if (fb != NULL && VAR_BIT_ISSET(fb->bits, fb->size, idx)) {
+        return fb;
+    }
+
+    return NULL;
+}
+
 /* add a flowbit to the flow */
 static void FlowBitAdd(Flow *f, uint16_t idx)
 {
-    FlowBit *fb = FlowBitGet(f, idx);
+    FlowBit *fb = FlowBitGetBits(f);
     if (fb == NULL) {
         fb = SCMalloc(sizeof(FlowBit));
         if (unlikely(fb == NULL))
             return;
+        memset(fb, 0, sizeof(FlowBit));
 
         fb->type = DETECT_FLOWBITS;
-        fb->idx = idx;
-        fb->next = NULL;
-        GenericVarAppend(&f->flowvar, (GenericVar *)fb);
+        fb->next = f->flowvar;
+        f->flowvar = (GenericVar *)fb;
+    }
+
+    if (GenericVarBitsGrow(&fb->bits, &fb->size, idx) < 0)
+        return;
+
+    if (!(VAR_BIT_ISSET(fb->bits, fb->size, idx))) {
+        fb->bits[idx >> 3] |= (1 << (idx & 7));
+        fb->cnt++;
     }
 }
 
@@ -77,8 +96,28 @@ static void FlowBitRemove(Flow *f, uint16_t idx)
     if (fb == NULL)
         return;
 
-    GenericVarRemove(&f->flowvar, (GenericVar *)fb);
-    FlowBitFree(fb);
+    fb->bits[idx >> 3] &= ~(1 << (idx & 7));
+    fb->cnt--;
+}
+
+/**
+ *  \brief get the next flowbit idx that is set
+ *
+ *  \param idx start looking at this idx
+ *
+ *  \retval idx of the next set bit, -1 if there is none
+ */
+int FlowBitGetNext(Flow *f, uint32_t idx)
+{
+    FlowBit *fb = FlowBitGetBits(f);
+    if (fb == NULL || fb->cnt == 0)
+        return -1;
+
+    for ( ; idx < fb->size; idx++) {
+        if (VAR_BIT_ISSET(fb->bits, fb->size, idx))
+            return (int)idx;
+    }
+    return -1;
 }
 
 void FlowBitSetNoLock(Flow *f, uint16_t idx)
@@ -151,6 +190,8 @@ void FlowBitFree(FlowBit *fb)
     if (fb == NULL)
         return;
 
+    if (fb->bits != NULL)
+        SCFree(fb->bits);
     SCFree(fb);
 }
 
@@ -418,6 +459,37 @@ end:
     return ret;
 }
 
+/** \test bits far apart, growing the bit array and walking the set bits */
+static int FlowBitTest12 (void)
+{
+    Flow f;
+    memset(&f, 0, sizeof(Flow));
+
+    FlowBitAdd(&f, 1000);
+    FlowBitAdd(&f, 3);
+    FlowBitAdd(&f, 3);
+
+    FlowBit *fb = FlowBitGet(&f, 1000);
+    FAIL_IF_NULL(fb);
+    FAIL_IF_NOT(fb->cnt == 2);
+    FAIL_IF_NOT(fb->size >= 1001);
+    FAIL_IF_NOT(FlowBitIsset(&f, 3));
+    FAIL_IF_NOT(FlowBitIsnotset(&f, 4));
+    FAIL_IF_NOT(FlowBitIsnotset(&f, 60000));
+
+    FAIL_IF_NOT(FlowBitGetNext(&f, 0) == 3);
+    FAIL_IF_NOT(FlowBitGetNext(&f, 4) == 1000);
+    FAIL_IF_NOT(FlowBitGetNext(&f, 1001) == -1);
+
+    FlowBitToggleNoLock(&f, 3);
+    FAIL_IF_NOT(FlowBitIsnotset(&f, 3));
+    FAIL_IF_NOT(fb->cnt == 1);
+    FAIL_IF_NOT((FlowBit *)f.flowvar == fb);
+
+    GenericVarFree(f.flowvar);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void FlowBitRegisterTests(void)
@@ -434,6 +506,7 @@ void FlowBitRegisterTests(void)
     UtRegisterTest("FlowBitTest09", FlowBitTest09);
     UtRegisterTest("FlowBitTest10", FlowBitTest10);
     UtRegisterTest("FlowBitTest11", FlowBitTest11);
+    UtRegisterTest("FlowBitTest12", FlowBitTest12);
 #endif /* UNITTESTS */
 }
 
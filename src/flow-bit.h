@@ -27,12 +27,16 @@
 #include "flow.h"
 #include "util-var.h"
 
+/** all flowbits of a flow are kept in a single node at the head
+ *  of the flow's var list: a bit array indexed by name idx that is
+ *  grown on demand to cover the highest idx set. */
 typedef struct FlowBit_ {
     uint8_t type; /* type, DETECT_FLOWBITS in this case */
-    uint16_t idx; /* name idx */
-    GenericVar *next; /* right now just implement this as a list,
-                       * in the long run we have think of something
-                       * faster. */
+    uint16_t idx; /* unused, bits are addressed by name idx */
+    GenericVar *next;
+    uint32_t size; /* number of idx covered by bits */
+    uint32_t cnt; /* number of bits set */
+    uint8_t *bits;
 } FlowBit;
 
 void FlowBitFree(FlowBit *);
@@ -46,5 +50,6 @@ void FlowBitToggleNoLock(Flow *, uint16_t);
 void FlowBitToggle(Flow *, uint16_t);
 int FlowBitIsset(Flow *, uint16_t);
 int FlowBitIsnotset(Flow *, uint16_t);
+int FlowBitGetNext(Flow *, uint32_t);
 #endif /* __FLOW_BIT_H__ */
 
@@ -0,0 +1,529 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Embryonic flow tracking, see flow-embryonic.h.
+ *
+ * The table is indexed by the flow hash of the packet. Each bucket has
+ * room for FLOW_EMBRYO_SLOTS records, a full bucket drops its oldest.
+ *
+ * TCP: a SYN without a flow gets a record with what the session setup
+ * needs of it. A SYN/ACK that matches it sets up the flow, oriented as
+ * if the SYN had set it up, and the stream engine takes the record to set
+ * up the session in the TCP_SYN_SENT state (FlowEmbryonicTake()). Other
+ * packets set up flows as usual.
+ *
+ * UDP (flow.embryonic.udp): the second packet of the flow, in either
+ * direction, sets up the flow. The app-layer won't see the payload of
+ * the first packet.
+ *
+ * Packets without a flow still go through the detection engine.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "threads.h"
+#include "conf.h"
+#include "counters.h"
+
+#include "decode.h"
+#include "flow.h"
+#include "flow-util.h"
+#include "flow-private.h"
+#include "flow-embryonic.h"
+
+#include "util-atomic.h"
+#include "util-byte.h"
+#include "util-debug.h"
+#include "util-hugepages.h"
+#include "util-memuse.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#define FLOW_EMBRYO_SLOTS               4
+#define FLOW_EMBRYONIC_DEFAULT_HASHSIZE 16384
+#define FLOW_EMBRYONIC_DEFAULT_TIMEOUT  30
+
+typedef struct FlowEmbryoBucket_ {
+    SCSpinlock lock;
+    FlowEmbryo e[FLOW_EMBRYO_SLOTS];
+} FlowEmbryoBucket;
+
+static FlowEmbryoBucket *embryo_hash = NULL;
+static uint32_t embryo_hash_size = 0;
+static uint32_t embryo_timeout = FLOW_EMBRYONIC_DEFAULT_TIMEOUT;
+static int embryo_udp = 0;
+
+static SC_ATOMIC_DECLARE(uint64_t, embryo_deferred);
+static SC_ATOMIC_DECLARE(uint64_t, embryo_promoted);
+static SC_ATOMIC_DECLARE(uint64_t, embryo_evicted);
+
+/** \internal
+ *  \brief set up the table
+ *
+ *  \retval 0 ok, -1 out of memory
+ */
+static int FlowEmbryonicSetup(uint32_t hash_size, uint32_t timeout, int udp)
+{
+    uint64_t size = (uint64_t)hash_size * sizeof(FlowEmbryoBucket);
+    uint32_t i;
+
+    embryo_hash = SCMallocHuge("flow embryonic hash", size);
+    if (embryo_hash == NULL)
+        return -1;
+    memset(embryo_hash, 0, size);
+    for (i = 0; i < hash_size; i++) {
+        SCSpinInit(&embryo_hash[i].lock, 0);
+    }
+    embryo_hash_size = hash_size;
+    embryo_timeout = timeout;
+    embryo_udp = udp;
+
+    (void) SC_ATOMIC_ADD(flow_memuse, size);
+    MemuseAlloc(MEMUSE_FLOW, size);
+    return 0;
+}
+
+/**
+ * \brief read the flow.embryonic config and set up the table
+ */
+void FlowEmbryonicInitConfig(char quiet)
+{
+    uint32_t hash_size = FLOW_EMBRYONIC_DEFAULT_HASHSIZE;
+    intmax_t timeout = FLOW_EMBRYONIC_DEFAULT_TIMEOUT;
+    int enabled = 0;
+    int udp = 0;
+    char *conf_val;
+
+    SC_ATOMIC_INIT(embryo_deferred);
+    SC_ATOMIC_INIT(embryo_promoted);
+    SC_ATOMIC_INIT(embryo_evicted);
+
+    if (ConfGetBool("flow.embryonic.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    if (ConfGet("flow.embryonic.hash-size", &conf_val) == 1) {
+        uint32_t configval = 0;
+        if (ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                    conf_val) > 0 && configval > 0) {
+            hash_size = configval;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid flow.embryonic.hash-size "
+                    "'%s', using %"PRIu32, conf_val, hash_size);
+        }
+    }
+    if (ConfGetInt("flow.embryonic.timeout", &timeout) == 1 &&
+            (timeout <= 0 || timeout > UINT16_MAX)) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "invalid flow.embryonic.timeout "
+                "%"PRIdMAX", using %d", timeout, FLOW_EMBRYONIC_DEFAULT_TIMEOUT);
+        timeout = FLOW_EMBRYONIC_DEFAULT_TIMEOUT;
+    }
+    (void)ConfGetBool("flow.embryonic.udp", &udp);
+
+    uint64_t size = (uint64_t)hash_size * sizeof(FlowEmbryoBucket);
+    if (!(FLOW_CHECK_MEMCAP(size))) {
+        SCLogError(SC_ERR_FLOW_INIT, "embryonic flow table of %"PRIu64" bytes "
+                "doesn't fit in the flow memcap, embryonic flow tracking "
+                "disabled", size);
+        return;
+    }
+    if (FlowEmbryonicSetup(hash_size, (uint32_t)timeout, udp) < 0) {
+        SCLogError(SC_ERR_FLOW_INIT, "allocating the embryonic flow table "
+                "failed, embryonic flow tracking disabled");
+        return;
+    }
+    flow_config.flags |= FLOW_CONFIG_FLAG_EMBRYONIC;
+
+    if (quiet == FALSE) {
+        SCLogConfig("flow: embryonic flow tracking enabled%s, %"PRIu32
+                " buckets of %d records, timeout %"PRIu32"s",
+                embryo_udp ? " for TCP and UDP" : " for TCP", embryo_hash_size,
+                FLOW_EMBRYO_SLOTS, embryo_timeout);
+    }
+}
+
+void FlowEmbryonicShutdown(void)
+{
+    uint32_t i;
+
+    flow_config.flags &= ~FLOW_CONFIG_FLAG_EMBRYONIC;
+    if (embryo_hash == NULL)
+        return;
+
+    for (i = 0; i < embryo_hash_size; i++) {
+        SCSpinDestroy(&embryo_hash[i].lock);
+    }
+    SCFreeHuge(embryo_hash);
+    embryo_hash = NULL;
+
+    uint64_t size = (uint64_t)embryo_hash_size * sizeof(FlowEmbryoBucket);
+    (void) SC_ATOMIC_SUB(flow_memuse, size);
+    MemuseFree(MEMUSE_FLOW, size);
+    embryo_hash_size = 0;
+}
+
+/** \internal
+ *  \brief fold an address into 32 bits, the table doesn't store them */
+static inline uint32_t FlowEmbryoAddr(const Address *a)
+{
+    return a->addr_data32[0] ^ a->addr_data32[1] ^
+           a->addr_data32[2] ^ a->addr_data32[3];
+}
+
+static inline int FlowEmbryoExpired(const FlowEmbryo *e, const Packet *p)
+{
+    const uint32_t now = (uint32_t)p->ts.tv_sec;
+    return (now > e->last && now - e->last > embryo_timeout);
+}
+
+/** \internal
+ *  \brief find the live record 'p' is the first packet of, or the reply to
+ *
+ *  \param reply 1: match 'p' as the reply, 0: as the first packet
+ */
+static FlowEmbryo *FlowEmbryoFind(FlowEmbryoBucket *fb, const Packet *p,
+        int reply)
+{
+    const uint32_t src = reply ? FlowEmbryoAddr(&p->dst) : FlowEmbryoAddr(&p->src);
+    const uint16_t sp = reply ? p->dp : p->sp;
+    const uint16_t dp = reply ? p->sp : p->dp;
+    int i;
+
+    for (i = 0; i < FLOW_EMBRYO_SLOTS; i++) {
+        FlowEmbryo *e = &fb->e[i];
+        if ((e->flags & FLOW_EMBRYO_USED) && e->hash == p->flow_hash &&
+                e->proto == p->proto && e->src == src &&
+                e->sp == sp && e->dp == dp && !FlowEmbryoExpired(e, p))
+            return e;
+    }
+    return NULL;
+}
+
+/** \internal
+ *  \brief get a slot for a new record: a free or expired one, or else
+ *         the oldest */
+static FlowEmbryo *FlowEmbryoGetSlot(FlowEmbryoBucket *fb, const Packet *p)
+{
+    FlowEmbryo *oldest = &fb->e[0];
+    int i;
+
+    for (i = 0; i < FLOW_EMBRYO_SLOTS; i++) {
+        FlowEmbryo *e = &fb->e[i];
+        if (!(e->flags & FLOW_EMBRYO_USED) || FlowEmbryoExpired(e, p))
+            return e;
+        if (e->last < oldest->last)
+            oldest = e;
+    }
+    (void) SC_ATOMIC_ADD(embryo_evicted, 1);
+    return oldest;
+}
+
+/** \internal
+ *  \brief store the first packet of a flow */
+static void FlowEmbryoStore(FlowEmbryo *e, const Packet *p)
+{
+    memset(e, 0, sizeof(*e));
+    e->flags = FLOW_EMBRYO_USED;
+    e->hash = p->flow_hash;
+    e->src = FlowEmbryoAddr(&p->src);
+    e->first = e->last = (uint32_t)p->ts.tv_sec;
+    e->sp = p->sp;
+    e->dp = p->dp;
+    e->proto = p->proto;
+
+    if (p->tcph != NULL) {
+        e->isn = TCP_GET_SEQ(p);
+        e->window = TCP_GET_WINDOW(p);
+        if (TCP_HAS_TS(p)) {
+            e->flags |= FLOW_EMBRYO_TS;
+            e->tsval = TCP_GET_TSVAL(p);
+        }
+        if (TCP_HAS_WSCALE(p)) {
+            e->flags |= FLOW_EMBRYO_WSCALE;
+            e->wscale = TCP_GET_WSCALE(p);
+        }
+        if (TCP_GET_SACKOK(p) == 1)
+            e->flags |= FLOW_EMBRYO_SACKOK;
+    }
+}
+
+static int FlowEmbryoLookupTcp(FlowEmbryoBucket *fb, const Packet *p,
+        uint32_t *first)
+{
+    const uint8_t flags = p->tcph->th_flags;
+    FlowEmbryo *e;
+
+    if (flags & (TH_RST|TH_FIN))
+        return FLOW_EMBRYO_NONE;
+
+    if ((flags & (TH_SYN|TH_ACK)) == TH_SYN) {
+        e = FlowEmbryoFind(fb, p, 0);
+        if (e != NULL && e->isn == TCP_GET_SEQ(p)) {
+            /* retransmission */
+            e->last = (uint32_t)p->ts.tv_sec;
+        } else {
+            if (e == NULL)
+                e = FlowEmbryoGetSlot(fb, p);
+            FlowEmbryoStore(e, p);
+        }
+        (void) SC_ATOMIC_ADD(embryo_deferred, 1);
+        return FLOW_EMBRYO_DEFER;
+
+    } else if ((flags & (TH_SYN|TH_ACK)) == (TH_SYN|TH_ACK)) {
+        e = FlowEmbryoFind(fb, p, 1);
+        if (e != NULL && TCP_GET_ACK(p) == e->isn + 1) {
+            /* left in place for FlowEmbryonicTake() */
+            *first = e->first;
+            (void) SC_ATOMIC_ADD(embryo_promoted, 1);
+            return FLOW_EMBRYO_PROMOTE;
+        }
+    }
+    return FLOW_EMBRYO_NONE;
+}
+
+static int FlowEmbryoLookupUdp(FlowEmbryoBucket *fb, const Packet *p,
+        uint32_t *first)
+{
+    FlowEmbryo *e;
+    int r = FLOW_EMBRYO_NONE;
+
+    if ((e = FlowEmbryoFind(fb, p, 1)) != NULL) {
+        r = FLOW_EMBRYO_PROMOTE;
+    } else if ((e = FlowEmbryoFind(fb, p, 0)) == NULL) {
+        e = FlowEmbryoGetSlot(fb, p);
+        FlowEmbryoStore(e, p);
+        (void) SC_ATOMIC_ADD(embryo_deferred, 1);
+        return FLOW_EMBRYO_DEFER;
+    }
+
+    /* second packet, the flow is set up now */
+    *first = e->first;
+    e->flags = 0;
+    (void) SC_ATOMIC_ADD(embryo_promoted, 1);
+    return r;
+}
+
+/**
+ * \brief see if a packet without a flow gets one
+ *
+ * Called from the flow hash before a new flow is set up.
+ *
+ * \param first set to the time the first packet was seen, unless
+ *        FLOW_EMBRYO_DEFER is returned
+ *
+ * \retval FLOW_EMBRYO_NONE set up a flow as usual
+ * \retval FLOW_EMBRYO_DEFER no flow for this packet
+ * \retval FLOW_EMBRYO_PROMOTE set up a flow, then FlowEmbryonicPromote()
+ */
+int FlowEmbryonicLookup(const Packet *p, uint32_t *first)
+{
+    int r = FLOW_EMBRYO_NONE;
+
+    if (embryo_hash == NULL)
+        return FLOW_EMBRYO_NONE;
+    if (p->tcph == NULL && (p->udph == NULL || !embryo_udp))
+        return FLOW_EMBRYO_NONE;
+
+    *first = (uint32_t)p->ts.tv_sec;
+    FlowEmbryoBucket *fb = &embryo_hash[p->flow_hash % embryo_hash_size];
+    SCSpinLock(&fb->lock);
+    if (p->tcph != NULL)
+        r = FlowEmbryoLookupTcp(fb, p, first);
+    else
+        r = FlowEmbryoLookupUdp(fb, p, first);
+    SCSpinUnlock(&fb->lock);
+    return r;
+}
+
+/**
+ * \brief set up a new flow for the reply to an embryonic flow
+ *
+ * Turns the flow FlowInit() set up from the reply 'p' around, as if the
+ * first packet had set it up.
+ */
+void FlowEmbryonicPromote(Flow *f, const Packet *p, uint32_t first)
+{
+    FlowAddress addr = f->src;
+    f->src = f->dst;
+    f->dst = addr;
+
+    Port port = f->sp;
+    f->sp = f->dp;
+    f->dp = port;
+
+    f->startts.tv_sec = first;
+    f->startts.tv_usec = 0;
+
+    /* the stream engine picks up the SYN from the table */
+    if (p->tcph != NULL)
+        f->flags |= FLOW_EMBRYONIC;
+}
+
+/**
+ * \brief take the record of the SYN a SYN/ACK replies to from the table
+ *
+ * \retval 1 'e' is filled in, 0 the record is gone
+ */
+int FlowEmbryonicTake(const Packet *p, FlowEmbryo *e)
+{
+    int r = 0;
+
+    if (embryo_hash == NULL || p->tcph == NULL)
+        return 0;
+
+    FlowEmbryoBucket *fb = &embryo_hash[p->flow_hash % embryo_hash_size];
+    SCSpinLock(&fb->lock);
+    FlowEmbryo *syn = FlowEmbryoFind(fb, p, 1);
+    if (syn != NULL && TCP_GET_ACK(p) == syn->isn + 1) {
+        *e = *syn;
+        syn->flags = 0;
+        r = 1;
+    }
+    SCSpinUnlock(&fb->lock);
+    return r;
+}
+
+static uint64_t FlowEmbryonicCounterDeferred(void)
+{
+    return SC_ATOMIC_GET(embryo_deferred);
+}
+
+static uint64_t FlowEmbryonicCounterPromoted(void)
+{
+    return SC_ATOMIC_GET(embryo_promoted);
+}
+
+static uint64_t FlowEmbryonicCounterEvicted(void)
+{
+    return SC_ATOMIC_GET(embryo_evicted);
+}
+
+/**
+ * \brief register the flow.embryonic.* stats counters, if enabled
+ */
+void FlowEmbryonicRegisterGlobalCounters(void)
+{
+    if (embryo_hash == NULL)
+        return;
+
+    StatsRegisterGlobalCounter("flow.embryonic.deferred",
+            FlowEmbryonicCounterDeferred);
+    StatsRegisterGlobalCounter("flow.embryonic.promoted",
+            FlowEmbryonicCounterPromoted);
+    StatsRegisterGlobalCounter("flow.embryonic.evicted",
+            FlowEmbryonicCounterEvicted);
+}
+
+#ifdef UNITTESTS
+static Packet *FlowEmbryoTestPacket(char *src, char *dst, uint16_t sp,
+        uint16_t dp, uint8_t flags, uint32_t seq, uint32_t ack)
+{
+    Packet *p = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, src, dst, sp, dp);
+    if (p == NULL)
+        return NULL;
+    p->tcph->th_flags = flags;
+    p->tcph->th_seq = htonl(seq);
+    p->tcph->th_ack = htonl(ack);
+    p->flow_hash = 12345;
+    return p;
+}
+
+/** \test SYN is deferred, its SYN/ACK promotes and can be taken once */
+static int FlowEmbryonicTest01(void)
+{
+    uint32_t first = 0;
+    FlowEmbryo e;
+
+    FAIL_IF(FlowEmbryonicSetup(8, 30, 0) < 0);
+
+    Packet *syn = FlowEmbryoTestPacket("1.2.3.4", "5.6.7.8", 1024, 80,
+            TH_SYN, 100, 0);
+    Packet *synack = FlowEmbryoTestPacket("5.6.7.8", "1.2.3.4", 80, 1024,
+            TH_SYN|TH_ACK, 5000, 101);
+    Packet *bad = FlowEmbryoTestPacket("5.6.7.8", "1.2.3.4", 80, 1024,
+            TH_SYN|TH_ACK, 5000, 999);
+    FAIL_IF_NULL(syn);
+    FAIL_IF_NULL(synack);
+    FAIL_IF_NULL(bad);
+
+    FAIL_IF(FlowEmbryonicLookup(syn, &first) != FLOW_EMBRYO_DEFER);
+    /* retransmission */
+    FAIL_IF(FlowEmbryonicLookup(syn, &first) != FLOW_EMBRYO_DEFER);
+    /* wrong ack */
+    FAIL_IF(FlowEmbryonicLookup(bad, &first) != FLOW_EMBRYO_NONE);
+    FAIL_IF(FlowEmbryonicTake(bad, &e) != 0);
+
+    FAIL_IF(FlowEmbryonicLookup(synack, &first) != FLOW_EMBRYO_PROMOTE);
+    FAIL_IF(first != (uint32_t)syn->ts.tv_sec);
+    FAIL_IF(FlowEmbryonicTake(synack, &e) != 1);
+    FAIL_IF(e.isn != 100);
+    FAIL_IF(e.sp != 1024);
+    FAIL_IF(FlowEmbryonicTake(synack, &e) != 0);
+
+    UTHFreePacket(syn);
+    UTHFreePacket(synack);
+    UTHFreePacket(bad);
+    FlowEmbryonicShutdown();
+    PASS;
+}
+
+/** \test a full bucket drops its oldest record */
+static int FlowEmbryonicTest02(void)
+{
+    uint32_t first = 0;
+    FlowEmbryo e;
+    Packet *syn[FLOW_EMBRYO_SLOTS + 1];
+    int i;
+
+    FAIL_IF(FlowEmbryonicSetup(1, 30, 0) < 0);
+
+    for (i = 0; i < FLOW_EMBRYO_SLOTS + 1; i++) {
+        syn[i] = FlowEmbryoTestPacket("1.2.3.4", "5.6.7.8", 1024 + i, 80,
+                TH_SYN, 100, 0);
+        FAIL_IF_NULL(syn[i]);
+        syn[i]->ts.tv_sec += i;
+        FAIL_IF(FlowEmbryonicLookup(syn[i], &first) != FLOW_EMBRYO_DEFER);
+    }
+
+    Packet *synack = FlowEmbryoTestPacket("5.6.7.8", "1.2.3.4", 80, 1024,
+            TH_SYN|TH_ACK, 5000, 101);
+    FAIL_IF_NULL(synack);
+    synack->ts = syn[FLOW_EMBRYO_SLOTS]->ts;
+    FAIL_IF(FlowEmbryonicTake(synack, &e) != 0);
+
+    /* the newest is there */
+    synack->tcph->th_dport = htons(1024 + FLOW_EMBRYO_SLOTS);
+    synack->dp = 1024 + FLOW_EMBRYO_SLOTS;
+    FAIL_IF(FlowEmbryonicTake(synack, &e) != 1);
+
+    for (i = 0; i < FLOW_EMBRYO_SLOTS + 1; i++)
+        UTHFreePacket(syn[i]);
+    UTHFreePacket(synack);
+    FlowEmbryonicShutdown();
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void FlowEmbryonicRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowEmbryonicTest01", FlowEmbryonicTest01);
+    UtRegisterTest("FlowEmbryonicTest02", FlowEmbryonicTest02);
+#endif
+}
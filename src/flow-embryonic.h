@@ -0,0 +1,73 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Embryonic flow tracking.
+ *
+ * The first packet of a TCP session (the SYN) or, optionally, of a UDP
+ * flow doesn't get a flow. Instead a small record is kept in a table of
+ * its own. The flow is only set up when the second packet comes in, so
+ * a SYN flood or a flood of single UDP packets doesn't use up the flow
+ * memcap and the session pool.
+ */
+
+#ifndef __FLOW_EMBRYONIC_H__
+#define __FLOW_EMBRYONIC_H__
+
+/** what the embryonic table knows about the first packet */
+typedef struct FlowEmbryo_ {
+    uint32_t hash;      /**< flow hash of the packet */
+    uint32_t src;       /**< source address of the first packet, folded */
+    uint32_t first;     /**< first seen, seconds */
+    uint32_t last;      /**< last seen, seconds */
+    uint32_t isn;       /**< TCP: seq of the SYN */
+    uint32_t tsval;     /**< TCP: timestamp of the SYN */
+    uint16_t sp;        /**< source port of the first packet */
+    uint16_t dp;        /**< destination port of the first packet */
+    uint16_t window;    /**< TCP: window of the SYN */
+    uint8_t proto;
+    uint8_t wscale;     /**< TCP: window scale of the SYN */
+    uint8_t flags;      /**< FLOW_EMBRYO_* */
+} FlowEmbryo;
+
+#define FLOW_EMBRYO_USED        0x01
+#define FLOW_EMBRYO_TS          0x02
+#define FLOW_EMBRYO_WSCALE      0x04
+#define FLOW_EMBRYO_SACKOK      0x08
+
+/** FlowEmbryonicLookup() results */
+enum {
+    /** set up a flow as usual */
+    FLOW_EMBRYO_NONE = 0,
+    /** don't set up a flow for this packet */
+    FLOW_EMBRYO_DEFER,
+    /** set up the flow with FlowEmbryonicPromote(), this packet is the
+     *  reply to the first */
+    FLOW_EMBRYO_PROMOTE,
+};
+
+void FlowEmbryonicInitConfig(char quiet);
+void FlowEmbryonicShutdown(void);
+int FlowEmbryonicLookup(const Packet *p, uint32_t *first);
+void FlowEmbryonicPromote(Flow *f, const Packet *p, uint32_t first);
+int FlowEmbryonicTake(const Packet *p, FlowEmbryo *e);
+void FlowEmbryonicRegisterGlobalCounters(void);
+void FlowEmbryonicRegisterTests(void);
+
+#endif /* __FLOW_EMBRYONIC_H__ */
@@ -36,12 +36,13 @@
 #include "flow-private.h"
 #include "flow-manager.h"
 #include "flow-storage.h"
+#include "flow-embryonic.h"
 #include "app-layer-parser.h"
 
 #include "util-time.h"
 #include "util-debug.h"
 
-#include "util-hash-lookup3.h"
+#include "util-hash-word.h"
 
 #include "conf.h"
 #include "output.h"
@@ -49,11 +50,65 @@
 
 #define FLOW_DEFAULT_FLOW_PRUNE 5
 
+/** buckets with flows FlowGetUsedFlow() looks at before it gives up */
+#define FLOW_EVICT_SCAN_MAX     256
+/** buckets it looks at for closed and new flows only */
+#define FLOW_EVICT_SCAN_PREFER  16
+/** the eviction hands of the threads start this far apart */
+#define FLOW_EVICT_HANDS        16
+
 SC_ATOMIC_EXTERN(unsigned int, flow_prune_idx);
 SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 
 static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv);
 
+#ifdef TLS
+/** per thread cache of spare flows, refilled from the spare queue
+ *  FLOW_SPARE_BATCH flows at a time, see flow.thread-cache */
+static __thread FlowStack flow_spare_cache;
+#endif
+
+/** \brief get a spare flow, from the thread cache if enabled */
+static inline Flow *FlowSpareGet(FlowQueue *spare_q)
+{
+#ifdef TLS
+    if (flow_config.flags & FLOW_CONFIG_FLAG_THREAD_CACHE) {
+        FlowStack *s = &flow_spare_cache;
+
+        if (s->len == 0)
+            (void)FlowDequeueBatch(spare_q, s, FLOW_SPARE_BATCH);
+        return FlowStackPop(s);
+    }
+#endif
+    return FlowDequeue(spare_q);
+}
+
+/**
+ * \brief return the spare flows cached by the calling thread
+ *
+ * To be called by threads that create flows before they exit.
+ */
+void FlowThreadCacheFlush(void)
+{
+#ifdef TLS
+    Flow *f;
+
+    while ((f = FlowStackPop(&flow_spare_cache)) != NULL) {
+        FlowMoveToSpare(f);
+    }
+#endif
+}
+
+/** \internal
+ *  \brief see if a packet without a flow gets one, see flow-embryonic.c
+ */
+static inline int FlowEmbryonicCheck(const Packet *p, uint32_t *first)
+{
+    if (!(flow_config.flags & FLOW_CONFIG_FLAG_EMBRYONIC))
+        return FLOW_EMBRYO_NONE;
+    return FlowEmbryonicLookup(p, first);
+}
+
 /** \brief compare two raw ipv6 addrs
  *
  *  \note we don't care about the real ipv6 ip's, this is just
@@ -143,7 +198,7 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = HashWord(fhk.u32, 5, flow_config.hash_rand);
 
         } else if (ICMPV4_DEST_UNREACH_IS_VALID(p)) {
             uint32_t psrc = IPV4_GET_RAW_IPSRC_U32(ICMPV4_GET_EMB_IPV4(p));
@@ -168,7 +223,7 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = HashWord(fhk.u32, 5, flow_config.hash_rand);
 
         } else {
             FlowHashKey4 fhk;
@@ -186,7 +241,7 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = HashWord(fhk.u32, 5, flow_config.hash_rand);
         }
     } else if (p->ip6h != NULL) {
         FlowHashKey6 fhk;
@@ -221,7 +276,7 @@ static inline uint32_t FlowGetHash(const Packet *p)
         fhk.vlan_id[0] = p->vlan_id[0];
         fhk.vlan_id[1] = p->vlan_id[1];
 
-        hash = hashword(fhk.u32, 11, flow_config.hash_rand);
+        hash = HashWord(fhk.u32, 11, flow_config.hash_rand);
     }
 
     return hash;
@@ -291,10 +346,26 @@ static inline int FlowCompareICMPv4(Flow *f, const Packet *p)
     return 0;
 }
 
+/** \brief prefetch the hash bucket of a packet's flow
+ *
+ *  Starts loading the bucket into the cache, so that it is (closer to
+ *  being) available when FlowGetFlowFromHash locks it.
+ *
+ *  \param p packet with PKT_WANTS_FLOW set by FlowSetupPacket
+ */
+void FlowPrefetchBucket(const Packet *p)
+{
+    if (likely(flow_hash != NULL)) {
+        prefetchw(&flow_hash[p->flow_hash % flow_config.hash_size]);
+    }
+}
+
 void FlowSetupPacket(Packet *p)
 {
     p->flags |= PKT_WANTS_FLOW;
     p->flow_hash = FlowGetHash(p);
+    /* the flow lookup usually follows soon after decoding */
+    FlowPrefetchBucket(p);
 }
 
 int TcpSessionPacketSsnReuse(const Packet *p, const Flow *f, void *tcp_ssn);
@@ -358,11 +429,22 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
         return NULL;
     }
 
-    /* get a flow from the spare queue */
-    f = FlowDequeue(&flow_spare_q);
+    /* get a flow from the spare queue of our NUMA node, or the shared one */
+    int node = (tv != NULL) ? tv->numa_node : -1;
+    FlowQueue *spare_q = FlowGetSpareQueue(node);
+    f = FlowSpareGet(spare_q);
+    if (f == NULL && spare_q != &flow_spare_q)
+        f = FlowDequeue(&flow_spare_q);
     if (f == NULL) {
         /* If we reached the max memcap, we get a used flow */
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize()))) {
+            /* a spare flow from another node beats reusing a used flow */
+            uint16_t n;
+            for (n = 0; n < flow_config.numa_nodes; n++) {
+                if ((int)n != node && (f = FlowDequeue(&flow_spare_numa_q[n])) != NULL)
+                    goto done;
+            }
+
             /* declare state of emergency */
             if (!(SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)) {
                 SC_ATOMIC_OR(flow_flags, FLOW_EMERGENCY);
@@ -394,6 +476,9 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
                 }
                 return NULL;
             }
+            /* allocated by this thread, so it lives on our node */
+            if (spare_q != &flow_spare_q)
+                f->numa_node = (uint8_t)node;
 
             /* flow is initialized but *unlocked* */
         }
@@ -403,6 +488,7 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
         /* flow is initialized (recylced) but *unlocked* */
     }
 
+done:
     FLOWLOCK_WRLOCK(f);
     return f;
 }
@@ -428,19 +514,79 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
     /* flow is locked */
 
     /* put at the start of the list */
+    FBSEQ_WRITE_BEGIN(fb);
     f->hnext = fb->head;
     fb->head->hprev = f;
     fb->head = f;
+    FBSEQ_WRITE_END(fb);
 
     /* initialize and return */
     FlowInit(f, p);
     f->flow_hash = hash;
     f->fb = fb;
+    FlowBucketLowerNextTs(fb, p->ts.tv_sec +
+            FlowGetFlowTimeout(f, FLOW_STATE_NEW, 0));
 
     f->thread_id = thread_id;
     return f;
 }
 
+/** \internal
+ *  \brief compare a flow and a packet without holding the flow lock
+ *
+ *  Only checks the tuple. The FLOW_TCP_REUSED and session reuse checks
+ *  are done by the caller once the flow is locked.
+ */
+static inline int FlowCompareLockless(Flow *f, const Packet *p)
+{
+    if (p->proto == IPPROTO_ICMP) {
+        return FlowCompareICMPv4(f, p);
+    }
+    return CMP_FLOW(f, p);
+}
+
+/** \internal
+ *  \brief look up the flow for a packet without taking the bucket lock
+ *
+ *  The chain is walked optimistically. A flow that matches is locked,
+ *  after which the bucket's chain version tells us if the chain was
+ *  modified during the walk. While we hold the flow lock, the flow
+ *  can't be removed from the hash. Flows are not freed at runtime in
+ *  this mode, so walking over a flow that was just removed is safe.
+ *
+ *  \retval f *LOCKED* flow
+ *  \retval NULL no (stable) match, use the locked lookup
+ */
+static Flow *FlowGetFlowFromHashLockless(FlowBucket *fb, const Packet *p)
+{
+    const uint32_t seq = FBSeqRead(fb);
+    if (seq & 1)
+        return NULL;
+
+    Flow *f = fb->head;
+    while (f != NULL) {
+        if (FlowCompareLockless(f, p))
+            break;
+        f = f->hnext;
+        /* don't follow pointers of a chain that is changing */
+        if (FBSeqRead(fb) != seq)
+            return NULL;
+    }
+    if (f == NULL)
+        return NULL;
+
+    FLOWLOCK_WRLOCK(f);
+    if (FBSeqRead(fb) != seq || FlowCompare(f, p) == 0 ||
+            TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)
+    {
+        /* changed, or a reused TCP session, which needs the bucket
+         * lock to be replaced */
+        FLOWLOCK_UNLOCK(f);
+        return NULL;
+    }
+    return f;
+}
+
 /** \brief Get Flow for packet
  *
  * Hash retrieval function for flows. Looks up the hash bucket containing the
@@ -461,16 +607,36 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
 Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p, Flow **dest)
 {
     Flow *f = NULL;
+    uint32_t first = 0;
+    int embryo;
 
     /* get our hash bucket and lock it */
     const uint32_t hash = p->flow_hash;
     FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
+
+    if (flow_config.flags & FLOW_CONFIG_FLAG_LOCKLESS_LOOKUP) {
+        f = FlowGetFlowFromHashLockless(fb, p);
+        if (f != NULL) {
+            /* update the last seen timestamp of this flow */
+            COPY_TIMESTAMP(&p->ts,&f->lastts);
+            f->clock_ref = 1;
+            FlowReference(dest, f);
+            return f;
+        }
+    }
+
     FBLOCK_LOCK(fb);
 
     SCLogDebug("fb %p fb->head %p", fb, fb->head);
 
     /* see if the bucket already has a flow */
     if (fb->head == NULL) {
+        embryo = FlowEmbryonicCheck(p, &first);
+        if (embryo == FLOW_EMBRYO_DEFER) {
+            FBLOCK_UNLOCK(fb);
+            return NULL;
+        }
+
         f = FlowGetNew(tv, dtv, p);
         if (f == NULL) {
             FBLOCK_UNLOCK(fb);
@@ -478,13 +644,19 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
         }
 
         /* flow is locked */
+        FBSEQ_WRITE_BEGIN(fb);
         fb->head = f;
         fb->tail = f;
 
         /* got one, now lock, initialize and return */
         FlowInit(f, p);
+        if (embryo == FLOW_EMBRYO_PROMOTE)
+            FlowEmbryonicPromote(f, p, first);
         f->flow_hash = hash;
         f->fb = fb;
+        FBSEQ_WRITE_END(fb);
+        FlowBucketLowerNextTs(fb, p->ts.tv_sec +
+                FlowGetFlowTimeout(f, FLOW_STATE_NEW, 0));
 
         /* update the last seen timestamp of this flow */
         COPY_TIMESTAMP(&p->ts,&f->lastts);
@@ -506,21 +678,34 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
             f = f->hnext;
 
             if (f == NULL) {
-                f = pf->hnext = FlowGetNew(tv, dtv, p);
+                embryo = FlowEmbryonicCheck(p, &first);
+                if (embryo == FLOW_EMBRYO_DEFER) {
+                    FBLOCK_UNLOCK(fb);
+                    return NULL;
+                }
+
+                f = FlowGetNew(tv, dtv, p);
                 if (f == NULL) {
                     FBLOCK_UNLOCK(fb);
                     return NULL;
                 }
-                fb->tail = f;
 
                 /* flow is locked */
 
-                f->hprev = pf;
-
                 /* initialize and return */
                 FlowInit(f, p);
+                if (embryo == FLOW_EMBRYO_PROMOTE)
+                    FlowEmbryonicPromote(f, p, first);
                 f->flow_hash = hash;
                 f->fb = fb;
+                FlowBucketLowerNextTs(fb, p->ts.tv_sec +
+                        FlowGetFlowTimeout(f, FLOW_STATE_NEW, 0));
+
+                FBSEQ_WRITE_BEGIN(fb);
+                pf->hnext = f;
+                fb->tail = f;
+                f->hprev = pf;
+                FBSEQ_WRITE_END(fb);
 
                 /* update the last seen timestamp of this flow */
                 COPY_TIMESTAMP(&p->ts,&f->lastts);
@@ -533,6 +718,7 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
             if (FlowCompare(f, p) != 0) {
                 /* we found our flow, lets put it on top of the
                  * hash list -- this rewards active flows */
+                FBSEQ_WRITE_BEGIN(fb);
                 if (f->hnext) {
                     f->hnext->hprev = f->hprev;
                 }
@@ -547,6 +733,7 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
                 f->hprev = NULL;
                 fb->head->hprev = f;
                 fb->head = f;
+                FBSEQ_WRITE_END(fb);
 
                 /* found our flow, lock & return */
                 FLOWLOCK_WRLOCK(f);
@@ -560,6 +747,7 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
 
                 /* update the last seen timestamp of this flow */
                 COPY_TIMESTAMP(&p->ts,&f->lastts);
+                f->clock_ref = 1;
                 FlowReference(dest, f);
 
                 FBLOCK_UNLOCK(fb);
@@ -580,21 +768,64 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
 
     /* update the last seen timestamp of this flow */
     COPY_TIMESTAMP(&p->ts,&f->lastts);
+    f->clock_ref = 1;
     FlowReference(dest, f);
 
     FBLOCK_UNLOCK(fb);
     return f;
 }
 
+#ifdef TLS
+/** per thread eviction hand, see FlowGetUsedFlow() */
+static __thread uint32_t flow_evict_hand;
+static __thread int flow_evict_hand_set = 0;
+#endif
+
+/** \internal
+ *  \brief get the bucket the eviction hand of this thread is at
+ *
+ *  With TLS each thread has a hand of its own, spread over the hash so
+ *  that the threads don't fight over the same buckets. Otherwise all
+ *  share "flow_prune_idx".
+ */
+static inline uint32_t FlowEvictHandGet(void)
+{
+#ifdef TLS
+    if (!flow_evict_hand_set) {
+        flow_evict_hand = SC_ATOMIC_ADD(flow_prune_idx,
+                flow_config.hash_size / FLOW_EVICT_HANDS + 1);
+        flow_evict_hand_set = 1;
+    }
+    return flow_evict_hand;
+#else
+    return SC_ATOMIC_GET(flow_prune_idx);
+#endif
+}
+
+static inline void FlowEvictHandSet(uint32_t idx)
+{
+#ifdef TLS
+    flow_evict_hand = idx;
+#else
+    SC_ATOMIC_SET(flow_prune_idx, idx);
+#endif
+}
+
 /** \internal
  *  \brief Get a flow from the hash directly.
  *
  *  Called in conditions where the spare queue is empty and memcap is reached.
  *
- *  Walks the hash until a flow can be freed. Timeouts are disregarded, use_cnt
- *  is adhered to. "flow_prune_idx" atomic int makes sure we don't start at the
- *  top each time since that would clear the top of the hash leading to longer
- *  and longer search times under high pressure (observed).
+ *  Evicts a flow using a CLOCK approximation of LRU: the hand of the
+ *  thread walks the hash buckets, tail (least recently looked up) first.
+ *  A flow that was looked up since the hand last passed has its reference
+ *  bit (Flow::clock_ref) cleared and gets a second chance. Timeouts are
+ *  disregarded, use_cnt is adhered to.
+ *
+ *  Closed flows are evicted right away, then new (embryonic) ones. Only
+ *  after FLOW_EVICT_SCAN_PREFER buckets without those, established flows
+ *  are evicted too. The hand gives up after FLOW_EVICT_SCAN_MAX buckets
+ *  with flows, so the cost of a new flow under memcap pressure is bounded.
  *
  *  \param tv thread vars
  *  \param dtv decode thread vars (for flow log api thread data)
@@ -603,38 +834,58 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
  */
 static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 {
-    uint32_t idx = SC_ATOMIC_GET(flow_prune_idx) % flow_config.hash_size;
+    uint32_t idx = FlowEvictHandGet() % flow_config.hash_size;
     uint32_t cnt = flow_config.hash_size;
+    uint32_t scanned = 0; /* buckets with flows looked at */
 
-    while (cnt--) {
+    while (cnt-- && scanned < FLOW_EVICT_SCAN_MAX) {
         if (++idx >= flow_config.hash_size)
             idx = 0;
 
         FlowBucket *fb = &flow_hash[idx];
 
-        if (FBLOCK_TRYLOCK(fb) != 0)
+        /* unlocked peek, empty buckets don't count */
+        if (fb->tail == NULL)
             continue;
+        scanned++;
 
-        Flow *f = fb->tail;
-        if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
+        if (FBLOCK_TRYLOCK(fb) != 0)
             continue;
-        }
 
-        if (FLOWLOCK_TRYWRLOCK(f) != 0) {
-            FBLOCK_UNLOCK(fb);
-            continue;
-        }
+        Flow *f;
+        int state = FLOW_STATE_NEW;
+        for (f = fb->tail; f != NULL; f = f->hprev) {
+            /** never prune a flow that is used by a packet or stream msg
+             *  we are currently processing in one of the threads */
+            if (SC_ATOMIC_GET(f->use_cnt) > 0)
+                continue;
+
+            state = SC_ATOMIC_GET(f->flow_state);
+            if (state != FLOW_STATE_CLOSED) {
+                if (f->clock_ref) {
+                    /* second chance */
+                    f->clock_ref = 0;
+                    continue;
+                }
+                if (state != FLOW_STATE_NEW && scanned <= FLOW_EVICT_SCAN_PREFER)
+                    continue;
+            }
 
-        /** never prune a flow that is used by a packet or stream msg
-         *  we are currently processing in one of the threads */
-        if (SC_ATOMIC_GET(f->use_cnt) > 0) {
+            if (FLOWLOCK_TRYWRLOCK(f) != 0)
+                continue;
+            if (SC_ATOMIC_GET(f->use_cnt) > 0) {
+                FLOWLOCK_UNLOCK(f);
+                continue;
+            }
+            break;
+        }
+        if (f == NULL) {
             FBLOCK_UNLOCK(fb);
-            FLOWLOCK_UNLOCK(f);
             continue;
         }
 
         /* remove from the hash */
+        FBSEQ_WRITE_BEGIN(fb);
         if (f->hprev != NULL)
             f->hprev->hnext = f->hnext;
         if (f->hnext != NULL)
@@ -647,9 +898,9 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
         f->hnext = NULL;
         f->hprev = NULL;
         f->fb = NULL;
+        FBSEQ_WRITE_END(fb);
         FBLOCK_UNLOCK(fb);
 
-        int state = SC_ATOMIC_GET(f->flow_state);
         if (state == FLOW_STATE_NEW)
             f->flow_end_flags |= FLOW_END_FLAG_STATE_NEW;
         else if (state == FLOW_STATE_ESTABLISHED)
@@ -657,6 +908,15 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
         else if (state == FLOW_STATE_CLOSED)
             f->flow_end_flags |= FLOW_END_FLAG_STATE_CLOSED;
 
+        if (tv != NULL && dtv != NULL) {
+            if (state == FLOW_STATE_CLOSED)
+                StatsIncr(tv, dtv->counter_flow_evict_closed);
+            else if (state == FLOW_STATE_NEW)
+                StatsIncr(tv, dtv->counter_flow_evict_new);
+            else
+                StatsIncr(tv, dtv->counter_flow_evict_established);
+        }
+
         f->flow_end_flags |= FLOW_END_FLAG_FORCED;
 
         if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
@@ -670,9 +930,10 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 
         FLOWLOCK_UNLOCK(f);
 
-        (void) SC_ATOMIC_ADD(flow_prune_idx, (flow_config.hash_size - cnt));
+        FlowEvictHandSet(idx);
         return f;
     }
 
+    FlowEvictHandSet(idx);
     return NULL;
 }
@@ -24,6 +24,8 @@
 #ifndef __FLOW_HASH_H__
 #define __FLOW_HASH_H__
 
+#include "util-lock-contention.h"
+
 /** Spinlocks or Mutex for the flow buckets. */
 //#define FBLOCK_SPIN
 #define FBLOCK_MUTEX
@@ -48,27 +50,67 @@ typedef struct FlowBucket_ {
 #else
     #error Enable FBLOCK_SPIN or FBLOCK_MUTEX
 #endif
+    /** chain version, odd while the chain is being modified. Used by the
+     *  lockless lookup to detect concurrent modifications. */
+    uint32_t seq;
+    /** lower bound (in seconds) of the time the first flow in this row can
+     *  time out. Lets the flow manager skip rows that have nothing due. */
+    SC_ATOMIC_DECLARE(uint32_t, next_ts);
 } __attribute__((aligned(CLS))) FlowBucket;
 
 #ifdef FBLOCK_SPIN
     #define FBLOCK_INIT(fb) SCSpinInit(&(fb)->s, 0)
     #define FBLOCK_DESTROY(fb) SCSpinDestroy(&(fb)->s)
-    #define FBLOCK_LOCK(fb) SCSpinLock(&(fb)->s)
+    #define FBLOCK_LOCK(fb) SCSpinLockCounted(&(fb)->s, LOCK_CONTENTION_FLOW_BUCKET)
     #define FBLOCK_TRYLOCK(fb) SCSpinTrylock(&(fb)->s)
     #define FBLOCK_UNLOCK(fb) SCSpinUnlock(&(fb)->s)
 #elif defined FBLOCK_MUTEX
     #define FBLOCK_INIT(fb) SCMutexInit(&(fb)->m, NULL)
     #define FBLOCK_DESTROY(fb) SCMutexDestroy(&(fb)->m)
-    #define FBLOCK_LOCK(fb) SCMutexLock(&(fb)->m)
+    #define FBLOCK_LOCK(fb) SCMutexLockCounted(&(fb)->m, LOCK_CONTENTION_FLOW_BUCKET)
     #define FBLOCK_TRYLOCK(fb) SCMutexTrylock(&(fb)->m)
     #define FBLOCK_UNLOCK(fb) SCMutexUnlock(&(fb)->m)
 #else
     #error Enable FBLOCK_SPIN or FBLOCK_MUTEX
 #endif
 
+/** mark the start and end of a modification of the bucket chain. Caller
+ *  must hold the bucket lock. */
+#define FBSEQ_WRITE_BEGIN(fb) do { \
+        (fb)->seq++;                \
+        hw_barrier();               \
+    } while (0)
+#define FBSEQ_WRITE_END(fb) do {   \
+        hw_barrier();               \
+        (fb)->seq++;                \
+    } while (0)
+
+/** read the bucket chain version for the lockless lookup */
+static inline uint32_t FBSeqRead(const FlowBucket *fb)
+{
+    uint32_t seq = *(volatile const uint32_t *)&fb->seq;
+    hw_barrier();
+    return seq;
+}
+
+/** \brief lower the row's next timeout hint to next_ts if that is earlier
+ *
+ *  Can be called w/o the bucket lock. Only the flow manager raises the hint,
+ *  and it does so with a CAS so a concurrent lowering is never lost. */
+static inline void FlowBucketLowerNextTs(FlowBucket *fb, uint32_t next_ts)
+{
+    uint32_t cur = SC_ATOMIC_GET(fb->next_ts);
+    while (next_ts < cur) {
+        if (SC_ATOMIC_CAS(&fb->next_ts, cur, next_ts))
+            break;
+        cur = SC_ATOMIC_GET(fb->next_ts);
+    }
+}
+
 /* prototypes */
 
 Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *, Flow **);
+void FlowPrefetchBucket(const Packet *p);
 
 void FlowDisableTcpReuseHandling(void);
 
@@ -0,0 +1,558 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Heavy hitter tracking, see flow-heavy.h.
+ *
+ * A key is hashed once, the rows of the sketch use h1 + row * h2 of the
+ * two lookup3 hashword2() values. The estimate of a key is the lowest of
+ * its counters, so it's never below the real count. A top list replaces
+ * its smallest entry by a key with a higher estimate, as in space-saving.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "threads.h"
+#include "conf.h"
+
+#include "decode.h"
+#include "flow.h"
+#include "flow-heavy.h"
+
+#include "util-debug.h"
+#include "util-hash-lookup3.h"
+#include "util-misc.h"
+#include "util-print.h"
+#include "util-proto-name.h"
+#include "util-unittest.h"
+
+#ifdef HAVE_LIBJANSSON
+#include <jansson.h>
+#endif
+
+#define FLOW_HEAVY_DEFAULT_WINDOW           60
+#define FLOW_HEAVY_DEFAULT_ELEPHANT_BYTES   (100 * 1024 * 1024)
+
+FlowHeavyConfig flow_heavy_config = { 0, FLOW_HEAVY_DEFAULT_WINDOW,
+                                      FLOW_HEAVY_DEFAULT_ELEPHANT_BYTES, 0 };
+
+/** words of the key that are used, per type */
+static const uint32_t flow_heavy_key_words[FLOW_HEAVY_MAX] = { 5, 1, 10 };
+
+typedef struct FlowHeavyWindow_ {
+    uint32_t start;         /**< packet time the window started, sec */
+    FlowHeavyTop top[FLOW_HEAVY_MAX];
+} FlowHeavyWindow;
+
+/** the merged sketches, the current window and the one before it */
+typedef struct FlowHeavyGlobal_ {
+    SCMutex m;
+    uint64_t cms[FLOW_HEAVY_SKETCHES][FLOW_HEAVY_DEPTH][FLOW_HEAVY_WIDTH];
+    FlowHeavyWindow cur;
+    FlowHeavyWindow last;
+} FlowHeavyGlobal;
+
+static FlowHeavyGlobal *flow_heavy = NULL;
+
+/** \internal
+ *  \brief counter index of 'key' in each row of a sketch */
+static inline void FlowHeavyHash(const FlowHeavyKey *key, uint32_t words,
+                                 uint32_t idx[FLOW_HEAVY_DEPTH])
+{
+    uint32_t h1 = 0, h2 = 0;
+    int row;
+
+    hashword2(key->w, words, &h1, &h2);
+    h2 |= 1;
+    for (row = 0; row < FLOW_HEAVY_DEPTH; row++) {
+        idx[row] = (h1 + (uint32_t)row * h2) & (FLOW_HEAVY_WIDTH - 1);
+    }
+}
+
+/** \internal
+ *  \brief add or update 'key' in a top list
+ *
+ *  If the list is full the key only goes in if it's above the smallest
+ *  entry, which it then replaces.
+ */
+static void FlowHeavyTopUpdate(FlowHeavyTop *top, const FlowHeavyKey *key,
+                               uint64_t bytes)
+{
+    uint32_t i, slot = top->cnt;
+
+    for (i = 0; i < top->cnt; i++) {
+        if (memcmp(&top->e[i].key, key, sizeof(*key)) == 0) {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot == top->cnt) {
+        if (top->cnt < FLOW_HEAVY_TOPN) {
+            top->cnt++;
+        } else {
+            if (bytes <= top->min)
+                return;
+            /* evict the smallest */
+            for (i = 0; i < top->cnt; i++) {
+                if (top->e[i].bytes == top->min) {
+                    slot = i;
+                    break;
+                }
+            }
+        }
+        top->e[slot].key = *key;
+    }
+    top->e[slot].bytes = bytes;
+
+    if (top->cnt < FLOW_HEAVY_TOPN) {
+        top->min = 0;
+        return;
+    }
+    top->min = top->e[0].bytes;
+    for (i = 1; i < top->cnt; i++) {
+        if (top->e[i].bytes < top->min)
+            top->min = top->e[i].bytes;
+    }
+}
+
+/** \internal
+ *  \brief count 'bytes' for 'key' in a thread's sketch of 'type' */
+static void FlowHeavyThreadAdd(FlowHeavyThreadData *td, int type,
+                               const FlowHeavyKey *key, uint32_t bytes)
+{
+    uint32_t idx[FLOW_HEAVY_DEPTH];
+    uint32_t est = UINT32_MAX;
+    int row;
+
+    FlowHeavyHash(key, flow_heavy_key_words[type], idx);
+    for (row = 0; row < FLOW_HEAVY_DEPTH; row++) {
+        uint32_t c = (td->cms[type][row][idx[row]] += bytes);
+        if (c < est)
+            est = c;
+    }
+
+    /* a key in the list only grows, so it can't be at or below the
+     * smallest entry here */
+    FlowHeavyTop *top = &td->top[type];
+    if (top->cnt == FLOW_HEAVY_TOPN && est <= top->min)
+        return;
+    FlowHeavyTopUpdate(top, key, est);
+}
+
+/** \internal
+ *  \brief add a thread's counts to the global ones and reset them
+ *
+ *  Starts a new window if the current one is over.
+ */
+static void FlowHeavyMerge(FlowHeavyThreadData *td, uint32_t now)
+{
+    int type, row;
+    uint32_t i;
+
+    if (unlikely(flow_heavy == NULL))
+        return;
+
+    SCMutexLock(&flow_heavy->m);
+    FlowHeavyWindow *cur = &flow_heavy->cur;
+    if (cur->start == 0) {
+        cur->start = now;
+    } else if (now >= cur->start + flow_heavy_config.window) {
+        flow_heavy->last = *cur;
+        memset(cur, 0, sizeof(*cur));
+        memset(flow_heavy->cms, 0, sizeof(flow_heavy->cms));
+        cur->start = now;
+    }
+
+    for (type = 0; type < FLOW_HEAVY_SKETCHES; type++) {
+        for (row = 0; row < FLOW_HEAVY_DEPTH; row++) {
+            for (i = 0; i < FLOW_HEAVY_WIDTH; i++) {
+                flow_heavy->cms[type][row][i] += td->cms[type][row][i];
+            }
+        }
+
+        /* the thread's top keys go in with their global estimate */
+        FlowHeavyTop *top = &td->top[type];
+        for (i = 0; i < top->cnt; i++) {
+            uint32_t idx[FLOW_HEAVY_DEPTH];
+            uint64_t est = UINT64_MAX;
+
+            FlowHeavyHash(&top->e[i].key, flow_heavy_key_words[type], idx);
+            for (row = 0; row < FLOW_HEAVY_DEPTH; row++) {
+                if (flow_heavy->cms[type][row][idx[row]] < est)
+                    est = flow_heavy->cms[type][row][idx[row]];
+            }
+            FlowHeavyTopUpdate(&cur->top[type], &top->e[i].key, est);
+        }
+    }
+
+    /* flow byte counts are totals already */
+    FlowHeavyTop *top = &td->top[FLOW_HEAVY_FLOW];
+    for (i = 0; i < top->cnt; i++) {
+        FlowHeavyTopUpdate(&cur->top[FLOW_HEAVY_FLOW], &top->e[i].key,
+                top->e[i].bytes);
+    }
+    SCMutexUnlock(&flow_heavy->m);
+
+    memset(td->cms, 0, sizeof(td->cms));
+    memset(td->top, 0, sizeof(td->top));
+}
+
+/**
+ * \brief count the packet's bytes for its source, port and flow
+ *
+ * To be called by the flow worker with the flow, if any, locked.
+ *
+ * \retval FLOW_HEAVY_ELEPHANT if the packet took the flow over
+ *         'elephant-bytes'
+ * \retval 0 otherwise
+ */
+int FlowHeavyUpdate(FlowHeavyThreadData *td, const Packet *p)
+{
+    const uint32_t len = GET_PKT_LEN(p);
+    const uint32_t now = (uint32_t)p->ts.tv_sec;
+    FlowHeavyKey key;
+    int r = 0;
+
+    if (now != td->last_merge) {
+        if (td->last_merge != 0)
+            FlowHeavyMerge(td, now);
+        td->last_merge = now;
+    }
+
+    if (!(PKT_IS_IPV4(p) || PKT_IS_IPV6(p)))
+        return 0;
+
+    memset(&key, 0, sizeof(key));
+    memcpy(key.w, p->src.addr_data32, sizeof(p->src.addr_data32));
+    key.w[4] = (uint32_t)p->src.family;
+    FlowHeavyThreadAdd(td, FLOW_HEAVY_SRC, &key, len);
+
+    const Flow *f = p->flow;
+    if (PKT_IS_TCP(p) || PKT_IS_UDP(p)) {
+        /* the server port, for the replies too */
+        memset(&key, 0, sizeof(key));
+        key.w[0] = ((uint32_t)p->proto << 16) | (f != NULL ? f->dp : p->dp);
+        FlowHeavyThreadAdd(td, FLOW_HEAVY_DPORT, &key, len);
+    }
+
+    if (f != NULL) {
+        const uint64_t bytes = f->todstbytecnt + f->tosrcbytecnt;
+        FlowHeavyTop *top = &td->top[FLOW_HEAVY_FLOW];
+
+        if (top->cnt < FLOW_HEAVY_TOPN || bytes > top->min) {
+            memcpy(&key.w[0], f->src.addr_data32, 16);
+            memcpy(&key.w[4], f->dst.addr_data32, 16);
+            key.w[8] = ((uint32_t)f->sp << 16) | f->dp;
+            key.w[9] = ((uint32_t)(FLOW_IS_IPV4(f) ? AF_INET : AF_INET6) << 8) |
+                       f->proto;
+            FlowHeavyTopUpdate(top, &key, bytes);
+        }
+
+        if (bytes >= flow_heavy_config.elephant_bytes &&
+            bytes - len < flow_heavy_config.elephant_bytes)
+            r = FLOW_HEAVY_ELEPHANT;
+    }
+    return r;
+}
+
+FlowHeavyThreadData *FlowHeavyThreadInit(void)
+{
+    if (!flow_heavy_config.enabled)
+        return NULL;
+
+    FlowHeavyThreadData *td = SCCalloc(1, sizeof(*td));
+    if (unlikely(td == NULL)) {
+        SCLogWarning(SC_ERR_MEM_ALLOC, "no memory for the heavy hitter "
+                "sketches, thread won't be counted");
+        return NULL;
+    }
+    return td;
+}
+
+void FlowHeavyThreadDeinit(FlowHeavyThreadData *td)
+{
+    if (td == NULL)
+        return;
+
+    if (td->last_merge != 0)
+        FlowHeavyMerge(td, td->last_merge);
+    SCFree(td);
+}
+
+/**
+ * \brief read the 'heavy-hitters' section
+ *
+ * Tracking is off unless 'heavy-hitters.enabled' is set.
+ */
+void FlowHeavyInitConfig(void)
+{
+    int enabled = 0;
+    intmax_t val;
+    char *str = NULL;
+    uint64_t size;
+
+    if (ConfGetBool("heavy-hitters.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    if (ConfGetInt("heavy-hitters.window", &val) == 1) {
+        if (val > 0 && val <= 86400)
+            flow_heavy_config.window = (uint32_t)val;
+        else
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid heavy-hitters.window "
+                    "%"PRIdMAX", using %u", val, flow_heavy_config.window);
+    }
+    if (ConfGet("heavy-hitters.elephant-bytes", &str) == 1 && str != NULL) {
+        if (ParseSizeStringU64(str, &size) == 0 && size > 0)
+            flow_heavy_config.elephant_bytes = size;
+        else
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid heavy-hitters."
+                    "elephant-bytes %s, using %"PRIu64, str,
+                    flow_heavy_config.elephant_bytes);
+    }
+    str = NULL;
+    if (ConfGet("heavy-hitters.bypass-bytes", &str) == 1 && str != NULL) {
+        if (ParseSizeStringU64(str, &size) == 0)
+            flow_heavy_config.bypass_bytes = size;
+        else
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid heavy-hitters."
+                    "bypass-bytes %s, bypass disabled", str);
+    }
+
+    flow_heavy = SCCalloc(1, sizeof(*flow_heavy));
+    if (unlikely(flow_heavy == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "no memory for the heavy hitter "
+                "sketches, disabled");
+        return;
+    }
+    SCMutexInit(&flow_heavy->m, NULL);
+
+    flow_heavy_config.enabled = 1;
+    SCLogConfig("heavy hitter tracking enabled: %us window, elephant flows "
+            "from %"PRIu64" bytes, bypass %s%"PRIu64, flow_heavy_config.window,
+            flow_heavy_config.elephant_bytes,
+            flow_heavy_config.bypass_bytes ? "from " : "off ",
+            flow_heavy_config.bypass_bytes);
+}
+
+void FlowHeavyShutdown(void)
+{
+    if (flow_heavy == NULL)
+        return;
+
+    SCMutexDestroy(&flow_heavy->m);
+    SCFree(flow_heavy);
+    flow_heavy = NULL;
+    flow_heavy_config.enabled = 0;
+}
+
+#ifdef HAVE_LIBJANSSON
+static int FlowHeavyEntryCompare(const void *a, const void *b)
+{
+    const FlowHeavyEntry *ea = a, *eb = b;
+    if (ea->bytes == eb->bytes)
+        return 0;
+    return ea->bytes > eb->bytes ? -1 : 1;
+}
+
+static json_t *FlowHeavyAddrToJSON(int family, const uint32_t *addr)
+{
+    char str[46] = "";
+
+    PrintInet(family, (const void *)addr, str, sizeof(str));
+    return json_string(str);
+}
+
+/** \internal
+ *  \brief a window's top lists, largest first */
+static json_t *FlowHeavyWindowToJSON(const FlowHeavyWindow *w)
+{
+    static const char *names[FLOW_HEAVY_MAX] = { "src_ip", "dest_port", "flows" };
+    json_t *js = json_object();
+    int type;
+    uint32_t i;
+
+    if (unlikely(js == NULL))
+        return NULL;
+    json_object_set_new(js, "start", json_integer(w->start));
+
+    for (type = 0; type < FLOW_HEAVY_MAX; type++) {
+        FlowHeavyTop top = w->top[type];
+        json_t *ja = json_array();
+        if (unlikely(ja == NULL))
+            continue;
+
+        qsort(top.e, top.cnt, sizeof(top.e[0]), FlowHeavyEntryCompare);
+        for (i = 0; i < top.cnt; i++) {
+            const uint32_t *k = top.e[i].key.w;
+            json_t *je = json_object();
+            if (unlikely(je == NULL))
+                continue;
+
+            if (type == FLOW_HEAVY_SRC) {
+                json_object_set_new(je, "ip", FlowHeavyAddrToJSON(k[4], k));
+            } else if (type == FLOW_HEAVY_DPORT) {
+                json_object_set_new(je, "port", json_integer(k[0] & 0xffff));
+                json_object_set_new(je, "proto", json_string(known_proto[k[0] >> 16]));
+            } else {
+                int family = k[9] >> 8;
+                json_object_set_new(je, "src_ip", FlowHeavyAddrToJSON(family, &k[0]));
+                json_object_set_new(je, "src_port", json_integer(k[8] >> 16));
+                json_object_set_new(je, "dest_ip", FlowHeavyAddrToJSON(family, &k[4]));
+                json_object_set_new(je, "dest_port", json_integer(k[8] & 0xffff));
+                json_object_set_new(je, "proto", json_string(known_proto[k[9] & 0xff]));
+            }
+            json_object_set_new(je, "bytes", json_integer(top.e[i].bytes));
+            json_array_append_new(ja, je);
+        }
+        json_object_set_new(js, names[type], ja);
+    }
+    return js;
+}
+
+/**
+ * \brief current and last window's heavy hitters
+ *
+ * Byte counts of hosts and ports are estimates: never low, high by a
+ * small share of the window's bytes at most.
+ *
+ * \retval js object or NULL if tracking is disabled
+ */
+json_t *FlowHeavyToJSON(void)
+{
+    if (flow_heavy == NULL)
+        return NULL;
+
+    json_t *js = json_object();
+    if (unlikely(js == NULL))
+        return NULL;
+
+    SCMutexLock(&flow_heavy->m);
+    FlowHeavyWindow cur = flow_heavy->cur;
+    FlowHeavyWindow last = flow_heavy->last;
+    SCMutexUnlock(&flow_heavy->m);
+
+    json_object_set_new(js, "window", json_integer(flow_heavy_config.window));
+    json_t *jcur = FlowHeavyWindowToJSON(&cur);
+    if (jcur != NULL)
+        json_object_set_new(js, "current", jcur);
+    if (last.start != 0) {
+        json_t *jlast = FlowHeavyWindowToJSON(&last);
+        if (jlast != NULL)
+            json_object_set_new(js, "last", jlast);
+    }
+    return js;
+}
+#endif /* HAVE_LIBJANSSON */
+
+#ifdef BUILD_UNIX_SOCKET
+/**
+ * \brief unix socket 'heavy-hitters' command
+ */
+TmEcode FlowHeavyCommand(json_t *cmd, json_t *answer, void *data)
+{
+    json_t *js = FlowHeavyToJSON();
+    if (js == NULL) {
+        json_object_set_new(answer, "message",
+                json_string("heavy hitter tracking is not enabled"));
+        return TM_ECODE_FAILED;
+    }
+    json_object_set_new(answer, "message", js);
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#ifdef UNITTESTS
+/** \test a heavy key ends up on top, over many small ones */
+static int FlowHeavyTest01(void)
+{
+    FlowHeavyThreadData *td = SCCalloc(1, sizeof(*td));
+    FAIL_IF_NULL(td);
+    FlowHeavyKey key;
+    uint32_t i;
+
+    for (i = 0; i < 10000; i++) {
+        memset(&key, 0, sizeof(key));
+        key.w[0] = i;
+        key.w[4] = AF_INET;
+        FlowHeavyThreadAdd(td, FLOW_HEAVY_SRC, &key, 100);
+
+        /* one in ten packets is from the heavy host */
+        if (i % 10 == 0) {
+            memset(&key, 0, sizeof(key));
+            key.w[0] = 0xffffffff;
+            key.w[4] = AF_INET;
+            FlowHeavyThreadAdd(td, FLOW_HEAVY_SRC, &key, 1500);
+        }
+    }
+
+    FlowHeavyTop *top = &td->top[FLOW_HEAVY_SRC];
+    FAIL_IF(top->cnt != FLOW_HEAVY_TOPN);
+    uint64_t heavy = 0, max_other = 0;
+    for (i = 0; i < top->cnt; i++) {
+        if (top->e[i].key.w[0] == 0xffffffff)
+            heavy = top->e[i].bytes;
+        else if (top->e[i].bytes > max_other)
+            max_other = top->e[i].bytes;
+    }
+    /* counts are never low */
+    FAIL_IF(heavy < 1000 * 1500);
+    FAIL_IF(heavy <= max_other);
+
+    SCFree(td);
+    PASS;
+}
+
+/** \test top list keeps the largest, evicts the smallest */
+static int FlowHeavyTest02(void)
+{
+    FlowHeavyTop top;
+    FlowHeavyKey key;
+    uint32_t i;
+
+    memset(&top, 0, sizeof(top));
+    for (i = 1; i <= FLOW_HEAVY_TOPN + 4; i++) {
+        memset(&key, 0, sizeof(key));
+        key.w[0] = i;
+        FlowHeavyTopUpdate(&top, &key, i * 10);
+    }
+    FAIL_IF(top.cnt != FLOW_HEAVY_TOPN);
+    FAIL_IF(top.min != 50);
+    /* updating a key that's in the list doesn't add it again */
+    memset(&key, 0, sizeof(key));
+    key.w[0] = FLOW_HEAVY_TOPN + 4;
+    FlowHeavyTopUpdate(&top, &key, 1000);
+    FAIL_IF(top.cnt != FLOW_HEAVY_TOPN);
+    /* too small to get in */
+    key.w[0] = 1000;
+    FlowHeavyTopUpdate(&top, &key, 10);
+    for (i = 0; i < top.cnt; i++) {
+        FAIL_IF(top.e[i].key.w[0] == 1000);
+    }
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void FlowHeavyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowHeavyTest01 -- heavy key on top", FlowHeavyTest01);
+    UtRegisterTest("FlowHeavyTest02 -- top list", FlowHeavyTest02);
+#endif
+}
@@ -0,0 +1,124 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Heavy hitter tracking: the source hosts, destination ports and flows
+ * that move the most bytes.
+ *
+ * Each flow worker counts the bytes per source host and per destination
+ * port in a count-min sketch of its own and keeps the top entries by
+ * their estimate. Flows keep their exact byte counts, so for them only
+ * the top list is needed. Once a second of packet time the worker adds
+ * its sketches and top lists to the global ones and starts over. The
+ * global ones cover a window of 'heavy-hitters.window' seconds and are
+ * reported in the stats and by the 'heavy-hitters' unix socket command.
+ */
+
+#ifndef __FLOW_HEAVY_H__
+#define __FLOW_HEAVY_H__
+
+#include "flow.h"
+#include "app-layer-protos.h"
+
+/** rows of the count-min sketches */
+#define FLOW_HEAVY_DEPTH    4
+/** counters per row, power of 2 */
+#define FLOW_HEAVY_WIDTH    1024
+/** entries of each top list */
+#define FLOW_HEAVY_TOPN     16
+
+enum FlowHeavyType {
+    FLOW_HEAVY_SRC = 0,     /**< bytes per source address */
+    FLOW_HEAVY_DPORT,       /**< bytes per destination port and protocol */
+    FLOW_HEAVY_SKETCHES,    /**< types above are counted in a sketch */
+
+    FLOW_HEAVY_FLOW = FLOW_HEAVY_SKETCHES, /**< bytes per flow, exact */
+
+    FLOW_HEAVY_MAX,
+};
+
+/** key of a top list entry, unused words are 0 */
+typedef struct FlowHeavyKey_ {
+    uint32_t w[10];
+} FlowHeavyKey;
+
+typedef struct FlowHeavyEntry_ {
+    FlowHeavyKey key;
+    uint64_t bytes;
+} FlowHeavyEntry;
+
+typedef struct FlowHeavyTop_ {
+    uint32_t cnt;
+    uint64_t min;           /**< lowest bytes once the list is full */
+    FlowHeavyEntry e[FLOW_HEAVY_TOPN];
+} FlowHeavyTop;
+
+/** per flow worker sketches, see FlowHeavyUpdate() */
+typedef struct FlowHeavyThreadData_ {
+    uint32_t cms[FLOW_HEAVY_SKETCHES][FLOW_HEAVY_DEPTH][FLOW_HEAVY_WIDTH];
+    FlowHeavyTop top[FLOW_HEAVY_MAX];
+    uint32_t last_merge;    /**< packet time of the last merge, sec */
+} FlowHeavyThreadData;
+
+typedef struct FlowHeavyConfig_ {
+    int enabled;
+    uint32_t window;            /**< seconds covered by the global lists */
+    uint64_t elephant_bytes;    /**< flows from this size are counted */
+    uint64_t bypass_bytes;      /**< bypass flows from this size, 0 off */
+} FlowHeavyConfig;
+
+extern FlowHeavyConfig flow_heavy_config;
+
+/** FlowHeavyUpdate() return value: the flow just became an elephant */
+#define FLOW_HEAVY_ELEPHANT 1
+
+void FlowHeavyInitConfig(void);
+void FlowHeavyShutdown(void);
+FlowHeavyThreadData *FlowHeavyThreadInit(void);
+void FlowHeavyThreadDeinit(FlowHeavyThreadData *td);
+int FlowHeavyUpdate(FlowHeavyThreadData *td, const Packet *p);
+#ifdef HAVE_LIBJANSSON
+json_t *FlowHeavyToJSON(void);
+#endif
+#ifdef BUILD_UNIX_SOCKET
+TmEcode FlowHeavyCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+void FlowHeavyRegisterTests(void);
+
+/**
+ * \brief check if the bypass policy applies to the flow
+ *
+ * The flow has to be over 'bypass-bytes' and done with the app layer:
+ * the parser asked for no more inspection, or no protocol was found.
+ */
+static inline int FlowHeavyWantsBypass(const Flow *f)
+{
+    if (flow_heavy_config.bypass_bytes == 0 ||
+        (f->flags & FLOW_BYPASSED) ||
+        f->todstbytecnt + f->tosrcbytecnt < flow_heavy_config.bypass_bytes)
+        return 0;
+
+    if (f->flags & FLOW_NOPAYLOAD_INSPECTION)
+        return 1;
+    return (f->alproto == ALPROTO_UNKNOWN &&
+            f->alproto_ts == ALPROTO_FAILED &&
+            (f->proto != IPPROTO_TCP || f->alproto_tc == ALPROTO_FAILED));
+}
+
+#endif /* __FLOW_HEAVY_H__ */
@@ -80,6 +80,27 @@ static uint32_t flowrec_number = 1;
 /* atomic counter for flow recyclers, to assign instance id */
 SC_ATOMIC_DECLARE(uint32_t, flowrec_cnt);
 
+/** \brief hand a flow to the recyclers. Flows are spread over the queues
+ *         by hash, and each recycler empties only its own queue. */
+static void FlowRecycleEnqueue(Flow *f)
+{
+    FlowEnqueue(&flow_recycle_q[f->flow_hash % flowrec_number], f);
+}
+
+/** \brief flows waiting in all recycle queues */
+static uint32_t FlowRecycleQueueLen(void)
+{
+    uint32_t len = 0;
+    uint32_t u;
+
+    for (u = 0; u < flowrec_number; u++) {
+        FQLOCK_LOCK(&flow_recycle_q[u]);
+        len += flow_recycle_q[u].len;
+        FQLOCK_UNLOCK(&flow_recycle_q[u]);
+    }
+    return len;
+}
+
 SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 
 /* 1 seconds */
@@ -95,6 +116,12 @@ typedef struct FlowTimeoutCounters_ {
     uint32_t est;
     uint32_t clo;
     uint32_t tcp_reuse;
+
+    uint32_t flows_checked;
+    uint32_t rows_checked;
+    uint32_t rows_skipped;  /**< row was locked, skipped for this pass */
+    uint32_t rows_empty;
+    uint32_t rows_not_due;  /**< row skipped based on its next_ts hint */
 } FlowTimeoutCounters;
 
 /**
@@ -159,50 +186,6 @@ void FlowDisableFlowManagerThread(void)
     return;
 }
 
-/** \internal
- *  \brief get timeout for flow
- *
- *  \param f flow
- *  \param state flow state
- *  \param emergency bool indicating emergency mode 1 yes, 0 no
- *
- *  \retval timeout timeout in seconds
- */
-static inline uint32_t FlowGetFlowTimeout(const Flow *f, int state, int emergency)
-{
-    uint32_t timeout;
-
-    if (emergency) {
-        switch(state) {
-            default:
-            case FLOW_STATE_NEW:
-                timeout = flow_proto[f->protomap].emerg_new_timeout;
-                break;
-            case FLOW_STATE_ESTABLISHED:
-                timeout = flow_proto[f->protomap].emerg_est_timeout;
-                break;
-            case FLOW_STATE_CLOSED:
-                timeout = flow_proto[f->protomap].emerg_closed_timeout;
-                break;
-        }
-    } else { /* implies no emergency */
-        switch(state) {
-            default:
-            case FLOW_STATE_NEW:
-                timeout = flow_proto[f->protomap].new_timeout;
-                break;
-            case FLOW_STATE_ESTABLISHED:
-                timeout = flow_proto[f->protomap].est_timeout;
-                break;
-            case FLOW_STATE_CLOSED:
-                timeout = flow_proto[f->protomap].closed_timeout;
-                break;
-        }
-    }
-
-    return timeout;
-}
-
 /** \internal
  *  \brief check if a flow is timed out
  *
@@ -269,13 +252,22 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
  *  \param ts timestamp
  *  \param emergency bool indicating emergency mode
  *  \param counters ptr to FlowTimeoutCounters structure
+ *  \param next_ts[out] earliest (non-emergency) timeout of the flows that
+ *                      remain in the row
  *
  *  \retval cnt timed out flows
  */
 static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
-        int emergency, FlowTimeoutCounters *counters)
+        int emergency, FlowTimeoutCounters *counters, uint32_t *next_ts)
 {
     uint32_t cnt = 0;
+    uint32_t row_next_ts = UINT32_MAX;
+
+#define FLOW_ROW_NEXT_TS_UPDATE(f, state) do {                              \
+        uint32_t fts = (f)->lastts.tv_sec + FlowGetFlowTimeout((f), (state), 0); \
+        if (fts < row_next_ts)                                              \
+            row_next_ts = fts;                                              \
+    } while (0)
 
     do {
         /* check flow timeout based on lastts and state. Both can be
@@ -284,9 +276,11 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
          * be modified when we have both the flow and hash row lock */
 
         int state = SC_ATOMIC_GET(f->flow_state);
+        counters->flows_checked++;
 
         /* timeout logic goes here */
         if (FlowManagerFlowTimeout(f, state, ts, emergency) == 0) {
+            FLOW_ROW_NEXT_TS_UPDATE(f, state);
             f = f->hprev;
             continue;
         }
@@ -299,10 +293,21 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
 
         Flow *next_flow = f->hprev;
 
+        /* with lockless lookups a worker may have updated lastts while
+         * we waited for the flow lock, so check again */
+        if ((flow_config.flags & FLOW_CONFIG_FLAG_LOCKLESS_LOOKUP) &&
+                FlowManagerFlowTimeout(f, state, ts, emergency) == 0) {
+            FLOW_ROW_NEXT_TS_UPDATE(f, state);
+            FLOWLOCK_UNLOCK(f);
+            f = next_flow;
+            continue;
+        }
+
         /* check if the flow is fully timed out and
          * ready to be discarded. */
         if (FlowManagerFlowTimedOut(f, ts) == 1) {
             /* remove from the hash */
+            FBSEQ_WRITE_BEGIN(f->fb);
             if (f->hprev != NULL)
                 f->hprev->hnext = f->hnext;
             if (f->hnext != NULL)
@@ -314,6 +319,7 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
 
             f->hnext = NULL;
             f->hprev = NULL;
+            FBSEQ_WRITE_END(f->fb);
 
             if (f->flags & FLOW_TCP_REUSED)
                 counters->tcp_reuse++;
@@ -334,7 +340,7 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
             /* no one is referring to this flow, use_cnt 0, removed from hash
              * so we can unlock it and move it back to the spare queue. */
             FLOWLOCK_UNLOCK(f);
-            FlowEnqueue(&flow_recycle_q, f);
+            FlowRecycleEnqueue(f);
             /* move to spare list */
 //            FlowMoveToSpare(f);
 
@@ -353,12 +359,16 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
                     break;
             }
         } else {
+            /* still in the row: it will be due again right away */
+            FLOW_ROW_NEXT_TS_UPDATE(f, state);
             FLOWLOCK_UNLOCK(f);
         }
 
         f = next_flow;
     } while (f != NULL);
+#undef FLOW_ROW_NEXT_TS_UPDATE
 
+    *next_ts = row_next_ts;
     return cnt;
 }
 
@@ -386,23 +396,41 @@ static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
 
     for (idx = hash_min; idx < hash_max; idx++) {
         FlowBucket *fb = &flow_hash[idx];
+        uint32_t row_next_ts = UINT32_MAX;
+
+        /* nothing in this row can have timed out yet. In emergency mode
+         * the timeouts are shorter than the hint assumes, so check all */
+        uint32_t next_ts = SC_ATOMIC_GET(fb->next_ts);
+        if (!emergency && (uint32_t)ts->tv_sec < next_ts) {
+            counters->rows_not_due++;
+            continue;
+        }
 
         /* before grabbing the row lock, make sure we have at least
          * 9 packets in the pool */
         PacketPoolWaitForN(9);
 
-        if (FBLOCK_TRYLOCK(fb) != 0)
+        if (FBLOCK_TRYLOCK(fb) != 0) {
+            counters->rows_skipped++;
             continue;
+        }
+        counters->rows_checked++;
 
         /* flow hash bucket is now locked */
 
-        if (fb->tail == NULL)
+        if (fb->tail == NULL) {
+            counters->rows_empty++;
             goto next;
+        }
 
         /* we have a flow, or more than one */
-        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters);
+        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters,
+                &row_next_ts);
 
 next:
+        /* raise the hint, unless a worker lowered it in the meantime by
+         * adding a flow or changing a flow's state */
+        (void)SC_ATOMIC_CAS(&fb->next_ts, next_ts, row_next_ts);
         FBLOCK_UNLOCK(fb);
 
         if (try_cnt > 0 && cnt >= try_cnt)
@@ -433,6 +461,7 @@ static uint32_t FlowManagerHashRowCleanup(Flow *f)
         int state = SC_ATOMIC_GET(f->flow_state);
 
         /* remove from the hash */
+        FBSEQ_WRITE_BEGIN(f->fb);
         if (f->hprev != NULL)
             f->hprev->hnext = f->hnext;
         if (f->hnext != NULL)
@@ -444,6 +473,7 @@ static uint32_t FlowManagerHashRowCleanup(Flow *f)
 
         f->hnext = NULL;
         f->hprev = NULL;
+        FBSEQ_WRITE_END(f->fb);
 
         if (state == FLOW_STATE_NEW)
             f->flow_end_flags |= FLOW_END_FLAG_STATE_NEW;
@@ -458,7 +488,7 @@ static uint32_t FlowManagerHashRowCleanup(Flow *f)
          * so we can unlock it and move it to the recycle queue. */
         FLOWLOCK_UNLOCK(f);
 
-        FlowEnqueue(&flow_recycle_q, f);
+        FlowRecycleEnqueue(f);
 
         cnt++;
 
@@ -507,6 +537,14 @@ typedef struct FlowManagerThreadData_ {
     uint16_t flow_emerg_mode_enter;
     uint16_t flow_emerg_mode_over;
     uint16_t flow_tcp_reuse;
+
+    uint16_t flow_mgr_flows_checked;
+    uint16_t flow_mgr_rows_checked;
+    uint16_t flow_mgr_rows_skipped;
+    uint16_t flow_mgr_rows_empty;
+    uint16_t flow_mgr_rows_not_due;
+    uint16_t flow_mgr_rows_sec;
+    uint16_t flow_mgr_pass_usec;
 } FlowManagerThreadData;
 
 static TmEcode FlowManagerThreadInit(ThreadVars *t, void *initdata, void **data)
@@ -545,6 +583,14 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, void *initdata, void **data)
     ftd->flow_emerg_mode_over = StatsRegisterCounter("flow.emerg_mode_over", t);
     ftd->flow_tcp_reuse = StatsRegisterCounter("flow.tcp_reuse", t);
 
+    ftd->flow_mgr_flows_checked = StatsRegisterCounter("flow_mgr.flows_checked", t);
+    ftd->flow_mgr_rows_checked = StatsRegisterCounter("flow_mgr.rows_checked", t);
+    ftd->flow_mgr_rows_skipped = StatsRegisterCounter("flow_mgr.rows_skipped", t);
+    ftd->flow_mgr_rows_empty = StatsRegisterCounter("flow_mgr.rows_empty", t);
+    ftd->flow_mgr_rows_not_due = StatsRegisterCounter("flow_mgr.rows_not_due", t);
+    ftd->flow_mgr_rows_sec = StatsRegisterCounter("flow_mgr.rows_per_sec", t);
+    ftd->flow_mgr_pass_usec = StatsRegisterCounter("flow_mgr.pass_usec", t);
+
     PacketPoolInit();
     return TM_ECODE_OK;
 }
@@ -613,9 +659,12 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
         if (ftd->instance == 1)
             FlowUpdateSpareFlows();
 
-        /* try to time out flows */
-        FlowTimeoutCounters counters = { 0, 0, 0, 0, };
+        /* try to time out flows in our part of the hash */
+        FlowTimeoutCounters counters = { 0, 0, 0, 0, 0, 0, 0, 0, 0, };
+        struct timeval pass_start, pass_end;
+        gettimeofday(&pass_start, NULL);
         FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters);
+        gettimeofday(&pass_end, NULL);
 
 
         if (ftd->instance == 1) {
@@ -636,10 +685,21 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
         StatsAddUI64(th_v, ftd->flow_mgr_cnt_est, (uint64_t)counters.est);
         StatsAddUI64(th_v, ftd->flow_tcp_reuse, (uint64_t)counters.tcp_reuse);
 
-        uint32_t len = 0;
-        FQLOCK_LOCK(&flow_spare_q);
-        len = flow_spare_q.len;
-        FQLOCK_UNLOCK(&flow_spare_q);
+        StatsAddUI64(th_v, ftd->flow_mgr_flows_checked, (uint64_t)counters.flows_checked);
+        StatsAddUI64(th_v, ftd->flow_mgr_rows_checked, (uint64_t)counters.rows_checked);
+        StatsAddUI64(th_v, ftd->flow_mgr_rows_skipped, (uint64_t)counters.rows_skipped);
+        StatsAddUI64(th_v, ftd->flow_mgr_rows_empty, (uint64_t)counters.rows_empty);
+        StatsAddUI64(th_v, ftd->flow_mgr_rows_not_due, (uint64_t)counters.rows_not_due);
+
+        uint64_t pass_usec = (uint64_t)(pass_end.tv_sec - pass_start.tv_sec) * 1000000ULL +
+                             (uint64_t)pass_end.tv_usec - (uint64_t)pass_start.tv_usec;
+        StatsSetUI64(th_v, ftd->flow_mgr_pass_usec, pass_usec);
+        if (pass_usec > 0) {
+            StatsSetUI64(th_v, ftd->flow_mgr_rows_sec,
+                    (uint64_t)(ftd->max - ftd->min) * 1000000ULL / pass_usec);
+        }
+
+        uint32_t len = FlowGetSpareCount();
         StatsSetUI64(th_v, ftd->flow_mgr_spare, (uint64_t)len);
 
         /* Don't fear, FlowManagerThread is here...
@@ -749,6 +809,11 @@ void FlowManagerThreadSpawn()
 
 typedef struct FlowRecyclerThreadData_ {
     void *output_thread_data;
+    /** the queue this recycler empties */
+    FlowQueue *queue;
+
+    uint16_t counter_queue_len;
+    uint16_t counter_queue_max;
 } FlowRecyclerThreadData;
 
 static TmEcode FlowRecyclerThreadInit(ThreadVars *t, void *initdata, void **data)
@@ -757,6 +822,13 @@ static TmEcode FlowRecyclerThreadInit(ThreadVars *t, void *initdata, void **data
     if (ftd == NULL)
         return TM_ECODE_FAILED;
 
+    uint32_t id = SC_ATOMIC_ADD(flowrec_cnt, 1) - 1;
+    ftd->queue = &flow_recycle_q[id % flowrec_number];
+    SCLogDebug("recycler %u uses queue %u", id, id % flowrec_number);
+
+    ftd->counter_queue_len = StatsRegisterCounter("flow_recycler.queue_len", t);
+    ftd->counter_queue_max = StatsRegisterMaxCounter("flow_recycler.queue_max", t);
+
     if (OutputFlowLogThreadInit(t, NULL, &ftd->output_thread_data) != TM_ECODE_OK) {
         SCLogError(SC_ERR_THREAD_INIT, "initializing flow log API for thread failed");
         SCFree(ftd);
@@ -811,23 +883,42 @@ static TmEcode FlowRecycler(ThreadVars *th_v, void *thread_data)
         SCLogDebug("ts %" PRIdMAX "", (intmax_t)ts.tv_sec);
 
         uint32_t len = 0;
-        FQLOCK_LOCK(&flow_recycle_q);
-        len = flow_recycle_q.len;
-        FQLOCK_UNLOCK(&flow_recycle_q);
+        FQLOCK_LOCK(ftd->queue);
+        len = ftd->queue->len;
+        FQLOCK_UNLOCK(ftd->queue);
+
+        StatsSetUI64(th_v, ftd->counter_queue_len, (uint64_t)len);
+        StatsSetUI64(th_v, ftd->counter_queue_max, (uint64_t)len);
 
-        /* Loop through the queue and clean up all flows in it */
+        /* Loop through the queue and clean up all flows in it. Flows are
+         * taken from the queue and returned to the spare queues in batches
+         * to take the locks shared with the workers less often. */
         if (len) {
             Flow *f;
-
-            while ((f = FlowDequeue(&flow_recycle_q)) != NULL) {
-                FLOWLOCK_WRLOCK(f);
-
-                (void)OutputFlowLog(th_v, ftd->output_thread_data, f);
-
-                FlowClearMemory (f, f->protomap);
-                FLOWLOCK_UNLOCK(f);
-                FlowMoveToSpare(f);
-                recycled_cnt++;
+            FlowStack work = { NULL, 0 };
+            FlowStack spare = { NULL, 0 };
+            FlowQueue *spare_q = NULL;
+
+            while (FlowDequeueBatch(ftd->queue, &work, FLOW_SPARE_BATCH) > 0) {
+                while ((f = FlowStackPop(&work)) != NULL) {
+                    FLOWLOCK_WRLOCK(f);
+
+                    (void)OutputFlowLog(th_v, ftd->output_thread_data, f);
+
+                    FlowClearMemory (f, f->protomap);
+                    FLOWLOCK_UNLOCK(f);
+
+                    /* flows go back to the spare queue of their node */
+                    FlowQueue *q = FlowGetSpareQueue(f->numa_node);
+                    if (q != spare_q) {
+                        if (spare_q != NULL)
+                            FlowEnqueueBatch(spare_q, &spare);
+                        spare_q = q;
+                    }
+                    FlowStackPush(&spare, f);
+                    recycled_cnt++;
+                }
+                FlowEnqueueBatch(spare_q, &spare);
             }
         }
 
@@ -857,12 +948,7 @@ static TmEcode FlowRecycler(ThreadVars *th_v, void *thread_data)
 
 int FlowRecyclerReadyToShutdown(void)
 {
-    uint32_t len = 0;
-    FQLOCK_LOCK(&flow_recycle_q);
-    len = flow_recycle_q.len;
-    FQLOCK_UNLOCK(&flow_recycle_q);
-
-    return ((len == 0));
+    return (FlowRecycleQueueLen() == 0);
 }
 
 /** \brief spawn the flow recycler thread */
@@ -874,7 +960,7 @@ void FlowRecyclerThreadSpawn()
     intmax_t setting = 1;
     (void)ConfGetInt("flow.recyclers", &setting);
 
-    if (setting < 1 || setting > 1024) {
+    if (setting < 1 || setting > FLOW_RECYCLE_QUEUES_MAX) {
         SCLogError(SC_ERR_INVALID_ARGUMENTS,
                 "invalid flow.recyclers setting %"PRIdMAX, setting);
         exit(EXIT_FAILURE);
@@ -1267,10 +1353,10 @@ static int FlowMgrTest05 (void)
     struct timeval ts;
     TimeGet(&ts);
     /* try to time out flows */
-    FlowTimeoutCounters counters = { 0, 0, 0, 0, };
+    FlowTimeoutCounters counters = { 0, 0, 0, 0, 0, 0, 0, 0, 0, };
     FlowTimeoutHash(&ts, 0 /* check all */, 0, flow_config.hash_size, &counters);
 
-    if (flow_recycle_q.len > 0) {
+    if (FlowRecycleQueueLen() > 0) {
         result = 1;
     }
 
@@ -1278,6 +1364,46 @@ static int FlowMgrTest05 (void)
     FlowShutdown();
     return result;
 }
+
+/**
+ *  \test   Test that rows with nothing due are skipped using the
+ *          next_ts hint and checked again once flows can time out.
+ */
+static int FlowMgrTest06 (void)
+{
+    struct timeval ts;
+
+    FlowInitConfig(FLOW_QUIET);
+
+    UTHBuildPacketOfFlows(0, 10, 0);
+    TimeGet(&ts);
+
+    /* first pass visits all rows and sets the hints */
+    FlowTimeoutCounters counters1 = { 0, 0, 0, 0, 0, 0, 0, 0, 0, };
+    FlowTimeoutHash(&ts, 0, 0, flow_config.hash_size, &counters1);
+    FAIL_IF(counters1.rows_checked != flow_config.hash_size);
+    FAIL_IF(counters1.rows_not_due != 0);
+    FAIL_IF(FlowRecycleQueueLen() != 0);
+
+    /* nothing can be due yet, so no row should be visited */
+    FlowTimeoutCounters counters2 = { 0, 0, 0, 0, 0, 0, 0, 0, 0, };
+    FlowTimeoutHash(&ts, 0, 0, flow_config.hash_size, &counters2);
+    FAIL_IF(counters2.rows_checked != 0);
+    FAIL_IF(counters2.flows_checked != 0);
+    FAIL_IF(counters2.rows_not_due != flow_config.hash_size);
+
+    /* after the timeout the rows with flows are checked again */
+    TimeSetIncrementTime(2000);
+    TimeGet(&ts);
+    FlowTimeoutCounters counters3 = { 0, 0, 0, 0, 0, 0, 0, 0, 0, };
+    FlowTimeoutHash(&ts, 0, 0, flow_config.hash_size, &counters3);
+    FAIL_IF(counters3.rows_checked == 0);
+    FAIL_IF(counters3.rows_checked > 10);
+    FAIL_IF(FlowRecycleQueueLen() != 10);
+
+    FlowShutdown();
+    PASS;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -1296,5 +1422,7 @@ void FlowMgrRegisterTests (void)
                    FlowMgrTest04);
     UtRegisterTest("FlowMgrTest05 -- Test flow Allocations when it reach memcap",
                    FlowMgrTest05);
+    UtRegisterTest("FlowMgrTest06 -- Skip rows with nothing due",
+                   FlowMgrTest06);
 #endif /* UNITTESTS */
 }
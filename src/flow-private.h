@@ -78,8 +78,15 @@ FlowProto flow_proto[FLOW_PROTO_MAX];
 /** spare/unused/prealloced flows live here */
 FlowQueue flow_spare_q;
 
-/** queue to pass flows to cleanup/log thread(s) */
-FlowQueue flow_recycle_q;
+/** per NUMA node spare flows, used if FLOW_CONFIG_FLAG_NUMA is set */
+FlowQueue flow_spare_numa_q[FLOW_NUMA_MAX_NODES];
+
+/** max number of flow recycler threads, each has its own queue */
+#define FLOW_RECYCLE_QUEUES_MAX 64
+
+/** queues to pass flows to cleanup/log thread(s), a flow goes to the
+ *  queue of flow_hash % the number of recyclers */
+FlowQueue flow_recycle_q[FLOW_RECYCLE_QUEUES_MAX];
 
 FlowBucket *flow_hash;
 FlowConfig flow_config;
@@ -87,5 +94,60 @@ FlowConfig flow_config;
 /** flow memuse counter (atomic), for enforcing memcap limit */
 SC_ATOMIC_DECLARE(long long unsigned int, flow_memuse);
 
+/** \brief get the spare queue for a NUMA node
+ *
+ *  \param node NUMA node, anything out of range means the shared queue
+ */
+static inline FlowQueue *FlowGetSpareQueue(int node)
+{
+    if ((flow_config.flags & FLOW_CONFIG_FLAG_NUMA) &&
+            node >= 0 && node < (int)flow_config.numa_nodes)
+        return &flow_spare_numa_q[node];
+    return &flow_spare_q;
+}
+
+/** \brief get timeout for flow
+ *
+ *  \param f flow
+ *  \param state flow state
+ *  \param emergency bool indicating emergency mode 1 yes, 0 no
+ *
+ *  \retval timeout timeout in seconds
+ */
+static inline uint32_t FlowGetFlowTimeout(const Flow *f, int state, int emergency)
+{
+    uint32_t timeout;
+
+    if (emergency) {
+        switch(state) {
+            default:
+            case FLOW_STATE_NEW:
+                timeout = flow_proto[f->protomap].emerg_new_timeout;
+                break;
+            case FLOW_STATE_ESTABLISHED:
+                timeout = flow_proto[f->protomap].emerg_est_timeout;
+                break;
+            case FLOW_STATE_CLOSED:
+                timeout = flow_proto[f->protomap].emerg_closed_timeout;
+                break;
+        }
+    } else { /* implies no emergency */
+        switch(state) {
+            default:
+            case FLOW_STATE_NEW:
+                timeout = flow_proto[f->protomap].new_timeout;
+                break;
+            case FLOW_STATE_ESTABLISHED:
+                timeout = flow_proto[f->protomap].est_timeout;
+                break;
+            case FLOW_STATE_CLOSED:
+                timeout = flow_proto[f->protomap].closed_timeout;
+                break;
+        }
+    }
+
+    return timeout;
+}
+
 #endif /* __FLOW_PRIVATE_H__ */
 
@@ -135,6 +135,73 @@ Flow *FlowDequeue (FlowQueue *q)
     return f;
 }
 
+/**
+ *  \brief remove up to 'max' flows from the queue, taking the lock once
+ *
+ *  \param q queue
+ *  \param s stack the flows are pushed on
+ *  \param max max number of flows to take
+ *
+ *  \retval cnt number of flows taken
+ */
+uint32_t FlowDequeueBatch(FlowQueue *q, FlowStack *s, uint32_t max)
+{
+    uint32_t cnt = 0;
+
+    FQLOCK_LOCK(q);
+    while (cnt < max && q->bot != NULL) {
+        Flow *f = q->bot;
+
+        q->bot = f->lprev;
+        if (q->bot != NULL)
+            q->bot->lnext = NULL;
+        else
+            q->top = NULL;
+
+        FlowStackPush(s, f);
+        cnt++;
+    }
+#ifdef DEBUG
+    BUG_ON(q->len < cnt);
+#endif
+    q->len -= cnt;
+    FQLOCK_UNLOCK(q);
+    return cnt;
+}
+
+/**
+ *  \brief add all flows of a stack to the queue, taking the lock once
+ *
+ *  The flows are added at the bottom, where FlowDequeue() takes them, like
+ *  FlowMoveToSpare() does. The stack is empty afterwards.
+ *
+ *  \param q queue
+ *  \param s stack of flows
+ */
+void FlowEnqueueBatch(FlowQueue *q, FlowStack *s)
+{
+    Flow *f;
+
+    if (s->len == 0)
+        return;
+
+    FQLOCK_LOCK(q);
+    while ((f = FlowStackPop(s)) != NULL) {
+        f->lprev = q->bot;
+        if (f->lprev != NULL)
+            f->lprev->lnext = f;
+        q->bot = f;
+        if (q->top == NULL)
+            q->top = f;
+        q->len++;
+    }
+#ifdef DBG_PERF
+    if (q->len > q->dbg_maxlen)
+        q->dbg_maxlen = q->len;
+#endif /* DBG_PERF */
+    FQLOCK_UNLOCK(q);
+}
+
 /**
  *  \brief Transfer a flow from a queue to the spare queue
  *
@@ -145,24 +212,27 @@ Flow *FlowDequeue (FlowQueue *q)
  */
 void FlowMoveToSpare(Flow *f)
 {
+    /* flows go back to the spare queue of the node they live on */
+    FlowQueue *q = FlowGetSpareQueue(f->numa_node);
+
     /* now put it in spare */
-    FQLOCK_LOCK(&flow_spare_q);
+    FQLOCK_LOCK(q);
 
     /* add to new queue (append) */
-    f->lprev = flow_spare_q.bot;
+    f->lprev = q->bot;
     if (f->lprev != NULL)
         f->lprev->lnext = f;
     f->lnext = NULL;
-    flow_spare_q.bot = f;
-    if (flow_spare_q.top == NULL)
-        flow_spare_q.top = f;
+    q->bot = f;
+    if (q->top == NULL)
+        q->top = f;
 
-    flow_spare_q.len++;
+    q->len++;
 #ifdef DBG_PERF
-    if (flow_spare_q.len > flow_spare_q.dbg_maxlen)
-        flow_spare_q.dbg_maxlen = flow_spare_q.len;
+    if (q->len > q->dbg_maxlen)
+        q->dbg_maxlen = q->len;
 #endif /* DBG_PERF */
 
-    FQLOCK_UNLOCK(&flow_spare_q);
+    FQLOCK_UNLOCK(q);
 }
 
@@ -71,6 +71,32 @@ typedef struct FlowQueue_
     #error Enable FQLOCK_SPIN or FQLOCK_MUTEX
 #endif
 
+/** unlocked stack of flows, linked through Flow::lnext, to move flows
+ *  to and from the locked queues in batches */
+typedef struct FlowStack_ {
+    Flow *top;
+    uint32_t len;
+} FlowStack;
+
+static inline void FlowStackPush(FlowStack *s, Flow *f)
+{
+    f->lnext = s->top;
+    f->lprev = NULL;
+    s->top = f;
+    s->len++;
+}
+
+static inline Flow *FlowStackPop(FlowStack *s)
+{
+    Flow *f = s->top;
+    if (f != NULL) {
+        s->top = f->lnext;
+        f->lnext = NULL;
+        s->len--;
+    }
+    return f;
+}
+
 /* prototypes */
 FlowQueue *FlowQueueNew();
 FlowQueue *FlowQueueInit(FlowQueue *);
@@ -78,6 +104,8 @@ void FlowQueueDestroy (FlowQueue *);
 
 void FlowEnqueue (FlowQueue *, Flow *);
 Flow *FlowDequeue (FlowQueue *);
+uint32_t FlowDequeueBatch(FlowQueue *, FlowStack *, uint32_t);
+void FlowEnqueueBatch(FlowQueue *, FlowStack *);
 
 void FlowMoveToSpare(Flow *);
 
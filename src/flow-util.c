@@ -34,11 +34,20 @@
 
 #include "util-var.h"
 #include "util-debug.h"
+#include "util-memuse.h"
 #include "flow-storage.h"
 
 #include "detect.h"
 #include "detect-engine-state.h"
 
+/* FlowCompare() and the flow manager's timeout check only look at the
+ * first cache line of a flow. With lock based atomics or the wider Tile
+ * types the layout doesn't fit, so only enforce it where it does. */
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_2) && !defined(__tile__)
+typedef char FlowFirstCacheLineCheck[
+    (offsetof(Flow, lastts) + sizeof(((Flow *)0)->lastts) <= CLS) ? 1 : -1];
+#endif
+
 /** \brief allocate a flow
  *
  *  We check against the memuse counter. If it passes that check we increment
@@ -57,12 +66,14 @@ Flow *FlowAlloc(void)
 
     (void) SC_ATOMIC_ADD(flow_memuse, size);
 
-    f = SCMalloc(size);
+    f = SCMallocAligned(size, CLS);
     if (unlikely(f == NULL)) {
         (void)SC_ATOMIC_SUB(flow_memuse, size);
         return NULL;
     }
+    MemuseAlloc(MEMUSE_FLOW, size);
     memset(f, 0, size);
+    f->numa_node = FLOW_NUMA_NODE_ANY;
 
     FLOW_INITIALIZE(f);
     return f;
@@ -77,10 +88,11 @@ Flow *FlowAlloc(void)
 void FlowFree(Flow *f)
 {
     FLOW_DESTROY(f);
-    SCFree(f);
+    SCFreeAligned(f);
 
     size_t size = sizeof(Flow) + FlowStorageSize();
     (void) SC_ATOMIC_SUB(flow_memuse, size);
+    MemuseFree(MEMUSE_FLOW, size);
 }
 
 /**
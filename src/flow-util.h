@@ -51,6 +51,7 @@
         FLOWLOCK_INIT((f)); \
         (f)->protoctx = NULL; \
         (f)->flow_end_flags = 0; \
+        (f)->clock_ref = 0; \
         (f)->alproto = 0; \
         (f)->alproto_ts = 0; \
         (f)->alproto_tc = 0; \
@@ -93,6 +94,7 @@
         (f)->lastts.tv_usec = 0; \
         (f)->protoctx = NULL; \
         (f)->flow_end_flags = 0; \
+        (f)->clock_ref = 0; \
         (f)->alparser = NULL; \
         (f)->alstate = NULL; \
         (f)->alproto = 0; \
@@ -41,11 +41,31 @@
 #include "suricata.h"
 
 #include "decode.h"
+#include "conf.h"
 #include "stream-tcp.h"
 #include "app-layer.h"
 #include "detect-engine.h"
+#include "flow-worker.h"
+#include "flow-heavy.h"
+#include "tm-queues.h"
 
 #include "util-validate.h"
+#include "util-latency.h"
+
+extern intmax_t max_pending_packets;
+
+/** overload control, see FlowWorkerOverloadInitConfig() */
+FlowWorkerOverloadConfig fw_overload = { 0, 70, 30, 1, 1000 };
+
+/** how often the backlog is looked at, in msec of packet time */
+#define FLOW_WORKER_OVERLOAD_INTERVAL   100
+
+static const char *overload_level_names[FLOW_WORKER_OVERLOAD_MAX + 1] = {
+    "full inspection",
+    "no raw stream inspection",
+    "priority rules only",
+    "bypassing large flows",
+};
 
 typedef DetectEngineThreadCtx *DetectEngineThreadCtxPtr;
 
@@ -64,8 +84,133 @@ typedef struct FlowWorkerThreadData_ {
 #endif
     PacketQueue pq;
 
+    uint16_t local_bypass_pkts;
+    uint16_t local_bypass_bytes;
+    uint16_t bypassed_flows;
+
+    uint16_t overload_level;
+    uint16_t overload_transitions;
+    uint16_t overload_bypassed;
+
+    /** packet time of the last backlog check, msec */
+    uint64_t overload_ts;
+
+    /** heavy hitter sketches, NULL if not enabled */
+    FlowHeavyThreadData *heavy;
+    uint16_t heavy_elephants;
+    uint16_t heavy_bypassed;
+
+    /** pipelined: detection is left to the FlowWorkerDetect thread */
+    int pipelined;
+
 } FlowWorkerThreadData;
 
+/**
+ * \brief read the 'overload' section
+ *
+ * Load shedding is off unless 'overload.enabled' is set.
+ */
+void FlowWorkerOverloadInitConfig(void)
+{
+    intmax_t val;
+    int enabled = 0;
+
+    if (ConfGetBool("overload.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    if (ConfGetInt("overload.high", &val) == 1) {
+        if (val > 0 && val <= 100)
+            fw_overload.high = (uint8_t)val;
+        else
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid overload.high "
+                    "%"PRIdMAX", using %u", val, fw_overload.high);
+    }
+    if (ConfGetInt("overload.low", &val) == 1) {
+        if (val >= 0 && val < fw_overload.high)
+            fw_overload.low = (uint8_t)val;
+        else
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid overload.low "
+                    "%"PRIdMAX", must be below overload.high, using %u",
+                    val, fw_overload.low);
+    }
+    if (fw_overload.low >= fw_overload.high)
+        fw_overload.low = fw_overload.high / 2;
+
+    if (ConfGetInt("overload.priority", &val) == 1) {
+        if (val > 0)
+            fw_overload.priority = (int)val;
+        else
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid overload.priority "
+                    "%"PRIdMAX", using %d", val, fw_overload.priority);
+    }
+    if (ConfGetInt("overload.bypass-min-packets", &val) == 1) {
+        if (val >= 0 && val <= UINT32_MAX)
+            fw_overload.bypass_min_pkts = (uint32_t)val;
+        else
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid overload."
+                    "bypass-min-packets %"PRIdMAX", using %u", val,
+                    fw_overload.bypass_min_pkts);
+    }
+
+    fw_overload.enabled = 1;
+    SCLogConfig("overload control enabled: shedding at %u%% capture backlog, "
+            "recovering at %u%%, priority rules up to prio %d, bypassing "
+            "flows from %u packets", fw_overload.high, fw_overload.low,
+            fw_overload.priority, fw_overload.bypass_min_pkts);
+}
+
+/** \internal
+ *  \brief backlog of this thread in percent
+ *
+ *  Ring fill of the capture method in workers mode, depth of the input
+ *  queue in autofp mode.
+ */
+static inline uint32_t FlowWorkerBacklog(const ThreadVars *tv)
+{
+    uint32_t backlog = tv->capture_backlog;
+
+    if (tv->inq != NULL && tv->inq->q_type == 0 && max_pending_packets > 0) {
+        uint32_t depth = (uint32_t)((uint64_t)trans_q[tv->inq->id].len * 100 /
+                max_pending_packets);
+        if (depth > backlog)
+            backlog = depth;
+    }
+    return backlog;
+}
+
+/** \internal
+ *  \brief step the load shedding level up or down by one
+ *
+ *  Looked at once per FLOW_WORKER_OVERLOAD_INTERVAL so that a short burst
+ *  doesn't go straight to bypassing flows and the level doesn't flap.
+ */
+static void FlowWorkerOverloadUpdate(ThreadVars *tv, FlowWorkerThreadData *fw,
+                                     const Packet *p)
+{
+    uint64_t now = (uint64_t)p->ts.tv_sec * 1000 + p->ts.tv_usec / 1000;
+
+    if (now >= fw->overload_ts &&
+            now - fw->overload_ts < FLOW_WORKER_OVERLOAD_INTERVAL)
+        return;
+    fw->overload_ts = now;
+
+    uint32_t backlog = FlowWorkerBacklog(tv);
+    uint8_t level = tv->overload_level;
+
+    if (backlog >= fw_overload.high && level < FLOW_WORKER_OVERLOAD_MAX)
+        level++;
+    else if (backlog <= fw_overload.low && level > FLOW_WORKER_OVERLOAD_NONE)
+        level--;
+    else
+        return;
+
+    SCLogNotice("%s: backlog %u%%, overload level %u -> %u: %s", tv->name,
+            backlog, tv->overload_level, level, overload_level_names[level]);
+    tv->overload_level = level;
+    StatsSetUI64(tv, fw->overload_level, level);
+    StatsIncr(tv, fw->overload_transitions);
+}
+
 /** \brief handle flow for packet
  *
  *  Handle flow creation/lookup
@@ -75,12 +220,14 @@ static inline void FlowUpdate(Packet *p)
     FlowHandlePacketUpdate(p->flow, p);
 }
 
-static TmEcode FlowWorkerThreadInit(ThreadVars *tv, void *initdata, void **data)
+static TmEcode FlowWorkerThreadInitCommon(ThreadVars *tv, int pipelined,
+                                          void **data)
 {
     FlowWorkerThreadData *fw = SCCalloc(1, sizeof(*fw));
     BUG_ON(fw == NULL);
     SC_ATOMIC_INIT(fw->detect_thread);
     SC_ATOMIC_SET(fw->detect_thread, NULL);
+    fw->pipelined = pipelined;
 
     fw->dtv = DecodeThreadVarsAlloc(tv);
     if (fw->dtv == NULL) {
@@ -89,10 +236,13 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, void *initdata, void **data)
         return TM_ECODE_FAILED;
     }
 
+    /* fill our NUMA node's spare flow queue, if needed */
+    FlowPreallocNumaNode(tv->numa_node);
+
     /* setup TCP */
     BUG_ON(StreamTcpThreadInit(tv, NULL, &fw->stream_thread_ptr) != TM_ECODE_OK);
 
-    if (DetectEngineEnabled()) {
+    if (DetectEngineEnabled() && !pipelined) {
         /* setup DETECT */
         void *detect_thread = NULL;
         BUG_ON(DetectEngineThreadCtxInit(tv, NULL, &detect_thread) != TM_ECODE_OK);
@@ -102,6 +252,20 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, void *initdata, void **data)
     // setup OUTPUTS
 #endif
 
+    fw->local_bypass_pkts = StatsRegisterCounter("flow_bypassed.local_pkts", tv);
+    fw->local_bypass_bytes = StatsRegisterCounter("flow_bypassed.local_bytes", tv);
+    fw->bypassed_flows = StatsRegisterCounter("flow_bypassed.flows", tv);
+    if (fw_overload.enabled) {
+        fw->overload_level = StatsRegisterCounter("overload.level", tv);
+        fw->overload_transitions = StatsRegisterCounter("overload.transitions", tv);
+        fw->overload_bypassed = StatsRegisterCounter("overload.bypassed_flows", tv);
+    }
+    fw->heavy = FlowHeavyThreadInit();
+    if (fw->heavy != NULL) {
+        fw->heavy_elephants = StatsRegisterCounter("heavy.elephant_flows", tv);
+        fw->heavy_bypassed = StatsRegisterCounter("heavy.bypassed_flows", tv);
+    }
+
     /* setup pq for stream end pkts */
     memset(&fw->pq, 0, sizeof(PacketQueue));
     SCMutexInit(&fw->pq.mutex_q, NULL);
@@ -110,6 +274,16 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, void *initdata, void **data)
     return TM_ECODE_OK;
 }
 
+static TmEcode FlowWorkerThreadInit(ThreadVars *tv, void *initdata, void **data)
+{
+    return FlowWorkerThreadInitCommon(tv, 0, data);
+}
+
+static TmEcode FlowWorkerStreamThreadInit(ThreadVars *tv, void *initdata, void **data)
+{
+    return FlowWorkerThreadInitCommon(tv, 1, data);
+}
+
 static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data)
 {
     FlowWorkerThreadData *fw = data;
@@ -128,6 +302,7 @@ static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data)
 #if 0
     // free OUTPUT
 #endif
+    FlowHeavyThreadDeinit(fw->heavy);
 
     /* free pq */
     BUG_ON(fw->pq.len);
@@ -149,12 +324,16 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
 
     /* update time */
     if (!(PKT_IS_PSEUDOPKT(p))) {
-        TimeSetByThread(tv->id, &p->ts);
+        TimeSetByThread(tv, &p->ts);
+
+        if (fw_overload.enabled)
+            FlowWorkerOverloadUpdate(tv, fw, p);
     }
 
     /* handle Flow */
     if (p->flags & PKT_WANTS_FLOW) {
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_FLOW);
+        uint64_t ticks = PACKET_LATENCY_TICKS(p);
 
         FlowHandlePacket(tv, fw->dtv, p);
         if (likely(p->flow != NULL)) {
@@ -163,6 +342,7 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
         }
         /* Flow is now LOCKED */
 
+        PACKET_LATENCY_END(tv, LATENCY_FLOW, ticks);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_FLOW);
 
     /* if PKT_WANTS_FLOW is not set, but PKT_HAS_FLOW is, then this is a
@@ -173,15 +353,59 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
 
     SCLogDebug("packet %"PRIu64" has flow? %s", p->pcap_cnt, p->flow ? "yes" : "no");
 
+    if (fw->heavy != NULL && !(PKT_IS_PSEUDOPKT(p))) {
+        if (FlowHeavyUpdate(fw->heavy, p) == FLOW_HEAVY_ELEPHANT)
+            StatsIncr(tv, fw->heavy_elephants);
+    }
+
+    /* last overload level: hand large established flows to the bypass */
+    if (tv->overload_level >= FLOW_WORKER_OVERLOAD_BYPASS && p->flow &&
+        !(PKT_IS_PSEUDOPKT(p)) && !(p->flow->flags & FLOW_BYPASSED) &&
+        SC_ATOMIC_GET(p->flow->flow_state) == FLOW_STATE_ESTABLISHED &&
+        (uint64_t)p->flow->todstpktcnt + p->flow->tosrcpktcnt >=
+                fw_overload.bypass_min_pkts)
+    {
+        PacketBypassCallback(p);
+        StatsIncr(tv, fw->overload_bypassed);
+        if (fw->pipelined)
+            DecodeSetNoPacketInspectionFlag(p);
+        FLOWLOCK_UNLOCK(p->flow);
+        return TM_ECODE_OK;
+    }
+
+    /* bypassed flow: skip stream, app layer and detection */
+    if (p->flow && (p->flow->flags & FLOW_BYPASSED)) {
+        SCLogDebug("packet %"PRIu64" flow is bypassed", p->pcap_cnt);
+        /* pipelined: tell the detect thread, the flow may have changed by
+         * the time it gets the packet */
+        if (fw->pipelined)
+            DecodeSetNoPacketInspectionFlag(p);
+        StatsIncr(tv, fw->local_bypass_pkts);
+        StatsAddUI64(tv, fw->local_bypass_bytes, GET_PKT_LEN(p));
+        /* the capture method may have timed out its bypass entry while
+         * the flow is still active, hand it the flow again */
+        if (p->BypassPacketsFlow != NULL)
+            (void)p->BypassPacketsFlow(p);
+        FLOWLOCK_UNLOCK(p->flow);
+        return TM_ECODE_OK;
+    }
+
     /* handle TCP and app layer */
     if (PKT_IS_TCP(p)) {
         SCLogDebug("packet %"PRIu64" is TCP", p->pcap_cnt);
         DEBUG_ASSERT_FLOW_LOCKED(p->flow);
 
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_STREAM);
+        uint64_t ticks = PACKET_LATENCY_TICKS(p);
         StreamTcp(tv, p, fw->stream_thread, &fw->pq, NULL);
+        PACKET_LATENCY_END(tv, LATENCY_STREAM, ticks);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_STREAM);
 
+        /* bypassed flows never get here again, so this counts each once */
+        if (p->flow && (p->flow->flags & FLOW_BYPASSED)) {
+            StatsIncr(tv, fw->bypassed_flows);
+        }
+
         /* Packets here can safely access p->flow as it's locked */
         SCLogDebug("packet %"PRIu64": extra packets %u", p->pcap_cnt, fw->pq.len);
         Packet *x;
@@ -206,17 +430,30 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
     /* handle the app layer part of the UDP packet payload */
     } else if (p->flow && p->proto == IPPROTO_UDP) {
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_APPLAYERUDP);
+        uint64_t ticks = PACKET_LATENCY_TICKS(p);
         AppLayerHandleUdp(tv, fw->stream_thread->ra_ctx->app_tctx, p, p->flow);
+        PACKET_LATENCY_END(tv, LATENCY_STREAM, ticks);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_APPLAYERUDP);
     }
 
+    /* large flows the app layer is done with: bypass the rest, this
+     * packet still goes through detection */
+    if (fw->heavy != NULL && p->flow && !(PKT_IS_PSEUDOPKT(p)) &&
+        FlowHeavyWantsBypass(p->flow))
+    {
+        PacketBypassCallback(p);
+        StatsIncr(tv, fw->heavy_bypassed);
+    }
+
     /* handle Detect */
     DEBUG_ASSERT_FLOW_LOCKED(p->flow);
     SCLogDebug("packet %"PRIu64" calling Detect", p->pcap_cnt);
 
     if (detect_thread != NULL) {
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_DETECT);
+        uint64_t ticks = PACKET_LATENCY_TICKS(p);
         Detect(tv, p, detect_thread, NULL, NULL);
+        PACKET_LATENCY_END(tv, LATENCY_DETECT, ticks);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_DETECT);
     }
 #if 0
@@ -233,6 +470,78 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
     return TM_ECODE_OK;
 }
 
+/**
+ *  \brief detect half of a pipelined flow worker
+ *
+ *  Gets the packets of a FlowWorkerStream thread over a ring, after flow
+ *  handling, stream and app layer are done with them. The stream thread
+ *  released the flow lock, so it's taken again here for detection. The
+ *  packet keeps its flow reference until it's returned to the pool.
+ */
+static TmEcode FlowWorkerDetect(ThreadVars *tv, Packet *p, void *data,
+                                PacketQueue *preq, PacketQueue *unused)
+{
+    FlowWorkerThreadData *fw = data;
+    void *detect_thread = SC_ATOMIC_GET(fw->detect_thread);
+
+    /* shed load along with the stream thread */
+    if (tv->pipeline_peer != NULL)
+        tv->overload_level = tv->pipeline_peer->overload_level;
+
+    if (detect_thread == NULL)
+        return TM_ECODE_OK;
+
+    if (p->flow)
+        FLOWLOCK_WRLOCK(p->flow);
+
+    FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_DETECT);
+    uint64_t ticks = PACKET_LATENCY_TICKS(p);
+    Detect(tv, p, detect_thread, NULL, NULL);
+    PACKET_LATENCY_END(tv, LATENCY_DETECT, ticks);
+    FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_DETECT);
+
+    if (p->flow)
+        FLOWLOCK_UNLOCK(p->flow);
+
+    return TM_ECODE_OK;
+}
+
+static TmEcode FlowWorkerDetectThreadInit(ThreadVars *tv, void *initdata, void **data)
+{
+    FlowWorkerThreadData *fw = SCCalloc(1, sizeof(*fw));
+    if (unlikely(fw == NULL))
+        return TM_ECODE_FAILED;
+    SC_ATOMIC_INIT(fw->detect_thread);
+    SC_ATOMIC_SET(fw->detect_thread, NULL);
+
+    if (DetectEngineEnabled()) {
+        void *detect_thread = NULL;
+        if (DetectEngineThreadCtxInit(tv, NULL, &detect_thread) != TM_ECODE_OK) {
+            SC_ATOMIC_DESTROY(fw->detect_thread);
+            SCFree(fw);
+            return TM_ECODE_FAILED;
+        }
+        SC_ATOMIC_SET(fw->detect_thread, detect_thread);
+    }
+
+    *data = fw;
+    return TM_ECODE_OK;
+}
+
+static TmEcode FlowWorkerDetectThreadDeinit(ThreadVars *tv, void *data)
+{
+    FlowWorkerThreadData *fw = data;
+
+    void *detect_thread = SC_ATOMIC_GET(fw->detect_thread);
+    if (detect_thread != NULL) {
+        DetectEngineThreadCtxDeinit(tv, detect_thread);
+        SC_ATOMIC_SET(fw->detect_thread, NULL);
+    }
+
+    SCFree(fw);
+    return TM_ECODE_OK;
+}
+
 void FlowWorkerReplaceDetectCtx(void *flow_worker, void *detect_ctx)
 {
     FlowWorkerThreadData *fw = flow_worker;
@@ -273,4 +582,19 @@ void TmModuleFlowWorkerRegister (void)
     tmm_modules[TMM_FLOWWORKER].ThreadDeinit = FlowWorkerThreadDeinit;
     tmm_modules[TMM_FLOWWORKER].cap_flags = 0;
     tmm_modules[TMM_FLOWWORKER].flags = TM_FLAG_STREAM_TM|TM_FLAG_DETECT_TM;
+
+    /* pipelined: the same worker split over two threads */
+    tmm_modules[TMM_FLOWWORKERSTREAM].name = "FlowWorkerStream";
+    tmm_modules[TMM_FLOWWORKERSTREAM].ThreadInit = FlowWorkerStreamThreadInit;
+    tmm_modules[TMM_FLOWWORKERSTREAM].Func = FlowWorker;
+    tmm_modules[TMM_FLOWWORKERSTREAM].ThreadDeinit = FlowWorkerThreadDeinit;
+    tmm_modules[TMM_FLOWWORKERSTREAM].cap_flags = 0;
+    tmm_modules[TMM_FLOWWORKERSTREAM].flags = TM_FLAG_STREAM_TM;
+
+    tmm_modules[TMM_FLOWWORKERDETECT].name = "FlowWorkerDetect";
+    tmm_modules[TMM_FLOWWORKERDETECT].ThreadInit = FlowWorkerDetectThreadInit;
+    tmm_modules[TMM_FLOWWORKERDETECT].Func = FlowWorkerDetect;
+    tmm_modules[TMM_FLOWWORKERDETECT].ThreadDeinit = FlowWorkerDetectThreadDeinit;
+    tmm_modules[TMM_FLOWWORKERDETECT].cap_flags = 0;
+    tmm_modules[TMM_FLOWWORKERDETECT].flags = TM_FLAG_DETECT_TM;
 }
@@ -27,6 +27,27 @@ enum ProfileFlowWorkerId {
 };
 const char *ProfileFlowWorkerIdToString(enum ProfileFlowWorkerId fwi);
 
+/** load shedding levels, each one includes the ones before it */
+enum {
+    FLOW_WORKER_OVERLOAD_NONE = 0,
+    FLOW_WORKER_OVERLOAD_NO_RAW,    /**< skip raw stream inspection */
+    FLOW_WORKER_OVERLOAD_PRIO,      /**< only inspect priority rules */
+    FLOW_WORKER_OVERLOAD_BYPASS,    /**< bypass established large flows */
+    FLOW_WORKER_OVERLOAD_MAX = FLOW_WORKER_OVERLOAD_BYPASS,
+};
+
+typedef struct FlowWorkerOverloadConfig_ {
+    int enabled;
+    uint8_t high;               /**< backlog % to step a level up at */
+    uint8_t low;                /**< backlog % to step a level down at */
+    int priority;               /**< rules with a prio above this are skipped */
+    uint32_t bypass_min_pkts;   /**< flows with fewer packets aren't bypassed */
+} FlowWorkerOverloadConfig;
+
+extern FlowWorkerOverloadConfig fw_overload;
+
+void FlowWorkerOverloadInitConfig(void);
+
 void FlowWorkerReplaceDetectCtx(void *flow_worker, void *detect_ctx);
 void *FlowWorkerGetDetectCtxPtr(void *flow_worker);
 
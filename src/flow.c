@@ -43,6 +43,7 @@
 #include "flow-timeout.h"
 #include "flow-manager.h"
 #include "flow-storage.h"
+#include "flow-embryonic.h"
 
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
@@ -55,6 +56,9 @@
 
 #include "util-debug.h"
 #include "util-privs.h"
+#include "util-hugepages.h"
+#include "util-memuse.h"
+#include "util-prealloc.h"
 
 #include "detect.h"
 #include "detect-engine-state.h"
@@ -70,6 +74,7 @@
 #define FLOW_DEFAULT_MEMCAP      (32 * 1024 * 1024) /* 32 MB */
 
 #define FLOW_DEFAULT_PREALLOC    10000
+#define FLOW_DEFAULT_TIMEOUT_BATCH 16
 
 /** atomic int that is used when freeing a flow from the hash. In this
  *  case we walk the hash to find a flow to free. This var records where
@@ -115,6 +120,11 @@ int FlowUpdateSpareFlows(void)
     SCEnter();
     uint32_t toalloc = 0, tofree = 0, len;
 
+    /* the per node queues are filled by the workers of each node. Topping
+     * them up from here would put the flows on the manager's node. */
+    if (flow_config.flags & FLOW_CONFIG_FLAG_NUMA)
+        return 1;
+
     FQLOCK_LOCK(&flow_spare_q);
     len = flow_spare_q.len;
     FQLOCK_UNLOCK(&flow_spare_q);
@@ -130,7 +140,10 @@ int FlowUpdateSpareFlows(void)
 
             FlowEnqueue(&flow_spare_q,f);
         }
-    } else if (len > flow_config.prealloc) {
+    } else if (len > flow_config.prealloc &&
+            !(flow_config.flags & FLOW_CONFIG_FLAG_LOCKLESS_LOOKUP)) {
+        /* flows are not freed at runtime in lockless lookup mode, as
+         * lookups may still be walking over them */
         tofree = len - flow_config.prealloc;
 
         uint32_t i;
@@ -147,6 +160,68 @@ int FlowUpdateSpareFlows(void)
     return 1;
 }
 
+/** protects flow_numa_prealloc_done */
+static SCMutex flow_numa_prealloc_lock = SCMUTEX_INITIALIZER;
+/** per node flag, set by the first worker thread of that node */
+static uint8_t flow_numa_prealloc_done[FLOW_NUMA_MAX_NODES];
+
+/** \brief get the number of flows in all spare queues */
+uint32_t FlowGetSpareCount(void)
+{
+    uint32_t len;
+    uint16_t n;
+
+    FQLOCK_LOCK(&flow_spare_q);
+    len = flow_spare_q.len;
+    FQLOCK_UNLOCK(&flow_spare_q);
+
+    for (n = 0; n < flow_config.numa_nodes; n++) {
+        FQLOCK_LOCK(&flow_spare_numa_q[n]);
+        len += flow_spare_numa_q[n].len;
+        FQLOCK_UNLOCK(&flow_spare_numa_q[n]);
+    }
+    return len;
+}
+
+/** \brief preallocate the spare flows of a NUMA node
+ *
+ *  Called from a worker thread after its cpu affinity has been set, so
+ *  that the memory is placed on the worker's node. Only the first worker
+ *  of a node does the allocation.
+ *
+ *  \param node NUMA node of the calling thread
+ */
+void FlowPreallocNumaNode(int node)
+{
+    if (!(flow_config.flags & FLOW_CONFIG_FLAG_NUMA) ||
+            node < 0 || node >= (int)flow_config.numa_nodes)
+        return;
+
+    SCMutexLock(&flow_numa_prealloc_lock);
+    if (flow_numa_prealloc_done[node]) {
+        SCMutexUnlock(&flow_numa_prealloc_lock);
+        return;
+    }
+    flow_numa_prealloc_done[node] = 1;
+    SCMutexUnlock(&flow_numa_prealloc_lock);
+
+    uint32_t cnt = flow_config.prealloc / flow_config.numa_nodes;
+    uint32_t i;
+    for (i = 0; i < cnt; i++) {
+        if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize())))
+            break;
+
+        Flow *f = FlowAlloc();
+        if (f == NULL)
+            break;
+        f->numa_node = (uint8_t)node;
+
+        FlowEnqueue(&flow_spare_numa_q[node], f);
+    }
+
+    SCLogPerf("preallocated %"PRIu32" flows on NUMA node %d", i, node);
+}
+
 /** \brief Set the IPOnly scanned flag for 'direction'.
   *
   * \param f Flow to set the flag in
@@ -212,6 +287,25 @@ static inline int FlowUpdateSeenFlag(const Packet *p)
     return 1;
 }
 
+/** \brief Update the state of a flow
+ *
+ *  Besides setting the state this lowers the flow's hash row timeout hint
+ *  if the new state has a shorter timeout, so the flow manager doesn't
+ *  skip the row for too long.
+ *
+ *  \param f locked flow
+ *  \param state new flow state
+ */
+void FlowUpdateState(Flow *f, FlowStateType state)
+{
+    SC_ATOMIC_SET(f->flow_state, state);
+
+    if (f->fb != NULL) {
+        FlowBucketLowerNextTs(f->fb,
+                f->lastts.tv_sec + FlowGetFlowTimeout(f, state, 0));
+    }
+}
+
 /** \brief Update Packet and Flow
  *
  *  Updates packet and flow based on the new packet.
@@ -252,8 +346,9 @@ void FlowHandlePacketUpdate(Flow *f, Packet *p)
         SCLogDebug("pkt %p FLOW_PKT_ESTABLISHED", p);
         p->flowflags |= FLOW_PKT_ESTABLISHED;
 
-        if (f->proto != IPPROTO_TCP) {
-            SC_ATOMIC_SET(f->flow_state, FLOW_STATE_ESTABLISHED);
+        if (f->proto != IPPROTO_TCP &&
+                SC_ATOMIC_GET(f->flow_state) != FLOW_STATE_ESTABLISHED) {
+            FlowUpdateState(f, FLOW_STATE_ESTABLISHED);
         }
     }
 
@@ -290,10 +385,33 @@ void FlowHandlePacket(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
     return;
 }
 
+/** \internal
+ *  \brief allocate the flows not preallocated at startup, in the
+ *         background. See util-prealloc.h
+ */
+static uint32_t FlowPreallocFill(void)
+{
+    uint32_t cnt = flow_config.prealloc - PreallocStartupCount(flow_config.prealloc);
+    uint32_t i;
+
+    for (i = 0; i < cnt && !PreallocStopped(); i++) {
+        if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize())))
+            break;
+
+        Flow *f = FlowAlloc();
+        if (f == NULL)
+            break;
+        FlowEnqueue(&flow_spare_q, f);
+    }
+    return i;
+}
+
 /** \brief initialize the configuration
  *  \warning Not thread safe */
 void FlowInitConfig(char quiet)
 {
+    uint16_t n;
+
     SCLogDebug("initializing flow engine...");
 
     memset(&flow_config,  0, sizeof(flow_config));
@@ -301,7 +419,11 @@ void FlowInitConfig(char quiet)
     SC_ATOMIC_INIT(flow_memuse);
     SC_ATOMIC_INIT(flow_prune_idx);
     FlowQueueInit(&flow_spare_q);
-    FlowQueueInit(&flow_recycle_q);
+    for (n = 0; n < FLOW_NUMA_MAX_NODES; n++)
+        FlowQueueInit(&flow_spare_numa_q[n]);
+    memset(flow_numa_prealloc_done, 0, sizeof(flow_numa_prealloc_done));
+    for (n = 0; n < FLOW_RECYCLE_QUEUES_MAX; n++)
+        FlowQueueInit(&flow_recycle_q[n]);
 
 #ifndef AFLFUZZ_NO_RANDOM
     unsigned int seed = RandomTimePreseed();
@@ -311,6 +433,8 @@ void FlowInitConfig(char quiet)
     flow_config.hash_size   = FLOW_DEFAULT_HASHSIZE;
     flow_config.memcap      = FLOW_DEFAULT_MEMCAP;
     flow_config.prealloc    = FLOW_DEFAULT_PREALLOC;
+    flow_config.flags       = 0;
+    flow_config.timeout_batch = FLOW_DEFAULT_TIMEOUT_BATCH;
 
     /* If we have specific config, overwrite the defaults with them,
      * otherwise, leave the default values */
@@ -355,6 +479,41 @@ void FlowInitConfig(char quiet)
             flow_config.prealloc = configval;
         }
     }
+    int lockless = 0;
+    if (ConfGetBool("flow.lockless-lookup", &lockless) == 1 && lockless) {
+        flow_config.flags |= FLOW_CONFIG_FLAG_LOCKLESS_LOOKUP;
+        SCLogConfig("flow: lockless hash lookups enabled");
+    }
+    int thread_cache = 0;
+    if (ConfGetBool("flow.thread-cache", &thread_cache) == 1 && thread_cache) {
+#ifdef TLS
+        flow_config.flags |= FLOW_CONFIG_FLAG_THREAD_CACHE;
+        SCLogConfig("flow: per thread spare flow caches enabled");
+#else
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "flow.thread-cache needs "
+                "thread local storage support, disabled");
+#endif
+    }
+    int numa = 0;
+    if (ConfGetBool("flow.numa", &numa) == 1 && numa) {
+        int nodes = AffinityGetNumaNodeCount();
+        if (nodes > 1) {
+            if (nodes > FLOW_NUMA_MAX_NODES)
+                nodes = FLOW_NUMA_MAX_NODES;
+            flow_config.flags |= FLOW_CONFIG_FLAG_NUMA;
+            flow_config.numa_nodes = (uint16_t)nodes;
+            SCLogConfig("flow: using spare queues for %d NUMA nodes", nodes);
+        } else {
+            SCLogConfig("flow: single NUMA node, not using per node spare queues");
+        }
+    }
+    if ((ConfGet("flow.timeout-batch", &conf_val)) == 1)
+    {
+        if (ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                    conf_val) > 0) {
+            flow_config.timeout_batch = configval;
+        }
+    }
     SCLogDebug("Flow config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, flow_config.memcap,
                flow_config.hash_size, flow_config.prealloc);
@@ -370,7 +529,7 @@ void FlowInitConfig(char quiet)
                 (uintmax_t)sizeof(FlowBucket));
         exit(EXIT_FAILURE);
     }
-    flow_hash = SCMallocAligned(flow_config.hash_size * sizeof(FlowBucket), CLS);
+    flow_hash = SCMallocHuge("flow hash", flow_config.hash_size * sizeof(FlowBucket));
     if (unlikely(flow_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -380,8 +539,11 @@ void FlowInitConfig(char quiet)
     uint32_t i = 0;
     for (i = 0; i < flow_config.hash_size; i++) {
         FBLOCK_INIT(&flow_hash[i]);
+        SC_ATOMIC_INIT(flow_hash[i].next_ts);
     }
     (void) SC_ATOMIC_ADD(flow_memuse, (flow_config.hash_size * sizeof(FlowBucket)));
+    MemuseAlloc(MEMUSE_FLOW, flow_config.hash_size * sizeof(FlowBucket));
+    MemuseSetMemcap(MEMUSE_FLOW, flow_config.memcap);
 
     if (quiet == FALSE) {
         SCLogConfig("allocated %llu bytes of memory for the flow hash... "
@@ -390,8 +552,12 @@ void FlowInitConfig(char quiet)
                   (uintmax_t)sizeof(FlowBucket));
     }
 
-    /* pre allocate flows */
-    for (i = 0; i < flow_config.prealloc; i++) {
+    /* pre allocate flows. With per node queues, this is done from the
+     * workers in FlowPreallocNumaNode(). In background mode only part of
+     * them. */
+    uint32_t startup_cnt = PreallocStartupCount(flow_config.prealloc);
+    for (i = 0; !(flow_config.flags & FLOW_CONFIG_FLAG_NUMA) &&
+            i < startup_cnt; i++) {
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize()))) {
             SCLogError(SC_ERR_FLOW_INIT, "preallocating flows failed: "
                     "max flow memcap reached. Memcap %"PRIu64", "
@@ -408,6 +574,9 @@ void FlowInitConfig(char quiet)
 
         FlowEnqueue(&flow_spare_q,f);
     }
+    if (!(flow_config.flags & FLOW_CONFIG_FLAG_NUMA) &&
+            startup_cnt < flow_config.prealloc)
+        PreallocRegisterFill("flows", FlowPreallocFill);
 
     if (quiet == FALSE) {
         SCLogConfig("preallocated %" PRIu32 " flows of size %" PRIuMAX "",
@@ -417,6 +586,7 @@ void FlowInitConfig(char quiet)
     }
 
     FlowInitFlowProto();
+    FlowEmbryonicInitConfig(quiet);
 
     return;
 }
@@ -437,12 +607,23 @@ void FlowShutdown(void)
 
     FlowPrintStats();
 
+    FlowThreadCacheFlush();
+    FlowEmbryonicShutdown();
+
     /* free queues */
     while((f = FlowDequeue(&flow_spare_q))) {
         FlowFree(f);
     }
-    while((f = FlowDequeue(&flow_recycle_q))) {
-        FlowFree(f);
+    for (u = 0; u < FLOW_NUMA_MAX_NODES; u++) {
+        while((f = FlowDequeue(&flow_spare_numa_q[u]))) {
+            FlowFree(f);
+        }
+        FlowQueueDestroy(&flow_spare_numa_q[u]);
+    }
+    for (u = 0; u < FLOW_RECYCLE_QUEUES_MAX; u++) {
+        while((f = FlowDequeue(&flow_recycle_q[u]))) {
+            FlowFree(f);
+        }
     }
 
     /* clear and free the hash */
@@ -462,13 +643,16 @@ void FlowShutdown(void)
             }
 
             FBLOCK_DESTROY(&flow_hash[u]);
+            SC_ATOMIC_DESTROY(flow_hash[u].next_ts);
         }
-        SCFreeAligned(flow_hash);
+        SCFreeHuge(flow_hash);
         flow_hash = NULL;
     }
     (void) SC_ATOMIC_SUB(flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
+    MemuseFree(MEMUSE_FLOW, flow_config.hash_size * sizeof(FlowBucket));
     FlowQueueDestroy(&flow_spare_q);
-    FlowQueueDestroy(&flow_recycle_q);
+    for (u = 0; u < FLOW_RECYCLE_QUEUES_MAX; u++)
+        FlowQueueDestroy(&flow_recycle_q[u]);
 
     SC_ATOMIC_DESTROY(flow_prune_idx);
     SC_ATOMIC_DESTROY(flow_memuse);
@@ -1071,6 +1255,125 @@ static int FlowTest09 (void)
     return result;
 }
 
+/**
+ *  \test   Test the lockless flow lookup: an existing flow is found without
+ *          modifying the bucket chain.
+ */
+
+static int FlowTest10 (void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.flags |= FLOW_CONFIG_FLAG_LOCKLESS_LOOKUP;
+
+    uint8_t payload[] = "Payload";
+    Packet *p1 = UTHBuildPacket(payload, sizeof(payload), IPPROTO_TCP);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = UTHBuildPacket(payload, sizeof(payload), IPPROTO_TCP);
+    FAIL_IF_NULL(p2);
+    FlowSetupPacket(p1);
+    FlowSetupPacket(p2);
+
+    FlowBucket *fb = &flow_hash[p1->flow_hash % flow_config.hash_size];
+    const uint32_t seq = fb->seq;
+
+    /* new flow: added to the chain under the bucket lock */
+    FlowHandlePacket(NULL, NULL, p1);
+    FAIL_IF_NULL(p1->flow);
+    Flow *f = p1->flow;
+    FLOWLOCK_UNLOCK(f);
+    FAIL_IF(fb->seq != seq + 2);
+
+    /* lookup without touching the chain */
+    FlowHandlePacket(NULL, NULL, p2);
+    FAIL_IF(p2->flow != f);
+    FLOWLOCK_UNLOCK(f);
+    FAIL_IF(fb->seq != seq + 2);
+    FAIL_IF(SC_ATOMIC_GET(f->use_cnt) != 2);
+
+    FlowDeReference(&p1->flow);
+    FlowDeReference(&p2->flow);
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+    FlowShutdown();
+    PASS;
+}
+
+#ifdef TLS
+/**
+ *  \test   Test the thread cache: spare flows are taken from the spare
+ *          queue in a batch and given back on flush.
+ */
+
+static int FlowTest11 (void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.flags |= FLOW_CONFIG_FLAG_THREAD_CACHE;
+    const uint32_t len = flow_spare_q.len;
+    FAIL_IF(len < FLOW_SPARE_BATCH);
+
+    uint8_t payload[] = "Payload";
+    Packet *p1 = UTHBuildPacketReal(payload, sizeof(payload), IPPROTO_TCP,
+            "192.168.1.5", "10.0.0.1", 1024, 80);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = UTHBuildPacketReal(payload, sizeof(payload), IPPROTO_TCP,
+            "192.168.1.5", "10.0.0.1", 1025, 80);
+    FAIL_IF_NULL(p2);
+    FlowSetupPacket(p1);
+    FlowSetupPacket(p2);
+
+    FlowHandlePacket(NULL, NULL, p1);
+    FAIL_IF_NULL(p1->flow);
+    FLOWLOCK_UNLOCK(p1->flow);
+    FAIL_IF(flow_spare_q.len != len - FLOW_SPARE_BATCH);
+
+    /* second flow comes from the cache */
+    FlowHandlePacket(NULL, NULL, p2);
+    FAIL_IF_NULL(p2->flow);
+    FLOWLOCK_UNLOCK(p2->flow);
+    FAIL_IF(p2->flow == p1->flow);
+    FAIL_IF(flow_spare_q.len != len - FLOW_SPARE_BATCH);
+
+    FlowThreadCacheFlush();
+    FAIL_IF(flow_spare_q.len != len - 2);
+
+    FlowDeReference(&p1->flow);
+    FlowDeReference(&p2->flow);
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+    FlowShutdown();
+    PASS;
+}
+#endif /* TLS */
+
+/**
+ *  \brief benchmark the flow hash and lookup over 1024 flows
+ */
+static int FlowBench01(UtBench *b)
+{
+    const uint16_t nflows = 1024;
+
+    FlowInitConfig(FLOW_QUIET);
+    uint8_t payload[] = "Payload";
+    Packet *p = UTHBuildPacketReal(payload, sizeof(payload), IPPROTO_TCP,
+            "192.168.1.5", "10.0.0.1", 1024, 80);
+    FAIL_IF_NULL(p);
+
+    UtBenchResetTimer(b);
+    uint64_t i;
+    for (i = 0; i < b->n; i++) {
+        p->sp = 1024 + (i % nflows);
+        FlowSetupPacket(p);
+        FlowHandlePacket(NULL, NULL, p);
+        FAIL_IF_NULL(p->flow);
+        FLOWLOCK_UNLOCK(p->flow);
+        FlowDeReference(&p->flow);
+    }
+
+    UTHFreePacket(p);
+    FlowShutdown();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -1088,6 +1391,12 @@ void FlowRegisterTests (void)
                    FlowTest08);
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap",
                    FlowTest09);
+    UtRegisterTest("FlowTest10 -- Test lockless flow lookup", FlowTest10);
+#ifdef TLS
+    UtRegisterTest("FlowTest11 -- Test the spare flow thread cache", FlowTest11);
+#endif
+
+    UtRegisterBenchmark("FlowBench01 -- flow hash lookup", FlowBench01);
 
     FlowMgrRegisterTests();
     RegisterFlowStorageTests();
@@ -27,6 +27,7 @@
 #include "decode.h"
 #include "util-var.h"
 #include "util-atomic.h"
+#include "util-lock-contention.h"
 #include "detect-tag.h"
 #include "util-optimize.h"
 
@@ -77,7 +78,8 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 /** alproto detect done.  Right now we need it only for udp */
 #define FLOW_ALPROTO_DETECT_DONE          0x00008000
 
-// vacany 1x
+/** flow is bypassed: no more stream tracking or inspection */
+#define FLOW_BYPASSED                     0x00010000
 
 /** Pattern matcher alproto detection done */
 #define FLOW_TS_PM_ALPROTO_DETECT_DONE    0x00020000
@@ -88,10 +90,17 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 /** Probing parser alproto detection done */
 #define FLOW_TC_PP_ALPROTO_DETECT_DONE    0x00200000
 #define FLOW_TIMEOUT_REASSEMBLY_DONE      0x00800000
+/** flow was set up from the reply to an embryonic flow, see
+ *  flow-embryonic.h */
+#define FLOW_EMBRYONIC                    0x00000400
+
 /** even if the flow has files, don't store 'm */
 #define FLOW_FILE_NO_STORE_TS             0x01000000
 #define FLOW_FILE_NO_STORE_TC             0x02000000
 
+/** no sig of the to client sgh inspects http response bodies or files */
+#define FLOW_NO_RESPONSE_BODY             0x00400000
+
 /** flow is ipv4 */
 #define FLOW_IPV4                         0x04000000
 /** flow is ipv6 */
@@ -204,8 +213,8 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 #elif defined FLOWLOCK_MUTEX
     #define FLOWLOCK_INIT(fb) SCMutexInit(&(fb)->m, NULL)
     #define FLOWLOCK_DESTROY(fb) SCMutexDestroy(&(fb)->m)
-    #define FLOWLOCK_RDLOCK(fb) SCMutexLock(&(fb)->m)
-    #define FLOWLOCK_WRLOCK(fb) SCMutexLock(&(fb)->m)
+    #define FLOWLOCK_RDLOCK(fb) SCMutexLockCounted(&(fb)->m, LOCK_CONTENTION_FLOW)
+    #define FLOWLOCK_WRLOCK(fb) SCMutexLockCounted(&(fb)->m, LOCK_CONTENTION_FLOW)
     #define FLOWLOCK_TRYRDLOCK(fb) SCMutexTrylock(&(fb)->m)
     #define FLOWLOCK_TRYWRLOCK(fb) SCMutexTrylock(&(fb)->m)
     #define FLOWLOCK_UNLOCK(fb) SCMutexUnlock(&(fb)->m)
@@ -238,8 +247,31 @@ typedef struct FlowCnf_
     uint32_t emerg_timeout_est;
     uint32_t emergency_recovery;
 
+    uint32_t flags;     /**< FLOW_CONFIG_FLAG_* */
+    /** max flow timeout packets a capture thread handles after each
+     *  packet, 0 for no limit */
+    uint32_t timeout_batch;
+    uint16_t numa_nodes; /**< number of per NUMA node spare queues in use */
 } FlowConfig;
 
+/** look up flows without taking the hash bucket lock */
+#define FLOW_CONFIG_FLAG_LOCKLESS_LOOKUP    0x01
+/** keep spare flows in per NUMA node queues */
+#define FLOW_CONFIG_FLAG_NUMA               0x02
+/** keep a per thread cache of spare flows, see FlowThreadCacheFlush() */
+#define FLOW_CONFIG_FLAG_THREAD_CACHE       0x04
+/** track the first packet of flows in the embryonic table */
+#define FLOW_CONFIG_FLAG_EMBRYONIC          0x08
+
+/** flows move between the thread caches / the recycler and the spare
+ *  queues this many at a time */
+#define FLOW_SPARE_BATCH        64
+
+/** max NUMA nodes we keep spare queues for */
+#define FLOW_NUMA_MAX_NODES     8
+/** flow wasn't allocated on a known NUMA node, uses the shared spare queue */
+#define FLOW_NUMA_NODE_ANY      0xff
+
 /* Hash key for the flow hash */
 typedef struct FlowKey_
 {
@@ -299,6 +331,9 @@ typedef uint16_t FlowThreadId;
 
 typedef struct Flow_
 {
+    /* first cache line: everything FlowCompare() and the flow manager's
+     * timeout check look at. Flows are allocated cache line aligned. */
+
     /* flow "header", used for hashing and flow lookup. Static after init,
      * so safe to look at without lock */
     FlowAddress src, dst;
@@ -314,17 +349,23 @@ typedef struct Flow_
     uint8_t recursion_level;
     uint16_t vlan_id[2];
 
-    /** flow hash - the flow hash before hash table size mod. */
-    uint32_t flow_hash;
+    /* end of flow "header" */
+
+    SC_ATOMIC_DECLARE(FlowStateType, flow_state);
+
+    uint32_t flags;
 
     /* time stamp of last update (last packet). Set/updated under the
      * flow and flow hash row locks, safe to read under either the
      * flow lock or flow hash row lock. */
     struct timeval lastts;
 
-    /* end of flow "header" */
+    /* end of first cache line */
 
-    SC_ATOMIC_DECLARE(FlowStateType, flow_state);
+    /** hash list pointers, protected by fb->s */
+    struct Flow_ *hnext; /* hash list */
+    struct Flow_ *hprev;
+    struct FlowBucket_ *fb;
 
     /** how many pkts and stream msgs are using the flow *right now*. This
      *  variable is atomic so not protected by the Flow mutex "m".
@@ -334,14 +375,26 @@ typedef struct Flow_
      */
     SC_ATOMIC_DECLARE(FlowRefCount, use_cnt);
 
-    /** flow tenant id, used to setup flow timeout and stream pseudo
-     *  packets with the correct tenant id set */
-    uint32_t tenant_id;
+    /** mapping to Flow's protocol specific protocols for timeouts
+        and state and free functions. */
+    uint8_t protomap;
 
-    uint32_t probing_parser_toserver_alproto_masks;
-    uint32_t probing_parser_toclient_alproto_masks;
+    uint8_t flow_end_flags;
+    /* coccinelle: Flow:flow_end_flags:FLOW_END_FLAG_ */
 
-    uint32_t flags;
+    /** NUMA node the flow was allocated on, FLOW_NUMA_NODE_ANY if unknown.
+     *  Static after alloc. */
+    uint8_t numa_node;
+
+    /** eviction reference bit: set when a packet looks the flow up, cleared
+     *  when the eviction hand passes it, see FlowGetUsedFlow() */
+    uint8_t clock_ref;
+
+    /** flow hash - the flow hash before hash table size mod. */
+    uint32_t flow_hash;
+
+    /** protocol specific data pointer, e.g. for TcpSession */
+    void *protoctx;
 
 #ifdef FLOWLOCK_RWLOCK
     SCRWLock r;
@@ -351,20 +404,20 @@ typedef struct Flow_
     #error Enable FLOWLOCK_RWLOCK or FLOWLOCK_MUTEX
 #endif
 
-    /** protocol specific data pointer, e.g. for TcpSession */
-    void *protoctx;
-
-    /** mapping to Flow's protocol specific protocols for timeouts
-        and state and free functions. */
-    uint8_t protomap;
+    /** flow tenant id, used to setup flow timeout and stream pseudo
+     *  packets with the correct tenant id set */
+    uint32_t tenant_id;
 
-    uint8_t flow_end_flags;
-    /* coccinelle: Flow:flow_end_flags:FLOW_END_FLAG_ */
+    uint32_t probing_parser_toserver_alproto_masks;
+    uint32_t probing_parser_toclient_alproto_masks;
 
     AppProto alproto; /**< \brief application level protocol */
     AppProto alproto_ts;
     AppProto alproto_tc;
 
+    /** Thread ID for the stream/detect portion of this flow */
+    FlowThreadId thread_id;
+
     uint32_t data_al_so_far[2];
 
     /** detection engine ctx id used to inspect this flow. Set at initial
@@ -372,12 +425,17 @@ typedef struct Flow_
      *  de_state and stored sgh ptrs are reset. */
     uint32_t de_ctx_id;
 
-    /** Thread ID for the stream/detect portion of this flow */
-    FlowThreadId thread_id;
-
     /** detect state 'alversion' inspected for both directions */
     uint8_t detect_alversion[2];
 
+    uint32_t todstpktcnt;
+    uint32_t tosrcpktcnt;
+    uint64_t todstbytecnt;
+    uint64_t tosrcbytecnt;
+
+    /* below here is state that is only used once the flow has been
+     * found, or not at all on the packet path */
+
     /** application level storage ptrs.
      *
      */
@@ -397,20 +455,10 @@ typedef struct Flow_
     /* pointer to the var list */
     GenericVar *flowvar;
 
-    /** hash list pointers, protected by fb->s */
-    struct Flow_ *hnext; /* hash list */
-    struct Flow_ *hprev;
-    struct FlowBucket_ *fb;
-
     /** queue list pointers, protected by queue mutex */
     struct Flow_ *lnext; /* list */
     struct Flow_ *lprev;
     struct timeval startts;
-
-    uint32_t todstpktcnt;
-    uint32_t tosrcpktcnt;
-    uint64_t todstbytecnt;
-    uint64_t tosrcbytecnt;
 } Flow;
 
 enum {
@@ -438,6 +486,7 @@ void FlowHandlePacket (ThreadVars *, DecodeThreadVars *, Packet *);
 void FlowInitConfig (char);
 void FlowPrintQueueInfo (void);
 void FlowShutdown(void);
+void FlowThreadCacheFlush(void);
 void FlowSetIPOnlyFlag(Flow *, int);
 
 void FlowRegisterTests (void);
@@ -555,6 +604,9 @@ void *FlowGetAppState(const Flow *f);
 uint8_t FlowGetDisruptionFlags(const Flow *f, uint8_t flags);
 
 void FlowHandlePacketUpdate(Flow *f, Packet *p);
+void FlowUpdateState(Flow *f, FlowStateType state);
+void FlowPreallocNumaNode(int node);
+uint32_t FlowGetSpareCount(void);
 
 #endif /* __FLOW_H__ */
 
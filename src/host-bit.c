@@ -24,7 +24,6 @@
  * but called that way because of Snort's flowbits.
  * It's a binary storage.
  *
- * \todo move away from a linked list implementation
  * \todo use different datatypes, such as string, int, etc.
  */
 
@@ -54,77 +53,47 @@ void HostBitInitCtx(void)
     }
 }
 
-/* lock before using this */
 int HostHasHostBits(Host *host)
 {
     if (host == NULL)
         return 0;
-    return HostGetStorageById(host, host_bit_id) ? 1 : 0;
+    XBit *xb = HostGetStorageById(host, host_bit_id);
+    return (xb != NULL && xb->cnt > 0) ? 1 : 0;
 }
 
 /** \retval 1 host timed out wrt xbits
   * \retval 0 host still has active (non-expired) xbits */
 int HostBitsTimedoutCheck(Host *h, struct timeval *ts)
 {
-    GenericVar *gv = HostGetStorageById(h, host_bit_id);
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_XBITS) {
-            XBit *xb = (XBit *)gv;
-            if (xb->expire > (uint32_t)ts->tv_sec)
-                return 0;
-        }
-    }
-    return 1;
+    XBit *xb = HostGetStorageById(h, host_bit_id);
+    return XBitsTimedout(xb, (uint32_t)ts->tv_sec);
 }
 
-/* get the bit with idx from the host */
+/* get the bits of the host if bit idx is set */
 static XBit *HostBitGet(Host *h, uint16_t idx)
 {
-    GenericVar *gv = HostGetStorageById(h, host_bit_id);
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_XBITS && gv->idx == idx) {
-            return (XBit *)gv;
-        }
-    }
+    XBit *xb = HostGetStorageById(h, host_bit_id);
+    if (XBitIsset(xb, idx))
+        return xb;
 
     return NULL;
 }
 
-/* add a flowbit to the flow */
+/* add a bit to the host, or update its expire time */
 static void HostBitAdd(Host *h, uint16_t idx, uint32_t expire)
 {
-    XBit *fb = HostBitGet(h, idx);
-    if (fb == NULL) {
-        fb = SCMalloc(sizeof(XBit));
-        if (unlikely(fb == NULL))
-            return;
-
-        fb->type = DETECT_XBITS;
-        fb->idx = idx;
-        fb->next = NULL;
-        fb->expire = expire;
+    XBit *xb = HostGetStorageById(h, host_bit_id);
+    XBit *orig = xb;
 
-        GenericVar *gv = HostGetStorageById(h, host_bit_id);
-        GenericVarAppend(&gv, (GenericVar *)fb);
-        HostSetStorageById(h, host_bit_id, gv);
-
-    // bit already set, lets update it's time
-    } else {
-        fb->expire = expire;
-    }
+    /* node may be allocated even if growing the bits failed */
+    (void)XBitAdd(&xb, idx, expire);
+    if (orig == NULL && xb != NULL)
+        HostSetStorageById(h, host_bit_id, xb);
 }
 
 static void HostBitRemove(Host *h, uint16_t idx)
 {
-    XBit *fb = HostBitGet(h, idx);
-    if (fb == NULL)
-        return;
-
-    GenericVar *gv = HostGetStorageById(h, host_bit_id);
-    if (gv) {
-        GenericVarRemove(&gv, (GenericVar *)fb);
-        HostSetStorageById(h, host_bit_id, gv);
-    }
+    XBitRemove(HostGetStorageById(h, host_bit_id), idx);
 }
 
 void HostBitSet(Host *h, uint16_t idx, uint32_t expire)
@@ -157,7 +126,7 @@ int HostBitIsset(Host *h, uint16_t idx, uint32_t ts)
 {
     XBit *fb = HostBitGet(h, idx);
     if (fb != NULL) {
-        if (fb->expire < ts) {
+        if (fb->expire[idx] < ts) {
             HostBitRemove(h,idx);
             return 0;
         }
@@ -173,7 +142,7 @@ int HostBitIsnotset(Host *h, uint16_t idx, uint32_t ts)
         return 1;
     }
 
-    if (fb->expire < ts) {
+    if (fb->expire[idx] < ts) {
         HostBitRemove(h,idx);
         return 1;
     }
@@ -483,6 +452,36 @@ end:
     return ret;
 }
 
+/** \test expire time per bit, bits far apart */
+static int HostBitTest12 (void)
+{
+    HostInitConfig(TRUE);
+    Host *h = HostAlloc();
+    FAIL_IF_NULL(h);
+
+    HostBitSet(h, 2, 100);
+    HostBitSet(h, 700, 200);
+    FAIL_IF_NOT(HostHasHostBits(h));
+
+    struct timeval ts = { 150, 0 };
+    FAIL_IF(HostBitsTimedoutCheck(h, &ts));
+
+    /* idx 2 expired, idx 700 not */
+    FAIL_IF(HostBitIsset(h, 2, 150));
+    FAIL_IF_NOT(HostBitIsset(h, 700, 150));
+    FAIL_IF_NOT(HostBitIsnotset(h, 3, 150));
+
+    ts.tv_sec = 250;
+    FAIL_IF_NOT(HostBitsTimedoutCheck(h, &ts));
+
+    HostBitUnset(h, 700);
+    FAIL_IF(HostHasHostBits(h));
+
+    HostFree(h);
+    HostCleanup();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void HostBitRegisterTests(void)
@@ -499,5 +498,6 @@ void HostBitRegisterTests(void)
     UtRegisterTest("HostBitTest09", HostBitTest09);
     UtRegisterTest("HostBitTest10", HostBitTest10);
     UtRegisterTest("HostBitTest11", HostBitTest11);
+    UtRegisterTest("HostBitTest12", HostBitTest12);
 #endif /* UNITTESTS */
 }
@@ -41,7 +41,10 @@
 #include "detect-engine-tag.h"
 #include "detect-engine-threshold.h"
 
-#include "util-hash-lookup3.h"
+#include "util-hash-word.h"
+#include "util-hugepages.h"
+#include "util-memuse.h"
+#include "util-prealloc.h"
 
 static Host *HostGetUsedHost(void);
 
@@ -73,6 +76,7 @@ Host *HostAlloc(void)
     Host *h = SCMalloc(g_host_size);
     if (unlikely(h == NULL))
         goto error;
+    MemuseAlloc(MEMUSE_HOST, g_host_size);
 
     memset(h, 0x00, g_host_size);
 
@@ -93,6 +97,7 @@ void HostFree(Host *h)
         SCMutexDestroy(&h->m);
         SCFree(h);
         (void) SC_ATOMIC_SUB(host_memuse, g_host_size);
+        MemuseFree(MEMUSE_HOST, g_host_size);
     }
 }
 
@@ -125,6 +130,29 @@ void HostClearMemory(Host *h)
 #define HOST_DEFAULT_HASHSIZE 4096
 #define HOST_DEFAULT_MEMCAP 16777216
 #define HOST_DEFAULT_PREALLOC 1000
+/** max rows HostGetUsedHost() checks per call */
+#define HOST_PRUNE_MAX_ROWS 1024
+
+/** \internal
+ *  \brief allocate the hosts not preallocated at startup, in the
+ *         background. See util-prealloc.h
+ */
+static uint32_t HostPreallocFill(void)
+{
+    uint32_t cnt = host_config.prealloc - PreallocStartupCount(host_config.prealloc);
+    uint32_t i;
+
+    for (i = 0; i < cnt && !PreallocStopped(); i++) {
+        if (!(HOST_CHECK_MEMCAP(g_host_size)))
+            break;
+
+        Host *h = HostAlloc();
+        if (h == NULL)
+            break;
+        HostEnqueue(&host_spare_q, h);
+    }
+    return i;
+}
 
 /** \brief initialize the configuration
  *  \warning Not thread safe */
@@ -196,7 +224,7 @@ void HostInitConfig(char quiet)
                 (uintmax_t)sizeof(HostHashRow));
         exit(EXIT_FAILURE);
     }
-    host_hash = SCMallocAligned(host_config.hash_size * sizeof(HostHashRow), CLS);
+    host_hash = SCMallocHuge("host hash", host_config.hash_size * sizeof(HostHashRow));
     if (unlikely(host_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in HostInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -208,6 +236,8 @@ void HostInitConfig(char quiet)
         HRLOCK_INIT(&host_hash[i]);
     }
     (void) SC_ATOMIC_ADD(host_memuse, (host_config.hash_size * sizeof(HostHashRow)));
+    MemuseAlloc(MEMUSE_HOST, host_config.hash_size * sizeof(HostHashRow));
+    MemuseSetMemcap(MEMUSE_HOST, host_config.memcap);
 
     if (quiet == FALSE) {
         SCLogConfig("allocated %llu bytes of memory for the host hash... "
@@ -216,8 +246,9 @@ void HostInitConfig(char quiet)
                   (uintmax_t)sizeof(HostHashRow));
     }
 
-    /* pre allocate hosts */
-    for (i = 0; i < host_config.prealloc; i++) {
+    /* pre allocate hosts, in background mode only part of them */
+    uint32_t startup_cnt = PreallocStartupCount(host_config.prealloc);
+    for (i = 0; i < startup_cnt; i++) {
         if (!(HOST_CHECK_MEMCAP(g_host_size))) {
             SCLogError(SC_ERR_HOST_INIT, "preallocating hosts failed: "
                     "max host memcap reached. Memcap %"PRIu64", "
@@ -233,6 +264,8 @@ void HostInitConfig(char quiet)
         }
         HostEnqueue(&host_spare_q,h);
     }
+    if (startup_cnt < host_config.prealloc)
+        PreallocRegisterFill("hosts", HostPreallocFill);
 
     if (quiet == FALSE) {
         SCLogConfig("preallocated %" PRIu32 " hosts of size %" PRIu16 "",
@@ -284,10 +317,11 @@ void HostShutdown(void)
 
             HRLOCK_DESTROY(&host_hash[u]);
         }
-        SCFreeAligned(host_hash);
+        SCFreeHuge(host_hash);
         host_hash = NULL;
     }
     (void) SC_ATOMIC_SUB(host_memuse, host_config.hash_size * sizeof(HostHashRow));
+    MemuseFree(MEMUSE_HOST, host_config.hash_size * sizeof(HostHashRow));
     HostQueueDestroy(&host_spare_q);
 
     SC_ATOMIC_DESTROY(host_prune_idx);
@@ -353,10 +387,10 @@ uint32_t HostGetKey(Address *a)
     uint32_t key;
 
     if (a->family == AF_INET) {
-        uint32_t hash = hashword(&a->addr_data32[0], 1, host_config.hash_rand);
+        uint32_t hash = HashWord(&a->addr_data32[0], 1, host_config.hash_rand);
         key = hash % host_config.hash_size;
     } else if (a->family == AF_INET6) {
-        uint32_t hash = hashword(a->addr_data32, 4, host_config.hash_rand);
+        uint32_t hash = HashWord(a->addr_data32, 4, host_config.hash_rand);
         key = hash % host_config.hash_size;
     } else
         key = 0;
@@ -565,6 +599,13 @@ Host *HostLookupHostFromHash (Address *a)
     uint32_t key = HostGetKey(a);
     /* get our hash bucket and lock it */
     HostHashRow *hb = &host_hash[key];
+
+    /* most lookups are for hosts that are not in the hash, so check for
+     * an empty row before taking the lock. A host that is added at the
+     * same time is missed, just like it would if we looked a bit earlier. */
+    if (hb->head == NULL)
+        return NULL;
+
     HRLOCK_LOCK(hb);
 
     /* see if the bucket already has a host */
@@ -634,7 +675,11 @@ Host *HostLookupHostFromHash (Address *a)
 static Host *HostGetUsedHost(void)
 {
     uint32_t idx = SC_ATOMIC_GET(host_prune_idx) % host_config.hash_size;
-    uint32_t cnt = host_config.hash_size;
+    /* don't walk the whole hash in the packet path: if the next rows
+     * only hold busy entries, give up and let the next caller continue
+     * where we stopped */
+    uint32_t max = MIN(host_config.hash_size, HOST_PRUNE_MAX_ROWS);
+    uint32_t cnt = max;
 
     while (cnt--) {
         if (++idx >= host_config.hash_size)
@@ -682,10 +727,11 @@ static Host *HostGetUsedHost(void)
 
         SCMutexUnlock(&h->m);
 
-        (void) SC_ATOMIC_ADD(host_prune_idx, (host_config.hash_size - cnt));
+        (void) SC_ATOMIC_ADD(host_prune_idx, (max - cnt));
         return h;
     }
 
+    (void) SC_ATOMIC_ADD(host_prune_idx, max);
     return NULL;
 }
 
@@ -24,7 +24,6 @@
  * but called that way because of Snort's flowbits.
  * It's a binary storage.
  *
- * \todo move away from a linked list implementation
  * \todo use different datatypes, such as string, int, etc.
  */
 
@@ -54,77 +53,47 @@ void IPPairBitInitCtx(void)
     }
 }
 
-/* lock before using this */
 int IPPairHasBits(IPPair *ippair)
 {
     if (ippair == NULL)
         return 0;
-    return IPPairGetStorageById(ippair, ippair_bit_id) ? 1 : 0;
+    XBit *xb = IPPairGetStorageById(ippair, ippair_bit_id);
+    return (xb != NULL && xb->cnt > 0) ? 1 : 0;
 }
 
 /** \retval 1 ippair timed out wrt xbits
   * \retval 0 ippair still has active (non-expired) xbits */
 int IPPairBitsTimedoutCheck(IPPair *h, struct timeval *ts)
 {
-    GenericVar *gv = IPPairGetStorageById(h, ippair_bit_id);
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_XBITS) {
-            XBit *xb = (XBit *)gv;
-            if (xb->expire > (uint32_t)ts->tv_sec)
-                return 0;
-        }
-    }
-    return 1;
+    XBit *xb = IPPairGetStorageById(h, ippair_bit_id);
+    return XBitsTimedout(xb, (uint32_t)ts->tv_sec);
 }
 
-/* get the bit with idx from the ippair */
+/* get the bits of the ippair if bit idx is set */
 static XBit *IPPairBitGet(IPPair *h, uint16_t idx)
 {
-    GenericVar *gv = IPPairGetStorageById(h, ippair_bit_id);
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_XBITS && gv->idx == idx) {
-            return (XBit *)gv;
-        }
-    }
+    XBit *xb = IPPairGetStorageById(h, ippair_bit_id);
+    if (XBitIsset(xb, idx))
+        return xb;
 
     return NULL;
 }
 
-/* add a flowbit to the flow */
+/* add a bit to the ippair, or update its expire time */
 static void IPPairBitAdd(IPPair *h, uint16_t idx, uint32_t expire)
 {
-    XBit *fb = IPPairBitGet(h, idx);
-    if (fb == NULL) {
-        fb = SCMalloc(sizeof(XBit));
-        if (unlikely(fb == NULL))
-            return;
-
-        fb->type = DETECT_XBITS;
-        fb->idx = idx;
-        fb->next = NULL;
-        fb->expire = expire;
+    XBit *xb = IPPairGetStorageById(h, ippair_bit_id);
+    XBit *orig = xb;
 
-        GenericVar *gv = IPPairGetStorageById(h, ippair_bit_id);
-        GenericVarAppend(&gv, (GenericVar *)fb);
-        IPPairSetStorageById(h, ippair_bit_id, gv);
-
-    // bit already set, lets update it's timer
-    } else {
-        fb->expire = expire;
-    }
+    /* node may be allocated even if growing the bits failed */
+    (void)XBitAdd(&xb, idx, expire);
+    if (orig == NULL && xb != NULL)
+        IPPairSetStorageById(h, ippair_bit_id, xb);
 }
 
 static void IPPairBitRemove(IPPair *h, uint16_t idx)
 {
-    XBit *fb = IPPairBitGet(h, idx);
-    if (fb == NULL)
-        return;
-
-    GenericVar *gv = IPPairGetStorageById(h, ippair_bit_id);
-    if (gv) {
-        GenericVarRemove(&gv, (GenericVar *)fb);
-        IPPairSetStorageById(h, ippair_bit_id, gv);
-    }
+    XBitRemove(IPPairGetStorageById(h, ippair_bit_id), idx);
 }
 
 void IPPairBitSet(IPPair *h, uint16_t idx, uint32_t expire)
@@ -157,7 +126,7 @@ int IPPairBitIsset(IPPair *h, uint16_t idx, uint32_t ts)
 {
     XBit *fb = IPPairBitGet(h, idx);
     if (fb != NULL) {
-        if (fb->expire < ts) {
+        if (fb->expire[idx] < ts) {
             IPPairBitRemove(h, idx);
             return 0;
         }
@@ -174,7 +143,7 @@ int IPPairBitIsnotset(IPPair *h, uint16_t idx, uint32_t ts)
         return 1;
     }
 
-    if (fb->expire < ts) {
+    if (fb->expire[idx] < ts) {
         IPPairBitRemove(h, idx);
         return 1;
     }
@@ -40,7 +40,10 @@
 #include "detect-engine-tag.h"
 #include "detect-engine-threshold.h"
 
-#include "util-hash-lookup3.h"
+#include "util-hash-word.h"
+#include "util-hugepages.h"
+#include "util-memuse.h"
+#include "util-prealloc.h"
 
 static IPPair *IPPairGetUsedIPPair(void);
 
@@ -73,6 +76,7 @@ IPPair *IPPairAlloc(void)
     IPPair *h = SCMalloc(g_ippair_size);
     if (unlikely(h == NULL))
         goto error;
+    MemuseAlloc(MEMUSE_IPPAIR, g_ippair_size);
 
     memset(h, 0x00, g_ippair_size);
 
@@ -93,6 +97,7 @@ void IPPairFree(IPPair *h)
         SCMutexDestroy(&h->m);
         SCFree(h);
         (void) SC_ATOMIC_SUB(ippair_memuse, g_ippair_size);
+        MemuseFree(MEMUSE_IPPAIR, g_ippair_size);
     }
 }
 
@@ -121,6 +126,29 @@ void IPPairClearMemory(IPPair *h)
 #define IPPAIR_DEFAULT_HASHSIZE 4096
 #define IPPAIR_DEFAULT_MEMCAP 16777216
 #define IPPAIR_DEFAULT_PREALLOC 1000
+/** max rows IPPairGetUsedIPPair() checks per call */
+#define IPPAIR_PRUNE_MAX_ROWS 1024
+
+/** \internal
+ *  \brief allocate the ippairs not preallocated at startup, in the
+ *         background. See util-prealloc.h
+ */
+static uint32_t IPPairPreallocFill(void)
+{
+    uint32_t cnt = ippair_config.prealloc - PreallocStartupCount(ippair_config.prealloc);
+    uint32_t i;
+
+    for (i = 0; i < cnt && !PreallocStopped(); i++) {
+        if (!(IPPAIR_CHECK_MEMCAP(g_ippair_size)))
+            break;
+
+        IPPair *h = IPPairAlloc();
+        if (h == NULL)
+            break;
+        IPPairEnqueue(&ippair_spare_q, h);
+    }
+    return i;
+}
 
 /** \brief initialize the configuration
  *  \warning Not thread safe */
@@ -192,7 +220,7 @@ void IPPairInitConfig(char quiet)
                 (uintmax_t)sizeof(IPPairHashRow));
         exit(EXIT_FAILURE);
     }
-    ippair_hash = SCMallocAligned(ippair_config.hash_size * sizeof(IPPairHashRow), CLS);
+    ippair_hash = SCMallocHuge("ippair hash", ippair_config.hash_size * sizeof(IPPairHashRow));
     if (unlikely(ippair_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in IPPairInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -204,6 +232,8 @@ void IPPairInitConfig(char quiet)
         HRLOCK_INIT(&ippair_hash[i]);
     }
     (void) SC_ATOMIC_ADD(ippair_memuse, (ippair_config.hash_size * sizeof(IPPairHashRow)));
+    MemuseAlloc(MEMUSE_IPPAIR, ippair_config.hash_size * sizeof(IPPairHashRow));
+    MemuseSetMemcap(MEMUSE_IPPAIR, ippair_config.memcap);
 
     if (quiet == FALSE) {
         SCLogConfig("allocated %llu bytes of memory for the ippair hash... "
@@ -212,8 +242,9 @@ void IPPairInitConfig(char quiet)
                   (uintmax_t)sizeof(IPPairHashRow));
     }
 
-    /* pre allocate ippairs */
-    for (i = 0; i < ippair_config.prealloc; i++) {
+    /* pre allocate ippairs, in background mode only part of them */
+    uint32_t startup_cnt = PreallocStartupCount(ippair_config.prealloc);
+    for (i = 0; i < startup_cnt; i++) {
         if (!(IPPAIR_CHECK_MEMCAP(g_ippair_size))) {
             SCLogError(SC_ERR_IPPAIR_INIT, "preallocating ippairs failed: "
                     "max ippair memcap reached. Memcap %"PRIu64", "
@@ -229,6 +260,8 @@ void IPPairInitConfig(char quiet)
         }
         IPPairEnqueue(&ippair_spare_q,h);
     }
+    if (startup_cnt < ippair_config.prealloc)
+        PreallocRegisterFill("ippairs", IPPairPreallocFill);
 
     if (quiet == FALSE) {
         SCLogConfig("preallocated %" PRIu32 " ippairs of size %" PRIu16 "",
@@ -280,10 +313,11 @@ void IPPairShutdown(void)
 
             HRLOCK_DESTROY(&ippair_hash[u]);
         }
-        SCFreeAligned(ippair_hash);
+        SCFreeHuge(ippair_hash);
         ippair_hash = NULL;
     }
     (void) SC_ATOMIC_SUB(ippair_memuse, ippair_config.hash_size * sizeof(IPPairHashRow));
+    MemuseFree(MEMUSE_IPPAIR, ippair_config.hash_size * sizeof(IPPairHashRow));
     IPPairQueueDestroy(&ippair_spare_q);
 
     SC_ATOMIC_DESTROY(ippair_prune_idx);
@@ -349,10 +383,10 @@ static uint32_t IPPairGetKey(Address *a, Address *b)
     uint32_t key;
 
     if (a->family == AF_INET) {
-        uint32_t hash = hashword(&a->addr_data32[0], 1, ippair_config.hash_rand);
+        uint32_t hash = HashWord(&a->addr_data32[0], 1, ippair_config.hash_rand);
         key = hash % ippair_config.hash_size;
     } else if (a->family == AF_INET6) {
-        uint32_t hash = hashword(a->addr_data32, 4, ippair_config.hash_rand);
+        uint32_t hash = HashWord(a->addr_data32, 4, ippair_config.hash_rand);
         key = hash % ippair_config.hash_size;
     } else
         key = 0;
@@ -562,6 +596,13 @@ IPPair *IPPairLookupIPPairFromHash (Address *a, Address *b)
     uint32_t key = IPPairGetKey(a, b);
     /* get our hash bucket and lock it */
     IPPairHashRow *hb = &ippair_hash[key];
+
+    /* most lookups are for ippairs that are not in the hash, so check for
+     * an empty row before taking the lock. A ippair that is added at the
+     * same time is missed, just like it would if we looked a bit earlier. */
+    if (hb->head == NULL)
+        return NULL;
+
     HRLOCK_LOCK(hb);
 
     /* see if the bucket already has a ippair */
@@ -631,7 +672,11 @@ IPPair *IPPairLookupIPPairFromHash (Address *a, Address *b)
 static IPPair *IPPairGetUsedIPPair(void)
 {
     uint32_t idx = SC_ATOMIC_GET(ippair_prune_idx) % ippair_config.hash_size;
-    uint32_t cnt = ippair_config.hash_size;
+    /* don't walk the whole hash in the packet path: if the next rows
+     * only hold busy entries, give up and let the next caller continue
+     * where we stopped */
+    uint32_t max = MIN(ippair_config.hash_size, IPPAIR_PRUNE_MAX_ROWS);
+    uint32_t cnt = max;
 
     while (cnt--) {
         if (++idx >= ippair_config.hash_size)
@@ -679,10 +724,11 @@ static IPPair *IPPairGetUsedIPPair(void)
 
         SCMutexUnlock(&h->m);
 
-        (void) SC_ATOMIC_ADD(ippair_prune_idx, (ippair_config.hash_size - cnt));
+        (void) SC_ATOMIC_ADD(ippair_prune_idx, (max - cnt));
         return h;
     }
 
+    (void) SC_ATOMIC_ADD(ippair_prune_idx, max);
     return NULL;
 }
 
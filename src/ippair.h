@@ -26,6 +26,7 @@
 
 #include "decode.h"
 #include "util-storage.h"
+#include "util-lock-contention.h"
 
 /** Spinlocks or Mutex for the flow buckets. */
 //#define HRLOCK_SPIN
@@ -41,14 +42,14 @@
     #define HRLOCK_TYPE SCSpinlock
     #define HRLOCK_INIT(fb) SCSpinInit(&(fb)->lock, 0)
     #define HRLOCK_DESTROY(fb) SCSpinDestroy(&(fb)->lock)
-    #define HRLOCK_LOCK(fb) SCSpinLock(&(fb)->lock)
+    #define HRLOCK_LOCK(fb) SCSpinLockCounted(&(fb)->lock, LOCK_CONTENTION_HOST_ROW)
     #define HRLOCK_TRYLOCK(fb) SCSpinTrylock(&(fb)->lock)
     #define HRLOCK_UNLOCK(fb) SCSpinUnlock(&(fb)->lock)
 #elif defined HRLOCK_MUTEX
     #define HRLOCK_TYPE SCMutex
     #define HRLOCK_INIT(fb) SCMutexInit(&(fb)->lock, NULL)
     #define HRLOCK_DESTROY(fb) SCMutexDestroy(&(fb)->lock)
-    #define HRLOCK_LOCK(fb) SCMutexLock(&(fb)->lock)
+    #define HRLOCK_LOCK(fb) SCMutexLockCounted(&(fb)->lock, LOCK_CONTENTION_HOST_ROW)
     #define HRLOCK_TRYLOCK(fb) SCMutexTrylock(&(fb)->lock)
     #define HRLOCK_UNLOCK(fb) SCMutexUnlock(&(fb)->lock)
 #else
@@ -183,7 +183,7 @@ static int LogDropLogNetFilter (ThreadVars *tv, const Packet *p, void *data)
 
     CreateTimeString(&p->ts, timebuf, sizeof(timebuf));
 
-    SCMutexLock(&dlt->file_ctx->fp_mutex);
+    SCMutexLockCounted(&dlt->file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
 
     if (dlt->file_ctx->rotation_flag) {
         dlt->file_ctx->rotation_flag  = 0;
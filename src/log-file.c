@@ -180,7 +180,7 @@ static void LogFileMetaGetSmtp(FILE *fp, const Packet *p, const File *ff)
  */
 static void LogFileWriteJsonRecord(LogFileLogThread *aft, const Packet *p, const File *ff, int ipver)
 {
-    SCMutexLock(&aft->file_ctx->fp_mutex);
+    SCMutexLockCounted(&aft->file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
 
     /* As writes are done via the LogFileCtx, check for rotation here. */
     if (aft->file_ctx->rotation_flag) {
@@ -290,6 +290,22 @@ static void LogFileWriteJsonRecord(LogFileLogThread *aft, const Packet *p, const
                 }
                 fprintf(fp, "\", ");
             }
+            if (ff->flags & FILE_SHA1) {
+                fprintf(fp, "\"sha1\": \"");
+                size_t x;
+                for (x = 0; x < sizeof(ff->sha1); x++) {
+                    fprintf(fp, "%02x", ff->sha1[x]);
+                }
+                fprintf(fp, "\", ");
+            }
+            if (ff->flags & FILE_SHA256) {
+                fprintf(fp, "\"sha256\": \"");
+                size_t x;
+                for (x = 0; x < sizeof(ff->sha256); x++) {
+                    fprintf(fp, "%02x", ff->sha256[x]);
+                }
+                fprintf(fp, "\", ");
+            }
 #endif
             break;
         case FILE_STATE_TRUNCATED:
@@ -438,6 +454,8 @@ static OutputCtx *LogFileLogInitCtx(ConfNode *conf)
 #endif
     }
 
+    FileForceHashParseCfg(conf);
+
     FileForceTrackingEnable();
     SCReturnPtr(output_ctx, "OutputCtx");
 }
@@ -62,10 +62,21 @@
 
 static char g_logfile_base_dir[PATH_MAX] = "/tmp";
 
+/** number of files per thread we keep an open fd for */
+#define FILESTORE_OPEN_FILES 32
+
+typedef struct LogFilestoreOpenFile_ {
+    uint32_t file_id;
+    int fd;                 /**< -1 if slot is unused */
+} LogFilestoreOpenFile;
+
 typedef struct LogFilestoreLogThread_ {
     LogFileCtx *file_ctx;
     /** LogFilestoreCtx has the pointer to the file and a mutex to allow multithreading */
     uint32_t file_cnt;
+    /** files that are being written by this thread, so that we don't
+     *  have to open and close them for every chunk */
+    LogFilestoreOpenFile open_files[FILESTORE_OPEN_FILES];
 } LogFilestoreLogThread;
 
 static void LogFilestoreMetaGetUri(FILE *fp, const Packet *p, const File *ff)
@@ -261,6 +272,22 @@ static void LogFilestoreLogCloseMetaFile(const File *ff)
                     }
                     fprintf(fp, "\n");
                 }
+                if (ff->flags & FILE_SHA1) {
+                    fprintf(fp, "SHA1:              ");
+                    size_t x;
+                    for (x = 0; x < sizeof(ff->sha1); x++) {
+                        fprintf(fp, "%02x", ff->sha1[x]);
+                    }
+                    fprintf(fp, "\n");
+                }
+                if (ff->flags & FILE_SHA256) {
+                    fprintf(fp, "SHA256:            ");
+                    size_t x;
+                    for (x = 0; x < sizeof(ff->sha256); x++) {
+                        fprintf(fp, "%02x", ff->sha256[x]);
+                    }
+                    fprintf(fp, "\n");
+                }
 #endif
                 break;
             case FILE_STATE_TRUNCATED:
@@ -308,23 +335,40 @@ static int LogFilestoreLogger(ThreadVars *tv, void *thread_data, const Packet *p
     snprintf(filename, sizeof(filename), "%s/file.%u",
             g_logfile_base_dir, ff->file_id);
 
+    /* the slot we keep the fd of this file in */
+    LogFilestoreOpenFile *of = &aft->open_files[ff->file_id % FILESTORE_OPEN_FILES];
+
     if (flags & OUTPUT_FILEDATA_FLAG_OPEN) {
         aft->file_cnt++;
 
         /* create a .meta file that contains time, src/dst/sp/dp/proto */
         LogFilestoreLogCreateMetaFile(p, ff, filename, ipver);
 
-        file_fd = open(filename, O_CREAT | O_TRUNC | O_NOFOLLOW | O_WRONLY, 0644);
+        /* in append mode so that a write from another thread for the
+         * same file, e.g. at flow timeout, can't get overwritten */
+        file_fd = open(filename, O_CREAT | O_TRUNC | O_NOFOLLOW | O_WRONLY | O_APPEND, 0644);
         if (file_fd == -1) {
             SCLogDebug("failed to create file");
             return -1;
         }
+        if (of->fd != -1)
+            close(of->fd);
+        of->fd = file_fd;
+        of->file_id = ff->file_id;
     /* we can get called with a NULL ffd when we need to close */
     } else if (data != NULL) {
-        file_fd = open(filename, O_APPEND | O_NOFOLLOW | O_WRONLY);
-        if (file_fd == -1) {
-            SCLogDebug("failed to open file %s: %s", filename, strerror(errno));
-            return -1;
+        if (of->fd != -1 && of->file_id == ff->file_id) {
+            file_fd = of->fd;
+        } else {
+            file_fd = open(filename, O_APPEND | O_NOFOLLOW | O_WRONLY);
+            if (file_fd == -1) {
+                SCLogDebug("failed to open file %s: %s", filename, strerror(errno));
+                return -1;
+            }
+            if (of->fd != -1)
+                close(of->fd);
+            of->fd = file_fd;
+            of->file_id = ff->file_id;
         }
     }
 
@@ -333,10 +377,13 @@ static int LogFilestoreLogger(ThreadVars *tv, void *thread_data, const Packet *p
         if (r == -1) {
             SCLogDebug("write failed: %s", strerror(errno));
         }
-        close(file_fd);
     }
 
     if (flags & OUTPUT_FILEDATA_FLAG_CLOSE) {
+        if (of->fd != -1 && of->file_id == ff->file_id) {
+            close(of->fd);
+            of->fd = -1;
+        }
         LogFilestoreLogCloseMetaFile(ff);
     }
 
@@ -350,6 +397,10 @@ static TmEcode LogFilestoreLogThreadInit(ThreadVars *t, void *initdata, void **d
         return TM_ECODE_FAILED;
     memset(aft, 0, sizeof(LogFilestoreLogThread));
 
+    int i;
+    for (i = 0; i < FILESTORE_OPEN_FILES; i++)
+        aft->open_files[i].fd = -1;
+
     if (initdata == NULL)
     {
         SCLogDebug("Error getting context for LogFileStore. \"initdata\" argument NULL");
@@ -390,6 +441,12 @@ static TmEcode LogFilestoreLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
+    int i;
+    for (i = 0; i < FILESTORE_OPEN_FILES; i++) {
+        if (aft->open_files[i].fd != -1)
+            close(aft->open_files[i].fd);
+    }
+
     /* clear memory */
     memset(aft, 0, sizeof(LogFilestoreLogThread));
 
@@ -474,6 +531,9 @@ static OutputCtx *LogFilestoreLogInitCtx(ConfNode *conf)
         SCLogInfo("md5 calculation requires linking against libnss");
 #endif
     }
+
+    FileForceHashParseCfg(conf);
+
     SCLogInfo("storing files in %s", g_logfile_base_dir);
 
     SCReturnPtr(output_ctx, "OutputCtx");
@@ -46,6 +46,8 @@
 #include "util-misc.h"
 #include "util-cpu.h"
 #include "util-atomic.h"
+#include "util-logopenfile.h"
+#include "flow-storage.h"
 
 #include "source-pcap.h"
 
@@ -53,6 +55,10 @@
 
 #include "queue.h"
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 #define DEFAULT_LOG_FILENAME            "pcaplog"
 #define MODULE_NAME                     "PcapLog"
 #define MIN_LIMIT                       1 * 1024 * 1024
@@ -75,6 +81,9 @@
 #define HONOR_PASS_RULES_DISABLED       0
 #define HONOR_PASS_RULES_ENABLED        1
 
+#define DEFAULT_LOOKBACK_PACKETS        64
+#define DEFAULT_LOOKBACK_BYTES          256 * 1024
+
 SC_ATOMIC_DECLARE(uint32_t, thread_cnt);
 
 typedef struct PcapFileName_ {
@@ -90,6 +99,21 @@ typedef struct PcapLogProfileData_ {
 
 #define MAX_TOKS 9
 
+/** packet record header as stored in the pcap file, struct pcap_pkthdr
+ *  has a struct timeval which is wider on 64 bit */
+typedef struct PcapLogRecordHdr_ {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t caplen;
+    uint32_t len;
+} PcapLogRecordHdr;
+
+/** record of the pcap index file (<pcap file>.idx), host byte order */
+typedef struct PcapLogIndexRecord_ {
+    uint64_t flow_id;   /**< flow_id, as in eve records */
+    uint64_t offset;    /**< offset of the packet record in the pcap file */
+} PcapLogIndexRecord;
+
 /**
  * PcapLog thread vars
  *
@@ -132,8 +156,47 @@ typedef struct PcapLogData_ {
     int threads;                /**< number of threads (only set in the global) */
     char *filename_parts[MAX_TOKS];
     int filename_part_cnt;
+    int compress;               /**< gzip the pcap files */
+    int compress_level;
+
+    int use_mmap;               /**< copy packets into a mapped file */
+    int map_fd;
+    uint8_t *map;               /**< mapping of the current file */
+    size_t map_size;
+
+    int index;                  /**< write a flow index per pcap file */
+    FILE *index_fp;
+    uint64_t file_offset;       /**< offset of the next packet record */
+
+    int conditional;            /**< only log flows with alerts */
+    uint32_t lookback_packets;  /**< packets held back per flow */
+    uint32_t lookback_bytes;    /**< and their max size */
+    uint32_t lookback_secs;     /**< max age at alert time, 0 no limit */
+    uint32_t post_alert_packets; /**< packets logged after the alert, 0 all */
 } PcapLogData;
 
+/** packet held back in the conditional mode */
+typedef struct PcapLogFlowPacket_ {
+    struct timeval ts;
+    uint32_t len;
+    uint32_t size;              /**< allocated size of data */
+    uint8_t *data;
+} PcapLogFlowPacket;
+
+/** conditional mode per flow state, in the flow storage */
+typedef struct PcapLogFlowData_ {
+    uint32_t slots;             /**< size of pkts */
+    uint32_t first;             /**< oldest held back packet */
+    uint32_t cnt;               /**< held back packets */
+    uint32_t bytes;             /**< held back packet bytes */
+    uint32_t logged;            /**< packets logged after the alert */
+    int alerted;
+    PcapLogFlowPacket pkts[];
+} PcapLogFlowData;
+
+/* flow storage id of the PcapLogFlowData */
+static int pcap_log_flow_id = -1;
+
 typedef struct PcapLogThreadData_ {
     PcapLogData *pcap_log;
 } PcapLogThreadData;
@@ -149,6 +212,7 @@ static TmEcode PcapLogDataDeinit(ThreadVars *, void *);
 static void PcapLogFileDeInitCtx(OutputCtx *);
 static OutputCtx *PcapLogInitCtx(ConfNode *);
 static void PcapLogProfilingDump(PcapLogData *);
+static void PcapLogFlowDataFree(void *);
 
 void TmModulePcapLogRegister(void)
 {
@@ -160,6 +224,13 @@ void TmModulePcapLogRegister(void)
 
     OutputRegisterModule(MODULE_NAME, "pcap-log", PcapLogInitCtx);
 
+    pcap_log_flow_id = FlowStorageRegister("pcap-log", sizeof(void *),
+            NULL, PcapLogFlowDataFree);
+    if (pcap_log_flow_id == -1) {
+        SCLogError(SC_ERR_FLOW_INIT, "Can't initiate flow storage for pcap-log");
+        exit(EXIT_FAILURE);
+    }
+
     SC_ATOMIC_INIT(thread_cnt);
     return;
 }
@@ -171,6 +242,131 @@ void TmModulePcapLogRegister(void)
     (prof).total += (UtilCpuGetTicks() - pcaplog_profile_ticks); \
     (prof).cnt++
 
+/** \internal
+ *  \brief name of the index file of the pcap file 'filename'
+ */
+static void PcapLogIndexName(const char *filename, char *name, size_t size)
+{
+    snprintf(name, size, "%s.idx", filename);
+}
+
+/** \internal
+ *  \brief open the index file of the current pcap file
+ *
+ *  The index has a PcapLogIndexRecord for each packet of a flow, in file
+ *  order, so the packets of a flow can be found without reading the pcap.
+ */
+static int PcapLogOpenIndex(PcapLogData *pl)
+{
+    char name[PATH_MAX];
+
+    PcapLogIndexName(pl->filename, name, sizeof(name));
+    pl->index_fp = fopen(name, "w");
+    if (pl->index_fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "Error opening pcap index \"%s\": %s",
+                name, strerror(errno));
+        return -1;
+    }
+    pl->file_offset = sizeof(struct pcap_file_header);
+    return 0;
+}
+
+static void PcapLogWriteIndex(PcapLogData *pl, const Flow *f, uint32_t len)
+{
+    if (f != NULL) {
+        PcapLogIndexRecord rec;
+        /* same id as the flow_id of eve records */
+        rec.flow_id = (uint64_t)FlowGetId(f) & 0x7ffffffffffffLL;
+        rec.offset = pl->file_offset;
+        if (fwrite(&rec, sizeof(rec), 1, pl->index_fp) != 1) {
+            SCLogDebug("pcap index write failed");
+        }
+    }
+    pl->file_offset += sizeof(PcapLogRecordHdr) + len;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+/** \internal
+ *  \brief create the current pcap file at its full size and map it
+ *
+ *  Packets are then copied into the mapping, without a write call per
+ *  packet. The file is cut down to what was used when it is closed.
+ */
+static int PcapLogOpenMapped(PcapLogData *pl, int linktype)
+{
+    size_t size = sizeof(struct pcap_file_header) + pl->size_limit;
+
+    int fd = open(pl->filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        SCLogError(SC_ERR_FOPEN, "Error opening dump file %s: %s",
+                pl->filename, strerror(errno));
+        return -1;
+    }
+    /* allocate the blocks up front: running out of disk while writing to
+     * a sparse mapping raises SIGBUS */
+#ifdef HAVE_POSIX_FALLOCATE
+    int r = posix_fallocate(fd, 0, size);
+#else
+    int r = ftruncate(fd, size) == 0 ? 0 : errno;
+#endif
+    if (r != 0) {
+        SCLogError(SC_ERR_FOPEN, "Error allocating %"PRIuMAX" bytes for "
+                "dump file %s: %s", (uintmax_t)size, pl->filename, strerror(r));
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error mapping dump file %s: %s",
+                pl->filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    struct pcap_file_header *hdr = map;
+    hdr->magic = 0xa1b2c3d4;
+    hdr->version_major = PCAP_VERSION_MAJOR;
+    hdr->version_minor = PCAP_VERSION_MINOR;
+    hdr->thiszone = 0;
+    hdr->sigfigs = 0;
+    hdr->snaplen = 65535;
+    hdr->linktype = linktype;
+
+    pl->map_fd = fd;
+    pl->map = map;
+    pl->map_size = size;
+    return 0;
+}
+
+static void PcapLogCloseMapped(PcapLogData *pl)
+{
+    munmap(pl->map, pl->map_size);
+    if (ftruncate(pl->map_fd, sizeof(struct pcap_file_header) +
+                pl->size_current) != 0) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to truncate dump file %s: %s",
+                pl->filename, strerror(errno));
+    }
+    close(pl->map_fd);
+    pl->map = NULL;
+    pl->map_fd = -1;
+}
+
+static inline void PcapLogWriteMapped(PcapLogData *pl, const struct timeval *ts,
+        const uint8_t *data, uint32_t len)
+{
+    uint8_t *dst = pl->map + sizeof(struct pcap_file_header) + pl->size_current;
+    PcapLogRecordHdr rec;
+
+    rec.ts_sec = (uint32_t)ts->tv_sec;
+    rec.ts_usec = (uint32_t)ts->tv_usec;
+    rec.caplen = len;
+    rec.len = len;
+    memcpy(dst, &rec, sizeof(rec));
+    memcpy(dst + sizeof(rec), data, len);
+}
+#endif /* HAVE_SYS_MMAN_H */
+
 /**
  * \brief Function to close pcaplog file
  *
@@ -184,6 +380,14 @@ static int PcapLogCloseFile(ThreadVars *t, PcapLogData *pl)
 
         if (pl->pcap_dumper != NULL)
             pcap_dump_close(pl->pcap_dumper);
+#ifdef HAVE_SYS_MMAN_H
+        if (pl->map != NULL)
+            PcapLogCloseMapped(pl);
+#endif
+        if (pl->index_fp != NULL) {
+            fclose(pl->index_fp);
+            pl->index_fp = NULL;
+        }
         pl->size_current = 0;
         pl->pcap_dumper = NULL;
 
@@ -243,6 +447,11 @@ static int PcapLogRotateFile(ThreadVars *t, PcapLogData *pl)
             //           "failed to remove log file %s: %s",
             //           pf->filename, strerror( errno ));
         }
+        if (pl->index) {
+            char name[PATH_MAX];
+            PcapLogIndexName(pf->filename, name, sizeof(name));
+            (void)remove(name);
+        }
 
         /* Remove directory if Sguil mode and no files left in sguil dir */
         if (pl->mode == LOGMODE_SGUIL) {
@@ -281,12 +490,26 @@ static int PcapLogRotateFile(ThreadVars *t, PcapLogData *pl)
     return 0;
 }
 
-static int PcapLogOpenHandles(PcapLogData *pl, Packet *p)
+static int PcapLogOpenHandles(PcapLogData *pl, const Packet *p)
 {
     PCAPLOG_PROFILE_START;
 
     SCLogDebug("Setting pcap-log link type to %u", p->datalink);
 
+    if (pl->index && pl->index_fp == NULL) {
+        if (PcapLogOpenIndex(pl) < 0)
+            return TM_ECODE_FAILED;
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    if (pl->use_mmap) {
+        if (PcapLogOpenMapped(pl, p->datalink) < 0)
+            return TM_ECODE_FAILED;
+        PCAPLOG_PROFILE_END(pl->profile_handles);
+        return TM_ECODE_OK;
+    }
+#endif
+
     if (pl->pcap_dead_handle == NULL) {
         if ((pl->pcap_dead_handle = pcap_open_dead(p->datalink,
                         -1)) == NULL) {
@@ -296,6 +519,19 @@ static int PcapLogOpenHandles(PcapLogData *pl, Packet *p)
     }
 
     if (pl->pcap_dumper == NULL) {
+#ifdef LOGFILE_HAVE_GZIP
+        if (pl->compress) {
+            FILE *fp = LogFileOpenGzipFp(pl->filename, 0, pl->compress_level);
+            if (fp == NULL)
+                return TM_ECODE_FAILED;
+            if ((pl->pcap_dumper = pcap_dump_fopen(pl->pcap_dead_handle,
+                            fp)) == NULL) {
+                SCLogInfo("Error opening dump file %s", pcap_geterr(pl->pcap_dead_handle));
+                fclose(fp);
+                return TM_ECODE_FAILED;
+            }
+        } else
+#endif
         if ((pl->pcap_dumper = pcap_dump_open(pl->pcap_dead_handle,
                         pl->filename)) == NULL) {
             SCLogInfo("Error opening dump file %s", pcap_geterr(pl->pcap_dead_handle));
@@ -333,50 +569,33 @@ static void PcapLogUnlock(PcapLogData *pl)
     }
 }
 
-/**
- * \brief Pcap logging main function
- *
- * \param t threadvar
- * \param p packet
- * \param data thread module specific data
- * \param pq pre-packet-queue
- * \param postpq post-packet-queue
+/** \internal
+ *  \brief write a packet record to the current file, rotating it first
+ *         if needed. Caller holds the PcapLogLock.
  *
- * \retval TM_ECODE_OK on succes
- * \retval TM_ECODE_FAILED on serious error
+ *  The record data can be a packet copied earlier, 'p' is the current
+ *  packet of the same flow: it gives the link type and the flow.
  */
-static TmEcode PcapLog (ThreadVars *t, Packet *p, void *thread_data, PacketQueue *pq,
-                 PacketQueue *postpq)
+static TmEcode PcapLogWrite(ThreadVars *t, PcapLogData *pl, const Packet *p,
+        const struct timeval *ts, const uint8_t *data, uint32_t data_len)
 {
     size_t len;
     int rotate = 0;
     int ret = 0;
 
-    PcapLogThreadData *td = (PcapLogThreadData *)thread_data;
-    PcapLogData *pl = td->pcap_log;
-
-    if ((p->flags & PKT_PSEUDO_STREAM_END) ||
-        ((p->flags & PKT_STREAM_NOPCAPLOG) &&
-         (pl->use_stream_depth == USE_STREAM_DEPTH_ENABLED)) ||
-        (IS_TUNNEL_PKT(p) && !IS_TUNNEL_ROOT_PKT(p)) ||
-        (pl->honor_pass_rules && (p->flags & PKT_NOPACKET_INSPECTION)))
-    {
-        return TM_ECODE_OK;
-    }
-
-    PcapLogLock(pl);
-
     pl->pkt_cnt++;
-    pl->h->ts.tv_sec = p->ts.tv_sec;
-    pl->h->ts.tv_usec = p->ts.tv_usec;
-    pl->h->caplen = GET_PKT_LEN(p);
-    pl->h->len = GET_PKT_LEN(p);
-    len = sizeof(*pl->h) + GET_PKT_LEN(p);
+    pl->h->ts.tv_sec = ts->tv_sec;
+    pl->h->ts.tv_usec = ts->tv_usec;
+    pl->h->caplen = data_len;
+    pl->h->len = data_len;
+    if (pl->use_mmap)
+        len = sizeof(PcapLogRecordHdr) + data_len;
+    else
+        len = sizeof(*pl->h) + data_len;
 
     if (pl->filename == NULL) {
         ret = PcapLogOpenFileCtx(pl);
         if (ret < 0) {
-            PcapLogUnlock(pl);
             return TM_ECODE_FAILED;
         }
         SCLogDebug("Opening PCAP log file %s", pl->filename);
@@ -384,7 +603,7 @@ static TmEcode PcapLog (ThreadVars *t, Packet *p, void *thread_data, PacketQueue
 
     if (pl->mode == LOGMODE_SGUIL) {
         struct tm local_tm;
-        struct tm *tms = SCLocalTime(p->ts.tv_sec, &local_tm);
+        struct tm *tms = SCLocalTime(ts->tv_sec, &local_tm);
         if (tms->tm_mday != pl->prev_day) {
             rotate = 1;
             pl->prev_day = tms->tm_mday;
@@ -393,7 +612,6 @@ static TmEcode PcapLog (ThreadVars *t, Packet *p, void *thread_data, PacketQueue
 
     if ((pl->size_current + len) > pl->size_limit || rotate) {
         if (PcapLogRotateFile(t,pl) < 0) {
-            PcapLogUnlock(pl);
             SCLogDebug("rotation of pcap failed");
             return TM_ECODE_FAILED;
         }
@@ -401,15 +619,22 @@ static TmEcode PcapLog (ThreadVars *t, Packet *p, void *thread_data, PacketQueue
 
     /* XXX pcap handles, nfq, pfring, can only have one link type ipfw? we do
      * this here as we don't know the link type until we get our first packet */
-    if (pl->pcap_dead_handle == NULL || pl->pcap_dumper == NULL) {
+    if (pl->use_mmap ? pl->map == NULL :
+            (pl->pcap_dead_handle == NULL || pl->pcap_dumper == NULL)) {
         if (PcapLogOpenHandles(pl, p) != TM_ECODE_OK) {
-            PcapLogUnlock(pl);
             return TM_ECODE_FAILED;
         }
     }
 
     PCAPLOG_PROFILE_START;
-    pcap_dump((u_char *)pl->pcap_dumper, pl->h, GET_PKT_DATA(p));
+    if (pl->index)
+        PcapLogWriteIndex(pl, p->flow, data_len);
+#ifdef HAVE_SYS_MMAN_H
+    if (pl->use_mmap)
+        PcapLogWriteMapped(pl, ts, data, data_len);
+    else
+#endif
+    pcap_dump((u_char *)pl->pcap_dumper, pl->h, data);
     pl->size_current += len;
     PCAPLOG_PROFILE_END(pl->profile_write);
     pl->profile_data_size += len;
@@ -417,10 +642,170 @@ static TmEcode PcapLog (ThreadVars *t, Packet *p, void *thread_data, PacketQueue
     SCLogDebug("pl->size_current %"PRIu64",  pl->size_limit %"PRIu64,
                pl->size_current, pl->size_limit);
 
-    PcapLogUnlock(pl);
     return TM_ECODE_OK;
 }
 
+static TmEcode PcapLogWritePacket(ThreadVars *t, PcapLogData *pl, const Packet *p)
+{
+    PcapLogLock(pl);
+    TmEcode r = PcapLogWrite(t, pl, p, &p->ts, GET_PKT_DATA(p), GET_PKT_LEN(p));
+    PcapLogUnlock(pl);
+    return r;
+}
+
+static PcapLogFlowData *PcapLogFlowDataAlloc(uint32_t slots)
+{
+    PcapLogFlowData *fd = SCCalloc(1, sizeof(*fd) + slots * sizeof(fd->pkts[0]));
+    if (unlikely(fd == NULL))
+        return NULL;
+    fd->slots = slots;
+    return fd;
+}
+
+/** \internal
+ *  \brief free the copied packets, keeping the flow's alert state */
+static void PcapLogFlowDataClear(PcapLogFlowData *fd)
+{
+    uint32_t i;
+    for (i = 0; i < fd->slots; i++) {
+        if (fd->pkts[i].data != NULL)
+            SCFree(fd->pkts[i].data);
+        fd->pkts[i].data = NULL;
+        fd->pkts[i].size = 0;
+    }
+    fd->first = fd->cnt = fd->bytes = 0;
+}
+
+static void PcapLogFlowDataFree(void *ptr)
+{
+    PcapLogFlowData *fd = ptr;
+    PcapLogFlowDataClear(fd);
+    SCFree(fd);
+}
+
+/** \internal
+ *  \brief copy 'p' into the flow's lookback, dropping the oldest packets
+ *         to stay within lookback-packets and lookback-bytes */
+static void PcapLogFlowDataAdd(const PcapLogData *pl, PcapLogFlowData *fd,
+        const Packet *p)
+{
+    uint32_t len = GET_PKT_LEN(p);
+
+    if (fd->slots == 0 || len > pl->lookback_bytes)
+        return;
+
+    while (fd->cnt > 0 && (fd->cnt == fd->slots ||
+                fd->bytes + len > pl->lookback_bytes)) {
+        fd->bytes -= fd->pkts[fd->first].len;
+        fd->first = (fd->first + 1) % fd->slots;
+        fd->cnt--;
+    }
+
+    PcapLogFlowPacket *fp = &fd->pkts[(fd->first + fd->cnt) % fd->slots];
+    if (fp->size < len) {
+        uint8_t *data = SCRealloc(fp->data, len);
+        if (unlikely(data == NULL))
+            return;
+        fp->data = data;
+        fp->size = len;
+    }
+    memcpy(fp->data, GET_PKT_DATA(p), len);
+    fp->ts = p->ts;
+    fp->len = len;
+    fd->bytes += len;
+    fd->cnt++;
+}
+
+/** \internal
+ *  \brief conditional mode: hold packets back per flow, and write them
+ *         out once an alert fires on the flow */
+static TmEcode PcapLogConditional(ThreadVars *t, PcapLogData *pl, Packet *p)
+{
+    TmEcode r = TM_ECODE_OK;
+
+    if (p->flow == NULL) {
+        /* no flow to hold packets for, only the alert itself */
+        if (p->alerts.cnt > 0)
+            r = PcapLogWritePacket(t, pl, p);
+        return r;
+    }
+
+    Flow *f = p->flow;
+    FLOWLOCK_WRLOCK(f);
+
+    PcapLogFlowData *fd = FlowGetStorageById(f, pcap_log_flow_id);
+    if (fd == NULL) {
+        fd = PcapLogFlowDataAlloc(pl->lookback_packets);
+        if (fd == NULL) {
+            FLOWLOCK_UNLOCK(f);
+            return TM_ECODE_OK;
+        }
+        FlowSetStorageById(f, pcap_log_flow_id, fd);
+    }
+
+    if (fd->alerted) {
+        if (pl->post_alert_packets == 0 || fd->logged < pl->post_alert_packets) {
+            fd->logged++;
+            r = PcapLogWritePacket(t, pl, p);
+        }
+    } else if (p->alerts.cnt > 0) {
+        fd->alerted = 1;
+
+        PcapLogLock(pl);
+        uint32_t i;
+        for (i = 0; i < fd->cnt && r == TM_ECODE_OK; i++) {
+            PcapLogFlowPacket *fp = &fd->pkts[(fd->first + i) % fd->slots];
+            if (pl->lookback_secs > 0 &&
+                    p->ts.tv_sec - fp->ts.tv_sec > (time_t)pl->lookback_secs)
+                continue;
+            r = PcapLogWrite(t, pl, p, &fp->ts, fp->data, fp->len);
+        }
+        if (r == TM_ECODE_OK)
+            r = PcapLogWrite(t, pl, p, &p->ts, GET_PKT_DATA(p), GET_PKT_LEN(p));
+        PcapLogUnlock(pl);
+
+        PcapLogFlowDataClear(fd);
+    } else {
+        PcapLogFlowDataAdd(pl, fd, p);
+    }
+
+    FLOWLOCK_UNLOCK(f);
+    return r;
+}
+
+/**
+ * \brief Pcap logging main function
+ *
+ * \param t threadvar
+ * \param p packet
+ * \param data thread module specific data
+ * \param pq pre-packet-queue
+ * \param postpq post-packet-queue
+ *
+ * \retval TM_ECODE_OK on succes
+ * \retval TM_ECODE_FAILED on serious error
+ */
+static TmEcode PcapLog (ThreadVars *t, Packet *p, void *thread_data, PacketQueue *pq,
+                 PacketQueue *postpq)
+{
+    PcapLogThreadData *td = (PcapLogThreadData *)thread_data;
+    PcapLogData *pl = td->pcap_log;
+
+    if ((p->flags & PKT_PSEUDO_STREAM_END) ||
+        ((p->flags & PKT_STREAM_NOPCAPLOG) &&
+         (pl->use_stream_depth == USE_STREAM_DEPTH_ENABLED)) ||
+        (IS_TUNNEL_PKT(p) && !IS_TUNNEL_ROOT_PKT(p)) ||
+        (pl->honor_pass_rules && (p->flags & PKT_NOPACKET_INSPECTION)))
+    {
+        return TM_ECODE_OK;
+    }
+
+    if (pl->conditional)
+        return PcapLogConditional(t, pl, p);
+
+    return PcapLogWritePacket(t, pl, p);
+}
+
 static PcapLogData *PcapLogDataCopy(const PcapLogData *pl)
 {
     BUG_ON(pl->mode != LOGMODE_MULTI);
@@ -450,6 +835,16 @@ static PcapLogData *PcapLogDataCopy(const PcapLogData *pl)
     copy->timestamp_format = pl->timestamp_format;
     copy->use_stream_depth = pl->use_stream_depth;
     copy->size_limit = pl->size_limit;
+    copy->compress = pl->compress;
+    copy->compress_level = pl->compress_level;
+    copy->use_mmap = pl->use_mmap;
+    copy->map_fd = -1;
+    copy->index = pl->index;
+    copy->conditional = pl->conditional;
+    copy->lookback_packets = pl->lookback_packets;
+    copy->lookback_bytes = pl->lookback_bytes;
+    copy->lookback_secs = pl->lookback_secs;
+    copy->post_alert_packets = pl->post_alert_packets;
 
     TAILQ_INIT(&copy->pcap_file_list);
     SCMutexInit(&copy->plog_lock, NULL);
@@ -553,7 +948,7 @@ static TmEcode PcapLogDataDeinit(ThreadVars *t, void *thread_data)
     PcapLogThreadData *td = (PcapLogThreadData *)thread_data;
     PcapLogData *pl = td->pcap_log;
 
-    if (pl->pcap_dumper != NULL) {
+    if (pl->pcap_dumper != NULL || pl->map != NULL) {
         if (PcapLogCloseFile(t,pl) < 0) {
             SCLogDebug("PcapLogCloseFile failed");
         }
@@ -869,6 +1264,95 @@ static OutputCtx *PcapLogInitCtx(ConfNode *conf)
         }
     }
 
+    /* the limit stays on the uncompressed size */
+    if (conf != NULL) { /* To faciliate unit tests. */
+        pl->compress = LogFileParseCompression(conf, &pl->compress_level);
+        if (pl->compress < 0)
+            exit(EXIT_FAILURE);
+    }
+
+    const char *use_mmap = NULL;
+    if (conf != NULL) { /* To faciliate unit tests. */
+        use_mmap = ConfNodeLookupChildValue(conf, "mmap");
+    }
+    if (use_mmap != NULL && ConfValIsTrue(use_mmap)) {
+#ifndef HAVE_SYS_MMAN_H
+        SCLogError(SC_ERR_INVALID_ARGUMENT,
+            "log-pcap mmap is not supported on this platform");
+        exit(EXIT_FAILURE);
+#endif
+        /* each thread maps its own files, so no lock is taken */
+        if (pl->mode != LOGMODE_MULTI || pl->compress) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap mmap needs mode multi and no compression");
+            exit(EXIT_FAILURE);
+        }
+        pl->use_mmap = 1;
+        pl->map_fd = -1;
+    }
+
+    const char *index = NULL;
+    if (conf != NULL) { /* To faciliate unit tests. */
+        index = ConfNodeLookupChildValue(conf, "index");
+    }
+    if (index != NULL && ConfValIsTrue(index)) {
+        if (pl->compress) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap index needs uncompressed files");
+            exit(EXIT_FAILURE);
+        }
+        pl->index = 1;
+    }
+
+    /* conditional: alerts, only log the flows alerts fire on, with the
+     * packets seen before the alert */
+    const char *conditional = NULL;
+    if (conf != NULL) { /* To faciliate unit tests. */
+        conditional = ConfNodeLookupChildValue(conf, "conditional");
+    }
+    if (conditional != NULL && strcasecmp(conditional, "all") != 0) {
+        if (strcasecmp(conditional, "alerts") != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap conditional \"%s\" is invalid, expected \"all\" "
+                "or \"alerts\"", conditional);
+            exit(EXIT_FAILURE);
+        }
+        pl->conditional = 1;
+        pl->lookback_packets = DEFAULT_LOOKBACK_PACKETS;
+        pl->lookback_bytes = DEFAULT_LOOKBACK_BYTES;
+
+        const char *val = ConfNodeLookupChildValue(conf, "lookback-packets");
+        if (val != NULL && ByteExtractStringUint32(&pl->lookback_packets,
+                    10, 0, val) <= 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap lookback-packets \"%s\" is invalid", val);
+            exit(EXIT_FAILURE);
+        }
+        val = ConfNodeLookupChildValue(conf, "lookback-bytes");
+        if (val != NULL && ParseSizeStringU32(val, &pl->lookback_bytes) < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap lookback-bytes \"%s\" is invalid", val);
+            exit(EXIT_FAILURE);
+        }
+        val = ConfNodeLookupChildValue(conf, "lookback-secs");
+        if (val != NULL && ByteExtractStringUint32(&pl->lookback_secs,
+                    10, 0, val) <= 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap lookback-secs \"%s\" is invalid", val);
+            exit(EXIT_FAILURE);
+        }
+        val = ConfNodeLookupChildValue(conf, "post-alert-packets");
+        if (val != NULL && ByteExtractStringUint32(&pl->post_alert_packets,
+                    10, 0, val) <= 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap post-alert-packets \"%s\" is invalid", val);
+            exit(EXIT_FAILURE);
+        }
+        SCLogInfo("pcap-log: only logging flows with alerts, holding back "
+                "%"PRIu32" packets (%"PRIu32" bytes) per flow",
+                pl->lookback_packets, pl->lookback_bytes);
+    }
+
     /* create the output ctx and send it back */
 
     OutputCtx *output_ctx = SCCalloc(1, sizeof(OutputCtx));
@@ -1032,6 +1516,9 @@ static int PcapLogOpenFileCtx(PcapLogData *pl)
         SCLogDebug("multi-mode: filename %s", filename);
     }
 
+    if (pl->compress)
+        strlcat(filename, ".gz", PATH_MAX);
+
     if ((pf->filename = SCStrdup(pl->filename)) == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory. For filename");
         goto error;
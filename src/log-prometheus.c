@@ -0,0 +1,592 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Stats in the OpenMetrics (Prometheus) text format, served over HTTP
+ * at /metrics.
+ *
+ * The stats thread renders the merged stats table each interval. A
+ * server thread of this logger answers the scrapes with the last
+ * rendering, so scrapes never reach the counters and workers are not
+ * affected by them.
+ */
+
+#include "suricata-common.h"
+#include "debug.h"
+#include "conf.h"
+
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+
+#include "util-unittest.h"
+#include "util-debug.h"
+#include "util-buffer.h"
+
+#include "output.h"
+#include "counters.h"
+#include "detect-engine-tenant.h"
+#include "log-prometheus.h"
+
+#define MODULE_NAME "LogPrometheusLog"
+
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_PORT    "9917"
+
+#define PROMETHEUS_BUFFER_SIZE 65536
+/** poll timeout of the server thread, bounds the time shutdown waits */
+#define PROMETHEUS_POLL_MS 500
+/** time a client gets to send its request and to read the reply */
+#define PROMETHEUS_CLIENT_TIMEOUT 2
+
+#define PROMETHEUS_CONTENT_TYPE \
+    "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+typedef struct LogPrometheusCtx_ {
+    int sock;
+
+    /** last rendering, handed out to scrapes */
+    SCMutex m;
+    char *text;
+    uint32_t text_len;
+
+    /** rendering buffer, only used by the stats thread */
+    MemBuffer *buffer;
+
+    SC_ATOMIC_DECLARE(unsigned int, stop);
+    pthread_t thread;
+} LogPrometheusCtx;
+
+typedef struct LogPrometheusThread_ {
+    LogPrometheusCtx *ctx;
+} LogPrometheusThread;
+
+/** \internal
+ *  \brief append to the rendering, growing the buffer as needed
+ *  \retval 0 ok, -1 out of memory */
+static int LogPrometheusPrintf(MemBuffer **buffer, const char *fmt, ...)
+{
+    char line[512];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return -1;
+    if ((size_t)len >= sizeof(line))
+        len = sizeof(line) - 1;
+
+    if (MEMBUFFER_OFFSET(*buffer) + len + 1 > MEMBUFFER_SIZE(*buffer)) {
+        uint32_t expand_by = MEMBUFFER_SIZE(*buffer);
+        if (expand_by < (uint32_t)len + 1)
+            expand_by = len + 1;
+        if (MemBufferExpand(buffer, expand_by) < 0)
+            return -1;
+    }
+    MemBufferWriteRaw((*buffer), line, (uint32_t)len);
+    return 0;
+}
+
+/** \internal
+ *  \brief metric name for the first 'len' chars of counter 'name':
+ *         "suricata_" and the name with everything but [a-zA-Z0-9_]
+ *         replaced by '_' */
+static void LogPrometheusMetricName(const char *name, size_t len,
+        char *out, size_t out_size)
+{
+    size_t o = strlcpy(out, "suricata_", out_size);
+    size_t i;
+    for (i = 0; i < len && name[i] != '\0' && o + 1 < out_size; i++, o++) {
+        char c = name[i];
+        out[o] = (isalnum((unsigned char)c) || c == '_') ? c : '_';
+    }
+    out[o] = '\0';
+}
+
+/** \internal
+ *  \brief render the histogram whose first bucket is st->stats[u]
+ *
+ *  Buckets are kept per range in the counters, OpenMetrics wants them
+ *  cumulative. */
+static int LogPrometheusHistogram(MemBuffer **buffer, const StatsTable *st,
+        uint32_t u, size_t base_len)
+{
+    const char *base = st->stats[u].name;
+    uint64_t vals[STATS_HISTOGRAM_COUNTERS];
+    char metric[256];
+    uint32_t v;
+    int i;
+
+    memset(vals, 0, sizeof(vals));
+    for (v = u; v < st->nstats; v++) {
+        const char *name = st->stats[v].name;
+        if (name == NULL || strncmp(name, base, base_len) != 0 ||
+                name[base_len] != '.')
+            continue;
+        size_t len = 0;
+        int idx = StatsHistogramCounterIndex(name, &len);
+        if (idx >= 0 && len == base_len)
+            vals[idx] = st->stats[v].value;
+    }
+
+    LogPrometheusMetricName(base, base_len, metric, sizeof(metric));
+    if (LogPrometheusPrintf(buffer, "# TYPE %s histogram\n", metric) < 0)
+        return -1;
+
+    uint64_t count = 0;
+    for (i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        count += vals[i];
+        if (LogPrometheusPrintf(buffer, "%s_bucket{le=\"%"PRIu64"\"} %"PRIu64"\n",
+                    metric, (uint64_t)1 << i, count) < 0)
+            return -1;
+    }
+    count += vals[STATS_HISTOGRAM_BUCKETS];
+    if (LogPrometheusPrintf(buffer, "%s_bucket{le=\"+Inf\"} %"PRIu64"\n"
+                "%s_count %"PRIu64"\n%s_sum %"PRIu64"\n",
+                metric, count, metric, count, metric,
+                vals[STATS_HISTOGRAM_BUCKETS + 1]) < 0)
+        return -1;
+    return 0;
+}
+
+/** \internal
+ *  \brief render the per tenant accounting, a metric per count with the
+ *         tenant as label */
+static int LogPrometheusTenants(MemBuffer **buffer)
+{
+    static const struct {
+        const char *name;
+        size_t offset;
+    } metrics[] = {
+        { "packets", offsetof(DetectTenantStats, c.packets) },
+        { "alerts", offsetof(DetectTenantStats, c.alerts) },
+        { "mpm_matches", offsetof(DetectTenantStats, c.mpm_matches) },
+        { "ticks", offsetof(DetectTenantStats, ticks_estimate) },
+        { "engine_memuse", offsetof(DetectTenantStats, engine_memuse) },
+        { "thread_memuse", offsetof(DetectTenantStats, thread_memuse) },
+    };
+    DetectTenantStats *s;
+    uint32_t n = DetectTenantGetStats(&s);
+    uint32_t i, x;
+    int r = 0;
+
+    if (n == 0)
+        return 0;
+
+    for (x = 0; x < sizeof(metrics) / sizeof(metrics[0]) && r == 0; x++) {
+        r = LogPrometheusPrintf(buffer, "# TYPE suricata_tenant_%s unknown\n",
+                metrics[x].name);
+        for (i = 0; i < n && r == 0; i++) {
+            uint64_t v;
+            memcpy(&v, (const uint8_t *)&s[i] + metrics[x].offset, sizeof(v));
+            r = LogPrometheusPrintf(buffer, "suricata_tenant_%s{tenant=\"%u\"} "
+                    "%"PRIu64"\n", metrics[x].name, s[i].tenant_id, v);
+        }
+    }
+
+    SCFree(s);
+    return r;
+}
+
+/** \internal
+ *  \brief render the totals of 'st' into 'buffer' */
+static int LogPrometheusRender(MemBuffer **buffer, const StatsTable *st)
+{
+    char metric[256];
+    uint32_t u;
+
+    if (LogPrometheusPrintf(buffer, "# TYPE suricata_uptime_seconds gauge\n"
+                "suricata_uptime_seconds %d\n",
+                (int)difftime(st->ts.tv_sec, st->start_time)) < 0)
+        return -1;
+
+    for (u = 0; u < st->nstats; u++) {
+        const char *name = st->stats[u].name;
+        if (name == NULL)
+            continue;
+
+        size_t base_len = 0;
+        int idx = StatsHistogramCounterIndex(name, &base_len);
+        if (idx == 0) {
+            if (LogPrometheusHistogram(buffer, st, u, base_len) < 0)
+                return -1;
+            continue;
+        } else if (idx > 0) {
+            /* rendered with the first bucket */
+            continue;
+        }
+
+        /* counters don't tell if they only go up, so leave the type
+         * to the reader */
+        LogPrometheusMetricName(name, strlen(name), metric, sizeof(metric));
+        if (LogPrometheusPrintf(buffer, "# TYPE %s unknown\n%s %"PRIu64"\n",
+                    metric, metric, st->stats[u].value) < 0)
+            return -1;
+    }
+
+    if (LogPrometheusTenants(buffer) < 0)
+        return -1;
+
+    return LogPrometheusPrintf(buffer, "# EOF\n");
+}
+
+static int LogPrometheusLogger(ThreadVars *tv, void *thread_data,
+        const StatsTable *st)
+{
+    LogPrometheusThread *aft = (LogPrometheusThread *)thread_data;
+    LogPrometheusCtx *ctx = aft->ctx;
+
+    MemBufferReset(ctx->buffer);
+    if (LogPrometheusRender(&ctx->buffer, st) < 0) {
+        SCLogDebug("out of memory rendering the stats");
+        return 0;
+    }
+
+    char *text = SCMalloc(MEMBUFFER_OFFSET(ctx->buffer) + 1);
+    if (unlikely(text == NULL))
+        return 0;
+    memcpy(text, MEMBUFFER_BUFFER(ctx->buffer), MEMBUFFER_OFFSET(ctx->buffer));
+    text[MEMBUFFER_OFFSET(ctx->buffer)] = '\0';
+
+    SCMutexLock(&ctx->m);
+    char *old = ctx->text;
+    ctx->text = text;
+    ctx->text_len = MEMBUFFER_OFFSET(ctx->buffer);
+    SCMutexUnlock(&ctx->m);
+
+    if (old != NULL)
+        SCFree(old);
+    return 0;
+}
+
+/** \internal
+ *  \brief send all of 'buf' or give up */
+static int LogPrometheusSend(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t r = send(fd, buf, len, MSG_NOSIGNAL);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += r;
+        len -= r;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief answer the request on 'fd' */
+static void LogPrometheusServe(LogPrometheusCtx *ctx, int fd)
+{
+    struct timeval tv = { PROMETHEUS_CLIENT_TIMEOUT, 0 };
+    char req[1024];
+    char hdr[256];
+    size_t len = 0;
+
+    (void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    (void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    /* the request line is all we look at */
+    req[0] = '\0';
+    while (len < sizeof(req) - 1 && strchr(req, '\n') == NULL) {
+        ssize_t r = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        len += r;
+        req[len] = '\0';
+    }
+
+    if (strncmp(req, "GET ", 4) != 0) {
+        const char *reply = "HTTP/1.0 405 Method Not Allowed\r\n"
+            "Allow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        (void)LogPrometheusSend(fd, reply, strlen(reply));
+        return;
+    }
+    if (strncmp(req + 4, "/metrics", 8) != 0 ||
+            (req[12] != ' ' && req[12] != '?' && req[12] != '\r')) {
+        const char *reply = "HTTP/1.0 404 Not Found\r\n"
+            "Content-Length: 0\r\nConnection: close\r\n\r\n";
+        (void)LogPrometheusSend(fd, reply, strlen(reply));
+        return;
+    }
+
+    /* copy, so that a slow client doesn't hold up the stats thread */
+    char *text = NULL;
+    uint32_t text_len = 0;
+    SCMutexLock(&ctx->m);
+    if (ctx->text != NULL) {
+        text = SCMalloc(ctx->text_len);
+        if (text != NULL) {
+            memcpy(text, ctx->text, ctx->text_len);
+            text_len = ctx->text_len;
+        }
+    }
+    SCMutexUnlock(&ctx->m);
+
+    if (text == NULL) {
+        const char *reply = "HTTP/1.0 503 Service Unavailable\r\n"
+            "Content-Length: 0\r\nConnection: close\r\n\r\n";
+        (void)LogPrometheusSend(fd, reply, strlen(reply));
+        return;
+    }
+
+    snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\n"
+            "Content-Length: %"PRIu32"\r\nConnection: close\r\n\r\n",
+            PROMETHEUS_CONTENT_TYPE, text_len);
+    if (LogPrometheusSend(fd, hdr, strlen(hdr)) == 0)
+        (void)LogPrometheusSend(fd, text, text_len);
+    SCFree(text);
+}
+
+static void *LogPrometheusServer(void *arg)
+{
+    LogPrometheusCtx *ctx = (LogPrometheusCtx *)arg;
+    struct pollfd pfd = { ctx->sock, POLLIN, 0 };
+
+    while (SC_ATOMIC_GET(ctx->stop) == 0) {
+        int r = poll(&pfd, 1, PROMETHEUS_POLL_MS);
+        if (r <= 0)
+            continue;
+
+        int fd = accept(ctx->sock, NULL, NULL);
+        if (fd < 0)
+            continue;
+        LogPrometheusServe(ctx, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/** \internal
+ *  \brief open the listening socket
+ *  \retval fd or -1 on error */
+static int LogPrometheusListen(const char *address, const char *port)
+{
+    struct addrinfo hints, *res = NULL, *ai;
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    int r = getaddrinfo(address, port, &hints, &res);
+    if (r != 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "prometheus: invalid address "
+                "%s port %s: %s", address, port, gai_strerror(r));
+        return -1;
+    }
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        int on = 1;
+        (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+                listen(fd, 16) == 0)
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+        SCLogError(SC_ERR_SOCKET, "prometheus: can't listen on %s port %s: %s",
+                address, port, strerror(errno));
+    }
+    return fd;
+}
+
+static TmEcode LogPrometheusThreadInit(ThreadVars *t, void *initdata, void **data)
+{
+    if (initdata == NULL) {
+        SCLogDebug("Error getting context for prometheus. \"initdata\" argument NULL");
+        return TM_ECODE_FAILED;
+    }
+
+    LogPrometheusThread *aft = SCCalloc(1, sizeof(LogPrometheusThread));
+    if (unlikely(aft == NULL))
+        return TM_ECODE_FAILED;
+
+    aft->ctx = ((OutputCtx *)initdata)->data;
+    *data = (void *)aft;
+    return TM_ECODE_OK;
+}
+
+static TmEcode LogPrometheusThreadDeinit(ThreadVars *t, void *data)
+{
+    LogPrometheusThread *aft = (LogPrometheusThread *)data;
+    if (aft == NULL) {
+        return TM_ECODE_OK;
+    }
+
+    SCFree(aft);
+    return TM_ECODE_OK;
+}
+
+static void LogPrometheusDeInitCtx(OutputCtx *output_ctx)
+{
+    LogPrometheusCtx *ctx = (LogPrometheusCtx *)output_ctx->data;
+
+    SC_ATOMIC_SET(ctx->stop, 1);
+    pthread_join(ctx->thread, NULL);
+    close(ctx->sock);
+
+    SCMutexDestroy(&ctx->m);
+    if (ctx->text != NULL)
+        SCFree(ctx->text);
+    MemBufferFree(ctx->buffer);
+    SCFree(ctx);
+    SCFree(output_ctx);
+}
+
+/** \brief set up the metrics endpoint
+ *  \param conf Pointer to ConfNode containing this loggers configuration.
+ *  \return NULL if failure, OutputCtx* if succesful
+ * */
+static OutputCtx *LogPrometheusInitCtx(ConfNode *conf)
+{
+    const char *address = DEFAULT_ADDRESS;
+    const char *port = DEFAULT_PORT;
+
+    if (conf != NULL) {
+        const char *val = ConfNodeLookupChildValue(conf, "address");
+        if (val != NULL)
+            address = val;
+        val = ConfNodeLookupChildValue(conf, "port");
+        if (val != NULL)
+            port = val;
+    }
+
+    LogPrometheusCtx *ctx = SCCalloc(1, sizeof(LogPrometheusCtx));
+    if (unlikely(ctx == NULL))
+        return NULL;
+
+    ctx->buffer = MemBufferCreateNew(PROMETHEUS_BUFFER_SIZE);
+    if (ctx->buffer == NULL) {
+        SCFree(ctx);
+        return NULL;
+    }
+
+    OutputCtx *output_ctx = SCCalloc(1, sizeof(OutputCtx));
+    if (unlikely(output_ctx == NULL)) {
+        MemBufferFree(ctx->buffer);
+        SCFree(ctx);
+        return NULL;
+    }
+
+    ctx->sock = LogPrometheusListen(address, port);
+    if (ctx->sock < 0) {
+        MemBufferFree(ctx->buffer);
+        SCFree(ctx);
+        SCFree(output_ctx);
+        return NULL;
+    }
+
+    SCMutexInit(&ctx->m, NULL);
+    SC_ATOMIC_INIT(ctx->stop);
+    if (pthread_create(&ctx->thread, NULL, LogPrometheusServer, ctx) != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "prometheus: can't create the "
+                "server thread");
+        close(ctx->sock);
+        SCMutexDestroy(&ctx->m);
+        MemBufferFree(ctx->buffer);
+        SCFree(ctx);
+        SCFree(output_ctx);
+        return NULL;
+    }
+
+    output_ctx->data = ctx;
+    output_ctx->DeInit = LogPrometheusDeInitCtx;
+
+    SCLogInfo("prometheus metrics on http://%s:%s/metrics", address, port);
+    return output_ctx;
+}
+
+#ifdef UNITTESTS
+static int LogPrometheusTest01(void)
+{
+    StatsRecord stats[3];
+    StatsTable st;
+    ThreadVars tv;
+
+    memset(stats, 0, sizeof(stats));
+    memset(&st, 0, sizeof(st));
+    memset(&tv, 0, sizeof(tv));
+
+    uint16_t id = StatsRegisterHistogramCounter("tt.lat", &tv);
+    FAIL_IF(id == 0);
+
+    stats[0].name = "decoder.pkts";
+    stats[0].value = 10;
+    stats[1].name = "tt.lat.bucket.1";
+    stats[1].value = 2;
+    stats[2].name = "tt.lat.bucket.4";
+    stats[2].value = 3;
+    st.stats = stats;
+    st.nstats = 3;
+
+    MemBuffer *buffer = MemBufferCreateNew(64);
+    FAIL_IF_NULL(buffer);
+    FAIL_IF(LogPrometheusRender(&buffer, &st) < 0);
+
+    const char *text = (const char *)MEMBUFFER_BUFFER(buffer);
+    FAIL_IF_NULL(strstr(text, "# TYPE suricata_decoder_pkts unknown\n"
+                "suricata_decoder_pkts 10\n"));
+    FAIL_IF_NULL(strstr(text, "# TYPE suricata_tt_lat histogram\n"));
+    FAIL_IF_NULL(strstr(text, "suricata_tt_lat_bucket{le=\"2\"} 2\n"));
+    FAIL_IF_NULL(strstr(text, "suricata_tt_lat_bucket{le=\"4\"} 5\n"));
+    FAIL_IF_NULL(strstr(text, "suricata_tt_lat_bucket{le=\"+Inf\"} 5\n"
+                "suricata_tt_lat_count 5\nsuricata_tt_lat_sum 0\n"));
+    FAIL_IF_NOT_NULL(strstr(text, "suricata_tt_lat_bucket_"));
+    FAIL_IF(strcmp(text + MEMBUFFER_OFFSET(buffer) - 6, "# EOF\n") != 0);
+
+    MemBufferFree(buffer);
+    StatsThreadCleanup(&tv);
+    PASS;
+}
+#endif
+
+static void LogPrometheusRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LogPrometheusTest01", LogPrometheusTest01);
+#endif
+}
+
+void TmModuleLogPrometheusRegister(void)
+{
+    tmm_modules[TMM_LOGPROMETHEUS].name = MODULE_NAME;
+    tmm_modules[TMM_LOGPROMETHEUS].ThreadInit = LogPrometheusThreadInit;
+    tmm_modules[TMM_LOGPROMETHEUS].ThreadDeinit = LogPrometheusThreadDeinit;
+    tmm_modules[TMM_LOGPROMETHEUS].RegisterTests = LogPrometheusRegisterTests;
+    tmm_modules[TMM_LOGPROMETHEUS].cap_flags = 0;
+    tmm_modules[TMM_LOGPROMETHEUS].flags = TM_FLAG_LOGAPI_TM;
+
+    OutputRegisterStatsModule(MODULE_NAME, "prometheus", LogPrometheusInitCtx,
+            LogPrometheusLogger);
+}
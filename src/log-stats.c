@@ -156,7 +156,7 @@ int LogStatsLogger(ThreadVars *tv, void *thread_data, const StatsTable *st)
         }
     }
 
-    SCMutexLock(&aft->statslog_ctx->file_ctx->fp_mutex);
+    SCMutexLockCounted(&aft->statslog_ctx->file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
     aft->statslog_ctx->file_ctx->Write((const char *)MEMBUFFER_BUFFER(aft->buffer),
         MEMBUFFER_OFFSET(aft->buffer), aft->statslog_ctx->file_ctx);
     SCMutexUnlock(&aft->statslog_ctx->file_ctx->fp_mutex);
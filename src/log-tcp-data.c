@@ -46,6 +46,8 @@
 
 #include "util-logopenfile.h"
 #include "util-time.h"
+#include "util-misc.h"
+#include "counters.h"
 
 #define DEFAULT_LOG_FILENAME "tcp-data.log"
 
@@ -75,14 +77,208 @@ void TmModuleLogTcpDataLogRegister (void) {
             LogTcpDataLogger, STREAMING_HTTP_BODIES);
 }
 
+/** bytes queued for the writer thread by default */
+#define LOGTCPDATA_QUEUE_SIZE   (64 * 1024 * 1024)
+
+/** chunk handed to the writer thread */
+typedef struct LogTcpDataRecord_ {
+    struct LogTcpDataRecord_ *next;
+    /** dir mode: file to write to, NULL for the log file */
+    char *path;
+    /** dir mode: start the file over */
+    int truncate;
+    uint32_t len;
+    uint8_t data[];
+} LogTcpDataRecord;
+
 typedef struct LogTcpDataFileCtx_ {
     LogFileCtx *file_ctx;
     enum OutputStreamingType type;
     const char *log_dir;
     int file;
     int dir;
+
+    /** async: a writer thread does the file io, fed through a queue
+     *  of at most queue_max bytes */
+    int async;
+    int stop;
+    uint64_t queue_max;
+    uint64_t queue_bytes;
+    LogTcpDataRecord *queue_head;
+    LogTcpDataRecord *queue_tail;
+    SCMutex queue_mutex;
+    SCCondT queue_cond;
+    pthread_t writer;
 } LogTcpDataFileCtx;
 
+/* flows cut off as the writer thread couldn't keep up */
+SC_ATOMIC_DECLARE(uint64_t, tcp_data_flows_stopped);
+
+static uint64_t LogTcpDataFlowsStoppedCounter(void)
+{
+    return SC_ATOMIC_GET(tcp_data_flows_stopped);
+}
+
+static void LogTcpDataWriteRecord(LogTcpDataFileCtx *td, const LogTcpDataRecord *r)
+{
+    if (r->path != NULL) {
+        FILE *fp = fopen(r->path, r->truncate ? "w" : "a");
+        if (fp == NULL) {
+            SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", r->path,
+                    strerror(errno));
+            return;
+        }
+        fwrite(r->data, r->len, 1, fp);
+        fclose(fp);
+    } else {
+        SCMutexLockCounted(&td->file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
+        td->file_ctx->Write((const char *)r->data, r->len, td->file_ctx);
+        SCMutexUnlock(&td->file_ctx->fp_mutex);
+    }
+}
+
+static void *LogTcpDataWriter(void *arg)
+{
+    LogTcpDataFileCtx *td = (LogTcpDataFileCtx *)arg;
+
+    while (1) {
+        SCMutexLock(&td->queue_mutex);
+        while (td->queue_head == NULL && !td->stop) {
+            SCCondWait(&td->queue_cond, &td->queue_mutex);
+        }
+        /* take the whole list, the producers start a new one */
+        LogTcpDataRecord *r = td->queue_head;
+        td->queue_head = td->queue_tail = NULL;
+        SCMutexUnlock(&td->queue_mutex);
+
+        if (r == NULL)
+            break;
+
+        while (r != NULL) {
+            LogTcpDataRecord *next = r->next;
+            LogTcpDataWriteRecord(td, r);
+
+            SCMutexLock(&td->queue_mutex);
+            td->queue_bytes -= r->len;
+            SCMutexUnlock(&td->queue_mutex);
+
+            SCFree(r);
+            r = next;
+        }
+    }
+    return NULL;
+}
+
+/** \internal
+ *  \brief queue a copy of 'data' for the writer thread
+ *
+ *  \retval 0 queued
+ *  \retval OUTPUT_STREAMING_STOP queue is full, stop feeding the flow
+ */
+static int LogTcpDataEnqueue(LogTcpDataFileCtx *td, const char *path,
+        int truncate, const uint8_t *data, uint32_t data_len)
+{
+    size_t path_len = path ? strlen(path) + 1 : 0;
+
+    SCMutexLock(&td->queue_mutex);
+    int full = (td->queue_bytes + data_len > td->queue_max);
+    if (!full)
+        td->queue_bytes += data_len;
+    SCMutexUnlock(&td->queue_mutex);
+
+    if (full) {
+        SC_ATOMIC_ADD(tcp_data_flows_stopped, 1);
+        return OUTPUT_STREAMING_STOP;
+    }
+
+    LogTcpDataRecord *r = SCMalloc(sizeof(*r) + data_len + path_len);
+    if (unlikely(r == NULL)) {
+        SCMutexLock(&td->queue_mutex);
+        td->queue_bytes -= data_len;
+        SCMutexUnlock(&td->queue_mutex);
+        return 0;
+    }
+    r->next = NULL;
+    r->truncate = truncate;
+    r->len = data_len;
+    memcpy(r->data, data, data_len);
+    r->path = NULL;
+    if (path != NULL) {
+        r->path = (char *)r->data + data_len;
+        memcpy(r->path, path, path_len);
+    }
+
+    SCMutexLock(&td->queue_mutex);
+    if (td->queue_tail != NULL)
+        td->queue_tail->next = r;
+    else
+        td->queue_head = r;
+    td->queue_tail = r;
+    SCCondSignal(&td->queue_cond);
+    SCMutexUnlock(&td->queue_mutex);
+    return 0;
+}
+
+/** \internal
+ *  \brief set up the writer thread if 'async' is enabled
+ *  \retval 0 ok, -1 error */
+static int LogTcpDataInitAsync(LogTcpDataFileCtx *td, ConfNode *conf)
+{
+    int async = 0;
+    if (conf == NULL || !ConfGetChildValueBool(conf, "async", &async) || !async)
+        return 0;
+
+    td->queue_max = LOGTCPDATA_QUEUE_SIZE;
+    const char *queue_size = ConfNodeLookupChildValue(conf, "queue-size");
+    if (queue_size != NULL &&
+        (ParseSizeStringU64(queue_size, &td->queue_max) < 0 || td->queue_max == 0))
+    {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s: invalid queue-size %s",
+                conf->name, queue_size);
+        return -1;
+    }
+
+    SCMutexInit(&td->queue_mutex, NULL);
+    SCCondInit(&td->queue_cond, NULL);
+    if (pthread_create(&td->writer, NULL, LogTcpDataWriter, td) != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "%s: unable to start writer thread",
+                conf->name);
+        SCMutexDestroy(&td->queue_mutex);
+        SCCondDestroy(&td->queue_cond);
+        return -1;
+    }
+    td->async = 1;
+
+    static int counters_registered = 0;
+    if (!counters_registered) {
+        StatsRegisterGlobalCounter("tcp_data.flows_stopped",
+                LogTcpDataFlowsStoppedCounter);
+        counters_registered = 1;
+    }
+
+    SCLogInfo("%s: using a writer thread, queue of %"PRIu64" bytes",
+            conf->name, td->queue_max);
+    return 0;
+}
+
+/** \internal
+ *  \brief let the writer thread write out what's queued and stop it */
+static void LogTcpDataDeinitAsync(LogTcpDataFileCtx *td)
+{
+    if (!td->async)
+        return;
+
+    SCMutexLock(&td->queue_mutex);
+    td->stop = 1;
+    SCCondSignal(&td->queue_cond);
+    SCMutexUnlock(&td->queue_mutex);
+    pthread_join(td->writer, NULL);
+
+    SCMutexDestroy(&td->queue_mutex);
+    SCCondDestroy(&td->queue_cond);
+    td->async = 0;
+}
+
 typedef struct LogTcpDataLogThread_ {
     LogTcpDataFileCtx *tcpdatalog_ctx;
     /** LogFileCtx has the pointer to the file and a mutex to allow multithreading */
@@ -96,6 +292,7 @@ static int LogTcpDataLoggerDir(ThreadVars *tv, void *thread_data, const Flow *f,
     LogTcpDataLogThread *aft = thread_data;
     LogTcpDataFileCtx *td = aft->tcpdatalog_ctx;
     char *mode = "a";
+    int r = 0;
 
     if (flags & OUTPUT_STREAMING_FLAG_OPEN)
         mode = "w";
@@ -123,15 +320,20 @@ static int LogTcpDataLoggerDir(ThreadVars *tv, void *thread_data, const Flow *f,
                 srcip, f->sp, dstip, f->dp, tx,
                 flags & OUTPUT_STREAMING_FLAG_TOSERVER ? "ts" : "tc");
 
-        FILE *fp = fopen(name, mode);
-        BUG_ON(fp == NULL);
+        if (td->async) {
+            r = LogTcpDataEnqueue(td, name, (flags & OUTPUT_STREAMING_FLAG_OPEN),
+                    data, data_len);
+        } else {
+            FILE *fp = fopen(name, mode);
+            BUG_ON(fp == NULL);
 
-        // PrintRawDataFp(stdout, (uint8_t *)data, data_len);
-        fwrite(data, data_len, 1, fp);
+            // PrintRawDataFp(stdout, (uint8_t *)data, data_len);
+            fwrite(data, data_len, 1, fp);
 
-        fclose(fp);
+            fclose(fp);
+        }
     }
-    SCReturnInt(TM_ECODE_OK);
+    SCReturnInt(r);
 }
 
 static int LogTcpDataLoggerFile(ThreadVars *tv, void *thread_data, const Flow *f,
@@ -165,7 +367,12 @@ static int LogTcpDataLoggerFile(ThreadVars *tv, void *thread_data, const Flow *f
         PrintRawDataToBuffer(aft->buffer->buffer, &aft->buffer->offset,
                 aft->buffer->size, (uint8_t *)data,data_len);
 
-        SCMutexLock(&td->file_ctx->fp_mutex);
+        if (td->async) {
+            SCReturnInt(LogTcpDataEnqueue(td, NULL, 0, MEMBUFFER_BUFFER(aft->buffer),
+                    MEMBUFFER_OFFSET(aft->buffer)));
+        }
+
+        SCMutexLockCounted(&td->file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
         td->file_ctx->Write((const char *)MEMBUFFER_BUFFER(aft->buffer),
                 MEMBUFFER_OFFSET(aft->buffer), td->file_ctx);
         SCMutexUnlock(&td->file_ctx->fp_mutex);
@@ -179,13 +386,16 @@ int LogTcpDataLogger(ThreadVars *tv, void *thread_data, const Flow *f,
     SCEnter();
     LogTcpDataLogThread *aft = thread_data;
     LogTcpDataFileCtx *td = aft->tcpdatalog_ctx;
+    int r = 0;
 
     if (td->dir == 1)
-        LogTcpDataLoggerDir(tv, thread_data, f, data, data_len, tx_id, flags);
+        r |= LogTcpDataLoggerDir(tv, thread_data, f, data, data_len, tx_id, flags);
     if (td->file == 1)
-        LogTcpDataLoggerFile(tv, thread_data, f, data, data_len, tx_id, flags);
+        r |= LogTcpDataLoggerFile(tv, thread_data, f, data, data_len, tx_id, flags);
 
-    SCReturnInt(TM_ECODE_OK);
+    /* a full queue stops the flow for both, so dir and file modes
+     * don't end up with different cut off points */
+    SCReturnInt(r ? OUTPUT_STREAMING_STOP : TM_ECODE_OK);
 }
 
 TmEcode LogTcpDataLogThreadInit(ThreadVars *t, void *initdata, void **data)
@@ -318,8 +528,12 @@ OutputCtx *LogTcpDataLogInitCtx(ConfNode *conf)
 #endif
     }
 
+    if (LogTcpDataInitAsync(tcpdatalog_ctx, conf) < 0)
+        goto parsererror;
+
     OutputCtx *output_ctx = SCCalloc(1, sizeof(OutputCtx));
     if (unlikely(output_ctx == NULL)) {
+        LogTcpDataDeinitAsync(tcpdatalog_ctx);
         goto parsererror;
     }
 
@@ -340,6 +554,7 @@ parsererror:
 static void LogTcpDataLogDeInitCtx(OutputCtx *output_ctx)
 {
     LogTcpDataFileCtx *tcpdatalog_ctx = (LogTcpDataFileCtx *)output_ctx->data;
+    LogTcpDataDeinitAsync(tcpdatalog_ctx);
     LogFileFreeCtx(tcpdatalog_ctx->file_ctx);
     SCFree(tcpdatalog_ctx);
     SCFree(output_ctx);
@@ -28,7 +28,9 @@
 #include "output-file.h"
 #include "app-layer.h"
 #include "app-layer-parser.h"
+#include "app-layer-htp.h"
 #include "detect-filemagic.h"
+#include "util-magic.h"
 #include "util-profiling.h"
 
 typedef struct OutputLoggerThreadStore_ {
@@ -40,6 +42,9 @@ typedef struct OutputLoggerThreadStore_ {
  *  data for the packet loggers. */
 typedef struct OutputLoggerThreadData_ {
     OutputLoggerThreadStore *store;
+    /** per thread magic ctx for force-magic, so we don't have to take
+     *  the global magic lock */
+    magic_t magic_ctx;
 } OutputLoggerThreadData;
 
 /* logger instance, a module + a output ctx,
@@ -71,6 +76,10 @@ int OutputRegisterFileLogger(const char *name, FileLogger LogFunc, OutputCtx *ou
     op->name = name;
     op->module_id = (TmmId) module_id;
 
+    /* http file tracking is only done for the file loggers and rules */
+    AppLayerHtpNeedFileInspection();
+    AppLayerHtpNeedResponseBodyForOutput();
+
     if (list == NULL)
         list = op;
     else {
@@ -140,7 +149,10 @@ static TmEcode OutputFileLog(ThreadVars *tv, Packet *p, void *thread_data, Packe
                 int file_logged = 0;
 
                 if (FileForceMagic() && ff->magic == NULL) {
-                    FilemagicGlobalLookup(ff);
+                    if (op_thread_data->magic_ctx != NULL)
+                        FilemagicThreadLookup(&op_thread_data->magic_ctx, ff);
+                    else
+                        FilemagicGlobalLookup(ff);
                 }
 
                 logger = list;
@@ -186,6 +198,10 @@ static TmEcode OutputFileLogThreadInit(ThreadVars *tv, void *initdata, void **da
 
     *data = (void *)td;
 
+    /* falls back to the global ctx if this fails */
+    if (FileForceMagic())
+        td->magic_ctx = MagicInitContext();
+
     SCLogDebug("OutputFileLogThreadInit happy (*data %p)", *data);
 
     OutputFileLogger *logger = list;
@@ -250,6 +266,9 @@ static TmEcode OutputFileLogThreadDeinit(ThreadVars *tv, void *thread_data)
         logger = logger->next;
     }
 
+    if (op_thread_data->magic_ctx != NULL)
+        magic_close(op_thread_data->magic_ctx);
+
     SCFree(op_thread_data);
     return TM_ECODE_OK;
 }
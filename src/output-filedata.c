@@ -28,7 +28,9 @@
 #include "output-filedata.h"
 #include "app-layer.h"
 #include "app-layer-parser.h"
+#include "app-layer-htp.h"
 #include "detect-filemagic.h"
+#include "util-magic.h"
 #include "conf.h"
 #include "util-profiling.h"
 
@@ -41,6 +43,9 @@ typedef struct OutputLoggerThreadStore_ {
  *  data for the packet loggers. */
 typedef struct OutputLoggerThreadData_ {
     OutputLoggerThreadStore *store;
+    /** per thread magic ctx for force-magic, so we don't have to take
+     *  the global magic lock */
+    magic_t magic_ctx;
 } OutputLoggerThreadData;
 
 /* logger instance, a module + a output ctx,
@@ -76,6 +81,10 @@ int OutputRegisterFiledataLogger(const char *name, FiledataLogger LogFunc, Outpu
     op->name = name;
     op->module_id = (TmmId) module_id;
 
+    /* http file tracking is only done for the file loggers and rules */
+    AppLayerHtpNeedFileInspection();
+    AppLayerHtpNeedResponseBodyForOutput();
+
     if (list == NULL)
         list = op;
     else {
@@ -157,7 +166,10 @@ static TmEcode OutputFiledataLog(ThreadVars *tv, Packet *p, void *thread_data, P
         File *ff;
         for (ff = ffc->head; ff != NULL; ff = ff->next) {
             if (FileForceMagic() && ff->magic == NULL) {
-                FilemagicGlobalLookup(ff);
+                if (op_thread_data->magic_ctx != NULL)
+                    FilemagicThreadLookup(&op_thread_data->magic_ctx, ff);
+                else
+                    FilemagicGlobalLookup(ff);
             }
 
             SCLogDebug("ff %p", ff);
@@ -295,6 +307,10 @@ static TmEcode OutputFiledataLogThreadInit(ThreadVars *tv, void *initdata, void
 
     *data = (void *)td;
 
+    /* falls back to the global ctx if this fails */
+    if (FileForceMagic())
+        td->magic_ctx = MagicInitContext();
+
     SCLogDebug("OutputFiledataLogThreadInit happy (*data %p)", *data);
 
     OutputFiledataLogger *logger = list;
@@ -418,6 +434,9 @@ static TmEcode OutputFiledataLogThreadDeinit(ThreadVars *tv, void *thread_data)
     }
     SCMutexUnlock(&g_waldo_mutex);
 
+    if (op_thread_data->magic_ctx != NULL)
+        magic_close(op_thread_data->magic_ctx);
+
     SCFree(op_thread_data);
     return TM_ECODE_OK;
 }
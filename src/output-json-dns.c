@@ -245,17 +245,41 @@ static struct {
    { "uri", LOG_URI }
 };
 
+/** clients per thread and interval when aggregating, more flush early */
+#define DNS_AGGREGATE_CLIENTS   1024
+/** rcode is a 4 bit field */
+#define DNS_AGGREGATE_RCODES    16
+
 typedef struct LogDnsFileCtx_ {
     LogFileCtx *file_ctx;
     uint64_t flags; /** Store mode */
+    /** log 1 in sample_rate flows, 0 for all */
+    uint32_t sample_rate;
+    /** seconds to aggregate queries and rcodes per client for, instead
+     *  of logging each of them. 0 to disable. */
+    uint32_t aggregate;
 } LogDnsFileCtx;
 
+/** per client counts of an aggregation interval */
+typedef struct LogDnsAggregate_ {
+    Address client;
+    uint8_t used;
+    uint32_t queries;
+    uint32_t rcodes[DNS_AGGREGATE_RCODES];
+} LogDnsAggregate;
+
 typedef struct LogDnsLogThread_ {
     LogDnsFileCtx *dnslog_ctx;
     /** LogFileCtx has the pointer to the file and a mutex to allow multithreading */
     uint32_t dns_cnt;
 
     MemBuffer *buffer;
+
+    /** aggregation table, DNS_AGGREGATE_CLIENTS entries */
+    LogDnsAggregate *agg;
+    uint32_t agg_cnt;
+    /** start of the current interval */
+    struct timeval agg_ts;
 } LogDnsLogThread;
 
 static int DNSRRTypeEnabled(uint16_t type, uint64_t flags)
@@ -615,6 +639,100 @@ static void LogAnswers(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx, uin
 
 }
 
+/** \internal
+ *  \brief log and reset the counts of the current interval */
+static void LogDnsAggregateFlush(LogDnsLogThread *aft)
+{
+    LogFileCtx *file_ctx = aft->dnslog_ctx->file_ctx;
+    char timebuf[64];
+    uint32_t i, r;
+
+    if (aft->agg_cnt == 0)
+        return;
+
+    CreateIsoTimeString(&aft->agg_ts, timebuf, sizeof(timebuf));
+
+    for (i = 0; i < DNS_AGGREGATE_CLIENTS; i++) {
+        LogDnsAggregate *agg = &aft->agg[i];
+        if (!agg->used)
+            continue;
+
+        char client[46] = "";
+        PrintInet(agg->client.family, (const void *)agg->client.addr_data32,
+                client, sizeof(client));
+
+        JsonWriter jw;
+        OutputJSONWriterInit(&jw, file_ctx, &aft->buffer);
+        JsonWriterString(&jw, "timestamp", timebuf);
+        JsonWriterString(&jw, "event_type", "dns");
+        JsonWriterOpenObject(&jw, "dns");
+        JsonWriterString(&jw, "type", "aggregate");
+        JsonWriterString(&jw, "client", client);
+        JsonWriterUint(&jw, "interval", aft->dnslog_ctx->aggregate);
+        JsonWriterUint(&jw, "queries", agg->queries);
+        JsonWriterOpenObject(&jw, "rcodes");
+        for (r = 0; r < DNS_AGGREGATE_RCODES; r++) {
+            if (agg->rcodes[r] == 0)
+                continue;
+            char rcode[16] = "";
+            DNSCreateRcodeString(r, rcode, sizeof(rcode));
+            JsonWriterUint(&jw, rcode, agg->rcodes[r]);
+        }
+        JsonWriterCloseObject(&jw);
+        JsonWriterCloseObject(&jw);
+        OutputJSONWriterBuffer(&jw, file_ctx, NULL);
+    }
+
+    memset(aft->agg, 0, DNS_AGGREGATE_CLIENTS * sizeof(LogDnsAggregate));
+    aft->agg_cnt = 0;
+}
+
+/** \internal
+ *  \brief get the counts of the client of packet 'p', flushing the
+ *         interval if it is over or the table is full
+ *
+ *  \retval agg entry of the client or NULL if it has no address
+ */
+static LogDnsAggregate *LogDnsAggregateGet(LogDnsLogThread *aft, const Packet *p)
+{
+    const Address *client = PKT_IS_TOSERVER(p) ? &p->src : &p->dst;
+    if (client->family != AF_INET && client->family != AF_INET6)
+        return NULL;
+
+    if (aft->agg_cnt > 0 &&
+        (uint32_t)(p->ts.tv_sec - aft->agg_ts.tv_sec) >= aft->dnslog_ctx->aggregate)
+    {
+        LogDnsAggregateFlush(aft);
+    }
+
+    uint32_t hash = (client->addr_data32[0] ^ client->addr_data32[1] ^
+            client->addr_data32[2] ^ client->addr_data32[3]) * 2654435761U;
+    uint32_t idx = hash % DNS_AGGREGATE_CLIENTS;
+    uint32_t n;
+    for (n = 0; n < DNS_AGGREGATE_CLIENTS; n++) {
+        LogDnsAggregate *agg = &aft->agg[idx];
+        if (!agg->used)
+            break;
+        if (CMP_ADDR(&agg->client, client))
+            return agg;
+        idx = (idx + 1) % DNS_AGGREGATE_CLIENTS;
+    }
+
+    /* keep the table sparse so lookups stay short */
+    if (aft->agg_cnt >= DNS_AGGREGATE_CLIENTS / 2) {
+        LogDnsAggregateFlush(aft);
+        idx = hash % DNS_AGGREGATE_CLIENTS;
+    }
+    if (aft->agg_cnt == 0)
+        aft->agg_ts = p->ts;
+
+    LogDnsAggregate *agg = &aft->agg[idx];
+    COPY_ADDRESS(client, &agg->client);
+    agg->used = 1;
+    aft->agg_cnt++;
+    return agg;
+}
+
 static int JsonDnsLoggerToServer(ThreadVars *tv, void *thread_data,
     const Packet *p, Flow *f, void *alstate, void *txptr, uint64_t tx_id)
 {
@@ -625,6 +743,22 @@ static int JsonDnsLoggerToServer(ThreadVars *tv, void *thread_data,
     DNSTransaction *tx = txptr;
     json_t *js;
 
+    if (OutputJsonFlowSampledOut(f, dnslog_ctx->sample_rate))
+        SCReturnInt(TM_ECODE_OK);
+
+    if (td->agg != NULL) {
+        if (likely(dnslog_ctx->flags & LOG_QUERIES) != 0) {
+            LogDnsAggregate *agg = LogDnsAggregateGet(td, p);
+            if (agg != NULL) {
+                DNSQueryEntry *query = NULL;
+                TAILQ_FOREACH(query, &tx->query_list, next) {
+                    agg->queries++;
+                }
+            }
+        }
+        SCReturnInt(TM_ECODE_OK);
+    }
+
     if (likely(dnslog_ctx->flags & LOG_QUERIES) != 0) {
         DNSQueryEntry *query = NULL;
         TAILQ_FOREACH(query, &tx->query_list, next) {
@@ -651,6 +785,18 @@ static int JsonDnsLoggerToClient(ThreadVars *tv, void *thread_data,
     DNSTransaction *tx = txptr;
     json_t *js;
 
+    if (OutputJsonFlowSampledOut(f, dnslog_ctx->sample_rate))
+        SCReturnInt(TM_ECODE_OK);
+
+    if (td->agg != NULL) {
+        if (likely(dnslog_ctx->flags & LOG_ANSWERS) != 0) {
+            LogDnsAggregate *agg = LogDnsAggregateGet(td, p);
+            if (agg != NULL)
+                agg->rcodes[tx->rcode % DNS_AGGREGATE_RCODES]++;
+        }
+        SCReturnInt(TM_ECODE_OK);
+    }
+
     if (likely(dnslog_ctx->flags & LOG_ANSWERS) != 0) {
         js = CreateJSONHeader((Packet *)p, 0, "dns");
         if (unlikely(js == NULL))
@@ -688,6 +834,15 @@ static TmEcode LogDnsLogThreadInit(ThreadVars *t, void *initdata, void **data)
     /* Use the Ouptut Context (file pointer and mutex) */
     aft->dnslog_ctx= ((OutputCtx *)initdata)->data;
 
+    if (aft->dnslog_ctx->aggregate) {
+        aft->agg = SCCalloc(DNS_AGGREGATE_CLIENTS, sizeof(LogDnsAggregate));
+        if (aft->agg == NULL) {
+            MemBufferFree(aft->buffer);
+            SCFree(aft);
+            return TM_ECODE_FAILED;
+        }
+    }
+
     *data = (void *)aft;
     return TM_ECODE_OK;
 }
@@ -699,6 +854,10 @@ static TmEcode LogDnsLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
+    if (aft->agg != NULL) {
+        LogDnsAggregateFlush(aft);
+        SCFree(aft->agg);
+    }
     MemBufferFree(aft->buffer);
     /* clear memory */
     memset(aft, 0, sizeof(LogDnsLogThread));
@@ -765,6 +924,18 @@ static void JsonDnsLogInitFilters(LogDnsFileCtx *dnslog_ctx, ConfNode *conf)
                 }
             }
         }
+
+        dnslog_ctx->sample_rate = OutputJsonParseSampleRate(conf);
+
+        intmax_t aggregate = 0;
+        if (ConfGetChildValueInt(conf, "aggregate", &aggregate)) {
+            if (aggregate < 0 || aggregate > 86400) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "dns: invalid aggregate "
+                        "interval %"PRIdMAX", should be 0-86400 seconds", aggregate);
+            } else {
+                dnslog_ctx->aggregate = (uint32_t)aggregate;
+            }
+        }
     }
 }
 
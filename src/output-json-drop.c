@@ -86,66 +86,63 @@ static int g_droplog_flows_start = 1;
 static int DropLogJSON (JsonDropLogThread *aft, const Packet *p)
 {
     uint16_t proto = 0;
-    json_t *js = CreateJSONHeader((Packet *)p, 0, "drop");//TODO const
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
+    JsonWriter jw;
 
-    json_t *djs = json_object();
-    if (unlikely(djs == NULL)) {
-        json_decref(js);
-        return TM_ECODE_OK;
-    }
-
-    /* reset */
-    MemBufferReset(aft->buffer);
+    OutputJSONWriterInit(&jw, aft->drop_ctx->file_ctx, &aft->buffer);
+    CreateJSONWriterHeader(&jw, p, 0, "drop");
 
+    JsonWriterOpenObject(&jw, "drop");
     if (PKT_IS_IPV4(p)) {
-        json_object_set_new(djs, "len", json_integer(IPV4_GET_IPLEN(p)));
-        json_object_set_new(djs, "tos", json_integer(IPV4_GET_IPTOS(p)));
-        json_object_set_new(djs, "ttl", json_integer(IPV4_GET_IPTTL(p)));
-        json_object_set_new(djs, "ipid", json_integer(IPV4_GET_IPID(p)));
+        JsonWriterUint(&jw, "len", IPV4_GET_IPLEN(p));
+        JsonWriterUint(&jw, "tos", IPV4_GET_IPTOS(p));
+        JsonWriterUint(&jw, "ttl", IPV4_GET_IPTTL(p));
+        JsonWriterUint(&jw, "ipid", IPV4_GET_IPID(p));
         proto = IPV4_GET_IPPROTO(p);
     } else if (PKT_IS_IPV6(p)) {
-        json_object_set_new(djs, "len", json_integer(IPV6_GET_PLEN(p)));
-        json_object_set_new(djs, "tc", json_integer(IPV6_GET_CLASS(p)));
-        json_object_set_new(djs, "hoplimit", json_integer(IPV6_GET_HLIM(p)));
-        json_object_set_new(djs, "flowlbl", json_integer(IPV6_GET_FLOW(p)));
+        JsonWriterUint(&jw, "len", IPV6_GET_PLEN(p));
+        JsonWriterUint(&jw, "tc", IPV6_GET_CLASS(p));
+        JsonWriterUint(&jw, "hoplimit", IPV6_GET_HLIM(p));
+        JsonWriterUint(&jw, "flowlbl", IPV6_GET_FLOW(p));
         proto = IPV6_GET_L4PROTO(p);
     }
     switch (proto) {
         case IPPROTO_TCP:
             if (PKT_IS_TCP(p)) {
-                json_object_set_new(djs, "tcpseq", json_integer(TCP_GET_SEQ(p)));
-                json_object_set_new(djs, "tcpack", json_integer(TCP_GET_ACK(p)));
-                json_object_set_new(djs, "tcpwin", json_integer(TCP_GET_WINDOW(p)));
-                json_object_set_new(djs, "syn", TCP_ISSET_FLAG_SYN(p) ? json_true() : json_false());
-                json_object_set_new(djs, "ack", TCP_ISSET_FLAG_ACK(p) ? json_true() : json_false());
-                json_object_set_new(djs, "psh", TCP_ISSET_FLAG_PUSH(p) ? json_true() : json_false());
-                json_object_set_new(djs, "rst", TCP_ISSET_FLAG_RST(p) ? json_true() : json_false());
-                json_object_set_new(djs, "urg", TCP_ISSET_FLAG_URG(p) ? json_true() : json_false());
-                json_object_set_new(djs, "fin", TCP_ISSET_FLAG_FIN(p) ? json_true() : json_false());
-                json_object_set_new(djs, "tcpres", json_integer(TCP_GET_RAW_X2(p->tcph)));
-                json_object_set_new(djs, "tcpurgp", json_integer(TCP_GET_URG_POINTER(p)));
+                JsonWriterUint(&jw, "tcpseq", TCP_GET_SEQ(p));
+                JsonWriterUint(&jw, "tcpack", TCP_GET_ACK(p));
+                JsonWriterUint(&jw, "tcpwin", TCP_GET_WINDOW(p));
+                JsonWriterBool(&jw, "syn", TCP_ISSET_FLAG_SYN(p));
+                JsonWriterBool(&jw, "ack", TCP_ISSET_FLAG_ACK(p));
+                JsonWriterBool(&jw, "psh", TCP_ISSET_FLAG_PUSH(p));
+                JsonWriterBool(&jw, "rst", TCP_ISSET_FLAG_RST(p));
+                JsonWriterBool(&jw, "urg", TCP_ISSET_FLAG_URG(p));
+                JsonWriterBool(&jw, "fin", TCP_ISSET_FLAG_FIN(p));
+                JsonWriterUint(&jw, "tcpres", TCP_GET_RAW_X2(p->tcph));
+                JsonWriterUint(&jw, "tcpurgp", TCP_GET_URG_POINTER(p));
             }
             break;
         case IPPROTO_UDP:
             if (PKT_IS_UDP(p)) {
-                json_object_set_new(djs, "udplen", json_integer(UDP_GET_LEN(p)));
+                JsonWriterUint(&jw, "udplen", UDP_GET_LEN(p));
             }
             break;
         case IPPROTO_ICMP:
             if (PKT_IS_ICMPV4(p)) {
-                json_object_set_new(djs, "icmp_id", json_integer(ICMPV4_GET_ID(p)));
-                json_object_set_new(djs, "icmp_seq", json_integer(ICMPV4_GET_SEQ(p)));
+                JsonWriterUint(&jw, "icmp_id", ICMPV4_GET_ID(p));
+                JsonWriterUint(&jw, "icmp_seq", ICMPV4_GET_SEQ(p));
             } else if(PKT_IS_ICMPV6(p)) {
-                json_object_set_new(djs, "icmp_id", json_integer(ICMPV6_GET_ID(p)));
-                json_object_set_new(djs, "icmp_seq", json_integer(ICMPV6_GET_SEQ(p)));
+                JsonWriterUint(&jw, "icmp_id", ICMPV6_GET_ID(p));
+                JsonWriterUint(&jw, "icmp_seq", ICMPV6_GET_SEQ(p));
             }
             break;
     }
-    json_object_set_new(js, "drop", djs);
+    JsonWriterCloseObject(&jw);
 
     if (aft->drop_ctx->flags & LOG_DROP_ALERTS) {
+        /* the alert header is still built as json_t */
+        json_t *js = json_object();
+        if (unlikely(js == NULL))
+            goto end;
         int logged = 0;
         int i;
         for (i = 0; i < p->alerts.cnt; i++) {
@@ -166,13 +163,12 @@ static int DropLogJSON (JsonDropLogThread *aft, const Packet *p)
                 AlertJsonHeader(p, pa, js);
             }
         }
+        JsonWriterJsonMembers(&jw, js);
+        json_decref(js);
     }
 
-    OutputJSONBuffer(js, aft->drop_ctx->file_ctx, &aft->buffer);
-    json_object_del(js, "drop");
-    json_object_clear(js);
-    json_decref(js);
-
+end:
+    OutputJSONWriterBuffer(&jw, aft->drop_ctx->file_ctx, p->flow);
     return TM_ECODE_OK;
 }
 
@@ -52,6 +52,8 @@
 
 typedef struct LogJsonFileCtx_ {
     LogFileCtx *file_ctx;
+    /** log 1 in sample_rate flows, 0 for all */
+    uint32_t sample_rate;
 } LogJsonFileCtx;
 
 typedef struct JsonNetFlowLogThread_ {
@@ -289,6 +291,9 @@ static int JsonNetFlowLogger(ThreadVars *tv, void *thread_data, Flow *f)
     SCEnter();
     JsonNetFlowLogThread *jhl = (JsonNetFlowLogThread *)thread_data;
 
+    if (OutputJsonFlowSampledOut(f, jhl->flowlog_ctx->sample_rate))
+        SCReturnInt(TM_ECODE_OK);
+
     /* reset */
     MemBufferReset(jhl->buffer);
     json_t *js = CreateJSONHeaderFromFlow(f, "netflow", 0); //TODO const
@@ -352,6 +357,7 @@ OutputCtx *OutputNetFlowLogInit(ConfNode *conf)
     }
 
     flow_ctx->file_ctx = file_ctx;
+    flow_ctx->sample_rate = OutputJsonParseSampleRate(conf);
     output_ctx->data = flow_ctx;
     output_ctx->DeInit = OutputNetFlowLogDeinit;
 
@@ -380,6 +386,7 @@ OutputCtx *OutputNetFlowLogInitSub(ConfNode *conf, OutputCtx *parent_ctx)
     }
 
     flow_ctx->file_ctx = ojc->file_ctx;
+    flow_ctx->sample_rate = OutputJsonParseSampleRate(conf);
 
     output_ctx->data = flow_ctx;
     output_ctx->DeInit = OutputNetFlowLogDeinitSub;
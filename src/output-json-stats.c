@@ -46,6 +46,8 @@
 
 #include "output-json.h"
 #include "output-json-stats.h"
+#include "flow-heavy.h"
+#include "detect-engine-tenant.h"
 
 #define MODULE_NAME "JsonStatsLog"
 
@@ -168,6 +170,17 @@ json_t *StatsToJSON(const StatsTable *st, uint8_t flags)
         }
         json_object_set_new(js_stats, "threads", threads);
     }
+
+    /* top talkers and elephant flows, if tracked */
+    json_t *js_heavy = FlowHeavyToJSON();
+    if (js_heavy != NULL)
+        json_object_set_new(js_stats, "heavy_hitters", js_heavy);
+
+    /* per tenant accounting in multi tenant mode */
+    json_t *js_tenants = DetectTenantToJSON();
+    if (js_tenants != NULL)
+        json_object_set_new(js_stats, "tenants", js_tenants);
+
     return js_stats;
 }
 
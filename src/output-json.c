@@ -162,6 +162,74 @@ void JsonTcpFlags(uint8_t flags, json_t *js)
         json_object_set_new(js, "cwr", json_true());
 }
 
+void JsonTcpFlagsWriter(uint8_t flags, JsonWriter *jw)
+{
+    if (flags & TH_SYN)
+        JsonWriterBool(jw, "syn", 1);
+    if (flags & TH_FIN)
+        JsonWriterBool(jw, "fin", 1);
+    if (flags & TH_RST)
+        JsonWriterBool(jw, "rst", 1);
+    if (flags & TH_PUSH)
+        JsonWriterBool(jw, "psh", 1);
+    if (flags & TH_ACK)
+        JsonWriterBool(jw, "ack", 1);
+    if (flags & TH_URG)
+        JsonWriterBool(jw, "urg", 1);
+    if (flags & TH_ECN)
+        JsonWriterBool(jw, "ecn", 1);
+    if (flags & TH_CWR)
+        JsonWriterBool(jw, "cwr", 1);
+}
+
+/** \brief JsonWriter version of CreateJSONFlowId */
+void CreateJSONWriterFlowId(JsonWriter *jw, const Flow *f)
+{
+    if (f == NULL)
+        return;
+    int64_t flow_id = FlowGetId(f);
+    flow_id &= 0x7ffffffffffffLL;
+    JsonWriterInt(jw, "flow_id", flow_id);
+}
+
+/** \brief get the "sample-rate" of an eve type from its config node
+ *
+ *  \retval rate with a rate of N the records of 1 in N flows are logged,
+ *          0 if all are
+ */
+uint32_t OutputJsonParseSampleRate(const ConfNode *conf)
+{
+    intmax_t rate = 0;
+
+    if (conf == NULL || !ConfGetChildValueInt(conf, "sample-rate", &rate))
+        return 0;
+    if (rate < 0 || rate > UINT32_MAX) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s: invalid sample-rate %"PRIdMAX
+                ", logging all records", conf->name, rate);
+        return 0;
+    }
+    if (rate > 1) {
+        SCLogInfo("%s: logging 1 in %"PRIdMAX" flows", conf->name, rate);
+        return (uint32_t)rate;
+    }
+    return 0;
+}
+
+/** \brief check if the records of flow 'f' are dropped by sampling
+ *
+ *  Decided on the flow hash, which is the same for both directions, so
+ *  a flow is either logged completely or not at all.
+ */
+int OutputJsonFlowSampledOut(const Flow *f, uint32_t rate)
+{
+    if (rate == 0 || f == NULL)
+        return 0;
+
+    /* the low bits of the hash select the hash row, so mix them in */
+    uint32_t h = f->flow_hash * 2654435761U;
+    return ((h >> 16) % rate) != 0;
+}
+
 void CreateJSONFlowId(json_t *js, const Flow *f)
 {
     if (f == NULL)
@@ -173,61 +241,72 @@ void CreateJSONFlowId(json_t *js, const Flow *f)
     json_object_set_new(js, "flow_id", json_integer(flow_id));
 }
 
-json_t *CreateJSONHeader(const Packet *p, int direction_sensitive,
-                         const char *event_type)
+/** \internal
+ *  \brief addresses, ports and protocol name of the packet as logged
+ *         in the record header */
+static void JsonPacketTuple(const Packet *p, int direction_sensitive,
+        char *srcip, size_t srcip_len, char *dstip, size_t dstip_len,
+        Port *sp, Port *dp, char *proto, size_t proto_len)
 {
-    char timebuf[64];
-    char srcip[46], dstip[46];
-    Port sp, dp;
-
-    json_t *js = json_object();
-    if (unlikely(js == NULL))
-        return NULL;
-
-    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
-
     srcip[0] = '\0';
     dstip[0] = '\0';
     if (direction_sensitive) {
         if ((PKT_IS_TOSERVER(p))) {
             if (PKT_IS_IPV4(p)) {
-                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
+                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, srcip_len);
+                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, dstip_len);
             } else if (PKT_IS_IPV6(p)) {
-                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
+                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, srcip_len);
+                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, dstip_len);
             }
-            sp = p->sp;
-            dp = p->dp;
+            *sp = p->sp;
+            *dp = p->dp;
         } else {
             if (PKT_IS_IPV4(p)) {
-                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), dstip, sizeof(dstip));
+                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), srcip, srcip_len);
+                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), dstip, dstip_len);
             } else if (PKT_IS_IPV6(p)) {
-                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), dstip, sizeof(dstip));
+                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), srcip, srcip_len);
+                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), dstip, dstip_len);
             }
-            sp = p->dp;
-            dp = p->sp;
+            *sp = p->dp;
+            *dp = p->sp;
         }
     } else {
         if (PKT_IS_IPV4(p)) {
-            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
-            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
+            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, srcip_len);
+            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, dstip_len);
         } else if (PKT_IS_IPV6(p)) {
-            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
-            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
+            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, srcip_len);
+            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, dstip_len);
         }
-        sp = p->sp;
-        dp = p->dp;
+        *sp = p->sp;
+        *dp = p->dp;
     }
 
-    char proto[16];
     if (SCProtoNameValid(IP_GET_IPPROTO(p)) == TRUE) {
-        strlcpy(proto, known_proto[IP_GET_IPPROTO(p)], sizeof(proto));
+        strlcpy(proto, known_proto[IP_GET_IPPROTO(p)], proto_len);
     } else {
-        snprintf(proto, sizeof(proto), "%03" PRIu32, IP_GET_IPPROTO(p));
+        snprintf(proto, proto_len, "%03" PRIu32, IP_GET_IPPROTO(p));
     }
+}
+
+json_t *CreateJSONHeader(const Packet *p, int direction_sensitive,
+                         const char *event_type)
+{
+    char timebuf[64];
+    char srcip[46], dstip[46];
+    char proto[16];
+    Port sp, dp;
+
+    json_t *js = json_object();
+    if (unlikely(js == NULL))
+        return NULL;
+
+    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
+
+    JsonPacketTuple(p, direction_sensitive, srcip, sizeof(srcip),
+            dstip, sizeof(dstip), &sp, &dp, proto, sizeof(proto));
 
     /* time & tx */
     json_object_set_new(js, "timestamp", json_string(timebuf));
@@ -333,6 +412,113 @@ json_t *CreateJSONHeaderWithTxId(const Packet *p, int direction_sensitive,
     return js;
 }
 
+/**
+ *  \brief start a record in 'buffer' using the JsonWriter
+ *
+ *  Resets the buffer, writes the configured prefix and opens the top
+ *  level object. Finish the record with OutputJSONWriterBuffer.
+ */
+void OutputJSONWriterInit(JsonWriter *jw, LogFileCtx *file_ctx, MemBuffer **buffer)
+{
+    MemBufferReset(*buffer);
+
+    if (file_ctx->binary) {
+        JsonWriterInitCbor(jw, buffer, OUTPUT_BUFFER_SIZE);
+        JsonWriterOpenObject(jw, NULL);
+        return;
+    }
+
+    if (file_ctx->prefix) {
+        MemBufferWriteRaw((*buffer), file_ctx->prefix, file_ctx->prefix_len);
+    }
+
+    JsonWriterInit(jw, buffer, OUTPUT_BUFFER_SIZE);
+    JsonWriterOpenObject(jw, NULL);
+}
+
+/**
+ *  \brief JsonWriter version of CreateJSONHeader
+ *
+ *  Writes the same members, in the same order, into the record opened
+ *  by OutputJSONWriterInit.
+ */
+void CreateJSONWriterHeader(JsonWriter *jw, const Packet *p,
+        int direction_sensitive, const char *event_type)
+{
+    char timebuf[64];
+    char srcip[46], dstip[46];
+    char proto[16];
+    Port sp, dp;
+
+    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
+
+    JsonPacketTuple(p, direction_sensitive, srcip, sizeof(srcip),
+            dstip, sizeof(dstip), &sp, &dp, proto, sizeof(proto));
+
+    JsonWriterString(jw, "timestamp", timebuf);
+
+    CreateJSONWriterFlowId(jw, (const Flow *)p->flow);
+
+    if (sensor_id >= 0)
+        JsonWriterInt(jw, "sensor_id", sensor_id);
+
+    if (p->livedev) {
+        JsonWriterString(jw, "in_iface", p->livedev->dev);
+    }
+
+    if (p->pcap_cnt != 0) {
+        JsonWriterUint(jw, "pcap_cnt", p->pcap_cnt);
+    }
+
+    if (event_type) {
+        JsonWriterString(jw, "event_type", event_type);
+    }
+
+    switch (p->vlan_idx) {
+        case 1:
+            JsonWriterUint(jw, "vlan", VLAN_GET_ID1(p));
+            break;
+        case 2:
+            JsonWriterOpenArray(jw, "vlan");
+            JsonWriterUint(jw, NULL, VLAN_GET_ID1(p));
+            JsonWriterUint(jw, NULL, VLAN_GET_ID2(p));
+            JsonWriterCloseArray(jw);
+            break;
+    }
+
+    JsonWriterString(jw, "src_ip", srcip);
+    switch(p->proto) {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JsonWriterUint(jw, "src_port", sp);
+            break;
+    }
+    JsonWriterString(jw, "dest_ip", dstip);
+    switch(p->proto) {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JsonWriterUint(jw, "dest_port", dp);
+            break;
+    }
+    JsonWriterString(jw, "proto", proto);
+    switch (p->proto) {
+        case IPPROTO_ICMP:
+            if (p->icmpv4h) {
+                JsonWriterUint(jw, "icmp_type", p->icmpv4h->type);
+                JsonWriterUint(jw, "icmp_code", p->icmpv4h->code);
+            }
+            break;
+        case IPPROTO_ICMPV6:
+            if (p->icmpv6h) {
+                JsonWriterUint(jw, "icmp_type", p->icmpv6h->type);
+                JsonWriterUint(jw, "icmp_code", p->icmpv6h->code);
+            }
+            break;
+    }
+}
+
 int OutputJSONMemBufferCallback(const char *str, size_t size, void *data)
 {
     OutputJSONMemBufferWrapper *wrapper = data;
@@ -348,11 +534,36 @@ int OutputJSONMemBufferCallback(const char *str, size_t size, void *data)
 
 int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer)
 {
+    char key[24];
+    size_t key_len = 0;
+
     if (file_ctx->sensor_name) {
         json_object_set_new(js, "host",
                             json_string(file_ctx->sensor_name));
     }
 
+    /* partition key, so a flow's records stay together */
+    if (file_ctx->type == LOGFILE_TYPE_KAFKA) {
+        json_t *flow_id = json_object_get(js, "flow_id");
+        if (flow_id != NULL && json_is_integer(flow_id)) {
+            key_len = snprintf(key, sizeof(key), "%"PRId64,
+                    (int64_t)json_integer_value(flow_id));
+        }
+    }
+
+    if (file_ctx->binary) {
+        JsonWriter jw;
+        JsonWriterInitCbor(&jw, buffer, OUTPUT_BUFFER_SIZE);
+        JsonWriterOpenObject(&jw, NULL);
+        JsonWriterJsonMembers(&jw, js);
+        JsonWriterCloseObject(&jw);
+        if (JsonWriterFinish(&jw) != 0)
+            return TM_ECODE_OK;
+
+        LogFileWriteWithKey(file_ctx, *buffer, key_len ? key : NULL, key_len);
+        return 0;
+    }
+
     if (file_ctx->prefix) {
         MemBufferWriteRaw((*buffer), file_ctx->prefix, file_ctx->prefix_len);
     }
@@ -368,7 +579,31 @@ int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer)
     if (r != 0)
         return TM_ECODE_OK;
 
-    LogFileWrite(file_ctx, *buffer);
+    LogFileWriteWithKey(file_ctx, *buffer, key_len ? key : NULL, key_len);
+    return 0;
+}
+
+/**
+ *  \brief close and write out a record started by OutputJSONWriterInit
+ */
+int OutputJSONWriterBuffer(JsonWriter *jw, LogFileCtx *file_ctx, const Flow *f)
+{
+    if (file_ctx->sensor_name) {
+        JsonWriterString(jw, "host", file_ctx->sensor_name);
+    }
+    JsonWriterCloseObject(jw);
+
+    if (JsonWriterFinish(jw) != 0)
+        return TM_ECODE_OK;
+
+    char key[24];
+    size_t key_len = 0;
+    if (file_ctx->type == LOGFILE_TYPE_KAFKA && f != NULL) {
+        int64_t flow_id = FlowGetId(f) & 0x7ffffffffffffLL;
+        key_len = snprintf(key, sizeof(key), "%"PRId64, flow_id);
+    }
+
+    LogFileWriteWithKey(file_ctx, *jw->buffer, key_len ? key : NULL, key_len);
     return 0;
 }
 
@@ -489,6 +724,14 @@ OutputCtx *OutputJsonInitCtx(ConfNode *conf)
                 json_ctx->json_out = LOGFILE_TYPE_UNIX_DGRAM;
             } else if (strcmp(output_s, "unix_stream") == 0) {
                 json_ctx->json_out = LOGFILE_TYPE_UNIX_STREAM;
+            } else if (strcmp(output_s, "kafka") == 0) {
+#ifdef HAVE_LIBRDKAFKA
+                json_ctx->json_out = LOGFILE_TYPE_KAFKA;
+#else
+                SCLogError(SC_ERR_INVALID_ARGUMENT,
+                           "kafka JSON output option is not compiled");
+                exit(EXIT_FAILURE);
+#endif
             } else if (strcmp(output_s, "redis") == 0) {
 #ifdef HAVE_LIBHIREDIS
                 json_ctx->json_out = LOGFILE_TYPE_REDIS;
@@ -536,6 +779,13 @@ OutputCtx *OutputJsonInitCtx(ConfNode *conf)
                     json_ctx->format = INDENT;
                 } else if (strcmp(format_s, "compact") == 0) {
                     json_ctx->format = COMPACT;
+                } else if (strcmp(format_s, "cbor") == 0) {
+                    json_ctx->format = CBOR;
+                    json_ctx->file_ctx->binary = 1;
+                    if (json_ctx->file_ctx->prefix != NULL) {
+                        SCLogWarning(SC_ERR_INVALID_ARGUMENT,
+                                "eve-log.prefix is ignored for format cbor");
+                    }
                 } else {
                     SCLogError(SC_ERR_INVALID_ARGUMENT,
                                "Invalid JSON format option: %s", format_s);
@@ -594,6 +844,16 @@ OutputCtx *OutputJsonInitCtx(ConfNode *conf)
             }
         }
 #endif
+#ifdef HAVE_LIBRDKAFKA
+        else if (json_ctx->json_out == LOGFILE_TYPE_KAFKA) {
+            if (SCConfLogOpenKafka(conf, json_ctx->file_ctx) < 0) {
+                LogFileFreeCtx(json_ctx->file_ctx);
+                SCFree(json_ctx);
+                SCFree(output_ctx);
+                return NULL;
+            }
+        }
+#endif
 
         const char *sensor_id_s = ConfNodeLookupChildValue(conf, "sensor-id");
         if (sensor_id_s != NULL) {
@@ -625,6 +885,28 @@ static void OutputJsonDeInitCtx(OutputCtx *output_ctx)
 
 #ifdef UNITTESTS
 
+/** \test sampling keeps roughly 1 in N flows, all of them without a rate */
+static int OutputJsonSampleTest01(void)
+{
+    Flow f;
+    uint32_t i, kept = 0;
+
+    memset(&f, 0, sizeof(f));
+    for (i = 0; i < 10000; i++) {
+        f.flow_hash = i;
+        FAIL_IF(OutputJsonFlowSampledOut(&f, 0));
+        if (!OutputJsonFlowSampledOut(&f, 4))
+            kept++;
+    }
+    FAIL_IF(kept < 2000 || kept > 3000);
+
+    /* same hash, same decision */
+    f.flow_hash = 12345;
+    int r = OutputJsonFlowSampledOut(&f, 7);
+    FAIL_IF(OutputJsonFlowSampledOut(&f, 7) != r);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -634,7 +916,7 @@ void OutputJsonRegisterTests(void)
 {
 
 #ifdef UNITTESTS
-
+    UtRegisterTest("OutputJsonSampleTest01", OutputJsonSampleTest01);
 #endif /* UNITTESTS */
 
 }
@@ -27,6 +27,7 @@
 #include "suricata-common.h"
 #include "util-buffer.h"
 #include "util-logopenfile.h"
+#include "util-json-writer.h"
 
 void TmModuleOutputJsonRegister (void);
 
@@ -41,13 +42,21 @@ int OutputJSONMemBufferCallback(const char *str, size_t size, void *data);
 
 void CreateJSONFlowId(json_t *js, const Flow *f);
 void JsonTcpFlags(uint8_t flags, json_t *js);
+void JsonTcpFlagsWriter(uint8_t flags, JsonWriter *jw);
+void CreateJSONWriterFlowId(JsonWriter *jw, const Flow *f);
+uint32_t OutputJsonParseSampleRate(const ConfNode *conf);
+int OutputJsonFlowSampledOut(const Flow *f, uint32_t rate);
 json_t *CreateJSONHeader(const Packet *p, int direction_sensative, const char *event_type);
 json_t *CreateJSONHeaderWithTxId(const Packet *p, int direction_sensitive, const char *event_type, uint64_t tx_id);
 TmEcode OutputJSON(json_t *js, void *data, uint64_t *count);
 int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer);
+void OutputJSONWriterInit(JsonWriter *jw, LogFileCtx *file_ctx, MemBuffer **buffer);
+void CreateJSONWriterHeader(JsonWriter *jw, const Packet *p,
+        int direction_sensitive, const char *event_type);
+int OutputJSONWriterBuffer(JsonWriter *jw, LogFileCtx *file_ctx, const Flow *f);
 OutputCtx *OutputJsonInitCtx(ConfNode *);
 
-enum JsonFormat { COMPACT, INDENT };
+enum JsonFormat { COMPACT, INDENT, CBOR };
 
 /*
  * Global configuration context data
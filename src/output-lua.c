@@ -78,6 +78,8 @@ typedef struct LogLuaCtx_ {
     SCMutex m;
     lua_State *luastate;
     int deinit_once;
+    int args_ref;   /**< registry ref of the args table of the tx and
+                     *   streaming loggers, reused between calls */
 } LogLuaCtx;
 
 typedef struct LogLuaThreadCtx_ {
@@ -107,7 +109,7 @@ static int LuaTxLogger(ThreadVars *tv, void *thread_data, const Packet *p, Flow
 
     /* prepare data to pass to script */
     lua_getglobal(td->lua_ctx->luastate, "log");
-    lua_newtable(td->lua_ctx->luastate);
+    lua_rawgeti(td->lua_ctx->luastate, LUA_REGISTRYINDEX, td->lua_ctx->args_ref);
     LuaPushTableKeyValueInt(td->lua_ctx->luastate, "tx_id", (int)(tx_id));
 
     int retval = lua_pcall(td->lua_ctx->luastate, 1, 0, 0);
@@ -152,10 +154,16 @@ static int LuaStreamingLogger(ThreadVars *tv, void *thread_data, const Flow *f,
 
     /* prepare data to pass to script */
     lua_getglobal(td->lua_ctx->luastate, "log");
-    lua_newtable(td->lua_ctx->luastate);
+    lua_rawgeti(td->lua_ctx->luastate, LUA_REGISTRYINDEX, td->lua_ctx->args_ref);
 
-    if (flags & OUTPUT_STREAMING_FLAG_TRANSACTION)
+    /* the table is reused, clear the tx_id of a previous call */
+    if (flags & OUTPUT_STREAMING_FLAG_TRANSACTION) {
         LuaPushTableKeyValueInt(td->lua_ctx->luastate, "tx_id", (int)(tx_id));
+    } else {
+        lua_pushliteral(td->lua_ctx->luastate, "tx_id");
+        lua_pushnil(td->lua_ctx->luastate);
+        lua_settable(td->lua_ctx->luastate, -3);
+    }
 
     int retval = lua_pcall(td->lua_ctx->luastate, 1, 0, 0);
     if (retval != 0) {
@@ -766,6 +774,10 @@ static OutputCtx *OutputLuaLogInitSub(ConfNode *conf, OutputCtx *parent_ctx)
 
     SCMutexLock(&lua_ctx->m);
     lua_ctx->luastate = LuaScriptSetup(path);
+    if (lua_ctx->luastate != NULL) {
+        lua_newtable(lua_ctx->luastate);
+        lua_ctx->args_ref = luaL_ref(lua_ctx->luastate, LUA_REGISTRYINDEX);
+    }
     SCMutexUnlock(&lua_ctx->m);
     if (lua_ctx->luastate == NULL)
         goto error;
@@ -864,6 +876,7 @@ static OutputCtx *OutputLuaLogInit(ConfNode *conf)
             om->alproto = ALPROTO_HTTP;
             AppLayerHtpEnableRequestBodyCallback();
             AppLayerHtpEnableResponseBodyCallback();
+            AppLayerHtpNeedResponseBodyForOutput();
         } else if (opts.alproto == ALPROTO_HTTP) {
             om->TxLogFunc = LuaTxLogger;
             om->alproto = ALPROTO_HTTP;
@@ -900,6 +913,7 @@ static OutputCtx *OutputLuaLogInit(ConfNode *conf)
         } else if (opts.file) {
             om->FileLogFunc = LuaFileLogger;
             AppLayerHtpNeedFileInspection();
+            AppLayerHtpNeedResponseBodyForOutput();
         } else if (opts.streaming && opts.tcp_data) {
             om->StreamingLogFunc = LuaStreamingLogger;
         } else if (opts.flow) {
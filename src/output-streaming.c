@@ -32,6 +32,7 @@
 #include "util-print.h"
 #include "conf.h"
 #include "util-profiling.h"
+#include "flow-storage.h"
 
 typedef struct OutputLoggerThreadStore_ {
     void *thread_data;
@@ -55,9 +56,16 @@ typedef struct OutputStreamingLogger_ {
     const char *name;
     TmmId module_id;
     enum OutputStreamingType type;
+    /** position in the list, bit in the flow's stopped mask */
+    uint32_t idx;
 } OutputStreamingLogger;
 
 static OutputStreamingLogger *list = NULL;
+static uint32_t list_cnt = 0;
+
+/** flow storage: uint32_t mask of the loggers that asked not to get
+ *  more data of the flow */
+static int streaming_flow_id = -1;
 
 int OutputRegisterStreamingLogger(const char *name, StreamingLogger LogFunc,
         OutputCtx *output_ctx, enum OutputStreamingType type )
@@ -66,6 +74,12 @@ int OutputRegisterStreamingLogger(const char *name, StreamingLogger LogFunc,
     if (module_id < 0)
         return -1;
 
+    if (list_cnt >= OUTPUT_STREAMING_LOGGERS_MAX) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s: too many streaming loggers, "
+                "max is %u", name, OUTPUT_STREAMING_LOGGERS_MAX);
+        return -1;
+    }
+
     OutputStreamingLogger *op = SCMalloc(sizeof(*op));
     if (op == NULL)
         return -1;
@@ -76,6 +90,13 @@ int OutputRegisterStreamingLogger(const char *name, StreamingLogger LogFunc,
     op->name = name;
     op->module_id = (TmmId) module_id;
     op->type = type;
+    op->idx = list_cnt++;
+
+    if (type == STREAMING_HTTP_BODIES) {
+        AppLayerHtpEnableRequestBodyCallback();
+        AppLayerHtpEnableResponseBodyCallback();
+        AppLayerHtpNeedResponseBodyForOutput();
+    }
 
     if (list == NULL)
         list = op;
@@ -111,14 +132,33 @@ int Streamer(void *cbdata, Flow *f, const uint8_t *data, uint32_t data_len, uint
     BUG_ON(logger == NULL);
     BUG_ON(store == NULL);
 
+    uint32_t *stopped = FlowGetStorageById(f, streaming_flow_id);
+
     while (logger && store) {
         BUG_ON(logger->LogFunc == NULL);
 
-        if (logger->type == streamer_cbdata->type) {
+        if (logger->type == streamer_cbdata->type &&
+            (stopped == NULL || !(*stopped & BIT_U32(logger->idx))))
+        {
             SCLogDebug("logger %p", logger);
             PACKET_PROFILING_TMM_START(p, logger->module_id);
-            logger->LogFunc(tv, store->thread_data, (const Flow *)f, data, data_len, tx_id, flags);
+            int r = logger->LogFunc(tv, store->thread_data, (const Flow *)f,
+                    data, data_len, tx_id, flags);
             PACKET_PROFILING_TMM_END(p, logger->module_id);
+
+            /* backpressure: leave the logger out for the rest of the
+             * flow. The data is still marked as logged, so reassembly
+             * can free it. */
+            if (r == OUTPUT_STREAMING_STOP) {
+                if (stopped == NULL) {
+                    stopped = SCCalloc(1, sizeof(*stopped));
+                    if (stopped != NULL)
+                        FlowSetStorageById(f, streaming_flow_id, stopped);
+                }
+                if (stopped != NULL)
+                    *stopped |= BIT_U32(logger->idx);
+                SCLogDebug("logger %s stopped for flow %p", logger->name, f);
+            }
         }
 
         logger = logger->next;
@@ -452,6 +492,11 @@ static void OutputStreamingLogExitPrintStats(ThreadVars *tv, void *thread_data)
     }
 }
 
+static void OutputStreamingFlowFree(void *ptr)
+{
+    SCFree(ptr);
+}
+
 void TmModuleStreamingLoggerRegister (void) {
     tmm_modules[TMM_STREAMINGLOGGER].name = "__streaming_logger__";
     tmm_modules[TMM_STREAMINGLOGGER].ThreadInit = OutputStreamingLogThreadInit;
@@ -459,6 +504,13 @@ void TmModuleStreamingLoggerRegister (void) {
     tmm_modules[TMM_STREAMINGLOGGER].ThreadExitPrintStats = OutputStreamingLogExitPrintStats;
     tmm_modules[TMM_STREAMINGLOGGER].ThreadDeinit = OutputStreamingLogThreadDeinit;
     tmm_modules[TMM_STREAMINGLOGGER].cap_flags = 0;
+
+    streaming_flow_id = FlowStorageRegister("output-streaming", sizeof(void *),
+            NULL, OutputStreamingFlowFree);
+    if (streaming_flow_id == -1) {
+        SCLogError(SC_ERR_FLOW_INIT, "Can't initiate flow storage for streaming loggers");
+        exit(EXIT_FAILURE);
+    }
 }
 
 void OutputStreamingShutdown(void)
@@ -470,4 +522,5 @@ void OutputStreamingShutdown(void)
         logger = next_logger;
     }
     list = NULL;
+    list_cnt = 0;
 }
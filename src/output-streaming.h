@@ -40,7 +40,18 @@ enum OutputStreamingType {
     STREAMING_HTTP_BODIES,
 };
 
-/** filedata logger function pointer type */
+/** return value of a StreamingLogger that can't keep up: no more data
+ *  of the flow is passed to it, not even the close */
+#define OUTPUT_STREAMING_STOP               1
+
+/** max number of registered streaming loggers */
+#define OUTPUT_STREAMING_LOGGERS_MAX        32
+
+/** streaming logger function pointer type
+ *
+ *  'data' points into the reassembly or body storage and is only valid
+ *  for the duration of the call. Returns 0, or OUTPUT_STREAMING_STOP to
+ *  not be fed the rest of this flow. */
 typedef int (*StreamingLogger)(ThreadVars *, void *thread_data,
         const Flow *f, const uint8_t *data, uint32_t data_len,
         uint64_t tx_id, uint8_t flags);
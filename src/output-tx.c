@@ -152,6 +152,15 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data, PacketQ
         goto end;
     }
 
+    /* nothing can have become ready to log if the state wasn't updated
+     * since the last run */
+    const uint8_t ts_disruption = FlowGetDisruptionFlags(f, STREAM_TOSERVER);
+    const uint8_t tc_disruption = FlowGetDisruptionFlags(f, STREAM_TOCLIENT);
+    if (!AppLayerParserTxLogPending(f->alparser, ts_disruption, tc_disruption)) {
+        SCLogDebug("no state updates since the last run");
+        goto end;
+    }
+
     uint64_t total_txs = AppLayerParserGetTxCnt(p->proto, alproto, alstate);
     uint64_t tx_id = AppLayerParserGetTransactionLogId(f->alparser);
 
@@ -166,10 +175,10 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data, PacketQ
         }
 
         int tx_progress_ts = AppLayerParserGetStateProgress(p->proto, alproto,
-                tx, FlowGetDisruptionFlags(f, STREAM_TOSERVER));
+                tx, ts_disruption);
 
         int tx_progress_tc = AppLayerParserGetStateProgress(p->proto, alproto,
-                tx, FlowGetDisruptionFlags(f, STREAM_TOCLIENT));
+                tx, tc_disruption);
 
         SCLogDebug("tx_progress_ts %d tx_progress_tc %d",
                 tx_progress_ts, tx_progress_tc);
@@ -238,6 +247,7 @@ next:
             AppLayerParserSetTransactionLogId(f->alparser);
         }
     }
+    AppLayerParserSetTxLogDone(f->alparser, ts_disruption, tc_disruption);
 
 end:
     FLOWLOCK_UNLOCK(f);
@@ -425,7 +425,13 @@ int SRepLoadCatFileFromFD(FILE *fp)
     return 0;
 }
 
-static int SRepLoadFile(SRepCIDRTree *cidr_ctx, char *filename)
+static int SRepLoadFileFromFDInternal(SRepCIDRTree *cidr_ctx, FILE *fp, int load_hosts);
+
+/**
+ *  \param load_hosts if 0 only netblocks are loaded, single addresses
+ *                    are skipped
+ */
+static int SRepLoadFile(SRepCIDRTree *cidr_ctx, char *filename, int load_hosts)
 {
     int r = 0;
     FILE *fp = fopen(filename, "r");
@@ -435,7 +441,7 @@ static int SRepLoadFile(SRepCIDRTree *cidr_ctx, char *filename)
         return -1;
     }
 
-    r = SRepLoadFileFromFD(cidr_ctx, fp);
+    r = SRepLoadFileFromFDInternal(cidr_ctx, fp, load_hosts);
 
     fclose(fp);
     fp = NULL;
@@ -444,6 +450,11 @@ static int SRepLoadFile(SRepCIDRTree *cidr_ctx, char *filename)
 }
 
 int SRepLoadFileFromFD(SRepCIDRTree *cidr_ctx, FILE *fp)
+{
+    return SRepLoadFileFromFDInternal(cidr_ctx, fp, 1);
+}
+
+static int SRepLoadFileFromFDInternal(SRepCIDRTree *cidr_ctx, FILE *fp, int load_hosts)
 {
     char line[8192] = "";
     Address a;
@@ -475,6 +486,9 @@ int SRepLoadFileFromFD(SRepCIDRTree *cidr_ctx, FILE *fp)
         if (r < 0) {
             SCLogError(SC_ERR_NO_REPUTATION, "bad line \"%s\"", line);
         } else if (r == 0) {
+            if (!load_hosts)
+                continue;
+
             if (a.family == AF_INET) {
                 char ipstr[16];
                 PrintInet(AF_INET, (const void *)&a.address, ipstr, sizeof(ipstr));
@@ -536,6 +550,40 @@ int SRepLoadFileFromFD(SRepCIDRTree *cidr_ctx, FILE *fp)
     return 0;
 }
 
+/**
+ *  \brief move the host reputation of the previous version to the new
+ *         version, so that it survives a reload that only applies deltas
+ *
+ *  Hosts with older versions were already outdated and are left to
+ *  time out.
+ */
+static void SRepCarryForward(uint32_t old_version, uint32_t new_version)
+{
+    uint32_t u;
+    uint32_t cnt = 0;
+
+    for (u = 0; u < host_config.hash_size; u++) {
+        HostHashRow *hb = &host_hash[u];
+
+        HRLOCK_LOCK(hb);
+        Host *h = hb->head;
+        while (h != NULL) {
+            HostLock(h);
+            SReputation *r = h->iprep;
+            if (r != NULL && r->version == old_version) {
+                r->version = new_version;
+                cnt++;
+            }
+            HostUnlock(h);
+            h = h->hnext;
+        }
+        HRLOCK_UNLOCK(hb);
+    }
+
+    SCLogDebug("carried %u host reputation entries from version %u to %u",
+            cnt, old_version, new_version);
+}
+
 /**
  *  \brief Create the path if default-rule-path was specified
  *  \param sig_file The name of the file
@@ -641,16 +689,47 @@ int SRepInit(DetectEngineCtx *de_ctx)
         }
     }
 
+    /* with delta files a reload keeps the host entries of the current
+     * version and applies the deltas on top of them. The full files are
+     * then only read for their netblocks, as each detect engine gets its
+     * own netblock trees. */
+    ConfNode *delta_files = ConfGetNode("reputation-delta-files");
+    int incremental = (!init && delta_files != NULL);
+
+    uint32_t prev_version = SRepGetVersion();
     de_ctx->srep_version = SRepIncrVersion();
     SCLogDebug("Reputation version %u", de_ctx->srep_version);
 
+    if (incremental) {
+        SRepCarryForward(prev_version, de_ctx->srep_version);
+    }
+
     /* ok, let's load signature files from the general config */
     if (files != NULL) {
         TAILQ_FOREACH(file, &files->head, next) {
             sfile = SRepCompleteFilePath(file->val);
-            SCLogInfo("Loading reputation file: %s", sfile);
+            if (incremental) {
+                SCLogInfo("Loading reputation netblocks from: %s", sfile);
+            } else {
+                SCLogInfo("Loading reputation file: %s", sfile);
+            }
+
+            r = SRepLoadFile(cidr_ctx, sfile, !incremental);
+            if (r < 0){
+                if (de_ctx->failure_fatal == 1) {
+                    exit(EXIT_FAILURE);
+                }
+            }
+            SCFree(sfile);
+        }
+    }
+
+    if (delta_files != NULL) {
+        TAILQ_FOREACH(file, &delta_files->head, next) {
+            sfile = SRepCompleteFilePath(file->val);
+            SCLogInfo("Loading reputation delta file: %s", sfile);
 
-            r = SRepLoadFile(cidr_ctx, sfile);
+            r = SRepLoadFile(cidr_ctx, sfile, 1);
             if (r < 0){
                 if (de_ctx->failure_fatal == 1) {
                     exit(EXIT_FAILURE);
@@ -666,6 +745,15 @@ int SRepInit(DetectEngineCtx *de_ctx)
         SRepInitComplete();
     }
 
+    /* single addresses live in the host table. With long hash rows every
+     * insert walks the row, which makes loading large files very slow. */
+    uint32_t hosts = SC_ATOMIC_GET(host_counter);
+    if (hosts / 16 > host_config.hash_size) {
+        SCLogWarning(SC_ERR_NO_REPUTATION, "%u hosts in a host table with "
+                "%u rows, consider increasing host.hash-size to speed up "
+                "reputation loading and lookups", hosts, host_config.hash_size);
+    }
+
     HostPrintStats();
     return 0;
 }
@@ -697,6 +785,7 @@ void SRepDestroy(DetectEngineCtx *de_ctx) {
 #include "stream-tcp-reassemble.h"
 #include "stream-tcp.h"
 #include "util-unittest-helper.h"
+#include "util-fmemopen.h"
 
 static int SRepTest01(void)
 {
@@ -890,6 +979,59 @@ end:
     return result;
 }
 
+static SReputation *SRepTestGetHostRep(const char *ip)
+{
+    Address a;
+    memset(&a, 0, sizeof(a));
+    a.family = AF_INET;
+    if (inet_pton(AF_INET, ip, &a.address) != 1)
+        return NULL;
+
+    Host *h = HostLookupHostFromHash(&a);
+    if (h == NULL)
+        return NULL;
+    SReputation *r = h->iprep;
+    HostRelease(h);
+    return r;
+}
+
+/** \test incremental reload: entries carried forward, delta applied */
+static int SRepTest08(void)
+{
+    char full[] = "1.2.3.4,1,20\n5.6.7.8,1,30\n";
+    char delta[] = "1.2.3.4,1,0\n9.9.9.9,1,40\n";
+
+    HostInitConfig(HOST_QUIET);
+    SRepResetVersion();
+
+    uint32_t v1 = SRepIncrVersion();
+    FILE *fp = SCFmemopen(full, strlen(full), "r");
+    FAIL_IF_NULL(fp);
+    FAIL_IF(SRepLoadFileFromFD(NULL, fp) != 0);
+    fclose(fp);
+
+    uint32_t v2 = SRepIncrVersion();
+    SRepCarryForward(v1, v2);
+    fp = SCFmemopen(delta, strlen(delta), "r");
+    FAIL_IF_NULL(fp);
+    FAIL_IF(SRepLoadFileFromFD(NULL, fp) != 0);
+    fclose(fp);
+
+    SReputation *r = SRepTestGetHostRep("1.2.3.4");
+    FAIL_IF_NULL(r);
+    FAIL_IF(r->version != v2 || r->rep[1] != 0);
+    r = SRepTestGetHostRep("5.6.7.8");
+    FAIL_IF_NULL(r);
+    FAIL_IF(r->version != v2 || r->rep[1] != 30);
+    r = SRepTestGetHostRep("9.9.9.9");
+    FAIL_IF_NULL(r);
+    FAIL_IF(r->version != v2 || r->rep[1] != 40);
+
+    HostShutdown();
+    SRepResetVersion();
+    PASS;
+}
+
 static int SRepTest07(void) {
     char str[] = "2000:0000:0000:0000:0000:0000:0000:0001,";
     int result = 0;
@@ -2347,6 +2489,7 @@ void SCReputationRegisterTests(void)
     UtRegisterTest("SRepTest05", SRepTest05);
     UtRegisterTest("SRepTest06", SRepTest06);
     UtRegisterTest("SRepTest07", SRepTest07);
+    UtRegisterTest("SRepTest08", SRepTest08);
 #endif /* UNITTESTS */
 }
 
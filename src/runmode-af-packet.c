@@ -99,6 +99,41 @@ void AFPDerefConfig(void *conf)
  * interface. */
 static int cluster_id_auto = 1;
 
+/**
+ * \brief check that the NIC's RSS matches a hardware steered cluster
+ *
+ * cluster_qm and cluster_cpu rely on the NIC to keep both directions of
+ * a flow on one queue, cluster_qm also on one queue per thread. With
+ * 'set-rss' we try to fix what's not, otherwise we warn.
+ *
+ * \param threads thread count the queues should match, 0 to not check
+ */
+static void AFPCheckRSS(const char *iface, int threads, int set_rss)
+{
+    int queues = threads ? GetIfaceRSSQueuesNum(iface) : 0;
+    if (queues > 0 && queues != threads) {
+        if (set_rss && SetIfaceRSSQueuesNum(iface, threads) == 0) {
+            SCLogConfig("Set %d RSS queues on iface %s to match the "
+                    "thread count", threads, iface);
+        } else {
+            SCLogWarning(SC_ERR_AFP_CREATE, "iface %s has %d RSS queues "
+                    "but %d threads are used, packets from one queue will "
+                    "be spread over threads", iface, queues, threads);
+        }
+    }
+
+    if (GetIfaceRSSSymmetric(iface) == 0) {
+        if (set_rss && SetIfaceRSSSymmetric(iface) == 0) {
+            SCLogConfig("Set symmetric RSS hash key on iface %s", iface);
+        } else {
+            SCLogWarning(SC_ERR_AFP_CREATE, "RSS hash key of iface %s is "
+                    "not symmetric, the two directions of a flow can be "
+                    "handled by different threads. Enable 'set-rss' or "
+                    "set a symmetric key with ethtool -X", iface);
+        }
+    }
+}
+
 /**
  * \brief extract information from config file
  *
@@ -123,6 +158,8 @@ void *ParseAFPConfig(const char *iface)
     char *bpf_filter = NULL;
     char *out_iface = NULL;
     int cluster_type = PACKET_FANOUT_HASH;
+    int set_rss = 0;
+    int max_threads = 0;
 
     if (iface == NULL) {
         return NULL;
@@ -137,6 +174,9 @@ void *ParseAFPConfig(const char *iface)
     aconf->threads = 0;
     SC_ATOMIC_INIT(aconf->ref);
     (void) SC_ATOMIC_ADD(aconf->ref, 1);
+    SC_ATOMIC_INIT(aconf->thread_idx);
+    aconf->autoscale_high = 60;
+    aconf->autoscale_low = 10;
     aconf->buffer_size = 0;
     aconf->cluster_id = 1;
     aconf->cluster_type = cluster_type | PACKET_FANOUT_FLAG_DEFRAG;
@@ -193,6 +233,24 @@ void *ParseAFPConfig(const char *iface)
         }
     }
 
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "max-threads", &value) == 1) {
+        if (value > 0 && value <= UINT8_MAX)
+            max_threads = (int)value;
+        else
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid max-threads %"PRIdMAX
+                    " for iface %s, ignoring it", value, iface);
+    }
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "autoscale",
+                                           &aconf->autoscale);
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "autoscale-high", &value) == 1) {
+        if (value > 0 && value <= 100)
+            aconf->autoscale_high = (int)value;
+    }
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "autoscale-low", &value) == 1) {
+        if (value >= 0 && value < aconf->autoscale_high)
+            aconf->autoscale_low = (int)value;
+    }
+
     if (ConfGetChildValueWithDefault(if_root, if_default, "copy-iface", &out_iface) == 1) {
         if (strlen(out_iface) > 0) {
             aconf->out_iface = out_iface;
@@ -220,7 +278,8 @@ void *ParseAFPConfig(const char *iface)
                                              "tpacket-v3", (int *)&boolval) == 1)
         {
             if (boolval) {
-                if (strcasecmp(RunmodeGetActive(), "workers") == 0) {
+                if (strcasecmp(RunmodeGetActive(), "workers") == 0 &&
+                        !threading_pipelined) {
 #ifdef HAVE_TPACKET_V3
                     SCLogConfig("Enabling tpacket v3 capture on iface %s",
                             aconf->iface);
@@ -231,8 +290,8 @@ void *ParseAFPConfig(const char *iface)
 #endif
                 } else {
                     SCLogWarning(SC_ERR_RUNMODE,
-                            "tpacket v3 is only implemented for 'workers' runmode."
-                            " Switching to tpacket v2.");
+                            "tpacket v3 is only implemented for 'workers' runmode"
+                            " without 'threading.pipelined'. Switching to tpacket v2.");
                     aconf->flags &= ~AFP_TPACKET_V3;
                 }
             } else {
@@ -274,6 +333,23 @@ void *ParseAFPConfig(const char *iface)
         }
     }
 
+    /* packets forwarded to this iface go out through a TX ring */
+    int tx_ring = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "tx-ring", &tx_ring);
+    if (tx_ring) {
+        if (!(aconf->flags & AFP_RING_MODE)) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "tx-ring requires use-mmap, "
+                    "disabling it on iface %s", aconf->iface);
+        } else if (aconf->flags & AFP_TPACKET_V3) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "tx-ring is not supported "
+                    "with tpacket-v3, disabling it on iface %s", aconf->iface);
+        } else {
+            SCLogConfig("Sending the packets forwarded to iface %s through "
+                    "a TX ring", aconf->iface);
+            aconf->flags |= AFP_TX_RING;
+        }
+    }
+
     if (ConfGetChildValueWithDefault(if_root, if_default, "cluster-id", &tmpclusterid) != 1) {
         aconf->cluster_id = (uint16_t)(cluster_id_auto++);
     } else {
@@ -338,6 +414,29 @@ void *ParseAFPConfig(const char *iface)
         aconf->cluster_type |= PACKET_FANOUT_FLAG_ROLLOVER;
     }
 
+    conf_val = 0;
+    ConfGetChildValueBoolWithDefault(if_root, if_default, "bypass", &conf_val);
+    if (conf_val) {
+        if (!(aconf->flags & AFP_RING_MODE)) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "bypass requires use-mmap, "
+                    "disabling it on iface %s", aconf->iface);
+        } else if (aconf->copy_mode != AFP_COPY_MODE_NONE) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "bypass is not supported in "
+                    "copy-mode as the packets would not be forwarded, "
+                    "disabling it on iface %s", aconf->iface);
+        } else if (aconf->threads != 1 && (cluster_type != PACKET_FANOUT_HASH ||
+                    (aconf->cluster_type & PACKET_FANOUT_FLAG_ROLLOVER))) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "bypass requires cluster_flow "
+                    "without rollover, disabling it on iface %s", aconf->iface);
+        } else {
+            SCLogConfig("Enabling kernel bypass of flows on iface %s",
+                    aconf->iface);
+            aconf->flags |= AFP_BYPASS;
+        }
+    }
+
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "set-rss", &set_rss);
+
     /*load af_packet bpf filter*/
     /* command line value has precedence */
     if (ConfGet("bpf-filter", &bpf_filter) != 1) {
@@ -431,6 +530,40 @@ finalize:
     if (aconf->threads <= 0) {
         aconf->threads = 1;
     }
+
+    /* runtime scaling: 'max-threads' workers are set up and 'threads' of
+     * them capture, the others are parked with their socket closed. Only
+     * with flow based fanout, so the kernel keeps a flow on one socket,
+     * and not in IPS mode where the threads are peered. */
+    aconf->threads_active = aconf->threads;
+    int scalable = (aconf->copy_mode == AFP_COPY_MODE_NONE &&
+            cluster_type == PACKET_FANOUT_HASH &&
+            !(aconf->cluster_type & PACKET_FANOUT_FLAG_ROLLOVER) &&
+            (aconf->threads > 1 || max_threads > 1) && AFPIsFanoutSupported());
+    if (max_threads > aconf->threads) {
+        if (scalable) {
+            aconf->threads = max_threads;
+            SCLogConfig("%s: %d workers capturing, up to %d at runtime",
+                    iface, aconf->threads_active, aconf->threads);
+        } else {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "%s: max-threads needs cluster_flow "
+                    "without rollover and no copy-mode, ignoring it", iface);
+        }
+    }
+    LiveDevice *ld = LiveGetDevice(iface);
+    if (ld != NULL && scalable)
+        LiveDeviceSetWorkersMax(ld, aconf->threads, aconf->threads_active);
+    if (aconf->autoscale && !scalable) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "%s: the worker count can't change, "
+                "autoscale disabled", iface);
+        aconf->autoscale = 0;
+    }
+
+    if (cluster_type == PACKET_FANOUT_QM || cluster_type == PACKET_FANOUT_CPU) {
+        AFPCheckRSS(iface, cluster_type == PACKET_FANOUT_QM ? aconf->threads : 0,
+                set_rss);
+    }
+
     SC_ATOMIC_RESET(aconf->ref);
     (void) SC_ATOMIC_ADD(aconf->ref, aconf->threads);
 
@@ -463,7 +596,9 @@ finalize:
     }
 
     char *active_runmode = RunmodeGetActive();
-    if (active_runmode && !strcmp("workers", active_runmode)) {
+    /* pipelined workers release the packets in the detect thread */
+    if (active_runmode && !strcmp("workers", active_runmode) &&
+            !threading_pipelined) {
         aconf->flags |= AFP_ZERO_COPY;
     } else {
         /* If we are using copy mode we need a lock */
@@ -567,6 +702,51 @@ int AFPRunModeIsIPS()
     return has_ips;
 }
 
+/**
+ * \brief check if all interfaces use the mmap ring, so that all packets
+ *        are handed over zero copy (see ParseAFPConfig)
+ *
+ * \retval 1 if so, 0 otherwise
+ */
+int AFPRunModeIsZeroCopy(void)
+{
+    int nlive = LiveGetDeviceCount();
+    int ldev;
+    ConfNode *if_root;
+    ConfNode *if_default = NULL;
+    ConfNode *af_packet_node;
+
+    af_packet_node = ConfGetNode("af-packet");
+    if (af_packet_node == NULL || nlive == 0) {
+        return 0;
+    }
+
+    if_default = ConfNodeLookupKeyValue(af_packet_node, "interface", "default");
+
+    for (ldev = 0; ldev < nlive; ldev++) {
+        const char *live_dev = LiveGetDeviceName(ldev);
+        if (live_dev == NULL) {
+            return 0;
+        }
+        if_root = ConfFindDeviceConfig(af_packet_node, live_dev);
+        if (if_root == NULL) {
+            if (if_default == NULL) {
+                return 0;
+            }
+            if_root = if_default;
+        }
+
+        /* use-mmap defaults to yes */
+        int boolval = 1;
+        (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "use-mmap", &boolval);
+        if (!boolval) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
 #endif
 
 
@@ -679,11 +859,21 @@ int RunModeIdsAFPWorkers(void)
         exit(EXIT_FAILURE);
     }
 
-    ret = RunModeSetLiveCaptureWorkers(ParseAFPConfig,
-                                    AFPConfigGeThreadsCount,
-                                    "ReceiveAFP",
-                                    "DecodeAFP", thread_name_workers,
-                                    live_dev);
+    if (threading_pipelined) {
+        SCLogConfig("pipelined workers: detection and outputs run on a "
+                "thread of their own");
+        ret = RunModeSetLiveCapturePipelined(ParseAFPConfig,
+                                        AFPConfigGeThreadsCount,
+                                        "ReceiveAFP",
+                                        "DecodeAFP", thread_name_workers,
+                                        live_dev);
+    } else {
+        ret = RunModeSetLiveCaptureWorkers(ParseAFPConfig,
+                                        AFPConfigGeThreadsCount,
+                                        "ReceiveAFP",
+                                        "DecodeAFP", thread_name_workers,
+                                        live_dev);
+    }
     if (ret != 0) {
         SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
         exit(EXIT_FAILURE);
@@ -45,6 +45,8 @@
 static const char *default_mode = NULL;
 #ifdef HAVE_NAPATECH
 static int num_configured_streams = 0;
+static int nt_zero_copy = 0;
+static int nt_bypass = 0;
 #endif
 
 const char *RunModeNapatechGetDefaultMode(void)
@@ -170,6 +172,9 @@ void *NapatechConfigParser(const char *device)
     if (ConfGetInt("napatech.hba", &conf->hba) == 0)
         conf->hba = -1;
 
+    conf->zero_copy = nt_zero_copy;
+    conf->bypass = nt_bypass;
+
     return (void *) conf;
 }
 
@@ -200,6 +205,25 @@ static int NapatechInit(int runmode)
         exit(EXIT_FAILURE);
     }
 
+    /* the packets reference the host buffer segment, which is released
+     * as soon as the capture thread is done with it. Only in workers mode
+     * the packets are done by then. */
+    if (ConfGetBool("napatech.zero-copy", &nt_zero_copy) == 1 && nt_zero_copy) {
+        if (runmode != NT_RUNMODE_WORKERS) {
+            SCLogWarning(SC_ERR_NAPATECH_PARSE_CONFIG, "napatech.zero-copy "
+                    "requires the workers runmode, copying packets");
+            nt_zero_copy = 0;
+        }
+    }
+
+    if (ConfGetBool("napatech.bypass", &nt_bypass) == 1 && nt_bypass) {
+        if (NapatechBypassSetup() < 0) {
+            SCLogWarning(SC_ERR_NAPATECH_CONFIG_STREAM, "napatech.bypass: can't "
+                    "set up the adapter filter, flows are bypassed in software");
+            nt_bypass = 0;
+        }
+    }
+
     switch(runmode) {
         case NT_RUNMODE_AUTOFP:
             ret = RunModeSetLiveCaptureAutoFp(NapatechConfigParser, NapatechGetThreadsCount,
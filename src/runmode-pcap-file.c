@@ -52,6 +52,11 @@ void RunModeFilePcapRegister(void)
                               "the same flow can be processed by any detect "
                               "thread",
                               RunModeFilePcapAutoFp);
+    RunModeRegisterNewRunMode(RUNMODE_PCAP_FILE, "workers",
+                              "Workers pcap file mode, each thread reads "
+                              "the file and processes a flow hashed share "
+                              "of its packets",
+                              RunModeFilePcapWorkers);
 
     return;
 }
@@ -73,6 +78,7 @@ int RunModeFilePcapSingle(void)
     TimeModeSetOffline();
 
     PcapFileGlobalInit();
+    PcapFileSetReaders(1);
 
     snprintf(tname, sizeof(tname), "%s#01", thread_name_single);
 
@@ -268,3 +274,84 @@ int RunModeFilePcapAutoFp(void)
 
     return 0;
 }
+
+/**
+ * \brief RunModeFilePcapWorkers sets up worker threads that each read
+ *        the pcap file and run the full pipeline on their flow hashed
+ *        share of its packets.
+ *
+ * \retval 0 If all goes well. (If any problem is detected the engine will
+ *           exit()).
+ */
+int RunModeFilePcapWorkers(void)
+{
+    SCEnter();
+    char tname[TM_THREAD_NAME_MAX];
+    int thread;
+
+    RunModeInitialize();
+
+    char *file = NULL;
+    if (ConfGet("pcap-file.file", &file) == 0) {
+        SCLogError(SC_ERR_RUNMODE, "Failed retrieving pcap-file from Conf");
+        exit(EXIT_FAILURE);
+    }
+    SCLogDebug("file %s", file);
+
+    TimeModeSetOffline();
+
+    PcapFileGlobalInit();
+
+    int thread_max = TmThreadGetNbThreads(WORKER_CPU_SET);
+    if (thread_max == 0)
+        thread_max = UtilCpuGetNumProcessorsOnline();
+    if (thread_max < 1)
+        thread_max = 1;
+
+    PcapFileSetReaders((uint16_t)thread_max);
+
+    for (thread = 0; thread < thread_max; thread++) {
+        snprintf(tname, sizeof(tname), "%s#%02u", thread_name_workers, thread+1);
+
+        ThreadVars *tv = TmThreadCreatePacketHandler(tname,
+                                                     "packetpool", "packetpool",
+                                                     "packetpool", "packetpool",
+                                                     "pktacqloop");
+        if (tv == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "threading setup failed");
+            exit(EXIT_FAILURE);
+        }
+
+        TmModule *tm_module = TmModuleGetByName("ReceivePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcap");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, file);
+
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+        tm_module = TmModuleGetByName("FlowWorker");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+        SetupOutputs(tv);
+
+        TmThreadSetCPU(tv, WORKER_CPU_SET);
+
+        if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return 0;
+}
@@ -118,6 +118,7 @@ void *OldParsePfringConfig(const char *iface)
     pfconf->DerefFunc = PfringDerefConfig;
     pfconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
     SC_ATOMIC_INIT(pfconf->ref);
+    SC_ATOMIC_INIT(pfconf->zc_queue);
     (void) SC_ATOMIC_ADD(pfconf->ref, 1);
 
     /* Find initial node */
@@ -221,6 +222,7 @@ void *ParsePfringConfig(const char *iface)
 #endif
     pfconf->DerefFunc = PfringDerefConfig;
     SC_ATOMIC_INIT(pfconf->ref);
+    SC_ATOMIC_INIT(pfconf->zc_queue);
     (void) SC_ATOMIC_ADD(pfconf->ref, 1);
 
     /* Find initial node */
@@ -0,0 +1,290 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/** \file
+ *
+ *  Runmodes of the synthetic traffic source.
+ */
+
+#include "suricata-common.h"
+#include "tm-threads.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "runmode-synthetic.h"
+#include "source-synthetic.h"
+#include "output.h"
+
+#include "detect-engine.h"
+
+#include "util-debug.h"
+#include "util-time.h"
+#include "util-cpu.h"
+#include "util-affinity.h"
+
+#include "util-runmodes.h"
+
+static const char *default_mode;
+
+const char *RunModeSyntheticGetDefaultMode(void)
+{
+    return default_mode;
+}
+
+void RunModeSyntheticRegister(void)
+{
+    default_mode = "workers";
+
+    RunModeRegisterNewRunMode(RUNMODE_SYNTHETIC, "single",
+        "Single threaded synthetic traffic mode",
+        RunModeSyntheticSingle);
+
+    RunModeRegisterNewRunMode(RUNMODE_SYNTHETIC, "autofp",
+        "Multi threaded synthetic traffic mode.  Packets from "
+        "each flow are assigned to a single detect thread",
+        RunModeSyntheticAutoFp);
+
+    RunModeRegisterNewRunMode(RUNMODE_SYNTHETIC, "workers",
+        "Workers synthetic traffic mode, each thread generates "
+        "its own flows and runs the full pipeline on them",
+        RunModeSyntheticWorkers);
+
+    return;
+}
+
+/** \internal
+ *  \brief add the generator and decoder slots to 'tv' */
+static void RunModeSyntheticAppendSource(ThreadVars *tv)
+{
+    TmModule *tm_module = TmModuleGetByName("ReceiveSynthetic");
+    if (tm_module == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceiveSynthetic");
+        exit(EXIT_FAILURE);
+    }
+    TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+    tm_module = TmModuleGetByName("DecodeSynthetic");
+    if (tm_module == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodeSynthetic failed");
+        exit(EXIT_FAILURE);
+    }
+    TmSlotSetFuncAppend(tv, tm_module, NULL);
+}
+
+int RunModeSyntheticSingle(void)
+{
+    SCEnter();
+
+    RunModeInitialize();
+
+    TimeModeSetOffline();
+
+    SyntheticGlobalInit();
+    SyntheticSetGenerators(1);
+
+    ThreadVars *tv = TmThreadCreatePacketHandler(thread_name_single,
+        "packetpool", "packetpool",
+        "packetpool", "packetpool",
+        "pktacqloop");
+    if (tv == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "threading setup failed");
+        exit(EXIT_FAILURE);
+    }
+
+    RunModeSyntheticAppendSource(tv);
+
+    TmModule *tm_module = TmModuleGetByName("FlowWorker");
+    if (tm_module == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
+        exit(EXIT_FAILURE);
+    }
+    TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+    SetupOutputs(tv);
+
+    TmThreadSetCPU(tv, WORKER_CPU_SET);
+
+    if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+        SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogInfo("RunModeSyntheticSingle initialised");
+
+    SCReturnInt(0);
+}
+
+/**
+ * \brief synthetic.threads generator threads (default 1) feeding the
+ *        flow hashed pickup queues of the detect threads.
+ */
+int RunModeSyntheticAutoFp(void)
+{
+    SCEnter();
+    char tname[TM_THREAD_NAME_MAX];
+    char qname[TM_QUEUE_NAME_MAX];
+    char *queues = NULL;
+    int thread;
+
+    RunModeInitialize();
+
+    TimeModeSetOffline();
+
+    SyntheticGlobalInit();
+
+    int generators = SyntheticGetThreads();
+    if (generators == 0)
+        generators = 1;
+    SyntheticSetGenerators((uint16_t)generators);
+
+    /* always create at least one thread */
+    int thread_max = TmThreadGetNbThreads(WORKER_CPU_SET);
+    if (thread_max == 0)
+        thread_max = UtilCpuGetNumProcessorsOnline() * threading_detect_ratio;
+    if (thread_max < 1)
+        thread_max = 1;
+
+    queues = RunmodeAutoFpCreatePickupQueuesString(thread_max);
+    if (queues == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "RunmodeAutoFpCreatePickupQueuesString failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (thread = 0; thread < generators; thread++) {
+        snprintf(tname, sizeof(tname), "%s#%02d", thread_name_autofp, thread+1);
+
+        ThreadVars *tv = TmThreadCreatePacketHandler(tname,
+                                                     "packetpool", "packetpool",
+                                                     queues, "flow",
+                                                     "pktacqloop");
+        if (tv == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "threading setup failed");
+            exit(EXIT_FAILURE);
+        }
+
+        RunModeSyntheticAppendSource(tv);
+
+        TmThreadSetCPU(tv, RECEIVE_CPU_SET);
+
+        if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    SCFree(queues);
+
+    for (thread = 0; thread < thread_max; thread++) {
+        snprintf(tname, sizeof(tname), "%s#%02d", thread_name_workers, thread+1);
+        snprintf(qname, sizeof(qname), "pickup%d", thread+1);
+
+        SCLogDebug("tname %s, qname %s", tname, qname);
+
+        ThreadVars *tv_detect_ncpu =
+            TmThreadCreatePacketHandler(tname,
+                                        qname, "flow",
+                                        "packetpool", "packetpool",
+                                        "varslot");
+        if (tv_detect_ncpu == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
+            exit(EXIT_FAILURE);
+        }
+
+        TmModule *tm_module = TmModuleGetByName("FlowWorker");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
+
+        TmThreadSetGroupName(tv_detect_ncpu, "Detect");
+
+        /* add outputs as well */
+        SetupOutputs(tv_detect_ncpu);
+
+        TmThreadSetCPU(tv_detect_ncpu, WORKER_CPU_SET);
+
+        if (TmThreadSpawn(tv_detect_ncpu) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    SCLogInfo("RunModeSyntheticAutoFp initialised");
+
+    SCReturnInt(0);
+}
+
+/**
+ * \brief worker threads that each generate their own flows, as many
+ *        as synthetic.threads, the worker cpu set or the cpus.
+ */
+int RunModeSyntheticWorkers(void)
+{
+    SCEnter();
+    char tname[TM_THREAD_NAME_MAX];
+    int thread;
+
+    RunModeInitialize();
+
+    TimeModeSetOffline();
+
+    SyntheticGlobalInit();
+
+    int thread_max = SyntheticGetThreads();
+    if (thread_max == 0)
+        thread_max = TmThreadGetNbThreads(WORKER_CPU_SET);
+    if (thread_max == 0)
+        thread_max = UtilCpuGetNumProcessorsOnline();
+    if (thread_max < 1)
+        thread_max = 1;
+
+    SyntheticSetGenerators((uint16_t)thread_max);
+
+    for (thread = 0; thread < thread_max; thread++) {
+        snprintf(tname, sizeof(tname), "%s#%02d", thread_name_workers, thread+1);
+
+        ThreadVars *tv = TmThreadCreatePacketHandler(tname,
+                                                     "packetpool", "packetpool",
+                                                     "packetpool", "packetpool",
+                                                     "pktacqloop");
+        if (tv == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "threading setup failed");
+            exit(EXIT_FAILURE);
+        }
+
+        RunModeSyntheticAppendSource(tv);
+
+        TmModule *tm_module = TmModuleGetByName("FlowWorker");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+        SetupOutputs(tv);
+
+        TmThreadSetCPU(tv, WORKER_CPU_SET);
+
+        if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    SCLogInfo("RunModeSyntheticWorkers initialised");
+
+    SCReturnInt(0);
+}
@@ -52,12 +52,18 @@
 #include "detect-engine-tag.h"
 #include "detect-engine-modbus.h"
 #include "detect-engine-filedata-smtp.h"
+#include "detect-engine-fpstats.h"
+#include "detect-engine-guard.h"
+#include "detect-engine-selftest.h"
+#include "detect-engine-tenant.h"
 #include "detect-fast-pattern.h"
 #include "flow.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
 #include "flow-var.h"
 #include "flow-bit.h"
+#include "flow-embryonic.h"
+#include "flow-heavy.h"
 #include "pkt-var.h"
 
 #include "host.h"
@@ -77,6 +83,8 @@
 #include "app-layer-htp.h"
 #include "app-layer-ftp.h"
 #include "app-layer-ssl.h"
+#include "app-layer-tls-handshake.h"
+#include "app-layer-expectation.h"
 #include "app-layer-ssh.h"
 #include "app-layer-smtp.h"
 
@@ -93,6 +101,8 @@
 #include "util-profiling.h"
 #include "util-magic.h"
 #include "util-memcmp.h"
+#include "util-memuse.h"
+#include "datasets.h"
 #include "util-misc.h"
 #include "util-ringbuffer.h"
 #include "util-signal.h"
@@ -102,6 +112,8 @@
 #include "util-spm.h"
 #include "util-hash.h"
 #include "util-hashlist.h"
+#include "util-hash-word.h"
+#include "util-arena.h"
 #include "util-bloomfilter.h"
 #include "util-bloomfilter-counting.h"
 #include "util-pool.h"
@@ -119,8 +131,16 @@
 #include "tmqh-flow.h"
 #include "defrag.h"
 #include "detect-engine-siggroup.h"
+#include "detect-engine-prefilter.h"
 
 #include "util-streaming-buffer.h"
+#include "util-json-writer.h"
+#include "util-latency.h"
+#include "util-affinity.h"
+#include "util-prealloc.h"
+#include "util-lock-contention.h"
+#include "util-hugepages.h"
+#include "util-profiling-sample.h"
 
 #endif /* UNITTESTS */
 
@@ -145,6 +165,7 @@ void RunUnittests(int list_unittests, char *regex_arg)
     SupportFastPatternForSigMatchTypes();
 
     default_packet_size = DEFAULT_PACKET_SIZE;
+    PacketSetInlineSize(0);
 #ifdef __SC_CUDA_SUPPORT__
     /* Init the CUDA environment */
     SCCudaInitCudaEnvironment();
@@ -192,6 +213,7 @@ void RunUnittests(int list_unittests, char *regex_arg)
 
     AppLayerHtpEnableRequestBodyCallback();
     AppLayerHtpNeedFileInspection();
+    AppLayerHtpNeedRawHeaders();
 
     UtInitialize();
     UTHRegisterTests();
@@ -201,7 +223,15 @@ void RunUnittests(int list_unittests, char *regex_arg)
     TmModuleRegisterTests();
     SigTableRegisterTests();
     HashTableRegisterTests();
+    HashWordRegisterTests();
     HashListTableRegisterTests();
+    ArenaRegisterTests();
+    FpStatsRegisterTests();
+    RuleGuardRegisterTests();
+    DetectTenantRegisterTests();
+    DetectSelfTestRegisterTests();
+    TLSCertCacheRegisterTests();
+    AppLayerExpectationRegisterTests();
     BloomFilterRegisterTests();
     BloomFilterCountingRegisterTests();
     PoolRegisterTests();
@@ -211,6 +241,12 @@ void RunUnittests(int list_unittests, char *regex_arg)
     HostBitRegisterTests();
     IPPairBitRegisterTests();
     StatsRegisterTests();
+    PacketLatencyRegisterTests();
+    AffinityRegisterTests();
+    PreallocRegisterTests();
+    LockContentionRegisterTests();
+    HugepagesRegisterTests();
+    RuleSampleRegisterTests();
     DecodePPPRegisterTests();
     DecodeVLANRegisterTests();
     DecodeRawRegisterTests();
@@ -229,12 +265,15 @@ void RunUnittests(int list_unittests, char *regex_arg)
     ConfYamlRegisterTests();
     TmqhFlowRegisterTests();
     FlowRegisterTests();
+    FlowEmbryonicRegisterTests();
+    FlowHeavyRegisterTests();
     HostRegisterUnittests();
     IPPairRegisterUnittests();
     SCSigRegisterSignatureOrderingTests();
     SCRadixRegisterTests();
     DefragRegisterTests();
     SigGroupHeadRegisterTests();
+    PrefilterRegisterTests();
     SCHInfoRegisterTests();
     SCRuleVarsRegisterTests();
     AppLayerParserRegisterUnittests();
@@ -256,6 +295,8 @@ void RunUnittests(int list_unittests, char *regex_arg)
     DeStateRegisterTests();
     DetectRingBufferRegisterTests();
     MemcmpRegisterTests();
+    MemuseRegisterTests();
+    DatasetsRegisterTests();
     DetectEngineHttpClientBodyRegisterTests();
     DetectEngineHttpServerBodyRegisterTests();
     DetectEngineHttpHeaderRegisterTests();
@@ -285,6 +326,7 @@ void RunUnittests(int list_unittests, char *regex_arg)
     AppLayerUnittestsRegister();
     MimeDecRegisterTests();
     StreamingBufferRegisterTests();
+    JsonWriterRegisterTests();
 
     if (list_unittests) {
         UtListTests(regex_arg);
@@ -294,7 +336,11 @@ void RunUnittests(int list_unittests, char *regex_arg)
         max_pending_packets = 128;
         PacketPoolInit();
 
-        uint32_t failed = UtRunTests(regex_arg);
+        uint32_t failed;
+        if (unittests_benchmarks)
+            failed = UtRunBenchmarks(regex_arg);
+        else
+            failed = UtRunTests(regex_arg);
         PacketPoolDestroy();
         UtCleanup();
 #ifdef BUILD_HYPERSCAN
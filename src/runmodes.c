@@ -161,6 +161,8 @@ static const char *RunModeTranslateModeToName(int runmode)
 #endif
         case RUNMODE_UNIX_SOCKET:
             return "UNIX_SOCKET";
+        case RUNMODE_SYNTHETIC:
+            return "SYNTHETIC";
         default:
             SCLogError(SC_ERR_UNKNOWN_RUN_MODE, "Unknown runtime mode. Aborting");
             exit(EXIT_FAILURE);
@@ -234,6 +236,7 @@ void RunModeRegisterRunModes(void)
     RunModeIdsNflogRegister();
     RunModeTileMpipeRegister();
     RunModeUnixSocketRegister();
+    RunModeSyntheticRegister();
 #ifdef UNITTESTS
     UtRunModeRegister();
 #endif
@@ -339,6 +342,9 @@ void RunModeDispatch(int runmode, const char *custom_mode)
             case RUNMODE_UNIX_SOCKET:
                 custom_mode = RunModeUnixSocketGetDefaultMode();
                 break;
+            case RUNMODE_SYNTHETIC:
+                custom_mode = RunModeSyntheticGetDefaultMode();
+                break;
             case RUNMODE_NFLOG:
                 custom_mode = RunModeIdsNflogGetDefaultMode();
                 break;
@@ -979,19 +985,29 @@ void SetupOutputs(ThreadVars *tv)
 }
 
 float threading_detect_ratio = 1;
+int threading_pipelined = 0;
 
 /**
  * Initialize multithreading settings.
  */
 void RunModeInitialize(void)
 {
+    char *affinity = NULL;
+
     threading_set_cpu_affinity = FALSE;
-    if ((ConfGetBool("threading.set-cpu-affinity", &threading_set_cpu_affinity)) == 0) {
-        threading_set_cpu_affinity = FALSE;
-    }
-    /* try to get custom cpu mask value if needed */
-    if (threading_set_cpu_affinity == TRUE) {
-        AffinitySetupLoadFromConfig();
+    if (ConfGet("threading.set-cpu-affinity", &affinity) == 1 &&
+            affinity != NULL && strcasecmp(affinity, "auto") == 0) {
+        /* build the cpu masks from the topology */
+        threading_set_cpu_affinity = TRUE;
+        AffinitySetupAuto();
+    } else {
+        if ((ConfGetBool("threading.set-cpu-affinity", &threading_set_cpu_affinity)) == 0) {
+            threading_set_cpu_affinity = FALSE;
+        }
+        /* try to get custom cpu mask value if needed */
+        if (threading_set_cpu_affinity == TRUE) {
+            AffinitySetupLoadFromConfig();
+        }
     }
     if ((ConfGetFloat("threading.detect-thread-ratio", &threading_detect_ratio)) != 1) {
         if (ConfGetNode("threading.detect-thread-ratio") != NULL)
@@ -1000,4 +1016,7 @@ void RunModeInitialize(void)
     }
 
     SCLogDebug("threading.detect-thread-ratio %f", threading_detect_ratio);
+
+    if (ConfGetBool("threading.pipelined", &threading_pipelined) != 1)
+        threading_pipelined = 0;
 }
@@ -40,6 +40,7 @@ enum RunModes {
     RUNMODE_UNITTEST,
     RUNMODE_NAPATECH,
     RUNMODE_UNIX_SOCKET,
+    RUNMODE_SYNTHETIC,
     RUNMODE_USER_MAX, /* Last standard running mode */
     RUNMODE_LIST_KEYWORDS,
     RUNMODE_LIST_APP_LAYERS,
@@ -52,6 +53,7 @@ enum RunModes {
     RUNMODE_CONF_TEST,
     RUNMODE_LIST_UNITTEST,
     RUNMODE_ENGINE_ANALYSIS,
+    RUNMODE_APPLAYER_BENCH,
 #ifdef OS_WIN32
     RUNMODE_INSTALL_SERVICE,
     RUNMODE_REMOVE_SERVICE,
@@ -103,9 +105,11 @@ int RunModeOutputFiledataEnabled(void);
 #include "runmode-nflog.h"
 #include "runmode-unix-socket.h"
 #include "runmode-netmap.h"
+#include "runmode-synthetic.h"
 
 int threading_set_cpu_affinity;
 extern float threading_detect_ratio;
+extern int threading_pipelined;
 
 extern int debuglog_enabled;
 
@@ -153,6 +153,13 @@ TmEcode NoAFPSupportExit(ThreadVars *tv, void *initdata, void **data)
 #define AFP_STATE_UP 1
 
 #define AFP_RECONNECT_TIMEOUT 500000
+/** how often a parked thread looks at the active worker count, usec */
+#define AFP_PARK_TIMEOUT 100000
+/** seconds the ring fill has to stay low before the autoscaler parks
+ *  a worker */
+#define AFP_AUTOSCALE_DOWN_SECS 30
+/** seconds the autoscaler waits after a change */
+#define AFP_AUTOSCALE_HOLD_SECS 5
 #define AFP_DOWN_COUNTER_INTERVAL 40
 
 #define POLL_TIMEOUT 100
@@ -169,11 +176,22 @@ TmEcode NoAFPSupportExit(ThreadVars *tv, void *initdata, void **data)
 /** protect pfring_set_bpf_filter, as it is not thread safe */
 static SCMutex afpacket_bpf_set_filter_lock = SCMUTEX_INITIALIZER;
 
+/** kernel 3.16+: checksum verified by the NIC */
+#ifndef TP_STATUS_CSUM_VALID
+#define TP_STATUS_CSUM_VALID    (1 << 7)
+#endif
+
+/** ring wait histogram buckets: <100us, <1ms, <10ms, <100ms, >=100ms */
+#define AFP_WAIT_BUCKETS        5
+/** refresh the wait reference time every this many frames */
+#define AFP_WAIT_TS_REFRESH     32
+
 enum {
     AFP_READ_OK,
     AFP_READ_FAILURE,
     AFP_FAILURE,
     AFP_KERNEL_DROP,
+    AFP_SOCKET_CLOSED,
 };
 
 enum {
@@ -189,6 +207,37 @@ union thdr {
     void *raw;
 };
 
+/** max flows in the kernel bypass filter of a socket */
+#define AFP_BYPASS_MAX_FLOWS    128
+/** seconds after which a bypass entry is removed from the filter. If the
+ *  flow is still active its packets will get it bypassed again. */
+#define AFP_BYPASS_TIMEOUT      30
+
+/** classic BPF instructions per bypassed flow direction */
+#define AFP_BYPASS_INSNS_PER_ENTRY  11
+
+typedef struct AFPBypassEntry_ {
+    uint32_t src;       /**< host order */
+    uint32_t dst;       /**< host order */
+    uint16_t sp;
+    uint16_t dp;
+    uint8_t proto;
+    time_t ts;          /**< time the entry was added */
+} AFPBypassEntry;
+
+/**
+ * \brief per socket table of flows dropped by the kernel
+ *
+ * Entries are added from the threads releasing the packets and are
+ * turned into a socket filter by the capture thread.
+ */
+typedef struct AFPBypassTable_ {
+    SCMutex lock;
+    int cnt;
+    int dirty;              /**< filter needs to be rebuilt */
+    AFPBypassEntry entries[AFP_BYPASS_MAX_FLOWS];
+} AFPBypassTable;
+
 /**
  * \brief Structure to hold thread specific variables.
  */
@@ -215,11 +264,19 @@ typedef struct AFPThreadVars_
     /* references to packet and drop counters */
     uint16_t capture_kernel_packets;
     uint16_t capture_kernel_drops;
+    uint16_t capture_bypass_flows;
+
+    /* ring mode: time packets waited in the ring before we picked them
+     * up, and how full the ring was at the start of a read pass */
+    struct timeval read_ts;
+    uint16_t capture_wait[AFP_WAIT_BUCKETS];
+    uint16_t capture_ring_fill;
+    uint16_t capture_ring_fill_max;
 
     /* handle state */
     uint8_t afp_state;
     uint8_t copy_mode;
-    uint8_t flags;
+    uint16_t flags;
 
     /* IPS peer */
     AFPPeer *mpeer;
@@ -243,6 +300,11 @@ typedef struct AFPThreadVars_
     int buffer_size;
     /* Filter */
     char *bpf_filter;
+    /* compiled user filter, kept to be combined with the bypass filter */
+    struct sock_filter *bpf_insns;
+    unsigned int bpf_len;
+
+    AFPBypassTable *bypass;
 
     int promisc;
 
@@ -253,12 +315,27 @@ typedef struct AFPThreadVars_
 
     int threads;
 
+    /* runtime scaling: index of the thread in the iface's workers, it's
+     * parked while it's not below LiveDevice::workers_active */
+    uint16_t thread_idx;
+    /* autoscaler, run by the first worker only */
+    uint8_t autoscale;
+    uint8_t autoscale_high;
+    uint8_t autoscale_low;
+    uint16_t autoscale_min;
+    uint16_t autoscale_low_secs;
+    uint16_t autoscale_hold;
+
     union {
         struct tpacket_req req;
 #ifdef HAVE_TPACKET_V3
         struct tpacket_req3 req3;
 #endif
     };
+    /* TX ring, mapped after the RX ring, for the packets sent to this
+     * iface by its peer */
+    struct tpacket_req tx_req;
+    char *tx_ring;
 
     char iface[AFP_IFACE_NAME_LENGTH];
     /* IPS output iface */
@@ -335,6 +412,17 @@ void AFPPeerUpdate(AFPThreadVars *ptv)
         return;
     }
     (void)SC_ATOMIC_SET(ptv->mpeer->if_idx, AFPGetIfnumByDev(ptv->socket, ptv->iface, 0));
+    if (ptv->mpeer->tx_ring != ptv->tx_ring) {
+        /* new socket, new ring */
+        ptv->mpeer->tx_block_size = ptv->tx_req.tp_block_size;
+        ptv->mpeer->tx_frames_per_block = ptv->tx_req.tp_frame_size ?
+            ptv->tx_req.tp_block_size / ptv->tx_req.tp_frame_size : 0;
+        ptv->mpeer->tx_frame_size = ptv->tx_req.tp_frame_size;
+        ptv->mpeer->tx_frame_nr = ptv->tx_req.tp_frame_nr;
+        ptv->mpeer->tx_offset = 0;
+        ptv->mpeer->tx_pending = 0;
+        ptv->mpeer->tx_ring = ptv->tx_ring;
+    }
     (void)SC_ATOMIC_SET(ptv->mpeer->socket, ptv->socket);
     (void)SC_ATOMIC_SET(ptv->mpeer->state, ptv->afp_state);
 }
@@ -541,6 +629,57 @@ static inline void AFPDumpCounters(AFPThreadVars *ptv)
 #endif
 }
 
+/**
+ * \brief account the time a packet waited in the ring
+ *
+ * \param sec,usec kernel timestamp of the packet
+ */
+static inline void AFPWaitUpdate(AFPThreadVars *ptv, uint32_t sec, uint32_t usec)
+{
+    int64_t wait = (int64_t)(ptv->read_ts.tv_sec - sec) * 1000000 +
+                   ((int64_t)ptv->read_ts.tv_usec - usec);
+    int b;
+
+    if (wait < 100)
+        b = 0;
+    else if (wait < 1000)
+        b = 1;
+    else if (wait < 10000)
+        b = 2;
+    else if (wait < 100000)
+        b = 3;
+    else
+        b = 4;
+    StatsIncr(ptv->tv, ptv->capture_wait[b]);
+}
+
+/**
+ * \brief update the ring fill level gauges
+ *
+ * \param used frames (V2) or blocks (V3) owned by userspace
+ * \param size frames or blocks in the ring
+ */
+static inline void AFPRingFillUpdate(AFPThreadVars *ptv, unsigned int used,
+                                     unsigned int size)
+{
+    uint64_t pct = (uint64_t)used * 100 / size;
+
+    StatsSetUI64(ptv->tv, ptv->capture_ring_fill, pct);
+    StatsSetUI64(ptv->tv, ptv->capture_ring_fill_max, pct);
+    /* input to the flow worker's overload control */
+    ptv->tv->capture_backlog = (uint8_t)pct;
+
+    /* and to the autoscaler, that wants the highest of the workers */
+    if (ptv->livedev->workers_max > 0) {
+        uint32_t cur;
+        do {
+            cur = SC_ATOMIC_GET(ptv->livedev->workers_backlog);
+            if (pct <= cur)
+                break;
+        } while (SC_ATOMIC_CAS(&ptv->livedev->workers_backlog, cur, (uint32_t)pct) == 0);
+    }
+}
+
 /**
  * \brief AF packet read function.
  *
@@ -649,7 +788,8 @@ int AFPRead(AFPThreadVars *ptv)
 
         aux = (struct tpacket_auxdata *)CMSG_DATA(cmsg);
 
-        if (aux_checksum && (aux->tp_status & TP_STATUS_CSUMNOTREADY)) {
+        if (aux_checksum &&
+                (aux->tp_status & (TP_STATUS_CSUMNOTREADY|TP_STATUS_CSUM_VALID))) {
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
         break;
@@ -662,6 +802,91 @@ int AFPRead(AFPThreadVars *ptv)
     SCReturnInt(AFP_READ_OK);
 }
 
+/** frames filled in a TX ring before the kernel is asked to send them */
+#define AFP_TX_KICK_BATCH   32
+
+/**
+ * \brief ask the kernel to send the filled frames of a peer's TX ring
+ *
+ * \param wait wait until the queued frames are sent
+ */
+static int AFPTxRingKick(AFPPeer *peer, int wait)
+{
+    int socket = SC_ATOMIC_GET(peer->socket);
+
+    peer->tx_pending = 0;
+    if (send(socket, NULL, 0, wait ? 0 : MSG_DONTWAIT) < 0 &&
+            errno != EAGAIN && errno != ENOBUFS) {
+        SCLogWarning(SC_ERR_SOCKET, "Sending TX ring on socket %d failed: %s",
+                socket, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief copy a packet into the TX ring of a peer
+ *
+ * The kernel is kicked once per AFP_TX_KICK_BATCH frames, and by
+ * AFPTxRingFlush() after each read pass of the capture thread. If
+ * several threads send to the peer (AFP_SOCK_PROTECT) every frame is
+ * kicked, as no single thread can flush the ring.
+ */
+static int AFPTxRingWrite(AFPPeer *peer, uint8_t *pkt, unsigned int len)
+{
+    const unsigned int data_offset = TPACKET_ALIGN(sizeof(struct tpacket2_hdr));
+    unsigned int i = peer->tx_offset;
+    union thdr h;
+
+    if (unlikely(len > peer->tx_frame_size - data_offset)) {
+        SCLogWarning(SC_ERR_SOCKET, "Packet of %u bytes is too big for the "
+                "TX ring of %s", len, peer->iface);
+        return -1;
+    }
+
+    h.raw = peer->tx_ring + (i / peer->tx_frames_per_block) * peer->tx_block_size +
+        (i % peer->tx_frames_per_block) * peer->tx_frame_size;
+    if (h.h2->tp_status != TP_STATUS_AVAILABLE) {
+        /* ring is full, wait for the kernel to send what is queued */
+        AFPTxRingKick(peer, 1);
+        if (h.h2->tp_status != TP_STATUS_AVAILABLE) {
+            SCLogDebug("TX ring of %s full", peer->iface);
+            return -1;
+        }
+    }
+
+    memcpy(h.raw + data_offset, pkt, len);
+    h.h2->tp_len = len;
+    /* the frame has to be complete before the kernel sees it */
+    hw_barrier();
+    h.h2->tp_status = TP_STATUS_SEND_REQUEST;
+
+    if (++peer->tx_offset >= peer->tx_frame_nr)
+        peer->tx_offset = 0;
+
+    if ((peer->flags & AFP_SOCK_PROTECT) || ++peer->tx_pending >= AFP_TX_KICK_BATCH)
+        return AFPTxRingKick(peer, 0);
+    return 0;
+}
+
+/**
+ * \brief kick the frames left in the TX ring of a peer
+ */
+static void AFPTxRingFlush(AFPPeer *peer)
+{
+    if (peer == NULL || peer->tx_ring == NULL || peer->tx_pending == 0)
+        return;
+    if (SC_ATOMIC_GET(peer->state) == AFP_STATE_DOWN)
+        return;
+
+    if (peer->flags & AFP_SOCK_PROTECT)
+        SCMutexLock(&peer->sock_protect);
+    if (peer->tx_pending != 0)
+        AFPTxRingKick(peer, 0);
+    if (peer->flags & AFP_SOCK_PROTECT)
+        SCMutexUnlock(&peer->sock_protect);
+}
+
 TmEcode AFPWritePacket(Packet *p)
 {
     struct sockaddr_ll socket_address;
@@ -690,6 +915,12 @@ TmEcode AFPWritePacket(Packet *p)
     /* Send packet, locking the socket if necessary */
     if (p->afp_v.peer->flags & AFP_SOCK_PROTECT)
         SCMutexLock(&p->afp_v.peer->sock_protect);
+    if (p->afp_v.peer->tx_ring != NULL) {
+        int r = AFPTxRingWrite(p->afp_v.peer, GET_PKT_DATA(p), GET_PKT_LEN(p));
+        if (p->afp_v.peer->flags & AFP_SOCK_PROTECT)
+            SCMutexUnlock(&p->afp_v.peer->sock_protect);
+        return (r < 0) ? TM_ECODE_FAILED : TM_ECODE_OK;
+    }
     socket = SC_ATOMIC_GET(p->afp_v.peer->socket);
     if (sendto(socket, GET_PKT_DATA(p), GET_PKT_LEN(p), 0,
                (struct sockaddr*) &socket_address,
@@ -707,6 +938,241 @@ TmEcode AFPWritePacket(Packet *p)
     return TM_ECODE_OK;
 }
 
+/**
+ *  \defgroup afpbypass AF_PACKET kernel bypass
+ *
+ *  Flows Suricata decided not to inspect anymore are added to a table of
+ *  the capture socket. The capture thread turns the table into a classic
+ *  BPF socket filter that drops the flow's packets in the kernel, in front
+ *  of the user bpf-filter. Only IPv4 TCP and UDP over ethernet is handled.
+ *
+ *  @{
+ */
+
+/**
+ * \brief add the flow of a packet to the bypass table
+ *
+ * Called from the thread releasing the packet.
+ */
+static void AFPBypassAdd(AFPBypassTable *bt, const Packet *p)
+{
+    uint32_t src = ntohl(GET_IPV4_SRC_ADDR_U32(p));
+    uint32_t dst = ntohl(GET_IPV4_DST_ADDR_U32(p));
+    int i;
+
+    SCMutexLock(&bt->lock);
+    for (i = 0; i < bt->cnt; i++) {
+        AFPBypassEntry *e = &bt->entries[i];
+        if (e->proto != p->proto)
+            continue;
+        if ((e->src == src && e->dst == dst && e->sp == p->sp && e->dp == p->dp) ||
+            (e->src == dst && e->dst == src && e->sp == p->dp && e->dp == p->sp)) {
+            SCMutexUnlock(&bt->lock);
+            return;
+        }
+    }
+    if (bt->cnt < AFP_BYPASS_MAX_FLOWS) {
+        AFPBypassEntry *e = &bt->entries[bt->cnt++];
+        e->src = src;
+        e->dst = dst;
+        e->sp = p->sp;
+        e->dp = p->dp;
+        e->proto = p->proto;
+        e->ts = p->ts.tv_sec;
+        bt->dirty = 1;
+    }
+    SCMutexUnlock(&bt->lock);
+}
+
+/**
+ * \brief Packet::BypassPacketsFlow callback: bypass the flow in the kernel
+ *
+ * \retval 1 if the flow was added to the bypass filter, 0 otherwise
+ */
+static int AFPBypassCallback(Packet *p)
+{
+    if (p->afp_v.bypass == NULL || PKT_IS_PSEUDOPKT(p))
+        return 0;
+    if (!PKT_IS_IPV4(p) || !(PKT_IS_TCP(p) || PKT_IS_UDP(p)))
+        return 0;
+
+    AFPBypassAdd(p->afp_v.bypass, p);
+    return 1;
+}
+
+/**
+ * \brief bypass the packet's flow in the kernel if it was marked as such
+ */
+static inline void AFPBypassCheck(Packet *p)
+{
+    if (!(p->flags & PKT_NOPACKET_INSPECTION))
+        return;
+
+    (void)AFPBypassCallback(p);
+}
+
+/** \internal
+ *  \brief add the checks dropping one direction of a flow */
+static unsigned int AFPBypassFilterAddEntry(struct sock_filter *insns,
+        unsigned int n, uint8_t proto, uint32_t src, uint32_t dst,
+        uint16_t sp, uint16_t dp)
+{
+    /* on a mismatch, jump over the rest of this entry */
+    insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_MEM, 0);
+    insns[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, proto, 0, 9);
+    insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_MEM, 1);
+    insns[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, src, 0, 7);
+    insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_MEM, 2);
+    insns[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, dst, 0, 5);
+    insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_MEM, 3);
+    insns[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, sp, 0, 3);
+    insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_MEM, 4);
+    insns[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, dp, 0, 1);
+    insns[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, 0);
+    return n;
+}
+
+/**
+ * \brief build the bypass filter and attach it to the socket
+ *
+ * Layout: extract the tuple of IPv4 packets into the scratch memory,
+ * compare it against each bypassed flow direction and drop on a match.
+ * Everything else ends up in the user bpf-filter, or is accepted.
+ *
+ * \retval 0 on success, -1 on error
+ */
+static int AFPBypassAttachFilter(AFPThreadVars *ptv,
+        const AFPBypassEntry *entries, int cnt)
+{
+    unsigned int n = 0;
+    unsigned int ja[4];
+    unsigned int ja_cnt = 0;
+    unsigned int u;
+    int i;
+
+    /* room for the prologue, the user filter and as many entries as fit */
+    unsigned int user_len = ptv->bpf_insns ? ptv->bpf_len : 1;
+    unsigned int max = BPF_MAXINSNS - 16 - user_len;
+    if ((unsigned int)cnt * 2 * AFP_BYPASS_INSNS_PER_ENTRY > max)
+        cnt = max / (2 * AFP_BYPASS_INSNS_PER_ENTRY);
+
+    struct sock_filter *insns = SCMalloc(BPF_MAXINSNS * sizeof(struct sock_filter));
+    if (insns == NULL)
+        return -1;
+
+    if (cnt > 0) {
+        /* IPv4 only */
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12);
+        insns[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 1, 0);
+        ja[ja_cnt++] = n++;
+        /* fixed part of the IPv4 header has to be there */
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_LEN, 0);
+        insns[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 34, 1, 0);
+        ja[ja_cnt++] = n++;
+        /* no ports in non-first fragments */
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 20);
+        insns[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x1fff, 0, 1);
+        ja[ja_cnt++] = n++;
+        /* ports have to be there as well */
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, 14);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_MISC|BPF_TXA, 0);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 18);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_MISC|BPF_TAX, 0);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_LEN, 0);
+        insns[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JGE|BPF_X, 0, 1, 0);
+        ja[ja_cnt++] = n++;
+        /* M[0] proto, M[1] src, M[2] dst, M[3] sp, M[4] dp */
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 23);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_ST, 0);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 26);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_ST, 1);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 30);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_ST, 2);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, 14);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_IND, 14);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_ST, 3);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_IND, 16);
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_ST, 4);
+
+        for (i = 0; i < cnt; i++) {
+            const AFPBypassEntry *e = &entries[i];
+            n = AFPBypassFilterAddEntry(insns, n, e->proto, e->src, e->dst, e->sp, e->dp);
+            n = AFPBypassFilterAddEntry(insns, n, e->proto, e->dst, e->src, e->dp, e->sp);
+        }
+
+        /* everything that is not bypassed continues at the user filter */
+        for (u = 0; u < ja_cnt; u++) {
+            insns[ja[u]] = (struct sock_filter)BPF_STMT(BPF_JMP|BPF_JA, n - (ja[u] + 1));
+        }
+    }
+
+    if (ptv->bpf_insns != NULL) {
+        memcpy(&insns[n], ptv->bpf_insns, ptv->bpf_len * sizeof(struct sock_filter));
+        n += ptv->bpf_len;
+    } else {
+        insns[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, 0xffffffff);
+    }
+
+    struct sock_fprog fcode;
+    fcode.len = n;
+    fcode.filter = insns;
+
+    int rc = setsockopt(ptv->socket, SOL_SOCKET, SO_ATTACH_FILTER, &fcode, sizeof(fcode));
+    SCFree(insns);
+    if (rc == -1) {
+        SCLogError(SC_ERR_AFP_CREATE, "Failed to attach bypass filter: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief expire old bypass entries and update the socket filter
+ *
+ * Called from the capture thread.
+ */
+static void AFPBypassUpdate(AFPThreadVars *ptv, time_t now)
+{
+    AFPBypassTable *bt = ptv->bypass;
+    AFPBypassEntry entries[AFP_BYPASS_MAX_FLOWS];
+    int cnt = 0;
+    int i;
+
+    /* disabled for this link type */
+    if (ptv->mpeer->bypass == NULL)
+        return;
+
+    SCMutexLock(&bt->lock);
+    for (i = 0; i < bt->cnt; i++) {
+        if (now - bt->entries[i].ts > AFP_BYPASS_TIMEOUT) {
+            bt->dirty = 1;
+            continue;
+        }
+        bt->entries[cnt++] = bt->entries[i];
+    }
+    bt->cnt = cnt;
+
+    if (!bt->dirty || ptv->afp_state != AFP_STATE_UP) {
+        SCMutexUnlock(&bt->lock);
+        return;
+    }
+    memcpy(entries, bt->entries, cnt * sizeof(AFPBypassEntry));
+    bt->dirty = 0;
+    SCMutexUnlock(&bt->lock);
+
+    if (AFPBypassAttachFilter(ptv, entries, cnt) < 0) {
+        /* try again next time */
+        SCMutexLock(&bt->lock);
+        bt->dirty = 1;
+        SCMutexUnlock(&bt->lock);
+    }
+    StatsSetUI64(ptv->tv, ptv->capture_bypass_flows, (uint64_t)cnt);
+}
+
+/**
+ * @}
+ */
+
 void AFPReleaseDataFromRing(Packet *p)
 {
     /* Need to be in copy mode and need to detect early release
@@ -715,6 +1181,8 @@ void AFPReleaseDataFromRing(Packet *p)
         AFPWritePacket(p);
     }
 
+    AFPBypassCheck(p);
+
     if (AFPDerefSocket(p->afp_v.mpeer) == 0)
         goto cleanup;
 
@@ -735,6 +1203,7 @@ void AFPReleasePacketV3(Packet *p)
     if ((p->afp_v.copy_mode != AFP_COPY_MODE_NONE) && !PKT_IS_PSEUDOPKT(p)) {
         AFPWritePacket(p);
     }
+    AFPBypassCheck(p);
     PacketFreeOrRelease(p);
 }
 
@@ -760,7 +1229,16 @@ int AFPReadFromRing(AFPThreadVars *ptv)
     uint8_t emergency_flush = 0;
     int read_pkts = 0;
     int loop_start = -1;
+    unsigned int used = 0;
 
+    /* ring fill level: frames not handed back to the kernel yet */
+    while (used < ptv->req.tp_frame_nr) {
+        h.raw = (((union thdr **)ptv->ring_v2)[(ptv->frame_offset + used) % ptv->req.tp_frame_nr]);
+        if (h.raw == NULL || h.h2->tp_status == TP_STATUS_KERNEL)
+            break;
+        used++;
+    }
+    AFPRingFillUpdate(ptv, used, ptv->req.tp_frame_nr);
 
     /* Loop till we have packets available */
     while (1) {
@@ -821,6 +1299,10 @@ int AFPReadFromRing(AFPThreadVars *ptv)
         ptv->pkts++;
         p->livedev = ptv->livedev;
         p->datalink = ptv->datalink;
+        if (ptv->mpeer->bypass != NULL) {
+            p->afp_v.bypass = ptv->mpeer->bypass;
+            p->BypassPacketsFlow = AFPBypassCallback;
+        }
 
         if (h.h2->tp_len > h.h2->tp_snaplen) {
             SCLogDebug("Packet length (%d) > snaplen (%d), truncating",
@@ -864,12 +1346,19 @@ int AFPReadFromRing(AFPThreadVars *ptv)
         SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
                 GET_PKT_LEN(p), p, GET_PKT_DATA(p));
 
+        if ((read_pkts - 1) % AFP_WAIT_TS_REFRESH == 0)
+            gettimeofday(&ptv->read_ts, NULL);
+        AFPWaitUpdate(ptv, p->ts.tv_sec, p->ts.tv_usec);
+
         /* We only check for checksum disable */
         if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
             p->flags |= PKT_IGNORE_CHECKSUM;
         } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
             if (ptv->livedev->ignore_checksum) {
                 p->flags |= PKT_IGNORE_CHECKSUM;
+            } else if (h.h2->tp_status & TP_STATUS_CSUM_VALID) {
+                /* the NIC verified it already */
+                p->flags |= PKT_IGNORE_CHECKSUM;
             } else if (ChecksumAutoModeCheck(ptv->pkts,
                         SC_ATOMIC_GET(ptv->livedev->pkts),
                         SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
@@ -877,7 +1366,7 @@ int AFPReadFromRing(AFPThreadVars *ptv)
                 p->flags |= PKT_IGNORE_CHECKSUM;
             }
         } else {
-            if (h.h2->tp_status & TP_STATUS_CSUMNOTREADY) {
+            if (h.h2->tp_status & (TP_STATUS_CSUMNOTREADY|TP_STATUS_CSUM_VALID)) {
                 p->flags |= PKT_IGNORE_CHECKSUM;
             }
         }
@@ -928,6 +1417,10 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     ptv->pkts++;
     p->livedev = ptv->livedev;
     p->datalink = ptv->datalink;
+    if (ptv->mpeer->bypass != NULL) {
+        p->afp_v.bypass = ptv->mpeer->bypass;
+        p->BypassPacketsFlow = AFPBypassCallback;
+    }
 
     if (ptv->flags & AFP_ZERO_COPY) {
         if (PacketSetData(p, (unsigned char*)ppd + ppd->tp_mac, ppd->tp_snaplen) == -1) {
@@ -936,8 +1429,8 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
         }
         p->afp_v.relptr = pbd;
         p->ReleasePacket = AFPReleasePacketV3;
+        /* the socket reference is held for the whole block by AFPWalkBlock */
         p->afp_v.mpeer = ptv->mpeer;
-        AFPRefSocket(ptv->mpeer);
 
         p->afp_v.copy_mode = ptv->copy_mode;
         if (p->afp_v.copy_mode != AFP_COPY_MODE_NONE) {
@@ -956,6 +1449,7 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     p->ts.tv_usec = ppd->tp_nsec/1000;
     SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
             GET_PKT_LEN(p), p, GET_PKT_DATA(p));
+    AFPWaitUpdate(ptv, p->ts.tv_sec, p->ts.tv_usec);
 
     /* We only check for checksum disable */
     if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
@@ -963,6 +1457,9 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
         if (ptv->livedev->ignore_checksum) {
             p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if (ppd->tp_status & TP_STATUS_CSUM_VALID) {
+            /* the NIC verified it already */
+            p->flags |= PKT_IGNORE_CHECKSUM;
         } else if (ChecksumAutoModeCheck(ptv->pkts,
                     SC_ATOMIC_GET(ptv->livedev->pkts),
                     SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
@@ -970,7 +1467,7 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
     } else {
-        if (ppd->tp_status & TP_STATUS_CSUMNOTREADY) {
+        if (ppd->tp_status & (TP_STATUS_CSUMNOTREADY|TP_STATUS_CSUM_VALID)) {
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
     }
@@ -983,21 +1480,54 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     SCReturnInt(AFP_READ_OK);
 }
 
+/**
+ * \brief process all packets of a block
+ *
+ * The packets run through the pipeline before this function returns,
+ * so the block is handed back to the kernel only once all of them are
+ * done. The socket is referenced once for the block instead of once
+ * per packet, and the next packet's header and data are prefetched
+ * while the current one is being processed.
+ *
+ * \retval AFP_READ_OK, AFP_READ_FAILURE, or AFP_SOCKET_CLOSED if the
+ *          socket was closed and the block must not be touched anymore
+ */
 static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pbd)
 {
     int num_pkts = pbd->hdr.bh1.num_pkts, i;
+    int ret = AFP_READ_OK;
     uint8_t *ppd;
+    uint8_t *next;
+
+    if (ptv->flags & AFP_ZERO_COPY)
+        AFPRefSocket(ptv->mpeer);
 
     ppd = (uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt;
     for (i = 0; i < num_pkts; ++i) {
+        if (i % AFP_WAIT_TS_REFRESH == 0)
+            gettimeofday(&ptv->read_ts, NULL);
+        next = ppd + ((struct tpacket3_hdr *)ppd)->tp_next_offset;
+        if (i + 1 < num_pkts) {
+            /* the frame data directly follows the tpacket3 header, so the
+             * first two lines cover the header and the start of the
+             * ethernet and ip headers */
+            prefetch(next);
+            prefetch(next + 64);
+        }
         if (unlikely(AFPParsePacketV3(ptv, pbd,
                              (struct tpacket3_hdr *)ppd) == AFP_FAILURE)) {
-            SCReturnInt(AFP_READ_FAILURE);
+            ret = AFP_READ_FAILURE;
+            break;
         }
-        ppd = ppd + ((struct tpacket3_hdr *)ppd)->tp_next_offset;
+        ppd = next;
     }
 
-    SCReturnInt(AFP_READ_OK);
+    if (ptv->flags & AFP_ZERO_COPY) {
+        if (AFPDerefSocket(ptv->mpeer) == 0)
+            ret = AFP_SOCKET_CLOSED;
+    }
+
+    SCReturnInt(ret);
 }
 #endif /* HAVE_TPACKET_V3 */
 
@@ -1014,6 +1544,17 @@ int AFPReadFromRingV3(AFPThreadVars *ptv)
 {
 #ifdef HAVE_TPACKET_V3
     struct tpacket_block_desc *pbd;
+    unsigned int used = 0;
+
+    /* ring fill level: blocks not handed back to the kernel yet */
+    while (used < ptv->req3.tp_block_nr) {
+        pbd = (struct tpacket_block_desc *)
+            ptv->ring_v3[(ptv->frame_offset + used) % ptv->req3.tp_block_nr].iov_base;
+        if ((pbd->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+            break;
+        used++;
+    }
+    AFPRingFillUpdate(ptv, used, ptv->req3.tp_block_nr);
 
     /* Loop till we have packets available */
     while (1) {
@@ -1029,8 +1570,10 @@ int AFPReadFromRingV3(AFPThreadVars *ptv)
             SCReturnInt(AFP_READ_OK);
         }
 
-        if (unlikely(AFPWalkBlock(ptv, pbd) != AFP_READ_OK)) {
-            AFPFlushBlock(pbd);
+        int r = AFPWalkBlock(ptv, pbd);
+        if (unlikely(r != AFP_READ_OK)) {
+            if (r != AFP_SOCKET_CLOSED)
+                AFPFlushBlock(pbd);
             SCReturnInt(AFP_READ_FAILURE);
         }
 
@@ -1294,6 +1837,96 @@ static int AFPTryReopen(AFPThreadVars *ptv)
     return 0;
 }
 
+/** \internal
+ *  \brief check if the thread is to be parked
+ */
+static inline int AFPIsParked(const AFPThreadVars *ptv)
+{
+    return (ptv->livedev->workers_max > 0 &&
+            ptv->thread_idx >= SC_ATOMIC_GET(ptv->livedev->workers_active));
+}
+
+/** \internal
+ *  \brief park the thread while it's not one of the active workers
+ *
+ *  The socket is closed once the packets in flight are done, which takes
+ *  it out of the fanout group. The kernel then spreads its flows over the
+ *  other sockets, whose threads find them in the flow table as usual.
+ *  Flow timeouts handed to this thread are still handled while parked.
+ *
+ *  \retval 0 unparked, the socket is down and needs to be reopened
+ *  \retval 1 the engine is shutting down
+ */
+static int AFPPark(ThreadVars *tv, AFPThreadVars *ptv,
+                   int (*AFPReadFunc)(AFPThreadVars *))
+{
+    SCLogNotice("%s: parked, %s has %u of %u workers capturing", tv->name,
+            ptv->iface, SC_ATOMIC_GET(ptv->livedev->workers_active),
+            ptv->livedev->workers_max);
+
+    if (ptv->afp_state == AFP_STATE_UP) {
+        /* handle what's in the ring already */
+        (void)AFPReadFunc(ptv);
+        AFPSwitchState(ptv, AFP_STATE_DOWN);
+    }
+    tv->capture_backlog = 0;
+
+    while (AFPIsParked(ptv)) {
+        if (suricata_ctl_flags != 0)
+            return 1;
+
+        TmThreadsCaptureInjectPacket(tv, ptv->slot, NULL);
+        StatsSyncCountersIfSignalled(tv);
+        usleep(AFP_PARK_TIMEOUT);
+    }
+
+    SCLogNotice("%s: capturing again, rejoining fanout group %d on %s",
+            tv->name, ptv->cluster_id, ptv->iface);
+    return 0;
+}
+
+/** \internal
+ *  \brief add or park a worker on the highest ring fill of the workers
+ *
+ *  Called once a second. A worker is added as soon as a ring fills up to
+ *  'autoscale-high', one is parked when none got over 'autoscale-low'
+ *  for AFP_AUTOSCALE_DOWN_SECS.
+ */
+static void AFPAutoscale(AFPThreadVars *ptv)
+{
+    LiveDevice *ld = ptv->livedev;
+    uint32_t backlog;
+
+    /* take the highest ring fill since the last pass */
+    do {
+        backlog = SC_ATOMIC_GET(ld->workers_backlog);
+    } while (SC_ATOMIC_CAS(&ld->workers_backlog, backlog, 0) == 0);
+
+    if (ptv->autoscale_hold > 0) {
+        ptv->autoscale_hold--;
+        return;
+    }
+
+    int active = SC_ATOMIC_GET(ld->workers_active);
+    int workers;
+    if (backlog >= ptv->autoscale_high && active < ld->workers_max) {
+        workers = active + 1;
+    } else if (backlog <= ptv->autoscale_low && active > ptv->autoscale_min) {
+        if (++ptv->autoscale_low_secs < AFP_AUTOSCALE_DOWN_SECS)
+            return;
+        workers = active - 1;
+    } else {
+        ptv->autoscale_low_secs = 0;
+        return;
+    }
+    ptv->autoscale_low_secs = 0;
+    ptv->autoscale_hold = AFP_AUTOSCALE_HOLD_SECS;
+
+    SCLogNotice("%s: ring fill %u%%, autoscaling from %d to %d workers",
+            ptv->iface, backlog, active, workers);
+    (void)LiveDeviceSetWorkers(ld, workers);
+}
+
 /**
  *  \brief Main AF_PACKET reading Loop function
  */
@@ -1306,6 +1939,8 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
     int r;
     TmSlot *s = (TmSlot *)slot;
     time_t last_dump = 0;
+    time_t last_bypass = 0;
+    time_t last_scale = 0;
     time_t current_time;
     int (*AFPReadFunc) (AFPThreadVars *);
     uint64_t discarded_pkts = 0;
@@ -1322,7 +1957,10 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
         AFPReadFunc = AFPRead;
     }
 
-    if (ptv->afp_state == AFP_STATE_DOWN) {
+    if (ptv->afp_state == AFP_STATE_DOWN && AFPIsParked(ptv)) {
+        /* starts parked: no socket until it's needed */
+        AFPPeersListReachedInc();
+    } else if (ptv->afp_state == AFP_STATE_DOWN) {
         /* Wait for our turn, threads before us must have opened the socket */
         while (AFPPeersListWaitTurn(ptv->mpeer)) {
             usleep(1000);
@@ -1373,6 +2011,12 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
     fds.events = POLLIN;
 
     while (1) {
+        /* not one of the active workers anymore */
+        if (unlikely(AFPIsParked(ptv))) {
+            if (AFPPark(tv, ptv, AFPReadFunc) != 0)
+                break;
+        }
+
         /* Start by checking the state of our interface */
         if (unlikely(ptv->afp_state == AFP_STATE_DOWN)) {
             int dbreak = 0;
@@ -1422,6 +2066,9 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
             }
         } else if (r > 0) {
             r = AFPReadFunc(ptv);
+            /* send what this pass forwarded to the peer */
+            if (ptv->copy_mode != AFP_COPY_MODE_NONE)
+                AFPTxRingFlush(ptv->mpeer->peer);
             switch (r) {
                 case AFP_READ_OK:
                     /* Trigger one dump of stats every second */
@@ -1449,6 +2096,8 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
         } else if (unlikely(r == 0)) {
             /* poll timed out, lets see if we need to inject a fake packet  */
             TmThreadsCaptureInjectPacket(tv, ptv->slot, NULL);
+            if (ptv->copy_mode != AFP_COPY_MODE_NONE)
+                AFPTxRingFlush(ptv->mpeer->peer);
 
         } else if ((r < 0) && (errno != EINTR)) {
             SCLogError(SC_ERR_AFP_READ, "Error reading data from iface '%s': (%d" PRIu32 ") %s",
@@ -1457,6 +2106,21 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
             AFPSwitchState(ptv, AFP_STATE_DOWN);
             continue;
         }
+
+        if (ptv->bypass != NULL) {
+            current_time = time(NULL);
+            if (current_time != last_bypass) {
+                AFPBypassUpdate(ptv, current_time);
+                last_bypass = current_time;
+            }
+        }
+        if (ptv->autoscale) {
+            current_time = time(NULL);
+            if (current_time != last_scale) {
+                AFPAutoscale(ptv);
+                last_scale = current_time;
+            }
+        }
         StatsSyncCountersIfSignalled(tv);
     }
 
@@ -1639,6 +2303,7 @@ static int AFPSetupRing(AFPThreadVars *ptv, char *devname)
     int val;
     unsigned int len = sizeof(val), i;
     unsigned int ring_buflen;
+    unsigned int tx_buflen = 0;
     uint8_t * ring_buf;
     int order;
     int r, mmap_flag;
@@ -1689,6 +2354,17 @@ static int AFPSetupRing(AFPThreadVars *ptv, char *devname)
     }
 #endif
 
+    if (ptv->flags & AFP_TX_RING) {
+        /* frames the kernel can't send are dropped instead of stopping
+         * the TX ring. Has to be set before the rings are set up. */
+        val = 1;
+        if (setsockopt(ptv->socket, SOL_PACKET, PACKET_LOSS, &val,
+                    sizeof(val)) < 0) {
+            SCLogWarning(SC_ERR_AFP_CREATE, "Can't set PACKET_LOSS on "
+                    "packet socket: %s", strerror(errno));
+        }
+    }
+
     /* Allocate RX ring */
 #ifdef HAVE_TPACKET_V3
     if (ptv->flags & AFP_TPACKET_V3) {
@@ -1737,6 +2413,22 @@ static int AFPSetupRing(AFPThreadVars *ptv, char *devname)
                     devname);
             return AFP_FATAL_ERROR;
         }
+
+        /* TX ring of the same geometry */
+        if (ptv->flags & AFP_TX_RING) {
+            ptv->tx_req = ptv->req;
+            r = setsockopt(ptv->socket, SOL_PACKET, PACKET_TX_RING,
+                    (void *) &ptv->tx_req, sizeof(ptv->tx_req));
+            if (r < 0) {
+                SCLogWarning(SC_ERR_MEM_ALLOC,
+                        "Unable to allocate TX Ring for iface %s, using "
+                        "sendto: (%d) %s", devname, errno, strerror(errno));
+                ptv->flags &= ~AFP_TX_RING;
+                memset(&ptv->tx_req, 0, sizeof(ptv->tx_req));
+            } else {
+                tx_buflen = ptv->tx_req.tp_block_nr * ptv->tx_req.tp_block_size;
+            }
+        }
 #ifdef HAVE_TPACKET_V3
     }
 #endif
@@ -1754,13 +2446,15 @@ static int AFPSetupRing(AFPThreadVars *ptv, char *devname)
     mmap_flag = MAP_SHARED;
     if (ptv->flags & AFP_MMAP_LOCKED)
         mmap_flag |= MAP_LOCKED;
-    ring_buf = mmap(0, ring_buflen, PROT_READ|PROT_WRITE,
+    /* the TX ring, if any, is mapped right after the RX ring */
+    ring_buf = mmap(0, ring_buflen + tx_buflen, PROT_READ|PROT_WRITE,
             mmap_flag, ptv->socket, 0);
     if (ring_buf == MAP_FAILED) {
         SCLogError(SC_ERR_MEM_ALLOC, "Unable to mmap, error %s",
                    strerror(errno));
         goto mmap_err;
     }
+    ptv->tx_ring = tx_buflen ? (char *)ring_buf + ring_buflen : NULL;
 #ifdef HAVE_TPACKET_V3
     if (ptv->flags & AFP_TPACKET_V3) {
         ptv->ring_v3 = SCMalloc(ptv->req3.tp_block_nr * sizeof(*ptv->ring_v3));
@@ -1799,7 +2493,8 @@ static int AFPSetupRing(AFPThreadVars *ptv, char *devname)
     return 0;
 
 postmmap_err:
-    munmap(ring_buf, ring_buflen);
+    munmap(ring_buf, ring_buflen + tx_buflen);
+    ptv->tx_ring = NULL;
     if (ptv->ring_v2)
         SCFree(ptv->ring_v2);
     if (ptv->ring_v3)
@@ -1969,6 +2664,13 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
             break;
     }
 
+    if (ptv->bypass != NULL && ptv->datalink != LINKTYPE_ETHERNET &&
+            ptv->mpeer->bypass != NULL) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "bypass is only supported on "
+                "ethernet, disabling it on iface %s", ptv->iface);
+        ptv->mpeer->bypass = NULL;
+    }
+
     TmEcode rc;
     rc = AFPSetBPFFilter(ptv);
     if (rc == TM_ECODE_FAILED) {
@@ -2001,6 +2703,13 @@ TmEcode AFPSetBPFFilter(AFPThreadVars *ptv)
     struct sock_fprog  fcode;
     int rc;
 
+    /* a new socket needs the bypass filter as well */
+    if (ptv->bypass != NULL) {
+        SCMutexLock(&ptv->bypass->lock);
+        ptv->bypass->dirty = 1;
+        SCMutexUnlock(&ptv->bypass->lock);
+    }
+
     if (!ptv->bpf_filter)
         return TM_ECODE_OK;
 
@@ -2030,6 +2739,19 @@ TmEcode AFPSetBPFFilter(AFPThreadVars *ptv)
     fcode.len    = filter.bf_len;
     fcode.filter = (struct sock_filter*)filter.bf_insns;
 
+    /* keep the program around to put it behind the bypass filter */
+    if (ptv->bypass != NULL) {
+        if (ptv->bpf_insns != NULL)
+            SCFree(ptv->bpf_insns);
+        ptv->bpf_insns = SCMalloc(filter.bf_len * sizeof(struct sock_filter));
+        if (ptv->bpf_insns == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Failed to copy bpf filter");
+            return TM_ECODE_FAILED;
+        }
+        memcpy(ptv->bpf_insns, filter.bf_insns, filter.bf_len * sizeof(struct sock_filter));
+        ptv->bpf_len = filter.bf_len;
+    }
+
     rc = setsockopt(ptv->socket, SOL_SOCKET, SO_ATTACH_FILTER, &fcode, sizeof(fcode));
 
     if(rc == -1) {
@@ -2101,6 +2823,14 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, void *initdata, void **data)
 #endif
     ptv->flags = afpconfig->flags;
 
+    ptv->thread_idx = (uint16_t)(SC_ATOMIC_ADD(afpconfig->thread_idx, 1) - 1);
+    if (ptv->thread_idx == 0 && afpconfig->autoscale) {
+        ptv->autoscale = 1;
+        ptv->autoscale_high = (uint8_t)afpconfig->autoscale_high;
+        ptv->autoscale_low = (uint8_t)afpconfig->autoscale_low;
+        ptv->autoscale_min = (uint16_t)afpconfig->threads_active;
+    }
+
     if (afpconfig->bpf_filter) {
         ptv->bpf_filter = afpconfig->bpf_filter;
     }
@@ -2112,6 +2842,30 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, void *initdata, void **data)
             ptv->tv);
 #endif
 
+    if (afpconfig->flags & AFP_RING_MODE) {
+        ptv->capture_wait[0] = StatsRegisterCounter("capture.wait_lt_100us", ptv->tv);
+        ptv->capture_wait[1] = StatsRegisterCounter("capture.wait_lt_1ms", ptv->tv);
+        ptv->capture_wait[2] = StatsRegisterCounter("capture.wait_lt_10ms", ptv->tv);
+        ptv->capture_wait[3] = StatsRegisterCounter("capture.wait_lt_100ms", ptv->tv);
+        ptv->capture_wait[4] = StatsRegisterCounter("capture.wait_ge_100ms", ptv->tv);
+        ptv->capture_ring_fill = StatsRegisterCounter("capture.ring_fill_pct", ptv->tv);
+        ptv->capture_ring_fill_max = StatsRegisterMaxCounter("capture.ring_fill_max_pct",
+                ptv->tv);
+    }
+
+    if (afpconfig->flags & AFP_BYPASS) {
+        ptv->bypass = SCMalloc(sizeof(AFPBypassTable));
+        if (ptv->bypass == NULL) {
+            afpconfig->DerefFunc(afpconfig);
+            SCFree(ptv);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        memset(ptv->bypass, 0, sizeof(AFPBypassTable));
+        SCMutexInit(&ptv->bypass->lock, NULL);
+        ptv->capture_bypass_flows = StatsRegisterCounter("capture.kernel_bypass_flows",
+                ptv->tv);
+    }
+
     ptv->copy_mode = afpconfig->copy_mode;
     if (ptv->copy_mode != AFP_COPY_MODE_NONE) {
         strlcpy(ptv->out_iface, afpconfig->out_iface, AFP_IFACE_NAME_LENGTH);
@@ -2129,6 +2883,7 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, void *initdata, void **data)
         afpconfig->DerefFunc(afpconfig);
         SCReturnInt(TM_ECODE_FAILED);
     }
+    ptv->mpeer->bypass = ptv->bypass;
 
 #define T_DATA_SIZE 70000
     ptv->data = SCMalloc(T_DATA_SIZE);
@@ -2199,6 +2954,16 @@ TmEcode ReceiveAFPThreadDeinit(ThreadVars *tv, void *data)
     ptv->datalen = 0;
 
     ptv->bpf_filter = NULL;
+    if (ptv->bpf_insns != NULL) {
+        SCFree(ptv->bpf_insns);
+        ptv->bpf_insns = NULL;
+    }
+    if (ptv->bypass != NULL) {
+        ptv->mpeer->bypass = NULL;
+        SCMutexDestroy(&ptv->bypass->lock);
+        SCFree(ptv->bypass);
+        ptv->bypass = NULL;
+    }
 
     SCReturnInt(TM_ECODE_OK);
 }
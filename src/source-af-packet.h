@@ -51,6 +51,8 @@
 #define AFP_TPACKET_V3 (1<<4)
 #define AFP_VLAN_DISABLED (1<<5)
 #define AFP_MMAP_LOCKED (1<<6)
+#define AFP_BYPASS (1<<7)
+#define AFP_TX_RING (1<<8)
 
 #define AFP_COPY_MODE_NONE  0
 #define AFP_COPY_MODE_TAP   1
@@ -70,6 +72,14 @@ typedef struct AFPIfaceConfig_
     char iface[AFP_IFACE_NAME_LENGTH];
     /* number of threads */
     int threads;
+    /* threads capturing at start, the others are parked */
+    int threads_active;
+    /* hands out the thread index in the iface, for parking */
+    SC_ATOMIC_DECLARE(unsigned int, thread_idx);
+    /* autoscaler: ring fill % to add or park a worker at */
+    int autoscale;
+    int autoscale_high;
+    int autoscale_low;
     /* socket buffer size */
     int buffer_size;
     /* ring size in number of packets */
@@ -98,6 +108,8 @@ typedef struct AFPIfaceConfig_
  * @{
  */
 
+struct AFPBypassTable_;
+
 typedef struct AFPPeer_ {
     SC_ATOMIC_DECLARE(int, socket);
     SC_ATOMIC_DECLARE(int, sock_usage);
@@ -107,6 +119,18 @@ typedef struct AFPPeer_ {
     int turn; /**< Field used to store initialisation order. */
     SC_ATOMIC_DECLARE(uint8_t, state);
     struct AFPPeer_ *peer;
+    /** kernel bypass table of the capture socket, NULL if not in use */
+    struct AFPBypassTable_ *bypass;
+    /** TX ring of the socket, NULL if packets are sent with sendto().
+     *  The offset and pending count belong to the thread sending to this
+     *  peer, or are protected by sock_protect */
+    char *tx_ring;
+    unsigned int tx_block_size;
+    unsigned int tx_frames_per_block;
+    unsigned int tx_frame_size;
+    unsigned int tx_frame_nr;
+    unsigned int tx_offset;     /**< next frame to fill */
+    unsigned int tx_pending;    /**< frames filled since the last kick */
     TAILQ_ENTRY(AFPPeer_) next;
     char iface[AFP_IFACE_NAME_LENGTH];
 } AFPPeer;
@@ -125,6 +149,8 @@ typedef struct AFPPacketVars_
      * to do reference counting.
      */
     AFPPeer *mpeer;
+    /** kernel bypass table of the capture thread, NULL if disabled */
+    struct AFPBypassTable_ *bypass;
     uint8_t copy_mode;
 } AFPPacketVars;
 
@@ -133,6 +159,7 @@ typedef struct AFPPacketVars_
     (afpv)->copy_mode = 0;                \
     (afpv)->peer = NULL;                  \
     (afpv)->mpeer = NULL;                 \
+    (afpv)->bypass = NULL;                \
 } while(0)
 
 /**
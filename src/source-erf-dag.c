@@ -24,6 +24,11 @@
  * Support for reading ERF records from a DAG card.
  *
  * Only ethernet supported at this time.
+ *
+ * A receive thread can read from several streams of a card, given as
+ * "dagN:S1,S2,..". In the workers runmode packets point into the stream
+ * buffer instead of getting a copy: a packet is done with before the
+ * loop advances the stream past its record.
  */
 
 #include "suricata-common.h"
@@ -33,6 +38,7 @@
 #include "util-privs.h"
 #include "util-device.h"
 #include "tmqh-packetpool.h"
+#include "runmodes.h"
 
 #ifndef HAVE_DAG
 
@@ -90,16 +96,33 @@ NoErfDagSupportExit(ThreadVars *tv, void *initdata, void **data)
 /* Number of bytes per loop to process before fetching more data. */
 #define BYTES_PER_LOOP (4 * 1024 * 1024) /* 4 MB */
 
+/* Maximum number of streams a receive thread reads from. */
+#define DAG_MAX_STREAMS 16
+
 extern int max_pending_packets;
 
+typedef struct ErfDagStream_ {
+    int stream;
+
+    /* Current location in the DAG stream input buffer.
+     */
+    uint8_t *top;
+    uint8_t *btm;
+} ErfDagStream;
+
 typedef struct ErfDagThreadVars_ {
     ThreadVars *tv;
     TmSlot *slot;
 
     int dagfd;
-    int dagstream;
     char dagname[DAGNAME_BUFSIZE];
 
+    ErfDagStream streams[DAG_MAX_STREAMS];
+    int nstreams;
+
+    /* packets point into the stream buffer */
+    int zero_copy;
+
     struct timeval maxwait, poll;   /* Could possibly be made static */
 
     LiveDevice *livedev;
@@ -108,16 +131,12 @@ typedef struct ErfDagThreadVars_ {
     uint16_t packets;
     uint16_t drops;
 
-    /* Current location in the DAG stream input buffer.
-     */
-    uint8_t *top;
-    uint8_t *btm;
-
 } ErfDagThreadVars;
 
-static inline TmEcode ProcessErfDagRecords(ErfDagThreadVars *ewtn, uint8_t *top,
-    uint32_t *pkts_read);
-static inline TmEcode ProcessErfDagRecord(ErfDagThreadVars *ewtn, char *prec);
+static inline TmEcode ProcessErfDagRecords(ErfDagThreadVars *ewtn,
+    ErfDagStream *ds, uint8_t *top, uint32_t *pkts_read);
+static inline TmEcode ProcessErfDagRecord(ErfDagThreadVars *ewtn,
+    ErfDagStream *ds, char *prec);
 TmEcode ReceiveErfDagLoop(ThreadVars *, void *data, void *slot);
 TmEcode ReceiveErfDagThreadInit(ThreadVars *, void *, void **);
 void ReceiveErfDagThreadExitStats(ThreadVars *, void *);
@@ -126,7 +145,7 @@ TmEcode DecodeErfDagThreadInit(ThreadVars *, void *, void **);
 TmEcode DecodeErfDagThreadDeinit(ThreadVars *tv, void *data);
 TmEcode DecodeErfDag(ThreadVars *, Packet *, void *, PacketQueue *,
     PacketQueue *);
-void ReceiveErfDagCloseStream(int dagfd, int stream);
+void ReceiveErfDagCloseStreams(ErfDagThreadVars *ewtn);
 
 /**
  * \brief Register the ERF file receiver (reader) module.
@@ -163,6 +182,116 @@ TmModuleDecodeErfDagRegister(void)
     tmm_modules[TMM_DECODEERFDAG].flags = TM_FLAG_DECODE_TM;
 }
 
+/**
+ * \brief   Parse the DAG interface into the device name and the streams
+ *          to read from.
+ *
+ *          dag_parse_name() takes "dagN:S", several streams are given
+ *          as "dagN:S1,S2,..".
+ *
+ * \retval  0 on success, -1 on an invalid interface
+ */
+static int
+ErfDagParseStreams(ErfDagThreadVars *ewtn, const char *iface)
+{
+    const char *sep = strchr(iface, ':');
+    if (sep == NULL || strchr(sep, ',') == NULL) {
+        if (dag_parse_name(iface, ewtn->dagname, DAGNAME_BUFSIZE,
+                &ewtn->streams[0].stream) < 0)
+            return -1;
+        ewtn->nstreams = 1;
+        return 0;
+    }
+
+    char list[256];
+    char name[256];
+    char *saveptr = NULL;
+    char *tok;
+    int dev_len = (int)(sep - iface);
+
+    strlcpy(list, sep + 1, sizeof(list));
+    for (tok = strtok_r(list, ",", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, ",", &saveptr)) {
+        if (ewtn->nstreams == DAG_MAX_STREAMS) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "DAG interface %s has more than %d streams",
+                iface, DAG_MAX_STREAMS);
+            return -1;
+        }
+        snprintf(name, sizeof(name), "%.*s:%s", dev_len, iface, tok);
+        if (dag_parse_name(name, ewtn->dagname, DAGNAME_BUFSIZE,
+                &ewtn->streams[ewtn->nstreams].stream) < 0)
+            return -1;
+        ewtn->nstreams++;
+    }
+
+    return ewtn->nstreams > 0 ? 0 : -1;
+}
+
+/**
+ * \brief   Attach and start a stream of the DAG opened by the thread.
+ *
+ * \retval  0 on success, -1 on failure
+ */
+static int
+ErfDagStreamStart(ErfDagThreadVars *ewtn, ErfDagStream *ds, int stream_count)
+{
+    /* Check to make sure we have enough rx streams to open the stream
+     * the user is asking for.
+     */
+    if (ds->stream > stream_count * 2) {
+        SCLogError(SC_ERR_ERF_DAG_OPEN_FAILED,
+            "Failed to open stream: %d, DAG: %s, insufficient streams: %d",
+            ds->stream, ewtn->dagname, stream_count);
+        return -1;
+    }
+
+    /* If we are transmitting into a soft DAG card then set the stream
+     * to act in reverse mode.
+     */
+    if (0 != (ds->stream & 0x01)) {
+        /* Setting reverse mode for using with soft dag from daemon side */
+        if (dag_set_mode(ewtn->dagfd, ds->stream, DAG_REVERSE_MODE)) {
+            SCLogError(SC_ERR_ERF_DAG_STREAM_OPEN_FAILED,
+                "Failed to set mode to DAG_REVERSE_MODE on stream: %d, DAG: %s",
+                ds->stream, ewtn->dagname);
+            return -1;
+        }
+    }
+
+    if (dag_attach_stream(ewtn->dagfd, ds->stream, 0, 0) < 0) {
+        SCLogError(SC_ERR_ERF_DAG_STREAM_OPEN_FAILED,
+            "Failed to open DAG stream: %d, DAG: %s",
+            ds->stream, ewtn->dagname);
+        return -1;
+    }
+
+    if (dag_start_stream(ewtn->dagfd, ds->stream) < 0) {
+        SCLogError(SC_ERR_ERF_DAG_STREAM_START_FAILED,
+            "Failed to start DAG stream: %d, DAG: %s",
+            ds->stream, ewtn->dagname);
+        return -1;
+    }
+
+    SCLogInfo("Attached and started stream: %d on DAG: %s",
+        ds->stream, ewtn->dagname);
+
+    /* 32kB minimum data to return -- we still restrict the number of
+     * pkts that are processed to a maximum of dag_max_read_packets.
+     * A thread reading several streams doesn't wait on any of them.
+     */
+    uint32_t mindata = ewtn->nstreams > 1 ? 0 : MINDATA;
+    if (dag_set_stream_poll(ewtn->dagfd, ds->stream, mindata,
+            &(ewtn->maxwait), &(ewtn->poll)) < 0) {
+        SCLogError(SC_ERR_ERF_DAG_STREAM_SET_FAILED,
+            "Failed to set poll parameters for stream: %d, DAG: %s",
+            ds->stream, ewtn->dagname);
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * \brief   Initialize the ERF receiver thread, generate a single
  *          ErfDagThreadVar structure for each thread, this will
@@ -174,7 +303,7 @@ TmModuleDecodeErfDagRegister(void)
  *                  this is processed by the user.
  *
  *                  We assume that we have only a single name for the DAG
- *                  interface.
+ *                  interface, naming one or more of its streams.
  *
  * \param data      data pointer gets populated with
  *
@@ -184,6 +313,7 @@ ReceiveErfDagThreadInit(ThreadVars *tv, void *initdata, void **data)
 {
     SCEnter();
     int stream_count = 0;
+    int i;
 
     if (initdata == NULL) {
         SCLogError(SC_ERR_INVALID_ARGUMENT,
@@ -203,8 +333,7 @@ ReceiveErfDagThreadInit(ThreadVars *tv, void *initdata, void **data)
     /* dag_parse_name will return a DAG device name and stream number
      * to open for this thread.
      */
-    if (dag_parse_name(initdata, ewtn->dagname, DAGNAME_BUFSIZE,
-            &ewtn->dagstream) < 0) {
+    if (ErfDagParseStreams(ewtn, (const char *)initdata) < 0) {
         SCLogError(SC_ERR_INVALID_ARGUMENT,
             "Failed to parse DAG interface: %s",
             (char*)initdata);
@@ -220,8 +349,8 @@ ReceiveErfDagThreadInit(ThreadVars *tv, void *initdata, void **data)
         SCReturnInt(TM_ECODE_FAILED);
     }
 
-    SCLogInfo("Opening DAG: %s on stream: %d for processing",
-        ewtn->dagname, ewtn->dagstream);
+    SCLogInfo("Opening DAG: %s on %d stream(s) for processing",
+        ewtn->dagname, ewtn->nstreams);
 
     if ((ewtn->dagfd = dag_open(ewtn->dagname)) < 0) {
         SCLogError(SC_ERR_ERF_DAG_OPEN_FAILED, "Failed to open DAG: %s",
@@ -231,60 +360,16 @@ ReceiveErfDagThreadInit(ThreadVars *tv, void *initdata, void **data)
     }
 
     /* Check to make sure the card has enough available streams to
-     * support reading from the one specified.
+     * support reading from the ones specified.
      */
     if ((stream_count = dag_rx_get_stream_count(ewtn->dagfd)) < 0) {
         SCLogError(SC_ERR_ERF_DAG_OPEN_FAILED,
-            "Failed to open stream: %d, DAG: %s, could not query stream count",
-            ewtn->dagstream, ewtn->dagname);
-        SCFree(ewtn);
-        SCReturnInt(TM_ECODE_FAILED);
-    }
-
-    /* Check to make sure we have enough rx streams to open the stream
-     * the user is asking for.
-     */
-    if (ewtn->dagstream > stream_count * 2) {
-        SCLogError(SC_ERR_ERF_DAG_OPEN_FAILED,
-            "Failed to open stream: %d, DAG: %s, insufficient streams: %d",
-            ewtn->dagstream, ewtn->dagname, stream_count);
-        SCFree(ewtn);
-        SCReturnInt(TM_ECODE_FAILED);
-    }
-
-    /* If we are transmitting into a soft DAG card then set the stream
-     * to act in reverse mode.
-     */
-    if (0 != (ewtn->dagstream & 0x01)) {
-        /* Setting reverse mode for using with soft dag from daemon side */
-        if (dag_set_mode(ewtn->dagfd, ewtn->dagstream, DAG_REVERSE_MODE)) {
-            SCLogError(SC_ERR_ERF_DAG_STREAM_OPEN_FAILED,
-                "Failed to set mode to DAG_REVERSE_MODE on stream: %d, DAG: %s",
-                ewtn->dagstream, ewtn->dagname);
-            SCFree(ewtn);
-            SCReturnInt(TM_ECODE_FAILED);
-        }
-    }
-
-    if (dag_attach_stream(ewtn->dagfd, ewtn->dagstream, 0, 0) < 0) {
-        SCLogError(SC_ERR_ERF_DAG_STREAM_OPEN_FAILED,
-            "Failed to open DAG stream: %d, DAG: %s",
-            ewtn->dagstream, ewtn->dagname);
-        SCFree(ewtn);
-        SCReturnInt(TM_ECODE_FAILED);
-    }
-
-    if (dag_start_stream(ewtn->dagfd, ewtn->dagstream) < 0) {
-        SCLogError(SC_ERR_ERF_DAG_STREAM_START_FAILED,
-            "Failed to start DAG stream: %d, DAG: %s",
-            ewtn->dagstream, ewtn->dagname);
+            "Failed to open DAG: %s, could not query stream count",
+            ewtn->dagname);
         SCFree(ewtn);
         SCReturnInt(TM_ECODE_FAILED);
     }
 
-    SCLogInfo("Attached and started stream: %d on DAG: %s",
-        ewtn->dagstream, ewtn->dagname);
-
     /*
      * Initialise DAG Polling parameters.
      */
@@ -293,16 +378,19 @@ ReceiveErfDagThreadInit(ThreadVars *tv, void *initdata, void **data)
     timerclear(&ewtn->poll);
     ewtn->poll.tv_usec = POLL_INTERVAL;
 
-    /* 32kB minimum data to return -- we still restrict the number of
-     * pkts that are processed to a maximum of dag_max_read_packets.
-     */
-    if (dag_set_stream_poll(ewtn->dagfd, ewtn->dagstream, MINDATA,
-            &(ewtn->maxwait), &(ewtn->poll)) < 0) {
-        SCLogError(SC_ERR_ERF_DAG_STREAM_SET_FAILED,
-            "Failed to set poll parameters for stream: %d, DAG: %s",
-            ewtn->dagstream, ewtn->dagname);
-        SCFree(ewtn);
-        SCReturnInt(TM_ECODE_FAILED);
+    for (i = 0; i < ewtn->nstreams; i++) {
+        if (ErfDagStreamStart(ewtn, &ewtn->streams[i], stream_count) < 0) {
+            SCFree(ewtn);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+    }
+
+    /* in workers mode a packet is done with by the time its thread
+     * reads on, so it can point into the stream buffer */
+    char *active_runmode = RunmodeGetActive();
+    if (active_runmode != NULL && strcmp("workers", active_runmode) == 0) {
+        ewtn->zero_copy = 1;
+        SCLogPerf("Enabling zero copy mode for DAG: %s", (char *)initdata);
     }
 
     ewtn->packets = StatsRegisterCounter("capture.dag_packets", tv);
@@ -311,8 +399,8 @@ ReceiveErfDagThreadInit(ThreadVars *tv, void *initdata, void **data)
     ewtn->tv = tv;
     *data = (void *)ewtn;
 
-    SCLogInfo("Starting processing packets from stream: %d on DAG: %s",
-        ewtn->dagstream, ewtn->dagname);
+    SCLogInfo("Starting processing packets from %d stream(s) on DAG: %s",
+        ewtn->nstreams, ewtn->dagname);
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -335,6 +423,7 @@ ReceiveErfDagLoop(ThreadVars *tv, void *data, void *slot)
     ErfDagThreadVars *dtv = (ErfDagThreadVars *)data;
     uint32_t diff = 0;
     int      err;
+    int      i;
     uint8_t  *top = NULL;
     uint32_t pkts_read = 0;
     TmSlot *s = (TmSlot *)slot;
@@ -346,44 +435,58 @@ ReceiveErfDagLoop(ThreadVars *tv, void *data, void *slot)
             SCReturnInt(TM_ECODE_OK);
         }
 
-        top = dag_advance_stream(dtv->dagfd, dtv->dagstream, &(dtv->btm));
-        if (top == NULL) {
-            if (errno == EAGAIN) {
-                if (dtv->dagstream & 0x1) {
-                    usleep(10 * 1000);
-                    dtv->btm = dtv->top;
+        /* Advancing a stream releases the records processed in the
+         * previous round, up to BYTES_PER_LOOP of them at a time. */
+        int idle = 1;
+        for (i = 0; i < dtv->nstreams; i++) {
+            ErfDagStream *ds = &dtv->streams[i];
+
+            top = dag_advance_stream(dtv->dagfd, ds->stream, &(ds->btm));
+            if (top == NULL) {
+                if (errno == EAGAIN) {
+                    if (ds->stream & 0x1) {
+                        usleep(10 * 1000);
+                        ds->btm = ds->top;
+                    }
+                    continue;
+                } else {
+                    SCLogError(SC_ERR_ERF_DAG_STREAM_READ_FAILED,
+                        "Failed to read from stream: %d, DAG: %s when "
+                        "using dag_advance_stream",
+                        ds->stream, dtv->dagname);
+                    SCReturnInt(TM_ECODE_FAILED);
                 }
+            }
+
+            diff = top - ds->btm;
+            if (diff == 0) {
                 continue;
-            } else {
+            }
+
+            assert(diff >= dag_record_size);
+            idle = 0;
+
+            err = ProcessErfDagRecords(dtv, ds, top, &pkts_read);
+
+            if (err == TM_ECODE_FAILED) {
                 SCLogError(SC_ERR_ERF_DAG_STREAM_READ_FAILED,
-                    "Failed to read from stream: %d, DAG: %s when "
-                    "using dag_advance_stream",
-                    dtv->dagstream, dtv->dagname);
+                    "Failed to read from stream: %d, DAG: %s",
+                    ds->stream, dtv->dagname);
+                ReceiveErfDagCloseStreams(dtv);
                 SCReturnInt(TM_ECODE_FAILED);
             }
-        }
 
-        diff = top - dtv->btm;
-        if (diff == 0) {
-            continue;
+            SCLogDebug("Read %d records from stream: %d, DAG: %s",
+                pkts_read, ds->stream, dtv->dagname);
         }
 
-        assert(diff >= dag_record_size);
-
-        err = ProcessErfDagRecords(dtv, top, &pkts_read);
-
-        if (err == TM_ECODE_FAILED) {
-            SCLogError(SC_ERR_ERF_DAG_STREAM_READ_FAILED,
-                "Failed to read from stream: %d, DAG: %s",
-                dtv->dagstream, dtv->dagname);
-            ReceiveErfDagCloseStream(dtv->dagfd, dtv->dagstream);
-            SCReturnInt(TM_ECODE_FAILED);
+        /* with several streams dag_advance_stream() doesn't wait for
+         * data, so wait here if none of them had any */
+        if (idle && dtv->nstreams > 1) {
+            usleep(dtv->poll.tv_usec);
         }
 
         StatsSyncCountersIfSignalled(tv);
-
-        SCLogDebug("Read %d records from stream: %d, DAG: %s",
-            pkts_read, dtv->dagstream, dtv->dagname);
     }
 
     SCReturnInt(TM_ECODE_OK);
@@ -396,7 +499,8 @@ ReceiveErfDagLoop(ThreadVars *tv, void *data, void *slot)
  * and processes it individual records.
  */
 static inline TmEcode
-ProcessErfDagRecords(ErfDagThreadVars *ewtn, uint8_t *top, uint32_t *pkts_read)
+ProcessErfDagRecords(ErfDagThreadVars *ewtn, ErfDagStream *ds, uint8_t *top,
+    uint32_t *pkts_read)
 {
     SCEnter();
 
@@ -409,14 +513,14 @@ ProcessErfDagRecords(ErfDagThreadVars *ewtn, uint8_t *top, uint32_t *pkts_read)
 
     *pkts_read = 0;
 
-    while (((top - ewtn->btm) >= dag_record_size) &&
+    while (((top - ds->btm) >= dag_record_size) &&
         ((processed + dag_record_size) < BYTES_PER_LOOP)) {
 
         /* Make sure we have at least one packet in the packet pool,
          * to prevent us from alloc'ing packets at line rate. */
         PacketPoolWait();
 
-        prec = (char *)ewtn->btm;
+        prec = (char *)ds->btm;
         dr = (dag_record_t*)prec;
         rlen = ntohs(dr->rlen);
         hdr_type = dr->type;
@@ -424,10 +528,10 @@ ProcessErfDagRecords(ErfDagThreadVars *ewtn, uint8_t *top, uint32_t *pkts_read)
         /* If we don't have enough data to finish processing this ERF
          * record return and maybe next time we will.
          */
-        if ((top - ewtn->btm) < rlen)
+        if ((top - ds->btm) < rlen)
             SCReturnInt(TM_ECODE_OK);
 
-        ewtn->btm += rlen;
+        ds->btm += rlen;
         processed += rlen;
 
         /* Only support ethernet at this time. */
@@ -452,7 +556,7 @@ ProcessErfDagRecords(ErfDagThreadVars *ewtn, uint8_t *top, uint32_t *pkts_read)
             SCReturnInt(TM_ECODE_FAILED);
         }
 
-        err = ProcessErfDagRecord(ewtn, prec);
+        err = ProcessErfDagRecord(ewtn, ds, prec);
         if (err != TM_ECODE_OK) {
             SCReturnInt(TM_ECODE_FAILED);
         }
@@ -469,7 +573,7 @@ ProcessErfDagRecords(ErfDagThreadVars *ewtn, uint8_t *top, uint32_t *pkts_read)
  * \param
  */
 static inline TmEcode
-ProcessErfDagRecord(ErfDagThreadVars *ewtn, char *prec)
+ProcessErfDagRecord(ErfDagThreadVars *ewtn, ErfDagStream *ds, char *prec)
 {
     SCEnter();
 
@@ -509,7 +613,7 @@ ProcessErfDagRecord(ErfDagThreadVars *ewtn, char *prec)
     if (p == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC,
             "Failed to allocate a Packet on stream: %d, DAG: %s",
-            ewtn->dagstream, ewtn->dagname);
+            ds->stream, ewtn->dagname);
         SCReturnInt(TM_ECODE_FAILED);
     }
     PKT_SET_SRC(p, PKT_SRC_WIRE);
@@ -519,8 +623,17 @@ ProcessErfDagRecord(ErfDagThreadVars *ewtn, char *prec)
 
     /* Take into account for link type Ethernet ETH frame starts
      * after ther ERF header + pad.
+     *
+     * In zero copy mode the record stays in the stream buffer until
+     * the next dag_advance_stream() on the stream, and the packet is
+     * done with before that.
      */
-    if (unlikely(PacketCopyData(p, pload->eth.dst, GET_PKT_LEN(p)))) {
+    if (ewtn->zero_copy) {
+        if (unlikely(PacketSetData(p, pload->eth.dst, GET_PKT_LEN(p)))) {
+            TmqhOutputPacketpool(ewtn->tv, p);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+    } else if (unlikely(PacketCopyData(p, pload->eth.dst, GET_PKT_LEN(p)))) {
         TmqhOutputPacketpool(ewtn->tv, p);
         SCReturnInt(TM_ECODE_FAILED);
     }
@@ -563,9 +676,9 @@ ReceiveErfDagThreadExitStats(ThreadVars *tv, void *data)
     (void)SC_ATOMIC_SET(ewtn->livedev->drop,
         StatsGetLocalCounterValue(tv, ewtn->drops));
 
-    SCLogInfo("Stream: %d; Bytes: %"PRIu64"; Packets: %"PRIu64
+    SCLogInfo("DAG: %s; Streams: %d; Bytes: %"PRIu64"; Packets: %"PRIu64
         "; Drops: %"PRIu64,
-        ewtn->dagstream,
+        ewtn->dagname, ewtn->nstreams,
         ewtn->bytes,
         StatsGetLocalCounterValue(tv, ewtn->packets),
         StatsGetLocalCounterValue(tv, ewtn->drops));
@@ -583,17 +696,21 @@ ReceiveErfDagThreadDeinit(ThreadVars *tv, void *data)
 
     ErfDagThreadVars *ewtn = (ErfDagThreadVars *)data;
 
-    ReceiveErfDagCloseStream(ewtn->dagfd, ewtn->dagstream);
+    ReceiveErfDagCloseStreams(ewtn);
 
     SCReturnInt(TM_ECODE_OK);
 }
 
 void
-ReceiveErfDagCloseStream(int dagfd, int stream)
+ReceiveErfDagCloseStreams(ErfDagThreadVars *ewtn)
 {
-    dag_stop_stream(dagfd, stream);
-    dag_detach_stream(dagfd, stream);
-    dag_close(dagfd);
+    int i;
+
+    for (i = 0; i < ewtn->nstreams; i++) {
+        dag_stop_stream(ewtn->dagfd, ewtn->streams[i].stream);
+        dag_detach_stream(ewtn->dagfd, ewtn->streams[i].stream);
+    }
+    dag_close(ewtn->dagfd);
 }
 
 /** Decode ErfDag */
@@ -80,14 +80,54 @@ TmEcode NoNapatechSupportExit(ThreadVars *tv, void *initdata, void **data)
 
 extern int max_pending_packets;
 
+/** max flows shunted in the adapter at the same time */
+#define NT_BYPASS_MAX_FLOWS     1024
+/** seconds a flow stays shunted in the adapter */
+#define NT_BYPASS_TIMEOUT       30
+/** NTPL key set the bypassed flows are added to */
+#define NT_BYPASS_KEYSET        3
+
+typedef struct NapatechBypassEntry_ {
+    uint32_t src;       /**< host order */
+    uint32_t dst;       /**< host order */
+    uint16_t sp;
+    uint16_t dp;
+    uint8_t proto;
+    uint8_t programmed; /**< key list entries are in the adapter */
+    uint32_t ntpl_id[2];/**< key list entry per direction */
+    time_t ts;          /**< time the entry was added */
+} NapatechBypassEntry;
+
+/**
+ * \brief table of the flows dropped by the adapter
+ *
+ * Entries are added by the threads releasing the packets; the capture
+ * threads program them into the adapter and remove them on timeout.
+ * The drop filter covers all streams, so there is one table.
+ */
+typedef struct NapatechBypassTable_ {
+    SCMutex lock;
+    int enabled;
+    int cnt;
+    int dirty;              /**< entries to program */
+    NtConfigStream_t cfg_stream;
+    NapatechBypassEntry entries[NT_BYPASS_MAX_FLOWS];
+} NapatechBypassTable;
+
+static NapatechBypassTable nt_bypass = { .lock = SCMUTEX_INITIALIZER };
+
 typedef struct NapatechThreadVars_ {
     ThreadVars *tv;
     NtNetStreamRx_t rx_stream;
     uint64_t stream_id;
     int hba;
+    int zero_copy;
+    int bypass;
     uint64_t pkts;
     uint64_t drops;
     uint64_t bytes;
+    uint64_t segments;
+    time_t last_sync;       /**< last drop stats read and bypass sync */
 
     TmSlot *slot;
 } NapatechThreadVars;
@@ -133,6 +173,175 @@ void TmModuleNapatechDecodeRegister(void)
     tmm_modules[TMM_DECODENAPATECH].flags = TM_FLAG_DECODE_TM;
 }
 
+/** \internal
+ *  \brief run a NTPL command on the bypass config stream
+ *  \retval 0 on success, -1 on error */
+static int NapatechBypassNtpl(const char *cmd, uint32_t *ntpl_id)
+{
+    NtNtplInfo_t ntpl_info;
+    char errbuf[100];
+    int status;
+
+    SCLogDebug("NTPL: %s", cmd);
+    if ((status = NT_NTPL(nt_bypass.cfg_stream, cmd, &ntpl_info,
+                    NT_NTPL_PARSER_VALIDATE_NORMAL)) != NT_SUCCESS) {
+        NT_ExplainError(status, errbuf, sizeof(errbuf));
+        SCLogError(SC_ERR_NAPATECH_CONFIG_STREAM, "NTPL \"%s\" failed: %s",
+                cmd, errbuf);
+        return -1;
+    }
+    if (ntpl_id != NULL)
+        *ntpl_id = ntpl_info.ntplId;
+    return 0;
+}
+
+/**
+ * \brief set up the adapter filter that drops the bypassed flows
+ *
+ * The flows are entries of a key list matched on the IPv4 protocol,
+ * addresses and ports. Packets matching it are dropped in the adapter,
+ * before they reach any stream.
+ *
+ * \retval 0 on success, -1 if bypass can't be used
+ */
+int NapatechBypassSetup(void)
+{
+    char errbuf[100];
+    char cmd[256];
+    int status;
+
+    if ((status = NT_ConfigOpen(&nt_bypass.cfg_stream, "SuricataBypass")) != NT_SUCCESS) {
+        NT_ExplainError(status, errbuf, sizeof(errbuf));
+        SCLogError(SC_ERR_NAPATECH_CONFIG_STREAM, "NT_ConfigOpen failed: %s", errbuf);
+        return -1;
+    }
+
+    if (NapatechBypassNtpl("KeyType[Name=SCBypassV4] = {8, 32, 32, 16, 16}", NULL) < 0 ||
+        NapatechBypassNtpl("KeyDef[Name=SCBypassV4; KeyType=SCBypassV4] = "
+            "(Layer3Header[9]/8, Layer3Header[12]/32, Layer3Header[16]/32, "
+            "Layer4Header[0]/16, Layer4Header[2]/16)", NULL) < 0)
+        goto error;
+
+    snprintf(cmd, sizeof(cmd), "Assign[StreamId=Drop; Priority=0] = "
+            "Layer3Protocol==IPV4 AND Key(SCBypassV4) == %d", NT_BYPASS_KEYSET);
+    if (NapatechBypassNtpl(cmd, NULL) < 0)
+        goto error;
+
+    nt_bypass.enabled = 1;
+    SCLogInfo("Napatech flow bypass enabled, up to %d flows", NT_BYPASS_MAX_FLOWS);
+    return 0;
+
+error:
+    NT_ConfigClose(nt_bypass.cfg_stream);
+    return -1;
+}
+
+/**
+ * \brief Packet::BypassPacketsFlow callback: drop the flow in the adapter
+ *
+ * \retval 1 if the flow was added to the bypass table, 0 otherwise
+ */
+static int NapatechBypassCallback(Packet *p)
+{
+    if (PKT_IS_PSEUDOPKT(p))
+        return 0;
+    if (!PKT_IS_IPV4(p) || !(PKT_IS_TCP(p) || PKT_IS_UDP(p)))
+        return 0;
+
+    uint32_t src = ntohl(GET_IPV4_SRC_ADDR_U32(p));
+    uint32_t dst = ntohl(GET_IPV4_DST_ADDR_U32(p));
+    int i, r = 0;
+
+    SCMutexLock(&nt_bypass.lock);
+    for (i = 0; i < nt_bypass.cnt; i++) {
+        NapatechBypassEntry *e = &nt_bypass.entries[i];
+        if (e->proto != p->proto)
+            continue;
+        if ((e->src == src && e->dst == dst && e->sp == p->sp && e->dp == p->dp) ||
+            (e->src == dst && e->dst == src && e->sp == p->dp && e->dp == p->sp)) {
+            SCMutexUnlock(&nt_bypass.lock);
+            return 1;
+        }
+    }
+    if (nt_bypass.cnt < NT_BYPASS_MAX_FLOWS) {
+        NapatechBypassEntry *e = &nt_bypass.entries[nt_bypass.cnt++];
+        memset(e, 0, sizeof(*e));
+        e->src = src;
+        e->dst = dst;
+        e->sp = p->sp;
+        e->dp = p->dp;
+        e->proto = p->proto;
+        e->ts = p->ts.tv_sec;
+        nt_bypass.dirty = 1;
+        r = 1;
+    }
+    SCMutexUnlock(&nt_bypass.lock);
+    return r;
+}
+
+/** \internal
+ *  \brief remove the key list entries of a bypassed flow */
+static void NapatechBypassUnprogram(NapatechBypassEntry *e)
+{
+    char cmd[64];
+    int d;
+
+    if (!e->programmed)
+        return;
+    for (d = 0; d < 2; d++) {
+        snprintf(cmd, sizeof(cmd), "Delete=%u", e->ntpl_id[d]);
+        (void)NapatechBypassNtpl(cmd, NULL);
+    }
+    e->programmed = 0;
+}
+
+/** \internal
+ *  \brief program new bypassed flows into the adapter, expire old ones
+ *
+ *  Called by the capture threads once a second.
+ */
+static void NapatechBypassSync(time_t now)
+{
+    char cmd[256];
+    int i;
+
+    if (SCMutexTrylock(&nt_bypass.lock) != 0)
+        return;
+
+    for (i = 0; i < nt_bypass.cnt; ) {
+        NapatechBypassEntry *e = &nt_bypass.entries[i];
+        if (now - e->ts >= NT_BYPASS_TIMEOUT) {
+            NapatechBypassUnprogram(e);
+            nt_bypass.entries[i] = nt_bypass.entries[--nt_bypass.cnt];
+            continue;
+        }
+        if (nt_bypass.dirty && !e->programmed) {
+            snprintf(cmd, sizeof(cmd), "KeyList[KeySet=%d; KeyType=SCBypassV4] = "
+                    "(%u, 0x%08x, 0x%08x, %u, %u)", NT_BYPASS_KEYSET,
+                    e->proto, e->src, e->dst, e->sp, e->dp);
+            if (NapatechBypassNtpl(cmd, &e->ntpl_id[0]) == 0) {
+                snprintf(cmd, sizeof(cmd), "KeyList[KeySet=%d; KeyType=SCBypassV4] = "
+                        "(%u, 0x%08x, 0x%08x, %u, %u)", NT_BYPASS_KEYSET,
+                        e->proto, e->dst, e->src, e->dp, e->sp);
+                if (NapatechBypassNtpl(cmd, &e->ntpl_id[1]) == 0) {
+                    e->programmed = 1;
+                } else {
+                    snprintf(cmd, sizeof(cmd), "Delete=%u", e->ntpl_id[0]);
+                    (void)NapatechBypassNtpl(cmd, NULL);
+                }
+            }
+            if (!e->programmed) {
+                /* adapter key list full or rejected, keep inspecting */
+                nt_bypass.entries[i] = nt_bypass.entries[--nt_bypass.cnt];
+                continue;
+            }
+        }
+        i++;
+    }
+    nt_bypass.dirty = 0;
+    SCMutexUnlock(&nt_bypass.lock);
+}
+
 /**
  * \brief   Initialize the Napatech receiver thread, generate a single
  *          NapatechThreadVar structure for each thread, this will
@@ -168,16 +377,144 @@ TmEcode NapatechStreamThreadInit(ThreadVars *tv, void *initdata, void **data)
     ntv->stream_id = stream_id;
     ntv->tv = tv;
     ntv->hba = conf->hba;
+    ntv->zero_copy = conf->zero_copy;
+    ntv->bypass = conf->bypass && nt_bypass.enabled;
 
-    SCLogInfo("Started processing packets from NAPATECH  Stream: %lu", ntv->stream_id);
+    SCLogInfo("Started processing packets from NAPATECH  Stream: %lu%s",
+            ntv->stream_id, ntv->zero_copy ? " (zero copy)" : "");
 
     *data = (void *)ntv;
 
     SCReturnInt(TM_ECODE_OK);
 }
 
+/** \internal
+ *  \brief set the packet timestamp from the adapter timestamp
+ *  \retval 0 ok, -1 timestamp type not supported
+ */
+static inline int NapatechSetTimestamp(Packet *p, NtNetBuf_t packet_buffer)
+{
+    uint64_t pkt_ts = NT_NET_GET_PKT_TIMESTAMP(packet_buffer);
+
+    /*
+     * Handle the different timestamp forms that the napatech cards could use
+     *   - NT_TIMESTAMP_TYPE_NATIVE is not supported due to having an base of 0 as opposed to NATIVE_UNIX which has a base of 1/1/1970
+     */
+    switch(NT_NET_GET_PKT_TIMESTAMP_TYPE(packet_buffer)) {
+        case NT_TIMESTAMP_TYPE_NATIVE_UNIX:
+            p->ts.tv_sec = pkt_ts / 100000000;
+            p->ts.tv_usec = ((pkt_ts % 100000000) / 100) + (pkt_ts % 100) > 50 ? 1 : 0;
+            break;
+        case NT_TIMESTAMP_TYPE_PCAP:
+            p->ts.tv_sec = pkt_ts >> 32;
+            p->ts.tv_usec = pkt_ts & 0xFFFFFFFF;
+            break;
+        case NT_TIMESTAMP_TYPE_PCAP_NANOTIME:
+            p->ts.tv_sec = pkt_ts >> 32;
+            p->ts.tv_usec = ((pkt_ts & 0xFFFFFFFF) / 1000) + (pkt_ts % 1000) > 500 ? 1 : 0;
+            break;
+        case NT_TIMESTAMP_TYPE_NATIVE_NDIS:
+            /* number of seconds between 1/1/1601 and 1/1/1970 */
+            p->ts.tv_sec = (pkt_ts / 100000000) - 11644473600;
+            p->ts.tv_usec = ((pkt_ts % 100000000) / 100) + (pkt_ts % 100) > 50 ? 1 : 0;
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief once a second: read the stream drop counter and sync the
+ *         bypass table with the adapter */
+static inline void NapatechPeriodic(NapatechThreadVars *ntv, time_t now)
+{
+    NtNetRx_t stat_cmd;
+    char errbuf[100];
+    int32_t status;
+
+    if (now == ntv->last_sync)
+        return;
+    ntv->last_sync = now;
+
+    stat_cmd.cmd = NT_NETRX_READ_CMD_STREAM_DROP;
+    if (unlikely((status = NT_NetRxRead(ntv->rx_stream, &stat_cmd)) != NT_SUCCESS))
+    {
+        NT_ExplainError(status, errbuf, sizeof(errbuf));
+        SCLogWarning(SC_ERR_NAPATECH_STAT_DROPS_FAILED, "Couldn't retrieve drop statistics from the RX stream: %lu - %s", ntv->stream_id, errbuf);
+    }
+    else
+    {
+        ntv->drops += stat_cmd.u.streamDrop.pktsDropped;
+    }
+
+    if (ntv->bypass)
+        NapatechBypassSync(now);
+}
+
+/** \internal
+ *  \brief hand one packet of the adapter to the pipeline
+ *
+ *  In zero copy mode the packet points into the host buffer segment,
+ *  which the caller releases after the last packet of the segment has
+ *  been through the pipeline.
+ */
+static inline TmEcode NapatechProcessPacket(NapatechThreadVars *ntv,
+        NtNetBuf_t packet_buffer)
+{
+    /* make sure we have at least one packet in the packet pool, to prevent
+     * us from alloc'ing packets at line rate */
+    PacketPoolWait();
+
+    Packet *p = PacketGetFromQueueOrAlloc();
+    if (unlikely(p == NULL)) {
+        return TM_ECODE_FAILED;
+    }
+
+    if (unlikely(NapatechSetTimestamp(p, packet_buffer) < 0)) {
+        SCLogError(SC_ERR_NAPATECH_TIMESTAMP_TYPE_NOT_SUPPORTED,
+                   "Packet from Napatech Stream: %lu does not have a supported timestamp format",
+                   ntv->stream_id);
+        TmqhOutputPacketpool(ntv->tv, p);
+        return TM_ECODE_FAILED;
+    }
+
+    SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
+    p->datalink = LINKTYPE_ETHERNET;
+    if (ntv->bypass)
+        p->BypassPacketsFlow = NapatechBypassCallback;
+
+    ntv->pkts++;
+    ntv->bytes += NT_NET_GET_PKT_WIRE_LENGTH(packet_buffer);
+
+    NapatechPeriodic(ntv, p->ts.tv_sec);
+
+    int r;
+    if (ntv->zero_copy) {
+        r = PacketSetData(p, (uint8_t *)NT_NET_GET_PKT_L2_PTR(packet_buffer), NT_NET_GET_PKT_WIRE_LENGTH(packet_buffer));
+    } else {
+        r = PacketCopyData(p, (uint8_t *)NT_NET_GET_PKT_L2_PTR(packet_buffer), NT_NET_GET_PKT_WIRE_LENGTH(packet_buffer));
+    }
+    if (unlikely(r != 0)) {
+        TmqhOutputPacketpool(ntv->tv, p);
+        return TM_ECODE_FAILED;
+    }
+
+    if (unlikely(TmThreadsSlotProcessPkt(ntv->tv, ntv->slot, p) != TM_ECODE_OK)) {
+        TmqhOutputPacketpool(ntv->tv, p);
+        return TM_ECODE_FAILED;
+    }
+    return TM_ECODE_OK;
+}
+
 /**
  *  \brief Main Napatech reading Loop function
+ *
+ *  Without zero copy the packet interface is used and every packet is
+ *  copied out of the host buffer. With zero copy (workers runmode only)
+ *  the segment interface is used: the packets point into the segment,
+ *  and the segment is released to the adapter once all of its packets
+ *  have been processed.
  */
 TmEcode NapatechStreamLoop(ThreadVars *tv, void *data, void *slot)
 {
@@ -185,34 +522,28 @@ TmEcode NapatechStreamLoop(ThreadVars *tv, void *data, void *slot)
 
     int32_t status;
     char errbuf[100];
-    uint64_t pkt_ts;
     NtNetBuf_t packet_buffer;
     NapatechThreadVars *ntv = (NapatechThreadVars *)data;
-    NtNetRx_t stat_cmd;
 
     SCLogInfo("Opening NAPATECH Stream: %lu for processing", ntv->stream_id);
 
-    if ((status = NT_NetRxOpen(&(ntv->rx_stream), "SuricataStream", NT_NET_INTERFACE_PACKET, ntv->stream_id, ntv->hba)) != NT_SUCCESS) {
+    if ((status = NT_NetRxOpen(&(ntv->rx_stream), "SuricataStream",
+                    ntv->zero_copy ? NT_NET_INTERFACE_SEGMENT : NT_NET_INTERFACE_PACKET,
+                    ntv->stream_id, ntv->hba)) != NT_SUCCESS) {
         NT_ExplainError(status, errbuf, sizeof(errbuf));
         SCLogError(SC_ERR_NAPATECH_OPEN_FAILED, "Failed to open NAPATECH Stream: %lu - %s", ntv->stream_id, errbuf);
         SCFree(ntv);
         SCReturnInt(TM_ECODE_FAILED);
     }
 
-    stat_cmd.cmd = NT_NETRX_READ_CMD_STREAM_DROP;
-
     SCLogInfo("Napatech Packet Stream Loop Started for Stream ID: %lu", ntv->stream_id);
 
     TmSlot *s = (TmSlot *)slot;
     ntv->slot = s->slot_next;
 
     while (!(suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL))) {
-        /* make sure we have at least one packet in the packet pool, to prevent
-         * us from alloc'ing packets at line rate */
-        PacketPoolWait();
-
         /*
-         * Napatech returns packets 1 at a time
+         * Napatech returns packets 1 at a time, or a segment of them
          */
         status = NT_NetRxGet(ntv->rx_stream, &packet_buffer, 1000);
         if (unlikely(status == NT_STATUS_TIMEOUT || status == NT_STATUS_TRYAGAIN)) {
@@ -227,71 +558,25 @@ TmEcode NapatechStreamLoop(ThreadVars *tv, void *data, void *slot)
             SCReturnInt(TM_ECODE_FAILED);
         }
 
-        Packet *p = PacketGetFromQueueOrAlloc();
-        if (unlikely(p == NULL)) {
-            NT_NetRxRelease(ntv->rx_stream, packet_buffer);
-            SCReturnInt(TM_ECODE_FAILED);
-        }
-
-        pkt_ts = NT_NET_GET_PKT_TIMESTAMP(packet_buffer);
-
-        /*
-         * Handle the different timestamp forms that the napatech cards could use
-         *   - NT_TIMESTAMP_TYPE_NATIVE is not supported due to having an base of 0 as opposed to NATIVE_UNIX which has a base of 1/1/1970
-         */
-        switch(NT_NET_GET_PKT_TIMESTAMP_TYPE(packet_buffer)) {
-            case NT_TIMESTAMP_TYPE_NATIVE_UNIX:
-                p->ts.tv_sec = pkt_ts / 100000000;
-                p->ts.tv_usec = ((pkt_ts % 100000000) / 100) + (pkt_ts % 100) > 50 ? 1 : 0;
-                break;
-            case NT_TIMESTAMP_TYPE_PCAP:
-                p->ts.tv_sec = pkt_ts >> 32;
-                p->ts.tv_usec = pkt_ts & 0xFFFFFFFF;
-                break;
-            case NT_TIMESTAMP_TYPE_PCAP_NANOTIME:
-                p->ts.tv_sec = pkt_ts >> 32;
-                p->ts.tv_usec = ((pkt_ts & 0xFFFFFFFF) / 1000) + (pkt_ts % 1000) > 500 ? 1 : 0;
-                break;
-            case NT_TIMESTAMP_TYPE_NATIVE_NDIS:
-                /* number of seconds between 1/1/1601 and 1/1/1970 */
-                p->ts.tv_sec = (pkt_ts / 100000000) - 11644473600;
-                p->ts.tv_usec = ((pkt_ts % 100000000) / 100) + (pkt_ts % 100) > 50 ? 1 : 0;
-                break;
-            default:
-                SCLogError(SC_ERR_NAPATECH_TIMESTAMP_TYPE_NOT_SUPPORTED,
-                           "Packet from Napatech Stream: %lu does not have a supported timestamp format",
-                           ntv->stream_id);
+        if (ntv->zero_copy) {
+            uint64_t seg_len = NT_NET_GET_SEGMENT_LENGTH(packet_buffer);
+            if (seg_len > 0) {
+                struct NtNetBuf_s pkt_buf;
+
+                _nt_net_build_pkt_netbuf(packet_buffer, &pkt_buf);
+                do {
+                    if (unlikely(NapatechProcessPacket(ntv, &pkt_buf) != TM_ECODE_OK)) {
+                        NT_NetRxRelease(ntv->rx_stream, packet_buffer);
+                        SCReturnInt(TM_ECODE_FAILED);
+                    }
+                } while (_nt_net_get_next_packet(packet_buffer, seg_len, &pkt_buf) > 0);
+            }
+            ntv->segments++;
+        } else {
+            if (unlikely(NapatechProcessPacket(ntv, packet_buffer) != TM_ECODE_OK)) {
                 NT_NetRxRelease(ntv->rx_stream, packet_buffer);
                 SCReturnInt(TM_ECODE_FAILED);
-        }
-
-        SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
-        p->datalink = LINKTYPE_ETHERNET;
-
-        ntv->pkts++;
-        ntv->bytes += NT_NET_GET_PKT_WIRE_LENGTH(packet_buffer);
-
-        // Update drop counter
-        if (unlikely((status = NT_NetRxRead(ntv->rx_stream, &stat_cmd)) != NT_SUCCESS))
-        {
-            NT_ExplainError(status, errbuf, sizeof(errbuf));
-            SCLogWarning(SC_ERR_NAPATECH_STAT_DROPS_FAILED, "Couldn't retrieve drop statistics from the RX stream: %lu - %s", ntv->stream_id, errbuf);
-        }
-        else
-        {
-            ntv->drops += stat_cmd.u.streamDrop.pktsDropped;
-        }
-
-        if (unlikely(PacketCopyData(p, (uint8_t *)NT_NET_GET_PKT_L2_PTR(packet_buffer), NT_NET_GET_PKT_WIRE_LENGTH(packet_buffer)))) {
-            TmqhOutputPacketpool(ntv->tv, p);
-            NT_NetRxRelease(ntv->rx_stream, packet_buffer);
-            SCReturnInt(TM_ECODE_FAILED);
-        }
-
-        if (unlikely(TmThreadsSlotProcessPkt(ntv->tv, ntv->slot, p) != TM_ECODE_OK)) {
-            TmqhOutputPacketpool(ntv->tv, p);
-            NT_NetRxRelease(ntv->rx_stream, packet_buffer);
-            SCReturnInt(TM_ECODE_FAILED);
+            }
         }
 
         NT_NetRxRelease(ntv->rx_stream, packet_buffer);
@@ -315,6 +600,8 @@ void NapatechStreamThreadExitStats(ThreadVars *tv, void *data)
         percent = (((double) ntv->drops) / (ntv->pkts+ntv->drops)) * 100;
 
     SCLogNotice("Stream: %lu; Packets: %"PRIu64"; Drops: %"PRIu64" (%5.2f%%); Bytes: %"PRIu64, ntv->stream_id, ntv->pkts, ntv->drops, percent, ntv->bytes);
+    if (ntv->zero_copy)
+        SCLogNotice("Stream: %lu; Segments: %"PRIu64, ntv->stream_id, ntv->segments);
 }
 
 /**
@@ -328,6 +615,15 @@ TmEcode NapatechStreamThreadDeinit(ThreadVars *tv, void *data)
     NapatechThreadVars *ntv = (NapatechThreadVars *)data;
     SCLogDebug("Closing Napatech Stream: %d", ntv->stream_id);
     NT_NetRxClose(ntv->rx_stream);
+
+    if (ntv->bypass) {
+        int i;
+        SCMutexLock(&nt_bypass.lock);
+        for (i = 0; i < nt_bypass.cnt; i++)
+            NapatechBypassUnprogram(&nt_bypass.entries[i]);
+        nt_bypass.cnt = 0;
+        SCMutexUnlock(&nt_bypass.lock);
+    }
     SCReturnInt(TM_ECODE_OK);
 }
 
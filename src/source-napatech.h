@@ -33,12 +33,16 @@ struct NapatechStreamDevConf
 {
     int stream_id;
     intmax_t hba;
+    int zero_copy;  /**< packets point into the host buffer, workers only */
+    int bypass;     /**< bypassed flows are dropped in the adapter */
 };
 
 #ifdef HAVE_NAPATECH
 
 #include <nt.h>
 
+int NapatechBypassSetup(void);
+
 #endif
 
 #endif /* __SOURCE_NAPATECH_H__ */
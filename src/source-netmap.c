@@ -165,6 +165,9 @@ typedef struct NetmapRing
     int dst_ring_to;
     int dst_next_ring;
     SCSpinlock tx_lock;
+    /** slots queued on the tx ring since the last NIOCTXSYNC,
+     *  protected by tx_lock */
+    uint32_t tx_pending;
 } NetmapRing;
 
 /**
@@ -661,6 +664,16 @@ error:
     SCReturnInt(TM_ECODE_FAILED);
 }
 
+/**
+ * \brief Hand the queued tx slots of a ring to the kernel.
+ * \note tx_lock needs to be held by the caller
+ */
+static inline void NetmapTxSync(NetmapRing *ring)
+{
+    ioctl(ring->fd, NIOCTXSYNC, 0);
+    ring->tx_pending = 0;
+}
+
 /**
  * \brief Output packet to destination interface or drop.
  * \param ntv Thread local variables.
@@ -681,9 +694,13 @@ static TmEcode NetmapWritePacket(NetmapThreadVars *ntv, Packet *p)
     SCSpinLock(&txring->tx_lock);
 
     if (!nm_ring_space(txring->tx)) {
-        ntv->drops++;
-        SCSpinUnlock(&txring->tx_lock);
-        return TM_ECODE_FAILED;
+        /* reclaim the slots the kernel has sent since the last sync */
+        NetmapTxSync(txring);
+        if (!nm_ring_space(txring->tx)) {
+            ntv->drops++;
+            SCSpinUnlock(&txring->tx_lock);
+            return TM_ECODE_FAILED;
+        }
     }
 
     struct netmap_slot *ts = &txring->tx->slot[txring->tx->cur];
@@ -709,8 +726,10 @@ static TmEcode NetmapWritePacket(NetmapThreadVars *ntv, Packet *p)
     }
 
     txring->tx->head = txring->tx->cur = nm_ring_next(txring->tx, txring->tx->cur);
+    txring->tx_pending++;
+    /* in zero copy mode the receive loop syncs once per batch */
     if ((ntv->flags & NETMAP_FLAG_ZERO_COPY) == 0) {
-        ioctl(txring->fd, NIOCTXSYNC, 0);
+        NetmapTxSync(txring);
     }
 
     SCSpinUnlock(&txring->tx_lock);
@@ -907,12 +926,13 @@ static TmEcode ReceiveNetmapLoop(ThreadVars *tv, void *data, void *slot)
 
                     NetmapRing *src_ring = &ntv->ifsrc->rings[src_ring_id];
 
-                    /* sync dst tx rings */
+                    /* sync dst tx rings that got packets from this batch */
                     for (int j = src_ring->dst_ring_from; j <= src_ring->dst_ring_to; j++) {
                         NetmapRing *dst_ring = &ntv->ifdst->rings[j];
                         /* if locked, another loop already do sync */
                         if (SCSpinTrylock(&dst_ring->tx_lock) == 0) {
-                            ioctl(dst_ring->fd, NIOCTXSYNC, 0);
+                            if (dst_ring->tx_pending)
+                                NetmapTxSync(dst_ring);
                             SCSpinUnlock(&dst_ring->tx_lock);
                         }
                     }
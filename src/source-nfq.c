@@ -790,18 +790,11 @@ TmEcode VerdictNFQThreadDeinit(ThreadVars *tv, void *data)
  *  \retval 0 on success.
  *  \retval -1 on failure.
  */
-int NFQRegisterQueue(char *queue)
+static int NFQRegisterOneQueue(uint16_t queue_num)
 {
     NFQThreadVars *ntv = NULL;
     NFQQueueVars *nq = NULL;
-    /* Extract the queue number from the specified command line argument */
-    uint16_t queue_num = 0;
-    if ((ByteExtractStringUint16(&queue_num, 10, strlen(queue), queue)) < 0)
-    {
-        SCLogError(SC_ERR_INVALID_ARGUMENT, "specified queue number %s is not "
-                                        "valid", queue);
-        return -1;
-    }
+    char queue[6];
 
     SCMutexLock(&nfq_init_lock);
     if (receive_queue_num >= NFQ_MAX_QUEUE) {
@@ -823,12 +816,59 @@ int NFQRegisterQueue(char *queue)
     nq->queue_num = queue_num;
     receive_queue_num++;
     SCMutexUnlock(&nfq_init_lock);
+
+    snprintf(queue, sizeof(queue), "%"PRIu16, queue_num);
     LiveRegisterDevice(queue);
 
     SCLogDebug("Queue \"%s\" registered.", queue);
     return 0;
 }
 
+/**
+ *  \brief Register a queue or a range of queues
+ *
+ *  A range "<first>:<last>" matches iptables' --queue-balance and
+ *  registers every queue in it, so that in workers mode each queue
+ *  gets its own thread, pinned through the worker-cpu-set.
+ *
+ *  \param queue queue number or range from the command line
+ *
+ *  \retval 0 on success, -1 on error
+ */
+int NFQRegisterQueue(char *queue)
+{
+    uint16_t queue_num = 0;
+    uint16_t queue_last = 0;
+    char *sep = strchr(queue, ':');
+
+    /* Extract the queue number(s) from the specified command line argument */
+    if (sep != NULL) {
+        if (ByteExtractStringUint16(&queue_num, 10, sep - queue, queue) < 0 ||
+            ByteExtractStringUint16(&queue_last, 10, strlen(sep + 1), sep + 1) < 0 ||
+            queue_last < queue_num)
+        {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "specified queue range %s is not "
+                                            "valid", queue);
+            return -1;
+        }
+    } else {
+        if ((ByteExtractStringUint16(&queue_num, 10, strlen(queue), queue)) < 0)
+        {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "specified queue number %s is not "
+                                            "valid", queue);
+            return -1;
+        }
+        queue_last = queue_num;
+    }
+
+    uint32_t q;
+    for (q = queue_num; q <= queue_last; q++) {
+        if (NFQRegisterOneQueue((uint16_t)q) != 0)
+            return -1;
+    }
+    return 0;
+}
+
 
 
 /**
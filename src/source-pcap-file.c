@@ -45,6 +45,8 @@
 #include "util-checksum.h"
 #include "util-atomic.h"
 
+#include <dirent.h>
+
 #ifdef __SC_CUDA_SUPPORT__
 
 #include "util-cuda.h"
@@ -59,22 +61,55 @@
 
 extern int max_pending_packets;
 
+/** seconds a file in a continuously read directory needs to be left
+ *  unmodified before we consider it complete */
+#define PCAP_FILE_DIR_MIN_AGE       2
+/** directory poll interval in continuous mode */
+#define PCAP_FILE_DIR_POLL_USEC     250000
+
+typedef int (*PcapFileDecoderFunc)(ThreadVars *, DecodeThreadVars *, Packet *,
+                                   uint8_t *, uint16_t, PacketQueue *);
+
 typedef struct PcapFileGlobalVars_ {
-    pcap_t *pcap_handle;
-    int (*Decoder)(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
-    int datalink;
-    struct bpf_program filter;
-    uint64_t cnt; /** packet counter */
     ChecksumValidationMode conf_checksum_mode;
     ChecksumValidationMode checksum_mode;
     SC_ATOMIC_DECLARE(unsigned int, invalid_checksums);
 
+    /** number of threads reading the file, each processing its own
+     *  flow hashed share of the records. 0 or 1: one reader. */
+    uint16_t readers;
+    /** readers run the full pipeline, so records can be passed on
+     *  without copying them out of the libpcap buffer */
+    int zero_copy;
+    SC_ATOMIC_DECLARE(uint16_t, reader_id);
+    SC_ATOMIC_DECLARE(uint16_t, readers_active);
+
 } PcapFileGlobalVars;
 
 typedef struct PcapFileThreadVars_
 {
     uint32_t tenant_id;
 
+    pcap_t *pcap_handle;
+    struct bpf_program filter;
+    int datalink;
+    uint64_t cnt; /** record counter */
+    char filename[PATH_MAX];
+
+    /** directory mode: read all files of 'dir' in order, keeping the
+     *  engine running between them */
+    char *dir;
+    /** keep polling 'dir' for new files */
+    int continuous;
+    char last_file[PATH_MAX];
+    time_t last_mtime;
+    uint32_t files;
+
+    /** this thread's share of the file: records whose flow hash modulo
+     *  'readers' is 'reader_id' */
+    uint16_t reader_id;
+    uint16_t readers;
+
     /* counters */
     uint32_t pkts;
     uint64_t bytes;
@@ -131,6 +166,98 @@ void PcapFileGlobalInit()
 {
     memset(&pcap_g, 0x00, sizeof(pcap_g));
     SC_ATOMIC_INIT(pcap_g.invalid_checksums);
+    SC_ATOMIC_INIT(pcap_g.reader_id);
+    SC_ATOMIC_INIT(pcap_g.readers_active);
+}
+
+/**
+ * \brief Set the number of threads reading the pcap file
+ *
+ * Each reader opens the file itself and only processes the records of
+ * its flow hashed share, so every flow is handled by one thread. As the
+ * readers run the whole pipeline, records are not copied out of the
+ * libpcap buffer.
+ *
+ * Needs to be called after PcapFileGlobalInit.
+ */
+void PcapFileSetReaders(uint16_t readers)
+{
+    pcap_g.readers = readers;
+    pcap_g.zero_copy = 1;
+}
+
+/**
+ * \internal
+ * \brief symmetric hash of the IP addresses of a pcap record
+ *
+ * Only the addresses are used so that fragments and tunneled traffic
+ * end up at the same reader as the rest of their flow.
+ *
+ * \retval hash, 0 for records that are not IPv4 or IPv6
+ */
+static uint32_t PcapFileRecordHash(int datalink, const uint8_t *pkt, uint32_t len)
+{
+    uint32_t off = 0;
+    uint16_t proto = 0;
+    uint32_t a, b, h;
+
+    switch (datalink) {
+        case LINKTYPE_ETHERNET:
+            off = 12;
+            if (len < off + 2)
+                return 0;
+            proto = (pkt[off] << 8) | pkt[off + 1];
+            while ((proto == ETHERNET_TYPE_8021Q || proto == ETHERNET_TYPE_8021AD ||
+                        proto == ETHERNET_TYPE_8021QINQ) && len >= off + 6) {
+                off += 4;
+                proto = (pkt[off] << 8) | pkt[off + 1];
+            }
+            off += 2;
+            break;
+        case LINKTYPE_LINUX_SLL:
+            off = 14;
+            if (len < off + 2)
+                return 0;
+            proto = (pkt[off] << 8) | pkt[off + 1];
+            off += 2;
+            break;
+        case LINKTYPE_NULL:
+            off = 4;
+            /* fall through */
+        case LINKTYPE_RAW:
+            if (len < off + 1)
+                return 0;
+            if ((pkt[off] >> 4) == 4)
+                proto = ETHERNET_TYPE_IP;
+            else if ((pkt[off] >> 4) == 6)
+                proto = ETHERNET_TYPE_IPV6;
+            break;
+        default:
+            return 0;
+    }
+
+    if (proto == ETHERNET_TYPE_IP) {
+        if (len < off + IPV4_HEADER_LEN)
+            return 0;
+        memcpy(&a, pkt + off + 12, sizeof(a));
+        memcpy(&b, pkt + off + 16, sizeof(b));
+        h = a ^ b;
+    } else if (proto == ETHERNET_TYPE_IPV6) {
+        int i;
+        if (len < off + IPV6_HEADER_LEN)
+            return 0;
+        h = 0;
+        for (i = 0; i < 4; i++) {
+            memcpy(&a, pkt + off + 8 + i * 4, sizeof(a));
+            memcpy(&b, pkt + off + 24 + i * 4, sizeof(b));
+            h ^= a ^ b;
+        }
+    } else {
+        return 0;
+    }
+
+    h *= 0x9e3779b1;
+    return h >> 16;
 }
 
 void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
@@ -138,6 +265,13 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     SCEnter();
 
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)user;
+
+    ptv->cnt++;
+    if (ptv->readers > 1 &&
+            PcapFileRecordHash(ptv->datalink, pkt, h->caplen) % ptv->readers != ptv->reader_id) {
+        SCReturn;
+    }
+
     Packet *p = PacketGetFromQueueOrAlloc();
 
     if (unlikely(p == NULL)) {
@@ -149,14 +283,20 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     p->ts.tv_sec = h->ts.tv_sec;
     p->ts.tv_usec = h->ts.tv_usec;
     SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
-    p->datalink = pcap_g.datalink;
-    p->pcap_cnt = ++pcap_g.cnt;
+    p->datalink = ptv->datalink;
+    p->pcap_cnt = ptv->cnt;
 
     p->pcap_v.tenant_id = ptv->tenant_id;
     ptv->pkts++;
     ptv->bytes += h->caplen;
 
-    if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
+    if (pcap_g.zero_copy) {
+        if (unlikely(PacketSetData(p, pkt, h->caplen))) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
+            SCReturn;
+        }
+    } else if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
         TmqhOutputPacketpool(ptv->tv, p);
         PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
         SCReturn;
@@ -176,13 +316,223 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
 
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-        pcap_breakloop(pcap_g.pcap_handle);
+        pcap_breakloop(ptv->pcap_handle);
         ptv->cb_result = TM_ECODE_FAILED;
     }
 
     SCReturn;
 }
 
+/**
+ * \brief get the decoder for a pcap datalink type
+ *
+ * \retval decoder or NULL if the datalink is not supported
+ */
+static PcapFileDecoderFunc PcapFileGetDecoder(int datalink)
+{
+    switch (datalink) {
+        case LINKTYPE_LINUX_SLL:
+            return DecodeSll;
+        case LINKTYPE_ETHERNET:
+            return DecodeEthernet;
+        case LINKTYPE_PPP:
+            return DecodePPP;
+        case LINKTYPE_RAW:
+            return DecodeRaw;
+        case LINKTYPE_NULL:
+            return DecodeNull;
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * \brief open a pcap file, set the bpf filter and check the datalink
+ *
+ * \retval TM_ECODE_OK or TM_ECODE_FAILED, in which case nothing is left open
+ */
+static TmEcode PcapFileOpen(PcapFileThreadVars *ptv, const char *filename)
+{
+    char *tmpbpfstring = NULL;
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+
+    SCLogInfo("reading pcap file %s", filename);
+
+    ptv->pcap_handle = pcap_open_offline(filename, errbuf);
+    if (ptv->pcap_handle == NULL) {
+        SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
+        return TM_ECODE_FAILED;
+    }
+
+    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
+        SCLogDebug("could not get bpf or none specified");
+    } else {
+        SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
+
+        if (pcap_compile(ptv->pcap_handle, &ptv->filter, tmpbpfstring, 1, 0) < 0) {
+            SCLogError(SC_ERR_BPF,"bpf compilation error %s",
+                    pcap_geterr(ptv->pcap_handle));
+            pcap_close(ptv->pcap_handle);
+            ptv->pcap_handle = NULL;
+            return TM_ECODE_FAILED;
+        }
+
+        if (pcap_setfilter(ptv->pcap_handle, &ptv->filter) < 0) {
+            SCLogError(SC_ERR_BPF,"could not set bpf filter %s", pcap_geterr(ptv->pcap_handle));
+            pcap_freecode(&ptv->filter);
+            pcap_close(ptv->pcap_handle);
+            ptv->pcap_handle = NULL;
+            return TM_ECODE_FAILED;
+        }
+    }
+
+    ptv->datalink = pcap_datalink(ptv->pcap_handle);
+    SCLogDebug("datalink %" PRId32 "", ptv->datalink);
+
+    if (PcapFileGetDecoder(ptv->datalink) == NULL) {
+        SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
+                  "(yet) supported in module PcapFile.\n", ptv->datalink);
+        pcap_freecode(&ptv->filter);
+        pcap_close(ptv->pcap_handle);
+        ptv->pcap_handle = NULL;
+        return TM_ECODE_FAILED;
+    }
+
+#ifdef HAVE_POSIX_FADVISE
+    (void)posix_fadvise(pcap_fileno(ptv->pcap_handle), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    strlcpy(ptv->filename, filename, sizeof(ptv->filename));
+    return TM_ECODE_OK;
+}
+
+static void PcapFileClose(PcapFileThreadVars *ptv)
+{
+    if (ptv->pcap_handle != NULL) {
+        pcap_close(ptv->pcap_handle);
+        ptv->pcap_handle = NULL;
+    }
+    pcap_freecode(&ptv->filter);
+    memset(&ptv->filter, 0, sizeof(ptv->filter));
+}
+
+/**
+ * \internal
+ * \brief compare two directory entries by modification time, then name
+ */
+static int PcapFileDirCmp(time_t mtime_a, const char *name_a,
+                          time_t mtime_b, const char *name_b)
+{
+    if (mtime_a != mtime_b)
+        return (mtime_a < mtime_b) ? -1 : 1;
+    return strcmp(name_a, name_b);
+}
+
+/**
+ * \internal
+ * \brief find the next file in the directory
+ *
+ * Files are processed in modification time order. The next file is the
+ * oldest one after the last file processed. In continuous mode files
+ * modified in the last PCAP_FILE_DIR_MIN_AGE seconds are assumed to still
+ * be written.
+ *
+ * \param ahead if not NULL, gets the file after the next one
+ *
+ * \retval 1 if a file was found, 0 otherwise
+ */
+static int PcapFileDirFind(PcapFileThreadVars *ptv, char *next, size_t next_len,
+                           time_t *next_mtime, char *ahead, size_t ahead_len)
+{
+    DIR *dir = opendir(ptv->dir);
+    if (dir == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open directory %s: %s",
+                ptv->dir, strerror(errno));
+        return 0;
+    }
+
+    time_t now = time(NULL);
+    time_t ahead_mtime = 0;
+    int found = 0;
+    int found_ahead = 0;
+    char path[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", ptv->dir, de->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        if (ptv->continuous && st.st_mtime > now - PCAP_FILE_DIR_MIN_AGE)
+            continue;
+        if (ptv->last_file[0] != '\0' &&
+            PcapFileDirCmp(st.st_mtime, path, ptv->last_mtime, ptv->last_file) <= 0)
+            continue;
+
+        if (!found || PcapFileDirCmp(st.st_mtime, path, *next_mtime, next) < 0) {
+            if (found && ahead != NULL) {
+                strlcpy(ahead, next, ahead_len);
+                ahead_mtime = *next_mtime;
+                found_ahead = 1;
+            }
+            strlcpy(next, path, next_len);
+            *next_mtime = st.st_mtime;
+            found = 1;
+        } else if (ahead != NULL && (!found_ahead ||
+                   PcapFileDirCmp(st.st_mtime, path, ahead_mtime, ahead) < 0)) {
+            strlcpy(ahead, path, ahead_len);
+            ahead_mtime = st.st_mtime;
+            found_ahead = 1;
+        }
+    }
+    closedir(dir);
+
+    if (ahead != NULL && !found_ahead)
+        ahead[0] = '\0';
+    return found;
+}
+
+/**
+ * \internal
+ * \brief open the next file of the directory
+ *
+ * While the file is processed the one after it is read ahead into the
+ * page cache.
+ *
+ * \retval 1 if a file was opened, 0 if there is none (yet)
+ */
+static int PcapFileDirOpenNext(PcapFileThreadVars *ptv)
+{
+    char next[PATH_MAX];
+    char ahead[PATH_MAX];
+    time_t mtime = 0;
+
+    while (PcapFileDirFind(ptv, next, sizeof(next), &mtime, ahead, sizeof(ahead)) == 1) {
+        /* mark it done even if it fails to open, so we don't retry it */
+        strlcpy(ptv->last_file, next, sizeof(ptv->last_file));
+        ptv->last_mtime = mtime;
+
+        if (PcapFileOpen(ptv, next) != TM_ECODE_OK) {
+            SCLogWarning(SC_ERR_FOPEN, "skipping %s", next);
+            continue;
+        }
+        ptv->files++;
+
+#ifdef HAVE_POSIX_FADVISE
+        if (ahead[0] != '\0') {
+            int fd = open(ahead, O_RDONLY);
+            if (fd != -1) {
+                (void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                close(fd);
+            }
+        }
+#endif
+        return 1;
+    }
+    return 0;
+}
+
 /**
  *  \brief Main PCAP file reading Loop function
  */
@@ -203,33 +553,51 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
             SCReturnInt(TM_ECODE_OK);
         }
 
+        /* continuous directory mode: wait for the next file */
+        if (ptv->pcap_handle == NULL) {
+            if (PcapFileDirOpenNext(ptv) == 0) {
+                usleep(PCAP_FILE_DIR_POLL_USEC);
+                StatsSyncCountersIfSignalled(tv);
+                continue;
+            }
+        }
+
         /* make sure we have at least one packet in the packet pool, to prevent
          * us from alloc'ing packets at line rate */
         PacketPoolWait();
 
         /* Right now we just support reading packets one at a time. */
-        r = pcap_dispatch(pcap_g.pcap_handle, packet_q_len,
+        r = pcap_dispatch(ptv->pcap_handle, packet_q_len,
                           (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
         if (unlikely(r == -1)) {
             SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s",
-                       r, pcap_geterr(pcap_g.pcap_handle));
+                       r, pcap_geterr(ptv->pcap_handle));
             if (! RunModeUnixSocketIsActive()) {
                 /* in the error state we just kill the engine */
                 EngineKill();
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                pcap_close(ptv->pcap_handle);
+                ptv->pcap_handle = NULL;
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
         } else if (unlikely(r == 0)) {
+            if (ptv->dir != NULL) {
+                /* directory mode: keep the engine running for the next file */
+                SCLogInfo("pcap file %s end of file reached", ptv->filename);
+                PcapFileClose(ptv);
+                if (PcapFileDirOpenNext(ptv) == 1 || ptv->continuous)
+                    continue;
+            }
             SCLogInfo("pcap file end of file reached (pcap err code %" PRId32 ")", r);
             if (! RunModeUnixSocketIsActive()) {
-                EngineStop();
+                /* last reader to finish stops the engine */
+                if (SC_ATOMIC_SUB(pcap_g.readers_active, 1) == 0)
+                    EngineStop();
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                pcap_close(ptv->pcap_handle);
+                ptv->pcap_handle = NULL;
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -240,8 +608,8 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
                 EngineKill();
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                pcap_close(ptv->pcap_handle);
+                ptv->pcap_handle = NULL;
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -256,7 +624,6 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data)
 {
     SCEnter();
 
-    char *tmpbpfstring = NULL;
     char *tmpstring = NULL;
 
     if (initdata == NULL) {
@@ -264,8 +631,6 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data)
         SCReturnInt(TM_ECODE_FAILED);
     }
 
-    SCLogInfo("reading pcap file %s", (char *)initdata);
-
     PcapFileThreadVars *ptv = SCMalloc(sizeof(PcapFileThreadVars));
     if (unlikely(ptv == NULL))
         SCReturnInt(TM_ECODE_FAILED);
@@ -281,72 +646,35 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data)
         }
     }
 
-    char errbuf[PCAP_ERRBUF_SIZE] = "";
-    pcap_g.pcap_handle = pcap_open_offline((char *)initdata, errbuf);
-    if (pcap_g.pcap_handle == NULL) {
-        SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
+    struct stat st;
+    if (!RunModeUnixSocketIsActive() &&
+            stat((char *)initdata, &st) == 0 && S_ISDIR(st.st_mode)) {
+        ptv->dir = SCStrdup((char *)initdata);
+        if (unlikely(ptv->dir == NULL)) {
+            SCFree(ptv);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        (void)ConfGetBool("pcap-file.continuous", &ptv->continuous);
+        SCLogInfo("reading pcap files from directory %s%s", ptv->dir,
+                ptv->continuous ? " (continuous)" : "");
+
+        /* in continuous mode the directory may still be empty */
+        if (PcapFileDirOpenNext(ptv) == 0 && !ptv->continuous) {
+            SCLogError(SC_ERR_FOPEN, "no pcap files found in %s", ptv->dir);
+            SCFree(ptv->dir);
+            SCFree(ptv);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+    } else if (PcapFileOpen(ptv, (char *)initdata) != TM_ECODE_OK) {
         SCFree(ptv);
         if (! RunModeUnixSocketIsActive()) {
-            return TM_ECODE_FAILED;
+            SCReturnInt(TM_ECODE_FAILED);
         } else {
             UnixSocketPcapFile(TM_ECODE_FAILED);
             SCReturnInt(TM_ECODE_DONE);
         }
     }
 
-    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
-        SCLogDebug("could not get bpf or none specified");
-    } else {
-        SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
-
-        if (pcap_compile(pcap_g.pcap_handle, &pcap_g.filter, tmpbpfstring, 1, 0) < 0) {
-            SCLogError(SC_ERR_BPF,"bpf compilation error %s",
-                    pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
-        }
-
-        if (pcap_setfilter(pcap_g.pcap_handle, &pcap_g.filter) < 0) {
-            SCLogError(SC_ERR_BPF,"could not set bpf filter %s", pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
-        }
-    }
-
-    pcap_g.datalink = pcap_datalink(pcap_g.pcap_handle);
-    SCLogDebug("datalink %" PRId32 "", pcap_g.datalink);
-
-    switch (pcap_g.datalink) {
-        case LINKTYPE_LINUX_SLL:
-            pcap_g.Decoder = DecodeSll;
-            break;
-        case LINKTYPE_ETHERNET:
-            pcap_g.Decoder = DecodeEthernet;
-            break;
-        case LINKTYPE_PPP:
-            pcap_g.Decoder = DecodePPP;
-            break;
-        case LINKTYPE_RAW:
-            pcap_g.Decoder = DecodeRaw;
-            break;
-        case LINKTYPE_NULL:
-            pcap_g.Decoder = DecodeNull;
-            break;
-
-        default:
-            SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
-                      "(yet) supported in module PcapFile.\n", pcap_g.datalink);
-            SCFree(ptv);
-            if (! RunModeUnixSocketIsActive()) {
-                SCReturnInt(TM_ECODE_FAILED);
-            } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
-                UnixSocketPcapFile(TM_ECODE_DONE);
-                SCReturnInt(TM_ECODE_DONE);
-            }
-    }
-
     if (ConfGet("pcap-file.checksum-checks", &tmpstring) != 1) {
         pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_AUTO;
     } else {
@@ -360,6 +688,13 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data)
     }
     pcap_g.checksum_mode = pcap_g.conf_checksum_mode;
 
+    ptv->readers = pcap_g.readers;
+    if (ptv->readers > 1) {
+        ptv->reader_id = SC_ATOMIC_ADD(pcap_g.reader_id, 1) - 1;
+        SCLogInfo("reader %u of %u", ptv->reader_id + 1, ptv->readers);
+    }
+    (void)SC_ATOMIC_ADD(pcap_g.readers_active, 1);
+
     ptv->tv = tv;
     *data = (void *)ptv;
 
@@ -372,9 +707,9 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
 
     if (pcap_g.conf_checksum_mode == CHECKSUM_VALIDATION_AUTO &&
-            pcap_g.cnt < CHECKSUM_SAMPLE_COUNT &&
+            ptv->cnt < CHECKSUM_SAMPLE_COUNT &&
             SC_ATOMIC_GET(pcap_g.invalid_checksums)) {
-        uint64_t chrate = pcap_g.cnt / SC_ATOMIC_GET(pcap_g.invalid_checksums);
+        uint64_t chrate = ptv->cnt / SC_ATOMIC_GET(pcap_g.invalid_checksums);
         if (chrate < CHECKSUM_INVALID_RATIO)
             SCLogWarning(SC_ERR_INVALID_CHECKSUM,
                          "1/%" PRIu64 "th of packets have an invalid checksum,"
@@ -385,6 +720,11 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
             SCLogInfo("1/%" PRIu64 "th of packets have an invalid checksum",
                       chrate);
     }
+    if (ptv->dir != NULL) {
+        SCLogNotice("Pcap-file module read %" PRIu32 " files, %" PRIu32 " packets, %" PRIu64 " bytes",
+                ptv->files, ptv->pkts, ptv->bytes);
+        return;
+    }
     SCLogNotice("Pcap-file module read %" PRIu32 " packets, %" PRIu64 " bytes", ptv->pkts, ptv->bytes);
     return;
 }
@@ -394,6 +734,9 @@ TmEcode ReceivePcapFileThreadDeinit(ThreadVars *tv, void *data)
     SCEnter();
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
     if (ptv) {
+        PcapFileClose(ptv);
+        if (ptv->dir != NULL)
+            SCFree(ptv->dir);
         SCFree(ptv);
     }
     SCReturnInt(TM_ECODE_OK);
@@ -420,8 +763,10 @@ TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, P
         FlowWakeupFlowManagerThread();
     }
 
-    /* call the decoder */
-    pcap_g.Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+    /* call the decoder, files read in directory mode can differ in datalink */
+    PcapFileDecoderFunc Decoder = PcapFileGetDecoder(p->datalink);
+    if (likely(Decoder != NULL))
+        Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
 
 #ifdef DEBUG
     BUG_ON(p->pkt_src != PKT_SRC_WIRE && p->pkt_src != PKT_SRC_FFR);
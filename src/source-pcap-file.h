@@ -30,6 +30,7 @@ void TmModuleDecodePcapFileRegister (void);
 void PcapIncreaseInvalidChecksum();
 
 void PcapFileGlobalInit();
+void PcapFileSetReaders(uint16_t readers);
 
 #endif /* __SOURCE_PCAP_FILE_H__ */
 
@@ -452,7 +452,18 @@ TmEcode ReceivePfringThreadInit(ThreadVars *tv, void *initdata, void **data)
     ptv->tv = tv;
     ptv->threads = 1;
 
-    ptv->interface = SCStrdup(pfconf->iface);
+    /* a ZC device without an explicit queue shared by several threads:
+     * attach each thread to its own ZC queue instead of a cluster */
+    if (strncmp(pfconf->iface, "zc", 2) == 0 && pfconf->threads > 1 &&
+            strchr(pfconf->iface, '@') == NULL) {
+        char zc_iface[PFRING_IFACE_NAME_LENGTH + 8];
+        unsigned int queue = SC_ATOMIC_ADD(pfconf->zc_queue, 1) - 1;
+
+        snprintf(zc_iface, sizeof(zc_iface), "%s@%u", pfconf->iface, queue);
+        ptv->interface = SCStrdup(zc_iface);
+    } else {
+        ptv->interface = SCStrdup(pfconf->iface);
+    }
     if (unlikely(ptv->interface == NULL)) {
         SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate device string");
         SCFree(ptv);
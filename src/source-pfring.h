@@ -52,6 +52,8 @@ typedef struct PfringIfaceConfig_
 
     ChecksumValidationMode checksum_mode;
     SC_ATOMIC_DECLARE(unsigned int, ref);
+    /* next ZC queue to attach a thread to */
+    SC_ATOMIC_DECLARE(unsigned int, zc_queue);
     void (*DerefFunc)(void *);
 } PfringIfaceConfig;
 
@@ -0,0 +1,842 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Synthetic traffic source, for load testing the engine without a
+ * capture method in the way.
+ *
+ * Each generator thread builds ethernet/ipv4 packets straight into
+ * packets from the packet pool. It keeps a set of concurrent flows
+ * and sends one packet of each in turn: tcp sessions with a three-way
+ * handshake, data in both directions and a reset, udp and icmp echo
+ * exchanges. Payloads are slices of a corpus read from disk, or of
+ * random data. All choices come from a per thread generator seeded
+ * with the configured seed, so runs with the same config produce the
+ * same traffic.
+ *
+ * Packet timestamps start at the time the engine starts and advance
+ * one microsecond per packet, the engine runs in offline time mode.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "decode.h"
+#include "pkt-var.h"
+#include "conf.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "tmqh-packetpool.h"
+#include "source-synthetic.h"
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-error.h"
+#include "util-profiling.h"
+#include "util-unittest.h"
+
+#include <dirent.h>
+
+#define SYNTHETIC_DEFAULT_FLOWS         1000
+#define SYNTHETIC_DEFAULT_PKTS_PER_FLOW 20
+#define SYNTHETIC_DEFAULT_PAYLOAD       512
+#define SYNTHETIC_DEFAULT_SEED          1
+
+/** size of the random corpus used when none is configured */
+#define SYNTHETIC_RANDOM_CORPUS         (64 * 1024)
+/** cap on the corpus read from disk */
+#define SYNTHETIC_MAX_CORPUS            (64 * 1024 * 1024)
+
+/** tcp flows need a handshake and a reset at least */
+#define SYNTHETIC_MIN_PKTS_PER_FLOW     4
+
+#define SYNTHETIC_NELEM(a) (sizeof(a) / sizeof((a)[0]))
+
+#define SYNTHETIC_HDR_LEN (ETHERNET_HEADER_LEN + IPV4_HEADER_LEN + TCP_HEADER_LEN)
+
+static struct {
+    uint32_t flows;             /**< concurrent flows per generator */
+    uint32_t pkts_per_flow;
+    uint16_t payload_size;      /**< max payload size */
+    uint32_t mix_tcp;
+    uint32_t mix_udp;
+    uint32_t mix_icmp;
+    uint64_t seed;
+    uint64_t count;             /**< packets per generator, 0 no limit */
+    int threads;
+
+    uint8_t *corpus;
+    uint32_t corpus_len;
+
+    struct timeval start;
+
+    /** generators still running, the last one to finish stops the
+     *  engine */
+    SC_ATOMIC_DECLARE(uint16_t, active);
+    /** generators started, used as the offset to the seed */
+    SC_ATOMIC_DECLARE(uint16_t, started);
+} synthetic_g;
+
+static const uint16_t synthetic_tcp_ports[] = { 80, 443, 8080, 25, 110, 143, 445, 21, 22, 3389 };
+static const uint16_t synthetic_udp_ports[] = { 53, 123, 161, 514, 1900, 5060 };
+
+typedef struct SyntheticFlow_ {
+    uint32_t src;               /**< client address, network order */
+    uint32_t dst;               /**< server address, network order */
+    uint16_t sp;
+    uint16_t dp;
+    uint8_t proto;
+    uint16_t ip_id;
+    uint32_t pkt;               /**< packets sent */
+    uint32_t seq[2];            /**< next tcp seq of client and server */
+} SyntheticFlow;
+
+typedef struct SyntheticThreadVars_ {
+    ThreadVars *tv;
+    TmSlot *slot;
+
+    uint64_t rng;
+    SyntheticFlow *flows;
+    uint32_t next;              /**< flow the next packet belongs to */
+    struct timeval ts;
+
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t flows_done;
+} SyntheticThreadVars;
+
+TmEcode ReceiveSyntheticLoop(ThreadVars *, void *, void *);
+TmEcode ReceiveSyntheticThreadInit(ThreadVars *, void *, void **);
+void ReceiveSyntheticThreadExitStats(ThreadVars *, void *);
+TmEcode ReceiveSyntheticThreadDeinit(ThreadVars *, void *);
+
+TmEcode DecodeSyntheticThreadInit(ThreadVars *, void *, void **);
+TmEcode DecodeSyntheticThreadDeinit(ThreadVars *tv, void *data);
+TmEcode DecodeSynthetic(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
+
+static void SyntheticRegisterTests(void);
+
+/**
+ * \brief Register the synthetic traffic receiver (generator) module.
+ */
+void TmModuleReceiveSyntheticRegister(void)
+{
+    tmm_modules[TMM_RECEIVESYNTHETIC].name = "ReceiveSynthetic";
+    tmm_modules[TMM_RECEIVESYNTHETIC].ThreadInit = ReceiveSyntheticThreadInit;
+    tmm_modules[TMM_RECEIVESYNTHETIC].Func = NULL;
+    tmm_modules[TMM_RECEIVESYNTHETIC].PktAcqLoop = ReceiveSyntheticLoop;
+    tmm_modules[TMM_RECEIVESYNTHETIC].PktAcqBreakLoop = NULL;
+    tmm_modules[TMM_RECEIVESYNTHETIC].ThreadExitPrintStats =
+        ReceiveSyntheticThreadExitStats;
+    tmm_modules[TMM_RECEIVESYNTHETIC].ThreadDeinit = ReceiveSyntheticThreadDeinit;
+    tmm_modules[TMM_RECEIVESYNTHETIC].RegisterTests = SyntheticRegisterTests;
+    tmm_modules[TMM_RECEIVESYNTHETIC].cap_flags = 0;
+    tmm_modules[TMM_RECEIVESYNTHETIC].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Register the synthetic traffic decoder module.
+ */
+void TmModuleDecodeSyntheticRegister(void)
+{
+    tmm_modules[TMM_DECODESYNTHETIC].name = "DecodeSynthetic";
+    tmm_modules[TMM_DECODESYNTHETIC].ThreadInit = DecodeSyntheticThreadInit;
+    tmm_modules[TMM_DECODESYNTHETIC].Func = DecodeSynthetic;
+    tmm_modules[TMM_DECODESYNTHETIC].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODESYNTHETIC].ThreadDeinit = DecodeSyntheticThreadDeinit;
+    tmm_modules[TMM_DECODESYNTHETIC].RegisterTests = NULL;
+    tmm_modules[TMM_DECODESYNTHETIC].cap_flags = 0;
+    tmm_modules[TMM_DECODESYNTHETIC].flags = TM_FLAG_DECODE_TM;
+}
+
+/** \internal
+ *  \brief get an integer from the synthetic config, checking its range
+ *
+ *  \retval 1 'val' was set
+ *  \retval 0 not set or invalid, 'val' is untouched
+ */
+static int SyntheticConfGetInt(const ConfNode *node, const char *name,
+        intmax_t min, intmax_t max, intmax_t *val)
+{
+    intmax_t v;
+
+    if (node == NULL || ConfGetChildValueInt(node, name, &v) != 1)
+        return 0;
+    if (v < min || v > max) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "synthetic.%s %"PRIdMAX" is out "
+                "of range [%"PRIdMAX"-%"PRIdMAX"], using %"PRIdMAX,
+                name, v, min, max, *val);
+        return 0;
+    }
+    *val = v;
+    return 1;
+}
+
+/** \internal
+ *  \brief append the content of file 'path' to the corpus */
+static void SyntheticCorpusAddFile(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "Failed to open synthetic corpus %s: %s",
+                path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    long size = 0;
+    if (fseek(fp, 0, SEEK_END) == 0)
+        size = ftell(fp);
+    rewind(fp);
+
+    if (size > (long)(SYNTHETIC_MAX_CORPUS - synthetic_g.corpus_len))
+        size = (long)(SYNTHETIC_MAX_CORPUS - synthetic_g.corpus_len);
+    if (size <= 0) {
+        fclose(fp);
+        return;
+    }
+
+    uint8_t *corpus = SCRealloc(synthetic_g.corpus, synthetic_g.corpus_len + size);
+    if (unlikely(corpus == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate the synthetic corpus");
+        exit(EXIT_FAILURE);
+    }
+    synthetic_g.corpus = corpus;
+
+    size_t r = fread(corpus + synthetic_g.corpus_len, 1, (size_t)size, fp);
+    synthetic_g.corpus_len += (uint32_t)r;
+    fclose(fp);
+}
+
+/** \internal
+ *  \brief read the corpus from a file, or from all files of a directory */
+static void SyntheticCorpusLoad(const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        SCLogError(SC_ERR_FOPEN, "Failed to open synthetic corpus %s: %s",
+                path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        SyntheticCorpusAddFile(path);
+    } else {
+        DIR *dir = opendir(path);
+        if (dir == NULL) {
+            SCLogError(SC_ERR_FOPEN, "Failed to open synthetic corpus %s: %s",
+                    path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        struct dirent *de;
+        while ((de = readdir(dir)) != NULL &&
+                synthetic_g.corpus_len < SYNTHETIC_MAX_CORPUS)
+        {
+            char file[PATH_MAX];
+
+            if (de->d_name[0] == '.')
+                continue;
+            snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+            if (stat(file, &st) != 0 || !S_ISREG(st.st_mode))
+                continue;
+            SyntheticCorpusAddFile(file);
+        }
+        closedir(dir);
+    }
+
+    if (synthetic_g.corpus_len == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "synthetic corpus %s is empty, "
+                "using random payloads", path);
+        SCFree(synthetic_g.corpus);
+        synthetic_g.corpus = NULL;
+        return;
+    }
+    SCLogConfig("synthetic: %u bytes of payload corpus from %s",
+            synthetic_g.corpus_len, path);
+}
+
+/** \internal
+ *  \brief xorshift64*, the generator behind every choice */
+static inline uint64_t SyntheticRandom(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline void SyntheticSeed(uint64_t *state, uint64_t seed)
+{
+    *state = (seed + 1) * 0x9E3779B97F4A7C15ULL;
+    if (*state == 0)
+        *state = 1;
+}
+
+/** \internal
+ *  \brief fill the corpus with random bytes */
+static void SyntheticCorpusRandom(void)
+{
+    uint64_t state;
+    uint32_t i;
+
+    synthetic_g.corpus = SCMalloc(SYNTHETIC_RANDOM_CORPUS);
+    if (unlikely(synthetic_g.corpus == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate the synthetic corpus");
+        exit(EXIT_FAILURE);
+    }
+    synthetic_g.corpus_len = SYNTHETIC_RANDOM_CORPUS;
+
+    SyntheticSeed(&state, synthetic_g.seed);
+    for (i = 0; i < SYNTHETIC_RANDOM_CORPUS; i += sizeof(uint64_t)) {
+        uint64_t r = SyntheticRandom(&state);
+        memcpy(synthetic_g.corpus + i, &r, sizeof(r));
+    }
+}
+
+/**
+ * \brief read the synthetic config, call before the generator threads
+ *        are set up
+ */
+void SyntheticGlobalInit(void)
+{
+    memset(&synthetic_g, 0, sizeof(synthetic_g));
+    SC_ATOMIC_INIT(synthetic_g.active);
+    SC_ATOMIC_INIT(synthetic_g.started);
+
+    intmax_t flows = SYNTHETIC_DEFAULT_FLOWS;
+    intmax_t pkts_per_flow = SYNTHETIC_DEFAULT_PKTS_PER_FLOW;
+    intmax_t payload_size = SYNTHETIC_DEFAULT_PAYLOAD;
+    intmax_t mix_tcp = 80, mix_udp = 15, mix_icmp = 5;
+    intmax_t seed = SYNTHETIC_DEFAULT_SEED;
+    intmax_t count = 0;
+    intmax_t threads = 0;
+
+    intmax_t max_payload = default_packet_size > SYNTHETIC_HDR_LEN ?
+        (intmax_t)(default_packet_size - SYNTHETIC_HDR_LEN) : 1;
+    if (payload_size > max_payload)
+        payload_size = max_payload;
+
+    ConfNode *node = ConfGetNode("synthetic");
+    SyntheticConfGetInt(node, "flows", 1, UINT32_MAX, &flows);
+    SyntheticConfGetInt(node, "packets-per-flow", SYNTHETIC_MIN_PKTS_PER_FLOW,
+            UINT32_MAX, &pkts_per_flow);
+    SyntheticConfGetInt(node, "payload-size", 1, max_payload, &payload_size);
+    SyntheticConfGetInt(node, "seed", 0, INTMAX_MAX, &seed);
+    SyntheticConfGetInt(node, "packets", 0, INTMAX_MAX, &count);
+    SyntheticConfGetInt(node, "threads", 0, UINT16_MAX, &threads);
+
+    ConfNode *mix = node ? ConfNodeLookupChild(node, "mix") : NULL;
+    if (mix != NULL) {
+        mix_tcp = mix_udp = mix_icmp = 0;
+        SyntheticConfGetInt(mix, "tcp", 0, 100, &mix_tcp);
+        SyntheticConfGetInt(mix, "udp", 0, 100, &mix_udp);
+        SyntheticConfGetInt(mix, "icmp", 0, 100, &mix_icmp);
+        if (mix_tcp + mix_udp + mix_icmp == 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "synthetic.mix is empty, "
+                    "generating tcp only");
+            mix_tcp = 100;
+        }
+    }
+
+    synthetic_g.flows = (uint32_t)flows;
+    synthetic_g.pkts_per_flow = (uint32_t)pkts_per_flow;
+    synthetic_g.payload_size = (uint16_t)payload_size;
+    synthetic_g.mix_tcp = (uint32_t)mix_tcp;
+    synthetic_g.mix_udp = (uint32_t)mix_udp;
+    synthetic_g.mix_icmp = (uint32_t)mix_icmp;
+    synthetic_g.seed = (uint64_t)seed;
+    synthetic_g.count = (uint64_t)count;
+    synthetic_g.threads = (int)threads;
+
+    char *corpus = NULL;
+    if (node != NULL && ConfGetChildValue(node, "corpus", &corpus) == 1 &&
+            corpus != NULL)
+    {
+        SyntheticCorpusLoad(corpus);
+    }
+    if (synthetic_g.corpus == NULL)
+        SyntheticCorpusRandom();
+
+    gettimeofday(&synthetic_g.start, NULL);
+
+    SCLogConfig("synthetic: %u flows per thread, %u packets per flow, "
+            "payloads up to %u bytes, tcp/udp/icmp %u/%u/%u, seed %"PRIu64,
+            synthetic_g.flows, synthetic_g.pkts_per_flow,
+            synthetic_g.payload_size, synthetic_g.mix_tcp,
+            synthetic_g.mix_udp, synthetic_g.mix_icmp, synthetic_g.seed);
+}
+
+/**
+ * \brief set the number of generator threads the runmode sets up
+ */
+void SyntheticSetGenerators(uint16_t generators)
+{
+    SC_ATOMIC_SET(synthetic_g.active, generators);
+}
+
+/**
+ * \brief get the configured number of threads
+ *
+ * \retval threads or 0 if not set
+ */
+int SyntheticGetThreads(void)
+{
+    return synthetic_g.threads;
+}
+
+/** \internal
+ *  \brief start a new flow in 'f' */
+static void SyntheticFlowNew(SyntheticThreadVars *stv, SyntheticFlow *f)
+{
+    uint64_t r = SyntheticRandom(&stv->rng);
+    uint32_t total = synthetic_g.mix_tcp + synthetic_g.mix_udp + synthetic_g.mix_icmp;
+    uint32_t pick = (uint32_t)(r % total);
+
+    memset(f, 0, sizeof(*f));
+    if (pick < synthetic_g.mix_tcp) {
+        f->proto = IPPROTO_TCP;
+        f->dp = synthetic_tcp_ports[(r >> 8) % SYNTHETIC_NELEM(synthetic_tcp_ports)];
+    } else if (pick < synthetic_g.mix_tcp + synthetic_g.mix_udp) {
+        f->proto = IPPROTO_UDP;
+        f->dp = synthetic_udp_ports[(r >> 8) % SYNTHETIC_NELEM(synthetic_udp_ports)];
+    } else {
+        f->proto = IPPROTO_ICMP;
+    }
+    f->sp = (uint16_t)(1024 + ((r >> 16) % (65536 - 1024)));
+    f->ip_id = (uint16_t)(r >> 48);
+
+    r = SyntheticRandom(&stv->rng);
+    /* clients in 10.0.0.0/8, servers in 192.168.0.0/16 */
+    f->src = htonl(0x0a000000 | (uint32_t)(r & 0x00ffffff));
+    f->dst = htonl(0xc0a80000 | (uint32_t)((r >> 24) & 0xffff));
+
+    r = SyntheticRandom(&stv->rng);
+    f->seq[0] = (uint32_t)r;
+    f->seq[1] = (uint32_t)(r >> 32);
+}
+
+/** \internal
+ *  \brief copy 'len' bytes from a random offset in the corpus */
+static void SyntheticPayload(SyntheticThreadVars *stv, uint8_t *dst, uint16_t len)
+{
+    uint32_t off = (uint32_t)(SyntheticRandom(&stv->rng) % synthetic_g.corpus_len);
+
+    while (len > 0) {
+        uint32_t n = MIN(len, synthetic_g.corpus_len - off);
+        memcpy(dst, synthetic_g.corpus + off, n);
+        dst += n;
+        len -= n;
+        off = 0;
+    }
+}
+
+/** \internal
+ *  \brief build the next packet in 'p'
+ *
+ *  Sends the next packet of the current flow and moves on to the next
+ *  flow, replacing flows that are complete.
+ */
+static void SyntheticNextPacket(SyntheticThreadVars *stv, Packet *p)
+{
+    SyntheticFlow *f = &stv->flows[stv->next];
+    const uint32_t last = synthetic_g.pkts_per_flow - 1;
+    uint8_t *pkt = GET_PKT_DATA(p);
+    int toserver = 1;
+    uint8_t tcp_flags = 0;
+    uint16_t plen = 0;
+    uint16_t l4len;
+
+    if (f->proto == IPPROTO_TCP) {
+        if (f->pkt == 0) {
+            tcp_flags = TH_SYN;
+        } else if (f->pkt == 1) {
+            tcp_flags = TH_SYN|TH_ACK;
+            toserver = 0;
+        } else if (f->pkt == 2) {
+            tcp_flags = TH_ACK;
+        } else if (f->pkt == last) {
+            tcp_flags = TH_RST|TH_ACK;
+        } else {
+            /* the client speaks first */
+            tcp_flags = TH_PUSH|TH_ACK;
+            toserver = f->pkt & 1;
+        }
+        l4len = TCP_HEADER_LEN;
+    } else {
+        toserver = !(f->pkt & 1);
+        l4len = (f->proto == IPPROTO_UDP) ? UDP_HEADER_LEN : ICMPV4_HEADER_LEN;
+    }
+    if (tcp_flags == 0 || tcp_flags == (TH_PUSH|TH_ACK)) {
+        plen = (uint16_t)(1 + SyntheticRandom(&stv->rng) % synthetic_g.payload_size);
+    }
+
+    EthernetHdr *eth = (EthernetHdr *)pkt;
+    memset(eth, 0, sizeof(*eth));
+    eth->eth_dst[5] = toserver ? 2 : 1;
+    eth->eth_src[5] = toserver ? 1 : 2;
+    eth->eth_type = htons(ETHERNET_TYPE_IP);
+
+    IPV4Hdr *ip4h = (IPV4Hdr *)(pkt + ETHERNET_HEADER_LEN);
+    ip4h->ip_verhl = 0x45;
+    ip4h->ip_tos = 0;
+    ip4h->ip_len = htons(IPV4_HEADER_LEN + l4len + plen);
+    ip4h->ip_id = htons(f->ip_id++);
+    ip4h->ip_off = 0;
+    ip4h->ip_ttl = 64;
+    ip4h->ip_proto = f->proto;
+    ip4h->s_ip_src.s_addr = toserver ? f->src : f->dst;
+    ip4h->s_ip_dst.s_addr = toserver ? f->dst : f->src;
+    ip4h->ip_csum = 0;
+    ip4h->ip_csum = IPV4CalculateChecksum((uint16_t *)ip4h, IPV4_HEADER_LEN);
+
+    uint8_t *l4 = (uint8_t *)ip4h + IPV4_HEADER_LEN;
+    const uint16_t sp = toserver ? f->sp : f->dp;
+    const uint16_t dp = toserver ? f->dp : f->sp;
+    const int dir = toserver ? 0 : 1;
+
+    if (f->proto == IPPROTO_TCP) {
+        TCPHdr *tcph = (TCPHdr *)l4;
+        tcph->th_sport = htons(sp);
+        tcph->th_dport = htons(dp);
+        tcph->th_seq = htonl(f->seq[dir]);
+        tcph->th_ack = (tcp_flags & TH_ACK) ? htonl(f->seq[!dir]) : 0;
+        tcph->th_offx2 = 0x50;
+        tcph->th_flags = tcp_flags;
+        tcph->th_win = htons(65535);
+        tcph->th_sum = 0;
+        tcph->th_urp = 0;
+
+        f->seq[dir] += plen + ((tcp_flags & TH_SYN) ? 1 : 0);
+    } else if (f->proto == IPPROTO_UDP) {
+        UDPHdr *udph = (UDPHdr *)l4;
+        udph->uh_sport = htons(sp);
+        udph->uh_dport = htons(dp);
+        udph->uh_len = htons(UDP_HEADER_LEN + plen);
+        udph->uh_sum = 0;
+    } else {
+        ICMPV4ExtHdr *icmph = (ICMPV4ExtHdr *)l4;
+        icmph->type = toserver ? ICMP_ECHO : ICMP_ECHOREPLY;
+        icmph->code = 0;
+        icmph->checksum = 0;
+        icmph->id = htons(f->sp);
+        icmph->seq = htons((uint16_t)(f->pkt / 2 + 1));
+    }
+    if (plen > 0)
+        SyntheticPayload(stv, l4 + l4len, plen);
+
+    uint32_t len = ETHERNET_HEADER_LEN + IPV4_HEADER_LEN + l4len + plen;
+    SET_PKT_LEN(p, len);
+    p->datalink = LINKTYPE_ETHERNET;
+    /* the checksums of the transport layer are left out */
+    p->flags |= PKT_IGNORE_CHECKSUM;
+    p->ts = stv->ts;
+
+    if (++stv->ts.tv_usec >= 1000000) {
+        stv->ts.tv_usec = 0;
+        stv->ts.tv_sec++;
+    }
+
+    if (++f->pkt == synthetic_g.pkts_per_flow) {
+        SyntheticFlowNew(stv, f);
+        stv->flows_done++;
+    }
+    if (++stv->next == synthetic_g.flows)
+        stv->next = 0;
+
+    stv->pkts++;
+    stv->bytes += len;
+}
+
+/**
+ * \brief Synthetic traffic generating loop.
+ */
+TmEcode ReceiveSyntheticLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    SyntheticThreadVars *stv = (SyntheticThreadVars *)data;
+    Packet *p = NULL;
+
+    stv->slot = ((TmSlot *)slot)->slot_next;
+
+    while (1) {
+        if (suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL)) {
+            SCReturnInt(TM_ECODE_OK);
+        }
+
+        if (synthetic_g.count != 0 && stv->pkts >= synthetic_g.count) {
+            SCLogInfo("synthetic: %"PRIu64" packets generated", stv->pkts);
+            /* last generator to finish stops the engine */
+            if (SC_ATOMIC_SUB(synthetic_g.active, 1) == 0)
+                EngineStop();
+            break;
+        }
+
+        /* Make sure we have at least one packet in the packet pool,
+         * to prevent us from alloc'ing packets at line rate. */
+        PacketPoolWait();
+
+        p = PacketGetFromQueueOrAlloc();
+        if (unlikely(p == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate a packet.");
+            EngineStop();
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        PKT_SET_SRC(p, PKT_SRC_WIRE);
+
+        SyntheticNextPacket(stv, p);
+
+        if (TmThreadsSlotProcessPkt(stv->tv, stv->slot, p) != TM_ECODE_OK) {
+            EngineStop();
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+
+        StatsSyncCountersIfSignalled(tv);
+    }
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Initialize a synthetic traffic generator thread.
+ */
+TmEcode ReceiveSyntheticThreadInit(ThreadVars *tv, void *initdata, void **data)
+{
+    SCEnter();
+    uint32_t i;
+
+    SyntheticThreadVars *stv = SCMalloc(sizeof(SyntheticThreadVars));
+    if (unlikely(stv == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate memory for synthetic thread vars.");
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    memset(stv, 0, sizeof(*stv));
+
+    stv->flows = SCCalloc(synthetic_g.flows, sizeof(SyntheticFlow));
+    if (unlikely(stv->flows == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate memory for %u "
+                "synthetic flows.", synthetic_g.flows);
+        SCFree(stv);
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    /* threads are initialized one by one, so each gets the same offset
+     * to the seed on every run */
+    uint16_t id = SC_ATOMIC_ADD(synthetic_g.started, 1);
+    SyntheticSeed(&stv->rng, synthetic_g.seed + id);
+
+    for (i = 0; i < synthetic_g.flows; i++)
+        SyntheticFlowNew(stv, &stv->flows[i]);
+
+    stv->ts = synthetic_g.start;
+    stv->tv = tv;
+    *data = (void *)stv;
+
+    SCLogInfo("Generating synthetic traffic, %u flows", synthetic_g.flows);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+TmEcode ReceiveSyntheticThreadDeinit(ThreadVars *tv, void *data)
+{
+    SyntheticThreadVars *stv = (SyntheticThreadVars *)data;
+
+    if (stv != NULL) {
+        SCFree(stv->flows);
+        SCFree(stv);
+    }
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Initialize the synthetic traffic decoder thread.
+ */
+TmEcode DecodeSyntheticThreadInit(ThreadVars *tv, void *initdata, void **data)
+{
+    SCEnter();
+    DecodeThreadVars *dtv = NULL;
+    dtv = DecodeThreadVarsAlloc(tv);
+
+    if (dtv == NULL)
+        SCReturnInt(TM_ECODE_FAILED);
+
+    DecodeRegisterPerfCounters(dtv, tv);
+
+    *data = (void *)dtv;
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+TmEcode DecodeSyntheticThreadDeinit(ThreadVars *tv, void *data)
+{
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Decode a synthetic packet.
+ *
+ * This function ups the decoder counters and then passes the packet
+ * off to the ethernet decoder.
+ */
+TmEcode DecodeSynthetic(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    SCEnter();
+    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+
+    /* XXX HACK: flow timeout can call us for injected pseudo packets
+     *           see bug: https://redmine.openinfosecfoundation.org/issues/1107 */
+    if (p->flags & PKT_PSEUDO_STREAM_END)
+        return TM_ECODE_OK;
+
+    DecodeUpdatePacketCounters(tv, dtv, p);
+
+    DecodeEthernet(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+
+    PacketDecodeFinalize(tv, dtv, p);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Print some stats to the log at program exit.
+ *
+ * \param tv Pointer to ThreadVars.
+ * \param data Pointer to data, SyntheticThreadVars.
+ */
+void ReceiveSyntheticThreadExitStats(ThreadVars *tv, void *data)
+{
+    SyntheticThreadVars *stv = (SyntheticThreadVars *)data;
+
+    SCLogInfo("Packets: %"PRIu64"; Bytes: %"PRIu64"; Flows: %"PRIu64,
+            stv->pkts, stv->bytes, stv->flows_done);
+}
+
+#ifdef UNITTESTS
+/** \test a tcp session: handshake, data both ways, reset */
+static int SyntheticTest01(void)
+{
+    ThreadVars tv, gtv;
+    DecodeThreadVars dtv;
+    void *data = NULL;
+
+    memset(&tv, 0, sizeof(tv));
+    memset(&gtv, 0, sizeof(gtv));
+    memset(&dtv, 0, sizeof(dtv));
+
+    SyntheticGlobalInit();
+    synthetic_g.flows = 1;
+    synthetic_g.pkts_per_flow = 6;
+    synthetic_g.mix_udp = synthetic_g.mix_icmp = 0;
+
+    FAIL_IF(ReceiveSyntheticThreadInit(&gtv, NULL, &data) != TM_ECODE_OK);
+    SyntheticThreadVars *stv = (SyntheticThreadVars *)data;
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+
+    static const uint8_t flags[] = { TH_SYN, TH_SYN|TH_ACK, TH_ACK,
+        TH_PUSH|TH_ACK, TH_PUSH|TH_ACK, TH_RST|TH_ACK, TH_SYN };
+    uint32_t seq[2] = { 0, 0 };
+    uint16_t client_port = 0;
+    int i;
+    for (i = 0; i < (int)SYNTHETIC_NELEM(flags); i++) {
+        SyntheticNextPacket(stv, p);
+        DecodeEthernet(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), NULL);
+        FAIL_IF_NOT(PKT_IS_TCP(p));
+        FAIL_IF(p->events.cnt != 0);
+        FAIL_IF(p->tcph->th_flags != flags[i]);
+
+        if (i == 0)
+            client_port = p->sp;
+        if (i == 1 || i == 4) {
+            FAIL_IF(p->dp != client_port);
+        } else if (i < 6) {
+            FAIL_IF(p->sp != client_port);
+        }
+        FAIL_IF((i == 3 || i == 4) && p->payload_len == 0);
+        FAIL_IF((i < 3 || i > 4) && p->payload_len != 0);
+
+        /* the seq follows on from the previous packet in that direction */
+        int dir = (i == 1 || i == 4);
+        if (i > 1 && i < 6) {
+            FAIL_IF(TCP_GET_SEQ(p) != seq[dir]);
+            FAIL_IF(TCP_GET_ACK(p) != seq[!dir]);
+        }
+        seq[dir] = TCP_GET_SEQ(p) + p->payload_len + ((flags[i] & TH_SYN) ? 1 : 0);
+
+        PACKET_RECYCLE(p);
+    }
+    FAIL_IF(stv->flows_done != 1);
+
+    ReceiveSyntheticThreadDeinit(&gtv, data);
+    PacketFree(p);
+    SCFree(synthetic_g.corpus);
+    PASS;
+}
+
+/** \test the same seed generates the same traffic */
+static int SyntheticTest02(void)
+{
+    ThreadVars gtv;
+    void *data[2] = { NULL, NULL };
+    uint8_t buf[2][64];
+    int i, t;
+
+    memset(&gtv, 0, sizeof(gtv));
+
+    SyntheticGlobalInit();
+    synthetic_g.flows = 8;
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+
+    for (t = 0; t < 2; t++) {
+        SC_ATOMIC_SET(synthetic_g.started, 0);
+        FAIL_IF(ReceiveSyntheticThreadInit(&gtv, NULL, &data[t]) != TM_ECODE_OK);
+    }
+
+    for (i = 0; i < 1000; i++) {
+        for (t = 0; t < 2; t++) {
+            SyntheticNextPacket((SyntheticThreadVars *)data[t], p);
+            memset(buf[t], 0, sizeof(buf[t]));
+            memcpy(buf[t], GET_PKT_DATA(p), MIN(GET_PKT_LEN(p), sizeof(buf[t])));
+            PACKET_RECYCLE(p);
+        }
+        FAIL_IF(memcmp(buf[0], buf[1], sizeof(buf[0])) != 0);
+    }
+
+    for (t = 0; t < 2; t++)
+        ReceiveSyntheticThreadDeinit(&gtv, data[t]);
+    PacketFree(p);
+    SCFree(synthetic_g.corpus);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+static void SyntheticRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SyntheticTest01", SyntheticTest01);
+    UtRegisterTest("SyntheticTest02", SyntheticTest02);
+#endif
+}
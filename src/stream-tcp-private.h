@@ -27,6 +27,7 @@
 #include "decode.h"
 #include "util-pool.h"
 #include "util-pool-thread.h"
+#include "util-streaming-buffer.h"
 
 #define STREAMTCP_QUEUE_FLAG_TS     0x01
 #define STREAMTCP_QUEUE_FLAG_WS     0x02
@@ -47,9 +48,11 @@ typedef struct TcpStateQueue_ {
 typedef struct StreamTcpSackRecord_ {
     uint32_t le;    /**< left edge, host order */
     uint32_t re;    /**< right edge, host order */
-    struct StreamTcpSackRecord_ *next;
 } StreamTcpSackRecord;
 
+/** SACK records kept in the stream itself, more go on the heap */
+#define STREAMTCP_SACK_INLINE   4
+
 typedef struct TcpSegment_ {
     uint8_t *payload;
     uint16_t payload_len;       /**< actual size of the payload */
@@ -57,6 +60,10 @@ typedef struct TcpSegment_ {
     uint32_t seq;
     struct TcpSegment_ *next;
     struct TcpSegment_ *prev;
+    /** location of the data in TcpStream::sb if the segment has the
+     *  SEGMENTTCP_FLAG_SB_DATA flag set. In that case 'payload' points
+     *  into the streaming buffer. */
+    StreamingBufferSegment sbseg;
     /* coccinelle: TcpSegment:flags:SEGMENTTCP_FLAG */
     uint8_t flags;
 } TcpSegment;
@@ -85,8 +92,28 @@ typedef struct TcpStream_ {
     TcpSegment *seg_list;           /**< list of TCP segments that are not yet (fully) used in reassembly */
     TcpSegment *seg_list_tail;      /**< Last segment in the reassembled stream seg list*/
 
-    StreamTcpSackRecord *sack_head; /**< head of list of SACK records */
-    StreamTcpSackRecord *sack_tail; /**< tail of list of SACK records */
+    TcpSegment **seg_idx;           /**< seg_list sorted by seq, to find the insert
+                                         point of out of order segments in long
+                                         lists. Only valid if
+                                         STREAMTCP_STREAM_FLAG_SEG_IDX is set */
+    uint32_t seg_idx_size;          /**< number of slots in seg_idx */
+    uint32_t seg_idx_start;         /**< first used slot in seg_idx */
+    uint32_t seg_idx_cnt;           /**< number of used slots in seg_idx */
+
+    StreamingBuffer *sb;            /**< contiguous segment data storage, only
+                                         used in streaming buffer mode */
+    uint32_t sb_seq;                /**< seq of the first byte in 'sb' */
+    uint32_t sb_views;              /**< number of stream msgs referencing
+                                         data in 'sb'. The buffer can't be
+                                         moved while this is non-zero */
+
+    /* SACK ranges, sorted and merged. In sack_inline, or in sack_heap
+     * if there are more than STREAMTCP_SACK_INLINE */
+    StreamTcpSackRecord *sack_heap; /**< SACK records on the heap or NULL */
+    uint32_t sack_heap_size;        /**< number of slots in sack_heap */
+    uint32_t sack_cnt;              /**< number of SACK records */
+    uint32_t sack_size;             /**< bytes covered by the SACK records */
+    StreamTcpSackRecord sack_inline[STREAMTCP_SACK_INLINE];
 } TcpStream;
 
 /* from /usr/include/netinet/tcp.h */
@@ -169,7 +196,9 @@ enum
 #define STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_SKIPPED 0x0100
 /** Raw reassembly disabled for new segments */
 #define STREAMTCP_STREAM_FLAG_NEW_RAW_DISABLED 0x0200
-// vacancy 2x
+/** seg_idx is in sync with seg_list */
+#define STREAMTCP_STREAM_FLAG_SEG_IDX           0x0400
+// vacancy 1x
 /** NOTE: flags field is 12 bits */
 
 
@@ -184,6 +213,8 @@ enum
 #define SEGMENTTCP_FLAG_APPLAYER_PROCESSED  0x02
 /** Log API (streaming) has processed this segment */
 #define SEGMENTTCP_FLAG_LOGAPI_PROCESSED    0x04
+/** Segment data is stored in the stream's streaming buffer */
+#define SEGMENTTCP_FLAG_SB_DATA             0x08
 
 
 #define PAWS_24DAYS         2073600         /**< 24 days in seconds */
@@ -222,6 +253,9 @@ typedef struct TcpSession_ {
     uint8_t tcp_packet_flags;
     /* coccinelle: TcpSession:flags:STREAMTCP_FLAG */
     uint16_t flags;
+    uint32_t reassembly_depth;              /**< reassembly depth for the session,
+                                                 0 for unlimited. See
+                                                 StreamTcpSetSessionReassemblyDepth */
     TcpStream server;
     TcpStream client;
     struct StreamMsg_ *toserver_smsg_head;  /**< list of stream msgs (for detection inspection) */
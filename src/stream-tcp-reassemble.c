@@ -62,15 +62,10 @@
 #include "detect-engine-state.h"
 
 #include "util-profiling.h"
+#include "util-memuse.h"
 
 #define PSEUDO_PACKET_PAYLOAD_SIZE  65416 /* 64 Kb minus max IP and TCP header */
 
-#ifdef DEBUG
-static SCMutex segment_pool_memuse_mutex;
-static uint64_t segment_pool_memuse = 0;
-static uint64_t segment_pool_memcnt = 0;
-#endif
-
 /* We define several pools with prealloced segments with fixed size
  * payloads. We do this to prevent having to do an SCMalloc call for every
  * data segment we receive, which would be a large performance penalty.
@@ -80,10 +75,6 @@ static int segment_pool_num = 0;
 static Pool **segment_pool = NULL;
 static SCMutex *segment_pool_mutex = NULL;
 static uint16_t *segment_pool_pktsizes = NULL;
-#ifdef DEBUG
-static SCMutex segment_pool_cnt_mutex;
-static uint64_t segment_pool_cnt = 0;
-#endif
 /* index to the right pool for all packet sizes. */
 static uint16_t segment_pool_idx[65536]; /* O(1) lookups of the pool */
 static int check_overlap_different_data = 0;
@@ -91,6 +82,266 @@ static int check_overlap_different_data = 0;
 /* Memory use counter */
 SC_ATOMIC_DECLARE(uint64_t, ra_memuse);
 
+/* Each thread keeps a small cache of segments per segment pool. Getting
+ * and returning segments is done against this cache without locking. Only
+ * when the cache runs empty or overflows a batch of segments is moved
+ * from or to the shared pool, so the pool lock is taken once per batch
+ * instead of once per segment. */
+#define SEGMENT_CACHE_BATCH     16
+#define SEGMENT_CACHE_MAX       (SEGMENT_CACHE_BATCH * 4)
+
+typedef struct TcpSegmentCacheStack_ {
+    TcpSegment *head;
+    uint32_t len;
+} TcpSegmentCacheStack;
+
+typedef struct TcpSegmentThreadCache_ {
+    /** array of segment_pool_num stacks, one per pool */
+    TcpSegmentCacheStack *stacks;
+#ifdef DEBUG
+    /* per thread stats, summed when the pools are freed */
+    int64_t cnt;
+    int64_t memuse;
+    int64_t memcnt;
+#endif
+    struct TcpSegmentThreadCache_ *next;
+} TcpSegmentThreadCache;
+
+/* thread local reference to the thread's cache. The generation tells us
+ * if the cache still exists: it's bumped each time the pools are freed,
+ * so that thread caches of a previous setup are not reused (unittests). */
+typedef struct TcpSegmentThreadCacheRef_ {
+    TcpSegmentThreadCache *cache;
+    uint32_t generation;
+} TcpSegmentThreadCacheRef;
+
+/* list of all thread caches, to be able to flush them at shutdown. Only
+ * touched when a thread sets up its cache and when the pools are freed. */
+static SCMutex segment_cache_list_mutex = SCMUTEX_INITIALIZER;
+static TcpSegmentThreadCache *segment_cache_list = NULL;
+static uint32_t segment_cache_generation = 1;
+
+#ifdef TLS
+static __thread TcpSegmentThreadCacheRef segment_thread_cache;
+
+static inline TcpSegmentThreadCacheRef *SegmentThreadCacheGetRef(void)
+{
+    return &segment_thread_cache;
+}
+#else
+/* __thread not supported. */
+static pthread_key_t segment_cache_thread_key;
+static int segment_cache_thread_key_initialized = 0;
+
+static void SegmentThreadCacheRefDestroy(void *ref)
+{
+    SCFree(ref);
+}
+
+static void SegmentThreadCacheKeyInit(void)
+{
+    SCMutexLock(&segment_cache_list_mutex);
+    if (segment_cache_thread_key_initialized == 0) {
+        int r = pthread_key_create(&segment_cache_thread_key,
+                SegmentThreadCacheRefDestroy);
+        if (r != 0) {
+            SCLogError(SC_ERR_MEM_ALLOC, "pthread_key_create failed with %d", r);
+            exit(EXIT_FAILURE);
+        }
+        segment_cache_thread_key_initialized = 1;
+    }
+    SCMutexUnlock(&segment_cache_list_mutex);
+}
+
+static inline TcpSegmentThreadCacheRef *SegmentThreadCacheGetRef(void)
+{
+    TcpSegmentThreadCacheRef *ref = pthread_getspecific(segment_cache_thread_key);
+    if (unlikely(ref == NULL)) {
+        ref = SCMalloc(sizeof(TcpSegmentThreadCacheRef));
+        if (unlikely(ref == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        memset(ref, 0x00, sizeof(TcpSegmentThreadCacheRef));
+
+        int r = pthread_setspecific(segment_cache_thread_key, ref);
+        if (r != 0) {
+            SCLogError(SC_ERR_MEM_ALLOC, "pthread_setspecific failed with %d", r);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return ref;
+}
+#endif
+
+/** \brief get the calling thread's segment cache, setting it up if needed
+ *
+ *  The cache memory is owned by segment_cache_list, so it outlives the
+ *  thread. StreamTcpReassembleFree() returns its segments and frees it.
+ */
+static TcpSegmentThreadCache *SegmentThreadCacheGet(void)
+{
+    TcpSegmentThreadCacheRef *ref = SegmentThreadCacheGetRef();
+    if (likely(ref->cache != NULL && ref->generation == segment_cache_generation))
+        return ref->cache;
+
+    TcpSegmentThreadCache *cache = SCMalloc(sizeof(TcpSegmentThreadCache));
+    if (unlikely(cache == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    memset(cache, 0x00, sizeof(TcpSegmentThreadCache));
+
+    SCMutexLock(&segment_cache_list_mutex);
+    cache->next = segment_cache_list;
+    segment_cache_list = cache;
+    ref->generation = segment_cache_generation;
+    SCMutexUnlock(&segment_cache_list_mutex);
+
+    ref->cache = cache;
+    return cache;
+}
+
+/** \brief get the cache stack for pool 'idx', or NULL if the pools are
+ *         not (yet) set up */
+static inline TcpSegmentCacheStack *SegmentThreadCacheGetStack(uint16_t idx)
+{
+    TcpSegmentThreadCache *cache = SegmentThreadCacheGet();
+    if (unlikely(cache->stacks == NULL)) {
+        if (segment_pool_num == 0)
+            return NULL;
+
+        cache->stacks = SCMalloc(segment_pool_num * sizeof(TcpSegmentCacheStack));
+        if (unlikely(cache->stacks == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        memset(cache->stacks, 0x00, segment_pool_num * sizeof(TcpSegmentCacheStack));
+    }
+    return &cache->stacks[idx];
+}
+
+/** \brief move up to 'cnt' segments from the cache stack to shared pool
+ *         'idx' under a single lock */
+static void SegmentThreadCacheSpill(TcpSegmentCacheStack *stack, uint16_t idx,
+        uint32_t cnt)
+{
+    SCMutexLockCounted(&segment_pool_mutex[idx], LOCK_CONTENTION_SEGMENT_POOL);
+    while (cnt > 0 && stack->head != NULL) {
+        TcpSegment *seg = stack->head;
+        stack->head = seg->next;
+        stack->len--;
+        cnt--;
+
+        seg->next = NULL;
+        PoolReturn(segment_pool[idx], (void *) seg);
+    }
+    SCLogDebug("segment_pool[%"PRIu16"]->empty_stack_size %"PRIu32"",
+               idx,segment_pool[idx]->empty_stack_size);
+    SCMutexUnlock(&segment_pool_mutex[idx]);
+}
+
+/** \brief refill the cache stack with a batch of segments from shared
+ *         pool 'idx' under a single lock
+ *
+ *  \retval cnt number of segments added to the stack
+ */
+static uint32_t SegmentThreadCacheRefill(TcpSegmentCacheStack *stack, uint16_t idx)
+{
+    uint32_t cnt = 0;
+
+    SCMutexLockCounted(&segment_pool_mutex[idx], LOCK_CONTENTION_SEGMENT_POOL);
+    while (cnt < SEGMENT_CACHE_BATCH) {
+        TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool[idx]);
+        if (seg == NULL)
+            break;
+
+        seg->next = stack->head;
+        stack->head = seg;
+        stack->len++;
+        cnt++;
+    }
+    SCLogDebug("segment_pool[%u]->empty_stack_size %u, segment_pool[%u]->alloc_"
+               "list_size %u, alloc %u", idx, segment_pool[idx]->empty_stack_size,
+               idx, segment_pool[idx]->alloc_stack_size,
+               segment_pool[idx]->allocated);
+    SCMutexUnlock(&segment_pool_mutex[idx]);
+    return cnt;
+}
+
+/** \brief return all segments in the calling thread's cache to the
+ *         shared pools
+ *
+ *  Called on thread exit so that the segments are available to the
+ *  remaining threads.
+ */
+static void SegmentThreadCacheFlush(void)
+{
+    TcpSegmentThreadCacheRef *ref = SegmentThreadCacheGetRef();
+    if (ref->cache == NULL || ref->generation != segment_cache_generation)
+        return;
+
+    TcpSegmentThreadCache *cache = ref->cache;
+    if (cache->stacks == NULL)
+        return;
+
+    uint16_t idx;
+    for (idx = 0; idx < segment_pool_num; idx++) {
+        TcpSegmentCacheStack *stack = &cache->stacks[idx];
+        if (stack->len > 0)
+            SegmentThreadCacheSpill(stack, idx, stack->len);
+    }
+}
+
+/** \brief return the segments of all thread caches to the pools and free
+ *         the caches. Only to be called when the pools are freed, with all
+ *         the threads that use segments stopped. */
+static void SegmentThreadCachesDestroy(void)
+{
+    SCMutexLock(&segment_cache_list_mutex);
+    TcpSegmentThreadCache *cache = segment_cache_list;
+    segment_cache_list = NULL;
+    segment_cache_generation++;
+    SCMutexUnlock(&segment_cache_list_mutex);
+
+    while (cache != NULL) {
+        TcpSegmentThreadCache *next = cache->next;
+        if (cache->stacks != NULL) {
+            uint16_t idx;
+            for (idx = 0; idx < segment_pool_num; idx++) {
+                TcpSegmentCacheStack *stack = &cache->stacks[idx];
+                if (stack->len > 0)
+                    SegmentThreadCacheSpill(stack, idx, stack->len);
+            }
+            SCFree(cache->stacks);
+        }
+#ifdef DEBUG
+        SCLogDebug("thread cache %p: segment_pool_cnt %"PRIi64", "
+                "segment_pool_memuse %"PRIi64", segment_pool_memcnt %"PRIi64,
+                cache, cache->cnt, cache->memuse, cache->memcnt);
+#endif
+        SCFree(cache);
+        cache = next;
+    }
+}
+
+#ifdef DEBUG
+/** \brief sum the per thread DEBUG counters */
+static void SegmentThreadCachesStats(int64_t *cnt, int64_t *memuse, int64_t *memcnt)
+{
+    *cnt = *memuse = *memcnt = 0;
+
+    SCMutexLock(&segment_cache_list_mutex);
+    TcpSegmentThreadCache *cache = segment_cache_list;
+    for ( ; cache != NULL; cache = cache->next) {
+        *cnt += cache->cnt;
+        *memuse += cache->memuse;
+        *memcnt += cache->memcnt;
+    }
+    SCMutexUnlock(&segment_cache_list_mutex);
+}
+#endif
+
 /* prototypes */
 static int HandleSegmentStartsBeforeListSegment(ThreadVars *, TcpReassemblyThreadCtx *,
                                     TcpStream *, TcpSegment *, TcpSegment *, Packet *);
@@ -120,6 +371,7 @@ void StreamTcpReassembleConfigEnableOverlapCheck(void)
 void StreamTcpReassembleIncrMemuse(uint64_t size)
 {
     (void) SC_ATOMIC_ADD(ra_memuse, size);
+    MemuseAlloc(MEMUSE_REASSEMBLY, size);
     return;
 }
 
@@ -132,6 +384,7 @@ void StreamTcpReassembleIncrMemuse(uint64_t size)
 void StreamTcpReassembleDecrMemuse(uint64_t size)
 {
     (void) SC_ATOMIC_SUB(ra_memuse, size);
+    MemuseFree(MEMUSE_REASSEMBLY, size);
     return;
 }
 
@@ -157,6 +410,64 @@ int StreamTcpReassembleCheckMemcap(uint32_t size)
     return 0;
 }
 
+static void *StreamTcpReassembleSBMalloc(size_t size)
+{
+    if (StreamTcpReassembleCheckMemcap((uint32_t)size) == 0)
+        return NULL;
+
+    void *ptr = SCMalloc(size);
+    if (unlikely(ptr == NULL))
+        return NULL;
+
+    StreamTcpReassembleIncrMemuse((uint64_t)size);
+    return ptr;
+}
+
+static void *StreamTcpReassembleSBCalloc(size_t n, size_t size)
+{
+    if (StreamTcpReassembleCheckMemcap((uint32_t)(n * size)) == 0)
+        return NULL;
+
+    void *ptr = SCCalloc(n, size);
+    if (unlikely(ptr == NULL))
+        return NULL;
+
+    StreamTcpReassembleIncrMemuse((uint64_t)(n * size));
+    return ptr;
+}
+
+static void *StreamTcpReassembleSBRealloc(void *optr, size_t orig_size, size_t size)
+{
+    if (size > orig_size) {
+        if (StreamTcpReassembleCheckMemcap((uint32_t)(size - orig_size)) == 0)
+            return NULL;
+    }
+
+    void *nptr = SCRealloc(optr, size);
+    if (unlikely(nptr == NULL))
+        return NULL;
+
+    if (size > orig_size)
+        StreamTcpReassembleIncrMemuse((uint64_t)(size - orig_size));
+    else
+        StreamTcpReassembleDecrMemuse((uint64_t)(orig_size - size));
+    return nptr;
+}
+
+static void StreamTcpReassembleSBFree(void *ptr, size_t size)
+{
+    SCFree(ptr);
+    StreamTcpReassembleDecrMemuse((uint64_t)size);
+}
+
+/** config for the per stream segment data buffers. The buffer grows in
+ *  steps of buf_size. It's never auto slid: sliding is done explicitly
+ *  as the segments pointing into it need updating. */
+static const StreamingBufferConfig stream_sbcfg = {
+    STREAMING_BUFFER_NOFLAGS, 0, 4096,
+    StreamTcpReassembleSBMalloc, StreamTcpReassembleSBCalloc,
+    StreamTcpReassembleSBRealloc, StreamTcpReassembleSBFree };
+
 /** \brief alloc a tcp segment pool entry */
 void *TcpSegmentPoolAlloc()
 {
@@ -188,17 +499,20 @@ int TcpSegmentPoolInit(void *data, void *payload_len)
     seg->pool_size = size;
     seg->payload_len = seg->pool_size;
 
-    seg->payload = SCMalloc(seg->payload_len);
-    if (seg->payload == NULL) {
-        return 0;
+    /* segments of the size 0 pool store their data in the stream's
+     * streaming buffer */
+    if (size > 0) {
+        seg->payload = SCMalloc(seg->payload_len);
+        if (seg->payload == NULL) {
+            return 0;
+        }
     }
 
 #ifdef DEBUG
-    SCMutexLock(&segment_pool_memuse_mutex);
-    segment_pool_memuse += seg->payload_len;
-    segment_pool_memcnt++;
-    SCLogDebug("segment_pool_memcnt %"PRIu64"", segment_pool_memcnt);
-    SCMutexUnlock(&segment_pool_memuse_mutex);
+    TcpSegmentThreadCache *cache = SegmentThreadCacheGet();
+    cache->memuse += seg->payload_len;
+    cache->memcnt++;
+    SCLogDebug("thread segment_pool_memcnt %"PRIi64"", cache->memcnt);
 #endif
 
     StreamTcpReassembleIncrMemuse((uint32_t)seg->pool_size + sizeof(TcpSegment));
@@ -216,20 +530,23 @@ void TcpSegmentPoolCleanup(void *ptr)
     StreamTcpReassembleDecrMemuse((uint32_t)seg->pool_size + sizeof(TcpSegment));
 
 #ifdef DEBUG
-    SCMutexLock(&segment_pool_memuse_mutex);
-    segment_pool_memuse -= seg->pool_size;
-    segment_pool_memcnt--;
-    SCLogDebug("segment_pool_memcnt %"PRIu64"", segment_pool_memcnt);
-    SCMutexUnlock(&segment_pool_memuse_mutex);
+    TcpSegmentThreadCache *cache = SegmentThreadCacheGet();
+    cache->memuse -= seg->pool_size;
+    cache->memcnt--;
+    SCLogDebug("thread segment_pool_memcnt %"PRIi64"", cache->memcnt);
 #endif
 
-    SCFree(seg->payload);
+    if (seg->pool_size > 0)
+        SCFree(seg->payload);
     return;
 }
 
 /**
  *  \brief Function to return the segment back to the pool.
  *
+ *  The segment is put in the thread's segment cache. If the cache is
+ *  full, a batch of segments is returned to the shared pool.
+ *
  *  \param seg Segment which will be returned back to the pool.
  */
 void StreamTcpSegmentReturntoPool(TcpSegment *seg)
@@ -237,23 +554,193 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
     if (seg == NULL)
         return;
 
-    seg->next = NULL;
     seg->prev = NULL;
+    if (seg->flags & SEGMENTTCP_FLAG_SB_DATA) {
+        seg->flags &= ~SEGMENTTCP_FLAG_SB_DATA;
+        seg->payload = NULL;
+    }
 
     uint16_t idx = segment_pool_idx[seg->pool_size];
-    SCMutexLock(&segment_pool_mutex[idx]);
-    PoolReturn(segment_pool[idx], (void *) seg);
-    SCLogDebug("segment_pool[%"PRIu16"]->empty_stack_size %"PRIu32"",
-               idx,segment_pool[idx]->empty_stack_size);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+    TcpSegmentCacheStack *stack = SegmentThreadCacheGetStack(idx);
+    BUG_ON(stack == NULL);
+
+    seg->next = stack->head;
+    stack->head = seg;
+    stack->len++;
+
+    if (stack->len > SEGMENT_CACHE_MAX) {
+        SegmentThreadCacheSpill(stack, idx, SEGMENT_CACHE_BATCH);
+    }
 
 #ifdef DEBUG
-    SCMutexLock(&segment_pool_cnt_mutex);
-    segment_pool_cnt--;
-    SCMutexUnlock(&segment_pool_cnt_mutex);
+    SegmentThreadCacheGet()->cnt--;
 #endif
 }
 
+/** out of order segments that had to walk more than this number of
+ *  segments to find their place in the list trigger building a segment
+ *  index for the stream */
+#define SEGMENT_INDEX_MIN_WALK  32
+
+/** \internal
+ *  \brief free the segment index of a stream */
+static void StreamTcpSegmentIndexFree(TcpStream *stream)
+{
+    if (stream->seg_idx != NULL) {
+        SCFree(stream->seg_idx);
+        StreamTcpReassembleDecrMemuse((uint64_t)stream->seg_idx_size * sizeof(TcpSegment *));
+        stream->seg_idx = NULL;
+    }
+    stream->seg_idx_size = 0;
+    stream->seg_idx_start = 0;
+    stream->seg_idx_cnt = 0;
+    stream->flags &= ~STREAMTCP_STREAM_FLAG_SEG_IDX;
+}
+
+/** \internal
+ *  \brief mark the segment index of a stream as out of sync with the
+ *         segment list. Used when the list is changed in ways the index
+ *         doesn't track, like the overlap handling. */
+static inline void StreamTcpSegmentIndexInvalidate(TcpStream *stream)
+{
+    stream->flags &= ~STREAMTCP_STREAM_FLAG_SEG_IDX;
+}
+
+/** \internal
+ *  \brief make sure the index has room for 'cnt' used slots after
+ *         seg_idx_start
+ *
+ *  \retval 0 ok
+ *  \retval -1 out of memory or memcap reached
+ */
+static int StreamTcpSegmentIndexReserve(TcpStream *stream, uint32_t cnt)
+{
+    if (stream->seg_idx_start + cnt <= stream->seg_idx_size)
+        return 0;
+
+    /* reclaim the slots of segments removed from the head of the list */
+    if (cnt <= stream->seg_idx_size &&
+            stream->seg_idx_start >= stream->seg_idx_size / 2)
+    {
+        memmove(stream->seg_idx, stream->seg_idx + stream->seg_idx_start,
+                stream->seg_idx_cnt * sizeof(TcpSegment *));
+        stream->seg_idx_start = 0;
+        return 0;
+    }
+
+    uint32_t size = stream->seg_idx_size ? stream->seg_idx_size : SEGMENT_INDEX_MIN_WALK * 2;
+    while (size < stream->seg_idx_start + cnt)
+        size *= 2;
+
+    uint32_t grow = (size - stream->seg_idx_size) * sizeof(TcpSegment *);
+    if (StreamTcpReassembleCheckMemcap(grow) == 0)
+        return -1;
+
+    TcpSegment **ptr = SCRealloc(stream->seg_idx, size * sizeof(TcpSegment *));
+    if (ptr == NULL)
+        return -1;
+    StreamTcpReassembleIncrMemuse((uint64_t)grow);
+
+    stream->seg_idx = ptr;
+    stream->seg_idx_size = size;
+    return 0;
+}
+
+/** \internal
+ *  \brief (re)build the segment index from the segment list */
+static void StreamTcpSegmentIndexBuild(TcpStream *stream)
+{
+    uint32_t cnt = 0;
+    TcpSegment *seg = stream->seg_list;
+    for ( ; seg != NULL; seg = seg->next)
+        cnt++;
+
+    stream->seg_idx_start = 0;
+    stream->seg_idx_cnt = 0;
+    /* leave some room to add segments */
+    if (StreamTcpSegmentIndexReserve(stream, cnt + cnt / 2) != 0) {
+        StreamTcpSegmentIndexFree(stream);
+        return;
+    }
+
+    for (seg = stream->seg_list; seg != NULL; seg = seg->next) {
+        stream->seg_idx[stream->seg_idx_cnt++] = seg;
+    }
+    stream->flags |= STREAMTCP_STREAM_FLAG_SEG_IDX;
+    SCLogDebug("stream %p: segment index built for %u segments", stream, cnt);
+}
+
+/** \internal
+ *  \brief find the first segment in the index that ends after 'seq'
+ *
+ *  \retval pos position relative to seg_idx_start, seg_idx_cnt if no
+ *              segment ends after 'seq'
+ */
+static uint32_t StreamTcpSegmentIndexSearch(const TcpStream *stream, uint32_t seq)
+{
+    TcpSegment **segs = stream->seg_idx + stream->seg_idx_start;
+    uint32_t lo = 0;
+    uint32_t hi = stream->seg_idx_cnt;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (SEQ_GT(segs[mid]->seq + segs[mid]->payload_len, seq)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/** \internal
+ *  \brief add a segment to the index at position 'pos' */
+static void StreamTcpSegmentIndexInsert(TcpStream *stream, uint32_t pos, TcpSegment *seg)
+{
+    if (!(stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX))
+        return;
+
+    if (StreamTcpSegmentIndexReserve(stream, stream->seg_idx_cnt + 1) != 0) {
+        StreamTcpSegmentIndexFree(stream);
+        return;
+    }
+
+    TcpSegment **segs = stream->seg_idx + stream->seg_idx_start;
+    if (pos < stream->seg_idx_cnt) {
+        memmove(segs + pos + 1, segs + pos,
+                (stream->seg_idx_cnt - pos) * sizeof(TcpSegment *));
+    }
+    segs[pos] = seg;
+    stream->seg_idx_cnt++;
+}
+
+/** \internal
+ *  \brief remove a segment from the index */
+static void StreamTcpSegmentIndexRemove(TcpStream *stream, TcpSegment *seg)
+{
+    if (!(stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX))
+        return;
+
+    TcpSegment **segs = stream->seg_idx + stream->seg_idx_start;
+    /* common case: segments are removed from the head of the list */
+    if (stream->seg_idx_cnt > 0 && segs[0] == seg) {
+        stream->seg_idx_start++;
+        stream->seg_idx_cnt--;
+        if (stream->seg_idx_cnt == 0)
+            stream->seg_idx_start = 0;
+        return;
+    }
+
+    uint32_t pos = StreamTcpSegmentIndexSearch(stream, seg->seq);
+    if (pos >= stream->seg_idx_cnt || segs[pos] != seg) {
+        StreamTcpSegmentIndexInvalidate(stream);
+        return;
+    }
+    memmove(segs + pos, segs + pos + 1,
+            (stream->seg_idx_cnt - pos - 1) * sizeof(TcpSegment *));
+    stream->seg_idx_cnt--;
+}
+
 /**
  *  \brief return all segments in this stream into the pool(s)
  *
@@ -264,9 +751,6 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
     TcpSegment *seg = stream->seg_list;
     TcpSegment *next_seg;
 
-    if (seg == NULL)
-        return;
-
     while (seg != NULL) {
         next_seg = seg->next;
         StreamTcpSegmentReturntoPool(seg);
@@ -275,6 +759,12 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
 
     stream->seg_list = NULL;
     stream->seg_list_tail = NULL;
+    StreamTcpSegmentIndexFree(stream);
+
+    if (stream->sb != NULL) {
+        StreamingBufferFree(stream->sb);
+        stream->sb = NULL;
+    }
 }
 
 /** \param f locked flow */
@@ -398,6 +888,22 @@ int StreamTcpReassemblyConfig(char quiet)
         npools = 8;
     }
 
+    /* in streaming buffer mode in order segments carry no payload buffer
+     * of their own: they come from a pool with pktsize 0 */
+    if ((stream_config.flags & STREAMTCP_INIT_FLAG_STREAMING_BUFFER) &&
+            sizes[0].pktsize != 0) {
+        if (npools >= 255) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "too many segment packet "
+                                                "pools defined, max is 255 "
+                                                "in streaming buffer mode");
+            return -1;
+        }
+        memmove(&sizes[1], &sizes[0], npools * sizeof(sizes[0]));
+        sizes[0].pktsize = 0;
+        sizes[0].prealloc = 1024;
+        npools++;
+    }
+
     int i = 0;
     for (i = 0; i < npools; i++) {
         SCLogDebug("pktsize %u, prealloc %u", sizes[i].pktsize, sizes[i].prealloc);
@@ -507,12 +1013,11 @@ int StreamTcpReassembleInit(char quiet)
     /* init the memcap/use tracker */
     SC_ATOMIC_INIT(ra_memuse);
 
+#ifndef TLS
+    SegmentThreadCacheKeyInit();
+#endif
     if (StreamTcpReassemblyConfig(quiet) < 0)
         return -1;
-#ifdef DEBUG
-    SCMutexInit(&segment_pool_memuse_mutex, NULL);
-    SCMutexInit(&segment_pool_cnt_mutex, NULL);
-#endif
 
     StatsRegisterGlobalCounter("tcp.reassembly_memuse",
             StreamTcpReassembleMemuseGlobalCounter);
@@ -526,6 +1031,14 @@ static uint32_t dbg_app_layer_gap_candidate;
 
 void StreamTcpReassembleFree(char quiet)
 {
+#ifdef DEBUG
+    int64_t segment_pool_cnt, segment_pool_memuse, segment_pool_memcnt;
+    SegmentThreadCachesStats(&segment_pool_cnt, &segment_pool_memuse,
+            &segment_pool_memcnt);
+#endif
+    /* return the segments held by the thread caches to their pools */
+    SegmentThreadCachesDestroy();
+
     uint16_t u16 = 0;
     for (u16 = 0; u16 < segment_pool_num; u16++) {
         SCMutexLock(&segment_pool_mutex[u16]);
@@ -555,15 +1068,14 @@ void StreamTcpReassembleFree(char quiet)
     segment_pool = NULL;
     segment_pool_mutex = NULL;
     segment_pool_pktsizes = NULL;
+    segment_pool_num = 0;
 
     StreamMsgQueuesDeinit(quiet);
 
 #ifdef DEBUG
-    SCLogDebug("segment_pool_cnt %"PRIu64"", segment_pool_cnt);
-    SCLogDebug("segment_pool_memuse %"PRIu64"", segment_pool_memuse);
-    SCLogDebug("segment_pool_memcnt %"PRIu64"", segment_pool_memcnt);
-    SCMutexDestroy(&segment_pool_memuse_mutex);
-    SCMutexDestroy(&segment_pool_cnt_mutex);
+    SCLogDebug("segment_pool_cnt %"PRIi64"", segment_pool_cnt);
+    SCLogDebug("segment_pool_memuse %"PRIi64"", segment_pool_memuse);
+    SCLogDebug("segment_pool_memcnt %"PRIi64"", segment_pool_memcnt);
     SCLogPerf("dbg_app_layer_gap %u", dbg_app_layer_gap);
     SCLogPerf("dbg_app_layer_gap_candidate %u", dbg_app_layer_gap_candidate);
 #endif
@@ -586,6 +1098,9 @@ TcpReassemblyThreadCtx *StreamTcpReassembleInitThreadCtx(ThreadVars *tv)
 void StreamTcpReassembleFreeThreadCtx(TcpReassemblyThreadCtx *ra_ctx)
 {
     SCEnter();
+    /* hand our cached segments back to the shared pools */
+    SegmentThreadCacheFlush();
+
     AppLayerDestroyCtxThread(ra_ctx->app_tctx);
 #ifdef DEBUG
     SCLogDebug("reassembly fast path stats: fp1 %"PRIu64" fp2 %"PRIu64" sp %"PRIu64,
@@ -740,6 +1255,9 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
 
     int ret_value = 0;
     char return_seg = FALSE;
+    uint32_t idx_pos = 0;
+    uint32_t walked = 0;
+    const int had_idx = (stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX) != 0;
 
     /* before our ra_app_base_seq we don't insert it in our list,
      * or ra_raw_base_seq if in stream gap state */
@@ -770,6 +1288,7 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
         stream->seg_list = seg;
         seg->prev = NULL;
         stream->seg_list_tail = seg;
+        StreamTcpSegmentIndexInsert(stream, 0, seg);
         goto end;
     }
 
@@ -781,6 +1300,7 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
         stream->seg_list_tail->next = seg;
         seg->prev = stream->seg_list_tail;
         stream->seg_list_tail = seg;
+        StreamTcpSegmentIndexInsert(stream, stream->seg_idx_cnt, seg);
 
         goto end;
     }
@@ -790,7 +1310,16 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
         StreamTcpSetOSPolicy(stream, p);
     }
 
-    for (; list_seg != NULL; list_seg = next_list_seg) {
+    /* skip the segments that end before seg using the index. Walking
+     * over them has no effect. */
+    if (stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX) {
+        idx_pos = StreamTcpSegmentIndexSearch(stream, seg->seq);
+        /* the tail check above guarantees a segment ending after seg->seq */
+        BUG_ON(idx_pos >= stream->seg_idx_cnt);
+        list_seg = stream->seg_idx[stream->seg_idx_start + idx_pos];
+    }
+
+    for (; list_seg != NULL; list_seg = next_list_seg, idx_pos++, walked++) {
         next_list_seg = list_seg->next;
 
         SCLogDebug("seg %p, list_seg %p, list_prev %p list_seg->next %p, "
@@ -816,11 +1345,13 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
                     seg->prev = list_seg->prev;
                 }
                 list_seg->prev = seg;
+                StreamTcpSegmentIndexInsert(stream, idx_pos, seg);
 
                 goto end;
 
             /* seg overlap with next seg(s) */
             } else {
+                StreamTcpSegmentIndexInvalidate(stream);
                 ret_value = HandleSegmentStartsBeforeListSegment(tv, ra_ctx, stream, list_seg, seg, p);
                 if (ret_value == 1) {
                     ret_value = 0;
@@ -836,6 +1367,7 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
 
         /* seg starts at same sequence number as list_seg */
         } else if (SEQ_EQ(seg->seq, list_seg->seq)) {
+            StreamTcpSegmentIndexInvalidate(stream);
             ret_value = HandleSegmentStartsAtSameListSegment(tv, ra_ctx, stream, list_seg, seg, p);
             if (ret_value == 1) {
                 ret_value = 0;
@@ -864,9 +1396,11 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
                     list_seg->next = seg;
                     seg->prev = list_seg;
                     stream->seg_list_tail = seg;
+                    StreamTcpSegmentIndexInsert(stream, idx_pos + 1, seg);
                     goto end;
                 }
             } else {
+                StreamTcpSegmentIndexInvalidate(stream);
                 ret_value = HandleSegmentStartsAfterListSegment(tv, ra_ctx, stream, list_seg, seg, p);
                 if (ret_value == 1) {
                     ret_value = 0;
@@ -887,6 +1421,13 @@ end:
         StreamTcpSegmentReturntoPool(seg);
     }
 
+    /* the list is getting long, index it to speed up future inserts. Also
+     * rebuild the index after the overlap handling invalidated it. */
+    if (!(stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX) &&
+            (had_idx || walked > SEGMENT_INDEX_MIN_WALK)) {
+        StreamTcpSegmentIndexBuild(stream);
+    }
+
 #ifdef DEBUG
     PrintList(stream->seg_list);
 #endif
@@ -1763,20 +2304,21 @@ int StreamTcpReassembleDepthReached(Packet *p)
  *  \brief Function to Check the reassembly depth valuer against the
  *        allowed max depth of the stream reassmbly for TCP streams.
  *
+ *  \param ssn session, for its reassembly depth
  *  \param stream stream direction
  *  \param seq sequence number where "size" starts
  *  \param size size of the segment that is added
  *
  *  \retval size Part of the size that fits in the depth, 0 if none
  */
-static uint32_t StreamTcpReassembleCheckDepth(TcpStream *stream,
+static uint32_t StreamTcpReassembleCheckDepth(TcpSession *ssn, TcpStream *stream,
         uint32_t seq, uint32_t size)
 {
     SCEnter();
 
     /* if the configured depth value is 0, it means there is no limit on
        reassembly depth. Otherwise carry on my boy ;) */
-    if (stream_config.reassembly_depth == 0) {
+    if (ssn->reassembly_depth == 0) {
         SCReturnUInt(size);
     }
 
@@ -1789,24 +2331,24 @@ static uint32_t StreamTcpReassembleCheckDepth(TcpStream *stream,
      * checking and just reject the rest of the packets including
      * retransmissions. Saves us the hassle of dealing with sequence
      * wraps as well */
-    if (SEQ_GEQ((StreamTcpReassembleGetRaBaseSeq(stream)+1),(stream->isn + stream_config.reassembly_depth))) {
+    if (SEQ_GEQ((StreamTcpReassembleGetRaBaseSeq(stream)+1),(stream->isn + ssn->reassembly_depth))) {
         stream->flags |= STREAMTCP_STREAM_FLAG_DEPTH_REACHED;
         SCReturnUInt(0);
     }
 
     SCLogDebug("full Depth not yet reached: %"PRIu32" <= %"PRIu32,
             (StreamTcpReassembleGetRaBaseSeq(stream)+1),
-            (stream->isn + stream_config.reassembly_depth));
+            (stream->isn + ssn->reassembly_depth));
 
-    if (SEQ_GEQ(seq, stream->isn) && SEQ_LT(seq, (stream->isn + stream_config.reassembly_depth))) {
+    if (SEQ_GEQ(seq, stream->isn) && SEQ_LT(seq, (stream->isn + ssn->reassembly_depth))) {
         /* packet (partly?) fits the depth window */
 
-        if (SEQ_LEQ((seq + size),(stream->isn + stream_config.reassembly_depth))) {
+        if (SEQ_LEQ((seq + size),(stream->isn + ssn->reassembly_depth))) {
             /* complete fit */
             SCReturnUInt(size);
         } else {
             /* partial fit, return only what fits */
-            uint32_t part = (stream->isn + stream_config.reassembly_depth) - seq;
+            uint32_t part = (stream->isn + ssn->reassembly_depth) - seq;
 #if DEBUG
             BUG_ON(part > size);
 #else
@@ -1870,6 +2412,128 @@ static void StreamTcpStoreStreamChunk(TcpSession *ssn, StreamMsg *smsg, const Pa
     }
 }
 
+/** max distance in bytes between the start of a stream's streaming
+ *  buffer and the end of a new segment. Segments further out use a
+ *  regular segment payload buffer. */
+#define STREAM_SB_MAX_SPAN  (8 * 1024 * 1024)
+
+/** \internal
+ *  \brief point the payload of all streaming buffer segments of a stream
+ *         to their data, after the buffer was moved (grown or slid) */
+static void StreamTcpSBUpdateSegmentPointers(TcpStream *stream)
+{
+    StreamingBuffer *sb = stream->sb;
+    TcpSegment *seg = stream->seg_list;
+    for ( ; seg != NULL; seg = seg->next) {
+        if (seg->flags & SEGMENTTCP_FLAG_SB_DATA) {
+            seg->payload = sb->buf + (seg->sbseg.stream_offset - sb->stream_offset);
+        }
+    }
+}
+
+/** \internal
+ *  \brief slide the data that is no longer referenced by any segment
+ *         out of the stream's streaming buffer
+ *
+ *  If no segment points into the buffer anymore, the buffer is emptied
+ *  and reset to start at seq 'seq'.
+ */
+static void StreamTcpSBSlide(TcpStream *stream, uint32_t seq)
+{
+    StreamingBuffer *sb = stream->sb;
+
+    TcpSegment *seg = stream->seg_list;
+    for ( ; seg != NULL; seg = seg->next) {
+        if (seg->flags & SEGMENTTCP_FLAG_SB_DATA)
+            break;
+    }
+
+    if (seg == NULL) {
+        StreamingBufferSlide(sb, sb->buf_offset);
+        stream->sb_seq = seq;
+        SCLogDebug("stream %p sb reset to seq %u", stream, seq);
+        return;
+    }
+
+    uint32_t slide = (uint32_t)(seg->sbseg.stream_offset - sb->stream_offset);
+    if (slide == 0)
+        return;
+
+    StreamingBufferSlideToOffset(sb, seg->sbseg.stream_offset);
+    stream->sb_seq += slide;
+    StreamTcpSBUpdateSegmentPointers(stream);
+    SCLogDebug("stream %p sb slid %u bytes, sb_seq now %u", stream, slide,
+            stream->sb_seq);
+}
+
+/** \internal
+ *  \brief get a segment that stores its data in the stream's streaming
+ *         buffer
+ *
+ *  Only used for segments that are appended to the end of the segment
+ *  list, so that their data never overlaps with other segments in the
+ *  buffer. Overlapping segments still use their own payload buffer, so
+ *  the overlap handling applies as usual.
+ *
+ *  \retval seg segment with payload pointing into the buffer
+ *  \retval NULL segment can't use the buffer, use a normal segment
+ */
+static TcpSegment *StreamTcpReassembleGetSegmentSB(ThreadVars *tv,
+        TcpReassemblyThreadCtx *ra_ctx, TcpStream *stream, Packet *p,
+        uint16_t size)
+{
+    const uint32_t seq = TCP_GET_SEQ(p);
+
+    /* only tail appends: no overlap with existing segments */
+    if (stream->seg_list_tail != NULL &&
+            SEQ_LT(seq, stream->seg_list_tail->seq + stream->seg_list_tail->payload_len))
+        return NULL;
+    /* will be rejected by the insert code, don't touch the buffer */
+    if (SEQ_LT(seq + size, StreamTcpReassembleGetRaBaseSeq(stream) + 1))
+        return NULL;
+
+    if (stream->sb == NULL) {
+        stream->sb = StreamingBufferInit(&stream_sbcfg);
+        if (stream->sb == NULL)
+            return NULL;
+        stream->sb_seq = seq;
+    }
+    StreamingBuffer *sb = stream->sb;
+
+    /* make room if the data doesn't fit without growing the buffer */
+    if (SEQ_LT(seq, stream->sb_seq) ||
+            (uint32_t)(seq + size - stream->sb_seq) > sb->buf_size)
+    {
+        /* raw stream msgs are pointing into the buffer, so it can't
+         * be slid or grown until detection is done with them */
+        if (stream->sb_views > 0)
+            return NULL;
+        StreamTcpSBSlide(stream, seq);
+    }
+    if (SEQ_LT(seq, stream->sb_seq) ||
+            (uint32_t)(seq + size - stream->sb_seq) > STREAM_SB_MAX_SPAN)
+        return NULL;
+
+    TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx, 0);
+    if (seg == NULL)
+        return NULL;
+
+    const uint8_t *old_buf = sb->buf;
+    uint64_t offset = sb->stream_offset + (uint32_t)(seq - stream->sb_seq);
+    if (StreamingBufferInsertAt(sb, &seg->sbseg, p->payload, size, offset) != 0) {
+        StreamTcpSegmentReturntoPool(seg);
+        return NULL;
+    }
+    if (sb->buf != old_buf)
+        StreamTcpSBUpdateSegmentPointers(stream);
+
+    seg->flags |= SEGMENTTCP_FLAG_SB_DATA;
+    seg->payload = sb->buf + (seg->sbseg.stream_offset - sb->stream_offset);
+    seg->payload_len = size;
+    seg->seq = seq;
+    return seg;
+}
+
 /**
  *  \brief Insert a packets TCP data into the stream reassembly engine.
  *
@@ -1901,7 +2565,7 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
 
     /* If we have reached the defined depth for either of the stream, then stop
        reassembling the TCP session */
-    uint32_t size = StreamTcpReassembleCheckDepth(stream, TCP_GET_SEQ(p), p->payload_len);
+    uint32_t size = StreamTcpReassembleCheckDepth(ssn, stream, TCP_GET_SEQ(p), p->payload_len);
     SCLogDebug("ssn %p: check depth returned %"PRIu32, ssn, size);
 
     if (stream->flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED) {
@@ -1924,18 +2588,24 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
         size = p->payload_len;
 #endif
 
-    TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx, size);
+    TcpSegment *seg = NULL;
+    if (stream_config.flags & STREAMTCP_INIT_FLAG_STREAMING_BUFFER) {
+        seg = StreamTcpReassembleGetSegmentSB(tv, ra_ctx, stream, p, size);
+    }
     if (seg == NULL) {
-        SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[size]);
+        seg = StreamTcpGetSegment(tv, ra_ctx, size);
+        if (seg == NULL) {
+            SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[size]);
+
+            StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
+            SCReturnInt(-1);
+        }
 
-        StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
-        SCReturnInt(-1);
+        memcpy(seg->payload, p->payload, size);
+        seg->payload_len = size;
+        seg->seq = TCP_GET_SEQ(p);
     }
 
-    memcpy(seg->payload, p->payload, size);
-    seg->payload_len = size;
-    seg->seq = TCP_GET_SEQ(p);
-
     if (ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED)
         seg->flags |= SEGMENTTCP_FLAG_APPLAYER_PROCESSED;
 
@@ -2084,6 +2754,7 @@ static int StreamTcpReassembleRawCheckLimit(TcpSession *ssn, TcpStream *stream,
 #define StreamTcpAppLayerSegmentProcessed(ssn, stream, segment) \
     (( ( (ssn)->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED) || \
        ( (stream)->flags & STREAMTCP_STREAM_FLAG_GAP ) || \
+       ( (stream)->flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY ) || \
        ( (segment)->flags & SEGMENTTCP_FLAG_APPLAYER_PROCESSED ) ? 1 :0 ))
 
 /** \internal
@@ -2129,6 +2800,8 @@ static inline int StreamTcpReturnSegmentCheck(const Flow *f, TcpSession *ssn, Tc
 
 static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg)
 {
+    StreamTcpSegmentIndexRemove(stream, seg);
+
     if (seg->prev == NULL) {
         stream->seg_list = seg->next;
         if (stream->seg_list != NULL)
@@ -2191,8 +2864,22 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
     uint32_t right_edge = TCP_GET_SEQ(p) + p->payload_len;
     uint32_t left_edge = right_edge - chunk_size;
 
+    if (stream_config.reassembly_inline_overlap > 0) {
+        /* incremental: the new data and only 'overlap' bytes of what was
+         * inspected before, so data isn't scanned over and over again by
+         * the overlapping windows. */
+        uint32_t inc_left_edge = (ra_base_seq + 1) -
+            stream_config.reassembly_inline_overlap;
+        if (SEQ_GT(inc_left_edge, left_edge))
+            left_edge = inc_left_edge;
+        if (SEQ_GT(seg->seq, left_edge))
+            left_edge = seg->seq;
+        if (SEQ_LEQ(right_edge, ra_base_seq + 1)) {
+            SCLogDebug("no new data in the window");
+            SCReturnInt(0);
+        }
     /* shift the window to the right if the left edge doesn't cover segments */
-    if (SEQ_GT(seg->seq,left_edge)) {
+    } else if (SEQ_GT(seg->seq,left_edge)) {
         right_edge += (seg->seq - left_edge);
         left_edge = seg->seq;
     }
@@ -2866,6 +3553,70 @@ static inline int DoReassemble(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     return 1;
 }
 
+/** \internal
+ *  \brief pass a run of in order segments that store their data in the
+ *         stream's streaming buffer to the app layer in a single call
+ *
+ *  As the data of these segments is contiguous in the buffer, it can be
+ *  passed to the app layer directly, without first copying it into a
+ *  reassembly chunk.
+ *
+ *  \param seg first segment of the run
+ *  \param last_seg set to the last segment that was processed
+ *
+ *  \retval 1 segments processed, continue with last_seg->next
+ *  \retval 0 segments processed, stop reassembly for now
+ *  \retval -1 not applicable, process seg in the regular way
+ */
+static int DoReassembleStreamingBuffer(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
+                 TcpSession *ssn, TcpStream *stream, TcpSegment *seg, ReassembleData *rd,
+                 Packet *p, TcpSegment **last_seg)
+{
+    if (!(stream->flags & STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_COMPLETED) ||
+            rd->data_len != 0 ||
+            !(SEQ_EQ(seg->seq, rd->ra_base_seq + 1)))
+        return -1;
+
+    const int inline_mode = StreamTcpInlineMode();
+    if (!inline_mode && SEQ_GT(seg->seq + seg->payload_len, stream->last_ack))
+        return -1;
+
+    /* find the end of the run: contiguous, fully ack'd, in the buffer */
+    TcpSegment *last = seg;
+    uint32_t len = seg->payload_len;
+    while (last->next != NULL) {
+        TcpSegment *next = last->next;
+        if (!(next->flags & SEGMENTTCP_FLAG_SB_DATA) ||
+                (next->flags & SEGMENTTCP_FLAG_APPLAYER_PROCESSED) ||
+                !(SEQ_EQ(next->seq, last->seq + last->payload_len)))
+            break;
+        if (!inline_mode && SEQ_GT(next->seq + next->payload_len, stream->last_ack))
+            break;
+        len += next->payload_len;
+        last = next;
+    }
+
+    SCLogDebug("passing %u bytes from the streaming buffer", len);
+    AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
+            seg->payload, len, StreamGetAppLayerFlags(ssn, stream, p));
+    AppLayerProfilingStore(ra_ctx->app_tctx, p);
+    rd->data_sent += len;
+    rd->ra_base_seq += len;
+    rd->partial = FALSE;
+
+    TcpSegment *s = seg;
+    for ( ; s != last->next; s = s->next) {
+        s->flags |= SEGMENTTCP_FLAG_APPLAYER_PROCESSED;
+    }
+    *last_seg = last;
+
+    if (!StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream)) {
+        SCLogDebug("no alproto after first data chunk");
+        return 0;
+    }
+    return 1;
+}
+
 /**
  *  \brief Update the stream reassembly upon receiving an ACK packet.
  *
@@ -3024,6 +3775,20 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
         if (DoHandleGap(tv, ra_ctx, ssn, stream, seg, &rd, p, next_seq) == 1)
             break;
 
+        /* process a run of segments directly from the streaming buffer */
+        if (seg->flags & SEGMENTTCP_FLAG_SB_DATA) {
+            TcpSegment *last_seg = NULL;
+            int r = DoReassembleStreamingBuffer(tv, ra_ctx, ssn, stream, seg,
+                    &rd, p, &last_seg);
+            if (r == 0) {
+                break;
+            } else if (r == 1) {
+                next_seq = last_seg->seq + last_seg->payload_len;
+                seg = last_seg->next;
+                continue;
+            }
+        }
+
         /* process this segment */
         if (DoReassemble(tv, ra_ctx, ssn, stream, seg, &rd, p) == 0)
             break;
@@ -3124,6 +3889,74 @@ static void DoHandleRawGap(TcpSession *ssn, TcpStream *stream, TcpSegment *seg,
     }
 }
 
+/** \internal
+ *  \brief create a single smsg for a run of in order segments that store
+ *         their data in the stream's streaming buffer
+ *
+ *  The smsg is a view into the buffer, so the data is inspected by the
+ *  detection engine in place instead of being copied into smsg chunks.
+ *
+ *  \param seg first segment of the run
+ *  \param last_seg set to the last segment that was processed
+ *
+ *  \retval 1 segments processed, continue with last_seg->next
+ *  \retval -1 not applicable, process seg in the regular way
+ */
+static int DoRawReassembleStreamingBuffer(TcpSession *ssn, TcpStream *stream,
+        TcpSegment *seg, Packet *p, ReassembleRawData *rd, TcpSegment **last_seg)
+{
+    if (!(SEQ_EQ(seg->seq, rd->ra_base_seq + 1)) ||
+            SEQ_GT(seg->seq + seg->payload_len, stream->last_ack))
+        return -1;
+
+    /* find the end of the run: contiguous, fully ack'd, in the buffer */
+    TcpSegment *last = seg;
+    uint32_t len = seg->payload_len;
+    while (last->next != NULL) {
+        TcpSegment *next = last->next;
+        if (!(next->flags & SEGMENTTCP_FLAG_SB_DATA) ||
+                (next->flags & SEGMENTTCP_FLAG_RAW_PROCESSED) ||
+                !(SEQ_EQ(next->seq, last->seq + last->payload_len)) ||
+                SEQ_GT(next->seq + next->payload_len, stream->last_ack))
+            break;
+        len += next->payload_len;
+        last = next;
+    }
+
+    StreamMsg *smsg = StreamMsgGetFromPool();
+    if (smsg == NULL) {
+        SCLogDebug("stream_msg_pool is empty");
+        return -1;
+    }
+
+    /* pass on the pre existing smsg first, so the order is kept */
+    if (rd->smsg != NULL) {
+        if (rd->smsg->data_len > 0) {
+            StreamTcpStoreStreamChunk(ssn, rd->smsg, p, 0);
+        } else {
+            StreamMsgReturnToPool(rd->smsg);
+        }
+        rd->smsg = NULL;
+        rd->smsg_offset = 0;
+    }
+
+    SCLogDebug("smsg view of %u bytes in the streaming buffer", len);
+    StreamMsgSetupView(smsg, stream, seg->payload, len);
+    smsg->seq = rd->ra_base_seq + 1;
+    StreamTcpStoreStreamChunk(ssn, smsg, p, 0);
+
+    rd->ra_base_seq += len;
+    rd->partial = FALSE;
+    stream->ra_raw_base_seq = rd->ra_base_seq;
+
+    TcpSegment *s = seg;
+    for ( ; s != last->next; s = s->next) {
+        s->flags |= SEGMENTTCP_FLAG_RAW_PROCESSED;
+    }
+    *last_seg = last;
+    return 1;
+}
+
 static int DoRawReassemble(TcpSession *ssn, TcpStream *stream, TcpSegment *seg, Packet *p,
     ReassembleRawData *rd)
 {
@@ -3361,6 +4194,17 @@ static int StreamTcpReassembleRaw (TcpReassemblyThreadCtx *ra_ctx,
 
         DoHandleRawGap(ssn, stream, seg, p, &rd, next_seq);
 
+        /* inspect a run of segments directly in the streaming buffer */
+        if (seg->flags & SEGMENTTCP_FLAG_SB_DATA) {
+            TcpSegment *last_seg = NULL;
+            if (DoRawReassembleStreamingBuffer(ssn, stream, seg, p, &rd,
+                        &last_seg) == 1) {
+                next_seq = last_seg->seq + last_seg->payload_len;
+                seg = last_seg->next;
+                continue;
+            }
+        }
+
         if (DoRawReassemble(ssn, stream, seg, p, &rd) == 0)
             break;
 
@@ -3622,14 +4466,18 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     SCLogDebug("segment_pool_idx %" PRIu32 " for payload_len %" PRIu32 "",
                 idx, len);
 
-    SCMutexLock(&segment_pool_mutex[idx]);
-    TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool[idx]);
-
-    SCLogDebug("segment_pool[%u]->empty_stack_size %u, segment_pool[%u]->alloc_"
-               "list_size %u, alloc %u", idx, segment_pool[idx]->empty_stack_size,
-               idx, segment_pool[idx]->alloc_stack_size,
-               segment_pool[idx]->allocated);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+    TcpSegment *seg = NULL;
+    TcpSegmentCacheStack *stack = SegmentThreadCacheGetStack(idx);
+    if (likely(stack != NULL)) {
+        if (stack->head == NULL)
+            (void)SegmentThreadCacheRefill(stack, idx);
+
+        seg = stack->head;
+        if (seg != NULL) {
+            stack->head = seg->next;
+            stack->len--;
+        }
+    }
 
     SCLogDebug("seg we return is %p", seg);
     if (seg == NULL) {
@@ -3646,9 +4494,7 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     }
 
 #ifdef DEBUG
-    SCMutexLock(&segment_pool_cnt_mutex);
-    segment_pool_cnt++;
-    SCMutexUnlock(&segment_pool_cnt_mutex);
+    SegmentThreadCacheGet()->cnt++;
 #endif
 
     return seg;
@@ -7285,6 +8131,7 @@ static int StreamTcpReassembleTest45 (void)
 
     /* set the default value of reassembly depth, as there is no config file */
     stream_config.reassembly_depth = httplen1 + 1;
+    ssn.reassembly_depth = stream_config.reassembly_depth;
 
     TcpStream *s = NULL;
     s = &ssn.server;
@@ -7404,6 +8251,7 @@ static int StreamTcpReassembleTest46 (void)
     ssn.state = TCP_ESTABLISHED;
 
     stream_config.reassembly_depth = 0;
+    ssn.reassembly_depth = stream_config.reassembly_depth;
 
     TcpStream *s = NULL;
     s = &ssn.server;
@@ -8688,6 +9536,447 @@ end:
     return ret;
 }
 
+/** \test segments returned to the pool are cached by the thread, and the
+ *        cache is capped by spilling to the shared pool. */
+static int StreamTcpReassembleSegmentCacheTest01(void)
+{
+    ThreadVars tv;
+    memset(&tv, 0x00, sizeof(tv));
+    TcpSegment *segs[SEGMENT_CACHE_MAX * 2];
+    int i;
+
+    StreamTcpInitConfig(TRUE);
+    TcpReassemblyThreadCtx *ra_ctx = StreamTcpReassembleInitThreadCtx(NULL);
+    FAIL_IF_NULL(ra_ctx);
+
+    uint16_t idx = segment_pool_idx[100];
+    for (i = 0; i < SEGMENT_CACHE_MAX * 2; i++) {
+        segs[i] = StreamTcpGetSegment(&tv, ra_ctx, 100);
+        FAIL_IF_NULL(segs[i]);
+    }
+    TcpSegmentCacheStack *stack = SegmentThreadCacheGetStack(idx);
+    FAIL_IF_NULL(stack);
+    FAIL_IF(stack->len >= SEGMENT_CACHE_BATCH);
+    FAIL_IF(segment_pool[idx]->outstanding < SEGMENT_CACHE_MAX * 2);
+
+    for (i = 0; i < SEGMENT_CACHE_MAX * 2; i++) {
+        StreamTcpSegmentReturntoPool(segs[i]);
+        FAIL_IF(stack->len > SEGMENT_CACHE_MAX);
+    }
+    FAIL_IF(stack->len == 0);
+    FAIL_IF(segment_pool[idx]->outstanding != stack->len);
+
+    /* reuse from the cache */
+    TcpSegment *seg = StreamTcpGetSegment(&tv, ra_ctx, 100);
+    FAIL_IF_NULL(seg);
+    FAIL_IF(segment_pool[idx]->outstanding != stack->len + 1);
+    StreamTcpSegmentReturntoPool(seg);
+
+    /* thread exit flushes the cache back to the pool */
+    StreamTcpReassembleFreeThreadCtx(ra_ctx);
+    FAIL_IF(stack->len != 0);
+    FAIL_IF(segment_pool[idx]->outstanding != 0);
+
+    StreamTcpFreeConfig(TRUE);
+    PASS;
+}
+
+/** \test in order segments in streaming buffer mode store their data in the
+ *        stream's buffer, overlapping segments use their own payload. */
+static int StreamTcpReassembleStreamingBufferTest01(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    Packet *p = NULL;
+    memset(&tv, 0x00, sizeof(tv));
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("stream.reassembly.streaming-buffer", "yes");
+
+    StreamTcpUTInit(&ra_ctx);
+    FAIL_IF_NULL(ra_ctx);
+    FAIL_IF(!(stream_config.flags & STREAMTCP_INIT_FLAG_STREAMING_BUFFER));
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+
+    uint8_t payload1[] = "AAAA";
+    uint8_t payload2[] = "BBBB";
+    uint8_t payload3[] = "CCCC";
+    uint8_t payload4[] = "XXXXXX";
+
+    p = UTHBuildPacketReal(payload1, 4, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    FAIL_IF_NULL(p);
+    p->tcph->th_seq = htonl(2);
+    FAIL_IF(StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, &ssn.client, p) != 0);
+    UTHFreePacket(p);
+
+    p = UTHBuildPacketReal(payload2, 4, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    FAIL_IF_NULL(p);
+    p->tcph->th_seq = htonl(6);
+    FAIL_IF(StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, &ssn.client, p) != 0);
+    UTHFreePacket(p);
+
+    p = UTHBuildPacketReal(payload3, 4, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    FAIL_IF_NULL(p);
+    p->tcph->th_seq = htonl(10);
+    FAIL_IF(StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, &ssn.client, p) != 0);
+    UTHFreePacket(p);
+
+    FAIL_IF_NULL(ssn.client.sb);
+    FAIL_IF(ssn.client.sb->buf_offset != 12);
+    FAIL_IF(StreamingBufferCompareRawData(ssn.client.sb,
+                (const uint8_t *)"AAAABBBBCCCC", 12) != 1);
+
+    TcpSegment *seg = ssn.client.seg_list;
+    int cnt = 0;
+    for ( ; seg != NULL; seg = seg->next) {
+        FAIL_IF(!(seg->flags & SEGMENTTCP_FLAG_SB_DATA));
+        FAIL_IF(seg->pool_size != 0);
+        cnt++;
+    }
+    FAIL_IF(cnt != 3);
+
+    /* overlaps with the 2nd and 3rd segment: not in the buffer */
+    p = UTHBuildPacketReal(payload4, 6, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    FAIL_IF_NULL(p);
+    p->tcph->th_seq = htonl(8);
+    FAIL_IF(StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, &ssn.client, p) != 0);
+    UTHFreePacket(p);
+
+    FAIL_IF(ssn.client.sb->buf_offset != 12);
+    for (seg = ssn.client.seg_list; seg != NULL; seg = seg->next) {
+        if (!(seg->flags & SEGMENTTCP_FLAG_SB_DATA)) {
+            FAIL_IF(seg->pool_size == 0);
+        }
+    }
+
+    StreamTcpUTClearSession(&ssn);
+    FAIL_IF_NOT_NULL(ssn.client.sb);
+    StreamTcpUTDeinit(ra_ctx);
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+
+/** \test raw reassembly in streaming buffer mode creates a single smsg
+ *        that points into the stream's buffer. While the smsg exists
+ *        the buffer is not grown. */
+static int StreamTcpReassembleStreamingBufferTest02(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    Packet *p = NULL;
+    memset(&tv, 0x00, sizeof(tv));
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("stream.reassembly.streaming-buffer", "yes");
+
+    StreamTcpUTInit(&ra_ctx);
+    FAIL_IF_NULL(ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+
+    uint8_t payload1[] = "AAAA";
+    uint8_t payload2[] = "BBBB";
+    uint8_t payload3[] = "CCCC";
+    static uint8_t payload4[4096];
+    memset(payload4, 'D', sizeof(payload4));
+
+    p = UTHBuildPacketReal(payload1, 4, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    FAIL_IF_NULL(p);
+    p->tcph->th_seq = htonl(2);
+    FAIL_IF(StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, &ssn.client, p) != 0);
+    UTHFreePacket(p);
+
+    p = UTHBuildPacketReal(payload2, 4, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    FAIL_IF_NULL(p);
+    p->tcph->th_seq = htonl(6);
+    FAIL_IF(StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, &ssn.client, p) != 0);
+    UTHFreePacket(p);
+
+    p = UTHBuildPacketReal(payload3, 4, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    FAIL_IF_NULL(p);
+    p->tcph->th_seq = htonl(10);
+    FAIL_IF(StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, &ssn.client, p) != 0);
+    UTHFreePacket(p);
+
+    /* ack all data and run raw reassembly from the ACK packet */
+    ssn.client.last_ack = 14;
+    ssn.flags |= STREAMTCP_FLAG_TRIGGER_RAW_REASSEMBLY;
+    p = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "2.2.2.2", "1.1.1.1", 80, 1024);
+    FAIL_IF_NULL(p);
+    p->flowflags = FLOW_PKT_TOCLIENT;
+    FAIL_IF(StreamTcpReassembleRaw(ra_ctx, &ssn, &ssn.client, p) != 0);
+    UTHFreePacket(p);
+
+    StreamMsg *smsg = ssn.toserver_smsg_head;
+    FAIL_IF_NULL(smsg);
+    FAIL_IF_NOT_NULL(smsg->next);
+    FAIL_IF(!(smsg->flags & STREAM_MSG_FLAG_VIEW));
+    FAIL_IF(smsg->seq != 2);
+    FAIL_IF(smsg->data_len != 12);
+    FAIL_IF(memcmp(smsg->data, "AAAABBBBCCCC", 12) != 0);
+    FAIL_IF(smsg->data != ssn.client.sb->buf);
+    FAIL_IF(ssn.client.sb_views != 1);
+    FAIL_IF(ssn.client.ra_raw_base_seq != 13);
+
+    /* doesn't fit the buffer and the buffer can't be grown now */
+    p = UTHBuildPacketReal(payload4, sizeof(payload4), IPPROTO_TCP,
+            "1.1.1.1", "2.2.2.2", 1024, 80);
+    FAIL_IF_NULL(p);
+    p->tcph->th_seq = htonl(14);
+    FAIL_IF(StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, &ssn.client, p) != 0);
+    UTHFreePacket(p);
+
+    FAIL_IF_NULL(ssn.client.seg_list_tail);
+    FAIL_IF(ssn.client.seg_list_tail->flags & SEGMENTTCP_FLAG_SB_DATA);
+    FAIL_IF(smsg->data != ssn.client.sb->buf);
+
+    StreamMsgReturnListToPool(ssn.toserver_smsg_head);
+    ssn.toserver_smsg_head = ssn.toserver_smsg_tail = NULL;
+    FAIL_IF(ssn.client.sb_views != 0);
+
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+
+/** \internal
+ *  \brief check that the segment list is in order and that the segment
+ *         index, if valid, matches it
+ *  \retval cnt number of segments, -1 on error */
+static int StreamTcpReassembleSegmentIndexCheck(TcpStream *stream)
+{
+    int cnt = 0;
+    TcpSegment *seg = stream->seg_list;
+    for ( ; seg != NULL; seg = seg->next, cnt++) {
+        if (seg->next != NULL && SEQ_GT(seg->seq + seg->payload_len, seg->next->seq))
+            return -1;
+        if ((stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX) &&
+            ((uint32_t)cnt >= stream->seg_idx_cnt ||
+             stream->seg_idx[stream->seg_idx_start + cnt] != seg))
+            return -1;
+    }
+    if ((stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX) &&
+            (uint32_t)cnt != stream->seg_idx_cnt)
+        return -1;
+    return cnt;
+}
+
+/** \test reverse order segment inserts build the segment index, which is
+ *        kept in sync with the list on inserts, overlaps and removals */
+static int StreamTcpReassembleSegmentIndexTest01(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    memset(&tv, 0x00, sizeof(tv));
+    const int nsegs = 200;
+    int i;
+
+    StreamTcpUTInit(&ra_ctx);
+    FAIL_IF_NULL(ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+    TcpStream *stream = &ssn.client;
+
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, stream, 2, 'A', 10) != 0);
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, stream,
+                2 + (nsegs - 1) * 10, 'A', 10) != 0);
+    for (i = nsegs - 2; i > 0; i--) {
+        FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, stream,
+                    2 + i * 10, 'A', 10) != 0);
+        FAIL_IF(StreamTcpReassembleSegmentIndexCheck(stream) != nsegs - i + 1);
+    }
+    FAIL_IF(!(stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX));
+
+    /* overlap handling invalidates the index, it's rebuilt after */
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, stream, 52, 'A', 10) != 0);
+    FAIL_IF(!(stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX));
+    FAIL_IF(StreamTcpReassembleSegmentIndexCheck(stream) != nsegs);
+
+    /* remove from the head and from the middle */
+    for (i = 0; i < 3; i++) {
+        TcpSegment *seg = stream->seg_list;
+        StreamTcpRemoveSegmentFromStream(stream, seg);
+        StreamTcpSegmentReturntoPool(seg);
+    }
+    TcpSegment *seg = stream->seg_list->next->next;
+    StreamTcpRemoveSegmentFromStream(stream, seg);
+    StreamTcpSegmentReturntoPool(seg);
+    FAIL_IF(!(stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX));
+    FAIL_IF(StreamTcpReassembleSegmentIndexCheck(stream) != nsegs - 4);
+
+    /* fill the hole again using the index */
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, stream, 52, 'A', 10) != 0);
+    FAIL_IF(!(stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX));
+    FAIL_IF(StreamTcpReassembleSegmentIndexCheck(stream) != nsegs - 3);
+
+    StreamTcpUTClearSession(&ssn);
+    FAIL_IF_NOT_NULL(stream->seg_idx);
+    FAIL_IF(stream->flags & STREAMTCP_STREAM_FLAG_SEG_IDX);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
+#define STREAM_BENCH_SEGS   64
+#define STREAM_BENCH_SEGLEN 1000
+
+/** \internal
+ *  \brief insert streams of STREAM_BENCH_SEGS segments. Out of order, the
+ *         segments of each group of 8 come in reverse. */
+static int StreamTcpReassembleBench(UtBench *b, int ooo)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpStream stream;
+    uint8_t payload[STREAM_BENCH_SEGLEN];
+
+    memset(&tv, 0x00, sizeof(tv));
+    memset(payload, 'A', sizeof(payload));
+    StreamTcpUTInit(&ra_ctx);
+    FAIL_IF_NULL(ra_ctx);
+    StreamTcpUTSetupStream(&stream, 1);
+    Packet *p = UTHBuildPacketReal(payload, sizeof(payload), IPPROTO_TCP,
+            "1.1.1.1", "2.2.2.2", 1024, 80);
+    FAIL_IF_NULL(p);
+
+    UtBenchResetTimer(b);
+    uint64_t n;
+    for (n = 0; n < b->n; n++) {
+        uint32_t i = n % STREAM_BENCH_SEGS;
+        if (i == 0 && n != 0) {
+            StreamTcpUTClearStream(&stream);
+            StreamTcpUTSetupStream(&stream, 1);
+        }
+        if (ooo)
+            i = (i & ~7) | (7 - (i & 7));
+
+        TcpSegment *seg = StreamTcpGetSegment(&tv, ra_ctx, sizeof(payload));
+        FAIL_IF_NULL(seg);
+        seg->seq = 2 + i * sizeof(payload);
+        seg->payload_len = sizeof(payload);
+        memcpy(seg->payload, payload, sizeof(payload));
+        p->tcph->th_seq = htonl(seg->seq);
+        FAIL_IF(StreamTcpReassembleInsertSegment(&tv, ra_ctx, &stream,
+                    seg, p) < 0);
+    }
+    b->bytes = sizeof(payload);
+
+    UTHFreePacket(p);
+    StreamTcpUTClearStream(&stream);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
+static int StreamTcpReassembleBench01(UtBench *b)
+{
+    return StreamTcpReassembleBench(b, 0);
+}
+
+static int StreamTcpReassembleBench02(UtBench *b)
+{
+    return StreamTcpReassembleBench(b, 1);
+}
+
+/** \test per session depth set on the fly, and segments released once
+ *        app layer reassembly stops for the stream */
+static int StreamTcpReassembleDepthTest01(void)
+{
+    TcpSession ssn;
+    TcpSegment seg;
+
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+    TcpStream *stream = &ssn.client;
+
+    /* unlimited */
+    FAIL_IF(StreamTcpReassembleCheckDepth(&ssn, stream, 2, 100) != 100);
+
+    StreamTcpSetSessionReassemblyDepth(&ssn, 50);
+    FAIL_IF(StreamTcpReassembleCheckDepth(&ssn, stream, 2, 100) != 49);
+    FAIL_IF(StreamTcpReassembleCheckDepth(&ssn, stream, 60, 10) != 0);
+    FAIL_IF(stream->flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED);
+
+    STREAMTCP_SET_RA_BASE_SEQ(stream, 60);
+    FAIL_IF(StreamTcpReassembleCheckDepth(&ssn, stream, 60, 10) != 0);
+    FAIL_IF(!(stream->flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED));
+
+    /* raw is done with the segment, app layer isn't */
+    memset(&seg, 0x00, sizeof(seg));
+    seg.seq = 2;
+    seg.payload_len = 10;
+    seg.flags = SEGMENTTCP_FLAG_RAW_PROCESSED;
+    StreamTcpSetStreamFlagAppProtoDetectionCompleted(stream);
+    FAIL_IF(StreamTcpReturnSegmentCheck(NULL, &ssn, stream, &seg) != 0);
+
+    /* app layer won't get to it anymore */
+    stream->flags |= STREAMTCP_STREAM_FLAG_NOREASSEMBLY;
+    FAIL_IF(StreamTcpReturnSegmentCheck(NULL, &ssn, stream, &seg) != 1);
+    PASS;
+}
+
+/** \test incremental inline raw reassembly: the second smsg only has the
+ *        overlap and the new data */
+static int StreamTcpReassembleInlineOverlapTest01(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    Flow f;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTInitInline();
+    stream_config.reassembly_inline_overlap = 3;
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+    FLOW_INITIALIZE(&f);
+
+    uint8_t stream_payload1[] = "AAAAABBBBBCCCCC";
+    uint8_t stream_payload2[] = "CCCDDDDD";
+    uint8_t payload[] = { 'C', 'C', 'C', 'C', 'C' };
+    Packet *p = UTHBuildPacketReal(payload, 5, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    FAIL_IF_NULL(p);
+    p->tcph->th_seq = htonl(12);
+    p->flow = &f;
+
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,  2, 'A', 5) == -1);
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,  7, 'B', 5) == -1);
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client, 12, 'C', 5) == -1);
+    ssn.client.next_seq = 17;
+
+    FAIL_IF(StreamTcpReassembleInlineRaw(ra_ctx, &ssn, &ssn.client, p) < 0);
+    FAIL_IF(UtSsnSmsgCnt(&ssn, STREAM_TOSERVER) != 1);
+    FAIL_IF(UtTestSmsg(ssn.toserver_smsg_head, stream_payload1, 15) == 0);
+
+    /* a retransmission, nothing new */
+    FAIL_IF(StreamTcpReassembleInlineRaw(ra_ctx, &ssn, &ssn.client, p) < 0);
+    FAIL_IF(UtSsnSmsgCnt(&ssn, STREAM_TOSERVER) != 1);
+
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client, 17, 'D', 5) == -1);
+    ssn.client.next_seq = 22;
+    p->tcph->th_seq = htonl(17);
+
+    FAIL_IF(StreamTcpReassembleInlineRaw(ra_ctx, &ssn, &ssn.client, p) < 0);
+    FAIL_IF(UtSsnSmsgCnt(&ssn, STREAM_TOSERVER) != 2);
+    FAIL_IF(UtTestSmsg(ssn.toserver_smsg_head->next, stream_payload2, 8) == 0);
+
+    stream_config.reassembly_inline_overlap = 0;
+    FLOW_DESTROY(&f);
+    UTHFreePacket(p);
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /** \brief  The Function Register the Unit tests to test the reassembly engine
@@ -8816,6 +10105,23 @@ void StreamTcpReassembleRegisterTests(void)
                    StreamTcpReassembleInsertTest02);
     UtRegisterTest("StreamTcpReassembleInsertTest03 -- insert with overlap",
                    StreamTcpReassembleInsertTest03);
+    UtRegisterTest("StreamTcpReassembleSegmentCacheTest01 -- thread segment cache",
+                   StreamTcpReassembleSegmentCacheTest01);
+    UtRegisterTest("StreamTcpReassembleStreamingBufferTest01 -- streaming buffer mode",
+                   StreamTcpReassembleStreamingBufferTest01);
+    UtRegisterTest("StreamTcpReassembleStreamingBufferTest02 -- streaming buffer raw smsg view",
+                   StreamTcpReassembleStreamingBufferTest02);
+    UtRegisterTest("StreamTcpReassembleSegmentIndexTest01 -- segment index",
+                   StreamTcpReassembleSegmentIndexTest01);
+    UtRegisterTest("StreamTcpReassembleDepthTest01 -- per session depth",
+                   StreamTcpReassembleDepthTest01);
+    UtRegisterTest("StreamTcpReassembleInlineOverlapTest01 -- incremental inline raw",
+                   StreamTcpReassembleInlineOverlapTest01);
+
+    UtRegisterBenchmark("StreamTcpReassembleBench01 -- in order insert",
+                        StreamTcpReassembleBench01);
+    UtRegisterBenchmark("StreamTcpReassembleBench02 -- out of order insert",
+                        StreamTcpReassembleBench02);
 
     StreamTcpInlineRegisterTests();
     StreamTcpUtilRegisterTests();
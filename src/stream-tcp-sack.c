@@ -32,35 +32,109 @@
 #ifdef DEBUG
 void StreamTcpSackPrintList(TcpStream *stream)
 {
-    StreamTcpSackRecord *rec = stream->sack_head;
-    for (; rec != NULL; rec = rec->next) {
-        SCLogDebug("record %8u - %8u", rec->le, rec->re);
+    StreamTcpSackRecord *recs = StreamTcpSackRecords(stream);
+    uint32_t i;
+    for (i = 0; i < stream->sack_cnt; i++) {
+        SCLogDebug("record %8u - %8u", recs[i].le, recs[i].re);
     }
 }
 #endif /* DEBUG */
 
-static StreamTcpSackRecord *StreamTcpSackRecordAlloc(void)
+/** \internal
+ *  \brief recalculate the sacked size after the records changed */
+static void StreamTcpSackUpdateSize(TcpStream *stream)
 {
-    if (StreamTcpCheckMemcap((uint32_t)sizeof(StreamTcpSackRecord)) == 0)
-        return NULL;
+    StreamTcpSackRecord *recs = StreamTcpSackRecords(stream);
+    uint32_t size = 0;
+    uint32_t i;
 
-    StreamTcpSackRecord *rec = SCMalloc(sizeof(*rec));
-    if (unlikely(rec == NULL))
-        return NULL;
+    for (i = 0; i < stream->sack_cnt; i++) {
+        size += (recs[i].re - recs[i].le);
+    }
+    stream->sack_size = size;
+}
+
+/** \internal
+ *  \brief make room for at least one more record
+ *
+ *  Moves the records to the heap once the inline slots are used up, the
+ *  heap array doubles after that.
+ *
+ *  \retval 0 ok
+ *  \retval -1 memcap or out of memory
+ */
+static int StreamTcpSackGrow(TcpStream *stream)
+{
+    uint32_t size = stream->sack_heap ? stream->sack_heap_size : STREAMTCP_SACK_INLINE;
+
+    if (stream->sack_cnt < size)
+        return 0;
+
+    uint32_t new_size = size * 2;
+    uint64_t grow = (uint64_t)(new_size - (stream->sack_heap ? size : 0)) *
+        sizeof(StreamTcpSackRecord);
+    if (StreamTcpCheckMemcap(grow) == 0)
+        return -1;
+
+    StreamTcpSackRecord *recs = SCRealloc(stream->sack_heap,
+            new_size * sizeof(StreamTcpSackRecord));
+    if (unlikely(recs == NULL))
+        return -1;
+
+    if (stream->sack_heap == NULL) {
+        memcpy(recs, stream->sack_inline,
+                stream->sack_cnt * sizeof(StreamTcpSackRecord));
+    }
+    StreamTcpIncrMemuse(grow);
+    stream->sack_heap = recs;
+    stream->sack_heap_size = new_size;
+    return 0;
+}
 
-    StreamTcpIncrMemuse((uint64_t)sizeof(*rec));
-    return rec;
+/** \internal
+ *  \brief free the heap records, after moving them back inline if there
+ *         is room */
+static void StreamTcpSackShrink(TcpStream *stream)
+{
+    if (stream->sack_heap == NULL || stream->sack_cnt > STREAMTCP_SACK_INLINE)
+        return;
+
+    memcpy(stream->sack_inline, stream->sack_heap,
+            stream->sack_cnt * sizeof(StreamTcpSackRecord));
+    SCFree(stream->sack_heap);
+    StreamTcpDecrMemuse((uint64_t)stream->sack_heap_size * sizeof(StreamTcpSackRecord));
+    stream->sack_heap = NULL;
+    stream->sack_heap_size = 0;
 }
 
-static void StreamTcpSackRecordFree(StreamTcpSackRecord *rec)
+/** \internal
+ *  \brief find the first record with a right edge at or beyond 'seq'
+ *
+ *  The records are disjoint and sorted, so the right edges are sorted
+ *  as well.
+ *
+ *  \retval idx index of the record, sack_cnt if there is none
+ */
+static uint32_t StreamTcpSackSearch(TcpStream *stream, uint32_t seq)
 {
-    SCFree(rec);
-    StreamTcpDecrMemuse((uint64_t)sizeof(*rec));
+    StreamTcpSackRecord *recs = StreamTcpSackRecords(stream);
+    uint32_t lo = 0, hi = stream->sack_cnt;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (SEQ_LT(recs[mid].re, seq))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
 /**
  *  \brief insert a SACK range
  *
+ *  Records that overlap or touch the new range are merged into it.
+ *
  *  \param le left edge in host order
  *  \param re right edge in host order
  *
@@ -77,167 +151,50 @@ static int StreamTcpSackInsertRange(TcpStream *stream, uint32_t le, uint32_t re)
     /* if to the left of last_ack then ignore */
     if (SEQ_LT(re, stream->last_ack)) {
         SCLogDebug("too far left. discarding");
-        goto end;
+        SCReturnInt(0);
     }
     /* if to the right of the tcp window then ignore */
     if (SEQ_GT(le, (stream->last_ack + stream->window))) {
         SCLogDebug("too far right. discarding");
-        goto end;
-    }
-    if (stream->sack_head != NULL) {
-        StreamTcpSackRecord *rec;
-
-        for (rec = stream->sack_head; rec != NULL; rec = rec->next) {
-            SCLogDebug("rec %p, le %u, re %u", rec, rec->le, rec->re);
-
-            if (SEQ_LT(le, rec->le)) {
-                SCLogDebug("SEQ_LT(le, rec->le)");
-                if (SEQ_LT(re, rec->le)) {
-                    SCLogDebug("SEQ_LT(re, rec->le)");
-                    // entirely before, prepend
-                    StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                    if (unlikely(stsr == NULL)) {
-                        SCReturnInt(-1);
-                    }
-                    stsr->le = le;
-                    stsr->re = re;
-
-                    stsr->next = stream->sack_head;
-                    stream->sack_head = stsr;
-                    goto end;
-                } else if (SEQ_EQ(re, rec->le)) {
-                    SCLogDebug("SEQ_EQ(re, rec->le)");
-                    // starts before, ends on rec->le, expand
-                    rec->le = le;
-                } else if (SEQ_GT(re, rec->le)) {
-                    SCLogDebug("SEQ_GT(re, rec->le)");
-                    // starts before, ends beyond rec->le
-                    if (SEQ_LEQ(re, rec->re)) {
-                        SCLogDebug("SEQ_LEQ(re, rec->re)");
-                        // ends before rec->re, expand
-                        rec->le = le;
-                    } else { // implied if (re > rec->re)
-                        SCLogDebug("implied if (re > rec->re), le set to %u", rec->re);
-                        le = rec->re;
-                        continue;
-                    }
-                }
-            } else if (SEQ_EQ(le, rec->le)) {
-                SCLogDebug("SEQ_EQ(le, rec->le)");
-                if (SEQ_LEQ(re, rec->re)) {
-                    SCLogDebug("SEQ_LEQ(re, rec->re)");
-                    // new record fully overlapped
-                    SCReturnInt(0);
-                } else { // implied re > rec->re
-                    SCLogDebug("implied re > rec->re");
-                    if (rec->next != NULL) {
-                        if (SEQ_LEQ(re, rec->next->le)) {
-                            rec->re = re;
-                            goto end;
-                        } else {
-                            rec->re = rec->next->le;
-                            le = rec->next->le;
-                            SCLogDebug("le is now %u", le);
-                            continue;
-                        }
-                    } else {
-                        rec->re = re;
-                        goto end;
-                    }
-                }
-            } else { // implied (le > rec->le)
-                SCLogDebug("implied (le > rec->le)");
-                if (SEQ_LT(le, rec->re)) {
-                    SCLogDebug("SEQ_LT(le, rec->re))");
-                    // new record fully overlapped
-                    if (SEQ_GT(re, rec->re)) {
-                        SCLogDebug("SEQ_GT(re, rec->re)");
-
-                        if (rec->next != NULL) {
-                            if (SEQ_LEQ(re, rec->next->le)) {
-                                rec->re = re;
-                                goto end;
-                            } else {
-                                rec->re = rec->next->le;
-                                le = rec->next->le;
-                                continue;
-                            }
-                        } else {
-                            rec->re = re;
-                            goto end;
-                        }
-                    }
-
-                    SCLogDebug("new range fully overlapped");
-                    SCReturnInt(0);
-                } else if (SEQ_EQ(le, rec->re)) {
-                    SCLogDebug("here");
-                    // new record fully overlapped
-                    //int r = StreamTcpSackInsertRange(stream, rec->re+1, re);
-                    //SCReturnInt(r);
-                    le = rec->re;
-                    continue;
-                } else { /* implied le > rec->re */
-                    SCLogDebug("implied le > rec->re");
-                    if (rec->next == NULL) {
-                        SCLogDebug("rec->next == NULL");
-                        StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                        if (unlikely(stsr == NULL)) {
-                            SCReturnInt(-1);
-                        }
-                        stsr->le = le;
-                        stsr->re = re;
-                        stsr->next = NULL;
-
-                        stream->sack_tail->next = stsr;
-                        stream->sack_tail = stsr;
-                        goto end;
-                    } else {
-                        SCLogDebug("implied rec->next != NULL");
-                        if (SEQ_LT(le, rec->next->le) && SEQ_LT(re, rec->next->le)) {
-                            SCLogDebug("SEQ_LT(le, rec->next->le) && SEQ_LT(re, rec->next->le)");
-                            StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                            if (unlikely(stsr == NULL)) {
-                                SCReturnInt(-1);
-                            }
-                            stsr->le = le;
-                            stsr->re = re;
-                            stsr->next = rec->next;
-                            rec->next = stsr;
-
-                        } else if (SEQ_LT(le, rec->next->le) && SEQ_GEQ(re, rec->next->le)) {
-                            SCLogDebug("SEQ_LT(le, rec->next->le) && SEQ_GEQ(re, rec->next->le)");
-                            StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                            if (unlikely(stsr == NULL)) {
-                                SCReturnInt(-1);
-                            }
-                            stsr->le = le;
-                            stsr->re = rec->next->le;
-                            stsr->next = rec->next;
-                            rec->next = stsr;
-
-                            le = rec->next->le;
-                        }
-                    }
-                }
-            }
+        SCReturnInt(0);
+    }
+
+    StreamTcpSackRecord *recs = StreamTcpSackRecords(stream);
+    uint32_t first = StreamTcpSackSearch(stream, le);
+    uint32_t last = first;
+
+    /* merge with all records from 'first' that start at or before 're' */
+    while (last < stream->sack_cnt && SEQ_LEQ(recs[last].le, re)) {
+        if (SEQ_LT(recs[last].le, le))
+            le = recs[last].le;
+        if (SEQ_GT(recs[last].re, re))
+            re = recs[last].re;
+        last++;
+    }
+
+    if (last > first) {
+        SCLogDebug("merged %u records into %u - %u", last - first, le, re);
+        recs[first].le = le;
+        recs[first].re = re;
+        if (last - first > 1) {
+            memmove(&recs[first + 1], &recs[last],
+                    (stream->sack_cnt - last) * sizeof(StreamTcpSackRecord));
+            stream->sack_cnt -= (last - first - 1);
         }
     } else {
-        SCLogDebug("implied empty list");
-        StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-        if (unlikely(stsr == NULL)) {
+        if (StreamTcpSackGrow(stream) < 0)
             SCReturnInt(-1);
-        }
-        stsr->le = le;
-        stsr->re = re;
-        stsr->next = NULL;
+        /* may have moved to the heap */
+        recs = StreamTcpSackRecords(stream);
 
-        stream->sack_head = stsr;
-        stream->sack_tail = stsr;
+        memmove(&recs[first + 1], &recs[first],
+                (stream->sack_cnt - first) * sizeof(StreamTcpSackRecord));
+        recs[first].le = le;
+        recs[first].re = re;
+        stream->sack_cnt++;
     }
 
     StreamTcpSackPruneList(stream);
-end:
     SCReturnInt(0);
 }
 
@@ -302,33 +259,25 @@ void StreamTcpSackPruneList(TcpStream *stream)
 {
     SCEnter();
 
-    StreamTcpSackRecord *rec = stream->sack_head;
-
-    while (rec != NULL) {
-        if (SEQ_LT(rec->re, stream->last_ack)) {
-            SCLogDebug("removing le %u re %u", rec->le, rec->re);
-
-            if (rec->next != NULL) {
-                stream->sack_head = rec->next;
-                StreamTcpSackRecordFree(rec);
-                rec = stream->sack_head;
-                continue;
-            } else {
-                stream->sack_head = NULL;
-                stream->sack_tail = NULL;
-                StreamTcpSackRecordFree(rec);
-                break;
-            }
-        } else if (SEQ_LT(rec->le, stream->last_ack)) {
-            SCLogDebug("adjusting record to le %u re %u", rec->le, rec->re);
-            /* last ack inside this record, update */
-            rec->le = stream->last_ack;
-            break;
-        } else {
-            SCLogDebug("record beyond last_ack, nothing to do. Bailing out.");
-            break;
+    StreamTcpSackRecord *recs = StreamTcpSackRecords(stream);
+
+    if (stream->sack_cnt > 0 && SEQ_LT(recs[0].le, stream->last_ack)) {
+        /* records that end at or before last_ack are gone */
+        uint32_t first = StreamTcpSackSearch(stream, stream->last_ack + 1);
+        if (first > 0) {
+            SCLogDebug("removing %u records", first);
+            memmove(&recs[0], &recs[first],
+                    (stream->sack_cnt - first) * sizeof(StreamTcpSackRecord));
+            stream->sack_cnt -= first;
+        }
+        /* last ack inside the first record, update */
+        if (stream->sack_cnt > 0 && SEQ_LT(recs[0].le, stream->last_ack)) {
+            recs[0].le = stream->last_ack;
+            SCLogDebug("adjusting record to le %u re %u", recs[0].le, recs[0].re);
         }
+        StreamTcpSackShrink(stream);
     }
+    StreamTcpSackUpdateSize(stream);
 #ifdef DEBUG
     StreamTcpSackPrintList(stream);
 #endif
@@ -344,17 +293,14 @@ void StreamTcpSackFreeList(TcpStream *stream)
 {
     SCEnter();
 
-    StreamTcpSackRecord *rec = stream->sack_head;
-    StreamTcpSackRecord *next = NULL;
-
-    while (rec != NULL) {
-        next = rec->next;
-        StreamTcpSackRecordFree(rec);
-        rec = next;
+    if (stream->sack_heap != NULL) {
+        SCFree(stream->sack_heap);
+        StreamTcpDecrMemuse((uint64_t)stream->sack_heap_size * sizeof(StreamTcpSackRecord));
+        stream->sack_heap = NULL;
+        stream->sack_heap_size = 0;
     }
-
-    stream->sack_head = NULL;
-    stream->sack_tail = NULL;
+    stream->sack_cnt = 0;
+    stream->sack_size = 0;
     SCReturn;
 }
 
@@ -383,9 +329,9 @@ static int StreamTcpSackTest01 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 1 || stream.sack_head->re != 20) {
+    if (StreamTcpSackRecords(&stream)[0].le != 1 || StreamTcpSackRecords(&stream)[0].re != 20) {
         printf("list in weird state, head le %u, re %u: ",
-                stream.sack_head->le, stream.sack_head->re);
+                StreamTcpSackRecords(&stream)[0].le, StreamTcpSackRecords(&stream)[0].re);
         goto end;
     }
 
@@ -420,9 +366,9 @@ static int StreamTcpSackTest02 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 1 || stream.sack_head->re != 20) {
+    if (StreamTcpSackRecords(&stream)[0].le != 1 || StreamTcpSackRecords(&stream)[0].re != 20) {
         printf("list in weird state, head le %u, re %u: ",
-                stream.sack_head->le, stream.sack_head->re);
+                StreamTcpSackRecords(&stream)[0].le, StreamTcpSackRecords(&stream)[0].re);
         goto end;
     }
 
@@ -461,7 +407,7 @@ static int StreamTcpSackTest03 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 5) {
+    if (StreamTcpSackRecords(&stream)[0].le != 5) {
         goto end;
     }
 
@@ -497,7 +443,7 @@ static int StreamTcpSackTest04 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (StreamTcpSackRecords(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -533,7 +479,7 @@ static int StreamTcpSackTest05 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (StreamTcpSackRecords(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -571,7 +517,7 @@ static int StreamTcpSackTest06 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (StreamTcpSackRecords(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -609,7 +555,7 @@ static int StreamTcpSackTest07 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (StreamTcpSackRecords(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -656,7 +602,7 @@ static int StreamTcpSackTest08 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (StreamTcpSackRecords(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -704,7 +650,7 @@ static int StreamTcpSackTest09 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (StreamTcpSackRecords(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -751,7 +697,7 @@ static int StreamTcpSackTest10 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 100) {
+    if (StreamTcpSackRecords(&stream)[0].le != 100) {
         goto end;
     }
 
@@ -798,7 +744,7 @@ static int StreamTcpSackTest11 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 100) {
+    if (StreamTcpSackRecords(&stream)[0].le != 100) {
         goto end;
     }
 
@@ -845,7 +791,7 @@ static int StreamTcpSackTest12 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 100) {
+    if (StreamTcpSackRecords(&stream)[0].le != 100) {
         goto end;
     }
 
@@ -942,6 +888,54 @@ end:
     SCReturnInt(retval);
 }
 
+/**
+ *  \test  more records than fit inline, merging them again and pruning
+ *         them back to inline.
+ */
+static int StreamTcpSackTest15 (void)
+{
+    TcpStream stream;
+    int i;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.last_ack = 1000;
+    stream.window = 10000;
+
+    /* out of order, every other one first */
+    for (i = 0; i < 64; i += 2) {
+        FAIL_IF(StreamTcpSackInsertRange(&stream, 2000+(20*i), 2010+(20*i)) != 0);
+    }
+    for (i = 1; i < 64; i += 2) {
+        FAIL_IF(StreamTcpSackInsertRange(&stream, 2000+(20*i), 2010+(20*i)) != 0);
+    }
+    FAIL_IF(stream.sack_cnt != 64);
+    FAIL_IF_NULL(stream.sack_heap);
+    FAIL_IF(StreamTcpSackedSize(&stream) != 640);
+
+    StreamTcpSackRecord *recs = StreamTcpSackRecords(&stream);
+    for (i = 0; i < 64; i++) {
+        FAIL_IF(recs[i].le != (uint32_t)(2000+(20*i)));
+    }
+
+    /* fill the holes between record 10 and 20 */
+    FAIL_IF(StreamTcpSackInsertRange(&stream, 2205, 2405) != 0);
+    FAIL_IF(stream.sack_cnt != 54);
+    recs = StreamTcpSackRecords(&stream);
+    FAIL_IF(recs[10].le != 2200 || recs[10].re != 2410);
+    FAIL_IF(StreamTcpSackedSize(&stream) != 640 + 100);
+
+    /* all but the last 2 ack'd */
+    stream.last_ack = 2000 + (20*62) + 5;
+    StreamTcpSackPruneList(&stream);
+    FAIL_IF(stream.sack_cnt != 2);
+    FAIL_IF_NOT_NULL(stream.sack_heap);
+    FAIL_IF(StreamTcpSackRecords(&stream)[0].le != stream.last_ack);
+    FAIL_IF(StreamTcpSackedSize(&stream) != 15);
+
+    StreamTcpSackFreeList(&stream);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void StreamTcpSackRegisterTests (void)
@@ -965,5 +959,7 @@ void StreamTcpSackRegisterTests (void)
                    StreamTcpSackTest13);
     UtRegisterTest("StreamTcpSackTest14 -- Insertion out of window",
                    StreamTcpSackTest14);
+    UtRegisterTest("StreamTcpSackTest15 -- Insertion beyond the inline records",
+                   StreamTcpSackTest15);
 #endif
 }
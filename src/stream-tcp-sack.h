@@ -40,19 +40,17 @@
  */
 static inline uint32_t StreamTcpSackedSize(TcpStream *stream)
 {
-    if (likely(stream->sack_head == NULL)) {
-        SCReturnUInt(0U);
-    } else {
-        uint32_t size = 0;
-
-        StreamTcpSackRecord *rec = NULL;
-
-        for (rec = stream->sack_head; rec != NULL; rec = rec->next) {
-            size += (rec->re - rec->le);
-        }
+    SCReturnUInt(stream->sack_size);
+}
 
-        SCReturnUInt(size);
-    }
+/**
+ *  \brief Get the sorted SACK records of a stream, stream->sack_cnt of them
+ */
+static inline StreamTcpSackRecord *StreamTcpSackRecords(TcpStream *stream)
+{
+    if (likely(stream->sack_heap == NULL))
+        return stream->sack_inline;
+    return stream->sack_heap;
 }
 
 int StreamTcpSackUpdatePacket(TcpStream *, Packet *);
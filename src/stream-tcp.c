@@ -35,6 +35,7 @@
 
 #include "flow.h"
 #include "flow-util.h"
+#include "flow-embryonic.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
@@ -73,6 +74,7 @@
 #include "util-misc.h"
 #include "util-validate.h"
 #include "util-runmodes.h"
+#include "util-memuse.h"
 
 #include "source-pcap-file.h"
 
@@ -104,46 +106,229 @@ static int StreamTcpValidateTimestamp(TcpSession * , Packet *);
 static int StreamTcpHandleTimestamp(TcpSession * , Packet *);
 static int StreamTcpValidateRst(TcpSession * , Packet *);
 static inline int StreamTcpValidateAck(TcpSession *ssn, TcpStream *, Packet *);
+static int StreamTcpPacketStateSynSent(ThreadVars *, Packet *,
+        StreamTcpThread *, TcpSession *, PacketQueue *);
 
 static PoolThread *ssn_pool = NULL;
 static SCMutex ssn_pool_mutex = SCMUTEX_INITIALIZER; /**< init only, protect initializing and growing pool */
-#ifdef DEBUG
-static uint64_t ssn_pool_cnt = 0; /** counts ssns, protected by ssn_pool_mutex */
-#endif
 
 uint64_t StreamTcpReassembleMemuseGlobalCounter(void);
+/** memory reserved by the stream engine, with TLS this is what the
+ *  threads reserved for their budgets, see StreamTcpThreadMemuse */
 SC_ATOMIC_DECLARE(uint64_t, st_memuse);
 
 /* stream engine running in "inline" mode. */
 int stream_inline = 0;
 
+#ifdef TLS
+/** bytes a thread reserves from st_memuse at a time */
+#define STREAM_TCP_MEMUSE_CHUNK     (256 * 1024)
+
+/** per thread memuse and session accounting
+ *
+ *  A thread reserves memory from st_memuse a chunk at a time and accounts
+ *  its allocations against that budget, it only touches st_memuse when the
+ *  budget runs out or when it has more than 2 chunks to give back. So the
+ *  memcap check is approximate: it can be off by about 2 chunks per thread.
+ *
+ *  Memory and sessions are often freed by another thread than the one that
+ *  allocated them (flow manager, flow recycler), so a block only counts
+ *  up. The counters sum incr - decr over all the blocks, which is exact
+ *  however the allocs and frees are spread over the threads.
+ *
+ *  The blocks are only written by their thread and read by the stats
+ *  thread. They're registered on st_thread_memuse_list once per thread and
+ *  never freed, as the thread may outlive the stream config. */
+typedef struct StreamTcpThreadMemuse_ {
+    uint64_t incr;          /**< bytes allocated by this thread */
+    uint64_t decr;          /**< bytes freed by this thread */
+    uint64_t budget;        /**< reserved from st_memuse, not in use */
+    uint64_t ssn_new;       /**< sessions taken from the pool */
+    uint64_t ssn_clear;     /**< sessions returned to the pool */
+    struct StreamTcpThreadMemuse_ *next;
+} StreamTcpThreadMemuse;
+
+static __thread StreamTcpThreadMemuse *st_thread_memuse = NULL;
+static StreamTcpThreadMemuse *st_thread_memuse_list = NULL;
+static SCMutex st_thread_memuse_lock = SCMUTEX_INITIALIZER;
+
+/** \internal
+ *  \brief get the accounting block of this thread, set it up on first use
+ *
+ *  \retval t block or NULL if out of memory, in which case the caller
+ *           uses st_memuse directly
+ */
+static inline StreamTcpThreadMemuse *StreamTcpThreadMemuseGet(void)
+{
+    StreamTcpThreadMemuse *t = st_thread_memuse;
+    if (likely(t != NULL))
+        return t;
+
+    t = SCCalloc(1, sizeof(*t));
+    if (unlikely(t == NULL))
+        return NULL;
+
+    SCMutexLock(&st_thread_memuse_lock);
+    t->next = st_thread_memuse_list;
+    st_thread_memuse_list = t;
+    SCMutexUnlock(&st_thread_memuse_lock);
+
+    st_thread_memuse = t;
+    return t;
+}
+
+/** \internal
+ *  \brief give the budgets back to st_memuse and reset all blocks
+ *
+ *  Only to be called when no other thread uses the stream engine.
+ */
+static void StreamTcpThreadMemuseReset(void)
+{
+    StreamTcpThreadMemuse *t;
+
+    SCMutexLock(&st_thread_memuse_lock);
+    for (t = st_thread_memuse_list; t != NULL; t = t->next) {
+        if (t->budget > 0) {
+            (void) SC_ATOMIC_SUB(st_memuse, t->budget);
+            MemuseFree(MEMUSE_STREAM, t->budget);
+        }
+        t->incr = t->decr = t->budget = 0;
+        t->ssn_new = t->ssn_clear = 0;
+    }
+    SCMutexUnlock(&st_thread_memuse_lock);
+}
+#else
+SC_ATOMIC_DECLARE(uint64_t, st_ssn_cnt);
+#endif /* TLS */
+
 void StreamTcpIncrMemuse(uint64_t size)
 {
+#ifdef TLS
+    StreamTcpThreadMemuse *t = StreamTcpThreadMemuseGet();
+    if (likely(t != NULL)) {
+        t->incr += size;
+        if (t->budget < size) {
+            uint64_t reserve = size - t->budget + STREAM_TCP_MEMUSE_CHUNK;
+            (void) SC_ATOMIC_ADD(st_memuse, reserve);
+            MemuseAlloc(MEMUSE_STREAM, reserve);
+            t->budget += reserve;
+        }
+        t->budget -= size;
+        return;
+    }
+#endif
     (void) SC_ATOMIC_ADD(st_memuse, size);
+    MemuseAlloc(MEMUSE_STREAM, size);
     return;
 }
 
 void StreamTcpDecrMemuse(uint64_t size)
 {
+#ifdef TLS
+    StreamTcpThreadMemuse *t = StreamTcpThreadMemuseGet();
+    if (likely(t != NULL)) {
+        t->decr += size;
+        t->budget += size;
+        if (t->budget > 2 * STREAM_TCP_MEMUSE_CHUNK) {
+            uint64_t release = t->budget - STREAM_TCP_MEMUSE_CHUNK;
+            (void) SC_ATOMIC_SUB(st_memuse, release);
+            MemuseFree(MEMUSE_STREAM, release);
+            t->budget -= release;
+        }
+        return;
+    }
+#endif
     (void) SC_ATOMIC_SUB(st_memuse, size);
+    MemuseFree(MEMUSE_STREAM, size);
     return;
 }
 
+/** \brief memory in use by the stream engine, for the tcp.memuse counter
+ *
+ *  Summed over the threads, so not tied to a point in time. */
 uint64_t StreamTcpMemuseCounter(void)
 {
+#ifdef TLS
+    StreamTcpThreadMemuse *t;
+    uint64_t incr = 0, decr = 0;
+
+    SCMutexLock(&st_thread_memuse_lock);
+    for (t = st_thread_memuse_list; t != NULL; t = t->next) {
+        incr += t->incr;
+        decr += t->decr;
+    }
+    SCMutexUnlock(&st_thread_memuse_lock);
+    return incr - decr;
+#else
     uint64_t memusecopy = SC_ATOMIC_GET(st_memuse);
     return memusecopy;
+#endif
+}
+
+/** \brief sessions in use, for the tcp.active_sessions counter */
+uint64_t StreamTcpActiveSessionsCounter(void)
+{
+#ifdef TLS
+    StreamTcpThreadMemuse *t;
+    uint64_t ssn_new = 0, ssn_clear = 0;
+
+    SCMutexLock(&st_thread_memuse_lock);
+    for (t = st_thread_memuse_list; t != NULL; t = t->next) {
+        ssn_new += t->ssn_new;
+        ssn_clear += t->ssn_clear;
+    }
+    SCMutexUnlock(&st_thread_memuse_lock);
+    return ssn_new - ssn_clear;
+#else
+    return SC_ATOMIC_GET(st_ssn_cnt);
+#endif
+}
+
+static inline void StreamTcpSessionCntIncr(void)
+{
+#ifdef TLS
+    StreamTcpThreadMemuse *t = StreamTcpThreadMemuseGet();
+    if (likely(t != NULL)) {
+        t->ssn_new++;
+        return;
+    }
+#else
+    (void) SC_ATOMIC_ADD(st_ssn_cnt, 1);
+#endif
+}
+
+static inline void StreamTcpSessionCntDecr(void)
+{
+#ifdef TLS
+    StreamTcpThreadMemuse *t = StreamTcpThreadMemuseGet();
+    if (likely(t != NULL)) {
+        t->ssn_clear++;
+        return;
+    }
+#else
+    (void) SC_ATOMIC_SUB(st_ssn_cnt, 1);
+#endif
 }
 
 /**
  *  \brief Check if alloc'ing "size" would mean we're over memcap
  *
+ *  With TLS the thread's budget is checked first, so this is approximate,
+ *  see StreamTcpThreadMemuse.
+ *
  *  \retval 1 if in bounds
  *  \retval 0 if not in bounds
  */
 int StreamTcpCheckMemcap(uint64_t size)
 {
-    if (stream_config.memcap == 0 || size + SC_ATOMIC_GET(st_memuse) <= stream_config.memcap)
+    if (stream_config.memcap == 0)
+        return 1;
+#ifdef TLS
+    StreamTcpThreadMemuse *t = st_thread_memuse;
+    if (t != NULL && t->budget >= size)
+        return 1;
+#endif
+    if (size + SC_ATOMIC_GET(st_memuse) <= stream_config.memcap)
         return 1;
     return 0;
 }
@@ -170,10 +355,8 @@ void StreamTcpSessionCleanup(TcpSession *ssn)
     if (ssn == NULL)
         return;
 
-    StreamTcpStreamCleanup(&ssn->client);
-    StreamTcpStreamCleanup(&ssn->server);
-
-    /* if we have (a) smsg(s), return to the pool */
+    /* if we have (a) smsg(s), return to the pool. Do this before the
+     * stream cleanup as smsgs can reference stream data. */
     smsg = ssn->toserver_smsg_head;
     while(smsg != NULL) {
         StreamMsg *smsg_next = smsg->next;
@@ -196,6 +379,9 @@ void StreamTcpSessionCleanup(TcpSession *ssn)
     }
     ssn->toclient_smsg_head = NULL;
 
+    StreamTcpStreamCleanup(&ssn->client);
+    StreamTcpStreamCleanup(&ssn->server);
+
     q = ssn->queue;
     while (q != NULL) {
         q_next = q->next;
@@ -234,11 +420,7 @@ void StreamTcpSessionClear(void *ssnptr)
     ssn->res = a;
 
     PoolThreadReturn(ssn_pool, ssn);
-#ifdef DEBUG
-    SCMutexLock(&ssn_pool_mutex);
-    ssn_pool_cnt--;
-    SCMutexUnlock(&ssn_pool_mutex);
-#endif
+    StreamTcpSessionCntDecr();
 
     SCReturn;
 }
@@ -358,6 +540,7 @@ void StreamTcpInitConfig(char quiet)
     if (!quiet) {
         SCLogConfig("stream \"memcap\": %"PRIu64, stream_config.memcap);
     }
+    MemuseSetMemcap(MEMUSE_STREAM, stream_config.memcap);
 
     ConfGetBool("stream.midstream", &stream_config.midstream);
 
@@ -371,6 +554,17 @@ void StreamTcpInitConfig(char quiet)
         SCLogConfig("stream \"async-oneside\": %s", stream_config.async_oneside ? "enabled" : "disabled");
     }
 
+    int bypass = 0;
+    if ((ConfGetBool("stream.bypass", &bypass)) == 1 && bypass) {
+        stream_config.flags |= STREAMTCP_INIT_FLAG_BYPASS;
+    }
+
+    if (!quiet) {
+        SCLogConfig("stream \"bypass\": %s",
+                stream_config.flags & STREAMTCP_INIT_FLAG_BYPASS ?
+                "enabled" : "disabled");
+    }
+
     int csum = 0;
 
     if ((ConfGetBool("stream.checksum-validation", &csum)) == 1) {
@@ -446,6 +640,7 @@ void StreamTcpInitConfig(char quiet)
     if (!quiet) {
         SCLogConfig("stream.reassembly \"memcap\": %"PRIu64"", stream_config.reassembly_memcap);
     }
+    MemuseSetMemcap(MEMUSE_REASSEMBLY, stream_config.reassembly_memcap);
 
     char *temp_stream_reassembly_depth_str;
     if (ConfGet("stream.reassembly.depth", &temp_stream_reassembly_depth_str) == 1) {
@@ -550,6 +745,25 @@ void StreamTcpInitConfig(char quiet)
             stream_config.reassembly_toclient_chunk_size);
     }
 
+    char *temp_inline_overlap_str;
+    if (ConfGet("stream.reassembly.inline-overlap", &temp_inline_overlap_str) == 1) {
+        if (ParseSizeStringU32(temp_inline_overlap_str,
+                               &stream_config.reassembly_inline_overlap) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                       "stream.reassembly.inline-overlap "
+                       "from conf file - %s.  Killing engine",
+                       temp_inline_overlap_str);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        stream_config.reassembly_inline_overlap = 0;
+    }
+    if (!quiet && StreamTcpInlineMode()) {
+        SCLogConfig("stream.reassembly \"inline-overlap\": %"PRIu32"%s",
+            stream_config.reassembly_inline_overlap,
+            stream_config.reassembly_inline_overlap ? "" : " (full window)");
+    }
+
     int enable_raw = 1;
     if (ConfGetBool("stream.reassembly.raw", &enable_raw) == 1) {
         if (!enable_raw) {
@@ -562,9 +776,24 @@ void StreamTcpInitConfig(char quiet)
     if (!quiet)
         SCLogConfig("stream.reassembly.raw: %s", enable_raw ? "enabled" : "disabled");
 
+    int streaming_buffer = 0;
+    if (ConfGetBool("stream.reassembly.streaming-buffer", &streaming_buffer) == 1 &&
+            streaming_buffer) {
+        stream_config.flags |= STREAMTCP_INIT_FLAG_STREAMING_BUFFER;
+    }
+    if (!quiet)
+        SCLogConfig("stream.reassembly.streaming-buffer: %s",
+                streaming_buffer ? "enabled" : "disabled");
+
     /* init the memcap/use tracking */
+#ifdef TLS
+    StreamTcpThreadMemuseReset();
+#else
+    SC_ATOMIC_INIT(st_ssn_cnt);
+#endif
     SC_ATOMIC_INIT(st_memuse);
     StatsRegisterGlobalCounter("tcp.memuse", StreamTcpMemuseCounter);
+    StatsRegisterGlobalCounter("tcp.active_sessions", StreamTcpActiveSessionsCounter);
 
     StreamTcpReassembleInit(quiet);
 
@@ -601,7 +830,10 @@ void StreamTcpFreeConfig(char quiet)
     SCMutexUnlock(&ssn_pool_mutex);
     SCMutexDestroy(&ssn_pool_mutex);
 
-    SCLogDebug("ssn_pool_cnt %"PRIu64"", ssn_pool_cnt);
+    SCLogDebug("active sessions %"PRIu64"", StreamTcpActiveSessionsCounter());
+#ifdef TLS
+    StreamTcpThreadMemuseReset();
+#endif
 }
 
 /** \brief The function is used to to fetch a TCP session from the
@@ -618,12 +850,8 @@ TcpSession *StreamTcpNewSession (Packet *p, int id)
 
     if (ssn == NULL) {
         p->flow->protoctx = PoolThreadGetById(ssn_pool, id);
-#ifdef DEBUG
-        SCMutexLock(&ssn_pool_mutex);
         if (p->flow->protoctx != NULL)
-            ssn_pool_cnt++;
-        SCMutexUnlock(&ssn_pool_mutex);
-#endif
+            StreamTcpSessionCntIncr();
 
         ssn = (TcpSession *)p->flow->protoctx;
         if (ssn == NULL) {
@@ -633,6 +861,7 @@ TcpSession *StreamTcpNewSession (Packet *p, int id)
 
         ssn->state = TCP_NONE;
         ssn->flags = stream_config.ssn_init_flags;
+        ssn->reassembly_depth = stream_config.reassembly_depth;
         ssn->tcp_packet_flags = p->tcph ? p->tcph->th_flags : 0;
 
         if (PKT_IS_TOSERVER(p)) {
@@ -662,12 +891,12 @@ static void StreamTcpPacketSetState(Packet *p, TcpSession *ssn,
         case TCP_FIN_WAIT2:
         case TCP_CLOSING:
         case TCP_CLOSE_WAIT:
-            SC_ATOMIC_SET(p->flow->flow_state, FLOW_STATE_ESTABLISHED);
+            FlowUpdateState(p->flow, FLOW_STATE_ESTABLISHED);
             break;
         case TCP_LAST_ACK:
         case TCP_TIME_WAIT:
         case TCP_CLOSED:
-            SC_ATOMIC_SET(p->flow->flow_state, FLOW_STATE_CLOSED);
+            FlowUpdateState(p->flow, FLOW_STATE_CLOSED);
             break;
     }
 }
@@ -683,21 +912,11 @@ void StreamTcpSetOSPolicy(TcpStream *stream, Packet *p)
 {
     int ret = 0;
 
-    if (PKT_IS_IPV4(p)) {
-        /* Get the OS policy based on destination IP address, as destination
-           OS will decide how to react on the anomalies of newly received
-           packets */
-        ret = SCHInfoGetIPv4HostOSFlavour((uint8_t *)GET_IPV4_DST_ADDR_PTR(p));
-        if (ret > 0)
-            stream->os_policy = ret;
-        else
-            stream->os_policy = OS_POLICY_DEFAULT;
-
-    } else if (PKT_IS_IPV6(p)) {
+    if (PKT_IS_IPV4(p) || PKT_IS_IPV6(p)) {
         /* Get the OS policy based on destination IP address, as destination
            OS will decide how to react on the anomalies of newly received
            packets */
-        ret = SCHInfoGetIPv6HostOSFlavour((uint8_t *)GET_IPV6_DST_ADDR(p));
+        ret = SCHInfoGetHostOSFlavourByAddr(&p->dst);
         if (ret > 0)
             stream->os_policy = ret;
         else
@@ -795,6 +1014,57 @@ static int StreamTcpPacketIsRetransmission(TcpStream *stream, Packet *p)
     SCReturnInt(0);
 }
 
+/** \internal
+ *  \brief set up the session for a SYN/ACK to a SYN that only has an
+ *         embryonic record, see flow-embryonic.c
+ *
+ *  The session is set up as the SYN would have, then the SYN/ACK is
+ *  handled in the TCP_SYN_SENT state.
+ */
+static int StreamTcpPacketEmbryonicSynAck(ThreadVars *tv, Packet *p,
+        StreamTcpThread *stt, PacketQueue *pq)
+{
+    FlowEmbryo e;
+
+    p->flow->flags &= ~FLOW_EMBRYONIC;
+    if (FlowEmbryonicTake(p, &e) == 0) {
+        SCLogDebug("embryonic record of the SYN is gone");
+        return 0;
+    }
+
+    TcpSession *ssn = StreamTcpNewSession(p, stt->ssn_pool_id);
+    if (ssn == NULL) {
+        StatsIncr(tv, stt->counter_tcp_ssn_memcap);
+        return -1;
+    }
+    StatsIncr(tv, stt->counter_tcp_sessions);
+
+    StreamTcpPacketSetState(p, ssn, TCP_SYN_SENT);
+    SCLogDebug("ssn %p: =~ ssn state is now TCP_SYN_SENT (embryonic)", ssn);
+
+    ssn->client.isn = e.isn;
+    STREAMTCP_SET_RA_BASE_SEQ(&ssn->client, ssn->client.isn);
+    ssn->client.next_seq = ssn->client.isn + 1;
+
+    if (e.flags & FLOW_EMBRYO_TS) {
+        ssn->client.last_ts = e.tsval;
+        if (ssn->client.last_ts == 0)
+            ssn->client.flags |= STREAMTCP_STREAM_FLAG_ZERO_TIMESTAMP;
+        ssn->client.last_pkt_ts = e.last;
+        ssn->client.flags |= STREAMTCP_STREAM_FLAG_TIMESTAMP;
+    }
+
+    ssn->server.window = e.window;
+    if (e.flags & FLOW_EMBRYO_WSCALE) {
+        ssn->flags |= STREAMTCP_FLAG_SERVER_WSCALE;
+        ssn->server.wscale = e.wscale;
+    }
+    if (e.flags & FLOW_EMBRYO_SACKOK)
+        ssn->flags |= STREAMTCP_FLAG_CLIENT_SACKOK;
+
+    return StreamTcpPacketStateSynSent(tv, p, stt, ssn, pq);
+}
+
 /**
  *  \internal
  *  \brief  Function to handle the TCP_CLOSED or NONE state. The function handles
@@ -823,6 +1093,9 @@ static int StreamTcpPacketStateNone(ThreadVars *tv, Packet *p,
 
     /* SYN/ACK */
     } else if ((p->tcph->th_flags & (TH_SYN|TH_ACK)) == (TH_SYN|TH_ACK)) {
+        if (ssn == NULL && (p->flow->flags & FLOW_EMBRYONIC))
+            return StreamTcpPacketEmbryonicSynAck(tv, p, stt, pq);
+
         if (stream_config.midstream == FALSE &&
                 stream_config.async_oneside == FALSE)
             return 0;
@@ -4419,6 +4692,16 @@ static int StreamTcpPacketIsBadWindowUpdate(TcpSession *ssn, Packet *p)
 }
 
 /* flow is and stays locked */
+/**
+ *  \brief check if a stream direction has reached the point where neither
+ *          the app layer nor raw inspection will see more of its data
+ */
+static inline int StreamTcpStreamIsDone(TcpStream *stream)
+{
+    return (stream->flags & (STREAMTCP_STREAM_FLAG_DEPTH_REACHED|
+                             STREAMTCP_STREAM_FLAG_NOREASSEMBLY)) ? 1 : 0;
+}
+
 int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
                      PacketQueue *pq)
 {
@@ -4632,6 +4915,14 @@ int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
         {
             p->flags |= PKT_STREAM_NOPCAPLOG;
         }
+
+        /* nothing left to reassemble in either direction */
+        if ((stream_config.flags & STREAMTCP_INIT_FLAG_BYPASS) &&
+            StreamTcpStreamIsDone(&ssn->client) &&
+            StreamTcpStreamIsDone(&ssn->server))
+        {
+            PacketBypassCallback(p);
+        }
     }
 
     SCReturnInt(0);
@@ -5521,6 +5812,25 @@ void StreamTcpSetDisableRawReassemblyFlag (TcpSession *ssn, char direction)
                 (ssn->client.flags |= STREAMTCP_STREAM_FLAG_NEW_RAW_DISABLED);
 }
 
+/** \brief  Set the reassembly depth of a TCP session, in both directions.
+ *
+ *  Used for the per protocol stream-depth once the app-layer protocol is
+ *  known, parsers can also call it to change the depth on the fly, e.g.
+ *  once the part of the stream they care about is done. A depth that is
+ *  already reached can't be extended.
+ *
+ * \param ssn TCP Session to set the depth in
+ * \param size depth in bytes from the ISN, 0 for unlimited
+ */
+void StreamTcpSetSessionReassemblyDepth(TcpSession *ssn, uint32_t size)
+{
+    if (ssn == NULL)
+        return;
+    SCLogDebug("ssn %p: reassembly depth %u -> %u", ssn,
+            ssn->reassembly_depth, size);
+    ssn->reassembly_depth = size;
+}
+
 #define PSEUDO_PKT_SET_IPV4HDR(nipv4h,ipv4h) do { \
         IPV4_SET_RAW_VER(nipv4h, IPV4_GET_RAW_VER(ipv4h)); \
         IPV4_SET_RAW_HLEN(nipv4h, IPV4_GET_RAW_HLEN(ipv4h)); \
@@ -8651,16 +8961,16 @@ static int StreamTcpTest28(void)
 {
     uint8_t ret = 0;
     StreamTcpInitConfig(TRUE);
-    uint32_t memuse = SC_ATOMIC_GET(st_memuse);
+    uint32_t memuse = StreamTcpMemuseCounter();
 
     StreamTcpIncrMemuse(500);
-    if (SC_ATOMIC_GET(st_memuse) != (memuse+500)) {
+    if (StreamTcpMemuseCounter() != (memuse+500)) {
         printf("failed in incrementing the memory");
         goto end;
     }
 
     StreamTcpDecrMemuse(500);
-    if (SC_ATOMIC_GET(st_memuse) != memuse) {
+    if (StreamTcpMemuseCounter() != memuse) {
         printf("failed in decrementing the memory");
         goto end;
     }
@@ -10493,6 +10803,36 @@ end:
     return ret;
 }
 
+/** \test the per thread memuse budget: allocs come out of the reservation,
+ *        frees give it back once there is more than 2 chunks */
+static int StreamTcpTest46(void)
+{
+    StreamTcpInitConfig(TRUE);
+    uint64_t memuse = StreamTcpMemuseCounter();
+
+    StreamTcpIncrMemuse(100);
+    uint64_t reserved = SC_ATOMIC_GET(st_memuse);
+    FAIL_IF(reserved < memuse + 100);
+    /* comes out of the budget */
+    StreamTcpIncrMemuse(100);
+    FAIL_IF(StreamTcpMemuseCounter() != memuse + 200);
+#ifdef TLS
+    FAIL_IF(SC_ATOMIC_GET(st_memuse) != reserved);
+
+    /* more than the budget has left */
+    StreamTcpIncrMemuse(4 * STREAM_TCP_MEMUSE_CHUNK);
+    FAIL_IF(SC_ATOMIC_GET(st_memuse) < memuse + 200 + 4 * STREAM_TCP_MEMUSE_CHUNK);
+    StreamTcpDecrMemuse(4 * STREAM_TCP_MEMUSE_CHUNK);
+    FAIL_IF(SC_ATOMIC_GET(st_memuse) > memuse + 200 + 2 * STREAM_TCP_MEMUSE_CHUNK);
+#endif
+    StreamTcpDecrMemuse(200);
+    FAIL_IF(StreamTcpMemuseCounter() != memuse);
+
+    StreamTcpFreeConfig(TRUE);
+    FAIL_IF(SC_ATOMIC_GET(st_memuse) != 0);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void StreamTcpRegisterTests (void)
@@ -10569,6 +10909,7 @@ void StreamTcpRegisterTests (void)
     UtRegisterTest("StreamTcpTest43 -- SYN/ACK queue", StreamTcpTest43);
     UtRegisterTest("StreamTcpTest44 -- SYN/ACK queue", StreamTcpTest44);
     UtRegisterTest("StreamTcpTest45 -- SYN/ACK queue", StreamTcpTest45);
+    UtRegisterTest("StreamTcpTest46 -- memuse budget", StreamTcpTest46);
 
     /* set up the reassembly tests as well */
     StreamTcpReassembleRegisterTests();
@@ -38,6 +38,12 @@
 /* Flag to indicate that the checksum validation for the stream engine
    has been enabled */
 #define STREAMTCP_INIT_FLAG_CHECKSUM_VALIDATION    0x01
+/* Flag to indicate that in order segment data is stored in a per stream
+ * contiguous StreamingBuffer instead of per segment payload buffers */
+#define STREAMTCP_INIT_FLAG_STREAMING_BUFFER       0x02
+/* Flag to indicate that flows with nothing left to reassemble or
+ * inspect should be bypassed */
+#define STREAMTCP_INIT_FLAG_BYPASS                 0x04
 
 /*global flow data*/
 typedef struct TcpStreamCnf_ {
@@ -69,6 +75,9 @@ typedef struct TcpStreamCnf_ {
      *  sliding window size for raw stream reassembly
      */
     uint32_t reassembly_inline_window;
+    /** incremental inline raw reassembly: bytes of already inspected data
+     *  to include before the new data, 0 to use the full chunk size window */
+    uint32_t reassembly_inline_overlap;
     uint8_t flags;
     uint8_t max_synack_queued;
 } TcpStreamCnf;
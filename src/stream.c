@@ -30,6 +30,7 @@
 #include "util-pool.h"
 #include "util-debug.h"
 #include "stream-tcp.h"
+#include "stream-tcp-private.h"
 #include "flow-util.h"
 
 #ifdef DEBUG
@@ -105,10 +106,38 @@ StreamMsg *StreamMsgGetFromPool(void)
     return s;
 }
 
+/**
+ *  \brief turn a smsg into a view into the reassembly storage of a stream
+ *
+ *  The stream's streaming buffer is not moved until the smsg is
+ *  returned to the pool.
+ *
+ *  \param s smsg from StreamMsgGetFromPool
+ *  \param stream stream owning the data
+ *  \param data data in the stream's streaming buffer
+ *  \param data_len length of the data
+ */
+void StreamMsgSetupView(StreamMsg *s, TcpStream *stream,
+        uint8_t *data, uint32_t data_len)
+{
+    s->flags |= STREAM_MSG_FLAG_VIEW;
+    s->stream = stream;
+    s->data = data;
+    s->data_len = data_len;
+    stream->sb_views++;
+}
+
 /* Used by l7inspection to return msgs to pool */
 void StreamMsgReturnToPool(StreamMsg *s)
 {
     SCLogDebug("s %p", s);
+    if (s->flags & STREAM_MSG_FLAG_VIEW) {
+        BUG_ON(s->stream->sb_views == 0);
+        s->stream->sb_views--;
+        s->stream = NULL;
+        s->data = (uint8_t *)s + sizeof(StreamMsg);
+        s->flags &= ~STREAM_MSG_FLAG_VIEW;
+    }
     SCMutexLock(&stream_msg_pool_mutex);
     PoolReturn(stream_msg_pool, (void *)s);
     SCMutexUnlock(&stream_msg_pool_mutex);
@@ -33,6 +33,11 @@
 #define STREAM_GAP              0x10    /**< data gap encountered */
 #define STREAM_DEPTH            0x20    /**< depth reached */
 
+#define STREAM_MSG_FLAG_VIEW    0x01    /**< data points into the stream's
+                                             *   reassembly storage */
+
+struct TcpStream_;
+
 typedef struct StreamMsg_ {
     struct StreamMsg_ *next;
     struct StreamMsg_ *prev;
@@ -40,8 +45,11 @@ typedef struct StreamMsg_ {
     uint32_t seq;                   /**< sequence number */
     uint32_t data_len;              /**< length of the data */
     uint32_t data_size;
+    uint8_t flags;                  /**< STREAM_MSG_FLAG_* */
     uint8_t *data;                  /**< reassembled data: ptr to after this
-                                     *   struct */
+                                     *   struct, or into the stream's
+                                     *   streaming buffer for a view */
+    struct TcpStream_ *stream;      /**< stream the view references */
 } StreamMsg;
 
 typedef struct StreamMsgQueue_ {
@@ -59,6 +67,7 @@ void StreamMsgQueuesDeinit(char);
 
 StreamMsg *StreamMsgGetFromPool(void);
 void StreamMsgReturnToPool(StreamMsg *);
+void StreamMsgSetupView(StreamMsg *, struct TcpStream_ *, uint8_t *, uint32_t);
 StreamMsg *StreamMsgGetFromQueue(StreamMsgQueue *);
 void StreamMsgPutInQueue(StreamMsgQueue *, StreamMsg *);
 
@@ -48,11 +48,16 @@
 #include "util-atomic.h"
 #include "util-spm.h"
 #include "util-cpu.h"
+#include "util-latency.h"
+#include "util-lock-contention.h"
+#include "util-hugepages.h"
+#include "util-prealloc.h"
 #include "util-action.h"
 #include "util-pidfile.h"
 #include "util-ioctl.h"
 #include "util-device.h"
 #include "util-misc.h"
+#include "util-hash-word.h"
 #include "util-running-modes.h"
 
 #include "detect-engine.h"
@@ -63,6 +68,10 @@
 #include "detect-engine-address.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-fpstats.h"
+#include "detect-engine-guard.h"
+#include "detect-engine-selftest.h"
+#include "detect-engine-tenant.h"
 
 #include "tm-queuehandlers.h"
 #include "tm-queues.h"
@@ -100,6 +109,7 @@
 #include "log-filestore.h"
 #include "log-tcp-data.h"
 #include "log-stats.h"
+#include "log-prometheus.h"
 
 #include "output-json.h"
 
@@ -121,6 +131,7 @@
 
 #include "source-erf-file.h"
 #include "source-erf-dag.h"
+#include "source-synthetic.h"
 #include "source-napatech.h"
 
 #include "source-af-packet.h"
@@ -134,6 +145,8 @@
 #include "flow-manager.h"
 #include "flow-var.h"
 #include "flow-bit.h"
+#include "flow-embryonic.h"
+#include "flow-heavy.h"
 #include "pkt-var.h"
 #include "host-bit.h"
 
@@ -205,6 +218,8 @@
 #endif
 #include "util-mpm-hs.h"
 #include "util-storage.h"
+#include "util-memuse.h"
+#include "datasets.h"
 #include "host-storage.h"
 
 /*
@@ -531,7 +546,7 @@ void usage(const char *progname)
     printf("\t-F <bpf filter file>                 : bpf filter file\n");
     printf("\t-r <path>                            : run in pcap file/offline mode\n");
 #ifdef NFQ
-    printf("\t-q <qid>                             : run in inline nfqueue mode\n");
+    printf("\t-q <qid[:qid]>                       : run in inline nfqueue mode (use colon to specify a range of queues)\n");
 #endif /* NFQ */
 #ifdef IPFW
     printf("\t-d <divert port>                     : run in inline ipfw divert mode\n");
@@ -555,8 +570,14 @@ void usage(const char *progname)
     printf("\t--list-unittests                     : list unit tests\n");
     printf("\t--fatal-unittests                    : enable fatal failure on unittest error\n");
     printf("\t--unittests-coverage                 : display unittest coverage report\n");
+    printf("\t--benchmarks                         : run the benchmarks and exit, -U filters them\n");
 #endif /* UNITTESTS */
     printf("\t--list-app-layer-protos              : list supported app layer protocols\n");
+    printf("\t--applayer-bench=<proto>             : run the <proto> parser over stream files and exit\n");
+    printf("\t--applayer-bench-ts=<file>           : toserver stream data for --applayer-bench\n");
+    printf("\t--applayer-bench-tc=<file>           : toclient stream data for --applayer-bench\n");
+    printf("\t--applayer-bench-chunk=<bytes>       : size of the chunks fed to the parser (default 1460)\n");
+    printf("\t--applayer-bench-rounds=<n>          : number of times to parse the streams (default 100)\n");
     printf("\t--list-keywords[=all|csv|<kword>]    : list keywords implemented by the engine\n");
 #ifdef __SC_CUDA_SUPPORT__
     printf("\t--list-cuda-cards                    : list cuda supported cards\n");
@@ -595,8 +616,9 @@ void usage(const char *progname)
     printf("\t--group <group>                      : run suricata as this group after init\n");
 #endif /* HAVE_LIBCAP_NG */
     printf("\t--erf-in <path>                      : process an ERF file\n");
+    printf("\t--synthetic                          : generate synthetic traffic, see the synthetic config\n");
 #ifdef HAVE_DAG
-    printf("\t--dag <dagX:Y>                       : process ERF records from DAG interface X, stream Y\n");
+    printf("\t--dag <dagX:Y[,Z..]>                 : process ERF records from DAG interface X, streams Y,Z.. in one thread\n");
 #endif
 #ifdef HAVE_NAPATECH
     printf("\t--napatech                           : run Napatech Streams using the API\n");
@@ -851,6 +873,9 @@ void RegisterAllModules()
     /* dag live */
     TmModuleReceiveErfDagRegister();
     TmModuleDecodeErfDagRegister();
+    /* synthetic traffic */
+    TmModuleReceiveSyntheticRegister();
+    TmModuleDecodeSyntheticRegister();
     /* napatech */
     TmModuleNapatechStreamRegister();
     TmModuleNapatechDecodeRegister();
@@ -900,6 +925,7 @@ void RegisterAllModules()
     TmModuleLogTcpDataLogRegister();
     /* log stats */
     TmModuleLogStatsLogRegister();
+    TmModuleLogPrometheusRegister();
 
     TmModuleJsonAlertLogRegister();
     /* flow/netflow */
@@ -1249,6 +1275,11 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
         {"pcap-buffer-size", required_argument, 0, 0},
         {"unittest-filter", required_argument, 0, 'U'},
         {"list-app-layer-protos", 0, &list_app_layer_protocols, 1},
+        {"applayer-bench", required_argument, 0, 0},
+        {"applayer-bench-ts", required_argument, 0, 0},
+        {"applayer-bench-tc", required_argument, 0, 0},
+        {"applayer-bench-chunk", required_argument, 0, 0},
+        {"applayer-bench-rounds", required_argument, 0, 0},
         {"list-unittests", 0, &list_unittests, 1},
         {"list-cuda-cards", 0, &list_cuda_cards, 1},
         {"list-runmodes", 0, &list_runmodes, 1},
@@ -1264,10 +1295,12 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
         {"init-errors-fatal", 0, 0, 0},
         {"disable-detection", 0, 0, 0},
         {"fatal-unittests", 0, 0, 0},
+        {"benchmarks", 0, 0, 0},
         {"unittests-coverage", 0, &coverage_unittests, 1},
         {"user", required_argument, 0, 0},
         {"group", required_argument, 0, 0},
         {"erf-in", required_argument, 0, 0},
+        {"synthetic", 0, 0, 0},
         {"dag", required_argument, 0, 0},
         {"napatech", 0, 0, 0},
         {"build-info", 0, &build_info, 1},
@@ -1585,6 +1618,23 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
                 }
             } else if (strcmp((long_opts[option_index]).name, "runmode") == 0) {
                 suri->runmode_custom_mode = optarg;
+            } else if (strncmp((long_opts[option_index]).name, "applayer-bench", 14) == 0) {
+                const char *name = (long_opts[option_index]).name;
+                const char *key = "applayer-bench.proto";
+                if (strcmp(name, "applayer-bench-ts") == 0)
+                    key = "applayer-bench.toserver";
+                else if (strcmp(name, "applayer-bench-tc") == 0)
+                    key = "applayer-bench.toclient";
+                else if (strcmp(name, "applayer-bench-chunk") == 0)
+                    key = "applayer-bench.chunk-size";
+                else if (strcmp(name, "applayer-bench-rounds") == 0)
+                    key = "applayer-bench.rounds";
+                else
+                    suri->run_mode = RUNMODE_APPLAYER_BENCH;
+                if (ConfSetFinal(key, optarg) != 1) {
+                    fprintf(stderr, "ERROR: Failed to set %s.\n", key);
+                    return TM_ECODE_FAILED;
+                }
             } else if(strcmp((long_opts[option_index]).name, "engine-analysis") == 0) {
                 // do nothing for now
             }
@@ -1615,6 +1665,22 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
 #else
                 fprintf(stderr, "ERROR: Unit tests not enabled. Make sure to pass --enable-unittests to configure when building.\n");
                 return TM_ECODE_FAILED;
+#endif /* UNITTESTS */
+            }
+            else if(strcmp((long_opts[option_index]).name, "benchmarks") == 0) {
+#ifdef UNITTESTS
+                if (suri->run_mode == RUNMODE_UNKNOWN) {
+                    suri->run_mode = RUNMODE_UNITTEST;
+                    unittests_benchmarks = 1;
+                } else {
+                    SCLogError(SC_ERR_MULTIPLE_RUN_MODE, "more than one run mode has"
+                                                         " been specified");
+                    usage(argv[0]);
+                    return TM_ECODE_FAILED;
+                }
+#else
+                fprintf(stderr, "ERROR: Unit tests not enabled. Make sure to pass --enable-unittests to configure when building.\n");
+                return TM_ECODE_FAILED;
 #endif /* UNITTESTS */
             }
             else if(strcmp((long_opts[option_index]).name, "user") == 0) {
@@ -1644,6 +1710,16 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
                     return TM_ECODE_FAILED;
                 }
             }
+            else if (strcmp((long_opts[option_index]).name, "synthetic") == 0) {
+                if (suri->run_mode == RUNMODE_UNKNOWN) {
+                    suri->run_mode = RUNMODE_SYNTHETIC;
+                } else {
+                    SCLogError(SC_ERR_MULTIPLE_RUN_MODE,
+                        "more than one run mode has been specified");
+                    usage(argv[0]);
+                    return TM_ECODE_FAILED;
+                }
+            }
             else if (strcmp((long_opts[option_index]).name, "dag") == 0) {
 #ifdef HAVE_DAG
                 if (suri->run_mode == RUNMODE_UNKNOWN) {
@@ -2143,7 +2219,9 @@ static int FinalizeRunMode(SCInstance *suri, char **argv)
     switch (suri->run_mode) {
         case RUNMODE_PCAP_FILE:
         case RUNMODE_ERF_FILE:
+        case RUNMODE_SYNTHETIC:
         case RUNMODE_ENGINE_ANALYSIS:
+        case RUNMODE_APPLAYER_BENCH:
             suri->offline = 1;
             break;
         case RUNMODE_UNKNOWN:
@@ -2197,6 +2275,9 @@ static int LoadSignatures(DetectEngineCtx *de_ctx, SCInstance *suri)
     }
 
     SCThresholdConfInitContext(de_ctx, NULL);
+
+    if (suri->run_mode != RUNMODE_ENGINE_ANALYSIS)
+        (void)DetectSelfTestRun(de_ctx, NULL);
     return TM_ECODE_OK;
 }
 
@@ -2265,6 +2346,13 @@ static int ConfigGetCaptureValue(SCInstance *suri)
 
     SCLogDebug("Default packet size set to %"PRIu32, default_packet_size);
 
+    int zero_copy = 0;
+#ifdef HAVE_AF_PACKET
+    if (suri->run_mode == RUNMODE_AFP_DEV)
+        zero_copy = AFPRunModeIsZeroCopy();
+#endif
+    PacketSetInlineSize(zero_copy);
+
     return TM_ECODE_OK;
 }
 /**
@@ -2282,6 +2370,9 @@ static int PostConfLoadedSetup(SCInstance *suri)
 #endif
     SpmTableSetup();
 
+    /* before any of the hashes using it are set up */
+    HashWordInitConfig();
+
     switch (suri->checksum_validation) {
         case 0:
             ConfSet("stream.checksum-validation", "0");
@@ -2364,6 +2455,9 @@ static int PostConfLoadedSetup(SCInstance *suri)
     StorageInit();
     CIDRInit();
     SigParsePrepare();
+    FpStatsSetup();
+    RuleGuardSetup();
+    DetectSelfTestSetup();
 #ifdef PROFILING
     if (suri->run_mode != RUNMODE_UNIX_SOCKET) {
         SCProfilingRulesGlobalInit();
@@ -2379,6 +2473,7 @@ static int PostConfLoadedSetup(SCInstance *suri)
     PacketAlertTagInit();
     ThresholdInit();
     HostBitInitCtx();
+    SCHInfoRegisterHostStorage();
     IPPairBitInitCtx();
 
     if (DetectAddressTestConfVars() < 0) {
@@ -2396,8 +2491,6 @@ static int PostConfLoadedSetup(SCInstance *suri)
 
     RegisterAllModules();
 
-    AppLayerHtpNeedFileInspection();
-
     DetectEngineRegisterAppInspectionEngines();
 
     StorageFinalize();
@@ -2448,6 +2541,8 @@ int main(int argc, char **argv)
     sc_set_caps = FALSE;
 
     SC_ATOMIC_INIT(engine_stage);
+    MemuseInit();
+    LockContentionInit();
 
     /* initialize the logging subsys */
     SCLogInitLogModule(NULL);
@@ -2532,9 +2627,20 @@ int main(int argc, char **argv)
 
     if (suri.run_mode != RUNMODE_UNIX_SOCKET) {
         FlowInitConfig(FLOW_VERBOSE);
+        FlowWorkerOverloadInitConfig();
+        FlowHeavyInitConfig();
         StreamTcpInitConfig(STREAM_VERBOSE);
         IPPairInitConfig(IPPAIR_VERBOSE);
         AppLayerRegisterGlobalCounters();
+        MemuseRegisterGlobalCounters();
+        LockContentionRegisterGlobalCounters();
+        HugepagesRegisterGlobalCounters();
+        FlowEmbryonicRegisterGlobalCounters();
+        DetectSelfTestRegisterGlobalCounters();
+    }
+
+    if (suri.run_mode == RUNMODE_APPLAYER_BENCH) {
+        exit(AppLayerParserBench() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
     }
 
     DetectEngineCtx *de_ctx = NULL;
@@ -2590,6 +2696,8 @@ int main(int argc, char **argv)
     if (suri.run_mode != RUNMODE_UNIX_SOCKET) {
         RunModeInitializeOutputs();
         StatsSetupPostConfig();
+        PacketLatencyInit();
+        AppLayerHtpPrintProfile();
     }
 
     if (suri.run_mode == RUNMODE_CONF_TEST){
@@ -2612,6 +2720,8 @@ int main(int argc, char **argv)
             UnixManagerRegisterCommand("iface-stat", LiveDeviceIfaceStat, NULL,
                                        UNIX_CMD_TAKE_ARGS);
             UnixManagerRegisterCommand("iface-list", LiveDeviceIfaceList, NULL, 0);
+            UnixManagerRegisterCommand("iface-set-workers", LiveDeviceIfaceSetWorkers,
+                                       NULL, UNIX_CMD_TAKE_ARGS);
 #endif
         }
         /* Spawn the flow manager thread */
@@ -2632,6 +2742,8 @@ int main(int argc, char **argv)
 
     /* Un-pause all the paused threads */
     TmThreadContinueThreads();
+    /* fill the rest of the spare queues now that capture runs */
+    PreallocStart();
     /* registering singal handlers we use.  We register usr2 here, so that one
      * can't call it during the first sig load phase or while threads are still
      * starting up. */
@@ -2735,6 +2847,7 @@ int main(int argc, char **argv)
 
     /* kill remaining threads */
     TmThreadKillThreads();
+    PreallocStop();
 
 
     if (suri.run_mode != RUNMODE_UNIX_SOCKET) {
@@ -2745,6 +2858,7 @@ int main(int argc, char **argv)
         StatsReleaseResources();
         IPPairShutdown();
         FlowShutdown();
+        FlowHeavyShutdown();
         StreamTcpFreeConfig(STREAM_VERBOSE);
     }
     HostShutdown();
@@ -2770,8 +2884,12 @@ int main(int argc, char **argv)
         DetectEngineDeReference(&de_ctx);
     }
     DetectEnginePruneFreeList();
+    DetectTenantShutdown();
+    DetectSelfTestShutdown();
+    DatasetsShutdown();
 
     AppLayerDeSetup();
+    FpStatsFree();
 
     TagDestroyCtx();
 
@@ -29,6 +29,7 @@
 #include "tm-queues.h"
 #include "counters.h"
 #include "threads.h"
+#include "util-latency.h"
 
 struct TmSlot_;
 
@@ -99,6 +100,21 @@ typedef struct ThreadVars_ {
 
     /** stream packet queue for flow time out injection */
     struct PacketQueue_ *stream_pq;
+    /** capture threads: the flow worker slot, stream_pq is its own
+     *  timeout queue then, see TmThreadsProcessTimeoutPackets() */
+    struct TmSlot_ *timeout_slot;
+    uint32_t timeout_batch;
+    uint16_t counter_timeout_deferred;
+    uint16_t counter_timeout_idle;
+
+    /** time spent waiting for packets on the inq, in usec */
+    uint16_t counter_wait_active;
+    uint16_t counter_wait_sleep;
+
+    /** capture threads: how full the capture ring is, in percent */
+    uint8_t capture_backlog;
+    /** load shedding level set by the flow worker, FLOW_WORKER_OVERLOAD_* */
+    uint8_t overload_level;
 
     uint8_t thread_setup_flags;
 
@@ -106,6 +122,14 @@ typedef struct ThreadVars_ {
     uint8_t type;
 
     uint16_t cpu_affinity; /** cpu or core number to set affinity to */
+    int numa_node; /** NUMA node of the cpu the thread is pinned to, -1 if unknown */
+    /** cpu the thread pinned itself to, plus one. 0 until known */
+    SC_ATOMIC_DECLARE(int, cpu);
+    /** pipelined workers: the stream thread feeding this detect thread */
+    struct ThreadVars_ *pipeline_peer;
+    /** offline mode: time of the last packet, sec << 20 | usec. Only
+     *  written by the thread itself, see TimeSetByThread() */
+    SC_ATOMIC_DECLARE(uint64_t, pkt_ts);
     uint16_t rank;
     int thread_priority; /** priority (real time) for this thread. Look at threads.h */
 
@@ -117,6 +141,9 @@ typedef struct ThreadVars_ {
     /** private counter store: counter updates modify this */
     StatsPrivateThreadContext perf_private_ctx;
 
+    /** sampled packet latency histograms */
+    PacketLatencyThread latency;
+
     SCCtrlMutex *ctrl_mutex;
     SCCtrlCondT *ctrl_cond;
 
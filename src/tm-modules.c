@@ -200,6 +200,8 @@ const char * TmModuleTmmIdToString(TmmId id)
 {
     switch (id) {
         CASE_CODE (TMM_FLOWWORKER);
+        CASE_CODE (TMM_FLOWWORKERSTREAM);
+        CASE_CODE (TMM_FLOWWORKERDETECT);
         CASE_CODE (TMM_RECEIVENFLOG);
         CASE_CODE (TMM_DECODENFLOG);
         CASE_CODE (TMM_DECODENFQ);
@@ -232,6 +234,8 @@ const char * TmModuleTmmIdToString(TmmId id)
         CASE_CODE (TMM_DECODEERFFILE);
         CASE_CODE (TMM_RECEIVEERFDAG);
         CASE_CODE (TMM_DECODEERFDAG);
+        CASE_CODE (TMM_RECEIVESYNTHETIC);
+        CASE_CODE (TMM_DECODESYNTHETIC);
         CASE_CODE (TMM_RECEIVEMPIPE);
         CASE_CODE (TMM_DECODEMPIPE);
         CASE_CODE (TMM_RECEIVENAPATECH);
@@ -263,6 +267,7 @@ const char * TmModuleTmmIdToString(TmmId id)
         CASE_CODE (TMM_DETECTLOADER);
         CASE_CODE (TMM_LUALOG);
         CASE_CODE (TMM_LOGSTATSLOG);
+        CASE_CODE (TMM_LOGPROMETHEUS);
         CASE_CODE (TMM_JSONTEMPLATELOG);
         CASE_CODE (TMM_RECEIVENETMAP);
         CASE_CODE (TMM_DECODENETMAP);
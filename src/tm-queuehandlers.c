@@ -36,10 +36,100 @@
 #include "tmqh-flow.h"
 #include "tmqh-ringbuffer.h"
 
+#include "tm-threads.h"
+#include "conf.h"
+#include "util-optimize.h"
+
+/** spin iterations before we start yielding in spin mode */
+#define TMQH_WAIT_SPIN_LOOPS    2000
+/** yields before we go to sleep in spin mode */
+#define TMQH_WAIT_YIELD_LOOPS   100
+/** poll iterations before we return to the thread loop in poll mode */
+#define TMQH_WAIT_POLL_LOOPS    10000
+
+TmqhWaitMode tmqh_wait_mode = TMQH_WAIT_CONDVAR;
+
+static void TmqhWaitSetup(void)
+{
+    char *mode = NULL;
+
+    if (ConfGet("threading.queue-wait", &mode) != 1 || mode == NULL)
+        return;
+
+    if (strcasecmp(mode, "condvar") == 0) {
+        tmqh_wait_mode = TMQH_WAIT_CONDVAR;
+    } else if (strcasecmp(mode, "spin") == 0) {
+        tmqh_wait_mode = TMQH_WAIT_SPIN;
+    } else if (strcasecmp(mode, "poll") == 0) {
+        tmqh_wait_mode = TMQH_WAIT_POLL;
+    } else {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid value \"%s\" for "
+                "threading.queue-wait, using condvar", mode);
+        return;
+    }
+    SCLogConfig("queue wait mode: %s", mode);
+}
+
+static uint64_t TmqhWaitElapsedUs(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000 +
+        (now.tv_usec - start->tv_usec);
+}
+
+/**
+ * \brief wait for packets without sleeping, as set by threading.queue-wait
+ *
+ * \param HasData callback checking the input queue of the thread
+ *
+ * \retval 1 data is available
+ * \retval 0 gave up: the caller should sleep (spin) or return to the
+ *           thread loop (poll)
+ */
+int TmqhWaitActive(ThreadVars *tv, int (*HasData)(ThreadVars *))
+{
+    struct timeval start;
+    uint32_t max = (tmqh_wait_mode == TMQH_WAIT_POLL) ? TMQH_WAIT_POLL_LOOPS :
+        TMQH_WAIT_SPIN_LOOPS + TMQH_WAIT_YIELD_LOOPS;
+    uint32_t i;
+    int r = 0;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < max; i++) {
+        if (HasData(tv)) {
+            r = 1;
+            break;
+        }
+        if (TmThreadsCheckFlag(tv, THV_KILL | THV_PAUSE))
+            break;
+
+        if (tmqh_wait_mode == TMQH_WAIT_SPIN && i >= TMQH_WAIT_SPIN_LOOPS)
+            sched_yield();
+        else
+            cpu_relax();
+    }
+    StatsAddUI64(tv, tv->counter_wait_active, TmqhWaitElapsedUs(&start));
+    return r;
+}
+
+/** \brief SCCondWait that accounts the time slept. Mutex must be held. */
+void TmqhWaitCond(ThreadVars *tv, SCCondT *cond, SCMutex *mutex)
+{
+    struct timeval start;
+
+    gettimeofday(&start, NULL);
+    SCCondWait(cond, mutex);
+    StatsAddUI64(tv, tv->counter_wait_sleep, TmqhWaitElapsedUs(&start));
+}
+
 void TmqhSetup (void)
 {
     memset(&tmqh_table, 0, sizeof(tmqh_table));
 
+    TmqhWaitSetup();
+
     TmqhSimpleRegister();
     TmqhNfqRegister();
     TmqhPacketpoolRegister();
@@ -51,6 +141,7 @@ void TmqhSetup (void)
 void TmqhCleanup(void)
 {
     TmqhRingBufferDestroy();
+    TmqhFlowDestroyRings();
 }
 
 Tmqh* TmqhGetQueueHandlerByName(char *name)
@@ -43,11 +43,24 @@ typedef struct Tmqh_ {
     void (*OutHandler)(ThreadVars *, Packet *);
     void *(*OutHandlerCtxSetup)(char *);
     void (*OutHandlerCtxFree)(void *);
+    void (*OutHandlerCtxRegisterCounters)(ThreadVars *, void *);
     void (*RegisterTests)(void);
 } Tmqh;
 
 Tmqh tmqh_table[TMQH_SIZE];
 
+/** how threads wait for packets on their input queue */
+typedef enum TmqhWaitMode_ {
+    TMQH_WAIT_CONDVAR = 0,  /**< sleep on the queue cond */
+    TMQH_WAIT_SPIN,         /**< spin, then yield, then sleep */
+    TMQH_WAIT_POLL,         /**< never sleep */
+} TmqhWaitMode;
+
+extern TmqhWaitMode tmqh_wait_mode;
+
+int TmqhWaitActive(ThreadVars *tv, int (*HasData)(ThreadVars *));
+void TmqhWaitCond(ThreadVars *tv, SCCondT *cond, SCMutex *mutex);
+
 void TmqhSetup (void);
 void TmqhCleanup(void);
 Tmqh* TmqhGetQueueHandlerByName(char *name);
@@ -32,6 +32,8 @@
  */
 typedef enum {
     TMM_FLOWWORKER,
+    TMM_FLOWWORKERSTREAM,
+    TMM_FLOWWORKERDETECT,
     TMM_DECODENFQ,
     TMM_VERDICTNFQ,
     TMM_RECEIVENFQ,
@@ -63,6 +65,8 @@ typedef enum {
     TMM_DECODEERFFILE,
     TMM_RECEIVEERFDAG,
     TMM_DECODEERFDAG,
+    TMM_RECEIVESYNTHETIC,
+    TMM_DECODESYNTHETIC,
     TMM_RECEIVEAFP,
     TMM_DECODEAFP,
     TMM_RECEIVENETMAP,
@@ -92,6 +96,7 @@ typedef enum {
     TMM_JSONFLOWLOG,
     TMM_JSONNETFLOWLOG,
     TMM_LOGSTATSLOG,
+    TMM_LOGPROMETHEUS,
     TMM_JSONTEMPLATELOG,
 
     TMM_FLOWMANAGER,
@@ -34,10 +34,14 @@
 #include "tm-queuehandlers.h"
 #include "tm-threads.h"
 #include "tmqh-packetpool.h"
+#include "tmqh-flow.h"
+#include "tmqh-ringbuffer.h"
+#include "flow-private.h"
 #include "threads.h"
 #include "util-debug.h"
 #include "util-privs.h"
 #include "util-cpu.h"
+#include "util-latency.h"
 #include "util-optimize.h"
 #include "util-profiling.h"
 #include "util-signal.h"
@@ -124,9 +128,13 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
     TmSlot *s;
     Packet *extra_p;
 
+    PACKET_LATENCY_SAMPLE(tv, p);
+    uint64_t output_ticks = 0;
+
     for (s = slot; s != NULL; s = s->slot_next) {
         TmSlotFunc SlotFunc = SC_ATOMIC_GET(s->SlotFunc);
         PACKET_PROFILING_TMM_START(p, s->tm_id);
+        uint64_t ticks = PACKET_LATENCY_TICKS(p);
 
         if (unlikely(s->id == 0)) {
             r = SlotFunc(tv, p, SC_ATOMIC_GET(s->slot_data), &s->slot_pre_pq, &s->slot_post_pq);
@@ -135,6 +143,15 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
         }
 
         PACKET_PROFILING_TMM_END(p, s->tm_id);
+        if (unlikely(ticks != 0)) {
+            /* the flow worker times its own stages */
+            if (tmm_modules[s->tm_id].flags & TM_FLAG_DECODE_TM) {
+                PACKET_LATENCY_END(tv, LATENCY_DECODE, ticks);
+            } else if (!(tmm_modules[s->tm_id].flags &
+                        (TM_FLAG_RECEIVE_TM|TM_FLAG_STREAM_TM|TM_FLAG_DETECT_TM))) {
+                output_ticks += UtilCpuGetTicks() - ticks;
+            }
+        }
 
         /* handle error */
         if (unlikely(r == TM_ECODE_FAILED)) {
@@ -174,9 +191,59 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
         }
     }
 
+    if (unlikely(p->latency_ticks != 0)) {
+        if (output_ticks != 0)
+            PacketLatencyAdd(tv, LATENCY_OUTPUT, output_ticks);
+        /* the packet is done when it goes back to the pool */
+        if (tv->tmqh_out == TmqhOutputPacketpool)
+            PACKET_LATENCY_END(tv, LATENCY_TOTAL, p->latency_ticks);
+    }
+
     return TM_ECODE_OK;
 }
 
+/**
+ *  \brief Process the queued flow timeout packets of a capture thread
+ *
+ *  The flow manager can time out many flows at once. Capture threads
+ *  queue these pseudo packets apart from the packets of the decoders, and
+ *  after each packet they handle at most 'flow.timeout-batch' of them so
+ *  the capture doesn't stall. The rest is handled when the capture is
+ *  idle, see TmThreadsCaptureInjectPacket().
+ *
+ *  \param max max packets to handle, 0 for all
+ */
+void TmThreadsProcessTimeoutPackets(ThreadVars *tv, uint32_t max)
+{
+    PacketQueue *pq = tv->stream_pq;
+    uint32_t cnt = 0;
+
+    while (max == 0 || cnt < max) {
+        SCMutexLock(&pq->mutex_q);
+        Packet *p = PacketDequeue(pq);
+        SCMutexUnlock(&pq->mutex_q);
+        if (p == NULL)
+            break;
+
+        cnt++;
+        if (TmThreadsSlotProcessPkt(tv, tv->timeout_slot, p) != TM_ECODE_OK)
+            break;
+    }
+
+    if (max == 0) {
+        StatsAddUI64(tv, tv->counter_timeout_idle, cnt);
+    } else if (pq->len != 0) {
+        StatsIncr(tv, tv->counter_timeout_deferred);
+    }
+}
+
+/** \internal
+ *  \brief check for the flow worker slot, pipelined or not */
+static inline int TmSlotIsFlowWorker(const TmSlot *s)
+{
+    return (s->tm_id == TMM_FLOWWORKER || s->tm_id == TMM_FLOWWORKERSTREAM);
+}
+
 /** \internal
  *
  *  \brief Process flow timeout packets
@@ -192,7 +259,7 @@ static int TmThreadTimeoutLoop(ThreadVars *tv, TmSlot *s)
     int r = TM_ECODE_OK;
 
     for (slot = s; slot != NULL; slot = slot->slot_next) {
-        if (slot->tm_id == TMM_FLOWWORKER)
+        if (TmSlotIsFlowWorker(slot))
         {
             stream_slot = slot;
             break;
@@ -315,18 +382,29 @@ void *TmThreadsSlotPktAcqLoop(void *td)
         SCMutexInit(&slot->slot_pre_pq.mutex_q, NULL);
         memset(&slot->slot_post_pq, 0, sizeof(PacketQueue));
         SCMutexInit(&slot->slot_post_pq.mutex_q, NULL);
+        memset(&slot->slot_timeout_pq, 0, sizeof(PacketQueue));
+        SCMutexInit(&slot->slot_timeout_pq.mutex_q, NULL);
 
-        /* get the 'pre qeueue' from module before the stream module */
-        if (slot->slot_next != NULL && (slot->slot_next->tm_id == TMM_FLOWWORKER)) {
-            SCLogDebug("pre-stream packetqueue %p (postq)", &s->slot_post_pq);
-            tv->stream_pq = &slot->slot_post_pq;
+        /* the flow timeout packets get a queue of their own in front
+         * of the flow worker, set up below */
+        if (slot->slot_next != NULL && TmSlotIsFlowWorker(slot->slot_next)) {
+            tv->timeout_slot = slot->slot_next;
         /* if the stream module is the first, get the threads input queue */
-        } else if (slot == (TmSlot *)tv->tm_slots && (slot->tm_id == TMM_FLOWWORKER)) {
+        } else if (slot == (TmSlot *)tv->tm_slots && TmSlotIsFlowWorker(slot)) {
             tv->stream_pq = &trans_q[tv->inq->id];
             SCLogDebug("pre-stream packetqueue %p (inq)", &slot->slot_pre_pq);
         }
     }
 
+    if (tv->timeout_slot != NULL) {
+        SCLogDebug("flow timeout packetqueue %p", &tv->timeout_slot->slot_timeout_pq);
+        tv->stream_pq = &tv->timeout_slot->slot_timeout_pq;
+        tv->timeout_batch = flow_config.timeout_batch;
+        tv->counter_timeout_deferred = StatsRegisterCounter("flow.timeout_deferred", tv);
+        tv->counter_timeout_idle = StatsRegisterCounter("flow.timeout_idle", tv);
+    }
+
+    PacketLatencyThreadInit(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -375,9 +453,11 @@ void *TmThreadsSlotPktAcqLoop(void *td)
 
         BUG_ON(slot->slot_pre_pq.len);
         BUG_ON(slot->slot_post_pq.len);
+        BUG_ON(slot->slot_timeout_pq.len);
     }
 
     tv->stream_pq = NULL;
+    tv->timeout_slot = NULL;
     SCLogDebug("%s ending", tv->name);
     TmThreadsSetFlag(tv, THV_CLOSED);
     pthread_exit((void *) 0);
@@ -385,6 +465,7 @@ void *TmThreadsSlotPktAcqLoop(void *td)
 
 error:
     tv->stream_pq = NULL;
+    tv->timeout_slot = NULL;
     pthread_exit((void *) -1);
     return NULL;
 }
@@ -441,16 +522,17 @@ void *TmThreadsSlotPktAcqLoopAFL(void *td)
         SCMutexInit(&slot->slot_post_pq.mutex_q, NULL);
 
         /* get the 'pre qeueue' from module before the stream module */
-        if (slot->slot_next != NULL && (slot->slot_next->tm_id == TMM_FLOWWORKER)) {
+        if (slot->slot_next != NULL && TmSlotIsFlowWorker(slot->slot_next)) {
             SCLogDebug("pre-stream packetqueue %p (postq)", &s->slot_post_pq);
             tv->stream_pq = &slot->slot_post_pq;
         /* if the stream module is the first, get the threads input queue */
-        } else if (slot == (TmSlot *)tv->tm_slots && (slot->tm_id == TMM_FLOWWORKER)) {
+        } else if (slot == (TmSlot *)tv->tm_slots && TmSlotIsFlowWorker(slot)) {
             tv->stream_pq = &trans_q[tv->inq->id];
             SCLogDebug("pre-stream packetqueue %p (inq)", &slot->slot_pre_pq);
         }
     }
 
+    PacketLatencyThreadInit(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -562,16 +644,17 @@ void *TmThreadsSlotVar(void *td)
          * from the flow timeout code */
 
         /* get the 'pre qeueue' from module before the stream module */
-        if (s->slot_next != NULL && (s->slot_next->tm_id == TMM_FLOWWORKER)) {
+        if (s->slot_next != NULL && TmSlotIsFlowWorker(s->slot_next)) {
             SCLogDebug("pre-stream packetqueue %p (preq)", &s->slot_pre_pq);
             tv->stream_pq = &s->slot_pre_pq;
         /* if the stream module is the first, get the threads input queue */
-        } else if (s == (TmSlot *)tv->tm_slots && (s->tm_id == TMM_FLOWWORKER)) {
+        } else if (s == (TmSlot *)tv->tm_slots && TmSlotIsFlowWorker(s)) {
             tv->stream_pq = &trans_q[tv->inq->id];
             SCLogDebug("pre-stream packetqueue %p (inq)", &s->slot_pre_pq);
         }
     }
 
+    PacketLatencyThreadInit(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -1095,6 +1178,8 @@ TmEcode TmThreadSetupOptions(ThreadVars *tv)
                   "%"PRIu16", thread id %lu", tv->name, tv->cpu_affinity,
                   SCGetThreadIdLong());
         SetCPUAffinity(tv->cpu_affinity);
+        SC_ATOMIC_SET(tv->cpu, tv->cpu_affinity + 1);
+        tv->numa_node = AffinityGetNumaNodeForCPU(tv->cpu_affinity);
     }
 
 #if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined sun
@@ -1103,8 +1188,21 @@ TmEcode TmThreadSetupOptions(ThreadVars *tv)
     if (tv->thread_setup_flags & THREAD_SET_AFFTYPE) {
         ThreadsAffinityType *taf = &thread_affinity[tv->cpu_affinity];
         if (taf->mode_flag == EXCLUSIVE_AFFINITY) {
-            int cpu = AffinityGetNextCPU(taf);
+            int cpu = -1;
+            /* pipelined detect thread: the hyperthread twin of its stream
+             * thread, so the two share the cache */
+            if (tv->pipeline_peer != NULL) {
+                int i;
+                for (i = 0; i < 1000 && SC_ATOMIC_GET(tv->pipeline_peer->cpu) == 0; i++)
+                    usleep(1000);
+                if (SC_ATOMIC_GET(tv->pipeline_peer->cpu) > 0)
+                    cpu = AffinityGetSiblingCPU(SC_ATOMIC_GET(tv->pipeline_peer->cpu) - 1);
+            }
+            if (cpu < 0)
+                cpu = AffinityGetNextCPU(taf);
             SetCPUAffinity(cpu);
+            SC_ATOMIC_SET(tv->cpu, cpu + 1);
+            tv->numa_node = AffinityGetNumaNodeForCPU(cpu);
             /* If CPU is in a set overwrite the default thread prio */
             if (CPU_ISSET(cpu, &taf->lowprio_cpu)) {
                 tv->thread_priority = PRIO_LOW;
@@ -1162,8 +1260,12 @@ ThreadVars *TmThreadCreate(const char *name, char *inq_name, char *inqh_name,
     if (unlikely(tv == NULL))
         goto error;
     memset(tv, 0, sizeof(ThreadVars));
+    tv->numa_node = -1;
 
     SC_ATOMIC_INIT(tv->flags);
+    SC_ATOMIC_INIT(tv->cpu);
+    SC_ATOMIC_INIT(tv->pkt_ts);
+    SC_ATOMIC_INIT(tv->perf_public_ctx.seq);
     SCMutexInit(&tv->perf_public_ctx.m, NULL);
 
     strlcpy(tv->name, name, sizeof(tv->name));
@@ -1200,6 +1302,11 @@ ThreadVars *TmThreadCreate(const char *name, char *inq_name, char *inqh_name,
         tv->tmqh_in = tmqh->InHandler;
         tv->InShutdownHandler = tmqh->InShutdownHandler;
         SCLogDebug("tv->tmqh_in %p", tv->tmqh_in);
+
+        if (tv->inq != NULL) {
+            tv->counter_wait_active = StatsRegisterCounter("queue.wait_active_us", tv);
+            tv->counter_wait_sleep = StatsRegisterCounter("queue.wait_sleep_us", tv);
+        }
     }
 
     /* set the outgoing queue */
@@ -1220,6 +1327,8 @@ ThreadVars *TmThreadCreate(const char *name, char *inq_name, char *inqh_name,
                 tv->outctx = tmqh->OutHandlerCtxSetup(outq_name);
                 if (tv->outctx == NULL)
                     goto error;
+                if (tmqh->OutHandlerCtxRegisterCounters != NULL)
+                    tmqh->OutHandlerCtxRegisterCounters(tv, tv->outctx);
                 tv->outq = NULL;
             } else {
                 tmq = TmqGetQueueByName(outq_name);
@@ -1475,7 +1584,8 @@ void TmThreadKillThread(ThreadVars *tv)
         if (!(strlen(tv->inq->name) == strlen("packetpool") &&
               strcasecmp(tv->inq->name, "packetpool") == 0)) {
             PacketQueue *q = &trans_q[tv->inq->id];
-            while (q->len != 0) {
+            while (q->len != 0 || TmqhFlowQueueHasPending(tv->inq->id) ||
+                TmqhRingBufferHasPending(tv->inq->id)) {
                 usleep(1000);
             }
         }
@@ -1586,7 +1696,8 @@ again:
                 if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                       strcasecmp(tv->inq->name, "packetpool") == 0)) {
                     PacketQueue *q = &trans_q[tv->inq->id];
-                    if (q->len != 0) {
+                    if (q->len != 0 || TmqhFlowQueueHasPending(tv->inq->id) ||
+                        TmqhRingBufferHasPending(tv->inq->id)) {
                         SCMutexUnlock(&tv_root_lock);
                         /* don't sleep while holding a lock */
                         usleep(1000);
@@ -1665,7 +1776,8 @@ again:
             if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                         strcasecmp(tv->inq->name, "packetpool") == 0)) {
                 PacketQueue *q = &trans_q[tv->inq->id];
-                if (q->len != 0) {
+                if (q->len != 0 || TmqhFlowQueueHasPending(tv->inq->id) ||
+                    TmqhRingBufferHasPending(tv->inq->id)) {
                     SCMutexUnlock(&tv_root_lock);
                     /* don't sleep while holding a lock */
                     usleep(1000);
@@ -2228,8 +2340,6 @@ typedef struct Thread_ {
     const char *name;
     int type;
     int in_use;         /**< bool to indicate this is in use */
-
-    struct timeval ts;  /**< current time of this thread (offline mode) */
 } Thread;
 
 typedef struct Threads_ {
@@ -2338,52 +2448,51 @@ end:
     SCMutexUnlock(&thread_store_lock);
 }
 
-void TmThreadsSetThreadTimestamp(const int id, const struct timeval *ts)
+/** usec take 20 bits of the packed timestamp */
+#define TS_USEC_BITS 20
+
+/**
+ *  \brief set the thread's packet time
+ *
+ *  Called for each packet by the thread itself, so it doesn't take the
+ *  thread store lock: the time is a single word in the ThreadVars.
+ */
+void TmThreadsSetThreadTimestamp(ThreadVars *tv, const struct timeval *ts)
 {
-    SCMutexLock(&thread_store_lock);
-    if (unlikely(id <= 0 || id > (int)thread_store.threads_size)) {
-        SCMutexUnlock(&thread_store_lock);
-        return;
-    }
+    uint64_t packed = ((uint64_t)ts->tv_sec << TS_USEC_BITS) |
+                      ((uint64_t)ts->tv_usec & ((1 << TS_USEC_BITS) - 1));
 
-    int idx = id - 1;
-    Thread *t = &thread_store.threads[idx];
-    t->ts.tv_sec = ts->tv_sec;
-    t->ts.tv_usec = ts->tv_usec;
-    SCMutexUnlock(&thread_store_lock);
+    if (SC_ATOMIC_GET(tv->pkt_ts) != packed)
+        SC_ATOMIC_SET(tv->pkt_ts, packed);
 }
 
-#define COPY_TIMESTAMP(src,dst) ((dst)->tv_sec = (src)->tv_sec, (dst)->tv_usec = (src)->tv_usec) // XXX unify with flow-util.h
+/**
+ *  \brief get the lowest packet time of the threads
+ *
+ *  Threads that didn't see a packet yet are skipped. The lock only
+ *  protects the thread store against threads coming and going.
+ */
 void TmreadsGetMinimalTimestamp(struct timeval *ts)
 {
-    struct timeval local, nullts;
-    memset(&local, 0, sizeof(local));
-    memset(&nullts, 0, sizeof(nullts));
-    int set = 0;
+    uint64_t min = 0;
     size_t s;
 
     SCMutexLock(&thread_store_lock);
     for (s = 0; s < thread_store.threads_size; s++) {
         Thread *t = &thread_store.threads[s];
-        if (t == NULL || t->in_use == 0)
+        if (t->in_use == 0)
             continue;
-        if (!(timercmp(&t->ts, &nullts, ==))) {
-            if (!set) {
-                local.tv_sec = t->ts.tv_sec;
-                local.tv_usec = t->ts.tv_usec;
-                set = 1;
-            } else {
-                if (timercmp(&t->ts, &local, <)) {
-                    COPY_TIMESTAMP(&t->ts, &local);
-                }
-            }
-        }
+        uint64_t cur = SC_ATOMIC_GET(t->tv->pkt_ts);
+        if (cur != 0 && (min == 0 || cur < min))
+            min = cur;
     }
     SCMutexUnlock(&thread_store_lock);
-    COPY_TIMESTAMP(&local, ts);
+
+    ts->tv_sec = (time_t)(min >> TS_USEC_BITS);
+    ts->tv_usec = (suseconds_t)(min & ((1 << TS_USEC_BITS) - 1));
     SCLogDebug("ts->tv_sec %u", (uint)ts->tv_sec);
 }
-#undef COPY_TIMESTAMP
+#undef TS_USEC_BITS
 
 /**
  *  \retval r 1 if packet was accepted, 0 otherwise
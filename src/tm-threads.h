@@ -62,6 +62,10 @@ typedef struct TmSlot_ {
      * locks in the queue are NOT used */
     PacketQueue slot_post_pq;
 
+    /* flow timeout pseudo packets for the flow worker of a
+     * capture thread. The locks in the queue are used */
+    PacketQueue slot_timeout_pq;
+
     /* store the thread module id */
     int tm_id;
 
@@ -127,6 +131,7 @@ void TmThreadsUnsetFlag(ThreadVars *, uint16_t);
 void TmThreadWaitForFlag(ThreadVars *, uint16_t);
 
 TmEcode TmThreadsSlotVarRun (ThreadVars *tv, Packet *p, TmSlot *slot);
+void TmThreadsProcessTimeoutPackets(ThreadVars *tv, uint32_t max);
 
 ThreadVars *TmThreadsGetTVContainingSlot(TmSlot *);
 void TmThreadDisablePacketThreads(void);
@@ -192,6 +197,13 @@ static inline TmEcode TmThreadsSlotProcessPkt(ThreadVars *tv, TmSlot *s, Packet
             } /* if (slot->slot_post_pq.top != NULL) */
             slot = slot->slot_next;
         } /* while (slot != NULL) */
+
+        /* a few of the flow timeout packets, the rest waits for
+         * the capture to be idle */
+        if (tv->timeout_slot != NULL && s != tv->timeout_slot &&
+                tv->stream_pq->len != 0) {
+            TmThreadsProcessTimeoutPackets(tv, tv->timeout_batch);
+        }
     }
 
     return r;
@@ -201,9 +213,13 @@ static inline TmEcode TmThreadsSlotProcessPkt(ThreadVars *tv, TmSlot *s, Packet
  *  Allow caller to supply their own packet
  *
  *  Meant for detect reload process that interupts an sleeping capture thread
- *  to force a packet through the engine to complete a reload */
+ *  to force a packet through the engine to complete a reload. Called when
+ *  the capture times out, so also handles all queued flow timeout packets. */
 static inline void TmThreadsCaptureInjectPacket(ThreadVars *tv, TmSlot *slot, Packet *p)
 {
+    if (tv->timeout_slot != NULL && tv->stream_pq->len != 0) {
+        TmThreadsProcessTimeoutPackets(tv, 0);
+    }
     if (TmThreadsCheckFlag(tv, THV_CAPTURE_INJECT_PKT)) {
         TmThreadsUnsetFlag(tv, THV_CAPTURE_INJECT_PKT);
         if (p == NULL)
@@ -222,7 +238,7 @@ int TmThreadsRegisterThread(ThreadVars *tv, const int type);
 void TmThreadsUnregisterThread(const int id);
 int TmThreadsInjectPacketsById(Packet **, int id);
 
-void TmThreadsSetThreadTimestamp(const int id, const struct timeval *ts);
+void TmThreadsSetThreadTimestamp(ThreadVars *tv, const struct timeval *ts);
 void TmreadsGetMinimalTimestamp(struct timeval *ts);
 
 #endif /* __TM_THREADS_H__ */
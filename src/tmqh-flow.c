@@ -38,12 +38,35 @@
 
 #include "conf.h"
 #include "util-unittest.h"
+#include "util-optimize.h"
+
+/** smallest ring we create, rings are 2^n sized */
+#define TMQH_FLOW_RING_MIN_SIZE     256
+/** publish the read index at least every this many packets */
+#define TMQH_FLOW_RING_BATCH        64
+
+extern intmax_t max_pending_packets;
+
+/** one reader per queue, indexed by queue id like trans_q */
+static TmqhFlowReader flow_readers[256];
+
+/** active-packets: flow hash buckets, 2^n */
+#define TMQH_FLOW_ASSIGN_SIZE       65536
+/** seconds a bucket has to be idle before it may move to another queue.
+ *  By then the old queue has long processed its packets, so this doesn't
+ *  reorder a flow. */
+#define TMQH_FLOW_ASSIGN_IDLE       2
+
+/** queue depth counter names, the stats api keeps the pointer */
+static char flow_depth_names[256][48];
 
 Packet *TmqhInputFlow(ThreadVars *t);
 void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
 void TmqhOutputFlowIPPair(ThreadVars *t, Packet *p);
+void TmqhOutputFlowActivePackets(ThreadVars *t, Packet *p);
 void *TmqhOutputFlowSetupCtx(char *queue_str);
 void TmqhOutputFlowFreeCtx(void *ctx);
+void TmqhOutputFlowRegisterCounters(ThreadVars *tv, void *ctx);
 void TmqhFlowRegisterTests(void);
 
 void TmqhFlowRegister(void)
@@ -52,6 +75,7 @@ void TmqhFlowRegister(void)
     tmqh_table[TMQH_FLOW].InHandler = TmqhInputFlow;
     tmqh_table[TMQH_FLOW].OutHandlerCtxSetup = TmqhOutputFlowSetupCtx;
     tmqh_table[TMQH_FLOW].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
+    tmqh_table[TMQH_FLOW].OutHandlerCtxRegisterCounters = TmqhOutputFlowRegisterCounters;
     tmqh_table[TMQH_FLOW].RegisterTests = TmqhFlowRegisterTests;
 
     char *scheduler = NULL;
@@ -60,8 +84,7 @@ void TmqhFlowRegister(void)
             SCLogNotice("using flow hash instead of round robin");
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
         } else if (strcasecmp(scheduler, "active-packets") == 0) {
-            SCLogNotice("using flow hash instead of active packets");
-            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
+            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowActivePackets;
         } else if (strcasecmp(scheduler, "hash") == 0) {
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
         } else if (strcasecmp(scheduler, "ippair") == 0) {
@@ -87,21 +110,204 @@ void TmqhFlowPrintAutofpHandler(void)
 
     PRINT_IF_FUNC(TmqhOutputFlowHash, "Hash");
     PRINT_IF_FUNC(TmqhOutputFlowIPPair, "IPPair");
+    PRINT_IF_FUNC(TmqhOutputFlowActivePackets, "ActivePackets");
 
 #undef PRINT_IF_FUNC
 }
 
-/* same as 'simple' */
-Packet *TmqhInputFlow(ThreadVars *tv)
+static TmqhFlowRing *TmqhFlowRingAlloc(void)
 {
-    PacketQueue *q = &trans_q[tv->inq->id];
+    uint32_t size = TMQH_FLOW_RING_MIN_SIZE;
 
-    StatsSyncCountersIfSignalled(tv);
+    /* a ring that can hold the writer's whole packet pool never fills
+     * up under normal operation */
+    while (size < (uint32_t)max_pending_packets)
+        size <<= 1;
+
+    TmqhFlowRing *ring = SCMallocAligned(sizeof(TmqhFlowRing), CLS);
+    if (unlikely(ring == NULL))
+        return NULL;
+    memset(ring, 0, sizeof(TmqhFlowRing));
+
+    ring->slots = SCCalloc(size, sizeof(Packet *));
+    if (unlikely(ring->slots == NULL)) {
+        SCFreeAligned(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+    return ring;
+}
+
+/** \brief register a new ring with the reader of queue 'qid' */
+static TmqhFlowRing *TmqhFlowRingRegister(uint16_t qid)
+{
+    TmqhFlowReader *reader = &flow_readers[qid];
+
+    TmqhFlowRing *ring = TmqhFlowRingAlloc();
+    if (ring == NULL)
+        return NULL;
+
+    TmqhFlowRing **ptmp = SCRealloc(reader->rings,
+            (reader->cnt + 1) * sizeof(TmqhFlowRing *));
+    if (ptmp == NULL) {
+        SCFree(ring->slots);
+        SCFreeAligned(ring);
+        return NULL;
+    }
+    reader->rings = ptmp;
+    reader->rings[reader->cnt++] = ring;
+    return ring;
+}
+
+/** \brief free all rings, called on shutdown when no thread uses them */
+void TmqhFlowDestroyRings(void)
+{
+    uint16_t i, r;
+
+    for (i = 0; i < 256; i++) {
+        TmqhFlowReader *reader = &flow_readers[i];
+        for (r = 0; r < reader->cnt; r++) {
+            SCFree(reader->rings[r]->slots);
+            SCFreeAligned(reader->rings[r]);
+        }
+        if (reader->rings != NULL)
+            SCFree(reader->rings);
+    }
+    memset(flow_readers, 0, sizeof(flow_readers));
+}
+
+/**
+ * \brief check if the rings of a queue still hold packets
+ *
+ * Used by the shutdown code to drain queues. Packets handed out of the
+ * current batch but not yet processed count as pending.
+ */
+int TmqhFlowQueueHasPending(uint16_t qid)
+{
+    TmqhFlowReader *reader = &flow_readers[qid];
+    uint16_t r;
+
+    for (r = 0; r < reader->cnt; r++) {
+        if (reader->rings[r]->write_idx != reader->rings[r]->read_idx)
+            return 1;
+    }
+    return 0;
+}
+
+/** \brief producer: add a packet to the ring and wake the reader if needed */
+static inline void TmqhFlowRingPut(TmqhFlowMode *m, Packet *p)
+{
+    TmqhFlowRing *ring = m->ring;
+    TmqhFlowReader *reader = m->reader;
+    PacketQueue *q = m->q;
+    uint32_t w = ring->write_idx;
+
+    if (unlikely(w - ring->read_cache > ring->mask)) {
+        ring->read_cache = ring->read_idx;
+        while (w - ring->read_cache > ring->mask) {
+            /* full: our packets are all queued at this reader. Make sure
+             * it's awake and wait for it to make room. */
+            SCMutexLock(&q->mutex_q);
+            SCCondSignal(&q->cond_q);
+            SCMutexUnlock(&q->mutex_q);
+            usleep(10);
+            ring->read_cache = ring->read_idx;
+        }
+    }
+
+    ring->slots[w & ring->mask] = p;
+    /* slot must be visible before the index */
+    hw_barrier();
+    ring->write_idx = w + 1;
+    /* pairs with the barrier after the reader sets 'sleeping' */
+    hw_barrier();
+
+    if (reader->sleeping) {
+        SCMutexLock(&q->mutex_q);
+        SCCondSignal(&q->cond_q);
+        SCMutexUnlock(&q->mutex_q);
+    }
+}
+
+/** \brief consumer: publish what we've taken and look for new packets
+ *  \retval 1 packets available
+ *  \retval 0 ring is empty */
+static inline int TmqhFlowRingRefill(TmqhFlowRing *ring)
+{
+    /* done reading the slots before handing them back */
+    hw_barrier();
+    ring->read_idx = ring->read_pos;
+    ring->write_cache = ring->write_idx;
+    /* read the slots only after the index */
+    hw_barrier();
+    return (ring->read_pos != ring->write_cache);
+}
+
+static inline Packet *TmqhFlowRingTake(TmqhFlowRing *ring)
+{
+    Packet *p = ring->slots[ring->read_pos & ring->mask];
+    ring->read_pos++;
+    if (ring->read_pos - ring->read_idx >= TMQH_FLOW_RING_BATCH) {
+        hw_barrier();
+        ring->read_idx = ring->read_pos;
+    }
+    return p;
+}
+
+/** \brief get the next packet from the rings of a reader
+ *
+ *  Takes from the current ring till its batch is exhausted, then moves
+ *  on to the next ring so a busy writer can't starve the others. */
+static Packet *TmqhFlowReaderGet(TmqhFlowReader *reader)
+{
+    TmqhFlowRing *ring = reader->rings[reader->cur];
+    uint16_t n;
+
+    if (ring->read_pos != ring->write_cache)
+        return TmqhFlowRingTake(ring);
+
+    /* batch done, hand its slots back before moving on */
+    hw_barrier();
+    ring->read_idx = ring->read_pos;
+
+    /* the current ring is checked last */
+    for (n = 1; n <= reader->cnt; n++) {
+        uint16_t idx = (reader->cur + n) % reader->cnt;
+        if (TmqhFlowRingRefill(reader->rings[idx])) {
+            reader->cur = idx;
+            return TmqhFlowRingTake(reader->rings[idx]);
+        }
+    }
+    return NULL;
+}
+
+static int TmqhFlowHasData(ThreadVars *tv)
+{
+    TmqhFlowReader *reader = &flow_readers[tv->inq->id];
+    uint16_t r;
+
+    if (trans_q[tv->inq->id].len > 0)
+        return 1;
+    for (r = 0; r < reader->cnt; r++) {
+        if (reader->rings[r]->write_idx != reader->rings[r]->read_pos)
+            return 1;
+    }
+    return 0;
+}
+
+/* same as 'simple' */
+static Packet *TmqhInputFlowQueue(ThreadVars *tv, PacketQueue *q)
+{
+    if (q->len == 0 && tmqh_wait_mode != TMQH_WAIT_CONDVAR) {
+        if (TmqhWaitActive(tv, TmqhFlowHasData) == 0 &&
+                tmqh_wait_mode == TMQH_WAIT_POLL)
+            return NULL;
+    }
 
     SCMutexLock(&q->mutex_q);
     if (q->len == 0) {
         /* if we have no packets in queue, wait... */
-        SCCondWait(&q->cond_q, &q->mutex_q);
+        TmqhWaitCond(tv, &q->cond_q, &q->mutex_q);
     }
 
     if (q->len > 0) {
@@ -115,6 +321,66 @@ Packet *TmqhInputFlow(ThreadVars *tv)
     }
 }
 
+/**
+ * \brief get a packet from the rings, or from the queue itself
+ *
+ * The PacketQueue only carries packets injected by other parts of the
+ * engine, like the flow manager's pseudo packets. When everything is
+ * empty we sleep on the queue cond. Writers only signal it when
+ * 'sleeping' is set, so there is no cond traffic while we're busy.
+ */
+Packet *TmqhInputFlow(ThreadVars *tv)
+{
+    PacketQueue *q = &trans_q[tv->inq->id];
+    TmqhFlowReader *reader = &flow_readers[tv->inq->id];
+    Packet *p;
+
+    StatsSyncCountersIfSignalled(tv);
+
+    if (reader->cnt == 0)
+        return TmqhInputFlowQueue(tv, q);
+
+    if (q->len > 0) {
+        SCMutexLock(&q->mutex_q);
+        p = PacketDequeue(q);
+        SCMutexUnlock(&q->mutex_q);
+        if (p != NULL)
+            return p;
+    }
+
+    p = TmqhFlowReaderGet(reader);
+    if (p != NULL)
+        return p;
+
+    if (tmqh_wait_mode != TMQH_WAIT_CONDVAR) {
+        if (TmqhWaitActive(tv, TmqhFlowHasData)) {
+            /* injected packets are picked up on the next call */
+            return TmqhFlowReaderGet(reader);
+        } else if (tmqh_wait_mode == TMQH_WAIT_POLL) {
+            return NULL;
+        }
+    }
+
+    SCMutexLock(&q->mutex_q);
+    reader->sleeping = 1;
+    /* pairs with the barrier in TmqhFlowRingPut: either the writer
+     * sees 'sleeping' or we see its packet */
+    hw_barrier();
+    p = TmqhFlowReaderGet(reader);
+    if (p == NULL && q->len == 0) {
+        TmqhWaitCond(tv, &q->cond_q, &q->mutex_q);
+    }
+    reader->sleeping = 0;
+    if (p == NULL && q->len > 0)
+        p = PacketDequeue(q);
+    SCMutexUnlock(&q->mutex_q);
+
+    if (p == NULL)
+        p = TmqhFlowReaderGet(reader);
+    /* NULL if we were woken up by a signal */
+    return p;
+}
+
 static int StoreQueueId(TmqhFlowCtx *ctx, char *name)
 {
     void *ptmp;
@@ -148,6 +414,12 @@ static int StoreQueueId(TmqhFlowCtx *ctx, char *name)
         memset(ctx->queues + (ctx->size - 1), 0, sizeof(TmqhFlowMode));
     }
     ctx->queues[ctx->size - 1].q = &trans_q[id];
+    snprintf(flow_depth_names[id], sizeof(flow_depth_names[id]),
+            "autofp.%s.depth", name);
+    ctx->queues[ctx->size - 1].reader = &flow_readers[id];
+    ctx->queues[ctx->size - 1].ring = TmqhFlowRingRegister(id);
+    if (ctx->queues[ctx->size - 1].ring == NULL)
+        return -1;
 
     return 0;
 }
@@ -199,6 +471,12 @@ void *TmqhOutputFlowSetupCtx(char *queue_str)
     } while (tstr != NULL);
 
     SCFree(str);
+
+    if (tmqh_table[TMQH_FLOW].OutHandler == TmqhOutputFlowActivePackets) {
+        ctx->assign = SCCalloc(TMQH_FLOW_ASSIGN_SIZE, sizeof(TmqhFlowAssign));
+        if (ctx->assign == NULL)
+            goto error;
+    }
     return (void *)ctx;
 
 error:
@@ -215,11 +493,29 @@ void TmqhOutputFlowFreeCtx(void *ctx)
     SCLogPerf("AutoFP - Total flow handler queues - %" PRIu16,
               fctx->size);
     SCFree(fctx->queues);
+    if (fctx->assign != NULL)
+        SCFree(fctx->assign);
     SCFree(fctx);
 
     return;
 }
 
+void TmqhOutputFlowRegisterCounters(ThreadVars *tv, void *ctx)
+{
+    TmqhFlowCtx *fctx = (TmqhFlowCtx *)ctx;
+    uint16_t i;
+
+    if (fctx->assign == NULL)
+        return;
+
+    fctx->counter_assigned = StatsRegisterCounter("autofp.flows_assigned", tv);
+    fctx->counter_imbalance = StatsRegisterCounter("autofp.queue_imbalance", tv);
+    for (i = 0; i < fctx->size; i++) {
+        uint16_t id = fctx->queues[i].q - trans_q;
+        fctx->queues[i].counter_depth = StatsRegisterCounter(flow_depth_names[id], tv);
+    }
+}
+
 void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
 {
     int16_t qid = 0;
@@ -236,11 +532,7 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
             ctx->last = 0;
     }
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
+    TmqhFlowRingPut(&ctx->queues[qid], p);
 
     return;
 }
@@ -271,15 +563,86 @@ void TmqhOutputFlowIPPair(ThreadVars *tv, Packet *p)
      * ctx->size will be lesser than 2 ** 31 for sure */
     qid = addr_hash % ctx->size;
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
+    TmqhFlowRingPut(&ctx->queues[qid], p);
 
     return;
 }
 
+/** \brief packets queued for the reader of a queue, from all writers */
+static inline uint32_t TmqhFlowQueueDepth(TmqhFlowMode *m)
+{
+    TmqhFlowReader *reader = m->reader;
+    uint32_t depth = m->q->len;
+    uint16_t r;
+
+    for (r = 0; r < reader->cnt; r++) {
+        depth += reader->rings[r]->write_idx - reader->rings[r]->read_idx;
+    }
+    return depth;
+}
+
+/** \brief pick the queue with the least packets pending
+ *
+ *  Counts from ctx->last on, so idle queues are used in turn. */
+static uint16_t TmqhFlowLeastLoaded(ThreadVars *tv, TmqhFlowCtx *ctx)
+{
+    uint32_t min = UINT32_MAX, max = 0;
+    uint16_t qid = ctx->last;
+    uint16_t i;
+
+    for (i = 0; i < ctx->size; i++) {
+        uint16_t idx = (ctx->last + i) % ctx->size;
+        uint32_t depth = TmqhFlowQueueDepth(&ctx->queues[idx]);
+
+        StatsSetUI64(tv, ctx->queues[idx].counter_depth, depth);
+        if (depth < min) {
+            min = depth;
+            qid = idx;
+        }
+        if (depth > max)
+            max = depth;
+    }
+    StatsSetUI64(tv, ctx->counter_imbalance, max - min);
+
+    ctx->last = (qid + 1) % ctx->size;
+    return qid;
+}
+
+/**
+ * \brief select the queue with the least unprocessed packets
+ *
+ * The choice is made when a flow hash bucket is first seen or has been
+ * idle, and is kept for the bucket after that so all packets of a flow
+ * go to the same queue. Elephant flows then get spread by load instead
+ * of by hash.
+ *
+ * \param tv thread vars.
+ * \param p packet.
+ */
+void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    uint16_t qid;
+
+    if ((p->flags & PKT_WANTS_FLOW) && ctx->assign != NULL) {
+        TmqhFlowAssign *a = &ctx->assign[p->flow_hash & (TMQH_FLOW_ASSIGN_SIZE - 1)];
+        uint32_t ts = (uint32_t)p->ts.tv_sec;
+
+        if (a->last_ts == 0 || ts - a->last_ts > TMQH_FLOW_ASSIGN_IDLE ||
+                a->qid >= ctx->size) {
+            a->qid = TmqhFlowLeastLoaded(tv, ctx);
+            StatsIncr(tv, ctx->counter_assigned);
+        }
+        /* 0 means unassigned */
+        a->last_ts = ts ? ts : 1;
+        qid = a->qid;
+    } else {
+        qid = TmqhFlowLeastLoaded(tv, ctx);
+    }
+
+    TmqhFlowRingPut(&ctx->queues[qid], p);
+}
+
 #ifdef UNITTESTS
 
 static int TmqhOutputFlowSetupCtxTest01(void)
@@ -331,6 +694,7 @@ end:
     if (fctx != NULL)
         TmqhOutputFlowFreeCtx(fctx);
     TmqResetQueues();
+    TmqhFlowDestroyRings();
     return retval;
 }
 
@@ -377,6 +741,7 @@ end:
     if (fctx != NULL)
         TmqhOutputFlowFreeCtx(fctx);
     TmqResetQueues();
+    TmqhFlowDestroyRings();
     return retval;
 }
 
@@ -415,9 +780,112 @@ end:
     if (fctx != NULL)
         TmqhOutputFlowFreeCtx(fctx);
     TmqResetQueues();
+    TmqhFlowDestroyRings();
     return retval;
 }
 
+/** \test two writers feeding one queue through their own rings */
+static int TmqhFlowRingTest01(void)
+{
+    Packet pkts[400];
+    int seen[400];
+    int i;
+
+    TmqResetQueues();
+    memset(seen, 0, sizeof(seen));
+
+    TmqhFlowCtx *ctx1 = TmqhOutputFlowSetupCtx("queue1");
+    FAIL_IF_NULL(ctx1);
+    TmqhFlowCtx *ctx2 = TmqhOutputFlowSetupCtx("queue1");
+    FAIL_IF_NULL(ctx2);
+    FAIL_IF(flow_readers[0].cnt != 2);
+    FAIL_IF(TmqhFlowQueueHasPending(0));
+
+    /* stay below the smallest ring size, we're the only reader */
+    for (i = 0; i < 200; i++) {
+        TmqhFlowRingPut(&ctx1->queues[0], &pkts[i]);
+        TmqhFlowRingPut(&ctx2->queues[0], &pkts[200 + i]);
+        if (i % 2 == 1) {
+            Packet *p = TmqhFlowReaderGet(&flow_readers[0]);
+            FAIL_IF_NULL(p);
+            seen[p - pkts]++;
+        }
+    }
+    FAIL_IF_NOT(TmqhFlowQueueHasPending(0));
+
+    Packet *p;
+    int last1 = -1, last2 = -1;
+    while ((p = TmqhFlowReaderGet(&flow_readers[0])) != NULL) {
+        int idx = p - pkts;
+        seen[idx]++;
+        /* each writer's packets come out in order */
+        if (idx < 200) {
+            FAIL_IF(idx < last1);
+            last1 = idx;
+        } else {
+            FAIL_IF(idx < last2);
+            last2 = idx;
+        }
+    }
+    for (i = 0; i < 400; i++)
+        FAIL_IF(seen[i] != 1);
+    FAIL_IF(TmqhFlowQueueHasPending(0));
+
+    TmqhOutputFlowFreeCtx(ctx1);
+    TmqhOutputFlowFreeCtx(ctx2);
+    TmqResetQueues();
+    TmqhFlowDestroyRings();
+    PASS;
+}
+
+/** \test active-packets: least loaded queue for new flows, sticky after */
+static int TmqhFlowActivePacketsTest01(void)
+{
+    ThreadVars tv;
+    Packet pkts[4];
+    void (*handler)(ThreadVars *, Packet *) = tmqh_table[TMQH_FLOW].OutHandler;
+
+    TmqResetQueues();
+    memset(&tv, 0, sizeof(tv));
+    memset(pkts, 0, sizeof(pkts));
+
+    tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowActivePackets;
+    TmqhFlowCtx *ctx = TmqhOutputFlowSetupCtx("queue1,queue2");
+    tmqh_table[TMQH_FLOW].OutHandler = handler;
+    FAIL_IF_NULL(ctx);
+    FAIL_IF_NULL(ctx->assign);
+    tv.outctx = ctx;
+
+    int i;
+    for (i = 0; i < 4; i++) {
+        pkts[i].flags = PKT_WANTS_FLOW;
+        pkts[i].ts.tv_sec = 10;
+    }
+    pkts[0].flow_hash = 1;
+    pkts[1].flow_hash = 2;
+    pkts[2].flow_hash = 1;
+    pkts[3].flow_hash = 1;
+    pkts[3].ts.tv_sec = 20;
+
+    /* both empty: first queue */
+    TmqhOutputFlowActivePackets(&tv, &pkts[0]);
+    FAIL_IF(TmqhFlowQueueDepth(&ctx->queues[0]) != 1);
+    /* new flow goes to the idle queue */
+    TmqhOutputFlowActivePackets(&tv, &pkts[1]);
+    FAIL_IF(TmqhFlowQueueDepth(&ctx->queues[1]) != 1);
+    /* same flow sticks to its queue */
+    TmqhOutputFlowActivePackets(&tv, &pkts[2]);
+    FAIL_IF(TmqhFlowQueueDepth(&ctx->queues[0]) != 2);
+    /* idle bucket is assigned again, by load */
+    TmqhOutputFlowActivePackets(&tv, &pkts[3]);
+    FAIL_IF(TmqhFlowQueueDepth(&ctx->queues[1]) != 2);
+
+    TmqhOutputFlowFreeCtx(ctx);
+    TmqResetQueues();
+    TmqhFlowDestroyRings();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void TmqhFlowRegisterTests(void)
@@ -429,6 +897,9 @@ void TmqhFlowRegisterTests(void)
                    TmqhOutputFlowSetupCtxTest02);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest03",
                    TmqhOutputFlowSetupCtxTest03);
+    UtRegisterTest("TmqhFlowRingTest01", TmqhFlowRingTest01);
+    UtRegisterTest("TmqhFlowActivePacketsTest01",
+                   TmqhFlowActivePacketsTest01);
 #endif
 
     return;
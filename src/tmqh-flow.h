@@ -24,10 +24,49 @@
 #ifndef __TMQH_FLOW_H__
 #define __TMQH_FLOW_H__
 
+/** \brief single producer, single consumer packet ring
+ *
+ *  Every (writer thread, queue) pair gets its own ring, so neither side
+ *  needs a lock. The producer and consumer indexes live on their own
+ *  cache lines. The consumer takes packets from a local position and only
+ *  publishes read_idx once per batch. */
+typedef struct TmqhFlowRing_ {
+    /* producer */
+    volatile uint32_t write_idx;
+    uint32_t read_cache;        /**< producer's copy of read_idx */
+
+    /* consumer */
+    volatile uint32_t read_idx __attribute__((aligned(CLS)));
+    uint32_t write_cache;       /**< consumer's copy of write_idx */
+    uint32_t read_pos;          /**< next slot to hand out */
+
+    uint32_t mask;
+    Packet **slots;
+} TmqhFlowRing;
+
+/** \brief consumer side of a flow queue: all rings feeding it */
+typedef struct TmqhFlowReader_ {
+    TmqhFlowRing **rings;
+    uint16_t cnt;
+    uint16_t cur;               /**< ring we're taking a batch from */
+    /** set while the reader waits on the queue cond */
+    volatile int sleeping;
+} TmqhFlowReader;
+
 typedef struct TmqhFlowMode_ {
     PacketQueue *q;
+    TmqhFlowRing *ring;
+    TmqhFlowReader *reader;
+
+    uint16_t counter_depth;
 } TmqhFlowMode;
 
+/** \brief sticky queue assignment for a flow hash bucket */
+typedef struct TmqhFlowAssign_ {
+    uint32_t last_ts;   /**< last packet seen, in seconds. 0: unassigned */
+    uint16_t qid;
+} TmqhFlowAssign;
+
 /** \brief Ctx for the flow queue handler
  *  \param size number of queues to output to
  *  \param queues array of queue id's this flow handler outputs to */
@@ -36,11 +75,18 @@ typedef struct TmqhFlowCtx_ {
     uint16_t last;
 
     TmqhFlowMode *queues;
+
+    /** active-packets: flow hash to queue assignments */
+    TmqhFlowAssign *assign;
+    uint16_t counter_assigned;
+    uint16_t counter_imbalance;
 } TmqhFlowCtx;
 
 void TmqhFlowRegister (void);
 void TmqhFlowRegisterTests(void);
 
 void TmqhFlowPrintAutofpHandler(void);
+int TmqhFlowQueueHasPending(uint16_t qid);
+void TmqhFlowDestroyRings(void);
 
 #endif /* __TMQH_FLOW_H__ */
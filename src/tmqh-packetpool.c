@@ -145,11 +145,43 @@ static int PacketPoolIsEmpty(PktPool *pool)
     return 1;
 }
 
+/** \brief hand a pending list back to its pool in one go */
+static void PacketPoolFlushPending(PktPoolPending *pend)
+{
+    PktPool *pool = pend->pool;
+
+    SCMutexLockCounted(&pool->return_stack.mutex, LOCK_CONTENTION_PACKET_POOL);
+    pend->tail->next = pool->return_stack.head;
+    pool->return_stack.head = pend->head;
+    SC_ATOMIC_RESET(pool->return_stack.sync_now);
+    SCMutexUnlock(&pool->return_stack.mutex);
+    SCCondSignal(&pool->return_stack.cond);
+
+    /* Clear the list of pending packets to return. */
+    pend->pool = NULL;
+    pend->head = NULL;
+    pend->tail = NULL;
+    pend->count = 0;
+}
+
+/** \brief return all pending packets before we go to sleep, so other
+ *         threads don't have to wait for us */
+static void PacketPoolFlushAllPending(PktPool *my_pool)
+{
+    int i;
+    for (i = 0; i < PKTPOOL_PENDING_POOLS; i++) {
+        if (my_pool->pending[i].pool != NULL)
+            PacketPoolFlushPending(&my_pool->pending[i]);
+    }
+}
+
 void PacketPoolWait(void)
 {
     PktPool *my_pool = GetThreadPacketPool();
 
     if (PacketPoolIsEmpty(my_pool)) {
+        PacketPoolFlushAllPending(my_pool);
+
         SCMutexLock(&my_pool->return_stack.mutex);
         SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
         SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
@@ -203,6 +235,7 @@ void PacketPoolWaitForN(int n)
 
         /* or signal that we need packets and wait */
         } else {
+            PacketPoolFlushAllPending(my_pool);
             SCMutexLock(&my_pool->return_stack.mutex);
             SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
             SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
@@ -227,7 +260,7 @@ static void PacketPoolStorePacket(Packet *p)
 
 static void PacketPoolGetReturnedPackets(PktPool *pool)
 {
-    SCMutexLock(&pool->return_stack.mutex);
+    SCMutexLockCounted(&pool->return_stack.mutex, LOCK_CONTENTION_PACKET_POOL);
     /* Move all the packets from the locked return stack to the local stack. */
     pool->head = pool->return_stack.head;
     pool->return_stack.head = NULL;
@@ -304,36 +337,41 @@ void PacketPoolReturnPacket(Packet *p)
         p->next = my_pool->head;
         my_pool->head = p;
     } else {
-        PktPool *pending_pool = my_pool->pending_pool;
-        if (pending_pool == NULL) {
-            /* No pending packet, so store the current packet. */
+        PktPoolPending *pend = NULL;
+        PktPoolPending *unused = NULL;
+        int i;
+
+        for (i = 0; i < PKTPOOL_PENDING_POOLS; i++) {
+            if (my_pool->pending[i].pool == pool) {
+                pend = &my_pool->pending[i];
+                break;
+            } else if (unused == NULL && my_pool->pending[i].pool == NULL) {
+                unused = &my_pool->pending[i];
+            }
+        }
+
+        if (pend == NULL && unused != NULL) {
+            /* No pending packet for this pool, so start a list. */
+            pend = unused;
             p->next = NULL;
-            my_pool->pending_pool = pool;
-            my_pool->pending_head = p;
-            my_pool->pending_tail = p;
-            my_pool->pending_count = 1;
-        } else if (pending_pool == pool) {
+            pend->pool = pool;
+            pend->head = p;
+            pend->tail = p;
+            pend->count = 1;
+            if (SC_ATOMIC_GET(pool->return_stack.sync_now))
+                PacketPoolFlushPending(pend);
+        } else if (pend != NULL) {
             /* Another packet for the pending pool list. */
-            p->next = my_pool->pending_head;
-            my_pool->pending_head = p;
-            my_pool->pending_count++;
-            if (SC_ATOMIC_GET(pool->return_stack.sync_now) || my_pool->pending_count > max_pending_return_packets) {
+            p->next = pend->head;
+            pend->head = p;
+            pend->count++;
+            if (SC_ATOMIC_GET(pool->return_stack.sync_now) || pend->count > max_pending_return_packets) {
                 /* Return the entire list of pending packets. */
-                SCMutexLock(&pool->return_stack.mutex);
-                my_pool->pending_tail->next = pool->return_stack.head;
-                pool->return_stack.head = my_pool->pending_head;
-                SC_ATOMIC_RESET(pool->return_stack.sync_now);
-                SCMutexUnlock(&pool->return_stack.mutex);
-                SCCondSignal(&pool->return_stack.cond);
-                /* Clear the list of pending packets to return. */
-                my_pool->pending_pool = NULL;
-                my_pool->pending_head = NULL;
-                my_pool->pending_tail = NULL;
-                my_pool->pending_count = 0;
+                PacketPoolFlushPending(pend);
             }
         } else {
             /* Push onto return stack for this pool */
-            SCMutexLock(&pool->return_stack.mutex);
+            SCMutexLockCounted(&pool->return_stack.mutex, LOCK_CONTENTION_PACKET_POOL);
             p->next = pool->return_stack.head;
             pool->return_stack.head = p;
             SC_ATOMIC_RESET(pool->return_stack.sync_now);
@@ -408,20 +446,25 @@ void PacketPoolDestroy(void)
     BUG_ON(my_pool->destroyed);
 #endif /* DEBUG_VALIDATION */
 
-    if (my_pool && my_pool->pending_pool != NULL) {
-        p = my_pool->pending_head;
+    int i;
+    for (i = 0; my_pool && i < PKTPOOL_PENDING_POOLS; i++) {
+        PktPoolPending *pend = &my_pool->pending[i];
+        if (pend->pool == NULL)
+            continue;
+
+        p = pend->head;
         while (p) {
             Packet *next_p = p->next;
             PacketFree(p);
             p = next_p;
-            my_pool->pending_count--;
+            pend->count--;
         }
 #ifdef DEBUG_VALIDATION
-        BUG_ON(my_pool->pending_count);
+        BUG_ON(pend->count);
 #endif /* DEBUG_VALIDATION */
-        my_pool->pending_pool = NULL;
-        my_pool->pending_head = NULL;
-        my_pool->pending_tail = NULL;
+        pend->pool = NULL;
+        pend->head = NULL;
+        pend->tail = NULL;
     }
 
     while ((p = PacketPoolGetPacket()) != NULL) {
@@ -37,20 +37,29 @@ typedef struct PktPoolLockedStack_{
     Packet *head;
 } __attribute__((aligned(CLS))) PktPoolLockedStack;
 
+/** number of foreign pools a thread batches returns for */
+#define PKTPOOL_PENDING_POOLS   8
+
+/* Packets waiting (pending) to be returned to the given Packet Pool.
+ * Accumulate packets for the same pool until a theshold is reached,
+ * then return them all at once. Keep the head and tail to fast
+ * insertion of the entire list onto a return stack.
+ */
+typedef struct PktPoolPending_ {
+    struct PktPool_ *pool;
+    Packet *head;
+    Packet *tail;
+    uint32_t count;
+} PktPoolPending;
+
 typedef struct PktPool_ {
     /* link listed of free packets local to this thread.
      * No mutex is needed.
      */
     Packet *head;
-    /* Packets waiting (pending) to be returned to the given Packet
-     * Pool. Accumulate packets for the same pool until a theshold is
-     * reached, then return them all at once.  Keep the head and tail
-     * to fast insertion of the entire list onto a return stack.
-     */
-    struct PktPool_ *pending_pool;
-    Packet *pending_head;
-    Packet *pending_tail;
-    uint32_t pending_count;
+    /* Packets of other pools waiting to be returned, one list per pool.
+     * In autofp a worker returns packets to every capture thread. */
+    PktPoolPending pending[PKTPOOL_PENDING_POOLS];
 
 #ifdef DEBUG_VALIDATION
     int initialized;
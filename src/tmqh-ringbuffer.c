@@ -30,6 +30,8 @@
 #include "threadvars.h"
 
 #include "tm-queuehandlers.h"
+#include "tmqh-packetpool.h"
+#include "tmqh-ringbuffer.h"
 
 #include "util-ringbuffer.h"
 
@@ -84,6 +86,17 @@ void TmqhRingBufferDestroy (void)
     }
 }
 
+/**
+ * \brief check if the ring of queue 'qid' still holds packets
+ * \retval 1 packets pending, 0 empty
+ */
+int TmqhRingBufferHasPending(uint16_t qid)
+{
+    RingBuffer8 *rb = ringbuffers[qid];
+
+    return (rb != NULL && !RingBuffer8IsEmpty(rb));
+}
+
 void TmqhInputRingBufferShutdownHandler(ThreadVars *tv)
 {
     if (tv == NULL || tv->inq == NULL) {
@@ -129,7 +142,9 @@ Packet *TmqhInputRingBufferSrSw(ThreadVars *t)
 void TmqhOutputRingBufferSrSw(ThreadVars *t, Packet *p)
 {
     RingBuffer8 *rb = ringbuffers[t->outq->id];
-    RingBufferSrSw8Put(rb, (void *)p);
+    /* the reader is gone, don't lose the packet */
+    if (RingBufferSrSw8Put(rb, (void *)p) != 0)
+        TmqhOutputPacketpool(t, p);
 }
 
 Packet *TmqhInputRingBufferSrMw(ThreadVars *t)
@@ -26,5 +26,6 @@
 
 void TmqhRingBufferRegister (void);
 void TmqhRingBufferDestroy (void);
+int TmqhRingBufferHasPending(uint16_t qid);
 
 #endif /* __TMQH_RINGBUFFER_H__ */
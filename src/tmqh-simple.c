@@ -30,6 +30,7 @@
 #include "threadvars.h"
 
 #include "tm-queuehandlers.h"
+#include "flow-hash.h"
 
 Packet *TmqhInputSimple(ThreadVars *t);
 void TmqhOutputSimple(ThreadVars *t, Packet *p);
@@ -43,21 +44,36 @@ void TmqhSimpleRegister (void)
     tmqh_table[TMQH_SIMPLE].OutHandler = TmqhOutputSimple;
 }
 
+static int TmqhSimpleHasData(ThreadVars *t)
+{
+    return (trans_q[t->inq->id].len > 0);
+}
+
 Packet *TmqhInputSimple(ThreadVars *t)
 {
     PacketQueue *q = &trans_q[t->inq->id];
 
     StatsSyncCountersIfSignalled(t);
 
+    if (q->len == 0 && tmqh_wait_mode != TMQH_WAIT_CONDVAR) {
+        if (TmqhWaitActive(t, TmqhSimpleHasData) == 0 &&
+                tmqh_wait_mode == TMQH_WAIT_POLL)
+            return NULL;
+    }
+
     SCMutexLock(&q->mutex_q);
 
     if (q->len == 0) {
         /* if we have no packets in queue, wait... */
-        SCCondWait(&q->cond_q, &q->mutex_q);
+        TmqhWaitCond(t, &q->cond_q, &q->mutex_q);
     }
 
     if (q->len > 0) {
         Packet *p = PacketDequeue(q);
+        /* start loading the flow bucket of the next packet while this
+         * one is processed */
+        if (q->bot != NULL && (q->bot->flags & PKT_WANTS_FLOW))
+            FlowPrefetchBucket(q->bot);
         SCMutexUnlock(&q->mutex_q);
         return p;
     } else {
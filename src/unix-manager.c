@@ -34,6 +34,10 @@
 #include "util-signal.h"
 
 #include "util-buffer.h"
+#include "util-profiling-sample.h"
+#include "util-memuse.h"
+#include "datasets.h"
+#include "flow-heavy.h"
 
 #include <sys/un.h>
 #include <sys/stat.h>
@@ -73,9 +77,30 @@ typedef struct Task_ {
 typedef struct UnixClient_ {
     int fd;
     MemBuffer *mbuf; /**< buffer for response construction */
+    /** 'subscribe-counters': seconds between updates, 0 if not subscribed */
+    uint32_t subscribe_interval;
+    time_t subscribe_next;
     TAILQ_ENTRY(UnixClient_) next;
 } UnixClient;
 
+enum UnixJobState {
+    UNIX_JOB_QUEUED = 0,
+    UNIX_JOB_RUNNING,
+    UNIX_JOB_DONE,
+};
+
+/** a command run with "async": true, see UnixJobSubmit() */
+typedef struct UnixJob_ {
+    uint32_t id;
+    enum UnixJobState state;
+    json_t *cmd;        /**< the command object, owned by the job */
+    json_t *answer;     /**< "return" and "message" once done */
+    TAILQ_ENTRY(UnixJob_) next;
+} UnixJob;
+
+/** finished jobs kept around for 'job-status' */
+#define UNIX_JOBS_KEEP_DONE 64
+
 typedef struct UnixCommand_ {
     time_t start_timestamp;
     int socket;
@@ -84,6 +109,23 @@ typedef struct UnixCommand_ {
     TAILQ_HEAD(, Command_) commands;
     TAILQ_HEAD(, Task_) tasks;
     TAILQ_HEAD(, UnixClient_) clients;
+
+    /** client of the command being run, NULL on the job thread */
+    UnixClient *client;
+    /** serialized counters, shared by the subscribed clients */
+    MemBuffer *subscribe_mbuf;
+    /** StatsTableUpdates() at the time subscribe_mbuf was filled */
+    uint64_t subscribe_updates;
+
+    /** jobs, in submission order. Protected by jobs_mutex. */
+    TAILQ_HEAD(, UnixJob_) jobs;
+    SCMutex jobs_mutex;
+    SCCondT jobs_cond;
+    uint32_t jobs_done;
+    uint32_t job_id;
+    int job_thread_running;
+    int job_thread_stop;
+    pthread_t job_thread;
 } UnixCommand;
 
 /**
@@ -107,6 +149,9 @@ int UnixNew(UnixCommand * this)
     TAILQ_INIT(&this->commands);
     TAILQ_INIT(&this->tasks);
     TAILQ_INIT(&this->clients);
+    TAILQ_INIT(&this->jobs);
+    SCMutexInit(&this->jobs_mutex, NULL);
+    SCCondInit(&this->jobs_cond, NULL);
 
     if (ConfGet("unix-command.filename", &socketname) == 1) {
         if (PathIsAbsolute(socketname)) {
@@ -238,6 +283,8 @@ static UnixClient *UnixClientAlloc(void)
         SCFree(uclient);
         return NULL;
     }
+    uclient->subscribe_interval = 0;
+    uclient->subscribe_next = 0;
     return uclient;
 }
 
@@ -435,78 +482,304 @@ int UnixCommandBackgroundTasks(UnixCommand* this)
     return ret;
 }
 
+static Command *UnixCommandLookup(UnixCommand *this, const char *name)
+{
+    Command *lcmd;
+
+    TAILQ_FOREACH(lcmd, &this->commands, next) {
+        if (!strcmp(name, lcmd->name))
+            return lcmd;
+    }
+    return NULL;
+}
+
+/**
+ * \brief Run a command object and fill in the answer
+ *
+ * \param this a UnixCommand:: structure
+ * \param jsoncmd the command object: "command" and "arguments"
+ * \param server_msg answer, gets "return" and usually "message"
+ *
+ * \retval 1 on success, 0 if the command failed, -1 if the command
+ *         object is invalid
+ */
+static int UnixCommandDispatch(UnixCommand *this, json_t *jsoncmd,
+                               json_t *server_msg)
+{
+    int ret = 1;
+    json_t *cmd = json_object_get(jsoncmd, "command");
+    if (!json_is_string(cmd)) {
+        SCLogInfo("error: command is not a string");
+        json_object_set_new(server_msg, "message", json_string("command is not a string"));
+        ret = -1;
+        goto end;
+    }
+
+    Command *lcmd = UnixCommandLookup(this, json_string_value(cmd));
+    if (lcmd == NULL) {
+        json_object_set_new(server_msg, "message", json_string("Unknown command"));
+        ret = 0;
+        goto end;
+    }
+
+    if (lcmd->flags & UNIX_CMD_TAKE_ARGS) {
+        cmd = json_object_get(jsoncmd, "arguments");
+        if (!json_is_object(cmd)) {
+            SCLogInfo("error: argument is not an object");
+            json_object_set_new(server_msg, "message", json_string("argument is not an object"));
+            ret = -1;
+            goto end;
+        }
+    }
+    if (lcmd->Func(cmd, server_msg, lcmd->data) != TM_ECODE_OK) {
+        ret = 0;
+    }
+
+end:
+    json_object_set_new(server_msg, "return", json_string(ret == 1 ? "OK" : "NOK"));
+    return ret;
+}
+
+/** \internal
+ *  \brief check that the command, or all commands of a batch, can run on
+ *         the job thread
+ */
+static int UnixCommandIsAsync(UnixCommand *this, json_t *jsoncmd)
+{
+    json_t *cmd = json_object_get(jsoncmd, "command");
+    if (!json_is_string(cmd))
+        return 0;
+
+    Command *lcmd = UnixCommandLookup(this, json_string_value(cmd));
+    if (lcmd == NULL || !(lcmd->flags & UNIX_CMD_ASYNC))
+        return 0;
+
+    if (strcmp(lcmd->name, "batch") == 0) {
+        json_t *jcmds = json_object_get(json_object_get(jsoncmd, "arguments"), "commands");
+        if (!json_is_array(jcmds))
+            return 0;
+
+        size_t i;
+        for (i = 0; i < json_array_size(jcmds); i++) {
+            if (!UnixCommandIsAsync(this, json_array_get(jcmds, i)))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static void *UnixJobThread(void *data)
+{
+    UnixCommand *this = (UnixCommand *)data;
+    UnixJob *job;
+
+    SCSetThreadName("UnixJobs");
+
+    SCMutexLock(&this->jobs_mutex);
+    while (!this->job_thread_stop) {
+        TAILQ_FOREACH(job, &this->jobs, next) {
+            if (job->state == UNIX_JOB_QUEUED)
+                break;
+        }
+        if (job == NULL) {
+            SCCondWait(&this->jobs_cond, &this->jobs_mutex);
+            continue;
+        }
+        job->state = UNIX_JOB_RUNNING;
+        SCMutexUnlock(&this->jobs_mutex);
+
+        /* the job's json objects are not touched by the unix manager
+         * thread until the job is done */
+        (void)UnixCommandDispatch(this, job->cmd, job->answer);
+
+        SCMutexLock(&this->jobs_mutex);
+        job->state = UNIX_JOB_DONE;
+        this->jobs_done++;
+    }
+    SCMutexUnlock(&this->jobs_mutex);
+    return NULL;
+}
+
+static void UnixJobFree(UnixJob *job)
+{
+    json_decref(job->cmd);
+    json_decref(job->answer);
+    SCFree(job);
+}
+
+/**
+ * \brief Queue a command for the job thread
+ *
+ * Commands marked UNIX_CMD_ASYNC, like rule reloads and tenant
+ * registrations, can take seconds. Sent with "async": true they are run
+ * one at a time on a separate thread, so that they don't block the
+ * other clients. The client gets a job id to pass to 'job-status'.
+ *
+ * \param jsoncmd the command, the job takes the reference
+ *
+ * \retval id job id, 0 on failure
+ */
+static uint32_t UnixJobSubmit(UnixCommand *this, json_t *jsoncmd)
+{
+    UnixJob *job = SCCalloc(1, sizeof(*job));
+    if (unlikely(job == NULL))
+        return 0;
+    job->answer = json_object();
+    if (job->answer == NULL) {
+        SCFree(job);
+        return 0;
+    }
+    job->cmd = jsoncmd;
+    job->state = UNIX_JOB_QUEUED;
+
+    SCMutexLock(&this->jobs_mutex);
+    if (!this->job_thread_running) {
+        this->job_thread_stop = 0;
+        if (pthread_create(&this->job_thread, NULL, UnixJobThread, this) != 0) {
+            SCMutexUnlock(&this->jobs_mutex);
+            SCLogError(SC_ERR_THREAD_CREATE, "unable to create the unix "
+                    "socket job thread: %s", strerror(errno));
+            json_decref(job->answer);
+            SCFree(job);
+            return 0;
+        }
+        this->job_thread_running = 1;
+    }
+
+    /* forget the oldest finished jobs */
+    UnixJob *ljob, *tjob;
+    TAILQ_FOREACH_SAFE(ljob, &this->jobs, next, tjob) {
+        if (this->jobs_done < UNIX_JOBS_KEEP_DONE)
+            break;
+        if (ljob->state == UNIX_JOB_DONE) {
+            TAILQ_REMOVE(&this->jobs, ljob, next);
+            UnixJobFree(ljob);
+            this->jobs_done--;
+        }
+    }
+
+    if (++this->job_id == 0)
+        this->job_id = 1;
+    job->id = this->job_id;
+    TAILQ_INSERT_TAIL(&this->jobs, job, next);
+    SCCondSignal(&this->jobs_cond);
+    SCMutexUnlock(&this->jobs_mutex);
+
+    return job->id;
+}
+
+/**
+ * \brief check if jobs are queued or running
+ *
+ * Jobs like tenant registrations load yaml, which isn't safe against
+ * other use of the config tree. So the config users of the unix manager
+ * thread (conf-get, the pcap-file background task) wait for the jobs.
+ */
+static int UnixJobsPending(UnixCommand *this)
+{
+    UnixJob *job;
+    int pending = 0;
+
+    SCMutexLock(&this->jobs_mutex);
+    TAILQ_FOREACH(job, &this->jobs, next) {
+        if (job->state != UNIX_JOB_DONE) {
+            pending = 1;
+            break;
+        }
+    }
+    SCMutexUnlock(&this->jobs_mutex);
+    return pending;
+}
+
+/**
+ * \brief Stop the job thread, waiting for the running job to finish,
+ *        and free the jobs
+ */
+static void UnixJobsShutdown(UnixCommand *this)
+{
+    UnixJob *job;
+
+    SCMutexLock(&this->jobs_mutex);
+    int running = this->job_thread_running;
+    this->job_thread_stop = 1;
+    SCCondSignal(&this->jobs_cond);
+    SCMutexUnlock(&this->jobs_mutex);
+
+    if (running) {
+        pthread_join(this->job_thread, NULL);
+        this->job_thread_running = 0;
+    }
+
+    while ((job = TAILQ_FIRST(&this->jobs)) != NULL) {
+        TAILQ_REMOVE(&this->jobs, job, next);
+        UnixJobFree(job);
+    }
+    this->jobs_done = 0;
+}
+
 /**
  * \brief Command dispatcher
  *
+ * The buffer can hold several commands back to back, they are run and
+ * answered in order.
+ *
  * \param this a UnixCommand:: structure
- * \param command a string containing a json formatted
- * command
+ * \param command json formatted command(s)
+ * \param len length of command
+ * \param used set to the number of bytes of the first command
  *
- * \retval 0 in case of error, 1 in case of success
+ * \retval 1 in case of success, 0 if the command failed, -1 in case of
+ *         error, the client is then closed
  */
-int UnixCommandExecute(UnixCommand * this, char *command, UnixClient *client)
+int UnixCommandExecute(UnixCommand * this, char *command, size_t len,
+                       size_t *used, UnixClient *client)
 {
     int ret = 1;
     json_error_t error;
     json_t *jsoncmd = NULL;
-    json_t *cmd = NULL;
     json_t *server_msg = json_object();
-    const char * value;
-    int found = 0;
-    Command *lcmd;
 
     if (server_msg == NULL) {
         return 0;
     }
 
-    jsoncmd = json_loads(command, 0, &error);
+    jsoncmd = json_loadb(command, len, JSON_DISABLE_EOF_CHECK, &error);
     if (jsoncmd == NULL) {
         SCLogInfo("Invalid command, error on line %d: %s\n", error.line, error.text);
         goto error;
     }
+    *used = error.position;
 
-    cmd = json_object_get(jsoncmd, "command");
-    if(!json_is_string(cmd)) {
-        SCLogInfo("error: command is not a string");
-        goto error_cmd;
-    }
-    value = json_string_value(cmd);
-
-    TAILQ_FOREACH(lcmd, &this->commands, next) {
-        if (!strcmp(value, lcmd->name)) {
-            int fret = TM_ECODE_OK;
-            found = 1;
-            if (lcmd->flags & UNIX_CMD_TAKE_ARGS) {
-                cmd = json_object_get(jsoncmd, "arguments");
-                if(!json_is_object(cmd)) {
-                    SCLogInfo("error: argument is not an object");
-                    goto error_cmd;
-                }
-            }
-            fret = lcmd->Func(cmd, server_msg, lcmd->data);
-            if (fret != TM_ECODE_OK) {
-                ret = 0;
+    if (json_is_true(json_object_get(jsoncmd, "async"))) {
+        uint32_t id = 0;
+        if (!UnixCommandIsAsync(this, jsoncmd)) {
+            json_object_set_new(server_msg, "message",
+                    json_string("command can't run asynchronously"));
+            ret = 0;
+        } else if ((id = UnixJobSubmit(this, jsoncmd)) == 0) {
+            json_object_set_new(server_msg, "message",
+                    json_string("unable to queue the command"));
+            ret = 0;
+        } else {
+            /* the job has the reference now */
+            jsoncmd = NULL;
+            json_t *jdata = json_object();
+            if (jdata != NULL) {
+                json_object_set_new(jdata, "job-id", json_integer(id));
+                json_object_set_new(server_msg, "message", jdata);
             }
-            break;
         }
-    }
-
-    if (found == 0) {
-        json_object_set_new(server_msg, "message", json_string("Unknown command"));
-        ret = 0;
-    }
-
-    switch (ret) {
-        case 0:
-            json_object_set_new(server_msg, "return", json_string("NOK"));
-            break;
-        case 1:
-            json_object_set_new(server_msg, "return", json_string("OK"));
-            break;
+        json_object_set_new(server_msg, "return", json_string(ret ? "OK" : "NOK"));
+    } else {
+        this->client = client;
+        ret = UnixCommandDispatch(this, jsoncmd, server_msg);
+        this->client = NULL;
+        if (ret == -1)
+            goto error_cmd;
     }
 
     if (UnixCommandSendJSONToClient(client, server_msg) != 0) {
-        goto error;
+        goto error_cmd;
     }
 
     json_decref(jsoncmd);
@@ -518,7 +791,7 @@ error_cmd:
 error:
     json_decref(server_msg);
     UnixCommandClose(this, client->fd);
-    return 0;
+    return -1;
 }
 
 void UnixCommandRun(UnixCommand * this, UnixClient *client)
@@ -540,9 +813,113 @@ void UnixCommandRun(UnixCommand * this, UnixClient *client)
         SCLogInfo("Command server: client command is too long, "
                   "disconnect him.");
         UnixCommandClose(this, client->fd);
+        return;
     }
     buffer[ret] = 0;
-    UnixCommandExecute(this, buffer, client);
+
+    /* pipelined commands: run them one after the other */
+    size_t offset = 0;
+    while (offset < (size_t)ret) {
+        while (offset < (size_t)ret && isspace((unsigned char)buffer[offset]))
+            offset++;
+        if (offset == (size_t)ret)
+            break;
+
+        size_t used = 0;
+        if (UnixCommandExecute(this, buffer + offset, ret - offset, &used, client) < 0) {
+            /* client was closed */
+            return;
+        }
+        if (used == 0)
+            break;
+        offset += used;
+    }
+}
+
+/** \internal
+ *  \brief serialize the counters for the subscribers, unless they
+ *         didn't change since the last time
+ *
+ *  \retval 0 on success, -1 on error
+ */
+static int UnixCommandSerializeCounters(UnixCommand *this)
+{
+    uint64_t updates = StatsTableUpdates();
+    if (this->subscribe_mbuf != NULL && MEMBUFFER_OFFSET(this->subscribe_mbuf) > 0 &&
+            this->subscribe_updates == updates) {
+        return 0;
+    }
+
+    if (this->subscribe_mbuf == NULL) {
+        this->subscribe_mbuf = MemBufferCreateNew(CLIENT_BUFFER_SIZE);
+        if (this->subscribe_mbuf == NULL)
+            return -1;
+    }
+
+    json_t *js = json_object();
+    if (js == NULL)
+        return -1;
+    TmEcode r = StatsOutputCounterSocket(NULL, js, NULL);
+    json_object_set_new(js, "return", json_string(r == TM_ECODE_OK ? "OK" : "NOK"));
+
+    MemBufferReset(this->subscribe_mbuf);
+    OutputJSONMemBufferWrapper wrapper = {
+        .buffer = &this->subscribe_mbuf,
+        .expand_by = CLIENT_BUFFER_SIZE
+    };
+    int ret = json_dump_callback(js, OutputJSONMemBufferCallback, &wrapper,
+            JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|
+            JSON_ESCAPE_SLASH);
+    json_decref(js);
+    /* one message per line */
+    if (ret != 0 || OutputJSONMemBufferCallback("\n", 1, &wrapper) != 0) {
+        MemBufferReset(this->subscribe_mbuf);
+        return -1;
+    }
+
+    this->subscribe_updates = updates;
+    return 0;
+}
+
+/**
+ * \brief Send the counters to the subscribed clients that are due
+ *
+ * The counters are serialized only when the stats were updated, however
+ * many clients subscribed. A client that doesn't keep up misses updates,
+ * it does not block the others.
+ */
+static void UnixCommandSubscriptions(UnixCommand *this)
+{
+    UnixClient *uclient;
+    UnixClient *tclient;
+    time_t now = time(NULL);
+    int serialized = 0;
+
+    TAILQ_FOREACH_SAFE(uclient, &this->clients, next, tclient) {
+        if (uclient->subscribe_interval == 0 || now < uclient->subscribe_next)
+            continue;
+        uclient->subscribe_next = now + uclient->subscribe_interval;
+
+        if (!serialized) {
+            if (UnixCommandSerializeCounters(this) != 0)
+                return;
+            serialized = 1;
+        }
+
+        size_t len = MEMBUFFER_OFFSET(this->subscribe_mbuf);
+        ssize_t r = send(uclient->fd, (const char *)MEMBUFFER_BUFFER(this->subscribe_mbuf),
+                len, MSG_NOSIGNAL|MSG_DONTWAIT);
+        if (r == (ssize_t)len)
+            continue;
+        if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            SCLogDebug("client socket %d is behind, skipping an update", uclient->fd);
+            continue;
+        }
+        /* error or partial message: the stream is unusable now */
+        SCLogInfo("Unix socket: closing counters subscriber: %s",
+                r == -1 ? strerror(errno) : "client too slow");
+        UnixCommandClose(this, uclient->fd);
+    }
 }
 
 /**
@@ -719,6 +1096,13 @@ TmEcode UnixManagerConfGetCommand(json_t *cmd,
 
     char *confval = NULL;
     char *variable = NULL;
+    UnixCommand *ucmd = (UnixCommand *)data;
+
+    if (UnixJobsPending(ucmd)) {
+        json_object_set_new(server_msg, "message",
+                json_string("configuration is being updated by a job, retry later"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
 
     json_t *jarg = json_object_get(cmd, "variable");
     if(!json_is_string(jarg)) {
@@ -776,6 +1160,173 @@ TmEcode UnixManagerListCommand(json_t *cmd,
     SCReturnInt(TM_ECODE_OK);
 }
 
+/**
+ * \brief 'batch' command: run a list of commands and answer with the
+ *        list of answers, in order
+ *
+ * { "command": "batch", "arguments": { "commands": [
+ *     { "command": "register-tenant", "arguments": { ... } }, ... ] } }
+ *
+ * Runs on the job thread if sent with "async" and all the commands allow
+ * it.
+ */
+TmEcode UnixManagerBatchCommand(json_t *cmd, json_t *answer, void *data)
+{
+    SCEnter();
+    UnixCommand *gcmd = (UnixCommand *) data;
+    int failed = 0;
+
+    json_t *jcmds = json_object_get(cmd, "commands");
+    if (!json_is_array(jcmds)) {
+        json_object_set_new(answer, "message", json_string("commands is not an array"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    json_t *jarray = json_array();
+    if (jarray == NULL) {
+        json_object_set_new(answer, "message",
+                            json_string("internal error at json object creation"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    size_t i;
+    for (i = 0; i < json_array_size(jcmds); i++) {
+        json_t *jcmd = json_array_get(jcmds, i);
+        json_t *jres = json_object();
+        if (jres == NULL) {
+            failed = 1;
+            break;
+        }
+
+        const char *name = json_string_value(json_object_get(jcmd, "command"));
+        if (name != NULL && strcmp(name, "batch") == 0) {
+            /* no nesting, keeps the async check simple */
+            json_object_set_new(jres, "message", json_string("batch can't be nested"));
+            json_object_set_new(jres, "return", json_string("NOK"));
+            failed = 1;
+        } else if (UnixCommandDispatch(gcmd, jcmd, jres) != 1) {
+            failed = 1;
+        }
+        json_array_append_new(jarray, jres);
+    }
+
+    json_object_set_new(answer, "message", jarray);
+    SCReturnInt(failed ? TM_ECODE_FAILED : TM_ECODE_OK);
+}
+
+static const char *UnixJobStateToString(enum UnixJobState state)
+{
+    switch (state) {
+        case UNIX_JOB_QUEUED:
+            return "queued";
+        case UNIX_JOB_RUNNING:
+            return "running";
+        case UNIX_JOB_DONE:
+            return "done";
+    }
+    return "unknown";
+}
+
+/**
+ * \brief 'job-status' command: state of an async command and, once it's
+ *        done, its answer
+ */
+TmEcode UnixManagerJobStatusCommand(json_t *cmd, json_t *answer, void *data)
+{
+    SCEnter();
+    UnixCommand *gcmd = (UnixCommand *) data;
+    UnixJob *job;
+
+    json_t *jarg = json_object_get(cmd, "job-id");
+    if (!json_is_integer(jarg)) {
+        json_object_set_new(answer, "message", json_string("job-id is not an integer"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    json_int_t id = json_integer_value(jarg);
+
+    json_t *jdata = json_object();
+    if (jdata == NULL) {
+        json_object_set_new(answer, "message",
+                            json_string("internal error at json object creation"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    SCMutexLock(&gcmd->jobs_mutex);
+    TAILQ_FOREACH(job, &gcmd->jobs, next) {
+        if (job->id == id)
+            break;
+    }
+    if (job != NULL) {
+        json_object_set_new(jdata, "job-id", json_integer(job->id));
+        /* a copy: the job thread may be using job->cmd */
+        json_object_set_new(jdata, "command",
+                json_string(json_string_value(json_object_get(job->cmd, "command"))));
+        json_object_set_new(jdata, "status", json_string(UnixJobStateToString(job->state)));
+        if (job->state == UNIX_JOB_DONE) {
+            json_object_set(jdata, "result", job->answer);
+        }
+    }
+    SCMutexUnlock(&gcmd->jobs_mutex);
+
+    if (job == NULL) {
+        json_decref(jdata);
+        json_object_set_new(answer, "message", json_string("no such job"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    json_object_set_new(answer, "message", jdata);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief 'subscribe-counters' command: push the 'dump-counters' answer
+ *        to this client every 'interval' seconds (default 1), one JSON
+ *        message per line. 'unsubscribe-counters' stops it.
+ */
+TmEcode UnixManagerSubscribeCountersCommand(json_t *cmd, json_t *answer, void *data)
+{
+    SCEnter();
+    UnixCommand *gcmd = (UnixCommand *) data;
+    json_int_t interval = 1;
+
+    if (gcmd->client == NULL) {
+        json_object_set_new(answer, "message", json_string("no client"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    json_t *jarg = json_object_get(cmd, "interval");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) <= 0 ||
+                json_integer_value(jarg) > 86400) {
+            json_object_set_new(answer, "message",
+                    json_string("interval must be 1 to 86400 seconds"));
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        interval = json_integer_value(jarg);
+    }
+
+    gcmd->client->subscribe_interval = (uint32_t)interval;
+    /* first update on the next round */
+    gcmd->client->subscribe_next = 0;
+
+    json_object_set_new(answer, "message", json_string("subscribed"));
+    SCReturnInt(TM_ECODE_OK);
+}
+
+TmEcode UnixManagerUnsubscribeCountersCommand(json_t *cmd, json_t *answer, void *data)
+{
+    SCEnter();
+    UnixCommand *gcmd = (UnixCommand *) data;
+
+    if (gcmd->client == NULL) {
+        json_object_set_new(answer, "message", json_string("no client"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    gcmd->client->subscribe_interval = 0;
+
+    json_object_set_new(answer, "message", json_string("unsubscribed"));
+    SCReturnInt(TM_ECODE_OK);
+}
 
 #if 0
 TmEcode UnixManagerReloadRules(json_t *cmd,
@@ -929,12 +1480,20 @@ static TmEcode UnixManagerThreadInit(ThreadVars *t, void *initdata, void **data)
     UnixManagerRegisterCommand("capture-mode", UnixManagerCaptureModeCommand, &command, 0);
     UnixManagerRegisterCommand("conf-get", UnixManagerConfGetCommand, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("dump-counters", StatsOutputCounterSocket, NULL, 0);
-    UnixManagerRegisterCommand("reload-rules", UnixManagerReloadRules, NULL, 0);
-    UnixManagerRegisterCommand("register-tenant-handler", UnixSocketRegisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS);
-    UnixManagerRegisterCommand("unregister-tenant-handler", UnixSocketUnregisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS);
-    UnixManagerRegisterCommand("register-tenant", UnixSocketRegisterTenant, &command, UNIX_CMD_TAKE_ARGS);
-    UnixManagerRegisterCommand("reload-tenant", UnixSocketReloadTenant, &command, UNIX_CMD_TAKE_ARGS);
-    UnixManagerRegisterCommand("unregister-tenant", UnixSocketUnregisterTenant, &command, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("rule-profiling", RuleSampleCommand, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("memory-usage", MemuseCommand, NULL, 0);
+    UnixManagerRegisterCommand("heavy-hitters", FlowHeavyCommand, NULL, 0);
+    UnixManagerRegisterCommand("dataset-reload", DatasetReloadCommand, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("reload-rules", UnixManagerReloadRules, NULL, UNIX_CMD_ASYNC);
+    UnixManagerRegisterCommand("register-tenant-handler", UnixSocketRegisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS|UNIX_CMD_ASYNC);
+    UnixManagerRegisterCommand("unregister-tenant-handler", UnixSocketUnregisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS|UNIX_CMD_ASYNC);
+    UnixManagerRegisterCommand("register-tenant", UnixSocketRegisterTenant, &command, UNIX_CMD_TAKE_ARGS|UNIX_CMD_ASYNC);
+    UnixManagerRegisterCommand("reload-tenant", UnixSocketReloadTenant, &command, UNIX_CMD_TAKE_ARGS|UNIX_CMD_ASYNC);
+    UnixManagerRegisterCommand("unregister-tenant", UnixSocketUnregisterTenant, &command, UNIX_CMD_TAKE_ARGS|UNIX_CMD_ASYNC);
+    UnixManagerRegisterCommand("batch", UnixManagerBatchCommand, &command, UNIX_CMD_TAKE_ARGS|UNIX_CMD_ASYNC);
+    UnixManagerRegisterCommand("job-status", UnixManagerJobStatusCommand, &command, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("subscribe-counters", UnixManagerSubscribeCountersCommand, &command, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("unsubscribe-counters", UnixManagerUnsubscribeCountersCommand, &command, 0);
 
     *data = utd;
     return TM_ECODE_OK;
@@ -973,11 +1532,18 @@ static TmEcode UnixManager(ThreadVars *th_v, void *thread_data)
                 close(item->fd);
                 SCFree(item);
             }
+            UnixJobsShutdown(&command);
+            if (command.subscribe_mbuf != NULL) {
+                MemBufferFree(command.subscribe_mbuf);
+                command.subscribe_mbuf = NULL;
+            }
             StatsSyncCounters(th_v);
             break;
         }
 
-        UnixCommandBackgroundTasks(&command);
+        if (!UnixJobsPending(&command))
+            UnixCommandBackgroundTasks(&command);
+        UnixCommandSubscriptions(&command);
     }
     return TM_ECODE_OK;
 }
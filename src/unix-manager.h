@@ -29,6 +29,8 @@
 #endif
 
 #define UNIX_CMD_TAKE_ARGS 1
+/** command can run on the job thread, see UnixJobSubmit() */
+#define UNIX_CMD_ASYNC     2
 
 SCCtrlCondT unix_manager_ctrl_cond;
 SCCtrlMutex unix_manager_ctrl_mutex;
@@ -30,6 +30,8 @@
 #include "threads.h"
 #include "queue.h"
 #include "runmodes.h"
+#include "util-device.h"
+#include "util-unittest.h"
 
 ThreadsAffinityType thread_affinity[MAX_CPU_SET] = {
     {
@@ -308,3 +310,344 @@ int AffinityGetNextCPU(ThreadsAffinityType *taf)
 #endif /* OS_WIN32 and __OpenBSD__ */
     return ncpu;
 }
+
+#define NUMA_SYSFS_NODE_PATH "/sys/devices/system/node"
+
+/**
+ * \brief Get the number of NUMA nodes
+ * \retval cnt number of nodes, 1 if it can't be determined
+ */
+int AffinityGetNumaNodeCount(void)
+{
+    char path[PATH_MAX];
+    int cnt = 0;
+
+    while (1) {
+        snprintf(path, sizeof(path), NUMA_SYSFS_NODE_PATH "/node%d", cnt);
+        if (access(path, F_OK) != 0)
+            break;
+        cnt++;
+    }
+
+    return cnt > 0 ? cnt : 1;
+}
+
+/**
+ * \brief Get the NUMA node a cpu belongs to
+ * \retval node the node id or -1 if it can't be determined
+ */
+int AffinityGetNumaNodeForCPU(int cpu)
+{
+    char path[PATH_MAX];
+    int node;
+
+    for (node = 0; ; node++) {
+        snprintf(path, sizeof(path), NUMA_SYSFS_NODE_PATH "/node%d", node);
+        if (access(path, F_OK) != 0)
+            break;
+
+        snprintf(path, sizeof(path), NUMA_SYSFS_NODE_PATH "/node%d/cpu%d",
+                node, cpu);
+        if (access(path, F_OK) == 0)
+            return node;
+    }
+
+    return -1;
+}
+
+#if defined __linux__
+#define CPU_SYSFS_PATH "/sys/devices/system/cpu"
+
+/** \internal
+ *  \brief parse a kernel cpu list like "0-3,8,10-11" into 'set'
+ *  \retval 0 on success, -1 on a malformed list
+ */
+static int AffinityParseCpuList(const char *str, cpu_set_t *set)
+{
+    const char *s = str;
+
+    CPU_ZERO(set);
+    while (*s != '\0' && *s != '\n') {
+        char *end;
+        long a = strtol(s, &end, 10);
+        long b = a;
+        if (end == s || a < 0)
+            return -1;
+        s = end;
+        if (*s == '-') {
+            s++;
+            b = strtol(s, &end, 10);
+            if (end == s || b < a)
+                return -1;
+            s = end;
+        }
+        if (b >= CPU_SETSIZE)
+            return -1;
+        for ( ; a <= b; a++)
+            CPU_SET(a, set);
+        if (*s == ',')
+            s++;
+        else if (*s != '\0' && *s != '\n')
+            return -1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief write 'set' as a cpu list like "0-3,8" to 'buf'
+ */
+static void AffinityCpusetToString(const cpu_set_t *set, int ncpu,
+        char *buf, size_t size)
+{
+    int cpu = 0;
+    size_t off = 0;
+
+    buf[0] = '\0';
+    while (cpu < ncpu && off < size) {
+        if (!CPU_ISSET(cpu, set)) {
+            cpu++;
+            continue;
+        }
+        int start = cpu;
+        while (cpu + 1 < ncpu && CPU_ISSET(cpu + 1, set))
+            cpu++;
+        int r;
+        if (start == cpu)
+            r = snprintf(buf + off, size - off, "%s%d", off ? "," : "", start);
+        else
+            r = snprintf(buf + off, size - off, "%s%d-%d", off ? "," : "",
+                    start, cpu);
+        if (r < 0)
+            break;
+        off += r;
+        cpu++;
+    }
+}
+
+static int AffinityReadCpuList(const char *path, cpu_set_t *set)
+{
+    char line[1024];
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    char *r = fgets(line, sizeof(line), fp);
+    fclose(fp);
+    if (r == NULL)
+        return -1;
+
+    return AffinityParseCpuList(line, set);
+}
+
+/** \internal
+ *  \brief check if 'cpu' is the first hyperthread of its core
+ */
+static int AffinityIsFirstSibling(int cpu)
+{
+    char path[PATH_MAX];
+    cpu_set_t siblings;
+    int i;
+
+    snprintf(path, sizeof(path),
+            CPU_SYSFS_PATH "/cpu%d/topology/thread_siblings_list", cpu);
+    if (AffinityReadCpuList(path, &siblings) != 0)
+        return 1;
+
+    for (i = 0; i < cpu; i++) {
+        if (CPU_ISSET(i, &siblings))
+            return 0;
+    }
+    return 1;
+}
+
+/** \internal
+ *  \brief get the NUMA node of a network interface
+ *  \retval node the node id or -1 if it can't be determined
+ */
+static int AffinityGetNumaNodeForDevice(const char *dev)
+{
+    char path[PATH_MAX];
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", dev);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    if (fscanf(fp, "%d", &node) != 1)
+        node = -1;
+    fclose(fp);
+    return node;
+}
+
+static int AffinityCpusetCount(const cpu_set_t *set, int ncpu)
+{
+    int cpu, cnt = 0;
+
+    for (cpu = 0; cpu < ncpu; cpu++) {
+        if (CPU_ISSET(cpu, set))
+            cnt++;
+    }
+    return cnt;
+}
+
+static void AffinitySetupAutoSet(int type, const cpu_set_t *set, uint8_t mode)
+{
+    ThreadsAffinityType *taf = &thread_affinity[type];
+
+    memcpy(&taf->cpu_set, set, sizeof(taf->cpu_set));
+    CPU_ZERO(&taf->lowprio_cpu);
+    CPU_ZERO(&taf->medprio_cpu);
+    CPU_ZERO(&taf->hiprio_cpu);
+    taf->mode_flag = mode;
+}
+#endif /* __linux__ */
+
+/**
+ * \brief Build the cpu affinity from the topology of the system
+ *
+ * Management threads go to the first core and its hyperthread
+ * siblings. Receive, worker and verdict threads go to the other cores,
+ * one hyperthread per core, on the NUMA nodes of the capture interfaces
+ * if those are known. The 'cpu-affinity' sets of the config are not
+ * used. The layout is logged.
+ */
+void AffinitySetupAuto(void)
+{
+#if defined __linux__
+    int ncpu = UtilCpuGetNumProcessorsOnline();
+    uint64_t nic_nodes = 0;
+    cpu_set_t housekeeping, workers;
+    char buf[256];
+    int cpu, i;
+
+    if (thread_affinity_init_done == 0) {
+        AffinitySetupInit();
+        thread_affinity_init_done = 1;
+    }
+
+    if (ConfGetNode("threading.cpu-affinity") != NULL) {
+        SCLogConfig("cpu-affinity: auto, ignoring the cpu-affinity sets");
+    }
+    if (ncpu <= 1 || ncpu > CPU_SETSIZE) {
+        SCLogConfig("cpu-affinity: auto, %d cpu(s), using all cpus for "
+                "all threads", ncpu);
+        return;
+    }
+
+    CPU_ZERO(&housekeeping);
+    if (AffinityReadCpuList(CPU_SYSFS_PATH "/cpu0/topology/thread_siblings_list",
+                &housekeeping) != 0 || !CPU_ISSET(0, &housekeeping)) {
+        CPU_ZERO(&housekeeping);
+        CPU_SET(0, &housekeeping);
+    }
+
+    int ndev = LiveGetDeviceCount();
+    for (i = 0; i < ndev; i++) {
+        const char *dev = LiveGetDeviceName(i);
+        if (dev == NULL)
+            continue;
+        int node = AffinityGetNumaNodeForDevice(dev);
+        if (node >= 0 && node < 64) {
+            nic_nodes |= (1ULL << node);
+            SCLogConfig("cpu-affinity: auto, interface %s is on numa node %d",
+                    dev, node);
+        }
+    }
+
+    CPU_ZERO(&workers);
+    for (cpu = 0; cpu < ncpu; cpu++) {
+        if (CPU_ISSET(cpu, &housekeeping) || !AffinityIsFirstSibling(cpu))
+            continue;
+        if (nic_nodes != 0) {
+            int node = AffinityGetNumaNodeForCPU(cpu);
+            if (node >= 0 && node < 64 && !(nic_nodes & (1ULL << node)))
+                continue;
+        }
+        CPU_SET(cpu, &workers);
+    }
+    /* small boxes: give up on the siblings, then on the housekeeping */
+    if (AffinityCpusetCount(&workers, ncpu) == 0) {
+        for (cpu = 0; cpu < ncpu; cpu++) {
+            if (!CPU_ISSET(cpu, &housekeeping))
+                CPU_SET(cpu, &workers);
+        }
+    }
+    if (AffinityCpusetCount(&workers, ncpu) == 0) {
+        for (cpu = 0; cpu < ncpu; cpu++)
+            CPU_SET(cpu, &workers);
+    }
+
+    AffinitySetupAutoSet(MANAGEMENT_CPU_SET, &housekeeping, BALANCED_AFFINITY);
+    AffinitySetupAutoSet(RECEIVE_CPU_SET, &workers, EXCLUSIVE_AFFINITY);
+    AffinitySetupAutoSet(WORKER_CPU_SET, &workers, EXCLUSIVE_AFFINITY);
+    AffinitySetupAutoSet(VERDICT_CPU_SET, &workers, BALANCED_AFFINITY);
+
+    for (i = 0; i < MAX_CPU_SET; i++) {
+        AffinityCpusetToString(&thread_affinity[i].cpu_set, ncpu, buf, sizeof(buf));
+        SCLogConfig("cpu-affinity: auto, %s: cpu(s) %s, %s",
+                thread_affinity[i].name, buf,
+                thread_affinity[i].mode_flag == EXCLUSIVE_AFFINITY ?
+                    "exclusive" : "balanced");
+    }
+#else
+    SCLogWarning(SC_ERR_INVALID_ARGUMENT, "cpu-affinity: auto is only "
+            "supported on Linux, using the cpu-affinity sets");
+    AffinitySetupLoadFromConfig();
+#endif /* __linux__ */
+}
+
+/**
+ * \brief Get the other hyperthread of the core 'cpu' is on
+ * \retval cpu the sibling or -1 if there is none or it can't be determined
+ */
+int AffinityGetSiblingCPU(int cpu)
+{
+#if defined __linux__
+    char path[PATH_MAX];
+    cpu_set_t siblings;
+    int i;
+
+    snprintf(path, sizeof(path),
+            CPU_SYSFS_PATH "/cpu%d/topology/thread_siblings_list", cpu);
+    if (AffinityReadCpuList(path, &siblings) != 0)
+        return -1;
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (i != cpu && CPU_ISSET(i, &siblings))
+            return i;
+    }
+#endif /* __linux__ */
+    return -1;
+}
+
+#ifdef UNITTESTS
+#if defined __linux__
+static int AffinityTest01(void)
+{
+    cpu_set_t set;
+    char buf[64];
+
+    FAIL_IF(AffinityParseCpuList("0-3,8,10-11\n", &set) != 0);
+    FAIL_IF_NOT(CPU_ISSET(0, &set) && CPU_ISSET(3, &set));
+    FAIL_IF(CPU_ISSET(4, &set));
+    FAIL_IF_NOT(CPU_ISSET(8, &set) && CPU_ISSET(11, &set));
+    FAIL_IF(CPU_ISSET(9, &set));
+
+    AffinityCpusetToString(&set, 16, buf, sizeof(buf));
+    FAIL_IF(strcmp(buf, "0-3,8,10-11") != 0);
+
+    FAIL_IF(AffinityParseCpuList("3-1", &set) == 0);
+    FAIL_IF(AffinityParseCpuList("1,x", &set) == 0);
+    PASS;
+}
+#endif /* __linux__ */
+#endif /* UNITTESTS */
+
+void AffinityRegisterTests(void)
+{
+#ifdef UNITTESTS
+#if defined __linux__
+    UtRegisterTest("AffinityTest01", AffinityTest01);
+#endif
+#endif
+}
@@ -82,8 +82,14 @@ extern ThreadsAffinityType thread_affinity[MAX_CPU_SET];
 #endif
 
 void AffinitySetupLoadFromConfig();
+void AffinitySetupAuto(void);
 ThreadsAffinityType * GetAffinityTypeFromName(const char *name);
 
 int AffinityGetNextCPU(ThreadsAffinityType *taf);
+int AffinityGetNumaNodeCount(void);
+int AffinityGetNumaNodeForCPU(int cpu);
+int AffinityGetSiblingCPU(int cpu);
+
+void AffinityRegisterTests(void);
 
 #endif /* __UTIL_AFFINITY_H__ */
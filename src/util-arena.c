@@ -0,0 +1,159 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Bump allocator for short lived per thread allocations.
+ *
+ * Chunks are never freed on reset, so after warming up to the high water
+ * mark of a packet no more malloc calls are done.
+ */
+
+#include "suricata-common.h"
+#include "util-arena.h"
+#include "util-unittest.h"
+
+#define ARENA_ALIGN     8
+
+static ArenaChunk *ArenaChunkAlloc(size_t size)
+{
+    ArenaChunk *c = SCMalloc(sizeof(ArenaChunk) + size);
+    if (unlikely(c == NULL))
+        return NULL;
+    c->next = NULL;
+    c->size = size;
+    c->used = 0;
+    return c;
+}
+
+/**
+ * \brief create a new arena
+ *
+ * \param chunk_size size of the chunks, larger allocations get a chunk
+ *                   of their own
+ */
+Arena *ArenaCreate(size_t chunk_size)
+{
+    Arena *a = SCMalloc(sizeof(Arena));
+    if (unlikely(a == NULL))
+        return NULL;
+
+    a->chunk_size = chunk_size;
+    a->chunks = ArenaChunkAlloc(chunk_size);
+    if (a->chunks == NULL) {
+        SCFree(a);
+        return NULL;
+    }
+    a->cur = a->chunks;
+    return a;
+}
+
+void ArenaDestroy(Arena *a)
+{
+    if (a == NULL)
+        return;
+
+    ArenaChunk *c = a->chunks;
+    while (c != NULL) {
+        ArenaChunk *next = c->next;
+        SCFree(c);
+        c = next;
+    }
+    SCFree(a);
+}
+
+/**
+ * \brief get 'size' bytes from the arena, 8 byte aligned
+ *
+ * \retval ptr memory valid till the next ArenaReset()
+ * \retval NULL out of memory
+ */
+void *ArenaAlloc(Arena *a, size_t size)
+{
+    size = (size + (ARENA_ALIGN - 1)) & ~((size_t)ARENA_ALIGN - 1);
+
+    ArenaChunk *c = a->cur;
+    while (c->size - c->used < size) {
+        if (c->next == NULL) {
+            ArenaChunk *n = ArenaChunkAlloc(size > a->chunk_size ?
+                                            size : a->chunk_size);
+            if (n == NULL)
+                return NULL;
+            c->next = n;
+        }
+        c = c->next;
+        /* chunks after 'cur' are unused since the last reset */
+        c->used = 0;
+    }
+    a->cur = c;
+
+    void *ptr = c->data + c->used;
+    c->used += size;
+    return ptr;
+}
+
+/** \brief give back all memory handed out since the last reset */
+void ArenaReset(Arena *a)
+{
+    a->cur = a->chunks;
+    a->chunks->used = 0;
+}
+
+#ifdef UNITTESTS
+
+static int ArenaTest01(void)
+{
+    Arena *a = ArenaCreate(64);
+    FAIL_IF_NULL(a);
+
+    uint8_t *p1 = ArenaAlloc(a, 10);
+    FAIL_IF_NULL(p1);
+    uint8_t *p2 = ArenaAlloc(a, 10);
+    FAIL_IF_NULL(p2);
+    /* aligned and in the same chunk */
+    FAIL_IF(p2 != p1 + 16);
+
+    /* doesn't fit the chunk anymore */
+    uint8_t *p3 = ArenaAlloc(a, 48);
+    FAIL_IF_NULL(p3);
+    FAIL_IF(a->cur == a->chunks);
+
+    /* larger than a chunk */
+    uint8_t *p4 = ArenaAlloc(a, 1000);
+    FAIL_IF_NULL(p4);
+    memset(p4, 0xff, 1000);
+
+    ArenaReset(a);
+    FAIL_IF(ArenaAlloc(a, 10) != p1);
+    FAIL_IF(ArenaAlloc(a, 10) != p2);
+    /* chunks are reused after a reset */
+    FAIL_IF(ArenaAlloc(a, 48) != p3);
+    FAIL_IF(ArenaAlloc(a, 1000) != p4);
+
+    ArenaDestroy(a);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void ArenaRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ArenaTest01", ArenaTest01);
+#endif
+}
@@ -0,0 +1,49 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Bump allocator for short lived per thread allocations. Memory is
+ * handed out from large chunks and given back all at once by
+ * ArenaReset(), e.g. at the end of a packet. Not thread safe.
+ */
+
+#ifndef __UTIL_ARENA_H__
+#define __UTIL_ARENA_H__
+
+typedef struct ArenaChunk_ {
+    struct ArenaChunk_ *next;
+    size_t size;
+    size_t used;
+    uint8_t data[];
+} ArenaChunk;
+
+typedef struct Arena_ {
+    ArenaChunk *chunks;     /**< all chunks, kept over resets */
+    ArenaChunk *cur;        /**< chunk we allocate from */
+    size_t chunk_size;
+} Arena;
+
+Arena *ArenaCreate(size_t chunk_size);
+void ArenaDestroy(Arena *a);
+void *ArenaAlloc(Arena *a, size_t size);
+void ArenaReset(Arena *a);
+
+void ArenaRegisterTests(void);
+
+#endif /* __UTIL_ARENA_H__ */
@@ -602,6 +602,30 @@ static int ByteTest16 (void)
 
     return 0;
 }
+/** \test all widths, both byte orders */
+static int ByteTest17 (void)
+{
+    uint8_t bytes[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+    uint64_t big = 0, little = 0;
+    uint16_t len;
+
+    for (len = 1; len <= 8; len++) {
+        FAIL_IF(ByteExtract(&big, BYTE_BIG_ENDIAN, len, bytes) != len);
+        FAIL_IF(ByteExtract(&little, BYTE_LITTLE_ENDIAN, len, bytes) != len);
+
+        uint64_t exp_big = 0, exp_little = 0;
+        uint16_t i;
+        for (i = 0; i < len; i++) {
+            exp_big = (exp_big << 8) | bytes[i];
+            exp_little |= (uint64_t)bytes[i] << (i * 8);
+        }
+        FAIL_IF(big != exp_big);
+        FAIL_IF(little != exp_little);
+    }
+
+    FAIL_IF(ByteExtract(&big, 2, 4, bytes) != -1);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 void ByteRegisterTests(void)
@@ -623,6 +647,7 @@ void ByteRegisterTests(void)
     UtRegisterTest("ByteTest14", ByteTest14);
     UtRegisterTest("ByteTest15", ByteTest15);
     UtRegisterTest("ByteTest16", ByteTest16);
+    UtRegisterTest("ByteTest17", ByteTest17);
 #endif /* UNITTESTS */
 }
 
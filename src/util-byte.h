@@ -262,29 +262,65 @@ static inline int ByteExtract(uint64_t *res, int e, uint16_t len, const uint8_t
     uint64_t b = 0;
     int i;
 
-    if ((e != BYTE_BIG_ENDIAN) && (e != BYTE_LITTLE_ENDIAN)) {
-        /** \todo Need standard return values */
-        return -1;
-    }
-
-    *res = 0;
-
-    /* Go through each byte and merge it into the result in the correct order */
-    /** \todo Probably a more efficient way to do this. */
-    for (i = 0; i < len; i++) {
-
-        if (e == BYTE_LITTLE_ENDIAN) {
-            b = bytes[i];
+    /* the common widths are assembled directly, so the compiler can turn
+     * them into a single (swapped) load */
+    if (e == BYTE_BIG_ENDIAN) {
+        switch (len) {
+            case 1:
+                *res = bytes[0];
+                return 1;
+            case 2:
+                *res = ((uint64_t)bytes[0] << 8) | (uint64_t)bytes[1];
+                return 2;
+            case 4:
+                *res = ((uint64_t)bytes[0] << 24) | ((uint64_t)bytes[1] << 16) |
+                       ((uint64_t)bytes[2] << 8) | (uint64_t)bytes[3];
+                return 4;
+            case 8:
+                *res = ((uint64_t)bytes[0] << 56) | ((uint64_t)bytes[1] << 48) |
+                       ((uint64_t)bytes[2] << 40) | ((uint64_t)bytes[3] << 32) |
+                       ((uint64_t)bytes[4] << 24) | ((uint64_t)bytes[5] << 16) |
+                       ((uint64_t)bytes[6] << 8) | (uint64_t)bytes[7];
+                return 8;
         }
-        else {
+
+        *res = 0;
+        for (i = 0; i < len; i++) {
             b = bytes[len - i - 1];
+            *res |= (b << ((i & 7) << 3));
         }
+        return len;
 
-        *res |= (b << ((i & 7) << 3));
+    } else if (e == BYTE_LITTLE_ENDIAN) {
+        switch (len) {
+            case 1:
+                *res = bytes[0];
+                return 1;
+            case 2:
+                *res = ((uint64_t)bytes[1] << 8) | (uint64_t)bytes[0];
+                return 2;
+            case 4:
+                *res = ((uint64_t)bytes[3] << 24) | ((uint64_t)bytes[2] << 16) |
+                       ((uint64_t)bytes[1] << 8) | (uint64_t)bytes[0];
+                return 4;
+            case 8:
+                *res = ((uint64_t)bytes[7] << 56) | ((uint64_t)bytes[6] << 48) |
+                       ((uint64_t)bytes[5] << 40) | ((uint64_t)bytes[4] << 32) |
+                       ((uint64_t)bytes[3] << 24) | ((uint64_t)bytes[2] << 16) |
+                       ((uint64_t)bytes[1] << 8) | (uint64_t)bytes[0];
+                return 8;
+        }
 
+        *res = 0;
+        for (i = 0; i < len; i++) {
+            b = bytes[i];
+            *res |= (b << ((i & 7) << 3));
+        }
+        return len;
     }
 
-    return len;
+    /** \todo Need standard return values */
+    return -1;
 }
 
 
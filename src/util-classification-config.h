@@ -49,6 +49,7 @@ void SCClassConfLoadClassficationConfigFile(DetectEngineCtx *, FILE *fd);
 SCClassConfClasstype *SCClassConfGetClasstype(const char *,
                                               DetectEngineCtx *);
 void SCClassConfDeInitContext(DetectEngineCtx *);
+char *SCClassConfGetConfFilename(const DetectEngineCtx *de_ctx);
 void SCClassConfRegisterTests(void);
 
 /* for unittests */
@@ -811,6 +811,38 @@ static uint8_t * GetToken(uint8_t *buf, uint32_t blen, const char *delims,
     return tok;
 }
 
+/**
+ * \brief Check if a header has to be stored in the entity
+ *
+ * Headers the decoder needs itself are always kept, the rest only if they
+ * are in the configured header_fields list (if any).
+ *
+ * \retval 1 store it
+ * \retval 0 it can be skipped
+ */
+static int MimeDecStoreHeaderField(const uint8_t *name, uint32_t nlen)
+{
+    static const char *needed[] = { CTNT_TYPE_STR, CTNT_DISP_STR,
+                                    CTNT_TRAN_STR, MSG_ID_STR, NULL };
+    char **list = mime_dec_config.header_fields;
+    int i;
+
+    if (list == NULL)
+        return 1;
+
+    for (i = 0; needed[i] != NULL; i++) {
+        if (strlen(needed[i]) == nlen &&
+            strncasecmp(needed[i], (const char *)name, nlen) == 0)
+            return 1;
+    }
+    for (i = 0; list[i] != NULL; i++) {
+        if (strlen(list[i]) == nlen &&
+            strncasecmp(list[i], (const char *)name, nlen) == 0)
+            return 1;
+    }
+    return 0;
+}
+
 /**
  * \brief Stores the final MIME header value into the current entity on the
  * stack.
@@ -834,6 +866,9 @@ static int StoreMimeHeader(MimeDecParseState *state)
                 SCLogDebug("Error: Invalid parser state - header value without"
                         " name");
                 ret = MIME_DEC_ERR_PARSE;
+            } else if (state->stack->top != NULL &&
+                       !MimeDecStoreHeaderField(state->hname, state->hlen)) {
+                SCLogDebug("header not needed, not storing it");
             } else if (state->stack->top != NULL) {
                 /* Store each header name and value */
                 if (MimeDecFillField(state->stack->top->data, state->hname,
@@ -2783,6 +2818,46 @@ static int MimeDecParseLineTest01(void)
     return 1;
 }
 
+/* Test that only the configured header fields are stored */
+static int MimeDecParseLineTest03(void)
+{
+    char *fields[] = { "subject", NULL };
+    uint32_t line_count = 0;
+    int ret = MIME_DEC_OK;
+
+    MimeDecConfig saved = *MimeDecGetConfig();
+    MimeDecGetConfig()->header_fields = fields;
+
+    MimeDecParseState *state = MimeDecInitParser(&line_count,
+            TestDataChunkCallback);
+    FAIL_IF_NULL(state);
+
+    char *str = "From: Sender1";
+    ret |= MimeDecParseLine((uint8_t *)str, strlen(str), 1, state);
+    str = "Subject: Test";
+    ret |= MimeDecParseLine((uint8_t *)str, strlen(str), 1, state);
+    str = "Content-Type: text/plain";
+    ret |= MimeDecParseLine((uint8_t *)str, strlen(str), 1, state);
+    str = "";
+    ret |= MimeDecParseLine((uint8_t *)str, strlen(str), 1, state);
+    str = "A simple message line 1";
+    ret |= MimeDecParseLine((uint8_t *)str, strlen(str), 1, state);
+    FAIL_IF(ret != MIME_DEC_OK);
+    FAIL_IF(MimeDecParseComplete(state) != MIME_DEC_OK);
+
+    MimeDecEntity *msg = state->msg;
+    FAIL_IF_NOT_NULL(MimeDecFindField(msg, "from"));
+    FAIL_IF_NULL(MimeDecFindField(msg, "subject"));
+    /* needed by the decoder so always stored */
+    FAIL_IF_NULL(MimeDecFindField(msg, "content-type"));
+    FAIL_IF_NOT(msg->ctnt_flags & CTNT_IS_TEXT);
+
+    MimeDecFreeEntity(msg);
+    MimeDecDeInitParser(state);
+    *MimeDecGetConfig() = saved;
+    PASS;
+}
+
 /* Test simple case of EXE URL extraction */
 static int MimeDecParseLineTest02(void)
 {
@@ -2957,6 +3032,32 @@ static int MimeBase64DecodeTest01(void)
     return ret;
 }
 
+/* invalid character after some valid blocks */
+static int MimeBase64DecodeTest02(void)
+{
+    const char *base64msg = "YWJjZGVm*Z2hp";
+    uint8_t dst[16];
+
+    uint32_t len = DecodeBase64(dst, (const uint8_t *)base64msg,
+                                strlen(base64msg), 0);
+    FAIL_IF(len != 6);
+    FAIL_IF(memcmp(dst, "abcdef", 6) != 0);
+
+    /* strict decoding fails on it */
+    len = DecodeBase64(dst, (const uint8_t *)base64msg, strlen(base64msg), 1);
+    FAIL_IF(len != 0);
+
+    /* padding and a partial last block */
+    len = DecodeBase64(dst, (const uint8_t *)"YWJjZA==", 8, 1);
+    FAIL_IF(len != 4);
+    FAIL_IF(memcmp(dst, "abcd", 4) != 0);
+    len = DecodeBase64(dst, (const uint8_t *)"YWJjZGU", 7, 0);
+    FAIL_IF(len != 5);
+    FAIL_IF(memcmp(dst, "abcde", 5) != 0);
+
+    PASS;
+}
+
 static int MimeIsExeURLTest01(void)
 {
     int ret = 0;
@@ -3051,9 +3152,11 @@ void MimeDecRegisterTests(void)
 #ifdef UNITTESTS
     UtRegisterTest("MimeDecParseLineTest01", MimeDecParseLineTest01);
     UtRegisterTest("MimeDecParseLineTest02", MimeDecParseLineTest02);
+    UtRegisterTest("MimeDecParseLineTest03", MimeDecParseLineTest03);
     UtRegisterTest("MimeDecParseFullMsgTest01", MimeDecParseFullMsgTest01);
     UtRegisterTest("MimeDecParseFullMsgTest02", MimeDecParseFullMsgTest02);
     UtRegisterTest("MimeBase64DecodeTest01", MimeBase64DecodeTest01);
+    UtRegisterTest("MimeBase64DecodeTest02", MimeBase64DecodeTest02);
     UtRegisterTest("MimeIsExeURLTest01", MimeIsExeURLTest01);
     UtRegisterTest("MimeIsIpv4HostTest01", MimeIsIpv4HostTest01);
     UtRegisterTest("MimeIsIpv6HostTest01", MimeIsIpv6HostTest01);
@@ -97,6 +97,8 @@ typedef struct MimeDecConfig {
     int body_md5;  /**< Compute md5 sum of body */
     uint32_t header_value_depth;  /**< Depth of which to store header values
                                        (Default is 2000) */
+    char **header_fields;  /**< NULL terminated list of the lowercase header
+                                names to store, NULL to store all */
 } MimeDecConfig;
 
 /**
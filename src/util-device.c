@@ -69,6 +69,9 @@ int LiveRegisterDevice(const char *dev)
     SC_ATOMIC_INIT(pd->pkts);
     SC_ATOMIC_INIT(pd->drop);
     SC_ATOMIC_INIT(pd->invalid_checksums);
+    SC_ATOMIC_INIT(pd->workers_active);
+    SC_ATOMIC_INIT(pd->workers_backlog);
+    pd->workers_max = 0;
     pd->ignore_checksum = 0;
     TAILQ_INSERT_TAIL(&live_devices, pd, next);
 
@@ -269,12 +272,47 @@ int LiveDeviceListClean()
         SC_ATOMIC_DESTROY(pd->pkts);
         SC_ATOMIC_DESTROY(pd->drop);
         SC_ATOMIC_DESTROY(pd->invalid_checksums);
+        SC_ATOMIC_DESTROY(pd->workers_active);
+        SC_ATOMIC_DESTROY(pd->workers_backlog);
         SCFree(pd);
     }
 
     SCReturnInt(TM_ECODE_OK);
 }
 
+/**
+ * \brief set up the runtime worker count of a device
+ *
+ * For capture methods that can park and unpark their threads. 'max'
+ * threads are set up, 'active' of them capture.
+ */
+void LiveDeviceSetWorkersMax(LiveDevice *ld, int max, int active)
+{
+    ld->workers_max = (uint16_t)max;
+    SC_ATOMIC_SET(ld->workers_active, (uint16_t)active);
+}
+
+/**
+ * \brief change the number of capturing workers of a device
+ *
+ * Parked workers leave the capture, see the capture method.
+ *
+ * \retval workers the new count, -1 if the device can't change it
+ */
+int LiveDeviceSetWorkers(LiveDevice *ld, int workers)
+{
+    if (ld->workers_max == 0)
+        return -1;
+
+    if (workers < 1)
+        workers = 1;
+    else if (workers > ld->workers_max)
+        workers = ld->workers_max;
+
+    SC_ATOMIC_SET(ld->workers_active, (uint16_t)workers);
+    return workers;
+}
+
 #ifdef BUILD_UNIX_SOCKET
 TmEcode LiveDeviceIfaceStat(json_t *cmd, json_t *answer, void *data)
 {
@@ -306,6 +344,61 @@ TmEcode LiveDeviceIfaceStat(json_t *cmd, json_t *answer, void *data)
                                 json_integer(SC_ATOMIC_GET(pd->invalid_checksums)));
             json_object_set_new(jdata, "drop",
                                 json_integer(SC_ATOMIC_GET(pd->drop)));
+            if (pd->workers_max > 0) {
+                json_object_set_new(jdata, "workers",
+                                    json_integer(SC_ATOMIC_GET(pd->workers_active)));
+                json_object_set_new(jdata, "workers-max",
+                                    json_integer(pd->workers_max));
+            }
+            json_object_set_new(answer, "message", jdata);
+            SCReturnInt(TM_ECODE_OK);
+        }
+    }
+    json_object_set_new(answer, "message", json_string("Iface does not exist"));
+    SCReturnInt(TM_ECODE_FAILED);
+}
+
+/**
+ * \brief unix socket command to change the number of capture workers
+ *
+ * Takes 'iface' and 'workers', the count is capped to 'max-threads'.
+ */
+TmEcode LiveDeviceIfaceSetWorkers(json_t *cmd, json_t *answer, void *data)
+{
+    SCEnter();
+    LiveDevice *pd;
+    json_t *jarg = json_object_get(cmd, "iface");
+    if (!json_is_string(jarg)) {
+        json_object_set_new(answer, "message", json_string("Iface is not a string"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    const char *name = json_string_value(jarg);
+    jarg = json_object_get(cmd, "workers");
+    if (!json_is_integer(jarg)) {
+        json_object_set_new(answer, "message", json_string("Workers is not an integer"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    int workers = (int)json_integer_value(jarg);
+
+    TAILQ_FOREACH(pd, &live_devices, next) {
+        if (name != NULL && !strcmp(name, pd->dev)) {
+            int r = LiveDeviceSetWorkers(pd, workers);
+            if (r < 0) {
+                json_object_set_new(answer, "message",
+                        json_string("Iface capture can't change its worker count"));
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+            SCLogNotice("%s: %d capture workers requested, %d of %u active",
+                    pd->dev, workers, r, pd->workers_max);
+
+            json_t *jdata = json_object();
+            if (jdata == NULL) {
+                json_object_set_new(answer, "message",
+                        json_string("internal error at json object creation"));
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+            json_object_set_new(jdata, "workers", json_integer(r));
+            json_object_set_new(jdata, "workers-max", json_integer(pd->workers_max));
             json_object_set_new(answer, "message", jdata);
             SCReturnInt(TM_ECODE_OK);
         }
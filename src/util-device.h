@@ -31,6 +31,13 @@ typedef struct LiveDevice_ {
     SC_ATOMIC_DECLARE(uint64_t, pkts);
     SC_ATOMIC_DECLARE(uint64_t, drop);
     SC_ATOMIC_DECLARE(uint64_t, invalid_checksums);
+    /** capture workers with an index below this capture, the others are
+     *  parked. Changed at runtime by iface-set-workers or the autoscaler */
+    SC_ATOMIC_DECLARE(uint16_t, workers_active);
+    /** workers set up for the device, 0 if the count can't change */
+    uint16_t workers_max;
+    /** highest ring fill % of the workers since the last autoscaler pass */
+    SC_ATOMIC_DECLARE(uint32_t, workers_backlog);
     TAILQ_ENTRY(LiveDevice_) next;
 } LiveDevice;
 
@@ -44,10 +51,13 @@ int LiveBuildDeviceList(const char *base);
 void LiveDeviceHasNoStats(void);
 int LiveDeviceListClean(void);
 int LiveBuildDeviceListCustom(const char *base, const char *itemname);
+void LiveDeviceSetWorkersMax(LiveDevice *ld, int max, int active);
+int LiveDeviceSetWorkers(LiveDevice *ld, int workers);
 
 #ifdef BUILD_UNIX_SOCKET
 TmEcode LiveDeviceIfaceStat(json_t *cmd, json_t *server_msg, void *data);
 TmEcode LiveDeviceIfaceList(json_t *cmd, json_t *server_msg, void *data);
+TmEcode LiveDeviceIfaceSetWorkers(json_t *cmd, json_t *server_msg, void *data);
 #endif
 
 #endif /* __UTIL_DEVICE_H__ */
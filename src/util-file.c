@@ -51,6 +51,16 @@ static int g_file_force_magic = 0;
  */
 static int g_file_force_md5 = 0;
 
+/** \brief switch to force sha1 calculation on all files
+ *         regardless of the rules.
+ */
+static int g_file_force_sha1 = 0;
+
+/** \brief switch to force sha256 calculation on all files
+ *         regardless of the rules.
+ */
+static int g_file_force_sha256 = 0;
+
 /** \brief switch to force tracking off all files
  *         regardless of the rules.
  */
@@ -89,6 +99,68 @@ int FileForceMd5(void)
     return g_file_force_md5;
 }
 
+void FileForceSha1Enable(void)
+{
+    g_file_force_sha1 = 1;
+}
+
+int FileForceSha1(void)
+{
+    return g_file_force_sha1;
+}
+
+void FileForceSha256Enable(void)
+{
+    g_file_force_sha256 = 1;
+}
+
+int FileForceSha256(void)
+{
+    return g_file_force_sha256;
+}
+
+/**
+ *  \brief parse the 'force-hash' list of a file logger config
+ *
+ *  \param conf logger config node, e.g. for 'force-hash: [md5, sha256]'
+ */
+void FileForceHashParseCfg(ConfNode *conf)
+{
+    if (conf == NULL)
+        return;
+
+    ConfNode *forcehash_node = ConfNodeLookupChild(conf, "force-hash");
+    if (forcehash_node == NULL)
+        return;
+
+    ConfNode *field = NULL;
+    TAILQ_FOREACH(field, &forcehash_node->head, next) {
+#ifdef HAVE_NSS
+        if (strcasecmp("md5", field->val) == 0) {
+            FileForceMd5Enable();
+            SCLogConfig("forcing md5 calculation for logged or stored files");
+        } else if (strcasecmp("sha1", field->val) == 0) {
+            FileForceSha1Enable();
+            SCLogConfig("forcing sha1 calculation for logged or stored files");
+        } else if (strcasecmp("sha256", field->val) == 0) {
+            FileForceSha256Enable();
+            SCLogConfig("forcing sha256 calculation for logged or stored files");
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "unknown hash '%s' in "
+                    "force-hash, supported are md5, sha1 and sha256", field->val);
+        }
+#else
+        SCLogInfo("%s calculation requires linking against libnss", field->val);
+#endif
+    }
+}
+
+/** \brief hashes are forced on so files need to be tracked till the end */
+static int FileForceHash(void)
+{
+    return (g_file_force_md5 || g_file_force_sha1 || g_file_force_sha256);
+}
+
 void FileForceTrackingEnable(void)
 {
     g_file_force_tracking = 1;
@@ -117,6 +189,25 @@ uint64_t FileSize(const File *file)
     return 0;
 }
 
+/**
+ *  \brief get the amount of file data buffered in memory by a container
+ */
+uint64_t FileContainerMemuse(const FileContainer *ffc)
+{
+    uint64_t memuse = 0;
+
+    if (ffc == NULL)
+        return 0;
+
+    const File *file;
+    for (file = ffc->head; file != NULL; file = file->next) {
+        memuse += sizeof(File) + file->name_len;
+        if (file->sb != NULL)
+            memuse += sizeof(StreamingBuffer) + file->sb->buf_size;
+    }
+    return memuse;
+}
+
 static int FilePruneFile(File *file)
 {
     SCEnter();
@@ -289,6 +380,10 @@ static void FileFree(File *ff)
 #ifdef HAVE_NSS
     if (ff->md5_ctx)
         HASH_Destroy(ff->md5_ctx);
+    if (ff->sha1_ctx)
+        HASH_Destroy(ff->sha1_ctx);
+    if (ff->sha256_ctx)
+        HASH_Destroy(ff->sha256_ctx);
 #endif
     SCFree(ff);
 }
@@ -355,14 +450,35 @@ static int FileStoreNoStoreCheck(File *ff)
     SCReturnInt(0);
 }
 
+#ifdef HAVE_NSS
+/** \brief feed a chunk to all active hashes while it's still in cache
+ *  \retval 1 at least one hash is active
+ *  \retval 0 no hashing for this file */
+static int FileHashUpdate(File *file, const uint8_t *data, uint32_t data_len)
+{
+    int r = 0;
+    if (file->md5_ctx) {
+        HASH_Update(file->md5_ctx, data, data_len);
+        r = 1;
+    }
+    if (file->sha1_ctx) {
+        HASH_Update(file->sha1_ctx, data, data_len);
+        r = 1;
+    }
+    if (file->sha256_ctx) {
+        HASH_Update(file->sha256_ctx, data, data_len);
+        r = 1;
+    }
+    return r;
+}
+#endif
+
 static int AppendData(File *file, const uint8_t *data, uint32_t data_len)
 {
     StreamingBufferAppendNoTrack(file->sb, data, data_len);
 
 #ifdef HAVE_NSS
-    if (file->md5_ctx) {
-        HASH_Update(file->md5_ctx, data, data_len);
-    }
+    (void)FileHashUpdate(file, data, data_len);
 #endif
     SCReturnInt(0);
 }
@@ -396,13 +512,9 @@ int FileAppendData(FileContainer *ffc, const uint8_t *data, uint32_t data_len)
 
     if (FileStoreNoStoreCheck(ffc->tail) == 1) {
 #ifdef HAVE_NSS
-        /* no storage but forced md5 */
-        if (ffc->tail->md5_ctx) {
-            if (ffc->tail->md5_ctx)
-                HASH_Update(ffc->tail->md5_ctx, data, data_len);
-
+        /* no storage but forced hashing */
+        if (FileHashUpdate(ffc->tail, data, data_len) == 1)
             SCReturnInt(0);
-        }
 #endif
         if (g_file_force_tracking || (!(ffc->tail->flags & FILE_NOTRACK)))
             SCReturnInt(0);
@@ -483,6 +595,18 @@ File *FileOpenFile(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
             HASH_Begin(ff->md5_ctx);
         }
     }
+    if (g_file_force_sha1) {
+        ff->sha1_ctx = HASH_Create(HASH_AlgSHA1);
+        if (ff->sha1_ctx != NULL) {
+            HASH_Begin(ff->sha1_ctx);
+        }
+    }
+    if (g_file_force_sha256) {
+        ff->sha256_ctx = HASH_Create(HASH_AlgSHA256);
+        if (ff->sha256_ctx != NULL) {
+            HASH_Begin(ff->sha256_ctx);
+        }
+    }
 #endif
 
     ff->state = FILE_STATE_OPENED;
@@ -517,9 +641,8 @@ static int FileCloseFilePtr(File *ff, const uint8_t *data,
     if (data != NULL) {
         if (ff->flags & FILE_NOSTORE) {
 #ifdef HAVE_NSS
-            /* no storage but md5 */
-            if (ff->md5_ctx)
-                HASH_Update(ff->md5_ctx, data, data_len);
+            /* no storage but hashing */
+            (void)FileHashUpdate(ff, data, data_len);
 #endif
         } else {
             if (AppendData(ff, data, data_len) != 0) {
@@ -547,6 +670,16 @@ static int FileCloseFilePtr(File *ff, const uint8_t *data,
             HASH_End(ff->md5_ctx, ff->md5, &len, sizeof(ff->md5));
             ff->flags |= FILE_MD5;
         }
+        if (ff->sha1_ctx) {
+            unsigned int len = 0;
+            HASH_End(ff->sha1_ctx, ff->sha1, &len, sizeof(ff->sha1));
+            ff->flags |= FILE_SHA1;
+        }
+        if (ff->sha256_ctx) {
+            unsigned int len = 0;
+            HASH_End(ff->sha256_ctx, ff->sha256, &len, sizeof(ff->sha256));
+            ff->flags |= FILE_SHA256;
+        }
 #endif
     }
 
@@ -731,7 +864,7 @@ void FileDisableStoringForFile(File *ff)
     ff->flags |= FILE_NOSTORE;
 
     if (ff->state == FILE_STATE_OPENED && FileSize(ff) >= (uint64_t)FileMagicSize()) {
-        if (g_file_force_md5 == 0 && g_file_force_tracking == 0) {
+        if (!FileForceHash() && g_file_force_tracking == 0) {
             (void)FileCloseFilePtr(ff, NULL, 0,
                     (FILE_TRUNCATED|FILE_NOSTORE));
         }
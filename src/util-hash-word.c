@@ -0,0 +1,290 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hash functions for the uint32_t keys of the flow, host, ippair and
+ * defrag hashes, see util-hash-word.h.
+ *
+ * crc32c runs two crc lanes over alternating words, so the latency of the
+ * crc instruction is hidden for the 10 and 11 word IPv6 keys, and ends
+ * with the murmur3 finalizer since a crc on its own is linear. It needs
+ * a build with SSE4.2 (-msse4.2 or -march=native) or ARMv8 CRC
+ * (-march=armv8-a+crc). mix64 takes two words per step, for any cpu.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+
+#include "util-hash-word.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define HASH_WORD_HAVE_CRC32C 1
+#define HashWordCrc32cU32(crc, v) _mm_crc32_u32((crc), (v))
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HASH_WORD_HAVE_CRC32C 1
+#define HashWordCrc32cU32(crc, v) __crc32cw((crc), (v))
+#endif
+
+int hash_word_algo = HASH_WORD_LOOKUP3;
+
+static const char *hash_word_names[HASH_WORD_MAX] = {
+    "lookup3",
+    "crc32c",
+    "mix64",
+};
+
+const char *HashWordAlgoName(int algo)
+{
+    if (algo < 0 || algo >= HASH_WORD_MAX)
+        return "unknown";
+    return hash_word_names[algo];
+}
+
+/**
+ * \retval 1 if this build can use the crc32c instructions
+ */
+int HashWordCrc32cAvailable(void)
+{
+#ifdef HASH_WORD_HAVE_CRC32C
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+#ifdef HASH_WORD_HAVE_CRC32C
+/** \internal
+ *  \brief murmur3 32 bit finalizer */
+static inline uint32_t HashWordFmix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+#endif
+
+uint32_t HashWordCrc32c(const uint32_t *k, size_t length, uint32_t initval)
+{
+#ifdef HASH_WORD_HAVE_CRC32C
+    uint32_t a = initval;
+    uint32_t b = initval ^ 0x9e3779b9;
+    size_t i = 0;
+
+    for ( ; i + 1 < length; i += 2) {
+        a = HashWordCrc32cU32(a, k[i]);
+        b = HashWordCrc32cU32(b, k[i + 1]);
+    }
+    if (i < length)
+        a = HashWordCrc32cU32(a, k[i]);
+
+    return HashWordFmix32(a ^ ((b << 16) | (b >> 16)) ^ (uint32_t)length);
+#else
+    return hashword(k, length, initval);
+#endif
+}
+
+#define HASH_WORD_MIX64_C1 0x87c37b91114253d5ULL
+#define HASH_WORD_MIX64_C2 0x4cf5ad432745937fULL
+
+static inline uint64_t HashWordRotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+uint32_t HashWordMix64(const uint32_t *k, size_t length, uint32_t initval)
+{
+    uint64_t h = ((uint64_t)initval << 32 | initval) ^ (uint64_t)length;
+    size_t i = 0;
+    uint64_t v;
+
+    for ( ; i < length; i += 2) {
+        v = k[i];
+        if (i + 1 < length)
+            v |= (uint64_t)k[i + 1] << 32;
+
+        v *= HASH_WORD_MIX64_C1;
+        v = HashWordRotl64(v, 31);
+        v *= HASH_WORD_MIX64_C2;
+        h ^= v;
+        h = HashWordRotl64(h, 27) * 5 + 0x52dce729;
+    }
+
+    /* murmur3 64 bit finalizer */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+/**
+ * \brief pick the hash function from 'hash-function'
+ *
+ * To be called before the flow, host, ippair and defrag hashes are set
+ * up. 'auto' means crc32c if this build can use it, lookup3 otherwise.
+ */
+void HashWordInitConfig(void)
+{
+    char *val = NULL;
+    int algo = HASH_WORD_LOOKUP3;
+
+    if (ConfGet("hash-function", &val) == 1 && val != NULL) {
+        if (strcasecmp(val, "auto") == 0) {
+            algo = HashWordCrc32cAvailable() ? HASH_WORD_CRC32C : HASH_WORD_LOOKUP3;
+        } else if (strcasecmp(val, "crc32c") == 0) {
+            if (HashWordCrc32cAvailable()) {
+                algo = HASH_WORD_CRC32C;
+            } else {
+                SCLogWarning(SC_ERR_INVALID_VALUE, "hash-function crc32c needs "
+                        "a build with SSE4.2 or ARMv8 CRC support, using lookup3");
+            }
+        } else if (strcasecmp(val, "mix64") == 0) {
+            algo = HASH_WORD_MIX64;
+        } else if (strcasecmp(val, "lookup3") != 0) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid hash-function '%s', "
+                    "using lookup3", val);
+        }
+    }
+
+    hash_word_algo = algo;
+    SCLogConfig("using the %s hash function for the flow, host, ippair "
+            "and defrag hashes", HashWordAlgoName(algo));
+}
+
+#ifdef UNITTESTS
+/** \internal
+ *  \brief spread 64k IPv6 flow keys that only differ in the ports over
+ *         'buckets' buckets and check that no bucket gets more than 3
+ *         times its share */
+static int HashWordTestSpread(int algo, uint32_t buckets)
+{
+    uint32_t keys = 65536;
+    uint32_t *cnt = SCCalloc(buckets, sizeof(uint32_t));
+    uint32_t k[11] = { 0x20010db8, 0, 0, 1, 0x20010db8, 0, 0, 2, 0, 6, 0 };
+    uint32_t i, max = 0;
+    int r = 1;
+
+    if (cnt == NULL)
+        return 0;
+
+    int saved = hash_word_algo;
+    hash_word_algo = algo;
+    for (i = 0; i < keys; i++) {
+        k[8] = ((1024 + i) << 16) | 80;
+        uint32_t b = HashWord(k, 11, 12345) % buckets;
+        if (++cnt[b] > max)
+            max = cnt[b];
+    }
+    hash_word_algo = saved;
+
+    if (max > 3 * (keys / buckets)) {
+        printf("%s: max bucket len %u, mean %u: ", HashWordAlgoName(algo),
+                max, keys / buckets);
+        r = 0;
+    }
+    SCFree(cnt);
+    return r;
+}
+
+static int HashWordTest01(void)
+{
+    int algo;
+
+    for (algo = 0; algo < HASH_WORD_MAX; algo++) {
+        /* power of 2 and prime hash sizes */
+        FAIL_IF_NOT(HashWordTestSpread(algo, 4096));
+        FAIL_IF_NOT(HashWordTestSpread(algo, 4099));
+    }
+    PASS;
+}
+
+/** \test the seed and every word count */
+static int HashWordTest02(void)
+{
+    uint32_t k[11] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+    uint32_t k2[11] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12 };
+
+    FAIL_IF(HashWordMix64(k, 11, 1) == HashWordMix64(k, 11, 2));
+    FAIL_IF(HashWordMix64(k, 11, 1) == HashWordMix64(k2, 11, 1));
+    FAIL_IF(HashWordMix64(k, 10, 1) == HashWordMix64(k, 11, 1));
+    FAIL_IF(HashWordCrc32c(k, 11, 1) == HashWordCrc32c(k, 11, 2));
+    FAIL_IF(HashWordCrc32c(k, 11, 1) == HashWordCrc32c(k2, 11, 1));
+    FAIL_IF(HashWordCrc32c(k, 10, 1) == HashWordCrc32c(k, 11, 1));
+    PASS;
+}
+
+static volatile uint32_t hash_word_bench_sink;
+
+static int HashWordBench(UtBench *b, int algo)
+{
+    uint32_t k[11] = { 0x20010db8, 0, 0, 1, 0x20010db8, 0, 0, 2, 0, 6, 0 };
+    uint32_t h = 0;
+    uint64_t i;
+
+    int saved = hash_word_algo;
+    hash_word_algo = algo;
+    UtBenchResetTimer(b);
+    for (i = 0; i < b->n; i++) {
+        k[8] = (uint32_t)i;
+        h ^= HashWord(k, 11, 12345);
+    }
+    hash_word_algo = saved;
+    b->bytes = sizeof(k);
+
+    /* keep the compiler from dropping the loop */
+    hash_word_bench_sink = h;
+    PASS;
+}
+
+static int HashWordBench01(UtBench *b)
+{
+    return HashWordBench(b, HASH_WORD_LOOKUP3);
+}
+
+static int HashWordBench02(UtBench *b)
+{
+    return HashWordBench(b, HASH_WORD_CRC32C);
+}
+
+static int HashWordBench03(UtBench *b)
+{
+    return HashWordBench(b, HASH_WORD_MIX64);
+}
+#endif /* UNITTESTS */
+
+void HashWordRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HashWordTest01 -- key spread", HashWordTest01);
+    UtRegisterTest("HashWordTest02", HashWordTest02);
+
+    UtRegisterBenchmark("HashWordBench01 -- lookup3, 11 words", HashWordBench01);
+    if (HashWordCrc32cAvailable())
+        UtRegisterBenchmark("HashWordBench02 -- crc32c, 11 words", HashWordBench02);
+    UtRegisterBenchmark("HashWordBench03 -- mix64, 11 words", HashWordBench03);
+#endif
+}
@@ -0,0 +1,64 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hashing of the uint32_t keys of the flow, host, ippair and defrag
+ * hashes. The function is picked at startup with 'hash-function'.
+ */
+
+#ifndef __UTIL_HASH_WORD_H__
+#define __UTIL_HASH_WORD_H__
+
+#include "util-hash-lookup3.h"
+
+enum HashWordAlgo {
+    HASH_WORD_LOOKUP3 = 0,  /**< lookup3 hashword(), the default */
+    HASH_WORD_CRC32C,       /**< SSE4.2 / ARMv8 crc32c instructions */
+    HASH_WORD_MIX64,        /**< 64 bit multiply/xor mixer */
+
+    HASH_WORD_MAX,
+};
+
+extern int hash_word_algo;
+
+uint32_t HashWordCrc32c(const uint32_t *k, size_t length, uint32_t initval);
+uint32_t HashWordMix64(const uint32_t *k, size_t length, uint32_t initval);
+
+int HashWordCrc32cAvailable(void);
+const char *HashWordAlgoName(int algo);
+void HashWordInitConfig(void);
+void HashWordRegisterTests(void);
+
+/**
+ * \brief hash 'length' words of 'k' with the configured function
+ */
+static inline uint32_t HashWord(const uint32_t *k, size_t length,
+        uint32_t initval)
+{
+    switch (hash_word_algo) {
+        case HASH_WORD_CRC32C:
+            return HashWordCrc32c(k, length, initval);
+        case HASH_WORD_MIX64:
+            return HashWordMix64(k, length, initval);
+        default:
+            return hashword(k, length, initval);
+    }
+}
+
+#endif /* __UTIL_HASH_WORD_H__ */
@@ -31,6 +31,8 @@
 #include "util-radix-tree.h"
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
+#include "host.h"
+#include "host-storage.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
@@ -60,6 +62,19 @@ SCEnumCharMap sc_hinfo_os_policy_map[ ] = {
 /** Radix tree that holds the host OS information */
 static SCRadixTree *sc_hinfo_tree = NULL;
 
+/** bumped on every change of the tree, invalidates the cached lookups.
+ *  The tree only changes at init, so no locking. */
+static uint32_t sc_hinfo_version = 1;
+
+/** lookup result cached in the host */
+typedef struct SCHInfoHostCache_ {
+    uint32_t version;
+    int policy;
+} SCHInfoHostCache;
+
+/** host storage id of the cache, -1 if lookups are not cached */
+static int sc_hinfo_host_id = -1;
+
 
 /**
  * \brief Allocates the host_os flavour wrapped in user_data variable to be sent
@@ -138,6 +153,7 @@ int SCHInfoAddHostOSInfo(char *host_os, char *host_os_ip_range, int is_ipv4)
     /* create the radix tree that would hold all the host os info */
     if (sc_hinfo_tree == NULL)
         sc_hinfo_tree = SCRadixCreateRadixTree(SCHInfoFreeUserDataOSPolicy, NULL);
+    sc_hinfo_version++;
 
     /* the host os flavour that has to be sent as user data */
     if ( (user_data = SCHInfoAllocUserDataOSPolicy(host_os)) == NULL) {
@@ -316,11 +332,101 @@ int SCHInfoGetIPv6HostOSFlavour(uint8_t *ipv6_addr)
         return *((int *)user_data);
 }
 
+/** \internal
+ *  \brief radix tree lookup of the os flavour for 'a' */
+static int SCHInfoLookupAddress(Address *a)
+{
+    if (a->family == AF_INET)
+        return SCHInfoGetIPv4HostOSFlavour((uint8_t *)a->addr_data32);
+    else if (a->family == AF_INET6)
+        return SCHInfoGetIPv6HostOSFlavour((uint8_t *)a->addr_data32);
+    return -1;
+}
+
+/**
+ * \brief Retrieves the host os flavour of the address 'a', caching the
+ *        result in its host.
+ *
+ *        The result is cached in hosts that exist already, and hosts are
+ *        created for the addresses that have a host os policy. A cached
+ *        result is only used while the tree hasn't changed since.
+ *
+ * \retval The OS flavour on success; -1 on failure, or on not finding the key
+ */
+int SCHInfoGetHostOSFlavourByAddr(Address *a)
+{
+    if (sc_hinfo_tree == NULL)
+        return -1;
+    if (sc_hinfo_host_id == -1)
+        return SCHInfoLookupAddress(a);
+
+    const uint32_t version = sc_hinfo_version;
+    SCHInfoHostCache *c;
+    Host *h = HostLookupHostFromHash(a);
+    if (h != NULL) {
+        c = HostGetStorageById(h, sc_hinfo_host_id);
+        if (c != NULL && c->version == version) {
+            int policy = c->policy;
+            HostRelease(h);
+            return policy;
+        }
+    }
+
+    int policy = SCHInfoLookupAddress(a);
+    if (h == NULL) {
+        if (policy == -1)
+            return -1;
+        h = HostGetHostFromHash(a);
+        if (h == NULL)
+            return policy;
+    }
+
+    c = HostAllocStorageById(h, sc_hinfo_host_id);
+    if (c != NULL) {
+        c->version = version;
+        c->policy = policy;
+    }
+    HostRelease(h);
+    return policy;
+}
+
+static void *SCHInfoHostCacheAlloc(unsigned int size)
+{
+    return SCCalloc(1, size);
+}
+
+static void SCHInfoHostCacheFree(void *ptr)
+{
+    SCFree(ptr);
+}
+
+/**
+ * \brief register the host storage used to cache the lookups
+ *
+ *        To be called after SCHInfoLoadFromConfig() and before the
+ *        storage is finalized. Without a host os policy there is nothing
+ *        to cache.
+ */
+void SCHInfoRegisterHostStorage(void)
+{
+    if (sc_hinfo_tree == NULL)
+        return;
+
+    sc_hinfo_host_id = HostStorageRegister("os-policy",
+            sizeof(SCHInfoHostCache), SCHInfoHostCacheAlloc,
+            SCHInfoHostCacheFree);
+    if (sc_hinfo_host_id == -1) {
+        SCLogWarning(SC_ERR_HOST_INIT, "can't cache the host os policy "
+                "lookups in the hosts");
+    }
+}
+
 void SCHInfoCleanResources(void)
 {
     if (sc_hinfo_tree != NULL) {
         SCRadixReleaseRadixTree(sc_hinfo_tree);
         sc_hinfo_tree = NULL;
+        sc_hinfo_version++;
     }
 
     return;
@@ -1621,6 +1727,52 @@ host-os-policy:\n\
     return result;
 }
 
+/**
+ * \test lookups are cached in the host until the tree changes
+ */
+static int SCHInfoTestHostCache01(void)
+{
+    Address a;
+    memset(&a, 0, sizeof(a));
+    a.family = AF_INET;
+    FAIL_IF(inet_pton(AF_INET, "192.168.1.1", &a.addr_data32[0]) != 1);
+
+    SCHInfoCreateContextBackup();
+    StorageInit();
+    FAIL_IF(SCHInfoAddHostOSInfo("linux", "192.168.1.0/24", SC_HINFO_IS_IPV4) == -1);
+    SCHInfoRegisterHostStorage();
+    FAIL_IF(sc_hinfo_host_id == -1);
+    StorageFinalize();
+    HostInitConfig(1);
+
+    FAIL_IF(SCHInfoGetHostOSFlavourByAddr(&a) != OS_POLICY_LINUX);
+    Host *h = HostLookupHostFromHash(&a);
+    FAIL_IF_NULL(h);
+    SCHInfoHostCache *c = HostGetStorageById(h, sc_hinfo_host_id);
+    FAIL_IF_NULL(c);
+    FAIL_IF(c->policy != OS_POLICY_LINUX);
+    /* a cached result is used as is */
+    c->policy = OS_POLICY_BSD;
+    HostRelease(h);
+    FAIL_IF(SCHInfoGetHostOSFlavourByAddr(&a) != OS_POLICY_BSD);
+
+    /* a change of the tree invalidates it */
+    FAIL_IF(SCHInfoAddHostOSInfo("windows", "192.168.1.1", SC_HINFO_IS_IPV4) == -1);
+    FAIL_IF(SCHInfoGetHostOSFlavourByAddr(&a) != OS_POLICY_WINDOWS);
+
+    /* no host for addresses without a policy */
+    FAIL_IF(inet_pton(AF_INET, "10.0.0.1", &a.addr_data32[0]) != 1);
+    FAIL_IF(SCHInfoGetHostOSFlavourByAddr(&a) != -1);
+    FAIL_IF_NOT_NULL(HostLookupHostFromHash(&a));
+
+    HostShutdown();
+    StorageCleanup();
+    sc_hinfo_host_id = -1;
+    SCHInfoCleanResources();
+    SCHInfoRestoreContextBackup();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCHInfoRegisterTests(void)
@@ -1651,6 +1803,7 @@ void SCHInfoRegisterTests(void)
     UtRegisterTest("SCHInfoTestLoadFromConfig02", SCHInfoTestLoadFromConfig02);
     UtRegisterTest("SCHInfoTestLoadFromConfig03", SCHInfoTestLoadFromConfig03);
     UtRegisterTest("SCHInfoTestLoadFromConfig04", SCHInfoTestLoadFromConfig04);
+    UtRegisterTest("SCHInfoTestHostCache01", SCHInfoTestHostCache01);
 #endif /* UNITTESTS */
 
 }
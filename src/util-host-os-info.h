@@ -24,6 +24,8 @@
 #ifndef __UTIL_HOST_OS_INFO_H__
 #define __UTIL_HOST_OS_INFO_H__
 
+#include "decode.h"
+
 #define SC_HINFO_IS_IPV6 0
 #define SC_HINFO_IS_IPV4 1
 
@@ -31,6 +33,8 @@ int SCHInfoAddHostOSInfo(char *, char *, int);
 int SCHInfoGetHostOSFlavour(char *);
 int SCHInfoGetIPv4HostOSFlavour(uint8_t *);
 int SCHInfoGetIPv6HostOSFlavour(uint8_t *);
+int SCHInfoGetHostOSFlavourByAddr(Address *);
+void SCHInfoRegisterHostStorage(void);
 void SCHInfoCleanResources(void);
 void SCHInfoLoadFromConfig(void);
 void SCHInfoRegisterTests(void);
@@ -0,0 +1,255 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hugepage backed allocation, see util-hugepages.h.
+ *
+ * The pages come from an anonymous MAP_HUGETLB mapping, or from a file
+ * on a hugetlbfs mount if 'hugepages.mount' is set. Either way the
+ * pages have to be reserved by the admin (vm.nr_hugepages or the
+ * hugepagesz/hugepages boot options). The mappings are kept in a list so
+ * that SCFreeHuge() can tell them from the fallback allocations.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "counters.h"
+#include "threads.h"
+
+#include "util-hugepages.h"
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-misc.h"
+#include "util-unittest.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+typedef struct HugepagesMapping_ {
+    void *ptr;
+    size_t size;
+    struct HugepagesMapping_ *next;
+} HugepagesMapping;
+
+/** -1 config not read yet, 0 disabled, 1 enabled */
+static int hugepages_enabled = -1;
+static uint64_t hugepages_page_size = 2 * 1024 * 1024;
+static char *hugepages_mount = NULL;
+
+static SCMutex hugepages_lock = SCMUTEX_INITIALIZER;
+static HugepagesMapping *hugepages_mappings = NULL;
+
+static SC_ATOMIC_DECLARE(uint64_t, hugepages_bytes);
+static SC_ATOMIC_DECLARE(uint64_t, hugepages_fallback_bytes);
+
+static void HugepagesConfig(void)
+{
+    int enabled = 0;
+    char *val = NULL;
+
+    SC_ATOMIC_INIT(hugepages_bytes);
+    SC_ATOMIC_INIT(hugepages_fallback_bytes);
+
+    hugepages_enabled = 0;
+    if (ConfGetBool("hugepages.enabled", &enabled) != 1 || !enabled)
+        return;
+
+#if defined(MAP_HUGETLB)
+    if (ConfGet("hugepages.page-size", &val) == 1 && val != NULL) {
+        uint64_t size = 0;
+        if (ParseSizeStringU64(val, &size) < 0 ||
+                (size != 2 * 1024 * 1024 && size != 1024 * 1024 * 1024)) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "hugepages.page-size must "
+                    "be 2mb or 1gb, not '%s'", val);
+            exit(EXIT_FAILURE);
+        }
+        hugepages_page_size = size;
+    }
+    if (ConfGet("hugepages.mount", &val) == 1 && val != NULL) {
+        hugepages_mount = val;
+    }
+    hugepages_enabled = 1;
+#else
+    SCLogWarning(SC_ERR_INVALID_ARGUMENT, "hugepages are not supported on "
+            "this system");
+#endif
+}
+
+#if defined(MAP_HUGETLB)
+/** \internal
+ *  \brief map 'len' bytes, a multiple of the page size, on hugepages
+ *  \retval ptr the mapping or NULL
+ */
+static void *HugepagesMap(size_t len)
+{
+    void *ptr;
+
+    if (hugepages_mount != NULL) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/suricata.XXXXXX", hugepages_mount);
+
+        int fd = mkstemp(path);
+        if (fd < 0)
+            return NULL;
+        /* the mapping keeps the pages, the file is only needed to get them */
+        unlink(path);
+        if (ftruncate(fd, len) != 0) {
+            close(fd);
+            return NULL;
+        }
+        ptr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    } else {
+        int flags = MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB;
+#if defined(MAP_HUGE_SHIFT)
+        if (hugepages_page_size == 1024 * 1024 * 1024)
+            flags |= (30 << MAP_HUGE_SHIFT);
+#endif
+        ptr = mmap(NULL, len, PROT_READ|PROT_WRITE, flags, -1, 0);
+    }
+
+    return (ptr == MAP_FAILED) ? NULL : ptr;
+}
+#endif
+
+/**
+ * \brief allocate a big table, on hugepages if possible
+ *
+ * \param name what the memory is for, used in the log
+ * \param size size in bytes
+ *
+ * \retval ptr cache line aligned memory or NULL on failure
+ */
+void *SCMallocHuge(const char *name, size_t size)
+{
+    SCMutexLock(&hugepages_lock);
+    if (hugepages_enabled == -1)
+        HugepagesConfig();
+    SCMutexUnlock(&hugepages_lock);
+
+#if defined(MAP_HUGETLB)
+    if (hugepages_enabled && size >= HUGEPAGES_MIN_SIZE) {
+        size_t len = (size + hugepages_page_size - 1) & ~(hugepages_page_size - 1);
+        void *ptr = HugepagesMap(len);
+        if (ptr != NULL) {
+            HugepagesMapping *m = SCMalloc(sizeof(*m));
+            if (m == NULL) {
+                munmap(ptr, len);
+                return NULL;
+            }
+            m->ptr = ptr;
+            m->size = len;
+
+            SCMutexLock(&hugepages_lock);
+            m->next = hugepages_mappings;
+            hugepages_mappings = m;
+            SCMutexUnlock(&hugepages_lock);
+
+            (void) SC_ATOMIC_ADD(hugepages_bytes, len);
+            SCLogConfig("%s: %"PRIuMAX" bytes on %"PRIu64"MB hugepages",
+                    name, (uintmax_t)len, hugepages_page_size / (1024 * 1024));
+            return ptr;
+        }
+
+        (void) SC_ATOMIC_ADD(hugepages_fallback_bytes, size);
+        SCLogConfig("%s: no hugepages available (%s), using regular memory",
+                name, strerror(errno));
+    }
+#endif
+
+    return SCMallocAligned(size, CLS);
+}
+
+/**
+ * \brief free memory from SCMallocHuge()
+ */
+void SCFreeHuge(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+#if defined(MAP_HUGETLB)
+    HugepagesMapping *m, *prev = NULL;
+
+    SCMutexLock(&hugepages_lock);
+    for (m = hugepages_mappings; m != NULL; prev = m, m = m->next) {
+        if (m->ptr == ptr) {
+            if (prev != NULL)
+                prev->next = m->next;
+            else
+                hugepages_mappings = m->next;
+            break;
+        }
+    }
+    SCMutexUnlock(&hugepages_lock);
+
+    if (m != NULL) {
+        munmap(m->ptr, m->size);
+        (void) SC_ATOMIC_SUB(hugepages_bytes, m->size);
+        SCFree(m);
+        return;
+    }
+#endif
+
+    SCFreeAligned(ptr);
+}
+
+static uint64_t HugepagesCounterBytes(void)
+{
+    return SC_ATOMIC_GET(hugepages_bytes);
+}
+
+static uint64_t HugepagesCounterFallbackBytes(void)
+{
+    return SC_ATOMIC_GET(hugepages_fallback_bytes);
+}
+
+/**
+ * \brief register the hugepages.bytes and hugepages.fallback_bytes stats
+ *        counters
+ */
+void HugepagesRegisterGlobalCounters(void)
+{
+    StatsRegisterGlobalCounter("hugepages.bytes", HugepagesCounterBytes);
+    StatsRegisterGlobalCounter("hugepages.fallback_bytes",
+            HugepagesCounterFallbackBytes);
+}
+
+#ifdef UNITTESTS
+/** \test without config the regular allocator is used */
+static int HugepagesTest01(void)
+{
+    uint8_t *ptr = SCMallocHuge("test", HUGEPAGES_MIN_SIZE);
+    FAIL_IF_NULL(ptr);
+    FAIL_IF(((uintptr_t)ptr & (CLS - 1)) != 0);
+    memset(ptr, 0xff, HUGEPAGES_MIN_SIZE);
+    FAIL_IF(SC_ATOMIC_GET(hugepages_bytes) != 0);
+    SCFreeHuge(ptr);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void HugepagesRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HugepagesTest01", HugepagesTest01);
+#endif
+}
@@ -0,0 +1,40 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hugepage backed allocation of big tables, like the flow hash.
+ *
+ * SCMallocHuge() maps the memory on hugepages if enabled in the config
+ * and available, and falls back to SCMallocAligned() otherwise. The
+ * memory must be freed with SCFreeHuge().
+ */
+
+#ifndef __UTIL_HUGEPAGES_H__
+#define __UTIL_HUGEPAGES_H__
+
+/** smaller allocations don't use hugepages */
+#define HUGEPAGES_MIN_SIZE  (2 * 1024 * 1024)
+
+void *SCMallocHuge(const char *name, size_t size);
+void SCFreeHuge(void *ptr);
+
+void HugepagesRegisterGlobalCounters(void);
+void HugepagesRegisterTests(void);
+
+#endif /* __UTIL_HUGEPAGES_H__ */
@@ -445,3 +445,180 @@ int GetIfaceRSSQueuesNum(const char *pcap_dev)
     return 0;
 #endif
 }
+
+#if defined HAVE_LINUX_ETHTOOL_H && defined SIOCETHTOOL
+static int IfaceEthtoolIoctl(const char *dev, void *data)
+{
+    struct ifreq ifr;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1) {
+        SCLogWarning(SC_ERR_SYSCALL,
+                "Failure when opening socket for ioctl: %s (%d)",
+                strerror(errno), errno);
+        return -1;
+    }
+    (void)strlcpy(ifr.ifr_name, dev, sizeof(ifr.ifr_name));
+    ifr.ifr_data = data;
+
+    int r = ioctl(fd, SIOCETHTOOL, (char *)&ifr);
+    close(fd);
+    return r;
+}
+#endif
+
+#if defined HAVE_LINUX_ETHTOOL_H && defined ETHTOOL_GRSSH
+/* uapi ethtool.h documents hfunc as ETH_RSS_HASH_* bits but doesn't
+ * define them */
+#define IOCTL_RSS_HASH_XOR  (1 << 1)
+
+/** symmetric Toeplitz key: a key repeating every 16 bits gives the same
+ *  hash with source and destination (address and port) swapped */
+static const uint8_t rss_symmetric_key[2] = { 0x6d, 0x5a };
+
+/**
+ * \brief get the RSS hash settings of an interface
+ *
+ * \retval rxfh with the key following the indirection table, to be
+ *         freed by the caller, or NULL if the driver doesn't support it
+ */
+static struct ethtool_rxfh *GetIfaceRSSHash(const char *dev)
+{
+    struct ethtool_rxfh hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.cmd = ETHTOOL_GRSSH;
+    if (IfaceEthtoolIoctl(dev, &hdr) < 0) {
+        SCLogDebug("no RSS hash info for '%s': %s", dev, strerror(errno));
+        return NULL;
+    }
+    if (hdr.key_size == 0)
+        return NULL;
+
+    size_t len = sizeof(hdr) + hdr.indir_size * sizeof(uint32_t) + hdr.key_size;
+    struct ethtool_rxfh *rxfh = SCMalloc(len);
+    if (unlikely(rxfh == NULL))
+        return NULL;
+    memset(rxfh, 0, len);
+    rxfh->cmd = ETHTOOL_GRSSH;
+    rxfh->indir_size = hdr.indir_size;
+    rxfh->key_size = hdr.key_size;
+    if (IfaceEthtoolIoctl(dev, rxfh) < 0) {
+        SCFree(rxfh);
+        return NULL;
+    }
+    return rxfh;
+}
+#endif
+
+/**
+ * \brief check if the RSS hash of an interface is symmetric
+ *
+ * With a symmetric hash both directions of a flow land in the same
+ * queue, which cluster_qm and cluster_cpu rely on.
+ *
+ * \retval 1 symmetric, 0 not symmetric, -1 unknown
+ */
+int GetIfaceRSSSymmetric(const char *dev)
+{
+#if defined HAVE_LINUX_ETHTOOL_H && defined ETHTOOL_GRSSH
+    struct ethtool_rxfh *rxfh = GetIfaceRSSHash(dev);
+    if (rxfh == NULL)
+        return -1;
+
+    int symmetric = 1;
+    if (!(rxfh->hfunc & IOCTL_RSS_HASH_XOR)) {
+        const uint8_t *key = (uint8_t *)&rxfh->rss_config[rxfh->indir_size];
+        uint32_t i;
+        for (i = 2; i < rxfh->key_size; i++) {
+            if (key[i] != key[i % 2]) {
+                symmetric = 0;
+                break;
+            }
+        }
+    }
+    SCFree(rxfh);
+    return symmetric;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * \brief set a symmetric RSS hash key on an interface
+ *
+ * \retval 0 on success, -1 on error
+ */
+int SetIfaceRSSSymmetric(const char *dev)
+{
+#if defined HAVE_LINUX_ETHTOOL_H && defined ETHTOOL_SRSSH
+    struct ethtool_rxfh *rxfh = GetIfaceRSSHash(dev);
+    if (rxfh == NULL)
+        return -1;
+
+    uint32_t key_size = rxfh->key_size;
+    SCFree(rxfh);
+
+    size_t len = sizeof(*rxfh) + key_size;
+    rxfh = SCMalloc(len);
+    if (unlikely(rxfh == NULL))
+        return -1;
+    memset(rxfh, 0, len);
+    rxfh->cmd = ETHTOOL_SRSSH;
+    rxfh->indir_size = ETH_RXFH_INDIR_NO_CHANGE;
+    rxfh->key_size = key_size;
+
+    uint8_t *key = (uint8_t *)rxfh->rss_config;
+    uint32_t i;
+    for (i = 0; i < key_size; i++) {
+        key[i] = rss_symmetric_key[i % 2];
+    }
+
+    int r = IfaceEthtoolIoctl(dev, rxfh);
+    SCFree(rxfh);
+    if (r < 0) {
+        SCLogWarning(SC_ERR_SYSCALL,
+                "Failure when trying to set RSS hash key for '%s': %s (%d)",
+                dev, strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * \brief set the number of combined rx/tx queues of an interface
+ *
+ * \retval 0 on success, -1 on error
+ */
+int SetIfaceRSSQueuesNum(const char *dev, int queues)
+{
+#if defined HAVE_LINUX_ETHTOOL_H && defined ETHTOOL_SCHANNELS
+    struct ethtool_channels ch;
+
+    memset(&ch, 0, sizeof(ch));
+    ch.cmd = ETHTOOL_GCHANNELS;
+    if (IfaceEthtoolIoctl(dev, &ch) < 0)
+        return -1;
+    if (ch.max_combined == 0 || (uint32_t)queues > ch.max_combined) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "'%s' supports at most %u "
+                "combined queues, can't set %d", dev, ch.max_combined, queues);
+        return -1;
+    }
+
+    ch.cmd = ETHTOOL_SCHANNELS;
+    ch.combined_count = queues;
+    if (IfaceEthtoolIoctl(dev, &ch) < 0) {
+        SCLogWarning(SC_ERR_SYSCALL,
+                "Failure when trying to set queue count for '%s': %s (%d)",
+                dev, strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
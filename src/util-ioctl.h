@@ -25,6 +25,9 @@ int GetIfaceMTU(const char *pcap_dev);
 int GetIfaceMaxPacketSize(const char *pcap_dev);
 int GetIfaceOffloading(const char *dev, int csum, int other);
 int GetIfaceRSSQueuesNum(const char *pcap_dev);
+int SetIfaceRSSQueuesNum(const char *dev, int queues);
+int GetIfaceRSSSymmetric(const char *dev);
+int SetIfaceRSSSymmetric(const char *dev);
 #ifdef SIOCGIFFLAGS
 int GetIfaceFlags(const char *ifname);
 #endif
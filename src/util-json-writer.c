@@ -0,0 +1,917 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ *  \brief Append only JSON writer
+ *
+ *  Records are encoded member by member straight into the (thread's)
+ *  MemBuffer, so no json_t tree has to be allocated, dumped and freed
+ *  per record. Output matches what the loggers get from jansson with
+ *  JSON_COMPACT|JSON_ENSURE_ASCII|JSON_ESCAPE_SLASH: no whitespace,
+ *  non-ascii as \uXXXX escapes (surrogate pairs above the BMP), '/'
+ *  escaped. Where jansson rejects a string that is not valid UTF-8, the
+ *  writer escapes the offending bytes as \u00XX instead.
+ *
+ *  Initialized with JsonWriterInitCbor, the same calls write a framed
+ *  CBOR record (see util-json-writer.h). Objects and arrays are
+ *  indefinite length maps and arrays, so nothing needs to be patched
+ *  up but the frame header.
+ *
+ *  Errors (nesting too deep, out of memory) are sticky and reported by
+ *  JsonWriterFinish, so the callers don't need to check every call.
+ */
+
+#include "suricata-common.h"
+#include "util-json-writer.h"
+#include "util-unittest.h"
+
+/** bytes that can be copied as is, everything else goes through
+ *  JsonWriterEscape */
+static const uint8_t json_plain[256] = {
+    /* 0x00 - 0x1f: control chars */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 0x20 - 0x2f: '"' and '/' */
+    1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /* 0x50 - 0x5f: '\' */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /* 0x80 - 0xff: non-ascii, all zero */
+};
+
+static const char json_hex[] = "0123456789ABCDEF";
+
+/** \internal
+ *  \brief make sure 'len' more bytes fit, keeping one for the
+ *         terminating NUL */
+static int JsonWriterReserve(JsonWriter *jw, uint32_t len)
+{
+    MemBuffer *b = *jw->buffer;
+
+    if (unlikely(jw->error))
+        return -1;
+
+    if (MEMBUFFER_OFFSET(b) + len >= MEMBUFFER_SIZE(b)) {
+        uint32_t expand_by = jw->expand_by;
+        if (expand_by < len + 1)
+            expand_by = len + 1;
+        if (MemBufferExpand(jw->buffer, expand_by) < 0) {
+            jw->error = 1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline void JsonWriterRaw(JsonWriter *jw, const void *data, uint32_t len)
+{
+    if (JsonWriterReserve(jw, len) < 0)
+        return;
+
+    MemBuffer *b = *jw->buffer;
+    memcpy(b->buffer + b->offset, data, len);
+    b->offset += len;
+}
+
+static inline void JsonWriterChar(JsonWriter *jw, char c)
+{
+    if (JsonWriterReserve(jw, 1) < 0)
+        return;
+
+    MemBuffer *b = *jw->buffer;
+    b->buffer[b->offset++] = (uint8_t)c;
+}
+
+static void JsonWriterUnicode(uint8_t *dst, uint32_t u)
+{
+    dst[0] = '\\';
+    dst[1] = 'u';
+    dst[2] = json_hex[(u >> 12) & 0xf];
+    dst[3] = json_hex[(u >> 8) & 0xf];
+    dst[4] = json_hex[(u >> 4) & 0xf];
+    dst[5] = json_hex[u & 0xf];
+}
+
+/** \internal
+ *  \brief decode one UTF-8 sequence
+ *  \retval len of the sequence, or 0 if it is not valid UTF-8 */
+static uint32_t JsonWriterUtf8(const uint8_t *s, uint32_t len, uint32_t *cp)
+{
+    uint32_t n, u, i;
+
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        n = 2;
+        u = s[0] & 0x1f;
+    } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        n = 3;
+        u = s[0] & 0x0f;
+    } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        n = 4;
+        u = s[0] & 0x07;
+    } else {
+        return 0;
+    }
+
+    if (n > len)
+        return 0;
+
+    for (i = 1; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80)
+            return 0;
+        u = (u << 6) | (s[i] & 0x3f);
+    }
+
+    /* overlong, surrogate halves and out of range */
+    if ((n == 3 && u < 0x800) || (n == 4 && u < 0x10000) ||
+        (u >= 0xd800 && u <= 0xdfff) || u > 0x10ffff)
+        return 0;
+
+    *cp = u;
+    return n;
+}
+
+#define CBOR_UINT   0
+#define CBOR_NEGINT 1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+
+#define CBOR_FALSE      0xf4
+#define CBOR_TRUE       0xf5
+#define CBOR_NULL       0xf6
+#define CBOR_DOUBLE     0xfb
+#define CBOR_ARRAY_INDEF 0x9f
+#define CBOR_MAP_INDEF  0xbf
+#define CBOR_BREAK      0xff
+
+/** \internal
+ *  \brief CBOR major type and argument, in the shortest form */
+static void CborHead(JsonWriter *jw, uint8_t major, uint64_t val)
+{
+    uint8_t out[9];
+    uint32_t len, i;
+
+    major <<= 5;
+    if (val < 24) {
+        out[0] = major | (uint8_t)val;
+        len = 1;
+    } else if (val <= 0xff) {
+        out[0] = major | 24;
+        len = 2;
+    } else if (val <= 0xffff) {
+        out[0] = major | 25;
+        len = 3;
+    } else if (val <= 0xffffffffULL) {
+        out[0] = major | 26;
+        len = 5;
+    } else {
+        out[0] = major | 27;
+        len = 9;
+    }
+    for (i = len - 1; i > 0; i--) {
+        out[i] = (uint8_t)val;
+        val >>= 8;
+    }
+
+    JsonWriterRaw(jw, out, len);
+}
+
+/** \internal
+ *  \brief CBOR string: text if valid UTF-8, bytes otherwise */
+static void CborString(JsonWriter *jw, const uint8_t *s, uint32_t len)
+{
+    uint8_t major = CBOR_TEXT;
+    uint32_t i = 0;
+
+    while (i < len) {
+        if (s[i] < 0x80) {
+            i++;
+            continue;
+        }
+        uint32_t cp;
+        uint32_t n = JsonWriterUtf8(s + i, len - i, &cp);
+        if (n == 0) {
+            major = CBOR_BYTES;
+            break;
+        }
+        i += n;
+    }
+
+    CborHead(jw, major, len);
+    JsonWriterRaw(jw, s, len);
+}
+
+/** \internal
+ *  \brief escape the byte(s) at 's'
+ *  \retval consumed number of input bytes */
+static uint32_t JsonWriterEscape(JsonWriter *jw, const uint8_t *s, uint32_t len)
+{
+    uint8_t out[12];
+    uint32_t outlen = 2;
+    uint32_t consumed = 1;
+
+    out[0] = '\\';
+    switch (s[0]) {
+        case '"':  out[1] = '"';  break;
+        case '\\': out[1] = '\\'; break;
+        case '/':  out[1] = '/';  break;
+        case '\b': out[1] = 'b';  break;
+        case '\f': out[1] = 'f';  break;
+        case '\n': out[1] = 'n';  break;
+        case '\r': out[1] = 'r';  break;
+        case '\t': out[1] = 't';  break;
+        default: {
+            uint32_t u = s[0];
+            if (s[0] >= 0x80) {
+                uint32_t n = JsonWriterUtf8(s, len, &u);
+                if (n > 0)
+                    consumed = n;
+                else
+                    u = s[0];
+            }
+            if (u >= 0x10000) {
+                u -= 0x10000;
+                JsonWriterUnicode(out, 0xd800 | (u >> 10));
+                JsonWriterUnicode(out + 6, 0xdc00 | (u & 0x3ff));
+                outlen = 12;
+            } else {
+                JsonWriterUnicode(out, u);
+                outlen = 6;
+            }
+            break;
+        }
+    }
+
+    JsonWriterRaw(jw, out, outlen);
+    return consumed;
+}
+
+/** \internal
+ *  \brief write a quoted, escaped string */
+static void JsonWriterQuoted(JsonWriter *jw, const uint8_t *s, uint32_t len)
+{
+    uint32_t i = 0;
+
+    JsonWriterChar(jw, '"');
+    while (i < len) {
+        /* copy the run of plain bytes in one go */
+        uint32_t start = i;
+        while (i < len && json_plain[s[i]])
+            i++;
+        if (i > start)
+            JsonWriterRaw(jw, s + start, i - start);
+        if (i < len)
+            i += JsonWriterEscape(jw, s + i, len - i);
+    }
+    JsonWriterChar(jw, '"');
+}
+
+/** \internal
+ *  \brief start a new value: comma and key as needed */
+static void JsonWriterValue(JsonWriter *jw, const char *key)
+{
+    if (jw->cbor) {
+        if (key != NULL)
+            CborString(jw, (const uint8_t *)key, strlen(key));
+        return;
+    }
+
+    if (jw->comma[jw->depth])
+        JsonWriterChar(jw, ',');
+    jw->comma[jw->depth] = 1;
+
+    if (key != NULL) {
+        JsonWriterQuoted(jw, (const uint8_t *)key, strlen(key));
+        JsonWriterChar(jw, ':');
+    }
+}
+
+/**
+ *  \brief set up a writer appending to 'buffer'
+ *
+ *  The buffer is not reset, so anything already in it (e.g. the
+ *  configured prefix) is kept in front of the record.
+ *
+ *  \param expand_by minimal size to grow the buffer by
+ */
+void JsonWriterInit(JsonWriter *jw, MemBuffer **buffer, uint32_t expand_by)
+{
+    memset(jw, 0, sizeof(*jw));
+    jw->buffer = buffer;
+    jw->expand_by = expand_by;
+}
+
+/**
+ *  \brief set up a writer appending a CBOR record to 'buffer'
+ */
+void JsonWriterInitCbor(JsonWriter *jw, MemBuffer **buffer, uint32_t expand_by)
+{
+    JsonWriterInit(jw, buffer, expand_by);
+    jw->cbor = 1;
+    jw->start = (*buffer)->offset;
+
+    /* frame header, length is filled in by JsonWriterFinish */
+    static const uint8_t hdr[5] = { 0, 0, 0, 0, JSON_WRITER_CBOR_VERSION };
+    JsonWriterRaw(jw, hdr, sizeof(hdr));
+}
+
+/**
+ *  \brief finish the record, NUL terminating the buffer
+ *
+ *  \retval 0 ok
+ *  \retval -1 unbalanced nesting or a write failed
+ */
+int JsonWriterFinish(JsonWriter *jw)
+{
+    if (jw->error || jw->depth != 0)
+        return -1;
+    if (JsonWriterReserve(jw, 1) < 0)
+        return -1;
+
+    MemBuffer *b = *jw->buffer;
+    if (jw->cbor) {
+        uint32_t len = b->offset - jw->start - 4;
+        b->buffer[jw->start] = (uint8_t)(len >> 24);
+        b->buffer[jw->start + 1] = (uint8_t)(len >> 16);
+        b->buffer[jw->start + 2] = (uint8_t)(len >> 8);
+        b->buffer[jw->start + 3] = (uint8_t)len;
+    }
+    b->buffer[b->offset] = '\0';
+    return 0;
+}
+
+static void JsonWriterOpen(JsonWriter *jw, const char *key, char c,
+        uint8_t cbor)
+{
+    JsonWriterValue(jw, key);
+    if (unlikely(jw->depth + 1 >= JSON_WRITER_MAX_DEPTH)) {
+        jw->error = 1;
+        return;
+    }
+    JsonWriterChar(jw, jw->cbor ? (char)cbor : c);
+    jw->comma[++jw->depth] = 0;
+}
+
+static void JsonWriterClose(JsonWriter *jw, char c)
+{
+    if (unlikely(jw->depth == 0)) {
+        jw->error = 1;
+        return;
+    }
+    JsonWriterChar(jw, jw->cbor ? (char)CBOR_BREAK : c);
+    jw->depth--;
+}
+
+/** \param key member name, or NULL for the top level object or an
+ *             array element. Same for all the value writers below. */
+void JsonWriterOpenObject(JsonWriter *jw, const char *key)
+{
+    JsonWriterOpen(jw, key, '{', CBOR_MAP_INDEF);
+}
+
+void JsonWriterCloseObject(JsonWriter *jw)
+{
+    JsonWriterClose(jw, '}');
+}
+
+void JsonWriterOpenArray(JsonWriter *jw, const char *key)
+{
+    JsonWriterOpen(jw, key, '[', CBOR_ARRAY_INDEF);
+}
+
+void JsonWriterCloseArray(JsonWriter *jw)
+{
+    JsonWriterClose(jw, ']');
+}
+
+void JsonWriterString(JsonWriter *jw, const char *key, const char *str)
+{
+    JsonWriterStringLen(jw, key, (const uint8_t *)str, strlen(str));
+}
+
+/** \brief write a string that is not NUL terminated or may contain
+ *         NUL bytes, like a payload or a header value */
+void JsonWriterStringLen(JsonWriter *jw, const char *key,
+        const uint8_t *str, uint32_t len)
+{
+    JsonWriterValue(jw, key);
+    if (jw->cbor)
+        CborString(jw, str, len);
+    else
+        JsonWriterQuoted(jw, str, len);
+}
+
+void JsonWriterUint(JsonWriter *jw, const char *key, uint64_t val)
+{
+    char buf[24];
+    char *p = buf + sizeof(buf);
+
+    JsonWriterValue(jw, key);
+    if (jw->cbor) {
+        CborHead(jw, CBOR_UINT, val);
+        return;
+    }
+    do {
+        *--p = '0' + (val % 10);
+        val /= 10;
+    } while (val);
+    JsonWriterRaw(jw, p, (uint32_t)(buf + sizeof(buf) - p));
+}
+
+void JsonWriterInt(JsonWriter *jw, const char *key, int64_t val)
+{
+    if (val >= 0) {
+        JsonWriterUint(jw, key, (uint64_t)val);
+        return;
+    }
+
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    /* negate as unsigned, so INT64_MIN works */
+    uint64_t u = -(uint64_t)val;
+
+    JsonWriterValue(jw, key);
+    if (jw->cbor) {
+        CborHead(jw, CBOR_NEGINT, u - 1);
+        return;
+    }
+    do {
+        *--p = '0' + (u % 10);
+        u /= 10;
+    } while (u);
+    *--p = '-';
+    JsonWriterRaw(jw, p, (uint32_t)(buf + sizeof(buf) - p));
+}
+
+void JsonWriterBool(JsonWriter *jw, const char *key, int val)
+{
+    JsonWriterValue(jw, key);
+    if (jw->cbor)
+        JsonWriterChar(jw, (char)(val ? CBOR_TRUE : CBOR_FALSE));
+    else if (val)
+        JsonWriterRaw(jw, "true", 4);
+    else
+        JsonWriterRaw(jw, "false", 5);
+}
+
+void JsonWriterNull(JsonWriter *jw, const char *key)
+{
+    JsonWriterValue(jw, key);
+    if (jw->cbor)
+        JsonWriterChar(jw, (char)CBOR_NULL);
+    else
+        JsonWriterRaw(jw, "null", 4);
+}
+
+#ifdef HAVE_LIBJANSSON
+
+#define JSON_WRITER_DUMP_FLAGS \
+    (JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|JSON_ESCAPE_SLASH)
+
+static int JsonWriterDumpCallback(const char *str, size_t size, void *data)
+{
+    JsonWriter *jw = data;
+    JsonWriterRaw(jw, str, (uint32_t)size);
+    return jw->error ? -1 : 0;
+}
+
+/** \internal
+ *  \brief encode a json_t value as CBOR
+ *
+ *  Walks the tree, so object members come in jansson's hash order
+ *  rather than insertion order, which doesn't matter to CBOR maps.
+ */
+static void CborJson(JsonWriter *jw, const char *key, json_t *js)
+{
+    size_t i;
+    void *iter;
+
+    switch (json_typeof(js)) {
+        case JSON_OBJECT:
+            JsonWriterOpenObject(jw, key);
+            for (iter = json_object_iter(js); iter != NULL;
+                 iter = json_object_iter_next(js, iter))
+            {
+                CborJson(jw, json_object_iter_key(iter),
+                        json_object_iter_value(iter));
+            }
+            JsonWriterCloseObject(jw);
+            break;
+        case JSON_ARRAY:
+            JsonWriterOpenArray(jw, key);
+            for (i = 0; i < json_array_size(js); i++) {
+                CborJson(jw, NULL, json_array_get(js, i));
+            }
+            JsonWriterCloseArray(jw);
+            break;
+        case JSON_REAL: {
+            union {
+                double d;
+                uint64_t u;
+            } v;
+            uint8_t out[9];
+            int b;
+            v.d = json_real_value(js);
+            out[0] = CBOR_DOUBLE;
+            for (b = 8; b > 0; b--) {
+                out[b] = (uint8_t)v.u;
+                v.u >>= 8;
+            }
+            JsonWriterValue(jw, key);
+            JsonWriterRaw(jw, out, sizeof(out));
+            break;
+        }
+        case JSON_STRING:
+            JsonWriterString(jw, key, json_string_value(js));
+            break;
+        case JSON_INTEGER:
+            JsonWriterInt(jw, key, (int64_t)json_integer_value(js));
+            break;
+        case JSON_TRUE:
+            JsonWriterBool(jw, key, 1);
+            break;
+        case JSON_FALSE:
+            JsonWriterBool(jw, key, 0);
+            break;
+        case JSON_NULL:
+            JsonWriterNull(jw, key);
+            break;
+    }
+}
+
+/**
+ *  \brief write a json_t value as member 'key'
+ *
+ *  For code that still builds (part of) its record as a json_t tree,
+ *  e.g. shared helpers that haven't been converted yet.
+ */
+void JsonWriterJson(JsonWriter *jw, const char *key, json_t *js)
+{
+    char buf[32];
+
+    if (jw->cbor) {
+        CborJson(jw, key, js);
+        return;
+    }
+
+    switch (json_typeof(js)) {
+        case JSON_OBJECT:
+        case JSON_ARRAY:
+            JsonWriterValue(jw, key);
+            if (json_dump_callback(js, JsonWriterDumpCallback, jw,
+                        JSON_WRITER_DUMP_FLAGS) != 0)
+                jw->error = 1;
+            break;
+        case JSON_STRING:
+            JsonWriterString(jw, key, json_string_value(js));
+            break;
+        case JSON_INTEGER:
+            JsonWriterInt(jw, key, (int64_t)json_integer_value(js));
+            break;
+        case JSON_REAL:
+            /* same format as jansson */
+            snprintf(buf, sizeof(buf), "%.17g", json_real_value(js));
+            if (strpbrk(buf, ".eE") == NULL && strlen(buf) + 2 < sizeof(buf))
+                strlcat(buf, ".0", sizeof(buf));
+            JsonWriterValue(jw, key);
+            JsonWriterRaw(jw, buf, strlen(buf));
+            break;
+        case JSON_TRUE:
+            JsonWriterBool(jw, key, 1);
+            break;
+        case JSON_FALSE:
+            JsonWriterBool(jw, key, 0);
+            break;
+        case JSON_NULL:
+            JsonWriterNull(jw, key);
+            break;
+    }
+}
+
+/**
+ *  \brief write the members of json_t object 'js' into the currently
+ *         open object, in insertion order
+ */
+void JsonWriterJsonMembers(JsonWriter *jw, json_t *js)
+{
+    if (!json_is_object(js) || json_object_size(js) == 0)
+        return;
+
+    if (jw->cbor) {
+        void *iter;
+        for (iter = json_object_iter(js); iter != NULL;
+             iter = json_object_iter_next(js, iter))
+        {
+            CborJson(jw, json_object_iter_key(iter),
+                    json_object_iter_value(iter));
+        }
+        return;
+    }
+
+    /* dump the object as a whole to keep the member order, then drop
+     * its braces */
+    if (jw->comma[jw->depth])
+        JsonWriterChar(jw, ',');
+    jw->comma[jw->depth] = 1;
+
+    uint32_t start = (*jw->buffer)->offset;
+    if (json_dump_callback(js, JsonWriterDumpCallback, jw,
+                JSON_WRITER_DUMP_FLAGS) != 0) {
+        jw->error = 1;
+        return;
+    }
+    if (jw->error)
+        return;
+
+    MemBuffer *b = *jw->buffer;
+    uint32_t len = b->offset - start;
+    memmove(b->buffer + start, b->buffer + start + 1, len - 2);
+    b->offset -= 2;
+}
+
+#endif /* HAVE_LIBJANSSON */
+
+#ifdef UNITTESTS
+
+static int JsonWriterTestCompare(MemBuffer *b, const char *expect)
+{
+    if (b->offset != strlen(expect) ||
+        memcmp(b->buffer, expect, b->offset) != 0) {
+        printf("got \"%s\", expected \"%s\": ", (char *)b->buffer, expect);
+        return 0;
+    }
+    return 1;
+}
+
+/** \test structure, commas, numbers */
+static int JsonWriterTest01(void)
+{
+    MemBuffer *b = MemBufferCreateNew(8);
+    FAIL_IF_NULL(b);
+
+    JsonWriter jw;
+    JsonWriterInit(&jw, &b, 4);
+    JsonWriterOpenObject(&jw, NULL);
+    JsonWriterUint(&jw, "a", 0);
+    JsonWriterInt(&jw, "b", -12);
+    JsonWriterUint(&jw, "c", 18446744073709551615ULL);
+    JsonWriterOpenArray(&jw, "d");
+    JsonWriterUint(&jw, NULL, 1);
+    JsonWriterBool(&jw, NULL, 1);
+    JsonWriterNull(&jw, NULL);
+    JsonWriterOpenObject(&jw, NULL);
+    JsonWriterCloseObject(&jw);
+    JsonWriterCloseArray(&jw);
+    JsonWriterBool(&jw, "e", 0);
+    JsonWriterCloseObject(&jw);
+    FAIL_IF(JsonWriterFinish(&jw) != 0);
+
+    FAIL_IF_NOT(JsonWriterTestCompare(b, "{\"a\":0,\"b\":-12,"
+                "\"c\":18446744073709551615,\"d\":[1,true,null,{}],"
+                "\"e\":false}"));
+
+    MemBufferFree(b);
+    PASS;
+}
+
+/** \test escaping */
+static int JsonWriterTest02(void)
+{
+    /* quote, slash, backslash, controls, 2/3/4 byte UTF-8, a stray
+     * continuation byte, a NUL and a truncated sequence */
+    static const uint8_t str[] = "a\"/\\\b\f\n\r\t\x01"
+        "\xc3\xa9" "\xe2\x82\xac" "\xf0\x9f\x98\x80" "\x80" "\0" "\xe2\x82";
+
+    MemBuffer *b = MemBufferCreateNew(8);
+    FAIL_IF_NULL(b);
+
+    JsonWriter jw;
+    JsonWriterInit(&jw, &b, 4);
+    JsonWriterOpenObject(&jw, NULL);
+    JsonWriterStringLen(&jw, "k/", str, sizeof(str) - 1);
+    JsonWriterCloseObject(&jw);
+    FAIL_IF(JsonWriterFinish(&jw) != 0);
+
+    FAIL_IF_NOT(JsonWriterTestCompare(b, "{\"k\\/\":\"a\\\"\\/\\\\"
+                "\\b\\f\\n\\r\\t\\u0001\\u00E9\\u20AC\\uD83D\\uDE00"
+                "\\u0080\\u0000\\u00E2\\u0082\"}"));
+
+    MemBufferFree(b);
+    PASS;
+}
+
+/** \test unbalanced nesting is reported */
+static int JsonWriterTest03(void)
+{
+    MemBuffer *b = MemBufferCreateNew(64);
+    FAIL_IF_NULL(b);
+
+    JsonWriter jw;
+    JsonWriterInit(&jw, &b, 64);
+    JsonWriterOpenObject(&jw, NULL);
+    FAIL_IF(JsonWriterFinish(&jw) == 0);
+
+    MemBufferReset(b);
+    JsonWriterInit(&jw, &b, 64);
+    JsonWriterCloseObject(&jw);
+    FAIL_IF(JsonWriterFinish(&jw) == 0);
+
+    MemBufferFree(b);
+    PASS;
+}
+
+/** \test CBOR record */
+static int JsonWriterTest05(void)
+{
+    static const uint8_t expect[] = {
+        0x00, 0x00, 0x00, 0x1c, JSON_WRITER_CBOR_VERSION,
+        0xbf,
+        0x61, 'a', 0x01,
+        0x61, 'b', 0x21,
+        0x61, 'c', 0x61, 'x',
+        0x61, 'd', 0x9f, 0xf5, 0xf6, 0xff,
+        0x61, 'e', 0x41, 0xff,
+        0x61, 'f', 0x19, 0x01, 0xf4,
+        0xff,
+    };
+
+    MemBuffer *b = MemBufferCreateNew(8);
+    FAIL_IF_NULL(b);
+
+    JsonWriter jw;
+    JsonWriterInitCbor(&jw, &b, 4);
+    JsonWriterOpenObject(&jw, NULL);
+    JsonWriterUint(&jw, "a", 1);
+    JsonWriterInt(&jw, "b", -2);
+    JsonWriterString(&jw, "c", "x");
+    JsonWriterOpenArray(&jw, "d");
+    JsonWriterBool(&jw, NULL, 1);
+    JsonWriterNull(&jw, NULL);
+    JsonWriterCloseArray(&jw);
+    /* not UTF-8, so a byte string */
+    JsonWriterStringLen(&jw, "e", (const uint8_t *)"\xff", 1);
+    JsonWriterUint(&jw, "f", 500);
+    JsonWriterCloseObject(&jw);
+    FAIL_IF(JsonWriterFinish(&jw) != 0);
+
+    FAIL_IF(b->offset != sizeof(expect));
+    FAIL_IF(memcmp(b->buffer, expect, sizeof(expect)) != 0);
+
+    MemBufferFree(b);
+    PASS;
+}
+
+#ifdef HAVE_LIBJANSSON
+/** \test output is the same as the json_t dump it replaces */
+static int JsonWriterTest04(void)
+{
+    static const char *str = "GET /index.html?q=\"x\" \xc3\xa9\x01";
+
+    json_t *js = json_object();
+    FAIL_IF_NULL(js);
+    json_object_set_new(js, "timestamp", json_string("2016-01-01T00:00:00"));
+    json_object_set_new(js, "flow_id", json_integer(1234567));
+    json_object_set_new(js, "url", json_string(str));
+    json_t *arr = json_array();
+    FAIL_IF_NULL(arr);
+    json_array_append_new(arr, json_integer(10));
+    json_array_append_new(arr, json_integer(-20));
+    json_object_set_new(js, "vlan", arr);
+    json_object_set_new(js, "syn", json_true());
+
+    char *expect = json_dumps(js, JSON_WRITER_DUMP_FLAGS);
+    FAIL_IF_NULL(expect);
+
+    MemBuffer *b = MemBufferCreateNew(16);
+    FAIL_IF_NULL(b);
+    JsonWriter jw;
+    JsonWriterInit(&jw, &b, 16);
+    JsonWriterOpenObject(&jw, NULL);
+    JsonWriterString(&jw, "timestamp", "2016-01-01T00:00:00");
+    JsonWriterUint(&jw, "flow_id", 1234567);
+    JsonWriterString(&jw, "url", str);
+    JsonWriterOpenArray(&jw, "vlan");
+    JsonWriterInt(&jw, NULL, 10);
+    JsonWriterInt(&jw, NULL, -20);
+    JsonWriterCloseArray(&jw);
+    JsonWriterBool(&jw, "syn", 1);
+    JsonWriterCloseObject(&jw);
+    FAIL_IF(JsonWriterFinish(&jw) != 0);
+    FAIL_IF_NOT(JsonWriterTestCompare(b, expect));
+
+    /* same again through the json_t shim */
+    MemBufferReset(b);
+    JsonWriterInit(&jw, &b, 16);
+    JsonWriterOpenObject(&jw, NULL);
+    JsonWriterJsonMembers(&jw, js);
+    JsonWriterCloseObject(&jw);
+    FAIL_IF(JsonWriterFinish(&jw) != 0);
+    FAIL_IF_NOT(JsonWriterTestCompare(b, expect));
+
+    free(expect);
+    json_decref(js);
+    MemBufferFree(b);
+    PASS;
+}
+#endif /* HAVE_LIBJANSSON */
+
+/** \internal
+ *  \brief write a record shaped like an eve alert */
+static void JsonWriterBenchRecord(JsonWriter *jw, uint64_t n)
+{
+    JsonWriterOpenObject(jw, NULL);
+    JsonWriterString(jw, "timestamp", "2016-01-01T00:00:00.123456+0000");
+    JsonWriterUint(jw, "flow_id", 1234567890123ULL + n);
+    JsonWriterString(jw, "event_type", "alert");
+    JsonWriterString(jw, "src_ip", "192.168.1.5");
+    JsonWriterUint(jw, "src_port", 49152);
+    JsonWriterString(jw, "dest_ip", "10.0.0.1");
+    JsonWriterUint(jw, "dest_port", 80);
+    JsonWriterString(jw, "proto", "TCP");
+    JsonWriterOpenObject(jw, "alert");
+    JsonWriterString(jw, "action", "allowed");
+    JsonWriterUint(jw, "gid", 1);
+    JsonWriterUint(jw, "signature_id", 2000001);
+    JsonWriterUint(jw, "rev", 3);
+    JsonWriterString(jw, "signature", "ET POLICY \"curl\" User-Agent Outbound");
+    JsonWriterString(jw, "category", "Attempted Information Leak");
+    JsonWriterUint(jw, "severity", 2);
+    JsonWriterCloseObject(jw);
+    JsonWriterOpenObject(jw, "http");
+    JsonWriterString(jw, "hostname", "www.example.com");
+    JsonWriterString(jw, "url", "/index.html?q=a%20b&lang=en");
+    JsonWriterString(jw, "http_user_agent", "curl/7.47.0");
+    JsonWriterUint(jw, "length", 4096);
+    JsonWriterCloseObject(jw);
+    JsonWriterCloseObject(jw);
+}
+
+static int JsonWriterBench(UtBench *b, int cbor)
+{
+    MemBuffer *buf = MemBufferCreateNew(1024);
+    FAIL_IF_NULL(buf);
+    JsonWriter jw;
+
+    UtBenchResetTimer(b);
+    uint64_t n;
+    for (n = 0; n < b->n; n++) {
+        MemBufferReset(buf);
+        if (cbor)
+            JsonWriterInitCbor(&jw, &buf, 1024);
+        else
+            JsonWriterInit(&jw, &buf, 1024);
+        JsonWriterBenchRecord(&jw, n);
+        FAIL_IF(JsonWriterFinish(&jw) != 0);
+    }
+    b->bytes = MEMBUFFER_OFFSET(buf);
+
+    MemBufferFree(buf);
+    PASS;
+}
+
+static int JsonWriterBench01(UtBench *b)
+{
+    return JsonWriterBench(b, 0);
+}
+
+static int JsonWriterBench02(UtBench *b)
+{
+    return JsonWriterBench(b, 1);
+}
+
+#endif /* UNITTESTS */
+
+void JsonWriterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("JsonWriterTest01", JsonWriterTest01);
+    UtRegisterTest("JsonWriterTest02", JsonWriterTest02);
+    UtRegisterTest("JsonWriterTest03", JsonWriterTest03);
+    UtRegisterTest("JsonWriterTest05", JsonWriterTest05);
+#ifdef HAVE_LIBJANSSON
+    UtRegisterTest("JsonWriterTest04", JsonWriterTest04);
+#endif
+
+    UtRegisterBenchmark("JsonWriterBench01 -- eve alert record", JsonWriterBench01);
+    UtRegisterBenchmark("JsonWriterBench02 -- eve alert record, cbor",
+                        JsonWriterBench02);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,88 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Append only JSON writer that encodes straight into a MemBuffer,
+ * producing the same compact, ascii only output as the jansson dump
+ * used by the eve loggers.
+ *
+ * The same calls can produce binary eve records instead (format: cbor).
+ * Each record is then framed as:
+ *
+ *   uint32_t length     big endian, length of what follows
+ *   uint8_t  version    JSON_WRITER_CBOR_VERSION
+ *   CBOR map            RFC 7049, same members as the JSON record
+ *
+ * Strings that are valid UTF-8 are CBOR text strings, others (payload
+ * like data) byte strings. Readers can skip records on the length
+ * alone and use the strings in place, as they are length prefixed.
+ */
+
+#ifndef __UTIL_JSON_WRITER_H__
+#define __UTIL_JSON_WRITER_H__
+
+#include "util-buffer.h"
+
+#define JSON_WRITER_MAX_DEPTH 32
+
+/** version of the binary record layout, bumped when members change
+ *  type or meaning */
+#define JSON_WRITER_CBOR_VERSION 1
+
+typedef struct JsonWriter_ {
+    MemBuffer **buffer;     /**< buffer to use & expand as needed */
+    uint32_t expand_by;     /**< expand by at least this size */
+    uint8_t depth;
+    /** set when something went wrong: nesting, memory */
+    uint8_t error;
+    /** write CBOR instead of JSON */
+    uint8_t cbor;
+    /** cbor: offset of the record's frame header */
+    uint32_t start;
+    /** per nesting level: a member was already written, so the next
+     *  one needs a comma */
+    uint8_t comma[JSON_WRITER_MAX_DEPTH];
+} JsonWriter;
+
+void JsonWriterInit(JsonWriter *jw, MemBuffer **buffer, uint32_t expand_by);
+void JsonWriterInitCbor(JsonWriter *jw, MemBuffer **buffer, uint32_t expand_by);
+int JsonWriterFinish(JsonWriter *jw);
+
+void JsonWriterOpenObject(JsonWriter *jw, const char *key);
+void JsonWriterCloseObject(JsonWriter *jw);
+void JsonWriterOpenArray(JsonWriter *jw, const char *key);
+void JsonWriterCloseArray(JsonWriter *jw);
+
+void JsonWriterString(JsonWriter *jw, const char *key, const char *str);
+void JsonWriterStringLen(JsonWriter *jw, const char *key,
+        const uint8_t *str, uint32_t len);
+void JsonWriterUint(JsonWriter *jw, const char *key, uint64_t val);
+void JsonWriterInt(JsonWriter *jw, const char *key, int64_t val);
+void JsonWriterBool(JsonWriter *jw, const char *key, int val);
+void JsonWriterNull(JsonWriter *jw, const char *key);
+
+#ifdef HAVE_LIBJANSSON
+/* compatibility with code still building json_t trees */
+void JsonWriterJson(JsonWriter *jw, const char *key, json_t *js);
+void JsonWriterJsonMembers(JsonWriter *jw, json_t *js);
+#endif
+
+void JsonWriterRegisterTests(void);
+
+#endif /* __UTIL_JSON_WRITER_H__ */
@@ -0,0 +1,217 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled packet latency histograms, in nanoseconds.
+ *
+ * Stage times are taken with the cpu ticks, converted using the tick
+ * rate measured at startup. The total of a packet that moves between
+ * threads (autofp) assumes the ticks of the cpus are in sync, which
+ * holds for the invariant TSC of current x86 cpus.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "decode.h"
+#include "pkt-var.h"
+#include "threadvars.h"
+#include "runmodes.h"
+
+#include "util-latency.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-profiling.h"
+#include "util-unittest.h"
+
+#define LATENCY_DEFAULT_RATE 1000
+
+/** time the tick rate is measured over at startup, in usec */
+#define LATENCY_CALIBRATE_USEC 10000
+
+uint32_t packet_latency_rate = 0;
+
+static double latency_ns_per_tick = 1.0;
+/** packet timestamps are the capture time: live capture */
+static int latency_live = 0;
+
+static const char *latency_names[LATENCY_STAGES] = {
+    "latency.capture",
+    "latency.decode",
+    "latency.flow",
+    "latency.stream",
+    "latency.detect",
+    "latency.output",
+    "latency.total",
+};
+
+/** \internal
+ *  \brief measure the length of a tick against the wall clock */
+static void PacketLatencyCalibrate(void)
+{
+    struct timeval tv_start, tv_end;
+
+    gettimeofday(&tv_start, NULL);
+    uint64_t start = UtilCpuGetTicks();
+    usleep(LATENCY_CALIBRATE_USEC);
+    uint64_t end = UtilCpuGetTicks();
+    gettimeofday(&tv_end, NULL);
+
+    uint64_t usec = (uint64_t)(tv_end.tv_sec - tv_start.tv_sec) * 1000000 +
+        tv_end.tv_usec - tv_start.tv_usec;
+    if (end > start && usec > 0)
+        latency_ns_per_tick = (double)(usec * 1000) / (double)(end - start);
+
+    SCLogConfig("packet latency: %.3f ns per tick", latency_ns_per_tick);
+}
+
+/**
+ * \brief read the stats.latency config
+ */
+void PacketLatencyInit(void)
+{
+    ConfNode *node = ConfGetNode("stats.latency");
+    if (node == NULL)
+        return;
+
+    int enabled = 0;
+    if (ConfGetChildValueBool(node, "enabled", &enabled) != 1 || !enabled)
+        return;
+
+    intmax_t rate = LATENCY_DEFAULT_RATE;
+    if (ConfGetChildValueInt(node, "sample-rate", &rate) == 1) {
+        if (rate < 1 || rate > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "stats.latency.sample-rate "
+                    "%"PRIdMAX" is invalid, using %u", rate, LATENCY_DEFAULT_RATE);
+            rate = LATENCY_DEFAULT_RATE;
+        }
+    }
+
+    int mode = RunmodeGetCurrent();
+    latency_live = !(mode == RUNMODE_PCAP_FILE || mode == RUNMODE_ERF_FILE ||
+            mode == RUNMODE_UNIX_SOCKET || mode == RUNMODE_SYNTHETIC ||
+            mode == RUNMODE_UNITTEST);
+
+    PacketLatencyCalibrate();
+    packet_latency_rate = (uint32_t)rate;
+    SCLogConfig("packet latency: sampling 1 in %u packets", packet_latency_rate);
+}
+
+/**
+ * \brief register the latency histograms of a packet thread. Call
+ *        before its counters are set up.
+ */
+void PacketLatencyThreadInit(ThreadVars *tv)
+{
+    if (packet_latency_rate == 0)
+        return;
+
+    int i;
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        if (i == LATENCY_CAPTURE && !latency_live)
+            continue;
+        tv->latency.id[i] = StatsRegisterHistogramCounter(latency_names[i], tv);
+    }
+}
+
+/**
+ * \brief start sampling 'p', see PACKET_LATENCY_SAMPLE
+ */
+void PacketLatencyStart(ThreadVars *tv, Packet *p)
+{
+    p->latency_ticks = UtilCpuGetTicks();
+
+    if (latency_live && tv->latency.id[LATENCY_CAPTURE] != 0 &&
+            !PKT_IS_PSEUDOPKT(p) && p->ts.tv_sec != 0)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+
+        int64_t usec = (int64_t)(now.tv_sec - p->ts.tv_sec) * 1000000 +
+            (now.tv_usec - p->ts.tv_usec);
+        /* nics and the clock can disagree a bit */
+        if (usec >= 0) {
+            StatsHistogramAdd(tv, tv->latency.id[LATENCY_CAPTURE],
+                    (uint64_t)usec * 1000);
+        }
+    }
+}
+
+/**
+ * \brief add 'ticks' spent by a sampled packet in 'stage'
+ */
+void PacketLatencyAdd(ThreadVars *tv, int stage, uint64_t ticks)
+{
+    if (tv->latency.id[stage] == 0)
+        return;
+
+    StatsHistogramAdd(tv, tv->latency.id[stage],
+            (uint64_t)((double)ticks * latency_ns_per_tick));
+}
+
+#ifdef UNITTESTS
+static int PacketLatencyTest01(void)
+{
+    ThreadVars tv;
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+
+    memset(&tv, 0, sizeof(tv));
+    uint32_t rate = packet_latency_rate;
+    packet_latency_rate = 2;
+
+    PacketLatencyThreadInit(&tv);
+    FAIL_IF(tv.latency.id[LATENCY_CAPTURE] != 0);
+    FAIL_IF(tv.latency.id[LATENCY_DETECT] == 0);
+    StatsSetupPrivate(&tv);
+
+    /* 1 in 2 */
+    PACKET_LATENCY_SAMPLE(&tv, p);
+    FAIL_IF(p->latency_ticks != 0);
+    PACKET_LATENCY_SAMPLE(&tv, p);
+    FAIL_IF(p->latency_ticks == 0);
+
+    uint64_t ticks = PACKET_LATENCY_TICKS(p);
+    FAIL_IF(ticks == 0);
+    PACKET_LATENCY_END(&tv, LATENCY_DETECT, ticks);
+
+    /* one value in one of the buckets of the detect histogram */
+    uint16_t id = tv.latency.id[LATENCY_DETECT];
+    uint64_t cnt = 0;
+    int i;
+    for (i = 0; i <= STATS_HISTOGRAM_BUCKETS; i++)
+        cnt += StatsGetLocalCounterValue(&tv, id + i);
+    FAIL_IF(cnt != 1);
+
+    PACKET_REINIT(p);
+    FAIL_IF(p->latency_ticks != 0);
+
+    packet_latency_rate = rate;
+    StatsThreadCleanup(&tv);
+    PacketFree(p);
+    PASS;
+}
+#endif
+
+void PacketLatencyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PacketLatencyTest01", PacketLatencyTest01);
+#endif
+}
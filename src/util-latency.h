@@ -0,0 +1,88 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled per packet latency of the pipeline stages, kept in histogram
+ * counters (see StatsRegisterHistogramCounter) so the stats thread
+ * merges them and every stats output has them. Unlike the profiling
+ * code this is in every build: packets that are not sampled only cost
+ * a counter increment on entering the slots.
+ */
+
+#ifndef __UTIL_LATENCY_H__
+#define __UTIL_LATENCY_H__
+
+#include "util-cpu.h"
+
+struct ThreadVars_;
+struct Packet_;
+
+enum PacketLatencyStage {
+    LATENCY_CAPTURE = 0,    /**< packet timestamp to the start of processing,
+                                 live capture only */
+    LATENCY_DECODE,
+    LATENCY_FLOW,
+    LATENCY_STREAM,         /**< stream engine and app-layer */
+    LATENCY_DETECT,
+    LATENCY_OUTPUT,         /**< loggers and the other slots after detect */
+    LATENCY_TOTAL,          /**< start of processing to the end of the
+                                 pipeline, including the queues between
+                                 threads */
+
+    LATENCY_STAGES,
+};
+
+typedef struct PacketLatencyThread_ {
+    /** packets since the last sample */
+    uint32_t cnt;
+    /** histogram id per stage, 0 if not registered */
+    uint16_t id[LATENCY_STAGES];
+} PacketLatencyThread;
+
+/** sample 1 in packet_latency_rate packets, 0 if disabled */
+extern uint32_t packet_latency_rate;
+
+void PacketLatencyInit(void);
+void PacketLatencyThreadInit(struct ThreadVars_ *tv);
+void PacketLatencyStart(struct ThreadVars_ *tv, struct Packet_ *p);
+void PacketLatencyAdd(struct ThreadVars_ *tv, int stage, uint64_t ticks);
+
+/** \brief sample 'p' if it's its turn and it isn't sampled yet */
+#define PACKET_LATENCY_SAMPLE(tv, p) do {                       \
+        if (unlikely(packet_latency_rate != 0) &&               \
+                (p)->latency_ticks == 0 &&                      \
+                ++(tv)->latency.cnt >= packet_latency_rate) {   \
+            (tv)->latency.cnt = 0;                              \
+            PacketLatencyStart((tv), (p));                      \
+        }                                                       \
+    } while (0)
+
+/** \brief start of a stage: ticks if 'p' is sampled, 0 otherwise */
+#define PACKET_LATENCY_TICKS(p) \
+    (unlikely((p)->latency_ticks != 0) ? UtilCpuGetTicks() : 0)
+
+/** \brief end of a stage that started at 'start' */
+#define PACKET_LATENCY_END(tv, stage, start) do {               \
+        if (unlikely((start) != 0))                             \
+            PacketLatencyAdd((tv), (stage), UtilCpuGetTicks() - (start)); \
+    } while (0)
+
+void PacketLatencyRegisterTests(void);
+
+#endif /* __UTIL_LATENCY_H__ */
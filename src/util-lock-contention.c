@@ -0,0 +1,119 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Lock contention counters, see util-lock-contention.h. Reported as the
+ * locks.<name>_contended stats counters.
+ */
+
+#include "suricata-common.h"
+#include "counters.h"
+
+#include "util-lock-contention.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+LockContentionCounter lock_contention[LOCK_CONTENTION_MAX];
+
+void LockContentionInit(void)
+{
+    int i;
+
+    memset(lock_contention, 0, sizeof(lock_contention));
+    for (i = 0; i < LOCK_CONTENTION_MAX; i++) {
+        SC_ATOMIC_INIT(lock_contention[i].contended);
+    }
+}
+
+#define LOCK_CONTENTION_COUNTER_FUNC(id, name)                  \
+static uint64_t LockContentionCounter_##name(void)              \
+{                                                               \
+    return SC_ATOMIC_GET(lock_contention[(id)].contended);      \
+}
+
+LOCK_CONTENTION_COUNTER_FUNC(LOCK_CONTENTION_FLOW_BUCKET, flow_bucket)
+LOCK_CONTENTION_COUNTER_FUNC(LOCK_CONTENTION_FLOW, flow)
+LOCK_CONTENTION_COUNTER_FUNC(LOCK_CONTENTION_HOST_ROW, host_row)
+LOCK_CONTENTION_COUNTER_FUNC(LOCK_CONTENTION_SEGMENT_POOL, segment_pool)
+LOCK_CONTENTION_COUNTER_FUNC(LOCK_CONTENTION_PACKET_POOL, packet_pool)
+LOCK_CONTENTION_COUNTER_FUNC(LOCK_CONTENTION_LOG_FILE, log_file)
+LOCK_CONTENTION_COUNTER_FUNC(LOCK_CONTENTION_STATS, stats)
+
+#define LOCK_CONTENTION_REGISTER(name)                                  \
+    StatsRegisterGlobalCounter("locks." #name "_contended",             \
+            LockContentionCounter_##name);
+
+/**
+ * \brief register the locks.<name>_contended stats counters
+ */
+void LockContentionRegisterGlobalCounters(void)
+{
+    LOCK_CONTENTION_REGISTER(flow_bucket);
+    LOCK_CONTENTION_REGISTER(flow);
+    LOCK_CONTENTION_REGISTER(host_row);
+    LOCK_CONTENTION_REGISTER(segment_pool);
+    LOCK_CONTENTION_REGISTER(packet_pool);
+    LOCK_CONTENTION_REGISTER(log_file);
+    LOCK_CONTENTION_REGISTER(stats);
+}
+
+#ifdef UNITTESTS
+static SCMutex lock_contention_test_mutex;
+
+static void *LockContentionTestThread(void *arg)
+{
+    SCMutexLockCounted(&lock_contention_test_mutex, LOCK_CONTENTION_STATS);
+    SCMutexUnlock(&lock_contention_test_mutex);
+    return NULL;
+}
+
+/** \test uncontended locking doesn't count, contended locking does */
+static int LockContentionTest01(void)
+{
+    uint64_t before;
+    pthread_t t;
+
+    SCMutexInit(&lock_contention_test_mutex, NULL);
+
+    before = SC_ATOMIC_GET(lock_contention[LOCK_CONTENTION_STATS].contended);
+    SCMutexLockCounted(&lock_contention_test_mutex, LOCK_CONTENTION_STATS);
+    SCMutexUnlock(&lock_contention_test_mutex);
+    FAIL_IF(SC_ATOMIC_GET(lock_contention[LOCK_CONTENTION_STATS].contended) != before);
+
+    /* hold the lock while the thread tries to take it */
+    SCMutexLock(&lock_contention_test_mutex);
+    FAIL_IF(pthread_create(&t, NULL, LockContentionTestThread, NULL) != 0);
+    while (SC_ATOMIC_GET(lock_contention[LOCK_CONTENTION_STATS].contended) == before)
+        usleep(1000);
+    SCMutexUnlock(&lock_contention_test_mutex);
+    pthread_join(t, NULL);
+
+    FAIL_IF(SC_ATOMIC_GET(lock_contention[LOCK_CONTENTION_STATS].contended) != before + 1);
+
+    SCMutexDestroy(&lock_contention_test_mutex);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void LockContentionRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LockContentionTest01", LockContentionTest01);
+#endif
+}
@@ -0,0 +1,75 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Contention counters for the hot locks, in every build.
+ *
+ * The counted lock macros try the lock first and only on failure bump
+ * the counter of the lock before blocking on it, so an uncontended
+ * acquisition costs the same as a plain lock. Unlike the lock profiling
+ * build this doesn't time the waits, it tells which lock is contended.
+ */
+
+#ifndef __UTIL_LOCK_CONTENTION_H__
+#define __UTIL_LOCK_CONTENTION_H__
+
+#include "threads.h"
+#include "util-atomic.h"
+
+enum LockContentionId {
+    LOCK_CONTENTION_FLOW_BUCKET = 0,
+    LOCK_CONTENTION_FLOW,
+    LOCK_CONTENTION_HOST_ROW,       /**< host and ippair hash rows */
+    LOCK_CONTENTION_SEGMENT_POOL,
+    LOCK_CONTENTION_PACKET_POOL,    /**< packet pool return stacks */
+    LOCK_CONTENTION_LOG_FILE,
+    LOCK_CONTENTION_STATS,
+
+    LOCK_CONTENTION_MAX,
+};
+
+/** one cache line per lock, the counters are bumped from all threads */
+typedef struct LockContentionCounter_ {
+    SC_ATOMIC_DECLARE(uint64_t, contended);
+} __attribute__((aligned(CLS))) LockContentionCounter;
+
+extern LockContentionCounter lock_contention[LOCK_CONTENTION_MAX];
+
+#define LockContentionHit(id) \
+    (void) SC_ATOMIC_ADD(lock_contention[(id)].contended, 1)
+
+#define SCMutexLockCounted(mut, id) do {        \
+        if (SCMutexTrylock((mut)) != 0) {       \
+            LockContentionHit((id));            \
+            SCMutexLock((mut));                 \
+        }                                       \
+    } while (0)
+
+#define SCSpinLockCounted(spin, id) do {        \
+        if (SCSpinTrylock((spin)) != 0) {       \
+            LockContentionHit((id));            \
+            SCSpinLock((spin));                 \
+        }                                       \
+    } while (0)
+
+void LockContentionInit(void);
+void LockContentionRegisterGlobalCounters(void);
+void LockContentionRegisterTests(void);
+
+#endif /* __UTIL_LOCK_CONTENTION_H__ */
@@ -33,10 +33,35 @@
 #include "output.h"          /* DEFAULT_LOG_* */
 #include "util-logopenfile.h"
 #include "util-logopenfile-tile.h"
+#include "util-misc.h"       /* ParseSizeStringU32 */
+#include "counters.h"        /* StatsRegisterGlobalCounter */
+
+#ifdef LOGFILE_HAVE_GZIP
+#include <zlib.h>
+#endif
 
 const char * redis_push_cmd = "LPUSH";
 const char * redis_publish_cmd = "PUBLISH";
 
+/* log slot of the current thread plus one, 0 if not yet assigned. Used
+ * to pick the thread's own ctx in 'threaded' mode. */
+#ifdef TLS
+static __thread int logfile_thread_slot = 0;
+#else
+static pthread_key_t logfile_thread_slot_key;
+static pthread_once_t logfile_thread_slot_once = PTHREAD_ONCE_INIT;
+
+static void LogFileThreadSlotKeyInit(void)
+{
+    if (pthread_key_create(&logfile_thread_slot_key, NULL) != 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "pthread_key_create failed");
+        exit(EXIT_FAILURE);
+    }
+}
+#endif
+static SCMutex logfile_thread_slot_mutex = SCMUTEX_INITIALIZER;
+static int logfile_thread_slot_cnt = 0;
+
 /** \brief connect to the indicated local stream socket, logging any errors
  *  \param path filesystem path to connect to
  *  \param log_err, non-zero if connect failure should be logged.
@@ -83,6 +108,21 @@ err:
  * \brief Attempt to reconnect a disconnected (or never-connected) Unix domain socket.
  * \retval 1 if it is now connected; otherwise 0
  */
+/** \brief set up the configured stdio buffer on a newly opened fp */
+static void SCLogFileSetBuffer(LogFileCtx *log_ctx)
+{
+    if (log_ctx->buffer_size == 0 || log_ctx->fp == NULL)
+        return;
+
+    if (setvbuf(log_ctx->fp, NULL, _IOFBF, log_ctx->buffer_size) != 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "failed to set a %"PRIu32
+                " byte buffer on \"%s\", flushing every record",
+                log_ctx->buffer_size, log_ctx->filename ? log_ctx->filename : "");
+        log_ctx->buffer_size = 0;
+    }
+    log_ctx->last_flush = time(NULL);
+}
+
 static int SCLogUnixSocketReconnect(LogFileCtx *log_ctx)
 {
     int disconnected = 0;
@@ -109,6 +149,7 @@ static int SCLogUnixSocketReconnect(LogFileCtx *log_ctx)
     log_ctx->reconn_timer = now;
 
     log_ctx->fp = SCLogOpenUnixSocketFp(log_ctx->filename, log_ctx->sock_type, 0);
+    SCLogFileSetBuffer(log_ctx);
     if (log_ctx->fp) {
         /* Connected at last (or reconnected) */
         SCLogNotice("Reconnected socket \"%s\"", log_ctx->filename);
@@ -141,7 +182,15 @@ static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ct
     if (log_ctx->fp) {
         clearerr(log_ctx->fp);
         ret = fwrite(buffer, buffer_len, 1, log_ctx->fp);
-        fflush(log_ctx->fp);
+        if (log_ctx->buffer_size == 0) {
+            fflush(log_ctx->fp);
+        } else {
+            time_t now = time(NULL);
+            if (now - log_ctx->last_flush >= LOGFILE_FLUSH_INTERVAL) {
+                fflush(log_ctx->fp);
+                log_ctx->last_flush = now;
+            }
+        }
 
         if (ferror(log_ctx->fp) && log_ctx->is_sock) {
             /* Error on Unix socket, maybe needs reconnect */
@@ -161,17 +210,234 @@ static void SCLogFileClose(LogFileCtx *log_ctx)
         fclose(log_ctx->fp);
 }
 
+#ifdef LOGFILE_HAVE_GZIP
+
+/* compression counters for all compressed outputs, as global stats
+ * counters */
+SC_ATOMIC_DECLARE(uint64_t, gzip_bytes_in);
+SC_ATOMIC_DECLARE(uint64_t, gzip_bytes_out);
+SC_ATOMIC_DECLARE(uint64_t, gzip_usecs);
+
+static uint64_t LogFileGzipBytesInCounter(void)
+{
+    return SC_ATOMIC_GET(gzip_bytes_in);
+}
+
+static uint64_t LogFileGzipBytesOutCounter(void)
+{
+    return SC_ATOMIC_GET(gzip_bytes_out);
+}
+
+/** bytes in per 100 bytes out */
+static uint64_t LogFileGzipRatioCounter(void)
+{
+    uint64_t out = SC_ATOMIC_GET(gzip_bytes_out);
+    return out ? SC_ATOMIC_GET(gzip_bytes_in) * 100 / out : 0;
+}
+
+static uint64_t LogFileGzipUsecsCounter(void)
+{
+    return SC_ATOMIC_GET(gzip_usecs);
+}
+
+/** deflate stream behind a compressed FILE * */
+typedef struct LogFileGzip_ {
+    z_stream zs;
+    int fd;
+    uint8_t out[LOGFILE_GZIP_OUT_SIZE];
+} LogFileGzip;
+
+/** \internal
+ *  \brief run deflate over the pending input and write out the result
+ *  \retval 0 ok, -1 on a write or stream error
+ */
+static int LogFileGzipDeflate(LogFileGzip *gz, int flush)
+{
+    do {
+        gz->zs.next_out = gz->out;
+        gz->zs.avail_out = sizeof(gz->out);
+        if (deflate(&gz->zs, flush) == Z_STREAM_ERROR)
+            return -1;
+
+        size_t have = sizeof(gz->out) - gz->zs.avail_out;
+        size_t done = 0;
+        while (done < have) {
+            ssize_t r = write(gz->fd, gz->out + done, have - done);
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            done += r;
+        }
+        SC_ATOMIC_ADD(gzip_bytes_out, have);
+    } while (gz->zs.avail_out == 0);
+
+    return 0;
+}
+
+/** \internal
+ *  \brief stdio write hook: each call is a stdio flush, so each ends
+ *         the deflate block. Readers can then decompress the file up
+ *         to the last flush while it is still being written. */
+static ssize_t LogFileGzipWrite(void *cookie, const char *buf, size_t size)
+{
+    LogFileGzip *gz = cookie;
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+    gz->zs.next_in = (Bytef *)buf;
+    gz->zs.avail_in = size;
+    int r = LogFileGzipDeflate(gz, Z_SYNC_FLUSH);
+    gettimeofday(&end, NULL);
+
+    SC_ATOMIC_ADD(gzip_bytes_in, size);
+    SC_ATOMIC_ADD(gzip_usecs, (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+            (end.tv_usec - start.tv_usec));
+    return r == 0 ? (ssize_t)size : -1;
+}
+
+static int LogFileGzipClose(void *cookie)
+{
+    LogFileGzip *gz = cookie;
+
+    gz->zs.next_in = NULL;
+    gz->zs.avail_in = 0;
+    int r = LogFileGzipDeflate(gz, Z_FINISH);
+    deflateEnd(&gz->zs);
+    if (close(gz->fd) != 0)
+        r = -1;
+    SCFree(gz);
+    return r;
+}
+
+/** \brief open 'path' for gzip compressed writing
+ *
+ *  The returned FILE * is used like any other: the data is compressed
+ *  when stdio flushes its buffer, which is set to LOGFILE_GZIP_BUFFER_SIZE
+ *  so that flushes stay rare. fclose() ends the gzip stream. Appending
+ *  adds a new gzip member, which gzip readers handle as one stream.
+ *
+ *  \param level zlib compression level, 1 (fast) to 9 (small)
+ *  \retval FILE* on success
+ *  \retval NULL on error, already logged
+ */
+FILE *LogFileOpenGzipFp(const char *path, int append, int level)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC),
+            0666);
+    if (fd < 0) {
+        SCLogError(SC_ERR_FOPEN, "Error opening file: \"%s\": %s",
+                   path, strerror(errno));
+        return NULL;
+    }
+
+    LogFileGzip *gz = SCMalloc(sizeof(*gz));
+    if (unlikely(gz == NULL)) {
+        close(fd);
+        return NULL;
+    }
+    memset(&gz->zs, 0, sizeof(gz->zs));
+    gz->fd = fd;
+
+    /* 15 bit window, plus 16 for a gzip instead of a zlib header */
+    if (deflateInit2(&gz->zs, level, Z_DEFLATED, 15 + 16, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error setting up compression for "
+                "\"%s\"", path);
+        close(fd);
+        SCFree(gz);
+        return NULL;
+    }
+
+    cookie_io_functions_t io = {
+        .read = NULL, .write = LogFileGzipWrite,
+        .seek = NULL, .close = LogFileGzipClose,
+    };
+    FILE *fp = fopencookie(gz, "w", io);
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "Error opening file: \"%s\": %s",
+                   path, strerror(errno));
+        deflateEnd(&gz->zs);
+        close(fd);
+        SCFree(gz);
+        return NULL;
+    }
+    if (setvbuf(fp, NULL, _IOFBF, LOGFILE_GZIP_BUFFER_SIZE) != 0) {
+        SCLogDebug("keeping the default stdio buffer for \"%s\"", path);
+    }
+    return fp;
+}
+
+#endif /* LOGFILE_HAVE_GZIP */
+
+/** \brief parse the 'compression' and 'compression-level' settings of
+ *         an output
+ *
+ *  \param level set to the zlib level to use when compressing
+ *  \retval 1 gzip compression, 0 none, -1 invalid or not supported
+ */
+int LogFileParseCompression(ConfNode *conf, int *level)
+{
+    const char *compression = ConfNodeLookupChildValue(conf, "compression");
+    if (compression == NULL || strcasecmp(compression, "none") == 0)
+        return 0;
+
+    if (strcasecmp(compression, "gzip") != 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid %s.compression \"%s\": "
+                "expected \"none\" or \"gzip\"", conf->name, compression);
+        return -1;
+    }
+#ifndef LOGFILE_HAVE_GZIP
+    SCLogError(SC_ERR_INVALID_ARGUMENT, "%s.compression: gzip support needs "
+            "zlib and fopencookie(), not available in this build", conf->name);
+    return -1;
+#else
+    *level = LOGFILE_GZIP_DEFAULT_LEVEL;
+    intmax_t val;
+    if (ConfGetChildValueInt(conf, "compression-level", &val)) {
+        if (val < 1 || val > 9) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid %s.compression-level "
+                    "%"PRIdMAX": expected 1 to 9", conf->name, val);
+            return -1;
+        }
+        *level = (int)val;
+    }
+
+    /* shared by all compressed outputs */
+    static int counters_registered = 0;
+    if (!counters_registered) {
+        SC_ATOMIC_INIT(gzip_bytes_in);
+        SC_ATOMIC_INIT(gzip_bytes_out);
+        SC_ATOMIC_INIT(gzip_usecs);
+        StatsRegisterGlobalCounter("logfile.gzip_bytes_in", LogFileGzipBytesInCounter);
+        StatsRegisterGlobalCounter("logfile.gzip_bytes_out", LogFileGzipBytesOutCounter);
+        StatsRegisterGlobalCounter("logfile.gzip_ratio", LogFileGzipRatioCounter);
+        StatsRegisterGlobalCounter("logfile.gzip_usecs", LogFileGzipUsecsCounter);
+        counters_registered = 1;
+    }
+    return 1;
+#endif
+}
+
 /** \brief open the indicated file, logging any errors
+ *  \param log_ctx ctx the file is for, decides on compression
  *  \param path filesystem path to open
  *  \param append_setting open file with O_APPEND: "yes" or "no"
  *  \retval FILE* on success
  *  \retval NULL on error
  */
 static FILE *
-SCLogOpenFileFp(const char *path, const char *append_setting)
+SCLogOpenFileFp(LogFileCtx *log_ctx, const char *path, const char *append_setting)
 {
     FILE *ret = NULL;
 
+#ifdef LOGFILE_HAVE_GZIP
+    if (log_ctx->compress) {
+        return LogFileOpenGzipFp(path, ConfValIsTrue(append_setting),
+                log_ctx->compress_level);
+    }
+#endif
     if (ConfValIsTrue(append_setting)) {
         ret = fopen(path, "a");
     } else {
@@ -256,12 +522,39 @@ SCConfLogOpenGeneric(ConfNode *conf,
     if (append == NULL)
         append = DEFAULT_LOG_MODE_APPEND;
 
+    /* no buffering for datagrams, each record is a message */
+    const char *buffer_size = ConfNodeLookupChildValue(conf, "buffer-size");
+    if (buffer_size != NULL && strcasecmp(filetype, "unix_dgram") != 0) {
+        if (ParseSizeStringU32(buffer_size, &log_ctx->buffer_size) < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid %s.buffer-size "
+                    "\"%s\"", conf->name, buffer_size);
+            return -1;
+        }
+    }
+
+    /* compressed regular files get a .gz name and are buffered, as a
+     * flush ends a compressed block */
+    if (strcasecmp(filetype, DEFAULT_LOG_FILETYPE) == 0 ||
+            strcasecmp(filetype, "file") == 0) {
+        log_ctx->compress = LogFileParseCompression(conf, &log_ctx->compress_level);
+        if (log_ctx->compress < 0)
+            return -1;
+        if (log_ctx->compress) {
+            size_t len = strlen(log_path);
+            if (len < 3 || strcmp(log_path + len - 3, ".gz") != 0)
+                strlcat(log_path, ".gz", sizeof(log_path));
+            if (log_ctx->buffer_size == 0)
+                log_ctx->buffer_size = LOGFILE_GZIP_BUFFER_SIZE;
+        }
+    }
+
     // Now, what have we been asked to open?
     if (strcasecmp(filetype, "unix_stream") == 0) {
         /* Don't bail. May be able to connect later. */
         log_ctx->is_sock = 1;
         log_ctx->sock_type = SOCK_STREAM;
         log_ctx->fp = SCLogOpenUnixSocketFp(log_path, SOCK_STREAM, 1);
+        SCLogFileSetBuffer(log_ctx);
     } else if (strcasecmp(filetype, "unix_dgram") == 0) {
         /* Don't bail. May be able to connect later. */
         log_ctx->is_sock = 1;
@@ -269,9 +562,10 @@ SCConfLogOpenGeneric(ConfNode *conf,
         log_ctx->fp = SCLogOpenUnixSocketFp(log_path, SOCK_DGRAM, 1);
     } else if (strcasecmp(filetype, DEFAULT_LOG_FILETYPE) == 0 ||
                strcasecmp(filetype, "file") == 0) {
-        log_ctx->fp = SCLogOpenFileFp(log_path, append);
+        log_ctx->fp = SCLogOpenFileFp(log_ctx, log_path, append);
         if (log_ctx->fp == NULL)
             return -1; // Error already logged by Open...Fp routine
+        SCLogFileSetBuffer(log_ctx);
         log_ctx->is_regular = 1;
         if (rotate) {
             OutputRegisterFileRotationFlag(&log_ctx->rotation_flag);
@@ -294,6 +588,20 @@ SCConfLogOpenGeneric(ConfNode *conf,
         return -1;
     }
 
+    /* files and sockets can get one per thread */
+    const char *threaded = ConfNodeLookupChildValue(conf, "threaded");
+    if (threaded != NULL && ConfValIsTrue(threaded) &&
+            (log_ctx->is_regular || log_ctx->is_sock)) {
+        log_ctx->threads = SCCalloc(LOGFILE_MAX_THREADS, sizeof(LogFileCtx *));
+        if (unlikely(log_ctx->threads == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC,
+                "Failed to allocate memory for threaded output");
+            return -1;
+        }
+        log_ctx->threaded = 1;
+        log_ctx->append = ConfValIsTrue(append);
+    }
+
     SCLogInfo("%s output device (%s) initialized: %s", conf->name, filetype,
               filename);
 
@@ -325,10 +633,11 @@ int SCConfLogReopen(LogFileCtx *log_ctx)
     /* Reopen the file. Append is forced in case the file was not
      * moved as part of a rotation process. */
     SCLogDebug("Reopening log file %s.", log_ctx->filename);
-    log_ctx->fp = SCLogOpenFileFp(log_ctx->filename, "yes");
+    log_ctx->fp = SCLogOpenFileFp(log_ctx, log_ctx->filename, "yes");
     if (log_ctx->fp == NULL) {
         return -1; // Already logged by Open..Fp routine.
     }
+    SCLogFileSetBuffer(log_ctx);
 
     return 0;
 }
@@ -336,8 +645,40 @@ int SCConfLogReopen(LogFileCtx *log_ctx)
 
 #ifdef HAVE_LIBHIREDIS
 
+static void LogFileRedisStop(LogFileCtx *log_ctx)
+{
+    RedisSetup *rs = &log_ctx->redis_setup;
+    uint32_t i;
+
+    SCMutexLock(&rs->queue_mutex);
+    rs->stop = 1;
+    SCCondSignal(&rs->queue_cond);
+    SCMutexUnlock(&rs->queue_mutex);
+
+    /* drains the queue if the server is there */
+    pthread_join(rs->thread, NULL);
+
+    if (rs->dropped > 0) {
+        SCLogInfo("redis output dropped %"PRIu64" records", rs->dropped);
+    }
+
+    for (i = 0; i < rs->queue_size; i++) {
+        if (rs->queue[i].data != NULL)
+            SCFree(rs->queue[i].data);
+    }
+    SCFree(rs->queue);
+    rs->queue = NULL;
+    SCMutexDestroy(&rs->queue_mutex);
+    SCCondDestroy(&rs->queue_cond);
+    rs->async = 0;
+}
+
 static void SCLogFileCloseRedis(LogFileCtx *log_ctx)
 {
+    if (log_ctx->redis_setup.async) {
+        LogFileRedisStop(log_ctx);
+    }
+
     if (log_ctx->redis) {
         redisReply *reply;
         int i;
@@ -353,6 +694,165 @@ static void SCLogFileCloseRedis(LogFileCtx *log_ctx)
     log_ctx->redis_setup.batch_count = 0;
 }
 
+/** \internal
+ *  \brief write 'n' queued records starting at 'head'
+ *
+ *  In list mode this is a single LPUSH of all records, in channel mode
+ *  the PUBLISH commands are pipelined.
+ *
+ *  \retval 0 done (or refused by the server, so no point in retrying)
+ *  \retval -1 not connected or the connection failed, retry */
+static int LogFileRedisWriteBatch(LogFileCtx *log_ctx, uint32_t head,
+        uint32_t n, const char **argv, size_t *argvlen)
+{
+    RedisSetup *rs = &log_ctx->redis_setup;
+    redisReply *reply = NULL;
+    uint32_t i;
+
+    if (log_ctx->redis == NULL) {
+        if (SCConfLogReopenRedis(log_ctx) < 0)
+            return -1;
+        SCLogInfo("Reconnected to redis server");
+    }
+
+    argv[0] = rs->command;
+    argvlen[0] = strlen(rs->command);
+    argv[1] = rs->key;
+    argvlen[1] = strlen(rs->key);
+
+    if (rs->mode == REDIS_LIST) {
+        for (i = 0; i < n; i++) {
+            const RedisRecord *r = &rs->queue[(head + i) % rs->queue_size];
+            argv[2 + i] = r->data;
+            argvlen[2 + i] = r->len;
+        }
+        reply = redisCommandArgv(log_ctx->redis, 2 + n, argv, argvlen);
+        if (reply == NULL)
+            goto error;
+        if (reply->type == REDIS_REPLY_ERROR) {
+            SCLogWarning(SC_ERR_SOCKET, "Redis error: %s", reply->str);
+        }
+        freeReplyObject(reply);
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        const RedisRecord *r = &rs->queue[(head + i) % rs->queue_size];
+        argv[2] = r->data;
+        argvlen[2] = r->len;
+        if (redisAppendCommandArgv(log_ctx->redis, 3, argv, argvlen) != REDIS_OK)
+            goto error;
+    }
+    for (i = 0; i < n; i++) {
+        if (redisGetReply(log_ctx->redis, (void **)&reply) != REDIS_OK)
+            goto error;
+        if (reply->type == REDIS_REPLY_ERROR) {
+            SCLogWarning(SC_ERR_SOCKET, "Redis error: %s", reply->str);
+        }
+        freeReplyObject(reply);
+    }
+    return 0;
+
+error:
+    SCLogInfo("Error writing to redis server: %s (%d)",
+            log_ctx->redis->errstr, log_ctx->redis->err);
+    redisFree(log_ctx->redis);
+    log_ctx->redis = NULL;
+    return -1;
+}
+
+/** \internal
+ *  \brief redis writer thread for 'async' */
+static void *LogFileRedisWriter(void *arg)
+{
+    LogFileCtx *log_ctx = (LogFileCtx *)arg;
+    RedisSetup *rs = &log_ctx->redis_setup;
+    uint32_t batch = rs->batch_size > 0 ?
+        (uint32_t)rs->batch_size : LOGFILE_REDIS_BATCH_SIZE;
+
+    const char **argv = SCMalloc((batch + 2) * sizeof(char *));
+    size_t *argvlen = SCMalloc((batch + 2) * sizeof(size_t));
+    if (argv == NULL || argvlen == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate redis writer");
+        goto end;
+    }
+
+    while (1) {
+        SCMutexLock(&rs->queue_mutex);
+        while (rs->queue_cnt == 0 && !rs->stop) {
+            SCCondWait(&rs->queue_cond, &rs->queue_mutex);
+        }
+        uint32_t head = rs->queue_head;
+        uint32_t n = MIN(rs->queue_cnt, batch);
+        int stop = rs->stop;
+        SCMutexUnlock(&rs->queue_mutex);
+
+        if (n == 0)
+            break;
+
+        /* the records stay queued (and untouched by the producers)
+         * until written, so a failed batch is retried as a whole */
+        if (LogFileRedisWriteBatch(log_ctx, head, n, argv, argvlen) < 0) {
+            if (stop)
+                break;
+            /* reconnects are limited to one per sec */
+            usleep(100000);
+            continue;
+        }
+
+        SCMutexLock(&rs->queue_mutex);
+        rs->queue_head = (head + n) % rs->queue_size;
+        rs->queue_cnt -= n;
+        SCMutexUnlock(&rs->queue_mutex);
+    }
+
+end:
+    /* shutting down without a server: whatever is left is lost */
+    SCMutexLock(&rs->queue_mutex);
+    rs->dropped += rs->queue_cnt;
+    rs->queue_cnt = 0;
+    SCMutexUnlock(&rs->queue_mutex);
+
+    if (argv != NULL)
+        SCFree(argv);
+    if (argvlen != NULL)
+        SCFree(argvlen);
+    return NULL;
+}
+
+/** \internal
+ *  \brief queue a record for the redis writer thread
+ *  \retval 0 queued, -1 dropped */
+static int LogFileRedisEnqueue(LogFileCtx *log_ctx, const char *string,
+        size_t string_len)
+{
+    RedisSetup *rs = &log_ctx->redis_setup;
+
+    SCMutexLock(&rs->queue_mutex);
+    if (rs->queue_cnt == rs->queue_size)
+        goto drop;
+
+    RedisRecord *r = &rs->queue[(rs->queue_head + rs->queue_cnt) % rs->queue_size];
+    if (r->size < string_len) {
+        char *ptr = SCRealloc(r->data, string_len);
+        if (ptr == NULL)
+            goto drop;
+        r->data = ptr;
+        r->size = string_len;
+    }
+    memcpy(r->data, string, string_len);
+    r->len = string_len;
+    rs->queue_cnt++;
+    SCCondSignal(&rs->queue_cond);
+    SCMutexUnlock(&rs->queue_mutex);
+    return 0;
+
+drop:
+    rs->dropped++;
+    SCMutexUnlock(&rs->queue_mutex);
+    return -1;
+}
+
 int SCConfLogOpenRedis(ConfNode *redis_node, LogFileCtx *log_ctx)
 {
     const char *redis_server = NULL;
@@ -402,12 +902,14 @@ int SCConfLogOpenRedis(ConfNode *redis_node, LogFileCtx *log_ctx)
     }
 
     if (!strcmp(redis_mode, "list")) {
+        log_ctx->redis_setup.mode = REDIS_LIST;
         log_ctx->redis_setup.command = redis_push_cmd;
         if (!log_ctx->redis_setup.command) {
             SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate redis key command");
             exit(EXIT_FAILURE);
         }
     } else {
+        log_ctx->redis_setup.mode = REDIS_CHANNEL;
         log_ctx->redis_setup.command = redis_publish_cmd;
         if (!log_ctx->redis_setup.command) {
             SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate redis key command");
@@ -433,6 +935,37 @@ int SCConfLogOpenRedis(ConfNode *redis_node, LogFileCtx *log_ctx)
 
     log_ctx->Close = SCLogFileCloseRedis;
 
+    int async = 0;
+    if (redis_node != NULL &&
+        ConfGetChildValueBool(redis_node, "async", &async) && async)
+    {
+        RedisSetup *rs = &log_ctx->redis_setup;
+        intmax_t queue_size = LOGFILE_REDIS_QUEUE_SIZE;
+
+        if (ConfGetChildValueInt(redis_node, "queue-size", &queue_size) &&
+            (queue_size <= 0 || queue_size > UINT32_MAX))
+        {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid redis queue-size: "
+                    "%"PRIdMAX, queue_size);
+            exit(EXIT_FAILURE);
+        }
+        rs->queue_size = (uint32_t)queue_size;
+        rs->queue = SCCalloc(rs->queue_size, sizeof(RedisRecord));
+        if (rs->queue == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate redis queue");
+            exit(EXIT_FAILURE);
+        }
+        SCMutexInit(&rs->queue_mutex, NULL);
+        SCCondInit(&rs->queue_cond, NULL);
+        if (pthread_create(&rs->thread, NULL, LogFileRedisWriter, log_ctx) != 0) {
+            SCLogError(SC_ERR_THREAD_CREATE, "Unable to start redis writer");
+            exit(EXIT_FAILURE);
+        }
+        rs->async = 1;
+        SCLogInfo("redis output using a writer thread, queue of %"PRIu32
+                " records", rs->queue_size);
+    }
+
     return 0;
 }
 
@@ -465,6 +998,207 @@ int SCConfLogReopenRedis(LogFileCtx *log_ctx)
 
 #endif
 
+#ifdef HAVE_LIBRDKAFKA
+
+/* delivery counters for all kafka outputs, as global stats counters */
+SC_ATOMIC_DECLARE(uint64_t, kafka_delivered);
+SC_ATOMIC_DECLARE(uint64_t, kafka_delivery_failed);
+SC_ATOMIC_DECLARE(uint64_t, kafka_queue_full);
+
+static uint64_t LogFileKafkaDeliveredCounter(void)
+{
+    return SC_ATOMIC_GET(kafka_delivered);
+}
+
+static uint64_t LogFileKafkaDeliveryFailedCounter(void)
+{
+    return SC_ATOMIC_GET(kafka_delivery_failed);
+}
+
+static uint64_t LogFileKafkaQueueFullCounter(void)
+{
+    return SC_ATOMIC_GET(kafka_queue_full);
+}
+
+static void LogFileKafkaDeliveryReport(rd_kafka_t *rk,
+        const rd_kafka_message_t *msg, void *opaque)
+{
+    if (msg->err) {
+        SC_ATOMIC_ADD(kafka_delivery_failed, 1);
+    } else {
+        SC_ATOMIC_ADD(kafka_delivered, 1);
+    }
+}
+
+static void SCLogFileCloseKafka(LogFileCtx *log_ctx)
+{
+    if (log_ctx->kafka) {
+        /* give the queued records a chance to go out */
+        rd_kafka_flush(log_ctx->kafka, LOGFILE_KAFKA_FLUSH_MS);
+        if (rd_kafka_outq_len(log_ctx->kafka) > 0) {
+            SCLogWarning(SC_ERR_SOCKET, "%d records still queued for kafka "
+                    "on shutdown", rd_kafka_outq_len(log_ctx->kafka));
+        }
+        rd_kafka_topic_destroy(log_ctx->kafka_setup.topic);
+        log_ctx->kafka_setup.topic = NULL;
+        rd_kafka_destroy(log_ctx->kafka);
+        log_ctx->kafka = NULL;
+    }
+}
+
+/** \internal
+ *  \brief create the producer and topic handle of 'log_ctx'
+ *
+ *  Takes ownership of 'conf' and 'topic_conf'.
+ */
+static int LogFileKafkaConnect(LogFileCtx *log_ctx, rd_kafka_conf_t *conf,
+        rd_kafka_topic_conf_t *topic_conf, const char *topic)
+{
+    char errstr[512];
+
+    rd_kafka_conf_set_dr_msg_cb(conf, LogFileKafkaDeliveryReport);
+    rd_kafka_t *rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));
+    if (rk == NULL) {
+        SCLogError(SC_ERR_SOCKET, "Error creating kafka producer: %s", errstr);
+        rd_kafka_conf_destroy(conf);
+        rd_kafka_topic_conf_destroy(topic_conf);
+        return -1;
+    }
+
+    rd_kafka_topic_t *rkt = rd_kafka_topic_new(rk, topic, topic_conf);
+    if (rkt == NULL) {
+        SCLogError(SC_ERR_SOCKET, "Error creating kafka topic %s: %s", topic,
+                rd_kafka_err2str(rd_kafka_last_error()));
+        rd_kafka_destroy(rk);
+        return -1;
+    }
+
+    log_ctx->kafka = rk;
+    log_ctx->kafka_setup.topic = rkt;
+    log_ctx->Close = SCLogFileCloseKafka;
+    return 0;
+}
+
+/** \brief set up a kafka output from the 'kafka' node of 'conf'
+ *
+ *  Records are keyed by flow_id (see LogFileWriteWithKey), so the
+ *  records of a flow end up in the same partition.
+ */
+int SCConfLogOpenKafka(ConfNode *conf, LogFileCtx *log_ctx)
+{
+    /* config name and the librdkafka property it sets */
+    static const char *props[][2] = {
+        { "brokers",        "metadata.broker.list" },
+        { "compression",    "compression.codec" },
+        { "batch-size",     "batch.num.messages" },
+        { "linger-ms",      "queue.buffering.max.ms" },
+        { "queue-size",     "queue.buffering.max.messages" },
+    };
+    char errstr[512];
+    size_t i;
+
+    log_ctx->type = LOGFILE_TYPE_KAFKA;
+
+    ConfNode *kafka_node = ConfNodeLookupChild(conf, "kafka");
+
+    const char *topic = NULL;
+    if (kafka_node != NULL)
+        topic = ConfNodeLookupChildValue(kafka_node, "topic");
+    if (topic == NULL)
+        topic = "suricata";
+
+    rd_kafka_conf_t *kconf = rd_kafka_conf_new();
+    rd_kafka_topic_conf_t *tconf = rd_kafka_topic_conf_new();
+    if (kconf == NULL || tconf == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate kafka config");
+        exit(EXIT_FAILURE);
+    }
+
+    if (rd_kafka_conf_set(kconf, "metadata.broker.list", "127.0.0.1:9092",
+                errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "kafka: %s", errstr);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; kafka_node != NULL && i < sizeof(props) / sizeof(props[0]); i++) {
+        const char *val = ConfNodeLookupChildValue(kafka_node, props[i][0]);
+        if (val == NULL)
+            continue;
+        if (rd_kafka_conf_set(kconf, props[i][1], val, errstr,
+                    sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid kafka %s \"%s\": %s",
+                    props[i][0], val, errstr);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* same key, same partition */
+    rd_kafka_topic_conf_set_partitioner_cb(tconf,
+            rd_kafka_msg_partitioner_consistent_random);
+
+    log_ctx->kafka_setup.topic_name = SCStrdup(topic);
+    log_ctx->kafka_setup.conf = rd_kafka_conf_dup(kconf);
+    log_ctx->kafka_setup.topic_conf = rd_kafka_topic_conf_dup(tconf);
+    if (log_ctx->kafka_setup.topic_name == NULL ||
+        log_ctx->kafka_setup.conf == NULL ||
+        log_ctx->kafka_setup.topic_conf == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate kafka config");
+        exit(EXIT_FAILURE);
+    }
+
+    if (LogFileKafkaConnect(log_ctx, kconf, tconf, topic) < 0)
+        return -1;
+
+    /* a producer per thread, instead of all threads sharing one */
+    const char *threaded = ConfNodeLookupChildValue(conf, "threaded");
+    if (threaded != NULL && ConfValIsTrue(threaded)) {
+        log_ctx->threads = SCCalloc(LOGFILE_MAX_THREADS, sizeof(LogFileCtx *));
+        if (unlikely(log_ctx->threads == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC,
+                "Failed to allocate memory for threaded output");
+            return -1;
+        }
+        log_ctx->threaded = 1;
+    }
+
+    /* shared by all kafka outputs */
+    static int counters_registered = 0;
+    if (!counters_registered) {
+        SC_ATOMIC_INIT(kafka_delivered);
+        SC_ATOMIC_INIT(kafka_delivery_failed);
+        SC_ATOMIC_INIT(kafka_queue_full);
+        StatsRegisterGlobalCounter("kafka.delivered", LogFileKafkaDeliveredCounter);
+        StatsRegisterGlobalCounter("kafka.delivery_failed", LogFileKafkaDeliveryFailedCounter);
+        StatsRegisterGlobalCounter("kafka.queue_full", LogFileKafkaQueueFullCounter);
+        counters_registered = 1;
+    }
+
+    SCLogInfo("%s output device (kafka) initialized: topic %s", conf->name, topic);
+    return 0;
+}
+
+/** \internal
+ *  \brief hand a record to the producer, which batches it in the
+ *         background. Never blocks: a full queue drops the record. */
+static void LogFileWriteKafka(LogFileCtx *log_ctx, const char *string,
+        size_t string_len, const char *key, size_t key_len)
+{
+    if (rd_kafka_produce(log_ctx->kafka_setup.topic, RD_KAFKA_PARTITION_UA,
+                RD_KAFKA_MSG_F_COPY, (void *)string, string_len,
+                key, key_len, NULL) == -1)
+    {
+        if (rd_kafka_last_error() == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+            SC_ATOMIC_ADD(kafka_queue_full, 1);
+        } else {
+            SC_ATOMIC_ADD(kafka_delivery_failed, 1);
+        }
+    }
+
+    /* serve the delivery reports */
+    rd_kafka_poll(log_ctx->kafka, 0);
+}
+
+#endif /* HAVE_LIBRDKAFKA */
+
 /** \brief LogFileNewCtx() Get a new LogFileCtx
  *  \retval LogFileCtx * pointer if succesful, NULL if error
  *  */
@@ -500,7 +1234,12 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
         SCReturnInt(0);
     }
 
-    if (lf_ctx->fp != NULL) {
+    if (lf_ctx->fp != NULL
+#ifdef HAVE_LIBHIREDIS
+        /* the redis writer thread needs stopping even if disconnected */
+        || (lf_ctx->type == LOGFILE_TYPE_REDIS && lf_ctx->redis_setup.async)
+#endif
+       ) {
         SCMutexLock(&lf_ctx->fp_mutex);
         lf_ctx->Close(lf_ctx);
         SCMutexUnlock(&lf_ctx->fp_mutex);
@@ -517,8 +1256,28 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
     }
 #endif
 
+#ifdef HAVE_LIBRDKAFKA
+    if (lf_ctx->type == LOGFILE_TYPE_KAFKA) {
+        if (lf_ctx->kafka_setup.conf)
+            rd_kafka_conf_destroy(lf_ctx->kafka_setup.conf);
+        if (lf_ctx->kafka_setup.topic_conf)
+            rd_kafka_topic_conf_destroy(lf_ctx->kafka_setup.topic_conf);
+        if (lf_ctx->kafka_setup.topic_name)
+            SCFree(lf_ctx->kafka_setup.topic_name);
+    }
+#endif
+
     SCMutexDestroy(&lf_ctx->fp_mutex);
 
+    if (lf_ctx->threads != NULL) {
+        int i;
+        for (i = 0; i < LOGFILE_MAX_THREADS; i++) {
+            if (lf_ctx->threads[i] != NULL && lf_ctx->threads[i] != lf_ctx)
+                LogFileFreeCtx(lf_ctx->threads[i]);
+        }
+        SCFree(lf_ctx->threads);
+    }
+
     if (lf_ctx->prefix != NULL) {
         SCFree(lf_ctx->prefix);
         lf_ctx->prefix_len = 0;
@@ -617,7 +1376,120 @@ static int  LogFileWriteRedis(LogFileCtx *file_ctx, const char *string, size_t s
 }
 #endif
 
+/** \brief get the log slot of the calling thread, assigning one on
+ *         first use */
+static int LogFileGetThreadSlot(void)
+{
+#ifdef TLS
+    int slot = logfile_thread_slot;
+#else
+    pthread_once(&logfile_thread_slot_once, LogFileThreadSlotKeyInit);
+    int slot = (int)(intptr_t)pthread_getspecific(logfile_thread_slot_key);
+#endif
+    if (likely(slot != 0))
+        return slot - 1;
+
+    SCMutexLock(&logfile_thread_slot_mutex);
+    slot = ++logfile_thread_slot_cnt;
+    SCMutexUnlock(&logfile_thread_slot_mutex);
+
+#ifdef TLS
+    logfile_thread_slot = slot;
+#else
+    pthread_setspecific(logfile_thread_slot_key, (void *)(intptr_t)slot);
+#endif
+    return slot - 1;
+}
+
+/** \brief open the calling thread's own ctx for a 'threaded' parent,
+ *         writing to <filename>.<slot> or a new connection to the
+ *         same socket.
+ *
+ *  \retval ctx the thread's ctx, or NULL to use the parent
+ */
+static LogFileCtx *LogFileGetThreadCtx(LogFileCtx *parent)
+{
+    int slot = LogFileGetThreadSlot();
+    if (slot >= LOGFILE_MAX_THREADS)
+        return NULL;
+
+    /* only this thread ever uses this slot. If opening its ctx failed
+     * before, the slot points to the parent. */
+    LogFileCtx *ctx = parent->threads[slot];
+    if (likely(ctx != NULL))
+        return (ctx != parent) ? ctx : NULL;
+
+    char path[PATH_MAX];
+    ctx = LogFileNewCtx();
+    if (unlikely(ctx == NULL))
+        return NULL;
+
+    ctx->type = parent->type;
+    ctx->is_sock = parent->is_sock;
+    ctx->sock_type = parent->sock_type;
+    ctx->buffer_size = parent->buffer_size;
+    ctx->compress = parent->compress;
+    ctx->compress_level = parent->compress_level;
+#ifdef HAVE_LIBRDKAFKA
+    if (parent->type == LOGFILE_TYPE_KAFKA) {
+        rd_kafka_conf_t *kconf = rd_kafka_conf_dup(parent->kafka_setup.conf);
+        rd_kafka_topic_conf_t *tconf =
+            rd_kafka_topic_conf_dup(parent->kafka_setup.topic_conf);
+        if (kconf == NULL || tconf == NULL) {
+            if (kconf != NULL)
+                rd_kafka_conf_destroy(kconf);
+            if (tconf != NULL)
+                rd_kafka_topic_conf_destroy(tconf);
+            goto error;
+        }
+        if (LogFileKafkaConnect(ctx, kconf, tconf,
+                    parent->kafka_setup.topic_name) < 0)
+            goto error;
+
+        SCLogDebug("thread slot %d has its own kafka producer", slot);
+        parent->threads[slot] = ctx;
+        return ctx;
+    }
+#endif
+    if (parent->is_sock) {
+        ctx->filename = SCStrdup(parent->filename);
+        if (ctx->filename == NULL)
+            goto error;
+        ctx->fp = SCLogOpenUnixSocketFp(ctx->filename, ctx->sock_type, 1);
+        SCLogFileSetBuffer(ctx);
+    } else {
+        snprintf(path, sizeof(path), "%s.%d", parent->filename, slot);
+        ctx->filename = SCStrdup(path);
+        if (ctx->filename == NULL)
+            goto error;
+        ctx->fp = SCLogOpenFileFp(ctx, ctx->filename, parent->append ? "yes" : "no");
+        if (ctx->fp == NULL)
+            goto error;
+        ctx->is_regular = 1;
+        SCLogFileSetBuffer(ctx);
+        OutputRegisterFileRotationFlag(&ctx->rotation_flag);
+    }
+
+    SCLogDebug("thread slot %d logging to %s", slot, ctx->filename);
+    parent->threads[slot] = ctx;
+    return ctx;
+
+error:
+    LogFileFreeCtx(ctx);
+    /* don't retry the open for every record */
+    parent->threads[slot] = parent;
+    return NULL;
+}
+
 int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer)
+{
+    return LogFileWriteWithKey(file_ctx, buffer, NULL, 0);
+}
+
+/** \brief write a record with a key, used by outputs that partition
+ *         on it (kafka). Others ignore the key. */
+int LogFileWriteWithKey(LogFileCtx *file_ctx, MemBuffer *buffer,
+        const char *key, size_t key_len)
 {
     if (file_ctx->type == LOGFILE_TYPE_SYSLOG) {
         syslog(file_ctx->syslog_setup.alert_syslog_level, "%s",
@@ -627,20 +1499,50 @@ int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer)
                file_ctx->type == LOGFILE_TYPE_UNIX_STREAM)
     {
         /* append \n for files only */
-        MemBufferWriteString(buffer, "\n");
-        SCMutexLock(&file_ctx->fp_mutex);
+        if (!file_ctx->binary)
+            MemBufferWriteString(buffer, "\n");
+
+        if (file_ctx->threaded) {
+            LogFileCtx *thread_ctx = LogFileGetThreadCtx(file_ctx);
+            if (thread_ctx != NULL) {
+                /* our own ctx, no need to lock */
+                thread_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
+                        MEMBUFFER_OFFSET(buffer), thread_ctx);
+                return 0;
+            }
+        }
+
+        SCMutexLockCounted(&file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
         file_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
                         MEMBUFFER_OFFSET(buffer), file_ctx);
         SCMutexUnlock(&file_ctx->fp_mutex);
     }
 #ifdef HAVE_LIBHIREDIS
-    else if (file_ctx->type == LOGFILE_TYPE_REDIS) {
-        SCMutexLock(&file_ctx->fp_mutex);
+    else if (file_ctx->type == LOGFILE_TYPE_REDIS &&
+             file_ctx->redis_setup.async) {
+        /* the writer thread owns the connection */
+        LogFileRedisEnqueue(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
+                MEMBUFFER_OFFSET(buffer));
+    } else if (file_ctx->type == LOGFILE_TYPE_REDIS) {
+        SCMutexLockCounted(&file_ctx->fp_mutex, LOCK_CONTENTION_LOG_FILE);
         LogFileWriteRedis(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
                 MEMBUFFER_OFFSET(buffer));
         SCMutexUnlock(&file_ctx->fp_mutex);
     }
 #endif
+#ifdef HAVE_LIBRDKAFKA
+    else if (file_ctx->type == LOGFILE_TYPE_KAFKA) {
+        LogFileCtx *ctx = file_ctx;
+        if (file_ctx->threaded) {
+            LogFileCtx *thread_ctx = LogFileGetThreadCtx(file_ctx);
+            if (thread_ctx != NULL)
+                ctx = thread_ctx;
+        }
+        /* producers are thread safe, no lock */
+        LogFileWriteKafka(ctx, (const char *)MEMBUFFER_BUFFER(buffer),
+                MEMBUFFER_OFFSET(buffer), key, key_len);
+    }
+#endif
 
     return 0;
 }
@@ -27,11 +27,21 @@
 #include "conf.h"            /* ConfNode   */
 #include "tm-modules.h"      /* LogFileCtx */
 #include "util-buffer.h"
+#include "util-lock-contention.h"
 
 #ifdef HAVE_LIBHIREDIS
 #include "hiredis/hiredis.h"
 #endif
 
+#ifdef HAVE_LIBRDKAFKA
+#include <librdkafka/rdkafka.h>
+#endif
+
+/* gzip output needs zlib and fopencookie() to hand out a FILE * */
+#if defined(HAVE_LIBZ) && defined(HAVE_FOPENCOOKIE)
+#define LOGFILE_HAVE_GZIP 1
+#endif
+
 typedef struct {
     uint16_t fileno;
 } PcieFile;
@@ -40,7 +50,8 @@ enum LogFileType { LOGFILE_TYPE_FILE,
                    LOGFILE_TYPE_SYSLOG,
                    LOGFILE_TYPE_UNIX_DGRAM,
                    LOGFILE_TYPE_UNIX_STREAM,
-                   LOGFILE_TYPE_REDIS };
+                   LOGFILE_TYPE_REDIS,
+                   LOGFILE_TYPE_KAFKA };
 
 typedef struct SyslogSetup_ {
     int alert_syslog_level;
@@ -49,6 +60,13 @@ typedef struct SyslogSetup_ {
 #ifdef HAVE_LIBHIREDIS
 enum RedisMode { REDIS_LIST, REDIS_CHANNEL };
 
+/** record queued for the redis writer thread, the buffer is reused */
+typedef struct RedisRecord_ {
+    char *data;
+    size_t len;
+    size_t size;
+} RedisRecord;
+
 typedef struct RedisSetup_ {
     enum RedisMode mode;
     const char *command;
@@ -58,7 +76,40 @@ typedef struct RedisSetup_ {
     char *server;
     int  port;
     time_t tried;
+
+    /** 'async': records are queued and written, batched, by a writer
+     *  thread that also does the reconnects. The packet threads only
+     *  copy into the queue, dropping records when it is full. */
+    int async;
+    RedisRecord *queue;
+    uint32_t queue_size;
+    uint32_t queue_head;    /**< oldest record */
+    uint32_t queue_cnt;     /**< queued records, incl. those being written */
+    uint64_t dropped;
+    SCMutex queue_mutex;
+    SCCondT queue_cond;
+    pthread_t thread;
+    int stop;
 } RedisSetup;
+
+/* default number of queued records for 'async' */
+#define LOGFILE_REDIS_QUEUE_SIZE    4096
+/* max records per command for 'async' without pipelining batch-size */
+#define LOGFILE_REDIS_BATCH_SIZE    64
+#endif
+
+#ifdef HAVE_LIBRDKAFKA
+typedef struct KafkaSetup_ {
+    rd_kafka_topic_t *topic;
+    /** producer and topic config, kept to set up the per thread
+     *  producers in 'threaded' mode. Only set in the parent. */
+    rd_kafka_conf_t *conf;
+    rd_kafka_topic_conf_t *topic_conf;
+    char *topic_name;
+} KafkaSetup;
+
+/* max time to wait for queued records at shutdown */
+#define LOGFILE_KAFKA_FLUSH_MS      5000
 #endif
 
 /** Global structure for Output Context */
@@ -68,6 +119,9 @@ typedef struct LogFileCtx_ {
         PcieFile *pcie_fp;
 #ifdef HAVE_LIBHIREDIS
         redisContext *redis;
+#endif
+#ifdef HAVE_LIBRDKAFKA
+        rd_kafka_t *kafka;
 #endif
     };
 
@@ -75,6 +129,9 @@ typedef struct LogFileCtx_ {
         SyslogSetup syslog_setup;
 #ifdef HAVE_LIBHIREDIS
         RedisSetup redis_setup;
+#endif
+#ifdef HAVE_LIBRDKAFKA
+        KafkaSetup kafka_setup;
 #endif
     };
 
@@ -120,11 +177,49 @@ typedef struct LogFileCtx_ {
 
     /* Flag set when file rotation notification is received. */
     int rotation_flag;
+
+    /** 'threaded' output: each writing thread gets its own file or
+     *  socket, so the writes don't contend on fp_mutex. The per thread
+     *  ctxs are indexed by the thread's log slot, and each slot is only
+     *  ever used by its own thread. */
+    int threaded;
+    /** open new thread files in append mode */
+    int append;
+    struct LogFileCtx_ **threads;
+
+    /** stdio buffer size, 0 to flush after every record. Buffered
+     *  output is flushed when the buffer fills up or when a record is
+     *  written LOGFILE_FLUSH_INTERVAL secs after the last flush. */
+    uint32_t buffer_size;
+    time_t last_flush;
+
+    /** records are binary and carry their own framing, so no newline
+     *  is added */
+    int binary;
+
+    /** regular files: gzip compress the output (compression: gzip) */
+    int compress;
+    int compress_level;
 } LogFileCtx;
 
 /* Min time (msecs) before trying to reconnect a Unix domain socket */
 #define LOGFILE_RECONN_MIN_TIME     500
 
+/* Max number of threads that get their own file in 'threaded' mode,
+ * others share the parent ctx */
+#define LOGFILE_MAX_THREADS         256
+
+/* Max time (secs) buffered records wait for a flush, if more records
+ * come in */
+#define LOGFILE_FLUSH_INTERVAL      1
+
+/* stdio buffer of compressed files: each flush of it ends a deflate
+ * block, so it is also the default buffer-size of compressed outputs */
+#define LOGFILE_GZIP_BUFFER_SIZE    (64 * 1024)
+/* compressed bytes written per write() */
+#define LOGFILE_GZIP_OUT_SIZE       (16 * 1024)
+#define LOGFILE_GZIP_DEFAULT_LEVEL  6
+
 /* flags for LogFileCtx */
 #define LOGFILE_HEADER_WRITTEN 0x01
 #define LOGFILE_ALERTS_PRINTED 0x02
@@ -132,9 +227,17 @@ typedef struct LogFileCtx_ {
 LogFileCtx *LogFileNewCtx(void);
 int LogFileFreeCtx(LogFileCtx *);
 int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer);
+int LogFileParseCompression(ConfNode *conf, int *level);
+#ifdef LOGFILE_HAVE_GZIP
+FILE *LogFileOpenGzipFp(const char *path, int append, int level);
+#endif
+int LogFileWriteWithKey(LogFileCtx *file_ctx, MemBuffer *buffer,
+        const char *key, size_t key_len);
 
 int SCConfLogOpenGeneric(ConfNode *conf, LogFileCtx *, const char *, int);
 int SCConfLogOpenRedis(ConfNode *conf, LogFileCtx *log_ctx);
+int SCConfLogReopenRedis(LogFileCtx *log_ctx);
+int SCConfLogOpenKafka(ConfNode *conf, LogFileCtx *log_ctx);
 int SCConfLogReopen(LogFileCtx *);
 
 #endif /* __UTIL_LOGOPENFILE_H__ */
@@ -131,6 +131,29 @@ static int LuaCallbackStreamingBuffer(lua_State *luastate)
     return LuaCallbackStreamingBufferPushToStack(luastate, b);
 }
 
+/** \internal
+ *  \brief Wrapper for getting the streaming buffer without a copy
+ *
+ *  Places: data (pointer), data length (number), open (bool), close (bool)
+ *
+ *  The pointer is only valid during the log call, with LuaJIT it can be
+ *  read through ffi.cast or ffi.string.
+ *
+ *  \retval cnt number of items placed on the stack
+ */
+static int LuaCallbackStreamingBufferPtr(lua_State *luastate)
+{
+    const LuaStreamingBuffer *b = LuaStateGetStreamingBuffer(luastate);
+    if (b == NULL)
+        return LuaCallbackError(luastate, "internal error: no buffer");
+
+    lua_pushlightuserdata(luastate, (void *)b->data);
+    lua_pushnumber(luastate, (lua_Number)b->data_len);
+    lua_pushboolean(luastate, (b->flags & OUTPUT_STREAMING_FLAG_OPEN));
+    lua_pushboolean(luastate, (b->flags & OUTPUT_STREAMING_FLAG_CLOSE));
+    return 4;
+}
+
 /** \internal
  *  \brief fill lua stack with payload
  *  \param luastate the lua state
@@ -735,6 +758,8 @@ int LuaRegisterFunctions(lua_State *luastate)
 
     lua_pushcfunction(luastate, LuaCallbackStreamingBuffer);
     lua_setglobal(luastate, "SCStreamingBuffer");
+    lua_pushcfunction(luastate, LuaCallbackStreamingBufferPtr);
+    lua_setglobal(luastate, "SCStreamingBufferPtr");
 
     lua_pushcfunction(luastate, LuaCallbackLogPath);
     lua_setglobal(luastate, "SCLogPath");
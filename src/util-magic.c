@@ -37,24 +37,20 @@ static magic_t g_magic_ctx = NULL;
 static SCMutex g_magic_lock;
 
 /**
- *  \brief Initialize the "magic" context.
+ *  \brief Open a magic context and load the configured magic-file
+ *
+ *  \retval ctx loaded context, to be closed with magic_close()
+ *  \retval NULL error
  */
-int MagicInit(void)
+magic_t MagicInitContext(void)
 {
-    BUG_ON(g_magic_ctx != NULL);
-
-    SCEnter();
-
     char *filename = NULL;
     FILE *fd = NULL;
 
-    SCMutexInit(&g_magic_lock, NULL);
-    SCMutexLock(&g_magic_lock);
-
-    g_magic_ctx = magic_open(0);
-    if (g_magic_ctx == NULL) {
+    magic_t ctx = magic_open(0);
+    if (ctx == NULL) {
         SCLogError(SC_ERR_MAGIC_OPEN, "magic_open failed: %s",
-                magic_error(g_magic_ctx));
+                magic_error(ctx));
         goto error;
     }
 
@@ -80,23 +76,39 @@ int MagicInit(void)
         }
     }
 
-    if (magic_load(g_magic_ctx, filename) != 0) {
+    if (magic_load(ctx, filename) != 0) {
         SCLogError(SC_ERR_MAGIC_LOAD, "magic_load failed: %s",
-                magic_error(g_magic_ctx));
+                magic_error(ctx));
         goto error;
     }
-
-    SCMutexUnlock(&g_magic_lock);
-    SCReturnInt(0);
+    return ctx;
 
 error:
-    if (g_magic_ctx != NULL) {
-        magic_close(g_magic_ctx);
-        g_magic_ctx = NULL;
+    if (ctx != NULL)
+        magic_close(ctx);
+    return NULL;
+}
+
+/**
+ *  \brief Initialize the "magic" context.
+ */
+int MagicInit(void)
+{
+    BUG_ON(g_magic_ctx != NULL);
+
+    SCEnter();
+
+    SCMutexInit(&g_magic_lock, NULL);
+    SCMutexLock(&g_magic_lock);
+
+    g_magic_ctx = MagicInitContext();
+    if (g_magic_ctx == NULL) {
+        SCMutexUnlock(&g_magic_lock);
+        SCReturnInt(-1);
     }
 
     SCMutexUnlock(&g_magic_lock);
-    SCReturnInt(-1);
+    SCReturnInt(0);
 }
 
 /**
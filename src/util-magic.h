@@ -27,6 +27,7 @@
 #include <magic.h>
 
 int MagicInit(void);
+magic_t MagicInitContext(void);
 void MagicDeinit(void);
 char *MagicGlobalLookup(const uint8_t *, uint32_t);
 char *MagicThreadLookup(magic_t *, const uint8_t *, uint32_t);
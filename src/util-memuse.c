@@ -0,0 +1,254 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memory accounting per subsystem, see util-memuse.h.
+ *
+ * The 'memory-usage' command puts the totals next to the resident set
+ * size of the process, the difference is memory no subsystem accounts
+ * for (libraries, the allocator, unaccounted structures).
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "counters.h"
+
+#include "util-memuse.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#ifdef BUILD_UNIX_SOCKET
+#include <jansson.h>
+#endif
+
+MemuseCounter memuse_counters[MEMUSE_MAX];
+
+/**
+ * \brief init the counters, call before any subsystem allocates
+ */
+void MemuseInit(void)
+{
+    int i;
+
+    memset(memuse_counters, 0, sizeof(memuse_counters));
+    for (i = 0; i < MEMUSE_MAX; i++) {
+        SC_ATOMIC_INIT(memuse_counters[i].memuse);
+        SC_ATOMIC_INIT(memuse_counters[i].peak);
+        SC_ATOMIC_INIT(memuse_counters[i].allocs);
+        SC_ATOMIC_INIT(memuse_counters[i].frees);
+    }
+}
+
+/**
+ * \brief set the memcap of subsystem 'id', for reporting only
+ */
+void MemuseSetMemcap(enum MemuseSubsystem id, uint64_t memcap)
+{
+    memuse_counters[id].memcap = memcap;
+}
+
+static uint64_t MemuseTotal(void)
+{
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < MEMUSE_MAX; i++)
+        total += SC_ATOMIC_GET(memuse_counters[i].memuse);
+    return total;
+}
+
+/* global counters take a function without arguments, one per value */
+#define MEMUSE_COUNTER_FUNCS(id, name)                          \
+static uint64_t MemuseCounter_##name(void)                      \
+{                                                               \
+    return SC_ATOMIC_GET(memuse_counters[(id)].memuse);         \
+}                                                               \
+static uint64_t MemuseCounterPeak_##name(void)                  \
+{                                                               \
+    return SC_ATOMIC_GET(memuse_counters[(id)].peak);           \
+}
+
+MEMUSE_COUNTER_FUNCS(MEMUSE_FLOW, flow)
+MEMUSE_COUNTER_FUNCS(MEMUSE_STREAM, stream)
+MEMUSE_COUNTER_FUNCS(MEMUSE_REASSEMBLY, reassembly)
+MEMUSE_COUNTER_FUNCS(MEMUSE_DEFRAG, defrag)
+MEMUSE_COUNTER_FUNCS(MEMUSE_HOST, host)
+MEMUSE_COUNTER_FUNCS(MEMUSE_IPPAIR, ippair)
+MEMUSE_COUNTER_FUNCS(MEMUSE_HTTP, http)
+MEMUSE_COUNTER_FUNCS(MEMUSE_DNS, dns)
+MEMUSE_COUNTER_FUNCS(MEMUSE_PACKETS, packets)
+MEMUSE_COUNTER_FUNCS(MEMUSE_DETECT, detect)
+MEMUSE_COUNTER_FUNCS(MEMUSE_MPM, mpm)
+MEMUSE_COUNTER_FUNCS(MEMUSE_THREADS, threads)
+
+#define MEMUSE_REGISTER(name)                                           \
+    StatsRegisterGlobalCounter("memuse." #name, MemuseCounter_##name);  \
+    StatsRegisterGlobalCounter("memuse." #name "_peak", MemuseCounterPeak_##name);
+
+/**
+ * \brief register the memuse.<subsystem> and memuse.<subsystem>_peak
+ *        stats counters
+ */
+void MemuseRegisterGlobalCounters(void)
+{
+    MEMUSE_REGISTER(flow);
+    MEMUSE_REGISTER(stream);
+    MEMUSE_REGISTER(reassembly);
+    MEMUSE_REGISTER(defrag);
+    MEMUSE_REGISTER(host);
+    MEMUSE_REGISTER(ippair);
+    MEMUSE_REGISTER(http);
+    MEMUSE_REGISTER(dns);
+    MEMUSE_REGISTER(packets);
+    MEMUSE_REGISTER(detect);
+    MEMUSE_REGISTER(mpm);
+    MEMUSE_REGISTER(threads);
+    StatsRegisterGlobalCounter("memuse.total", MemuseTotal);
+}
+
+#if defined(BUILD_UNIX_SOCKET) || defined(UNITTESTS)
+/** \internal
+ *  \brief get the resident set size of the process
+ *
+ *  \retval 0 on success, -1 if not available on this system
+ */
+static int MemuseGetRss(uint64_t *rss)
+{
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL)
+        return -1;
+
+    unsigned long size = 0, resident = 0;
+    int r = fscanf(fp, "%lu %lu", &size, &resident);
+    fclose(fp);
+    if (r != 2)
+        return -1;
+
+    *rss = (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+    return 0;
+}
+#endif
+
+#ifdef BUILD_UNIX_SOCKET
+static const char *memuse_names[MEMUSE_MAX] = {
+    "flow",
+    "stream",
+    "reassembly",
+    "defrag",
+    "host",
+    "ippair",
+    "http",
+    "dns",
+    "packets",
+    "detect",
+    "mpm",
+    "threads",
+};
+
+/**
+ * \brief unix socket 'memory-usage' command: current and peak use,
+ *        memcap and allocation counts per subsystem
+ */
+TmEcode MemuseCommand(json_t *cmd, json_t *answer, void *data)
+{
+    json_t *js = json_object();
+    json_t *jsubs = json_object();
+    if (js == NULL || jsubs == NULL) {
+        json_decref(js);
+        json_decref(jsubs);
+        json_object_set_new(answer, "message", json_string("out of memory"));
+        return TM_ECODE_FAILED;
+    }
+
+    uint64_t total = 0;
+    int i;
+    for (i = 0; i < MEMUSE_MAX; i++) {
+        MemuseCounter *c = &memuse_counters[i];
+        json_t *jsub = json_object();
+        if (jsub == NULL)
+            continue;
+
+        uint64_t memuse = SC_ATOMIC_GET(c->memuse);
+        total += memuse;
+
+        json_object_set_new(jsub, "memuse", json_integer(memuse));
+        json_object_set_new(jsub, "peak", json_integer(SC_ATOMIC_GET(c->peak)));
+        if (c->memcap != 0)
+            json_object_set_new(jsub, "memcap", json_integer(c->memcap));
+        json_object_set_new(jsub, "allocs", json_integer(SC_ATOMIC_GET(c->allocs)));
+        json_object_set_new(jsub, "frees", json_integer(SC_ATOMIC_GET(c->frees)));
+        json_object_set_new(jsubs, memuse_names[i], jsub);
+    }
+    json_object_set_new(js, "subsystems", jsubs);
+    json_object_set_new(js, "total", json_integer(total));
+
+    uint64_t rss = 0;
+    if (MemuseGetRss(&rss) == 0) {
+        json_object_set_new(js, "rss", json_integer(rss));
+        json_object_set_new(js, "unaccounted",
+                json_integer(rss > total ? rss - total : 0));
+    }
+
+    json_object_set_new(answer, "message", js);
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#ifdef UNITTESTS
+static int MemuseTest01(void)
+{
+    MemuseCounter *c = &memuse_counters[MEMUSE_MPM];
+    uint64_t memuse = SC_ATOMIC_GET(c->memuse);
+    uint64_t allocs = SC_ATOMIC_GET(c->allocs);
+    uint64_t frees = SC_ATOMIC_GET(c->frees);
+
+    MemuseAlloc(MEMUSE_MPM, 100);
+    MemuseAlloc(MEMUSE_MPM, 50);
+    FAIL_IF(SC_ATOMIC_GET(c->memuse) != memuse + 150);
+    FAIL_IF(SC_ATOMIC_GET(c->peak) < memuse + 150);
+
+    MemuseFree(MEMUSE_MPM, 150);
+    FAIL_IF(SC_ATOMIC_GET(c->memuse) != memuse);
+    /* the peak stays */
+    FAIL_IF(SC_ATOMIC_GET(c->peak) < memuse + 150);
+
+    FAIL_IF(SC_ATOMIC_GET(c->allocs) != allocs + 2);
+    FAIL_IF(SC_ATOMIC_GET(c->frees) != frees + 1);
+    PASS;
+}
+
+static int MemuseTest02(void)
+{
+    uint64_t rss = 0;
+
+    /* not every system has /proc */
+    if (MemuseGetRss(&rss) == 0) {
+        FAIL_IF(rss == 0);
+    }
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void MemuseRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MemuseTest01", MemuseTest01);
+    UtRegisterTest("MemuseTest02", MemuseTest02);
+#endif
+}
@@ -0,0 +1,99 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memory accounting per subsystem.
+ *
+ * Subsystems report their allocations and frees here, next to the
+ * memuse counters they keep for their own memcap. The registry keeps
+ * the current use, the peak and the number of allocations and frees of
+ * each, for the stats and the 'memory-usage' unix socket command.
+ */
+
+#ifndef __UTIL_MEMUSE_H__
+#define __UTIL_MEMUSE_H__
+
+#include "util-atomic.h"
+
+enum MemuseSubsystem {
+    MEMUSE_FLOW = 0,
+    MEMUSE_STREAM,
+    MEMUSE_REASSEMBLY,
+    MEMUSE_DEFRAG,
+    MEMUSE_HOST,
+    MEMUSE_IPPAIR,
+    MEMUSE_HTTP,
+    MEMUSE_DNS,
+    MEMUSE_PACKETS,
+    MEMUSE_DETECT,
+    MEMUSE_MPM,
+    MEMUSE_THREADS,
+
+    MEMUSE_MAX,
+};
+
+typedef struct MemuseCounter_ {
+    SC_ATOMIC_DECLARE(uint64_t, memuse);
+    SC_ATOMIC_DECLARE(uint64_t, peak);
+    SC_ATOMIC_DECLARE(uint64_t, allocs);
+    SC_ATOMIC_DECLARE(uint64_t, frees);
+    uint64_t memcap;            /**< 0 if the subsystem has none */
+} MemuseCounter;
+
+extern MemuseCounter memuse_counters[MEMUSE_MAX];
+
+void MemuseInit(void);
+void MemuseSetMemcap(enum MemuseSubsystem id, uint64_t memcap);
+void MemuseRegisterGlobalCounters(void);
+void MemuseRegisterTests(void);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode MemuseCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+
+/**
+ * \brief account 'size' bytes allocated by subsystem 'id'
+ */
+static inline void MemuseAlloc(enum MemuseSubsystem id, uint64_t size)
+{
+    MemuseCounter *c = &memuse_counters[id];
+
+    uint64_t cur = SC_ATOMIC_ADD(c->memuse, size);
+    (void) SC_ATOMIC_ADD(c->allocs, 1);
+
+    uint64_t peak = SC_ATOMIC_GET(c->peak);
+    while (cur > peak) {
+        if (SC_ATOMIC_CAS(&c->peak, peak, cur))
+            break;
+        peak = SC_ATOMIC_GET(c->peak);
+    }
+}
+
+/**
+ * \brief account 'size' bytes freed by subsystem 'id'
+ */
+static inline void MemuseFree(enum MemuseSubsystem id, uint64_t size)
+{
+    MemuseCounter *c = &memuse_counters[id];
+
+    (void) SC_ATOMIC_SUB(c->memuse, size);
+    (void) SC_ATOMIC_ADD(c->frees, 1);
+}
+
+#endif /* __UTIL_MEMUSE_H__ */
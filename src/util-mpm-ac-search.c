@@ -0,0 +1,77 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Included by util-mpm-ac.c with different FUNC_NAME, STYPE, STABLE,
+ * SMASK, SOUTPUT, START_FILTER and CASE_CHECK, so that the state width,
+ * the root state skip and the case sensitive check are decided once per
+ * ctx instead of in the inner loop.
+ */
+
+/* Only included into util-mpm-ac.c, which defines FUNC_NAME */
+#ifdef FUNC_NAME
+
+static uint32_t FUNC_NAME(const SCACCtx *ctx, PatternMatcherQueue *pmq,
+                          const uint8_t *buf, uint16_t buflen,
+                          uint8_t *bitarray)
+{
+    const SCACPatternList *pid_pat_list = ctx->pid_pat_list;
+    STYPE (*state_table)[256] = ctx->STABLE;
+    register STYPE state = 0;
+    uint32_t matches = 0;
+    int i;
+
+    for (i = 0; i < buflen; i++) {
+#if START_FILTER
+        if (state == 0) {
+            i = SCACSkipRoot(ctx, buf, i, buflen);
+            if (i == buflen)
+                break;
+        }
+#endif
+        state = state_table[state & SMASK][u8_tolower(buf[i])];
+        if (!(state & SOUTPUT))
+            continue;
+
+        const uint32_t no_of_entries = ctx->output_table[state & SMASK].no_of_entries;
+        const uint32_t *pids = ctx->output_table[state & SMASK].pids;
+        uint32_t k;
+        for (k = 0; k < no_of_entries; k++) {
+            uint32_t pid = pids[k];
+#if CASE_CHECK
+            if (pid & AC_CASE_MASK) {
+                pid &= AC_PID_MASK;
+                if (SCMemcmp(pid_pat_list[pid].cs,
+                             buf + i - pid_pat_list[pid].patlen + 1,
+                             pid_pat_list[pid].patlen) != 0) {
+                    continue;
+                }
+            }
+#endif
+            if (!(bitarray[pid / 8] & (1 << (pid % 8)))) {
+                bitarray[pid / 8] |= (1 << (pid % 8));
+                MpmAddSids(pmq, pid_pat_list[pid].sids, pid_pat_list[pid].sids_size);
+            }
+            matches++;
+        }
+    }
+    return matches;
+}
+
+#endif /* FUNC_NAME */
@@ -59,6 +59,19 @@
 #include "util-memcmp.h"
 #include "util-mpm-ac.h"
 #include "util-memcpy.h"
+#include "util-hash-lookup3.h"
+
+#include <sys/mman.h>
+
+#ifdef UNITTESTS
+#include <dirent.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #ifdef __SC_CUDA_SUPPORT__
 
@@ -95,6 +108,8 @@ void SCACRegisterTests(void);
 
 static int construct_both_16_and_32_state_tables = 0;
 
+static void SCACSelectSearch(SCACCtx *ctx);
+
 /**
  * \brief Helper structure used by AC during state table creation
  */
@@ -104,18 +119,30 @@ typedef struct StateQueue_ {
     int bot;
 } StateQueue;
 
+/* defaults for splitting big pattern sets */
+#define SC_AC_PARTITION_MIN_PATTERNS    10000
+#define SC_AC_PARTITION_LONG_LEN        16
+
 /**
  * \internal
- * \brief Initialize the AC context with user specified conf parameters.  We
- *        aren't retrieving anything for AC conf now, but we will certainly
- *        need it, when we customize AC.
+ * \brief Initialize the AC context with user specified conf parameters.
  */
-static void SCACGetConfig()
+static void SCACGetConfig(SCACCtx *ctx)
 {
-    //ConfNode *ac_conf;
-    //const char *hash_val = NULL;
+    intmax_t value;
+
+    ctx->partition_min_patterns = SC_AC_PARTITION_MIN_PATTERNS;
+    if (ConfGetInt("detect.mpm-partition.min-patterns", &value) == 1) {
+        /* 0 disables partitioning */
+        if (value >= 0 && value <= UINT32_MAX)
+            ctx->partition_min_patterns = (uint32_t)value;
+    }
 
-    //ConfNode *pm = ConfGetNode("pattern-matcher");
+    ctx->partition_long_len = SC_AC_PARTITION_LONG_LEN;
+    if (ConfGetInt("detect.mpm-partition.long-pattern-length", &value) == 1) {
+        if (value >= SC_AC_LONG_ANCHOR_LEN && value <= UINT16_MAX)
+            ctx->partition_long_len = (uint16_t)value;
+    }
 
     return;
 }
@@ -320,7 +347,7 @@ static inline void SCACCreateGotoTable(MpmCtx *mpm_ctx)
     uint32_t i = 0;
 
     /* add each pattern to create the goto table */
-    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+    for (i = 0; i < ctx->ac_pattern_cnt; i++) {
         SCACEnter(ctx->parray[i]->ci, ctx->parray[i]->len,
                   ctx->parray[i]->id, mpm_ctx);
     }
@@ -343,7 +370,7 @@ static inline void SCACDetermineLevel1Gap(MpmCtx *mpm_ctx)
     int map[256];
     memset(map, 0, sizeof(map));
 
-    for (u = 0; u < mpm_ctx->pattern_cnt; u++)
+    for (u = 0; u < ctx->ac_pattern_cnt; u++)
         map[ctx->parray[u]->ci[0]] = 1;
 
     for (u = 0; u < 256; u++) {
@@ -680,6 +707,7 @@ static inline void SCACInsertCaseSensitiveEntriesForPatterns(MpmCtx *mpm_ctx)
             if (ctx->pid_pat_list[ctx->output_table[state].pids[k]].cs != NULL) {
                 ctx->output_table[state].pids[k] &= AC_PID_MASK;
                 ctx->output_table[state].pids[k] |= ((uint32_t)1 << AC_CASE_BIT);
+                ctx->has_cs_patterns = 1;
             }
         }
     }
@@ -749,6 +777,468 @@ static void SCACPrepareStateTable(MpmCtx *mpm_ctx)
     return;
 }
 
+static inline uint32_t SCACLongHash(uint32_t anchor)
+{
+    return (anchor * 2654435761U) >> (32 - SC_AC_LONG_FILTER_SHIFT);
+}
+
+/**
+ * \internal
+ * \brief Split off the long patterns of a big pattern set.
+ *
+ * The state table grows with the total length of the patterns, so for big
+ * sets it doesn't fit the cpu caches anymore. The long patterns are moved
+ * to the end of parray and kept out of the state table. Instead they are
+ * hashed by their first bytes and only verified where the input has a
+ * matching anchor, which is rare for long patterns.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+static void SCACPartitionPatterns(MpmCtx *mpm_ctx)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    uint32_t i;
+
+    ctx->ac_pattern_cnt = mpm_ctx->pattern_cnt;
+
+    if (ctx->partition_min_patterns == 0 ||
+        mpm_ctx->pattern_cnt < ctx->partition_min_patterns)
+        return;
+#ifdef __SC_CUDA_SUPPORT__
+    /* the cuda search only knows about the state table */
+    if (mpm_ctx->mpm_type == MPM_AC_CUDA)
+        return;
+#endif
+
+    /* move the long patterns to the end */
+    uint32_t hot = 0;
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        if (ctx->parray[i]->len < ctx->partition_long_len) {
+            MpmPattern *tmp = ctx->parray[hot];
+            ctx->parray[hot] = ctx->parray[i];
+            ctx->parray[i] = tmp;
+            hot++;
+        }
+    }
+    uint32_t long_cnt = mpm_ctx->pattern_cnt - hot;
+    if (long_cnt == 0)
+        return;
+
+    uint32_t hash_size = 1;
+    while (hash_size < long_cnt * 2 && hash_size < (1 << SC_AC_LONG_FILTER_SHIFT))
+        hash_size <<= 1;
+
+    ctx->long_patterns = SCCalloc(long_cnt, sizeof(SCACLongPattern));
+    ctx->long_hash = SCCalloc(hash_size, sizeof(uint32_t));
+    ctx->long_filter = SCCalloc(1, (1 << SC_AC_LONG_FILTER_SHIFT) / 8);
+    if (ctx->long_patterns == NULL || ctx->long_hash == NULL ||
+        ctx->long_filter == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    ctx->long_hash_mask = hash_size - 1;
+    ctx->long_memory_size = long_cnt * sizeof(SCACLongPattern) +
+        hash_size * sizeof(uint32_t) + (1 << SC_AC_LONG_FILTER_SHIFT) / 8;
+
+    for (i = 0; i < long_cnt; i++) {
+        const MpmPattern *p = ctx->parray[hot + i];
+        SCACLongPattern *lp = &ctx->long_patterns[i];
+
+        lp->ci = SCMalloc(p->len);
+        if (lp->ci == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(lp->ci, p->ci, p->len);
+        lp->len = p->len;
+        lp->pid = p->id;
+        ctx->long_memory_size += p->len;
+
+        uint32_t anchor = (uint32_t)p->ci[0] << 24 | (uint32_t)p->ci[1] << 16 |
+                          (uint32_t)p->ci[2] << 8 | (uint32_t)p->ci[3];
+        uint32_t h = SCACLongHash(anchor);
+        ctx->long_filter[h / 8] |= (1 << (h % 8));
+        lp->next = ctx->long_hash[h & ctx->long_hash_mask];
+        ctx->long_hash[h & ctx->long_hash_mask] = i + 1;
+    }
+    ctx->long_cnt = long_cnt;
+    ctx->ac_pattern_cnt = hot;
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += ctx->long_memory_size;
+
+    SCLogDebug("%u of %u patterns kept out of the state table", long_cnt,
+               mpm_ctx->pattern_cnt);
+}
+
+/**
+ * \internal
+ * \brief Collect the bytes that take the search out of the root state.
+ *
+ * \param ctx Pointer to the ac ctx, with the state table created.
+ */
+static void SCACPrepareStartBytes(SCACCtx *ctx)
+{
+    uint32_t cnt = 0;
+    int c;
+
+    ctx->start_bytes_cnt = 0;
+    for (c = 0; c < 256; c++) {
+        uint32_t next;
+        /* the search looks up the lower case byte */
+        if (ctx->state_count < 32767)
+            next = ctx->state_table_u16[0][u8_tolower(c)];
+        else
+            next = ctx->state_table_u32[0][u8_tolower(c)];
+
+        ctx->start_byte[c] = (next != 0);
+        if (next != 0) {
+            if (cnt < SC_AC_START_BYTES_MAX)
+                ctx->start_bytes[cnt] = (uint8_t)c;
+            cnt++;
+        }
+    }
+
+    /* with most bytes leaving the root, skipping doesn't pay off */
+    ctx->use_start_filter = (cnt <= 128);
+    if (cnt <= SC_AC_START_BYTES_MAX)
+        ctx->start_bytes_cnt = (uint8_t)cnt;
+
+    SCLogDebug("%u start bytes, filter %s", cnt,
+               ctx->use_start_filter ? "enabled" : "disabled");
+}
+
+/** \internal
+ *  \brief free the state and output tables of ctx */
+static void SCACFreeStateTables(MpmCtx *mpm_ctx, SCACCtx *ctx)
+{
+    if (ctx->state_table_u16 != NULL) {
+        if (ctx->cache_map == NULL)
+            SCFree(ctx->state_table_u16);
+        ctx->state_table_u16 = NULL;
+
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size -= (ctx->state_count *
+                                 sizeof(SC_AC_STATE_TYPE_U16) * 256);
+    }
+    if (ctx->state_table_u32 != NULL) {
+        if (ctx->cache_map == NULL)
+            SCFree(ctx->state_table_u32);
+        ctx->state_table_u32 = NULL;
+
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size -= (ctx->state_count *
+                                 sizeof(SC_AC_STATE_TYPE_U32) * 256);
+    }
+
+    if (ctx->output_table != NULL) {
+        uint32_t state_count;
+        for (state_count = 0; ctx->cache_map == NULL &&
+                state_count < ctx->state_count; state_count++) {
+            if (ctx->output_table[state_count].pids != NULL) {
+                SCFree(ctx->output_table[state_count].pids);
+            }
+        }
+        SCFree(ctx->output_table);
+        ctx->output_table = NULL;
+    }
+
+    if (ctx->cache_map != NULL) {
+        munmap(ctx->cache_map, ctx->cache_map_size);
+        ctx->cache_map = NULL;
+        ctx->cache_map_size = 0;
+    }
+}
+
+/* Cache of built state and output tables on disk, so that unchanged
+ * pattern sets don't have to go through the goto, failure and delta
+ * table construction again on the next start. */
+#define SC_AC_CACHE_MAGIC       0x53434143  /* "SCAC" */
+#define SC_AC_CACHE_VERSION     1
+
+typedef struct SCACCacheHeader_ {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t state_count;
+    uint32_t state_size;    /**< 2 or 4 bytes per state table entry */
+    uint32_t pids_cnt;      /**< pids in all output tables together */
+} SCACCacheHeader;
+
+static SCMutex ac_cache_lock = SCMUTEX_INITIALIZER;
+static int ac_cache_dir_init = 0;
+static const char *ac_cache_dir = NULL;
+/* map the cache files instead of reading them, see SCACCacheMap() */
+static int ac_cache_shared = 0;
+
+static const char *SCACCacheDir(void)
+{
+    SCMutexLock(&ac_cache_lock);
+    if (ac_cache_dir_init == 0) {
+        ac_cache_dir_init = 1;
+        char *dir = NULL;
+        if (ConfGet("detect.ac-cache-dir", &dir) == 1 &&
+            dir != NULL && strlen(dir) > 0) {
+            ac_cache_dir = dir;
+            SCLogConfig("caching ac state tables in %s", ac_cache_dir);
+
+            int shared = 0;
+            if (ConfGetBool("detect.ac-cache-shared", &shared) == 1 && shared) {
+                ac_cache_shared = 1;
+                SCLogConfig("sharing cached ac state tables between processes");
+            }
+        }
+    }
+    SCMutexUnlock(&ac_cache_lock);
+    return ac_cache_dir;
+}
+
+/** \internal
+ *  \brief hash what the tables are built from: the patterns of the state
+ *         table in parray order */
+static int SCACCachePath(const char *dir, const MpmCtx *mpm_ctx,
+                         char *path, size_t path_size)
+{
+    const SCACCtx *ctx = (const SCACCtx *)mpm_ctx->ctx;
+    const uint32_t version = SC_AC_CACHE_VERSION;
+    /* two differently seeded hashes for a 64 bit key */
+    uint32_t h1 = 0, h2 = 0x9e3779b9;
+    uint32_t i;
+
+    hashlittle2(&version, sizeof(version), &h1, &h2);
+    hashlittle2(&ctx->ac_pattern_cnt, sizeof(ctx->ac_pattern_cnt), &h1, &h2);
+    for (i = 0; i < ctx->ac_pattern_cnt; i++) {
+        const MpmPattern *p = ctx->parray[i];
+        hashlittle2(&p->id, sizeof(p->id), &h1, &h2);
+        hashlittle2(&p->flags, sizeof(p->flags), &h1, &h2);
+        hashlittle2(&p->len, sizeof(p->len), &h1, &h2);
+        hashlittle2(p->original_pat, p->len, &h1, &h2);
+    }
+
+    int r = snprintf(path, path_size, "%s/%08x%08x-%u.ac", dir, h1, h2,
+                     ctx->ac_pattern_cnt);
+    if (r < 0 || (size_t)r >= path_size)
+        return -1;
+    return 0;
+}
+
+/** \internal
+ *  \brief load the state and output tables from the cache
+ *
+ *  \retval 0 on success, -1 if not cached or the file is not usable
+ */
+static int SCACCacheLoad(MpmCtx *mpm_ctx, const char *path)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    SCACCacheHeader hdr;
+    void *state_table = NULL;
+    SCACOutputTable *output_table = NULL;
+    uint32_t state = 0, pids = 0;
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != SC_AC_CACHE_MAGIC ||
+        hdr.version != SC_AC_CACHE_VERSION || hdr.state_count == 0 ||
+        hdr.state_size != (hdr.state_count < 32767 ? 2 : 4))
+        goto error;
+
+    size_t table_size = (size_t)hdr.state_count * 256 * hdr.state_size;
+    state_table = SCMalloc(table_size);
+    output_table = SCCalloc(hdr.state_count, sizeof(SCACOutputTable));
+    if (state_table == NULL || output_table == NULL)
+        goto error;
+    if (fread(state_table, table_size, 1, fp) != 1)
+        goto error;
+
+    for (state = 0; state < hdr.state_count; state++) {
+        SCACOutputTable *o = &output_table[state];
+        if (fread(&o->no_of_entries, sizeof(o->no_of_entries), 1, fp) != 1 ||
+            o->no_of_entries > hdr.pids_cnt - pids)
+            goto error;
+        if (o->no_of_entries == 0)
+            continue;
+
+        o->pids = SCMalloc(o->no_of_entries * sizeof(uint32_t));
+        if (o->pids == NULL ||
+            fread(o->pids, sizeof(uint32_t), o->no_of_entries, fp) != o->no_of_entries)
+            goto error;
+        pids += o->no_of_entries;
+    }
+    if (pids != hdr.pids_cnt)
+        goto error;
+    fclose(fp);
+
+    ctx->state_count = hdr.state_count;
+    ctx->allocated_state_count = hdr.state_count;
+    ctx->output_table = output_table;
+    if (hdr.state_size == 2)
+        ctx->state_table_u16 = state_table;
+    else
+        ctx->state_table_u32 = state_table;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += table_size;
+
+    SCLogDebug("loaded %u states from %s", hdr.state_count, path);
+    return 0;
+
+error:
+    SCLogWarning(SC_ERR_INVALID_ARGUMENT, "ignoring invalid ac cache file %s",
+                 path);
+    fclose(fp);
+    if (output_table != NULL) {
+        for (state = 0; state < hdr.state_count; state++) {
+            if (output_table[state].pids != NULL)
+                SCFree(output_table[state].pids);
+        }
+        SCFree(output_table);
+    }
+    if (state_table != NULL)
+        SCFree(state_table);
+    return -1;
+}
+
+/** \internal
+ *  \brief map the cache file read only and use the tables in place
+ *
+ *  All processes that map the same file share its pages, so several
+ *  instances started with the same rules only keep one copy of the
+ *  tables in memory. Only the output table index is private.
+ *
+ *  \retval 0 on success, -1 if not cached or the file is not usable
+ */
+static int SCACCacheMap(MpmCtx *mpm_ctx, const char *path)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    SCACOutputTable *output_table = NULL;
+    uint32_t state = 0, pids = 0;
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SCACCacheHeader)) {
+        close(fd);
+        return -1;
+    }
+    size_t map_size = (size_t)st.st_size;
+    uint8_t *map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SCLogWarning(SC_ERR_MEM_ALLOC, "failed to map ac cache file %s: %s",
+                     path, strerror(errno));
+        return -1;
+    }
+
+    const SCACCacheHeader *hdr = (const SCACCacheHeader *)map;
+    if (hdr->magic != SC_AC_CACHE_MAGIC || hdr->version != SC_AC_CACHE_VERSION ||
+        hdr->state_count == 0 ||
+        hdr->state_size != (hdr->state_count < 32767 ? 2 : 4))
+        goto error;
+
+    size_t table_size = (size_t)hdr->state_count * 256 * hdr->state_size;
+    size_t offset = sizeof(*hdr) + table_size;
+    if (offset > map_size)
+        goto error;
+    output_table = SCCalloc(hdr->state_count, sizeof(SCACOutputTable));
+    if (output_table == NULL)
+        goto error;
+
+    /* the header and the table sizes keep everything 4 byte aligned */
+    for (state = 0; state < hdr->state_count; state++) {
+        SCACOutputTable *o = &output_table[state];
+        if (map_size - offset < sizeof(uint32_t))
+            goto error;
+        o->no_of_entries = *(const uint32_t *)(map + offset);
+        offset += sizeof(uint32_t);
+        if (o->no_of_entries > hdr->pids_cnt - pids ||
+            (map_size - offset) / sizeof(uint32_t) < o->no_of_entries)
+            goto error;
+        if (o->no_of_entries == 0)
+            continue;
+
+        o->pids = (uint32_t *)(map + offset);
+        offset += o->no_of_entries * sizeof(uint32_t);
+        pids += o->no_of_entries;
+    }
+    if (pids != hdr->pids_cnt || offset != map_size)
+        goto error;
+
+    ctx->state_count = hdr->state_count;
+    ctx->allocated_state_count = hdr->state_count;
+    ctx->output_table = output_table;
+    if (hdr->state_size == 2)
+        ctx->state_table_u16 = (void *)(map + sizeof(*hdr));
+    else
+        ctx->state_table_u32 = (void *)(map + sizeof(*hdr));
+    ctx->cache_map = map;
+    ctx->cache_map_size = map_size;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += table_size;
+
+    SCLogDebug("mapped %u states from %s", ctx->state_count, path);
+    return 0;
+
+error:
+    SCLogWarning(SC_ERR_INVALID_ARGUMENT, "ignoring invalid ac cache file %s",
+                 path);
+    if (output_table != NULL)
+        SCFree(output_table);
+    munmap(map, map_size);
+    return -1;
+}
+
+/** \internal
+ *  \brief store the tables in the cache. A temporary file is renamed into
+ *         place so concurrent starts never see partial files. */
+static int SCACCacheStore(const MpmCtx *mpm_ctx, const char *path)
+{
+    const SCACCtx *ctx = (const SCACCtx *)mpm_ctx->ctx;
+    char tmp_path[PATH_MAX];
+    SCACCacheHeader hdr;
+    uint32_t state;
+    int ok = 1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SC_AC_CACHE_MAGIC;
+    hdr.version = SC_AC_CACHE_VERSION;
+    hdr.state_count = ctx->state_count;
+    hdr.state_size = (ctx->state_count < 32767) ? 2 : 4;
+    for (state = 0; state < ctx->state_count; state++)
+        hdr.pids_cnt += ctx->output_table[state].no_of_entries;
+
+    /* unique per thread, identical sets may be built concurrently */
+    int r = snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%lu.tmp", path,
+                     (int)getpid(), SCGetThreadIdLong());
+    if (r < 0 || (size_t)r >= sizeof(tmp_path))
+        return -1;
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to open ac cache file %s: %s",
+                     tmp_path, strerror(errno));
+        return -1;
+    }
+
+    const void *table = (hdr.state_size == 2) ? (const void *)ctx->state_table_u16 :
+                                                (const void *)ctx->state_table_u32;
+    ok &= (fwrite(&hdr, sizeof(hdr), 1, fp) == 1);
+    ok &= (fwrite(table, (size_t)hdr.state_count * 256 * hdr.state_size, 1, fp) == 1);
+    for (state = 0; ok && state < ctx->state_count; state++) {
+        const SCACOutputTable *o = &ctx->output_table[state];
+        ok &= (fwrite(&o->no_of_entries, sizeof(o->no_of_entries), 1, fp) == 1);
+        if (o->no_of_entries > 0)
+            ok &= (fwrite(o->pids, sizeof(uint32_t), o->no_of_entries, fp) == o->no_of_entries);
+    }
+
+    if (fclose(fp) != 0 || !ok || rename(tmp_path, path) != 0) {
+        SCLogWarning(SC_ERR_FWRITE, "failed to write ac cache file %s", path);
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * \brief Process the patterns added to the mpm, and create the internal tables.
  *
@@ -820,8 +1310,37 @@ int SCACPreparePatterns(MpmCtx *mpm_ctx)
         ctx->parray[i]->sids = NULL;
     }
 
+    SCACPartitionPatterns(mpm_ctx);
+
+    /* the cache only holds the table sized for the state count, not
+     * the 16 and 32 bit tables cuda and some tests want */
+    char cache_path[PATH_MAX];
+    const char *cache_dir = NULL;
+    if (mpm_ctx->mpm_type == MPM_AC && !construct_both_16_and_32_state_tables) {
+        cache_dir = SCACCacheDir();
+        if (cache_dir != NULL &&
+            SCACCachePath(cache_dir, mpm_ctx, cache_path, sizeof(cache_path)) != 0)
+            cache_dir = NULL;
+    }
+
     /* prepare the state table required by AC */
-    SCACPrepareStateTable(mpm_ctx);
+    if (cache_dir != NULL && ac_cache_shared) {
+        if (SCACCacheMap(mpm_ctx, cache_path) != 0) {
+            SCACPrepareStateTable(mpm_ctx);
+            /* the first process to build the tables switches to the
+             * mapping as well, so it doesn't keep a private copy */
+            SCACCtx built = *ctx;
+            if (SCACCacheStore(mpm_ctx, cache_path) == 0 &&
+                SCACCacheMap(mpm_ctx, cache_path) == 0)
+                SCACFreeStateTables(mpm_ctx, &built);
+        }
+    } else if (cache_dir == NULL || SCACCacheLoad(mpm_ctx, cache_path) != 0) {
+        SCACPrepareStateTable(mpm_ctx);
+        if (cache_dir != NULL)
+            SCACCacheStore(mpm_ctx, cache_path);
+    }
+    SCACPrepareStartBytes(ctx);
+    SCACSelectSearch(ctx);
 
 #ifdef __SC_CUDA_SUPPORT__
     if (mpm_ctx->mpm_type == MPM_AC_CUDA) {
@@ -910,9 +1429,8 @@ void SCACInitCtx(MpmCtx *mpm_ctx)
     }
     memset(mpm_ctx->init_hash, 0, sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
 
-    /* get conf values for AC from our yaml file.  We have no conf values for
-     * now.  We will certainly need this, as we develop the algo */
-    SCACGetConfig();
+    /* get conf values for AC from our yaml file */
+    SCACGetConfig((SCACCtx *)mpm_ctx->ctx);
 
     SCReturn;
 }
@@ -969,31 +1487,19 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
         mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(MpmPattern *));
     }
 
-    if (ctx->state_table_u16 != NULL) {
-        SCFree(ctx->state_table_u16);
-        ctx->state_table_u16 = NULL;
+    SCACFreeStateTables(mpm_ctx, ctx);
 
-        mpm_ctx->memory_cnt++;
-        mpm_ctx->memory_size -= (ctx->state_count *
-                                 sizeof(SC_AC_STATE_TYPE_U16) * 256);
-    }
-    if (ctx->state_table_u32 != NULL) {
-        SCFree(ctx->state_table_u32);
-        ctx->state_table_u32 = NULL;
-
-        mpm_ctx->memory_cnt++;
-        mpm_ctx->memory_size -= (ctx->state_count *
-                                 sizeof(SC_AC_STATE_TYPE_U32) * 256);
-    }
-
-    if (ctx->output_table != NULL) {
-        uint32_t state_count;
-        for (state_count = 0; state_count < ctx->state_count; state_count++) {
-            if (ctx->output_table[state_count].pids != NULL) {
-                SCFree(ctx->output_table[state_count].pids);
-            }
+    if (ctx->long_patterns != NULL) {
+        uint32_t i;
+        for (i = 0; i < ctx->long_cnt; i++) {
+            SCFree(ctx->long_patterns[i].ci);
         }
-        SCFree(ctx->output_table);
+        SCFree(ctx->long_patterns);
+        SCFree(ctx->long_hash);
+        SCFree(ctx->long_filter);
+
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->long_memory_size;
     }
 
     if (ctx->pid_pat_list != NULL) {
@@ -1014,6 +1520,203 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
     return;
 }
 
+/**
+ * \internal
+ * \brief Skip the bytes that keep the search in the root state.
+ *
+ * In the root state each transition only depends on the input byte and not
+ * on the previous lookup, so a run of bytes can be checked in bulk. Where
+ * available, 16 bytes at a time are compared against the start bytes.
+ *
+ * \retval offset of the first byte leaving the root state, or buflen
+ */
+static inline int SCACSkipRoot(const SCACCtx *ctx, const uint8_t *buf,
+                               int i, int buflen)
+{
+#if defined(__SSE2__) || (defined(__aarch64__) && defined(__ARM_NEON))
+    if (ctx->start_bytes_cnt > 0) {
+        const uint8_t cnt = ctx->start_bytes_cnt;
+        uint8_t k;
+        for (; i + 16 <= buflen; i += 16) {
+#if defined(__SSE2__)
+            __m128i data = _mm_loadu_si128((const __m128i *)(buf + i));
+            __m128i hit = _mm_setzero_si128();
+            for (k = 0; k < cnt; k++) {
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(data,
+                            _mm_set1_epi8((char)ctx->start_bytes[k])));
+            }
+            if (_mm_movemask_epi8(hit) != 0)
+                break;
+#else
+            uint8x16_t data = vld1q_u8(buf + i);
+            uint8x16_t hit = vdupq_n_u8(0);
+            for (k = 0; k < cnt; k++) {
+                hit = vorrq_u8(hit, vceqq_u8(data, vdupq_n_u8(ctx->start_bytes[k])));
+            }
+            if (vmaxvq_u8(hit) != 0)
+                break;
+#endif
+        }
+    }
+#endif
+    while (i < buflen && ctx->start_byte[buf[i]] == 0)
+        i++;
+    return i;
+}
+
+/**
+ * \internal
+ * \brief Search for the long patterns that are not in the state table.
+ *
+ * \retval number of matches
+ */
+static uint32_t SCACSearchLong(const SCACCtx *ctx, PatternMatcherQueue *pmq,
+                               const uint8_t *buf, uint16_t buflen,
+                               uint8_t *bitarray)
+{
+    const SCACPatternList *pid_pat_list = ctx->pid_pat_list;
+    uint32_t matches = 0;
+    uint32_t anchor = 0;
+    int i;
+
+    for (i = 0; i < buflen; i++) {
+        anchor = (anchor << 8) | u8_tolower(buf[i]);
+        if (i < SC_AC_LONG_ANCHOR_LEN - 1)
+            continue;
+
+        uint32_t h = SCACLongHash(anchor);
+        if (!(ctx->long_filter[h / 8] & (1 << (h % 8))))
+            continue;
+
+        const int offset = i - (SC_AC_LONG_ANCHOR_LEN - 1);
+        uint32_t idx = ctx->long_hash[h & ctx->long_hash_mask];
+        while (idx != 0) {
+            const SCACLongPattern *lp = &ctx->long_patterns[idx - 1];
+            idx = lp->next;
+
+            if (lp->len > buflen - offset)
+                continue;
+            if (SCMemcmpLowercase(lp->ci, buf + offset, lp->len) != 0)
+                continue;
+            const SCACPatternList *pl = &pid_pat_list[lp->pid];
+            if (pl->cs != NULL && SCMemcmp(pl->cs, buf + offset, lp->len) != 0)
+                continue;
+
+            if (!(bitarray[lp->pid / 8] & (1 << (lp->pid % 8)))) {
+                bitarray[lp->pid / 8] |= (1 << (lp->pid % 8));
+                MpmAddSids(pmq, pl->sids, pl->sids_size);
+            }
+            matches++;
+        }
+    }
+    return matches;
+}
+
+/* Search loop variants, see util-mpm-ac-search.c. The 16 bit tables keep
+ * the output flag in bit 15, the 32 bit ones in the top byte. */
+#define STYPE SC_AC_STATE_TYPE_U16
+#define STABLE state_table_u16
+#define SMASK 0x7FFF
+#define SOUTPUT 0x8000
+
+#define FUNC_NAME SCACSearch16
+#define START_FILTER 0
+#define CASE_CHECK 0
+#include "util-mpm-ac-search.c"
+#undef FUNC_NAME
+#undef START_FILTER
+#undef CASE_CHECK
+
+#define FUNC_NAME SCACSearch16Cs
+#define START_FILTER 0
+#define CASE_CHECK 1
+#include "util-mpm-ac-search.c"
+#undef FUNC_NAME
+#undef START_FILTER
+#undef CASE_CHECK
+
+#define FUNC_NAME SCACSearch16Skip
+#define START_FILTER 1
+#define CASE_CHECK 0
+#include "util-mpm-ac-search.c"
+#undef FUNC_NAME
+#undef START_FILTER
+#undef CASE_CHECK
+
+#define FUNC_NAME SCACSearch16SkipCs
+#define START_FILTER 1
+#define CASE_CHECK 1
+#include "util-mpm-ac-search.c"
+#undef FUNC_NAME
+#undef START_FILTER
+#undef CASE_CHECK
+
+#undef STYPE
+#undef STABLE
+#undef SMASK
+#undef SOUTPUT
+#define STYPE SC_AC_STATE_TYPE_U32
+#define STABLE state_table_u32
+#define SMASK 0x00FFFFFF
+#define SOUTPUT 0xFF000000
+
+#define FUNC_NAME SCACSearch32
+#define START_FILTER 0
+#define CASE_CHECK 0
+#include "util-mpm-ac-search.c"
+#undef FUNC_NAME
+#undef START_FILTER
+#undef CASE_CHECK
+
+#define FUNC_NAME SCACSearch32Cs
+#define START_FILTER 0
+#define CASE_CHECK 1
+#include "util-mpm-ac-search.c"
+#undef FUNC_NAME
+#undef START_FILTER
+#undef CASE_CHECK
+
+#define FUNC_NAME SCACSearch32Skip
+#define START_FILTER 1
+#define CASE_CHECK 0
+#include "util-mpm-ac-search.c"
+#undef FUNC_NAME
+#undef START_FILTER
+#undef CASE_CHECK
+
+#define FUNC_NAME SCACSearch32SkipCs
+#define START_FILTER 1
+#define CASE_CHECK 1
+#include "util-mpm-ac-search.c"
+#undef FUNC_NAME
+#undef START_FILTER
+#undef CASE_CHECK
+
+#undef STYPE
+#undef STABLE
+#undef SMASK
+#undef SOUTPUT
+
+/**
+ * \internal
+ * \brief pick the search loop for the state width, the root state skip
+ *        and whether case sensitive patterns need checking
+ */
+static void SCACSelectSearch(SCACCtx *ctx)
+{
+    if (ctx->state_count < 32767) {
+        if (ctx->use_start_filter)
+            ctx->search = ctx->has_cs_patterns ? SCACSearch16SkipCs : SCACSearch16Skip;
+        else
+            ctx->search = ctx->has_cs_patterns ? SCACSearch16Cs : SCACSearch16;
+    } else {
+        if (ctx->use_start_filter)
+            ctx->search = ctx->has_cs_patterns ? SCACSearch32SkipCs : SCACSearch32Skip;
+        else
+            ctx->search = ctx->has_cs_patterns ? SCACSearch32Cs : SCACSearch32;
+    }
+}
+
 /**
  * \brief The aho corasick search function.
  *
@@ -1030,97 +1733,16 @@ uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen)
 {
     const SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
-    int i = 0;
-    int matches = 0;
-
-    /* \todo tried loop unrolling with register var, with no perf increase.  Need
-     * to dig deeper */
-    /* \todo Change it for stateful MPM.  Supply the state using mpm_thread_ctx */
-    SCACPatternList *pid_pat_list = ctx->pid_pat_list;
+    uint32_t matches = 0;
 
     uint8_t bitarray[ctx->pattern_id_bitarray_size];
     memset(bitarray, 0, ctx->pattern_id_bitarray_size);
 
-    if (ctx->state_count < 32767) {
-        register SC_AC_STATE_TYPE_U16 state = 0;
-        SC_AC_STATE_TYPE_U16 (*state_table_u16)[256] = ctx->state_table_u16;
-        for (i = 0; i < buflen; i++) {
-            state = state_table_u16[state & 0x7FFF][u8_tolower(buf[i])];
-            if (state & 0x8000) {
-                uint32_t no_of_entries = ctx->output_table[state & 0x7FFF].no_of_entries;
-                uint32_t *pids = ctx->output_table[state & 0x7FFF].pids;
-                uint32_t k;
-                for (k = 0; k < no_of_entries; k++) {
-                    if (pids[k] & AC_CASE_MASK) {
-                        uint32_t lower_pid = pids[k] & AC_PID_MASK;
-                        if (SCMemcmp(pid_pat_list[lower_pid].cs,
-                                     buf + i - pid_pat_list[lower_pid].patlen + 1,
-                                     pid_pat_list[lower_pid].patlen) != 0) {
-                            /* inside loop */
-                            continue;
-                        }
-                        if (bitarray[(lower_pid) / 8] & (1 << ((lower_pid) % 8))) {
-                            ;
-                        } else {
-                            bitarray[(lower_pid) / 8] |= (1 << ((lower_pid) % 8));
-                            MpmAddSids(pmq, pid_pat_list[lower_pid].sids, pid_pat_list[lower_pid].sids_size);
-                        }
-                        matches++;
-                    } else {
-                        if (bitarray[pids[k] / 8] & (1 << (pids[k] % 8))) {
-                            ;
-                        } else {
-                            bitarray[pids[k] / 8] |= (1 << (pids[k] % 8));
-                            MpmAddSids(pmq, pid_pat_list[pids[k]].sids, pid_pat_list[pids[k]].sids_size);
-                        }
-                        matches++;
-                    }
-                    //loop1:
-                    //;
-                }
-            }
-        } /* for (i = 0; i < buflen; i++) */
+    if (ctx->search != NULL)
+        matches = ctx->search(ctx, pmq, buf, buflen, bitarray);
 
-    } else {
-        register SC_AC_STATE_TYPE_U32 state = 0;
-        SC_AC_STATE_TYPE_U32 (*state_table_u32)[256] = ctx->state_table_u32;
-        for (i = 0; i < buflen; i++) {
-            state = state_table_u32[state & 0x00FFFFFF][u8_tolower(buf[i])];
-            if (state & 0xFF000000) {
-                uint32_t no_of_entries = ctx->output_table[state & 0x00FFFFFF].no_of_entries;
-                uint32_t *pids = ctx->output_table[state & 0x00FFFFFF].pids;
-                uint32_t k;
-                for (k = 0; k < no_of_entries; k++) {
-                    if (pids[k] & AC_CASE_MASK) {
-                        uint32_t lower_pid = pids[k] & 0x0000FFFF;
-                        if (SCMemcmp(pid_pat_list[lower_pid].cs,
-                                     buf + i - pid_pat_list[lower_pid].patlen + 1,
-                                     pid_pat_list[lower_pid].patlen) != 0) {
-                            /* inside loop */
-                            continue;
-                        }
-                        if (bitarray[(lower_pid) / 8] & (1 << ((lower_pid) % 8))) {
-                            ;
-                        } else {
-                            bitarray[(lower_pid) / 8] |= (1 << ((lower_pid) % 8));
-                            MpmAddSids(pmq, pid_pat_list[lower_pid].sids, pid_pat_list[lower_pid].sids_size);
-                        }
-                        matches++;
-                    } else {
-                        if (bitarray[pids[k] / 8] & (1 << (pids[k] % 8))) {
-                            ;
-                        } else {
-                            bitarray[pids[k] / 8] |= (1 << (pids[k] % 8));
-                            MpmAddSids(pmq, pid_pat_list[pids[k]].sids, pid_pat_list[pids[k]].sids_size);
-                        }
-                        matches++;
-                    }
-                    //loop1:
-                    //;
-                }
-            }
-        } /* for (i = 0; i < buflen; i++) */
-    }
+    if (ctx->long_cnt > 0 && buflen >= ctx->partition_long_len)
+        matches += SCACSearchLong(ctx, pmq, buf, buflen, bitarray);
 
     return matches;
 }
@@ -2827,6 +3449,277 @@ end:
     return result;
 }
 
+/** \test root state skipping, matches around the 16 byte blocks */
+static int SCACTest30(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"xyz", 3, 0, 0, 1, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"9", 1, 0, 0, 2, 0, 0);
+    PmqSetup(&pmq);
+
+    SCACPreparePatterns(&mpm_ctx);
+    const SCACCtx *ctx = (SCACCtx *)mpm_ctx.ctx;
+    FAIL_IF_NOT(ctx->use_start_filter);
+    /* a, A, x, X and 9: the table is looked up by the lower case byte */
+    FAIL_IF(ctx->start_bytes_cnt != 5);
+
+    /* "abcd" straddles the first 16 byte block, "XyZ" ends the buffer */
+    char *buf = "------------abcd----------------"
+                "--------------------------XyZ";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 2);
+
+    /* near misses in the root state and a match in the tail */
+    buf = "aaaaaaaaaaaaaaaaxxxxxxxxxxxxxxxxab9";
+    cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                     (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 1);
+
+    buf = "--------------------------------------------------";
+    cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                     (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 0);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test start byte sets too large for the vectorized skip */
+static int SCACTest31(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint8_t pat[2];
+    int c;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    /* 10 digits: filtered, but without the vectorized skip */
+    for (c = 0; c < 10; c++) {
+        pat[0] = '0' + c;
+        pat[1] = '!';
+        MpmAddPatternCS(&mpm_ctx, pat, 2, 0, 0, c, 0, 0);
+    }
+    PmqSetup(&pmq);
+
+    SCACPreparePatterns(&mpm_ctx);
+    const SCACCtx *ctx = (SCACCtx *)mpm_ctx.ctx;
+    FAIL_IF_NOT(ctx->use_start_filter);
+    FAIL_IF(ctx->start_bytes_cnt != 0);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyz0123456789!abc3!";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 2);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+
+    /* most bytes start a pattern: no filter */
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    for (c = 0; c < 200; c++) {
+        pat[0] = c;
+        pat[1] = c;
+        MpmAddPatternCS(&mpm_ctx, pat, 2, 0, 0, c, 0, 0);
+    }
+    PmqSetup(&pmq);
+
+    SCACPreparePatterns(&mpm_ctx);
+    ctx = (SCACCtx *)mpm_ctx.ctx;
+    FAIL_IF(ctx->use_start_filter);
+
+    buf = "--ab11";
+    cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                     (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 2);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test long patterns split off from the state table */
+static int SCACTest32(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx.ctx;
+    ctx->partition_min_patterns = 1;
+    ctx->partition_long_len = 8;
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abc", 3, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"LongCaseSensitive", 17, 0, 0, 1, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"longnocase", 10, 0, 0, 2, 0, 0);
+    PmqSetup(&pmq);
+
+    SCACPreparePatterns(&mpm_ctx);
+    FAIL_IF(ctx->long_cnt != 2);
+    FAIL_IF(ctx->ac_pattern_cnt != 1);
+
+    char *buf = "abc LongCaseSensitive LONGNOCASE longcasesensitive LongNoCase";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 4);
+
+    /* shared anchors, truncated at the end of the buffer */
+    buf = "longnocas longcasesensitiv LongCaseSensitiv";
+    cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                     (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 0);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test partitioned set without short patterns */
+static int SCACTest33(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx.ctx;
+    ctx->partition_min_patterns = 1;
+    ctx->partition_long_len = 4;
+
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"abcdef", 6, 0, 0, 1, 0, 0);
+    PmqSetup(&pmq);
+
+    SCACPreparePatterns(&mpm_ctx);
+    FAIL_IF(ctx->long_cnt != 2);
+    FAIL_IF(ctx->ac_pattern_cnt != 0);
+
+    char *buf = "xxabcdefxxABCDxx";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 3);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \internal
+ *  \brief build the ctx from the patterns, search buf and return the count */
+static uint32_t SCACTestCacheSearch(char *buf)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"FGhJ", 4, 0, 0, 1, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"xyz", 3, 0, 0, 2, 0, 0);
+    PmqSetup(&pmq);
+
+    SCACPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)buf, strlen(buf));
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return cnt;
+}
+
+/** \internal
+ *  \brief build the same ctx twice with the cache in a new directory */
+static int SCACTestCache(int shared)
+{
+    char dir[] = "/tmp/suricata-ac-cache-XXXXXX";
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    int files = 0;
+
+    FAIL_IF_NULL(mkdtemp(dir));
+    const char *saved_dir = ac_cache_dir;
+    int saved_init = ac_cache_dir_init;
+    int saved_shared = ac_cache_shared;
+    ac_cache_dir = dir;
+    ac_cache_dir_init = 1;
+    ac_cache_shared = shared;
+
+    uint32_t built = SCACTestCacheSearch(buf);
+    uint32_t loaded = SCACTestCacheSearch(buf);
+
+    char path[PATH_MAX];
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    while (d != NULL && (de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        if (strstr(de->d_name, ".ac") != NULL)
+            files++;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        unlink(path);
+    }
+    if (d != NULL)
+        closedir(d);
+    rmdir(dir);
+
+    ac_cache_dir = saved_dir;
+    ac_cache_dir_init = saved_init;
+    ac_cache_shared = saved_shared;
+
+    FAIL_IF(files != 1);
+    FAIL_IF(built != 3);
+    FAIL_IF(loaded != built);
+    PASS;
+}
+
+/** \test tables stored in the cache and loaded again search the same */
+static int SCACTest34(void)
+{
+    return SCACTestCache(0);
+}
+
+/** \test the same with the tables used in place from the mapped file */
+static int SCACTest35(void)
+{
+    return SCACTestCache(1);
+}
+
 #endif /* UNITTESTS */
 
 void SCACRegisterTests(void)
@@ -2862,6 +3755,12 @@ void SCACRegisterTests(void)
     UtRegisterTest("SCACTest27", SCACTest27);
     UtRegisterTest("SCACTest28", SCACTest28);
     UtRegisterTest("SCACTest29", SCACTest29);
+    UtRegisterTest("SCACTest30", SCACTest30);
+    UtRegisterTest("SCACTest31", SCACTest31);
+    UtRegisterTest("SCACTest32", SCACTest32);
+    UtRegisterTest("SCACTest33", SCACTest33);
+    UtRegisterTest("SCACTest34 -- state table cache", SCACTest34);
+    UtRegisterTest("SCACTest35 -- shared state table cache", SCACTest35);
 #endif
 
     return;
@@ -54,6 +54,24 @@ typedef struct SCACOutputTable_ {
     uint32_t no_of_entries;
 } SCACOutputTable;
 
+/** long pattern kept out of the state table */
+typedef struct SCACLongPattern_ {
+    /* lower case copy of the pattern */
+    uint8_t *ci;
+    uint16_t len;
+    uint32_t pid;
+    /* next pattern in the hash bucket + 1, 0 for none */
+    uint32_t next;
+} SCACLongPattern;
+
+/* the long patterns are hashed by their first SC_AC_LONG_ANCHOR_LEN bytes */
+#define SC_AC_LONG_ANCHOR_LEN   4
+/* bits in the long pattern filter: 8KiB */
+#define SC_AC_LONG_FILTER_SHIFT 16
+
+/* max number of distinct start bytes for the vectorized skip */
+#define SC_AC_START_BYTES_MAX 8
+
 typedef struct SCACCtx_ {
     /* pattern arrays.  We need this only during the goto table creation phase */
     MpmPattern **parray;
@@ -80,6 +98,43 @@ typedef struct SCACCtx_ {
 
     uint32_t allocated_state_count;
 
+    /* if set the state table and the pids of the output table point into
+     * this read only mapping of a cache file, see SCACCacheMap() */
+    void *cache_map;
+    size_t cache_map_size;
+
+    /* big pattern sets are split: patterns of at least partition_long_len
+     * bytes are kept out of the state table, see SCACPartitionPatterns() */
+    uint32_t partition_min_patterns;
+    uint16_t partition_long_len;
+    /* number of patterns (at the start of parray) in the state table */
+    uint32_t ac_pattern_cnt;
+
+    uint32_t long_cnt;
+    SCACLongPattern *long_patterns;
+    /* bucket heads as index + 1 into long_patterns, 0 for empty */
+    uint32_t *long_hash;
+    uint32_t long_hash_mask;
+    /* bitmap of the anchor hashes, checked before the buckets */
+    uint8_t *long_filter;
+    /* memory used by all of the above */
+    uint32_t long_memory_size;
+
+    /* bytes that leave the root state. While in the root state the search
+     * skips ahead to the next of these. Not used if most bytes qualify. */
+    int use_start_filter;
+    uint8_t start_byte[256];
+    /* the same set as a list, for the vectorized skip. Not used if
+     * start_bytes_cnt is 0. */
+    uint8_t start_bytes_cnt;
+    uint8_t start_bytes[SC_AC_START_BYTES_MAX];
+
+    /* set if any output has a case sensitive pattern to check */
+    int has_cs_patterns;
+    /* the search loop variant for this ctx, see SCACSelectSearch() */
+    uint32_t (*search)(const struct SCACCtx_ *, PatternMatcherQueue *,
+                       const uint8_t *, uint16_t, uint8_t *);
+
 #ifdef __SC_CUDA_SUPPORT__
     CUdeviceptr state_table_u16_cuda;
     CUdeviceptr state_table_u32_cuda;
@@ -45,6 +45,7 @@
 #ifdef BUILD_HYPERSCAN
 
 #include <hs.h>
+#include <dirent.h>
 
 void SCHSInitCtx(MpmCtx *);
 void SCHSInitThreadCtx(MpmCtx *, MpmThreadCtx *);
@@ -57,6 +58,9 @@ int SCHSAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
 int SCHSPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PatternMatcherQueue *pmq, const uint8_t *buf, const uint16_t buflen);
+uint32_t SCHSSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PatternMatcherQueue *pmq, const uint8_t **bufs,
+                          const uint16_t *lens, uint32_t cnt);
 void SCHSPrintInfo(MpmCtx *mpm_ctx);
 void SCHSPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCHSRegisterTests(void);
@@ -364,6 +368,7 @@ typedef struct SCHSCompileData_ {
     char **expressions;
     hs_expr_ext_t **ext;
     unsigned int pattern_cnt;
+    unsigned int mode;
 } SCHSCompileData;
 
 static SCHSCompileData *SCHSAllocCompileData(unsigned int pattern_cnt)
@@ -441,6 +446,8 @@ typedef struct PatternDatabase_ {
     SCHSPattern **parray;
     hs_database_t *hs_db;
     uint32_t pattern_cnt;
+    /* HS_MODE_BLOCK or HS_MODE_VECTORED */
+    unsigned int mode;
 
     /* Reference count: number of MPM contexts using this pattern database. */
     uint32_t ref_cnt;
@@ -487,6 +494,7 @@ static uint32_t PatternDatabaseHash(HashTable *ht, void *data, uint16_t len)
     const PatternDatabase *pd = data;
     uint32_t hash = 0;
     hash = hashword(&pd->pattern_cnt, 1, hash);
+    hash = hashword(&pd->mode, 1, hash);
 
     for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
         hash = SCHSPatternHash(pd->parray[i], hash);
@@ -502,7 +510,7 @@ static char PatternDatabaseCompare(void *data1, uint16_t len1, void *data2,
     const PatternDatabase *pd1 = data1;
     const PatternDatabase *pd2 = data2;
 
-    if (pd1->pattern_cnt != pd2->pattern_cnt) {
+    if (pd1->pattern_cnt != pd2->pattern_cnt || pd1->mode != pd2->mode) {
         return 0;
     }
 
@@ -542,6 +550,158 @@ static void PatternDatabaseTableFree(void *data)
      * structures is done in MPM destruction when the ref_cnt drops to zero. */
 }
 
+/* Cache of serialised databases on disk, so that unchanged pattern sets
+ * don't need to be compiled again on the next start or rule reload. The
+ * setting is read with g_db_table_mutex held. */
+static int g_cache_dir_init = 0;
+static const char *g_cache_dir = NULL;
+
+static const char *SCHSCacheDir(void)
+{
+    if (g_cache_dir_init == 0) {
+        g_cache_dir_init = 1;
+        char *dir = NULL;
+        if (ConfGet("detect.hyperscan-cache-dir", &dir) == 1 &&
+            dir != NULL && strlen(dir) > 0) {
+            g_cache_dir = dir;
+            SCLogConfig("caching hyperscan databases in %s", g_cache_dir);
+        }
+    }
+    return g_cache_dir;
+}
+
+static inline void SCHSCacheHashAdd(const void *data, size_t len,
+                                    uint32_t *h1, uint32_t *h2)
+{
+    *h1 = hashlittle_safe(data, len, *h1);
+    *h2 = hashlittle_safe(data, len, *h2);
+}
+
+/** \internal
+ *  \brief hash everything the compiled database depends on: the compile
+ *         input, the Hyperscan version and the platform compiled for */
+static void SCHSCacheHash(const SCHSCompileData *cd, uint32_t *h1, uint32_t *h2)
+{
+    hs_platform_info_t plat;
+    memset(&plat, 0, sizeof(plat));
+    (void)hs_populate_platform(&plat);
+    const char *version = hs_version();
+
+    SCHSCacheHashAdd(version, strlen(version), h1, h2);
+    SCHSCacheHashAdd(&plat, sizeof(plat), h1, h2);
+    SCHSCacheHashAdd(&cd->mode, sizeof(cd->mode), h1, h2);
+    SCHSCacheHashAdd(&cd->pattern_cnt, sizeof(cd->pattern_cnt), h1, h2);
+
+    for (unsigned int i = 0; i < cd->pattern_cnt; i++) {
+        SCHSCacheHashAdd(&cd->ids[i], sizeof(cd->ids[i]), h1, h2);
+        SCHSCacheHashAdd(&cd->flags[i], sizeof(cd->flags[i]), h1, h2);
+        SCHSCacheHashAdd(cd->expressions[i], strlen(cd->expressions[i]) + 1,
+                         h1, h2);
+        if (cd->ext[i] != NULL) {
+            SCHSCacheHashAdd(&cd->ext[i]->flags, sizeof(cd->ext[i]->flags), h1, h2);
+            SCHSCacheHashAdd(&cd->ext[i]->min_offset,
+                             sizeof(cd->ext[i]->min_offset), h1, h2);
+            SCHSCacheHashAdd(&cd->ext[i]->max_offset,
+                             sizeof(cd->ext[i]->max_offset), h1, h2);
+        } else {
+            uint8_t none = 0;
+            SCHSCacheHashAdd(&none, sizeof(none), h1, h2);
+        }
+    }
+}
+
+static int SCHSCachePath(const char *dir, const SCHSCompileData *cd,
+                         char *path, size_t path_size)
+{
+    if (dir == NULL)
+        return -1;
+
+    /* two differently seeded hashes for a 64 bit key */
+    uint32_t h1 = 0, h2 = 0x9e3779b9;
+    SCHSCacheHash(cd, &h1, &h2);
+
+    int r = snprintf(path, path_size, "%s/%08x%08x-%u.hs", dir, h1, h2,
+                     cd->pattern_cnt);
+    if (r < 0 || (size_t)r >= path_size)
+        return -1;
+    return 0;
+}
+
+/** \internal
+ *  \brief load a database from the cache
+ *
+ *  \retval 0 on success, -1 if not cached or the file is not usable
+ */
+static int SCHSCacheLoad(const char *path, hs_database_t **db)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+
+    int ret = -1;
+    char *bytes = NULL;
+    long len;
+
+    if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) <= 0 ||
+        fseek(fp, 0, SEEK_SET) != 0)
+        goto end;
+
+    bytes = SCMalloc(len);
+    if (bytes == NULL)
+        goto end;
+    if (fread(bytes, 1, len, fp) != (size_t)len)
+        goto end;
+
+    /* fails on a version or platform mismatch as well */
+    if (hs_deserialize_database(bytes, len, db) != HS_SUCCESS) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "ignoring invalid hyperscan "
+                     "cache file %s", path);
+        *db = NULL;
+        goto end;
+    }
+    SCLogDebug("loaded database from %s", path);
+    ret = 0;
+end:
+    if (bytes != NULL)
+        SCFree(bytes);
+    fclose(fp);
+    return ret;
+}
+
+/** \internal
+ *  \brief store a compiled database in the cache. A temporary file is
+ *         renamed into place so concurrent starts never see partial files. */
+static void SCHSCacheStore(const char *path, const hs_database_t *db)
+{
+    char *bytes = NULL;
+    size_t len = 0;
+    char tmp_path[PATH_MAX];
+
+    if (hs_serialize_database(db, &bytes, &len) != HS_SUCCESS)
+        return;
+
+    /* unique per thread, identical sets may be compiled concurrently */
+    int r = snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%lu.tmp", path,
+                     (int)getpid(), SCGetThreadIdLong());
+    if (r < 0 || (size_t)r >= sizeof(tmp_path))
+        goto end;
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to open hyperscan cache file %s: %s",
+                     tmp_path, strerror(errno));
+        goto end;
+    }
+    size_t written = fwrite(bytes, 1, len, fp);
+    if (fclose(fp) != 0 || written != len || rename(tmp_path, path) != 0) {
+        SCLogWarning(SC_ERR_FWRITE, "failed to write hyperscan cache file %s",
+                     path);
+        unlink(tmp_path);
+    }
+end:
+    SCHSFree(bytes);
+}
+
 static PatternDatabase *PatternDatabaseAlloc(uint32_t pattern_cnt)
 {
     PatternDatabase *pd = SCMalloc(sizeof(PatternDatabase));
@@ -565,6 +725,28 @@ static PatternDatabase *PatternDatabaseAlloc(uint32_t pattern_cnt)
     return pd;
 }
 
+/** \internal
+ *  \brief use an already built database for the same patterns, if any
+ *
+ *  Must be called with g_db_table_mutex held.
+ *
+ *  \retval 1 ctx now uses the cached database, 0 if there is none
+ */
+static int SCHSReuseCachedDatabase(SCHSCtx *ctx, PatternDatabase *pd)
+{
+    PatternDatabase *pd_cached = HashTableLookup(g_db_table, pd, 1);
+    if (pd_cached == NULL)
+        return 0;
+
+    SCLogDebug("Reusing cached database %p with %" PRIu32
+               " patterns (ref_cnt=%" PRIu32 ")",
+               pd_cached->hs_db, pd_cached->pattern_cnt,
+               pd_cached->ref_cnt);
+    pd_cached->ref_cnt++;
+    ctx->pattern_db = pd_cached;
+    return 1;
+}
+
 /**
  * \brief Process the patterns added to the mpm, and create the internal tables.
  *
@@ -609,8 +791,25 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     SCFree(ctx->init_hash);
     ctx->init_hash = NULL;
 
-    /* Serialise whole database compilation as a relatively easy way to ensure
-     * dedupe is safe. */
+    /* A vectored database matches offset and depth against the start of
+     * the first buffer, while the other matchers apply them to each buffer.
+     * Keep block mode for those patterns and let the stitching fallback
+     * handle the vector. */
+    pd->mode = HS_MODE_BLOCK;
+    if (mpm_ctx->flags & MPMCTX_FLAGS_VECTORED) {
+        pd->mode = HS_MODE_VECTORED;
+        for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
+            if (pd->parray[i]->flags &
+                    (MPM_PATTERN_FLAG_OFFSET | MPM_PATTERN_FLAG_DEPTH)) {
+                pd->mode = HS_MODE_BLOCK;
+                break;
+            }
+        }
+    }
+    cd->mode = pd->mode;
+
+    /* Only the database table is serialised, the compile itself runs
+     * unlocked so that several contexts can be prepared in parallel. */
     SCMutexLock(&g_db_table_mutex);
 
     /* Init global pattern database hash if necessary. */
@@ -626,21 +825,16 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
 
     /* Check global hash table to see if we've seen this pattern database
      * before, and reuse the Hyperscan database if so. */
-    PatternDatabase *pd_cached = HashTableLookup(g_db_table, pd, 1);
-
-    if (pd_cached != NULL) {
-        SCLogDebug("Reusing cached database %p with %" PRIu32
-                   " patterns (ref_cnt=%" PRIu32 ")",
-                   pd_cached->hs_db, pd_cached->pattern_cnt,
-                   pd_cached->ref_cnt);
-        pd_cached->ref_cnt++;
-        ctx->pattern_db = pd_cached;
+    if (SCHSReuseCachedDatabase(ctx, pd) == 1) {
         SCMutexUnlock(&g_db_table_mutex);
         PatternDatabaseFree(pd);
         SCHSFreeCompileData(cd);
         return 0;
     }
 
+    const char *cache_dir = SCHSCacheDir();
+    SCMutexUnlock(&g_db_table_mutex);
+
     BUG_ON(ctx->pattern_db != NULL); /* already built? */
 
     for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
@@ -674,21 +868,28 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
 
     BUG_ON(mpm_ctx->pattern_cnt == 0);
 
-    err = hs_compile_ext_multi((const char *const *)cd->expressions, cd->flags,
-                               cd->ids, (const hs_expr_ext_t *const *)cd->ext,
-                               cd->pattern_cnt, HS_MODE_BLOCK, NULL, &pd->hs_db,
-                               &compile_err);
+    char cache_path[PATH_MAX];
+    int use_cache = (SCHSCachePath(cache_dir, cd, cache_path,
+                                   sizeof(cache_path)) == 0);
 
-    if (err != HS_SUCCESS) {
-        SCLogError(SC_ERR_FATAL, "failed to compile hyperscan database");
-        if (compile_err) {
-            SCLogError(SC_ERR_FATAL, "compile error: %s", compile_err->message);
+    if (!use_cache || SCHSCacheLoad(cache_path, &pd->hs_db) != 0) {
+        err = hs_compile_ext_multi((const char *const *)cd->expressions, cd->flags,
+                                   cd->ids, (const hs_expr_ext_t *const *)cd->ext,
+                                   cd->pattern_cnt, cd->mode, NULL, &pd->hs_db,
+                                   &compile_err);
+
+        if (err != HS_SUCCESS) {
+            SCLogError(SC_ERR_FATAL, "failed to compile hyperscan database");
+            if (compile_err) {
+                SCLogError(SC_ERR_FATAL, "compile error: %s", compile_err->message);
+            }
+            hs_free_compile_error(compile_err);
+            goto error;
         }
-        hs_free_compile_error(compile_err);
-        goto error;
-    }
 
-    ctx->pattern_db = pd;
+        if (use_cache)
+            SCHSCacheStore(cache_path, pd->hs_db);
+    }
 
     SCMutexLock(&g_scratch_proto_mutex);
     err = hs_alloc_scratch(pd->hs_db, &g_scratch_proto);
@@ -698,28 +899,40 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         goto error;
     }
 
-    err = hs_database_size(pd->hs_db, &ctx->hs_db_size);
+    size_t db_size = 0;
+    err = hs_database_size(pd->hs_db, &db_size);
     if (err != HS_SUCCESS) {
         SCLogError(SC_ERR_FATAL, "failed to query database size");
         goto error;
     }
 
-    mpm_ctx->memory_cnt++;
-    mpm_ctx->memory_size += ctx->hs_db_size;
-
-    SCLogDebug("Built %" PRIu32 " patterns into a database of size %" PRIuMAX
-               " bytes", mpm_ctx->pattern_cnt, (uintmax_t)ctx->hs_db_size);
+    SCMutexLock(&g_db_table_mutex);
+    /* another thread may have built the same database while we were
+     * compiling, in which case we use theirs and drop our copy */
+    if (SCHSReuseCachedDatabase(ctx, pd) == 1) {
+        SCMutexUnlock(&g_db_table_mutex);
+        PatternDatabaseFree(pd);
+        SCHSFreeCompileData(cd);
+        return 0;
+    }
 
     /* Cache this database globally for later. */
     pd->ref_cnt = 1;
     HashTableAdd(g_db_table, pd, 1);
     SCMutexUnlock(&g_db_table_mutex);
 
+    ctx->pattern_db = pd;
+    ctx->hs_db_size = db_size;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += ctx->hs_db_size;
+
+    SCLogDebug("Built %" PRIu32 " patterns into a database of size %" PRIuMAX
+               " bytes", mpm_ctx->pattern_cnt, (uintmax_t)ctx->hs_db_size);
+
     SCHSFreeCompileData(cd);
     return 0;
 
 error:
-    SCMutexUnlock(&g_db_table_mutex);
     if (pd) {
         PatternDatabaseFree(pd);
     }
@@ -930,8 +1143,16 @@ uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     BUG_ON(pd->hs_db == NULL);
     BUG_ON(scratch == NULL);
 
-    hs_error_t err = hs_scan(pd->hs_db, (const char *)buf, buflen, 0, scratch,
+    hs_error_t err;
+    if (pd->mode == HS_MODE_VECTORED) {
+        const char *data = (const char *)buf;
+        unsigned int len = buflen;
+        err = hs_scan_vector(pd->hs_db, &data, &len, 1, 0, scratch,
                              SCHSMatchEvent, &cctx);
+    } else {
+        err = hs_scan(pd->hs_db, (const char *)buf, buflen, 0, scratch,
+                      SCHSMatchEvent, &cctx);
+    }
     if (err != HS_SUCCESS) {
         /* An error value (other than HS_SCAN_TERMINATED) from hs_scan()
          * indicates that it was passed an invalid database or scratch region,
@@ -945,6 +1166,48 @@ uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     return ret;
 }
 
+/**
+ * \brief The Hyperscan vectored search function.
+ *
+ * Databases of contexts flagged MPMCTX_FLAGS_VECTORED are compiled in
+ * vectored mode and scan the buffers in place. Others are searched per
+ * buffer by MpmSearchVectorStitch().
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCHSSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PatternMatcherQueue *pmq, const uint8_t **bufs,
+                          const uint16_t *lens, uint32_t cnt)
+{
+    SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
+    SCHSThreadCtx *hs_thread_ctx = (SCHSThreadCtx *)(mpm_thread_ctx->ctx);
+    const PatternDatabase *pd = ctx->pattern_db;
+    const char *data[MPM_VECTOR_MAX];
+    unsigned int len[MPM_VECTOR_MAX];
+
+    if (pd->mode != HS_MODE_VECTORED || cnt > MPM_VECTOR_MAX) {
+        return MpmSearchVectorStitch(mpm_ctx, mpm_thread_ctx, pmq,
+                                     bufs, lens, cnt);
+    }
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        data[i] = (const char *)bufs[i];
+        len[i] = lens[i];
+    }
+
+    SCHSCallbackCtx cctx = {.ctx = ctx, .pmq = pmq, .match_count = 0};
+    hs_scratch_t *scratch = hs_thread_ctx->scratch;
+    BUG_ON(scratch == NULL);
+
+    hs_error_t err = hs_scan_vector(pd->hs_db, data, len, cnt, 0, scratch,
+                                    SCHSMatchEvent, &cctx);
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "Hyperscan returned error %d", err);
+        exit(EXIT_FAILURE);
+    }
+    return cctx.match_count;
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -1045,6 +1308,7 @@ void MpmHSRegister(void)
     mpm_table[MPM_HS].AddPatternNocase = SCHSAddPatternCI;
     mpm_table[MPM_HS].Prepare = SCHSPreparePatterns;
     mpm_table[MPM_HS].Search = SCHSSearch;
+    mpm_table[MPM_HS].SearchVector = SCHSSearchVector;
     mpm_table[MPM_HS].Cleanup = NULL;
     mpm_table[MPM_HS].PrintCtx = SCHSPrintInfo;
     mpm_table[MPM_HS].PrintThreadCtx = SCHSPrintSearchStats;
@@ -2130,6 +2394,115 @@ end:
     return result;
 }
 
+static int SCHSCacheTestCountFiles(const char *dir, int unlink_files)
+{
+    int cnt = 0;
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return -1;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        cnt++;
+        if (unlink_files) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+    return cnt;
+}
+
+static uint32_t SCHSCacheTestSearch(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_HS);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"XYZ", 3, 0, 0, 1, 0, 0);
+    PmqSetup(&pmq);
+
+    SCHSPreparePatterns(&mpm_ctx);
+    SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCHSSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf,
+                              strlen(buf));
+
+    SCHSDestroyCtx(&mpm_ctx);
+    SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return cnt;
+}
+
+/** \test database compiled once, then loaded from the on disk cache */
+static int SCHSTest30(void)
+{
+    char dir[] = "/tmp/suricata-hs-cache-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+
+    int old_init = g_cache_dir_init;
+    const char *old_dir = g_cache_dir;
+    g_cache_dir_init = 1;
+    g_cache_dir = dir;
+
+    FAIL_IF(SCHSCacheTestSearch() != 2);
+    FAIL_IF(SCHSCacheTestCountFiles(dir, 0) != 1);
+
+    /* the database is gone from g_db_table, so this one comes from disk */
+    FAIL_IF(SCHSCacheTestSearch() != 2);
+    FAIL_IF(SCHSCacheTestCountFiles(dir, 1) != 1);
+
+    g_cache_dir_init = old_init;
+    g_cache_dir = old_dir;
+    rmdir(dir);
+    PASS;
+}
+
+/** \test vectored database finds patterns across buffer boundaries */
+static int SCHSTest31(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_HS);
+    mpm_ctx.flags |= MPMCTX_FLAGS_VECTORED;
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcdef", 6, 0, 0, 0, 0, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx) != 0);
+    SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    FAIL_IF(((PatternDatabase *)((SCHSCtx *)mpm_ctx.ctx)->pattern_db)->mode !=
+            HS_MODE_VECTORED);
+
+    const uint8_t *bufs[3] = { (uint8_t *)"xxab", (uint8_t *)"cd",
+                               (uint8_t *)"efyy" };
+    uint16_t lens[3] = { 4, 2, 4 };
+    FAIL_IF(MpmSearchVector(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                            bufs, lens, 3) != 1);
+
+    /* single buffer search on a vectored database */
+    const char *buf = "xxabcdefyy";
+    FAIL_IF(SCHSSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf,
+                       strlen(buf)) != 1);
+
+    SCHSDestroyCtx(&mpm_ctx);
+    SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCHSRegisterTests(void)
@@ -2164,6 +2537,8 @@ void SCHSRegisterTests(void)
     UtRegisterTest("SCHSTest27", SCHSTest27);
     UtRegisterTest("SCHSTest28", SCHSTest28);
     UtRegisterTest("SCHSTest29", SCHSTest29);
+    UtRegisterTest("SCHSTest30", SCHSTest30);
+    UtRegisterTest("SCHSTest31", SCHSTest31);
 #endif
 
     return;
@@ -46,6 +46,7 @@
 #include "detect-engine-mpm.h"
 #endif
 #include "util-memcpy.h"
+#include "util-memuse.h"
 
 /**
  * \brief Register a new Mpm Context.
@@ -508,8 +509,39 @@ void MpmInitCtx (MpmCtx *mpm_ctx, uint16_t matcher)
     mpm_table[matcher].InitCtx(mpm_ctx);
 }
 
+/* the Prepare and DestroyCtx of the matchers, called from wrappers that
+ * account the memory of the prepared contexts */
+static int (*mpm_prepare[MPM_TABLE_SIZE])(struct MpmCtx_ *);
+static void (*mpm_destroy[MPM_TABLE_SIZE])(struct MpmCtx_ *);
+
+static int MpmPrepareMemuse(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->flags & MPMCTX_FLAGS_MEMUSE) {
+        MemuseFree(MEMUSE_MPM, mpm_ctx->memory_size);
+        mpm_ctx->flags &= ~MPMCTX_FLAGS_MEMUSE;
+    }
+
+    int r = mpm_prepare[mpm_ctx->mpm_type](mpm_ctx);
+
+    MemuseAlloc(MEMUSE_MPM, mpm_ctx->memory_size);
+    mpm_ctx->flags |= MPMCTX_FLAGS_MEMUSE;
+    return r;
+}
+
+static void MpmDestroyCtxMemuse(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->flags & MPMCTX_FLAGS_MEMUSE) {
+        MemuseFree(MEMUSE_MPM, mpm_ctx->memory_size);
+        mpm_ctx->flags &= ~MPMCTX_FLAGS_MEMUSE;
+    }
+
+    mpm_destroy[mpm_ctx->mpm_type](mpm_ctx);
+}
+
 void MpmTableSetup(void)
 {
+    int i;
+
     memset(mpm_table, 0, sizeof(mpm_table));
 
     MpmACRegister();
@@ -521,6 +553,17 @@ void MpmTableSetup(void)
 #ifdef __SC_CUDA_SUPPORT__
     MpmACCudaRegister();
 #endif /* __SC_CUDA_SUPPORT__ */
+
+    for (i = 0; i < MPM_TABLE_SIZE; i++) {
+        if (mpm_table[i].Prepare != NULL) {
+            mpm_prepare[i] = mpm_table[i].Prepare;
+            mpm_table[i].Prepare = MpmPrepareMemuse;
+        }
+        if (mpm_table[i].DestroyCtx != NULL) {
+            mpm_destroy[i] = mpm_table[i].DestroyCtx;
+            mpm_table[i].DestroyCtx = MpmDestroyCtxMemuse;
+        }
+    }
 }
 
 int MpmAddPatternCS(struct MpmCtx_ *mpm_ctx, uint8_t *pat, uint16_t patlen,
@@ -541,6 +584,164 @@ int MpmAddPatternCI(struct MpmCtx_ *mpm_ctx, uint8_t *pat, uint16_t patlen,
                                                          pid, sid, flags);
 }
 
+void MpmBatchInit(MpmBatch *batch, const MpmCtx *mpm_ctx,
+                  MpmBatchItem *items, uint32_t cnt)
+{
+    uint32_t i;
+
+    memset(batch, 0, sizeof(*batch));
+    batch->mpm_ctx = mpm_ctx;
+    batch->items = items;
+    batch->cnt = cnt;
+    for (i = 0; i < cnt; i++) {
+        items[i].complete = 0;
+        items[i].matches = 0;
+    }
+}
+
+/**
+ * \brief search a batch of buffers, asynchronously if the matcher has an
+ *        offload engine
+ *
+ * Matchers without BatchSubmit, or whose engine refuses the batch, search
+ * all items right away, so the batch is always complete or in flight
+ * afterwards. Poll with MpmBatchPoll() until it returns 1 before reusing
+ * the buffers or the pmqs.
+ *
+ * \retval 1 batch complete, 0 in flight
+ */
+int MpmBatchSubmit(MpmThreadCtx *mpm_thread_ctx, MpmBatch *batch)
+{
+    const MpmCtx *mpm_ctx = batch->mpm_ctx;
+    const MpmTableElmt *m = &mpm_table[mpm_ctx->mpm_type];
+    uint32_t i;
+
+    if (m->BatchSubmit != NULL && m->BatchSubmit(mpm_thread_ctx, batch) == 0)
+        return MpmBatchPoll(mpm_thread_ctx, batch);
+
+    for (i = 0; i < batch->cnt; i++) {
+        MpmBatchItem *item = &batch->items[i];
+        if (item->complete)
+            continue;
+        if (item->buflen >= mpm_ctx->minlen && item->buflen > 0) {
+            item->matches = m->Search(mpm_ctx, mpm_thread_ctx, item->pmq,
+                                      item->buf, item->buflen);
+        }
+        item->complete = 1;
+    }
+    batch->done = batch->cnt;
+    return 1;
+}
+
+/** \retval 1 all items of the batch are complete, 0 if not */
+int MpmBatchPoll(MpmThreadCtx *mpm_thread_ctx, MpmBatch *batch)
+{
+    const MpmTableElmt *m = &mpm_table[batch->mpm_ctx->mpm_type];
+
+    if (batch->done == batch->cnt)
+        return 1;
+    if (m->BatchPoll == NULL)
+        return 0;
+    return m->BatchPoll(mpm_thread_ctx, batch);
+}
+
+/** \internal
+ *  \brief copy the last 'len' bytes of bufs[0..cnt-1] to 'out' */
+static void MpmVectorCopyTail(const uint8_t **bufs, const uint16_t *lens,
+                              uint32_t cnt, uint8_t *out, uint32_t len)
+{
+    uint32_t i = cnt;
+    while (len > 0 && i > 0) {
+        i--;
+        uint32_t n = MIN(len, lens[i]);
+        memcpy(out + len - n, bufs[i] + lens[i] - n, n);
+        len -= n;
+    }
+}
+
+/**
+ * \brief search buffers that are consecutive parts of the same data, e.g.
+ *        the reassembled stream chunks of a flow, also finding the patterns
+ *        that span the buffer boundaries.
+ *
+ * Matchers without a SearchVector callback use MpmSearchVectorStitch().
+ *
+ * \param bufs buffers in order, at most MPM_VECTOR_MAX
+ * \param lens length of each buffer
+ * \param cnt number of buffers
+ *
+ * \retval matches match count, may include duplicates of the same pattern
+ */
+uint32_t MpmSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                         PatternMatcherQueue *pmq, const uint8_t **bufs,
+                         const uint16_t *lens, uint32_t cnt)
+{
+    const MpmTableElmt *m = &mpm_table[mpm_ctx->mpm_type];
+
+    if (m->SearchVector == NULL)
+        return MpmSearchVectorStitch(mpm_ctx, mpm_thread_ctx, pmq,
+                                     bufs, lens, cnt);
+
+    uint32_t total = 0;
+    uint32_t i;
+    for (i = 0; i < cnt; i++)
+        total += lens[i];
+    if (total < mpm_ctx->minlen)
+        return 0;
+    return m->SearchVector(mpm_ctx, mpm_thread_ctx, pmq, bufs, lens, cnt);
+}
+
+/**
+ * \brief vectored search through the single buffer Search callback: every
+ *        buffer is searched and then the bytes around each boundary,
+ *        copied into a small stitch buffer.
+ */
+uint32_t MpmSearchVectorStitch(const MpmCtx *mpm_ctx,
+                               MpmThreadCtx *mpm_thread_ctx,
+                               PatternMatcherQueue *pmq, const uint8_t **bufs,
+                               const uint16_t *lens, uint32_t cnt)
+{
+    const MpmTableElmt *m = &mpm_table[mpm_ctx->mpm_type];
+    uint8_t stitch[MPM_VECTOR_STITCH_MAX * 2];
+    uint32_t ret = 0;
+    uint32_t total = 0;
+    uint32_t i;
+
+    /* bytes a pattern can have on either side of a boundary */
+    uint32_t side = mpm_ctx->maxlen > 1 ? mpm_ctx->maxlen - 1 : 0;
+    if (side > MPM_VECTOR_STITCH_MAX)
+        side = MPM_VECTOR_STITCH_MAX;
+
+    for (i = 0; i < cnt; i++) {
+        if (lens[i] >= mpm_ctx->minlen && lens[i] > 0)
+            ret += m->Search(mpm_ctx, mpm_thread_ctx, pmq, bufs[i], lens[i]);
+
+        total += lens[i];
+        if (i == cnt - 1 || side == 0)
+            continue;
+
+        /* boundary between buffer i and i + 1 */
+        uint32_t before = MIN(side, total);
+        uint32_t after = 0, j;
+        for (j = i + 1; j < cnt && after < side; j++)
+            after += lens[j];
+        after = MIN(side, after);
+        if (before + after < mpm_ctx->minlen || after == 0)
+            continue;
+
+        MpmVectorCopyTail(bufs, lens, i + 1, stitch, before);
+        uint32_t n = 0;
+        for (j = i + 1; j < cnt && n < after; j++) {
+            uint32_t c = MIN(after - n, lens[j]);
+            memcpy(stitch + before + n, bufs[j], c);
+            n += c;
+        }
+        ret += m->Search(mpm_ctx, mpm_thread_ctx, pmq, stitch,
+                         (uint16_t)(before + after));
+    }
+    return ret;
+}
+
 
 /**
  * \internal
@@ -827,6 +1028,165 @@ error:
 /************************************Unittests*********************************/
 
 #ifdef UNITTESTS
+
+static uint32_t MpmVectorTestSearch(const char *pat, const char **strs,
+                                    uint32_t cnt)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    const uint8_t *bufs[MPM_VECTOR_MAX];
+    uint16_t lens[MPM_VECTOR_MAX];
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    mpm_table[MPM_AC].InitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(&pmq);
+    mpm_table[MPM_AC].Prepare(&mpm_ctx);
+
+    for (i = 0; i < cnt; i++) {
+        bufs[i] = (const uint8_t *)strs[i];
+        lens[i] = strlen(strs[i]);
+    }
+    uint32_t r = MpmSearchVector(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 bufs, lens, cnt);
+
+    mpm_table[MPM_AC].DestroyCtx(&mpm_ctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return r;
+}
+
+/** \test patterns across buffer boundaries of a vectored search */
+static int MpmSearchVectorTest01(void)
+{
+    const char *split[] = { "xxab", "cd", "efyy" };
+    FAIL_IF(MpmVectorTestSearch("abcdef", split, 3) == 0);
+
+    const char *whole[] = { "abcdef", "zz" };
+    FAIL_IF(MpmVectorTestSearch("abcdef", whole, 2) != 1);
+
+    const char *none[] = { "abc", "xdef" };
+    FAIL_IF(MpmVectorTestSearch("abcdef", none, 2) != 0);
+
+    const char *tiny[] = { "a", "b", "c", "d", "e", "f" };
+    FAIL_IF(MpmVectorTestSearch("abcdef", tiny, 6) == 0);
+    PASS;
+}
+
+/** \test batches complete synchronously without an offload engine */
+static int MpmBatchTest01(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq[3];
+    MpmBatchItem items[3];
+    MpmBatch batch;
+    int i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    memset(items, 0, sizeof(items));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    mpm_table[MPM_AC].InitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    mpm_table[MPM_AC].Prepare(&mpm_ctx);
+
+    const char *bufs[3] = { "xxabcdxx", "abc", "abcdabcd" };
+    for (i = 0; i < 3; i++) {
+        PmqSetup(&pmq[i]);
+        items[i].buf = (const uint8_t *)bufs[i];
+        items[i].buflen = strlen(bufs[i]);
+        items[i].pmq = &pmq[i];
+    }
+
+    MpmBatchInit(&batch, &mpm_ctx, items, 3);
+    FAIL_IF(MpmBatchSubmit(&mpm_thread_ctx, &batch) != 1);
+    FAIL_IF(MpmBatchPoll(&mpm_thread_ctx, &batch) != 1);
+    FAIL_IF(batch.done != 3);
+    for (i = 0; i < 3; i++)
+        FAIL_IF_NOT(items[i].complete);
+    FAIL_IF(items[0].matches != 1);
+    /* too short for the ctx */
+    FAIL_IF(items[1].matches != 0);
+    FAIL_IF(pmq[1].rule_id_array_cnt != 0);
+    FAIL_IF(items[2].matches == 0);
+
+    mpm_table[MPM_AC].DestroyCtx(&mpm_ctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    for (i = 0; i < 3; i++)
+        PmqFree(&pmq[i]);
+    PASS;
+}
+
+#define MPM_BENCH_PATTERNS  1000
+#define MPM_BENCH_BUFLEN    1500
+
+/** \internal
+ *  \brief search packet sized buffers of text against a set of
+ *         case insensitive patterns of 4 to 12 bytes */
+static int MpmBench(UtBench *b, uint16_t matcher)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint8_t pat[12];
+    uint8_t buf[MPM_BENCH_BUFLEN];
+    uint32_t rnd = 1;
+    uint32_t i, j;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, matcher);
+    mpm_table[matcher].InitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqSetup(&pmq);
+
+    /* same patterns and text on every run */
+    for (i = 0; i < MPM_BENCH_PATTERNS; i++) {
+        rnd = rnd * 1103515245 + 12345;
+        uint16_t len = 4 + (rnd >> 16) % 9;
+        for (j = 0; j < len; j++) {
+            rnd = rnd * 1103515245 + 12345;
+            pat[j] = 'a' + (rnd >> 16) % 26;
+        }
+        MpmAddPatternCI(&mpm_ctx, pat, len, 0, 0, i, i, 0);
+    }
+    for (i = 0; i < sizeof(buf); i++) {
+        rnd = rnd * 1103515245 + 12345;
+        buf[i] = (rnd >> 16) % 8 ? 'a' + (rnd >> 16) % 26 : ' ';
+    }
+    FAIL_IF(mpm_table[matcher].Prepare(&mpm_ctx) != 0);
+
+    UtBenchResetTimer(b);
+    uint64_t n;
+    for (n = 0; n < b->n; n++) {
+        (void)mpm_table[matcher].Search(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                buf, sizeof(buf));
+        PmqReset(&pmq);
+    }
+    b->bytes = sizeof(buf);
+
+    mpm_table[matcher].DestroyCtx(&mpm_ctx);
+    mpm_table[matcher].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+static int MpmBenchAc(UtBench *b)
+{
+    return MpmBench(b, MPM_AC);
+}
+
+#ifdef BUILD_HYPERSCAN
+static int MpmBenchHs(UtBench *b)
+{
+    return MpmBench(b, MPM_HS);
+}
+#endif
+
 #endif /* UNITTESTS */
 
 void MpmRegisterTests(void)
@@ -834,6 +1194,14 @@ void MpmRegisterTests(void)
 #ifdef UNITTESTS
     uint16_t i;
 
+    UtRegisterTest("MpmSearchVectorTest01", MpmSearchVectorTest01);
+    UtRegisterTest("MpmBatchTest01", MpmBatchTest01);
+
+    UtRegisterBenchmark("MpmBench01 -- ac search", MpmBenchAc);
+#ifdef BUILD_HYPERSCAN
+    UtRegisterBenchmark("MpmBench02 -- hs search", MpmBenchHs);
+#endif
+
     for (i = 0; i < MPM_TABLE_SIZE; i++) {
         if (i == MPM_NOTSET)
             continue;
@@ -123,10 +123,50 @@ typedef struct MpmCtx_ {
 
     uint32_t max_pat_id;
 
+    /* MPMCTX_FLAGS_* */
+    uint32_t flags;
+
     /* hash used during ctx initialization */
     MpmPattern **init_hash;
 } MpmCtx;
 
+/** \brief one buffer of a batch search */
+typedef struct MpmBatchItem_ {
+    const uint8_t *buf;
+    uint16_t buflen;
+    /** set by the matcher when the item is done */
+    uint8_t complete;
+    /** match count, valid once complete */
+    uint32_t matches;
+    /** receives the sids of the matches */
+    PatternMatcherQueue *pmq;
+    /** caller data, e.g. the packet the buffer belongs to */
+    void *user;
+} MpmBatchItem;
+
+/** \brief buffers searched against the same ctx, possibly offloaded */
+typedef struct MpmBatch_ {
+    const struct MpmCtx_ *mpm_ctx;
+    MpmBatchItem *items;
+    uint32_t cnt;
+    /** number of complete items */
+    uint32_t done;
+    /** matcher state of a batch in flight */
+    void *engine;
+} MpmBatch;
+
+/* ctx will be searched through MpmSearchVector(), set before Prepare */
+#define MPMCTX_FLAGS_VECTORED   0x01
+/* memory_size of the prepared ctx is accounted to MEMUSE_MPM */
+#define MPMCTX_FLAGS_MEMUSE     0x02
+
+/* max number of buffers in a vectored search */
+#define MPM_VECTOR_MAX          16
+/* max bytes taken from either side of a buffer boundary when a matcher
+ * without native vector support stitches the buffers together. Patterns
+ * longer than this are not found across boundaries. */
+#define MPM_VECTOR_STITCH_MAX   255
+
 /* if we want to retrieve an unique mpm context from the mpm context factory
  * we should supply this as the key */
 #define MPM_CTX_FACTORY_UNIQUE_CONTEXT -1
@@ -179,6 +219,15 @@ typedef struct MpmTableElmt_ {
     int  (*AddPatternNocase)(struct MpmCtx_ *, uint8_t *, uint16_t, uint16_t, uint16_t, uint32_t, SigIntId, uint8_t);
     int  (*Prepare)(struct MpmCtx_ *);
     uint32_t (*Search)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, const uint8_t *, uint16_t);
+    /** search a list of buffers that are consecutive parts of the same
+     *  data, optional. See MpmSearchVector(). */
+    uint32_t (*SearchVector)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, const uint8_t **, const uint16_t *, uint32_t);
+    /** hand a batch to an offload engine, optional. See MpmBatchSubmit().
+     *  \retval 0 batch accepted, -1 engine unavailable */
+    int (*BatchSubmit)(struct MpmThreadCtx_ *, MpmBatch *);
+    /** update the complete items of a submitted batch, required if
+     *  BatchSubmit is set. \retval 1 when all items are done, 0 if not */
+    int (*BatchPoll)(struct MpmThreadCtx_ *, MpmBatch *);
     void (*Cleanup)(struct MpmThreadCtx_ *);
     void (*PrintCtx)(struct MpmCtx_ *);
     void (*PrintThreadCtx)(struct MpmThreadCtx_ *);
@@ -252,6 +301,19 @@ int MpmAddPatternCI(struct MpmCtx_ *mpm_ctx, uint8_t *pat, uint16_t patlen,
 
 void MpmFreePattern(MpmCtx *mpm_ctx, MpmPattern *p);
 
+uint32_t MpmSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                         PatternMatcherQueue *pmq, const uint8_t **bufs,
+                         const uint16_t *lens, uint32_t cnt);
+void MpmBatchInit(MpmBatch *batch, const MpmCtx *mpm_ctx,
+                  MpmBatchItem *items, uint32_t cnt);
+int MpmBatchSubmit(MpmThreadCtx *mpm_thread_ctx, MpmBatch *batch);
+int MpmBatchPoll(MpmThreadCtx *mpm_thread_ctx, MpmBatch *batch);
+
+uint32_t MpmSearchVectorStitch(const MpmCtx *mpm_ctx,
+                               MpmThreadCtx *mpm_thread_ctx,
+                               PatternMatcherQueue *pmq, const uint8_t **bufs,
+                               const uint16_t *lens, uint32_t cnt);
+
 int MpmAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
                             uint16_t offset, uint16_t depth, uint32_t pid,
                             SigIntId sid, uint8_t flags);
@@ -36,6 +36,22 @@
 #endif
 #endif
 
+/** hint the CPU to load the cache line of 'addr', which is about to be
+ *  read from */
+#if CPPCHECK==1
+#define prefetch(addr)
+#else
+#define prefetch(addr) __builtin_prefetch((addr), 0, 3)
+#endif
+
+/** hint the CPU to load the cache line of 'addr', which is about to be
+ *  written to */
+#if CPPCHECK==1
+#define prefetchw(addr)
+#else
+#define prefetchw(addr) __builtin_prefetch((addr), 1, 3)
+#endif
+
 /** from http://en.wikipedia.org/wiki/Memory_ordering
  *
  *  C Compiler memory barrier
@@ -48,5 +64,12 @@
  */
 #define hw_barrier() __sync_synchronize()
 
+/** tell the CPU we're in a spin-wait loop */
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __asm__ __volatile__("pause": : :"memory")
+#else
+#define cpu_relax() cc_barrier()
+#endif
+
 #endif /* __UTIL_OPTIMIZE_H__ */
 
@@ -0,0 +1,215 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Background preallocation, see util-prealloc.h.
+ *
+ * The fill threads are plain threads, not thread modules: they exit when
+ * they are done and are joined by PreallocStop() before the subsystems
+ * are shut down.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "threads.h"
+
+#include "util-prealloc.h"
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-time.h"
+#include "util-unittest.h"
+
+#define PREALLOC_MAX_FILLS  8
+
+typedef struct PreallocFill_ {
+    const char *name;
+    uint32_t (*Fill)(void);
+    pthread_t thread;
+    int started;
+} PreallocFill;
+
+static PreallocFill prealloc_fills[PREALLOC_MAX_FILLS];
+static int prealloc_fills_cnt = 0;
+
+/** -1 not read from the config yet */
+static int prealloc_background = -1;
+
+static SC_ATOMIC_DECLARE(int, prealloc_stop);
+
+/**
+ * \brief check if preallocation is done in the background
+ *
+ * Not in unix socket mode, where the subsystems are set up again for
+ * every pcap, nor in unittests.
+ */
+int PreallocInBackground(void)
+{
+    if (prealloc_background == -1) {
+        char *mode = NULL;
+
+        SC_ATOMIC_INIT(prealloc_stop);
+        prealloc_background = 0;
+        if (ConfGet("prealloc-mode", &mode) == 1 && mode != NULL) {
+            if (strcmp(mode, "background") == 0) {
+                prealloc_background = 1;
+            } else if (strcmp(mode, "full") != 0) {
+                SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid prealloc-mode "
+                        "'%s', using 'full'", mode);
+            }
+        }
+        if (RunmodeIsUnittests() || RunmodeGetCurrent() == RUNMODE_UNIX_SOCKET)
+            prealloc_background = 0;
+    }
+    return prealloc_background;
+}
+
+/**
+ * \brief get the number of objects to preallocate at startup
+ *
+ * \param prealloc the configured prealloc setting of the subsystem
+ */
+uint32_t PreallocStartupCount(uint32_t prealloc)
+{
+    if (!PreallocInBackground())
+        return prealloc;
+    return MIN(prealloc, PREALLOC_STARTUP_CNT);
+}
+
+/**
+ * \brief register a fill function, called from its own thread by
+ *        PreallocStart()
+ *
+ * The function allocates the rest of the spare objects of its subsystem
+ * and returns the number it allocated. It must check PreallocStopped()
+ * in its loop.
+ */
+void PreallocRegisterFill(const char *name, uint32_t (*Fill)(void))
+{
+    if (prealloc_fills_cnt == PREALLOC_MAX_FILLS) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "too many background "
+                "preallocations, %s is not filled", name);
+        return;
+    }
+    prealloc_fills[prealloc_fills_cnt].name = name;
+    prealloc_fills[prealloc_fills_cnt].Fill = Fill;
+    prealloc_fills_cnt++;
+}
+
+/**
+ * \brief check if the fill functions should stop
+ */
+int PreallocStopped(void)
+{
+    return SC_ATOMIC_GET(prealloc_stop);
+}
+
+static void *PreallocFillThread(void *arg)
+{
+    PreallocFill *pf = (PreallocFill *)arg;
+    struct timeval start, end;
+
+    (void) SCSetThreadName("Prealloc");
+
+    gettimeofday(&start, NULL);
+    uint32_t cnt = pf->Fill();
+    gettimeofday(&end, NULL);
+
+    SCLogPerf("background preallocation of %"PRIu32" %s done in %"PRIu64"ms",
+            cnt, pf->name,
+            (uint64_t)((end.tv_sec - start.tv_sec) * 1000 +
+                (end.tv_usec - start.tv_usec) / 1000));
+    return NULL;
+}
+
+/**
+ * \brief start a thread per registered fill function
+ *
+ * Called once the engine is running.
+ */
+void PreallocStart(void)
+{
+    int i;
+
+    for (i = 0; i < prealloc_fills_cnt; i++) {
+        PreallocFill *pf = &prealloc_fills[i];
+        if (pthread_create(&pf->thread, NULL, PreallocFillThread, pf) != 0) {
+            SCLogWarning(SC_ERR_THREAD_CREATE, "failed to start the "
+                    "background preallocation of %s", pf->name);
+            continue;
+        }
+        pf->started = 1;
+    }
+}
+
+/**
+ * \brief stop the fill threads and wait for them
+ *
+ * Called before the subsystems using the spare queues are shut down.
+ */
+void PreallocStop(void)
+{
+    int i;
+
+    if (prealloc_background == 1)
+        SC_ATOMIC_SET(prealloc_stop, 1);
+
+    for (i = 0; i < prealloc_fills_cnt; i++) {
+        PreallocFill *pf = &prealloc_fills[i];
+        if (pf->started) {
+            pthread_join(pf->thread, NULL);
+            pf->started = 0;
+        }
+    }
+    prealloc_fills_cnt = 0;
+}
+
+#ifdef UNITTESTS
+static uint32_t prealloc_test_cnt = 0;
+
+static uint32_t PreallocTestFill(void)
+{
+    while (!PreallocStopped() && prealloc_test_cnt < 100)
+        prealloc_test_cnt++;
+    return prealloc_test_cnt;
+}
+
+/** \test unittests use full preallocation, fill threads are joined */
+static int PreallocTest01(void)
+{
+    FAIL_IF(PreallocInBackground());
+    FAIL_IF(PreallocStartupCount(10000) != 10000);
+
+    prealloc_test_cnt = 0;
+    PreallocRegisterFill("test objects", PreallocTestFill);
+    PreallocStart();
+    PreallocStop();
+    FAIL_IF(prealloc_test_cnt != 100);
+    FAIL_IF(prealloc_fills_cnt != 0);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PreallocRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PreallocTest01", PreallocTest01);
+#endif
+}
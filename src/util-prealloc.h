@@ -0,0 +1,45 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Background preallocation of the spare queues.
+ *
+ * With 'prealloc-mode: background' the subsystems only preallocate
+ * PreallocStartupCount() objects at init and register a fill function.
+ * The fill functions run in parallel, one thread each, once the engine
+ * is running.
+ */
+
+#ifndef __UTIL_PREALLOC_H__
+#define __UTIL_PREALLOC_H__
+
+/** number of objects preallocated at startup in background mode */
+#define PREALLOC_STARTUP_CNT    1024
+
+int PreallocInBackground(void);
+uint32_t PreallocStartupCount(uint32_t prealloc);
+void PreallocRegisterFill(const char *name, uint32_t (*Fill)(void));
+int PreallocStopped(void);
+
+void PreallocStart(void);
+void PreallocStop(void);
+
+void PreallocRegisterTests(void);
+
+#endif /* __UTIL_PREALLOC_H__ */
@@ -0,0 +1,516 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled rule and keyword profiling, see util-profiling-sample.h
+ *
+ * The tables are written by their thread without locking, the dump reads
+ * them as they are. Counts of the packet being inspected at that moment
+ * may be missing from the results, but no lock is taken per packet.
+ */
+
+#include "suricata-common.h"
+#include "detect.h"
+#include "threads.h"
+
+#include "util-profiling.h"
+#include "util-profiling-sample.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#define RULE_SAMPLE_DEFAULT_RATE 100
+#define RULE_SAMPLE_DEFAULT_COUNT 20
+
+typedef struct RuleSampleData_ {
+    uint64_t ticks;
+    uint64_t checks;
+    uint64_t matches;
+} RuleSampleData;
+
+typedef struct RuleSampleSig_ {
+    uint32_t sid;
+    uint32_t gid;
+    uint32_t rev;
+} RuleSampleSig;
+
+/** per detect thread table */
+typedef struct RuleSampleThread_ {
+    /** run the data belongs to, reset on a new 'start' */
+    uint32_t gen;
+    uint64_t packets;
+
+    /** rules by Signature::num, with their ids copied so that the
+     *  dump doesn't need the detect engine */
+    uint32_t nsigs;
+    RuleSampleSig *sigs;
+    RuleSampleData *rules;
+
+    RuleSampleData keywords[DETECT_TBLSIZE];
+
+    struct RuleSampleThread_ *next;
+} RuleSampleThread;
+
+uint32_t rule_sample_rate = 0;
+#ifdef TLS
+__thread int rule_sample_active = 0;
+#endif
+
+/** bumped by every 'start', so threads reset their tables */
+static uint32_t rule_sample_gen = 0;
+
+static RuleSampleThread *rule_sample_list = NULL;
+static SCMutex rule_sample_list_lock = SCMUTEX_INITIALIZER;
+
+/** \internal
+ *  \brief set up the table of det_ctx, in the detect thread */
+static RuleSampleThread *RuleSampleThreadSetup(DetectEngineThreadCtx *det_ctx)
+{
+    const DetectEngineCtx *de_ctx = det_ctx->de_ctx;
+    if (de_ctx == NULL || de_ctx->sig_array_len == 0)
+        return NULL;
+
+    RuleSampleThread *t = SCCalloc(1, sizeof(*t));
+    if (unlikely(t == NULL))
+        return NULL;
+    t->sigs = SCCalloc(de_ctx->sig_array_len, sizeof(RuleSampleSig));
+    t->rules = SCCalloc(de_ctx->sig_array_len, sizeof(RuleSampleData));
+    if (t->sigs == NULL || t->rules == NULL) {
+        if (t->sigs != NULL)
+            SCFree(t->sigs);
+        if (t->rules != NULL)
+            SCFree(t->rules);
+        SCFree(t);
+        return NULL;
+    }
+
+    t->nsigs = de_ctx->sig_array_len;
+    uint32_t i;
+    for (i = 0; i < t->nsigs; i++) {
+        const Signature *s = de_ctx->sig_array[i];
+        if (s == NULL)
+            continue;
+        t->sigs[i].sid = s->id;
+        t->sigs[i].gid = s->gid;
+        t->sigs[i].rev = s->rev;
+    }
+
+    SCMutexLock(&rule_sample_list_lock);
+    t->gen = rule_sample_gen;
+    t->next = rule_sample_list;
+    rule_sample_list = t;
+    SCMutexUnlock(&rule_sample_list_lock);
+    return t;
+}
+
+/**
+ * \brief start timing the rules and keywords of the current packet
+ */
+void RuleSampleStart(DetectEngineThreadCtx *det_ctx)
+{
+    det_ctx->rule_sample_cnt = 0;
+
+    RuleSampleThread *t = det_ctx->rule_sample;
+    if (t == NULL) {
+        t = det_ctx->rule_sample = RuleSampleThreadSetup(det_ctx);
+        if (t == NULL)
+            return;
+    }
+    uint32_t gen = rule_sample_gen;
+    if (t->gen != gen) {
+        t->packets = 0;
+        memset(t->rules, 0, t->nsigs * sizeof(RuleSampleData));
+        memset(t->keywords, 0, sizeof(t->keywords));
+        t->gen = gen;
+    }
+
+    t->packets++;
+    det_ctx->rule_sample_active = 1;
+#ifdef TLS
+    rule_sample_active = 1;
+#endif
+}
+
+void RuleSampleEnd(DetectEngineThreadCtx *det_ctx)
+{
+    det_ctx->rule_sample_active = 0;
+#ifdef TLS
+    rule_sample_active = 0;
+#endif
+}
+
+void RuleSampleRuleUpdate(DetectEngineThreadCtx *det_ctx, const Signature *s,
+        uint64_t ticks, int match)
+{
+    RuleSampleThread *t = det_ctx->rule_sample;
+    if (t == NULL || !det_ctx->rule_sample_active || s->num >= t->nsigs)
+        return;
+
+    RuleSampleData *d = &t->rules[s->num];
+    d->ticks += ticks;
+    d->checks++;
+    if (match)
+        d->matches++;
+}
+
+void RuleSampleKeywordUpdate(DetectEngineThreadCtx *det_ctx, int type,
+        uint64_t ticks, int match)
+{
+    RuleSampleThread *t = det_ctx->rule_sample;
+    if (t == NULL || !det_ctx->rule_sample_active ||
+            type < 0 || type >= DETECT_TBLSIZE)
+        return;
+
+    RuleSampleData *d = &t->keywords[type];
+    d->ticks += ticks;
+    d->checks++;
+    if (match)
+        d->matches++;
+}
+
+/**
+ * \brief drop the table of a detect thread that goes away
+ */
+void RuleSampleThreadCleanup(DetectEngineThreadCtx *det_ctx)
+{
+    RuleSampleThread *t = det_ctx->rule_sample;
+    if (t == NULL)
+        return;
+
+    SCMutexLock(&rule_sample_list_lock);
+    RuleSampleThread **prev = &rule_sample_list;
+    while (*prev != NULL && *prev != t)
+        prev = &(*prev)->next;
+    if (*prev != NULL)
+        *prev = t->next;
+    SCMutexUnlock(&rule_sample_list_lock);
+
+    SCFree(t->sigs);
+    SCFree(t->rules);
+    SCFree(t);
+    det_ctx->rule_sample = NULL;
+}
+
+/** merged result for a rule */
+typedef struct RuleSampleEntry_ {
+    RuleSampleSig sig;
+    RuleSampleData data;
+} RuleSampleEntry;
+
+static int RuleSampleSigCompare(const void *a, const void *b)
+{
+    const RuleSampleEntry *x = a, *y = b;
+    if (x->sig.gid != y->sig.gid)
+        return x->sig.gid < y->sig.gid ? -1 : 1;
+    if (x->sig.sid != y->sig.sid)
+        return x->sig.sid < y->sig.sid ? -1 : 1;
+    return 0;
+}
+
+static int RuleSampleTicksCompare(const void *a, const void *b)
+{
+    const RuleSampleEntry *x = a, *y = b;
+    if (x->data.ticks != y->data.ticks)
+        return x->data.ticks > y->data.ticks ? -1 : 1;
+    return 0;
+}
+
+/** \internal
+ *  \brief merge the tables of the current run. Call with the list lock.
+ *
+ *  Rules are merged on gid:sid, as threads on a reloaded engine number
+ *  them differently. For the keywords 'sig.sid' holds the keyword type.
+ *
+ *  \param rules set to the rules, sorted by ticks, caller frees
+ *  \param keywords set to the keywords, sorted by ticks, caller frees
+ *  \retval packets sampled packets */
+static uint64_t RuleSampleMerge(RuleSampleEntry **rules, uint32_t *nrules,
+        RuleSampleEntry **keywords, uint32_t *nkeywords)
+{
+    const uint32_t gen = rule_sample_gen;
+    uint64_t packets = 0;
+    uint32_t total = 0, n = 0, i;
+    RuleSampleThread *t;
+
+    *rules = *keywords = NULL;
+    *nrules = *nkeywords = 0;
+
+    for (t = rule_sample_list; t != NULL; t = t->next) {
+        if (t->gen == gen)
+            total += t->nsigs;
+    }
+
+    RuleSampleEntry *r = SCCalloc(total ? total : 1, sizeof(RuleSampleEntry));
+    RuleSampleEntry *k = SCCalloc(DETECT_TBLSIZE, sizeof(RuleSampleEntry));
+    if (r == NULL || k == NULL) {
+        if (r != NULL)
+            SCFree(r);
+        if (k != NULL)
+            SCFree(k);
+        return 0;
+    }
+
+    for (i = 0; i < DETECT_TBLSIZE; i++)
+        k[i].sig.sid = i;
+
+    for (t = rule_sample_list; t != NULL; t = t->next) {
+        if (t->gen != gen)
+            continue;
+        packets += t->packets;
+        for (i = 0; i < t->nsigs; i++) {
+            if (t->rules[i].checks == 0)
+                continue;
+            r[n].sig = t->sigs[i];
+            r[n].data = t->rules[i];
+            n++;
+        }
+        for (i = 0; i < DETECT_TBLSIZE; i++) {
+            k[i].data.ticks += t->keywords[i].ticks;
+            k[i].data.checks += t->keywords[i].checks;
+            k[i].data.matches += t->keywords[i].matches;
+        }
+    }
+
+    /* sum up the threads' entries of each rule */
+    qsort(r, n, sizeof(RuleSampleEntry), RuleSampleSigCompare);
+    uint32_t m = 0;
+    for (i = 0; i < n; i++) {
+        if (m > 0 && RuleSampleSigCompare(&r[m - 1], &r[i]) == 0) {
+            r[m - 1].data.ticks += r[i].data.ticks;
+            r[m - 1].data.checks += r[i].data.checks;
+            r[m - 1].data.matches += r[i].data.matches;
+        } else {
+            r[m++] = r[i];
+        }
+    }
+    qsort(r, m, sizeof(RuleSampleEntry), RuleSampleTicksCompare);
+    qsort(k, DETECT_TBLSIZE, sizeof(RuleSampleEntry), RuleSampleTicksCompare);
+
+    uint32_t nk = 0;
+    while (nk < DETECT_TBLSIZE && k[nk].data.checks > 0)
+        nk++;
+
+    *rules = r;
+    *nrules = m;
+    *keywords = k;
+    *nkeywords = nk;
+    return packets;
+}
+
+#ifdef BUILD_UNIX_SOCKET
+static json_t *RuleSampleEntryJson(const RuleSampleEntry *e, int keyword)
+{
+    json_t *js = json_object();
+    if (js == NULL)
+        return NULL;
+
+    if (keyword) {
+        const char *name = sigmatch_table[e->sig.sid].name;
+        json_object_set_new(js, "keyword", json_string(name ? name : "unknown"));
+    } else {
+        json_object_set_new(js, "signature_id", json_integer(e->sig.sid));
+        json_object_set_new(js, "gid", json_integer(e->sig.gid));
+        json_object_set_new(js, "rev", json_integer(e->sig.rev));
+    }
+    json_object_set_new(js, "checks", json_integer(e->data.checks));
+    json_object_set_new(js, "matches", json_integer(e->data.matches));
+    json_object_set_new(js, "ticks_total", json_integer(e->data.ticks));
+    json_object_set_new(js, "ticks_avg",
+            json_integer(e->data.ticks / e->data.checks));
+    return js;
+}
+
+static TmEcode RuleSampleDump(json_t *cmd, json_t *answer)
+{
+    uint32_t count = RULE_SAMPLE_DEFAULT_COUNT;
+    json_t *jarg = json_object_get(cmd, "count");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) < 1) {
+            json_object_set_new(answer, "message",
+                    json_string("count is not a positive integer"));
+            return TM_ECODE_FAILED;
+        }
+        count = (uint32_t)MIN(json_integer_value(jarg), UINT32_MAX);
+    }
+
+    RuleSampleEntry *rules, *keywords;
+    uint32_t nrules, nkeywords, i;
+
+    SCMutexLock(&rule_sample_list_lock);
+    uint64_t packets = RuleSampleMerge(&rules, &nrules, &keywords, &nkeywords);
+    SCMutexUnlock(&rule_sample_list_lock);
+    if (rules == NULL) {
+        json_object_set_new(answer, "message", json_string("out of memory"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *js = json_object();
+    json_t *jrules = json_array();
+    json_t *jkeywords = json_array();
+    if (js == NULL || jrules == NULL || jkeywords == NULL) {
+        if (js != NULL)
+            json_decref(js);
+        if (jrules != NULL)
+            json_decref(jrules);
+        if (jkeywords != NULL)
+            json_decref(jkeywords);
+        SCFree(rules);
+        SCFree(keywords);
+        json_object_set_new(answer, "message", json_string("out of memory"));
+        return TM_ECODE_FAILED;
+    }
+
+    for (i = 0; i < nrules && i < count; i++)
+        json_array_append_new(jrules, RuleSampleEntryJson(&rules[i], 0));
+    for (i = 0; i < nkeywords && i < count; i++)
+        json_array_append_new(jkeywords, RuleSampleEntryJson(&keywords[i], 1));
+
+    json_object_set_new(js, "running", json_boolean(rule_sample_rate != 0));
+    json_object_set_new(js, "sample_rate", json_integer(rule_sample_rate));
+    json_object_set_new(js, "packets", json_integer(packets));
+    json_object_set_new(js, "rules", jrules);
+    json_object_set_new(js, "keywords", jkeywords);
+    json_object_set_new(answer, "message", js);
+
+    SCFree(rules);
+    SCFree(keywords);
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief 'rule-profiling' unix socket command
+ *
+ * Arguments: "action" start, stop or dump. start takes an optional
+ * "rate" (1 in rate packets), dump an optional "count" of rules and
+ * keywords to return.
+ */
+TmEcode RuleSampleCommand(json_t *cmd, json_t *answer, void *data)
+{
+    json_t *jarg = json_object_get(cmd, "action");
+    if (!json_is_string(jarg)) {
+        json_object_set_new(answer, "message", json_string("action is not a string"));
+        return TM_ECODE_FAILED;
+    }
+    const char *action = json_string_value(jarg);
+
+#ifdef PROFILING
+    json_object_set_new(answer, "message", json_string("profiling build: "
+                "use the rule and keyword profiling output instead"));
+    return TM_ECODE_FAILED;
+#endif
+
+    if (strcmp(action, "start") == 0) {
+        uint32_t rate = RULE_SAMPLE_DEFAULT_RATE;
+        jarg = json_object_get(cmd, "rate");
+        if (jarg != NULL) {
+            if (!json_is_integer(jarg) || json_integer_value(jarg) < 1 ||
+                    json_integer_value(jarg) > UINT32_MAX) {
+                json_object_set_new(answer, "message",
+                        json_string("rate is not a positive integer"));
+                return TM_ECODE_FAILED;
+            }
+            rate = (uint32_t)json_integer_value(jarg);
+        }
+
+        SCMutexLock(&rule_sample_list_lock);
+        rule_sample_gen++;
+        SCMutexUnlock(&rule_sample_list_lock);
+        rule_sample_rate = rate;
+
+        SCLogInfo("rule profiling started, sampling 1 in %u packets", rate);
+        json_object_set_new(answer, "message", json_string("rule profiling started"));
+        return TM_ECODE_OK;
+    } else if (strcmp(action, "stop") == 0) {
+        rule_sample_rate = 0;
+
+        SCLogInfo("rule profiling stopped");
+        json_object_set_new(answer, "message", json_string("rule profiling stopped"));
+        return TM_ECODE_OK;
+    } else if (strcmp(action, "dump") == 0) {
+        return RuleSampleDump(cmd, answer);
+    }
+
+    json_object_set_new(answer, "message",
+            json_string("action is not one of start, stop or dump"));
+    return TM_ECODE_FAILED;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#ifdef UNITTESTS
+static int RuleSampleTest01(void)
+{
+    RuleSampleThread a, b;
+    RuleSampleSig sigs_a[2] = { { 1, 1, 1 }, { 2, 1, 1 } };
+    RuleSampleSig sigs_b[1] = { { 2, 1, 1 } };
+    RuleSampleData rules_a[2] = { { 10, 1, 0 }, { 20, 2, 1 } };
+    RuleSampleData rules_b[1] = { { 5, 1, 0 } };
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.nsigs = 2;
+    a.sigs = sigs_a;
+    a.rules = rules_a;
+    a.packets = 3;
+    a.keywords[DETECT_CONTENT].ticks = 7;
+    a.keywords[DETECT_CONTENT].checks = 1;
+    b.nsigs = 1;
+    b.sigs = sigs_b;
+    b.rules = rules_b;
+    b.packets = 4;
+    /* made by a previous run: ignored */
+    b.gen = rule_sample_gen - 1;
+
+    RuleSampleThread *list = rule_sample_list;
+    rule_sample_list = &a;
+    a.gen = rule_sample_gen;
+    a.next = &b;
+
+    RuleSampleEntry *rules, *keywords;
+    uint32_t nrules, nkeywords;
+    uint64_t packets = RuleSampleMerge(&rules, &nrules, &keywords, &nkeywords);
+    FAIL_IF(packets != 3);
+    FAIL_IF(nrules != 2);
+    FAIL_IF(rules[0].sig.sid != 2 || rules[0].data.ticks != 20);
+    FAIL_IF(nkeywords != 1);
+    FAIL_IF(keywords[0].sig.sid != DETECT_CONTENT);
+    SCFree(rules);
+    SCFree(keywords);
+
+    /* same run: sid 2 of both threads is merged */
+    b.gen = a.gen;
+    packets = RuleSampleMerge(&rules, &nrules, &keywords, &nkeywords);
+    FAIL_IF(packets != 7);
+    FAIL_IF(nrules != 2);
+    FAIL_IF(rules[0].sig.sid != 2 || rules[0].data.ticks != 25 ||
+            rules[0].data.checks != 3 || rules[0].data.matches != 1);
+    FAIL_IF(rules[1].sig.sid != 1);
+    SCFree(rules);
+    SCFree(keywords);
+
+    rule_sample_list = list;
+    PASS;
+}
+#endif
+
+void RuleSampleRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("RuleSampleTest01", RuleSampleTest01);
+#endif
+}
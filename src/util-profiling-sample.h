@@ -0,0 +1,77 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled rule and keyword profiling for builds without --enable-profiling.
+ *
+ * Started and stopped at runtime with the 'rule-profiling' unix socket
+ * command. While running, each detect thread times the rules and
+ * keywords of 1 in 'rate' packets into a table of its own. The tables
+ * are only merged when the results are asked for.
+ */
+
+#ifndef __UTIL_PROFILING_SAMPLE_H__
+#define __UTIL_PROFILING_SAMPLE_H__
+
+#include "util-cpu.h"
+
+struct DetectEngineThreadCtx_;
+struct Signature_;
+
+/** sample 1 in rule_sample_rate packets, 0 if not sampling */
+extern uint32_t rule_sample_rate;
+
+#ifdef TLS
+/** set while the packet the thread inspects is sampled */
+extern __thread int rule_sample_active;
+#define RULE_SAMPLE_ACTIVE rule_sample_active
+#else
+/* keywords can't tell they are being sampled, only time the rules */
+#define RULE_SAMPLE_ACTIVE 0
+#endif
+
+void RuleSampleStart(struct DetectEngineThreadCtx_ *det_ctx);
+void RuleSampleEnd(struct DetectEngineThreadCtx_ *det_ctx);
+void RuleSampleRuleUpdate(struct DetectEngineThreadCtx_ *det_ctx,
+        const struct Signature_ *s, uint64_t ticks, int match);
+void RuleSampleKeywordUpdate(struct DetectEngineThreadCtx_ *det_ctx,
+        int type, uint64_t ticks, int match);
+void RuleSampleThreadCleanup(struct DetectEngineThreadCtx_ *det_ctx);
+
+/** \brief sample the packet about to be inspected if it's its turn */
+#define RULE_SAMPLE_PACKET_START(det_ctx) do {                          \
+        if (unlikely(rule_sample_rate != 0) &&                          \
+                ++(det_ctx)->rule_sample_cnt >= rule_sample_rate) {     \
+            RuleSampleStart((det_ctx));                                 \
+        }                                                               \
+    } while (0)
+
+#define RULE_SAMPLE_PACKET_END(det_ctx) do {                            \
+        if (unlikely((det_ctx)->rule_sample_active)) {                  \
+            RuleSampleEnd((det_ctx));                                   \
+        }                                                               \
+    } while (0)
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode RuleSampleCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+
+void RuleSampleRegisterTests(void);
+
+#endif /* __UTIL_PROFILING_SAMPLE_H__ */
@@ -284,12 +284,33 @@ void SCProfilingDump(void);
 
 #else
 
-#define RULE_PROFILING_START(p)
-#define RULE_PROFILING_END(a,b,c,p)
+#include "util-profiling-sample.h"
+
+/* no profiling build: rules and keywords are timed for the packets
+ * sampled by the 'rule-profiling' command */
+#define RULE_PROFILING_START(p) \
+    uint64_t profile_rule_start_ = \
+        unlikely(RULE_SAMPLE_ACTIVE) ? UtilCpuGetTicks() : 0;
+
+#define RULE_PROFILING_END(ctx, r, m, p) \
+    if (unlikely(profile_rule_start_ != 0)) { \
+        RuleSampleRuleUpdate((ctx), (r), \
+            UtilCpuGetTicks() - profile_rule_start_, (m)); \
+    }
 
 #define KEYWORD_PROFILING_SET_LIST(a,b)
-#define KEYWORD_PROFILING_START
-#define KEYWORD_PROFILING_END(a,b,c)
+
+#define KEYWORD_PROFILING_START \
+    uint64_t profile_keyword_start_ = \
+        unlikely(RULE_SAMPLE_ACTIVE) ? UtilCpuGetTicks() : 0;
+
+/* may be called more than once after a start, only the first counts */
+#define KEYWORD_PROFILING_END(ctx, type, m) \
+    if (unlikely(profile_keyword_start_ != 0)) { \
+        RuleSampleKeywordUpdate((ctx), (type), \
+            UtilCpuGetTicks() - profile_keyword_start_, (m)); \
+        profile_keyword_start_ = 0; \
+    }
 
 #define PACKET_PROFILING_START(p)
 #define PACKET_PROFILING_RESTART(p)
@@ -1408,13 +1408,16 @@ static SCRadixNode *SCRadixFindKey(uint8_t *key_stream, uint16_t key_bitlen,
     SCRadixNode *node = tree->head;
     uint32_t mask = 0;
     int bytes = 0;
-    uint8_t tmp_stream[255];
+    uint8_t tmp_stream[32];
 
     if (key_bitlen > 255)
         return NULL;
 
-    memset(tmp_stream, 0, 255);
-    memcpy(tmp_stream, key_stream, key_bitlen / 8);
+    /* the walk below never looks past the byte after the key, so only
+     * that one needs clearing instead of the whole buffer */
+    bytes = key_bitlen / 8;
+    memcpy(tmp_stream, key_stream, bytes);
+    tmp_stream[bytes] = 0;
 
     while (node->bit < key_bitlen) {
         if (SC_RADIX_BITTEST(tmp_stream[node->bit >> 3],
@@ -1433,7 +1436,6 @@ static SCRadixNode *SCRadixFindKey(uint8_t *key_stream, uint16_t key_bitlen,
         return NULL;
     }
 
-    bytes = key_bitlen / 8;
     if (SCMemcmp(node->prefix->stream, tmp_stream, bytes) == 0) {
         mask = UINT_MAX << (8 - key_bitlen % 8);
 
@@ -4173,6 +4175,41 @@ this_end:
     return result;
 }
 
+/**
+ * \brief Benchmark best match lookups of random addresses in a tree of
+ *        10000 /16 to /28 ipv4 netblocks.
+ */
+static int SCRadixBenchIPV4BestMatch01(UtBench *b)
+{
+    static int user = 1;
+    uint32_t rnd = 1;
+    uint32_t addr;
+    int i;
+
+    SCRadixTree *tree = SCRadixCreateRadixTree(NULL, NULL);
+    FAIL_IF_NULL(tree);
+
+    for (i = 0; i < 10000; i++) {
+        rnd = rnd * 1103515245 + 12345;
+        addr = rnd;
+        rnd = rnd * 1103515245 + 12345;
+        uint8_t netmask = 16 + (rnd >> 16) % 13;
+        addr &= htonl(0xffffffff << (32 - netmask));
+        SCRadixAddKeyIPV4Netblock((uint8_t *)&addr, tree, &user, netmask);
+    }
+
+    UtBenchResetTimer(b);
+    uint64_t n;
+    for (n = 0; n < b->n; n++) {
+        rnd = rnd * 1103515245 + 12345;
+        addr = rnd;
+        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&addr, tree, NULL);
+    }
+
+    SCRadixReleaseRadixTree(tree);
+    PASS;
+}
+
 #endif
 
 void SCRadixRegisterTests(void)
@@ -4225,6 +4262,9 @@ void SCRadixRegisterTests(void)
                    SCRadixTestIPV4NetblockInsertion25);
     UtRegisterTest("SCRadixTestIPV4NetblockInsertion26",
                    SCRadixTestIPV4NetblockInsertion26);
+
+    UtRegisterBenchmark("SCRadixBenchIPV4BestMatch01",
+                        SCRadixBenchIPV4BestMatch01);
 #endif
 
     return;
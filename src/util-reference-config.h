@@ -37,6 +37,7 @@ typedef struct SCRConfReference_ {
 SCRConfReference *SCRConfAllocSCRConfReference(const char *, const char *);
 void SCRConfDeAllocSCRConfReference(SCRConfReference *);
 int SCRConfLoadReferenceConfigFile(DetectEngineCtx *, FILE *);
+char *SCRConfGetConfFilename(const DetectEngineCtx *de_ctx);
 void SCRConfDeInitContext(DetectEngineCtx *);
 SCRConfReference *SCRConfGetReference(const char *,
                                       DetectEngineCtx *);
@@ -81,6 +81,8 @@ void RingBuffer8Destroy(RingBuffer8 *);
 RingBuffer16 *RingBufferInit(void);
 void RingBufferDestroy(RingBuffer16 *);
 
+int RingBuffer8IsEmpty(RingBuffer8 *);
+int RingBuffer8IsFull(RingBuffer8 *);
 int RingBufferIsEmpty(RingBuffer16 *);
 int RingBufferIsFull(RingBuffer16 *);
 uint16_t RingBufferSize(RingBuffer16 *);
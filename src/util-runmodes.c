@@ -272,11 +272,57 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
 
 /**
  */
+/** \internal
+ *  \brief set up the detect half of a pipelined worker
+ *
+ *  Detection, reject and the outputs run on a thread of their own, fed
+ *  by the FlowWorkerStream thread 'stream_tv' over the ring 'qname'.
+ */
+static void RunModeSetPipelinedDetect(ThreadVars *stream_tv, char *qname,
+                                      const char *tname)
+{
+    TmModule *tm_module = NULL;
+
+    ThreadVars *tv = TmThreadCreatePacketHandler(tname,
+            qname, "ringbuffer_srsw",
+            "packetpool", "packetpool",
+            "varslot");
+    if (tv == NULL) {
+        SCLogError(SC_ERR_THREAD_CREATE, "TmThreadsCreate failed");
+        exit(EXIT_FAILURE);
+    }
+    /* pinned to the hyperthread twin of the stream thread, if any */
+    tv->pipeline_peer = stream_tv;
+
+    tm_module = TmModuleGetByName("FlowWorkerDetect");
+    if (tm_module == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorkerDetect failed");
+        exit(EXIT_FAILURE);
+    }
+    TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+    tm_module = TmModuleGetByName("RespondReject");
+    if (tm_module == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName RespondReject failed");
+        exit(EXIT_FAILURE);
+    }
+    TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+    SetupOutputs(tv);
+
+    TmThreadSetCPU(tv, WORKER_CPU_SET);
+
+    if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+        SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
 static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc ModThreadsCount,
                               const char *recv_mod_name,
                               const char *decode_mod_name, const char *thread_name,
                               const char *live_dev, void *aconf,
-                              unsigned char single_mode)
+                              unsigned char single_mode, int pipelined)
 {
     int thread;
     int threads_count;
@@ -291,6 +337,7 @@ static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc Mod
     /* create the threads */
     for (thread = 0; thread < threads_count; thread++) {
         char tname[TM_THREAD_NAME_MAX];
+        char qname[TM_THREAD_NAME_MAX + 8];
         ThreadVars *tv = NULL;
         TmModule *tm_module = NULL;
         const char *visual_devname = LiveGetShortName(live_dev);
@@ -301,10 +348,18 @@ static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc Mod
             snprintf(tname, sizeof(tname), "%s#%02d-%s", thread_name,
                      thread+1, visual_devname);
         }
-        tv = TmThreadCreatePacketHandler(tname,
-                "packetpool", "packetpool",
-                "packetpool", "packetpool",
-                "pktacqloop");
+        if (pipelined) {
+            snprintf(qname, sizeof(qname), "pipe-%s", tname);
+            tv = TmThreadCreatePacketHandler(tname,
+                    "packetpool", "packetpool",
+                    qname, "ringbuffer_srsw",
+                    "pktacqloop");
+        } else {
+            tv = TmThreadCreatePacketHandler(tname,
+                    "packetpool", "packetpool",
+                    "packetpool", "packetpool",
+                    "pktacqloop");
+        }
         if (tv == NULL) {
             SCLogError(SC_ERR_THREAD_CREATE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
@@ -324,6 +379,27 @@ static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc Mod
         }
         TmSlotSetFuncAppend(tv, tm_module, NULL);
 
+        if (pipelined) {
+            tm_module = TmModuleGetByName("FlowWorkerStream");
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorkerStream failed");
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+            TmThreadSetCPU(tv, WORKER_CPU_SET);
+
+            if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+                SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed");
+                exit(EXIT_FAILURE);
+            }
+
+            snprintf(tname, sizeof(tname), "%sD#%02d-%s", thread_name,
+                     thread+1, visual_devname);
+            RunModeSetPipelinedDetect(tv, qname, tname);
+            continue;
+        }
+
         tm_module = TmModuleGetByName("FlowWorker");
         if (tm_module == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
@@ -351,11 +427,11 @@ static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc Mod
     return 0;
 }
 
-int RunModeSetLiveCaptureWorkers(ConfigIfaceParserFunc ConfigParser,
+static int RunModeSetLiveCaptureWorkersReal(ConfigIfaceParserFunc ConfigParser,
                               ConfigIfaceThreadsCountFunc ModThreadsCount,
                               const char *recv_mod_name,
                               const char *decode_mod_name, const char *thread_name,
-                              const char *live_dev)
+                              const char *live_dev, int pipelined)
 {
     int nlive = LiveGetDeviceCount();
     void *aconf;
@@ -380,12 +456,39 @@ int RunModeSetLiveCaptureWorkers(ConfigIfaceParserFunc ConfigParser,
                 thread_name,
                 live_dev_c,
                 aconf,
-                0);
+                0, pipelined);
     }
 
     return 0;
 }
 
+int RunModeSetLiveCaptureWorkers(ConfigIfaceParserFunc ConfigParser,
+                              ConfigIfaceThreadsCountFunc ModThreadsCount,
+                              const char *recv_mod_name,
+                              const char *decode_mod_name, const char *thread_name,
+                              const char *live_dev)
+{
+    return RunModeSetLiveCaptureWorkersReal(ConfigParser, ModThreadsCount,
+            recv_mod_name, decode_mod_name, thread_name, live_dev, 0);
+}
+
+/**
+ * \brief workers with each worker split over two threads
+ *
+ * The capture thread does decoding, flow, stream and app layer, its
+ * detect thread detection and the outputs. Only for capture methods
+ * that don't need the packet back before reading the next one.
+ */
+int RunModeSetLiveCapturePipelined(ConfigIfaceParserFunc ConfigParser,
+                              ConfigIfaceThreadsCountFunc ModThreadsCount,
+                              const char *recv_mod_name,
+                              const char *decode_mod_name, const char *thread_name,
+                              const char *live_dev)
+{
+    return RunModeSetLiveCaptureWorkersReal(ConfigParser, ModThreadsCount,
+            recv_mod_name, decode_mod_name, thread_name, live_dev, 1);
+}
+
 int RunModeSetLiveCaptureSingle(ConfigIfaceParserFunc ConfigParser,
                               ConfigIfaceThreadsCountFunc ModThreadsCount,
                               const char *recv_mod_name,
@@ -418,7 +521,7 @@ int RunModeSetLiveCaptureSingle(ConfigIfaceParserFunc ConfigParser,
                                  thread_name,
                                  live_dev_c,
                                  aconf,
-                                 1);
+                                 1, 0);
 }
 
 
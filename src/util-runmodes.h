@@ -54,6 +54,12 @@ int RunModeSetLiveCaptureWorkers(ConfigIfaceParserFunc configparser,
                               const char *decode_mod_name, const char *thread_name,
                               const char *live_dev);
 
+int RunModeSetLiveCapturePipelined(ConfigIfaceParserFunc configparser,
+                              ConfigIfaceThreadsCountFunc ModThreadsCount,
+                              const char *recv_mod_name,
+                              const char *decode_mod_name, const char *thread_name,
+                              const char *live_dev);
+
 int RunModeSetIPSAutoFp(ConfigIPSParserFunc ConfigParser,
                         const char *recv_mod_name,
                         const char *verdict_mod_name,
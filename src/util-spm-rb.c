@@ -0,0 +1,340 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Rare byte single pattern matcher.
+ *
+ * At setup the two bytes of the pattern that are least likely to show up
+ * in traffic are picked. The scan looks for positions where both bytes are
+ * at their offsets, 16 (SSE2) or 32 (AVX2) positions at a time, and only
+ * compares the full pattern there. Without SIMD, memchr on the rarest byte
+ * is used instead.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "util-spm.h"
+#include "util-spm-rb.h"
+#include "util-debug.h"
+#include "util-memcmp.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+typedef struct SpmRbCtx_ {
+    /* lower case if nocase */
+    uint8_t *needle;
+    uint16_t needle_len;
+    int nocase;
+
+    /* offsets of the two rarest bytes, off1 is the rarest */
+    uint16_t off1;
+    uint16_t off2;
+    /* bytes expected at the offsets: the lower and upper case variant for
+     * nocase letters, twice the same byte otherwise */
+    uint8_t b1[2];
+    uint8_t b2[2];
+} SpmRbCtx;
+
+/**
+ * \internal
+ * \brief rough estimate of how common a byte is in payloads
+ *
+ * Text, protocol headers and padding dominate most traffic, so lower case
+ * letters, white space and nulls are assumed to be the most common.
+ */
+static int RbByteFreq(uint8_t c)
+{
+    static const char letters[] = "etaoinsrhldcumfpgwybvkxjqz";
+
+    if (c == 0x00 || c == ' ')
+        return 100;
+    if (c >= 'a' && c <= 'z')
+        return 90 - (int)(strchr(letters, c) - letters);
+    if (c >= 'A' && c <= 'Z')
+        return 50 - (int)(strchr(letters, u8_tolower(c)) - letters) / 2;
+    if (c == '\r' || c == '\n')
+        return 70;
+    if (c >= '0' && c <= '9')
+        return 50;
+    if (strchr("/.-=:,_;&%", c) != NULL)
+        return 45;
+    if (c == 0xff)
+        return 40;
+    if (isprint(c))
+        return 20;
+    return 10;
+}
+
+static int RbNeedleByteFreq(const SpmRbCtx *sctx, uint16_t offset)
+{
+    uint8_t c = sctx->needle[offset];
+    if (sctx->nocase && c >= 'a' && c <= 'z')
+        return RbByteFreq(c) + RbByteFreq(c - 'a' + 'A');
+    return RbByteFreq(c);
+}
+
+static void RbSetByte(const SpmRbCtx *sctx, uint16_t offset, uint8_t *b)
+{
+    uint8_t c = sctx->needle[offset];
+    b[0] = c;
+    b[1] = c;
+    if (sctx->nocase && c >= 'a' && c <= 'z')
+        b[1] = c - 'a' + 'A';
+}
+
+/** \internal
+ *  \brief pick the two rarest bytes of the needle */
+static void RbPrepare(SpmRbCtx *sctx)
+{
+    uint16_t i;
+
+    sctx->off1 = 0;
+    for (i = 1; i < sctx->needle_len; i++) {
+        if (RbNeedleByteFreq(sctx, i) < RbNeedleByteFreq(sctx, sctx->off1))
+            sctx->off1 = i;
+    }
+
+    sctx->off2 = sctx->off1;
+    for (i = 0; i < sctx->needle_len; i++) {
+        if (i == sctx->off1)
+            continue;
+        if (sctx->off2 == sctx->off1 ||
+            RbNeedleByteFreq(sctx, i) < RbNeedleByteFreq(sctx, sctx->off2))
+            sctx->off2 = i;
+    }
+
+    RbSetByte(sctx, sctx->off1, sctx->b1);
+    RbSetByte(sctx, sctx->off2, sctx->b2);
+}
+
+static inline int RbVerify(const SpmRbCtx *sctx, const uint8_t *candidate)
+{
+    if (sctx->nocase)
+        return SCMemcmpLowercase(sctx->needle, candidate, sctx->needle_len) == 0;
+    return SCMemcmp(sctx->needle, candidate, sctx->needle_len) == 0;
+}
+
+static inline int RbCandidate(const SpmRbCtx *sctx, const uint8_t *candidate)
+{
+    const uint8_t c1 = candidate[sctx->off1];
+    const uint8_t c2 = candidate[sctx->off2];
+    return (c1 == sctx->b1[0] || c1 == sctx->b1[1]) &&
+           (c2 == sctx->b2[0] || c2 == sctx->b2[1]);
+}
+
+static uint8_t *RbScan(const SpmRbCtx *sctx, const uint8_t *haystack,
+                       uint16_t haystack_len)
+{
+    if (haystack_len < sctx->needle_len)
+        return NULL;
+
+    /* last possible start of a match */
+    const int last = haystack_len - sctx->needle_len;
+    int i = 0;
+
+    /* the loads for a block of candidates at i end at
+     * i + block - 1 + off2, which is inside the haystack
+     * as long as i + block - 1 <= last */
+#if defined(__AVX2__)
+    const __m256i v1a = _mm256_set1_epi8((char)sctx->b1[0]);
+    const __m256i v1b = _mm256_set1_epi8((char)sctx->b1[1]);
+    const __m256i v2a = _mm256_set1_epi8((char)sctx->b2[0]);
+    const __m256i v2b = _mm256_set1_epi8((char)sctx->b2[1]);
+
+    for (; i + 31 <= last; i += 32) {
+        __m256i d1 = _mm256_loadu_si256((const __m256i *)(haystack + i + sctx->off1));
+        __m256i d2 = _mm256_loadu_si256((const __m256i *)(haystack + i + sctx->off2));
+        __m256i m1 = _mm256_or_si256(_mm256_cmpeq_epi8(d1, v1a),
+                                     _mm256_cmpeq_epi8(d1, v1b));
+        __m256i m2 = _mm256_or_si256(_mm256_cmpeq_epi8(d2, v2a),
+                                     _mm256_cmpeq_epi8(d2, v2b));
+        uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(m1, m2));
+        while (bits != 0) {
+            const uint8_t *candidate = haystack + i + __builtin_ctz(bits);
+            if (RbVerify(sctx, candidate))
+                return (uint8_t *)candidate;
+            bits &= bits - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i v1a = _mm_set1_epi8((char)sctx->b1[0]);
+    const __m128i v1b = _mm_set1_epi8((char)sctx->b1[1]);
+    const __m128i v2a = _mm_set1_epi8((char)sctx->b2[0]);
+    const __m128i v2b = _mm_set1_epi8((char)sctx->b2[1]);
+
+    for (; i + 15 <= last; i += 16) {
+        __m128i d1 = _mm_loadu_si128((const __m128i *)(haystack + i + sctx->off1));
+        __m128i d2 = _mm_loadu_si128((const __m128i *)(haystack + i + sctx->off2));
+        __m128i m1 = _mm_or_si128(_mm_cmpeq_epi8(d1, v1a), _mm_cmpeq_epi8(d1, v1b));
+        __m128i m2 = _mm_or_si128(_mm_cmpeq_epi8(d2, v2a), _mm_cmpeq_epi8(d2, v2b));
+        uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_and_si128(m1, m2));
+        while (bits != 0) {
+            const uint8_t *candidate = haystack + i + __builtin_ctz(bits);
+            if (RbVerify(sctx, candidate))
+                return (uint8_t *)candidate;
+            bits &= bits - 1;
+        }
+    }
+#else
+    if (sctx->b1[0] == sctx->b1[1]) {
+        while (i <= last) {
+            const uint8_t *p = memchr(haystack + i + sctx->off1, sctx->b1[0],
+                                      last - i + 1);
+            if (p == NULL)
+                return NULL;
+            const uint8_t *candidate = p - sctx->off1;
+            if (RbCandidate(sctx, candidate) && RbVerify(sctx, candidate))
+                return (uint8_t *)candidate;
+            i = (int)(candidate - haystack) + 1;
+        }
+        return NULL;
+    }
+#endif
+
+    for (; i <= last; i++) {
+        const uint8_t *candidate = haystack + i;
+        if (RbCandidate(sctx, candidate) && RbVerify(sctx, candidate))
+            return (uint8_t *)candidate;
+    }
+    return NULL;
+}
+
+static SpmCtx *RBInitCtx(const uint8_t *needle, uint16_t needle_len, int nocase,
+                         SpmGlobalThreadCtx *global_thread_ctx)
+{
+    if (needle_len == 0)
+        return NULL;
+
+    SpmCtx *ctx = SCMalloc(sizeof(SpmCtx));
+    if (ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmCtx.");
+        return NULL;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->matcher = SPM_RB;
+
+    SpmRbCtx *sctx = SCMalloc(sizeof(SpmRbCtx));
+    if (sctx == NULL) {
+        SCLogDebug("Unable to alloc SpmRbCtx.");
+        SCFree(ctx);
+        return NULL;
+    }
+    memset(sctx, 0, sizeof(*sctx));
+
+    sctx->needle = SCMalloc(needle_len);
+    if (sctx->needle == NULL) {
+        SCLogDebug("Unable to alloc string.");
+        SCFree(sctx);
+        SCFree(ctx);
+        return NULL;
+    }
+    memcpy(sctx->needle, needle, needle_len);
+    sctx->needle_len = needle_len;
+    sctx->nocase = nocase ? 1 : 0;
+
+    if (sctx->nocase) {
+        uint16_t i;
+        for (i = 0; i < needle_len; i++)
+            sctx->needle[i] = u8_tolower(sctx->needle[i]);
+    }
+    RbPrepare(sctx);
+
+    ctx->ctx = sctx;
+    return ctx;
+}
+
+static void RBDestroyCtx(SpmCtx *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+
+    SpmRbCtx *sctx = ctx->ctx;
+    if (sctx != NULL) {
+        if (sctx->needle != NULL) {
+            SCFree(sctx->needle);
+        }
+        SCFree(sctx);
+    }
+
+    SCFree(ctx);
+}
+
+static uint8_t *RBScan(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
+                       const uint8_t *haystack, uint16_t haystack_len)
+{
+    return RbScan(ctx->ctx, haystack, haystack_len);
+}
+
+static SpmGlobalThreadCtx *RBInitGlobalThreadCtx(void)
+{
+    SpmGlobalThreadCtx *global_thread_ctx = SCMalloc(sizeof(SpmGlobalThreadCtx));
+    if (global_thread_ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmThreadCtx.");
+        return NULL;
+    }
+    memset(global_thread_ctx, 0, sizeof(*global_thread_ctx));
+    global_thread_ctx->matcher = SPM_RB;
+    return global_thread_ctx;
+}
+
+static void RBDestroyGlobalThreadCtx(SpmGlobalThreadCtx *global_thread_ctx)
+{
+    if (global_thread_ctx == NULL) {
+        return;
+    }
+    SCFree(global_thread_ctx);
+}
+
+static void RBDestroyThreadCtx(SpmThreadCtx *thread_ctx)
+{
+    if (thread_ctx == NULL) {
+        return;
+    }
+    SCFree(thread_ctx);
+}
+
+static SpmThreadCtx *RBMakeThreadCtx(const SpmGlobalThreadCtx *global_thread_ctx)
+{
+    SpmThreadCtx *thread_ctx = SCMalloc(sizeof(SpmThreadCtx));
+    if (thread_ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmThreadCtx.");
+        return NULL;
+    }
+    memset(thread_ctx, 0, sizeof(*thread_ctx));
+    thread_ctx->matcher = SPM_RB;
+    return thread_ctx;
+}
+
+void SpmRBRegister(void)
+{
+    spm_table[SPM_RB].name = "rb";
+    spm_table[SPM_RB].InitGlobalThreadCtx = RBInitGlobalThreadCtx;
+    spm_table[SPM_RB].DestroyGlobalThreadCtx = RBDestroyGlobalThreadCtx;
+    spm_table[SPM_RB].MakeThreadCtx = RBMakeThreadCtx;
+    spm_table[SPM_RB].DestroyThreadCtx = RBDestroyThreadCtx;
+    spm_table[SPM_RB].InitCtx = RBInitCtx;
+    spm_table[SPM_RB].DestroyCtx = RBDestroyCtx;
+    spm_table[SPM_RB].Scan = RBScan;
+}
@@ -54,6 +54,7 @@
 #include "util-spm-bs2bm.h"
 #include "util-spm-bm.h"
 #include "util-spm-hs.h"
+#include "util-spm-rb.h"
 #include "util-clock.h"
 
 /**
@@ -101,6 +102,7 @@ void SpmTableSetup(void)
     memset(spm_table, 0, sizeof(spm_table));
 
     SpmBMRegister();
+    SpmRBRegister();
 #ifdef BUILD_HYPERSCAN
     SpmHSRegister();
 #endif
@@ -2637,6 +2639,187 @@ int SpmSearchTest02() {
     return ret;
 }
 
+int SpmSearchTest03() {
+    SpmTableSetup();
+    printf("\n");
+
+    /* Haystacks full of partial matches before the real one, so matchers
+     * that filter on a few bytes of the needle have to verify and move on. */
+
+    static const char* needles[] = {
+        "xqzx", "XqZ!", "\x01\x02\x01", "longer needle with spaces",
+    };
+
+    int ret = 1;
+
+    uint16_t matcher;
+    for (matcher = 0; matcher < SPM_TABLE_SIZE; matcher++) {
+        const SpmTableElmt *m = &spm_table[matcher];
+        if (m->name == NULL) {
+            continue;
+        }
+        printf("matcher: %s\n", m->name);
+
+        uint32_t i;
+        for (i = 0; i < sizeof(needles) / sizeof(needles[0]); i++) {
+            const char *needle = needles[i];
+            uint16_t needle_len = strlen(needle);
+            uint16_t copies;
+            for (copies = 0; copies < 40; copies += 3) {
+                /* copies of the needle with the last byte changed */
+                uint16_t haystack_len = (copies + 1) * needle_len;
+                char *haystack = SCMalloc(haystack_len);
+                if (haystack == NULL) {
+                    printf("alloc failure\n");
+                    return 0;
+                }
+                uint16_t j;
+                for (j = 0; j < copies; j++) {
+                    memcpy(haystack + j * needle_len, needle, needle_len);
+                    haystack[(j + 1) * needle_len - 1] ^= 0x40;
+                }
+                memcpy(haystack + copies * needle_len, needle, needle_len);
+
+                SpmTestData d = { needle, needle_len, haystack, haystack_len,
+                                  0, copies * needle_len };
+                if (SpmTestSearch(&d, matcher) == 0) {
+                    printf("  test %" PRIu32 ": fail (case-sensitive)\n", i);
+                    ret = 0;
+                }
+                d.nocase = 1;
+                if (SpmTestSearch(&d, matcher) == 0) {
+                    printf("  test %" PRIu32 ": fail (case-insensitive)\n", i);
+                    ret = 0;
+                }
+
+                /* and without the real match */
+                haystack[haystack_len - 1] ^= 0x40;
+                d.nocase = 0;
+                d.match_offset = SPM_NO_MATCH;
+                if (SpmTestSearch(&d, matcher) == 0) {
+                    printf("  test %" PRIu32 ": fail (no match)\n", i);
+                    ret = 0;
+                }
+                SCFree(haystack);
+            }
+        }
+        printf("  %" PRIu32 " tests passed\n", i);
+    }
+
+    return ret;
+}
+
+#ifdef ENABLE_SEARCH_STATS
+/**
+ * \test Compare the registered SPM matchers on the same haystack
+ */
+int SpmSearchStatsTest01()
+{
+    SpmTableSetup();
+    printf("\n");
+
+    static const char *needles[] = {
+        "HTTP/1.1", "Content-Length: ", "aBcDeFgHiJkLmNoP", "\x90\x90\x90\x90",
+    };
+
+    /* text like haystack without any of the needles */
+    uint8_t haystack[1500];
+    uint16_t i;
+    for (i = 0; i < sizeof(haystack); i++) {
+        haystack[i] = "GET /index.html HTTP/1.0\r\nHost: example.com\r\n"[i % 45];
+    }
+
+    uint16_t matcher;
+    for (matcher = 0; matcher < SPM_TABLE_SIZE; matcher++) {
+        const SpmTableElmt *m = &spm_table[matcher];
+        if (m->name == NULL) {
+            continue;
+        }
+
+        SpmGlobalThreadCtx *global_thread_ctx = SpmInitGlobalThreadCtx(matcher);
+        SpmThreadCtx *thread_ctx = SpmMakeThreadCtx(global_thread_ctx);
+
+        uint32_t n;
+        for (n = 0; n < sizeof(needles) / sizeof(needles[0]); n++) {
+            int nocase;
+            for (nocase = 0; nocase <= 1; nocase++) {
+                SpmCtx *ctx = SpmInitCtx((const uint8_t *)needles[n],
+                        strlen(needles[n]), nocase, global_thread_ctx);
+                if (ctx == NULL)
+                    return 0;
+
+                printf("%s: needle %" PRIu32 "%s: ", m->name, n,
+                       nocase ? " nocase" : "");
+                CLOCK_INIT;
+                CLOCK_START;
+                int t;
+                for (t = 0; t < STATS_TIMES / 100; t++) {
+                    if (SpmScan(ctx, thread_ctx, haystack, sizeof(haystack)) != NULL)
+                        return 0;
+                }
+                CLOCK_END;
+                CLOCK_PRINT_SEC;
+                printf("\n");
+                SpmDestroyCtx(ctx);
+            }
+        }
+
+        SpmDestroyThreadCtx(thread_ctx);
+        SpmDestroyGlobalThreadCtx(global_thread_ctx);
+    }
+    return 1;
+}
+#endif
+
+/** \internal
+ *  \brief scan a packet sized haystack the needle isn't in */
+static int SpmBench(UtBench *b, uint16_t matcher, int nocase)
+{
+    const char *needle = "Content-Type: application/x-www-form";
+    uint8_t haystack[1500];
+    uint32_t i;
+
+    for (i = 0; i < sizeof(haystack); i++)
+        haystack[i] = "Content-Length: 0123456789\r\n"[i % 28];
+
+    SpmGlobalThreadCtx *global_thread_ctx = SpmInitGlobalThreadCtx(matcher);
+    FAIL_IF_NULL(global_thread_ctx);
+    SpmThreadCtx *thread_ctx = SpmMakeThreadCtx(global_thread_ctx);
+    FAIL_IF_NULL(thread_ctx);
+    SpmCtx *ctx = SpmInitCtx((const uint8_t *)needle, strlen(needle), nocase,
+            global_thread_ctx);
+    FAIL_IF_NULL(ctx);
+
+    UtBenchResetTimer(b);
+    uint64_t n;
+    for (n = 0; n < b->n; n++) {
+        FAIL_IF(SpmScan(ctx, thread_ctx, haystack, sizeof(haystack)) != NULL);
+    }
+    b->bytes = sizeof(haystack);
+
+    SpmDestroyCtx(ctx);
+    SpmDestroyThreadCtx(thread_ctx);
+    SpmDestroyGlobalThreadCtx(global_thread_ctx);
+    PASS;
+}
+
+static int SpmBenchBm(UtBench *b)
+{
+    return SpmBench(b, SPM_BM, 0);
+}
+
+static int SpmBenchBmNocase(UtBench *b)
+{
+    return SpmBench(b, SPM_BM, 1);
+}
+
+#ifdef BUILD_HYPERSCAN
+static int SpmBenchHs(UtBench *b)
+{
+    return SpmBench(b, SPM_HS, 0);
+}
+#endif
+
 #endif
 
 /* Register unittests */
@@ -2680,6 +2863,7 @@ void UtilSpmSearchRegistertests(void)
     /* new SPM API */
     UtRegisterTest("SpmSearchTest01", SpmSearchTest01);
     UtRegisterTest("SpmSearchTest02", SpmSearchTest02);
+    UtRegisterTest("SpmSearchTest03", SpmSearchTest03);
 
 #ifdef ENABLE_SEARCH_STATS
     /* Give some stats searching given a prepared context (look at the wrappers) */
@@ -2709,6 +2893,14 @@ void UtilSpmSearchRegistertests(void)
     UtRegisterTest("UtilSpmNocaseSearchStatsTest07",
                    UtilSpmNocaseSearchStatsTest07);
 
+    /* Compare the registered matchers */
+    UtRegisterTest("SpmSearchStatsTest01", SpmSearchStatsTest01);
+#endif
+
+    UtRegisterBenchmark("SpmBench01 -- bm scan", SpmBenchBm);
+    UtRegisterBenchmark("SpmBench02 -- bm nocase scan", SpmBenchBmNocase);
+#ifdef BUILD_HYPERSCAN
+    UtRegisterBenchmark("SpmBench03 -- hs scan", SpmBenchHs);
 #endif
 #endif
 }
@@ -281,19 +281,23 @@ void StreamingBufferAppendNoTrack(StreamingBuffer *sb,
 
 /**
  *  \param offset offset relative to StreamingBuffer::stream_offset
+ *
+ *  \retval 0 data inserted
+ *  \retval -1 data could not be inserted: offset is before the window or
+ *              the buffer could not be grown
  */
-void StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
+int StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
                              const uint8_t *data, uint32_t data_len,
                              uint64_t offset)
 {
     BUG_ON(seg == NULL);
 
     if (offset < sb->stream_offset)
-        return;
+        return -1;
 
     if (sb->buf == NULL) {
         if (InitBuffer(sb) == -1)
-            return;
+            return -1;
     }
 
     uint32_t rel_offset = offset - sb->stream_offset;
@@ -306,15 +310,16 @@ void StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
             GrowToSize(sb, (rel_offset + data_len));
         }
     }
-    BUG_ON(!DATA_FITS_AT_OFFSET(sb, data_len, rel_offset));
+    if (!DATA_FITS_AT_OFFSET(sb, data_len, rel_offset)) {
+        return -1;
+    }
 
     memcpy(sb->buf + rel_offset, data, data_len);
     seg->stream_offset = offset;
     seg->segment_len = data_len;
     if (rel_offset + data_len > sb->buf_offset)
         sb->buf_offset = rel_offset + data_len;
-
-
+    return 0;
 }
 
 int StreamingBufferSegmentIsBeforeWindow(const StreamingBuffer *sb,
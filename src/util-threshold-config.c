@@ -103,7 +103,7 @@ static pcre_extra *regex_suppress_study = NULL;
  * \retval log_filename Pointer to a string containing the path for the
  *                      Threshold Config file.
  */
-static char *SCThresholdConfGetConfFilename(const DetectEngineCtx *de_ctx)
+char *SCThresholdConfGetConfFilename(const DetectEngineCtx *de_ctx)
 {
     char *log_filename = NULL;
 
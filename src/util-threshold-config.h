@@ -27,6 +27,7 @@
 void SCThresholdConfDeInitContext(DetectEngineCtx *, FILE *);
 void SCThresholdConfParseFile(DetectEngineCtx *, FILE *);
 int SCThresholdConfInitContext(DetectEngineCtx *, FILE *);
+char *SCThresholdConfGetConfFilename(const DetectEngineCtx *de_ctx);
 
 void SCThresholdConfRegisterTests();
 
@@ -90,12 +90,12 @@ void TimeModeSetOffline (void)
     SCLogDebug("offline time mode enabled");
 }
 
-void TimeSetByThread(const int thread_id, const struct timeval *tv)
+void TimeSetByThread(ThreadVars *tv, const struct timeval *ts)
 {
     if (live == TRUE)
         return;
 
-    TmThreadsSetThreadTimestamp(thread_id, tv);
+    TmThreadsSetThreadTimestamp(tv, ts);
 }
 
 #ifdef UNITTESTS
@@ -170,6 +170,18 @@ void TimeSetIncrementTime(uint32_t tv_sec)
 }
 #endif
 
+/*
+ * Time Caching code
+ */
+
+#ifndef TLS
+/* OpenBSD does not support __thread, so don't use time caching on BSD
+ */
+struct tm *SCLocalTime(time_t timep, struct tm *result)
+{
+    return localtime_r(&timep, result);
+}
+
 void CreateIsoTimeString (const struct timeval *ts, char *str, size_t size)
 {
     time_t time = ts->tv_sec;
@@ -185,18 +197,6 @@ void CreateIsoTimeString (const struct timeval *ts, char *str, size_t size)
     }
 }
 
-/*
- * Time Caching code
- */
-
-#ifndef TLS
-/* OpenBSD does not support __thread, so don't use time caching on BSD
- */
-struct tm *SCLocalTime(time_t timep, struct tm *result)
-{
-    return localtime_r(&timep, result);
-}
-
 void CreateTimeString (const struct timeval *ts, char *str, size_t size)
 {
     time_t time = ts->tv_sec;
@@ -348,4 +348,44 @@ void CreateTimeString (const struct timeval *ts, char *str, size_t size)
              seconds, (uint32_t) ts->tv_usec);
 }
 
+/* "2013-01-01T15:42:21." and "+0100", see CreateIsoTimeString() */
+#define MAX_ISO_TIME_PREFIX 32
+#define MAX_ISO_TIME_ZONE   8
+
+/* Per-thread cache of the ISO time string for the current second. The
+ * loggers mostly write records of the same second, so strftime() and the
+ * time zone lookup then only run once a second. */
+static __thread time_t cached_iso_sec;
+static __thread int cached_iso_set;
+static __thread char cached_iso_prefix[MAX_ISO_TIME_PREFIX];
+static __thread char cached_iso_zone[MAX_ISO_TIME_ZONE];
+
+/** \brief Return the ISO 8601 string for the provided time.
+ *
+ * E.g. "2013-01-01T15:42:21.123456+0100". Everything but the
+ * microseconds is cached for the current second.
+ */
+void CreateIsoTimeString (const struct timeval *ts, char *str, size_t size)
+{
+    time_t time = ts->tv_sec;
+
+    if (!cached_iso_set || time != cached_iso_sec) {
+        struct tm local_tm;
+        struct tm *t = (struct tm*)SCLocalTime(time, &local_tm);
+        if (unlikely(t == NULL)) {
+            snprintf(str, size, "ts-error");
+            return;
+        }
+
+        strftime(cached_iso_prefix, sizeof(cached_iso_prefix),
+                 "%Y-%m-%dT%H:%M:%S.", t);
+        strftime(cached_iso_zone, sizeof(cached_iso_zone), "%z", t);
+        cached_iso_sec = time;
+        cached_iso_set = 1;
+    }
+
+    snprintf(str, size, "%s%06u%s", cached_iso_prefix,
+             (uint32_t) ts->tv_usec, cached_iso_zone);
+}
+
 #endif /* defined(__OpenBSD__) */
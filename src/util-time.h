@@ -37,7 +37,8 @@ typedef struct SCTimeval32_ {
 void TimeInit(void);
 void TimeDeinit(void);
 
-void TimeSetByThread(const int thread_id, const struct timeval *tv);
+struct ThreadVars_;
+void TimeSetByThread(struct ThreadVars_ *tv, const struct timeval *ts);
 void TimeGet(struct timeval *);
 
 #ifdef UNITTESTS
@@ -37,6 +37,7 @@
 #include "util-unittest.h"
 #include "util-debug.h"
 #include "util-time.h"
+#include "util-cpu.h"
 #include "conf.h"
 
 #ifdef UNITTESTS
@@ -45,8 +46,10 @@ static pcre *parse_regex;
 static pcre_extra *parse_regex_study;
 
 static UtTest *ut_list;
+static UtBenchmark *ut_bench_list;
 
 int unittests_fatal = 0;
+int unittests_benchmarks = 0;
 
 /**
  * \brief Allocate UtTest list member
@@ -232,6 +235,130 @@ uint32_t UtRunTests(char *regex_arg)
     }
     return bad;
 }
+/** time a benchmark is run for to get its result, in usec */
+#define UT_BENCH_TIME 500000
+#define UT_BENCH_MAX_N 1000000000ULL
+
+/**
+ * \brief Register a benchmark.
+ *
+ * \param name Unique name of the benchmark.
+ * \param BenchFn Function running b->n iterations of the benchmark,
+ *        returning 1 or 0 on failure. Setup done before the loop can
+ *        be kept out of the results with UtBenchResetTimer().
+ */
+void UtRegisterBenchmark(char *name, int (*BenchFn)(UtBench *))
+{
+    UtBenchmark *ub = SCMalloc(sizeof(UtBenchmark));
+    if (unlikely(ub == NULL))
+        return;
+
+    ub->name = name;
+    ub->BenchFn = BenchFn;
+    ub->next = NULL;
+
+    UtBenchmark **tail = &ut_bench_list;
+    while (*tail != NULL)
+        tail = &(*tail)->next;
+    *tail = ub;
+}
+
+/** \brief start timing a benchmark from here */
+void UtBenchResetTimer(UtBench *b)
+{
+    gettimeofday(&b->start, NULL);
+    b->start_ticks = UtilCpuGetTicks();
+}
+
+/** \internal
+ *  \brief run b->n iterations of 'ub'
+ *  \retval usec time it took, 0 on failure */
+static uint64_t UtBenchRunN(UtBenchmark *ub, UtBench *b, uint64_t *ticks)
+{
+    struct timeval end;
+
+    /* reset the time */
+    TimeModeSetOffline();
+    TimeSetToCurrentTime();
+
+    UtBenchResetTimer(b);
+    if (ub->BenchFn(b) != 1)
+        return 0;
+    uint64_t end_ticks = UtilCpuGetTicks();
+    gettimeofday(&end, NULL);
+
+    *ticks = end_ticks - b->start_ticks;
+    uint64_t usec = (uint64_t)(end.tv_sec - b->start.tv_sec) * 1000000 +
+        end.tv_usec - b->start.tv_usec;
+    return usec ? usec : 1;
+}
+
+/**
+ * \brief Run the benchmarks matching regex_arg.
+ *
+ * Each benchmark is run with a growing number of iterations, until a run
+ * takes 0.5s. The results are printed as one JSON object per line.
+ *
+ * \retval number of benchmarks that failed
+ */
+uint32_t UtRunBenchmarks(char *regex_arg)
+{
+    UtBenchmark *ub;
+    uint32_t bad = 0;
+    int ov[MAX_SUBSTRINGS];
+
+    if (UtRegex(regex_arg) != 1) {
+        SCLogInfo("UtRunBenchmarks: pcre compilation failed");
+        return 1;
+    }
+
+    for (ub = ut_bench_list; ub != NULL; ub = ub->next) {
+        if (pcre_exec(parse_regex, parse_regex_study, ub->name,
+                    strlen(ub->name), 0, 0, ov, MAX_SUBSTRINGS) < 1)
+            continue;
+
+        UtBench b;
+        uint64_t usec, ticks = 0;
+        memset(&b, 0, sizeof(b));
+        b.n = 1;
+
+        while (1) {
+            b.bytes = 0;
+            usec = UtBenchRunN(ub, &b, &ticks);
+            if (usec == 0 || usec >= UT_BENCH_TIME || b.n >= UT_BENCH_MAX_N)
+                break;
+
+            /* aim a bit past the target time, growing 100x at most */
+            uint64_t n = b.n * UT_BENCH_TIME / usec;
+            n += n / 5;
+            b.n = MAX(b.n + 1, MIN(n, MIN(b.n * 100, UT_BENCH_MAX_N)));
+        }
+
+        if (usec == 0) {
+            printf("{\"benchmark\":\"%s\",\"result\":\"failed\"}\n",
+                    ub->name);
+            if (unittests_fatal == 1) {
+                fprintf(stderr, "ERROR: benchmark failed.\n");
+                exit(EXIT_FAILURE);
+            }
+            bad++;
+            continue;
+        }
+
+        double ns = (double)usec * 1000 / (double)b.n;
+        printf("{\"benchmark\":\"%s\",\"iterations\":%"PRIu64","
+               "\"ns_per_op\":%.2f,\"cycles_per_op\":%.2f",
+               ub->name, b.n, ns, (double)ticks / (double)b.n);
+        if (b.bytes > 0) {
+            printf(",\"mb_per_sec\":%.2f",
+                    (double)b.bytes * (double)b.n / (double)usec);
+        }
+        printf("}\n");
+        fflush(stdout);
+    }
+    return bad;
+}
+
 /**
  * \brief Initialize unit test list
  */
@@ -239,6 +366,7 @@ uint32_t UtRunTests(char *regex_arg)
 void UtInitialize(void)
 {
     ut_list = NULL;
+    ut_bench_list = NULL;
 }
 
 /**
@@ -257,6 +385,14 @@ void UtCleanup(void)
     }
 
     ut_list = NULL;
+
+    UtBenchmark *ub = ut_bench_list, *next;
+    while (ub != NULL) {
+        next = ub->next;
+        SCFree(ub);
+        ub = next;
+    }
+    ut_bench_list = NULL;
 }
 
 void UtRunModeRegister(void)
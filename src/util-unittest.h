@@ -44,8 +44,29 @@ typedef struct UtTest_ {
 
 } UtTest;
 
+/** state of a running benchmark, see UtRegisterBenchmark() */
+typedef struct UtBench_ {
+    /** number of iterations to run */
+    uint64_t n;
+    /** bytes handled per iteration, 0 if it's not about bytes */
+    uint64_t bytes;
+
+    struct timeval start;
+    uint64_t start_ticks;
+} UtBench;
+
+typedef struct UtBenchmark_ {
+    char *name;
+    int (*BenchFn)(UtBench *);
+
+    struct UtBenchmark_ *next;
+} UtBenchmark;
+
 void UtRegisterTest(char *name, int(*TestFn)(void));
+void UtRegisterBenchmark(char *name, int (*BenchFn)(UtBench *));
+void UtBenchResetTimer(UtBench *b);
 uint32_t UtRunTests(char *regex_arg);
+uint32_t UtRunBenchmarks(char *regex_arg);
 void UtInitialize(void);
 void UtCleanup(void);
 int UtRunSelftest (char *regex_arg);
@@ -53,6 +74,8 @@ void UtListTests(char *regex_arg);
 void UtRunModeRegister(void);
 
 extern int unittests_fatal;
+/** run the benchmarks instead of the tests */
+extern int unittests_benchmarks;
 
 /**
  * \breif Fail a test.
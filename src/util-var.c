@@ -41,9 +41,111 @@ static void XBitFree(XBit *fb)
     if (fb == NULL)
         return;
 
+    if (fb->bits != NULL)
+        SCFree(fb->bits);
+    if (fb->expire != NULL)
+        SCFree(fb->expire);
     SCFree(fb);
 }
 
+/**
+ *  \brief grow a bit array so that it covers idx
+ *
+ *  The size (in bits) is rounded up to a multiple of 64, new bits are
+ *  cleared.
+ *
+ *  \retval 0 ok
+ *  \retval -1 out of memory, bits and size are left untouched
+ */
+int GenericVarBitsGrow(uint8_t **bits, uint32_t *size, uint16_t idx)
+{
+    if (idx < *size)
+        return 0;
+
+    uint32_t newsize = ((uint32_t)idx + 64) & ~63;
+    uint8_t *ptr = SCRealloc(*bits, newsize / 8);
+    if (unlikely(ptr == NULL))
+        return -1;
+
+    memset(ptr + (*size / 8), 0, (newsize - *size) / 8);
+    *bits = ptr;
+    *size = newsize;
+    return 0;
+}
+
+int XBitIsset(const XBit *xb, uint16_t idx)
+{
+    if (xb == NULL)
+        return 0;
+    return VAR_BIT_ISSET(xb->bits, xb->size, idx) ? 1 : 0;
+}
+
+/**
+ *  \brief set bit idx, allocating the node if *xb is NULL
+ *
+ *  If the bit is already set only its expire time is updated.
+ *
+ *  \retval 0 ok
+ *  \retval -1 out of memory
+ */
+int XBitAdd(XBit **xb, uint16_t idx, uint32_t expire)
+{
+    XBit *x = *xb;
+    if (x == NULL) {
+        x = SCMalloc(sizeof(XBit));
+        if (unlikely(x == NULL))
+            return -1;
+        memset(x, 0, sizeof(XBit));
+        x->type = DETECT_XBITS;
+        *xb = x;
+    }
+
+    if (idx >= x->size) {
+        uint32_t oldsize = x->size;
+        uint32_t *ptr = SCRealloc(x->expire, (((uint32_t)idx + 64) & ~63) *
+                                             sizeof(uint32_t));
+        if (unlikely(ptr == NULL))
+            return -1;
+        x->expire = ptr;
+
+        if (GenericVarBitsGrow(&x->bits, &x->size, idx) < 0)
+            return -1;
+        memset(x->expire + oldsize, 0, (x->size - oldsize) * sizeof(uint32_t));
+    }
+
+    if (!(VAR_BIT_ISSET(x->bits, x->size, idx))) {
+        x->bits[idx >> 3] |= (1 << (idx & 7));
+        x->cnt++;
+    }
+    x->expire[idx] = expire;
+    return 0;
+}
+
+void XBitRemove(XBit *xb, uint16_t idx)
+{
+    if (xb == NULL || !(VAR_BIT_ISSET(xb->bits, xb->size, idx)))
+        return;
+
+    xb->bits[idx >> 3] &= ~(1 << (idx & 7));
+    xb->expire[idx] = 0;
+    xb->cnt--;
+}
+
+/** \retval 1 all bits expired at ts
+ *  \retval 0 at least one bit still active */
+int XBitsTimedout(const XBit *xb, uint32_t ts)
+{
+    if (xb == NULL || xb->cnt == 0)
+        return 1;
+
+    uint32_t i;
+    for (i = 0; i < xb->size; i++) {
+        if (VAR_BIT_ISSET(xb->bits, xb->size, i) && xb->expire[i] > ts)
+            return 0;
+    }
+    return 1;
+}
+
 void GenericVarFree(GenericVar *gv)
 {
     if (gv == NULL)
@@ -50,13 +50,22 @@ typedef struct GenericVar_ {
     struct GenericVar_ *next;
 } GenericVar;
 
+/** bits are stored as a single node per host/ippair: a bit array
+ *  indexed by name idx with an expire time per idx. Both arrays are
+ *  grown on demand to cover the highest idx set. */
 typedef struct XBit_ {
     uint8_t type;       /* type, DETECT_XBITS in this case */
-    uint16_t idx;       /* name idx */
+    uint16_t idx;       /* unused, bits are addressed by name idx */
     GenericVar *next;
-    uint32_t expire;
+    uint32_t size;      /* number of idx covered by bits and expire */
+    uint32_t cnt;       /* number of bits set */
+    uint8_t *bits;
+    uint32_t *expire;
 } XBit;
 
+#define VAR_BIT_ISSET(bits, size, idx) \
+    ((idx) < (size) && ((bits)[(idx) >> 3] & (1 << ((idx) & 7))))
+
 // A list of variables we try to resolve while parsing configuration file.
 // Helps to detect recursive declarations.
 typedef struct ResolvedVariable_ {
@@ -70,6 +79,13 @@ void GenericVarFree(GenericVar *);
 void GenericVarAppend(GenericVar **, GenericVar *);
 void GenericVarRemove(GenericVar **, GenericVar *);
 
+int GenericVarBitsGrow(uint8_t **bits, uint32_t *size, uint16_t idx);
+
+int XBitIsset(const XBit *, uint16_t);
+int XBitAdd(XBit **, uint16_t, uint32_t);
+void XBitRemove(XBit *, uint16_t);
+int XBitsTimedout(const XBit *, uint32_t);
+
 int AddVariableToResolveList(ResolvedVariablesList *list, char *var);
 void CleanVariableResolveList(ResolvedVariablesList *var_list);
 